@@ -0,0 +1,339 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <math.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+#ifdef SR_CPU_DISPATCH_X86
+#include <immintrin.h>
+#endif
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "analog-trigger: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/**
+ * @file
+ *
+ * Software trigger matching on analog values.
+ */
+
+/**
+ * @addtogroup grp_soft_trigger
+ *
+ * An analog trigger fires on a sample of one probe matching a condition,
+ * after an earlier sample matched the matching arming condition: for a
+ * rising edge, the value must have been below the level less the
+ * hysteresis first, then reach the level. Either search is done many
+ * samples at a time where the CPU has SIMD instructions for it, see
+ * @ref grp_cpu.
+ *
+ * @{
+ */
+
+static inline gboolean range_match(const struct sr_analog_range *r, float v)
+{
+	if (r->inside)
+		return r->lo <= v && v <= r->hi;
+	else
+		return v < r->lo || r->hi < v;
+}
+
+/*
+ * Return the index of the first of num_samples values, stride floats
+ * apart, which is in (or outside) the range, or num_samples if none is.
+ * The search starts at value i, the ones before it don't match.
+ */
+static uint64_t range_find_from(const struct sr_analog_range *r,
+		const float *data, uint64_t i, uint64_t num_samples,
+		unsigned int stride)
+{
+	for (; i < num_samples; i++) {
+		if (range_match(r, data[i * stride]))
+			return i;
+	}
+
+	return num_samples;
+}
+
+/* The plain C variant, the reference for the others. */
+static uint64_t range_find_c(const struct sr_analog_range *r,
+		const float *data, uint64_t num_samples, unsigned int stride)
+{
+	return range_find_from(r, data, 0, num_samples, stride);
+}
+
+#ifdef SR_CPU_DISPATCH_X86
+/*
+ * The body of a SIMD variant, with vecf_t and the vecf_*() operations
+ * defined for its instruction set.
+ *
+ * A vector covers per = lanes / stride samples, plus the other probes'
+ * values after each. Of the comparison mask, only the bits of this
+ * probe's lanes count. With several probes, the last load must not run
+ * past the end of the data.
+ */
+#define RANGE_FIND_VEC \
+	vecf_t vlo, vhi, v, m; \
+	uint64_t i; \
+	unsigned int bits, lanes, per, mask, j; \
+	\
+	lanes = sizeof(vecf_t) / sizeof(float); \
+	i = 0; \
+	if (stride <= lanes && lanes % stride == 0) { \
+		per = lanes / stride; \
+		mask = 0; \
+		for (j = 0; j < lanes; j += stride) \
+			mask |= 1 << j; \
+		vlo = vecf_set1(r->lo); \
+		vhi = vecf_set1(r->hi); \
+		for (; i + per + (stride > 1) <= num_samples; i += per) { \
+			v = vecf_load(data + i * stride); \
+			if (r->inside) \
+				m = vecf_and(vecf_cmple(vlo, v), \
+						vecf_cmple(v, vhi)); \
+			else \
+				m = vecf_or(vecf_cmplt(v, vlo), \
+						vecf_cmplt(vhi, v)); \
+			if ((bits = vecf_movemask(m) & mask)) \
+				return i + __builtin_ctz(bits) / stride; \
+		} \
+	} \
+	\
+	return range_find_from(r, data, i, num_samples, stride);
+
+#define vecf_t			__m128
+#define vecf_load(p)		_mm_loadu_ps(p)
+#define vecf_set1(x)		_mm_set1_ps(x)
+#define vecf_and(a, b)		_mm_and_ps(a, b)
+#define vecf_or(a, b)		_mm_or_ps(a, b)
+#define vecf_cmplt(a, b)	_mm_cmplt_ps(a, b)
+#define vecf_cmple(a, b)	_mm_cmple_ps(a, b)
+#define vecf_movemask(a)	((unsigned int)_mm_movemask_ps(a))
+
+__attribute__((target("sse")))
+static uint64_t range_find_sse(const struct sr_analog_range *r,
+		const float *data, uint64_t num_samples, unsigned int stride)
+{
+	RANGE_FIND_VEC
+}
+
+#undef vecf_t
+#undef vecf_load
+#undef vecf_set1
+#undef vecf_and
+#undef vecf_or
+#undef vecf_cmplt
+#undef vecf_cmple
+#undef vecf_movemask
+
+#define vecf_t			__m256
+#define vecf_load(p)		_mm256_loadu_ps(p)
+#define vecf_set1(x)		_mm256_set1_ps(x)
+#define vecf_and(a, b)		_mm256_and_ps(a, b)
+#define vecf_or(a, b)		_mm256_or_ps(a, b)
+#define vecf_cmplt(a, b)	_mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define vecf_cmple(a, b)	_mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define vecf_movemask(a)	((unsigned int)_mm256_movemask_ps(a))
+
+__attribute__((target("avx")))
+static uint64_t range_find_avx(const struct sr_analog_range *r,
+		const float *data, uint64_t num_samples, unsigned int stride)
+{
+	RANGE_FIND_VEC
+}
+
+#undef vecf_t
+#undef vecf_load
+#undef vecf_set1
+#undef vecf_and
+#undef vecf_or
+#undef vecf_cmplt
+#undef vecf_cmple
+#undef vecf_movemask
+#endif
+
+/* Set by sr_analog_trigger_kernels_select(). */
+static uint64_t (*range_find)(const struct sr_analog_range *r,
+		const float *data, uint64_t num_samples,
+		unsigned int stride) = range_find_c;
+
+/**
+ * Choose the analog trigger's kernels for a set of CPU features.
+ *
+ * @param features The SR_CPU_* flags of the features to use.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_trigger_kernels_select(unsigned int features)
+{
+	range_find = range_find_c;
+#ifdef SR_CPU_DISPATCH_X86
+	if (features & SR_CPU_AVX)
+		range_find = range_find_avx;
+	else if (features & SR_CPU_SSE)
+		range_find = range_find_sse;
+#else
+	(void)features;
+#endif
+}
+
+/**
+ * Create a new analog trigger matcher.
+ *
+ * @param trigger The trigger conditions. Must not be NULL.
+ *
+ * @return The new matcher, or NULL upon invalid conditions or errors.
+ *
+ * @private
+ */
+SR_PRIV struct sr_analog_matcher *sr_analog_matcher_new(
+		const struct sr_analog_trigger *trigger)
+{
+	struct sr_analog_matcher *am;
+	float lo, hi, h;
+
+	h = trigger->hysteresis;
+	lo = trigger->level;
+	hi = trigger->high;
+	if (!(h >= 0) || isnan(lo) || ((trigger->type
+			== SR_ANALOG_TRIGGER_WINDOW_ENTER || trigger->type
+			== SR_ANALOG_TRIGGER_WINDOW_LEAVE) && !(lo <= hi))) {
+		sr_err("Invalid trigger level or hysteresis.");
+		return NULL;
+	}
+
+	if (!(am = g_try_malloc0(sizeof(struct sr_analog_matcher)))) {
+		sr_err("%s: am malloc failed", __func__);
+		return NULL;
+	}
+
+	am->num_dirs = 1;
+	switch (trigger->type) {
+	case SR_ANALOG_TRIGGER_EDGE:
+		/* Rising, and falling as the second direction. */
+		am->num_dirs = 2;
+		am->arm[0] = (struct sr_analog_range){ lo - h, INFINITY, FALSE };
+		am->fire[0] = (struct sr_analog_range){ lo, INFINITY, TRUE };
+		am->arm[1] = (struct sr_analog_range){ -INFINITY, lo + h, FALSE };
+		am->fire[1] = (struct sr_analog_range){ -INFINITY, lo, TRUE };
+		break;
+	case SR_ANALOG_TRIGGER_RISING:
+		am->arm[0] = (struct sr_analog_range){ lo - h, INFINITY, FALSE };
+		am->fire[0] = (struct sr_analog_range){ lo, INFINITY, TRUE };
+		break;
+	case SR_ANALOG_TRIGGER_FALLING:
+		am->arm[0] = (struct sr_analog_range){ -INFINITY, lo + h, FALSE };
+		am->fire[0] = (struct sr_analog_range){ -INFINITY, lo, TRUE };
+		break;
+	case SR_ANALOG_TRIGGER_WINDOW_ENTER:
+		am->arm[0] = (struct sr_analog_range){ lo - h, hi + h, FALSE };
+		am->fire[0] = (struct sr_analog_range){ lo, hi, TRUE };
+		break;
+	case SR_ANALOG_TRIGGER_WINDOW_LEAVE:
+		/* A window narrower than the hysteresis never arms. */
+		am->arm[0] = (struct sr_analog_range){ lo + h, hi - h, TRUE };
+		am->fire[0] = (struct sr_analog_range){ lo, hi, FALSE };
+		break;
+	default:
+		sr_err("Unknown analog trigger type %d.", trigger->type);
+		g_free(am);
+		return NULL;
+	}
+
+	return am;
+}
+
+/**
+ * Free an analog trigger matcher.
+ *
+ * @param am The matcher, or NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_matcher_free(struct sr_analog_matcher *am)
+{
+	g_free(am);
+}
+
+/**
+ * Disarm an analog trigger matcher, as after it fired.
+ *
+ * @param am The matcher. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_matcher_reset(struct sr_analog_matcher *am)
+{
+	am->armed[0] = am->armed[1] = FALSE;
+}
+
+/**
+ * Look for the trigger in a buffer of values, continuing where the
+ * previous call left off.
+ *
+ * After it fired, the matcher is disarmed: it takes another sample
+ * matching the arming condition to fire again.
+ *
+ * @param am The matcher. Must not be NULL.
+ * @param data The probe's first value.
+ * @param num_samples The number of values.
+ * @param stride The distance between the values, in floats. This is the
+ *               number of probes in interleaved data.
+ *
+ * @return The index of the value the trigger fired on, or -1 if it
+ *         didn't.
+ *
+ * @private
+ */
+SR_PRIV int64_t sr_analog_matcher_scan(struct sr_analog_matcher *am,
+		const float *data, uint64_t num_samples, unsigned int stride)
+{
+	uint64_t arm[2], fire, first;
+	int d;
+
+	first = num_samples;
+	for (d = 0; d < am->num_dirs; d++) {
+		arm[d] = am->armed[d] ? 0
+			: range_find(&am->arm[d], data, num_samples, stride);
+		if (arm[d] == num_samples)
+			continue;
+		fire = arm[d] + range_find(&am->fire[d], data + arm[d] * stride,
+				num_samples - arm[d], stride);
+		first = MIN(first, fire);
+	}
+
+	if (first < num_samples) {
+		sr_analog_matcher_reset(am);
+		return first;
+	}
+
+	for (d = 0; d < am->num_dirs; d++)
+		if (arm[d] < num_samples)
+			am->armed[d] = TRUE;
+
+	return -1;
+}
+
+/** @} */
@@ -18,13 +18,17 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE /* For pthread_setaffinity_np(). */
+#include <string.h>
 #include <glib.h>
 #include "config.h" /* Needed for HAVE_LIBUSB_1_0 and others. */
+#ifdef HAVE_PTHREAD_SETSCHEDPARAM
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
-extern struct sr_session *session;
-
 /**
  * @mainpage libsigrok API
  *
@@ -116,96 +120,6 @@ extern struct sr_session *session;
  * @{
  */
 
-/**
- * Sanity-check all libsigrok drivers.
- *
- * @return SR_OK if all drivers are OK, SR_ERR if one or more have issues.
- */
-static int sanity_check_all_drivers(void)
-{
-	int i, errors, ret = SR_OK;
-	struct sr_dev_driver **drivers;
-	const char *d;
-
-	sr_spew("Sanity-checking all drivers.");
-
-	drivers = sr_driver_list();
-	for (i = 0; drivers[i]; i++) {
-		errors = 0;
-
-		d = (drivers[i]->name) ? drivers[i]->name : "NULL";
-
-		if (!drivers[i]->name) {
-			sr_err("No name in driver %d ('%s').", i, d);
-			errors++;
-		}
-		if (!drivers[i]->longname) {
-			sr_err("No longname in driver %d ('%s').", i, d);
-			errors++;
-		}
-		if (drivers[i]->api_version < 1) {
-			sr_err("API version in driver %d ('%s') < 1.", i, d);
-			errors++;
-		}
-		if (!drivers[i]->init) {
-			sr_err("No init in driver %d ('%s').", i, d);
-			errors++;
-		}
-		if (!drivers[i]->cleanup) {
-			sr_err("No cleanup in driver %d ('%s').", i, d);
-			errors++;
-		}
-		if (!drivers[i]->scan) {
-			sr_err("No scan in driver %d ('%s').", i, d);
-			errors++;
-		}
-		if (!drivers[i]->dev_list) {
-			sr_err("No dev_list in driver %d ('%s').", i, d);
-			errors++;
-		}
-		if (!drivers[i]->dev_clear) {
-			sr_err("No dev_clear in driver %d ('%s').", i, d);
-			errors++;
-		}
-		/* Note: config_get() is optional. */
-		if (!drivers[i]->config_set) {
-			sr_err("No config_set in driver %d ('%s').", i, d);
-			errors++;
-		}
-		if (!drivers[i]->config_list) {
-			sr_err("No config_list in driver %d ('%s').", i, d);
-			errors++;
-		}
-		if (!drivers[i]->dev_open) {
-			sr_err("No dev_open in driver %d ('%s').", i, d);
-			errors++;
-		}
-		if (!drivers[i]->dev_close) {
-			sr_err("No dev_close in driver %d ('%s').", i, d);
-			errors++;
-		}
-		if (!drivers[i]->dev_acquisition_start) {
-			sr_err("No dev_acquisition_start in driver %d ('%s').",
-			       i, d);
-			errors++;
-		}
-		if (!drivers[i]->dev_acquisition_stop) {
-			sr_err("No dev_acquisition_stop in driver %d ('%s').",
-			       i, d);
-			errors++;
-		}
-
-		/* Note: 'priv' is allowed to be NULL. */
-
-		if (errors == 0)
-			continue;
-
-		ret = SR_ERR;
-	}
-
-	return ret;
-}
-
 /**
  * Sanity-check all libsigrok input modules.
  *
@@ -288,15 +202,15 @@ static int sanity_check_all_output_modules(void)
 			errors++;
 		}
 
-		/* All modules must provide a data or recv API callback. */
-		if (!outputs[i]->data && !outputs[i]->receive) {
-			sr_err("No data/receive in module %d ('%s').", i, d);
+		/* All modules must provide a receive API callback. */
+		if (!outputs[i]->receive) {
+			sr_err("No receive in module %d ('%s').", i, d);
 			errors++;
 		}
 
 		/*
 		 * Currently most API calls are optional (their function
-		 * pointers can thus be NULL) in theory: init, event, cleanup.
+		 * pointers can thus be NULL) in theory: init, write, cleanup.
 		 */
 
 		if (errors == 0)
@@ -334,11 +248,6 @@ SR_API int sr_init(struct sr_context **ctx)
 		return SR_ERR;
 	}
 
-	if (sanity_check_all_drivers() < 0) {
-		sr_err("Internal driver error(s), aborting.");
-		return ret;
-	}
-
 	if (sanity_check_all_input_modules() < 0) {
 		sr_err("Internal input module error(s), aborting.");
 		return ret;
@@ -349,6 +258,8 @@ SR_API int sr_init(struct sr_context **ctx)
 		return ret;
 	}
 
+	sr_cpu_init();
+
 	/* + 1 to handle when struct sr_context has no members. */
 	context = g_try_malloc0(sizeof(struct sr_context) + 1);
 
@@ -356,24 +267,25 @@ SR_API int sr_init(struct sr_context **ctx)
 		ret = SR_ERR_MALLOC;
 		goto done;
 	}
+	g_mutex_init(&context->scan_mutex);
+	g_cond_init(&context->scan_cond);
 
-#ifdef HAVE_LIBUSB_1_0
-	ret = libusb_init(&context->libusb_ctx);
-	if (LIBUSB_SUCCESS != ret) {
-		sr_err("libusb_init() returned %s.\n", libusb_error_name(ret));
-		ret = SR_ERR;
-		goto done;
-	}
-#endif
+	/*
+	 * Drivers are checked when they're initialized, and libusb only
+	 * when the first USB driver is: a frontend using a single serial
+	 * device doesn't pay for any of the others.
+	 */
 
 	*ctx = context;
 	context = NULL;
-	session = NULL;
 	ret = SR_OK;
 
 done:
-	if (context)
+	if (context) {
+		g_mutex_clear(&context->scan_mutex);
+		g_cond_clear(&context->scan_cond);
 		g_free(context);
+	}
 	return ret;
 }
 
@@ -393,15 +305,423 @@ SR_API int sr_exit(struct sr_context *ctx)
 		return SR_ERR;
 	}
 
+#ifdef HAVE_LIBUSB_1_0
+	sr_usb_hotplug_set(ctx, NULL, NULL);
+#endif
+
+	/* Drivers may still be scanning after sr_driver_scan_all(). */
+	if (ctx->scan_pool)
+		g_thread_pool_free(ctx->scan_pool, FALSE, TRUE);
+
 	sr_hw_cleanup_all();
+	sr_firmware_cache_clear();
 
 #ifdef HAVE_LIBUSB_1_0
-	libusb_exit(ctx->libusb_ctx);
+	sr_usb_thread_stop(ctx);
+	if (ctx->libusb_ctx)
+		libusb_exit(ctx->libusb_ctx);
 #endif
 
+	g_mutex_clear(&ctx->scan_mutex);
+	g_cond_clear(&ctx->scan_cond);
+	g_free(ctx->thread_cpus);
 	g_free(ctx);
 
 	return SR_OK;
 }
 
+/**
+ * Enable or disable handling USB events on a thread of their own.
+ *
+ * With the thread enabled, USB transfers of drivers that support it
+ * complete on a dedicated thread, so a busy session loop (or a slow
+ * datafeed callback) no longer starves the device of transfers. Packets
+ * the thread produces are still delivered to the datafeed callbacks from
+ * sr_session_run().
+ *
+ * The setting takes effect when the next acquisition starts.
+ *
+ * @param ctx Pointer to a libsigrok context struct. Must not be NULL.
+ * @param enable TRUE to use the USB event thread, FALSE to handle USB
+ *               events from the session loop (the default).
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, SR_ERR_NA
+ *         if libsigrok was built without USB support.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_usb_thread_set(struct sr_context *ctx, gboolean enable)
+{
+	if (!ctx) {
+		sr_err("%s(): libsigrok context was NULL.", __func__);
+		return SR_ERR_ARG;
+	}
+
+#ifdef HAVE_LIBUSB_1_0
+	ctx->usb_thread_enabled = enable;
+	return SR_OK;
+#else
+	(void)enable;
+	return SR_ERR_NA;
+#endif
+}
+
+/**
+ * Query whether USB events are handled on a thread of their own.
+ *
+ * @param ctx Pointer to a libsigrok context struct. Must not be NULL.
+ * @param enable Pointer where the setting is stored. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, SR_ERR_NA
+ *         if libsigrok was built without USB support.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_usb_thread_get(struct sr_context *ctx, gboolean *enable)
+{
+	if (!ctx || !enable) {
+		sr_err("%s(): Invalid arguments.", __func__);
+		return SR_ERR_ARG;
+	}
+
+#ifdef HAVE_LIBUSB_1_0
+	*enable = ctx->usb_thread_enabled;
+	return SR_OK;
+#else
+	return SR_ERR_NA;
+#endif
+}
+
+/**
+ * Set the scheduling priority of libsigrok's acquisition threads.
+ *
+ * With a priority set, the threads acquiring and passing on data get
+ * realtime scheduling (SCHED_FIFO) at that priority, so other jobs on the
+ * host don't preempt them and make the devices overrun. This applies to
+ * the thread running sr_session_run() for as long as it runs, and to the
+ * USB event thread, device threads and datafeed worker threads. Where the
+ * system doesn't permit realtime scheduling, the threads keep theirs and
+ * a warning is logged.
+ *
+ * The setting takes effect when the next acquisition starts.
+ *
+ * @param ctx Pointer to a libsigrok context struct. Must not be NULL.
+ * @param priority The SCHED_FIFO priority, or 0 for normal scheduling
+ *                 (the default).
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, SR_ERR_NA
+ *         if threads can't be given realtime scheduling on this platform.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_thread_priority_set(struct sr_context *ctx, int priority)
+{
+	if (!ctx || priority < 0) {
+		sr_err("%s(): Invalid arguments.", __func__);
+		return SR_ERR_ARG;
+	}
+
+#ifdef HAVE_PTHREAD_SETSCHEDPARAM
+	if (priority && (priority < sched_get_priority_min(SCHED_FIFO)
+	    || priority > sched_get_priority_max(SCHED_FIFO))) {
+		sr_err("Invalid realtime priority %d.", priority);
+		return SR_ERR_ARG;
+	}
+	ctx->thread_priority = priority;
+	return SR_OK;
+#else
+	return priority ? SR_ERR_NA : SR_OK;
+#endif
+}
+
+/**
+ * Query the scheduling priority of libsigrok's acquisition threads.
+ *
+ * @param ctx Pointer to a libsigrok context struct. Must not be NULL.
+ * @param priority Pointer where the priority is stored, 0 for normal
+ *                 scheduling. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_thread_priority_get(struct sr_context *ctx, int *priority)
+{
+	if (!ctx || !priority) {
+		sr_err("%s(): Invalid arguments.", __func__);
+		return SR_ERR_ARG;
+	}
+
+	*priority = ctx->thread_priority;
+
+	return SR_OK;
+}
+
+/**
+ * Set the CPUs libsigrok's acquisition threads may run on.
+ *
+ * The threads are the same as for sr_thread_priority_set(). Keeping them
+ * on CPUs other jobs don't use gives the most predictable latency.
+ *
+ * The setting takes effect when the next acquisition starts.
+ *
+ * @param ctx Pointer to a libsigrok context struct. Must not be NULL.
+ * @param cpus The numbers of the CPUs, or NULL to allow all of them
+ *             (the default).
+ * @param num_cpus The number of entries in cpus.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, SR_ERR_NA
+ *         if the CPU affinity of threads can't be set on this platform,
+ *         SR_ERR_MALLOC upon memory allocation errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_thread_affinity_set(struct sr_context *ctx, const int *cpus,
+		int num_cpus)
+{
+	int i;
+
+	if (!ctx || num_cpus < 0 || (num_cpus && !cpus)) {
+		sr_err("%s(): Invalid arguments.", __func__);
+		return SR_ERR_ARG;
+	}
+
+	g_free(ctx->thread_cpus);
+	ctx->thread_cpus = NULL;
+	ctx->num_thread_cpus = 0;
+	if (!cpus || !num_cpus)
+		return SR_OK;
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	for (i = 0; i < num_cpus; i++) {
+		if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+			sr_err("Invalid CPU %d.", cpus[i]);
+			return SR_ERR_ARG;
+		}
+	}
+	if (!(ctx->thread_cpus = g_try_malloc(sizeof(int) * num_cpus))) {
+		sr_err("%s: thread_cpus malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	memcpy(ctx->thread_cpus, cpus, sizeof(int) * num_cpus);
+	ctx->num_thread_cpus = num_cpus;
+	return SR_OK;
+#else
+	(void)i;
+	return SR_ERR_NA;
+#endif
+}
+
+/* A thread's scheduling before sr_thread_tune() changed it. */
+struct sr_thread_state {
+	gboolean sched_saved;
+	gboolean cpus_saved;
+#ifdef HAVE_PTHREAD_SETSCHEDPARAM
+	int policy;
+	struct sched_param param;
+#endif
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t cpus;
+#endif
+};
+
+/**
+ * Give the calling thread the scheduling set for acquisition threads, see
+ * sr_thread_priority_set() and sr_thread_affinity_set().
+ *
+ * @param ctx The libsigrok context, can be NULL.
+ *
+ * @return The thread's scheduling before, for sr_thread_restore(), or NULL
+ *         if nothing was changed.
+ *
+ * @private
+ */
+SR_PRIV struct sr_thread_state *sr_thread_tune(const struct sr_context *ctx)
+{
+	struct sr_thread_state *state;
+#ifdef HAVE_PTHREAD_SETSCHEDPARAM
+	struct sched_param param;
+	int ret;
+#endif
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t cpus;
+	int i;
+#endif
+
+	if (!ctx || (!ctx->thread_priority && !ctx->num_thread_cpus))
+		return NULL;
+
+	if (!(state = g_try_malloc0(sizeof(struct sr_thread_state)))) {
+		sr_err("%s: state malloc failed", __func__);
+		return NULL;
+	}
+
+#ifdef HAVE_PTHREAD_SETSCHEDPARAM
+	if (ctx->thread_priority && !pthread_getschedparam(pthread_self(),
+			&state->policy, &state->param)) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = ctx->thread_priority;
+		if ((ret = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+				&param)))
+			sr_warn("Failed to set realtime scheduling: %s.",
+				strerror(ret));
+		else
+			state->sched_saved = TRUE;
+	}
+#endif
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	if (ctx->num_thread_cpus && !pthread_getaffinity_np(pthread_self(),
+			sizeof(cpu_set_t), &state->cpus)) {
+		CPU_ZERO(&cpus);
+		for (i = 0; i < ctx->num_thread_cpus; i++)
+			CPU_SET(ctx->thread_cpus[i], &cpus);
+		if ((ret = pthread_setaffinity_np(pthread_self(),
+				sizeof(cpu_set_t), &cpus)))
+			sr_warn("Failed to set the CPU affinity: %s.",
+				strerror(ret));
+		else
+			state->cpus_saved = TRUE;
+	}
+#endif
+
+	return state;
+}
+
+/**
+ * Give the calling thread back the scheduling it had before
+ * sr_thread_tune().
+ *
+ * @param state What sr_thread_tune() returned, can be NULL. It is freed.
+ *
+ * @private
+ */
+SR_PRIV void sr_thread_restore(struct sr_thread_state *state)
+{
+	if (!state)
+		return;
+
+#ifdef HAVE_PTHREAD_SETSCHEDPARAM
+	if (state->sched_saved)
+		pthread_setschedparam(pthread_self(), state->policy,
+				&state->param);
+#endif
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	if (state->cpus_saved)
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+				&state->cpus);
+#endif
+
+	g_free(state);
+}
+
+/**
+ * Enable or disable locking USB transfer buffers in memory.
+ *
+ * Locked buffers are never paged out, so a transfer never waits for its
+ * buffer to be paged in again. The buffers of drivers that support it are
+ * then kept by the driver instead of being handed to the datafeed
+ * callbacks; callbacks keeping the data get a copy. How much memory can
+ * be locked is limited by RLIMIT_MEMLOCK; beyond it, buffers are used
+ * unlocked and a warning is logged.
+ *
+ * The setting takes effect when the next acquisition starts.
+ *
+ * @param ctx Pointer to a libsigrok context struct. Must not be NULL.
+ * @param enable TRUE to lock the buffers, FALSE not to (the default).
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, SR_ERR_NA
+ *         if libsigrok was built without USB support, or memory can't be
+ *         locked on this platform.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_usb_buffer_lock_set(struct sr_context *ctx, gboolean enable)
+{
+	if (!ctx) {
+		sr_err("%s(): libsigrok context was NULL.", __func__);
+		return SR_ERR_ARG;
+	}
+
+#if defined(HAVE_LIBUSB_1_0) && defined(HAVE_MLOCK)
+	ctx->usb_buffer_lock = enable;
+	return SR_OK;
+#else
+	return enable ? SR_ERR_NA : SR_OK;
+#endif
+}
+
+/**
+ * Watch for USB devices being plugged in and unplugged.
+ *
+ * Instead of rescanning all drivers periodically, a frontend can have
+ * libsigrok report devices coming and going. Whenever a device arrives,
+ * the drivers which can scan a single USB device with SR_CONF_CONN are
+ * asked to scan just that one, and every instance they find is reported
+ * to the callback with SR_HOTPLUG_ARRIVED. Driver instances whose device
+ * is unplugged are reported with SR_HOTPLUG_LEFT.
+ *
+ * The events are collected as libusb handles its events, which may be on
+ * the USB event thread or in a running session. They are only acted upon,
+ * and the callback only called, from sr_hotplug_handle_events().
+ *
+ * Serial devices are not watched.
+ *
+ * @param ctx Pointer to a libsigrok context struct. Must not be NULL.
+ * @param cb The callback, or NULL to stop watching.
+ * @param cb_data Opaque pointer passed to the callback.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, SR_ERR_NA
+ *         if libsigrok was built without USB support, or libusb has no
+ *         hotplug support on this platform, SR_ERR upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_hotplug_set(struct sr_context *ctx, sr_hotplug_callback_t cb,
+		void *cb_data)
+{
+	if (!ctx) {
+		sr_err("%s(): libsigrok context was NULL.", __func__);
+		return SR_ERR_ARG;
+	}
+
+#ifdef HAVE_LIBUSB_1_0
+	return sr_usb_hotplug_set(ctx, cb, cb_data);
+#else
+	(void)cb_data;
+	return cb ? SR_ERR_NA : SR_OK;
+#endif
+}
+
+/**
+ * Act upon the devices which arrived or left since the last call.
+ *
+ * Waits up to timeout_ms for USB events first, then scans newly arrived
+ * devices and calls the callback set with sr_hotplug_set(). Frontends
+ * call this from their main loop, or periodically.
+ *
+ * @param ctx Pointer to a libsigrok context struct. Must not be NULL.
+ * @param timeout_ms How long to wait for events, 0 to only handle those
+ *                   that are pending.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments or if no
+ *         callback is set, SR_ERR_NA if libsigrok was built without USB
+ *         support.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_hotplug_handle_events(struct sr_context *ctx, int timeout_ms)
+{
+	if (!ctx || timeout_ms < 0) {
+		sr_err("%s(): Invalid arguments.", __func__);
+		return SR_ERR_ARG;
+	}
+
+#ifdef HAVE_LIBUSB_1_0
+	return sr_usb_hotplug_handle_events(ctx, timeout_ms);
+#else
+	return SR_ERR_NA;
+#endif
+}
+
 /** @} */
@@ -22,6 +22,7 @@ from fractions import Fraction
 from .lowlevel import *
 from . import lowlevel
 import itertools
+import sys
 
 __all__ = ['Error', 'Context', 'Driver', 'Device', 'Session', 'Packet', 'Log',
     'LogLevel', 'PacketType', 'Quantity', 'Unit', 'QuantityFlag', 'ConfigKey',
@@ -285,26 +286,51 @@ class Session(object):
         context.session = self
 
     def __del__(self):
-        check(sr_session_destroy())
+        check(sr_session_destroy(self.struct))
 
     def add_device(self, device):
-        check(sr_session_dev_add(device.struct))
+        check(sr_session_dev_add(self.struct, device.struct))
 
     def open_device(self, device):
         check(sr_dev_open(device.struct))
 
     def add_callback(self, callback):
         wrapper = partial(callback_wrapper, self, callback)
-        check(sr_session_datafeed_python_callback_add(wrapper))
+        check(sr_session_datafeed_python_callback_add(self.struct, wrapper))
+
+    # With a queue, callbacks run on their own thread and the GIL is only
+    # taken there, so a slow callback doesn't hold up acquisition.
+    @property
+    def queue_depth(self):
+        depth_ptr = new_uint_ptr()
+        check(sr_session_queue_depth_get(self.struct, depth_ptr))
+        depth = uint_ptr_value(depth_ptr)
+        delete_uint_ptr(depth_ptr)
+        return depth
+
+    @queue_depth.setter
+    def queue_depth(self, depth):
+        check(sr_session_queue_depth_set(self.struct, depth))
+
+    @property
+    def queue_overruns(self):
+        overruns_ptr = new_uint64_ptr()
+        max_used_ptr = new_uint_ptr()
+        check(sr_session_queue_stats_get(self.struct, overruns_ptr,
+            max_used_ptr))
+        overruns = uint64_ptr_value(overruns_ptr)
+        delete_uint64_ptr(overruns_ptr)
+        delete_uint_ptr(max_used_ptr)
+        return overruns
 
     def start(self):
-        check(sr_session_start())
+        check(sr_session_start(self.struct))
 
     def run(self):
-        check(sr_session_run())
+        check(sr_session_run(self.struct))
 
     def stop(self):
-        check(sr_session_stop())
+        check(sr_session_stop(self.struct))
 
 class Packet(object):
 
@@ -339,12 +365,28 @@ class Logic(object):
         self.struct = struct
         self._data = None
 
+    # Views of the packet's memory, only valid during the datafeed
+    # callback. Use bytes(data) or array.copy() to keep the samples.
     @property
     def data(self):
         if self._data is None:
-            self._data = cdata(self.struct.data, self.struct.length)
+            self._data = cview(self.struct.data, self.struct.length)
         return self._data
 
+    @property
+    def unitsize(self):
+        return self.struct.unitsize
+
+    @property
+    def array(self):
+        import numpy
+        unitsize = self.struct.unitsize
+        if unitsize in (1, 2, 4, 8):
+            return numpy.frombuffer(self.data, dtype='<u%d' % unitsize)
+        else:
+            return numpy.frombuffer(self.data, dtype=numpy.uint8).reshape(
+                -1, unitsize)
+
 class Analog(object):
 
     def __init__(self, packet, struct):
@@ -368,12 +410,31 @@ class Analog(object):
     def mqflags(self):
         return QuantityFlag.set_from_mask(self.struct.mqflags)
 
+    @property
+    def num_probes(self):
+        return len(gslist_to_python(self.struct.probes))
+
+    def _view(self):
+        return cview(self.struct.data,
+            self.struct.num_samples * self.num_probes * 4)
+
+    # Views of the packet's memory, only valid during the datafeed
+    # callback. The samples are interleaved by probe.
     @property
     def data(self):
         if self._data is None:
-            self._data = float_array.frompointer(self.struct.data)
+            if sys.version_info >= (3, 3):
+                self._data = self._view().cast('f')
+            else:
+                self._data = float_array.frompointer(self.struct.data)
         return self._data
 
+    @property
+    def array(self):
+        import numpy
+        return numpy.frombuffer(self._view(), dtype=numpy.float32).reshape(
+            self.struct.num_samples, self.num_probes)
+
 class Log(object):
 
     @property
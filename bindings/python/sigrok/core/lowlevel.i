@@ -54,14 +54,15 @@ void sr_datafeed_python_callback(const struct sr_dev_inst *sdi,
     PyGILState_Release(gstate);
 }
 
-int sr_session_datafeed_python_callback_add(PyObject *cb)
+int sr_session_datafeed_python_callback_add(struct sr_session *session,
+        PyObject *cb)
 {
     int ret;
 
     if (!PyCallable_Check(cb))
         return SR_ERR_ARG;
     else {
-        ret = sr_session_datafeed_callback_add(
+        ret = sr_session_datafeed_callback_add(session,
             sr_datafeed_python_callback, cb);
         if (ret == SR_OK)
             Py_XINCREF(cb);
@@ -78,6 +79,16 @@ PyObject *cdata(const void *data, unsigned long size)
 #endif
 }
 
+/* A read-only view of the memory, without copying it. */
+PyObject *cview(void *data, unsigned long size)
+{
+#if PY_MAJOR_VERSION < 3
+    return PyBuffer_FromMemory(data, size);
+#else
+    return PyMemoryView_FromMemory(data, size, PyBUF_READ);
+#endif
+}
+
 GSList *python_to_gslist(PyObject *pylist)
 {
     if (PyList_Check(pylist)) {
@@ -105,9 +116,11 @@ PyObject *gslist_to_python(GSList *gslist)
 
 %}
 
-int sr_session_datafeed_python_callback_add(PyObject *cb);
+int sr_session_datafeed_python_callback_add(struct sr_session *session,
+        PyObject *cb);
 
 PyObject *cdata(const void *data, unsigned long size);
+PyObject *cview(void *data, unsigned long size);
 
 GSList *python_to_gslist(PyObject *pylist);
 PyObject *gslist_to_python(GSList *gslist);
@@ -26,5 +26,11 @@ $LDFLAGS += " " + `pkg-config --libs libsigrok`.strip
 have_library("sigrok", "sr_init") or exit(false)
 find_header("libsigrok/libsigrok.h") or exit(false)
 
+# Waiting for packets without holding up other threads (Ruby 2.0), and
+# payload strings without a copy (Ruby 2.2). Both are optional.
+have_header("ruby/thread.h")
+have_func("rb_thread_call_without_gvl", "ruby/thread.h")
+have_func("rb_str_new_static")
+
 create_makefile('sigrok_lowlevel')
 
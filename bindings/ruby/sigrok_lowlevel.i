@@ -18,7 +18,216 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+/*
+ * Besides the wrapped API, this takes packets from the session's packet
+ * queue (see sr_session_packet_queue_set()) in batches, and makes their
+ * payloads frozen strings backed by the packet data rather than copies.
+ * A queued packet holds a reference to the data, which Ruby drops once
+ * neither the packet nor any string of its payload is referenced any
+ * more, so the strings remain valid as long as they're kept. Wrap them
+ * in a StringIO for an IO view. E.g.:
+ *
+ *   sr_session_packet_queue_set(session, 64)
+ *   sr_session_start(session)
+ *   runner = Thread.new { sr_session_run_ruby(session) }
+ *   loop do
+ *     batch = sr_session_packets_ruby(session, 64, 100)
+ *     break if batch.empty? && !runner.alive?
+ *     batch.each do |sdi, packet|
+ *       data = sr_packet_payload_ruby(packet)
+ *       ...
+ *     end
+ *   end
+ */
+
 %module sigrok_lowlevel
 
 %include "../swig/libsigrok.i"
 
+%{
+
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+
+/* Frees a queued packet once Ruby no longer refers to it. */
+static void packet_owner_free(void *packet)
+{
+    sr_session_packet_free(packet);
+}
+
+/* A packet taken from the queue, as a packet object owning it. */
+static VALUE packet_wrap(struct sr_datafeed_packet *packet)
+{
+    VALUE obj, owner;
+
+    owner = Data_Wrap_Struct(rb_cObject, NULL, packet_owner_free, packet);
+    obj = SWIG_NewPointerObj(packet, SWIGTYPE_p_sr_datafeed_packet, 0);
+    rb_ivar_set(obj, rb_intern("@owner"), owner);
+
+    return obj;
+}
+
+struct packet_next_args {
+    struct sr_session *session;
+    int timeout_ms;
+    const struct sr_dev_inst *sdi;
+    struct sr_datafeed_packet *packet;
+    int ret;
+};
+
+static void *packet_next_nogvl(void *data)
+{
+    struct packet_next_args *args;
+
+    args = data;
+    args->ret = sr_session_packet_next(args->session, args->timeout_ms,
+            &args->sdi, &args->packet);
+
+    return NULL;
+}
+
+/* Longest wait without the GVL, between checks for Ruby interrupts. */
+#define PACKET_WAIT_MS 100
+
+/*
+ * Wait for the next packet with other Ruby threads running meanwhile.
+ * The wait is split into bounded ones, so Thread#raise, Thread#kill and
+ * Ctrl-C get through in between, even with a negative timeout.
+ */
+static int packet_next(struct packet_next_args *args)
+{
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    int left_ms;
+
+    if (args->timeout_ms != 0) {
+        left_ms = args->timeout_ms;
+        do {
+            args->timeout_ms = left_ms < 0 ? PACKET_WAIT_MS
+                    : MIN(left_ms, PACKET_WAIT_MS);
+            rb_thread_call_without_gvl(packet_next_nogvl, args, NULL, NULL);
+            if (args->ret != SR_ERR_TIMEOUT)
+                return args->ret;
+            if (left_ms > 0)
+                left_ms -= args->timeout_ms;
+            rb_thread_check_ints();
+        } while (left_ms != 0);
+        return SR_ERR_TIMEOUT;
+    }
+#endif
+    packet_next_nogvl(args);
+
+    return args->ret;
+}
+
+/*
+ * Take up to max_packets packets from the session's packet queue, as an
+ * array of [sdi, packet] pairs. Waits timeout_ms (or for as long as it
+ * takes, if negative) for the first one; the others are only those
+ * queued already. The array is empty if no packet came in time.
+ */
+VALUE sr_session_packets_ruby(struct sr_session *session, int max_packets,
+        int timeout_ms)
+{
+    struct packet_next_args args;
+    VALUE batch, sdi_obj;
+    int ret;
+
+    args.session = session;
+    args.timeout_ms = timeout_ms;
+    batch = rb_ary_new();
+    while (RARRAY_LEN(batch) < max_packets) {
+        if ((ret = packet_next(&args)) == SR_ERR_TIMEOUT)
+            break;
+        if (ret != SR_OK)
+            rb_raise(rb_eRuntimeError, "Taking a packet failed: %s.",
+                    sr_strerror(ret));
+        sdi_obj = SWIG_NewPointerObj((void *)args.sdi,
+                SWIGTYPE_p_sr_dev_inst, 0);
+        rb_ary_push(batch, rb_ary_new3(2, sdi_obj,
+                packet_wrap(args.packet)));
+        args.timeout_ms = 0;
+    }
+
+    return batch;
+}
+
+/*
+ * The payload of a logic or analog packet as a frozen binary string, or
+ * nil for other packets. The string refers to the packet's data, and
+ * keeps the packet it came from alive; only for packets from
+ * sr_session_packets_ruby() does that keep the data as well. Without
+ * rb_str_new_static() (before Ruby 2.2), the payload is copied.
+ */
+VALUE sr_packet_payload_ruby(VALUE packet_obj)
+{
+    struct sr_datafeed_packet *packet;
+    const struct sr_datafeed_logic *logic;
+    const struct sr_datafeed_analog *analog;
+    const void *data;
+    long size;
+    VALUE str;
+
+    if (!SWIG_IsOK(SWIG_ConvertPtr(packet_obj, (void **)&packet,
+            SWIGTYPE_p_sr_datafeed_packet, 0)))
+        rb_raise(rb_eTypeError, "Expected a packet.");
+
+    switch (packet->type) {
+    case SR_DF_LOGIC:
+        logic = packet->payload;
+        data = logic->data;
+        size = logic->length;
+        break;
+    case SR_DF_ANALOG:
+        analog = packet->payload;
+        data = analog->data;
+        size = analog->num_samples * g_slist_length(analog->probes)
+                * sizeof(float);
+        break;
+    default:
+        return Qnil;
+    }
+
+#ifdef HAVE_RB_STR_NEW_STATIC
+    str = rb_str_new_static(data, size);
+    rb_ivar_set(str, rb_intern("@packet"), packet_obj);
+#else
+    str = rb_str_new(data, size);
+#endif
+
+    return rb_obj_freeze(str);
+}
+
+static void *session_run_nogvl(void *data)
+{
+    return GINT_TO_POINTER(sr_session_run(data));
+}
+
+/* Interrupting the running thread stops the session, so the run returns. */
+static void session_run_ubf(void *data)
+{
+    sr_session_stop(data);
+}
+
+/*
+ * Run the session with other Ruby threads running meanwhile, e.g. one
+ * taking the packets with sr_session_packets_ruby(). Thread#raise,
+ * Thread#kill and Ctrl-C stop the session, then raise as usual.
+ */
+int sr_session_run_ruby(struct sr_session *session)
+{
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    return GPOINTER_TO_INT(rb_thread_call_without_gvl(session_run_nogvl,
+            session, session_run_ubf, session));
+#else
+    return GPOINTER_TO_INT(session_run_nogvl(session));
+#endif
+}
+
+%}
+
+VALUE sr_session_packets_ruby(struct sr_session *session, int max_packets,
+        int timeout_ms);
+VALUE sr_packet_payload_ruby(VALUE packet_obj);
+int sr_session_run_ruby(struct sr_session *session);
+
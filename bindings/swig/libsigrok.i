@@ -60,6 +60,8 @@ GVariant *g_variant_get_child_value(GVariant *value, unsigned long index);
 %pointer_functions(GVariant *, gvariant_ptr_ptr);
 %array_functions(GVariant *, gvariant_ptr_array);
 %pointer_functions(struct sr_context *, sr_context_ptr_ptr);
+%pointer_functions(unsigned int, uint_ptr);
+%pointer_functions(uint64_t, uint64_ptr);
 %array_functions(struct sr_dev_driver *, sr_dev_driver_ptr_array);
 %pointer_cast(gpointer, struct sr_dev_inst *, gpointer_to_sr_dev_inst_ptr);
 %pointer_cast(void *, struct sr_datafeed_logic *, void_ptr_to_sr_datafeed_logic_ptr)
@@ -0,0 +1,149 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "cpu: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/**
+ * @file
+ *
+ * Choosing the SIMD variants of the hot loops for the CPU at hand.
+ */
+
+/**
+ * @defgroup grp_cpu CPU features
+ *
+ * Choosing the SIMD variants of the hot loops for the CPU at hand.
+ *
+ * Kernels with SIMD variants are built for each instruction set this
+ * file knows of, whatever the compiler flags, next to a plain C one.
+ * Each file with such kernels keeps pointers to the variants it uses,
+ * which sr_init() sets for the features the CPU has, so a build for
+ * a generic target gets the speed of the machine it runs on. The plain
+ * C variants serve as the reference: sr_cpu_features_limit() can make
+ * all files fall back to them, or to any subset of the features.
+ *
+ * @{
+ */
+
+/* Sets the kernels of each file which has some, for a set of features. */
+static void (*const kernel_selectors[])(unsigned int features) = {
+	sr_analog_trigger_kernels_select,
+	sr_filter_kernels_select,
+	sr_soft_trigger_kernels_select,
+};
+
+static unsigned int cpu_features;
+static unsigned int features_limit = ~0u;
+
+static unsigned int features_detect(void)
+{
+	unsigned int features;
+
+	features = 0;
+#ifdef SR_CPU_DISPATCH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse"))
+		features |= SR_CPU_SSE;
+	if (__builtin_cpu_supports("sse2"))
+		features |= SR_CPU_SSE2;
+	/* These also check the OS saves the AVX registers. */
+	if (__builtin_cpu_supports("avx"))
+		features |= SR_CPU_AVX;
+	if (__builtin_cpu_supports("avx2"))
+		features |= SR_CPU_AVX2;
+	if (__builtin_cpu_supports("bmi2"))
+		features |= SR_CPU_BMI2;
+#endif
+#if defined(__aarch64__) || defined(__ARM_NEON)
+	features |= SR_CPU_NEON;
+#endif
+
+	return features;
+}
+
+static void kernels_select(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(kernel_selectors); i++)
+		kernel_selectors[i](cpu_features & features_limit);
+}
+
+/**
+ * Detect the CPU's features, once, and choose the kernels for them.
+ *
+ * @private
+ */
+SR_PRIV void sr_cpu_init(void)
+{
+	static gsize done = 0;
+
+	if (g_once_init_enter(&done)) {
+		cpu_features = features_detect();
+		sr_dbg("CPU features: 0x%x.", cpu_features);
+		kernels_select();
+		g_once_init_leave(&done, 1);
+	}
+}
+
+/**
+ * Get the CPU features libsigrok uses SIMD kernels for.
+ *
+ * @return The SR_CPU_* flags of the features the CPU has, and which
+ *         sr_cpu_features_limit() leaves in use.
+ *
+ * @since 0.3.0
+ */
+SR_API unsigned int sr_cpu_features_get(void)
+{
+	sr_cpu_init();
+
+	return cpu_features & features_limit;
+}
+
+/**
+ * Limit the CPU features libsigrok uses SIMD kernels for.
+ *
+ * Only the kernels for the features in the mask which the CPU has are
+ * used from then on; with a mask of 0, every kernel is the plain C one.
+ * This is meant for comparing the variants with each other, and for
+ * ruling them out when looking for a bug. It must not be called while a
+ * session runs.
+ *
+ * @param mask The SR_CPU_* flags of the features to use, ~0 for all.
+ *
+ * @since 0.3.0
+ */
+SR_API void sr_cpu_features_limit(unsigned int mask)
+{
+	sr_cpu_init();
+	features_limit = mask;
+	kernels_select();
+}
+
+/** @} */
@@ -0,0 +1,1180 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "datafeed: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/**
+ * @file
+ *
+ * Reference-counted datafeed payload buffers.
+ */
+
+/**
+ * @defgroup grp_datafeed Datafeed buffers
+ *
+ * Keeping datafeed payloads alive beyond the datafeed callback.
+ *
+ * Payloads passed to a datafeed callback are only valid for the duration
+ * of that callback. A frontend or output module which wants to hold on to
+ * the data can take a reference on the payload with sr_datafeed_logic_ref()
+ * or sr_datafeed_analog_ref(), and drop it again with the respective
+ * _unref() call once it's done with it.
+ *
+ * If the driver sent the packet from a reference-counted buffer, taking a
+ * reference does not copy the sample data. Otherwise the data is copied
+ * once, so the call always succeeds regardless of the driver in use.
+ *
+ * @{
+ */
+
+/* Smallest and largest size class of the buffer pool (as powers of two). */
+#define POOL_MIN_SHIFT	12
+#define POOL_MAX_SHIFT	24
+#define POOL_CLASSES	(POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+/* Number of unused buffers kept around per size class. */
+#define POOL_MAX_FREE	16
+
+struct sr_buffer_pool {
+	/* One reference for the session, one for each buffer handed out. */
+	gint refcount;
+	GMutex mutex;
+	gboolean closed;
+	GSList *free[POOL_CLASSES];
+	unsigned int num_free[POOL_CLASSES];
+};
+
+/* A retained payload, along with the buffer which keeps its data alive. */
+struct logic_ref {
+	struct sr_datafeed_logic logic;
+	struct sr_buffer *buffer;
+};
+
+struct analog_ref {
+	struct sr_datafeed_analog analog;
+	struct sr_buffer *buffer;
+};
+
+/**
+ * Create a new reference-counted buffer.
+ *
+ * @param size The size of the buffer in bytes.
+ *
+ * @return The new buffer with a reference count of 1, or NULL upon
+ *         memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV struct sr_buffer *sr_buffer_new(size_t size)
+{
+	void *data;
+	struct sr_buffer *buf;
+
+	if (!(data = g_try_malloc(size))) {
+		sr_err("%s: data malloc failed", __func__);
+		return NULL;
+	}
+
+	if (!(buf = sr_buffer_new_wrap(data, size, g_free)))
+		g_free(data);
+
+	return buf;
+}
+
+/**
+ * Create a new reference-counted buffer around existing memory.
+ *
+ * @param data The memory which will be owned by the buffer. Must not be NULL.
+ * @param size The size of the memory area in bytes.
+ * @param free_func Function used to free the memory once the last reference
+ *                  is gone. Can be NULL if the memory doesn't need freeing.
+ *
+ * @return The new buffer with a reference count of 1, or NULL upon
+ *         memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV struct sr_buffer *sr_buffer_new_wrap(void *data, size_t size,
+		GDestroyNotify free_func)
+{
+	struct sr_buffer *buf;
+
+	if (!data) {
+		sr_err("%s: data was NULL", __func__);
+		return NULL;
+	}
+
+	if (!(buf = g_try_malloc(sizeof(struct sr_buffer)))) {
+		sr_err("%s: buf malloc failed", __func__);
+		return NULL;
+	}
+
+	buf->data = data;
+	buf->size = size;
+	buf->refcount = 1;
+	buf->free_func = free_func;
+	buf->pool = NULL;
+	buf->pool_class = -1;
+
+	return buf;
+}
+
+/** @private */
+SR_PRIV struct sr_buffer *sr_buffer_ref(struct sr_buffer *buf)
+{
+	g_atomic_int_inc(&buf->refcount);
+
+	return buf;
+}
+
+static void buffer_free(struct sr_buffer *buf)
+{
+	if (buf->free_func)
+		buf->free_func(buf->data);
+	g_free(buf);
+}
+
+static void pool_unref(struct sr_buffer_pool *pool)
+{
+	if (!g_atomic_int_dec_and_test(&pool->refcount))
+		return;
+
+	g_mutex_clear(&pool->mutex);
+	g_free(pool);
+}
+
+/* Hand a buffer nobody uses anymore back to its pool. */
+static void pool_put(struct sr_buffer *buf)
+{
+	struct sr_buffer_pool *pool;
+	int c;
+
+	pool = buf->pool;
+	c = buf->pool_class;
+
+	g_mutex_lock(&pool->mutex);
+	if (!pool->closed && pool->num_free[c] < POOL_MAX_FREE) {
+		pool->free[c] = g_slist_prepend(pool->free[c], buf);
+		pool->num_free[c]++;
+		buf = NULL;
+	}
+	g_mutex_unlock(&pool->mutex);
+
+	if (buf)
+		buffer_free(buf);
+	pool_unref(pool);
+}
+
+/** @private */
+SR_PRIV void sr_buffer_unref(struct sr_buffer *buf)
+{
+	if (!g_atomic_int_dec_and_test(&buf->refcount))
+		return;
+
+	if (buf->pool)
+		pool_put(buf);
+	else
+		buffer_free(buf);
+}
+
+/**
+ * Take back the memory of a buffer nobody else holds a reference to.
+ *
+ * This is meant for drivers which wrap their receive buffers with
+ * sr_buffer_new_wrap() before sending them to the session bus. If no
+ * datafeed consumer kept a reference, the buffer is freed (but not its
+ * memory) and the memory is returned, so the driver can reuse it. If
+ * the buffer is still referenced elsewhere, the caller's reference is
+ * dropped and NULL is returned; the memory stays with the other holders
+ * and will be freed by the last of them.
+ *
+ * @param buf The buffer. Must not be NULL.
+ *
+ * @return The buffer's memory, or NULL if it's still in use elsewhere.
+ *
+ * @private
+ */
+SR_PRIV void *sr_buffer_steal(struct sr_buffer *buf)
+{
+	void *data;
+
+	/* Memory of pooled buffers always goes back to the pool. */
+	if (buf->pool || g_atomic_int_get(&buf->refcount) != 1) {
+		sr_buffer_unref(buf);
+		return NULL;
+	}
+
+	data = buf->data;
+	g_free(buf);
+
+	return data;
+}
+
+/**
+ * Create a new buffer pool.
+ *
+ * A buffer pool keeps buffers which are no longer in use around for reuse,
+ * sorted into power-of-two size classes, so that hot paths which need a
+ * fresh buffer for every packet don't keep the allocator busy.
+ *
+ * @return The new pool, or NULL upon memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV struct sr_buffer_pool *sr_buffer_pool_new(void)
+{
+	struct sr_buffer_pool *pool;
+
+	if (!(pool = g_try_malloc0(sizeof(struct sr_buffer_pool)))) {
+		sr_err("%s: pool malloc failed", __func__);
+		return NULL;
+	}
+
+	pool->refcount = 1;
+	g_mutex_init(&pool->mutex);
+
+	return pool;
+}
+
+/**
+ * Destroy a buffer pool.
+ *
+ * All unused buffers are freed right away. Buffers still in use are freed
+ * when their last reference is dropped; the pool itself stays around until
+ * then.
+ *
+ * @param pool The pool. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_buffer_pool_destroy(struct sr_buffer_pool *pool)
+{
+	GSList *list[POOL_CLASSES];
+	int c;
+
+	g_mutex_lock(&pool->mutex);
+	pool->closed = TRUE;
+	for (c = 0; c < POOL_CLASSES; c++) {
+		list[c] = pool->free[c];
+		pool->free[c] = NULL;
+		pool->num_free[c] = 0;
+	}
+	g_mutex_unlock(&pool->mutex);
+
+	for (c = 0; c < POOL_CLASSES; c++)
+		g_slist_free_full(list[c], (GDestroyNotify)buffer_free);
+
+	pool_unref(pool);
+}
+
+/**
+ * Get a buffer from the current session's buffer pool.
+ *
+ * The buffer is returned to the pool once its last reference is dropped
+ * with sr_buffer_unref(). Sizes above the largest size class, or calls
+ * without a session, get a regular buffer from sr_buffer_new().
+ *
+ * The contents of the buffer are undefined.
+ *
+ * @param size The size of the buffer in bytes.
+ *
+ * @return A buffer of at least the given size with a reference count of 1,
+ *         or NULL upon memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV struct sr_buffer *sr_buffer_pool_acquire(size_t size)
+{
+	struct sr_buffer_pool *pool;
+	struct sr_buffer *buf;
+	GSList *l;
+	int c;
+
+	pool = sr_session_buffer_pool_get();
+	if (!pool || size > (1 << POOL_MAX_SHIFT))
+		return sr_buffer_new(size);
+
+	for (c = 0; size > ((size_t)1 << (c + POOL_MIN_SHIFT)); c++);
+
+	buf = NULL;
+	g_mutex_lock(&pool->mutex);
+	if ((l = pool->free[c])) {
+		buf = l->data;
+		pool->free[c] = g_slist_delete_link(pool->free[c], l);
+		pool->num_free[c]--;
+	}
+	g_mutex_unlock(&pool->mutex);
+
+	if (!buf) {
+		if (!(buf = sr_buffer_new((size_t)1 << (c + POOL_MIN_SHIFT))))
+			return NULL;
+		buf->pool = pool;
+		buf->pool_class = c;
+	}
+
+	buf->size = size;
+	buf->refcount = 1;
+	g_atomic_int_inc(&pool->refcount);
+
+	return buf;
+}
+
+/* Return a buffer reference if ptr lies inside the buffer being sent. */
+static struct sr_buffer *current_buffer_ref(const void *ptr, size_t len)
+{
+	struct sr_buffer *buf;
+	const uint8_t *p, *start;
+
+	if (!(buf = sr_session_cur_buffer_get()))
+		return NULL;
+
+	p = ptr;
+	start = buf->data;
+	if (p < start || p + len > start + buf->size)
+		return NULL;
+
+	return sr_buffer_ref(buf);
+}
+
+/**
+ * Take a reference on a logic payload.
+ *
+ * This can be called from within a datafeed callback, to keep the payload
+ * of an SR_DF_LOGIC packet around after the callback returns.
+ *
+ * @param logic The payload to keep. Must not be NULL.
+ *
+ * @return A newly allocated copy of the payload struct, whose data stays
+ *         valid until it's released with sr_datafeed_logic_unref(), or
+ *         NULL upon errors.
+ *
+ * @since 0.3.0
+ */
+SR_API struct sr_datafeed_logic *sr_datafeed_logic_ref(
+		const struct sr_datafeed_logic *logic)
+{
+	struct logic_ref *ref;
+
+	if (!logic) {
+		sr_err("%s: logic was NULL", __func__);
+		return NULL;
+	}
+
+	if (!(ref = g_try_malloc(sizeof(struct logic_ref)))) {
+		sr_err("%s: ref malloc failed", __func__);
+		return NULL;
+	}
+
+	ref->logic = *logic;
+	if (!(ref->buffer = current_buffer_ref(logic->data, logic->length))) {
+		/* Not backed by a shared buffer, copy the data once. */
+		if (!(ref->buffer = sr_buffer_new(logic->length))) {
+			g_free(ref);
+			return NULL;
+		}
+		memcpy(ref->buffer->data, logic->data, logic->length);
+		ref->logic.data = ref->buffer->data;
+	}
+
+	return &ref->logic;
+}
+
+/**
+ * Release a logic payload obtained from sr_datafeed_logic_ref().
+ *
+ * @param logic The payload to release. Must not be NULL.
+ *
+ * @since 0.3.0
+ */
+SR_API void sr_datafeed_logic_unref(struct sr_datafeed_logic *logic)
+{
+	struct logic_ref *ref;
+
+	if (!logic) {
+		sr_err("%s: logic was NULL", __func__);
+		return;
+	}
+
+	ref = (struct logic_ref *)logic;
+	sr_buffer_unref(ref->buffer);
+	g_free(ref);
+}
+
+/**
+ * Take a reference on an analog payload.
+ *
+ * This can be called from within a datafeed callback, to keep the payload
+ * of an SR_DF_ANALOG packet around after the callback returns. The probe
+ * list and the timestamps are copied, the probes themselves are owned by
+ * the device instance.
+ *
+ * @param analog The payload to keep. Must not be NULL.
+ *
+ * @return A newly allocated copy of the payload struct, whose data stays
+ *         valid until it's released with sr_datafeed_analog_unref(), or
+ *         NULL upon errors.
+ *
+ * @since 0.3.0
+ */
+SR_API struct sr_datafeed_analog *sr_datafeed_analog_ref(
+		const struct sr_datafeed_analog *analog)
+{
+	struct analog_ref *ref;
+	size_t size;
+
+	if (!analog) {
+		sr_err("%s: analog was NULL", __func__);
+		return NULL;
+	}
+
+	if (!(ref = g_try_malloc(sizeof(struct analog_ref)))) {
+		sr_err("%s: ref malloc failed", __func__);
+		return NULL;
+	}
+
+	ref->analog = *analog;
+	ref->analog.probes = g_slist_copy(analog->probes);
+	size = analog->num_samples * g_slist_length(analog->probes)
+			* sizeof(float);
+	if (!(ref->buffer = current_buffer_ref(analog->data, size))) {
+		/* Not backed by a shared buffer, copy the data once. */
+		if (!(ref->buffer = sr_buffer_new(size))) {
+			g_slist_free(ref->analog.probes);
+			g_free(ref);
+			return NULL;
+		}
+		memcpy(ref->buffer->data, analog->data, size);
+		ref->analog.data = ref->buffer->data;
+	}
+	if (analog->timestamps) {
+		size = analog->num_samples * sizeof(int64_t);
+		if (!(ref->analog.timestamps = g_try_malloc(size))) {
+			sr_err("%s: timestamps malloc failed", __func__);
+			sr_buffer_unref(ref->buffer);
+			g_slist_free(ref->analog.probes);
+			g_free(ref);
+			return NULL;
+		}
+		memcpy(ref->analog.timestamps, analog->timestamps, size);
+	}
+
+	return &ref->analog;
+}
+
+/**
+ * Release an analog payload obtained from sr_datafeed_analog_ref().
+ *
+ * @param analog The payload to release. Must not be NULL.
+ *
+ * @since 0.3.0
+ */
+SR_API void sr_datafeed_analog_unref(struct sr_datafeed_analog *analog)
+{
+	struct analog_ref *ref;
+
+	if (!analog) {
+		sr_err("%s: analog was NULL", __func__);
+		return;
+	}
+
+	ref = (struct analog_ref *)analog;
+	g_slist_free(ref->analog.probes);
+	g_free(ref->analog.timestamps);
+	sr_buffer_unref(ref->buffer);
+	g_free(ref);
+}
+
+/* Sample intervals are sent in ms, or as a rational number of seconds. */
+static uint64_t sample_interval_ms(GVariant *gvar)
+{
+	uint64_t p, q;
+
+	if (!g_variant_is_of_type(gvar, G_VARIANT_TYPE("(tt)")))
+		return g_variant_get_uint64(gvar);
+
+	g_variant_get(gvar, "(tt)", &p, &q);
+
+	return q ? p * 1000 / q : 0;
+}
+
+/**
+ * Keep the stream parameters of a datafeed up to date.
+ *
+ * Pass every packet of the datafeed, or at least its SR_DF_HEADER and
+ * SR_DF_META packets. The header starts over with the samplerate the
+ * device is set to, and each META packet's configuration is decoded
+ * into params once, so datafeed consumers can read the current values
+ * from it instead of walking the META packets themselves. Packets of
+ * other types leave params as it is.
+ *
+ * Output modules get this done for them by sr_output_send(), in the
+ * output instance's params.
+ *
+ * @param params The parameters to update. Must not be NULL. Zero it
+ *               before the first packet.
+ * @param sdi The device instance the packet originates from. May be NULL,
+ *            in which case the samplerate starts out as 0.
+ * @param packet The packet. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_stream_params_update(struct sr_stream_params *params,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_meta *meta;
+	const struct sr_config *src;
+	GVariant *gvar;
+	GSList *l;
+	uint64_t generation;
+
+	if (!params || !packet) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		generation = params->generation;
+		memset(params, 0, sizeof(struct sr_stream_params));
+		params->generation = generation + 1;
+		if (sdi && sdi->driver && sr_config_get(sdi->driver, sdi, NULL,
+				SR_CONF_SAMPLERATE, &gvar) == SR_OK) {
+			params->samplerate = g_variant_get_uint64(gvar);
+			g_variant_unref(gvar);
+		}
+		break;
+	case SR_DF_META:
+		params->generation++;
+		meta = packet->payload;
+		for (l = meta->config; l; l = l->next) {
+			src = l->data;
+			switch (src->key) {
+			case SR_CONF_SAMPLERATE:
+				params->samplerate =
+					g_variant_get_uint64(src->data);
+				break;
+			case SR_CONF_SAMPLE_INTERVAL:
+				params->sample_interval =
+					sample_interval_ms(src->data);
+				break;
+			case SR_CONF_PACKED_PROBES:
+				params->packed_probes =
+					g_variant_get_uint64(src->data);
+				break;
+			}
+		}
+		break;
+	}
+
+	return SR_OK;
+}
+
+/* Copy an RLE payload, runs and all, into a single allocation. */
+static struct sr_datafeed_logic_rle *logic_rle_copy(
+		const struct sr_datafeed_logic_rle *rle)
+{
+	struct sr_datafeed_logic_rle *copy;
+	size_t counts_size;
+
+	counts_size = rle->num_runs * sizeof(uint64_t);
+	if (!(copy = g_try_malloc(sizeof(struct sr_datafeed_logic_rle)
+			+ counts_size + rle->num_runs * rle->unitsize))) {
+		sr_err("%s: copy malloc failed", __func__);
+		return NULL;
+	}
+
+	*copy = *rle;
+	copy->counts = (uint64_t *)(copy + 1);
+	copy->values = (uint8_t *)copy->counts + counts_size;
+	memcpy(copy->counts, rle->counts, counts_size);
+	memcpy(copy->values, rle->values, rle->num_runs * rle->unitsize);
+
+	return copy;
+}
+
+/**
+ * Expand run-length encoded logic data into plain samples.
+ *
+ * The position in the runs is kept in run and offset (the number of
+ * samples of that run already expanded), both of which start at 0. Call
+ * this repeatedly to expand the data in pieces of a bounded size.
+ *
+ * @param rle The payload to expand. Must not be NULL.
+ * @param run The run to continue with, updated on return.
+ * @param offset The number of samples of that run which were already
+ *               expanded, updated on return.
+ * @param buf Where to put the samples, room for max_samples of them.
+ * @param max_samples The number of samples to expand at most.
+ *
+ * @return The number of samples put in buf, 0 once all runs are done.
+ *
+ * @private
+ */
+SR_PRIV uint64_t sr_logic_rle_expand(const struct sr_datafeed_logic_rle *rle,
+		uint64_t *run, uint64_t *offset, void *buf, uint64_t max_samples)
+{
+	const uint8_t *value;
+	uint8_t *out;
+	uint64_t done, n, i;
+
+	out = buf;
+	done = 0;
+	while (*run < rle->num_runs && done < max_samples) {
+		n = MIN(rle->counts[*run] - *offset, max_samples - done);
+		value = (const uint8_t *)rle->values + *run * rle->unitsize;
+		if (rle->unitsize == 1) {
+			memset(out, *value, n);
+			out += n;
+		} else {
+			for (i = 0; i < n; i++, out += rle->unitsize)
+				memcpy(out, value, rle->unitsize);
+		}
+		done += n;
+		if ((*offset += n) == rle->counts[*run]) {
+			(*run)++;
+			*offset = 0;
+		}
+	}
+
+	return done;
+}
+
+/* Copy an edges payload into a single allocation. */
+static struct sr_datafeed_logic_edges *logic_edges_copy(
+		const struct sr_datafeed_logic_edges *edges)
+{
+	struct sr_datafeed_logic_edges *copy;
+	size_t timestamps_size;
+
+	timestamps_size = edges->num_edges * sizeof(uint64_t);
+	if (!(copy = g_try_malloc(sizeof(struct sr_datafeed_logic_edges)
+			+ timestamps_size + edges->num_edges * edges->unitsize))) {
+		sr_err("%s: copy malloc failed", __func__);
+		return NULL;
+	}
+
+	*copy = *edges;
+	copy->timestamps = (uint64_t *)(copy + 1);
+	copy->values = (uint8_t *)copy->timestamps + timestamps_size;
+	memcpy(copy->timestamps, edges->timestamps, timestamps_size);
+	memcpy(copy->values, edges->values, edges->num_edges * edges->unitsize);
+
+	return copy;
+}
+
+/**
+ * Create a converter from logic packets to SR_DF_LOGIC_EDGES payloads.
+ *
+ * @return The converter, to be freed with sr_edge_conv_free(), or NULL
+ *         upon memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV struct sr_edge_conv *sr_edge_conv_new(void)
+{
+	struct sr_edge_conv *conv;
+
+	if (!(conv = g_try_malloc0(sizeof(struct sr_edge_conv))))
+		sr_err("%s: conv malloc failed", __func__);
+
+	return conv;
+}
+
+/**
+ * Free a converter made with sr_edge_conv_new().
+ *
+ * @param conv The converter. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_edge_conv_free(struct sr_edge_conv *conv)
+{
+	g_free(conv->last);
+	g_free(conv->edges.timestamps);
+	g_free(conv->edges.values);
+	g_free(conv);
+}
+
+/**
+ * Start over with a converter, for a new acquisition.
+ *
+ * The next sample is sample number 0 again, and always makes an edge.
+ *
+ * @param conv The converter. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_edge_conv_reset(struct sr_edge_conv *conv)
+{
+	conv->sample = 0;
+}
+
+/* Get ready for data of the given unitsize. */
+static int edge_conv_begin(struct sr_edge_conv *conv, uint16_t unitsize)
+{
+	if (unitsize == conv->unitsize)
+		return SR_OK;
+
+	/* The arrays are sized for the unitsize, start over. */
+	g_free(conv->last);
+	g_free(conv->edges.timestamps);
+	g_free(conv->edges.values);
+	conv->edges.timestamps = NULL;
+	conv->edges.values = NULL;
+	conv->size = 0;
+	conv->sample = 0;
+	conv->unitsize = 0;
+
+	if (!(conv->last = g_try_malloc(unitsize))) {
+		sr_err("%s: last malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	conv->unitsize = unitsize;
+
+	return SR_OK;
+}
+
+/* Append an edge to the payload, making room for it if needed. */
+static int edge_conv_add(struct sr_edge_conv *conv, uint64_t sample,
+		const uint8_t *value)
+{
+	struct sr_datafeed_logic_edges *edges;
+	uint64_t *timestamps;
+	uint8_t *values;
+	uint64_t size;
+
+	edges = &conv->edges;
+	if (edges->num_edges == conv->size) {
+		size = conv->size ? conv->size * 2 : 256;
+		if (!(timestamps = g_try_realloc(edges->timestamps,
+				size * sizeof(uint64_t)))) {
+			sr_err("%s: timestamps malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		edges->timestamps = timestamps;
+		if (!(values = g_try_realloc(edges->values,
+				size * conv->unitsize))) {
+			sr_err("%s: values malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		edges->values = values;
+		conv->size = size;
+	}
+
+	edges->timestamps[edges->num_edges] = sample;
+	memcpy((uint8_t *)edges->values + edges->num_edges * conv->unitsize,
+			value, conv->unitsize);
+	edges->num_edges++;
+
+	return SR_OK;
+}
+
+/**
+ * Find the transitions in a logic payload.
+ *
+ * @param conv The converter, which keeps track of the sample numbers and
+ *             the last value across packets. Must not be NULL.
+ * @param logic The payload. Must not be NULL.
+ *
+ * @return The edges payload, valid until the next call with this
+ *         converter, or NULL upon memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV const struct sr_datafeed_logic_edges *sr_edge_conv_logic(
+		struct sr_edge_conv *conv, const struct sr_datafeed_logic *logic)
+{
+	const uint8_t *p, *prev;
+	uint64_t num_samples, i;
+	uint16_t unitsize;
+
+	unitsize = logic->unitsize;
+	if (edge_conv_begin(conv, unitsize) != SR_OK)
+		return NULL;
+
+	num_samples = logic->length / unitsize;
+	conv->edges.start = conv->sample;
+	conv->edges.num_samples = num_samples;
+	conv->edges.num_edges = 0;
+	conv->edges.unitsize = unitsize;
+
+	p = logic->data;
+	prev = conv->sample ? conv->last : NULL;
+	for (i = 0; i < num_samples; i++, prev = p, p += unitsize) {
+		if (prev && (unitsize == 1 ? *prev == *p
+		    : !memcmp(prev, p, unitsize)))
+			continue;
+		if (edge_conv_add(conv, conv->sample + i, p) != SR_OK)
+			return NULL;
+	}
+
+	if (num_samples)
+		memcpy(conv->last, prev, unitsize);
+	conv->sample += num_samples;
+
+	return &conv->edges;
+}
+
+/**
+ * Find the transitions in an RLE payload.
+ *
+ * @param conv The converter, which keeps track of the sample numbers and
+ *             the last value across packets. Must not be NULL.
+ * @param rle The payload. Must not be NULL.
+ *
+ * @return The edges payload, valid until the next call with this
+ *         converter, or NULL upon memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV const struct sr_datafeed_logic_edges *sr_edge_conv_rle(
+		struct sr_edge_conv *conv,
+		const struct sr_datafeed_logic_rle *rle)
+{
+	const uint8_t *value, *prev;
+	uint64_t sample, i;
+	uint16_t unitsize;
+
+	unitsize = rle->unitsize;
+	if (edge_conv_begin(conv, unitsize) != SR_OK)
+		return NULL;
+
+	conv->edges.start = conv->sample;
+	conv->edges.num_samples = rle->num_samples;
+	conv->edges.num_edges = 0;
+	conv->edges.unitsize = unitsize;
+
+	sample = conv->sample;
+	value = rle->values;
+	prev = sample ? conv->last : NULL;
+	for (i = 0; i < rle->num_runs; i++, prev = value, value += unitsize) {
+		if (!prev || memcmp(prev, value, unitsize))
+			if (edge_conv_add(conv, sample, value) != SR_OK)
+				return NULL;
+		sample += rle->counts[i];
+	}
+
+	if (rle->num_runs)
+		memcpy(conv->last, prev, unitsize);
+	conv->sample = sample;
+
+	return &conv->edges;
+}
+
+/*
+ * Copy a raw analog payload into a single allocation, apart from the
+ * probes list.
+ */
+static struct sr_datafeed_analog_raw *analog_raw_copy(
+		const struct sr_datafeed_analog_raw *raw)
+{
+	struct sr_datafeed_analog_raw *copy;
+	size_t scale_size, data_size;
+	unsigned int num_probes;
+
+	num_probes = g_slist_length(raw->probes);
+	scale_size = num_probes * sizeof(float);
+	data_size = (size_t)raw->num_samples * num_probes
+			* sr_analog_encoding_size(raw->encoding);
+	if (!(copy = g_try_malloc(sizeof(struct sr_datafeed_analog_raw)
+			+ 2 * scale_size + data_size))) {
+		sr_err("%s: copy malloc failed", __func__);
+		return NULL;
+	}
+
+	*copy = *raw;
+	copy->probes = g_slist_copy(raw->probes);
+	copy->scale = (float *)(copy + 1);
+	copy->offset = copy->scale + num_probes;
+	copy->data = copy->offset + num_probes;
+	memcpy(copy->scale, raw->scale, scale_size);
+	memcpy(copy->offset, raw->offset, scale_size);
+	memcpy(copy->data, raw->data, data_size);
+
+	return copy;
+}
+
+/* Copy a statistics payload into one allocation, apart from the probes. */
+static struct sr_datafeed_analog_stats *analog_stats_copy(
+		const struct sr_datafeed_analog_stats *stats)
+{
+	struct sr_datafeed_analog_stats *copy;
+	size_t size;
+
+	size = g_slist_length(stats->probes) * sizeof(struct sr_analog_stats);
+	if (!(copy = g_try_malloc(sizeof(struct sr_datafeed_analog_stats)
+			+ 2 * size))) {
+		sr_err("%s: copy malloc failed", __func__);
+		return NULL;
+	}
+
+	*copy = *stats;
+	copy->probes = g_slist_copy(stats->probes);
+	copy->window = (struct sr_analog_stats *)(copy + 1);
+	copy->total = (struct sr_analog_stats *)((uint8_t *)copy->window
+			+ size);
+	memcpy(copy->window, stats->window, size);
+	memcpy(copy->total, stats->total, size);
+
+	return copy;
+}
+
+/* The same, for logic statistics. */
+static struct sr_datafeed_logic_stats *logic_stats_copy(
+		const struct sr_datafeed_logic_stats *stats)
+{
+	struct sr_datafeed_logic_stats *copy;
+	size_t size;
+
+	size = stats->unitsize * 8 * sizeof(struct sr_logic_stats);
+	if (!(copy = g_try_malloc(sizeof(struct sr_datafeed_logic_stats)
+			+ 2 * size))) {
+		sr_err("%s: copy malloc failed", __func__);
+		return NULL;
+	}
+
+	*copy = *stats;
+	copy->window = (struct sr_logic_stats *)(copy + 1);
+	copy->total = (struct sr_logic_stats *)((uint8_t *)copy->window
+			+ size);
+	memcpy(copy->window, stats->window, size);
+	memcpy(copy->total, stats->total, size);
+
+	return copy;
+}
+
+static void config_free(gpointer data)
+{
+	struct sr_config *src;
+
+	src = data;
+	g_variant_unref(src->data);
+	g_free(src);
+}
+
+/**
+ * Make a copy of a datafeed packet which outlives the datafeed callback.
+ *
+ * Logic and analog payloads are retained with sr_datafeed_logic_ref() and
+ * sr_datafeed_analog_ref(), so they share the driver's buffer if possible.
+ * Header, meta, RLE, edges, raw analog and statistics payloads are
+ * copied.
+ *
+ * @param packet The packet to copy. Must not be NULL.
+ *
+ * @return A newly allocated packet, to be freed with sr_packet_free(),
+ *         or NULL upon errors.
+ *
+ * @private
+ */
+SR_PRIV struct sr_datafeed_packet *sr_packet_copy(
+		const struct sr_datafeed_packet *packet)
+{
+	struct sr_datafeed_packet *copy;
+	struct sr_datafeed_header *header;
+	const struct sr_datafeed_meta *meta;
+	struct sr_datafeed_meta *meta_copy;
+	struct sr_config *src, *src_copy;
+	GSList *l;
+
+	if (!(copy = g_try_malloc(sizeof(struct sr_datafeed_packet)))) {
+		sr_err("%s: packet malloc failed", __func__);
+		return NULL;
+	}
+
+	copy->type = packet->type;
+	copy->payload = NULL;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		if (!(header = g_try_malloc(sizeof(struct sr_datafeed_header))))
+			break;
+		*header = *(const struct sr_datafeed_header *)packet->payload;
+		copy->payload = header;
+		break;
+	case SR_DF_META:
+		if (!(meta_copy = g_try_malloc0(sizeof(struct sr_datafeed_meta))))
+			break;
+		meta = packet->payload;
+		for (l = meta->config; l; l = l->next) {
+			src = l->data;
+			if (!(src_copy = g_try_malloc(sizeof(struct sr_config)))) {
+				g_slist_free_full(meta_copy->config, config_free);
+				g_free(meta_copy);
+				meta_copy = NULL;
+				break;
+			}
+			src_copy->key = src->key;
+			src_copy->data = g_variant_ref(src->data);
+			meta_copy->config = g_slist_append(meta_copy->config,
+					src_copy);
+		}
+		copy->payload = meta_copy;
+		break;
+	case SR_DF_LOGIC:
+		copy->payload = sr_datafeed_logic_ref(packet->payload);
+		break;
+	case SR_DF_ANALOG:
+		copy->payload = sr_datafeed_analog_ref(packet->payload);
+		break;
+	case SR_DF_LOGIC_RLE:
+		copy->payload = logic_rle_copy(packet->payload);
+		break;
+	case SR_DF_LOGIC_EDGES:
+		copy->payload = logic_edges_copy(packet->payload);
+		break;
+	case SR_DF_ANALOG_RAW:
+		copy->payload = analog_raw_copy(packet->payload);
+		break;
+	case SR_DF_ANALOG_STATS:
+		copy->payload = analog_stats_copy(packet->payload);
+		break;
+	case SR_DF_LOGIC_STATS:
+		copy->payload = logic_stats_copy(packet->payload);
+		break;
+	default:
+		/* No payload. */
+		return copy;
+	}
+
+	if (!copy->payload) {
+		sr_err("%s: payload copy failed", __func__);
+		g_free(copy);
+		return NULL;
+	}
+
+	return copy;
+}
+
+/**
+ * Free a packet made with sr_packet_copy().
+ *
+ * @param packet The packet to free. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_packet_free(struct sr_datafeed_packet *packet)
+{
+	struct sr_datafeed_meta *meta;
+	struct sr_datafeed_analog_raw *raw;
+	struct sr_datafeed_analog_stats *stats;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+	case SR_DF_LOGIC_RLE:
+	case SR_DF_LOGIC_EDGES:
+	case SR_DF_LOGIC_STATS:
+		g_free((void *)packet->payload);
+		break;
+	case SR_DF_META:
+		meta = (struct sr_datafeed_meta *)packet->payload;
+		g_slist_free_full(meta->config, config_free);
+		g_free(meta);
+		break;
+	case SR_DF_LOGIC:
+		sr_datafeed_logic_unref((struct sr_datafeed_logic *)packet->payload);
+		break;
+	case SR_DF_ANALOG:
+		sr_datafeed_analog_unref((struct sr_datafeed_analog *)packet->payload);
+		break;
+	case SR_DF_ANALOG_RAW:
+		raw = (struct sr_datafeed_analog_raw *)packet->payload;
+		g_slist_free(raw->probes);
+		g_free(raw);
+		break;
+	case SR_DF_ANALOG_STATS:
+		stats = (struct sr_datafeed_analog_stats *)packet->payload;
+		g_slist_free(stats->probes);
+		g_free(stats);
+		break;
+	}
+
+	g_free(packet);
+}
+
+/**
+ * Get the buffer backing the payload of a packet made with sr_packet_copy().
+ *
+ * @param packet The packet. Must not be NULL.
+ *
+ * @return The buffer, or NULL if the packet has no sample data.
+ *
+ * @private
+ */
+SR_PRIV struct sr_buffer *sr_packet_buffer_get(
+		const struct sr_datafeed_packet *packet)
+{
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		return ((const struct logic_ref *)packet->payload)->buffer;
+	case SR_DF_ANALOG:
+		return ((const struct analog_ref *)packet->payload)->buffer;
+	default:
+		return NULL;
+	}
+}
+
+/**
+ * Get the number of samples a packet carries.
+ *
+ * @param packet The packet. Must not be NULL.
+ *
+ * @return The number of logic or analog samples, 0 for packets without.
+ *
+ * @private
+ */
+SR_PRIV uint64_t sr_packet_samples(const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_logic *logic;
+
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		return logic->unitsize ? logic->length / logic->unitsize : 0;
+	case SR_DF_LOGIC_RLE:
+		return ((const struct sr_datafeed_logic_rle *)
+				packet->payload)->num_samples;
+	case SR_DF_LOGIC_EDGES:
+		return ((const struct sr_datafeed_logic_edges *)
+				packet->payload)->num_samples;
+	case SR_DF_ANALOG:
+		return ((const struct sr_datafeed_analog *)
+				packet->payload)->num_samples;
+	case SR_DF_ANALOG_RAW:
+		return ((const struct sr_datafeed_analog_raw *)
+				packet->payload)->num_samples;
+	default:
+		return 0;
+	}
+}
+
+/** @} */
@@ -18,6 +18,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <glib.h>
 #include "config.h" /* Needed for HAVE_LIBUSB_1_0 and others. */
 #include "libsigrok.h"
@@ -26,11 +27,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "device: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 /**
  * @file
@@ -38,6 +39,14 @@
  * Device handling in libsigrok.
  */
 
+/* The most devices sr_dev_open_all() opens at the same time. */
+#define OPEN_THREADS 16
+
+struct open_job {
+	struct sr_dev_inst *sdi;
+	int ret;
+};
+
 /**
  * @defgroup grp_devices Devices
  *
@@ -66,6 +75,146 @@ SR_PRIV struct sr_probe *sr_probe_new(int index, int type,
 	return probe;
 }
 
+static void probe_table_clear(struct sr_probe_table *table)
+{
+	g_free(table->probes);
+	g_free(table->enabled);
+	g_free(table->enabled_mask);
+	table->probes = NULL;
+	table->enabled = NULL;
+	table->enabled_mask = NULL;
+	table->num_probes = table->num_enabled = table->num_words = 0;
+}
+
+static int probe_table_build(struct sr_probe_table *table, GSList *probes)
+{
+	struct sr_probe *probe;
+	GSList *l;
+	int num_probes;
+
+	probe_table_clear(table);
+
+	num_probes = 0;
+	for (l = probes; l; l = l->next) {
+		probe = l->data;
+		if (probe->index >= num_probes)
+			num_probes = probe->index + 1;
+	}
+
+	table->num_words = (num_probes + 63) / 64;
+	table->probes = g_try_new0(struct sr_probe *, MAX(num_probes, 1));
+	table->enabled = g_try_new(int, MAX(num_probes, 1));
+	table->enabled_mask = g_try_new0(uint64_t, MAX(table->num_words, 1));
+	if (!table->probes || !table->enabled || !table->enabled_mask) {
+		sr_err("%s: probe table malloc failed", __func__);
+		probe_table_clear(table);
+		return SR_ERR_MALLOC;
+	}
+	table->num_probes = num_probes;
+
+	for (l = probes; l; l = l->next) {
+		probe = l->data;
+		if (probe->index >= 0)
+			table->probes[probe->index] = probe;
+	}
+	table->probes_stale = FALSE;
+	table->enabled_stale = TRUE;
+
+	return SR_OK;
+}
+
+static void probe_table_enabled_update(struct sr_probe_table *table)
+{
+	struct sr_probe *probe;
+	int i;
+
+	memset(table->enabled_mask, 0, table->num_words * sizeof(uint64_t));
+	table->num_enabled = 0;
+	for (i = 0; i < table->num_probes; i++) {
+		if (!(probe = table->probes[i]) || !probe->enabled)
+			continue;
+		table->enabled[table->num_enabled++] = i;
+		table->enabled_mask[i / 64] |= (uint64_t)1 << (i % 64);
+	}
+	table->enabled_stale = FALSE;
+}
+
+/**
+ * Get the table of a device's probes by index, for code which looks up
+ * probes over and over.
+ *
+ * The table is built from sdi->probes the first time, and kept up to date
+ * with probes being enabled or disabled through sr_dev_probe_enable().
+ * Code which adds probes to sdi->probes after that must call
+ * sr_dev_probe_table_invalidate().
+ *
+ * @param sdi The device instance. Must not be NULL.
+ *
+ * @return The table, owned by the device instance, or NULL upon memory
+ *         allocation errors. It stays valid until the probes change.
+ *
+ * @private
+ */
+SR_PRIV const struct sr_probe_table *sr_dev_probe_table_get(
+		const struct sr_dev_inst *sdi)
+{
+	struct sr_probe_table *table;
+
+	if (!(table = sdi->probe_table)) {
+		if (!(table = g_try_malloc0(sizeof(struct sr_probe_table)))) {
+			sr_err("%s: table malloc failed", __func__);
+			return NULL;
+		}
+		table->probes_stale = TRUE;
+		((struct sr_dev_inst *)sdi)->probe_table = table;
+	}
+
+	if (table->probes_stale
+	    && probe_table_build(table, sdi->probes) != SR_OK)
+		return NULL;
+	if (table->enabled_stale)
+		probe_table_enabled_update(table);
+
+	return table;
+}
+
+/**
+ * Have a device's probe table rebuilt from sdi->probes the next time it
+ * is used.
+ *
+ * @param sdi The device instance. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_dev_probe_table_invalidate(const struct sr_dev_inst *sdi)
+{
+	if (sdi->probe_table)
+		sdi->probe_table->probes_stale = TRUE;
+}
+
+/**
+ * Get a device's probe by its index.
+ *
+ * @param sdi The device instance. Must not be NULL.
+ * @param probenum The probe number, starting from 0.
+ *
+ * @return The probe, or NULL if the device has no such probe.
+ *
+ * @private
+ */
+SR_PRIV struct sr_probe *sr_dev_probe_get(const struct sr_dev_inst *sdi,
+		int probenum)
+{
+	const struct sr_probe_table *table;
+
+	if (!(table = sr_dev_probe_table_get(sdi)))
+		return NULL;
+	if (probenum < 0 || probenum >= table->num_probes)
+		return NULL;
+
+	return table->probes[probenum];
+}
+
 /**
  * Set the name of the specified probe in the specified device.
  *
@@ -85,27 +234,20 @@ SR_PRIV struct sr_probe *sr_probe_new(int index, int type,
 SR_API int sr_dev_probe_name_set(const struct sr_dev_inst *sdi,
 		int probenum, const char *name)
 {
-	GSList *l;
 	struct sr_probe *probe;
-	int ret;
 
 	if (!sdi) {
 		sr_err("%s: sdi was NULL", __func__);
 		return SR_ERR_ARG;
 	}
 
-	ret = SR_ERR_ARG;
-	for (l = sdi->probes; l; l = l->next) {
-		probe = l->data;
-		if (probe->index == probenum) {
-			g_free(probe->name);
-			probe->name = g_strdup(name);
-			ret = SR_OK;
-			break;
-		}
-	}
+	if (!(probe = sr_dev_probe_get(sdi, probenum)))
+		return SR_ERR_ARG;
 
-	return ret;
+	g_free(probe->name);
+	probe->name = g_strdup(name);
+
+	return SR_OK;
 }
 
 /**
@@ -122,24 +264,18 @@ SR_API int sr_dev_probe_name_set(const struct sr_dev_inst *sdi,
 SR_API int sr_dev_probe_enable(const struct sr_dev_inst *sdi, int probenum,
 		gboolean state)
 {
-	GSList *l;
 	struct sr_probe *probe;
-	int ret;
 
 	if (!sdi)
 		return SR_ERR_ARG;
 
-	ret = SR_ERR_ARG;
-	for (l = sdi->probes; l; l = l->next) {
-		probe = l->data;
-		if (probe->index == probenum) {
-			probe->enabled = state;
-			ret = SR_OK;
-			break;
-		}
-	}
+	if (!(probe = sr_dev_probe_get(sdi, probenum)))
+		return SR_ERR_ARG;
 
-	return ret;
+	probe->enabled = state;
+	sdi->probe_table->enabled_stale = TRUE;
+
+	return SR_OK;
 }
 
 /**
@@ -159,26 +295,19 @@ SR_API int sr_dev_probe_enable(const struct sr_dev_inst *sdi, int probenum,
 SR_API int sr_dev_trigger_set(const struct sr_dev_inst *sdi, int probenum,
 		const char *trigger)
 {
-	GSList *l;
 	struct sr_probe *probe;
-	int ret;
 
 	if (!sdi)
 		return SR_ERR_ARG;
 
-	ret = SR_ERR_ARG;
-	for (l = sdi->probes; l; l = l->next) {
-		probe = l->data;
-		if (probe->index == probenum) {
-			/* If the probe already has a trigger, kill it first. */
-			g_free(probe->trigger);
-			probe->trigger = g_strdup(trigger);
-			ret = SR_OK;
-			break;
-		}
-	}
+	if (!(probe = sr_dev_probe_get(sdi, probenum)))
+		return SR_ERR_ARG;
 
-	return ret;
+	/* If the probe already has a trigger, kill it first. */
+	g_free(probe->trigger);
+	probe->trigger = g_strdup(trigger);
+
+	return SR_OK;
 }
 
 /**
@@ -247,6 +376,12 @@ SR_PRIV struct sr_dev_inst *sr_dev_inst_new(int index, int status,
 	sdi->probe_groups = NULL;
 	sdi->conn = NULL;
 	sdi->priv = NULL;
+	sdi->session = NULL;
+	sdi->config_cache = NULL;
+	sdi->probe_table = NULL;
+	sdi->keep_open = sdi->held_open = FALSE;
+	sdi->limit_samples = sdi->limit_msec = 0;
+	sdi->mem_used = sdi->mem_peak = sdi->mem_limit = 0;
 
 	return sdi;
 }
@@ -271,6 +406,11 @@ SR_PRIV void sr_dev_inst_free(struct sr_dev_inst *sdi)
 	g_free(sdi->vendor);
 	g_free(sdi->model);
 	g_free(sdi->version);
+	sr_config_cache_free(sdi);
+	if (sdi->probe_table) {
+		probe_table_clear(sdi->probe_table);
+		g_free(sdi->probe_table);
+	}
 	g_free(sdi);
 }
 
@@ -348,6 +488,7 @@ SR_PRIV void sr_serial_dev_inst_free(struct sr_serial_dev_inst *serial)
 {
 	g_free(serial->port);
 	g_free(serial->serialcomm);
+	g_free(serial->rx_buf);
 	g_free(serial);
 }
 #endif
@@ -374,6 +515,11 @@ SR_PRIV struct sr_usbtmc_dev_inst *sr_usbtmc_dev_inst_new(const char *device)
 
 SR_PRIV void sr_usbtmc_dev_inst_free(struct sr_usbtmc_dev_inst *usbtmc)
 {
+#ifdef HAVE_LIBUSB_1_0
+	if (usbtmc->usb)
+		sr_usb_dev_inst_free(usbtmc->usb);
+	g_free(usbtmc->rx_buf);
+#endif
 	g_free(usbtmc->device);
 	g_free(usbtmc);
 }
@@ -429,11 +575,112 @@ SR_API int sr_dev_open(struct sr_dev_inst *sdi)
 	if (!sdi || !sdi->driver || !sdi->driver->dev_open)
 		return SR_ERR;
 
+	sr_config_cache_clear(sdi);
+
+	if (sdi->held_open) {
+		sdi->held_open = FALSE;
+		if (!sdi->driver->dev_check
+		    || sdi->driver->dev_check(sdi) == SR_OK) {
+			sr_dbg("Reusing device left open.");
+			return SR_OK;
+		}
+		sr_info("Device left open failed its check, reopening it.");
+		sdi->driver->dev_close(sdi);
+	}
+
 	ret = sdi->driver->dev_open(sdi);
 
 	return ret;
 }
 
+static void open_job_run(gpointer data, gpointer user_data)
+{
+	struct open_job *job;
+
+	job = data;
+	job->ret = sr_dev_open(job->sdi);
+	g_async_queue_push(user_data, job);
+}
+
+/**
+ * Open several devices at the same time.
+ *
+ * Each device is opened as with sr_dev_open(), but in a thread of its own
+ * (up to 16 at a time). Devices that wait for a firmware upload to take
+ * effect then wait together, and a whole rack of them is brought up in
+ * about the time it takes to open one.
+ *
+ * The callback is called as each device is done, in any order, from the
+ * thread which called this function. It is never called from another
+ * thread.
+ *
+ * @param devices A GSList of struct sr_dev_inst * to open.
+ * @param cb Function to call with each device and the result of opening
+ *           it. May be NULL.
+ * @param cb_data Opaque pointer passed to the callback.
+ *
+ * @return SR_OK if all devices were opened, the error of the first one to
+ *         fail otherwise. SR_ERR_MALLOC upon memory allocation
+ *         errors, or SR_ERR if the threads could not be started, in
+ *         which case no device is opened.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_dev_open_all(GSList *devices, sr_dev_open_callback_t cb,
+		void *cb_data)
+{
+	struct open_job *jobs, *job;
+	GThreadPool *pool;
+	GAsyncQueue *done;
+	GError *error;
+	GSList *l;
+	int num_devices, ret, i;
+
+	if (!(num_devices = g_slist_length(devices)))
+		return SR_OK;
+
+	if (!(jobs = g_try_new0(struct open_job, num_devices))) {
+		sr_err("%s: jobs malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	done = g_async_queue_new();
+	error = NULL;
+	if (!(pool = g_thread_pool_new(open_job_run, done,
+			MIN(num_devices, OPEN_THREADS), TRUE, &error))) {
+		sr_err("Failed to start the open threads: %s.",
+		       error->message);
+		g_error_free(error);
+		g_async_queue_unref(done);
+		g_free(jobs);
+		return SR_ERR;
+	}
+
+	for (l = devices, i = 0; l; l = l->next, i++) {
+		jobs[i].sdi = l->data;
+		g_thread_pool_push(pool, &jobs[i], NULL);
+	}
+
+	ret = SR_OK;
+	for (i = 0; i < num_devices; i++) {
+		job = g_async_queue_pop(done);
+		if (job->ret != SR_OK) {
+			sr_err("Failed to open device %d: %d.",
+			       (int)(job - jobs), job->ret);
+			if (ret == SR_OK)
+				ret = job->ret;
+		}
+		if (cb)
+			cb(job->sdi, job->ret, cb_data);
+	}
+
+	g_thread_pool_free(pool, FALSE, TRUE);
+	g_async_queue_unref(done);
+	g_free(jobs);
+
+	return ret;
+}
+
 /**
  * Close the specified device.
  *
@@ -450,9 +697,53 @@ SR_API int sr_dev_close(struct sr_dev_inst *sdi)
 	if (!sdi || !sdi->driver || !sdi->driver->dev_close)
 		return SR_ERR;
 
+	sr_config_cache_clear(sdi);
+
+	if (sdi->keep_open && sdi->status == SR_ST_ACTIVE) {
+		sdi->held_open = TRUE;
+		return SR_OK;
+	}
+
 	ret = sdi->driver->dev_close(sdi);
 
 	return ret;
 }
 
+/**
+ * Keep a device open between sessions.
+ *
+ * With this set, sr_dev_close() leaves the device open, with its
+ * firmware, FPGA configuration and calibration as they are. The next
+ * sr_dev_open() then only runs the driver's quick check that the device
+ * is still there and set up, and opens it from scratch if it isn't.
+ * This makes for much faster setup of many short acquisitions in turn.
+ *
+ * The device is closed for good when this is turned off again, or
+ * when the driver's devices are cleared.
+ *
+ * @param sdi Device instance to use. Must not be NULL.
+ * @param keep TRUE to keep the device open, FALSE to have
+ *             sr_dev_close() close it as usual.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or the
+ *         driver's error closing a device it had left open.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_dev_keep_open(struct sr_dev_inst *sdi, gboolean keep)
+{
+	if (!sdi || !sdi->driver || !sdi->driver->dev_close) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	sdi->keep_open = keep;
+	if (!keep && sdi->held_open) {
+		sdi->held_open = FALSE;
+		return sdi->driver->dev_close(sdi);
+	}
+
+	return SR_OK;
+}
+
 /** @} */
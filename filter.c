@@ -24,14 +24,20 @@
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
+/* PEXT kernels, built whatever the compiler flags; PEXT is 64 bit only. */
+#if defined(SR_CPU_DISPATCH_X86) && defined(__x86_64__)
+#include <immintrin.h>
+#define FILTER_PEXT
+#endif
+
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "filter: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 /**
  * @file
@@ -83,10 +89,12 @@
  * @param probe_array Pointer to a list of probe numbers, numbered starting
  *                    from 0. The list is terminated with -1.
  * @param data_in Pointer to the input data buffer. Must not be NULL.
- * @param length_in The input data length (>= 1), in number of bytes.
+ * @param length_in The input data length (>= 1), in number of bytes. Must
+ *                  be a multiple of in_unitsize.
  * @param data_out Variable which will point to the newly allocated buffer
  *                 of output data. The caller is responsible for g_free()'ing
  *                 the buffer when it's no longer needed. Must not be NULL.
+ *                 Use sr_filter_probes_buf() to supply the buffer instead.
  * @param length_out Pointer to the variable which will contain the output
  *                   data length (in number of bytes) when the function
  *                   returns SR_OK. Must not be NULL.
@@ -103,10 +111,416 @@ SR_API int sr_filter_probes(unsigned int in_unitsize, unsigned int out_unitsize,
 			    uint64_t length_in, uint8_t **data_out,
 			    uint64_t *length_out)
 {
-	unsigned int in_offset, out_offset;
-	int *probelist, out_bit;
+	int ret;
+
+	if (!data_out) {
+		sr_err("%s: data_out was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (in_unitsize < 1 || out_unitsize < 1) {
+		sr_err("%s: unsupported unit size", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (length_in % in_unitsize) {
+		sr_err("%s: length_in is not a multiple of the unit size",
+		       __func__);
+		return SR_ERR_ARG;
+	}
+
+	/* Wider output samples take more room than the input. */
+	if (!(*data_out = g_try_malloc(MAX((length_in / in_unitsize)
+			* out_unitsize, 1)))) {
+		sr_err("%s: data_out malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	if ((ret = sr_filter_probes_buf(in_unitsize, out_unitsize, probe_array,
+			data_in, length_in, *data_out, length_out)) != SR_OK) {
+		g_free(*data_out);
+		*data_out = NULL;
+	}
+
+	return ret;
+}
+
+/**
+ * Get 64 probes' worth of a logic sample of any width.
+ *
+ * Wide samples are handled as arrays of 64-bit words, with bit n of word
+ * w holding probe w * 64 + n.
+ *
+ * @param sample The sample, unitsize bytes in little-endian order.
+ * @param unitsize The sample's unit size in bytes.
+ * @param word The word to get. Words past the end of the sample read as
+ *             zero, as do the bits of the last one the sample doesn't
+ *             cover.
+ *
+ * @return The word.
+ *
+ * @private
+ */
+SR_PRIV uint64_t sr_sample_word_get(const uint8_t *sample,
+		unsigned int unitsize, unsigned int word)
+{
+	uint64_t bits;
+	unsigned int start, i;
+
+	start = word * 8;
+	if (start + 8 <= unitsize) {
+		memcpy(&bits, sample + start, 8);
+		return GUINT64_FROM_LE(bits);
+	}
+
+	bits = 0;
+	for (i = start; i < unitsize; i++)
+		bits |= (uint64_t)sample[i] << (8 * (i - start));
+
+	return bits;
+}
+
+/**
+ * Set 64 probes' worth of a logic sample of any width.
+ *
+ * @param sample The sample, unitsize bytes in little-endian order.
+ * @param unitsize The sample's unit size in bytes.
+ * @param word The word to set. Bits past the end of the sample are
+ *             dropped.
+ * @param bits The word's new value.
+ *
+ * @private
+ */
+SR_PRIV void sr_sample_word_set(uint8_t *sample, unsigned int unitsize,
+		unsigned int word, uint64_t bits)
+{
+	unsigned int start, i;
+
+	start = word * 8;
+	if (start + 8 <= unitsize) {
+		bits = GUINT64_TO_LE(bits);
+		memcpy(sample + start, &bits, 8);
+		return;
+	}
+
+	for (i = start; i < unitsize; i++, bits >>= 8)
+		sample[i] = bits & 0xff;
+}
+
+/*
+ * Filter samples which don't fit in 64 bits, on the input or the output
+ * side. As in the narrow case, every input byte holding used probes maps
+ * its value to the output bits it contributes, through a table. These
+ * bits can be spread over several output words, so each byte's table
+ * entries hold the words from the first to the last one it touches;
+ * usually that is a single word, and the cost per input byte stays that
+ * of one lookup.
+ */
+static int filter_wide(unsigned int in_unitsize, unsigned int out_unitsize,
+		const int *probelist, unsigned int num_probes,
+		const uint8_t *data_in, uint64_t length_in, uint8_t *data_out,
+		uint64_t *length_out)
+{
+	uint64_t *table, *words, *row, in_offset, out_offset;
+	unsigned int *first_word, *num_words, *offset, *bytes;
+	unsigned int out_words, num_bytes, size, i, b, w;
+	int v, ret;
+
+	out_words = SR_SAMPLE_WORDS(out_unitsize);
+	first_word = g_try_new0(unsigned int, in_unitsize);
+	num_words = g_try_new0(unsigned int, in_unitsize);
+	offset = g_try_new0(unsigned int, in_unitsize);
+	bytes = g_try_new(unsigned int, in_unitsize);
+	words = g_try_new(uint64_t, out_words);
+	table = NULL;
+	if (!first_word || !num_words || !offset || !bytes || !words) {
+		sr_err("%s: table malloc failed", __func__);
+		ret = SR_ERR_MALLOC;
+		goto out;
+	}
+
+	/* The range of output words every input byte contributes to. */
+	for (i = 0; i < num_probes; i++) {
+		b = probelist[i] / 8;
+		w = i / 64;
+		if (!num_words[b]) {
+			first_word[b] = w;
+			num_words[b] = 1;
+		} else if (w < first_word[b]) {
+			num_words[b] += first_word[b] - w;
+			first_word[b] = w;
+		} else if (w >= first_word[b] + num_words[b]) {
+			num_words[b] = w - first_word[b] + 1;
+		}
+	}
+	size = num_bytes = 0;
+	for (b = 0; b < in_unitsize; b++) {
+		if (!num_words[b])
+			continue;
+		bytes[num_bytes++] = b;
+		offset[b] = size;
+		size += 256 * num_words[b];
+	}
+
+	if (!(table = g_try_new0(uint64_t, size))) {
+		sr_err("%s: table malloc failed", __func__);
+		ret = SR_ERR_MALLOC;
+		goto out;
+	}
+	for (i = 0; i < num_probes; i++) {
+		b = probelist[i] / 8;
+		row = table + offset[b] + i / 64 - first_word[b];
+		for (v = 0; v < 256; v++, row += num_words[b])
+			if (v & (1 << (probelist[i] % 8)))
+				*row |= (uint64_t)1 << (i % 64);
+	}
+
+	in_offset = out_offset = 0;
+	while (in_offset + in_unitsize <= length_in) {
+		memset(words, 0, out_words * sizeof(uint64_t));
+		for (i = 0; i < num_bytes; i++) {
+			b = bytes[i];
+			row = table + offset[b]
+				+ data_in[in_offset + b] * num_words[b];
+			for (w = 0; w < num_words[b]; w++)
+				words[first_word[b] + w] |= row[w];
+		}
+		for (w = 0; w < out_words; w++)
+			sr_sample_word_set(data_out + out_offset,
+					out_unitsize, w, words[w]);
+		in_offset += in_unitsize;
+		out_offset += out_unitsize;
+	}
+	*length_out = out_offset;
+	ret = SR_OK;
+
+out:
+	g_free(table);
+	g_free(first_word);
+	g_free(num_words);
+	g_free(offset);
+	g_free(bytes);
+	g_free(words);
+
+	return ret;
+}
+
+/* What the kernels for samples of up to 64 bits work on. */
+struct filter_args {
+	/* Input byte value to output bits, for bytes first..last. */
+	const uint64_t (*table)[256];
+	unsigned int first, last;
+	/* Gather the bits of this mask instead, for the PEXT kernels. */
+	uint64_t mask;
+	const uint8_t *data_in;
+	uint64_t length_in;
+	uint8_t *data_out;
+};
+
+/*
+ * Filter samples of up to 64 bits. This is instantiated below with
+ * constant unit sizes for the common cases, where sample loads and
+ * stores become single moves and the per-byte loop can be unrolled.
+ * Returns the output length.
+ */
+static inline uint64_t filter_narrow(const unsigned int in_unitsize,
+		const unsigned int out_unitsize, const struct filter_args *a)
+{
+	const uint8_t *in;
+	uint8_t *out;
+	uint64_t n, num_samples, sample_out;
 	unsigned int i;
-	uint64_t sample_in, sample_out;
+
+	in = a->data_in;
+	out = a->data_out;
+	num_samples = a->length_in / in_unitsize;
+
+	for (n = 0; n < num_samples; n++) {
+		sample_out = 0;
+		for (i = a->first; i <= a->last; i++)
+			sample_out |= a->table[i][in[i]];
+		sr_sample_store(out, out_unitsize, sample_out);
+		in += in_unitsize;
+		out += out_unitsize;
+	}
+
+	return num_samples * out_unitsize;
+}
+
+#define UNITSIZE_POW2(u) ((u) == 1 || (u) == 2 || (u) == 4 || (u) == 8)
+
+#define FILTER_KERNEL(in, out) \
+static uint64_t filter_##in##_##out(const struct filter_args *a) \
+{ \
+	return filter_narrow(in, out, a); \
+}
+
+FILTER_KERNEL(1, 1) FILTER_KERNEL(1, 2) FILTER_KERNEL(1, 4) FILTER_KERNEL(1, 8)
+FILTER_KERNEL(2, 1) FILTER_KERNEL(2, 2) FILTER_KERNEL(2, 4) FILTER_KERNEL(2, 8)
+FILTER_KERNEL(4, 1) FILTER_KERNEL(4, 2) FILTER_KERNEL(4, 4) FILTER_KERNEL(4, 8)
+FILTER_KERNEL(8, 1) FILTER_KERNEL(8, 2) FILTER_KERNEL(8, 4) FILTER_KERNEL(8, 8)
+
+/* By log2 of the input and the output unit size. */
+static uint64_t (*const filter_kernels[4][4])(const struct filter_args *) = {
+	{ filter_1_1, filter_1_2, filter_1_4, filter_1_8 },
+	{ filter_2_1, filter_2_2, filter_2_4, filter_2_8 },
+	{ filter_4_1, filter_4_2, filter_4_4, filter_4_8 },
+	{ filter_8_1, filter_8_2, filter_8_4, filter_8_8 },
+};
+
+#ifdef FILTER_PEXT
+/*
+ * Filter samples of up to 64 bits with one PEXT per sample, which
+ * gathers exactly the masked bits, in ascending order.
+ */
+__attribute__((target("bmi2")))
+static inline uint64_t filter_pext(const unsigned int in_unitsize,
+		const unsigned int out_unitsize, const struct filter_args *a)
+{
+	const uint8_t *in;
+	uint8_t *out;
+	uint64_t n, num_samples;
+
+	in = a->data_in;
+	out = a->data_out;
+	num_samples = a->length_in / in_unitsize;
+
+	for (n = 0; n < num_samples; n++) {
+		sr_sample_store(out, out_unitsize,
+				_pext_u64(sr_sample_load(in, in_unitsize),
+					  a->mask));
+		in += in_unitsize;
+		out += out_unitsize;
+	}
+
+	return num_samples * out_unitsize;
+}
+
+#define FILTER_PEXT_KERNEL(in, out) \
+__attribute__((target("bmi2"))) \
+static uint64_t filter_pext_##in##_##out(const struct filter_args *a) \
+{ \
+	return filter_pext(in, out, a); \
+}
+
+FILTER_PEXT_KERNEL(1, 1) FILTER_PEXT_KERNEL(1, 2)
+FILTER_PEXT_KERNEL(1, 4) FILTER_PEXT_KERNEL(1, 8)
+FILTER_PEXT_KERNEL(2, 1) FILTER_PEXT_KERNEL(2, 2)
+FILTER_PEXT_KERNEL(2, 4) FILTER_PEXT_KERNEL(2, 8)
+FILTER_PEXT_KERNEL(4, 1) FILTER_PEXT_KERNEL(4, 2)
+FILTER_PEXT_KERNEL(4, 4) FILTER_PEXT_KERNEL(4, 8)
+FILTER_PEXT_KERNEL(8, 1) FILTER_PEXT_KERNEL(8, 2)
+FILTER_PEXT_KERNEL(8, 4) FILTER_PEXT_KERNEL(8, 8)
+
+__attribute__((target("bmi2")))
+static uint64_t filter_pext_any(unsigned int in_unitsize,
+		unsigned int out_unitsize, const struct filter_args *a)
+{
+	return filter_pext(in_unitsize, out_unitsize, a);
+}
+
+static uint64_t (*const filter_pext_kernels[4][4])(
+		const struct filter_args *) = {
+	{ filter_pext_1_1, filter_pext_1_2, filter_pext_1_4, filter_pext_1_8 },
+	{ filter_pext_2_1, filter_pext_2_2, filter_pext_2_4, filter_pext_2_8 },
+	{ filter_pext_4_1, filter_pext_4_2, filter_pext_4_4, filter_pext_4_8 },
+	{ filter_pext_8_1, filter_pext_8_2, filter_pext_8_4, filter_pext_8_8 },
+};
+
+__attribute__((target("bmi2")))
+static uint64_t pack_mask_pext(uint64_t mask, uint64_t packed)
+{
+	return _pext_u64(mask, packed);
+}
+#endif
+
+static uint64_t pack_mask_c(uint64_t mask, uint64_t packed)
+{
+	uint64_t out, bit;
+
+	for (out = 0, bit = 1; packed; packed &= packed - 1, bit <<= 1) {
+		if (mask & packed & -packed)
+			out |= bit;
+	}
+
+	return out;
+}
+
+/* Set by sr_filter_kernels_select(). */
+static gboolean use_pext = FALSE;
+static uint64_t (*pack_mask)(uint64_t mask, uint64_t packed) = pack_mask_c;
+
+/**
+ * Choose the probe filter's kernels for a set of CPU features.
+ *
+ * @param features The SR_CPU_* flags of the features to use.
+ *
+ * @private
+ */
+SR_PRIV void sr_filter_kernels_select(unsigned int features)
+{
+	use_pext = FALSE;
+	pack_mask = pack_mask_c;
+#ifdef FILTER_PEXT
+	if (features & SR_CPU_BMI2) {
+		use_pext = TRUE;
+		pack_mask = pack_mask_pext;
+	}
+#else
+	(void)features;
+#endif
+}
+
+/**
+ * Remove unused probes from samples, into a buffer supplied by the caller.
+ *
+ * This works like sr_filter_probes(), but writes the output to data_out
+ * instead of allocating a new buffer. The output may overwrite the input
+ * (i.e. data_out may be the same as data_in), as long as out_unitsize is
+ * not larger than in_unitsize.
+ *
+ * Each output sample is assembled with one table lookup per input byte
+ * holding any of the probes, rather than bit by bit. Where the CPU has
+ * BMI2 (see sr_cpu_features_get()), the probes are listed in ascending
+ * order and the samples fit in 64 bits, a single PEXT instruction per
+ * sample is used instead.
+ * Samples wider than 64 bits are assembled a 64-bit word at a time.
+ * Unit sizes of 1, 2, 4 and 8 bytes are handled by loops specialized on
+ * them, picked once per call.
+ *
+ * @param in_unitsize The unit size (>= 1) of the input (data_in).
+ * @param out_unitsize The unit size (>= 1) the output shall have (data_out).
+ *                     The requested unit size must be big enough to hold as
+ *                     much data as is specified by the number of enabled
+ *                     probes in 'probelist'.
+ * @param probe_array Pointer to a list of probe numbers, numbered starting
+ *                    from 0. The list is terminated with -1.
+ * @param data_in Pointer to the input data buffer. Must not be NULL.
+ * @param length_in The input data length (>= 1), in number of bytes.
+ * @param data_out Pointer to the output data buffer, which must have room
+ *                 for (length_in / in_unitsize) * out_unitsize bytes, or
+ *                 length_in bytes if all probes are used. Must not be NULL.
+ * @param length_out Pointer to the variable which will contain the output
+ *                   data length (in number of bytes) when the function
+ *                   returns SR_OK. Must not be NULL.
+ *
+ * @return SR_OK upon success, or SR_ERR_ARG upon invalid arguments.
+ *         If something other than SR_OK is returned, the values of
+ *         data_out and length_out are undefined.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_filter_probes_buf(unsigned int in_unitsize,
+		unsigned int out_unitsize, const GArray *probe_array,
+		const uint8_t *data_in, uint64_t length_in, uint8_t *data_out,
+		uint64_t *length_out)
+{
+	struct filter_args a;
+	uint64_t (*table)[256];
+	uint64_t mask;
+	unsigned int i, first, last;
+	int *probelist, b, v;
+	gboolean ascending;
 
 	if (!probe_array) {
 		sr_err("%s: probe_array was NULL", __func__);
@@ -129,6 +543,11 @@ SR_API int sr_filter_probes(unsigned int in_unitsize, unsigned int out_unitsize,
 		return SR_ERR_ARG;
 	}
 
+	if (in_unitsize < 1 || out_unitsize < 1) {
+		sr_err("%s: unsupported unit size", __func__);
+		return SR_ERR_ARG;
+	}
+
 	/* Are there more probes than the target unit size supports? */
 	if (probe_array->len > out_unitsize * 8) {
 		sr_err("%s: too many probes (%d) for the target unit "
@@ -136,35 +555,117 @@ SR_API int sr_filter_probes(unsigned int in_unitsize, unsigned int out_unitsize,
 		return SR_ERR_ARG;
 	}
 
-	if (!(*data_out = g_try_malloc(length_in))) {
-		sr_err("%s: data_out malloc failed", __func__);
-		return SR_ERR_MALLOC;
-	}
-
 	if (probe_array->len == in_unitsize * 8) {
 		/* All probes are used -- no need to compress anything. */
-		memcpy(*data_out, data_in, length_in);
+		if (data_out != data_in)
+			memmove(data_out, data_in, length_in);
 		*length_out = length_in;
 		return SR_OK;
 	}
 
-	/* If we reached this point, not all probes are used, so "compress". */
-	in_offset = out_offset = 0;
-	while (in_offset <= length_in - in_unitsize) {
-		memcpy(&sample_in, data_in + in_offset, in_unitsize);
-		sample_out = out_bit = 0;
-		for (i = 0; i < probe_array->len; i++) {
-			if (sample_in & (1 << (probelist[i])))
-				sample_out |= (1 << out_bit);
-			out_bit++;
+	ascending = TRUE;
+	for (i = 0; i < probe_array->len; i++) {
+		if (probelist[i] < 0 || probelist[i] >= (int)in_unitsize * 8) {
+			sr_err("%s: invalid probe %d", __func__, probelist[i]);
+			return SR_ERR_ARG;
 		}
-		memcpy((*data_out) + out_offset, &sample_out, out_unitsize);
-		in_offset += in_unitsize;
-		out_offset += out_unitsize;
+		if (i > 0 && probelist[i] <= probelist[i - 1])
+			ascending = FALSE;
 	}
-	*length_out = out_offset;
+
+	if (!probe_array->len) {
+		/* No probes at all, every output sample is zero. */
+		*length_out = (length_in / in_unitsize) * out_unitsize;
+		memset(data_out, 0, *length_out);
+		return SR_OK;
+	}
+
+	if (in_unitsize > 8 || out_unitsize > 8)
+		return filter_wide(in_unitsize, out_unitsize, probelist,
+				probe_array->len, data_in, length_in, data_out,
+				length_out);
+
+	mask = 0;
+	for (i = 0; i < probe_array->len; i++)
+		mask |= (uint64_t)1 << probelist[i];
+
+	a.data_in = data_in;
+	a.length_in = length_in;
+	a.data_out = data_out;
+	a.table = NULL;
+	a.mask = mask;
+	table = NULL;
+
+#ifdef FILTER_PEXT
+	if (use_pext && ascending) {
+		if (UNITSIZE_POW2(in_unitsize) && UNITSIZE_POW2(out_unitsize))
+			*length_out = filter_pext_kernels
+					[__builtin_ctz(in_unitsize)]
+					[__builtin_ctz(out_unitsize)](&a);
+		else
+			*length_out = filter_pext_any(in_unitsize,
+					out_unitsize, &a);
+		return SR_OK;
+	}
+#else
+	(void)ascending;
+#endif
+
+	/*
+	 * For every input byte holding used probes, a table maps the byte's
+	 * value to the output bits it contributes.
+	 */
+	if (!(table = g_try_malloc0(in_unitsize * sizeof(*table)))) {
+		sr_err("%s: table malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	for (i = 0; i < probe_array->len; i++) {
+		b = probelist[i] / 8;
+		for (v = 0; v < 256; v++)
+			if (v & (1 << (probelist[i] % 8)))
+				table[b][v] |= (uint64_t)1 << i;
+	}
+	a.table = (const uint64_t (*)[256])table;
+
+	/* Only bytes first..last need to be looked at. */
+	for (first = 0; !(mask & ((uint64_t)0xff << (first * 8)));
+			first++);
+	for (last = in_unitsize - 1;
+			!(mask & ((uint64_t)0xff << (last * 8)));
+			last--);
+	a.first = first;
+	a.last = last;
+
+	if (UNITSIZE_POW2(in_unitsize) && UNITSIZE_POW2(out_unitsize))
+		*length_out = filter_kernels[__builtin_ctz(in_unitsize)]
+				[__builtin_ctz(out_unitsize)](&a);
+	else
+		*length_out = filter_narrow(in_unitsize, out_unitsize, &a);
+
+	g_free(table);
 
 	return SR_OK;
 }
 
+/**
+ * Find the bits of probes in packed logic data.
+ *
+ * Drivers with SR_CONF_PROBE_PACKING send samples which only hold the
+ * probes in the SR_CONF_PACKED_PROBES mask, the lowest of them in bit 0.
+ * This turns a mask of probe indices, such as those of a trigger, into
+ * the mask of the bits with those probes in such samples.
+ *
+ * @param mask Mask of probe indices, bit n for the probe with index n.
+ * @param packed The SR_CONF_PACKED_PROBES of the data.
+ *
+ * @return The mask of the bits holding the probes in mask. Probes which
+ *         aren't in packed have no bits, and are left out.
+ *
+ * @since 0.3.0
+ */
+SR_API uint64_t sr_filter_probes_pack_mask(uint64_t mask, uint64_t packed)
+{
+	return pack_mask(mask, packed);
+}
+
 /** @} */
@@ -23,13 +23,17 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "agilent-dmm: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define AGDMM_BUFSIZE  256
+/* Queries which may wait for a reply at the same time. */
+#define AGDMM_MAX_PENDING  2
+/* How long to wait for a reply before giving up on a query, in ms. */
+#define AGDMM_TIMEOUT  1000
 
 /* Supported models */
 enum {
@@ -61,6 +65,9 @@ struct dev_context {
 	/* Runtime. */
 	uint64_t num_samples;
 	int64_t jobqueue[8];
+	/* Send times of the queries waiting for a reply, oldest first. */
+	int64_t pending_sent_at[AGDMM_MAX_PENDING];
+	int num_pending;
 	unsigned char buf[AGDMM_BUFSIZE];
 	int buflen;
 	int cur_mq;
@@ -73,6 +80,7 @@ struct dev_context {
 };
 
 struct agdmm_job {
+	/* Minimum time between sends in ms, 0 for as often as there's room. */
 	int interval;
 	int (*send) (const struct sr_dev_inst *sdi);
 };
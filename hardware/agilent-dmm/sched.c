@@ -26,6 +26,24 @@
 #include <errno.h>
 #include <math.h>
 
+static int recv_switch(const struct sr_dev_inst *sdi, GMatchInfo *match);
+
+/* The meter answered the oldest query which is waiting for a reply. */
+static void retire(struct dev_context *devc)
+{
+	if (!devc->num_pending)
+		return;
+	devc->num_pending--;
+	memmove(devc->pending_sent_at, devc->pending_sent_at + 1,
+			devc->num_pending * sizeof(int64_t));
+}
+
+/*
+ * The meter answers queries in the order they came in, so the next one
+ * can be sent before the reply to the previous one is in. Up to
+ * AGDMM_MAX_PENDING are kept in flight, which hides the round trip over
+ * the link, and the jobs earlier in the list go first when there's room.
+ */
 static void dispatch(const struct sr_dev_inst *sdi)
 {
 	struct dev_context *devc;
@@ -36,55 +54,64 @@ static void dispatch(const struct sr_dev_inst *sdi)
 	devc = sdi->priv;
 	jobs = devc->profile->jobs;
 	now = g_get_monotonic_time() / 1000;
-	for (i = 0; (&jobs[i])->interval; i++) {
+
+	/* Don't let a lost reply stall the pipeline. */
+	while (devc->num_pending
+	    && now - devc->pending_sent_at[0] > AGDMM_TIMEOUT) {
+		sr_dbg("Query timed out.");
+		retire(devc);
+	}
+
+	for (i = 0; (&jobs[i])->send; i++) {
+		if (devc->num_pending >= AGDMM_MAX_PENDING)
+			break;
 		if (now - devc->jobqueue[i] > (&jobs[i])->interval) {
 			sr_spew("Running job %d.", i);
-			(&jobs[i])->send(sdi);
+			if ((&jobs[i])->send(sdi) == SR_OK)
+				devc->pending_sent_at[devc->num_pending++] =
+					now;
 			devc->jobqueue[i] = now;
 		}
 	}
 }
 
-static void receive_line(const struct sr_dev_inst *sdi)
+static void receive_line(char *line, int len, void *cb_data)
 {
+	const struct sr_dev_inst *sdi;
 	struct dev_context *devc;
 	const struct agdmm_recv *recvs, *recv;
 	GRegex *reg;
 	GMatchInfo *match;
 	int i;
 
+	sdi = cb_data;
 	devc = sdi->priv;
 
-	/* Strip CRLF */
-	while (devc->buflen) {
-		if (*(devc->buf + devc->buflen - 1) == '\r'
-				|| *(devc->buf + devc->buflen - 1) == '\n')
-			*(devc->buf + --devc->buflen) = '\0';
-		else
-			break;
-	}
-	sr_spew("Received '%s'.", devc->buf);
+	/* Strip CR */
+	while (len && line[len - 1] == '\r')
+		line[--len] = '\0';
+	sr_spew("Received '%s'.", line);
 
 	recv = NULL;
 	recvs = devc->profile->recvs;
 	for (i = 0; (&recvs[i])->recv_regex; i++) {
 		reg = g_regex_new((&recvs[i])->recv_regex, 0, 0, NULL);
-		if (g_regex_match(reg, (char *)devc->buf, 0, &match)) {
+		if (g_regex_match(reg, line, 0, &match)) {
 			recv = &recvs[i];
 			break;
 		}
 		g_match_info_unref(match);
 		g_regex_unref(reg);
 	}
+	/* Everything but the switch position is an answer to a query. */
+	if (!recv || recv->recv != recv_switch)
+		retire(devc);
 	if (recv) {
 		recv->recv(sdi, match);
 		g_match_info_unref(match);
 		g_regex_unref(reg);
 	} else
-		sr_dbg("Unknown line '%s'.", devc->buf);
-
-	/* Done with this. */
-	devc->buflen = 0;
+		sr_dbg("Unknown line '%s'.", line);
 }
 
 SR_PRIV int agdmm_receive_data(int fd, int revents, void *cb_data)
@@ -92,7 +119,6 @@ SR_PRIV int agdmm_receive_data(int fd, int revents, void *cb_data)
 	struct sr_dev_inst *sdi;
 	struct dev_context *devc;
 	struct sr_serial_dev_inst *serial;
-	int len;
 
 	(void)fd;
 
@@ -105,18 +131,8 @@ SR_PRIV int agdmm_receive_data(int fd, int revents, void *cb_data)
 	serial = sdi->conn;
 	if (revents == G_IO_IN) {
 		/* Serial data arrived. */
-		while(AGDMM_BUFSIZE - devc->buflen - 1 > 0) {
-			len = serial_read(serial, devc->buf + devc->buflen, 1);
-			if (len < 1)
-				break;
-			devc->buflen += len;
-			*(devc->buf + devc->buflen) = '\0';
-			if (*(devc->buf + devc->buflen - 1) == '\n') {
-				/* End of line */
-				receive_line(sdi);
-				break;
-			}
-		}
+		serial_read_lines(serial, (char *)devc->buf, &devc->buflen,
+				AGDMM_BUFSIZE, '\n', receive_line, sdi);
 	}
 
 	dispatch(sdi);
@@ -442,7 +458,7 @@ static int recv_switch(const struct sr_dev_inst *sdi, GMatchInfo *match)
 SR_PRIV const struct agdmm_job agdmm_jobs_u123x[] = {
 	{ 143, send_stat },
 	{ 1000, send_conf },
-	{ 143, send_fetc },
+	{ 0, send_fetc },
 	{ 0, NULL }
 };
 
@@ -459,7 +475,7 @@ SR_PRIV const struct agdmm_recv agdmm_recvs_u123x[] = {
 SR_PRIV const struct agdmm_job agdmm_jobs_u125x[] = {
 	{ 143, send_stat },
 	{ 1000, send_conf },
-	{ 143, send_fetc },
+	{ 0, send_fetc },
 	{ 0, NULL }
 };
 
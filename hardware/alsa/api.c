@@ -30,6 +30,7 @@
 static const int32_t hwcaps[] = {
 	SR_CONF_SAMPLERATE,
 	SR_CONF_LIMIT_SAMPLES,
+	SR_CONF_BUFFERSIZE,
 	SR_CONF_CONTINUOUS,
 };
 
@@ -140,6 +141,10 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 		devc = sdi->priv;
 		*data = g_variant_new_uint64(devc->cur_samplerate);
 		break;
+	case SR_CONF_BUFFERSIZE:
+		devc = sdi->priv;
+		*data = g_variant_new_uint64(devc->period_size);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -166,6 +171,12 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 	case SR_CONF_LIMIT_SAMPLES:
 		devc->limit_samples = g_variant_get_uint64(data);
 		break;
+	case SR_CONF_BUFFERSIZE:
+		/* The period size, in frames. */
+		if (g_variant_get_uint64(data) == 0)
+			return SR_ERR_ARG;
+		devc->period_size = g_variant_get_uint64(data);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -214,6 +225,7 @@ static int config_list(int key, GVariant **data, const struct sr_dev_inst *sdi,
 static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 {
 	struct dev_context *devc;
+	snd_pcm_uframes_t period_size;
 	int count, ret;
 	char *endianness;
 
@@ -224,9 +236,15 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	devc->cb_data = cb_data;
 	devc->num_samples = 0;
 
-	sr_dbg("Setting audio access type to RW/interleaved.");
+	/* Samples can be sent from the mmap()ed buffer without a copy. */
+	devc->mmap_access = snd_pcm_hw_params_test_access(devc->capture_handle,
+			devc->hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+	sr_dbg("Setting audio access type to %s/interleaved.",
+	       devc->mmap_access ? "mmap" : "RW");
 	ret = snd_pcm_hw_params_set_access(devc->capture_handle,
-			devc->hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
+			devc->hw_params, devc->mmap_access ?
+			SND_PCM_ACCESS_MMAP_INTERLEAVED :
+			SND_PCM_ACCESS_RW_INTERLEAVED);
 	if (ret < 0) {
 		sr_err("Can't set audio access type: %s.", snd_strerror(ret));
 		return SR_ERR;
@@ -263,6 +281,15 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 		return SR_ERR;
 	}
 
+	period_size = devc->period_size;
+	ret = snd_pcm_hw_params_set_period_size_near(devc->capture_handle,
+			devc->hw_params, &period_size, 0);
+	if (ret < 0) {
+		sr_err("Can't set period size: %s.", snd_strerror(ret));
+		return SR_ERR;
+	}
+	sr_dbg("Audio period size is %lu frames.", period_size);
+
 	sr_dbg("Setting audio parameters.");
 	ret = snd_pcm_hw_params(devc->capture_handle, devc->hw_params);
 	if (ret < 0) {
@@ -298,6 +325,14 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 		return SR_ERR;
 	}
 
+	/* Only reads start an RW capture by themselves. */
+	if (devc->mmap_access
+	    && (ret = snd_pcm_start(devc->capture_handle)) < 0) {
+		sr_err("Can't start capture: %s.", snd_strerror(ret));
+		g_free(devc->ufds);
+		return SR_ERR;
+	}
+
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
 
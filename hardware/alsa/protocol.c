@@ -20,6 +20,7 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include <errno.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 #include "protocol.h"
@@ -151,6 +152,7 @@ static void alsa_scan_handle_dev(GSList **devices,
 	devc->hwdev = g_strdup(alsaname);
 	devc->num_probes = channels;
 	devc->hw_params = hw_params;
+	devc->period_size = DEFAULT_PERIOD_SIZE;
 	memcpy(devrates, hwrates, offset * sizeof(uint64_t));
 	devc->samplerates = devrates;
 
@@ -325,15 +327,39 @@ SR_PRIV int alsa_set_samplerate(const struct sr_dev_inst *sdi,
 	return SR_OK;
 }
 
+/* Restart the capture after the ring buffer overran. */
+static int xrun_recover(const struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	int ret;
+
+	devc = sdi->priv;
+	sr_warn("Audio buffer overrun, samples were lost.");
+	sr_session_dev_stats_add(sdi, 1, 0);
+
+	if ((ret = snd_pcm_prepare(devc->capture_handle)) < 0
+	    || (devc->mmap_access
+	    && (ret = snd_pcm_start(devc->capture_handle)) < 0)) {
+		sr_err("Failed to restart capture: %s.", snd_strerror(ret));
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}
+
 SR_PRIV int alsa_receive_data(int fd, int revents, void *cb_data)
 {
 	struct sr_dev_inst *sdi;
 	struct dev_context *devc;
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_analog analog;
-	int16_t inbuf[4096];
-	int i, x, count, offset, samples_to_get;
-	int16_t tmp16;
+	struct sr_datafeed_analog_raw analog;
+	struct sr_buffer *buf;
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t frames, ring_offset;
+	snd_pcm_sframes_t avail, count;
+	float scale[UINT8_MAX], offset[UINT8_MAX];
+	void *data;
+	int i;
 	const float s16norm = 1 / (float)(1 << 15);
 
 	(void)fd;
@@ -342,41 +368,72 @@ SR_PRIV int alsa_receive_data(int fd, int revents, void *cb_data)
 	sdi = cb_data;
 	devc = sdi->priv;
 
-	memset(&analog, 0, sizeof(struct sr_datafeed_analog));
-	memset(inbuf, 0, sizeof(inbuf));
-
-	samples_to_get = MIN(4096 / 4, devc->limit_samples);
-
-	sr_spew("Getting %d samples from audio device.", samples_to_get);
-	count = snd_pcm_readi(devc->capture_handle, inbuf, samples_to_get);
-
-	if (count < 0) {
-		sr_err("Failed to read samples: %s.", snd_strerror(count));
+	/* Send whole periods, and no more than was asked for. */
+	frames = devc->period_size;
+	if (devc->limit_samples)
+		frames = MIN(frames, devc->limit_samples - devc->num_samples);
+
+	avail = snd_pcm_avail_update(devc->capture_handle);
+	if (avail == -EPIPE)
+		return xrun_recover(sdi) == SR_OK;
+	if (avail < 0) {
+		sr_err("Failed to get available samples: %s.",
+		       snd_strerror(avail));
 		return FALSE;
-	} else if (count != samples_to_get) {
-		sr_spew("Only got %d/%d samples.", count, samples_to_get);
 	}
-
-	analog.data = g_try_malloc0(count * sizeof(float) * devc->num_probes);
-	if (!analog.data) {
-		sr_err("Failed to malloc sample buffer.");
-		return FALSE;
+	if ((snd_pcm_uframes_t)avail < frames)
+		/* Wait for the rest of the period. */
+		return TRUE;
+
+	buf = NULL;
+	if (devc->mmap_access) {
+		/*
+		 * The samples go out straight from the ring buffer. Queued
+		 * consumers get a copy, the rest is done with them when
+		 * sr_session_send() returns.
+		 */
+		count = snd_pcm_mmap_begin(devc->capture_handle, &areas,
+				&ring_offset, &frames);
+		if (count < 0) {
+			sr_err("Failed to map samples: %s.",
+			       snd_strerror(count));
+			return FALSE;
+		}
+		/* Interleaved, so all channels are in the first area. */
+		data = (uint8_t *)areas[0].addr + (areas[0].first
+				+ ring_offset * areas[0].step) / 8;
+		count = frames;
+	} else {
+		if (!(buf = sr_buffer_pool_acquire(frames * devc->num_probes
+				* sizeof(int16_t)))) {
+			sr_err("Sample buffer malloc failed.");
+			return FALSE;
+		}
+		data = buf->data;
+		sr_spew("Getting %lu samples from audio device.", frames);
+		count = snd_pcm_readi(devc->capture_handle, data, frames);
+		if (count < 0) {
+			sr_err("Failed to read samples: %s.",
+			       snd_strerror(count));
+			sr_buffer_unref(buf);
+			return FALSE;
+		} else if ((snd_pcm_uframes_t)count != frames) {
+			sr_spew("Only got %ld/%lu samples.", count, frames);
+		}
 	}
 
-	offset = 0;
 	/*
 	 * It's impossible to know what voltage levels the soundcard handles.
 	 * Some handle 0 dBV rms, some 0dBV peak-to-peak, +4dbmW (600 ohm), etc
 	 * Each of these corresponds to a different voltage, and there is no
 	 * mechanism to determine this voltage. The best solution is to send all
 	 * audio data as a normalized float, and let the frontend or user worry
-	 * about the calibration.
+	 * about the calibration. The samples go out as they are, along with
+	 * the scale normalizing them.
 	 */
-	for (i = 0; i < count; i += devc->num_probes) {
-		for (x = 0; x < devc->num_probes; x++) {
-			tmp16 = inbuf[i + x];
-			analog.data[offset++] = tmp16 * s16norm;
-		}
+	for (i = 0; i < devc->num_probes; i++) {
+		scale[i] = s16norm;
+		offset[i] = 0;
 	}
 
 	/* Send a sample packet with the analog values. */
@@ -384,13 +441,30 @@ SR_PRIV int alsa_receive_data(int fd, int revents, void *cb_data)
 	analog.num_samples = count;
 	analog.mq = SR_MQ_VOLTAGE; /* FIXME */
 	analog.unit = SR_UNIT_VOLT; /* FIXME */
-	packet.type = SR_DF_ANALOG;
+	analog.mqflags = 0;
+	analog.encoding = SR_ANALOG_S16;
+	analog.scale = scale;
+	analog.offset = offset;
+	analog.data = data;
+	packet.type = SR_DF_ANALOG_RAW;
 	packet.payload = &analog;
-	sr_session_send(devc->cb_data, &packet);
-
-	g_free(analog.data);
+	if (buf) {
+		sr_session_send_buffer(devc->cb_data, &packet, buf);
+		sr_buffer_unref(buf);
+	} else {
+		sr_session_send(devc->cb_data, &packet);
+		count = snd_pcm_mmap_commit(devc->capture_handle, ring_offset,
+				frames);
+		if (count == -EPIPE)
+			return xrun_recover(sdi) == SR_OK;
+		if (count < 0) {
+			sr_err("Failed to release samples: %s.",
+			       snd_strerror(count));
+			return FALSE;
+		}
+	}
 
-	devc->num_samples += count;
+	devc->num_samples += analog.num_samples;
 
 	/* Stop acquisition if we acquired enough samples. */
 	if (devc->limit_samples && devc->num_samples >= devc->limit_samples) {
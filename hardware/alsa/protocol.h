@@ -31,11 +31,14 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "alsa: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/* Frames per period, and per packet sent to the session, by default. */
+#define DEFAULT_PERIOD_SIZE 1024
 
 /** Private, per-device-instance driver context. */
 struct dev_context {
@@ -47,6 +50,10 @@ struct dev_context {
 	char *hwdev;
 	snd_pcm_t *capture_handle;
 	snd_pcm_hw_params_t *hw_params;
+	/* Requested period size, in frames. */
+	uint64_t period_size;
+	/* Whether samples are read from the mmap()ed ring buffer. */
+	gboolean mmap_access;
 	struct pollfd *ufds;
 	void *cb_data;
 };
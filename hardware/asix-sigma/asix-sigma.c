@@ -37,7 +37,7 @@
 #define USB_VENDOR_NAME			"ASIX"
 #define USB_MODEL_NAME			"SIGMA"
 #define USB_MODEL_VERSION		""
-#define TRIGGER_TYPE 			"rf10"
+#define TRIGGER_TYPE 			"rf10c"
 #define NUM_PROBES			16
 
 SR_PRIV struct sr_dev_driver asix_sigma_driver_info;
@@ -299,85 +299,35 @@ static int sigma_write_trigger_lut(struct triggerlut *lut, struct dev_context *d
 	return SR_OK;
 }
 
-/* Generate the bitbang stream for programming the FPGA. */
-static int bin2bitbang(const char *filename,
-		       unsigned char **buf, size_t *buf_size)
+/*
+ * Generate the bitbang stream for programming the FPGA from the
+ * (obfuscated) firmware file's contents.
+ */
+static GBytes *bin2bitbang(const uint8_t *data, size_t size)
 {
-	FILE *f;
-	unsigned long file_size;
-	unsigned long offset = 0;
 	unsigned char *p;
-	uint8_t *firmware;
-	unsigned long fwsize = 0;
-	const int buffer_size = 65536;
-	size_t i;
-	int c, bit, v;
+	size_t i, offset;
+	int bit, v;
+	uint8_t c;
 	uint32_t imm = 0x3f6df2ab;
 
-	f = g_fopen(filename, "rb");
-	if (!f) {
-		sr_err("g_fopen(\"%s\", \"rb\")", filename);
-		return SR_ERR;
-	}
-
-	if (-1 == fseek(f, 0, SEEK_END)) {
-		sr_err("fseek on %s failed", filename);
-		fclose(f);
-		return SR_ERR;
-	}
-
-	file_size = ftell(f);
-
-	fseek(f, 0, SEEK_SET);
-
-	if (!(firmware = g_try_malloc(buffer_size))) {
-		sr_err("%s: firmware malloc failed", __func__);
-		fclose(f);
-		return SR_ERR_MALLOC;
-	}
-
-	while ((c = getc(f)) != EOF) {
-		imm = (imm + 0xa853753) % 177 + (imm * 0x8034052);
-		firmware[fwsize++] = c ^ imm;
-	}
-	fclose(f);
-
-	if(fwsize != file_size) {
-	    sr_err("%s: Error reading firmware", filename);
-	    fclose(f);
-	    g_free(firmware);
-	    return SR_ERR;
-	}
-
-	*buf_size = fwsize * 2 * 8;
-
-	*buf = p = (unsigned char *)g_try_malloc(*buf_size);
-	if (!p) {
+	if (!(p = g_try_malloc(size * 2 * 8))) {
 		sr_err("%s: buf/p malloc failed", __func__);
-		g_free(firmware);
-		return SR_ERR_MALLOC;
+		return NULL;
 	}
 
-	for (i = 0; i < fwsize; ++i) {
+	offset = 0;
+	for (i = 0; i < size; ++i) {
+		imm = (imm + 0xa853753) % 177 + (imm * 0x8034052);
+		c = data[i] ^ imm;
 		for (bit = 7; bit >= 0; --bit) {
-			v = firmware[i] & 1 << bit ? 0x40 : 0x00;
+			v = c & 1 << bit ? 0x40 : 0x00;
 			p[offset++] = v | 0x01;
 			p[offset++] = v;
 		}
 	}
 
-	g_free(firmware);
-
-	if (offset != *buf_size) {
-		g_free(*buf);
-		sr_err("Error reading firmware %s "
-		       "offset=%ld, file_size=%ld, buf_size=%zd.",
-		       filename, offset, file_size, *buf_size);
-
-		return SR_ERR;
-	}
-
-	return SR_OK;
+	return g_bytes_new_take(p, offset);
 }
 
 static void clear_helper(void *priv)
@@ -386,6 +336,7 @@ static void clear_helper(void *priv)
 
 	devc = priv;
 
+	/* The buffers went in dev_close(). */
 	ftdi_deinit(&devc->ftdic);
 }
 
@@ -454,6 +405,9 @@ static GSList *scan(GSList *options)
 	devc->samples_per_event = 0;
 	devc->capture_ratio = 50;
 	devc->use_triggers = 0;
+	devc->dram_buf = NULL;
+	devc->run_values = NULL;
+	devc->run_counts = NULL;
 
 	/* Register SIGMA device. */
 	if (!(sdi = sr_dev_inst_new(0, SR_ST_INITIALIZING, USB_VENDOR_NAME,
@@ -493,12 +447,20 @@ static GSList *dev_list(void)
 static int upload_firmware(int firmware_idx, struct dev_context *devc)
 {
 	int ret;
-	unsigned char *buf;
+	GBytes *fw;
+	const unsigned char *buf;
 	unsigned char pins;
-	size_t buf_size;
+	gsize buf_size;
 	unsigned char result[32];
 	char firmware_path[128];
 
+	/* The FPGA keeps its configuration for as long as it has power. */
+	if (devc->cur_firmware == firmware_idx) {
+		sr_dbg("Firmware '%s' is already running.",
+		       firmware_files[firmware_idx]);
+		return SR_OK;
+	}
+
 	/* Make sure it's an ASIX SIGMA. */
 	if ((ret = ftdi_usb_open_desc(&devc->ftdic,
 		USB_VENDOR, USB_PRODUCT, USB_DESCRIPTION, NULL)) < 0) {
@@ -542,17 +504,18 @@ static int upload_firmware(int firmware_idx, struct dev_context *devc)
 	snprintf(firmware_path, sizeof(firmware_path), "%s/%s", FIRMWARE_DIR,
 		 firmware_files[firmware_idx]);
 
-	if ((ret = bin2bitbang(firmware_path, &buf, &buf_size)) != SR_OK) {
+	if (!(fw = sr_firmware_get(firmware_path, bin2bitbang))) {
 		sr_err("An error occured while reading the firmware: %s",
 		       firmware_path);
-		return ret;
+		return SR_ERR;
 	}
+	buf = g_bytes_get_data(fw, &buf_size);
 
 	/* Upload firmare. */
 	sr_info("Uploading firmware file '%s'.", firmware_files[firmware_idx]);
-	sigma_write(buf, buf_size, devc);
+	sigma_write((unsigned char *)buf, buf_size, devc);
 
-	g_free(buf);
+	g_bytes_unref(fw);
 
 	if ((ret = ftdi_set_bitmode(&devc->ftdic, 0x00, BITMODE_RESET)) < 0) {
 		sr_err("ftdi_set_bitmode failed: %s",
@@ -645,81 +608,60 @@ static int set_samplerate(const struct sr_dev_inst *sdi, uint64_t samplerate)
 
 /*
  * In 100 and 200 MHz mode, only a single pin rising/falling can be
- * set as trigger. In other modes, two rising/falling triggers can be set,
- * in addition to value/mask trigger for any number of probes.
- *
- * The Sigma supports complex triggers using boolean expressions, but this
- * has not been implemented yet.
+ * set as trigger. In other modes, the trigger strings are compiled into
+ * the LUTs by build_trigger_lut(), which has the limits on what they
+ * can hold.
  */
 static int configure_probes(const struct sr_dev_inst *sdi)
 {
 	struct dev_context *devc = sdi->priv;
 	const struct sr_probe *probe;
+	const struct sr_soft_trigger_stage *stage;
 	const GSList *l;
-	int trigger_set = 0;
-	int probebit;
+	char *triggerlist[NUM_PROBES];
+	uint16_t edges;
+	int ret;
 
 	memset(&devc->trigger, 0, sizeof(struct sigma_trigger));
+	memset(triggerlist, 0, sizeof(triggerlist));
 
 	for (l = sdi->probes; l; l = l->next) {
 		probe = (struct sr_probe *)l->data;
-		probebit = 1 << (probe->index);
-
-		if (!probe->enabled || !probe->trigger)
-			continue;
+		if (probe->enabled && probe->index < NUM_PROBES)
+			triggerlist[probe->index] = probe->trigger;
+	}
 
-		if (devc->cur_samplerate >= SR_MHZ(100)) {
-			/* Fast trigger support. */
-			if (trigger_set) {
-				sr_err("Only a single pin trigger in 100 and "
-				       "200MHz mode is supported.");
-				return SR_ERR;
-			}
-			if (probe->trigger[0] == 'f')
-				devc->trigger.fallingmask |= probebit;
-			else if (probe->trigger[0] == 'r')
-				devc->trigger.risingmask |= probebit;
-			else {
-				sr_err("Only rising/falling trigger in 100 "
-				       "and 200MHz mode is supported.");
-				return SR_ERR;
-			}
+	ret = sr_soft_trigger_compile(sdi, triggerlist, devc->trigger.stages,
+			&devc->trigger.num_stages);
+	if (ret != SR_OK)
+		return ret;
+	devc->use_triggers = devc->trigger.num_stages > 0;
 
-			++trigger_set;
-		} else {
-			/* Simple trigger support (event). */
-			if (probe->trigger[0] == '1') {
-				devc->trigger.simplevalue |= probebit;
-				devc->trigger.simplemask |= probebit;
-			}
-			else if (probe->trigger[0] == '0') {
-				devc->trigger.simplevalue &= ~probebit;
-				devc->trigger.simplemask |= probebit;
-			}
-			else if (probe->trigger[0] == 'f') {
-				devc->trigger.fallingmask |= probebit;
-				++trigger_set;
-			}
-			else if (probe->trigger[0] == 'r') {
-				devc->trigger.risingmask |= probebit;
-				++trigger_set;
-			}
+	if (devc->trigger.num_stages > MAX_TRIGGER_STAGES) {
+		sr_err("Only %d trigger stages are supported.",
+		       MAX_TRIGGER_STAGES);
+		return SR_ERR;
+	}
 
-			/*
-			 * Actually, Sigma supports 2 rising/falling triggers,
-			 * but they are ORed and the current trigger syntax
-			 * does not permit ORed triggers.
-			 */
-			if (trigger_set > 1) {
-				sr_err("Only 1 rising/falling trigger "
-				       "is supported.");
-				return SR_ERR;
-			}
-		}
+	if (!devc->use_triggers || devc->cur_samplerate < SR_MHZ(100))
+		return SR_OK;
 
-		if (trigger_set)
-			devc->use_triggers = 1;
+	/* Fast trigger support. */
+	stage = &devc->trigger.stages[0];
+	edges = stage->rising | stage->falling;
+	if (devc->trigger.num_stages > 1 || stage->mask || stage->change ||
+	    (stage->rising && stage->falling)) {
+		sr_err("Only rising/falling trigger in 100 "
+		       "and 200MHz mode is supported.");
+		return SR_ERR;
 	}
+	if (edges & (edges - 1)) {
+		sr_err("Only a single pin trigger in 100 and "
+		       "200MHz mode is supported.");
+		return SR_ERR;
+	}
+	devc->trigger.risingmask = stage->rising;
+	devc->trigger.fallingmask = stage->falling;
 
 	return SR_OK;
 }
@@ -730,6 +672,13 @@ static int dev_close(struct sr_dev_inst *sdi)
 
 	devc = sdi->priv;
 
+	sr_dev_mem_free(sdi, devc->dram_buf);
+	sr_dev_mem_free(sdi, devc->run_values);
+	sr_dev_mem_free(sdi, devc->run_counts);
+	devc->dram_buf = NULL;
+	devc->run_values = NULL;
+	devc->run_counts = NULL;
+
 	/* TODO */
 	if (sdi->status == SR_ST_ACTIVE)
 		ftdi_usb_close(&devc->ftdic);
@@ -831,28 +780,43 @@ static int config_list(int key, GVariant **data, const struct sr_dev_inst *sdi,
 	return SR_OK;
 }
 
+/* Check a sample, and the one before it, against a trigger stage. */
+static gboolean stage_match(const struct sr_soft_trigger_stage *stage,
+			    uint16_t prev, uint16_t cur)
+{
+	if ((cur & stage->mask) != stage->value)
+		return FALSE;
+	if ((prev & stage->rising) || (~cur & stage->rising))
+		return FALSE;
+	if ((~prev & stage->falling) || (cur & stage->falling))
+		return FALSE;
+	if (~(prev ^ cur) & stage->change)
+		return FALSE;
+
+	return TRUE;
+}
+
 /* Software trigger to determine exact trigger position. */
 static int get_trigger_offset(uint16_t *samples, uint16_t last_sample,
 			      struct sigma_trigger *t)
 {
+	const struct sr_soft_trigger_stage *last;
 	int i;
 
+	if (!t->num_stages)
+		return 0;
+	last = &t->stages[t->num_stages - 1];
+
 	for (i = 0; i < 8; ++i) {
 		if (i > 0)
 			last_sample = samples[i-1];
 
-		/* Simple triggers. */
-		if ((samples[i] & t->simplemask) != t->simplevalue)
-			continue;
-
-		/* Rising edge. */
-		if ((last_sample & t->risingmask) != 0 || (samples[i] &
-		    t->risingmask) != t->risingmask)
+		if (!stage_match(last, last_sample, samples[i]))
 			continue;
 
-		/* Falling edge. */
-		if ((last_sample & t->fallingmask) != t->fallingmask ||
-		    (samples[i] & t->fallingmask) != 0)
+		/* The stage before has no edges, see build_trigger_lut(). */
+		if (t->num_stages > 1 &&
+		    !stage_match(&t->stages[0], last_sample, last_sample))
 			continue;
 
 		break;
@@ -862,6 +826,43 @@ static int get_trigger_offset(uint16_t *samples, uint16_t last_sample,
 	return i & 0x7;
 }
 
+/* Send the collected runs of samples to the session bus. */
+static void flush_runs(struct dev_context *devc)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic_rle rle;
+
+	if (!devc->num_runs)
+		return;
+
+	packet.type = SR_DF_LOGIC_RLE;
+	packet.payload = &rle;
+	rle.num_samples = devc->num_run_samples;
+	rle.num_runs = devc->num_runs;
+	rle.unitsize = 2;
+	rle.values = devc->run_values;
+	rle.counts = devc->run_counts;
+	sr_session_send(devc->cb_data, &packet);
+
+	devc->num_runs = 0;
+	devc->num_run_samples = 0;
+}
+
+/* Add count samples of the given value to the runs collected so far. */
+static void add_samples(struct dev_context *devc, uint16_t sample,
+			uint64_t count)
+{
+	if (devc->num_runs && devc->run_values[devc->num_runs - 1] == sample) {
+		devc->run_counts[devc->num_runs - 1] += count;
+	} else {
+		if (devc->num_runs == MAX_RUNS)
+			flush_runs(devc);
+		devc->run_values[devc->num_runs] = sample;
+		devc->run_counts[devc->num_runs++] = count;
+	}
+	devc->num_run_samples += count;
+}
+
 /*
  * Decode chunk of 1024 bytes, 64 clusters, 7 events per cluster.
  * Each event is 20ns apart, and can contain multiple samples.
@@ -870,6 +871,9 @@ static int get_trigger_offset(uint16_t *samples, uint16_t last_sample,
  * For 100 MHz, events contain 2 samples for each channel, spread 10 ns apart.
  * For 50 MHz and below, events contain one sample for each channel,
  * spread 20 ns apart.
+ *
+ * The samples are collected as runs, so the gaps between clusters,
+ * during which the inputs didn't change, cost no more than one run.
  */
 static int decode_chunk_ts(uint8_t *buf, uint16_t *lastts,
 			   uint16_t *lastsample, int triggerpos,
@@ -878,12 +882,12 @@ static int decode_chunk_ts(uint8_t *buf, uint16_t *lastts,
 	struct sr_dev_inst *sdi = cb_data;
 	struct dev_context *devc = sdi->priv;
 	uint16_t tsdiff, ts;
-	uint16_t samples[65536 * devc->samples_per_event];
+	/* One more, the trigger search looks at 8 samples. */
+	uint16_t samples[EVENTS_PER_CLUSTER * 4 + 1];
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_logic logic;
-	int i, j, k, l, numpad, tosend;
-	size_t n = 0, sent = 0;
-	int clustersize = EVENTS_PER_CLUSTER * devc->samples_per_event;
+	int i, j, k, l, n, numpad, tosend;
+	int spe = devc->samples_per_event;
+	int clustersize = EVENTS_PER_CLUSTER * spe;
 	uint16_t *event;
 	uint16_t cur_sample;
 	int triggerts = -1;
@@ -911,51 +915,37 @@ static int decode_chunk_ts(uint8_t *buf, uint16_t *lastts,
 			return SR_OK;
 
 		/* Pad last sample up to current point. */
-		numpad = tsdiff * devc->samples_per_event - clustersize;
-		if (numpad > 0) {
-			for (j = 0; j < numpad; ++j)
-				samples[j] = *lastsample;
-
-			n = numpad;
-		}
-
-		/* Send samples between previous and this timestamp to sigrok. */
-		sent = 0;
-		while (sent < n) {
-			tosend = MIN(2048, n - sent);
-
-			packet.type = SR_DF_LOGIC;
-			packet.payload = &logic;
-			logic.length = tosend * sizeof(uint16_t);
-			logic.unitsize = 2;
-			logic.data = samples + sent;
-			sr_session_send(devc->cb_data, &packet);
-
-			sent += tosend;
-		}
-		n = 0;
+		numpad = tsdiff * spe - clustersize;
+		if (numpad > 0)
+			add_samples(devc, *lastsample, numpad);
 
 		event = (uint16_t *) &buf[i * 16 + 2];
-		cur_sample = 0;
-
-		/* For each event in cluster. */
-		for (j = 0; j < 7; ++j) {
-
-			/* For each sample in event. */
-			for (k = 0; k < devc->samples_per_event; ++k) {
-				cur_sample = 0;
-
-				/* For each probe. */
-				for (l = 0; l < devc->num_probes; ++l)
-					cur_sample |= (!!(event[j] & (1 << (l *
-					   devc->samples_per_event + k)))) << l;
+		n = 0;
 
-				samples[n++] = cur_sample;
+		if (spe == 1) {
+			/* One sample per event, probe l is bit l. */
+			for (j = 0; j < EVENTS_PER_CLUSTER; ++j)
+				samples[n++] = event[j];
+		} else {
+			/* For each event in cluster. */
+			for (j = 0; j < EVENTS_PER_CLUSTER; ++j) {
+				/* For each sample in event. */
+				for (k = 0; k < spe; ++k) {
+					cur_sample = 0;
+
+					/* For each probe. */
+					for (l = 0; l < devc->num_probes; ++l)
+						cur_sample |= (!!(event[j] &
+						    (1 << (l * spe + k)))) << l;
+
+					samples[n++] = cur_sample;
+				}
 			}
 		}
+		samples[n] = samples[n - 1];
 
 		/* Send data up to trigger point (if triggered). */
-		sent = 0;
+		tosend = 0;
 		if (i == triggerts) {
 			/*
 			 * Trigger is not always accurate to sample because of
@@ -965,36 +955,20 @@ static int decode_chunk_ts(uint8_t *buf, uint16_t *lastts,
 			 */
 			tosend = get_trigger_offset(samples, *lastsample,
 						    &devc->trigger);
-
-			if (tosend > 0) {
-				packet.type = SR_DF_LOGIC;
-				packet.payload = &logic;
-				logic.length = tosend * sizeof(uint16_t);
-				logic.unitsize = 2;
-				logic.data = samples;
-				sr_session_send(devc->cb_data, &packet);
-
-				sent += tosend;
-			}
+			for (j = 0; j < tosend; ++j)
+				add_samples(devc, samples[j], 1);
 
 			/* Only send trigger if explicitly enabled. */
 			if (devc->use_triggers) {
+				flush_runs(devc);
 				packet.type = SR_DF_TRIGGER;
 				sr_session_send(devc->cb_data, &packet);
 			}
 		}
 
-		/* Send rest of the chunk to sigrok. */
-		tosend = n - sent;
-
-		if (tosend > 0) {
-			packet.type = SR_DF_LOGIC;
-			packet.payload = &logic;
-			logic.length = tosend * sizeof(uint16_t);
-			logic.unitsize = 2;
-			logic.data = samples + sent;
-			sr_session_send(devc->cb_data, &packet);
-		}
+		/* Rest of the cluster. */
+		for (j = tosend; j < n; ++j)
+			add_samples(devc, samples[j], 1);
 
 		*lastsample = samples[n - 1];
 	}
@@ -1007,8 +981,7 @@ static int receive_data(int fd, int revents, void *cb_data)
 	struct sr_dev_inst *sdi = cb_data;
 	struct dev_context *devc = sdi->priv;
 	struct sr_datafeed_packet packet;
-	const int chunks_per_read = 32;
-	unsigned char buf[chunks_per_read * CHUNK_SIZE];
+	unsigned char *buf = devc->dram_buf;
 	int bufsz, numchunks, i, newchunks;
 	uint64_t running_msec;
 	struct timeval tv;
@@ -1016,15 +989,15 @@ static int receive_data(int fd, int revents, void *cb_data)
 	(void)fd;
 	(void)revents;
 
-	/* Get the current position. */
-	sigma_read_pos(&devc->state.stoppos, &devc->state.triggerpos, devc);
-
-	numchunks = (devc->state.stoppos + 511) / 512;
-
 	if (devc->state.state == SIGMA_IDLE)
 		return TRUE;
 
 	if (devc->state.state == SIGMA_CAPTURE) {
+		/* Get the current position. */
+		sigma_read_pos(&devc->state.stoppos, &devc->state.triggerpos,
+			       devc);
+		numchunks = (devc->state.stoppos + 511) / 512;
+
 		/* Check if the timer has expired, or memory is full. */
 		gettimeofday(&tv, 0);
 		running_msec = (tv.tv_sec - devc->start_tv.tv_sec) * 1000 +
@@ -1037,6 +1010,9 @@ static int receive_data(int fd, int revents, void *cb_data)
 
 	}
 
+	/* The final position, as read when stopping, for the download. */
+	numchunks = (devc->state.stoppos + 511) / 512;
+
 	if (devc->state.state == SIGMA_DOWNLOAD) {
 		if (devc->state.chunks_downloaded >= numchunks) {
 			/* End of samples. */
@@ -1048,7 +1024,7 @@ static int receive_data(int fd, int revents, void *cb_data)
 			return TRUE;
 		}
 
-		newchunks = MIN(chunks_per_read,
+		newchunks = MIN(CHUNKS_PER_READ,
 				numchunks - devc->state.chunks_downloaded);
 
 		sr_info("Downloading sample data: %.0f %%.",
@@ -1089,6 +1065,7 @@ static int receive_data(int fd, int revents, void *cb_data)
 
 			++devc->state.chunks_downloaded;
 		}
+		flush_runs(devc);
 	}
 
 	return TRUE;
@@ -1162,6 +1139,10 @@ static void add_trigger_function(enum triggerop oper, enum triggerfunc func,
 		x[1][1] = 1;
 		x[0][0] = 1;
 		break;
+	case OP_PREVLEVEL:
+		x[1][0] = 1;
+		x[1][1] = 1;
+		break;
 	}
 
 	/* Transpose if neg is set. */
@@ -1201,52 +1182,78 @@ static void add_trigger_function(enum triggerop oper, enum triggerfunc func,
 }
 
 /*
- * Build trigger LUTs used by 50 MHz and lower sample rates for supporting
- * simple pin change and state triggers. Only two transitions (rise/fall) can be
- * set at any time, but a full mask and value can be set (0/1).
+ * Build the trigger LUTs used by 50 MHz and lower sample rates from the
+ * trigger stages. The last stage is matched on the sample that triggers:
+ * its levels on any probes by the value/mask LUT (m2d), its edges on up
+ * to two probes by the two pin detectors (m0d, m1d), whose current and
+ * previous outputs the glue logic (m3) sees. A stage before it, which
+ * can't have edges, takes the first detector for its pattern, which the
+ * glue logic then requires on the previous sample. All of it is ANDed.
  */
-static int build_basic_trigger(struct triggerlut *lut, struct dev_context *devc)
+static int build_trigger_lut(struct triggerlut *lut, struct dev_context *devc)
 {
-	int i,j;
-	uint16_t masks[2] = { 0, 0 };
+	const struct sigma_trigger *t = &devc->trigger;
+	const struct sr_soft_trigger_stage *first, *last;
+	enum triggerop oper;
+	uint16_t edges, probebit;
+	int detector, i;
 
 	memset(lut, 0, sizeof(struct triggerlut));
 
 	/* Contant for simple triggers. */
 	lut->m4 = 0xa000;
 
-	/* Value/mask trigger support. */
-	build_lut_entry(devc->trigger.simplevalue, devc->trigger.simplemask,
-			lut->m2d);
+	/* Triggertype: event. */
+	lut->params.selres = 3;
 
-	/* Rise/fall trigger support. */
-	for (i = 0, j = 0; i < 16; ++i) {
-		if (devc->trigger.risingmask & (1 << i) ||
-		    devc->trigger.fallingmask & (1 << i))
-			masks[j++] = 1 << i;
+	/* No condition of the glue logic fails until one is added. */
+	lut->m3 = 0xffff;
+
+	if (!t->num_stages) {
+		build_lut_entry(0, 0, lut->m2d);
+		return SR_OK;
 	}
+	last = &t->stages[t->num_stages - 1];
 
-	build_lut_entry(masks[0], masks[0], lut->m0d);
-	build_lut_entry(masks[1], masks[1], lut->m1d);
-
-	/* Add glue logic */
-	if (masks[0] || masks[1]) {
-		/* Transition trigger. */
-		if (masks[0] & devc->trigger.risingmask)
-			add_trigger_function(OP_RISE, FUNC_OR, 0, 0, &lut->m3);
-		if (masks[0] & devc->trigger.fallingmask)
-			add_trigger_function(OP_FALL, FUNC_OR, 0, 0, &lut->m3);
-		if (masks[1] & devc->trigger.risingmask)
-			add_trigger_function(OP_RISE, FUNC_OR, 1, 0, &lut->m3);
-		if (masks[1] & devc->trigger.fallingmask)
-			add_trigger_function(OP_FALL, FUNC_OR, 1, 0, &lut->m3);
-	} else {
-		/* Only value/mask trigger. */
-		lut->m3 = 0xffff;
+	/* Value/mask trigger support. */
+	build_lut_entry(last->value, last->mask, lut->m2d);
+
+	/* Sequence support: the stage before, on the previous sample. */
+	detector = 0;
+	if (t->num_stages > 1) {
+		first = &t->stages[0];
+		if (first->rising || first->falling || first->change) {
+			sr_err("Only the last trigger stage can have edges.");
+			return SR_ERR;
+		}
+		build_lut_entry(first->value, first->mask, lut->m0d);
+		add_trigger_function(OP_PREVLEVEL, FUNC_AND, detector++, 0,
+				     &lut->m3);
 	}
 
-	/* Triggertype: event. */
-	lut->params.selres = 3;
+	/* Rise/fall trigger support. */
+	edges = last->rising | last->falling | last->change;
+	for (i = 0; i < NUM_PROBES; ++i) {
+		probebit = 1 << i;
+		if (!(edges & probebit))
+			continue;
+		if (detector == 2) {
+			sr_err("The trigger needs more than the two pin "
+			       "detectors.");
+			return SR_ERR;
+		}
+
+		if (last->change & probebit)
+			oper = OP_RISEFALL;
+		else if (last->rising & probebit)
+			oper = OP_RISE;
+		else
+			oper = OP_FALL;
+
+		build_lut_entry(probebit, probebit,
+				detector ? lut->m1d : lut->m0d);
+		add_trigger_function(oper, FUNC_AND, detector++, 0, &lut->m3);
+	}
 
 	return SR_OK;
 }
@@ -1270,12 +1277,34 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 		return SR_ERR;
 	}
 
+	if (!devc->dram_buf && !(devc->dram_buf = sr_dev_mem_alloc(sdi,
+			CHUNKS_PER_READ * CHUNK_SIZE))) {
+		sr_err("%s: dram_buf malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if (!devc->run_values && !(devc->run_values = sr_dev_mem_alloc(sdi,
+			MAX_RUNS * sizeof(uint16_t)))) {
+		sr_err("%s: run_values malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if (!devc->run_counts && !(devc->run_counts = sr_dev_mem_alloc(sdi,
+			MAX_RUNS * sizeof(uint64_t)))) {
+		sr_err("%s: run_counts malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	devc->num_runs = devc->num_run_samples = 0;
+
 	/* If the samplerate has not been set, default to 200 kHz. */
 	if (devc->cur_firmware == -1) {
 		if ((ret = set_samplerate(sdi, SR_KHZ(200))) != SR_OK)
 			return ret;
 	}
 
+	/* Before programming, so an unsupported trigger changes nothing. */
+	if (devc->cur_samplerate <= SR_MHZ(50) &&
+	    (ret = build_trigger_lut(&lut, devc)) != SR_OK)
+		return ret;
+
 	/* Enter trigger programming mode. */
 	sigma_set_register(WRITE_TRIGGER_SELECT1, 0x20, devc);
 
@@ -1298,8 +1327,6 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 
 	/* All other modes. */
 	} else if (devc->cur_samplerate <= SR_MHZ(50)) {
-		build_basic_trigger(&lut, devc);
-
 		sigma_write_trigger_lut(&lut, devc);
 
 		triggerselect = (1 << LEDSEL1) | (1 << LEDSEL0);
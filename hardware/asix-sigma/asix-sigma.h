@@ -25,11 +25,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "asix-sigma: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 enum sigma_write_register {
 	WRITE_CLOCK_SELECT	= 0,
@@ -83,6 +83,12 @@ enum sigma_read_register {
 
 #define CHUNK_SIZE		1024
 
+/* DRAM chunks fetched per read while downloading. */
+#define CHUNKS_PER_READ		64
+
+/* Runs of equal samples collected per SR_DF_LOGIC_RLE packet. */
+#define MAX_RUNS		4096
+
 struct clockselect_50 {
 	uint8_t async;
 	uint8_t fraction;
@@ -131,17 +137,18 @@ struct triggerlut {
 	} params;
 };
 
+/* Stages the LUTs can match in sequence, see build_trigger_lut(). */
+#define MAX_TRIGGER_STAGES	2
+
 /* Trigger configuration */
 struct sigma_trigger {
-	/* Only two probes can be used in mask. */
+	/* The stages, compiled from the probes' trigger strings. */
+	int num_stages;
+	struct sr_soft_trigger_stage stages[SR_SOFT_TRIGGER_MAX_STAGES];
+
+	/* The single pin trigger of 100 and 200 MHz mode. */
 	uint16_t risingmask;
 	uint16_t fallingmask;
-
-	/* Simple trigger support (<= 50 MHz). */
-	uint16_t simplemask;
-	uint16_t simplevalue;
-
-	/* TODO: Advanced trigger support (boolean expressions). */
 };
 
 /* Events for trigger operation. */
@@ -154,6 +161,8 @@ enum triggerop {
 	OP_NOTRISE,
 	OP_NOTFALL,
 	OP_NOTRISEFALL,
+	/* Level on the previous sample. */
+	OP_PREVLEVEL,
 };
 
 /* Logical functions for trigger operation. */
@@ -197,6 +206,12 @@ struct dev_context {
 	int use_triggers;
 	struct sigma_state state;
 	void *cb_data;
+	/* Download and decode buffers, kept across acquisitions. */
+	uint8_t *dram_buf;
+	uint16_t *run_values;
+	uint64_t *run_counts;
+	uint64_t num_runs;
+	uint64_t num_run_samples;
 };
 
 #endif
@@ -409,6 +409,9 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	devc->state = ST_INIT;
 	devc->num_samples = 0;
 	devc->buf_len = 0;
+	sr_analog_batch_start(&devc->batch, cb_data);
+	devc->batch.max_samples = LOG_BATCH_SAMPLES;
+	devc->batch.max_wait = 0;
 
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
@@ -423,15 +426,20 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 
 static int dev_acquisition_stop(struct sr_dev_inst *sdi, void *cb_data)
 {
+	struct dev_context *devc;
+
 	(void)cb_data;
 
 	if (sdi->status != SR_ST_ACTIVE)
 		return SR_ERR_DEV_CLOSED;
 
+	/* Stored samples not sent yet go out before the end packet. */
+	devc = sdi->priv;
+	sr_analog_batch_flush(&devc->batch);
+	sr_analog_batch_clear(&devc->batch);
+
 	return std_dev_acquisition_stop_serial(sdi, cb_data, dev_close,
 			sdi->conn, LOG_PREFIX);
-
-	return SR_OK;
 }
 
 SR_PRIV struct sr_dev_driver cem_dt_885x_driver_info = {
@@ -176,7 +176,6 @@ static void send_data(const struct sr_dev_inst *sdi, unsigned char *data,
 		uint64_t num_samples)
 {
 	struct dev_context *devc;
-	struct sr_datafeed_packet packet;
 	struct sr_datafeed_analog analog;
 	float fbuf[SAMPLES_PER_PACKET];
 	unsigned int i;
@@ -196,9 +195,9 @@ static void send_data(const struct sr_dev_inst *sdi, unsigned char *data,
 	analog.probes = sdi->probes;
 	analog.num_samples = num_samples;
 	analog.data = fbuf;
-	packet.type = SR_DF_ANALOG;
-	packet.payload = &analog;
-	sr_session_send(devc->cb_data, &packet);
+	sr_analog_batch_add_stored(&devc->batch, &analog, devc->log_time,
+			devc->log_interval);
+	devc->log_time += num_samples * devc->log_interval;
 
 	devc->num_samples += analog.num_samples;
 	if (devc->limit_samples && devc->num_samples >= devc->limit_samples)
@@ -307,6 +306,11 @@ static void process_byte(const struct sr_dev_inst *sdi, const unsigned char c,
 					((devc->buf[0] << 8) + devc->buf[1]) - 100);
 			devc->buf_len = 0;
 			devc->state = ST_GET_LOG_RECORD_META;
+			/*
+			 * The device doesn't say when it logged the samples,
+			 * so their timestamps count from the download's start.
+			 */
+			devc->log_time = g_get_monotonic_time();
 		}
 	} else if (devc->state == ST_GET_LOG_RECORD_META) {
 		sr_dbg("log meta: 0x%.2x", c);
@@ -336,6 +340,9 @@ static void process_byte(const struct sr_dev_inst *sdi, const unsigned char c,
 				sr_dbg("Unknown record token 0x%.2x", c);
 				return;
 			}
+			/* The previous record's samples go out first. */
+			sr_analog_batch_flush(&devc->batch);
+			devc->log_interval = devc->buf[7] * G_USEC_PER_SEC;
 			packet.type = SR_DF_META;
 			packet.payload = &meta;
 			src = sr_config_new(SR_CONF_SAMPLE_INTERVAL,
@@ -28,16 +28,19 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "cem-dt-885x: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
-
-/* When retrieving samples from device memory, group this many
- * together into a sigrok packet. */
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/* When retrieving samples from device memory, decode this many
+ * at a time. */
 #define SAMPLES_PER_PACKET 50
 
+/* Stored samples sent in one analog packet. */
+#define LOG_BATCH_SAMPLES 1000
+
 /* Various temporary storage, at least 8 bytes. */
 #define BUF_SIZE SAMPLES_PER_PACKET * 2
 
@@ -118,6 +121,11 @@ struct dev_context {
 	unsigned char buf[BUF_SIZE];
 	float last_spl;
 	gint64 hold_last_sent;
+	/* Decoded stored samples not sent yet. */
+	struct sr_analog_batch batch;
+	/* When the next stored sample was taken, and their interval, in us. */
+	int64_t log_time;
+	int64_t log_interval;
 };
 
 /* Parser state machine. */
@@ -104,7 +104,7 @@ static GSList *scan(GSList *options)
 	devc->limit_msec = 0;
 	devc->limit_samples = 0;
 	devc->cb_data = NULL;
-	memset(devc->mangled_buf, 0, BS);
+	memset(devc->mangled_buf, 0, READ_SIZE);
 	devc->final_buf = NULL;
 	devc->trigger_pattern = 0x00; /* Value irrelevant, see trigger_mask. */
 	devc->trigger_mask = 0x00; /* All probes are "don't care". */
@@ -227,6 +227,15 @@ static int dev_open(struct sr_dev_inst *sdi)
 	}
 	sr_dbg("FTDI flow control enabled successfully.");
 
+	/* Let libftdi fetch a whole read's worth per USB request. */
+	if ((ret = ftdi_read_data_set_chunksize(devc->ftdic, READ_SIZE)) < 0) {
+		sr_err("%s: ftdi_read_data_set_chunksize: (%d) %s",
+		       __func__, ret, ftdi_get_error_string(devc->ftdic));
+		(void) la8_close_usb_reset_sequencer(devc); /* Ignore errors. */
+		goto err_dev_open_close_ftdic;
+	}
+	sr_dbg("FTDI read chunk size set successfully.");
+
 	/* Wait 100ms. */
 	g_usleep(100 * 1000);
 
@@ -400,10 +409,9 @@ static int receive_data(int fd, int revents, void *cb_data)
 	}
 
 	/* We need to get exactly NUM_BLOCKS blocks (i.e. 8MB) of data. */
-	if (devc->block_counter != (NUM_BLOCKS - 1)) {
-		devc->block_counter++;
+	devc->block_counter += READ_SIZE / BS;
+	if (devc->block_counter < NUM_BLOCKS)
 		return TRUE;
-	}
 
 	sr_dbg("Sampling finished, sending data to session bus now.");
 
@@ -368,7 +368,7 @@ SR_PRIV int set_samplerate(const struct sr_dev_inst *sdi, uint64_t samplerate)
 }
 
 /**
- * Get a block of data from the LA8.
+ * Get READ_SIZE bytes (READ_SIZE / BS blocks) of data from the LA8.
  *
  * @param devc The struct containing private per-device-instance data. Must not
  *            be NULL. devc->ftdic must not be NULL either.
@@ -376,38 +376,46 @@ SR_PRIV int set_samplerate(const struct sr_dev_inst *sdi, uint64_t samplerate)
  */
 SR_PRIV int la8_read_block(struct dev_context *devc)
 {
-	int i, byte_offset, m, mi, p, index, bytes_read;
-	time_t now;
+	int i, byte_offset, m, mi, p, index, bytes_read, ret;
 
 	/* Note: Caller checked that devc and devc->ftdic != NULL. */
 
-	sr_spew("Reading block %d.", devc->block_counter);
+	sr_spew("Reading blocks %d-%d.", devc->block_counter,
+		devc->block_counter + READ_SIZE / BS - 1);
 
-	bytes_read = la8_read(devc, devc->mangled_buf, BS);
-
-	/* If first block read got 0 bytes, retry until success or timeout. */
-	if ((bytes_read == 0) && (devc->block_counter == 0)) {
-		do {
-			sr_spew("Reading block 0 (again).");
-			bytes_read = la8_read(devc, devc->mangled_buf, BS);
-			/* TODO: How to handle read errors here? */
-			now = time(NULL);
-		} while ((devc->done > now) && (bytes_read == 0));
+	bytes_read = 0;
+	while (bytes_read < READ_SIZE) {
+		ret = la8_read(devc, devc->mangled_buf + bytes_read,
+			       READ_SIZE - bytes_read);
+		/* TODO: How to handle read errors here? */
+		if (ret > 0) {
+			bytes_read += ret;
+			continue;
+		}
+		/* Until the first block arrives, retry until the timeout. */
+		if (ret < 0 || devc->block_counter != 0 || bytes_read != 0
+		    || devc->done <= time(NULL))
+			break;
+		sr_spew("Reading block 0 (again).");
 	}
 
 	/* Check if block read was successful or a timeout occured. */
-	if (bytes_read != BS) {
+	if (bytes_read != READ_SIZE) {
 		sr_err("Trigger timed out. Bytes read: %d.", bytes_read);
 		(void) la8_reset(devc); /* Ignore errors. */
 		return SR_ERR;
 	}
 
-	/* De-mangle the data. */
-	sr_spew("Demangling block %d.", devc->block_counter);
+	/*
+	 * De-mangle the data. READ_SIZE divides 1MB, so all of it is
+	 * from the same megabyte.
+	 */
+	sr_spew("Demangling blocks %d-%d.", devc->block_counter,
+		devc->block_counter + READ_SIZE / BS - 1);
 	byte_offset = devc->block_counter * BS;
 	m = byte_offset / (1024 * 1024);
 	mi = m * (1024 * 1024);
-	for (i = 0; i < BS; i++) {
+	for (i = 0; i < READ_SIZE; i++) {
 		p = i & (1 << 0);
 		index = m * 2 + (((byte_offset + i) - mi) / 2) * 16;
 		index += (devc->divcount == 0) ? p : (1 - p);
@@ -30,11 +30,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "la8: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define USB_VENDOR_ID			0x0403
 #define USB_DESCRIPTION			"ChronoVu LA8"
@@ -50,6 +50,9 @@
 #define BS				4096 /* Block size */
 #define NUM_BLOCKS			2048 /* Number of blocks */
 
+/* Bytes read from the device at once, a multiple of BS dividing 1MB. */
+#define READ_SIZE			(64 * 1024)
+
 /* Private, per-device-instance driver context. */
 struct dev_context {
 	/** FTDI device context (used by libftdi). */
@@ -70,7 +73,7 @@ struct dev_context {
 	 * A buffer containing some (mangled) samples from the device.
 	 * Format: Pretty mangled-up (due to hardware reasons), see code.
 	 */
-	uint8_t mangled_buf[BS];
+	uint8_t mangled_buf[READ_SIZE];
 
 	/**
 	 * An 8MB buffer where we'll store the de-mangled samples.
@@ -100,7 +103,7 @@ struct dev_context {
 	/** TODO */
 	time_t done;
 
-	/** Counter/index for the data block to be read. */
+	/** Counter/index for the next data block to be read. */
 	int block_counter;
 
 	/** The divcount value (determines the sample period) for the LA8. */
@@ -218,6 +218,7 @@ SR_PRIV int colead_slm_receive_data(int fd, int revents, void *cb_data)
 		devc->buflen += len;
 		if (devc->buflen > 10) {
 			sr_dbg("buffer overrun");
+			sr_session_dev_stats_add(sdi, 1, 0);
 			devc->state = IDLE;
 			return TRUE;
 		}
@@ -0,0 +1,615 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Helper functions to convert raw ADC samples to floats.
+ *
+ * Every function converts 'count' samples with value = raw * gain + offset.
+ * The strides are the distance between two consecutive samples in the
+ * input and output buffer, counted in samples. They deinterleave samples
+ * of several channels from one input buffer, or interleave them into one
+ * output buffer. Dense buffers (both strides 1) take a separate loop the
+ * compiler can vectorize.
+ *
+ * sr_analog_transpose() converts floats between the interleaved and the
+ * planar layout.
+ *
+ * The sr_analog_batch functions collect single readings, e.g. those of a
+ * multimeter, into SR_DF_ANALOG packets of many samples each.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "analog: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/**
+ * Convert unsigned 8-bit samples.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_u8_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset)
+{
+	uint64_t i;
+
+	if (in_stride == 1 && out_stride == 1) {
+		for (i = 0; i < count; i++)
+			out[i] = in[i] * gain + offset;
+	} else {
+		for (i = 0; i < count; i++)
+			out[i * out_stride] = in[i * in_stride] * gain + offset;
+	}
+}
+
+/**
+ * Convert signed 8-bit samples.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_s8_to_float(const int8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset)
+{
+	uint64_t i;
+
+	if (in_stride == 1 && out_stride == 1) {
+		for (i = 0; i < count; i++)
+			out[i] = in[i] * gain + offset;
+	} else {
+		for (i = 0; i < count; i++)
+			out[i * out_stride] = in[i * in_stride] * gain + offset;
+	}
+}
+
+/**
+ * Convert signed 16-bit samples in host byte order.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_s16_to_float(const int16_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset)
+{
+	uint64_t i;
+
+	if (in_stride == 1 && out_stride == 1) {
+		for (i = 0; i < count; i++)
+			out[i] = in[i] * gain + offset;
+	} else {
+		for (i = 0; i < count; i++)
+			out[i * out_stride] = in[i * in_stride] * gain + offset;
+	}
+}
+
+/**
+ * Convert unsigned 9-bit samples, stored in the low bits of 16-bit
+ * little endian words. The stride counts words.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_u9_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset)
+{
+	uint64_t i;
+	const uint8_t *p;
+
+	for (i = 0; i < count; i++) {
+		p = in + i * in_stride * 2;
+		out[i * out_stride] = ((p[0] | p[1] << 8) & 0x1ff) * gain + offset;
+	}
+}
+
+/**
+ * Convert signed 16-bit little endian samples. The input needs no
+ * particular alignment.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_s16le_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset)
+{
+	uint64_t i;
+	const uint8_t *p;
+
+	if (in_stride == 1 && out_stride == 1) {
+		for (i = 0; i < count; i++) {
+			p = in + i * 2;
+			out[i] = (int16_t)(p[0] | p[1] << 8) * gain + offset;
+		}
+	} else {
+		for (i = 0; i < count; i++) {
+			p = in + i * in_stride * 2;
+			out[i * out_stride] = (int16_t)(p[0] | p[1] << 8)
+					* gain + offset;
+		}
+	}
+}
+
+static inline int32_t s24le_get(const uint8_t *p)
+{
+	/* Shift the sign bit into place, and back with sign extension. */
+	return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16
+			| (uint32_t)p[2] << 24) >> 8;
+}
+
+/**
+ * Convert signed 24-bit little endian samples, packed in 3 bytes each.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_s24le_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset)
+{
+	uint64_t i;
+
+	if (in_stride == 1 && out_stride == 1) {
+		for (i = 0; i < count; i++)
+			out[i] = s24le_get(in + i * 3) * gain + offset;
+	} else {
+		for (i = 0; i < count; i++)
+			out[i * out_stride] = s24le_get(in + i * in_stride * 3)
+					* gain + offset;
+	}
+}
+
+static inline uint32_t u32le_get(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+			| (uint32_t)p[3] << 24;
+}
+
+/**
+ * Convert signed 32-bit little endian samples. The input needs no
+ * particular alignment.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_s32le_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset)
+{
+	uint64_t i;
+
+	if (in_stride == 1 && out_stride == 1) {
+		for (i = 0; i < count; i++)
+			out[i] = (int32_t)u32le_get(in + i * 4) * gain + offset;
+	} else {
+		for (i = 0; i < count; i++)
+			out[i * out_stride] = (int32_t)u32le_get(
+					in + i * in_stride * 4) * gain + offset;
+	}
+}
+
+/**
+ * Convert IEEE 754 single precision little endian samples. The input
+ * needs no particular alignment.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_f32le_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset)
+{
+	uint64_t i;
+	union {
+		uint32_t u;
+		float f;
+	} v;
+
+	if (in_stride == 1 && out_stride == 1) {
+		for (i = 0; i < count; i++) {
+			v.u = u32le_get(in + i * 4);
+			out[i] = v.f * gain + offset;
+		}
+	} else {
+		for (i = 0; i < count; i++) {
+			v.u = u32le_get(in + i * in_stride * 4);
+			out[i * out_stride] = v.f * gain + offset;
+		}
+	}
+}
+
+/**
+ * Get the size of one raw analog sample.
+ *
+ * @param encoding One of SR_ANALOG_*.
+ *
+ * @return The size in bytes, or 0 for unknown encodings.
+ *
+ * @private
+ */
+SR_PRIV int sr_analog_encoding_size(int encoding)
+{
+	switch (encoding) {
+	case SR_ANALOG_U8:
+	case SR_ANALOG_S8:
+		return 1;
+	case SR_ANALOG_S16:
+	case SR_ANALOG_U9:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Convert a raw analog payload to floats.
+ *
+ * @param raw The payload to convert. Must not be NULL.
+ * @param out Where to put the values, room for num_samples times the
+ *            number of probes. They are interleaved like the raw samples.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG for unknown encodings.
+ *
+ * @private
+ */
+SR_PRIV int sr_analog_raw_to_float(const struct sr_datafeed_analog_raw *raw,
+		float *out)
+{
+	const uint8_t *in;
+	unsigned int num_probes, i;
+	int size;
+
+	if (!(size = sr_analog_encoding_size(raw->encoding))) {
+		sr_err("Unknown analog encoding %d.", raw->encoding);
+		return SR_ERR_ARG;
+	}
+
+	num_probes = g_slist_length(raw->probes);
+	for (i = 0; i < num_probes; i++) {
+		in = (const uint8_t *)raw->data + i * size;
+		switch (raw->encoding) {
+		case SR_ANALOG_U8:
+			sr_analog_u8_to_float(in, num_probes, out + i,
+					num_probes, raw->num_samples,
+					raw->scale[i], raw->offset[i]);
+			break;
+		case SR_ANALOG_S8:
+			sr_analog_s8_to_float((const int8_t *)in, num_probes,
+					out + i, num_probes, raw->num_samples,
+					raw->scale[i], raw->offset[i]);
+			break;
+		case SR_ANALOG_S16:
+			sr_analog_s16_to_float((const int16_t *)in, num_probes,
+					out + i, num_probes, raw->num_samples,
+					raw->scale[i], raw->offset[i]);
+			break;
+		case SR_ANALOG_U9:
+			sr_analog_u9_to_float(in, num_probes, out + i,
+					num_probes, raw->num_samples,
+					raw->scale[i], raw->offset[i]);
+			break;
+		}
+	}
+
+	return SR_OK;
+}
+
+/* Side of the square blocks sr_analog_transpose() copies at a time. */
+#define TRANSPOSE_BLOCK 16
+
+/**
+ * Transpose rows of cols values each into cols rows of rows values each.
+ *
+ * With rows samples of cols probes, this turns interleaved samples into
+ * planar ones (all of the first probe's samples, then all of the
+ * second's, and so on), and with rows probes of cols samples each, planar
+ * samples into interleaved ones. Few probes, the common case, take loops
+ * which read or write sequentially; anything else is copied in square
+ * blocks, so both sides stay within the cache.
+ *
+ * @param in The values to transpose.
+ * @param out Where to put them, room for rows times cols values. Must not
+ *            overlap in.
+ * @param rows The number of rows in.
+ * @param cols The number of values per row in.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_transpose(const float *in, float *out, uint64_t rows,
+		uint64_t cols)
+{
+	uint64_t r, c, rb, cb, r_end, c_end;
+
+	if (rows == 1 || cols == 1) {
+		memcpy(out, in, rows * cols * sizeof(float));
+	} else if (cols < TRANSPOSE_BLOCK) {
+		for (c = 0; c < cols; c++)
+			for (r = 0; r < rows; r++)
+				out[c * rows + r] = in[r * cols + c];
+	} else if (rows < TRANSPOSE_BLOCK) {
+		for (r = 0; r < rows; r++)
+			for (c = 0; c < cols; c++)
+				out[c * rows + r] = in[r * cols + c];
+	} else {
+		for (rb = 0; rb < rows; rb += TRANSPOSE_BLOCK) {
+			r_end = MIN(rb + TRANSPOSE_BLOCK, rows);
+			for (cb = 0; cb < cols; cb += TRANSPOSE_BLOCK) {
+				c_end = MIN(cb + TRANSPOSE_BLOCK, cols);
+				for (r = rb; r < r_end; r++)
+					for (c = cb; c < c_end; c++)
+						out[c * rows + r] =
+							in[r * cols + c];
+			}
+		}
+	}
+}
+
+/**
+ * Set up a batch of readings for a new acquisition.
+ *
+ * The max_samples and max_wait fields are left alone, they are set by the
+ * driver from SR_CONF_BATCH_SAMPLES and SR_CONF_BATCH_MSEC.
+ *
+ * @param batch The batch. Must not be NULL.
+ * @param cb_data The device instance the readings are sent for.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_batch_start(struct sr_analog_batch *batch,
+		void *cb_data)
+{
+	batch->cb_data = cb_data;
+	batch->num_samples = 0;
+}
+
+/**
+ * Send the readings collected so far, if any.
+ *
+ * @param batch The batch. Must not be NULL.
+ *
+ * @return SR_OK upon success, or an error from sr_session_send_timed().
+ *
+ * @private
+ */
+SR_PRIV int sr_analog_batch_flush(struct sr_analog_batch *batch)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+
+	if (!batch->num_samples)
+		return SR_OK;
+
+	analog = batch->analog;
+	analog.num_samples = batch->num_samples;
+	analog.data = batch->data;
+	batch->num_samples = 0;
+
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+
+	return sr_session_send_timed(batch->cb_data, &packet,
+			batch->timestamps);
+}
+
+/* Make room for count more samples of num_probes values. */
+static int batch_grow(struct sr_analog_batch *batch, unsigned int num_probes,
+		uint64_t count)
+{
+	float *data;
+	int64_t *timestamps;
+	uint64_t size;
+
+	if (batch->num_samples + count <= batch->size)
+		return SR_OK;
+
+	size = MAX(batch->size * 2, 16);
+	size = MAX(size, batch->num_samples + count);
+	if (!(data = g_try_realloc(batch->data,
+			size * num_probes * sizeof(float)))) {
+		sr_err("%s: data malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	batch->data = data;
+	if (!(timestamps = g_try_realloc(batch->timestamps,
+			size * sizeof(int64_t)))) {
+		sr_err("%s: timestamps malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	batch->timestamps = timestamps;
+	batch->size = size;
+
+	return SR_OK;
+}
+
+/*
+ * Send the readings collected so far if the new ones don't go with them,
+ * and make room for count of the new ones.
+ */
+static int batch_prepare(struct sr_analog_batch *batch,
+		const struct sr_datafeed_analog *analog, uint64_t count)
+{
+	unsigned int num_probes;
+	int ret;
+
+	if (batch->num_samples && (analog->probes != batch->analog.probes
+	    || analog->mq != batch->analog.mq
+	    || analog->unit != batch->analog.unit
+	    || analog->mqflags != batch->analog.mqflags)) {
+		if ((ret = sr_analog_batch_flush(batch)) != SR_OK)
+			return ret;
+	}
+
+	num_probes = g_slist_length(analog->probes);
+	if (batch->num_probes != num_probes) {
+		/* The buffers hold a different number of values now. */
+		batch->num_probes = num_probes;
+		batch->size = 0;
+	}
+
+	return batch_grow(batch, num_probes, count);
+}
+
+/**
+ * Add a reading to a batch, or send it right away.
+ *
+ * Readings are sent as they are when batch->max_samples is 0 or 1.
+ * Otherwise they are collected, and sent once there are max_samples of
+ * them or the first has waited max_wait. A reading with a different
+ * probe list, MQ, unit or MQ flags than the ones collected so far
+ * sends those first.
+ *
+ * @param batch The batch. Must not be NULL.
+ * @param analog The reading, with one sample per probe. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_MALLOC upon memory allocation errors,
+ *         or an error from sending the packet.
+ *
+ * @private
+ */
+SR_PRIV int sr_analog_batch_add(struct sr_analog_batch *batch,
+		const struct sr_datafeed_analog *analog)
+{
+	struct sr_datafeed_packet packet;
+	unsigned int num_probes;
+	int ret;
+
+	if (batch->max_samples <= 1) {
+		packet.type = SR_DF_ANALOG;
+		packet.payload = analog;
+		return sr_session_send(batch->cb_data, &packet);
+	}
+
+	if ((ret = batch_prepare(batch, analog, 1)) != SR_OK)
+		return ret;
+	num_probes = batch->num_probes;
+
+	batch->analog = *analog;
+	memcpy(batch->data + batch->num_samples * num_probes, analog->data,
+			num_probes * sizeof(float));
+	batch->timestamps[batch->num_samples++] = g_get_monotonic_time();
+
+	if (batch->num_samples >= batch->max_samples)
+		return sr_analog_batch_flush(batch);
+
+	return sr_analog_batch_poll(batch);
+}
+
+/**
+ * Add readings downloaded from a device's memory to a batch.
+ *
+ * This is the bulk counterpart of sr_analog_batch_add(), for drivers
+ * which decode a whole block of stored records at once. The readings are
+ * sent in packets of batch->max_samples, or all of them in one packet if
+ * that is 0, each one stamped with when it was taken. Since they were not
+ * taken just now, max_wait does not apply to them; drivers should leave
+ * it 0 and flush the batch once the download is done.
+ *
+ * @param batch The batch. Must not be NULL.
+ * @param analog The readings, num_samples of them with one value per
+ *               probe each. Must not be NULL.
+ * @param timestamp When the first reading was taken, in
+ *                  g_get_monotonic_time() microseconds.
+ * @param interval The time between readings, in microseconds.
+ *
+ * @return SR_OK upon success, SR_ERR_MALLOC upon memory allocation errors,
+ *         or an error from sending the packet.
+ *
+ * @private
+ */
+SR_PRIV int sr_analog_batch_add_stored(struct sr_analog_batch *batch,
+		const struct sr_datafeed_analog *analog, int64_t timestamp,
+		int64_t interval)
+{
+	uint64_t total, done, count, i;
+	int ret;
+
+	total = analog->num_samples > 0 ? analog->num_samples : 0;
+	for (done = 0; done < total; done += count) {
+		if (batch->max_samples
+		    && batch->num_samples >= batch->max_samples
+		    && (ret = sr_analog_batch_flush(batch)) != SR_OK)
+			return ret;
+		count = total - done;
+		if (batch->max_samples)
+			count = MIN(count,
+				    batch->max_samples - batch->num_samples);
+		if ((ret = batch_prepare(batch, analog, count)) != SR_OK)
+			return ret;
+
+		batch->analog = *analog;
+		memcpy(batch->data + batch->num_samples * batch->num_probes,
+				analog->data + done * batch->num_probes,
+				count * batch->num_probes * sizeof(float));
+		for (i = 0; i < count; i++)
+			batch->timestamps[batch->num_samples + i] =
+					timestamp + (done + i) * interval;
+		batch->num_samples += count;
+
+		if (!batch->max_samples
+		    && (ret = sr_analog_batch_flush(batch)) != SR_OK)
+			return ret;
+	}
+	if (batch->max_samples && batch->num_samples >= batch->max_samples)
+		return sr_analog_batch_flush(batch);
+
+	return SR_OK;
+}
+
+/**
+ * Send the collected readings if the first of them has waited max_wait.
+ *
+ * Drivers call this regularly, so readings go out in time even when no
+ * new ones arrive.
+ *
+ * @param batch The batch. Must not be NULL.
+ *
+ * @return SR_OK upon success, or an error from sending the packet.
+ *
+ * @private
+ */
+SR_PRIV int sr_analog_batch_poll(struct sr_analog_batch *batch)
+{
+	if (!batch->num_samples || !batch->max_wait)
+		return SR_OK;
+
+	if (g_get_monotonic_time() - batch->timestamps[0] < batch->max_wait)
+		return SR_OK;
+
+	return sr_analog_batch_flush(batch);
+}
+
+/**
+ * Free the buffers of a batch. Readings not yet sent are dropped.
+ *
+ * @param batch The batch. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_batch_clear(struct sr_analog_batch *batch)
+{
+	g_free(batch->data);
+	g_free(batch->timestamps);
+	batch->data = NULL;
+	batch->timestamps = NULL;
+	batch->size = 0;
+	batch->num_samples = 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Table-driven helpers shared by the DMM chip parsers.
+ *
+ * A chip parser describes its packet with static tables (which bit sets
+ * which flag, what the flags mean for the measurement, which 7-segment
+ * bytes are which digits), and these run over them. The tables are
+ * const data built by the compiler, so adding a chip means writing
+ * tables rather than another set of branches.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+static const float powers_of_ten[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+	1000000000,
+};
+
+/**
+ * Set the flags of an info struct from the bits of a packet.
+ *
+ * @param buf The protocol packet. Must not be NULL.
+ * @param flags The chip's flag table.
+ * @param num_flags The number of entries in the flag table.
+ * @param info The chip's info struct, whose flags are set. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_dmm_flags_parse(const uint8_t *buf,
+		const struct sr_dmm_flag *flags, int num_flags, void *info)
+{
+	int i;
+
+	for (i = 0; i < num_flags; i++)
+		G_STRUCT_MEMBER(gboolean, info, flags[i].offset) =
+			(buf[flags[i].byte] & flags[i].mask) != 0;
+}
+
+/**
+ * Count the set flags out of a group of them, e.g. to check that a packet
+ * has at most one multiplier.
+ *
+ * @param info The chip's info struct. Must not be NULL.
+ * @param offsets The offsets of the flags in the info struct.
+ * @param num_offsets The number of offsets.
+ *
+ * @return The number of flags set.
+ *
+ * @private
+ */
+SR_PRIV int sr_dmm_flags_count(const void *info, const uint16_t *offsets,
+		int num_offsets)
+{
+	int i, count;
+
+	count = 0;
+	for (i = 0; i < num_offsets; i++)
+		count += G_STRUCT_MEMBER(gboolean, info, offsets[i]) ? 1 : 0;
+
+	return count;
+}
+
+/**
+ * Scale a value by the multiplier flags which are set.
+ *
+ * @param info The chip's info struct. Must not be NULL.
+ * @param factors The chip's multiplier table.
+ * @param num_factors The number of entries in the multiplier table.
+ * @param floatval The value to scale. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_dmm_factors_apply(const void *info,
+		const struct sr_dmm_factor *factors, int num_factors,
+		float *floatval)
+{
+	int i, exponent;
+
+	for (i = 0; i < num_factors; i++) {
+		if (!G_STRUCT_MEMBER(gboolean, info, factors[i].offset))
+			continue;
+		/* Divide for negative exponents, to round like 1/10^n does. */
+		exponent = factors[i].exponent;
+		if (exponent < 0)
+			*floatval /= powers_of_ten[-exponent];
+		else
+			*floatval *= powers_of_ten[exponent];
+	}
+}
+
+/**
+ * Set the mq, unit and mqflags of an analog packet from the mode flags
+ * which are set.
+ *
+ * @param info The chip's info struct. Must not be NULL.
+ * @param modes The chip's mode table.
+ * @param num_modes The number of entries in the mode table.
+ * @param analog The analog packet to fill in. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_dmm_modes_apply(const void *info,
+		const struct sr_dmm_mode *modes, int num_modes,
+		struct sr_datafeed_analog *analog)
+{
+	int i;
+
+	for (i = 0; i < num_modes; i++) {
+		if (!G_STRUCT_MEMBER(gboolean, info, modes[i].offset))
+			continue;
+		if (modes[i].mq) {
+			analog->mq = modes[i].mq;
+			analog->unit = modes[i].unit;
+		}
+		analog->mqflags |= modes[i].mqflags;
+	}
+}
+
+/**
+ * Set up the packet framing of a DMM's receive stream.
+ *
+ * @param framer The framing state to set up. Must not be NULL.
+ * @param packet_size The chip's packet size.
+ * @param sync The chip's sync byte. Must not be NULL.
+ * @param packet_valid The chip's packet check.
+ *
+ * @private
+ */
+SR_PRIV void sr_dmm_framer_init(struct sr_dmm_framer *framer,
+		int packet_size, const struct sr_dmm_sync *sync,
+		gboolean (*packet_valid)(const uint8_t *))
+{
+	framer->packet_size = packet_size;
+	framer->sync = *sync;
+	framer->packet_valid = packet_valid;
+	framer->locked = FALSE;
+}
+
+/*
+ * Find the first offset from the given one on at which a packet may start,
+ * judging by the sync byte only. Returns an offset which leaves less than
+ * a packet's worth of data if there is none.
+ */
+static int sync_find(const struct sr_dmm_framer *framer, const uint8_t *buf,
+		int offset, int len)
+{
+	const struct sr_dmm_sync *sync;
+	const uint8_t *p;
+	int i, last;
+
+	sync = &framer->sync;
+	if (sync->offset < 0)
+		return offset;
+
+	/* Positions of the sync byte for complete packets. */
+	i = offset + sync->offset;
+	last = len - framer->packet_size + sync->offset;
+	if (i > last)
+		return offset;
+
+	if (sync->mask == 0xff) {
+		/* memchr() compares a word or a vector at a time. */
+		if ((p = memchr(buf + i, sync->value, last - i + 1)))
+			return p - buf - sync->offset;
+	} else {
+		for (; i <= last; i++) {
+			if ((buf[i] & sync->mask) == sync->value)
+				return i - sync->offset;
+		}
+	}
+
+	return last - sync->offset + 1;
+}
+
+/**
+ * Find all valid packets in a buffer of received bytes.
+ *
+ * Once a valid packet was found, the next one is expected right after it.
+ * Only when it isn't valid, the framer looks for the next byte offset the
+ * chip's sync byte matches at, and runs the packet check there.
+ *
+ * @param framer The stream's framing state. Must not be NULL.
+ * @param buf The received bytes. Must not be NULL.
+ * @param len The number of received bytes.
+ * @param packet_cb Called with every valid packet, in order.
+ * @param cb_data Passed to packet_cb.
+ *
+ * @return The number of bytes used up. The rest may be the start of a
+ *         packet which is not complete yet, and must be kept for the
+ *         next call.
+ *
+ * @private
+ */
+SR_PRIV int sr_dmm_framer_parse(struct sr_dmm_framer *framer,
+		const uint8_t *buf, int len,
+		void (*packet_cb)(const uint8_t *, void *), void *cb_data)
+{
+	int offset;
+
+	offset = 0;
+	while (len - offset >= framer->packet_size) {
+		if (!framer->locked) {
+			offset = sync_find(framer, buf, offset, len);
+			if (len - offset < framer->packet_size)
+				break;
+		}
+		if (framer->packet_valid(buf + offset)) {
+			framer->locked = TRUE;
+			packet_cb(buf + offset, cb_data);
+			offset += framer->packet_size;
+		} else {
+			framer->locked = FALSE;
+			offset++;
+		}
+	}
+
+	return offset;
+}
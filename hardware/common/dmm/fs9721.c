@@ -41,39 +41,106 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "fs9721: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/* The digit bytes, with bit 7 (not part of the digit) cleared. */
+static const uint8_t digits[256] = SR_DMM_SEGMENTS(
+	0x7d, 0x05, 0x5b, 0x1f, 0x27, 0x3e, 0x7e, 0x15, 0x7f, 0x3f);
+
+#define FLAG(field, byte, bit) \
+	SR_DMM_FLAG(struct fs9721_info, field, byte, bit)
+
+static const struct sr_dmm_flag flags[] = {
+	/* Byte 0: LCD SEG1 */
+	FLAG(is_ac, 0, 3),
+	FLAG(is_dc, 0, 2),
+	FLAG(is_auto, 0, 1),
+	FLAG(is_rs232, 0, 0),
+	/* Byte 1: LCD SEG2 */
+	FLAG(is_sign, 1, 3),
+	/* Byte 9: LCD SEG10 */
+	FLAG(is_micro, 9, 3),
+	FLAG(is_nano, 9, 2),
+	FLAG(is_kilo, 9, 1),
+	FLAG(is_diode, 9, 0),
+	/* Byte 10: LCD SEG11 */
+	FLAG(is_milli, 10, 3),
+	FLAG(is_percent, 10, 2),
+	FLAG(is_mega, 10, 1),
+	FLAG(is_beep, 10, 0),
+	/* Byte 11: LCD SEG12 */
+	FLAG(is_farad, 11, 3),
+	FLAG(is_ohm, 11, 2),
+	FLAG(is_rel, 11, 1),
+	FLAG(is_hold, 11, 0),
+	/* Byte 12: LCD SEG13 */
+	FLAG(is_ampere, 12, 3),
+	FLAG(is_volt, 12, 2),
+	FLAG(is_hz, 12, 1),
+	FLAG(is_bat, 12, 0),
+	/* Byte 13: LCD SEG14 */
+	FLAG(is_c2c1_11, 13, 3),
+	FLAG(is_c2c1_10, 13, 2),
+	FLAG(is_c2c1_01, 13, 1),
+	FLAG(is_c2c1_00, 13, 0),
+};
+
+#define FIELD(field) G_STRUCT_OFFSET(struct fs9721_info, field)
+
+static const uint16_t multipliers[] = {
+	FIELD(is_nano), FIELD(is_micro), FIELD(is_milli), FIELD(is_kilo),
+	FIELD(is_mega),
+};
+
+static const uint16_t measurements[] = {
+	FIELD(is_hz), FIELD(is_ohm), FIELD(is_farad), FIELD(is_ampere),
+	FIELD(is_volt), FIELD(is_percent),
+};
+
+#define FACTOR(field, exponent) \
+	SR_DMM_FACTOR(struct fs9721_info, field, exponent)
+
+static const struct sr_dmm_factor factors[] = {
+	FACTOR(is_nano, -9),
+	FACTOR(is_micro, -6),
+	FACTOR(is_milli, -3),
+	FACTOR(is_kilo, 3),
+	FACTOR(is_mega, 6),
+};
+
+#define MODE(field, mq, unit, mqflags) \
+	SR_DMM_MODE(struct fs9721_info, field, mq, unit, mqflags)
+
+static const struct sr_dmm_mode modes[] = {
+	/* Measurement modes */
+	MODE(is_volt, SR_MQ_VOLTAGE, SR_UNIT_VOLT, 0),
+	MODE(is_ampere, SR_MQ_CURRENT, SR_UNIT_AMPERE, 0),
+	MODE(is_ohm, SR_MQ_RESISTANCE, SR_UNIT_OHM, 0),
+	MODE(is_hz, SR_MQ_FREQUENCY, SR_UNIT_HERTZ, 0),
+	MODE(is_farad, SR_MQ_CAPACITANCE, SR_UNIT_FARAD, 0),
+	MODE(is_beep, SR_MQ_CONTINUITY, SR_UNIT_BOOLEAN, 0),
+	MODE(is_diode, SR_MQ_VOLTAGE, SR_UNIT_VOLT, SR_MQFLAG_DIODE),
+	MODE(is_percent, SR_MQ_DUTY_CYCLE, SR_UNIT_PERCENTAGE, 0),
+	/* Measurement related flags */
+	MODE(is_ac, 0, 0, SR_MQFLAG_AC),
+	MODE(is_dc, 0, 0, SR_MQFLAG_DC),
+	MODE(is_auto, 0, 0, SR_MQFLAG_AUTORANGE),
+	MODE(is_hold, 0, 0, SR_MQFLAG_HOLD),
+	MODE(is_rel, 0, 0, SR_MQFLAG_RELATIVE),
+};
 
 static int parse_digit(uint8_t b)
 {
-	switch (b) {
-	case 0x7d:
-		return 0;
-	case 0x05:
-		return 1;
-	case 0x5b:
-		return 2;
-	case 0x1f:
-		return 3;
-	case 0x27:
-		return 4;
-	case 0x3e:
-		return 5;
-	case 0x7e:
-		return 6;
-	case 0x15:
-		return 7;
-	case 0x7f:
-		return 8;
-	case 0x3f:
-		return 9;
-	default:
+	int digit;
+
+	if ((digit = SR_DMM_SEGMENT_DIGIT(digits, b)) < 0)
 		sr_err("Invalid digit byte: 0x%02x.", b);
-		return -1;
-	}
+
+	return digit;
 }
 
 static gboolean sync_nibbles_valid(const uint8_t *buf)
@@ -94,29 +161,14 @@ static gboolean sync_nibbles_valid(const uint8_t *buf)
 
 static gboolean flags_valid(const struct fs9721_info *info)
 {
-	int count;
-
 	/* Does the packet have more than one multiplier? */
-	count = 0;
-	count += (info->is_nano) ? 1 : 0;
-	count += (info->is_micro) ? 1 : 0;
-	count += (info->is_milli) ? 1 : 0;
-	count += (info->is_kilo) ? 1 : 0;
-	count += (info->is_mega) ? 1 : 0;
-	if (count > 1) {
+	if (sr_dmm_flags_count(info, ARRAY_AND_SIZE(multipliers)) > 1) {
 		sr_err("More than one multiplier detected in packet.");
 		return FALSE;
 	}
 
 	/* Does the packet "measure" more than one type of value? */
-	count = 0;
-	count += (info->is_hz) ? 1 : 0;
-	count += (info->is_ohm) ? 1 : 0;
-	count += (info->is_farad) ? 1 : 0;
-	count += (info->is_ampere) ? 1 : 0;
-	count += (info->is_volt) ? 1 : 0;
-	count += (info->is_percent) ? 1 : 0;
-	if (count > 1) {
+	if (sr_dmm_flags_count(info, ARRAY_AND_SIZE(measurements)) > 1) {
 		sr_err("More than one measurement type detected in packet.");
 		return FALSE;
 	}
@@ -209,109 +261,17 @@ static int parse_value(const uint8_t *buf, float *result)
 
 static void parse_flags(const uint8_t *buf, struct fs9721_info *info)
 {
-	/* Byte 0: LCD SEG1 */
-	info->is_ac         = (buf[0] & (1 << 3)) != 0;
-	info->is_dc         = (buf[0] & (1 << 2)) != 0;
-	info->is_auto       = (buf[0] & (1 << 1)) != 0;
-	info->is_rs232      = (buf[0] & (1 << 0)) != 0;
-
-	/* Byte 1: LCD SEG2 */
-	info->is_sign       = (buf[1] & (1 << 3)) != 0;
-
-	/* Byte 9: LCD SEG10 */
-	info->is_micro      = (buf[9] & (1 << 3)) != 0;
-	info->is_nano       = (buf[9] & (1 << 2)) != 0;
-	info->is_kilo       = (buf[9] & (1 << 1)) != 0;
-	info->is_diode      = (buf[9] & (1 << 0)) != 0;
-
-	/* Byte 10: LCD SEG11 */
-	info->is_milli      = (buf[10] & (1 << 3)) != 0;
-	info->is_percent    = (buf[10] & (1 << 2)) != 0;
-	info->is_mega       = (buf[10] & (1 << 1)) != 0;
-	info->is_beep       = (buf[10] & (1 << 0)) != 0;
-
-	/* Byte 11: LCD SEG12 */
-	info->is_farad      = (buf[11] & (1 << 3)) != 0;
-	info->is_ohm        = (buf[11] & (1 << 2)) != 0;
-	info->is_rel        = (buf[11] & (1 << 1)) != 0;
-	info->is_hold       = (buf[11] & (1 << 0)) != 0;
-
-	/* Byte 12: LCD SEG13 */
-	info->is_ampere     = (buf[12] & (1 << 3)) != 0;
-	info->is_volt       = (buf[12] & (1 << 2)) != 0;
-	info->is_hz         = (buf[12] & (1 << 1)) != 0;
-	info->is_bat        = (buf[12] & (1 << 0)) != 0;
-
-	/* Byte 13: LCD SEG14 */
-	info->is_c2c1_11    = (buf[13] & (1 << 3)) != 0;
-	info->is_c2c1_10    = (buf[13] & (1 << 2)) != 0;
-	info->is_c2c1_01    = (buf[13] & (1 << 1)) != 0;
-	info->is_c2c1_00    = (buf[13] & (1 << 0)) != 0;
+	sr_dmm_flags_parse(buf, ARRAY_AND_SIZE(flags), info);
 }
 
 static void handle_flags(struct sr_datafeed_analog *analog, float *floatval,
 			 const struct fs9721_info *info)
 {
-	/* Factors */
-	if (info->is_nano)
-		*floatval /= 1000000000;
-	if (info->is_micro)
-		*floatval /= 1000000;
-	if (info->is_milli)
-		*floatval /= 1000;
-	if (info->is_kilo)
-		*floatval *= 1000;
-	if (info->is_mega)
-		*floatval *= 1000000;
+	sr_dmm_factors_apply(info, ARRAY_AND_SIZE(factors), floatval);
+	sr_dmm_modes_apply(info, ARRAY_AND_SIZE(modes), analog);
 
-	/* Measurement modes */
-	if (info->is_volt) {
-		analog->mq = SR_MQ_VOLTAGE;
-		analog->unit = SR_UNIT_VOLT;
-	}
-	if (info->is_ampere) {
-		analog->mq = SR_MQ_CURRENT;
-		analog->unit = SR_UNIT_AMPERE;
-	}
-	if (info->is_ohm) {
-		analog->mq = SR_MQ_RESISTANCE;
-		analog->unit = SR_UNIT_OHM;
-	}
-	if (info->is_hz) {
-		analog->mq = SR_MQ_FREQUENCY;
-		analog->unit = SR_UNIT_HERTZ;
-	}
-	if (info->is_farad) {
-		analog->mq = SR_MQ_CAPACITANCE;
-		analog->unit = SR_UNIT_FARAD;
-	}
-	if (info->is_beep) {
-		analog->mq = SR_MQ_CONTINUITY;
-		analog->unit = SR_UNIT_BOOLEAN;
+	if (info->is_beep)
 		*floatval = (*floatval == INFINITY) ? 0.0 : 1.0;
-	}
-	if (info->is_diode) {
-		analog->mq = SR_MQ_VOLTAGE;
-		analog->unit = SR_UNIT_VOLT;
-	}
-	if (info->is_percent) {
-		analog->mq = SR_MQ_DUTY_CYCLE;
-		analog->unit = SR_UNIT_PERCENTAGE;
-	}
-
-	/* Measurement related flags */
-	if (info->is_ac)
-		analog->mqflags |= SR_MQFLAG_AC;
-	if (info->is_dc)
-		analog->mqflags |= SR_MQFLAG_DC;
-	if (info->is_auto)
-		analog->mqflags |= SR_MQFLAG_AUTORANGE;
-	if (info->is_diode)
-		analog->mqflags |= SR_MQFLAG_DIODE;
-	if (info->is_hold)
-		analog->mqflags |= SR_MQFLAG_HOLD;
-	if (info->is_rel)
-		analog->mqflags |= SR_MQFLAG_RELATIVE;
 
 	/* Other flags */
 	if (info->is_rs232)
@@ -32,47 +32,120 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "fs9922: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+#define FLAG(field, byte, bit) \
+	SR_DMM_FLAG(struct fs9922_info, field, byte, bit)
+
+/* Z1/Z2/Z3/Z4 are bits for user-defined LCD symbols (on/off). */
+static const struct sr_dmm_flag flags[] = {
+	/* Byte 7 */
+	/* Bit 7: Always 0 */
+	/* Bit 6: Always 0 */
+	FLAG(is_auto, 7, 5),
+	FLAG(is_dc, 7, 4),
+	FLAG(is_ac, 7, 3),
+	FLAG(is_rel, 7, 2),
+	FLAG(is_hold, 7, 1),
+	FLAG(is_bpn, 7, 0), /* Bargraph shown */
+	/* Byte 8 */
+	FLAG(is_z1, 8, 7), /* User symbol 1 */
+	FLAG(is_z2, 8, 6), /* User symbol 2 */
+	FLAG(is_max, 8, 5),
+	FLAG(is_min, 8, 4),
+	FLAG(is_apo, 8, 3), /* Auto-poweroff on */
+	FLAG(is_bat, 8, 2), /* Battery low */
+	FLAG(is_nano, 8, 1),
+	FLAG(is_z3, 8, 0), /* User symbol 3 */
+	/* Byte 9 */
+	FLAG(is_micro, 9, 7),
+	FLAG(is_milli, 9, 6),
+	FLAG(is_kilo, 9, 5),
+	FLAG(is_mega, 9, 4),
+	FLAG(is_beep, 9, 3),
+	FLAG(is_diode, 9, 2),
+	FLAG(is_percent, 9, 1),
+	FLAG(is_z4, 9, 0), /* User symbol 4 */
+	/* Byte 10 */
+	FLAG(is_volt, 10, 7),
+	FLAG(is_ampere, 10, 6),
+	FLAG(is_ohm, 10, 5),
+	FLAG(is_hfe, 10, 4),
+	FLAG(is_hertz, 10, 3),
+	FLAG(is_farad, 10, 2),
+	FLAG(is_celsius, 10, 1), /* Only FS9922-DMM4 */
+	FLAG(is_fahrenheit, 10, 0), /* Only FS9922-DMM4 */
+};
+
+#define FIELD(field) G_STRUCT_OFFSET(struct fs9922_info, field)
+
+static const uint16_t multipliers[] = {
+	FIELD(is_nano), FIELD(is_micro), FIELD(is_milli), FIELD(is_kilo),
+	FIELD(is_mega),
+};
+
+/*
+ * Note: In "diode mode", both is_diode and is_volt will be set.
+ * That is a valid use-case, so is_diode is not counted here.
+ */
+static const uint16_t measurements[] = {
+	FIELD(is_percent), FIELD(is_volt), FIELD(is_ampere), FIELD(is_ohm),
+	FIELD(is_hfe), FIELD(is_hertz), FIELD(is_farad), FIELD(is_celsius),
+	FIELD(is_fahrenheit),
+};
+
+#define FACTOR(field, exponent) \
+	SR_DMM_FACTOR(struct fs9922_info, field, exponent)
+
+static const struct sr_dmm_factor factors[] = {
+	FACTOR(is_nano, -9),
+	FACTOR(is_micro, -6),
+	FACTOR(is_milli, -3),
+	FACTOR(is_kilo, 3),
+	FACTOR(is_mega, 6),
+};
+
+#define MODE(field, mq, unit, mqflags) \
+	SR_DMM_MODE(struct fs9922_info, field, mq, unit, mqflags)
+
+static const struct sr_dmm_mode modes[] = {
+	/* Measurement modes */
+	MODE(is_volt, SR_MQ_VOLTAGE, SR_UNIT_VOLT, 0),
+	/* Note: In "diode mode" both is_diode and is_volt are set. */
+	MODE(is_diode, SR_MQ_VOLTAGE, SR_UNIT_VOLT, SR_MQFLAG_DIODE),
+	MODE(is_ampere, SR_MQ_CURRENT, SR_UNIT_AMPERE, 0),
+	MODE(is_ohm, SR_MQ_RESISTANCE, SR_UNIT_OHM, 0),
+	MODE(is_hfe, SR_MQ_GAIN, SR_UNIT_UNITLESS, 0),
+	MODE(is_hertz, SR_MQ_FREQUENCY, SR_UNIT_HERTZ, 0),
+	MODE(is_farad, SR_MQ_CAPACITANCE, SR_UNIT_FARAD, 0),
+	MODE(is_celsius, SR_MQ_TEMPERATURE, SR_UNIT_CELSIUS, 0),
+	MODE(is_fahrenheit, SR_MQ_TEMPERATURE, SR_UNIT_FAHRENHEIT, 0),
+	MODE(is_beep, SR_MQ_CONTINUITY, SR_UNIT_BOOLEAN, 0),
+	MODE(is_percent, SR_MQ_DUTY_CYCLE, SR_UNIT_PERCENTAGE, 0),
+	/* Measurement related flags */
+	MODE(is_ac, 0, 0, SR_MQFLAG_AC),
+	MODE(is_dc, 0, 0, SR_MQFLAG_DC),
+	MODE(is_auto, 0, 0, SR_MQFLAG_AUTORANGE),
+	MODE(is_hold, 0, 0, SR_MQFLAG_HOLD),
+	MODE(is_max, 0, 0, SR_MQFLAG_MAX),
+	MODE(is_min, 0, 0, SR_MQFLAG_MIN),
+	MODE(is_rel, 0, 0, SR_MQFLAG_RELATIVE),
+};
 
 static gboolean flags_valid(const struct fs9922_info *info)
 {
-	int count;
-
 	/* Does the packet have more than one multiplier? */
-	count = 0;
-	count += (info->is_nano) ? 1 : 0;
-	count += (info->is_micro) ? 1 : 0;
-	count += (info->is_milli) ? 1 : 0;
-	count += (info->is_kilo) ? 1 : 0;
-	count += (info->is_mega) ? 1 : 0;
-	if (count > 1) {
+	if (sr_dmm_flags_count(info, ARRAY_AND_SIZE(multipliers)) > 1) {
 		sr_err("More than one multiplier detected in packet.");
 		return FALSE;
 	}
 
-	/*
-	 * Does the packet "measure" more than one type of value?
-	 *
-	 * Note: In "diode mode", both is_diode and is_volt will be set.
-	 * That is a valid use-case, so we don't want to error out below
-	 * if it happens. Thus, we don't check for is_diode here.
-	 */
-	count = 0;
-	// count += (info->is_diode) ? 1 : 0;
-	count += (info->is_percent) ? 1 : 0;
-	count += (info->is_volt) ? 1 : 0;
-	count += (info->is_ampere) ? 1 : 0;
-	count += (info->is_ohm) ? 1 : 0;
-	count += (info->is_hfe) ? 1 : 0;
-	count += (info->is_hertz) ? 1 : 0;
-	count += (info->is_farad) ? 1 : 0;
-	count += (info->is_celsius) ? 1 : 0;
-	count += (info->is_fahrenheit) ? 1 : 0;
-	if (count > 1) {
+	/* Does the packet "measure" more than one type of value? */
+	if (sr_dmm_flags_count(info, ARRAY_AND_SIZE(measurements)) > 1) {
 		sr_err("More than one measurement type detected in packet.");
 		return FALSE;
 	}
@@ -164,47 +237,7 @@ static int parse_value(const uint8_t *buf, float *result)
 
 static void parse_flags(const uint8_t *buf, struct fs9922_info *info)
 {
-	/* Z1/Z2/Z3/Z4 are bits for user-defined LCD symbols (on/off). */
-
-	/* Byte 7 */
-	/* Bit 7: Always 0 */
-	/* Bit 6: Always 0 */
-	info->is_auto       = (buf[7] & (1 << 5)) != 0;
-	info->is_dc         = (buf[7] & (1 << 4)) != 0;
-	info->is_ac         = (buf[7] & (1 << 3)) != 0;
-	info->is_rel        = (buf[7] & (1 << 2)) != 0;
-	info->is_hold       = (buf[7] & (1 << 1)) != 0;
-	info->is_bpn        = (buf[7] & (1 << 0)) != 0; /* Bargraph shown */
-
-	/* Byte 8 */
-	info->is_z1         = (buf[8] & (1 << 7)) != 0; /* User symbol 1 */
-	info->is_z2         = (buf[8] & (1 << 6)) != 0; /* User symbol 2 */
-	info->is_max        = (buf[8] & (1 << 5)) != 0;
-	info->is_min        = (buf[8] & (1 << 4)) != 0;
-	info->is_apo        = (buf[8] & (1 << 3)) != 0; /* Auto-poweroff on */
-	info->is_bat        = (buf[8] & (1 << 2)) != 0; /* Battery low */
-	info->is_nano       = (buf[8] & (1 << 1)) != 0;
-	info->is_z3         = (buf[8] & (1 << 0)) != 0; /* User symbol 3 */
-
-	/* Byte 9 */
-	info->is_micro      = (buf[9] & (1 << 7)) != 0;
-	info->is_milli      = (buf[9] & (1 << 6)) != 0;
-	info->is_kilo       = (buf[9] & (1 << 5)) != 0;
-	info->is_mega       = (buf[9] & (1 << 4)) != 0;
-	info->is_beep       = (buf[9] & (1 << 3)) != 0;
-	info->is_diode      = (buf[9] & (1 << 2)) != 0;
-	info->is_percent    = (buf[9] & (1 << 1)) != 0;
-	info->is_z4         = (buf[9] & (1 << 0)) != 0; /* User symbol 4 */
-
-	/* Byte 10 */
-	info->is_volt       = (buf[10] & (1 << 7)) != 0;
-	info->is_ampere     = (buf[10] & (1 << 6)) != 0;
-	info->is_ohm        = (buf[10] & (1 << 5)) != 0;
-	info->is_hfe        = (buf[10] & (1 << 4)) != 0;
-	info->is_hertz      = (buf[10] & (1 << 3)) != 0;
-	info->is_farad      = (buf[10] & (1 << 2)) != 0;
-	info->is_celsius    = (buf[10] & (1 << 1)) != 0; /* Only FS9922-DMM4 */
-	info->is_fahrenheit = (buf[10] & (1 << 0)) != 0; /* Only FS9922-DMM4 */
+	sr_dmm_flags_parse(buf, ARRAY_AND_SIZE(flags), info);
 
 	/*
 	 * Byte 11: Bar graph
@@ -230,79 +263,11 @@ static void parse_flags(const uint8_t *buf, struct fs9922_info *info)
 static void handle_flags(struct sr_datafeed_analog *analog, float *floatval,
 			 const struct fs9922_info *info)
 {
-	/* Factors */
-	if (info->is_nano)
-		*floatval /= 1000000000;
-	if (info->is_micro)
-		*floatval /= 1000000;
-	if (info->is_milli)
-		*floatval /= 1000;
-	if (info->is_kilo)
-		*floatval *= 1000;
-	if (info->is_mega)
-		*floatval *= 1000000;
+	sr_dmm_factors_apply(info, ARRAY_AND_SIZE(factors), floatval);
+	sr_dmm_modes_apply(info, ARRAY_AND_SIZE(modes), analog);
 
-	/* Measurement modes */
-	if (info->is_volt || info->is_diode) {
-		/* Note: In "diode mode" both is_diode and is_volt are set. */
-		analog->mq = SR_MQ_VOLTAGE;
-		analog->unit = SR_UNIT_VOLT;
-	}
-	if (info->is_ampere) {
-		analog->mq = SR_MQ_CURRENT;
-		analog->unit = SR_UNIT_AMPERE;
-	}
-	if (info->is_ohm) {
-		analog->mq = SR_MQ_RESISTANCE;
-		analog->unit = SR_UNIT_OHM;
-	}
-	if (info->is_hfe) {
-		analog->mq = SR_MQ_GAIN;
-		analog->unit = SR_UNIT_UNITLESS;
-	}
-	if (info->is_hertz) {
-		analog->mq = SR_MQ_FREQUENCY;
-		analog->unit = SR_UNIT_HERTZ;
-	}
-	if (info->is_farad) {
-		analog->mq = SR_MQ_CAPACITANCE;
-		analog->unit = SR_UNIT_FARAD;
-	}
-	if (info->is_celsius) {
-		analog->mq = SR_MQ_TEMPERATURE;
-		analog->unit = SR_UNIT_CELSIUS;
-	}
-	if (info->is_fahrenheit) {
-		analog->mq = SR_MQ_TEMPERATURE;
-		analog->unit = SR_UNIT_FAHRENHEIT;
-	}
-	if (info->is_beep) {
-		analog->mq = SR_MQ_CONTINUITY;
-		analog->unit = SR_UNIT_BOOLEAN;
+	if (info->is_beep)
 		*floatval = (*floatval == INFINITY) ? 0.0 : 1.0;
-	}
-	if (info->is_percent) {
-		analog->mq = SR_MQ_DUTY_CYCLE;
-		analog->unit = SR_UNIT_PERCENTAGE;
-	}
-
-	/* Measurement related flags */
-	if (info->is_ac)
-		analog->mqflags |= SR_MQFLAG_AC;
-	if (info->is_dc)
-		analog->mqflags |= SR_MQFLAG_DC;
-	if (info->is_auto)
-		analog->mqflags |= SR_MQFLAG_AUTORANGE;
-	if (info->is_diode)
-		analog->mqflags |= SR_MQFLAG_DIODE;
-	if (info->is_hold)
-		analog->mqflags |= SR_MQFLAG_HOLD;
-	if (info->is_max)
-		analog->mqflags |= SR_MQFLAG_MAX;
-	if (info->is_min)
-		analog->mqflags |= SR_MQFLAG_MIN;
-	if (info->is_rel)
-		analog->mqflags |= SR_MQFLAG_RELATIVE;
 
 	/* Other flags */
 	if (info->is_apo)
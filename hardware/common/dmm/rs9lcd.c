@@ -38,11 +38,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "rs9lcd: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 /* Byte 1 of the packet, and the modes it represents */
 #define IND1_HZ		(1 << 7)
@@ -227,37 +227,26 @@ SR_PRIV gboolean sr_rs9lcd_packet_valid(const uint8_t *buf)
 	return TRUE;
 }
 
+static const uint8_t lcd_digits[256] = SR_DMM_SEGMENTS(
+	LCD_0, LCD_1, LCD_2, LCD_3, LCD_4, LCD_5, LCD_6, LCD_7, LCD_8, LCD_9);
+
 static uint8_t decode_digit(uint8_t raw_digit)
 {
-	/* Take out the decimal point, so we can use a simple switch(). */
+	int digit;
+
+	/* Take out the decimal point, so we can use the digit map. */
 	raw_digit &= ~DP_MASK;
 
-	switch (raw_digit) {
-	case 0x00:
-	case LCD_0:
+	/* A blank digit reads as 0. */
+	if (raw_digit == 0x00)
 		return 0;
-	case LCD_1:
-		return 1;
-	case LCD_2:
-		return 2;
-	case LCD_3:
-		return 3;
-	case LCD_4:
-		return 4;
-	case LCD_5:
-		return 5;
-	case LCD_6:
-		return 6;
-	case LCD_7:
-		return 7;
-	case LCD_8:
-		return 8;
-	case LCD_9:
-		return 9;
-	default:
+
+	if ((digit = SR_DMM_SEGMENT_DIGIT(lcd_digits, raw_digit)) < 0) {
 		sr_err("Invalid digit byte: 0x%02x.", raw_digit);
 		return 0xff;
 	}
+
+	return digit;
 }
 
 static double lcd_to_double(const struct rs9lcd_packet *rs_packet, int type)
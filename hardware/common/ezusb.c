@@ -33,11 +33,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "ezusb: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 SR_PRIV int ezusb_reset(struct libusb_device_handle *hdl, int set_clear)
 {
@@ -59,23 +59,22 @@ SR_PRIV int ezusb_reset(struct libusb_device_handle *hdl, int set_clear)
 SR_PRIV int ezusb_install_firmware(libusb_device_handle *hdl,
 				   const char *filename)
 {
-	FILE *fw;
+	GBytes *fw;
+	const uint8_t *data;
+	gsize size;
 	int offset, chunksize, ret, result;
 	unsigned char buf[4096];
 
 	sr_info("Uploading firmware at %s", filename);
-	if ((fw = g_fopen(filename, "rb")) == NULL) {
-		sr_err("Unable to open firmware file %s for reading: %s",
-		       filename, strerror(errno));
+	if (!(fw = sr_firmware_get(filename, NULL)))
 		return SR_ERR;
-	}
+	data = g_bytes_get_data(fw, &size);
 
 	result = SR_OK;
-	offset = 0;
-	while (1) {
-		chunksize = fread(buf, 1, 4096, fw);
-		if (chunksize == 0)
-			break;
+	for (offset = 0; (gsize)offset < size; offset += chunksize) {
+		chunksize = MIN(size - offset, sizeof(buf));
+		/* The control transfer wants a writable buffer. */
+		memcpy(buf, data + offset, chunksize);
 		ret = libusb_control_transfer(hdl, LIBUSB_REQUEST_TYPE_VENDOR |
 					      LIBUSB_ENDPOINT_OUT, 0xa0, offset,
 					      0x0000, buf, chunksize, 100);
@@ -86,9 +85,8 @@ SR_PRIV int ezusb_install_firmware(libusb_device_handle *hdl,
 			break;
 		}
 		sr_info("Uploaded %d bytes", chunksize);
-		offset += chunksize;
 	}
-	fclose(fw);
+	g_bytes_unref(fw);
 	sr_info("Firmware upload done");
 
 	return result;
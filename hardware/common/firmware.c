@@ -0,0 +1,154 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Firmware images and FPGA bitstreams, read from disk once and kept in
+ * memory. An image is read again when its file's size or modification
+ * time changes, so drivers can ask for it every time they upload it.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "firmware: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+struct fw_entry {
+	sr_firmware_encode_t encode;
+	GBytes *image;
+	gint64 mtime;
+	gint64 size;
+};
+
+/* Filename -> struct fw_entry. */
+static GHashTable *fw_cache = NULL;
+G_LOCK_DEFINE_STATIC(fw_cache);
+
+static void fw_entry_free(gpointer data)
+{
+	struct fw_entry *entry;
+
+	entry = data;
+	g_bytes_unref(entry->image);
+	g_free(entry);
+}
+
+/**
+ * Get a firmware image, from memory if the file didn't change since it
+ * was last read.
+ *
+ * @param filename The firmware file.
+ * @param encode Function to turn the file's contents into the image the
+ *               device wants, or NULL to use them as they are. The cached
+ *               image is only used if it was made by the same function.
+ *
+ * @return A new reference to the image, to be released with
+ *         g_bytes_unref(), or NULL upon errors.
+ *
+ * @private
+ */
+SR_PRIV GBytes *sr_firmware_get(const char *filename,
+		sr_firmware_encode_t encode)
+{
+	struct fw_entry *entry;
+	GStatBuf st;
+	GBytes *raw, *image;
+	GError *error;
+	gchar *contents;
+	gsize len;
+
+	if (g_stat(filename, &st) < 0) {
+		sr_err("Unable to open firmware file %s: %s.", filename,
+		       strerror(errno));
+		return NULL;
+	}
+
+	image = NULL;
+	G_LOCK(fw_cache);
+	if (fw_cache && (entry = g_hash_table_lookup(fw_cache, filename))
+	    && entry->encode == encode && entry->mtime == st.st_mtime
+	    && entry->size == st.st_size)
+		image = g_bytes_ref(entry->image);
+	G_UNLOCK(fw_cache);
+	if (image) {
+		sr_spew("Using cached firmware %s.", filename);
+		return image;
+	}
+
+	error = NULL;
+	if (!g_file_get_contents(filename, &contents, &len, &error)) {
+		sr_err("Unable to read firmware file %s: %s.", filename,
+		       error->message);
+		g_error_free(error);
+		return NULL;
+	}
+	raw = g_bytes_new_take(contents, len);
+	if (encode) {
+		image = encode(g_bytes_get_data(raw, NULL), len);
+		g_bytes_unref(raw);
+		if (!image)
+			return NULL;
+	} else {
+		image = raw;
+	}
+	sr_dbg("Read firmware %s, %" G_GSIZE_FORMAT " bytes.", filename,
+	       g_bytes_get_size(image));
+
+	if (!(entry = g_try_malloc(sizeof(struct fw_entry)))) {
+		/* Not caching it only costs time. */
+		sr_err("%s: entry malloc failed", __func__);
+		return image;
+	}
+	entry->encode = encode;
+	entry->image = g_bytes_ref(image);
+	entry->mtime = st.st_mtime;
+	entry->size = st.st_size;
+
+	G_LOCK(fw_cache);
+	if (!fw_cache)
+		fw_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, fw_entry_free);
+	g_hash_table_replace(fw_cache, g_strdup(filename), entry);
+	G_UNLOCK(fw_cache);
+
+	return image;
+}
+
+/**
+ * Drop all cached firmware images.
+ *
+ * @private
+ */
+SR_PRIV void sr_firmware_cache_clear(void)
+{
+	G_LOCK(fw_cache);
+	if (fw_cache) {
+		g_hash_table_destroy(fw_cache);
+		fw_cache = NULL;
+	}
+	G_UNLOCK(fw_cache);
+}
@@ -21,6 +21,11 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
 #include <glib.h>
 #include <libserialport.h>
 #include "libsigrok.h"
@@ -29,11 +34,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "serial: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 /**
  * Open the specified serial port.
@@ -132,6 +137,9 @@ SR_PRIV int serial_close(struct sr_serial_dev_inst *serial)
 	}
 
 	serial->fd = -1;
+	g_free(serial->rx_buf);
+	serial->rx_buf = NULL;
+	serial->rx_start = serial->rx_end = 0;
 
 	return SR_OK;
 }
@@ -162,6 +170,7 @@ SR_PRIV int serial_flush(struct sr_serial_dev_inst *serial)
 	sr_spew("Flushing serial port %s (fd %d).", serial->port, serial->fd);
 
 	ret = sp_flush(serial->data, SP_BUF_BOTH);
+	serial->rx_start = serial->rx_end = 0;
 
 	switch (ret) {
 	case SP_ERR_ARG:
@@ -224,9 +233,63 @@ SR_PRIV int serial_write(struct sr_serial_dev_inst *serial,
 	return ret;
 }
 
+/* Read from the port itself, bypassing the receive buffer. */
+static int port_read(struct sr_serial_dev_inst *serial, void *buf,
+		size_t count, int nonblocking)
+{
+	ssize_t ret;
+	char *error;
+
+	if (nonblocking)
+		ret = sp_nonblocking_read(serial->data, buf, count);
+	else
+		ret = sp_blocking_read(serial->data, buf, count, 0);
+
+	switch (ret) {
+	case SP_ERR_ARG:
+		sr_err("Attempted serial port read with invalid arguments.");
+		return SR_ERR_ARG;
+	case SP_ERR_FAIL:
+		error = sp_last_error_message();
+		sr_err("Read error: %s.", error);
+		sp_free_error_message(error);
+		return SR_ERR;
+	}
+
+	if (ret > 0)
+		sr_spew("Read %d/%d bytes (fd %d).", ret, count, serial->fd);
+
+	return ret;
+}
+
+/* Read from the receive buffer first, then from the port. */
+static int buffered_read(struct sr_serial_dev_inst *serial, void *buf,
+		size_t count, int nonblocking)
+{
+	size_t len;
+	int ret;
+
+	len = MIN(count, serial->rx_end - serial->rx_start);
+	if (len == 0)
+		return port_read(serial, buf, count, nonblocking);
+
+	memcpy(buf, serial->rx_buf + serial->rx_start, len);
+	serial->rx_start += len;
+	if (len == count)
+		return len;
+
+	/* The buffered bytes are already consumed, errors can wait. */
+	ret = port_read(serial, (uint8_t *)buf + len, count - len, nonblocking);
+
+	return ret > 0 ? (int)len + ret : (int)len;
+}
+
 /**
  * Read a number of bytes from the specified serial port.
  *
+ * Bytes which serial_readline() or serial_stream_detect() have already
+ * taken from the port, but not consumed, are returned first.
+ *
  * @param serial Previously initialized serial port structure.
  * @param buf Buffer where to store the bytes that are read.
  * @param count The number of bytes to read.
@@ -236,9 +299,6 @@ SR_PRIV int serial_write(struct sr_serial_dev_inst *serial,
 SR_PRIV int serial_read(struct sr_serial_dev_inst *serial, void *buf,
 		size_t count)
 {
-	ssize_t ret;
-	char *error;
-
 	if (!serial) {
 		sr_dbg("Invalid serial port.");
 		return SR_ERR;
@@ -250,28 +310,56 @@ SR_PRIV int serial_read(struct sr_serial_dev_inst *serial, void *buf,
 		return SR_ERR;
 	}
 
-	if (serial->nonblocking)
-		ret = sp_nonblocking_read(serial->data, buf, count);
-	else
-		ret = sp_blocking_read(serial->data, buf, count, 0);
+	return buffered_read(serial, buf, count, serial->nonblocking);
+}
 
-	switch (ret) {
-	case SP_ERR_ARG:
-		sr_err("Attempted serial port read with invalid arguments.");
-		return SR_ERR_ARG;
-	case SP_ERR_FAIL:
-		error = sp_last_error_message();
-		sr_err("Read error: %s.", error);
-		sp_free_error_message(error);
-		return SR_ERR;
+/*
+ * Read whatever the port has into the receive buffer, without waiting.
+ * Returns the number of bytes added, or a negative error code.
+ */
+static int serial_fill(struct sr_serial_dev_inst *serial)
+{
+	int ret;
+
+	if (!serial->rx_buf
+	    && !(serial->rx_buf = g_try_malloc(SERIAL_RX_BUF_SIZE))) {
+		sr_err("%s: rx_buf malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	if (serial->rx_start > 0) {
+		memmove(serial->rx_buf, serial->rx_buf + serial->rx_start,
+				serial->rx_end - serial->rx_start);
+		serial->rx_end -= serial->rx_start;
+		serial->rx_start = 0;
 	}
+	if (serial->rx_end == SERIAL_RX_BUF_SIZE)
+		return 0;
 
+	ret = port_read(serial, serial->rx_buf + serial->rx_end,
+			SERIAL_RX_BUF_SIZE - serial->rx_end, TRUE);
 	if (ret > 0)
-		sr_spew("Read %d/%d bytes (fd %d).", ret, count, serial->fd);
+		serial->rx_end += ret;
 
 	return ret;
 }
 
+/* Wait until the port has data, for at most timeout_ms milliseconds. */
+static void serial_wait(struct sr_serial_dev_inst *serial, gint64 timeout_ms)
+{
+#ifdef _WIN32
+	(void)serial;
+	g_usleep(MIN(timeout_ms, 2) * 1000);
+#else
+	GPollFD pfd;
+
+	pfd.fd = serial->fd;
+	pfd.events = G_IO_IN;
+	pfd.revents = 0;
+	g_poll(&pfd, 1, timeout_ms);
+#endif
+}
+
 /**
  * Set serial parameters for the specified serial port.
  *
@@ -347,6 +435,45 @@ SR_PRIV int serial_set_params(struct sr_serial_dev_inst *serial, int baudrate,
 	return SR_OK;
 }
 
+/*
+ * Have the port hand over received bytes right away. USB serial adapters
+ * otherwise hold on to them for a while: FTDI chips for up to 16 ms, the
+ * default of their latency timer.
+ */
+static void serial_set_low_latency(struct sr_serial_dev_inst *serial)
+{
+#ifdef __linux__
+	struct serial_struct ss;
+	const char *name;
+	char path[256];
+	FILE *f;
+
+	/* Also sets FTDI adapters' latency timer to 1 ms, in ftdi_sio. */
+	if (ioctl(serial->fd, TIOCGSERIAL, &ss) < 0) {
+		sr_dbg("Port %s doesn't support TIOCGSERIAL.", serial->port);
+	} else {
+		ss.flags |= ASYNC_LOW_LATENCY;
+		if (ioctl(serial->fd, TIOCSSERIAL, &ss) < 0)
+			sr_dbg("Failed to set low latency on %s.",
+			       serial->port);
+	}
+
+	/* Newer kernels leave that to the adapter's sysfs attribute. */
+	name = strrchr(serial->port, '/');
+	name = name ? name + 1 : serial->port;
+	snprintf(path, sizeof(path),
+		 "/sys/bus/usb-serial/devices/%s/latency_timer", name);
+	if ((f = fopen(path, "w"))) {
+		if (fputs("1", f) < 0)
+			sr_dbg("Failed to set the latency timer of %s.", name);
+		fclose(f);
+	}
+#else
+	sr_dbg("Low latency mode isn't supported on this platform.");
+	(void)serial;
+#endif
+}
+
 /**
  * Set serial parameters for the specified serial port.
  *
@@ -354,6 +481,8 @@ SR_PRIV int serial_set_params(struct sr_serial_dev_inst *serial, int baudrate,
  * @param paramstr A serial communication parameters string, in the form
  * of <speed>/<data bits><parity><stopbits><flow>, for example "9600/8n1" or
  * "600/7o2" or "460800/8n1/flow=2" where flow is 0 for none, 1 for rts/cts and 2 for xon/xoff.
+ * With "/lowlat=1", received data is handed over with as little delay as
+ * the port allows, where supported.
  *
  * @return SR_OK upon success, SR_ERR upon failure.
  */
@@ -363,10 +492,10 @@ SR_PRIV int serial_set_paramstr(struct sr_serial_dev_inst *serial,
 {
 	GRegex *reg;
 	GMatchInfo *match;
-	int speed, databits, parity, stopbits, flow, rts, dtr, i;
+	int speed, databits, parity, stopbits, flow, rts, dtr, lowlat, i, ret;
 	char *mstr, **opts, **kv;
 
-	speed = databits = parity = stopbits = flow = 0;
+	speed = databits = parity = stopbits = flow = lowlat = 0;
 	rts = dtr = -1;
 	sr_spew("Parsing parameters from \"%s\".", paramstr);
 	reg = g_regex_new(SERIAL_COMM_SPEC, 0, 0, NULL);
@@ -432,6 +561,15 @@ SR_PRIV int serial_set_paramstr(struct sr_serial_dev_inst *serial,
 							sr_dbg("invalid value for flow: %c", kv[1][0]);
 							speed = 0;
 						}
+					} else if (!strncmp(kv[0], "lowlat", 6)) {
+						if (kv[1][0] == '1')
+							lowlat = 1;
+						else if (kv[1][0] == '0')
+							lowlat = 0;
+						else {
+							sr_dbg("invalid value for lowlat: %c", kv[1][0]);
+							speed = 0;
+						}
 					}
 					g_strfreev(kv);
 				}
@@ -444,8 +582,11 @@ SR_PRIV int serial_set_paramstr(struct sr_serial_dev_inst *serial,
 	g_regex_unref(reg);
 
 	if (speed) {
-		return serial_set_params(serial, speed, databits, parity,
-					 stopbits, flow, rts, dtr);
+		ret = serial_set_params(serial, speed, databits, parity,
+					stopbits, flow, rts, dtr);
+		if (ret == SR_OK && lowlat)
+			serial_set_low_latency(serial);
+		return ret;
 	} else {
 		sr_dbg("Could not infer speed from parameter string.");
 		return SR_ERR_ARG;
@@ -467,8 +608,9 @@ SR_PRIV int serial_set_paramstr(struct sr_serial_dev_inst *serial,
 SR_PRIV int serial_readline(struct sr_serial_dev_inst *serial, char **buf,
 		int *buflen, gint64 timeout_ms)
 {
-	gint64 start;
-	int maxlen, len;
+	gint64 start, remaining;
+	int maxlen;
+	char c;
 
 	if (!serial || serial->fd == -1) {
 		sr_dbg("Invalid serial port.");
@@ -485,27 +627,28 @@ SR_PRIV int serial_readline(struct sr_serial_dev_inst *serial, char **buf,
 	start = g_get_monotonic_time();
 
 	maxlen = *buflen;
-	*buflen = len = 0;
-	while(1) {
-		len = maxlen - *buflen - 1;
-		if (len < 1)
-			break;
-		len = serial_read(serial, *buf + *buflen, 1);
-		if (len > 0) {
-			*buflen += len;
-			*(*buf + *buflen) = '\0';
-			if (*buflen > 0 && (*(*buf + *buflen - 1) == '\r'
-					|| *(*buf + *buflen - 1) == '\n')) {
-				/* Strip CR/LF and terminate. */
-				*(*buf + --*buflen) = '\0';
+	*buflen = 0;
+	c = 0;
+	while (*buflen < maxlen - 1) {
+		/* Take bytes up to the first CR/LF from the read-ahead. */
+		while (serial->rx_start < serial->rx_end
+		       && *buflen < maxlen - 1) {
+			c = serial->rx_buf[serial->rx_start++];
+			if (c == '\r' || c == '\n')
 				break;
-			}
+			*(*buf + (*buflen)++) = c;
 		}
-		if (g_get_monotonic_time() - start > timeout_ms)
+		*(*buf + *buflen) = '\0';
+		if (c == '\r' || c == '\n')
+			/* CR/LF stripped, the line is complete. */
+			break;
+		if (*buflen >= maxlen - 1 || serial_fill(serial) > 0)
+			continue;
+		remaining = timeout_ms - (g_get_monotonic_time() - start);
+		if (remaining <= 0)
 			/* Timeout */
 			break;
-		if (len < 1)
-			g_usleep(2000);
+		serial_wait(serial, (remaining + 999) / 1000);
 	}
 	if (*buflen)
 		sr_dbg("Received %d: '%s'.", *buflen, *buf);
@@ -513,6 +656,74 @@ SR_PRIV int serial_readline(struct sr_serial_dev_inst *serial, char **buf,
 	return SR_OK;
 }
 
+/**
+ * Read all bytes the port has, and pass on every complete line in them.
+ *
+ * This is meant for the receive callbacks of line-based protocols. The
+ * bytes are taken from the port in one read per call (more if it has more
+ * than the read-ahead buffer holds), instead of one read per byte.
+ *
+ * @param serial Previously initialized serial port structure.
+ * @param buf Buffer holding the line being received. Bytes of a line
+ *            which is not complete yet stay in it until the next call.
+ * @param buflen Number of bytes of the incomplete line in buf.
+ * @param bufsize Size of buf.
+ * @param eol The byte which ends a line. It is not passed on.
+ * @param line_cb Called with every complete line, which is terminated
+ *                by a NUL byte and may be modified. Afterwards, *buflen
+ *                is 0.
+ * @param cb_data Passed to line_cb.
+ *
+ * @return SR_OK upon success, or a negative error code upon read errors.
+ *
+ * @private
+ */
+SR_PRIV int serial_read_lines(struct sr_serial_dev_inst *serial, char *buf,
+		int *buflen, int bufsize, char eol, serial_line_cb_t line_cb,
+		void *cb_data)
+{
+	uint8_t *start, *end, *p;
+	size_t len;
+	int ret;
+
+	if (!serial || serial->fd == -1) {
+		sr_dbg("Invalid serial port.");
+		return SR_ERR;
+	}
+
+	while (TRUE) {
+		if (serial->rx_start == serial->rx_end) {
+			if ((ret = serial_fill(serial)) < 0)
+				return ret;
+			if (ret == 0)
+				break;
+		}
+
+		/* Take bytes up to the end of the line from the read-ahead. */
+		start = serial->rx_buf + serial->rx_start;
+		end = serial->rx_buf + serial->rx_end;
+		p = memchr(start, eol, end - start);
+		len = MIN((size_t)((p ? p : end) - start),
+			  (size_t)(bufsize - 1 - *buflen));
+		memcpy(buf + *buflen, start, len);
+		*buflen += len;
+		buf[*buflen] = '\0';
+		serial->rx_start += len;
+
+		if (p && start + len == p) {
+			/* Skip the end of line, the line is complete. */
+			serial->rx_start++;
+			line_cb(buf, *buflen, cb_data);
+			*buflen = 0;
+		} else if (*buflen == bufsize - 1) {
+			sr_dbg("Line too long, discarding %d bytes.", *buflen);
+			*buflen = 0;
+		}
+	}
+
+	return SR_OK;
+}
+
 /**
  * Try to find a valid packet in a serial data stream.
  *
@@ -523,9 +734,8 @@ SR_PRIV int serial_readline(struct sr_serial_dev_inst *serial, char **buf,
  * @param is_valid Callback that assesses whether the packet is valid or not.
  * @param timeout_ms The timeout after which, if no packet is detected, to
  *                   abort scanning.
- * @param baudrate The baudrate of the serial port. This parameter is not
- *                 critical, but it helps fine tune the serial port polling
- *                 delay.
+ * @param baudrate The baudrate of the serial port. Only used for logging,
+ *                 as reads wait for data to arrive instead of polling.
  *
  * @return SR_OK if a valid packet is found within the given timeout,
  *         SR_ERR upon failure.
@@ -535,7 +745,7 @@ SR_PRIV int serial_stream_detect(struct sr_serial_dev_inst *serial,
 				 size_t packet_size, packet_valid_t is_valid,
 				 uint64_t timeout_ms, int baudrate)
 {
-	uint64_t start, time, byte_delay_us;
+	uint64_t start, time;
 	size_t ibuf, i, maxlen;
 	int len;
 
@@ -549,25 +759,19 @@ SR_PRIV int serial_stream_detect(struct sr_serial_dev_inst *serial,
 		return SR_ERR;
 	}
 
-	/* Assume 8n1 transmission. That is 10 bits for every byte. */
-	byte_delay_us = 10 * (1000000 / baudrate);
 	start = g_get_monotonic_time();
 
 	i = ibuf = len = 0;
 	while (ibuf < maxlen) {
-		len = serial_read(serial, &buf[ibuf], 1);
-		if (len > 0) {
+		/* Errors reading are ignored, the timeout ends the search. */
+		len = buffered_read(serial, &buf[ibuf], maxlen - ibuf, TRUE);
+		if (len > 0)
 			ibuf += len;
-		} else if (len == 0) {
-			/* No logging, already done in serial_read(). */
-		} else {
-			/* Error reading byte, but continuing anyway. */
-		}
 
 		time = g_get_monotonic_time() - start;
 		time /= 1000;
 
-		if ((ibuf - i) >= packet_size) {
+		while ((ibuf - i) >= packet_size) {
 			/* We have at least a packet's worth of data. */
 			if (is_valid(&buf[i])) {
 				sr_spew("Found valid %d-byte packet after "
@@ -587,7 +791,7 @@ SR_PRIV int serial_stream_detect(struct sr_serial_dev_inst *serial,
 			break;
 		}
 		if (len < 1)
-			g_usleep(byte_delay_us);
+			serial_wait(serial, timeout_ms - time);
 	}
 
 	*buflen = ibuf;
@@ -20,10 +20,21 @@
  */
 
 #include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#define pipe(fds) _pipe(fds, 4096, _O_BINARY)
+#endif
 #include <glib.h>
 #include <libusb.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
+#ifdef HAVE_MLOCK
+#include <sys/mman.h>
+#endif
 
 /* SR_CONF_CONN takes one of these: */
 #define CONN_USB_VIDPID  "^([0-9a-z]{4})\\.([0-9a-z]{4})$"
@@ -33,19 +44,127 @@
 #define SUBCLASS_USBTMC 0x03
 #define USBTMC_USB488   0x01
 
+/* How long the USB event thread blocks in libusb at a time. */
+#define USB_THREAD_TIMEOUT_US	(100 * 1000)
+
+/* Hotplug support appeared in libusb 1.0.16. */
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000102
+#define HAVE_LIBUSB_HOTPLUG 1
+#endif
+
+/* libusb_dev_mem_alloc() came with libusb 1.0.21. */
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+#define HAVE_LIBUSB_DEV_MEM 1
+#endif
+
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "usb: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/**
+ * Set up the libusb context, unless that was done already. USB drivers
+ * call this from their init(), so that libsigrok only pays for libusb
+ * when a frontend actually uses one of them.
+ *
+ * @param ctx libsigrok context to set up libusb for.
+ *
+ * @return SR_OK upon success, SR_ERR if libusb failed to initialize.
+ *
+ * @private
+ */
+SR_PRIV int sr_usb_init(struct sr_context *ctx)
+{
+	int ret;
+
+	ret = SR_OK;
+	g_mutex_lock(&ctx->scan_mutex);
+	if (!ctx->libusb_ctx) {
+		sr_spew("Initializing libusb.");
+		if ((ret = libusb_init(&ctx->libusb_ctx)) != LIBUSB_SUCCESS) {
+			sr_err("libusb_init() returned %s.",
+			       libusb_error_name(ret));
+			ctx->libusb_ctx = NULL;
+			ret = SR_ERR;
+		}
+	}
+	g_mutex_unlock(&ctx->scan_mutex);
+
+	return ret;
+}
+
+/**
+ * Get the list of attached USB devices, like libusb_get_device_list().
+ *
+ * While sr_driver_scan_all() runs, the bus is only enumerated once, and
+ * every driver scanning it gets its own copy of that list. The list must
+ * be freed with libusb_free_device_list(list, 1), as usual.
+ *
+ * @param ctx libsigrok context to use while scanning.
+ * @param list Where to store the NULL-terminated list of devices.
+ *
+ * @return The number of devices, or a negative libusb error code.
+ */
+SR_PRIV ssize_t sr_usb_get_device_list(struct sr_context *ctx,
+		libusb_device ***list)
+{
+	ssize_t cnt, i;
+
+	g_mutex_lock(&ctx->scan_mutex);
+	if (!ctx->usb_devlist) {
+		g_mutex_unlock(&ctx->scan_mutex);
+		return libusb_get_device_list(ctx->libusb_ctx, list);
+	}
+
+	for (cnt = 0; ctx->usb_devlist[cnt]; cnt++);
+	/* libusb_free_device_list() releases this with free(). */
+	if (!(*list = calloc(cnt + 1, sizeof(libusb_device *)))) {
+		g_mutex_unlock(&ctx->scan_mutex);
+		sr_err("%s: list malloc failed", __func__);
+		return LIBUSB_ERROR_NO_MEM;
+	}
+	for (i = 0; i < cnt; i++)
+		(*list)[i] = libusb_ref_device(ctx->usb_devlist[i]);
+	g_mutex_unlock(&ctx->scan_mutex);
+
+	return cnt;
+}
+
+/**
+ * Enumerate the USB devices for sr_usb_get_device_list() to hand out, or
+ * drop that list again. Must be called with ctx->scan_mutex held.
+ *
+ * @param ctx libsigrok context to use while scanning.
+ * @param enable TRUE to (re-)enumerate the bus, FALSE to drop the list.
+ */
+SR_PRIV void sr_usb_devlist_cache(struct sr_context *ctx, gboolean enable)
+{
+	ssize_t ret;
+
+	if (ctx->usb_devlist) {
+		libusb_free_device_list(ctx->usb_devlist, 1);
+		ctx->usb_devlist = NULL;
+	}
+	/* Without libusb set up, no USB driver is scanning either. */
+	if (!enable || !ctx->libusb_ctx)
+		return;
+
+	if ((ret = libusb_get_device_list(ctx->libusb_ctx,
+			&ctx->usb_devlist)) < 0) {
+		sr_err("Failed to retrieve device list: %s.",
+		       libusb_error_name(ret));
+		ctx->usb_devlist = NULL;
+	}
+}
 
 /**
  * Find USB devices according to a connection string.
  *
- * @param usb_ctx libusb context to use while scanning.
+ * @param ctx libsigrok context to use while scanning.
  * @param conn Connection string specifying the device(s) to match. This
  * can be of the form "<bus>.<address>", or "<vendorid>.<productid>".
  *
@@ -53,7 +172,7 @@
  * matching the device that matched the connection string. The GSList and
  * its contents must be freed by the caller.
  */
-SR_PRIV GSList *sr_usb_find(libusb_context *usb_ctx, const char *conn)
+SR_PRIV GSList *sr_usb_find(struct sr_context *ctx, const char *conn)
 {
 	struct sr_usb_dev_inst *usb;
 	struct libusb_device **devlist;
@@ -112,7 +231,8 @@ SR_PRIV GSList *sr_usb_find(libusb_context *usb_ctx, const char *conn)
 
 	/* Looks like a valid USB device specification, but is it connected? */
 	devices = NULL;
-	libusb_get_device_list(usb_ctx, &devlist);
+	if (sr_usb_get_device_list(ctx, &devlist) < 0)
+		return NULL;
 	for (i = 0; devlist[i]; i++) {
 		if ((ret = libusb_get_device_descriptor(devlist[i], &des))) {
 			sr_err("Failed to get device descriptor: %s.",
@@ -145,12 +265,12 @@ SR_PRIV GSList *sr_usb_find(libusb_context *usb_ctx, const char *conn)
 /**
  * Find USB devices supporting the USBTMC class
  *
- * @param usb_ctx libusb context to use while scanning.
+ * @param ctx libsigrok context to use while scanning.
  *
  * @return A GSList of struct sr_usb_dev_inst, with bus and address fields
  * indicating devices with USBTMC support.
  */
-SR_PRIV GSList *sr_usb_find_usbtmc(libusb_context *usb_ctx)
+SR_PRIV GSList *sr_usb_find_usbtmc(struct sr_context *ctx)
 {
 	struct sr_usb_dev_inst *usb;
 	struct libusb_device **devlist;
@@ -161,7 +281,8 @@ SR_PRIV GSList *sr_usb_find_usbtmc(libusb_context *usb_ctx)
 	int confidx, intfidx, ret, i;
 
 	devices = NULL;
-	libusb_get_device_list(usb_ctx, &devlist);
+	if (sr_usb_get_device_list(ctx, &devlist) < 0)
+		return NULL;
 	for (i = 0; devlist[i]; i++) {
 		if ((ret = libusb_get_device_descriptor(devlist[i], &des))) {
 			sr_err("Failed to get device descriptor: %s.",
@@ -243,3 +364,801 @@ SR_PRIV int sr_usb_open(libusb_context *usb_ctx, struct sr_usb_dev_inst *usb)
 
 	return ret;
 }
+
+/*
+ * A driver's callback, as registered with sr_usb_source_add() while the
+ * USB event thread is enabled. Each one has a pipe of its own, added to
+ * the session the driver runs in, through which the USB thread wakes up
+ * that session's thread.
+ */
+struct usb_source {
+	struct sr_context *ctx;
+	struct sr_session *session;
+	sr_receive_data_callback_t cb;
+	void *cb_data;
+	int pipe_fds[2];
+	GIOChannel *channel;
+	/* Set while the session thread has been woken up but didn't run. */
+	gint signalled;
+	/* Set by sr_usb_source_remove(), which may run on any thread. */
+	gint removed;
+};
+
+struct sr_usb_thread {
+	const struct sr_context *ctx;
+	libusb_context *libusb_ctx;
+	GThread *thread;
+	gint stop;
+	/* Sources are only freed by the session threads. */
+	GMutex mutex;
+	GSList *sources;
+};
+
+/*
+ * Handle USB events continuously, independent of how busy the session
+ * threads are. The drivers' completion callbacks run here, and the packets
+ * they send are handed over to their session's thread, which gets woken up
+ * through the pipe.
+ */
+static gpointer usb_thread(gpointer data)
+{
+	struct sr_usb_thread *thread;
+	struct sr_thread_state *state;
+	struct usb_source *source;
+	struct timeval tv;
+	GSList *l;
+
+	thread = data;
+	sr_session_send_defer(TRUE);
+	state = sr_thread_tune(thread->ctx);
+
+	while (!g_atomic_int_get(&thread->stop)) {
+		tv.tv_sec = 0;
+		tv.tv_usec = USB_THREAD_TIMEOUT_US;
+		libusb_handle_events_timeout_completed(thread->libusb_ctx, &tv,
+				NULL);
+		g_mutex_lock(&thread->mutex);
+		for (l = thread->sources; l; l = l->next) {
+			source = l->data;
+			if (g_atomic_int_get(&source->signalled)
+			    || !sr_session_deferred_pending(source->session))
+				continue;
+			g_atomic_int_set(&source->signalled, 1);
+			if (write(source->pipe_fds[1], "", 1) != 1)
+				sr_warn("Failed to wake up the session thread.");
+		}
+		g_mutex_unlock(&thread->mutex);
+	}
+	sr_thread_restore(state);
+
+	return NULL;
+}
+
+static void usb_source_free(struct usb_source *source)
+{
+	if (source->channel) {
+		g_io_channel_shutdown(source->channel, FALSE, NULL);
+		g_io_channel_unref(source->channel);
+	}
+	close(source->pipe_fds[0]);
+	close(source->pipe_fds[1]);
+	g_free(source);
+}
+
+/*
+ * Stop the USB event thread of a context, if any. Packets it sent are
+ * still waiting for sr_session_deferred_dispatch() afterwards.
+ *
+ * @private
+ */
+SR_PRIV void sr_usb_thread_stop(struct sr_context *ctx)
+{
+	struct sr_usb_thread *thread;
+
+	if (!(thread = ctx->usb_thread))
+		return;
+
+	g_atomic_int_set(&thread->stop, 1);
+	g_thread_join(thread->thread);
+	ctx->usb_thread = NULL;
+
+	g_slist_free_full(thread->sources, (GDestroyNotify)usb_source_free);
+	g_mutex_clear(&thread->mutex);
+	g_free(thread);
+}
+
+/* Runs on the session thread whenever the USB thread has sent packets. */
+static int usb_source_receive(int fd, int revents, void *cb_data)
+{
+	struct usb_source *source;
+	struct sr_usb_thread *thread;
+	struct sr_session *session;
+	gchar buf[16];
+	gsize len;
+	gboolean empty;
+
+	source = cb_data;
+	session = source->session;
+
+	if (revents & G_IO_IN) {
+		while (g_io_channel_read_chars(source->channel, buf,
+				sizeof(buf), &len, NULL) == G_IO_STATUS_NORMAL
+				&& len > 0);
+	}
+	g_atomic_int_set(&source->signalled, 0);
+	sr_session_deferred_dispatch(session);
+
+	/* The driver's own callback, for timeouts and housekeeping. */
+	if (!g_atomic_int_get(&source->removed)
+	    && !source->cb(fd, revents, source->cb_data))
+		g_atomic_int_set(&source->removed, 1);
+
+	if (!g_atomic_int_get(&source->removed))
+		return TRUE;
+
+	thread = source->ctx->usb_thread;
+	g_mutex_lock(&thread->mutex);
+	thread->sources = g_slist_remove(thread->sources, source);
+	empty = !thread->sources;
+	g_mutex_unlock(&thread->mutex);
+
+	/* Nobody is using USB anymore. */
+	if (empty)
+		sr_usb_thread_stop(source->ctx);
+	sr_session_deferred_dispatch(session);
+	usb_source_free(source);
+
+	return FALSE;
+}
+
+static int usb_thread_start(struct sr_context *ctx)
+{
+	struct sr_usb_thread *thread;
+
+	if (!(thread = g_try_malloc0(sizeof(struct sr_usb_thread)))) {
+		sr_err("%s: thread malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	thread->ctx = ctx;
+	thread->libusb_ctx = ctx->libusb_ctx;
+	g_mutex_init(&thread->mutex);
+
+	if (!(thread->thread = g_thread_try_new("sr-usb", usb_thread,
+			thread, NULL))) {
+		sr_err("Failed to start the USB event thread.");
+		g_mutex_clear(&thread->mutex);
+		g_free(thread);
+		return SR_ERR;
+	}
+	ctx->usb_thread = thread;
+
+	return SR_OK;
+}
+
+/**
+ * Add the session event source for a driver's USB transfers.
+ *
+ * The source is added to the session started or run by the calling
+ * thread.
+ *
+ * Without the USB event thread (see sr_usb_thread_set()), this adds the
+ * libusb file descriptors to the session, as a source calling cb. The
+ * callback is then expected to handle the libusb events.
+ *
+ * With the USB event thread, the thread handles the libusb events and the
+ * drivers' completion callbacks, for all sessions. The packets those send
+ * are passed on by the thread of the session the device is part of, which
+ * also still calls cb on the given timeout. Drivers must then keep the
+ * parts of their code called from other callbacks from racing with the
+ * completion callbacks, e.g. by holding libusb_lock_events() around them.
+ *
+ * @param ctx The libsigrok context.
+ * @param timeout Timeout for cb, in ms.
+ * @param cb The callback.
+ * @param cb_data Data for the callback, also identifying the source for
+ *                sr_usb_source_remove().
+ *
+ * @return SR_OK upon success, SR_ERR_MALLOC upon memory allocation
+ *         errors, SR_ERR_BUG if no session is running, or SR_ERR upon
+ *         other errors.
+ *
+ * @private
+ */
+SR_PRIV int sr_usb_source_add(struct sr_context *ctx, int timeout,
+		sr_receive_data_callback_t cb, void *cb_data)
+{
+	const struct libusb_pollfd **lupfd;
+	struct usb_source *source;
+	int ret, i;
+
+	if (!ctx->usb_thread_enabled && !ctx->usb_thread) {
+		if (!(lupfd = libusb_get_pollfds(ctx->libusb_ctx))) {
+			sr_err("libusb_get_pollfds failed.");
+			return SR_ERR;
+		}
+		for (i = 0; lupfd[i]; i++)
+			sr_source_add(lupfd[i]->fd, lupfd[i]->events,
+				      timeout, cb, cb_data);
+		free(lupfd);
+		return SR_OK;
+	}
+
+	if (!sr_session_cur_get()) {
+		sr_err("%s: no session running", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (!(source = g_try_malloc0(sizeof(struct usb_source)))) {
+		sr_err("%s: source malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	source->ctx = ctx;
+	source->session = sr_session_cur_get();
+	source->cb = cb;
+	source->cb_data = cb_data;
+
+	if (pipe(source->pipe_fds)) {
+		sr_err("%s: pipe() failed", __func__);
+		g_free(source);
+		return SR_ERR;
+	}
+	source->channel = g_io_channel_unix_new(source->pipe_fds[0]);
+	g_io_channel_set_flags(source->channel, G_IO_FLAG_NONBLOCK, NULL);
+	g_io_channel_set_encoding(source->channel, NULL, NULL);
+	g_io_channel_set_buffered(source->channel, FALSE);
+
+	if ((ret = sr_session_source_add_channel(source->session,
+			source->channel, G_IO_IN | G_IO_ERR, timeout,
+			usb_source_receive, source)) != SR_OK) {
+		usb_source_free(source);
+		return ret;
+	}
+
+	if (!ctx->usb_thread && (ret = usb_thread_start(ctx)) != SR_OK) {
+		sr_session_source_remove_channel(source->session,
+				source->channel);
+		usb_source_free(source);
+		return ret;
+	}
+	g_mutex_lock(&ctx->usb_thread->mutex);
+	ctx->usb_thread->sources = g_slist_append(ctx->usb_thread->sources,
+			source);
+	g_mutex_unlock(&ctx->usb_thread->mutex);
+
+	return SR_OK;
+}
+
+/**
+ * Remove the session event source added with sr_usb_source_add().
+ *
+ * With the USB event thread, this may be called from the drivers'
+ * completion callbacks. The thread stops once the last source is gone.
+ *
+ * @param ctx The libsigrok context.
+ * @param cb_data The cb_data passed to sr_usb_source_add().
+ *
+ * @return SR_OK upon success, SR_ERR upon errors.
+ *
+ * @private
+ */
+SR_PRIV int sr_usb_source_remove(struct sr_context *ctx, void *cb_data)
+{
+	const struct libusb_pollfd **lupfd;
+	struct usb_source *source;
+	GSList *l;
+	int i;
+
+	if (ctx->usb_thread) {
+		g_mutex_lock(&ctx->usb_thread->mutex);
+		for (l = ctx->usb_thread->sources; l; l = l->next) {
+			source = l->data;
+			if (source->cb_data == cb_data
+			    && !g_atomic_int_get(&source->removed)) {
+				g_atomic_int_set(&source->removed, 1);
+				/* Have the session thread free it soon. */
+				if (write(source->pipe_fds[1], "", 1) != 1)
+					sr_warn("Failed to wake up the "
+						"session thread.");
+				break;
+			}
+		}
+		g_mutex_unlock(&ctx->usb_thread->mutex);
+		return SR_OK;
+	}
+
+	if (!(lupfd = libusb_get_pollfds(ctx->libusb_ctx))) {
+		sr_err("libusb_get_pollfds failed.");
+		return SR_ERR;
+	}
+	for (i = 0; lupfd[i]; i++)
+		sr_source_remove(lupfd[i]->fd);
+	free(lupfd);
+
+	return SR_OK;
+}
+
+/**
+ * Allocate a USB transfer buffer, locked in memory if
+ * sr_usb_buffer_lock_set() says so.
+ *
+ * @param ctx The libsigrok context.
+ * @param size The size of the buffer.
+ *
+ * @return The buffer, or NULL upon memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV void *sr_usb_buffer_alloc(struct sr_context *ctx, size_t size)
+{
+	void *buf;
+
+	if (!(buf = g_try_malloc(size)))
+		return NULL;
+
+#ifdef HAVE_MLOCK
+	if (ctx->usb_buffer_lock && mlock(buf, size) < 0)
+		sr_warn("Failed to lock a USB transfer buffer: %s.",
+			strerror(errno));
+#else
+	(void)ctx;
+#endif
+
+	return buf;
+}
+
+#ifdef HAVE_LIBUSB_DEV_MEM
+/* The buffers from libusb_dev_mem_alloc(), each with its device handle. */
+static GHashTable *dev_mem_buffers;
+G_LOCK_DEFINE_STATIC(dev_mem_buffers);
+#endif
+
+/**
+ * Allocate a transfer buffer for a device. Where libusb and the platform
+ * support it, this is memory the kernel can DMA into directly, so the data
+ * isn't copied from a kernel buffer on every transfer; otherwise it comes
+ * from sr_usb_buffer_alloc().
+ *
+ * Either way, it is freed with sr_usb_buffer_free(), before the device
+ * gets closed.
+ *
+ * @param ctx The libsigrok context.
+ * @param devhdl The handle of the open device the buffer is for.
+ * @param size The size of the buffer.
+ *
+ * @return The buffer, or NULL upon memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV void *sr_usb_dev_buffer_alloc(struct sr_context *ctx,
+		libusb_device_handle *devhdl, size_t size)
+{
+#ifdef HAVE_LIBUSB_DEV_MEM
+	void *buf;
+
+	if (devhdl && (buf = libusb_dev_mem_alloc(devhdl, size))) {
+		G_LOCK(dev_mem_buffers);
+		if (!dev_mem_buffers)
+			dev_mem_buffers = g_hash_table_new(NULL, NULL);
+		g_hash_table_insert(dev_mem_buffers, buf, devhdl);
+		G_UNLOCK(dev_mem_buffers);
+		return buf;
+	}
+#else
+	(void)devhdl;
+#endif
+
+	return sr_usb_buffer_alloc(ctx, size);
+}
+
+/**
+ * Find out whether a buffer is device memory from sr_usb_dev_buffer_alloc(),
+ * which must not outlive the device, and so can't be handed on to datafeed
+ * consumers.
+ *
+ * @param buf The buffer.
+ *
+ * @private
+ */
+SR_PRIV gboolean sr_usb_buffer_is_dev_mem(const void *buf)
+{
+#ifdef HAVE_LIBUSB_DEV_MEM
+	gboolean ret;
+
+	G_LOCK(dev_mem_buffers);
+	ret = dev_mem_buffers && g_hash_table_contains(dev_mem_buffers, buf);
+	G_UNLOCK(dev_mem_buffers);
+
+	return ret;
+#else
+	(void)buf;
+
+	return FALSE;
+#endif
+}
+
+/**
+ * Free a buffer allocated with sr_usb_buffer_alloc() or
+ * sr_usb_dev_buffer_alloc().
+ *
+ * @param ctx The libsigrok context.
+ * @param buf The buffer, can be NULL.
+ * @param size The size of the buffer.
+ *
+ * @private
+ */
+SR_PRIV void sr_usb_buffer_free(struct sr_context *ctx, void *buf,
+		size_t size)
+{
+#ifdef HAVE_LIBUSB_DEV_MEM
+	libusb_device_handle *devhdl;
+
+	G_LOCK(dev_mem_buffers);
+	devhdl = dev_mem_buffers && buf
+		? g_hash_table_lookup(dev_mem_buffers, buf) : NULL;
+	if (devhdl)
+		g_hash_table_remove(dev_mem_buffers, buf);
+	G_UNLOCK(dev_mem_buffers);
+	if (devhdl) {
+		libusb_dev_mem_free(devhdl, buf, size);
+		return;
+	}
+#endif
+
+#ifdef HAVE_MLOCK
+	if (buf && ctx->usb_buffer_lock)
+		munlock(buf, size);
+#else
+	(void)ctx;
+	(void)size;
+#endif
+
+	g_free(buf);
+}
+
+/**
+ * Get a bulk transfer with a buffer of the given size for a device,
+ * reusing one from a pool of idle transfers if there is one, so that
+ * restarting an acquisition with the same buffer size allocates nothing.
+ *
+ * A pool is only used from one thread at a time: while an acquisition
+ * runs, by the one completing its transfers, otherwise by the one
+ * starting it.
+ *
+ * @param ctx The libsigrok context.
+ * @param pool The driver's list of idle transfers.
+ * @param devhdl The handle of the open device the transfer is for.
+ * @param size The size of the transfer buffer.
+ *
+ * @return The transfer, with the buffer and its size set, or NULL upon
+ *         memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV struct libusb_transfer *sr_usb_transfer_get(struct sr_context *ctx,
+		GSList **pool, libusb_device_handle *devhdl, size_t size)
+{
+	struct libusb_transfer *transfer;
+	GSList *l;
+	uint8_t *buf;
+
+	for (l = *pool; l; l = l->next) {
+		transfer = l->data;
+		if (transfer->dev_handle == devhdl
+		    && (size_t)transfer->length == size) {
+			*pool = g_slist_delete_link(*pool, l);
+			return transfer;
+		}
+	}
+
+	if (!(buf = sr_usb_dev_buffer_alloc(ctx, devhdl, size)))
+		return NULL;
+	if (!(transfer = libusb_alloc_transfer(0))) {
+		sr_usb_buffer_free(ctx, buf, size);
+		return NULL;
+	}
+	transfer->dev_handle = devhdl;
+	transfer->buffer = buf;
+	transfer->length = size;
+
+	return transfer;
+}
+
+/**
+ * Put a transfer from sr_usb_transfer_get() back into the pool of idle
+ * transfers, with its buffer. It must not be submitted.
+ *
+ * @param pool The driver's list of idle transfers.
+ * @param transfer The transfer.
+ *
+ * @private
+ */
+SR_PRIV void sr_usb_transfer_put(GSList **pool,
+		struct libusb_transfer *transfer)
+{
+	*pool = g_slist_prepend(*pool, transfer);
+}
+
+/**
+ * Free the idle transfers of a pool, except those with buffers of the
+ * given size. Must be called with a size of 0 before the device is
+ * closed.
+ *
+ * @param ctx The libsigrok context.
+ * @param pool The driver's list of idle transfers.
+ * @param keep_size The buffer size of the transfers to keep, or 0.
+ *
+ * @private
+ */
+SR_PRIV void sr_usb_transfer_pool_trim(struct sr_context *ctx,
+		GSList **pool, size_t keep_size)
+{
+	struct libusb_transfer *transfer;
+	GSList *l, *next;
+
+	for (l = *pool; l; l = next) {
+		next = l->next;
+		transfer = l->data;
+		if (keep_size && (size_t)transfer->length == keep_size)
+			continue;
+		sr_usb_buffer_free(ctx, transfer->buffer, transfer->length);
+		libusb_free_transfer(transfer);
+		*pool = g_slist_delete_link(*pool, l);
+	}
+}
+
+/* A device arrival or removal, as queued by hotplug_callback(). */
+struct hotplug_event {
+	int event;
+	uint8_t bus;
+	uint8_t address;
+};
+
+#ifdef HAVE_LIBUSB_HOTPLUG
+/*
+ * Runs from within libusb's event handling, on whichever thread that is.
+ * Drivers can't scan from here, so the event is only queued up.
+ */
+static int LIBUSB_CALL hotplug_callback(libusb_context *libusb_ctx,
+		libusb_device *dev, libusb_hotplug_event event, void *user_data)
+{
+	struct sr_context *ctx;
+	struct hotplug_event *ev;
+
+	(void)libusb_ctx;
+
+	ctx = user_data;
+	if (!(ev = g_try_malloc(sizeof(struct hotplug_event)))) {
+		sr_err("%s: ev malloc failed", __func__);
+		return 0;
+	}
+	ev->event = event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED
+			? SR_HOTPLUG_ARRIVED : SR_HOTPLUG_LEFT;
+	ev->bus = libusb_get_bus_number(dev);
+	ev->address = libusb_get_device_address(dev);
+
+	g_mutex_lock(&ctx->scan_mutex);
+	ctx->hotplug_events = g_slist_append(ctx->hotplug_events, ev);
+	g_mutex_unlock(&ctx->scan_mutex);
+
+	/* Stay registered. */
+	return 0;
+}
+#endif
+
+/**
+ * Set the callback sr_hotplug_handle_events() reports to, see
+ * sr_hotplug_set().
+ *
+ * @param ctx libsigrok context to use.
+ * @param cb The callback, or NULL to stop watching for devices.
+ * @param cb_data Opaque pointer passed to the callback.
+ *
+ * @return SR_OK upon success, SR_ERR_NA if libusb can't report hotplug
+ *         events on this platform, SR_ERR upon other errors.
+ *
+ * @private
+ */
+SR_PRIV int sr_usb_hotplug_set(struct sr_context *ctx,
+		sr_hotplug_callback_t cb, void *cb_data)
+{
+#ifdef HAVE_LIBUSB_HOTPLUG
+	GSList *events;
+	int ret;
+
+	if (ctx->hotplug_cb) {
+		libusb_hotplug_deregister_callback(ctx->libusb_ctx,
+				ctx->hotplug_handle);
+		ctx->hotplug_cb = NULL;
+		g_mutex_lock(&ctx->scan_mutex);
+		events = ctx->hotplug_events;
+		ctx->hotplug_events = NULL;
+		g_mutex_unlock(&ctx->scan_mutex);
+		g_slist_free_full(events, g_free);
+	}
+	if (!cb)
+		return SR_OK;
+
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		sr_dbg("libusb has no hotplug support on this platform.");
+		return SR_ERR_NA;
+	}
+	if (sr_usb_init(ctx) != SR_OK)
+		return SR_ERR;
+
+	ret = libusb_hotplug_register_callback(ctx->libusb_ctx,
+			LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED
+			| LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, 0,
+			LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+			LIBUSB_HOTPLUG_MATCH_ANY, hotplug_callback, ctx,
+			&ctx->hotplug_handle);
+	if (ret != LIBUSB_SUCCESS) {
+		sr_err("Failed to register hotplug callback: %s.",
+		       libusb_error_name(ret));
+		return SR_ERR;
+	}
+	ctx->hotplug_cb = cb;
+	ctx->hotplug_cb_data = cb_data;
+
+	return SR_OK;
+#else
+	(void)ctx;
+	(void)cb_data;
+
+	return cb ? SR_ERR_NA : SR_OK;
+#endif
+}
+
+static gboolean usb_inst_at(const struct sr_dev_inst *sdi, uint8_t bus,
+		uint8_t address)
+{
+	struct sr_usb_dev_inst *usb;
+
+	if (sdi->inst_type != SR_INST_USB || !(usb = sdi->conn))
+		return FALSE;
+
+	return usb->bus == bus && usb->address == address;
+}
+
+/*
+ * Whether a driver should be told about a new device. It must be able to
+ * scan just that device through SR_CONF_CONN, and not be a serial driver,
+ * for which the connection string would be a port name. A driver with an
+ * instance still booting is skipped: its device renumerates after the
+ * firmware upload, and would be found a second time.
+ */
+static gboolean hotplug_driver_ok(struct sr_dev_driver *driver,
+		uint8_t bus, uint8_t address)
+{
+	struct sr_dev_inst *sdi;
+	GVariant *gvar;
+	const int32_t *opts;
+	gsize num_opts, i;
+	gboolean conn, serial;
+	GSList *l;
+
+	if (sr_config_list(driver, NULL, NULL, SR_CONF_SCAN_OPTIONS,
+			&gvar) != SR_OK)
+		return FALSE;
+	opts = g_variant_get_fixed_array(gvar, &num_opts, sizeof(int32_t));
+	conn = serial = FALSE;
+	for (i = 0; i < num_opts; i++) {
+		if (opts[i] == SR_CONF_CONN)
+			conn = TRUE;
+		else if (opts[i] == SR_CONF_SERIALCOMM)
+			serial = TRUE;
+	}
+	g_variant_unref(gvar);
+	if (!conn || serial)
+		return FALSE;
+
+	for (l = sr_dev_list(driver); l; l = l->next) {
+		sdi = l->data;
+		if (sdi->status == SR_ST_INITIALIZING
+		    || usb_inst_at(sdi, bus, address))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void hotplug_arrived(struct sr_context *ctx, uint8_t bus,
+		uint8_t address)
+{
+	struct sr_dev_driver **drivers;
+	struct sr_config *src;
+	GSList *options, *devices, *l;
+	gboolean busy;
+	char *conn;
+	int i;
+
+	conn = g_strdup_printf("%d.%d", bus, address);
+	src = sr_config_new(SR_CONF_CONN, g_variant_new_string(conn));
+	options = g_slist_append(NULL, src);
+
+	drivers = sr_driver_list();
+	for (i = 0; drivers[i]; i++) {
+		if (!drivers[i]->priv
+		    || !hotplug_driver_ok(drivers[i], bus, address))
+			continue;
+		/* Leave it alone while sr_driver_scan_all() runs it. */
+		g_mutex_lock(&ctx->scan_mutex);
+		busy = g_slist_find(ctx->scan_busy, drivers[i]) != NULL;
+		g_mutex_unlock(&ctx->scan_mutex);
+		if (busy)
+			continue;
+		devices = sr_driver_scan(drivers[i], options);
+		for (l = devices; l; l = l->next)
+			ctx->hotplug_cb(SR_HOTPLUG_ARRIVED, l->data,
+					ctx->hotplug_cb_data);
+		g_slist_free(devices);
+	}
+
+	g_slist_free(options);
+	sr_config_free(src);
+	g_free(conn);
+}
+
+static void hotplug_left(struct sr_context *ctx, uint8_t bus,
+		uint8_t address)
+{
+	struct sr_dev_driver **drivers;
+	GSList *l;
+	int i;
+
+	drivers = sr_driver_list();
+	for (i = 0; drivers[i]; i++) {
+		if (!drivers[i]->priv)
+			continue;
+		for (l = sr_dev_list(drivers[i]); l; l = l->next) {
+			if (usb_inst_at(l->data, bus, address))
+				ctx->hotplug_cb(SR_HOTPLUG_LEFT, l->data,
+						ctx->hotplug_cb_data);
+		}
+	}
+}
+
+/**
+ * Handle pending libusb events, then hand the devices which came or went
+ * to the drivers and the hotplug callback, see sr_hotplug_handle_events().
+ *
+ * @param ctx libsigrok context to use.
+ * @param timeout_ms How long to wait in libusb for events to come in.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG if no hotplug callback is set.
+ *
+ * @private
+ */
+SR_PRIV int sr_usb_hotplug_handle_events(struct sr_context *ctx,
+		int timeout_ms)
+{
+	struct hotplug_event *ev;
+	struct timeval tv;
+	GSList *events, *l;
+
+	if (!ctx->hotplug_cb) {
+		sr_err("No hotplug callback set.");
+		return SR_ERR_ARG;
+	}
+
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	libusb_handle_events_timeout_completed(ctx->libusb_ctx, &tv, NULL);
+
+	g_mutex_lock(&ctx->scan_mutex);
+	events = ctx->hotplug_events;
+	ctx->hotplug_events = NULL;
+	g_mutex_unlock(&ctx->scan_mutex);
+
+	for (l = events; l; l = l->next) {
+		ev = l->data;
+		sr_dbg("USB device %d.%d %s.", ev->bus, ev->address,
+		       ev->event == SR_HOTPLUG_ARRIVED ? "arrived" : "left");
+		if (ev->event == SR_HOTPLUG_ARRIVED)
+			hotplug_arrived(ctx, ev->bus, ev->address);
+		else
+			hotplug_left(ctx, ev->bus, ev->address);
+	}
+	g_slist_free_full(events, g_free);
+
+	return SR_OK;
+}
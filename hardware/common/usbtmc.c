@@ -0,0 +1,415 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * USBTMC transport: through the kernel's usbtmc driver for devices named
+ * by their /dev node, or straight through libusb for the ones found with
+ * sr_usb_find_usbtmc().
+ *
+ * The kernel driver moves at most a few KiB per read() and asks the
+ * device for each of them separately. With libusb, a read asks for up to
+ * USBTMC_MAX_TRANSFER bytes of the response in one go, and hands them
+ * out of a buffer to the following reads. Deep memory waveforms then take
+ * a handful of bulk transfers instead of thousands.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "usbtmc: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+#ifdef HAVE_LIBUSB_1_0
+
+/* Bulk message IDs and header layout, as defined in the USBTMC standard. */
+#define DEV_DEP_MSG_OUT           1
+#define REQUEST_DEV_DEP_MSG_IN    2
+#define DEV_DEP_MSG_IN            2
+#define HEADER_SIZE               12
+#define ATTR_EOM                  0x01
+
+/* Interface class codes, see sr_usb_find_usbtmc(). */
+#define SUBCLASS_USBTMC           0x03
+
+/*
+ * What a bulk IN transfer asks the device for. A shorter response ends
+ * it early, so short replies don't get slower for it.
+ */
+#define USBTMC_MAX_TRANSFER       (4 * 1024 * 1024)
+/* Largest command a bulk OUT transfer carries. */
+#define USBTMC_MAX_COMMAND        1024
+
+#define USBTMC_TIMEOUT_MS         5000
+
+static void header_fill(uint8_t *buf, uint8_t msgid, uint8_t btag,
+		uint32_t size, uint8_t attr)
+{
+	memset(buf, 0, HEADER_SIZE);
+	buf[0] = msgid;
+	buf[1] = btag;
+	buf[2] = ~btag;
+	buf[4] = size & 0xff;
+	buf[5] = (size >> 8) & 0xff;
+	buf[6] = (size >> 16) & 0xff;
+	buf[7] = size >> 24;
+	buf[8] = attr;
+}
+
+static uint8_t next_btag(struct sr_usbtmc_dev_inst *usbtmc)
+{
+	/* 1 to 255, 0 isn't a valid tag. */
+	if (++usbtmc->btag == 0)
+		usbtmc->btag = 1;
+
+	return usbtmc->btag;
+}
+
+/* Find the USBTMC interface of an opened device, and its bulk endpoints. */
+static int find_endpoints(struct sr_usbtmc_dev_inst *usbtmc)
+{
+	struct libusb_config_descriptor *confdes;
+	const struct libusb_interface_descriptor *intfdes;
+	const struct libusb_endpoint_descriptor *epdes;
+	libusb_device *dev;
+	int i, j, ret;
+
+	dev = libusb_get_device(usbtmc->usb->devhdl);
+	if ((ret = libusb_get_active_config_descriptor(dev, &confdes)) < 0) {
+		sr_err("Failed to get configuration descriptor: %s.",
+		       libusb_error_name(ret));
+		return SR_ERR;
+	}
+
+	ret = SR_ERR;
+	for (i = 0; i < confdes->bNumInterfaces && ret != SR_OK; i++) {
+		intfdes = confdes->interface[i].altsetting;
+		if (intfdes->bInterfaceClass != LIBUSB_CLASS_APPLICATION
+			|| intfdes->bInterfaceSubClass != SUBCLASS_USBTMC)
+			continue;
+		usbtmc->ep_in = usbtmc->ep_out = 0;
+		for (j = 0; j < intfdes->bNumEndpoints; j++) {
+			epdes = &intfdes->endpoint[j];
+			if ((epdes->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)
+					!= LIBUSB_TRANSFER_TYPE_BULK)
+				continue;
+			if (epdes->bEndpointAddress & LIBUSB_ENDPOINT_IN)
+				usbtmc->ep_in = epdes->bEndpointAddress;
+			else
+				usbtmc->ep_out = epdes->bEndpointAddress;
+		}
+		if (usbtmc->ep_in && usbtmc->ep_out) {
+			usbtmc->intf = intfdes->bInterfaceNumber;
+			ret = SR_OK;
+		}
+	}
+	libusb_free_config_descriptor(confdes);
+
+	if (ret != SR_OK)
+		sr_err("No USBTMC interface with bulk endpoints found.");
+
+	return ret;
+}
+
+static int usb_open(struct sr_context *ctx, struct sr_usbtmc_dev_inst *usbtmc)
+{
+	libusb_device_handle *hdl;
+	int ret;
+
+	if (sr_usb_open(ctx->libusb_ctx, usbtmc->usb) != SR_OK)
+		return SR_ERR;
+	hdl = usbtmc->usb->devhdl;
+
+	if (find_endpoints(usbtmc) != SR_OK)
+		goto err;
+
+	usbtmc->detached = FALSE;
+	if (libusb_kernel_driver_active(hdl, usbtmc->intf) == 1) {
+		if ((ret = libusb_detach_kernel_driver(hdl,
+				usbtmc->intf)) < 0) {
+			sr_err("Failed to detach kernel driver: %s.",
+			       libusb_error_name(ret));
+			goto err;
+		}
+		usbtmc->detached = TRUE;
+	}
+	if ((ret = libusb_claim_interface(hdl, usbtmc->intf)) < 0) {
+		sr_err("Failed to claim interface: %s.",
+		       libusb_error_name(ret));
+		goto err;
+	}
+
+	if (!usbtmc->rx_buf && !(usbtmc->rx_buf =
+			g_try_malloc(HEADER_SIZE + USBTMC_MAX_TRANSFER))) {
+		sr_err("%s: rx_buf malloc failed", __func__);
+		libusb_release_interface(hdl, usbtmc->intf);
+		goto err;
+	}
+	usbtmc->rx_start = usbtmc->rx_end = 0;
+
+	return SR_OK;
+
+err:
+	if (usbtmc->detached)
+		libusb_attach_kernel_driver(hdl, usbtmc->intf);
+	libusb_close(hdl);
+	usbtmc->usb->devhdl = NULL;
+
+	return SR_ERR;
+}
+
+static void usb_close(struct sr_usbtmc_dev_inst *usbtmc)
+{
+	libusb_device_handle *hdl;
+
+	hdl = usbtmc->usb->devhdl;
+	libusb_release_interface(hdl, usbtmc->intf);
+	/* Give /dev/usbtmc* back to the kernel. */
+	if (usbtmc->detached)
+		libusb_attach_kernel_driver(hdl, usbtmc->intf);
+	libusb_close(hdl);
+	usbtmc->usb->devhdl = NULL;
+	usbtmc->rx_start = usbtmc->rx_end = 0;
+}
+
+static int usb_write(struct sr_usbtmc_dev_inst *usbtmc, const void *buf,
+		int count)
+{
+	uint8_t msg[HEADER_SIZE + USBTMC_MAX_COMMAND + 3];
+	int len, done, ret;
+
+	if (count > USBTMC_MAX_COMMAND) {
+		sr_err("Command of %d bytes is too long.", count);
+		return -1;
+	}
+
+	/* The whole command in one transfer, padded to a multiple of 4. */
+	header_fill(msg, DEV_DEP_MSG_OUT, next_btag(usbtmc), count, ATTR_EOM);
+	memcpy(msg + HEADER_SIZE, buf, count);
+	len = HEADER_SIZE + count;
+	while (len % 4)
+		msg[len++] = 0;
+
+	ret = libusb_bulk_transfer(usbtmc->usb->devhdl, usbtmc->ep_out, msg,
+			len, &done, USBTMC_TIMEOUT_MS);
+	if (ret < 0 || done != len) {
+		sr_err("Failed to send command: %s.", libusb_error_name(ret));
+		return -1;
+	}
+
+	return count;
+}
+
+/* Ask the device for more of the response, into the emptied buffer. */
+static int usb_fill(struct sr_usbtmc_dev_inst *usbtmc)
+{
+	uint8_t req[HEADER_SIZE], *hdr;
+	uint32_t size;
+	uint8_t btag;
+	int done, ret;
+
+	size = USBTMC_MAX_TRANSFER;
+	btag = next_btag(usbtmc);
+	header_fill(req, REQUEST_DEV_DEP_MSG_IN, btag, size, 0);
+	ret = libusb_bulk_transfer(usbtmc->usb->devhdl, usbtmc->ep_out, req,
+			HEADER_SIZE, &done, USBTMC_TIMEOUT_MS);
+	if (ret < 0 || done != HEADER_SIZE) {
+		sr_err("Failed to request response: %s.",
+		       libusb_error_name(ret));
+		return -1;
+	}
+
+	/*
+	 * One transfer takes all of it: libusb splits it into as many URBs
+	 * as it needs, and keeps them all queued on the endpoint.
+	 */
+	hdr = usbtmc->rx_buf;
+	ret = libusb_bulk_transfer(usbtmc->usb->devhdl, usbtmc->ep_in, hdr,
+			HEADER_SIZE + ((size + 3) & ~3), &done,
+			USBTMC_TIMEOUT_MS);
+	if (ret < 0) {
+		sr_err("Failed to read response: %s.", libusb_error_name(ret));
+		libusb_clear_halt(usbtmc->usb->devhdl, usbtmc->ep_in);
+		return -1;
+	}
+	if (done < HEADER_SIZE || hdr[0] != DEV_DEP_MSG_IN
+			|| hdr[1] != btag || hdr[2] != (uint8_t)~btag) {
+		sr_err("Received invalid response header.");
+		return -1;
+	}
+
+	size = hdr[4] | hdr[5] << 8 | hdr[6] << 16 | (uint32_t)hdr[7] << 24;
+	if (size > (uint32_t)(done - HEADER_SIZE)) {
+		sr_warn("Response is %d bytes short.",
+			size - (done - HEADER_SIZE));
+		size = done - HEADER_SIZE;
+	}
+	usbtmc->rx_start = HEADER_SIZE;
+	usbtmc->rx_end = HEADER_SIZE + size;
+	sr_spew("Received %d bytes%s.", size,
+		(hdr[8] & ATTR_EOM) ? "" : ", more to come");
+
+	return size;
+}
+
+/* Like read() on the kernel device: a part of one response at most. */
+static int usb_read(struct sr_usbtmc_dev_inst *usbtmc, void *buf, int count)
+{
+	int len;
+
+	if (usbtmc->rx_start == usbtmc->rx_end) {
+		if (count <= 0)
+			return 0;
+		if (usb_fill(usbtmc) < 0)
+			return -1;
+	}
+
+	len = MIN((size_t)count, usbtmc->rx_end - usbtmc->rx_start);
+	memcpy(buf, usbtmc->rx_buf + usbtmc->rx_start, len);
+	usbtmc->rx_start += len;
+
+	return len;
+}
+
+#endif
+
+/**
+ * Open a USBTMC device, through libusb if it was found that way.
+ *
+ * @param ctx libsigrok context, for the libusb context.
+ * @param usbtmc Device instance to open.
+ *
+ * @return SR_OK upon success, SR_ERR upon failure.
+ *
+ * @private
+ */
+SR_PRIV int sr_usbtmc_open(struct sr_context *ctx,
+		struct sr_usbtmc_dev_inst *usbtmc)
+{
+#ifdef HAVE_LIBUSB_1_0
+	if (usbtmc->usb)
+		return usb_open(ctx, usbtmc);
+#else
+	(void)ctx;
+#endif
+
+	if ((usbtmc->fd = open(usbtmc->device, O_RDWR)) < 0) {
+		sr_err("Failed to open %s.", usbtmc->device);
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Close a USBTMC device opened with sr_usbtmc_open().
+ *
+ * @param usbtmc Device instance to close.
+ *
+ * @private
+ */
+SR_PRIV void sr_usbtmc_close(struct sr_usbtmc_dev_inst *usbtmc)
+{
+#ifdef HAVE_LIBUSB_1_0
+	if (usbtmc->usb) {
+		if (usbtmc->usb->devhdl)
+			usb_close(usbtmc);
+		return;
+	}
+#endif
+
+	if (usbtmc->fd != -1) {
+		close(usbtmc->fd);
+		usbtmc->fd = -1;
+	}
+}
+
+/**
+ * Check whether a USBTMC device is open.
+ *
+ * @param usbtmc Device instance to check.
+ *
+ * @return TRUE once sr_usbtmc_open() succeeded, until sr_usbtmc_close().
+ *
+ * @private
+ */
+SR_PRIV gboolean sr_usbtmc_is_open(const struct sr_usbtmc_dev_inst *usbtmc)
+{
+#ifdef HAVE_LIBUSB_1_0
+	if (usbtmc->usb)
+		return usbtmc->usb->devhdl != NULL;
+#endif
+
+	return usbtmc->fd != -1;
+}
+
+/**
+ * Send a command to a USBTMC device, in a single message.
+ *
+ * @param usbtmc Device instance to write to.
+ * @param buf The command.
+ * @param count Its length in bytes.
+ *
+ * @return The number of bytes written, or -1 upon errors.
+ *
+ * @private
+ */
+SR_PRIV int sr_usbtmc_write(struct sr_usbtmc_dev_inst *usbtmc,
+		const void *buf, int count)
+{
+#ifdef HAVE_LIBUSB_1_0
+	if (usbtmc->usb)
+		return usb_write(usbtmc, buf, count);
+#endif
+
+	return write(usbtmc->fd, buf, count);
+}
+
+/**
+ * Read (part of) the response to the last command.
+ *
+ * Like read() on the kernel's device, this returns what the device had
+ * ready, up to @a count bytes. Further calls return the rest of the
+ * response.
+ *
+ * @param usbtmc Device instance to read from.
+ * @param buf Buffer for the data.
+ * @param count Size of the buffer.
+ *
+ * @return The number of bytes read, or -1 upon errors.
+ *
+ * @private
+ */
+SR_PRIV int sr_usbtmc_read(struct sr_usbtmc_dev_inst *usbtmc, void *buf,
+		int count)
+{
+#ifdef HAVE_LIBUSB_1_0
+	if (usbtmc->usb)
+		return usb_read(usbtmc, buf, count);
+#endif
+
+	return read(usbtmc->fd, buf, count);
+}
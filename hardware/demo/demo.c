@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <math.h>
 #ifdef _WIN32
 #include <io.h>
 #include <fcntl.h>
@@ -34,21 +35,35 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "demo: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
-/* TODO: Number of probes should be configurable. */
-#define NUM_PROBES             8
+/* Probes a device gets by default, and the most it can get. */
+#define DEFAULT_LOGIC_PROBES   8
+#define MAX_LOGIC_PROBES       64
+#define MAX_ANALOG_PROBES      16
 
 #define DEMONAME               "Demo device"
 
-/* The size of chunks to send through the session bus. */
-/* TODO: Should be configurable. */
+/* The default size of chunks to send through the session bus. */
 #define BUFSIZE                4096
 
+/* Largest sample width and chunk size which can be configured. */
+#define MAX_UNITSIZE           8
+#define MAX_BUFSIZE            (16 * 1024 * 1024)
+
+/* Chunks sent per callback invocation in free-running mode. */
+#define FREERUN_CHUNKS         64
+
+/* Samples per period of the analog waveforms. */
+#define ANALOG_PERIOD          1000
+
+/* Seed of the random pattern, so every acquisition gets the same data. */
+#define RANDOM_SEED            0x2545f4914f6cdd1dULL
+
 #define STR_PATTERN_SIGROK   "sigrok"
 #define STR_PATTERN_RANDOM   "random"
 #define STR_PATTERN_INC      "incremental"
@@ -91,6 +106,25 @@ struct dev_context {
 	uint64_t samples_counter;
 	void *cb_data;
 	int64_t starttime;
+	gboolean freerun;
+	uint64_t bufsize;
+	uint64_t unitsize;
+	uint8_t *buf;
+	int num_logic_probes;
+	int num_analog_probes;
+	/* Generator state, kept over the chunks of an acquisition. */
+	uint64_t pattern_pos;
+	uint64_t random_state;
+	/* One period of each enabled analog probe's waveform. */
+	GSList *analog_probes;
+	float *analog_period;
+	unsigned int analog_pos;
+	float *analog_buf;
+};
+
+static const int32_t hwopts[] = {
+	SR_CONF_NUM_LOGIC_PROBES,
+	SR_CONF_NUM_ANALOG_PROBES,
 };
 
 static const int hwcaps[] = {
@@ -101,6 +135,9 @@ static const int hwcaps[] = {
 	SR_CONF_LIMIT_SAMPLES,
 	SR_CONF_LIMIT_MSEC,
 	SR_CONF_CONTINUOUS,
+	SR_CONF_FREERUN,
+	SR_CONF_BUFFERSIZE,
+	SR_CONF_CAPTURE_UNITSIZE,
 };
 
 static const uint64_t samplerates[] = {
@@ -117,12 +154,6 @@ static const char *pattern_strings[] = {
 	"all-high",
 };
 
-/* We name the probes 0-7 on our demo driver. */
-static const char *probe_names[NUM_PROBES + 1] = {
-	"0", "1", "2", "3", "4", "5", "6", "7",
-	NULL,
-};
-
 static uint8_t pattern_sigrok[] = {
 	0x4c, 0x92, 0x92, 0x92, 0x64, 0x00, 0x00, 0x00,
 	0x82, 0xfe, 0xfe, 0x82, 0x00, 0x00, 0x00, 0x00,
@@ -157,27 +188,52 @@ static GSList *scan(GSList *options)
 {
 	struct sr_dev_inst *sdi;
 	struct sr_probe *probe;
+	struct sr_config *src;
 	struct drv_context *drvc;
 	struct dev_context *devc;
-	GSList *devices;
+	GSList *devices, *l;
+	uint64_t num_logic, num_analog;
+	char *name;
 	int i;
 
-	(void)options;
-
 	drvc = di->priv;
 
+	num_logic = DEFAULT_LOGIC_PROBES;
+	num_analog = 0;
+	for (l = options; l; l = l->next) {
+		src = l->data;
+		if (src->key == SR_CONF_NUM_LOGIC_PROBES)
+			num_logic = g_variant_get_uint64(src->data);
+		else if (src->key == SR_CONF_NUM_ANALOG_PROBES)
+			num_analog = g_variant_get_uint64(src->data);
+	}
+	if (num_logic > MAX_LOGIC_PROBES || num_analog > MAX_ANALOG_PROBES
+	    || num_logic + num_analog == 0) {
+		sr_err("Invalid number of probes: %" PRIu64 " logic, %" PRIu64
+		       " analog.", num_logic, num_analog);
+		return NULL;
+	}
+
 	devices = NULL;
 
-	sdi = sr_dev_inst_new(0, SR_ST_ACTIVE, DEMONAME, NULL, NULL);
+	sdi = sr_dev_inst_new(g_slist_length(drvc->instances), SR_ST_ACTIVE,
+			DEMONAME, NULL, NULL);
 	if (!sdi) {
 		sr_err("Device instance creation failed.");
 		return NULL;
 	}
 	sdi->driver = di;
 
-	for (i = 0; probe_names[i]; i++) {
-		if (!(probe = sr_probe_new(i, SR_PROBE_LOGIC, TRUE,
-				probe_names[i])))
+	/* Logic probes are named 0, 1, ..., analog ones A0, A1, ... */
+	for (i = 0; i < (int)(num_logic + num_analog); i++) {
+		if (i < (int)num_logic)
+			name = g_strdup_printf("%d", i);
+		else
+			name = g_strdup_printf("A%d", i - (int)num_logic);
+		probe = sr_probe_new(i, i < (int)num_logic ? SR_PROBE_LOGIC
+				: SR_PROBE_ANALOG, TRUE, name);
+		g_free(name);
+		if (!probe)
 			return NULL;
 		sdi->probes = g_slist_append(sdi->probes, probe);
 	}
@@ -185,7 +241,7 @@ static GSList *scan(GSList *options)
 	devices = g_slist_append(devices, sdi);
 	drvc->instances = g_slist_append(drvc->instances, sdi);
 
-	if (!(devc = g_try_malloc(sizeof(struct dev_context)))) {
+	if (!(devc = g_try_malloc0(sizeof(struct dev_context)))) {
 		sr_err("Device context malloc failed.");
 		return NULL;
 	}
@@ -195,6 +251,12 @@ static GSList *scan(GSList *options)
 	devc->limit_samples = 0;
 	devc->limit_msec = 0;
 	devc->sample_generator = PATTERN_SIGROK;
+	devc->freerun = FALSE;
+	devc->bufsize = BUFSIZE;
+	devc->unitsize = MAX((num_logic + 7) / 8, 1);
+	devc->buf = NULL;
+	devc->num_logic_probes = num_logic;
+	devc->num_analog_probes = num_analog;
 
 	sdi->priv = devc;
 
@@ -242,6 +304,15 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 	case SR_CONF_LIMIT_MSEC:
 		*data = g_variant_new_uint64(devc->limit_msec);
 		break;
+	case SR_CONF_FREERUN:
+		*data = g_variant_new_boolean(devc->freerun);
+		break;
+	case SR_CONF_BUFFERSIZE:
+		*data = g_variant_new_uint64(devc->bufsize);
+		break;
+	case SR_CONF_CAPTURE_UNITSIZE:
+		*data = g_variant_new_uint64(devc->unitsize);
+		break;
 	case SR_CONF_PATTERN_MODE:
 		switch (devc->sample_generator) {
 		case PATTERN_SIGROK:
@@ -273,6 +344,7 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 {
 	int ret;
 	const char *stropt;
+	uint64_t tmp_u64;
 
 	(void)probe_group;
 	struct dev_context *const devc = sdi->priv;
@@ -315,6 +387,34 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 		}
 		sr_dbg("%s: setting pattern to %d",
 			__func__, devc->sample_generator);
+	} else if (id == SR_CONF_FREERUN) {
+		devc->freerun = g_variant_get_boolean(data);
+		sr_dbg("%s: setting freerun to %d", __func__, devc->freerun);
+		ret = SR_OK;
+	} else if (id == SR_CONF_BUFFERSIZE) {
+		tmp_u64 = g_variant_get_uint64(data);
+		if (tmp_u64 < devc->unitsize || tmp_u64 > MAX_BUFSIZE) {
+			sr_err("%s: invalid buffer size %" PRIu64, __func__,
+			       tmp_u64);
+			return SR_ERR_ARG;
+		}
+		devc->bufsize = tmp_u64;
+		sr_dbg("%s: setting buffer size to %" PRIu64, __func__,
+		       devc->bufsize);
+		ret = SR_OK;
+	} else if (id == SR_CONF_CAPTURE_UNITSIZE) {
+		tmp_u64 = g_variant_get_uint64(data);
+		if (tmp_u64 < 1 || tmp_u64 > MAX_UNITSIZE
+		    || tmp_u64 > devc->bufsize
+		    || tmp_u64 * 8 < (uint64_t)devc->num_logic_probes) {
+			sr_err("%s: invalid unit size %" PRIu64, __func__,
+			       tmp_u64);
+			return SR_ERR_ARG;
+		}
+		devc->unitsize = tmp_u64;
+		sr_dbg("%s: setting unit size to %" PRIu64, __func__,
+		       devc->unitsize);
+		ret = SR_OK;
 	} else {
 		ret = SR_ERR_NA;
 	}
@@ -332,6 +432,10 @@ static int config_list(int key, GVariant **data, const struct sr_dev_inst *sdi,
 	(void)probe_group;
 
 	switch (key) {
+	case SR_CONF_SCAN_OPTIONS:
+		*data = g_variant_new_fixed_array(G_VARIANT_TYPE_INT32,
+				hwopts, ARRAY_SIZE(hwopts), sizeof(int32_t));
+		break;
 	case SR_CONF_DEVICE_OPTIONS:
 		*data = g_variant_new_fixed_array(G_VARIANT_TYPE_INT32,
 				hwcaps, ARRAY_SIZE(hwcaps), sizeof(int32_t));
@@ -353,29 +457,60 @@ static int config_list(int key, GVariant **data, const struct sr_dev_inst *sdi,
 	return SR_OK;
 }
 
-static void samples_generator(uint8_t *buf, uint64_t size,
+/* xorshift64*, fast enough to keep up with the session bus. */
+static uint64_t random_next(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * Fill buf with the given number of samples. The sigrok pattern goes into
+ * the lowest byte of wide samples, with the other probes low. The others
+ * cover the whole sample, the incremental one as a little endian number.
+ */
+static void samples_generator(uint8_t *buf, uint64_t samples,
 			      struct dev_context *devc)
 {
-	static uint64_t p = 0;
-	uint64_t i;
+	uint64_t i, size, unitsize, v;
+	unsigned int j;
 
-	/* TODO: Needed? */
-	memset(buf, 0, size);
+	unitsize = devc->unitsize;
+	size = samples * unitsize;
 
 	switch (devc->sample_generator) {
 	case PATTERN_SIGROK: /* sigrok pattern */
-		for (i = 0; i < size; i++) {
-			*(buf + i) = ~(pattern_sigrok[
-				p++ % sizeof(pattern_sigrok)] >> 1);
+		if (unitsize > 1)
+			memset(buf, 0, size);
+		for (i = 0; i < size; i += unitsize) {
+			buf[i] = ~(pattern_sigrok[devc->pattern_pos++
+					% sizeof(pattern_sigrok)] >> 1);
 		}
 		break;
 	case PATTERN_RANDOM: /* Random */
-		for (i = 0; i < size; i++)
-			*(buf + i) = (uint8_t)(rand() & 0xff);
+		for (i = 0; i + 8 <= size; i += 8) {
+			v = random_next(&devc->random_state);
+			memcpy(buf + i, &v, 8);
+		}
+		if (i < size) {
+			v = random_next(&devc->random_state);
+			memcpy(buf + i, &v, size - i);
+		}
 		break;
 	case PATTERN_INC: /* Simple increment */
-		for (i = 0; i < size; i++)
-			*(buf + i) = p++;
+		if (unitsize == 1) {
+			for (i = 0; i < size; i++)
+				buf[i] = devc->pattern_pos++;
+			break;
+		}
+		for (i = 0; i < size; i += unitsize) {
+			v = devc->pattern_pos++;
+			for (j = 0; j < unitsize; j++, v >>= 8)
+				buf[i + j] = v;
+		}
 		break;
 	case PATTERN_ALL_LOW: /* All probes are low */
 		memset(buf, 0x00, size);
@@ -389,25 +524,131 @@ static void samples_generator(uint8_t *buf, uint64_t size,
 	}
 }
 
+/*
+ * One period of the waveform of the n-th analog probe: a sine, square,
+ * triangle or sawtooth wave, in turn, between -1 and 1 V.
+ */
+static void analog_period_fill(float *period, int n)
+{
+	double t;
+	int i;
+
+	for (i = 0; i < ANALOG_PERIOD; i++) {
+		t = (double)i / ANALOG_PERIOD;
+		switch (n % 4) {
+		case 0:
+			period[i] = sin(2 * G_PI * t);
+			break;
+		case 1:
+			period[i] = t < 0.5 ? 1 : -1;
+			break;
+		case 2:
+			period[i] = t < 0.5 ? 4 * t - 1 : 3 - 4 * t;
+			break;
+		default:
+			period[i] = 2 * t - 1;
+			break;
+		}
+	}
+}
+
+/* Fill the analog buffer with samples of all enabled analog probes. */
+static void analog_generator(uint64_t samples, struct dev_context *devc)
+{
+	unsigned int num, pos, p;
+	uint64_t i;
+	float *out;
+
+	num = g_slist_length(devc->analog_probes);
+	pos = devc->analog_pos;
+	out = devc->analog_buf;
+	for (i = 0; i < samples; i++) {
+		for (p = 0; p < num; p++)
+			*out++ = devc->analog_period[p * ANALOG_PERIOD + pos];
+		if (++pos == ANALOG_PERIOD)
+			pos = 0;
+	}
+	devc->analog_pos = pos;
+}
+
+static void analog_free(struct dev_context *devc)
+{
+	g_slist_free(devc->analog_probes);
+	devc->analog_probes = NULL;
+	sr_dev_mem_free(devc->sdi, devc->analog_period);
+	devc->analog_period = NULL;
+	sr_dev_mem_free(devc->sdi, devc->analog_buf);
+	devc->analog_buf = NULL;
+}
+
+static int analog_init(const struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	struct sr_probe *probe;
+	GSList *l;
+	unsigned int num, n;
+
+	devc = sdi->priv;
+	devc->analog_pos = 0;
+	for (l = sdi->probes; l; l = l->next) {
+		probe = l->data;
+		if (probe->type == SR_PROBE_ANALOG && probe->enabled)
+			devc->analog_probes = g_slist_append(
+					devc->analog_probes, probe);
+	}
+	if (!(num = g_slist_length(devc->analog_probes)))
+		return SR_OK;
+
+	devc->analog_period = sr_dev_mem_alloc(sdi, num * ANALOG_PERIOD
+			* sizeof(float));
+	devc->analog_buf = sr_dev_mem_alloc(sdi, devc->bufsize / devc->unitsize
+			* num * sizeof(float));
+	if (!devc->analog_period || !devc->analog_buf) {
+		sr_err("%s: analog buffer malloc failed", __func__);
+		analog_free(devc);
+		return SR_ERR_MALLOC;
+	}
+
+	/* Each probe gets the waveform of its number. */
+	for (l = devc->analog_probes, n = 0; l; l = l->next, n++) {
+		probe = l->data;
+		analog_period_fill(devc->analog_period + n * ANALOG_PERIOD,
+				probe->index - devc->num_logic_probes);
+	}
+
+	return SR_OK;
+}
+
 /* Callback handling data */
 static int receive_data(int fd, int revents, void *cb_data)
 {
 	struct dev_context *devc = cb_data;
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_logic logic;
-	uint8_t buf[BUFSIZE];
-	static uint64_t samples_to_send, expected_samplenum, sending_now;
+	struct sr_datafeed_analog analog;
+	uint64_t samples_to_send, expected_samplenum, sending_now;
+	uint64_t chunk_samples;
 	int64_t time, elapsed;
 
 	(void)fd;
 	(void)revents;
 
-	/* How many "virtual" samples should we have collected by now? */
-	time = g_get_monotonic_time();
-	elapsed = time - devc->starttime;
-	expected_samplenum = elapsed * devc->cur_samplerate / 1000000;
-	/* Of those, how many do we still have to send? */
-	samples_to_send = expected_samplenum - devc->samples_counter;
+	chunk_samples = devc->bufsize / devc->unitsize;
+
+	if (devc->freerun) {
+		/*
+		 * Don't keep to any samplerate, but return to the main
+		 * loop every now and then so the session can be stopped.
+		 */
+		samples_to_send = chunk_samples * FREERUN_CHUNKS;
+	} else {
+		/* How many "virtual" samples should we have collected by now? */
+		time = g_get_monotonic_time();
+		elapsed = time - devc->starttime;
+		expected_samplenum = elapsed * devc->cur_samplerate / 1000000;
+		/* Of those, how many do we still have to send? */
+		samples_to_send = expected_samplenum - devc->samples_counter;
+	}
 
 	if (devc->limit_samples) {
 		samples_to_send = MIN(samples_to_send,
@@ -415,16 +656,32 @@ static int receive_data(int fd, int revents, void *cb_data)
 	}
 
 	while (samples_to_send > 0) {
-		sending_now = MIN(samples_to_send, sizeof(buf));
+		sending_now = MIN(samples_to_send, chunk_samples);
 		samples_to_send -= sending_now;
-		samples_generator(buf, sending_now, devc);
-
-		packet.type = SR_DF_LOGIC;
-		packet.payload = &logic;
-		logic.length = sending_now;
-		logic.unitsize = 1;
-		logic.data = buf;
-		sr_session_send(devc->cb_data, &packet);
+
+		if (devc->num_logic_probes) {
+			samples_generator(devc->buf, sending_now, devc);
+			packet.type = SR_DF_LOGIC;
+			packet.payload = &logic;
+			logic.length = sending_now * devc->unitsize;
+			logic.unitsize = devc->unitsize;
+			logic.data = devc->buf;
+			sr_session_send(devc->cb_data, &packet);
+		}
+
+		if (devc->analog_probes) {
+			analog_generator(sending_now, devc);
+			memset(&analog, 0, sizeof(analog));
+			packet.type = SR_DF_ANALOG;
+			packet.payload = &analog;
+			analog.probes = devc->analog_probes;
+			analog.num_samples = sending_now;
+			analog.mq = SR_MQ_VOLTAGE;
+			analog.unit = SR_UNIT_VOLT;
+			analog.data = devc->analog_buf;
+			sr_session_send(devc->cb_data, &packet);
+		}
+
 		devc->samples_counter += sending_now;
 	}
 
@@ -447,6 +704,18 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 
 	devc->cb_data = cb_data;
 	devc->samples_counter = 0;
+	devc->pattern_pos = 0;
+	devc->random_state = RANDOM_SEED + sdi->index;
+
+	if (!(devc->buf = sr_dev_mem_alloc(sdi, devc->bufsize))) {
+		sr_err("%s: buf malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if (analog_init(sdi) != SR_OK) {
+		sr_dev_mem_free(sdi, devc->buf);
+		devc->buf = NULL;
+		return SR_ERR_MALLOC;
+	}
 
 	/*
 	 * Setting two channels connected by a pipe is a remnant from when the
@@ -458,6 +727,24 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	if (pipe(devc->pipe_fds)) {
 		/* TODO: Better error message. */
 		sr_err("%s: pipe() failed", __func__);
+		analog_free(devc);
+		sr_dev_mem_free(sdi, devc->buf);
+		devc->buf = NULL;
+		return SR_ERR;
+	}
+
+	/*
+	 * In free-running mode, leave a byte in the pipe which is never
+	 * read. That keeps the channel readable, so the callback is run
+	 * on every pass through the main loop.
+	 */
+	if (devc->freerun && write(devc->pipe_fds[1], "", 1) != 1) {
+		sr_err("%s: write() failed", __func__);
+		close(devc->pipe_fds[0]);
+		close(devc->pipe_fds[1]);
+		analog_free(devc);
+		sr_dev_mem_free(sdi, devc->buf);
+		devc->buf = NULL;
 		return SR_ERR;
 	}
 
@@ -471,8 +758,8 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	/* Make channels to unbuffered. */
 	g_io_channel_set_buffered(devc->channel, FALSE);
 
-	sr_session_source_add_channel(devc->channel, G_IO_IN | G_IO_ERR,
-		    40, receive_data, devc);
+	sr_session_source_add_channel(sdi->session, devc->channel,
+		    G_IO_IN | G_IO_ERR, 40, receive_data, devc);
 
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
@@ -492,15 +779,20 @@ static int dev_acquisition_stop(struct sr_dev_inst *sdi, void *cb_data)
 
 	sr_dbg("Stopping aquisition.");
 
-	sr_session_source_remove_channel(devc->channel);
+	sr_session_source_remove_channel(sdi->session, devc->channel);
 	g_io_channel_shutdown(devc->channel, FALSE, NULL);
 	g_io_channel_unref(devc->channel);
 	devc->channel = NULL;
+	close(devc->pipe_fds[1]);
 
 	/* Send last packet. */
 	packet.type = SR_DF_END;
 	sr_session_send(devc->cb_data, &packet);
 
+	sr_dev_mem_free(sdi, devc->buf);
+	devc->buf = NULL;
+	analog_free(devc);
+
 	return SR_OK;
 }
 
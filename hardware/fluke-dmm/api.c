@@ -53,9 +53,9 @@ static char *scan_conn[] = {
 };
 
 static const struct flukedmm_profile supported_flukedmm[] = {
-	{ FLUKE_187, "187", 100, 1000 },
-	{ FLUKE_287, "287", 100, 1000 },
-	{ FLUKE_190, "199B", 1000, 3500 },
+	{ FLUKE_187, "187", 100, 1000, 2 },
+	{ FLUKE_287, "287", 100, 1000, 2 },
+	{ FLUKE_190, "199B", 1000, 3500, 1 },
 };
 
 static int dev_clear(void)
@@ -315,12 +315,9 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	serial = sdi->conn;
 	sr_source_add(serial->fd, G_IO_IN, 50, fluke_receive_data, (void *)sdi);
 
-	if (serial_write(serial, "QM\r", 3) == -1) {
-		sr_err("Unable to send QM: %s.", strerror(errno));
+	devc->qm_pending = 0;
+	if (fluke_send_qm(sdi) != SR_OK)
 		return SR_ERR;
-	}
-	devc->cmd_sent_at = g_get_monotonic_time() / 1000;
-	devc->expect_response = TRUE;
 
 	return SR_OK;
 }
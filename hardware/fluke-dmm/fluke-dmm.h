@@ -23,13 +23,14 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "fluke-dmm: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define FLUKEDMM_BUFSIZE  256
+#define FLUKEDMM_MAX_PENDING  4
 
 /* Supported models */
 enum {
@@ -46,6 +47,8 @@ struct flukedmm_profile {
 	int poll_period;
 	/* If no response received, how long to wait before retrying. */
 	int timeout;
+	/* How many QM queries may wait for a reply at the same time. */
+	int max_pending;
 };
 
 /* Private, per-device-instance driver context. */
@@ -61,8 +64,10 @@ struct dev_context {
 	uint64_t num_samples;
 	char buf[FLUKEDMM_BUFSIZE];
 	int buflen;
-	int64_t cmd_sent_at;
-	int expect_response;
+	/* Send times of the QM queries waiting for a reply, oldest first. */
+	int64_t qm_sent_at[FLUKEDMM_MAX_PENDING];
+	int qm_pending;
+	int64_t qm_last_sent;
 	int meas_type;
 	int is_relative;
 	int mq;
@@ -70,6 +75,7 @@ struct dev_context {
 	int mqflags;
 };
 
+SR_PRIV int fluke_send_qm(const struct sr_dev_inst *sdi);
 SR_PRIV int fluke_receive_data(int fd, int revents, void *cb_data);
 
 #endif
@@ -406,8 +406,19 @@ static void handle_qm_19x_data(const struct sr_dev_inst *sdi, char **tokens)
 
 }
 
-static void handle_line(const struct sr_dev_inst *sdi)
+/* The meter answered the oldest query which is waiting for a reply. */
+static void qm_retire(struct dev_context *devc)
 {
+	if (!devc->qm_pending)
+		return;
+	devc->qm_pending--;
+	memmove(devc->qm_sent_at, devc->qm_sent_at + 1,
+			devc->qm_pending * sizeof(int64_t));
+}
+
+static void handle_line(char *line, int len, void *cb_data)
+{
+	const struct sr_dev_inst *sdi;
 	struct dev_context *devc;
 	struct sr_serial_dev_inst *serial;
 	struct sr_datafeed_packet packet;
@@ -415,33 +426,33 @@ static void handle_line(const struct sr_dev_inst *sdi)
 	int num_tokens, n, i;
 	char cmd[16], **tokens;
 
+	sdi = cb_data;
 	devc = sdi->priv;
 	serial = sdi->conn;
-	sr_spew("Received line '%s' (%d).", devc->buf, devc->buflen);
+	sr_spew("Received line '%s' (%d).", line, len);
 
-	if (devc->buflen == 1) {
-		if (devc->buf[0] != '0') {
+	if (len == 1) {
+		if (line[0] != '0') {
 			/* Not just a CMD_ACK from the query command. */
-			sr_dbg("Got CMD_ACK '%c'.", devc->buf[0]);
-			devc->expect_response = FALSE;
+			sr_dbg("Got CMD_ACK '%c'.", line[0]);
+			qm_retire(devc);
 		}
-		devc->buflen = 0;
 		return;
 	}
 
 	analog = NULL;
-	tokens = g_strsplit(devc->buf, ",", 0);
+	tokens = g_strsplit(line, ",", 0);
 	if (tokens[0]) {
 		if (devc->profile->model == FLUKE_187) {
-			devc->expect_response = FALSE;
+			qm_retire(devc);
 			analog = handle_qm_18x(sdi, tokens);
 		} else if (devc->profile->model == FLUKE_287) {
-			devc->expect_response = FALSE;
+			qm_retire(devc);
 			analog = handle_qm_28x(sdi, tokens);
 		} else if (devc->profile->model == FLUKE_190) {
-			devc->expect_response = FALSE;
 			for (num_tokens = 0; tokens[num_tokens]; num_tokens++);
 			if (num_tokens >= 7) {
+				qm_retire(devc);
 				/* Response to QM: this is a comma-separated list of
 				 * fields with metadata about the measurement. This
 				 * format can return multiple sets of metadata,
@@ -464,7 +475,6 @@ static void handle_line(const struct sr_dev_inst *sdi)
 		}
 	}
 	g_strfreev(tokens);
-	devc->buflen = 0;
 
 	if (analog) {
 		/* Got a measurement. */
@@ -478,13 +488,32 @@ static void handle_line(const struct sr_dev_inst *sdi)
 
 }
 
+SR_PRIV int fluke_send_qm(const struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	int64_t now;
+
+	devc = sdi->priv;
+	if (devc->qm_pending >= FLUKEDMM_MAX_PENDING)
+		return SR_ERR;
+
+	if (serial_write(sdi->conn, "QM\r", 3) == -1) {
+		sr_err("Unable to send QM: %s.", strerror(errno));
+		return SR_ERR;
+	}
+	now = g_get_monotonic_time() / 1000;
+	devc->qm_sent_at[devc->qm_pending++] = now;
+	devc->qm_last_sent = now;
+
+	return SR_OK;
+}
+
 SR_PRIV int fluke_receive_data(int fd, int revents, void *cb_data)
 {
 	struct sr_dev_inst *sdi;
 	struct dev_context *devc;
 	struct sr_serial_dev_inst *serial;
-	int len;
-	int64_t now, elapsed;
+	int64_t now;
 
 	(void)fd;
 
@@ -497,18 +526,8 @@ SR_PRIV int fluke_receive_data(int fd, int revents, void *cb_data)
 	serial = sdi->conn;
 	if (revents == G_IO_IN) {
 		/* Serial data arrived. */
-		while(FLUKEDMM_BUFSIZE - devc->buflen - 1 > 0) {
-			len = serial_read(serial, devc->buf + devc->buflen, 1);
-			if (len < 1)
-				break;
-			devc->buflen++;
-			*(devc->buf + devc->buflen) = '\0';
-			if (*(devc->buf + devc->buflen - 1) == '\r') {
-				*(devc->buf + --devc->buflen) = '\0';
-				handle_line(sdi);
-				break;
-			}
-		}
+		serial_read_lines(serial, devc->buf, &devc->buflen,
+				FLUKEDMM_BUFSIZE, '\r', handle_line, sdi);
 	}
 
 	if (devc->limit_samples && devc->num_samples >= devc->limit_samples) {
@@ -517,17 +536,20 @@ SR_PRIV int fluke_receive_data(int fd, int revents, void *cb_data)
 	}
 
 	now = g_get_monotonic_time() / 1000;
-	elapsed = now - devc->cmd_sent_at;
-	/* Send query command at poll_period interval, or after 1 second
-	 * has elapsed. This will make it easier to recover from any
-	 * out-of-sync or temporary disconnect issues. */
-	if ((devc->expect_response == FALSE && elapsed > devc->profile->poll_period)
-			|| elapsed > devc->profile->timeout) {
-		if (serial_write(serial, "QM\r", 3) == -1)
-			sr_err("Unable to send QM: %s.", strerror(errno));
-		devc->cmd_sent_at = now;
-		devc->expect_response = TRUE;
+	/* Give up on queries which weren't answered in time. This will
+	 * make it easier to recover from any out-of-sync or temporary
+	 * disconnect issues. */
+	while (devc->qm_pending
+	    && now - devc->qm_sent_at[0] > devc->profile->timeout) {
+		sr_dbg("No response to QM, retrying.");
+		qm_retire(devc);
 	}
+	/* Send a query at every poll_period interval, without waiting for
+	 * the previous reply as long as fewer than max_pending are. The
+	 * next reading is then on its way while one is being parsed. */
+	if (devc->qm_pending < devc->profile->max_pending
+	    && now - devc->qm_last_sent > devc->profile->poll_period)
+		fluke_send_qm(sdi);
 
 	return TRUE;
 }
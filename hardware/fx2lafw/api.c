@@ -81,10 +81,14 @@ static const int32_t hwcaps[] = {
 	SR_CONF_LOGIC_ANALYZER,
 	SR_CONF_TRIGGER_TYPE,
 	SR_CONF_SAMPLERATE,
+	SR_CONF_MAX_SAMPLERATE,
 
 	/* These are really implemented in the driver, not the hardware. */
 	SR_CONF_LIMIT_SAMPLES,
+	SR_CONF_CAPTURE_RATIO,
 	SR_CONF_CONTINUOUS,
+	SR_CONF_USB_TRANSFERS,
+	SR_CONF_PROBE_PACKING,
 };
 
 static const char *probe_names[] = {
@@ -122,6 +126,11 @@ static int dev_clear(void)
 
 static int init(struct sr_context *sr_ctx)
 {
+	int ret;
+
+	if ((ret = sr_usb_init(sr_ctx)) != SR_OK)
+		return ret;
+
 	return std_init(sr_ctx, di, LOG_PREFIX);
 }
 
@@ -152,13 +161,13 @@ static GSList *scan(GSList *options)
 		}
 	}
 	if (conn)
-		conn_devices = sr_usb_find(drvc->sr_ctx->libusb_ctx, conn);
+		conn_devices = sr_usb_find(drvc->sr_ctx, conn);
 	else
 		conn_devices = NULL;
 
 	/* Find all fx2lafw compatible devices and upload firmware to them. */
 	devices = NULL;
-	libusb_get_device_list(drvc->sr_ctx->libusb_ctx, &devlist);
+	sr_usb_get_device_list(drvc->sr_ctx, &devlist);
 	for (i = 0; devlist[i]; i++) {
 		if (conn) {
 			usb = NULL;
@@ -262,8 +271,13 @@ static int dev_open(struct sr_dev_inst *sdi)
 	ret = SR_ERR;
 	if (devc->fw_updated > 0) {
 		sr_info("Waiting for device to reset.");
-		/* Takes >= 300ms for the FX2 to be gone from the USB bus. */
-		g_usleep(300 * 1000);
+		/*
+		 * Takes >= 300ms for the FX2 to be gone from the USB bus,
+		 * counting from the upload.
+		 */
+		timediff_us = g_get_monotonic_time() - devc->fw_updated;
+		if (timediff_us < 300 * 1000)
+			g_usleep(300 * 1000 - timediff_us);
 		timediff_ms = 0;
 		while (timediff_ms < MAX_RENUM_DELAY_MS) {
 			if ((ret = fx2lafw_dev_open(sdi, di)) == SR_OK)
@@ -279,6 +293,8 @@ static int dev_open(struct sr_dev_inst *sdi)
 			return SR_ERR;
 		}
 		sr_info("Device came back after %" PRIi64 "ms.", timediff_ms);
+		/* It runs the firmware now, later opens needn't wait. */
+		devc->fw_updated = 0;
 	} else {
 		sr_info("Firmware upload was not needed.");
 		ret = fx2lafw_dev_open(sdi, di);
@@ -319,11 +335,20 @@ static int dev_open(struct sr_dev_inst *sdi)
 static int dev_close(struct sr_dev_inst *sdi)
 {
 	struct sr_usb_dev_inst *usb;
+	struct drv_context *drvc;
+	struct dev_context *devc;
 
 	usb = sdi->conn;
 	if (usb->devhdl == NULL)
 		return SR_ERR;
 
+	/* Their buffers may be device memory, which goes with the handle. */
+	drvc = di->priv;
+	devc = sdi->priv;
+	sr_usb_transfer_pool_trim(drvc->sr_ctx, &devc->idle_transfers, 0);
+	sr_usb_buffer_free(drvc->sr_ctx, devc->spare_buf, devc->spare_size);
+	devc->spare_buf = NULL;
+
 	sr_info("fx2lafw: Closing device %d on %d.%d interface %d.",
 		sdi->index, usb->bus, usb->address, USB_INTERFACE);
 	libusb_release_interface(usb->devhdl, USB_INTERFACE);
@@ -355,6 +380,7 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 {
 	struct dev_context *devc;
 	struct sr_usb_dev_inst *usb;
+	GVariant *range[2];
 	char str[128];
 
 	(void)probe_group;
@@ -377,6 +403,31 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 		devc = sdi->priv;
 		*data = g_variant_new_uint64(devc->cur_samplerate);
 		break;
+	case SR_CONF_CAPTURE_RATIO:
+		if (!sdi)
+			return SR_ERR;
+		devc = sdi->priv;
+		*data = g_variant_new_uint64(devc->capture_ratio);
+		break;
+	case SR_CONF_USB_TRANSFERS:
+		if (!sdi)
+			return SR_ERR;
+		devc = sdi->priv;
+		range[0] = g_variant_new_uint64(devc->min_transfers);
+		range[1] = g_variant_new_uint64(devc->max_transfers);
+		*data = g_variant_new_tuple(range, 2);
+		break;
+	case SR_CONF_MAX_SAMPLERATE:
+		if (!sdi)
+			return SR_ERR;
+		*data = g_variant_new_uint64(fx2lafw_max_samplerate(sdi));
+		break;
+	case SR_CONF_PROBE_PACKING:
+		if (!sdi)
+			return SR_ERR;
+		devc = sdi->priv;
+		*data = g_variant_new_boolean(devc->probe_packing);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -388,6 +439,7 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 		const struct sr_probe_group *probe_group)
 {
 	struct dev_context *devc;
+	uint64_t low, high;
 	int ret;
 
 	(void)probe_group;
@@ -403,6 +455,25 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 	} else if (id == SR_CONF_LIMIT_SAMPLES) {
 		devc->limit_samples = g_variant_get_uint64(data);
 		ret = SR_OK;
+	} else if (id == SR_CONF_CAPTURE_RATIO) {
+		if (g_variant_get_uint64(data) > 100) {
+			ret = SR_ERR_ARG;
+		} else {
+			devc->capture_ratio = g_variant_get_uint64(data);
+			ret = SR_OK;
+		}
+	} else if (id == SR_CONF_USB_TRANSFERS) {
+		g_variant_get(data, "(tt)", &low, &high);
+		if (low < 1 || low > high || high > MAX_SIMUL_TRANSFERS) {
+			ret = SR_ERR_ARG;
+		} else {
+			devc->min_transfers = low;
+			devc->max_transfers = high;
+			ret = SR_OK;
+		}
+	} else if (id == SR_CONF_PROBE_PACKING) {
+		devc->probe_packing = g_variant_get_boolean(data);
+		ret = SR_OK;
 	} else {
 		ret = SR_ERR_NA;
 	}
@@ -448,16 +519,19 @@ static int config_list(int key, GVariant **data, const struct sr_dev_inst *sdi,
 static int receive_data(int fd, int revents, void *cb_data)
 {
 	struct timeval tv;
-	struct drv_context *drvc;
+	struct dev_context *devc;
 
 	(void)fd;
 	(void)revents;
-	(void)cb_data;
 
-	drvc = di->priv;
+	devc = cb_data;
+
+	/* Completions are handled elsewhere if the USB thread runs. */
+	if (devc->ctx->usb_thread)
+		return TRUE;
 
 	tv.tv_sec = tv.tv_usec = 0;
-	libusb_handle_events_timeout(drvc->sr_ctx->libusb_ctx, &tv);
+	libusb_handle_events_timeout(devc->ctx->libusb_ctx, &tv);
 
 	return TRUE;
 }
@@ -468,10 +542,8 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	struct drv_context *drvc;
 	struct sr_usb_dev_inst *usb;
 	struct libusb_transfer *transfer;
-	const struct libusb_pollfd **lupfd;
 	unsigned int i, timeout, num_transfers;
 	int ret;
-	unsigned char *buf;
 	size_t size;
 
 	if (sdi->status != SR_ST_ACTIVE)
@@ -488,35 +560,61 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	}
 
 	devc->cb_data = cb_data;
+	devc->ctx = drvc->sr_ctx;
 	devc->num_samples = 0;
 	devc->empty_transfer_count = 0;
+	devc->processing = FALSE;
+
+	if (fx2lafw_pretrigger_init(devc) != SR_OK)
+		return SR_ERR_MALLOC;
 
-	timeout = fx2lafw_get_timeout(devc);
 	num_transfers = fx2lafw_get_number_of_transfers(devc);
 	size = fx2lafw_get_buffer_size(devc);
+	devc->target_transfers = num_transfers;
+	devc->base_transfer_size = devc->transfer_size = size;
+	devc->last_completion = devc->max_gap = 0;
+	devc->window_start = g_get_monotonic_time();
+	timeout = fx2lafw_get_timeout(devc);
 	devc->submitted_transfers = 0;
 
-	devc->transfers = g_try_malloc0(sizeof(*devc->transfers) * num_transfers);
+	/*
+	 * The last acquisition's transfers are reused if their size is
+	 * still right, as when only the probes or limits changed.
+	 */
+	sr_usb_transfer_pool_trim(devc->ctx, &devc->idle_transfers, size);
+
+	/*
+	 * Room for as many transfers as the queue may grow to, so the array
+	 * is never reallocated while the USB thread completes transfers.
+	 */
+	devc->transfers = g_try_malloc0(sizeof(*devc->transfers)
+			* MAX(num_transfers, devc->max_transfers));
 	if (!devc->transfers) {
 		sr_err("USB transfers malloc failed.");
 		return SR_ERR_MALLOC;
 	}
 
-	devc->num_transfers = num_transfers;
+	devc->num_transfers = MAX(num_transfers, devc->max_transfers);
 	for (i = 0; i < num_transfers; i++) {
-		if (!(buf = g_try_malloc(size))) {
-			sr_err("USB transfer buffer malloc failed.");
+		if (sr_dev_mem_charge(sdi, size) != SR_OK) {
+			fx2lafw_abort_acquisition(devc);
+			return SR_ERR_MALLOC;
+		}
+		if (!(transfer = sr_usb_transfer_get(devc->ctx,
+				&devc->idle_transfers, usb->devhdl, size))) {
+			sr_err("USB transfer malloc failed.");
+			sr_dev_mem_uncharge(sdi, size);
+			fx2lafw_abort_acquisition(devc);
 			return SR_ERR_MALLOC;
 		}
-		transfer = libusb_alloc_transfer(0);
 		libusb_fill_bulk_transfer(transfer, usb->devhdl,
-				2 | LIBUSB_ENDPOINT_IN, buf, size,
+				2 | LIBUSB_ENDPOINT_IN, transfer->buffer, size,
 				fx2lafw_receive_transfer, devc, timeout);
 		if ((ret = libusb_submit_transfer(transfer)) != 0) {
 			sr_err("Failed to submit transfer: %s.",
 			       libusb_error_name(ret));
-			libusb_free_transfer(transfer);
-			g_free(buf);
+			sr_usb_transfer_put(&devc->idle_transfers, transfer);
+			sr_dev_mem_uncharge(sdi, size);
 			fx2lafw_abort_acquisition(devc);
 			return SR_ERR;
 		}
@@ -524,20 +622,17 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 		devc->submitted_transfers++;
 	}
 
-	lupfd = libusb_get_pollfds(drvc->sr_ctx->libusb_ctx);
-	for (i = 0; lupfd[i]; i++);
-	if (!(devc->usbfd = g_try_malloc(sizeof(struct libusb_pollfd) * (i + 1))))
-		return SR_ERR;
-	for (i = 0; lupfd[i]; i++) {
-		sr_source_add(lupfd[i]->fd, lupfd[i]->events,
-			      timeout, receive_data, NULL);
-		devc->usbfd[i] = lupfd[i]->fd;
+	if ((ret = sr_usb_source_add(devc->ctx, timeout, receive_data,
+			devc)) != SR_OK) {
+		fx2lafw_abort_acquisition(devc);
+		return ret;
 	}
-	devc->usbfd[i] = -1;
-	free(lupfd);
 
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
+	if (devc->packed_probes)
+		std_session_send_df_packed_probes(cb_data, devc->packed_probes,
+				LOG_PREFIX);
 
 	if ((ret = fx2lafw_command_start_acquisition(usb->devhdl,
 		devc->cur_samplerate, devc->sample_wide)) != SR_OK) {
@@ -550,9 +645,16 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 
 static int dev_acquisition_stop(struct sr_dev_inst *sdi, void *cb_data)
 {
+	struct drv_context *drvc;
+
 	(void)cb_data;
 
+	drvc = di->priv;
+
+	/* Keep the USB thread from completing transfers meanwhile. */
+	libusb_lock_events(drvc->sr_ctx->libusb_ctx);
 	fx2lafw_abort_acquisition(sdi->priv);
+	libusb_unlock_events(drvc->sr_ctx->libusb_ctx);
 
 	return SR_OK;
 }
@@ -571,6 +673,7 @@ SR_PRIV struct sr_dev_driver fx2lafw_driver_info = {
 	.config_list = config_list,
 	.dev_open = dev_open,
 	.dev_close = dev_close,
+	.dev_check = std_dev_check_usb,
 	.dev_acquisition_start = dev_acquisition_start,
 	.dev_acquisition_stop = dev_acquisition_stop,
 	.priv = NULL,
@@ -292,15 +292,70 @@ SR_PRIV int fx2lafw_dev_open(struct sr_dev_inst *sdi, struct sr_dev_driver *di)
 	return SR_OK;
 }
 
+/*
+ * With probe packing, work out the width of the packed samples, and a
+ * table per byte of an FX2 sample with where its probes go in them. Only
+ * the lowest probes being enabled means the samples are packed already.
+ */
+static void pack_setup(struct dev_context *devc, uint64_t enabled)
+{
+	unsigned int byte, v;
+
+	devc->unitsize = devc->sample_wide ? 2 : 1;
+	devc->packed_probes = 0;
+	devc->pack = FALSE;
+	if (!devc->probe_packing || !enabled)
+		return;
+
+	devc->packed_probes = enabled;
+	devc->unitsize = (__builtin_popcountll(enabled) + 7) / 8;
+	if (!(enabled & (enabled + 1)))
+		return;
+
+	devc->pack = TRUE;
+	for (byte = 0; byte < 2; byte++) {
+		for (v = 0; v < 256; v++)
+			devc->pack_lut[byte][v] = sr_filter_probes_pack_mask(
+					(uint64_t)v << (byte * 8), enabled);
+	}
+}
+
+/* Pack the samples from the FX2 in place, see pack_setup(). */
+static void pack_samples(struct dev_context *devc, uint8_t *buf,
+		int num_samples)
+{
+	uint16_t v;
+	int i;
+
+	if (!devc->sample_wide) {
+		for (i = 0; i < num_samples; i++)
+			buf[i] = devc->pack_lut[0][buf[i]];
+	} else if (devc->unitsize == 1) {
+		for (i = 0; i < num_samples; i++)
+			buf[i] = devc->pack_lut[0][buf[i * 2]]
+				| devc->pack_lut[1][buf[i * 2 + 1]];
+	} else {
+		for (i = 0; i < num_samples; i++) {
+			v = devc->pack_lut[0][buf[i * 2]]
+				| devc->pack_lut[1][buf[i * 2 + 1]];
+			buf[i * 2] = v & 0xff;
+			buf[i * 2 + 1] = v >> 8;
+		}
+	}
+}
+
 SR_PRIV int fx2lafw_configure_probes(const struct sr_dev_inst *sdi)
 {
 	struct dev_context *devc;
 	struct sr_probe *probe;
+	struct sr_soft_trigger_stage stages[NUM_TRIGGER_STAGES];
 	GSList *l;
+	uint64_t enabled;
 	int probe_bit, stage, i;
 	char *tc;
 
 	devc = sdi->priv;
+	enabled = 0;
 	for (i = 0; i < NUM_TRIGGER_STAGES; i++) {
 		devc->trigger_mask[i] = 0;
 		devc->trigger_value[i] = 0;
@@ -316,6 +371,7 @@ SR_PRIV int fx2lafw_configure_probes(const struct sr_dev_inst *sdi)
 			devc->sample_wide = TRUE;
 
 		probe_bit = 1 << (probe->index);
+		enabled |= probe_bit;
 		if (!(probe->trigger))
 			continue;
 
@@ -330,18 +386,57 @@ SR_PRIV int fx2lafw_configure_probes(const struct sr_dev_inst *sdi)
 		}
 	}
 
-	if (stage == -1)
+	pack_setup(devc, enabled);
+
+	/* The trigger stages in use are the ones up to the first empty one. */
+	for (i = 0; i < NUM_TRIGGER_STAGES && devc->trigger_mask[i]; i++);
+
+	sr_soft_trigger_free(devc->stl);
+	devc->stl = NULL;
+
+	if (stage == -1 || i == 0) {
 		/*
 		 * We didn't configure any triggers, make sure acquisition
 		 * doesn't wait for any.
 		 */
 		devc->trigger_stage = TRIGGER_FIRED;
-	else
+	} else {
+		memset(stages, 0, sizeof(stages));
+		for (stage = 0; stage < i; stage++) {
+			stages[stage].mask = devc->trigger_mask[stage];
+			stages[stage].value = devc->trigger_value[stage];
+		}
+		if (devc->packed_probes)
+			sr_soft_trigger_stages_pack(stages, i,
+					devc->packed_probes);
+		if (!(devc->stl = sr_soft_trigger_new(devc->unitsize,
+				stages, i)))
+			return SR_ERR;
 		devc->trigger_stage = 0;
+	}
 
 	return SR_OK;
 }
 
+/*
+ * The highest samplerate for the probes enabled now: any probe past the
+ * first eight makes the samples 16 bits wide, which halves the rate USB
+ * keeps up with.
+ */
+SR_PRIV uint64_t fx2lafw_max_samplerate(const struct sr_dev_inst *sdi)
+{
+	struct sr_probe *probe;
+	GSList *l;
+
+	for (l = sdi->probes; l; l = l->next) {
+		probe = l->data;
+		if (probe->enabled && probe->index > 7)
+			return MAX_16BIT_SAMPLE_RATE;
+	}
+
+	return MAX_8BIT_SAMPLE_RATE;
+}
+
 SR_PRIV struct dev_context *fx2lafw_dev_new(void)
 {
 	struct dev_context *devc;
@@ -355,7 +450,19 @@ SR_PRIV struct dev_context *fx2lafw_dev_new(void)
 	devc->fw_updated = 0;
 	devc->cur_samplerate = 0;
 	devc->limit_samples = 0;
+	devc->capture_ratio = 0;
 	devc->sample_wide = 0;
+	devc->probe_packing = FALSE;
+	devc->packed_probes = 0;
+	devc->unitsize = 1;
+	devc->pack = FALSE;
+	devc->stl = NULL;
+	devc->pretrig_buf = NULL;
+	devc->spare_buf = NULL;
+	devc->spare_size = 0;
+	devc->idle_transfers = NULL;
+	devc->min_transfers = MIN_SIMUL_TRANSFERS;
+	devc->max_transfers = MAX_SIMUL_TRANSFERS;
 
 	return devc;
 }
@@ -375,19 +482,22 @@ SR_PRIV void fx2lafw_abort_acquisition(struct dev_context *devc)
 static void finish_acquisition(struct dev_context *devc)
 {
 	struct sr_datafeed_packet packet;
-	int i;
 
 	/* Terminate session. */
 	packet.type = SR_DF_END;
 	sr_session_send(devc->cb_data, &packet);
 
-	/* Remove fds from polling. */
-	for (i = 0; devc->usbfd[i] != -1; i++)
-		sr_source_remove(devc->usbfd[i]);
-	g_free(devc->usbfd);
+	sr_usb_source_remove(devc->ctx, devc);
 
 	devc->num_transfers = 0;
 	g_free(devc->transfers);
+
+	sr_dev_mem_free(devc->cb_data, devc->pretrig_buf);
+	devc->pretrig_buf = NULL;
+
+	/* The transfers and the spare buffer stay for the next one. */
+	sr_soft_trigger_free(devc->stl);
+	devc->stl = NULL;
 }
 
 static void free_transfer(struct libusb_transfer *transfer)
@@ -397,10 +507,7 @@ static void free_transfer(struct libusb_transfer *transfer)
 
 	devc = transfer->user_data;
 
-	g_free(transfer->buffer);
-	transfer->buffer = NULL;
-	libusb_free_transfer(transfer);
-
+	/* Clear the slot first, so aborting never sees a freed transfer. */
 	for (i = 0; i < devc->num_transfers; i++) {
 		if (devc->transfers[i] == transfer) {
 			devc->transfers[i] = NULL;
@@ -408,22 +515,279 @@ static void free_transfer(struct libusb_transfer *transfer)
 		}
 	}
 
+	sr_dev_mem_uncharge(devc->cb_data, transfer->length);
+	sr_usb_transfer_put(&devc->idle_transfers, transfer);
+
 	devc->submitted_transfers--;
-	if (devc->submitted_transfers == 0)
+	if (devc->submitted_transfers == 0 && !devc->processing)
 		finish_acquisition(devc);
 }
 
+/*
+ * Set up the pre-trigger buffer, which holds the latest capture ratio's
+ * share of limit_samples while waiting for the software trigger.
+ */
+SR_PRIV int fx2lafw_pretrigger_init(struct dev_context *devc)
+{
+	int sample_width;
+
+	sr_dev_mem_free(devc->cb_data, devc->pretrig_buf);
+	devc->pretrig_buf = NULL;
+	devc->pretrig_size = devc->pretrig_pos = devc->pretrig_fill = 0;
+
+	/* Without a trigger, there's nothing to wait for. */
+	if (devc->trigger_stage == TRIGGER_FIRED || !devc->capture_ratio
+	    || !devc->limit_samples)
+		return SR_OK;
+
+	sample_width = devc->unitsize;
+	devc->pretrig_size = MIN(devc->limit_samples * devc->capture_ratio / 100,
+			MAX_PRETRIGGER_SIZE / sample_width) * sample_width;
+	if (!devc->pretrig_size)
+		return SR_OK;
+
+	if (!(devc->pretrig_buf = sr_dev_mem_alloc(devc->cb_data,
+			devc->pretrig_size))) {
+		sr_err("Pre-trigger buffer malloc failed.");
+		devc->pretrig_size = 0;
+		return SR_ERR_MALLOC;
+	}
+
+	return SR_OK;
+}
+
+/* Keep the latest samples received while waiting for the trigger. */
+static void pretrigger_append(struct dev_context *devc, const uint8_t *data,
+		size_t len)
+{
+	size_t n;
+
+	if (!devc->pretrig_buf)
+		return;
+
+	/* Only the newest pretrig_size bytes can survive anyway. */
+	if (len > devc->pretrig_size) {
+		data += len - devc->pretrig_size;
+		len = devc->pretrig_size;
+	}
+
+	while (len) {
+		n = MIN(len, devc->pretrig_size - devc->pretrig_pos);
+		memcpy(devc->pretrig_buf + devc->pretrig_pos, data, n);
+		devc->pretrig_pos = (devc->pretrig_pos + n) % devc->pretrig_size;
+		devc->pretrig_fill = MIN(devc->pretrig_fill + n, devc->pretrig_size);
+		data += n;
+		len -= n;
+	}
+}
+
+static void send_logic(struct dev_context *devc, const uint8_t *data,
+		size_t len, int sample_width)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+
+	if (!len)
+		return;
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.length = len;
+	logic.unitsize = sample_width;
+	logic.data = (void *)data;
+	sr_session_send(devc->cb_data, &packet);
+
+	devc->num_samples += len / sample_width;
+}
+
+/*
+ * Send the samples preceding the trigger, straight from where they are
+ * stored: the pre-trigger buffer (oldest part first), then the current
+ * transfer up to the start of the trigger match. The matching samples
+ * themselves are sent separately, so they're left out here; 'skip' is
+ * the number of them that are still in the pre-trigger buffer.
+ */
+static void pretrigger_send(struct dev_context *devc, const uint8_t *cur_buf,
+		size_t cur_len, size_t skip, int sample_width)
+{
+	size_t start, len, first;
+
+	if (!devc->pretrig_buf)
+		return;
+
+	skip = MIN(skip, devc->pretrig_fill);
+	len = devc->pretrig_fill - skip;
+
+	/* Drop the oldest samples if the current transfer has enough. */
+	if (cur_len >= devc->pretrig_size)
+		len = 0;
+	else
+		len = MIN(len, devc->pretrig_size - cur_len);
+
+	start = (devc->pretrig_pos + devc->pretrig_size - skip - len)
+			% devc->pretrig_size;
+	first = MIN(len, devc->pretrig_size - start);
+	send_logic(devc, devc->pretrig_buf + start, first, sample_width);
+	send_logic(devc, devc->pretrig_buf, len - first, sample_width);
+
+	if (cur_len > devc->pretrig_size) {
+		cur_buf += cur_len - devc->pretrig_size;
+		cur_len = devc->pretrig_size;
+	}
+	send_logic(devc, cur_buf, cur_len, sample_width);
+
+	devc->pretrig_fill = 0;
+}
+
+static unsigned int to_bytes_per_ms(unsigned int samplerate)
+{
+	return samplerate / 1000;
+}
+
+/*
+ * The longest gap between two completed transfers shows how long the host
+ * leaves the transfer queue unattended. If a gap uses up more than half of
+ * the time the queued transfers cover, or the FX2 returned an empty
+ * transfer, the queue grows: first in the number of transfers, then in
+ * their size. If the gaps stay below a quarter of it for ADAPT_WINDOW_US,
+ * the queue shrinks again by one step, for lower latency and memory use.
+ */
+static void adapt_transfers(struct dev_context *devc, gboolean empty)
+{
+	int64_t now, gap, capacity;
+	unsigned int limit;
+
+	now = g_get_monotonic_time();
+	gap = devc->last_completion ? now - devc->last_completion : 0;
+	devc->last_completion = now;
+	devc->max_gap = MAX(devc->max_gap, gap);
+
+	if (devc->min_transfers == devc->max_transfers)
+		return;
+
+	/* No more transfers than the array has slots for. */
+	limit = MIN(devc->max_transfers, devc->num_transfers);
+
+	capacity = (int64_t)devc->target_transfers * devc->transfer_size
+			* 1000 / MAX(to_bytes_per_ms(devc->cur_samplerate), 1);
+
+	/* Don't react again before the last change could take effect. */
+	if ((empty || gap > capacity / 2)
+	    && now - devc->window_start > capacity / 2) {
+		if (devc->target_transfers < limit)
+			devc->target_transfers = MIN(devc->target_transfers * 2,
+					limit);
+		else if (devc->transfer_size < MAX_TRANSFER_SIZE)
+			devc->transfer_size *= 2;
+		else
+			return;
+		sr_dbg("Growing transfer queue to %u x %zu bytes.",
+		       devc->target_transfers, devc->transfer_size);
+	} else if (now - devc->window_start > ADAPT_WINDOW_US) {
+		if (devc->max_gap < capacity / 4) {
+			if (devc->transfer_size > devc->base_transfer_size)
+				devc->transfer_size /= 2;
+			else if (devc->target_transfers > devc->min_transfers)
+				devc->target_transfers--;
+			sr_spew("Transfer queue at %u x %zu bytes.",
+				devc->target_transfers, devc->transfer_size);
+		}
+	} else {
+		return;
+	}
+
+	devc->window_start = now;
+	devc->max_gap = 0;
+}
+
+/* Queue another transfer just like the given one. */
+static int add_transfer(struct dev_context *devc,
+		const struct libusb_transfer *like)
+{
+	struct libusb_transfer *transfer;
+	unsigned int i;
+	int ret;
+
+	/*
+	 * Find a free slot, so aborting the acquisition can find it. The
+	 * array has room for max_transfers and is never reallocated here,
+	 * as the transfers in it may be completing meanwhile.
+	 */
+	for (i = 0; i < devc->num_transfers && devc->transfers[i]; i++);
+	if (i == devc->num_transfers) {
+		sr_err("%s: no free transfer slot", __func__);
+		return SR_ERR_BUG;
+	}
+
+	/* Every transfer's buffer counts towards the device's memory. */
+	if (sr_dev_mem_charge(devc->cb_data, devc->transfer_size) != SR_OK)
+		return SR_ERR_MALLOC;
+	if (!(transfer = sr_usb_transfer_get(devc->ctx, &devc->idle_transfers,
+			like->dev_handle, devc->transfer_size))) {
+		sr_dev_mem_uncharge(devc->cb_data, devc->transfer_size);
+		return SR_ERR_MALLOC;
+	}
+	libusb_fill_bulk_transfer(transfer, like->dev_handle, like->endpoint,
+			transfer->buffer, devc->transfer_size, like->callback,
+			devc, fx2lafw_get_timeout(devc));
+	if ((ret = libusb_submit_transfer(transfer)) != 0) {
+		sr_err("Failed to submit transfer: %s.", libusb_error_name(ret));
+		sr_usb_transfer_put(&devc->idle_transfers, transfer);
+		sr_dev_mem_uncharge(devc->cb_data, devc->transfer_size);
+		return SR_ERR;
+	}
+	devc->transfers[i] = transfer;
+	devc->submitted_transfers++;
+
+	return SR_OK;
+}
+
 static void resubmit_transfer(struct libusb_transfer *transfer)
 {
+	struct dev_context *devc;
+	uint8_t *buf;
 	int ret;
 
-	if ((ret = libusb_submit_transfer(transfer)) == LIBUSB_SUCCESS)
+	devc = transfer->user_data;
+
+	/* Retire transfers until the queue is down to its target size. */
+	if ((unsigned int)devc->submitted_transfers > devc->target_transfers) {
+		free_transfer(transfer);
 		return;
+	}
 
-	free_transfer(transfer);
-	/* TODO: Stop session? */
+	/* Within the memory limit, or the transfer keeps its size. */
+	if ((size_t)transfer->length != devc->transfer_size
+	    && sr_dev_mem_charge(devc->cb_data, devc->transfer_size) == SR_OK) {
+		if ((buf = sr_usb_dev_buffer_alloc(devc->ctx,
+				transfer->dev_handle, devc->transfer_size))) {
+			sr_usb_buffer_free(devc->ctx, transfer->buffer,
+					transfer->length);
+			sr_dev_mem_uncharge(devc->cb_data, transfer->length);
+			transfer->buffer = buf;
+			transfer->length = devc->transfer_size;
+		} else {
+			sr_dev_mem_uncharge(devc->cb_data,
+					devc->transfer_size);
+		}
+	}
+	transfer->timeout = fx2lafw_get_timeout(devc);
+
+	SR_TRACE2(fx2lafw_transfer_resubmit, transfer, transfer->length);
+	if ((ret = libusb_submit_transfer(transfer)) != LIBUSB_SUCCESS) {
+		free_transfer(transfer);
+		/* TODO: Stop session? */
+		sr_err("%s: %s", __func__, libusb_error_name(ret));
+		return;
+	}
 
-	sr_err("%s: %s", __func__, libusb_error_name(ret));
+	while ((unsigned int)devc->submitted_transfers < devc->target_transfers) {
+		if (add_transfer(devc, transfer) != SR_OK) {
+			/* Make do with what we have. */
+			devc->target_transfers = devc->submitted_transfers;
+			break;
+		}
+	}
 }
 
 SR_PRIV void fx2lafw_receive_transfer(struct libusb_transfer *transfer)
@@ -432,9 +796,14 @@ SR_PRIV void fx2lafw_receive_transfer(struct libusb_transfer *transfer)
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_logic logic;
 	struct dev_context *devc;
-	int trigger_offset, i, sample_width, cur_sample_count;
-	int trigger_offset_bytes;
+	struct sr_session *session;
+	struct sr_stage_timer timer;
+	struct sr_buffer *buf;
+	int trigger_offset, sample_width, cur_sample_count;
+	int trigger_offset_bytes, pre_samples, num_stages, cur_length;
+	int64_t match;
 	uint8_t *cur_buf;
+	size_t cur_size;
 
 	devc = transfer->user_data;
 
@@ -447,11 +816,11 @@ SR_PRIV void fx2lafw_receive_transfer(struct libusb_transfer *transfer)
 		return;
 	}
 
-	sr_info("receive_transfer(): status %d received %d bytes.",
+	sr_spew("receive_transfer(): status %d received %d bytes.",
 		transfer->status, transfer->actual_length);
+	SR_TRACE3(fx2lafw_transfer_done, transfer, transfer->status,
+			transfer->actual_length);
 
-	/* Save incoming transfer before reusing the transfer struct. */
-	cur_buf = transfer->buffer;
 	sample_width = devc->sample_wide ? 2 : 1;
 	cur_sample_count = transfer->actual_length / sample_width;
 
@@ -468,7 +837,10 @@ SR_PRIV void fx2lafw_receive_transfer(struct libusb_transfer *transfer)
 		break;
 	}
 
+	adapt_transfers(devc, transfer->actual_length == 0 || packet_has_error);
+
 	if (transfer->actual_length == 0 || packet_has_error) {
+		sr_session_dev_stats_add(devc->cb_data, 0, 1);
 		devc->empty_transfer_count++;
 		if (devc->empty_transfer_count > MAX_EMPTY_TRANSFERS) {
 			/*
@@ -485,61 +857,77 @@ SR_PRIV void fx2lafw_receive_transfer(struct libusb_transfer *transfer)
 		devc->empty_transfer_count = 0;
 	}
 
+	/*
+	 * Queue the transfer again right away with the spare buffer, so the
+	 * host controller doesn't run a transfer short while this one's data
+	 * is processed. Until that's done, the acquisition can't finish.
+	 */
+	cur_buf = transfer->buffer;
+	cur_size = transfer->length;
+	cur_length = transfer->actual_length;
+	if (!devc->spare_buf || devc->spare_size != cur_size) {
+		sr_usb_buffer_free(devc->ctx, devc->spare_buf,
+				devc->spare_size);
+		devc->spare_buf = sr_usb_dev_buffer_alloc(devc->ctx,
+				transfer->dev_handle, cur_size);
+	}
+	if (!(transfer->buffer = devc->spare_buf)) {
+		sr_err("USB transfer buffer malloc failed.");
+		transfer->buffer = cur_buf;
+		fx2lafw_abort_acquisition(devc);
+		free_transfer(transfer);
+		return;
+	}
+	devc->spare_buf = NULL;
+	devc->processing = TRUE;
+	resubmit_transfer(transfer);
+
+	/* From here on, the samples are the ones that go out. */
+	session = ((struct sr_dev_inst *)devc->cb_data)->session;
+	if (devc->pack) {
+		sr_stage_begin(session, &timer);
+		pack_samples(devc, cur_buf, cur_sample_count);
+		cur_length = cur_sample_count * devc->unitsize;
+		sr_stage_end(session, &timer, "convert", "fx2lafw",
+			     cur_sample_count);
+	}
+	sample_width = devc->unitsize;
+
 	trigger_offset = 0;
 	if (devc->trigger_stage >= 0) {
-		for (i = 0; i < cur_sample_count; i++) {
-
-			const uint16_t cur_sample = devc->sample_wide ?
-				*((const uint16_t*)cur_buf + i) :
-				*((const uint8_t*)cur_buf + i);
-
-			if ((cur_sample & devc->trigger_mask[devc->trigger_stage]) ==
-				devc->trigger_value[devc->trigger_stage]) {
-				/* Match on this trigger stage. */
-				devc->trigger_buffer[devc->trigger_stage] = cur_sample;
-				devc->trigger_stage++;
-
-				if (devc->trigger_stage == NUM_TRIGGER_STAGES ||
-					devc->trigger_mask[devc->trigger_stage] == 0) {
-					/* Match on all trigger stages, we're done. */
-					trigger_offset = i + 1;
-
-					/*
-					 * TODO: Send pre-trigger buffer to session bus.
-					 * Tell the frontend we hit the trigger here.
-					 */
-					packet.type = SR_DF_TRIGGER;
-					packet.payload = NULL;
-					sr_session_send(devc->cb_data, &packet);
-
-					/*
-					 * Send the samples that triggered it,
-					 * since we're skipping past them.
-					 */
-					packet.type = SR_DF_LOGIC;
-					packet.payload = &logic;
-					logic.unitsize = sizeof(*devc->trigger_buffer);
-					logic.length = devc->trigger_stage * logic.unitsize;
-					logic.data = devc->trigger_buffer;
-					sr_session_send(devc->cb_data, &packet);
-
-					devc->trigger_stage = TRIGGER_FIRED;
-					break;
-				}
-			} else if (devc->trigger_stage > 0) {
-				/*
-				 * We had a match before, but not in the next sample. However, we may
-				 * have a match on this stage in the next bit -- trigger on 0001 will
-				 * fail on seeing 00001, so we need to go back to stage 0 -- but at
-				 * the next sample from the one that matched originally, which the
-				 * counter increment at the end of the loop takes care of.
-				 */
-				i -= devc->trigger_stage;
-				if (i < -1)
-					i = -1; /* Oops, went back past this buffer. */
-				/* Reset trigger stage. */
-				devc->trigger_stage = 0;
-			}
+		sr_stage_begin(session, &timer);
+		match = sr_soft_trigger_scan(devc->stl, cur_buf, cur_sample_count);
+		sr_stage_end(session, &timer, "trigger", "fx2lafw",
+			     cur_sample_count);
+		if (match >= 0) {
+			/* Match on all trigger stages, we're done. */
+			trigger_offset = match;
+			num_stages = devc->stl->num_stages;
+
+			/*
+			 * Send the samples before the match, and
+			 * tell the frontend we hit the trigger here.
+			 */
+			pre_samples = MAX(trigger_offset - num_stages, 0);
+			pretrigger_send(devc, cur_buf, pre_samples * sample_width,
+				(num_stages - (trigger_offset - pre_samples))
+					* sample_width, sample_width);
+			packet.type = SR_DF_TRIGGER;
+			packet.payload = NULL;
+			sr_session_send(devc->cb_data, &packet);
+
+			/*
+			 * Send the samples that triggered it,
+			 * since we're skipping past them.
+			 */
+			packet.type = SR_DF_LOGIC;
+			packet.payload = &logic;
+			logic.unitsize = sample_width;
+			logic.length = num_stages * logic.unitsize;
+			logic.data = devc->stl->matched;
+			sr_session_send(devc->cb_data, &packet);
+
+			devc->trigger_stage = TRIGGER_FIRED;
 		}
 	}
 
@@ -548,31 +936,36 @@ SR_PRIV void fx2lafw_receive_transfer(struct libusb_transfer *transfer)
 		trigger_offset_bytes = trigger_offset * sample_width;
 		packet.type = SR_DF_LOGIC;
 		packet.payload = &logic;
-		logic.length = transfer->actual_length - trigger_offset_bytes;
+		logic.length = cur_length - trigger_offset_bytes;
 		logic.unitsize = sample_width;
 		logic.data = cur_buf + trigger_offset_bytes;
-		sr_session_send(devc->cb_data, &packet);
+		/* Locked buffers and device memory stay here, consumers
+		 * get a copy. */
+		if (!devc->ctx->usb_buffer_lock
+		    && !sr_usb_buffer_is_dev_mem(cur_buf)
+		    && (buf = sr_buffer_new_wrap(cur_buf, cur_size, g_free))) {
+			sr_session_send_buffer(devc->cb_data, &packet, buf);
+			/* No spare if a consumer kept this one. */
+			cur_buf = sr_buffer_steal(buf);
+		} else {
+			sr_session_send(devc->cb_data, &packet);
+		}
 
 		devc->num_samples += cur_sample_count;
 		if (devc->limit_samples &&
-			(unsigned int)devc->num_samples > devc->limit_samples) {
+			(unsigned int)devc->num_samples >= devc->limit_samples)
 			fx2lafw_abort_acquisition(devc);
-			free_transfer(transfer);
-			return;
-		}
 	} else {
-		/*
-		 * TODO: Buffer pre-trigger data in capture
-		 * ratio-sized buffer.
-		 */
+		/* Still waiting, keep the data in case it's pre-trigger. */
+		pretrigger_append(devc, cur_buf, cur_length);
 	}
 
-	resubmit_transfer(transfer);
-}
-
-static unsigned int to_bytes_per_ms(unsigned int samplerate)
-{
-	return samplerate / 1000;
+	/* The buffer is the next transfer's. */
+	devc->spare_buf = cur_buf;
+	devc->spare_size = cur_size;
+	devc->processing = FALSE;
+	if (devc->submitted_transfers == 0)
+		finish_acquisition(devc);
 }
 
 SR_PRIV size_t fx2lafw_get_buffer_size(struct dev_context *devc)
@@ -580,10 +973,12 @@ SR_PRIV size_t fx2lafw_get_buffer_size(struct dev_context *devc)
 	size_t s;
 
 	/*
-	 * The buffer should be large enough to hold 10ms of data and
-	 * a multiple of 512.
+	 * The buffer should be large enough to hold 10ms of data (or what
+	 * the session's profile makes of that) and a multiple of 512.
 	 */
-	s = 10 * to_bytes_per_ms(devc->cur_samplerate);
+	s = sr_session_buffer_ms(devc->cb_data, 10)
+		* to_bytes_per_ms(devc->cur_samplerate);
+	s = MIN(s, MAX_TRANSFER_SIZE);
 	return (s + 511) & ~511;
 }
 
@@ -592,13 +987,14 @@ SR_PRIV unsigned int fx2lafw_get_number_of_transfers(struct dev_context *devc)
 	unsigned int n;
 
 	/* Total buffer size should be able to hold about 500ms of data. */
-	n = (500 * to_bytes_per_ms(devc->cur_samplerate) /
-		fx2lafw_get_buffer_size(devc));
+	n = (sr_session_queue_ms(devc->cb_data, 500)
+		* to_bytes_per_ms(devc->cur_samplerate)
+		/ fx2lafw_get_buffer_size(devc));
 
-	if (n > NUM_SIMUL_TRANSFERS)
-		return NUM_SIMUL_TRANSFERS;
+	/* Start from there, the queue adapts to the host later on. */
+	n = MIN(n, NUM_SIMUL_TRANSFERS);
 
-	return n;
+	return MIN(MAX(n, devc->min_transfers), devc->max_transfers);
 }
 
 SR_PRIV unsigned int fx2lafw_get_timeout(struct dev_context *devc)
@@ -606,8 +1002,7 @@ SR_PRIV unsigned int fx2lafw_get_timeout(struct dev_context *devc)
 	size_t total_size;
 	unsigned int timeout;
 
-	total_size = fx2lafw_get_buffer_size(devc) *
-			fx2lafw_get_number_of_transfers(devc);
+	total_size = devc->transfer_size * devc->target_transfers;
 	timeout = total_size / to_bytes_per_ms(devc->cur_samplerate);
 	return timeout + timeout / 4; /* Leave a headroom of 25% percent. */
 }
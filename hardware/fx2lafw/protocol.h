@@ -32,11 +32,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "fx2lafw: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define USB_INTERFACE		0
 #define USB_CONFIGURATION	1
@@ -47,6 +47,14 @@
 #define NUM_SIMUL_TRANSFERS	32
 #define MAX_EMPTY_TRANSFERS	(NUM_SIMUL_TRANSFERS * 2)
 
+/* Bounds for the adaptive transfer queue. */
+#define MIN_SIMUL_TRANSFERS	2
+#define MAX_SIMUL_TRANSFERS	256
+#define MAX_TRANSFER_SIZE	(4 * 1024 * 1024)
+
+/* How long the queue must be idle before it shrinks by one step. */
+#define ADAPT_WINDOW_US		(2 * 1000 * 1000)
+
 #define FX2LAFW_REQUIRED_VERSION_MAJOR	1
 
 #define MAX_8BIT_SAMPLE_RATE	SR_MHZ(24)
@@ -55,9 +63,12 @@
 /* 6 delay states of up to 256 clock ticks */
 #define MAX_SAMPLE_DELAY	(6 * 256)
 
-/* Software trigger implementation: positive values indicate trigger stage. */
+/* Software trigger state: 0 while waiting for the trigger. */
 #define TRIGGER_FIRED          -1
 
+/* Upper limit for the pre-trigger buffer, in bytes. */
+#define MAX_PRETRIGGER_SIZE	(64 * 1024 * 1024)
+
 #define DEV_CAPS_16BIT_POS	0
 
 #define DEV_CAPS_16BIT		(1 << DEV_CAPS_16BIT_POS)
@@ -88,22 +99,70 @@ struct dev_context {
 	/* Device/capture settings */
 	uint64_t cur_samplerate;
 	uint64_t limit_samples;
+	uint64_t capture_ratio;
 
 	/* Operational settings */
 	gboolean sample_wide;
-	uint16_t trigger_mask[NUM_TRIGGER_STAGES];
-	uint16_t trigger_value[NUM_TRIGGER_STAGES];
+	/*
+	 * With probe packing, the enabled probes, the width of the samples
+	 * they are packed into, and where each byte of a sample from the
+	 * FX2 puts its probes in those. packed_probes is 0 without packing,
+	 * pack is FALSE if the samples already are packed as they come.
+	 */
+	gboolean probe_packing;
+	uint64_t packed_probes;
+	int unitsize;
+	gboolean pack;
+	uint16_t pack_lut[2][256];
+	uint64_t trigger_mask[NUM_TRIGGER_STAGES];
+	uint64_t trigger_value[NUM_TRIGGER_STAGES];
 	int trigger_stage;
-	uint16_t trigger_buffer[NUM_TRIGGER_STAGES];
+	struct sr_soft_trigger *stl;
+
+	/*
+	 * Circular buffer holding the most recent samples while waiting for
+	 * the trigger, sized by the capture ratio. All sizes are in bytes.
+	 */
+	uint8_t *pretrig_buf;
+	size_t pretrig_size;
+	size_t pretrig_pos;
+	size_t pretrig_fill;
 
 	int num_samples;
 	int submitted_transfers;
 	int empty_transfer_count;
 
+	/*
+	 * The buffer a completed transfer is resubmitted with, while its
+	 * own one is processed. Meanwhile, processing is set.
+	 */
+	uint8_t *spare_buf;
+	size_t spare_size;
+	gboolean processing;
+
+	/*
+	 * Adaptive transfer queue: the number of transfers is kept within
+	 * min/max_transfers, their size between base_transfer_size and
+	 * MAX_TRANSFER_SIZE.
+	 */
+	unsigned int min_transfers;
+	unsigned int max_transfers;
+	unsigned int target_transfers;
+	size_t base_transfer_size;
+	size_t transfer_size;
+	int64_t last_completion;
+	int64_t window_start;
+	int64_t max_gap;
+
 	void *cb_data;
+	struct sr_context *ctx;
 	unsigned int num_transfers;
 	struct libusb_transfer **transfers;
-	int *usbfd;
+	/*
+	 * Transfers of earlier acquisitions, with their buffers, for the
+	 * next one to reuse. See sr_usb_transfer_get().
+	 */
+	GSList *idle_transfers;
 };
 
 SR_PRIV int fx2lafw_command_start_acquisition(libusb_device_handle *devhdl,
@@ -111,7 +170,9 @@ SR_PRIV int fx2lafw_command_start_acquisition(libusb_device_handle *devhdl,
 SR_PRIV gboolean fx2lafw_check_conf_profile(libusb_device *dev);
 SR_PRIV int fx2lafw_dev_open(struct sr_dev_inst *sdi, struct sr_dev_driver *di);
 SR_PRIV int fx2lafw_configure_probes(const struct sr_dev_inst *sdi);
+SR_PRIV uint64_t fx2lafw_max_samplerate(const struct sr_dev_inst *sdi);
 SR_PRIV struct dev_context *fx2lafw_dev_new(void);
+SR_PRIV int fx2lafw_pretrigger_init(struct dev_context *devc);
 SR_PRIV void fx2lafw_abort_acquisition(struct dev_context *devc);
 SR_PRIV void fx2lafw_receive_transfer(struct libusb_transfer *transfer);
 SR_PRIV size_t fx2lafw_get_buffer_size(struct dev_context *devc);
@@ -766,13 +766,74 @@ static void process_msg_inf_13(struct sr_dev_inst *sdi)
 }
 
 
+/* Add a received byte to the message buffer, and handle the message. */
+static void handle_byte(struct sr_dev_inst *sdi, unsigned char buf)
+{
+	struct dev_context *devc;
+	unsigned char msgt;
+
+	devc = sdi->priv;
+
+	sr_spew("read 0x%02x/%d/%d", buf, buf, buf & MSGC_MASK);
+	if (devc->buflen >= GMC_BUFSIZE - 1) {
+		sr_err("Message buffer overflow, discarding %d bytes.",
+		       devc->buflen);
+		devc->buflen = 0;
+	}
+	devc->buf[devc->buflen++] = buf;
+	if (!devc->settings_ok) {
+		/* If no device type/settings record processed
+		 * yet, wait for one. */
+		if ((devc->buf[0] & MSGID_MASK) != MSGID_INF) {
+			devc->buflen = 0;
+			return;
+		}
+		devc->settings_ok = TRUE;
+	}
+
+	msgt = devc->buf[0] & MSGID_MASK;
+	switch (msgt) {
+	case MSGID_INF:
+		if (devc->buflen == 13) {
+			process_msg_inf_13(sdi);
+			devc->buflen = 0;
+		}
+		else if ((devc->buflen == 10) &&
+			 (devc->model <= SR_METRAHIT_18S)) {
+			process_msg_inf_10(sdi);
+			devc->buflen = 0;
+		}
+		else if ((devc->buflen >= 5) &&
+			(devc->buf[devc->buflen-1] &
+			MSGID_MASK) != MSGID_DATA) {
+			/* Char just received is beginning
+			 * of next message */
+			process_msg_inf_5(sdi);
+			devc->buf[0] = devc->buf[devc->buflen-1];
+			devc->buflen = 1;
+		}
+		break;
+	case MSGID_DTA:
+	case MSGID_D10:
+		if (devc->buflen == 6) {
+			process_msg_dta_6(sdi);
+			devc->buflen = 0;
+		}
+		break;
+	case MSGID_DATA:
+		sr_err("Comm error, unexpected data byte!");
+		devc->buflen = 0;
+		break;
+	}
+}
+
 SR_PRIV int gmc_mh_1x_2x_receive_data(int fd, int revents, void *cb_data)
 {
 	struct sr_dev_inst *sdi;
 	struct dev_context *devc;
 	struct sr_serial_dev_inst *serial;
-	unsigned char buf, msgt;
-	int len;
+	unsigned char rbuf[GMC_BUFSIZE];
+	int i, len;
 
 	(void)fd;
 
@@ -785,60 +846,10 @@ SR_PRIV int gmc_mh_1x_2x_receive_data(int fd, int revents, void *cb_data)
 	serial = sdi->conn;
 
 	if (revents == G_IO_IN) { /* Serial data arrived. */
-		while (GMC_BUFSIZE - devc->buflen - 1 > 0) {
-			len = serial_read(serial, devc->buf + devc->buflen, 1);
-			if (len < 1)
-				break;
-			buf = *(devc->buf + devc->buflen);
-			sr_spew("read 0x%02x/%d/%d", buf, buf, buf & MSGC_MASK);
-			devc->buflen += len;
-			if (!devc->settings_ok) {
-				/* If no device type/settings record processed
-				 * yet, wait for one. */
-				if ((devc->buf[0] & MSGID_MASK) != MSGID_INF) {
-					devc->buflen = 0;
-					continue;
-				}
-				devc->settings_ok = TRUE;
-			}
-
-			msgt = devc->buf[0] & MSGID_MASK;
-			switch (msgt) {
-			case MSGID_INF:
-				if (devc->buflen == 13) {
-					process_msg_inf_13(sdi);
-					devc->buflen = 0;
-					continue;
-				}
-				else if ((devc->buflen == 10) &&
-					 (devc->model <= SR_METRAHIT_18S)) {
-					process_msg_inf_10(sdi);
-					devc->buflen = 0;
-					continue;
-				}
-				else if ((devc->buflen >= 5) &&
-					(devc->buf[devc->buflen-1] &
-					MSGID_MASK) != MSGID_DATA) {
-					/* Char just received is beginning
-					 * of next message */
-					process_msg_inf_5(sdi);
-					devc->buf[0] =devc->buf[devc->buflen-1];
-					devc->buflen = 1;
-					continue;
-				}
-				break;
-			case MSGID_DTA:
-			case MSGID_D10:
-				if (devc->buflen == 6) {
-					process_msg_dta_6(sdi);
-					devc->buflen = 0;
-				}
-				break;
-			case MSGID_DATA:
-				sr_err("Comm error, unexpected data byte!");
-				devc->buflen = 0;
-				break;
-			}
+		/* Take all bytes the port has, and feed them in one by one. */
+		while ((len = serial_read(serial, rbuf, sizeof(rbuf))) > 0) {
+			for (i = 0; i < len; i++)
+				handle_byte(sdi, rbuf[i]);
 		}
 	}
 
@@ -240,6 +240,7 @@ static void clear_dev_context(void *priv)
 
 	devc = priv;
 	g_free(devc->triggersource);
+	g_free(devc->serial);
 	g_slist_free(devc->enabled_probes);
 
 }
@@ -251,6 +252,11 @@ static int dev_clear(void)
 
 static int init(struct sr_context *sr_ctx)
 {
+	int ret;
+
+	if ((ret = sr_usb_init(sr_ctx)) != SR_OK)
+		return ret;
+
 	return std_init(sr_ctx, di, LOG_PREFIX);
 }
 
@@ -282,12 +288,12 @@ static GSList *scan(GSList *options)
 		}
 	}
 	if (conn)
-		conn_devices = sr_usb_find(drvc->sr_ctx->libusb_ctx, conn);
+		conn_devices = sr_usb_find(drvc->sr_ctx, conn);
 	else
 		conn_devices = NULL;
 
 	/* Find all Hantek DSO devices and upload firmware to all of them. */
-	libusb_get_device_list(drvc->sr_ctx->libusb_ctx, &devlist);
+	sr_usb_get_device_list(drvc->sr_ctx, &devlist);
 	for (i = 0; devlist[i]; i++) {
 		if (conn) {
 			usb = NULL;
@@ -379,8 +385,13 @@ static int dev_open(struct sr_dev_inst *sdi)
 	err = SR_ERR;
 	if (devc->fw_updated > 0) {
 		sr_info("Waiting for device to reset.");
-		/* Takes >= 300ms for the FX2 to be gone from the USB bus. */
-		g_usleep(300 * 1000);
+		/*
+		 * Takes >= 300ms for the FX2 to be gone from the USB bus,
+		 * counting from the upload.
+		 */
+		timediff_us = g_get_monotonic_time() - devc->fw_updated;
+		if (timediff_us < 300 * 1000)
+			g_usleep(300 * 1000 - timediff_us);
 		timediff_ms = 0;
 		while (timediff_ms < MAX_RENUM_DELAY_MS) {
 			if ((err = dso_open(sdi)) == SR_OK)
@@ -391,6 +402,9 @@ static int dev_open(struct sr_dev_inst *sdi)
 			sr_spew("Waited %" PRIi64 " ms.", timediff_ms);
 		}
 		sr_info("Device came back after %d ms.", timediff_ms);
+		/* It runs the firmware now, later opens needn't wait. */
+		if (err == SR_OK)
+			devc->fw_updated = 0;
 	} else {
 		err = dso_open(sdi);
 	}
@@ -419,12 +433,15 @@ static int dev_close(struct sr_dev_inst *sdi)
 
 static int cleanup(void)
 {
+	dso_offsets_cache_clear();
+
 	return dev_clear();
 }
 
 static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 		const struct sr_probe_group *probe_group)
 {
+	struct dev_context *devc;
 	struct sr_usb_dev_inst *usb;
 	char str[128];
 
@@ -448,6 +465,11 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 	case SR_CONF_NUM_VDIV:
 		*data = g_variant_new_int32(NUM_VDIV);
 		break;
+	case SR_CONF_BUFFERSIZE:
+		if (!sdi || !(devc = sdi->priv))
+			return SR_ERR_ARG;
+		*data = g_variant_new_uint64(devc->framesize);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -649,56 +671,129 @@ static int config_list(int key, GVariant **data, const struct sr_dev_inst *sdi,
 	return SR_OK;
 }
 
-static void send_chunk(struct sr_dev_inst *sdi, unsigned char *buf,
-		int num_samples)
+/* Part of a frame, straight from a transfer's buffer. */
+struct chunk {
+	const unsigned char *buf;
+	int num_samples;
+};
+
+/* Send the samples of these chunks, in this order, as one packet. */
+static void send_chunks(struct sr_dev_inst *sdi, const struct chunk *chunks,
+		int num_chunks)
 {
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_analog analog;
+	struct sr_datafeed_analog_raw analog;
 	struct dev_context *devc;
-	float ch1, ch2, range;
-	int num_probes, data_offset, i;
+	struct sr_buffer *fbuf;
+	float range, scale[2], offset[2];
+	const unsigned char *buf;
+	uint8_t *out;
+	int num_probes, num_samples, c, i;
+
+	num_samples = 0;
+	for (c = 0; c < num_chunks; c++)
+		num_samples += chunks[c].num_samples;
+	if (!num_samples)
+		return;
 
 	devc = sdi->priv;
 	num_probes = (devc->ch1_enabled && devc->ch2_enabled) ? 2 : 1;
-	packet.type = SR_DF_ANALOG;
+	fbuf = sr_buffer_pool_acquire(num_samples * num_probes);
+	if (!fbuf) {
+		sr_err("Analog buffer malloc failed.");
+		return;
+	}
+	packet.type = SR_DF_ANALOG_RAW;
 	packet.payload = &analog;
 	/* TODO: support for 5xxx series 9-bit samples */
 	analog.probes = devc->enabled_probes;
 	analog.num_samples = num_samples;
 	analog.mq = SR_MQ_VOLTAGE;
 	analog.unit = SR_UNIT_VOLT;
-	/* TODO: Check malloc return value. */
-	analog.data = g_try_malloc(analog.num_samples * sizeof(float) * num_probes);
-	data_offset = 0;
-	for (i = 0; i < analog.num_samples; i++) {
-		/*
-		 * The device always sends data for both channels. If a channel
-		 * is disabled, it contains a copy of the enabled channel's
-		 * data. However, we only send the requested channels to
-		 * the bus.
-		 *
-		 * Voltage values are encoded as a value 0-255 (0-512 on the
-		 * DSO-5200*), where the value is a point in the range
-		 * represented by the vdiv setting. There are 8 vertical divs,
-		 * so e.g. 500mV/div represents 4V peak-to-peak where 0 = -2V
-		 * and 255 = +2V.
-		 */
-		/* TODO: Support for DSO-5xxx series 9-bit samples. */
-		if (devc->ch1_enabled) {
-			range = ((float)vdivs[devc->voltage_ch1][0] / vdivs[devc->voltage_ch1][1]) * 8;
-			ch1 = range / 255 * *(buf + i * 2 + 1);
-			/* Value is centered around 0V. */
-			ch1 -= range / 2;
-			analog.data[data_offset++] = ch1;
-		}
-		if (devc->ch2_enabled) {
-			range = ((float)vdivs[devc->voltage_ch2][0] / vdivs[devc->voltage_ch2][1]) * 8;
-			ch2 = range / 255 * *(buf + i * 2);
-			ch2 -= range / 2;
-			analog.data[data_offset++] = ch2;
+	analog.mqflags = 0;
+	analog.encoding = SR_ANALOG_U8;
+	analog.scale = scale;
+	analog.offset = offset;
+	analog.data = fbuf->data;
+	/*
+	 * Voltage values are encoded as a value 0-255 (0-512 on the
+	 * DSO-5200*), where the value is a point in the range
+	 * represented by the vdiv setting. There are 8 vertical divs,
+	 * so e.g. 500mV/div represents 4V peak-to-peak where 0 = -2V
+	 * and 255 = +2V. The value is centered around 0V.
+	 */
+	/* TODO: Support for DSO-5xxx series 9-bit samples. */
+	i = 0;
+	if (devc->ch1_enabled) {
+		range = ((float)vdivs[devc->voltage_ch1][0] / vdivs[devc->voltage_ch1][1]) * 8;
+		scale[i] = range / 255;
+		offset[i++] = -range / 2;
+	}
+	if (devc->ch2_enabled) {
+		range = ((float)vdivs[devc->voltage_ch2][0] / vdivs[devc->voltage_ch2][1]) * 8;
+		scale[i] = range / 255;
+		offset[i++] = -range / 2;
+	}
+	/*
+	 * The device always sends data for both channels, interleaved as
+	 * CH2, CH1. If a channel is disabled, it contains a copy of the
+	 * enabled channel's data. However, we only send the requested
+	 * channels to the bus, in the order of the probes.
+	 */
+	out = fbuf->data;
+	for (c = 0; c < num_chunks; c++) {
+		buf = chunks[c].buf;
+		for (i = 0; i < chunks[c].num_samples; i++) {
+			if (devc->ch1_enabled)
+				*out++ = buf[i * 2 + 1];
+			if (devc->ch2_enabled)
+				*out++ = buf[i * 2];
 		}
 	}
-	sr_session_send(devc->cb_data, &packet);
+	sr_session_send_buffer(devc->cb_data, &packet, fbuf);
+	sr_buffer_unref(fbuf);
+}
+
+static void send_chunk(struct sr_dev_inst *sdi, const unsigned char *buf,
+		int num_samples)
+{
+	struct chunk chunk;
+
+	chunk.buf = buf;
+	chunk.num_samples = num_samples;
+	send_chunks(sdi, &chunk, 1);
+}
+
+/*
+ * Send the samples of the frame before the trigger point. They are still
+ * in the buffers of the frame's first transfers, which complete in the
+ * order they were submitted in and aren't submitted again before the next
+ * frame, so they are sent from there.
+ */
+static void send_pretrigger(struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	struct libusb_transfer *transfer;
+	struct chunk *chunks;
+	int left, n, i;
+
+	devc = sdi->priv;
+	if (!devc->samp_buffered)
+		return;
+
+	if (!(chunks = g_try_new(struct chunk, devc->num_transfers))) {
+		sr_err("%s: chunks malloc failed", __func__);
+		return;
+	}
+	left = devc->samp_buffered;
+	for (i = n = 0; i < devc->num_transfers && left; i++) {
+		transfer = devc->transfers[i];
+		chunks[n].buf = transfer->buffer;
+		chunks[n].num_samples = MIN(transfer->actual_length / 2, left);
+		left -= chunks[n++].num_samples;
+	}
+	send_chunks(sdi, chunks, n);
+	g_free(chunks);
 }
 
 /*
@@ -718,6 +813,14 @@ static void receive_transfer(struct libusb_transfer *transfer)
 	devc = sdi->priv;
 	sr_spew("receive_transfer(): status %d received %d bytes.",
 		   transfer->status, transfer->actual_length);
+	SR_TRACE3(hantek_dso_transfer_done, transfer, transfer->status,
+			transfer->actual_length);
+
+	devc->num_busy_transfers--;
+	if (transfer->status == LIBUSB_TRANSFER_CANCELLED
+	    || devc->dev_state != FETCH_DATA)
+		/* The acquisition is winding up. */
+		return;
 
 	if (transfer->actual_length == 0)
 		/* Nothing to send to the bus. */
@@ -741,18 +844,14 @@ static void receive_transfer(struct libusb_transfer *transfer)
 		/* Trigger point not yet reached. */
 		if (devc->samp_received + num_samples < devc->trigger_offset) {
 			/* The entire chunk is before the trigger point. */
-			memcpy(devc->framebuf + devc->samp_buffered * 2,
-					transfer->buffer, num_samples * 2);
 			devc->samp_buffered += num_samples;
 		} else {
 			/*
 			 * This chunk hits or overruns the trigger point.
-			 * Store the part before the trigger fired, and
-			 * send the rest up to the session bus.
+			 * Leave the part before the trigger fired in the
+			 * buffer, and send the rest up to the session bus.
 			 */
 			pre = devc->trigger_offset - devc->samp_received;
-			memcpy(devc->framebuf + devc->samp_buffered * 2,
-					transfer->buffer, pre * 2);
 			devc->samp_buffered += pre;
 
 			/* The rest of this chunk starts with the trigger point. */
@@ -773,17 +872,15 @@ static void receive_transfer(struct libusb_transfer *transfer)
 
 	devc->samp_received += num_samples;
 
-	/* Everything in this transfer was either copied to the buffer or
-	 * sent to the session bus. */
-	g_free(transfer->buffer);
-	libusb_free_transfer(transfer);
+	/* The pre-trigger part of this transfer is sent from its buffer at
+	 * the end of the frame, so it stays untouched until then. */
 
 	if (devc->samp_received >= devc->framesize) {
 		/* That was the last chunk in this frame. Send the buffered
 		 * pre-trigger samples out now, in one big chunk. */
 		sr_dbg("End of frame, sending %d pre-trigger buffered samples.",
 			   devc->samp_buffered);
-		send_chunk(sdi, devc->framebuf, devc->samp_buffered);
+		send_pretrigger(sdi);
 
 		/* Mark the end of this frame. */
 		packet.type = SR_DF_FRAME_END;
@@ -806,7 +903,7 @@ static int handle_event(int fd, int revents, void *cb_data)
 	struct dev_context *devc;
 	struct drv_context *drvc = di->priv;
 	const struct libusb_pollfd **lupfd;
-	int num_probes, i;
+	int i;
 	uint32_t trigger_offset;
 	uint8_t capturestate;
 
@@ -819,9 +916,22 @@ static int handle_event(int fd, int revents, void *cb_data)
 		/* We've been told to wind up the acquisition. */
 		sr_dbg("Stopping acquisition.");
 		/*
-		 * TODO: Doesn't really cancel pending transfers so they might
-		 * come in after SR_DF_END is sent.
+		 * Wait for pending transfers to come back, so they can be
+		 * freed and none of them comes in after SR_DF_END is sent.
+		 * They time out after 40ms anyway.
 		 */
+		dso_transfers_cancel(sdi);
+		tv.tv_sec = 0;
+		tv.tv_usec = 100000;
+		for (i = 0; devc->num_busy_transfers && i < 10; i++)
+			libusb_handle_events_timeout(drvc->sr_ctx->libusb_ctx,
+					&tv);
+		if (devc->num_busy_transfers)
+			sr_err("%d transfers didn't come back, leaking them.",
+			       devc->num_busy_transfers);
+		else
+			dso_transfers_free(sdi);
+
 		lupfd = libusb_get_pollfds(drvc->sr_ctx->libusb_ctx);
 		for (i = 0; lupfd[i]; i++)
 			sr_source_remove(lupfd[i]->fd);
@@ -848,8 +958,8 @@ static int handle_event(int fd, int revents, void *cb_data)
 //		if (dso_force_trigger(sdi) != SR_OK)
 //			return TRUE;
 		sr_dbg("Successfully requested next chunk.");
+		/* Go on to poll the capture state right away. */
 		devc->dev_state = CAPTURE;
-		return TRUE;
 	}
 	if (devc->dev_state != CAPTURE)
 		return TRUE;
@@ -878,10 +988,6 @@ static int handle_event(int fd, int revents, void *cb_data)
 	case CAPTURE_READY_8BIT:
 		/* Remember where in the captured frame the trigger is. */
 		devc->trigger_offset = trigger_offset;
-
-		num_probes = (devc->ch1_enabled && devc->ch2_enabled) ? 2 : 1;
-		/* TODO: Check malloc return value. */
-		devc->framebuf = g_try_malloc(devc->framesize * num_probes * 2);
 		devc->samp_buffered = devc->samp_received = 0;
 
 		/* Tell the scope to send us the first frame. */
@@ -979,6 +1085,7 @@ SR_PRIV struct sr_dev_driver hantek_dso_driver_info = {
 	.config_list = config_list,
 	.dev_open = dev_open,
 	.dev_close = dev_close,
+	.dev_check = std_dev_check_usb,
 	.dev_acquisition_start = dev_acquisition_start,
 	.dev_acquisition_stop = dev_acquisition_stop,
 	.priv = NULL,
@@ -28,6 +28,13 @@
 
 extern struct sr_dev_driver hantek_dso_driver_info;
 
+/*
+ * Channel offsets read from the EEPROM, by the serial number of the
+ * device they came from, so they are read once per device rather than
+ * for every acquisition.
+ */
+static GHashTable *offsets_cache;
+
 static int send_begin(const struct sr_dev_inst *sdi)
 {
 	struct sr_usb_dev_inst *usb;
@@ -113,6 +120,7 @@ SR_PRIV int dso_open(struct sr_dev_inst *sdi)
 	struct sr_usb_dev_inst *usb;
 	struct libusb_device_descriptor des;
 	libusb_device **devlist;
+	unsigned char serial[64];
 	int err, skip, i;
 
 	devc = sdi->priv;
@@ -160,6 +168,14 @@ SR_PRIV int dso_open(struct sr_dev_inst *sdi)
 				 */
 				usb->address = libusb_get_device_address(devlist[i]);
 
+			g_free(devc->serial);
+			devc->serial = NULL;
+			if (des.iSerialNumber
+			    && libusb_get_string_descriptor_ascii(usb->devhdl,
+					des.iSerialNumber, serial,
+					sizeof(serial)) > 0)
+				devc->serial = g_strdup((char *)serial);
+
 			if (!(devc->epin_maxpacketsize = dso_getmps(devlist[i])))
 				sr_err("Wrong endpoint profile.");
 			else {
@@ -207,13 +223,26 @@ static int get_channel_offsets(const struct sr_dev_inst *sdi)
 	struct dev_context *devc;
 	struct sr_usb_dev_inst *usb;
 	GString *gs;
+	gpointer cached;
 	int chan, v, ret;
 
-	sr_dbg("Getting channel offsets.");
-
 	devc = sdi->priv;
 	usb = sdi->conn;
 
+	/* The offsets are calibration data, they don't change. */
+	if (devc->channel_levels_valid)
+		return SR_OK;
+	if (devc->serial && offsets_cache && (cached = g_hash_table_lookup(
+			offsets_cache, devc->serial))) {
+		sr_dbg("Using cached channel offsets.");
+		memcpy(devc->channel_levels, cached,
+				sizeof(devc->channel_levels));
+		devc->channel_levels_valid = TRUE;
+		return SR_OK;
+	}
+
+	sr_dbg("Getting channel offsets.");
+
 	ret = libusb_control_transfer(usb->devhdl,
 			LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR,
 			CTRL_READ_EEPROM, EEPROM_CHANNEL_OFFSETS, 0,
@@ -253,9 +282,29 @@ static int get_channel_offsets(const struct sr_dev_inst *sdi)
 		g_string_free(gs, TRUE);
 	}
 
+	devc->channel_levels_valid = TRUE;
+	if (!devc->serial)
+		return SR_OK;
+	if (!offsets_cache)
+		offsets_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, g_free);
+	if ((cached = g_try_malloc(sizeof(devc->channel_levels)))) {
+		memcpy(cached, devc->channel_levels,
+				sizeof(devc->channel_levels));
+		g_hash_table_insert(offsets_cache, g_strdup(devc->serial),
+				cached);
+	}
+
 	return SR_OK;
 }
 
+SR_PRIV void dso_offsets_cache_clear(void)
+{
+	if (offsets_cache)
+		g_hash_table_destroy(offsets_cache);
+	offsets_cache = NULL;
+}
+
 SR_PRIV int dso_set_trigger_samplerate(const struct sr_dev_inst *sdi)
 {
 	struct dev_context *devc;
@@ -737,20 +786,89 @@ SR_PRIV int dso_capture_start(const struct sr_dev_inst *sdi)
 	return SR_OK;
 }
 
-SR_PRIV int dso_get_channeldata(const struct sr_dev_inst *sdi,
-		libusb_transfer_cb_fn cb)
+static int transfers_alloc(const struct sr_dev_inst *sdi, int num_transfers,
+		int size, libusb_transfer_cb_fn cb)
 {
+	struct drv_context *drvc;
 	struct dev_context *devc;
 	struct sr_usb_dev_inst *usb;
 	struct libusb_transfer *transfer;
-	int num_transfers, ret, i;
-	uint8_t cmdstring[2];
 	unsigned char *buf;
+	int i;
+
+	drvc = sdi->driver->priv;
+	devc = sdi->priv;
+	usb = sdi->conn;
+
+	devc->transfers = g_try_malloc0(num_transfers
+			* sizeof(struct libusb_transfer *));
+	if (!devc->transfers) {
+		sr_err("%s: transfers malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	for (i = 0; i < num_transfers; i++) {
+		if (!(buf = sr_usb_dev_buffer_alloc(drvc->sr_ctx, usb->devhdl,
+				size))) {
+			sr_err("Failed to malloc USB endpoint buffer.");
+			dso_transfers_free(sdi);
+			return SR_ERR_MALLOC;
+		}
+		if (!(transfer = libusb_alloc_transfer(0))) {
+			sr_err("Failed to allocate transfer.");
+			sr_usb_buffer_free(drvc->sr_ctx, buf, size);
+			dso_transfers_free(sdi);
+			return SR_ERR_MALLOC;
+		}
+		libusb_fill_bulk_transfer(transfer, usb->devhdl, DSO_EP_IN, buf,
+				size, cb, (void *)sdi, 40);
+		devc->transfers[i] = transfer;
+		devc->num_transfers = i + 1;
+	}
+
+	return SR_OK;
+}
+
+SR_PRIV int dso_get_channeldata(const struct sr_dev_inst *sdi,
+		libusb_transfer_cb_fn cb)
+{
+	struct dev_context *devc;
+	int num_transfers, frame_bytes, packets, size, ret, i;
+	uint8_t cmdstring[2];
 
 	sr_dbg("Sending CMD_GET_CHANNELDATA.");
 
 	devc = sdi->priv;
-	usb = sdi->conn;
+
+	if (devc->num_busy_transfers) {
+		sr_err("Transfers of the previous frame are still pending.");
+		return SR_ERR;
+	}
+
+	/*
+	 * The frame size can't change during an acquisition, so the
+	 * transfers are set up once and submitted again for every frame.
+	 */
+	if (!devc->transfers) {
+		/* TODO: DSO-2xxx only. */
+		frame_bytes = devc->framesize * sizeof(unsigned short);
+		/*
+		 * A packet per transfer gets every bit of the frame out right
+		 * away. For throughput, transfers take several packets, as
+		 * many as divide the frame: a transfer the frame's end leaves
+		 * short would only complete when it times out.
+		 */
+		packets = 1;
+		if (sr_session_dev_profile(sdi) == SR_PROFILE_THROUGHPUT)
+			packets = MAX_PACKETS_PER_TRANSFER;
+		while (packets > 1
+		       && frame_bytes % (packets * devc->epin_maxpacketsize))
+			packets /= 2;
+		size = packets * devc->epin_maxpacketsize;
+		num_transfers = frame_bytes / size;
+		ret = transfers_alloc(sdi, num_transfers, size, cb);
+		if (ret != SR_OK)
+			return ret;
+	}
 
 	cmdstring[0] = CMD_GET_CHANNELDATA;
 	cmdstring[1] = 0;
@@ -761,27 +879,46 @@ SR_PRIV int dso_get_channeldata(const struct sr_dev_inst *sdi,
 		return SR_ERR;
 	}
 
-	/* TODO: DSO-2xxx only. */
-	num_transfers = devc->framesize *
-			sizeof(unsigned short) / devc->epin_maxpacketsize;
-	sr_dbg("Queueing up %d transfers.", num_transfers);
-	for (i = 0; i < num_transfers; i++) {
-		if (!(buf = g_try_malloc(devc->epin_maxpacketsize))) {
-			sr_err("Failed to malloc USB endpoint buffer.");
-			return SR_ERR_MALLOC;
-		}
-		transfer = libusb_alloc_transfer(0);
-		libusb_fill_bulk_transfer(transfer, usb->devhdl, DSO_EP_IN, buf,
-				devc->epin_maxpacketsize, cb, (void *)sdi, 40);
-		if ((ret = libusb_submit_transfer(transfer)) != 0) {
+	sr_dbg("Queueing up %d transfers.", devc->num_transfers);
+	for (i = 0; i < devc->num_transfers; i++) {
+		SR_TRACE2(hantek_dso_transfer_submit, devc->transfers[i],
+				devc->transfers[i]->length);
+		if ((ret = libusb_submit_transfer(devc->transfers[i])) != 0) {
 			sr_err("Failed to submit transfer: %s.",
 			       libusb_error_name(ret));
-			/* TODO: Free them all. */
-			libusb_free_transfer(transfer);
-			g_free(buf);
 			return SR_ERR;
 		}
+		devc->num_busy_transfers++;
 	}
 
 	return SR_OK;
 }
+
+SR_PRIV void dso_transfers_cancel(const struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	int i;
+
+	devc = sdi->priv;
+	for (i = 0; i < devc->num_transfers; i++)
+		libusb_cancel_transfer(devc->transfers[i]);
+}
+
+/* Must only be called when none of the transfers is busy. */
+SR_PRIV void dso_transfers_free(const struct sr_dev_inst *sdi)
+{
+	struct drv_context *drvc;
+	struct dev_context *devc;
+	int i;
+
+	drvc = sdi->driver->priv;
+	devc = sdi->priv;
+	for (i = 0; i < devc->num_transfers; i++) {
+		sr_usb_buffer_free(drvc->sr_ctx, devc->transfers[i]->buffer,
+				devc->transfers[i]->length);
+		libusb_free_transfer(devc->transfers[i]);
+	}
+	g_free(devc->transfers);
+	devc->transfers = NULL;
+	devc->num_transfers = 0;
+}
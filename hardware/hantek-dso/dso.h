@@ -25,11 +25,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "hantek-dso: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define USB_INTERFACE           0
 #define USB_CONFIGURATION       1
@@ -41,6 +41,9 @@
 
 #define MAX_CAPTURE_EMPTY       3
 
+/* Largest USB transfer for channel data, in endpoint packets. */
+#define MAX_PACKETS_PER_TRANSFER 16
+
 #define DEFAULT_VOLTAGE         VDIV_500MV
 #define DEFAULT_FRAMESIZE       FRAMESIZE_SMALL
 #define DEFAULT_TIMEBASE        TIME_100us
@@ -196,6 +199,10 @@ struct dev_context {
 	float voffset_ch2;
 	float voffset_trigger;
 	uint16_t channel_levels[2][9][2];
+	/* Set once channel_levels were read from the device, or the cache. */
+	gboolean channel_levels_valid;
+	/* The device's USB serial number, NULL if it has none. */
+	char *serial;
 	unsigned int framesize;
 	gboolean filter_ch1;
 	gboolean filter_ch2;
@@ -209,7 +216,10 @@ struct dev_context {
 	unsigned int samp_received;
 	unsigned int samp_buffered;
 	unsigned int trigger_offset;
-	unsigned char *framebuf;
+	/* Allocated on the first frame and reused for all of them. */
+	struct libusb_transfer **transfers;
+	int num_transfers;
+	int num_busy_transfers;
 };
 
 SR_PRIV int dso_open(struct sr_dev_inst *sdi);
@@ -222,5 +232,8 @@ SR_PRIV int dso_get_capturestate(const struct sr_dev_inst *sdi,
 SR_PRIV int dso_capture_start(const struct sr_dev_inst *sdi);
 SR_PRIV int dso_get_channeldata(const struct sr_dev_inst *sdi,
 		libusb_transfer_cb_fn cb);
+SR_PRIV void dso_transfers_cancel(const struct sr_dev_inst *sdi);
+SR_PRIV void dso_transfers_free(const struct sr_dev_inst *sdi);
+SR_PRIV void dso_offsets_cache_clear(void);
 
 #endif
@@ -49,8 +49,25 @@ static const char *probe_names[NUM_PROBES + 1] = {
 SR_PRIV struct sr_dev_driver ikalogic_scanalogic2_driver_info;
 static struct sr_dev_driver *di = &ikalogic_scanalogic2_driver_info;
 
+/* Free the status transfers and the first num_data sample transfers. */
+static void free_transfers(struct dev_context *devc, int num_data)
+{
+	int i;
+
+	libusb_free_transfer(devc->xfer_in);
+	libusb_free_transfer(devc->xfer_out);
+
+	for (i = 0; i < num_data; i++)
+		libusb_free_transfer(devc->xfer_data[i]);
+}
+
 static int init(struct sr_context *sr_ctx)
 {
+	int ret;
+
+	if ((ret = sr_usb_init(sr_ctx)) != SR_OK)
+		return ret;
+
 	return std_init(sr_ctx, di, LOG_PREFIX);
 }
 
@@ -73,7 +90,7 @@ static GSList *scan(GSList *options)
 	drvc->instances = NULL;
 	device_index = 0;
 
-	usb_devices = sr_usb_find(drvc->sr_ctx->libusb_ctx, USB_VID_PID);
+	usb_devices = sr_usb_find(drvc->sr_ctx, USB_VID_PID);
 
 	if (usb_devices == NULL)
 		return NULL;
@@ -108,13 +125,25 @@ static GSList *scan(GSList *options)
 			continue;
 		}
 
+		for (i = 0; i < NUM_DATA_TRANSFERS; i++) {
+			if (!(devc->xfer_data[i] = libusb_alloc_transfer(0)))
+				break;
+		}
+
+		if (i < NUM_DATA_TRANSFERS) {
+			sr_err("Transfer malloc failed.");
+			sr_usb_dev_inst_free(usb);
+			free_transfers(devc, i);
+			g_free(devc);
+			continue;
+		}
+
 		fw_ver_str = g_strdup_printf("%u.%u", dev_info.fw_ver_major,
 			dev_info.fw_ver_minor);
 		if (!fw_ver_str) {
 			sr_err("Firmware string malloc failed.");
 			sr_usb_dev_inst_free(usb);
-			libusb_free_transfer(devc->xfer_in);
-			libusb_free_transfer(devc->xfer_out);
+			free_transfers(devc, NUM_DATA_TRANSFERS);
 			g_free(devc);
 			continue;
 		}
@@ -125,8 +154,7 @@ static GSList *scan(GSList *options)
 		if (!sdi) {
 			sr_err("sr_dev_inst_new failed.");
 			sr_usb_dev_inst_free(usb);
-			libusb_free_transfer(devc->xfer_in);
-			libusb_free_transfer(devc->xfer_out);
+			free_transfers(devc, NUM_DATA_TRANSFERS);
 			g_free(devc);
 			continue;
 		}
@@ -169,6 +197,15 @@ static GSList *scan(GSList *options)
 			USB_HID_REPORT_TYPE_FEATURE, USB_INTERFACE,
 			PACKET_LENGTH);
 
+		for (i = 0; i < NUM_DATA_TRANSFERS; i++) {
+			memset(devc->xfer_buf_data[i], 0,
+				LIBUSB_CONTROL_SETUP_SIZE + PACKET_LENGTH);
+			libusb_fill_control_setup(devc->xfer_buf_data[i],
+				USB_REQUEST_TYPE_IN, USB_HID_GET_REPORT,
+				USB_HID_REPORT_TYPE_FEATURE, USB_INTERFACE,
+				PACKET_LENGTH);
+		}
+
 		devc->xfer_data_in = devc->xfer_buf_in +
 			LIBUSB_CONTROL_SETUP_SIZE;
 		devc->xfer_data_out = devc->xfer_buf_out +
@@ -198,8 +235,7 @@ static void clear_dev_context(void *priv)
 
 	sr_dbg("Device context cleared.");
 
-	libusb_free_transfer(devc->xfer_in);
-	libusb_free_transfer(devc->xfer_out);
+	free_transfers(devc, NUM_DATA_TRANSFERS);
 	g_free(devc);
 }
 
@@ -214,7 +250,7 @@ static int dev_open(struct sr_dev_inst *sdi)
 	struct dev_context *devc;
 	struct sr_usb_dev_inst *usb;
 	uint8_t buffer[PACKET_LENGTH];
-	int ret;
+	int ret, i;
 
 	if (!(drvc = di->priv)) {
 		sr_err("Driver was not initialized.");
@@ -254,6 +290,11 @@ static int dev_open(struct sr_dev_inst *sdi)
 		devc->xfer_buf_out, sl2_receive_transfer_out,
 		sdi, USB_TIMEOUT);
 
+	for (i = 0; i < NUM_DATA_TRANSFERS; i++)
+		libusb_fill_control_transfer(devc->xfer_data[i], usb->devhdl,
+			devc->xfer_buf_data[i], sl2_receive_transfer_data,
+			sdi, USB_TIMEOUT);
+
 	memset(buffer, 0, sizeof(buffer));
 
 	buffer[0] = CMD_RESET;
@@ -64,7 +64,8 @@ static void abort_acquisition(struct sr_dev_inst *sdi)
 	sdi->driver->dev_close(sdi);
 }
 
-static void buffer_sample_data(const struct sr_dev_inst *sdi)
+static void buffer_sample_data(const struct sr_dev_inst *sdi,
+		const uint8_t *data)
 {
 	struct dev_context *devc;
 	unsigned int offset, packet_length;
@@ -86,37 +87,44 @@ static void buffer_sample_data(const struct sr_dev_inst *sdi)
 		 * contain channel and packet information only.
 		 */
 		memcpy(devc->sample_buffer[devc->channel] + offset,
-			devc->xfer_data_in + 4, packet_length);
+			data + 4, packet_length);
 	}
 }
 
+static void send_samples(struct dev_context *devc, uint8_t *buffer,
+		uint16_t n)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.length = n;
+	logic.unitsize = 1;
+	logic.data = buffer;
+	sr_session_send(devc->cb_data, &packet);
+}
+
+/* Turn the received sample bytes of all channels into samples. */
 static void process_sample_data(const struct sr_dev_inst *sdi)
 {
 	struct dev_context *devc;
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_logic logic;
-	uint8_t i, j, tmp, buffer[PACKET_NUM_SAMPLES], *ptr[NUM_PROBES];
-	uint16_t offset, n = 0;
+	uint8_t j, tmp, buffer[PACKET_NUM_SAMPLES], *ptr[NUM_PROBES];
+	unsigned int i, num_bytes;
+	uint16_t n = 0;
 	int8_t k;
 
 	devc = sdi->priv;
-	offset = devc->sample_packet * PACKET_NUM_SAMPLE_BYTES;
 
-	/*
-	 * Array of pointers to the sample data of all channels up to the last
-	 * enabled one for an uniform access to them. Note that the currently
-	 * received samples always belong to the last enabled channel.
-	 */
-	for (i = 0; i < devc->num_enabled_probes - 1; i++)
-		ptr[i] = devc->sample_buffer[devc->probe_map[i]] + offset;
+	/* Uniform access to the sample data of all enabled channels. */
+	for (j = 0; j < devc->num_enabled_probes; j++)
+		ptr[j] = devc->sample_buffer[devc->probe_map[j]];
 
-	/*
-	 * Skip the first 4 bytes of the buffer because they contain channel
-	 * and packet information only.
-	 */
-	ptr[i] = devc->xfer_data_in + 4;
+	num_bytes = MIN(devc->num_sample_packets * PACKET_NUM_SAMPLE_BYTES,
+		MAX_DEV_SAMPLE_BYTES);
 
-	for (i = 0; i < PACKET_NUM_SAMPLE_BYTES; i++) {
+	for (i = 0; i < num_bytes; i++) {
 		/* Stop processing if all requested samples are processed. */
 		if (devc->samples_processed == devc->limit_samples)
 			break;
@@ -177,29 +185,49 @@ static void process_sample_data(const struct sr_dev_inst *sdi)
 			 */
 			if (devc->samples_processed == devc->pre_trigger_samples &&
 					devc->trigger_type != TRIGGER_TYPE_NONE) {
-				packet.type = SR_DF_LOGIC;
-				packet.payload = &logic;
-				logic.length = n;
-				logic.unitsize = 1;
-				logic.data = buffer;
-				sr_session_send(devc->cb_data, &packet);
+				send_samples(devc, buffer, n);
 
 				packet.type = SR_DF_TRIGGER;
 				sr_session_send(devc->cb_data, &packet);
 
+				n = 0;
+			} else if (n == sizeof(buffer)) {
+				send_samples(devc, buffer, n);
 				n = 0;
 			}
 		}
 	}
 
-	if (n > 0) {
-		packet.type = SR_DF_LOGIC;
-		packet.payload = &logic;
-		logic.length = n;
-		logic.unitsize = 1;
-		logic.data = buffer;
-		sr_session_send(devc->cb_data, &packet);
+	if (n > 0)
+		send_samples(devc, buffer, n);
+}
+
+/* Request the first sample packets, the rest follow as they arrive. */
+static int submit_data_transfers(const struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	uint8_t last_channel;
+	unsigned int i;
+	int ret;
+
+	devc = sdi->priv;
+
+	/* The device sends all channels up to the last enabled one. */
+	last_channel = devc->probe_map[devc->num_enabled_probes - 1];
+	devc->num_packets = (last_channel + 1) * devc->num_sample_packets;
+	devc->packets_requested = 0;
+	devc->num_data_xfers_active = 0;
+
+	for (i = 0; i < NUM_DATA_TRANSFERS; i++) {
+		if (devc->packets_requested == devc->num_packets)
+			break;
+		if ((ret = libusb_submit_transfer(devc->xfer_data[i])) != 0)
+			return ret;
+		devc->packets_requested++;
+		devc->num_data_xfers_active++;
 	}
+
+	return 0;
 }
 
 SR_PRIV int ikalogic_scanalogic2_receive_data(int fd, int revents, void *cb_data)
@@ -267,7 +295,6 @@ SR_PRIV void sl2_receive_transfer_in( struct libusb_transfer *transfer)
 {
 	struct sr_dev_inst *sdi;
 	struct dev_context *devc;
-	uint8_t last_channel;
 	int ret = 0;
 
 	sdi = transfer->user_data;
@@ -313,33 +340,11 @@ SR_PRIV void sl2_receive_transfer_in( struct libusb_transfer *transfer)
 		if (devc->xfer_data_in[0] == 0x05 &&
 				devc->xfer_data_in[1] == STATUS_DATA_READY) {
 			devc->next_state = STATE_RECEIVE_DATA;
-			ret = libusb_submit_transfer(transfer);
+			ret = submit_data_transfers(sdi);
 		} else {
 			devc->wait_data_ready_locked = FALSE;
 			devc->wait_data_ready_time = g_get_monotonic_time();
 		}
-	} else if (devc->state == STATE_RECEIVE_DATA) {
-		last_channel = devc->probe_map[devc->num_enabled_probes - 1];
-
-		if (devc->channel < last_channel) {
-			buffer_sample_data(sdi);
-		} else if (devc->channel == last_channel) {
-			process_sample_data(sdi);
-		} else {
-			/*
-			 * Stop acquisition because all samples of enabled
-			 * probes are processed.
-			 */
-			devc->next_state = STATE_RESET_AND_IDLE;
-		}
-
-		devc->sample_packet++;
-		devc->sample_packet %= devc->num_sample_packets;
-
-		if (devc->sample_packet == 0)
-			devc->channel++;
-
-		ret = libusb_submit_transfer(transfer);
 	} else if (devc->state == STATE_RESET_AND_IDLE) {
 		/* Check if the received data are a valid device status. */
 		if (devc->xfer_data_in[0] == 0x05) {
@@ -443,6 +448,75 @@ SR_PRIV void sl2_receive_transfer_out( struct libusb_transfer *transfer)
 	}
 }
 
+/*
+ * Sample packets arrive in the order they were requested, with up to
+ * NUM_DATA_TRANSFERS of them in flight. Once all are there, the samples
+ * are processed and the device is reset.
+ */
+SR_PRIV void sl2_receive_transfer_data(struct libusb_transfer *transfer)
+{
+	struct sr_dev_inst *sdi;
+	struct dev_context *devc;
+	int ret = 0;
+
+	sdi = transfer->user_data;
+	devc = sdi->priv;
+
+	devc->num_data_xfers_active--;
+
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		sr_err("Transfer to device failed: %i.", transfer->status);
+		devc->transfer_error = TRUE;
+		return;
+	}
+
+	if (devc->transfer_error)
+		return;
+
+	if (devc->state != devc->next_state)
+		sr_spew("State changed from %i to %i.",
+			devc->state, devc->next_state);
+	devc->state = devc->next_state;
+
+	buffer_sample_data(sdi, transfer->buffer + LIBUSB_CONTROL_SETUP_SIZE);
+
+	devc->sample_packet++;
+	devc->sample_packet %= devc->num_sample_packets;
+
+	if (devc->sample_packet == 0)
+		devc->channel++;
+
+	/* Don't ask for more once stopping, just let the rest arrive. */
+	if (sdi->status == SR_ST_STOPPING)
+		devc->num_packets = devc->packets_requested;
+
+	if (devc->packets_requested < devc->num_packets) {
+		if ((ret = libusb_submit_transfer(transfer)) != 0) {
+			sr_err("Submit transfer failed: %s.",
+				libusb_error_name(ret));
+			devc->transfer_error = TRUE;
+			return;
+		}
+		devc->packets_requested++;
+		devc->num_data_xfers_active++;
+		return;
+	}
+
+	if (devc->num_data_xfers_active > 0)
+		return;
+
+	if (sdi->status == SR_ST_STOPPING)
+		devc->stopping_in_progress = TRUE;
+	else
+		process_sample_data(sdi);
+
+	devc->next_state = STATE_RESET_AND_IDLE;
+	if ((ret = libusb_submit_transfer(devc->xfer_in)) != 0) {
+		sr_err("Submit transfer failed: %s.", libusb_error_name(ret));
+		devc->transfer_error = TRUE;
+	}
+}
+
 SR_PRIV int sl2_set_samplerate(const struct sr_dev_inst *sdi,
 		uint64_t samplerate)
 {
@@ -30,11 +30,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "ikalogic-scanalogic2: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define VENDOR_NAME			"IKALOGIC"
 #define MODEL_NAME			"Scanalogic-2"
@@ -81,6 +81,9 @@
 /* Number of samples per packet. */
 #define PACKET_NUM_SAMPLES		(PACKET_NUM_SAMPLE_BYTES * 8)
 
+/* Number of sample packets requested from the device ahead of time. */
+#define NUM_DATA_TRANSFERS		8
+
 #define DEFAULT_SAMPLERATE		SR_KHZ(1.25)
 
 /*
@@ -176,6 +179,16 @@ struct dev_context {
 	/* Pointers to the payload of incoming and outgoing transfers. */
 	uint8_t *xfer_data_in, *xfer_data_out;
 
+	/* Transfers to receive sample packets, with their buffers. */
+	struct libusb_transfer *xfer_data[NUM_DATA_TRANSFERS];
+	uint8_t xfer_buf_data[NUM_DATA_TRANSFERS][LIBUSB_CONTROL_SETUP_SIZE +
+		PACKET_LENGTH];
+
+	/* Sample packets to receive, requested so far and in flight. */
+	unsigned int num_packets;
+	unsigned int packets_requested;
+	unsigned int num_data_xfers_active;
+
 	/* Current state of the state machine */
 	unsigned int state;
 
@@ -201,10 +214,9 @@ struct dev_context {
 
 	/*
 	 * Buffer which contains the samples received from the device for each
-	 * channel except the last one. The samples of the last channel will be
-	 * processed directly after they will be received.
+	 * channel. They are processed once all of them are received.
 	 */
-	uint8_t sample_buffer[NUM_PROBES - 1][MAX_DEV_SAMPLE_BYTES];
+	uint8_t sample_buffer[NUM_PROBES][MAX_DEV_SAMPLE_BYTES];
 
 	/* Expected number of sample packets for each channel. */
 	uint16_t num_sample_packets;
@@ -231,6 +243,7 @@ struct dev_context {
 SR_PRIV int ikalogic_scanalogic2_receive_data(int fd, int revents, void *cb_data);
 SR_PRIV void sl2_receive_transfer_in(struct libusb_transfer *transfer);
 SR_PRIV void sl2_receive_transfer_out(struct libusb_transfer *transfer);
+SR_PRIV void sl2_receive_transfer_data(struct libusb_transfer *transfer);
 SR_PRIV int sl2_set_samplerate(const struct sr_dev_inst *sdi,
 		uint64_t samplerate);
 SR_PRIV int sl2_set_limit_samples(const struct sr_dev_inst *sdi,
@@ -34,6 +34,7 @@ static const int32_t hwcaps[] = {
 	SR_CONF_LIMIT_MSEC,
 	SR_CONF_LIMIT_SAMPLES,
 	SR_CONF_CONTINUOUS, // TODO?
+	SR_CONF_RLE,
 };
 
 /* Probes are numbered 1-9. */
@@ -59,6 +60,8 @@ static void clear_helper(void *priv)
 	ftdi_free(devc->ftdic);
 	g_free(devc->compressed_buf);
 	g_free(devc->sample_buf);
+	g_free(devc->run_values);
+	g_free(devc->run_counts);
 }
 
 static int dev_clear(void)
@@ -94,7 +97,7 @@ static GSList *scan(GSList *options)
 	}
 
 	/* Allocate memory for the incoming compressed samples. */
-	if (!(devc->compressed_buf = g_try_malloc0(COMPRESSED_BUF_SIZE))) {
+	if (!(devc->compressed_buf = g_try_malloc0(READ_SIZE))) {
 		sr_err("compressed_buf malloc failed.");
 		goto err_free_devc;
 	}
@@ -105,10 +108,21 @@ static GSList *scan(GSList *options)
 		goto err_free_compressed_buf;
 	}
 
+	/* Allocate memory for the runs of one compressed block (RLE). */
+	if (!(devc->run_values = g_try_malloc(COMPRESSED_BUF_SIZE))) {
+		sr_err("run_values malloc failed.");
+		goto err_free_sample_buf;
+	}
+	if (!(devc->run_counts = g_try_malloc(COMPRESSED_BUF_SIZE / 2 *
+					      sizeof(uint64_t)))) {
+		sr_err("run_counts malloc failed.");
+		goto err_free_run_values;
+	}
+
 	/* Allocate memory for the FTDI context (ftdic) and initialize it. */
 	if (!(devc->ftdic = ftdi_new())) {
 		sr_err("Failed to initialize libftdi.");
-		goto err_free_sample_buf;
+		goto err_free_run_counts;
 	}
 
 	/* Check for the device and temporarily open it. */
@@ -151,6 +165,10 @@ err_close_ftdic:
 	scanaplus_close(devc);
 err_free_ftdic:
 	ftdi_free(devc->ftdic); /* NOT free() or g_free()! */
+err_free_run_counts:
+	g_free(devc->run_counts);
+err_free_run_values:
+	g_free(devc->run_values);
 err_free_sample_buf:
 	g_free(devc->sample_buf);
 err_free_compressed_buf:
@@ -228,8 +246,8 @@ static int dev_open(struct sr_dev_inst *sdi)
 	}
 	sr_dbg("FTDI chip latency timer set successfully.");
 
-	/* Set the FTDI read data chunk size to 64kB. */
-	ret = ftdi_read_data_set_chunksize(devc->ftdic, 64 * 1024);
+	/* Read a whole READ_SIZE block with one USB transfer. */
+	ret = ftdi_read_data_set_chunksize(devc->ftdic, READ_SIZE);
 	if (ret < 0) {
 		sr_err("Failed to set FTDI read data chunk size (%d): %s.",
 		       ret, ftdi_get_error_string(devc->ftdic));
@@ -282,7 +300,8 @@ static int cleanup(void)
 static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 		const struct sr_probe_group *probe_group)
 {
-	(void)sdi;
+	struct dev_context *devc;
+
 	(void)probe_group;
 
 	switch (id) {
@@ -290,6 +309,12 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 		/* The ScanaPLUS samplerate is 100MHz and can't be changed. */
 		*data = g_variant_new_uint64(SR_MHZ(100));
 		break;
+	case SR_CONF_RLE:
+		if (!sdi)
+			return SR_ERR;
+		devc = sdi->priv;
+		*data = g_variant_new_boolean(devc->rle);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -327,6 +352,10 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 			return SR_ERR_ARG;
 		devc->limit_samples = g_variant_get_uint64(data);
 		break;
+	case SR_CONF_RLE:
+		devc->rle = g_variant_get_boolean(data);
+		sr_info("%s RLE.", devc->rle ? "Enabling" : "Disabling");
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -383,6 +412,7 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 
 	/* Properly reset internal variables before every new acquisition. */
 	devc->compressed_bytes_ignored = 0;
+	devc->compressed_bytes_left = 0;
 	devc->samples_sent = 0;
 	devc->bytes_received = 0;
 
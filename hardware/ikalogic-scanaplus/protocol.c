@@ -87,23 +87,53 @@ SR_PRIV int scanaplus_close(struct dev_context *devc)
 	return SR_OK;
 }
 
+/*
+ * Every two bytes of compressed data are a run: bits 7-1 of the first byte
+ * are its length, bit 0 is probe 9 and the second byte holds probes 1-8.
+ */
 static void scanaplus_uncompress_block(struct dev_context *devc,
-				       uint64_t num_bytes)
+				       const uint8_t *buf, uint64_t num_bytes)
 {
-	uint64_t i, j;
-	uint8_t num_samples, low, high;
+	uint64_t i;
+	uint16_t *samples, sample;
+	uint8_t j, num_samples;
+
+	/* bytes_received is always even, so this is aligned. */
+	samples = (uint16_t *)(devc->sample_buf + devc->bytes_received);
 
 	for (i = 0; i < num_bytes; i += 2) {
-		num_samples = devc->compressed_buf[i + 0] >> 1;
+		num_samples = buf[i + 0] >> 1;
+		sample = GUINT16_TO_LE(buf[i + 1] | ((buf[i + 0] & 1) << 8));
 
-		low = devc->compressed_buf[i + 0] & (1 << 0);
-		high = devc->compressed_buf[i + 1];
+		for (j = 0; j < num_samples; j++)
+			*samples++ = sample;
+	}
 
-		for (j = 0; j < num_samples; j++) {
-			devc->sample_buf[devc->bytes_received++] = high;
-			devc->sample_buf[devc->bytes_received++] = low;
-		}
+	devc->bytes_received = (uint8_t *)samples - devc->sample_buf;
+}
+
+/* Turn the compressed data into runs, at most max_samples long in total. */
+static uint64_t scanaplus_uncompress_rle(struct dev_context *devc,
+		const uint8_t *buf, uint64_t num_bytes, uint64_t max_samples,
+		uint64_t *num_samples)
+{
+	uint64_t i, num_runs, count;
+
+	num_runs = 0;
+	*num_samples = 0;
+
+	for (i = 0; i < num_bytes && *num_samples < max_samples; i += 2) {
+		if (!(count = buf[i + 0] >> 1))
+			continue;
+		count = MIN(count, max_samples - *num_samples);
+
+		devc->run_values[num_runs * 2 + 0] = buf[i + 1];
+		devc->run_values[num_runs * 2 + 1] = buf[i + 0] & 1;
+		devc->run_counts[num_runs++] = count;
+		*num_samples += count;
 	}
+
+	return num_runs;
 }
 
 static void send_samples(struct dev_context *devc, uint64_t samples_to_send)
@@ -291,12 +321,73 @@ SR_PRIV int scanaplus_start_acquisition(struct dev_context *devc)
 	return SR_OK;
 }
 
+/* Number of samples that may still be sent, G_MAXUINT64 without limits. */
+static uint64_t samples_left(const struct dev_context *devc)
+{
+	uint64_t limit;
+
+	limit = G_MAXUINT64;
+	if (devc->limit_samples)
+		limit = devc->limit_samples;
+	if (devc->limit_msec)
+		limit = MIN(limit, (SR_MHZ(100) / 1000) * devc->limit_msec);
+
+	return limit - devc->samples_sent;
+}
+
+/* Send one slice of compressed data, returns FALSE once a limit is hit. */
+static gboolean scanaplus_process_block(struct sr_dev_inst *sdi,
+					const uint8_t *buf, uint64_t num_bytes)
+{
+	struct dev_context *devc;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic_rle rle;
+	uint64_t left;
+
+	devc = sdi->priv;
+	left = samples_left(devc);
+
+	if (devc->rle) {
+		rle.num_runs = scanaplus_uncompress_rle(devc, buf, num_bytes,
+				left, &rle.num_samples);
+		if (rle.num_runs > 0) {
+			sr_spew("Sending %" PRIu64 " samples in %" PRIu64
+				" runs.", rle.num_samples, rle.num_runs);
+			packet.type = SR_DF_LOGIC_RLE;
+			packet.payload = &rle;
+			rle.unitsize = 2; /* We need 2 bytes for 9 probes. */
+			rle.values = devc->run_values;
+			rle.counts = devc->run_counts;
+			sr_session_send(devc->cb_data, &packet);
+			devc->samples_sent += rle.num_samples;
+		}
+	} else {
+		scanaplus_uncompress_block(devc, buf, num_bytes);
+		if ((left = MIN(devc->bytes_received / 2, left)) > 0)
+			send_samples(devc, left);
+		/* Drop whatever is past the limit. */
+		devc->bytes_received = 0;
+	}
+
+	if (samples_left(devc) > 0)
+		return TRUE;
+
+	if (devc->limit_samples && devc->samples_sent >= devc->limit_samples)
+		sr_info("Requested number of samples reached.");
+	else
+		sr_info("Requested time limit reached.");
+	sdi->driver->dev_acquisition_stop(sdi, devc->cb_data);
+
+	return FALSE;
+}
+
 SR_PRIV int scanaplus_receive_data(int fd, int revents, void *cb_data)
 {
 	int bytes_read;
 	struct sr_dev_inst *sdi;
 	struct dev_context *devc;
-	uint64_t max, n;
+	const uint8_t *buf;
+	uint64_t num_bytes, n;
 
 	(void)fd;
 	(void)revents;
@@ -310,9 +401,10 @@ SR_PRIV int scanaplus_receive_data(int fd, int revents, void *cb_data)
 	if (!devc->ftdic)
 		return TRUE;
 
-	/* Get a block of data. */
-	bytes_read = ftdi_read_data(devc->ftdic, devc->compressed_buf,
-				    COMPRESSED_BUF_SIZE);
+	/* Get a block of data, after the byte left over from the last one. */
+	bytes_read = ftdi_read_data(devc->ftdic,
+			devc->compressed_buf + devc->compressed_bytes_left,
+			READ_SIZE - devc->compressed_bytes_left);
 	if (bytes_read < 0) {
 		sr_err("Failed to read FTDI data (%d): %s.",
 		       bytes_read, ftdi_get_error_string(devc->ftdic));
@@ -324,6 +416,9 @@ SR_PRIV int scanaplus_receive_data(int fd, int revents, void *cb_data)
 		return TRUE;
 	}
 
+	buf = devc->compressed_buf;
+	num_bytes = devc->compressed_bytes_left + bytes_read;
+
 	/*
 	 * After a ScanaPLUS acquisition starts, a bunch of samples will be
 	 * returned as all-zero, no matter which signals are actually present
@@ -340,31 +435,27 @@ SR_PRIV int scanaplus_receive_data(int fd, int revents, void *cb_data)
 	 * "reconfigure" time is a lot less than that usually.
 	 */
 	if (devc->compressed_bytes_ignored < COMPRESSED_BUF_SIZE) {
-		/* Ignore the first 64kB of data of every acquisition. */
-		sr_spew("Ignoring first 64kB chunk of data.");
-		devc->compressed_bytes_ignored += COMPRESSED_BUF_SIZE;
-		return TRUE;
+		n = MIN(num_bytes,
+			COMPRESSED_BUF_SIZE - devc->compressed_bytes_ignored);
+		sr_spew("Ignoring %" PRIu64 " bytes of the first 64kB.", n);
+		devc->compressed_bytes_ignored += n;
+		buf += n;
+		num_bytes -= n;
 	}
 
-	/* TODO: Handle bytes_read which is not a multiple of 2? */
-	scanaplus_uncompress_block(devc, bytes_read);
-
-	n = devc->samples_sent + (devc->bytes_received / 2);
-	max = (SR_MHZ(100) / 1000) * devc->limit_msec;
-
-	if (devc->limit_samples && (n >= devc->limit_samples)) {
-		send_samples(devc, devc->limit_samples - devc->samples_sent);
-		sr_info("Requested number of samples reached.");
-		sdi->driver->dev_acquisition_stop(sdi, cb_data);
-		return TRUE;
-	} else if (devc->limit_msec && (n >= max)) {
-		send_samples(devc, max - devc->samples_sent);
-		sr_info("Requested time limit reached.");
-		sdi->driver->dev_acquisition_stop(sdi, cb_data);
-		return TRUE;
-	} else {
-		send_samples(devc, devc->bytes_received / 2);
+	/* Uncompress and send the data in slices that fit sample_buf. */
+	while (num_bytes >= 2) {
+		n = MIN(num_bytes & ~1ULL, COMPRESSED_BUF_SIZE);
+		if (!scanaplus_process_block(sdi, buf, n))
+			return TRUE;
+		buf += n;
+		num_bytes -= n;
 	}
 
+	/* Runs are two bytes, keep an odd one for the next read. */
+	if (num_bytes)
+		devc->compressed_buf[0] = *buf;
+	devc->compressed_bytes_left = num_bytes;
+
 	return TRUE;
 }
@@ -31,14 +31,17 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "scanaplus: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define COMPRESSED_BUF_SIZE		(64 * 1024)
 
+/* Bytes asked of the FTDI chip at a time, uncompressed in 64kB slices. */
+#define READ_SIZE			(4 * COMPRESSED_BUF_SIZE)
+
 /* Private, per-device-instance driver context. */
 struct dev_context {
 	/** FTDI device context (used by libftdi). */
@@ -52,11 +55,18 @@ struct dev_context {
 
 	void *cb_data;
 
+	/** Send the runs as the device compresses them (SR_CONF_RLE). */
+	gboolean rle;
+
 	uint8_t *compressed_buf;
 	uint64_t compressed_bytes_ignored;
+	/** Odd byte at the end of the last read, kept for the next one. */
+	uint64_t compressed_bytes_left;
 	uint8_t *sample_buf;
 	uint64_t bytes_received;
 	uint64_t samples_sent;
+	uint8_t *run_values;
+	uint64_t *run_counts;
 
 	/** ScanaPLUS unique device ID (3 bytes). */
 	uint8_t devid[3];
@@ -65,6 +65,11 @@ static struct sr_dev_driver *di = &kecheng_kc_330b_driver_info;
 
 static int init(struct sr_context *sr_ctx)
 {
+	int ret;
+
+	if ((ret = sr_usb_init(sr_ctx)) != SR_OK)
+		return ret;
+
 	return std_init(sr_ctx, di, LOG_PREFIX);
 }
 
@@ -122,7 +127,7 @@ static GSList *scan(GSList *options)
 	drvc->instances = NULL;
 
 	devices = NULL;
-	if ((usb_devices = sr_usb_find(drvc->sr_ctx->libusb_ctx, USB_CONN))) {
+	if ((usb_devices = sr_usb_find(drvc->sr_ctx, USB_CONN))) {
 		/* We have a list of sr_usb_dev_inst matching the connection
 		 * string. Wrap them in sr_dev_inst and we're done. */
 		for (l = usb_devices; l; l = l->next) {
@@ -153,6 +158,7 @@ static GSList *scan(GSList *options)
 			devc->mqflags = DEFAULT_WEIGHT_TIME | DEFAULT_WEIGHT_FREQ;
 			devc->data_source = DEFAULT_DATA_SOURCE;
 			devc->config_dirty = FALSE;
+			memset(&devc->batch, 0, sizeof(struct sr_analog_batch));
 
 			/* TODO: Set date/time? */
 
@@ -446,6 +452,9 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 
 	devc->cb_data = cb_data;
 	devc->num_samples = 0;
+	sr_analog_batch_start(&devc->batch, cb_data);
+	devc->batch.max_samples = LOG_BATCH_SAMPLES;
+	devc->batch.max_wait = 0;
 
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
@@ -480,6 +489,12 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 			devc->stored_samples = devc->limit_samples;
 
 		si = kecheng_kc_330b_sample_intervals[buf[1]];
+		/*
+		 * The device doesn't say when it logged the samples, so their
+		 * timestamps count from the start of the download.
+		 */
+		devc->log_interval = si[0] * G_USEC_PER_SEC / si[1];
+		devc->log_time = g_get_monotonic_time();
 		rational[0] = g_variant_new_uint64(si[0]);
 		rational[1] = g_variant_new_uint64(si[1]);
 		gvar = g_variant_new_tuple(rational, 2);
@@ -516,16 +531,16 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 		buf[2] = 0;
 		buf_len = 4;
 		devc->state = LOG_DATA_WAIT;
-		if (devc->stored_samples < 63)
+		if (devc->stored_samples < LOG_CHUNK_SAMPLES)
 			buf[3] = devc->stored_samples;
 		else
-			buf[3] = 63;
+			buf[3] = LOG_CHUNK_SAMPLES;
 		/* Command ack byte + 2 bytes per sample. */
 		req_len = 1 + buf[3] * 2;
 	}
 
 	ret = libusb_bulk_transfer(usb->devhdl, EP_OUT, buf, buf_len, &len, 5);
-	if (ret != 0 || len != 1) {
+	if (ret != 0 || len != buf_len) {
 		sr_dbg("Failed to start acquisition: %s", libusb_error_name(ret));
 		libusb_free_transfer(devc->xfer);
 		return SR_ERR;
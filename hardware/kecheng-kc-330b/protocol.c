@@ -24,6 +24,44 @@ extern struct sr_dev_driver kecheng_kc_330b_driver_info;
 static struct sr_dev_driver *di = &kecheng_kc_330b_driver_info;
 extern const uint64_t kecheng_kc_330b_sample_intervals[][2];
 
+static void send_data(const struct sr_dev_inst *sdi, void *buf,
+		unsigned int buf_len);
+
+/* Request the next chunk of stored samples. */
+static int log_data_request(const struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	struct sr_usb_dev_inst *usb;
+	int offset, len, ret, num_samples;
+	unsigned char buf[4];
+
+	devc = sdi->priv;
+	usb = sdi->conn;
+
+	buf[0] = CMD_GET_LOG_DATA;
+	offset = devc->num_samples / LOG_CHUNK_SAMPLES;
+	buf[1] = (offset >> 8) & 0xff;
+	buf[2] = offset & 0xff;
+	num_samples = devc->stored_samples - devc->num_samples;
+	if (num_samples > LOG_CHUNK_SAMPLES)
+		buf[3] = LOG_CHUNK_SAMPLES;
+	else
+		/* Last chunk. */
+		buf[3] = num_samples;
+	ret = libusb_bulk_transfer(usb->devhdl, EP_OUT, buf, 4, &len, 5);
+	if (ret != 0 || len != 4) {
+		sr_dbg("Failed to request next chunk: %s",
+				libusb_error_name(ret));
+		return SR_ERR;
+	}
+	/* Command ack byte + 2 bytes per sample. */
+	devc->xfer->length = 1 + buf[3] * 2;
+	libusb_submit_transfer(devc->xfer);
+	devc->state = LOG_DATA_WAIT;
+
+	return SR_OK;
+}
+
 SR_PRIV int kecheng_kc_330b_handle_events(int fd, int revents, void *cb_data)
 {
 	struct drv_context *drvc;
@@ -34,7 +72,7 @@ SR_PRIV int kecheng_kc_330b_handle_events(int fd, int revents, void *cb_data)
 	struct timeval tv;
 	const uint64_t *intv_entry;
 	gint64 now, interval;
-	int offset, len, ret, i;
+	int len, ret, i;
 	unsigned char buf[4];
 
 	(void)fd;
@@ -50,6 +88,8 @@ SR_PRIV int kecheng_kc_330b_handle_events(int fd, int revents, void *cb_data)
 					       NULL);
 
 	if (sdi->status == SR_ST_STOPPING) {
+		sr_analog_batch_flush(&devc->batch);
+		sr_analog_batch_clear(&devc->batch);
 		libusb_free_transfer(devc->xfer);
 		for (i = 0; devc->usbfd[i] != -1; i++)
 			sr_source_remove(devc->usbfd[i]);
@@ -78,32 +118,32 @@ SR_PRIV int kecheng_kc_330b_handle_events(int fd, int revents, void *cb_data)
 			devc->last_live_request = now;
 			devc->state = LIVE_SPL_WAIT;
 		}
-	} else if (devc->state == LIVE_SPL_IDLE) {
-		buf[0] = CMD_GET_LOG_DATA;
-		offset = devc->num_samples / 63;
-		buf[1] = (offset >> 8) & 0xff;
-		buf[2] = offset & 0xff;
-		if (devc->stored_samples - devc->num_samples > 63)
-			buf[3] = 63;
-		else
-			/* Last chunk. */
-			buf[3] = devc->stored_samples - devc->num_samples;
-		ret = libusb_bulk_transfer(usb->devhdl, EP_OUT, buf, 4, &len, 5);
-		if (ret != 0 || len != 4) {
-			sr_dbg("Failed to request next chunk: %s",
-					libusb_error_name(ret));
-			sdi->driver->dev_acquisition_stop((struct sr_dev_inst *)sdi,
-					devc->cb_data);
-			return TRUE;
+	} else if (devc->state == LOG_DATA_IDLE) {
+		/*
+		 * Ask for the next chunks right after the previous ones come
+		 * in, rather than one chunk per poll.
+		 */
+		for (i = 0; i < LOG_CHUNKS_PER_POLL; i++) {
+			if (log_data_request(sdi) != SR_OK) {
+				sdi->driver->dev_acquisition_stop(
+						(struct sr_dev_inst *)sdi,
+						devc->cb_data);
+				return TRUE;
+			}
+			tv.tv_sec = 0;
+			tv.tv_usec = LOG_CHUNK_TIMEOUT * 1000;
+			libusb_handle_events_timeout_completed(
+					drvc->sr_ctx->libusb_ctx, &tv, NULL);
+			if (devc->state != LOG_DATA_IDLE)
+				break;
 		}
-		libusb_submit_transfer(devc->xfer);
-		devc->state = LIVE_SPL_WAIT;
 	}
 
 	return TRUE;
 }
 
-static void send_data(const struct sr_dev_inst *sdi, void *buf, unsigned int buf_len)
+static void send_data(const struct sr_dev_inst *sdi, void *buf,
+		unsigned int buf_len)
 {
 	struct dev_context *devc;
 	struct sr_datafeed_packet packet;
@@ -128,7 +168,9 @@ SR_PRIV void kecheng_kc_330b_receive_transfer(struct libusb_transfer *transfer)
 {
 	struct dev_context *devc;
 	struct sr_dev_inst *sdi;
-	float fvalue[64];
+	struct sr_datafeed_analog analog;
+	float fvalue[LOG_CHUNK_SAMPLES];
+	unsigned char *buf;
 	int packet_has_error, num_samples, i;
 
 	sdi = transfer->user_data;
@@ -172,13 +214,23 @@ SR_PRIV void kecheng_kc_330b_receive_transfer(struct libusb_transfer *transfer)
 		if (transfer->actual_length < 1 || !(transfer->actual_length & 0x01)) {
 			sr_dbg("Received invalid stored SPL packet.");
 		} else {
+			/* Decode the chunk in one go, and batch it up. */
 			num_samples = (transfer->actual_length - 1) / 2;
-			for (i = 0; i < num_samples; i++) {
-				fvalue[i] = transfer->buffer[1 + i * 2] << 8;
-				fvalue[i] += transfer->buffer[1 + i * 2 + 1];
-				fvalue[i] /= 10.0;
+			buf = transfer->buffer + 1;
+			for (i = 0; i < num_samples; i++, buf += 2) {
+				/* Big endian, in tenths of a dB. */
+				fvalue[i] = (buf[0] << 8 | buf[1]) / 10.0;
 			}
-			send_data(sdi, fvalue, 1);
+			memset(&analog, 0, sizeof(struct sr_datafeed_analog));
+			analog.mq = SR_MQ_SOUND_PRESSURE_LEVEL;
+			analog.mqflags = devc->mqflags;
+			analog.unit = SR_UNIT_DECIBEL_SPL;
+			analog.probes = sdi->probes;
+			analog.num_samples = num_samples;
+			analog.data = fvalue;
+			sr_analog_batch_add_stored(&devc->batch, &analog,
+					devc->log_time, devc->log_interval);
+			devc->log_time += num_samples * devc->log_interval;
 			devc->num_samples += num_samples;
 			if (devc->num_samples >= devc->stored_samples) {
 				sdi->driver->dev_acquisition_stop((struct sr_dev_inst *)sdi,
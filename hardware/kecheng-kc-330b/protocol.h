@@ -28,11 +28,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "kecheng-kc-330b: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define EP_IN 0x80 | 1
 #define EP_OUT 2
@@ -46,6 +46,15 @@
 /* Live */
 #define DEFAULT_DATA_SOURCE DATA_SOURCE_LIVE
 
+/* Stored samples the device returns per log data request. */
+#define LOG_CHUNK_SAMPLES 63
+/* Stored samples sent in one analog packet, 16 chunks' worth. */
+#define LOG_BATCH_SAMPLES (16 * LOG_CHUNK_SAMPLES)
+/* Log data requests made back to back per poll of the USB events. */
+#define LOG_CHUNKS_PER_POLL 16
+/* How long to wait for each of those, in ms. */
+#define LOG_CHUNK_TIMEOUT 20
+
 enum {
 	LIVE_SPL_IDLE,
 	LIVE_SPL_WAIT,
@@ -92,6 +101,11 @@ struct dev_context {
 	int usbfd[10];
 	struct libusb_transfer *xfer;
 	unsigned char buf[128];
+	/* Decoded stored samples not sent yet. */
+	struct sr_analog_batch batch;
+	/* When the next stored sample was taken, and their interval, in us. */
+	int64_t log_time;
+	int64_t log_interval;
 
 	/* Temporary state across callbacks */
 	gint64 last_live_request;
@@ -45,6 +45,11 @@ static int dev_clear(void)
 
 static int init(struct sr_context *sr_ctx)
 {
+	int ret;
+
+	if ((ret = sr_usb_init(sr_ctx)) != SR_OK)
+		return ret;
+
 	return std_init(sr_ctx, di, LOG_PREFIX);
 }
 
@@ -72,7 +77,7 @@ static GSList *scan(GSList *options)
 		return NULL;
 
 	devices = NULL;
-	if ((usb_devices = sr_usb_find(drvc->sr_ctx->libusb_ctx, conn))) {
+	if ((usb_devices = sr_usb_find(drvc->sr_ctx, conn))) {
 		/* We have a list of sr_usb_dev_inst matching the connection
 		 * string. Wrap them in sr_dev_inst and we're done. */
 		for (l = usb_devices; l; l = l->next) {
@@ -438,6 +443,7 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 		return SR_ERR;
 	}
 	devc->log_size = xfer_in->buffer[1] + (xfer_in->buffer[2] << 8);
+	libusb_free_transfer(xfer_in);
 	libusb_free_transfer(xfer_out);
 
 	pfd = libusb_get_pollfds(drvc->sr_ctx->libusb_ctx);
@@ -450,13 +456,54 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	}
 	devc->usbfd[i] = -1;
 
-	buf = g_try_malloc(4096);
-	libusb_fill_bulk_transfer(xfer_in, usb->devhdl, LASCAR_EP_IN,
-			buf, 4096, lascar_el_usb_receive_transfer, cb_data, 100);
-	if ((ret = libusb_submit_transfer(xfer_in) != 0)) {
-		sr_err("Unable to submit transfer: %s.", libusb_error_name(ret));
-		libusb_free_transfer(xfer_in);
-		g_free(buf);
+	devc->rcvd_bytes = 0;
+	devc->rcvd_samples = 0;
+	devc->batch_samples = 0;
+	devc->xfers_cancelled = FALSE;
+	devc->num_xfers = 0;
+	devc->batch[0] = devc->batch[1] = NULL;
+	for (i = 0; i < 2; i++) {
+		if (!(devc->batch[i] = g_try_malloc(sizeof(float)
+				* LASCAR_BATCH_SAMPLES))) {
+			sr_err("%s: batch malloc failed", __func__);
+			break;
+		}
+	}
+
+	/* Keep several transfers queued, so the device never waits for us. */
+	for (i = 0; i < LASCAR_NUM_XFERS && devc->batch[1]; i++) {
+		if (!(buf = g_try_malloc(LASCAR_XFER_SIZE))) {
+			sr_err("%s: buf malloc failed", __func__);
+			break;
+		}
+		if (!(xfer_in = libusb_alloc_transfer(0))) {
+			g_free(buf);
+			break;
+		}
+		libusb_fill_bulk_transfer(xfer_in, usb->devhdl, LASCAR_EP_IN,
+				buf, LASCAR_XFER_SIZE,
+				lascar_el_usb_receive_transfer, (void *)sdi,
+				100);
+		if ((ret = libusb_submit_transfer(xfer_in)) != 0) {
+			sr_err("Unable to submit transfer: %s.",
+			       libusb_error_name(ret));
+			libusb_free_transfer(xfer_in);
+			g_free(buf);
+			break;
+		}
+		devc->xfers[i] = xfer_in;
+		devc->num_xfers++;
+	}
+	for (; i < LASCAR_NUM_XFERS; i++)
+		devc->xfers[i] = NULL;
+
+	if (devc->num_xfers == 0) {
+		for (i = 0; devc->usbfd[i] != -1; i++)
+			sr_source_remove(devc->usbfd[i]);
+		for (i = 0; i < 2; i++) {
+			g_free(devc->batch[i]);
+			devc->batch[i] = NULL;
+		}
 		return SR_ERR;
 	}
 
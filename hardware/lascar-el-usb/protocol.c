@@ -368,7 +368,7 @@ SR_PRIV struct sr_dev_inst *lascar_scan(int bus, int address)
 	drvc = di->priv;
 	sdi = NULL;
 
-	libusb_get_device_list(drvc->sr_ctx->libusb_ctx, &devlist);
+	sr_usb_get_device_list(drvc->sr_ctx, &devlist);
 	for (i = 0; devlist[i]; i++) {
 		if ((ret = libusb_get_device_descriptor(devlist[i], &des))) {
 			sr_err("Failed to get device descriptor: %d.", ret);
@@ -392,16 +392,82 @@ SR_PRIV struct sr_dev_inst *lascar_scan(int bus, int address)
 	return sdi;
 }
 
-static void lascar_el_usb_dispatch(struct sr_dev_inst *sdi, unsigned char *buf,
-		int buflen)
+static void send_batch(const struct sr_dev_inst *sdi, GSList *probes,
+		int mq, int unit, float *data)
 {
 	struct dev_context *devc;
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_analog analog;
+
+	devc = sdi->priv;
+
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	analog.probes = probes;
+	analog.num_samples = devc->batch_samples;
+	analog.mq = mq;
+	analog.unit = unit;
+	analog.mqflags = 0;
+	analog.data = data;
+	sr_session_send(devc->cb_data, &packet);
+}
+
+/* Send the decoded samples collected so far, one packet per probe. */
+static void lascar_el_usb_flush(const struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
 	struct sr_probe *probe;
-	float *temp, *rh;
+	GSList *probes;
+	int unit;
+
+	devc = sdi->priv;
+
+	if (devc->batch_samples == 0)
+		return;
+
+	switch (devc->profile->logformat) {
+	case LOG_TEMP_RH:
+		probe = sdi->probes->data;
+		if (probe->enabled) {
+			probes = g_slist_append(NULL, probe);
+			if (devc->temp_unit == 1)
+				unit = SR_UNIT_FAHRENHEIT;
+			else
+				unit = SR_UNIT_CELSIUS;
+			send_batch(sdi, probes, SR_MQ_TEMPERATURE, unit,
+					devc->batch[0]);
+			g_slist_free(probes);
+		}
+
+		probe = sdi->probes->next->data;
+		if (probe->enabled) {
+			probes = g_slist_append(NULL, probe);
+			send_batch(sdi, probes, SR_MQ_RELATIVE_HUMIDITY,
+					SR_UNIT_PERCENTAGE, devc->batch[1]);
+			g_slist_free(probes);
+		}
+		break;
+	case LOG_CO:
+		send_batch(sdi, sdi->probes, SR_MQ_CARBON_MONOXIDE,
+				SR_UNIT_CONCENTRATION, devc->batch[0]);
+		break;
+	default:
+		break;
+	}
+	devc->batch_samples = 0;
+}
+
+/*
+ * Decode the log records in a received buffer into the batch, which is
+ * sent whenever it fills up, and at the end of the download.
+ */
+static void lascar_el_usb_dispatch(struct sr_dev_inst *sdi, unsigned char *buf,
+		int buflen)
+{
+	struct dev_context *devc;
+	float temp, rh, co;
 	uint16_t s;
-	int samples, samples_left, i, j;
+	int samples, samples_left, i;
 
 	devc = sdi->priv;
 
@@ -411,72 +477,39 @@ static void lascar_el_usb_dispatch(struct sr_dev_inst *sdi, unsigned char *buf,
 		samples = samples_left;
 	switch (devc->profile->logformat) {
 	case LOG_TEMP_RH:
-		packet.type = SR_DF_ANALOG;
-		packet.payload = &analog;
-		analog.mqflags = 0;
-		if (!(temp = g_try_malloc(sizeof(float) * samples)))
-			break;
-		if (!(rh = g_try_malloc(sizeof(float) * samples)))
-			break;
-		for (i = 0, j = 0; i < samples; i++) {
+		for (i = 0; i < samples; i++) {
 			/* Both Celcius and Fahrenheit stored at base -40. */
 			if (devc->temp_unit == 0)
 				/* Celcius is stored in half-degree increments. */
-				temp[j] = buf[i * 2] / 2 - 40;
+				temp = buf[i * 2] / 2 - 40;
 			else
-				temp[j] = buf[i * 2] - 40;
+				temp = buf[i * 2] - 40;
 
-			rh[j] = buf[i * 2 + 1] / 2;
+			rh = buf[i * 2 + 1] / 2;
 
-			if (temp[j] == 0.0 && rh[j] == 0.0)
+			if (temp == 0.0 && rh == 0.0)
 				/* Skip invalid measurement. */
 				continue;
-			j++;
-		}
-		analog.num_samples = j;
 
-		probe = sdi->probes->data;
-		if (probe->enabled) {
-			analog.probes = g_slist_append(NULL, probe);
-			analog.mq = SR_MQ_TEMPERATURE;
-			if (devc->temp_unit == 1)
-				analog.unit = SR_UNIT_FAHRENHEIT;
-			else
-				analog.unit = SR_UNIT_CELSIUS;
-			analog.data = temp;
-			sr_session_send(devc->cb_data, &packet);
+			if (devc->batch_samples == LASCAR_BATCH_SAMPLES)
+				lascar_el_usb_flush(sdi);
+			devc->batch[0][devc->batch_samples] = temp;
+			devc->batch[1][devc->batch_samples] = rh;
+			devc->batch_samples++;
 		}
-
-		probe = sdi->probes->next->data;
-		if (probe->enabled) {
-			analog.probes = g_slist_append(NULL, probe);
-			analog.mq = SR_MQ_RELATIVE_HUMIDITY;
-			analog.unit = SR_UNIT_PERCENTAGE;
-			analog.data = rh;
-			sr_session_send(devc->cb_data, &packet);
-		}
-
-		g_free(temp);
-		g_free(rh);
 		break;
 	case LOG_CO:
-		packet.type = SR_DF_ANALOG;
-		packet.payload = &analog;
-		analog.probes = sdi->probes;
-		analog.num_samples = samples;
-		analog.mq = SR_MQ_CARBON_MONOXIDE;
-		analog.unit = SR_UNIT_CONCENTRATION;
-		analog.mqflags = 0;
-		if (!(analog.data = g_try_malloc(sizeof(float) * samples)))
-			break;
 		for (i = 0; i < samples; i++) {
 			s = (buf[i * 2] << 8) | buf[i * 2 + 1];
-			analog.data[i] = (s * devc->co_high + devc->co_low) / 1000000;
-			if (analog.data[i] < 0.0)
-				analog.data[i] = 0.0;
+			co = (s * devc->co_high + devc->co_low) / 1000000;
+			if (co < 0.0)
+				co = 0.0;
+
+			if (devc->batch_samples == LASCAR_BATCH_SAMPLES)
+				lascar_el_usb_flush(sdi);
+			devc->batch[0][devc->batch_samples] = co;
+			devc->batch_samples++;
 		}
-		sr_session_send(devc->cb_data, &packet);
-		g_free(analog.data);
 		break;
 	default:
 		/* How did we even get this far? */
@@ -501,21 +534,62 @@ SR_PRIV int lascar_el_usb_handle_events(int fd, int revents, void *cb_data)
 	sdi = cb_data;
 	devc = sdi->priv;
 
-	if (sdi->status == SR_ST_STOPPING) {
+	if (sdi->status == SR_ST_STOPPING && !devc->xfers_cancelled) {
+		/* The others may be waiting for data which never comes. */
+		for (i = 0; i < LASCAR_NUM_XFERS; i++) {
+			if (devc->xfers[i])
+				libusb_cancel_transfer(devc->xfers[i]);
+		}
+		devc->xfers_cancelled = TRUE;
+	}
+
+	memset(&tv, 0, sizeof(struct timeval));
+	libusb_handle_events_timeout_completed(drvc->sr_ctx->libusb_ctx, &tv,
+					       NULL);
+
+	/* Only finish once all transfers came back. */
+	if (sdi->status == SR_ST_STOPPING && devc->num_xfers == 0) {
 		for (i = 0; devc->usbfd[i] != -1; i++)
 			sr_source_remove(devc->usbfd[i]);
 
+		lascar_el_usb_flush(sdi);
+		for (i = 0; i < 2; i++) {
+			g_free(devc->batch[i]);
+			devc->batch[i] = NULL;
+		}
+
 		packet.type = SR_DF_END;
 		sr_session_send(cb_data, &packet);
+		sdi->status = SR_ST_ACTIVE;
 	}
 
-	memset(&tv, 0, sizeof(struct timeval));
-	libusb_handle_events_timeout_completed(drvc->sr_ctx->libusb_ctx, &tv,
-					       NULL);
-
 	return TRUE;
 }
 
+static void free_transfer(struct libusb_transfer *transfer)
+{
+	struct dev_context *devc;
+	struct sr_dev_inst *sdi;
+	int i;
+
+	sdi = transfer->user_data;
+	devc = sdi->priv;
+
+	for (i = 0; i < LASCAR_NUM_XFERS; i++) {
+		if (devc->xfers[i] == transfer) {
+			devc->xfers[i] = NULL;
+			break;
+		}
+	}
+	g_free(transfer->buffer);
+	libusb_free_transfer(transfer);
+	devc->num_xfers--;
+}
+
+/*
+ * Bulk IN transfers on one endpoint complete in the order they were
+ * submitted, so with several in flight the log still arrives in order.
+ */
 SR_PRIV void lascar_el_usb_receive_transfer(struct libusb_transfer *transfer)
 {
 	struct dev_context *devc;
@@ -530,7 +604,9 @@ SR_PRIV void lascar_el_usb_receive_transfer(struct libusb_transfer *transfer)
 	switch (transfer->status) {
 	case LIBUSB_TRANSFER_NO_DEVICE:
 		/* USB device was unplugged. */
-		dev_acquisition_stop(sdi, sdi);
+		free_transfer(transfer);
+		if (sdi->status == SR_ST_ACTIVE)
+			dev_acquisition_stop(sdi, sdi);
 		return;
 	case LIBUSB_TRANSFER_COMPLETED:
 	case LIBUSB_TRANSFER_TIMED_OUT: /* We may have received some data though */
@@ -540,7 +616,7 @@ SR_PRIV void lascar_el_usb_receive_transfer(struct libusb_transfer *transfer)
 		break;
 	}
 
-	if (!packet_has_error) {
+	if (!packet_has_error && devc->rcvd_bytes < devc->log_size) {
 		if (devc->rcvd_samples < devc->logged_samples)
 			lascar_el_usb_dispatch(sdi, transfer->buffer,
 					transfer->actual_length);
@@ -548,24 +624,23 @@ SR_PRIV void lascar_el_usb_receive_transfer(struct libusb_transfer *transfer)
 		sr_spew("received %d/%d bytes (%d/%d samples)",
 				devc->rcvd_bytes, devc->log_size,
 				devc->rcvd_samples, devc->logged_samples);
-		if (devc->rcvd_bytes >= devc->log_size)
+		if (devc->rcvd_bytes >= devc->log_size
+		    && sdi->status == SR_ST_ACTIVE)
 			dev_acquisition_stop(sdi, sdi);
 	}
 
 	if (sdi->status == SR_ST_ACTIVE) {
 		/* Send the same request again. */
-		if ((ret = libusb_submit_transfer(transfer) != 0)) {
+		if ((ret = libusb_submit_transfer(transfer)) != 0) {
 			sr_err("Unable to resubmit transfer: %s.",
 			       libusb_error_name(ret));
-			g_free(transfer->buffer);
-			libusb_free_transfer(transfer);
+			free_transfer(transfer);
 			dev_acquisition_stop(sdi, sdi);
 		}
 	} else {
 		/* This was the last transfer we're going to receive, so
 		 * clean up now. */
-		g_free(transfer->buffer);
-		libusb_free_transfer(transfer);
+		free_transfer(transfer);
 	}
 
 }
@@ -27,11 +27,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "lascar-el-usb: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define LASCAR_VENDOR "Lascar"
 #define LASCAR_INTERFACE 0
@@ -40,6 +40,11 @@
 /* Max 100ms for a device to positively identify. */
 #define SCAN_TIMEOUT 100000
 #define MAX_CONFIGBLOCK_SIZE 256
+/* Log download: bulk IN transfers kept in flight, and their size. */
+#define LASCAR_NUM_XFERS 4
+#define LASCAR_XFER_SIZE 4096
+/* Decoded samples per probe sent in one analog packet. */
+#define LASCAR_BATCH_SAMPLES 4096
 
 /** Private, per-device-instance driver context. */
 struct dev_context {
@@ -54,6 +59,13 @@ struct dev_context {
 	unsigned int logged_samples;
 	unsigned int rcvd_samples;
 	uint64_t limit_samples;
+	/* Log download in progress */
+	struct libusb_transfer *xfers[LASCAR_NUM_XFERS];
+	int num_xfers;
+	gboolean xfers_cancelled;
+	/* Decoded samples not sent yet, per probe. */
+	float *batch[2];
+	unsigned int batch_samples;
 	/* Model-specific */
 	/* EL-USB-CO: these are something like scaling and calibration values
 	 * fixed per device, used to convert the sample values to CO ppm. */
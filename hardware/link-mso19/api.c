@@ -80,6 +80,7 @@ static int dev_clear(void)
 			continue;
 		}
 		dev_close(sdi);
+		g_slist_free(devc->analog_probes);
 		sr_serial_dev_inst_free(devc->serial);
 		sr_dev_inst_free(sdi);
 	}
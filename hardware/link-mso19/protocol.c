@@ -354,13 +354,65 @@ SR_PRIV int mso_check_trigger(struct sr_serial_dev_inst *serial, uint8_t *info)
 	return ret;
 }
 
-SR_PRIV int mso_receive_data(int fd, int revents, void *cb_data)
+/*
+ * Send a dump of samples. Every 24-bit word holds a 10-bit ADC reading
+ * and the 8 logic probes, both are unpacked in the same pass.
+ */
+static void mso_send_samples(struct sr_dev_inst *sdi, void *cb_data)
 {
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_logic logic;
+	struct sr_datafeed_analog_raw analog;
+	struct dev_context *devc;
+	const uint8_t *p;
+	uint8_t logic_out[MSO_NUM_SAMPLES];
+	int16_t analog_out[MSO_NUM_SAMPLES];
+	float scale, offset;
+	int i;
+
+	devc = sdi->priv;
+
+	p = devc->buffer;
+	for (i = 0; i < MSO_NUM_SAMPLES; i++, p += 3) {
+		analog_out[i] = (p[0] & 0x3f) | ((p[1] & 0xf) << 6);
+		logic_out[i] = ((p[1] & 0x30) >> 4) | ((p[2] & 0x3f) << 2);
+	}
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.length = MSO_NUM_SAMPLES;
+	logic.unitsize = 1;
+	logic.data = logic_out;
+	sr_session_send(cb_data, &packet);
+
+	if (devc->analog_probes) {
+		/*
+		 * The ADC reads 0x200 at 0 V, and goes down by vbit mV per
+		 * step of the input voltage, see mso_calc_raw_from_mv().
+		 */
+		scale = -devc->vbit * devc->dso_probe_attn / 1000;
+		offset = 0x200 * devc->vbit * devc->dso_probe_attn / 1000;
+		packet.type = SR_DF_ANALOG_RAW;
+		packet.payload = &analog;
+		analog.probes = devc->analog_probes;
+		analog.num_samples = MSO_NUM_SAMPLES;
+		analog.mq = SR_MQ_VOLTAGE;
+		analog.unit = SR_UNIT_VOLT;
+		analog.mqflags = 0;
+		analog.encoding = SR_ANALOG_S16;
+		analog.scale = &scale;
+		analog.offset = &offset;
+		analog.data = analog_out;
+		sr_session_send(cb_data, &packet);
+	}
+}
+
+SR_PRIV int mso_receive_data(int fd, int revents, void *cb_data)
+{
 	struct sr_dev_inst *sdi;
 	GSList *l;
-	int i;
+	uint8_t in[1024];
+	int s;
 
 	struct drv_context *drvc = di->priv;
 
@@ -379,15 +431,11 @@ SR_PRIV int mso_receive_data(int fd, int revents, void *cb_data)
 
 	(void)revents;
 
-	uint8_t in[1024];
-	size_t s = serial_read(devc->serial, in, sizeof(in));
-
-	if (s <= 0)
-		return FALSE;
-
 	/* Check if we triggered, then send a command that we are ready
 	 * to read the data */
 	if (devc->trigger_state != MSO_TRIGGER_DATAREADY) {
+		if ((s = serial_read(devc->serial, in, sizeof(in))) <= 0)
+			return FALSE;
 		devc->trigger_state = in[0];
 		if (devc->trigger_state == MSO_TRIGGER_DATAREADY) {
 			mso_read_buffer(sdi);
@@ -398,34 +446,18 @@ SR_PRIV int mso_receive_data(int fd, int revents, void *cb_data)
 		return TRUE;
 	}
 
-	/* the hardware always dumps 1024 samples, 24bits each */
-	if (devc->buffer_n < 3072) {
-		memcpy(devc->buffer + devc->buffer_n, in, s);
-		devc->buffer_n += s;
-	}
-	if (devc->buffer_n < 3072)
+	/* Read the dump straight into the buffer it is unpacked from. */
+	s = serial_read(devc->serial, devc->buffer + devc->buffer_n,
+			sizeof(devc->buffer) - devc->buffer_n);
+	if (s <= 0)
+		return FALSE;
+	devc->buffer_n += s;
+	if (devc->buffer_n < sizeof(devc->buffer))
 		return TRUE;
 
-	/* do the conversion */
-	uint8_t logic_out[1024];
-	double analog_out[1024];
-	for (i = 0; i < 1024; i++) {
-		/* FIXME: Need to do conversion to mV */
-		analog_out[i] = (devc->buffer[i * 3] & 0x3f) |
-		    ((devc->buffer[i * 3 + 1] & 0xf) << 6);
-		(void)analog_out;
-		logic_out[i] = ((devc->buffer[i * 3 + 1] & 0x30) >> 4) |
-		    ((devc->buffer[i * 3 + 2] & 0x3f) << 2);
-	}
-
-	packet.type = SR_DF_LOGIC;
-	packet.payload = &logic;
-	logic.length = 1024;
-	logic.unitsize = 1;
-	logic.data = logic_out;
-	sr_session_send(cb_data, &packet);
-
-	devc->num_samples += 1024;
+	mso_send_samples(sdi, cb_data);
+	devc->buffer_n = 0;
+	devc->num_samples += MSO_NUM_SAMPLES;
 
 	if (devc->limit_samples && devc->num_samples >= devc->limit_samples) {
 		sr_info("Requested number of samples reached.");
@@ -452,11 +484,20 @@ SR_PRIV int mso_configure_probes(const struct sr_dev_inst *sdi)
 	devc->trigger_chan = 3;	//LA combination trigger
 	devc->use_trigger = FALSE;
 
+	g_slist_free(devc->analog_probes);
+	devc->analog_probes = NULL;
+
 	for (l = sdi->probes; l; l = l->next) {
 		probe = (struct sr_probe *)l->data;
 		if (probe->enabled == FALSE)
 			continue;
 
+		if (probe->type == SR_PROBE_ANALOG) {
+			devc->analog_probes = g_slist_append(
+					devc->analog_probes, probe);
+			continue;
+		}
+
 		int probe_bit = 1 << (probe->index);
 		if (!(probe->trigger))
 			continue;
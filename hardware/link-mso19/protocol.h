@@ -32,11 +32,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "mso19: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define USB_VENDOR		"3195"
 #define USB_PRODUCT		"f190"
@@ -48,6 +48,8 @@
 #define SERIALCONN		"/dev/ttyUSB0"
 #define CLOCK_RATE		SR_MHZ(100)
 #define MIN_NUM_SAMPLES		4
+/* The hardware always dumps this many samples, 24 bits each. */
+#define MSO_NUM_SAMPLES		1024
 
 #define MSO_TRIGGER_UNKNOWN	'!'
 #define MSO_TRIGGER_UNKNOWN1	'1'
@@ -124,8 +126,10 @@ struct dev_context {
 	uint16_t dso_trigger_width;
 	struct mso_prototrig protocol_trigger;
 	void *cb_data;
+	/* The analog probe, if it is enabled. */
+	GSList *analog_probes;
 	uint16_t buffer_n;
-	char buffer[4096];
+	uint8_t buffer[MSO_NUM_SAMPLES * 3];
 };
 
 SR_PRIV int mso_parse_serial(const char *iSerial, const char *iProduct,
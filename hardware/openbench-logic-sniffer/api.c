@@ -30,6 +30,7 @@ static const int32_t hwcaps[] = {
 	SR_CONF_LOGIC_ANALYZER,
 	SR_CONF_SAMPLERATE,
 	SR_CONF_TRIGGER_TYPE,
+	SR_CONF_TRIGGER_STAGES,
 	SR_CONF_CAPTURE_RATIO,
 	SR_CONF_LIMIT_SAMPLES,
 	SR_CONF_EXTERNAL_CLOCK,
@@ -225,6 +226,13 @@ static int dev_open(struct sr_dev_inst *sdi)
 static int dev_close(struct sr_dev_inst *sdi)
 {
 	struct sr_serial_dev_inst *serial;
+	struct dev_context *devc;
+
+	/* Left over from an acquisition that failed to start. */
+	if ((devc = sdi->priv)) {
+		sr_dev_mem_free(sdi, devc->raw_sample_buf);
+		devc->raw_sample_buf = NULL;
+	}
 
 	serial = sdi->conn;
 	if (serial && serial->fd != -1) {
@@ -244,6 +252,7 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 		const struct sr_probe_group *probe_group)
 {
 	struct dev_context *devc;
+	char *stages;
 
 	(void)probe_group;
 
@@ -270,6 +279,11 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 	case SR_CONF_RLE:
 		*data = g_variant_new_boolean(devc->flag_reg & FLAG_RLE ? TRUE : FALSE);
 		break;
+	case SR_CONF_TRIGGER_STAGES:
+		stages = ols_trigger_stages_format(devc);
+		*data = g_variant_new_string(stages);
+		g_free(stages);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -358,6 +372,10 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 		}
 		ret = SR_OK;
 		break;
+	case SR_CONF_TRIGGER_STAGES:
+		ret = ols_trigger_stages_parse(devc,
+				g_variant_get_string(data, NULL));
+		break;
 	default:
 		ret = SR_ERR_NA;
 	}
@@ -408,7 +426,6 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 {
 	struct dev_context *devc;
 	struct sr_serial_dev_inst *serial;
-	uint32_t trigger_config[4];
 	uint32_t data;
 	uint16_t readcount, delaycount;
 	uint8_t changrp_mask;
@@ -426,6 +443,14 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 		return SR_ERR;
 	}
 
+	/* Before the device is set up, so this can fail cleanly. */
+	sr_dev_mem_free(sdi, devc->raw_sample_buf);
+	if (!(devc->raw_sample_buf = sr_dev_mem_alloc(sdi,
+			devc->limit_samples * 4))) {
+		sr_err("Sample buffer malloc failed.");
+		return SR_ERR_MALLOC;
+	}
+
 	/*
 	 * Enable/disable channel groups in the flag register according to the
 	 * probe mask. Calculate this here, because num_channels is needed
@@ -446,63 +471,14 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 	 */
 	readcount = MIN(devc->max_samples / num_channels, devc->limit_samples) / 4;
 
-	memset(trigger_config, 0, 16);
-	trigger_config[devc->num_stages] |= 0x08;
-	if (devc->trigger_mask[0]) {
+	if (devc->trigger_mask[0] || devc->num_stage_cfgs) {
 		delaycount = readcount * (1 - devc->capture_ratio / 100.0);
 		devc->trigger_at = (readcount - delaycount) * 4 - devc->num_stages;
-
-		if (send_longcommand(serial, CMD_SET_TRIGGER_MASK_0,
-			reverse32(devc->trigger_mask[0])) != SR_OK)
-			return SR_ERR;
-		if (send_longcommand(serial, CMD_SET_TRIGGER_VALUE_0,
-			reverse32(devc->trigger_value[0])) != SR_OK)
-			return SR_ERR;
-		if (send_longcommand(serial, CMD_SET_TRIGGER_CONFIG_0,
-			trigger_config[0]) != SR_OK)
-			return SR_ERR;
-
-		if (send_longcommand(serial, CMD_SET_TRIGGER_MASK_1,
-			reverse32(devc->trigger_mask[1])) != SR_OK)
-			return SR_ERR;
-		if (send_longcommand(serial, CMD_SET_TRIGGER_VALUE_1,
-			reverse32(devc->trigger_value[1])) != SR_OK)
-			return SR_ERR;
-		if (send_longcommand(serial, CMD_SET_TRIGGER_CONFIG_1,
-			trigger_config[1]) != SR_OK)
-			return SR_ERR;
-
-		if (send_longcommand(serial, CMD_SET_TRIGGER_MASK_2,
-			reverse32(devc->trigger_mask[2])) != SR_OK)
-			return SR_ERR;
-		if (send_longcommand(serial, CMD_SET_TRIGGER_VALUE_2,
-			reverse32(devc->trigger_value[2])) != SR_OK)
-			return SR_ERR;
-		if (send_longcommand(serial, CMD_SET_TRIGGER_CONFIG_2,
-			trigger_config[2]) != SR_OK)
-			return SR_ERR;
-
-		if (send_longcommand(serial, CMD_SET_TRIGGER_MASK_3,
-			reverse32(devc->trigger_mask[3])) != SR_OK)
-			return SR_ERR;
-		if (send_longcommand(serial, CMD_SET_TRIGGER_VALUE_3,
-			reverse32(devc->trigger_value[3])) != SR_OK)
-			return SR_ERR;
-		if (send_longcommand(serial, CMD_SET_TRIGGER_CONFIG_3,
-			trigger_config[3]) != SR_OK)
-			return SR_ERR;
 	} else {
-		if (send_longcommand(serial, CMD_SET_TRIGGER_MASK_0,
-				devc->trigger_mask[0]) != SR_OK)
-			return SR_ERR;
-		if (send_longcommand(serial, CMD_SET_TRIGGER_VALUE_0,
-				devc->trigger_value[0]) != SR_OK)
-			return SR_ERR;
-		if (send_longcommand(serial, CMD_SET_TRIGGER_CONFIG_0,
-		     0x00000008) != SR_OK)
-			return SR_ERR;
 		delaycount = readcount;
 	}
+	if (ols_trigger_send(sdi) != SR_OK)
+		return SR_ERR;
 
 	sr_info("Setting samplerate to %" PRIu64 "Hz (divider %u, "
 		"demux %s, noise_filter %s)", devc->cur_samplerate,
@@ -17,6 +17,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <stdlib.h>
 #include "protocol.h"
 
 extern SR_PRIV struct sr_dev_driver ols_driver_info;
@@ -56,8 +58,9 @@ SR_PRIV int ols_configure_probes(const struct sr_dev_inst *sdi)
 {
 	struct dev_context *devc;
 	const struct sr_probe *probe;
+	const struct ols_trigger_stage *cfg;
 	const GSList *l;
-	int probe_bit, stage, i;
+	int probe_bit, stage, num_stages, i;
 	char *tc;
 
 	devc = sdi->priv;
@@ -68,7 +71,7 @@ SR_PRIV int ols_configure_probes(const struct sr_dev_inst *sdi)
 		devc->trigger_value[i] = 0;
 	}
 
-	devc->num_stages = 0;
+	num_stages = 0;
 	for (l = sdi->probes; l; l = l->next) {
 		probe = (const struct sr_probe *)l->data;
 		if (!probe->enabled)
@@ -92,19 +95,228 @@ SR_PRIV int ols_configure_probes(const struct sr_dev_inst *sdi)
 		/* Configure trigger mask and value. */
 		stage = 0;
 		for (tc = probe->trigger; tc && *tc; tc++) {
+			if (stage == NUM_TRIGGER_STAGES) {
+				sr_err("Triggers of over %d stages are not "
+				       "supported.", NUM_TRIGGER_STAGES);
+				return SR_ERR;
+			}
 			devc->trigger_mask[stage] |= probe_bit;
 			if (*tc == '1')
 				devc->trigger_value[stage] |= probe_bit;
 			stage++;
-			if (stage > 3)
-				/*
-				 * TODO: Only supporting parallel mode, with
-				 * up to 4 stages.
-				 */
-				return SR_ERR;
 		}
-		if (stage > devc->num_stages)
-			devc->num_stages = stage - 1;
+		num_stages = MAX(num_stages, stage);
+	}
+
+	/*
+	 * Stages set up with SR_CONF_TRIGGER_STAGES take part even without
+	 * a trigger string reaching them, and serial ones match the bits
+	 * shifted in from their probe rather than the parallel ones.
+	 */
+	for (i = 0; i < devc->num_stage_cfgs; i++) {
+		cfg = &devc->stage_cfg[i];
+		if (cfg->has_mask) {
+			devc->trigger_mask[i] = cfg->mask;
+			devc->trigger_value[i] = cfg->value;
+		}
+	}
+	num_stages = MAX(num_stages, devc->num_stage_cfgs);
+	devc->num_stages = MAX(num_stages - 1, 0);
+
+	return SR_OK;
+}
+
+static int parse_setting(struct ols_trigger_stage *cfg, const char *setting)
+{
+	const char *arg;
+	char *end;
+	unsigned long val;
+
+	if (!strcmp(setting, "start")) {
+		cfg->start = TRUE;
+		return SR_OK;
+	}
+
+	if (!(arg = strchr(setting, '=')) || !arg[1]) {
+		sr_err("Invalid trigger stage setting '%s'.", setting);
+		return SR_ERR_ARG;
+	}
+	arg++;
+	errno = 0;
+	val = strtoul(arg, &end, 0);
+	if (errno || *end || val > 0xffffffff) {
+		sr_err("Invalid trigger stage setting '%s'.", setting);
+		return SR_ERR_ARG;
+	}
+
+	if (!strncmp(setting, "delay=", 6) && val <= TRIGGER_DELAY_MAX) {
+		cfg->delay = val;
+	} else if (!strncmp(setting, "level=", 6) && val <= TRIGGER_LEVEL_MAX) {
+		cfg->level = val;
+	} else if (!strncmp(setting, "serial=", 7) && val < NUM_PROBES) {
+		cfg->channel = val;
+	} else if (!strncmp(setting, "mask=", 5)) {
+		cfg->mask = val;
+		cfg->has_mask = TRUE;
+	} else if (!strncmp(setting, "value=", 6)) {
+		cfg->value = val;
+		cfg->has_mask = TRUE;
+	} else {
+		sr_err("Invalid trigger stage setting '%s'.", setting);
+		return SR_ERR_ARG;
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Parse the SR_CONF_TRIGGER_STAGES string into the device's stage settings.
+ *
+ * An empty string clears them, leaving the trigger strings alone to set up
+ * the stages. On error, the previous settings stay in place.
+ *
+ * @private
+ */
+SR_PRIV int ols_trigger_stages_parse(struct dev_context *devc,
+		const char *spec)
+{
+	struct ols_trigger_stage cfg[NUM_TRIGGER_STAGES];
+	char **stages, **settings;
+	int num_cfgs, ret, i, j;
+
+	stages = g_strsplit(spec, ";", 0);
+	num_cfgs = *spec ? g_strv_length(stages) : 0;
+	if (num_cfgs > NUM_TRIGGER_STAGES) {
+		sr_err("Only %d trigger stages are supported.",
+		       NUM_TRIGGER_STAGES);
+		g_strfreev(stages);
+		return SR_ERR_ARG;
+	}
+
+	ret = SR_OK;
+	for (i = 0; i < num_cfgs && ret == SR_OK; i++) {
+		cfg[i].delay = 0;
+		cfg[i].level = -1;
+		cfg[i].channel = -1;
+		cfg[i].has_mask = FALSE;
+		cfg[i].mask = cfg[i].value = 0;
+		cfg[i].start = FALSE;
+		settings = g_strsplit(stages[i], ",", 0);
+		for (j = 0; settings[j] && ret == SR_OK; j++) {
+			g_strstrip(settings[j]);
+			if (*settings[j])
+				ret = parse_setting(&cfg[i], settings[j]);
+		}
+		g_strfreev(settings);
+	}
+	g_strfreev(stages);
+	if (ret != SR_OK)
+		return ret;
+
+	memcpy(devc->stage_cfg, cfg, num_cfgs * sizeof(cfg[0]));
+	devc->num_stage_cfgs = num_cfgs;
+
+	return SR_OK;
+}
+
+/**
+ * Turn the device's stage settings back into an SR_CONF_TRIGGER_STAGES
+ * string, which the caller must g_free().
+ *
+ * @private
+ */
+SR_PRIV char *ols_trigger_stages_format(const struct dev_context *devc)
+{
+	const struct ols_trigger_stage *cfg;
+	GString *str;
+	int i;
+
+	str = g_string_new("");
+	for (i = 0; i < devc->num_stage_cfgs; i++) {
+		cfg = &devc->stage_cfg[i];
+		if (i)
+			g_string_append_c(str, ';');
+		g_string_append_printf(str, "delay=%u", cfg->delay);
+		if (cfg->level >= 0)
+			g_string_append_printf(str, ",level=%d", cfg->level);
+		if (cfg->channel >= 0)
+			g_string_append_printf(str, ",serial=%d", cfg->channel);
+		if (cfg->has_mask)
+			g_string_append_printf(str, ",mask=0x%.8x,value=0x%.8x",
+					cfg->mask, cfg->value);
+		if (cfg->start)
+			g_string_append(str, ",start");
+	}
+
+	return g_string_free(str, FALSE);
+}
+
+/**
+ * Send the masks, values and configurations of the trigger stages in use.
+ *
+ * Without a trigger, stage 0 is set up to start capturing right away.
+ * Otherwise each stage waits for the level its number gives, unless
+ * set up otherwise, and the last one starts the capture unless another
+ * stage was made to. Config values go out byte-reversed, like the masks
+ * and values, since the device takes them least significant byte first.
+ *
+ * @private
+ */
+SR_PRIV int ols_trigger_send(const struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	struct sr_serial_dev_inst *serial;
+	const struct ols_trigger_stage *cfg;
+	uint32_t config;
+	gboolean start_set;
+	int level, i;
+
+	devc = sdi->priv;
+	serial = sdi->conn;
+
+	if (!devc->trigger_mask[0] && !devc->num_stage_cfgs) {
+		if (send_longcommand(serial,
+				CMD_SET_TRIGGER_MASK_0, 0) != SR_OK)
+			return SR_ERR;
+		if (send_longcommand(serial,
+				CMD_SET_TRIGGER_VALUE_0, 0) != SR_OK)
+			return SR_ERR;
+		if (send_longcommand(serial, CMD_SET_TRIGGER_CONFIG_0,
+				reverse32(TRIGGER_START)) != SR_OK)
+			return SR_ERR;
+		return SR_OK;
+	}
+
+	start_set = FALSE;
+	for (i = 0; i < devc->num_stage_cfgs; i++)
+		start_set |= devc->stage_cfg[i].start;
+
+	for (i = 0; i < NUM_TRIGGER_STAGES; i++) {
+		cfg = i < devc->num_stage_cfgs ? &devc->stage_cfg[i] : NULL;
+		/* Unused stages wait for a level no stage leads to. */
+		config = TRIGGER_LEVEL_MAX << TRIGGER_LEVEL_SHIFT;
+		if (i <= devc->num_stages) {
+			level = cfg && cfg->level >= 0 ? cfg->level : i;
+			config = level << TRIGGER_LEVEL_SHIFT;
+			if (cfg) {
+				config |= cfg->delay;
+				if (cfg->channel >= 0)
+					config |= TRIGGER_SERIAL | cfg->channel
+						<< TRIGGER_CHANNEL_SHIFT;
+			}
+			if (start_set ? cfg && cfg->start
+					: i == devc->num_stages)
+				config |= TRIGGER_START;
+		}
+		if (send_longcommand(serial, CMD_SET_TRIGGER_MASK_0 + i * 4,
+				reverse32(devc->trigger_mask[i])) != SR_OK)
+			return SR_ERR;
+		if (send_longcommand(serial, CMD_SET_TRIGGER_VALUE_0 + i * 4,
+				reverse32(devc->trigger_value[i])) != SR_OK)
+			return SR_ERR;
+		if (send_longcommand(serial, CMD_SET_TRIGGER_CONFIG_0 + i * 4,
+				reverse32(config)) != SR_OK)
+			return SR_ERR;
 	}
 
 	return SR_OK;
@@ -151,6 +363,8 @@ SR_PRIV struct dev_context *ols_dev_new(void)
 	devc->trigger_at = -1;
 	devc->probe_mask = 0xffffffff;
 	devc->flag_reg = 0;
+	devc->num_stages = devc->num_stage_cfgs = 0;
+	devc->raw_sample_buf = NULL;
 
 	return devc;
 }
@@ -332,15 +546,97 @@ SR_PRIV void abort_acquisition(const struct sr_dev_inst *sdi)
 {
 	struct sr_datafeed_packet packet;
 	struct sr_serial_dev_inst *serial;
+	struct dev_context *devc;
 
+	devc = sdi->priv;
 	serial = sdi->conn;
 	sr_source_remove(serial->fd);
 
+	sr_dev_mem_free(sdi, devc->raw_sample_buf);
+	devc->raw_sample_buf = NULL;
+
 	/* Terminate session */
 	packet.type = SR_DF_END;
 	sr_session_send(sdi, &packet);
 }
 
+/* Store the complete sample in devc->sample, expanding RLE counts. */
+static void sample_add(struct dev_context *devc, int num_channels)
+{
+	uint32_t sample;
+	uint64_t n, total;
+	unsigned char *dest;
+	int offset, i, j;
+
+	/* Convert from the OLS's little-endian sample to the local format. */
+	sample = devc->sample[0] | (devc->sample[1] << 8) \
+			| (devc->sample[2] << 16) | (devc->sample[3] << 24);
+	if (devc->flag_reg & FLAG_RLE) {
+		/*
+		 * In RLE mode the high bit of the sample is the
+		 * "count" flag, meaning this sample is the number
+		 * of times the previous sample occurred.
+		 */
+		if (devc->sample[devc->num_bytes - 1] & 0x80) {
+			/* Clear the high bit. */
+			sample &= ~(0x80 << (devc->num_bytes - 1) * 8);
+			devc->rle_count = sample;
+			sr_spew("RLE count: %u.", devc->rle_count);
+			devc->num_bytes = 0;
+			return;
+		}
+	}
+	devc->num_samples += devc->rle_count + 1;
+	if (devc->num_samples > devc->limit_samples) {
+		/* Save us from overrunning the buffer. */
+		devc->rle_count -= devc->num_samples - devc->limit_samples;
+		devc->num_samples = devc->limit_samples;
+	}
+
+	if (num_channels < 4) {
+		/*
+		 * Some channel groups may have been turned
+		 * off, to speed up transfer between the
+		 * hardware and the PC. Expand that here before
+		 * submitting it over the session bus --
+		 * whatever is listening on the bus will be
+		 * expecting a full 32-bit sample, based on
+		 * the number of probes.
+		 */
+		j = 0;
+		memset(devc->tmp_sample, 0, 4);
+		for (i = 0; i < 4; i++) {
+			if (((devc->flag_reg >> 2) & (1 << i)) == 0) {
+				/*
+				 * This channel group was
+				 * enabled, copy from received
+				 * sample.
+				 */
+				devc->tmp_sample[i] = devc->sample[j++];
+			} else if (devc->flag_reg & FLAG_DEMUX && (i > 2)) {
+				/* group 2 & 3 get added to 0 & 1 */
+				devc->tmp_sample[i - 2] = devc->sample[j++];
+			}
+		}
+		memcpy(devc->sample, devc->tmp_sample, 4);
+	}
+
+	/* the OLS sends its sample buffer backwards.
+	 * store it in reverse order here, so we can dump
+	 * this on the session bus later. Runs are filled
+	 * by doubling the part already copied.
+	 */
+	offset = (devc->limit_samples - devc->num_samples) * 4;
+	dest = devc->raw_sample_buf + offset;
+	total = ((uint64_t)devc->rle_count + 1) * 4;
+	memcpy(dest, devc->sample, 4);
+	for (n = 4; n < total; n *= 2)
+		memcpy(dest + n, dest, MIN(n, total - n));
+	memset(devc->sample, 0, 4);
+	devc->num_bytes = 0;
+	devc->rle_count = 0;
+}
+
 SR_PRIV int ols_receive_data(int fd, int revents, void *cb_data)
 {
 	struct drv_context *drvc;
@@ -350,10 +646,9 @@ SR_PRIV int ols_receive_data(int fd, int revents, void *cb_data)
 	struct sr_datafeed_logic logic;
 	struct sr_dev_inst *sdi;
 	GSList *l;
-	uint32_t sample;
-	int num_channels, offset, j;
+	int num_channels, len, k;
 	unsigned int i;
-	unsigned char byte;
+	unsigned char buf[READ_BUF_SIZE];
 
 	drvc = di->priv;
 
@@ -376,17 +671,13 @@ SR_PRIV int ols_receive_data(int fd, int revents, void *cb_data)
 		 * First time round, means the device started sending data,
 		 * and will not stop until done. If it stops sending for
 		 * longer than it takes to send a byte, that means it's
-		 * finished. We'll double that to 30ms to be sure...
+		 * finished. We'll double that to 30ms to be sure, or wait
+		 * less for the low latency profile...
 		 */
 		sr_source_remove(fd);
-		sr_source_add(fd, G_IO_IN, 30, ols_receive_data, cb_data);
-		devc->raw_sample_buf = g_try_malloc(devc->limit_samples * 4);
-		if (!devc->raw_sample_buf) {
-			sr_err("Sample buffer malloc failed.");
-			return FALSE;
-		}
-		/* fill with 1010... for debugging */
-		memset(devc->raw_sample_buf, 0x82, devc->limit_samples * 4);
+		sr_source_add(fd, G_IO_IN,
+			MAX(sr_session_buffer_ms(sdi, 30), MIN_END_TIMEOUT_MS),
+			ols_receive_data, cb_data);
 	}
 
 	num_channels = 0;
@@ -398,84 +689,17 @@ SR_PRIV int ols_receive_data(int fd, int revents, void *cb_data)
 	}
 
 	if (revents == G_IO_IN && devc->num_samples < devc->limit_samples) {
-		if (serial_read(serial, &byte, 1) != 1)
+		/* Take everything the port has buffered up in one go. */
+		if ((len = serial_read(serial, buf, sizeof(buf))) <= 0)
 			return FALSE;
 
-		/* Ignore it if we've read enough. */
-		if (devc->num_samples >= devc->limit_samples)
-			return TRUE;
-
-		devc->sample[devc->num_bytes++] = byte;
-		sr_dbg("Received byte 0x%.2x.", byte);
-		if (devc->num_bytes == num_channels) {
-			/* Got a full sample. Convert from the OLS's little-endian
-			 * sample to the local format. */
-			sample = devc->sample[0] | (devc->sample[1] << 8) \
-					| (devc->sample[2] << 16) | (devc->sample[3] << 24);
-			sr_dbg("Received sample 0x%.*x.", devc->num_bytes * 2, sample);
-			if (devc->flag_reg & FLAG_RLE) {
-				/*
-				 * In RLE mode the high bit of the sample is the
-				 * "count" flag, meaning this sample is the number
-				 * of times the previous sample occurred.
-				 */
-				if (devc->sample[devc->num_bytes - 1] & 0x80) {
-					/* Clear the high bit. */
-					sample &= ~(0x80 << (devc->num_bytes - 1) * 8);
-					devc->rle_count = sample;
-					sr_dbg("RLE count: %u.", devc->rle_count);
-					devc->num_bytes = 0;
-					return TRUE;
-				}
-			}
-			devc->num_samples += devc->rle_count + 1;
-			if (devc->num_samples > devc->limit_samples) {
-				/* Save us from overrunning the buffer. */
-				devc->rle_count -= devc->num_samples - devc->limit_samples;
-				devc->num_samples = devc->limit_samples;
-			}
-
-			if (num_channels < 4) {
-				/*
-				 * Some channel groups may have been turned
-				 * off, to speed up transfer between the
-				 * hardware and the PC. Expand that here before
-				 * submitting it over the session bus --
-				 * whatever is listening on the bus will be
-				 * expecting a full 32-bit sample, based on
-				 * the number of probes.
-				 */
-				j = 0;
-				memset(devc->tmp_sample, 0, 4);
-				for (i = 0; i < 4; i++) {
-					if (((devc->flag_reg >> 2) & (1 << i)) == 0) {
-						/*
-						 * This channel group was
-						 * enabled, copy from received
-						 * sample.
-						 */
-						devc->tmp_sample[i] = devc->sample[j++];
-					} else if (devc->flag_reg & FLAG_DEMUX && (i > 2)) {
-						/* group 2 & 3 get added to 0 & 1 */
-						devc->tmp_sample[i - 2] = devc->sample[j++];
-					}
-				}
-				memcpy(devc->sample, devc->tmp_sample, 4);
-				sr_dbg("Full sample: 0x%.8x.", sample);
-			}
-
-			/* the OLS sends its sample buffer backwards.
-			 * store it in reverse order here, so we can dump
-			 * this on the session bus later.
-			 */
-			offset = (devc->limit_samples - devc->num_samples) * 4;
-			for (i = 0; i <= devc->rle_count; i++) {
-				memcpy(devc->raw_sample_buf + offset + (i * 4),
-				       devc->sample, 4);
-			}
-			memset(devc->sample, 0, 4);
-			devc->num_bytes = 0;
-			devc->rle_count = 0;
+		/* Bytes after the last sample we asked for are ignored. */
+		for (k = 0; k < len; k++) {
+			if (devc->num_samples >= devc->limit_samples)
+				break;
+			devc->sample[devc->num_bytes++] = buf[k];
+			if (devc->num_bytes == num_channels)
+				sample_add(devc, num_channels);
 		}
 	} else {
 		/*
@@ -520,7 +744,6 @@ SR_PRIV int ols_receive_data(int fd, int revents, void *cb_data)
 				(devc->limit_samples - devc->num_samples) * 4;
 			sr_session_send(cb_data, &packet);
 		}
-		g_free(devc->raw_sample_buf);
 
 		serial_flush(serial);
 		abort_acquisition(sdi);
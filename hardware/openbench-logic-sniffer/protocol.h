@@ -29,11 +29,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "ols: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define NUM_PROBES             32
 #define NUM_TRIGGER_STAGES     4
@@ -42,6 +42,9 @@
 #define CLOCK_RATE             SR_MHZ(100)
 #define MIN_NUM_SAMPLES        4
 #define DEFAULT_SAMPLERATE     SR_KHZ(200)
+#define READ_BUF_SIZE          4096
+/* Shortest gap in the data that ends a capture, ~50 bytes at 115200. */
+#define MIN_END_TIMEOUT_MS     5
 
 /* Command opcodes */
 #define CMD_RESET                  0x00
@@ -65,6 +68,14 @@
 #define CMD_SET_TRIGGER_CONFIG_2   0xca
 #define CMD_SET_TRIGGER_CONFIG_3   0xce
 
+/* Fields of the CMD_SET_TRIGGER_CONFIG_* argument */
+#define TRIGGER_DELAY_MAX          0xffff
+#define TRIGGER_LEVEL_SHIFT        16
+#define TRIGGER_LEVEL_MAX          3
+#define TRIGGER_CHANNEL_SHIFT      20
+#define TRIGGER_SERIAL             (1 << 26)
+#define TRIGGER_START              (1 << 27)
+
 /* Bitmasks for CMD_FLAGS */
 #define FLAG_DEMUX                 0x01
 #define FLAG_FILTER                0x02
@@ -79,6 +90,20 @@
 #define FLAG_EXTERNAL_TEST_MODE    0x0400
 #define FLAG_INTERNAL_TEST_MODE    0x0800
 
+/* A trigger stage's settings from SR_CONF_TRIGGER_STAGES. */
+struct ols_trigger_stage {
+	uint16_t delay;
+	/* -1 for the stage's number. */
+	int level;
+	/* The probe a serial stage matches on, -1 for a parallel one. */
+	int channel;
+	/* Whether mask and value replace those of the trigger strings. */
+	gboolean has_mask;
+	uint32_t mask;
+	uint32_t value;
+	gboolean start;
+};
+
 /* Private, per-device-instance driver context. */
 struct dev_context {
 	/* Fixed device settings */
@@ -97,6 +122,8 @@ struct dev_context {
 	uint32_t trigger_mask[4];
 	uint32_t trigger_value[4];
 	int num_stages;
+	struct ols_trigger_stage stage_cfg[NUM_TRIGGER_STAGES];
+	int num_stage_cfgs;
 	uint32_t flag_reg;
 
 	/* Operational states */
@@ -119,6 +146,10 @@ SR_PRIV int send_shortcommand(struct sr_serial_dev_inst *serial,
 SR_PRIV int send_longcommand(struct sr_serial_dev_inst *serial,
 		uint8_t command, uint32_t data);
 SR_PRIV int ols_configure_probes(const struct sr_dev_inst *sdi);
+SR_PRIV int ols_trigger_stages_parse(struct dev_context *devc,
+		const char *spec);
+SR_PRIV char *ols_trigger_stages_format(const struct dev_context *devc);
+SR_PRIV int ols_trigger_send(const struct sr_dev_inst *sdi);
 SR_PRIV uint32_t reverse16(uint32_t in);
 SR_PRIV uint32_t reverse32(uint32_t in);
 SR_PRIV struct dev_context *ols_dev_new(void);
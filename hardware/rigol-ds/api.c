@@ -19,8 +19,6 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <fcntl.h>
-#include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <glib.h>
@@ -39,6 +37,7 @@ static const int32_t hwcaps[] = {
 	SR_CONF_TRIGGER_SLOPE,
 	SR_CONF_HORIZ_TRIGGERPOS,
 	SR_CONF_NUM_TIMEBASE,
+	SR_CONF_TRIGGER_WINDOW,
 };
 
 static const int32_t analog_hwcaps[] = {
@@ -173,7 +172,6 @@ static void clear_helper(void *priv)
 	struct dev_context *devc;
 
 	devc = priv;
-	g_free(devc->data);
 	g_free(devc->buffer);
 	g_free(devc->coupling[0]);
 	g_free(devc->coupling[1]);
@@ -210,14 +208,25 @@ static int set_cfg(const struct sr_dev_inst *sdi, const char *format, ...)
 
 static int init(struct sr_context *sr_ctx)
 {
+#ifdef HAVE_LIBUSB_1_0
+	int ret;
+
+	if ((ret = sr_usb_init(sr_ctx)) != SR_OK)
+		return ret;
+#endif
+
 	return std_init(sr_ctx, di, LOG_PREFIX);
 }
 
-static int probe_port(const char *port, GSList **devices)
+/*
+ * Check for a supported scope. Upon success, the device instance becomes
+ * the new device's conn, otherwise it's left to the caller.
+ */
+static int probe_port(struct sr_usbtmc_dev_inst *usbtmc, GSList **devices)
 {
+	struct drv_context *drvc;
 	struct dev_context *devc;
 	struct sr_dev_inst *sdi;
-	struct sr_usbtmc_dev_inst *usbtmc;
 	struct sr_probe *probe;
 	unsigned int i;
 	int len, num_tokens;
@@ -226,25 +235,20 @@ static int probe_port(const char *port, GSList **devices)
 	char buf[256];
 	gchar **tokens, *channel_name;
 
-	*devices = NULL;
-	if (!(usbtmc = sr_usbtmc_dev_inst_new(port)))
-		return SR_ERR_MALLOC;
-
-	if ((usbtmc->fd = open(usbtmc->device, O_RDWR)) < 0)
-		return SR_ERR;
-	len = write(usbtmc->fd, "*IDN?", 5);
-	len = read(usbtmc->fd, buf, sizeof(buf));
-	if (close(usbtmc->fd) < 0)
+	drvc = di->priv;
+	if (sr_usbtmc_open(drvc->sr_ctx, usbtmc) != SR_OK)
 		return SR_ERR;
+	len = sr_usbtmc_write(usbtmc, "*IDN?", 5);
+	if (len == 5)
+		len = sr_usbtmc_read(usbtmc, buf, sizeof(buf) - 1);
+	sr_usbtmc_close(usbtmc);
 
-	sr_usbtmc_dev_inst_free(usbtmc);
-
-	if (len == 0)
+	if (len <= 0)
 		return SR_ERR_NA;
 
 	buf[len] = 0;
 	tokens = g_strsplit(buf, ",", 0);
-	sr_dbg("response: %s [%s]", port, buf);
+	sr_dbg("response: %s [%s]", usbtmc->device, buf);
 
 	for (num_tokens = 0; tokens[num_tokens] != NULL; num_tokens++);
 
@@ -277,8 +281,7 @@ static int probe_port(const char *port, GSList **devices)
 
 	g_strfreev(tokens);
 
-	if (!(sdi->conn = sr_usbtmc_dev_inst_new(port)))
-		return SR_ERR_MALLOC;
+	sdi->conn = usbtmc;
 	sdi->driver = di;
 	sdi->inst_type = SR_INST_USBTMC;
 
@@ -331,59 +334,138 @@ static int probe_port(const char *port, GSList **devices)
 
 	if (!(devc->buffer = g_try_malloc(ACQ_BUFFER_SIZE)))
 		return SR_ERR_MALLOC;
-	if (!(devc->data = g_try_malloc(ACQ_BUFFER_SIZE * sizeof(float))))
-		return SR_ERR_MALLOC;
 
 	devc->data_source = DATA_SOURCE_LIVE;
 
 	sdi->priv = devc;
 
-	*devices = g_slist_append(NULL, sdi);
+	*devices = g_slist_append(*devices, sdi);
 
 	return SR_OK;
 }
 
+/* Probe a device node of the kernel's usbtmc driver. */
+static int probe_node(const char *port, GSList **devices)
+{
+	struct sr_usbtmc_dev_inst *usbtmc;
+	int ret;
+
+	if (!(usbtmc = sr_usbtmc_dev_inst_new(port)))
+		return SR_ERR_MALLOC;
+	if ((ret = probe_port(usbtmc, devices)) != SR_OK)
+		sr_usbtmc_dev_inst_free(usbtmc);
+
+	return ret;
+}
+
+#ifdef HAVE_LIBUSB_1_0
+/* Probe USBTMC devices through libusb, which takes over the device. */
+static int probe_usb(GSList *usb_devices, GSList **devices)
+{
+	struct sr_usbtmc_dev_inst *usbtmc;
+	struct sr_usb_dev_inst *usb;
+	GSList *l;
+	char *name;
+	int ret;
+
+	ret = SR_OK;
+	for (l = usb_devices; l; l = l->next) {
+		usb = l->data;
+		l->data = NULL;
+		if (ret == SR_ERR_MALLOC) {
+			sr_usb_dev_inst_free(usb);
+			continue;
+		}
+		name = g_strdup_printf("%d.%d", usb->bus, usb->address);
+		usbtmc = sr_usbtmc_dev_inst_new(name);
+		g_free(name);
+		if (!usbtmc) {
+			sr_usb_dev_inst_free(usb);
+			ret = SR_ERR_MALLOC;
+			continue;
+		}
+		usbtmc->usb = usb;
+		if ((ret = probe_port(usbtmc, devices)) != SR_OK)
+			sr_usbtmc_dev_inst_free(usbtmc);
+	}
+	g_slist_free(usb_devices);
+
+	return ret == SR_ERR_MALLOC ? ret : SR_OK;
+}
+#endif
+
+/* Probe the device nodes of the kernel's usbtmc driver. */
+static int probe_sysfs(GSList **devices)
+{
+	GDir *dir;
+	const gchar *dev_name;
+	gchar *port;
+	int ret;
+
+	if (!(dir = g_dir_open("/sys/class/usbmisc/", 0, NULL)))
+		if (!(dir = g_dir_open("/sys/class/usb/", 0, NULL)))
+			return SR_OK;
+	ret = SR_OK;
+	while (ret != SR_ERR_MALLOC && (dev_name = g_dir_read_name(dir))) {
+		if (strncmp(dev_name, "usbtmc", 6))
+			continue;
+		port = g_strconcat("/dev/", dev_name, NULL);
+		ret = probe_node(port, devices);
+		g_free(port);
+	}
+	g_dir_close(dir);
+
+	return ret == SR_ERR_MALLOC ? ret : SR_OK;
+}
+
+/* Probe port, or everywhere if it's NULL, without adding to the list. */
+static GSList *rigol_scan(const char *port)
+{
+#ifdef HAVE_LIBUSB_1_0
+	struct drv_context *drvc;
+#endif
+	GSList *devices;
+	int ret;
+
+	devices = NULL;
+	ret = SR_OK;
+	if (port && port[0] == '/') {
+		ret = probe_node(port, &devices);
+	} else {
+#ifdef HAVE_LIBUSB_1_0
+		/* Otherwise conn is whatever sr_usb_find() takes. */
+		drvc = di->priv;
+		ret = probe_usb(port ? sr_usb_find(drvc->sr_ctx, port)
+				: sr_usb_find_usbtmc(drvc->sr_ctx), &devices);
+#endif
+		/* Where libusb can't get at the device, the kernel may. */
+		if (!port && !devices && ret != SR_ERR_MALLOC)
+			ret = probe_sysfs(&devices);
+	}
+	if (ret == SR_ERR_MALLOC)
+		return NULL;
+
+	return devices;
+}
+
 static GSList *scan(GSList *options)
 {
 	struct drv_context *drvc;
 	struct sr_config *src;
 	GSList *l, *devices;
-	GDir *dir;
-	int ret;
-	const gchar *dev_name;
-	gchar *port = NULL;
+	const gchar *port = NULL;
 
 	drvc = di->priv;
 
 	for (l = options; l; l = l->next) {
 		src = l->data;
 		if (src->key == SR_CONF_CONN) {
-			port = (char *)g_variant_get_string(src->data, NULL);
+			port = g_variant_get_string(src->data, NULL);
 			break;
 		}
 	}
 
-	devices = NULL;
-	if (port) {
-		if (probe_port(port, &devices) == SR_ERR_MALLOC)
-			return NULL;
-	} else {
-		if (!(dir = g_dir_open("/sys/class/usbmisc/", 0, NULL)))
-			if (!(dir = g_dir_open("/sys/class/usb/", 0, NULL)))
-				return NULL;
-		while ((dev_name = g_dir_read_name(dir))) {
-			if (strncmp(dev_name, "usbtmc", 6))
-				continue;
-			port = g_strconcat("/dev/", dev_name, NULL);
-			ret = probe_port(port, &devices);
-			g_free(port);
-			if (ret == SR_ERR_MALLOC) {
-				g_dir_close(dir);
-				return NULL;
-			}
-		}
-		g_dir_close(dir);
-	}
+	devices = rigol_scan(port);
 
 	/* Tack a copy of the newly found devices onto the driver list. */
 	l = g_slist_copy(devices);
@@ -392,6 +474,13 @@ static GSList *scan(GSList *options)
 	return devices;
 }
 
+static GSList *scan_port(const char *port, GSList *options)
+{
+	(void)options;
+
+	return rigol_scan(port);
+}
+
 static GSList *dev_list(void)
 {
 	return ((struct drv_context *)(di->priv))->instances;
@@ -399,9 +488,9 @@ static GSList *dev_list(void)
 
 static int dev_open(struct sr_dev_inst *sdi)
 {
-	struct sr_usbtmc_dev_inst *usbtmc = sdi->conn;
+	struct drv_context *drvc = di->priv;
 
-	if ((usbtmc->fd = open(usbtmc->device, O_RDWR)) < 0)
+	if (sr_usbtmc_open(drvc->sr_ctx, sdi->conn) != SR_OK)
 		return SR_ERR;
 
 	if (rigol_ds_get_dev_cfg(sdi) != SR_OK)
@@ -417,9 +506,8 @@ static int dev_close(struct sr_dev_inst *sdi)
 	struct sr_usbtmc_dev_inst *usbtmc;
 
 	usbtmc = sdi->conn;
-	if (usbtmc && usbtmc->fd != -1) {
-		close(usbtmc->fd);
-		usbtmc->fd = -1;
+	if (usbtmc && sr_usbtmc_is_open(usbtmc)) {
+		sr_usbtmc_close(usbtmc);
 		sdi->status = SR_ST_INACTIVE;
 	}
 
@@ -435,6 +523,7 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 		const struct sr_probe_group *probe_group)
 {
 	struct dev_context *devc;
+	GVariant *range[2];
 	unsigned int i;
 
 	if (!sdi || !(devc = sdi->priv))
@@ -473,6 +562,17 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 		else
 			*data = g_variant_new_string("Segmented");
 		break;
+	case SR_CONF_BUFFERSIZE:
+		/* Only known once an acquisition has been set up. */
+		if (!devc->analog_frame_size)
+			return SR_ERR_NA;
+		*data = g_variant_new_uint64(devc->analog_frame_size);
+		break;
+	case SR_CONF_TRIGGER_WINDOW:
+		range[0] = g_variant_new_uint64(devc->pre_trigger_samples);
+		range[1] = g_variant_new_uint64(devc->post_trigger_samples);
+		*data = g_variant_new_tuple(range, 2);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -510,6 +610,11 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 	case SR_CONF_LIMIT_FRAMES:
 		devc->limit_frames = g_variant_get_uint64(data);
 		break;
+	case SR_CONF_TRIGGER_WINDOW:
+		g_variant_get(data, "(tt)", &p, &q);
+		devc->pre_trigger_samples = p;
+		devc->post_trigger_samples = q;
+		break;
 	case SR_CONF_TRIGGER_SLOPE:
 		tmp_u64 = g_variant_get_uint64(data);
 		if (tmp_u64 != 0 && tmp_u64 != 1)
@@ -794,7 +899,9 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	if (!devc->enabled_analog_probes && !devc->enabled_digital_probes)
 		return SR_ERR;
 
-	sr_source_add(usbtmc->fd, G_IO_IN, 50, rigol_ds_receive, (void *)sdi);
+	/* Nothing to poll for libusb devices, check back right away. */
+	sr_source_add(usbtmc->fd, G_IO_IN, usbtmc->fd == -1 ? 1 : 50,
+			rigol_ds_receive, (void *)sdi);
 
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
@@ -833,6 +940,8 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 					return SR_ERR;
 			} else
 				devc->analog_frame_size = DS2000_ANALOG_LIVE_WAVEFORM_SIZE;
+			devc->window_start = 0;
+			devc->window_size = devc->analog_frame_size;
 			devc->channel_frame = devc->enabled_analog_probes->data;
 			if (rigol_ds_capture_start(sdi) != SR_OK)
 				return SR_ERR;
@@ -873,6 +982,7 @@ SR_PRIV struct sr_dev_driver rigol_ds_driver_info = {
 	.init = init,
 	.cleanup = cleanup,
 	.scan = scan,
+	.scan_port = scan_port,
 	.dev_list = dev_list,
 	.dev_clear = dev_clear,
 	.config_get = config_get,
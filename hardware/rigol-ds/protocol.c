@@ -66,6 +66,7 @@
 
 static int get_cfg(const struct sr_dev_inst *sdi, char *cmd, char *reply, size_t maxlen);
 static int get_cfg_int(const struct sr_dev_inst *sdi, char *cmd, int *i);
+static int get_cfg_float(const struct sr_dev_inst *sdi, char *cmd, float *f);
 
 static int parse_int(const char *str, int *ret)
 {
@@ -248,6 +249,47 @@ static int rigol_ds_check_stop(const struct sr_dev_inst *sdi)
 	return SR_OK;
 }
 
+/*
+ * Find the part of sample memory to read, around the trigger point if a
+ * trigger window is set. The memory is centered on the middle of the
+ * screen, from which the trigger is the horizontal offset away.
+ */
+static int rigol_ds_window_setup(const struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	float samplerate, offset;
+	int64_t trigger, start, stop;
+
+	if (!(devc = sdi->priv))
+		return SR_ERR;
+
+	devc->window_start = 0;
+	devc->window_size = devc->analog_frame_size;
+	if (!devc->pre_trigger_samples && !devc->post_trigger_samples)
+		return SR_OK;
+
+	if (get_cfg_float(sdi, ":ACQ:SRAT?", &samplerate) != SR_OK)
+		return SR_ERR;
+	if (get_cfg_float(sdi, ":TIM:OFFS?", &offset) != SR_OK)
+		offset = 0;
+
+	trigger = devc->analog_frame_size / 2 - (int64_t)(offset * samplerate);
+	trigger = MAX(0, MIN(trigger, (int64_t)devc->analog_frame_size));
+	start = MAX(0, trigger - (int64_t)devc->pre_trigger_samples);
+	stop = MIN((int64_t)devc->analog_frame_size,
+		   trigger + (int64_t)devc->post_trigger_samples);
+	if (stop <= start)
+		stop = MIN(start + 1, (int64_t)devc->analog_frame_size);
+
+	devc->window_start = start;
+	devc->window_size = stop - start;
+	sr_dbg("Reading samples %" PRIi64 " to %" PRIi64 " of %" PRIu64
+	       ", trigger at %" PRIi64, start, stop, devc->analog_frame_size,
+	       trigger);
+
+	return SR_OK;
+}
+
 /* Wait for enough data becoming available in scope output buffer */
 static int rigol_ds_block_wait(const struct sr_dev_inst *sdi)
 {
@@ -255,25 +297,32 @@ static int rigol_ds_block_wait(const struct sr_dev_inst *sdi)
 	struct dev_context *devc;
 	time_t start;
 	int len;
+	gulong delay, max_delay;
 
 	if (!(devc = sdi->priv))
 		return SR_ERR;
 
 	start = time(NULL);
 
+	/*
+	 * The scope copies data really slowly from sample
+	 * memory to its output buffer, so try not to bother
+	 * it too much with SCPI requests but don't wait too
+	 * long for short sample frame sizes. The first check
+	 * comes early and the delay doubles up to the limit,
+	 * so a block which is ready quickly isn't held up.
+	 */
+	max_delay = devc->window_size < 15000 ? 100000 : 1000000;
+	delay = 10000;
+
 	do {
 		if (time(NULL) - start >= 3) {
 			sr_dbg("Timeout waiting for data block");
 			return SR_ERR_TIMEOUT;
 		}
 
-		/*
-		 * The scope copies data really slowly from sample
-		 * memory to its output buffer, so try not to bother
-		 * it too much with SCPI requests but don't wait too
-		 * long for short sample frame sizes.
-		 */
-		g_usleep(devc->analog_frame_size < 15000 ? 100000 : 1000000);
+		g_usleep(delay);
+		delay = MIN(delay * 2, max_delay);
 
 		/* "READ,nnnn" (still working) or "IDLE,nnnn" (finished) */
 		if (get_cfg(sdi, ":WAV:STAT?", buf, sizeof(buf)) != SR_OK)
@@ -331,6 +380,13 @@ SR_PRIV int rigol_ds_channel_start(const struct sr_dev_inst *sdi)
 			  devc->channel_frame->index + 1) != SR_OK)
 		return SR_ERR;
 	if (devc->data_source != DATA_SOURCE_LIVE) {
+		/* Limit the read to the trigger window; points count from 1. */
+		if (rigol_ds_send(sdi, ":WAV:STAR %" PRIu64,
+				  devc->window_start + 1) != SR_OK)
+			return SR_ERR;
+		if (rigol_ds_send(sdi, ":WAV:STOP %" PRIu64, devc->window_start
+				  + devc->window_size) != SR_OK)
+			return SR_ERR;
 		if (rigol_ds_send(sdi, ":WAV:RES") != SR_OK)
 			return SR_ERR;
 		if (rigol_ds_send(sdi, ":WAV:BEG") != SR_OK)
@@ -352,7 +408,7 @@ static int rigol_ds_read_header(struct sr_usbtmc_dev_inst *usbtmc)
 	int len, tmp;
 
 	/* Read the hashsign and length digit. */
-	tmp = read(usbtmc->fd, start, 2);
+	tmp = sr_usbtmc_read(usbtmc, start, 2);
 	start[2] = '\0';
 	if (tmp != 2)
 	{
@@ -367,7 +423,7 @@ static int rigol_ds_read_header(struct sr_usbtmc_dev_inst *usbtmc)
 	len = atoi(start + 1);
 
 	/* Read the data length. */
-	tmp = read(usbtmc->fd, length, len);
+	tmp = sr_usbtmc_read(usbtmc, length, len);
 	length[len] = '\0';
 	if (tmp != len)
 	{
@@ -391,13 +447,14 @@ SR_PRIV int rigol_ds_receive(int fd, int revents, void *cb_data)
 	struct sr_usbtmc_dev_inst *usbtmc;
 	struct dev_context *devc;
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_analog analog;
+	struct sr_datafeed_analog_raw analog;
 	struct sr_datafeed_logic logic;
-	double vdiv, offset;
-	int len, i, waveform_size, vref;
+	float vdiv, scale, offset;
+	int len, remaining, waveform_size, vref;
+	gboolean block_end_read;
 	struct sr_probe *probe;
 
-	(void)fd;
+	block_end_read = FALSE;
 
 	if (!(sdi = cb_data))
 		return TRUE;
@@ -407,7 +464,8 @@ SR_PRIV int rigol_ds_receive(int fd, int revents, void *cb_data)
 
 	usbtmc = sdi->conn;
 
-	if (revents == G_IO_IN) {
+	/* Devices driven through libusb have no fd, every call may read. */
+	if (revents == G_IO_IN || fd == -1) {
 		if (devc->model->protocol == PROTOCOL_IEEE488_2) {
 			switch(devc->wait_event) {
 			case WAIT_NONE:
@@ -430,6 +488,8 @@ SR_PRIV int rigol_ds_receive(int fd, int revents, void *cb_data)
 					return TRUE;
 				if (rigol_ds_check_stop(sdi) != SR_OK)
 					return TRUE;
+				if (rigol_ds_window_setup(sdi) != SR_OK)
+					return TRUE;
 				if (rigol_ds_channel_start(sdi) != SR_OK)
 					return TRUE;
 				return TRUE;
@@ -454,7 +514,8 @@ SR_PRIV int rigol_ds_receive(int fd, int revents, void *cb_data)
 				if (devc->data_source == DATA_SOURCE_LIVE
 				    && (unsigned)len < devc->num_frame_bytes) {
 					sr_dbg("Discarding short data block");
-					read(usbtmc->fd, devc->buffer, len + 1);
+					sr_usbtmc_read(usbtmc, devc->buffer,
+							len + 1);
 					return TRUE;
 				}
 				devc->num_block_bytes = len;
@@ -464,13 +525,21 @@ SR_PRIV int rigol_ds_receive(int fd, int revents, void *cb_data)
 
 		probe = devc->channel_frame;
 		if (devc->model->protocol == PROTOCOL_IEEE488_2) {
-			len = devc->num_block_bytes - devc->num_block_read;
-			len = read(usbtmc->fd, devc->buffer,
-					len < ACQ_BUFFER_SIZE ? len : ACQ_BUFFER_SIZE);
+			/* Read the terminating linefeed along with the
+			 * rest of the block if it fits, saving a read(). */
+			remaining = devc->num_block_bytes - devc->num_block_read;
+			len = sr_usbtmc_read(usbtmc, devc->buffer,
+					remaining < ACQ_BUFFER_SIZE ?
+					remaining + 1 : ACQ_BUFFER_SIZE);
+			if (len > remaining) {
+				len = remaining;
+				block_end_read = TRUE;
+			}
 		} else {
 			waveform_size = probe->type == SR_PROBE_ANALOG ?
 					DS1000_ANALOG_LIVE_WAVEFORM_SIZE : DIGITAL_WAVEFORM_SIZE;
-			len = read(usbtmc->fd, devc->buffer, waveform_size - devc->num_frame_bytes);
+			len = sr_usbtmc_read(usbtmc, devc->buffer,
+					waveform_size - devc->num_frame_bytes);
 		}
 		sr_dbg("Received %d bytes.", len);
 		if (len == -1)
@@ -488,19 +557,25 @@ SR_PRIV int rigol_ds_receive(int fd, int revents, void *cb_data)
 			vref = devc->vert_reference[probe->index];
 			vdiv = devc->vdiv[probe->index] / 25.6;
 			offset = devc->vert_offset[probe->index];
-			if (devc->model->protocol == PROTOCOL_IEEE488_2)
-				for (i = 0; i < len; i++)
-					devc->data[i] = ((int)devc->buffer[i] - vref) * vdiv - offset;
-			else
-				for (i = 0; i < len; i++)
-					devc->data[i] = (128 - devc->buffer[i]) * vdiv - offset;
+			if (devc->model->protocol == PROTOCOL_IEEE488_2) {
+				/* (raw - vref) * vdiv - offset */
+				scale = vdiv;
+				offset = -vref * vdiv - offset;
+			} else {
+				/* (128 - raw) * vdiv - offset */
+				scale = -vdiv;
+				offset = 128 * vdiv - offset;
+			}
 			analog.probes = g_slist_append(NULL, probe);
 			analog.num_samples = len;
-			analog.data = devc->data;
 			analog.mq = SR_MQ_VOLTAGE;
 			analog.unit = SR_UNIT_VOLT;
 			analog.mqflags = 0;
-			packet.type = SR_DF_ANALOG;
+			analog.encoding = SR_ANALOG_U8;
+			analog.scale = &scale;
+			analog.offset = &offset;
+			analog.data = devc->buffer;
+			packet.type = SR_DF_ANALOG_RAW;
 			packet.payload = &analog;
 			sr_session_send(cb_data, &packet);
 			g_slist_free(analog.probes);
@@ -510,7 +585,9 @@ SR_PRIV int rigol_ds_receive(int fd, int revents, void *cb_data)
 					sr_dbg("Block has been completed");
 					/* Discard the terminating linefeed and prepare for
 					   possible next block */
-					read(usbtmc->fd, devc->buffer, 1);
+					if (!block_end_read)
+						sr_usbtmc_read(usbtmc,
+								devc->buffer, 1);
 					devc->num_block_bytes = 0;
 					if (devc->data_source != DATA_SOURCE_LIVE)
 						rigol_ds_set_wait_event(devc, WAIT_BLOCK);
@@ -519,7 +596,7 @@ SR_PRIV int rigol_ds_receive(int fd, int revents, void *cb_data)
 
 				devc->num_frame_bytes += len;
 
-				if (devc->num_frame_bytes < devc->analog_frame_size)
+				if (devc->num_frame_bytes < devc->window_size)
 					/* Don't have the whole frame yet. */
 					return TRUE;
 
@@ -618,7 +695,7 @@ SR_PRIV int rigol_ds_send(const struct sr_dev_inst *sdi, const char *format, ...
 	va_end(args);
 	strcat(buf, "\n");
 	len++;
-	out = write(usbtmc->fd, buf, len);
+	out = sr_usbtmc_write(usbtmc, buf, len);
 	buf[len - 1] = '\0';
 	if (out != len) {
 		sr_dbg("Only sent %d/%d bytes of '%s'.", out, len, buf);
@@ -640,7 +717,7 @@ static int get_cfg(const struct sr_dev_inst *sdi, char *cmd, char *reply, size_t
 	if (rigol_ds_send(sdi, cmd) != SR_OK)
 		return SR_ERR;
 
-	if ((len = read(usbtmc->fd, reply, maxlen - 1)) < 0)
+	if ((len = sr_usbtmc_read(usbtmc, reply, maxlen - 1)) < 0)
 		return SR_ERR;
 	reply[len] = '\0';
 
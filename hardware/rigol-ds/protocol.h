@@ -29,11 +29,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "rigol-ds: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define DS1000_ANALOG_LIVE_WAVEFORM_SIZE 600
 #define DS2000_ANALOG_LIVE_WAVEFORM_SIZE 1400
@@ -105,6 +105,9 @@ struct dev_context {
 	void *cb_data;
 	enum data_source data_source;
 	uint64_t analog_frame_size;
+	/* Samples to read around the trigger from memory, 0 for all. */
+	uint64_t pre_trigger_samples;
+	uint64_t post_trigger_samples;
 
 	/* Device settings */
 	gboolean analog_channels[2];
@@ -123,6 +126,9 @@ struct dev_context {
 	/* FIXME: misnomer, actually this is number of frame samples? */
 	uint64_t num_frame_bytes;
 	struct sr_probe *channel_frame;
+	/* First sample and number of samples read of each channel frame */
+	uint64_t window_start;
+	uint64_t window_size;
 	/* Number of bytes in current data block, if 0 block header expected */
 	uint64_t num_block_bytes;
 	/* Number of data block bytes already read */
@@ -133,7 +139,6 @@ struct dev_context {
 	int wait_status;
 	/* Acq buffers used for reading from the scope and sending data to app */
 	unsigned char *buffer;
-	float *data;
 };
 
 SR_PRIV int rigol_ds_capture_start(const struct sr_dev_inst *sdi);
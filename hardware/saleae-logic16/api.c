@@ -37,6 +37,8 @@
 
 #define MAX_RENUM_DELAY_MS	3000
 #define NUM_SIMUL_TRANSFERS	32
+#define MAX_SIMUL_TRANSFERS	64
+#define MAX_TRANSFER_SIZE	(4 * 1024 * 1024)
 
 SR_PRIV struct sr_dev_driver saleae_logic16_driver_info;
 static struct sr_dev_driver *di = &saleae_logic16_driver_info;
@@ -48,11 +50,15 @@ static const int32_t hwopts[] = {
 static const int32_t hwcaps[] = {
 	SR_CONF_LOGIC_ANALYZER,
 	SR_CONF_SAMPLERATE,
+	SR_CONF_MAX_SAMPLERATE,
 	SR_CONF_VOLTAGE_THRESHOLD,
 
 	/* These are really implemented in the driver, not the hardware. */
+	SR_CONF_TRIGGER_TYPE,
+	SR_CONF_CAPTURE_RATIO,
 	SR_CONF_LIMIT_SAMPLES,
 	SR_CONF_CONTINUOUS,
+	SR_CONF_PROBE_PACKING,
 };
 
 static const char *probe_names[] = {
@@ -89,6 +95,11 @@ static const uint64_t samplerates[] = {
 
 static int init(struct sr_context *sr_ctx)
 {
+	int ret;
+
+	if ((ret = sr_usb_init(sr_ctx)) != SR_OK)
+		return ret;
+
 	return std_init(sr_ctx, di, LOG_PREFIX);
 }
 
@@ -156,13 +167,13 @@ static GSList *scan(GSList *options)
 		}
 	}
 	if (conn)
-		conn_devices = sr_usb_find(drvc->sr_ctx->libusb_ctx, conn);
+		conn_devices = sr_usb_find(drvc->sr_ctx, conn);
 	else
 		conn_devices = NULL;
 
 	/* Find all Logic16 devices and upload firmware to them. */
 	devices = NULL;
-	libusb_get_device_list(drvc->sr_ctx->libusb_ctx, &devlist);
+	sr_usb_get_device_list(drvc->sr_ctx, &devlist);
 	for (i = 0; devlist[i]; i++) {
 		if (conn) {
 			usb = NULL;
@@ -362,8 +373,13 @@ static int dev_open(struct sr_dev_inst *sdi)
 	ret = SR_ERR;
 	if (devc->fw_updated > 0) {
 		sr_info("Waiting for device to reset.");
-		/* Takes >= 300ms for the FX2 to be gone from the USB bus. */
-		g_usleep(300 * 1000);
+		/*
+		 * Takes >= 300ms for the FX2 to be gone from the USB bus,
+		 * counting from the upload.
+		 */
+		timediff_us = g_get_monotonic_time() - devc->fw_updated;
+		if (timediff_us < 300 * 1000)
+			g_usleep(300 * 1000 - timediff_us);
 		timediff_ms = 0;
 		while (timediff_ms < MAX_RENUM_DELAY_MS) {
 			if ((ret = logic16_dev_open(sdi)) == SR_OK)
@@ -379,6 +395,8 @@ static int dev_open(struct sr_dev_inst *sdi)
 			return SR_ERR;
 		}
 		sr_info("Device came back after %" PRIi64 "ms.", timediff_ms);
+		/* It runs the firmware now, later opens needn't wait. */
+		devc->fw_updated = 0;
 	} else {
 		sr_info("Firmware upload was not needed.");
 		ret = logic16_dev_open(sdi);
@@ -400,11 +418,22 @@ static int dev_open(struct sr_dev_inst *sdi)
 static int dev_close(struct sr_dev_inst *sdi)
 {
 	struct sr_usb_dev_inst *usb;
+	struct drv_context *drvc;
+	struct dev_context *devc;
 
 	usb = sdi->conn;
 	if (usb->devhdl == NULL)
 		return SR_ERR;
 
+	/* Their buffers may be device memory, which goes with the handle. */
+	drvc = di->priv;
+	devc = sdi->priv;
+	sr_usb_transfer_pool_trim(drvc->sr_ctx, &devc->idle_transfers, 0);
+	sr_usb_buffer_free(drvc->sr_ctx, devc->spare_buf, devc->spare_size);
+	devc->spare_buf = NULL;
+	g_free(devc->convbuffer);
+	devc->convbuffer = NULL;
+
 	sr_info("Closing device %d on %d.%d interface %d.",
 		sdi->index, usb->bus, usb->address, USB_INTERFACE);
 	libusb_release_interface(usb->devhdl, USB_INTERFACE);
@@ -415,6 +444,16 @@ static int dev_close(struct sr_dev_inst *sdi)
 	return SR_OK;
 }
 
+static int dev_check(struct sr_dev_inst *sdi)
+{
+	int ret;
+
+	if ((ret = std_dev_check_usb(sdi)) != SR_OK)
+		return ret;
+
+	return logic16_check_device(sdi);
+}
+
 static int cleanup(void)
 {
 	int ret;
@@ -436,9 +475,11 @@ static int config_get(int key, GVariant **data, const struct sr_dev_inst *sdi,
 {
 	struct dev_context *devc;
 	struct sr_usb_dev_inst *usb;
+	struct sr_probe *probe;
 	GVariant *range[2];
+	GSList *l;
 	char str[128];
-	int ret;
+	int ret, num_channels;
 	unsigned int i;
 
 	(void)probe_group;
@@ -462,6 +503,18 @@ static int config_get(int key, GVariant **data, const struct sr_dev_inst *sdi,
 		devc = sdi->priv;
 		*data = g_variant_new_uint64(devc->cur_samplerate);
 		break;
+	case SR_CONF_CAPTURE_RATIO:
+		if (!sdi)
+			return SR_ERR;
+		devc = sdi->priv;
+		*data = g_variant_new_uint64(devc->capture_ratio);
+		break;
+	case SR_CONF_PROBE_PACKING:
+		if (!sdi)
+			return SR_ERR;
+		devc = sdi->priv;
+		*data = g_variant_new_boolean(devc->probe_packing);
+		break;
 	case SR_CONF_VOLTAGE_THRESHOLD:
 		if (!sdi)
 			return SR_ERR;
@@ -478,6 +531,18 @@ static int config_get(int key, GVariant **data, const struct sr_dev_inst *sdi,
 			break;
 		}
 		break;
+	case SR_CONF_MAX_SAMPLERATE:
+		if (!sdi)
+			return SR_ERR;
+		num_channels = 0;
+		for (l = sdi->probes; l; l = l->next) {
+			probe = l->data;
+			if (probe->enabled)
+				num_channels++;
+		}
+		*data = g_variant_new_uint64(
+				logic16_max_samplerate(num_channels));
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -508,6 +573,15 @@ static int config_set(int key, GVariant *data, const struct sr_dev_inst *sdi,
 	case SR_CONF_LIMIT_SAMPLES:
 		devc->limit_samples = g_variant_get_uint64(data);
 		break;
+	case SR_CONF_CAPTURE_RATIO:
+		if (g_variant_get_uint64(data) > 100)
+			ret = SR_ERR_ARG;
+		else
+			devc->capture_ratio = g_variant_get_uint64(data);
+		break;
+	case SR_CONF_PROBE_PACKING:
+		devc->probe_packing = g_variant_get_boolean(data);
+		break;
 	case SR_CONF_VOLTAGE_THRESHOLD:
 		g_variant_get(data, "(dd)", &low, &high);
 		ret = SR_ERR_ARG;
@@ -556,6 +630,9 @@ static int config_list(int key, GVariant **data, const struct sr_dev_inst *sdi,
 		g_variant_builder_add(&gvb, "{sv}", "samplerates", gvar);
 		*data = g_variant_builder_end(&gvb);
 		break;
+	case SR_CONF_TRIGGER_TYPE:
+		*data = g_variant_new_string(SR_SOFT_TRIGGER_TYPES);
+		break;
 	case SR_CONF_VOLTAGE_THRESHOLD:
 		g_variant_builder_init(&gvb, G_VARIANT_TYPE_ARRAY);
 		for (i = 0; i < ARRAY_SIZE(volt_thresholds); i++) {
@@ -587,7 +664,19 @@ static void abort_acquisition(struct dev_context *devc)
 
 static unsigned int bytes_per_ms(struct dev_context *devc)
 {
-	return devc->cur_samplerate * devc->num_channels / 8000;
+	return MAX(devc->cur_samplerate * devc->num_channels / 8000, 1);
+}
+
+/*
+ * Captures using more than half of the bandwidth the device has for
+ * their number of channels run close to what USB delivers. They get
+ * larger transfers, and more of them in flight, so the host falling
+ * behind for a moment doesn't overflow the device's FIFO.
+ */
+static gboolean high_bandwidth(struct dev_context *devc)
+{
+	return devc->cur_samplerate * 2
+		> logic16_max_samplerate(devc->num_channels);
 }
 
 static size_t get_buffer_size(struct dev_context *devc)
@@ -595,24 +684,35 @@ static size_t get_buffer_size(struct dev_context *devc)
 	size_t s;
 
 	/*
-	 * The buffer should be large enough to hold 10ms of data and
-	 * a multiple of 512.
+	 * The buffer should be large enough to hold 10ms of data (20ms for
+	 * high-bandwidth captures, or what the session's profile makes of
+	 * that) and a multiple of 512.
 	 */
-	s = 10 * bytes_per_ms(devc);
+	s = sr_session_buffer_ms(devc->sdi, high_bandwidth(devc) ? 20 : 10)
+		* bytes_per_ms(devc);
+	s = MIN(s, MAX_TRANSFER_SIZE);
 	return (s + 511) & ~511;
 }
 
 static unsigned int get_number_of_transfers(struct dev_context *devc)
 {
-	unsigned int n;
-
-	/* Total buffer size should be able to hold about 500ms of data. */
-	n = 500 * bytes_per_ms(devc) / get_buffer_size(devc);
+	unsigned int n, max;
 
-	if (n > NUM_SIMUL_TRANSFERS)
-		return NUM_SIMUL_TRANSFERS;
+	/*
+	 * Total buffer size should be able to hold about 500ms of data,
+	 * a whole second for high-bandwidth captures.
+	 */
+	if (high_bandwidth(devc)) {
+		n = sr_session_queue_ms(devc->sdi, 1000);
+		max = MAX_SIMUL_TRANSFERS;
+	} else {
+		n = sr_session_queue_ms(devc->sdi, 500);
+		max = NUM_SIMUL_TRANSFERS;
+	}
+	n = n * bytes_per_ms(devc) / get_buffer_size(devc);
 
-	return n;
+	/* Keep one transfer in flight while the other one is handled. */
+	return CLAMP(n, 2, max);
 }
 
 static unsigned int get_timeout(struct dev_context *devc)
@@ -631,6 +731,7 @@ static int configure_probes(const struct sr_dev_inst *sdi)
 	struct sr_probe *probe;
 	GSList *l;
 	uint16_t probe_bit;
+	int bit;
 
 	devc = sdi->priv;
 
@@ -645,17 +746,21 @@ static int configure_probes(const struct sr_dev_inst *sdi)
 
 		devc->cur_channels |= probe_bit;
 
+		/* Packed, the channels take the lowest bits in turn. */
+		bit = devc->probe_packing ? devc->num_channels : probe->index;
 #ifdef WORDS_BIGENDIAN
 		/*
 		 * Output logic data should be stored in little endian format.
 		 * To speed things up during conversion, do the switcharoo
 		 * here instead.
 		 */
-		probe_bit = 1 << (probe->index ^ 8);
+		bit ^= 8;
 #endif
 
-		devc->channel_masks[devc->num_channels++] = probe_bit;
+		devc->channel_bits[devc->num_channels] = bit;
+		devc->channel_masks[devc->num_channels++] = 1 << bit;
 	}
+	devc->packed_probes = devc->probe_packing ? devc->cur_channels : 0;
 
 	return SR_OK;
 }
@@ -664,22 +769,23 @@ static int receive_data(int fd, int revents, void *cb_data)
 {
 	struct timeval tv;
 	struct dev_context *devc;
-	struct drv_context *drvc;
-	const struct sr_dev_inst *sdi;
 
 	(void)fd;
 	(void)revents;
 
-	sdi = cb_data;
-	drvc = di->priv;
-	devc = sdi->priv;
+	devc = cb_data;
 
-	tv.tv_sec = tv.tv_usec = 0;
-	libusb_handle_events_timeout(drvc->sr_ctx->libusb_ctx, &tv);
+	/* Completions are handled elsewhere if the USB thread runs. */
+	if (!devc->ctx->usb_thread) {
+		tv.tv_sec = tv.tv_usec = 0;
+		libusb_handle_events_timeout(devc->ctx->libusb_ctx, &tv);
+	}
 
 	if (devc->num_samples == -2) {
-		logic16_abort_acquisition(sdi);
+		libusb_lock_events(devc->ctx->libusb_ctx);
+		logic16_abort_acquisition(devc->sdi);
 		abort_acquisition(devc);
+		libusb_unlock_events(devc->ctx->libusb_ctx);
 	}
 
 	return TRUE;
@@ -691,10 +797,8 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	struct drv_context *drvc;
 	struct sr_usb_dev_inst *usb;
 	struct libusb_transfer *transfer;
-	const struct libusb_pollfd **lupfd;
 	unsigned int i, timeout, num_transfers;
 	int ret;
-	unsigned char *buf;
 	size_t size, convsize;
 
 	if (sdi->status != SR_ST_ACTIVE)
@@ -710,10 +814,19 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 		return SR_ERR;
 	}
 
+	/* Needs the probes, and limit_samples for the pre-trigger size. */
+	if ((ret = logic16_configure_trigger(sdi)) != SR_OK) {
+		sr_err("Failed to configure the trigger.");
+		return ret;
+	}
+
 	devc->cb_data = cb_data;
+	devc->sdi = sdi;
+	devc->ctx = drvc->sr_ctx;
 	devc->num_samples = 0;
 	devc->empty_transfer_count = 0;
 	devc->cur_channel = 0;
+	devc->processing = FALSE;
 	memset(devc->channel_data, 0, sizeof(devc->channel_data));
 
 	timeout = get_timeout(devc);
@@ -721,49 +834,59 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	size = get_buffer_size(devc);
 	convsize = (size / devc->num_channels + 2) * 16;
 	devc->submitted_transfers = 0;
-	devc->usbfd = NULL;
+	devc->usb_source = FALSE;
+	devc->bw_start = devc->bw_window_start = 0;
+	devc->bw_bytes = devc->bw_window_bytes = 0;
+	devc->bw_warned = FALSE;
 
-	devc->convbuffer_size = convsize;
-	if (!(devc->convbuffer = g_try_malloc(convsize))) {
-		sr_err("Conversion buffer malloc failed.");
-		return SR_ERR_MALLOC;
+	/* Kept from the last acquisition if the size is still right. */
+	if (!devc->convbuffer || devc->convbuffer_size != convsize) {
+		g_free(devc->convbuffer);
+		devc->convbuffer_size = convsize;
+		if (!(devc->convbuffer = g_try_malloc(convsize))) {
+			sr_err("Conversion buffer malloc failed.");
+			return SR_ERR_MALLOC;
+		}
 	}
 
 	devc->transfers = g_try_malloc0(sizeof(*devc->transfers) * num_transfers);
 	if (!devc->transfers) {
 		sr_err("USB transfers malloc failed.");
-		g_free(devc->convbuffer);
 		return SR_ERR_MALLOC;
 	}
 
 	if ((ret = logic16_setup_acquisition(sdi, devc->cur_samplerate,
 					     devc->cur_channels)) != SR_OK) {
 		g_free(devc->transfers);
-		g_free(devc->convbuffer);
 		return ret;
 	}
 
+	/* Likewise for the transfers, with their buffers. */
+	sr_usb_transfer_pool_trim(devc->ctx, &devc->idle_transfers, size);
+
+	sr_dbg("%u transfers of %zu bytes for %.1f MB/s%s, timeout %u ms.",
+	       num_transfers, size,
+	       (double)bytes_per_ms(devc) / 1000,
+	       high_bandwidth(devc) ? " (high bandwidth)" : "", timeout);
+
 	devc->num_transfers = num_transfers;
 	for (i = 0; i < num_transfers; i++) {
-		if (!(buf = g_try_malloc(size))) {
-			sr_err("USB transfer buffer malloc failed.");
+		if (!(transfer = sr_usb_transfer_get(devc->ctx,
+				&devc->idle_transfers, usb->devhdl, size))) {
+			sr_err("USB transfer malloc failed.");
 			if (devc->submitted_transfers)
 				abort_acquisition(devc);
-			else {
+			else
 				g_free(devc->transfers);
-				g_free(devc->convbuffer);
-			}
 			return SR_ERR_MALLOC;
 		}
-		transfer = libusb_alloc_transfer(0);
 		libusb_fill_bulk_transfer(transfer, usb->devhdl,
-				2 | LIBUSB_ENDPOINT_IN, buf, size,
+				2 | LIBUSB_ENDPOINT_IN, transfer->buffer, size,
 				logic16_receive_transfer, devc, timeout);
 		if ((ret = libusb_submit_transfer(transfer)) != 0) {
 			sr_err("Failed to submit transfer: %s.",
 			       libusb_error_name(ret));
-			libusb_free_transfer(transfer);
-			g_free(buf);
+			sr_usb_transfer_put(&devc->idle_transfers, transfer);
 			abort_acquisition(devc);
 			return SR_ERR;
 		}
@@ -771,24 +894,18 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 		devc->submitted_transfers++;
 	}
 
-	lupfd = libusb_get_pollfds(drvc->sr_ctx->libusb_ctx);
-	for (i = 0; lupfd[i]; i++);
-	devc->usbfd = g_try_malloc(sizeof(struct libusb_pollfd) * (i + 1));
-	if (!devc->usbfd) {
+	if ((ret = sr_usb_source_add(devc->ctx, timeout, receive_data,
+			devc)) != SR_OK) {
 		abort_acquisition(devc);
-		free(lupfd);
-		return SR_ERR;
-	}
-	for (i = 0; lupfd[i]; i++) {
-		sr_source_add(lupfd[i]->fd, lupfd[i]->events,
-			      timeout, receive_data, (void *)sdi);
-		devc->usbfd[i] = lupfd[i]->fd;
+		return ret;
 	}
-	devc->usbfd[i] = -1;
-	free(lupfd);
+	devc->usb_source = TRUE;
 
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
+	if (devc->packed_probes)
+		std_session_send_df_packed_probes(cb_data, devc->packed_probes,
+				LOG_PREFIX);
 
 	if ((ret = logic16_start_acquisition(sdi)) != SR_OK) {
 		abort_acquisition(devc);
@@ -800,6 +917,7 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 
 static int dev_acquisition_stop(struct sr_dev_inst *sdi, void *cb_data)
 {
+	struct drv_context *drvc;
 	int ret;
 
 	(void)cb_data;
@@ -807,9 +925,13 @@ static int dev_acquisition_stop(struct sr_dev_inst *sdi, void *cb_data)
 	if (sdi->status != SR_ST_ACTIVE)
 		return SR_ERR_DEV_CLOSED;
 
-	ret = logic16_abort_acquisition(sdi);
+	drvc = di->priv;
 
+	/* Keep the USB thread from completing transfers meanwhile. */
+	libusb_lock_events(drvc->sr_ctx->libusb_ctx);
+	ret = logic16_abort_acquisition(sdi);
 	abort_acquisition(sdi->priv);
+	libusb_unlock_events(drvc->sr_ctx->libusb_ctx);
 
 	return ret;
 }
@@ -828,6 +950,7 @@ SR_PRIV struct sr_dev_driver saleae_logic16_driver_info = {
 	.config_list = config_list,
 	.dev_open = dev_open,
 	.dev_close = dev_close,
+	.dev_check = dev_check,
 	.dev_acquisition_start = dev_acquisition_start,
 	.dev_acquisition_stop = dev_acquisition_stop,
 	.priv = NULL,
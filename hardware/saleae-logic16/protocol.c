@@ -66,6 +66,13 @@
 
 #define MAX_EMPTY_TRANSFERS		64
 
+/* How much slower than the capture's data rate USB may run, in percent. */
+#define BANDWIDTH_TOLERANCE		10
+
+/* Bitstream data bytes per upload command, and commands in flight. */
+#define FPGA_UPLOAD_CHUNK_SIZE		62
+#define FPGA_UPLOAD_TRANSFERS		16
+
 static void encrypt(uint8_t *dest, const uint8_t *src, uint8_t cnt)
 {
 	uint8_t state1 = 0x9b, state2 = 0x54;
@@ -323,14 +330,157 @@ static int configure_led(const struct sr_dev_inst *sdi)
 	return set_led_mode(sdi, 1, 6250, 0, 1);
 }
 
+/*
+ * Turn a bitstream into the encrypted upload commands carrying it, so
+ * the firmware cache keeps them ready to send. Every command but the
+ * last is a full 64 byte packet.
+ */
+static GBytes *encode_bitstream(const uint8_t *data, size_t size)
+{
+	uint8_t *stream, command[64];
+	size_t offset, out;
+	uint8_t len;
+
+	if (!(stream = g_try_malloc(size + 2 *
+			(size / FPGA_UPLOAD_CHUNK_SIZE + 1)))) {
+		sr_err("%s: stream malloc failed", __func__);
+		return NULL;
+	}
+
+	out = 0;
+	for (offset = 0; offset < size; offset += len) {
+		len = MIN(size - offset, FPGA_UPLOAD_CHUNK_SIZE);
+		command[0] = COMMAND_FPGA_UPLOAD_SEND_DATA;
+		command[1] = len;
+		memcpy(command + 2, data + offset, len);
+		encrypt(stream + out, command, len + 2);
+		out += len + 2;
+	}
+
+	return g_bytes_new_take(stream, out);
+}
+
+struct upload_state {
+	unsigned char *stream;
+	gsize size, offset;
+	int active;
+	int completed;
+	gboolean error;
+};
+
+/* Submit the next upload command on this transfer, if any are left. */
+static int upload_next(struct libusb_transfer *transfer)
+{
+	struct upload_state *state;
+	int len, ret;
+
+	state = transfer->user_data;
+	if (state->error || state->offset >= state->size)
+		return LIBUSB_ERROR_NOT_FOUND;
+
+	len = MIN(state->size - state->offset, 64);
+	transfer->buffer = state->stream + state->offset;
+	transfer->length = len;
+	if ((ret = libusb_submit_transfer(transfer)) != 0) {
+		sr_dbg("Failed to submit bitstream transfer: %s.",
+		       libusb_error_name(ret));
+		state->error = TRUE;
+		return ret;
+	}
+	state->offset += len;
+
+	return 0;
+}
+
+static void LIBUSB_CALL upload_transfer_cb(struct libusb_transfer *transfer)
+{
+	struct upload_state *state;
+
+	state = transfer->user_data;
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED
+	    || transfer->actual_length != transfer->length) {
+		sr_dbg("Bitstream transfer failed: status %d, %d of %d "
+		       "bytes.", transfer->status, transfer->actual_length,
+		       transfer->length);
+		state->error = TRUE;
+	}
+
+	/* Transfers on one endpoint complete in order. */
+	if (upload_next(transfer) != 0 && --state->active == 0)
+		state->completed = 1;
+}
+
+/*
+ * Send the upload commands with several bulk transfers in flight, so
+ * the device never waits for the host between two of them.
+ */
+static int upload_stream(const struct sr_dev_inst *sdi, GBytes *stream)
+{
+	struct drv_context *drvc;
+	struct sr_usb_dev_inst *usb;
+	libusb_context *ctx;
+	struct libusb_transfer *transfers[FPGA_UPLOAD_TRANSFERS];
+	struct upload_state state;
+	struct timeval tv;
+	int i, num_transfers;
+
+	drvc = sdi->driver->priv;
+	usb = sdi->conn;
+	ctx = drvc->sr_ctx->libusb_ctx;
+
+	state.stream = (unsigned char *)g_bytes_get_data(stream, &state.size);
+	state.offset = 0;
+	state.active = 0;
+	state.completed = 0;
+	state.error = FALSE;
+
+	for (i = 0; i < FPGA_UPLOAD_TRANSFERS; i++) {
+		if (!(transfers[i] = libusb_alloc_transfer(0))) {
+			sr_err("%s: transfer malloc failed", __func__);
+			state.error = TRUE;
+			break;
+		}
+		libusb_fill_bulk_transfer(transfers[i], usb->devhdl, 1, NULL, 0,
+				upload_transfer_cb, &state, 1000);
+	}
+	num_transfers = i;
+
+	/* Keep the USB thread, if it runs, out of the callback meanwhile. */
+	libusb_lock_events(ctx);
+	for (i = 0; i < num_transfers; i++) {
+		if (upload_next(transfers[i]) != 0)
+			break;
+		state.active++;
+	}
+	if (state.active == 0)
+		state.completed = 1;
+	libusb_unlock_events(ctx);
+
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	while (!state.completed)
+		libusb_handle_events_timeout_completed(ctx, &tv,
+				&state.completed);
+
+	for (i = 0; i < num_transfers; i++)
+		libusb_free_transfer(transfers[i]);
+
+	if (state.error) {
+		sr_err("Failed to upload FPGA bitstream.");
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}
+
 static int upload_fpga_bitstream(const struct sr_dev_inst *sdi,
 				 enum voltage_range vrange)
 {
 	struct dev_context *devc;
-	int offset, chunksize, ret;
+	int ret;
 	const char *filename;
-	uint8_t len, buf[256 * 62], command[64];
-	FILE *fw;
+	uint8_t command[1];
+	GBytes *stream;
 
 	devc = sdi->priv;
 
@@ -349,40 +499,19 @@ static int upload_fpga_bitstream(const struct sr_dev_inst *sdi,
 		return SR_ERR;
 	}
 
+	/* Loading the FPGA resets its registers. */
+	devc->fpga_regs_valid = FALSE;
+
 	sr_info("Uploading FPGA bitstream at %s.", filename);
-	if ((fw = g_fopen(filename, "rb")) == NULL) {
-		sr_err("Unable to open bitstream file %s for reading: %s.",
-		       filename, strerror(errno));
+	if (!(stream = sr_firmware_get(filename, encode_bitstream)))
 		return SR_ERR;
-	}
 
-	buf[0] = COMMAND_FPGA_UPLOAD_INIT;
-	if ((ret = do_ep1_command(sdi, buf, 1, NULL, 0)) != SR_OK) {
-		fclose(fw);
+	command[0] = COMMAND_FPGA_UPLOAD_INIT;
+	if ((ret = do_ep1_command(sdi, command, 1, NULL, 0)) == SR_OK)
+		ret = upload_stream(sdi, stream);
+	g_bytes_unref(stream);
+	if (ret != SR_OK)
 		return ret;
-	}
-
-	while (1) {
-		chunksize = fread(buf, 1, sizeof(buf), fw);
-		if (chunksize == 0)
-			break;
-
-		for (offset = 0; offset < chunksize; offset += 62) {
-			len = (offset + 62 > chunksize ?
-				chunksize - offset : 62);
-			command[0] = COMMAND_FPGA_UPLOAD_SEND_DATA;
-			command[1] = len;
-			memcpy(command + 2, buf + offset, len);
-			ret = do_ep1_command(sdi, command, len + 2, NULL, 0);
-			if (ret != SR_OK) {
-				fclose(fw);
-				return ret;
-			}
-		}
-
-		sr_info("Uploaded %d bytes.", chunksize);
-	}
-	fclose(fw);
 	sr_info("FPGA bitstream upload done.");
 
 	if ((ret = prime_fpga(sdi)) != SR_OK)
@@ -417,12 +546,43 @@ static int abort_acquisition_sync(const struct sr_dev_inst *sdi)
 	return SR_OK;
 }
 
+/* The samplerate limits, from the most channels down. */
+static const struct {
+	int num_channels;
+	uint64_t samplerate;
+} max_samplerates[] = {
+	{ 13, MAX_13CH_SAMPLE_RATE },
+	{ 10, MAX_10CH_SAMPLE_RATE },
+	{ 8, MAX_8CH_SAMPLE_RATE },
+	{ 7, MAX_7CH_SAMPLE_RATE },
+	{ 4, MAX_4CH_SAMPLE_RATE },
+	{ 0, MAX_SAMPLE_RATE },
+};
+
+/**
+ * Get the highest samplerate the device can stream at with the given
+ * number of channels enabled.
+ *
+ * @private
+ */
+SR_PRIV uint64_t logic16_max_samplerate(int num_channels)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(max_samplerates) - 1; i++)
+		if (num_channels >= max_samplerates[i].num_channels)
+			break;
+
+	return max_samplerates[i].samplerate;
+}
+
 SR_PRIV int logic16_setup_acquisition(const struct sr_dev_inst *sdi,
 			     uint64_t samplerate, uint16_t channels)
 {
 	uint8_t clock_select, reg1, reg10;
 	uint64_t div;
 	int i, ret, nchan = 0;
+	gboolean valid;
 	struct dev_context *devc;
 
 	devc = sdi->priv;
@@ -447,11 +607,7 @@ SR_PRIV int logic16_setup_acquisition(const struct sr_dev_inst *sdi,
 		if (channels & (1U << i))
 			nchan++;
 
-	if ((nchan >= 13 && samplerate > MAX_13CH_SAMPLE_RATE) ||
-	    (nchan >= 10 && samplerate > MAX_10CH_SAMPLE_RATE) ||
-	    (nchan >= 8  && samplerate > MAX_8CH_SAMPLE_RATE) ||
-	    (nchan >= 7  && samplerate > MAX_7CH_SAMPLE_RATE) ||
-	    (nchan >= 4  && samplerate > MAX_4CH_SAMPLE_RATE)) {
+	if (samplerate > logic16_max_samplerate(nchan)) {
 		sr_err("Unable to sample at %" PRIu64 "Hz "
 		       "with this many channels.", samplerate);
 		return SR_ERR;
@@ -472,17 +628,32 @@ SR_PRIV int logic16_setup_acquisition(const struct sr_dev_inst *sdi,
 	if ((ret = write_fpga_register(sdi, 1, 0x40)) != SR_OK)
 		return ret;
 
-	if ((ret = write_fpga_register(sdi, 10, clock_select)) != SR_OK)
-		return ret;
+	/*
+	 * Only the registers whose values changed since the last setup
+	 * are written, which saves most of the round trips when a sweep
+	 * restarts the acquisition with another samplerate or channels.
+	 */
+	valid = devc->fpga_regs_valid;
+	devc->fpga_regs_valid = FALSE;
 
-	if ((ret = write_fpga_register(sdi, 4, (uint8_t)(div - 1))) != SR_OK)
-		return ret;
+	if (!valid || devc->fpga_clock_select != clock_select)
+		if ((ret = write_fpga_register(sdi, 10, clock_select)) != SR_OK)
+			return ret;
 
-	if ((ret = write_fpga_register(sdi, 2, (uint8_t)(channels & 0xff))) != SR_OK)
-		return ret;
+	if (!valid || devc->fpga_divider != (uint8_t)(div - 1))
+		if ((ret = write_fpga_register(sdi, 4,
+				(uint8_t)(div - 1))) != SR_OK)
+			return ret;
 
-	if ((ret = write_fpga_register(sdi, 3, (uint8_t)(channels >> 8))) != SR_OK)
-		return ret;
+	if (!valid || (devc->fpga_channels & 0xff) != (channels & 0xff))
+		if ((ret = write_fpga_register(sdi, 2,
+				(uint8_t)(channels & 0xff))) != SR_OK)
+			return ret;
+
+	if (!valid || (devc->fpga_channels >> 8) != (channels >> 8))
+		if ((ret = write_fpga_register(sdi, 3,
+				(uint8_t)(channels >> 8))) != SR_OK)
+			return ret;
 
 	if ((ret = write_fpga_register(sdi, 1, 0x42)) != SR_OK)
 		return ret;
@@ -507,6 +678,11 @@ SR_PRIV int logic16_setup_acquisition(const struct sr_dev_inst *sdi,
 		return SR_ERR;
 	}
 
+	devc->fpga_clock_select = clock_select;
+	devc->fpga_divider = div - 1;
+	devc->fpga_channels = channels;
+	devc->fpga_regs_valid = TRUE;
+
 	return SR_OK;
 }
 
@@ -576,25 +752,304 @@ SR_PRIV int logic16_init_device(const struct sr_dev_inst *sdi)
 	return SR_OK;
 }
 
+/*
+ * Check that a device left open between sessions still has its FPGA
+ * configured, and is idle, so that none of logic16_init_device() needs
+ * to be done again.
+ */
+SR_PRIV int logic16_check_device(const struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	uint8_t reg1;
+	int ret;
+
+	devc = sdi->priv;
+
+	if (devc->cur_voltage_range == VOLTAGE_RANGE_UNKNOWN)
+		return SR_ERR;
+
+	if ((ret = read_fpga_register(sdi, 1, &reg1)) != SR_OK)
+		return ret;
+
+	if (reg1 != 0x08) {
+		sr_dbg("Invalid state of device left open: 0x%02x != 0x08.",
+		       reg1);
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}
+
+/*
+ * Set up the software trigger from the probes' trigger strings, and the
+ * pre-trigger buffer holding the latest capture ratio's share of
+ * limit_samples while waiting for it. Converted samples have probe n in
+ * bit n, so the trigger works on them directly, unless they are packed.
+ */
+SR_PRIV int logic16_configure_trigger(const struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	struct sr_soft_trigger_stage stages[SR_SOFT_TRIGGER_MAX_STAGES];
+	struct sr_probe *probe;
+	char **triggerlist;
+	GSList *l;
+	int num_probes, num_stages, ret;
+
+	devc = sdi->priv;
+
+	sr_soft_trigger_free(devc->stl);
+	devc->stl = NULL;
+	devc->trigger_fired = TRUE;
+	g_free(devc->pretrig_buf);
+	devc->pretrig_buf = NULL;
+	devc->pretrig_size = devc->pretrig_pos = devc->pretrig_fill = 0;
+
+	num_probes = g_slist_length(sdi->probes);
+	if (!(triggerlist = g_try_malloc0(num_probes * sizeof(char *)))) {
+		sr_err("Trigger list malloc failed.");
+		return SR_ERR_MALLOC;
+	}
+	for (l = sdi->probes; l; l = l->next) {
+		probe = l->data;
+		if (probe->enabled && probe->index < num_probes)
+			triggerlist[probe->index] = probe->trigger;
+	}
+	ret = sr_soft_trigger_compile(sdi, triggerlist, stages, &num_stages);
+	g_free(triggerlist);
+	if (ret != SR_OK)
+		return ret;
+
+	/* Without a trigger, there's nothing to wait for. */
+	if (!num_stages)
+		return SR_OK;
+
+	/* Packed samples have the probes elsewhere. */
+	if (devc->packed_probes)
+		sr_soft_trigger_stages_pack(stages, num_stages,
+				devc->packed_probes);
+
+	if (!(devc->stl = sr_soft_trigger_new(2, stages, num_stages)))
+		return SR_ERR;
+	devc->trigger_fired = FALSE;
+
+	if (!devc->capture_ratio || !devc->limit_samples)
+		return SR_OK;
+
+	devc->pretrig_size = MIN(devc->limit_samples * devc->capture_ratio
+			/ 100, MAX_PRETRIGGER_SIZE / 2) * 2;
+	if (!devc->pretrig_size)
+		return SR_OK;
+
+	if (!(devc->pretrig_buf = g_try_malloc(devc->pretrig_size))) {
+		sr_err("Pre-trigger buffer malloc failed.");
+		devc->pretrig_size = 0;
+		return SR_ERR_MALLOC;
+	}
+
+	return SR_OK;
+}
+
+/* Keep the latest samples converted while waiting for the trigger. */
+static void pretrigger_append(struct dev_context *devc, const uint8_t *data,
+		size_t len)
+{
+	size_t n;
+
+	if (!devc->pretrig_buf)
+		return;
+
+	/* Only the newest pretrig_size bytes can survive anyway. */
+	if (len > devc->pretrig_size) {
+		data += len - devc->pretrig_size;
+		len = devc->pretrig_size;
+	}
+
+	while (len) {
+		n = MIN(len, devc->pretrig_size - devc->pretrig_pos);
+		memcpy(devc->pretrig_buf + devc->pretrig_pos, data, n);
+		devc->pretrig_pos = (devc->pretrig_pos + n)
+				% devc->pretrig_size;
+		devc->pretrig_fill = MIN(devc->pretrig_fill + n,
+				devc->pretrig_size);
+		data += n;
+		len -= n;
+	}
+}
+
+static void send_logic(struct dev_context *devc, const uint8_t *data,
+		size_t len)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+
+	if (!len)
+		return;
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.length = len;
+	logic.unitsize = 2;
+	logic.data = (void *)data;
+	sr_session_send(devc->cb_data, &packet);
+
+	devc->num_samples += len / 2;
+}
+
+/*
+ * Send the samples preceding the trigger: the pre-trigger buffer (oldest
+ * part first), then the converted data up to the start of the trigger
+ * match. The matching samples themselves are sent separately, so they're
+ * left out here; 'skip' is the number of bytes of them that are still in
+ * the pre-trigger buffer.
+ */
+static void pretrigger_send(struct dev_context *devc, const uint8_t *cur_buf,
+		size_t cur_len, size_t skip)
+{
+	size_t start, len, first;
+
+	if (!devc->pretrig_buf)
+		return;
+
+	skip = MIN(skip, devc->pretrig_fill);
+	len = devc->pretrig_fill - skip;
+
+	/* Drop the oldest samples if the converted data has enough. */
+	if (cur_len >= devc->pretrig_size)
+		len = 0;
+	else
+		len = MIN(len, devc->pretrig_size - cur_len);
+
+	start = (devc->pretrig_pos + devc->pretrig_size - skip - len)
+			% devc->pretrig_size;
+	first = MIN(len, devc->pretrig_size - start);
+	send_logic(devc, devc->pretrig_buf + start, first);
+	send_logic(devc, devc->pretrig_buf, len - first);
+
+	if (cur_len > devc->pretrig_size) {
+		cur_buf += cur_len - devc->pretrig_size;
+		cur_len = devc->pretrig_size;
+	}
+	send_logic(devc, cur_buf, cur_len);
+
+	devc->pretrig_fill = 0;
+}
+
+/*
+ * Pass on converted samples, or keep them back until the trigger fires.
+ * When it does, the samples from before it are sent (as many as the
+ * capture ratio asks for), then an SR_DF_TRIGGER packet, then the rest.
+ */
+static void send_samples(struct dev_context *devc, const uint8_t *data,
+		size_t len)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_stage_timer timer;
+	int64_t match, num_stages, pre_samples;
+
+	if (devc->trigger_fired) {
+		send_logic(devc, data, len);
+		return;
+	}
+
+	sr_stage_begin(devc->sdi->session, &timer);
+	match = sr_soft_trigger_scan(devc->stl, data, len / 2);
+	sr_stage_end(devc->sdi->session, &timer, "trigger", "saleae-logic16",
+		     len / 2);
+	if (match < 0) {
+		/* Still waiting, keep the data in case it's pre-trigger. */
+		pretrigger_append(devc, data, len);
+		return;
+	}
+
+	sr_dbg("Software trigger fired.");
+	devc->trigger_fired = TRUE;
+	num_stages = devc->stl->num_stages;
+	pre_samples = MAX(match - num_stages, 0);
+	pretrigger_send(devc, data, pre_samples * 2,
+			(num_stages - (match - pre_samples)) * 2);
+
+	packet.type = SR_DF_TRIGGER;
+	packet.payload = NULL;
+	sr_session_send(devc->cb_data, &packet);
+
+	/* The samples that matched, then the ones after them. */
+	send_logic(devc, devc->stl->matched, num_stages * 2);
+	send_logic(devc, data + match * 2, len - match * 2);
+}
+
+static double bytes_per_sec(const struct dev_context *devc)
+{
+	return (double)devc->cur_samplerate * devc->num_channels / 8;
+}
+
+/*
+ * Measure the rate the data comes in at over windows of about a second,
+ * and warn once if it falls behind the rate the capture produces data
+ * at. The device's FIFO then fills up, and the capture will fail.
+ * Timing starts with the first transfer, whose data doesn't count.
+ */
+static void bandwidth_update(struct dev_context *devc, size_t length)
+{
+	int64_t now;
+	double rate;
+
+	now = g_get_monotonic_time();
+	if (!devc->bw_start) {
+		devc->bw_start = devc->bw_window_start = now;
+		return;
+	}
+	devc->bw_bytes += length;
+	devc->bw_window_bytes += length;
+
+	if (now - devc->bw_window_start < G_USEC_PER_SEC)
+		return;
+
+	rate = (double)devc->bw_window_bytes * G_USEC_PER_SEC
+		/ (now - devc->bw_window_start);
+	if (!devc->bw_warned && rate * 100 < bytes_per_sec(devc)
+			* (100 - BANDWIDTH_TOLERANCE)) {
+		sr_warn("USB delivers %.1f MB/s, but the capture needs "
+			"%.1f MB/s. Samples will be lost; use fewer channels "
+			"or a lower samplerate.", rate / 1000000,
+			bytes_per_sec(devc) / 1000000);
+		devc->bw_warned = TRUE;
+	}
+	devc->bw_window_start = now;
+	devc->bw_window_bytes = 0;
+}
+
 static void finish_acquisition(struct dev_context *devc)
 {
 	struct sr_datafeed_packet packet;
-	int i;
+	int64_t elapsed;
+
+	if ((elapsed = g_get_monotonic_time() - devc->bw_start) > 0
+	    && devc->bw_bytes)
+		sr_info("Measured USB bandwidth %.1f MB/s, expected %.1f MB/s.",
+			(double)devc->bw_bytes / elapsed,
+			bytes_per_sec(devc) / 1000000);
 
 	/* Terminate session. */
 	packet.type = SR_DF_END;
 	sr_session_send(devc->cb_data, &packet);
 
-	/* Remove fds from polling. */
-	if (devc->usbfd != NULL) {
-		for (i = 0; devc->usbfd[i] != -1; i++)
-			sr_source_remove(devc->usbfd[i]);
-		g_free(devc->usbfd);
+	if (devc->usb_source) {
+		sr_usb_source_remove(devc->ctx, devc);
+		devc->usb_source = FALSE;
 	}
 
 	devc->num_transfers = 0;
 	g_free(devc->transfers);
-	g_free(devc->convbuffer);
+
+	/*
+	 * The transfers, the spare buffer and the conversion buffer stay
+	 * for the next acquisition.
+	 */
+	g_free(devc->pretrig_buf);
+	devc->pretrig_buf = NULL;
+
+	sr_soft_trigger_free(devc->stl);
+	devc->stl = NULL;
 }
 
 static void free_transfer(struct libusb_transfer *transfer)
@@ -604,10 +1059,7 @@ static void free_transfer(struct libusb_transfer *transfer)
 
 	devc = transfer->user_data;
 
-	g_free(transfer->buffer);
-	transfer->buffer = NULL;
-	libusb_free_transfer(transfer);
-
+	/* Clear the slot first, so aborting never sees a freed transfer. */
 	for (i = 0; i < devc->num_transfers; i++) {
 		if (devc->transfers[i] == transfer) {
 			devc->transfers[i] = NULL;
@@ -615,8 +1067,10 @@ static void free_transfer(struct libusb_transfer *transfer)
 		}
 	}
 
+	sr_usb_transfer_put(&devc->idle_transfers, transfer);
+
 	devc->submitted_transfers--;
-	if (devc->submitted_transfers == 0)
+	if (devc->submitted_transfers == 0 && !devc->processing)
 		finish_acquisition(devc);
 }
 
@@ -624,6 +1078,7 @@ static void resubmit_transfer(struct libusb_transfer *transfer)
 {
 	int ret;
 
+	SR_TRACE2(logic16_transfer_resubmit, transfer, transfer->length);
 	if ((ret = libusb_submit_transfer(transfer)) == LIBUSB_SUCCESS)
 		return;
 
@@ -633,12 +1088,40 @@ static void resubmit_transfer(struct libusb_transfer *transfer)
 	sr_err("%s: %s", __func__, libusb_error_name(ret));
 }
 
+/*
+ * Transpose a 16x16 bit matrix in place, swapping bit 15 - j of word i
+ * with bit 15 - i of word j. Every step swaps the off-diagonal blocks
+ * of all the subwords, halving their size until single bits remain.
+ */
+static void transpose_16x16(uint16_t *m)
+{
+	uint16_t mask, t;
+	int j, k;
+
+	mask = 0x00ff;
+	for (j = 8; j != 0; j >>= 1, mask ^= mask << j) {
+		for (k = 0; k < 16; k = (k + j + 1) & ~j) {
+			t = (m[k] ^ (m[k + j] >> j)) & mask;
+			m[k] ^= t;
+			m[k + j] ^= t << j;
+		}
+	}
+}
+
+/*
+ * The device sends one 16-bit word per enabled channel for every 16
+ * samples, the first sample in the MSB. Whole groups of words are
+ * turned into samples with a single matrix transpose. Only a group
+ * split across two transfers goes through the bit-by-bit path, which
+ * keeps its state in devc->channel_data.
+ */
 static size_t convert_sample_data(struct dev_context *devc,
 				  uint8_t *dest, size_t destcnt,
 				  const uint8_t *src, size_t srccnt)
 {
 	uint16_t *channel_data;
-	int i, cur_channel;
+	uint16_t words[16];
+	int i, cur_channel, num_channels;
 	size_t ret = 0;
 	uint16_t sample, channel_mask;
 
@@ -646,10 +1129,30 @@ static size_t convert_sample_data(struct dev_context *devc,
 
 	channel_data = devc->channel_data;
 	cur_channel = devc->cur_channel;
+	num_channels = devc->num_channels;
+
+	while (srccnt) {
+		if (cur_channel == 0 && srccnt >= (size_t)num_channels) {
+			if (destcnt < 16 * 2) {
+				sr_err("Conversion buffer too small!");
+				break;
+			}
+			memset(words, 0, sizeof(words));
+			for (i = 0; i < num_channels; i++, src += 2)
+				words[15 - devc->channel_bits[i]] =
+						src[0] | (src[1] << 8);
+			transpose_16x16(words);
+			memcpy(dest, words, 16 * 2);
+			srccnt -= num_channels;
+			dest += 16 * 2;
+			ret += 16 * 2;
+			destcnt -= 16 * 2;
+			continue;
+		}
 
-	while (srccnt--) {
 		sample = src[0] | (src[1] << 8);
 		src += 2;
+		srccnt--;
 
 		channel_mask = devc->channel_masks[cur_channel];
 
@@ -657,7 +1160,7 @@ static size_t convert_sample_data(struct dev_context *devc,
 			if (sample & 1)
 				channel_data[i] |= channel_mask;
 
-		if (++cur_channel == devc->num_channels) {
+		if (++cur_channel == num_channels) {
 			cur_channel = 0;
 			if (destcnt < 16 * 2) {
 				sr_err("Conversion buffer too small!");
@@ -679,10 +1182,11 @@ static size_t convert_sample_data(struct dev_context *devc,
 SR_PRIV void logic16_receive_transfer(struct libusb_transfer *transfer)
 {
 	gboolean packet_has_error = FALSE;
-	struct sr_datafeed_packet packet;
-	struct sr_datafeed_logic logic;
 	struct dev_context *devc;
+	struct sr_stage_timer timer;
 	size_t converted_length;
+	uint8_t *cur_buf;
+	int cur_length;
 
 	devc = transfer->user_data;
 
@@ -695,8 +1199,10 @@ SR_PRIV void logic16_receive_transfer(struct libusb_transfer *transfer)
 		return;
 	}
 
-	sr_info("receive_transfer(): status %d received %d bytes.",
+	sr_spew("receive_transfer(): status %d received %d bytes.",
 		transfer->status, transfer->actual_length);
+	SR_TRACE3(logic16_transfer_done, transfer, transfer->status,
+			transfer->actual_length);
 
 	switch (transfer->status) {
 	case LIBUSB_TRANSFER_NO_DEVICE:
@@ -720,6 +1226,7 @@ SR_PRIV void logic16_receive_transfer(struct libusb_transfer *transfer)
 	}
 
 	if (transfer->actual_length == 0 || packet_has_error) {
+		sr_session_dev_stats_add(devc->cb_data, 0, 1);
 		devc->empty_transfer_count++;
 		if (devc->empty_transfer_count > MAX_EMPTY_TRANSFERS) {
 			/*
@@ -736,27 +1243,56 @@ SR_PRIV void logic16_receive_transfer(struct libusb_transfer *transfer)
 		devc->empty_transfer_count = 0;
 	}
 
+	bandwidth_update(devc, transfer->actual_length);
+
+	/*
+	 * Queue the transfer again right away with the spare buffer, so the
+	 * host controller doesn't run a transfer short while this one's data
+	 * is converted. Until that's done, the acquisition can't finish.
+	 */
+	cur_buf = transfer->buffer;
+	cur_length = transfer->actual_length;
+	if (!devc->spare_buf || devc->spare_size != (size_t)transfer->length) {
+		sr_usb_buffer_free(devc->ctx, devc->spare_buf,
+				devc->spare_size);
+		devc->spare_buf = sr_usb_dev_buffer_alloc(devc->ctx,
+				transfer->dev_handle, transfer->length);
+		devc->spare_size = transfer->length;
+	}
+	if (devc->spare_buf) {
+		transfer->buffer = devc->spare_buf;
+		devc->spare_buf = NULL;
+		devc->processing = TRUE;
+		resubmit_transfer(transfer);
+		transfer = NULL;
+	}
+
+	sr_stage_begin(devc->sdi->session, &timer);
 	converted_length = convert_sample_data(devc, devc->convbuffer,
-				devc->convbuffer_size, transfer->buffer,
-				transfer->actual_length);
+				devc->convbuffer_size, cur_buf, cur_length);
+	sr_stage_end(devc->sdi->session, &timer, "convert", "saleae-logic16",
+		     converted_length / 2);
 
 	if (converted_length > 0) {
 		/* Send the incoming transfer to the session bus. */
-		packet.type = SR_DF_LOGIC;
-		packet.payload = &logic;
-		logic.length = converted_length;
-		logic.unitsize = 2;
-		logic.data = devc->convbuffer;
-		sr_session_send(devc->cb_data, &packet);
-
-		devc->num_samples += converted_length / 2;
+		send_samples(devc, devc->convbuffer, converted_length);
 		if (devc->limit_samples &&
-		    (uint64_t)devc->num_samples > devc->limit_samples) {
+		    (uint64_t)devc->num_samples > devc->limit_samples)
 			devc->num_samples = -2;
+	}
+
+	/* Without a spare buffer, the transfer is queued again only now. */
+	if (transfer) {
+		if (devc->num_samples == -2)
 			free_transfer(transfer);
-			return;
-		}
+		else
+			resubmit_transfer(transfer);
+		return;
 	}
 
-	resubmit_transfer(transfer);
+	/* The buffer is the next transfer's. */
+	devc->spare_buf = cur_buf;
+	devc->processing = FALSE;
+	if (devc->submitted_transfers == 0)
+		finish_acquisition(devc);
 }
@@ -30,11 +30,14 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "saleae-logic16: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/* Upper limit for the pre-trigger buffer, in bytes. */
+#define MAX_PRETRIGGER_SIZE	(64 * 1024 * 1024)
 
 enum voltage_range {
 	VOLTAGE_RANGE_UNKNOWN,
@@ -67,6 +70,39 @@ struct dev_context {
 	/** Channels to use. */
 	uint16_t cur_channels;
 
+	/*
+	 * What the FPGA's clock and channel registers were last set to,
+	 * so that a new acquisition only writes the ones that changed.
+	 * Not valid after the FPGA is loaded, or if setting up failed.
+	 */
+	gboolean fpga_regs_valid;
+	uint8_t fpga_clock_select;
+	uint8_t fpga_divider;
+	uint16_t fpga_channels;
+
+	/** Whether the samples only hold the channels used, see
+	 * SR_CONF_PROBE_PACKING. */
+	gboolean probe_packing;
+
+	/** The channels the samples hold when packed, 0 if they aren't. */
+	uint64_t packed_probes;
+
+	/** Percentage of limit_samples to send from before the trigger. */
+	uint64_t capture_ratio;
+
+	/* The software trigger; NULL without one. */
+	struct sr_soft_trigger *stl;
+	gboolean trigger_fired;
+
+	/*
+	 * Ring buffer of the latest samples converted before the trigger,
+	 * sized by the capture ratio. All sizes are in bytes.
+	 */
+	uint8_t *pretrig_buf;
+	size_t pretrig_size;
+	size_t pretrig_pos;
+	size_t pretrig_fill;
+
 	/* EEPROM data from address 8. */
 	uint8_t eeprom_data[8];
 
@@ -75,14 +111,36 @@ struct dev_context {
 	int empty_transfer_count;
 	int num_channels, cur_channel;
 	uint16_t channel_masks[16];
+	/* Bit in the output sample each channel goes to. */
+	uint8_t channel_bits[16];
 	uint16_t channel_data[16];
 	uint8_t *convbuffer;
 	size_t convbuffer_size;
 
+	/*
+	 * The buffer a completed transfer is resubmitted with, while its
+	 * own one is converted. Meanwhile, processing is set.
+	 */
+	uint8_t *spare_buf;
+	size_t spare_size;
+	gboolean processing;
+
 	void *cb_data;
+	const struct sr_dev_inst *sdi;
+	struct sr_context *ctx;
+	gboolean usb_source;
 	unsigned int num_transfers;
 	struct libusb_transfer **transfers;
-	int *usbfd;
+	/*
+	 * Transfers of earlier acquisitions, with their buffers, for the
+	 * next one to reuse. See sr_usb_transfer_get().
+	 */
+	GSList *idle_transfers;
+
+	/* USB bandwidth measurement. */
+	int64_t bw_start, bw_window_start;
+	uint64_t bw_bytes, bw_window_bytes;
+	gboolean bw_warned;
 };
 
 SR_PRIV int logic16_setup_acquisition(const struct sr_dev_inst *sdi,
@@ -90,6 +148,9 @@ SR_PRIV int logic16_setup_acquisition(const struct sr_dev_inst *sdi,
 SR_PRIV int logic16_start_acquisition(const struct sr_dev_inst *sdi);
 SR_PRIV int logic16_abort_acquisition(const struct sr_dev_inst *sdi);
 SR_PRIV int logic16_init_device(const struct sr_dev_inst *sdi);
+SR_PRIV int logic16_configure_trigger(const struct sr_dev_inst *sdi);
+SR_PRIV int logic16_check_device(const struct sr_dev_inst *sdi);
 SR_PRIV void logic16_receive_transfer(struct libusb_transfer *transfer);
+SR_PRIV uint64_t logic16_max_samplerate(int num_channels);
 
 #endif
@@ -39,6 +39,8 @@ static const int32_t hwcaps[] = {
 	SR_CONF_LIMIT_SAMPLES,
 	SR_CONF_LIMIT_MSEC,
 	SR_CONF_CONTINUOUS,
+	SR_CONF_BATCH_SAMPLES,
+	SR_CONF_BATCH_MSEC,
 };
 
 SR_PRIV struct sr_dev_driver digitek_dt4000zc_driver_info;
@@ -69,98 +71,106 @@ SR_PRIV struct sr_dev_driver iso_tech_idm103n_driver_info;
 SR_PRIV struct dmm_info dmms[] = {
 	{
 		"Digitek", "DT4000ZC", "2400/8n1/dtr=1", 2400,
-		FS9721_PACKET_SIZE, NULL,
+		FS9721_PACKET_SIZE, FS9721_PACKET_SYNC, NULL,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		sr_fs9721_10_temp_c,
 		&digitek_dt4000zc_driver_info, receive_data_DIGITEK_DT4000ZC,
 	},
 	{
 		"TekPower", "TP4000ZC", "2400/8n1/dtr=1", 2400,
-		FS9721_PACKET_SIZE, NULL,
+		FS9721_PACKET_SIZE, FS9721_PACKET_SYNC, NULL,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		sr_fs9721_10_temp_c,
 		&tekpower_tp4000zc_driver_info, receive_data_TEKPOWER_TP4000ZC,
 	},
 	{
 		"Metex", "ME-31", "600/7n2/rts=0/dtr=1", 600,
-		METEX14_PACKET_SIZE, sr_metex14_packet_request,
+		METEX14_PACKET_SIZE, METEX14_PACKET_SYNC,
+		sr_metex14_packet_request,
 		sr_metex14_packet_valid, sr_metex14_parse,
 		NULL,
 		&metex_me31_driver_info, receive_data_METEX_ME31,
 	},
 	{
 		"Peaktech", "3410", "600/7n2/rts=0/dtr=1", 600,
-		METEX14_PACKET_SIZE, sr_metex14_packet_request,
+		METEX14_PACKET_SIZE, METEX14_PACKET_SYNC,
+		sr_metex14_packet_request,
 		sr_metex14_packet_valid, sr_metex14_parse,
 		NULL,
 		&peaktech_3410_driver_info, receive_data_PEAKTECH_3410,
 	},
 	{
 		"MASTECH", "MAS345", "600/7n2/rts=0/dtr=1", 600,
-		METEX14_PACKET_SIZE, sr_metex14_packet_request,
+		METEX14_PACKET_SIZE, METEX14_PACKET_SYNC,
+		sr_metex14_packet_request,
 		sr_metex14_packet_valid, sr_metex14_parse,
 		NULL,
 		&mastech_mas345_driver_info, receive_data_MASTECH_MAS345,
 	},
 	{
 		"V&A", "VA18B", "2400/8n1", 2400,
-		FS9721_PACKET_SIZE, NULL,
+		FS9721_PACKET_SIZE, FS9721_PACKET_SYNC, NULL,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		sr_fs9721_01_temp_c,
 		&va_va18b_driver_info, receive_data_VA_VA18B,
 	},
 	{
 		"Metex", "M-3640D", "1200/7n2/rts=0/dtr=1", 1200,
-		METEX14_PACKET_SIZE, sr_metex14_packet_request,
+		METEX14_PACKET_SIZE, METEX14_PACKET_SYNC,
+		sr_metex14_packet_request,
 		sr_metex14_packet_valid, sr_metex14_parse,
 		NULL,
 		&metex_m3640d_driver_info, receive_data_METEX_M3640D,
 	},
 	{
 		"Metex", "M-4650CR", "1200/7n2/rts=0/dtr=1", 1200,
-		METEX14_PACKET_SIZE, sr_metex14_packet_request,
+		METEX14_PACKET_SIZE, METEX14_PACKET_SYNC,
+		sr_metex14_packet_request,
 		sr_metex14_packet_valid, sr_metex14_parse,
 		NULL,
 		&metex_m4650cr_driver_info, receive_data_METEX_M4650CR,
 	},
 	{
 		"PeakTech", "4370", "1200/7n2/rts=0/dtr=1", 1200,
-		METEX14_PACKET_SIZE, sr_metex14_packet_request,
+		METEX14_PACKET_SIZE, METEX14_PACKET_SYNC,
+		sr_metex14_packet_request,
 		sr_metex14_packet_valid, sr_metex14_parse,
 		NULL,
 		&peaktech_4370_driver_info, receive_data_PEAKTECH_4370,
 	},
 	{
 		"PCE", "PCE-DM32", "2400/8n1", 2400,
-		FS9721_PACKET_SIZE, NULL,
+		FS9721_PACKET_SIZE, FS9721_PACKET_SYNC, NULL,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		sr_fs9721_01_10_temp_f_c,
 		&pce_pce_dm32_driver_info, receive_data_PCE_PCE_DM32,
 	},
 	{
 		"RadioShack", "22-168", "1200/7n2/rts=0/dtr=1", 1200,
-		METEX14_PACKET_SIZE, sr_metex14_packet_request,
+		METEX14_PACKET_SIZE, METEX14_PACKET_SYNC,
+		sr_metex14_packet_request,
 		sr_metex14_packet_valid, sr_metex14_parse,
 		NULL,
 		&radioshack_22_168_driver_info, receive_data_RADIOSHACK_22_168,
 	},
 	{
 		"RadioShack", "22-805", "600/7n2/rts=0/dtr=1", 600,
-		METEX14_PACKET_SIZE, sr_metex14_packet_request,
+		METEX14_PACKET_SIZE, METEX14_PACKET_SYNC,
+		sr_metex14_packet_request,
 		sr_metex14_packet_valid, sr_metex14_parse,
 		NULL,
 		&radioshack_22_805_driver_info, receive_data_RADIOSHACK_22_805,
 	},
 	{
 		"RadioShack", "22-812", "4800/8n1/rts=0/dtr=1", 4800,
-		RS9LCD_PACKET_SIZE, NULL,
+		RS9LCD_PACKET_SIZE, RS9LCD_PACKET_SYNC, NULL,
 		sr_rs9lcd_packet_valid, sr_rs9lcd_parse,
 		NULL,
 		&radioshack_22_812_driver_info, receive_data_RADIOSHACK_22_812,
 	},
 	{
 		"Tecpel", "DMM-8061 (UT-D02 cable)", "2400/8n1/rts=0/dtr=1",
-		2400, FS9721_PACKET_SIZE, NULL,
+		2400, FS9721_PACKET_SIZE, FS9721_PACKET_SYNC, NULL,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		sr_fs9721_00_temp_c,
 		&tecpel_dmm_8061_ser_driver_info,
@@ -168,21 +178,23 @@ SR_PRIV struct dmm_info dmms[] = {
 	},
 	{
 		"Voltcraft", "M-3650D", "1200/7n2/rts=0/dtr=1", 1200,
-		METEX14_PACKET_SIZE, sr_metex14_packet_request,
+		METEX14_PACKET_SIZE, METEX14_PACKET_SYNC,
+		sr_metex14_packet_request,
 		sr_metex14_packet_valid, sr_metex14_parse,
 		NULL,
 		&voltcraft_m3650d_driver_info, receive_data_VOLTCRAFT_M3650D,
 	},
 	{
 		"Voltcraft", "M-4650CR", "1200/7n2/rts=0/dtr=1", 1200,
-		METEX14_PACKET_SIZE, sr_metex14_packet_request,
+		METEX14_PACKET_SIZE, METEX14_PACKET_SYNC,
+		sr_metex14_packet_request,
 		sr_metex14_packet_valid, sr_metex14_parse,
 		NULL,
 		&voltcraft_m4650cr_driver_info, receive_data_VOLTCRAFT_M4650CR,
 	},
 	{
 		"Voltcraft", "VC-820 (UT-D02 cable)", "2400/8n1/rts=0/dtr=1",
-		2400, FS9721_PACKET_SIZE, NULL,
+		2400, FS9721_PACKET_SIZE, FS9721_PACKET_SYNC, NULL,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		NULL,
 		&voltcraft_vc820_ser_driver_info,
@@ -195,7 +207,7 @@ SR_PRIV struct dmm_info dmms[] = {
 		 * bit "z1" to indicate "diode mode" and "voltage".
 		 */
 		"Voltcraft", "VC-830 (UT-D02 cable)", "2400/8n1/rts=0/dtr=1",
-		2400, FS9922_PACKET_SIZE, NULL,
+		2400, FS9922_PACKET_SIZE, FS9922_PACKET_SYNC, NULL,
 		sr_fs9922_packet_valid, sr_fs9922_parse,
 		&sr_fs9922_z1_diode,
 		&voltcraft_vc830_ser_driver_info,
@@ -203,7 +215,7 @@ SR_PRIV struct dmm_info dmms[] = {
 	},
 	{
 		"Voltcraft", "VC-840 (UT-D02 cable)", "2400/8n1/rts=0/dtr=1",
-		2400, FS9721_PACKET_SIZE, NULL,
+		2400, FS9721_PACKET_SIZE, FS9721_PACKET_SYNC, NULL,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		sr_fs9721_00_temp_c,
 		&voltcraft_vc840_ser_driver_info,
@@ -211,7 +223,7 @@ SR_PRIV struct dmm_info dmms[] = {
 	},
 	{
 		"UNI-T", "UT60A (UT-D02 cable)", "2400/8n1/rts=0/dtr=1",
-		2400, FS9721_PACKET_SIZE, NULL,
+		2400, FS9721_PACKET_SIZE, FS9721_PACKET_SYNC, NULL,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		NULL,
 		&uni_t_ut60a_ser_driver_info,
@@ -219,7 +231,7 @@ SR_PRIV struct dmm_info dmms[] = {
 	},
 	{
 		"UNI-T", "UT60E (UT-D02 cable)", "2400/8n1/rts=0/dtr=1",
-		2400, FS9721_PACKET_SIZE, NULL,
+		2400, FS9721_PACKET_SIZE, FS9721_PACKET_SYNC, NULL,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		sr_fs9721_00_temp_c,
 		&uni_t_ut60e_ser_driver_info,
@@ -227,28 +239,46 @@ SR_PRIV struct dmm_info dmms[] = {
 	},
 	{
 		"UNI-T", "UT61D (UT-D02 cable)", "2400/8n1/rts=0/dtr=1",
-		2400, FS9922_PACKET_SIZE, NULL,
+		2400, FS9922_PACKET_SIZE, FS9922_PACKET_SYNC, NULL,
 		sr_fs9922_packet_valid, sr_fs9922_parse, NULL,
 		&uni_t_ut61d_ser_driver_info, receive_data_UNI_T_UT61D_SER,
 	},
 	{
 		/* Note: ES51922 baudrate is actually 19230! */
 		"UNI-T", "UT61E (UT-D02 cable)", "19200/7o1/rts=0/dtr=1",
-		19200, ES51922_PACKET_SIZE, NULL,
+		19200, ES51922_PACKET_SIZE, ES51922_PACKET_SYNC, NULL,
 		sr_es51922_packet_valid, sr_es51922_parse, NULL,
 		&uni_t_ut61e_ser_driver_info, receive_data_UNI_T_UT61E_SER,
 	},
 	{
 		"ISO-TECH", "IDM103N", "2400/7o1/rts=0/dtr=1",
-		2400, ES519XX_11B_PACKET_SIZE, NULL,
+		2400, ES519XX_11B_PACKET_SIZE, ES519XX_11B_PACKET_SYNC, NULL,
 		sr_es519xx_2400_11b_packet_valid, sr_es519xx_2400_11b_parse, NULL,
 		&iso_tech_idm103n_driver_info, receive_data_ISO_TECH_IDM103N,
 	},
 };
 
+static void clear_helper(void *priv)
+{
+	struct dev_context *devc;
+	unsigned int i;
+
+	devc = priv;
+
+	/* The first port's serial instance is sdi->conn. */
+	for (i = 0; i < devc->num_ports; i++) {
+		if (i > 0)
+			sr_serial_dev_inst_free(devc->ports[i].serial);
+		g_slist_free(devc->ports[i].probes);
+	}
+	g_free(devc->ports);
+	g_free(devc->values);
+	g_free(devc);
+}
+
 static int dev_clear(int dmm)
 {
-	return std_dev_clear(dmms[dmm].di, NULL);
+	return std_dev_clear(dmms[dmm].di, clear_helper);
 }
 
 static int init(struct sr_context *sr_ctx, int dmm)
@@ -258,14 +288,11 @@ static int init(struct sr_context *sr_ctx, int dmm)
 	return std_init(sr_ctx, dmms[dmm].di, LOG_PREFIX);
 }
 
-static GSList *sdmm_scan(const char *conn, const char *serialcomm, int dmm)
+/* Check whether there's a DMM on the port, returns its serial instance. */
+static struct sr_serial_dev_inst *sdmm_probe_port(const char *conn,
+		const char *serialcomm, int dmm)
 {
-	struct sr_dev_inst *sdi;
-	struct drv_context *drvc;
-	struct dev_context *devc;
-	struct sr_probe *probe;
 	struct sr_serial_dev_inst *serial;
-	GSList *devices;
 	int dropped, ret;
 	size_t len;
 	uint8_t buf[128];
@@ -273,20 +300,20 @@ static GSList *sdmm_scan(const char *conn, const char *serialcomm, int dmm)
 	if (!(serial = sr_serial_dev_inst_new(conn, serialcomm)))
 		return NULL;
 
-	if (serial_open(serial, SERIAL_RDWR | SERIAL_NONBLOCK) != SR_OK)
+	if (serial_open(serial, SERIAL_RDWR | SERIAL_NONBLOCK) != SR_OK) {
+		sr_serial_dev_inst_free(serial);
 		return NULL;
+	}
 
 	sr_info("Probing serial port %s.", conn);
 
-	drvc = dmms[dmm].di->priv;
-	devices = NULL;
 	serial_flush(serial);
 
 	/* Request a packet if the DMM requires this. */
 	if (dmms[dmm].packet_request) {
 		if ((ret = dmms[dmm].packet_request(serial)) < 0) {
 			sr_err("Failed to request packet: %d.", ret);
-			return FALSE;
+			goto probe_fail;
 		}
 	}
 
@@ -302,7 +329,7 @@ static GSList *sdmm_scan(const char *conn, const char *serialcomm, int dmm)
 				   dmms[dmm].packet_valid, 1000,
 				   dmms[dmm].baudrate);
 	if (ret != SR_OK)
-		goto scan_cleanup;
+		goto probe_fail;
 
 	/*
 	 * If we dropped more than two packets worth of data, something is
@@ -316,6 +343,44 @@ static GSList *sdmm_scan(const char *conn, const char *serialcomm, int dmm)
 		sr_warn("Had to drop too much data.");
 
 	sr_info("Found device on port %s.", conn);
+	serial_close(serial);
+
+	return serial;
+
+probe_fail:
+	serial_close(serial);
+	sr_serial_dev_inst_free(serial);
+
+	return NULL;
+}
+
+/*
+ * Several ports can be given, separated by DMM_CONN_SEPARATOR. The meters
+ * found on them, which must all be of the same model, become the probes
+ * of one device. The device isn't added to the driver's list here.
+ */
+static GSList *sdmm_scan(const char *conn, const char *serialcomm, int dmm)
+{
+	struct sr_dev_inst *sdi;
+	struct dev_context *devc;
+	struct sr_probe *probe;
+	struct sr_serial_dev_inst *serial;
+	GSList *devices, *serials, *l;
+	gchar **ports, *name;
+	unsigned int i;
+
+	devices = serials = NULL;
+
+	ports = g_strsplit(conn, DMM_CONN_SEPARATOR, 0);
+	for (i = 0; ports[i]; i++) {
+		if (*ports[i] && (serial = sdmm_probe_port(ports[i],
+				serialcomm, dmm)))
+			serials = g_slist_append(serials, serial);
+	}
+	g_strfreev(ports);
+
+	if (!serials)
+		return NULL;
 
 	if (!(sdi = sr_dev_inst_new(0, SR_ST_INACTIVE, dmms[dmm].vendor,
 				    dmms[dmm].device, "")))
@@ -323,38 +388,71 @@ static GSList *sdmm_scan(const char *conn, const char *serialcomm, int dmm)
 
 	if (!(devc = g_try_malloc0(sizeof(struct dev_context)))) {
 		sr_err("Device context malloc failed.");
+		sr_dev_inst_free(sdi);
+		goto scan_cleanup;
+	}
+
+	devc->num_ports = g_slist_length(serials);
+	devc->ports = g_try_malloc0(devc->num_ports * sizeof(struct dmm_port));
+	devc->values = g_try_malloc(devc->num_ports * sizeof(float));
+	if (!devc->ports || !devc->values) {
+		sr_err("Port malloc failed.");
+		g_free(devc->ports);
+		g_free(devc->values);
+		g_free(devc);
+		sr_dev_inst_free(sdi);
 		goto scan_cleanup;
 	}
 
 	sdi->inst_type = SR_INST_SERIAL;
-	sdi->conn = serial;
+	sdi->conn = serials->data;
 
 	sdi->priv = devc;
 	sdi->driver = dmms[dmm].di;
-	if (!(probe = sr_probe_new(0, SR_PROBE_ANALOG, TRUE, "P1")))
-		goto scan_cleanup;
-	sdi->probes = g_slist_append(sdi->probes, probe);
-	drvc->instances = g_slist_append(drvc->instances, sdi);
+	for (i = 0, l = serials; l; i++, l = l->next) {
+		devc->ports[i].serial = l->data;
+		name = g_strdup_printf("P%u", i + 1);
+		probe = sr_probe_new(i, SR_PROBE_ANALOG, TRUE, name);
+		g_free(name);
+		if (!probe) {
+			/* The serial instances are the device's now. */
+			g_slist_free(serials);
+			clear_helper(devc);
+			sdi->priv = NULL;
+			sr_serial_dev_inst_free(sdi->conn);
+			sdi->conn = NULL;
+			sr_dev_inst_free(sdi);
+			return NULL;
+		}
+		sdi->probes = g_slist_append(sdi->probes, probe);
+		devc->ports[i].probes = g_slist_append(NULL, probe);
+	}
+	g_slist_free(serials);
 	devices = g_slist_append(devices, sdi);
 
+	return devices;
+
 scan_cleanup:
-	serial_close(serial);
+	g_slist_free_full(serials, (GDestroyNotify)sr_serial_dev_inst_free);
 
-	return devices;
+	return NULL;
 }
 
-static GSList *scan(GSList *options, int dmm)
+/* Scan conn, or the port in the options if it's NULL. */
+static GSList *sdmm_scan_options(const char *conn, GSList *options,
+		int dmm)
 {
 	struct sr_config *src;
 	GSList *l, *devices;
-	const char *conn, *serialcomm;
+	const char *serialcomm;
 
-	conn = serialcomm = NULL;
+	serialcomm = NULL;
 	for (l = options; l; l = l->next) {
 		src = l->data;
 		switch (src->key) {
 		case SR_CONF_CONN:
-			conn = g_variant_get_string(src->data, NULL);
+			if (!conn)
+				conn = g_variant_get_string(src->data, NULL);
 			break;
 		case SR_CONF_SERIALCOMM:
 			serialcomm = g_variant_get_string(src->data, NULL);
@@ -375,18 +473,45 @@ static GSList *scan(GSList *options, int dmm)
 	return devices;
 }
 
+static GSList *scan(GSList *options, int dmm)
+{
+	struct drv_context *drvc;
+	GSList *devices;
+
+	drvc = dmms[dmm].di->priv;
+	devices = sdmm_scan_options(NULL, options, dmm);
+	drvc->instances = g_slist_concat(drvc->instances,
+					 g_slist_copy(devices));
+
+	return devices;
+}
+
+/* Probing touches nothing but the port, so any number can run at once. */
+static GSList *scan_port(const char *port, GSList *options, int dmm)
+{
+	return sdmm_scan_options(port, options, dmm);
+}
+
 static GSList *dev_list(int dmm)
 {
 	return ((struct drv_context *)(dmms[dmm].di->priv))->instances;
 }
 
+static int dev_close(struct sr_dev_inst *sdi);
+
 static int dev_open(struct sr_dev_inst *sdi)
 {
-	struct sr_serial_dev_inst *serial;
-
-	serial = sdi->conn;
-	if (serial_open(serial, SERIAL_RDWR | SERIAL_NONBLOCK) != SR_OK)
-		return SR_ERR;
+	struct dev_context *devc;
+	unsigned int i;
+
+	devc = sdi->priv;
+	for (i = 0; i < devc->num_ports; i++) {
+		if (serial_open(devc->ports[i].serial,
+				SERIAL_RDWR | SERIAL_NONBLOCK) != SR_OK) {
+			dev_close(sdi);
+			return SR_ERR;
+		}
+	}
 
 	sdi->status = SR_ST_ACTIVE;
 
@@ -395,13 +520,19 @@ static int dev_open(struct sr_dev_inst *sdi)
 
 static int dev_close(struct sr_dev_inst *sdi)
 {
+	struct dev_context *devc;
 	struct sr_serial_dev_inst *serial;
+	unsigned int i;
 
-	serial = sdi->conn;
-	if (serial && serial->fd != -1) {
-		serial_close(serial);
-		sdi->status = SR_ST_INACTIVE;
+	if (!(devc = sdi->priv))
+		return SR_OK;
+
+	for (i = 0; i < devc->num_ports; i++) {
+		serial = devc->ports[i].serial;
+		if (serial && serial->fd != -1)
+			serial_close(serial);
 	}
+	sdi->status = SR_ST_INACTIVE;
 
 	return SR_OK;
 }
@@ -437,6 +568,16 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 		sr_dbg("Setting time limit to %" PRIu64 "ms.",
 		       devc->limit_msec);
 		break;
+	case SR_CONF_BATCH_SAMPLES:
+		devc->batch.max_samples = g_variant_get_uint64(data);
+		sr_dbg("Setting batch size to %" PRIu64 " readings.",
+		       devc->batch.max_samples);
+		break;
+	case SR_CONF_BATCH_MSEC:
+		devc->batch.max_wait = g_variant_get_uint64(data) * 1000;
+		sr_dbg("Setting batch time window to %" PRIu64 "ms.",
+		       g_variant_get_uint64(data));
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -471,6 +612,7 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 {
 	struct dev_context *devc;
 	struct sr_serial_dev_inst *serial;
+	unsigned int i;
 
 	if (sdi->status != SR_ST_ACTIVE)
 		return SR_ERR_DEV_CLOSED;
@@ -489,20 +631,48 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 	 */
 	devc->num_samples = 0;
 	devc->starttime = g_get_monotonic_time();
+	sr_analog_batch_start(&devc->batch, cb_data);
+	devc->num_fresh = 0;
+	for (i = 0; i < devc->num_ports; i++) {
+		devc->ports[i].buflen = 0;
+		sr_dmm_framer_init(&devc->ports[i].framer,
+				dmms[dmm].packet_size, &dmms[dmm].sync,
+				dmms[dmm].packet_valid);
+		devc->ports[i].fresh = FALSE;
+	}
 
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
 
-	/* Poll every 50ms, or whenever some data comes in. */
-	serial = sdi->conn;
-	sr_source_add(serial->fd, G_IO_IN, 50,
-		      dmms[dmm].receive_data, (void *)sdi);
+	/*
+	 * Poll every 50ms, or whenever some data comes in. Any port's data
+	 * wakes up the same callback, the first port's source also polls.
+	 */
+	for (i = 0; i < devc->num_ports; i++) {
+		serial = devc->ports[i].serial;
+		sr_source_add(serial->fd, G_IO_IN, i == 0 ? 50 : 0,
+			      dmms[dmm].receive_data, (void *)sdi);
+	}
 
 	return SR_OK;
 }
 
 static int dev_acquisition_stop(struct sr_dev_inst *sdi, void *cb_data)
 {
+	struct dev_context *devc;
+	unsigned int i;
+
+	/* Send what's left of the batch before SR_DF_END. */
+	if ((devc = sdi->priv)) {
+		if (sdi->status == SR_ST_ACTIVE) {
+			/* The first port's source is removed below. */
+			for (i = 1; i < devc->num_ports; i++)
+				sr_source_remove(devc->ports[i].serial->fd);
+			sr_analog_batch_flush(&devc->batch);
+		}
+		sr_analog_batch_clear(&devc->batch);
+	}
+
 	return std_dev_acquisition_stop_serial(sdi, cb_data, dev_close,
 					       sdi->conn, LOG_PREFIX);
 }
@@ -514,6 +684,9 @@ static int init_##X(struct sr_context *sr_ctx) { return init(sr_ctx, X); }
 static int cleanup_##X(void) { return cleanup(X); }
 #define HW_SCAN(X) \
 static GSList *scan_##X(GSList *options) { return scan(options, X); }
+#define HW_SCAN_PORT(X) \
+static GSList *scan_port_##X(const char *port, GSList *options) \
+{ return scan_port(port, options, X); }
 #define HW_DEV_LIST(X) \
 static GSList *dev_list_##X(void) { return dev_list(X); }
 #define HW_DEV_CLEAR(X) \
@@ -527,6 +700,7 @@ void *cb_data) { return dev_acquisition_start(sdi, cb_data, X); }
 HW_INIT(ID_UPPER) \
 HW_CLEANUP(ID_UPPER) \
 HW_SCAN(ID_UPPER) \
+HW_SCAN_PORT(ID_UPPER) \
 HW_DEV_LIST(ID_UPPER) \
 HW_DEV_CLEAR(ID_UPPER) \
 HW_DEV_ACQUISITION_START(ID_UPPER) \
@@ -537,6 +711,7 @@ SR_PRIV struct sr_dev_driver ID##_driver_info = { \
 	.init = init_##ID_UPPER, \
 	.cleanup = cleanup_##ID_UPPER, \
 	.scan = scan_##ID_UPPER, \
+	.scan_port = scan_port_##ID_UPPER, \
 	.dev_list = dev_list_##ID_UPPER, \
 	.dev_clear = dev_clear_##ID_UPPER, \
 	.config_get = NULL, \
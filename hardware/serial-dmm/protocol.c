@@ -35,11 +35,68 @@ static void log_dmm_packet(const uint8_t *buf)
 	       buf[7], buf[8], buf[9], buf[10], buf[11], buf[12], buf[13]);
 }
 
+/*
+ * Send the new readings of all ports. If every port has one and they were
+ * all taken in the same mode, they go out as one sample of all probes.
+ * Otherwise each reading goes out on its own.
+ */
+static void send_readings(struct sr_dev_inst *sdi)
+{
+	struct sr_datafeed_analog analog;
+	struct dev_context *devc;
+	struct dmm_port *port;
+	unsigned int i;
+	gboolean merge;
+	float *values;
+
+	devc = sdi->priv;
+
+	merge = devc->num_fresh == devc->num_ports;
+	for (i = 1; merge && i < devc->num_ports; i++) {
+		port = &devc->ports[i];
+		merge = port->mq == devc->ports[0].mq
+			&& port->unit == devc->ports[0].unit
+			&& port->mqflags == devc->ports[0].mqflags;
+	}
+
+	memset(&analog, 0, sizeof(struct sr_datafeed_analog));
+	analog.num_samples = 1;
+
+	if (merge) {
+		values = devc->values;
+		for (i = 0; i < devc->num_ports; i++) {
+			values[i] = devc->ports[i].value;
+			devc->ports[i].fresh = FALSE;
+		}
+		analog.probes = sdi->probes;
+		analog.mq = devc->ports[0].mq;
+		analog.unit = devc->ports[0].unit;
+		analog.mqflags = devc->ports[0].mqflags;
+		analog.data = values;
+		sr_analog_batch_add(&devc->batch, &analog);
+	} else {
+		for (i = 0; i < devc->num_ports; i++) {
+			port = &devc->ports[i];
+			if (!port->fresh)
+				continue;
+			port->fresh = FALSE;
+			analog.probes = port->probes;
+			analog.mq = port->mq;
+			analog.unit = port->unit;
+			analog.mqflags = port->mqflags;
+			analog.data = &port->value;
+			sr_analog_batch_add(&devc->batch, &analog);
+		}
+	}
+
+	devc->num_fresh = 0;
+	devc->num_samples++;
+}
+
 static void handle_packet(const uint8_t *buf, struct sr_dev_inst *sdi,
-			  int dmm, void *info)
+			  struct dmm_port *port, int dmm, void *info)
 {
 	float floatval;
-	struct sr_datafeed_packet packet;
 	struct sr_datafeed_analog analog;
 	struct dev_context *devc;
 
@@ -48,7 +105,7 @@ static void handle_packet(const uint8_t *buf, struct sr_dev_inst *sdi,
 
 	memset(&analog, 0, sizeof(struct sr_datafeed_analog));
 
-	analog.probes = sdi->probes;
+	analog.probes = port->probes;
 	analog.num_samples = 1;
 	analog.mq = -1;
 
@@ -59,57 +116,80 @@ static void handle_packet(const uint8_t *buf, struct sr_dev_inst *sdi,
 	if (dmms[dmm].dmm_details)
 		dmms[dmm].dmm_details(&analog, info);
 
-	if (analog.mq != -1) {
-		/* Got a measurement. */
-		packet.type = SR_DF_ANALOG;
-		packet.payload = &analog;
-		sr_session_send(devc->cb_data, &packet);
-		devc->num_samples++;
-	}
+	if (analog.mq == -1)
+		return;
+
+	/* Got a measurement. A meter that's ahead sends the others'. */
+	if (port->fresh)
+		send_readings(sdi);
+
+	port->fresh = TRUE;
+	port->value = floatval;
+	port->mq = analog.mq;
+	port->unit = analog.unit;
+	port->mqflags = analog.mqflags;
+
+	if (++devc->num_fresh == devc->num_ports)
+		send_readings(sdi);
 }
 
-static void handle_new_data(struct sr_dev_inst *sdi, int dmm, void *info)
+struct packet_ctx {
+	struct sr_dev_inst *sdi;
+	struct dmm_port *port;
+	int dmm;
+	void *info;
+};
+
+static void packet_found(const uint8_t *buf, void *cb_data)
 {
-	struct dev_context *devc;
-	int len, i, offset = 0;
-	struct sr_serial_dev_inst *serial;
+	struct packet_ctx *ctx;
 
-	devc = sdi->priv;
-	serial = sdi->conn;
+	ctx = cb_data;
+	handle_packet(buf, ctx->sdi, ctx->port, ctx->dmm, ctx->info);
+}
+
+static void handle_new_data(struct sr_dev_inst *sdi, struct dmm_port *port,
+			    int dmm, void *info)
+{
+	struct packet_ctx ctx;
+	int len, i, offset;
 
 	/* Try to get as much data as the buffer can hold. */
-	len = DMM_BUFSIZE - devc->buflen;
-	len = serial_read(serial, devc->buf + devc->buflen, len);
+	len = DMM_BUFSIZE - port->buflen;
+	len = serial_read(port->serial, port->buf + port->buflen, len);
 	if (len == 0)
 		return; /* No new bytes, nothing to do. */
 	if (len < 0) {
 		sr_err("Serial port read error: %d.", len);
 		return;
 	}
-	devc->buflen += len;
+	port->buflen += len;
 
 	/* Now look for packets in that data. */
-	while ((devc->buflen - offset) >= dmms[dmm].packet_size) {
-		if (dmms[dmm].packet_valid(devc->buf + offset)) {
-			handle_packet(devc->buf + offset, sdi, dmm, info);
-			offset += dmms[dmm].packet_size;
-		} else {
-			offset++;
-		}
-	}
+	ctx.sdi = sdi;
+	ctx.port = port;
+	ctx.dmm = dmm;
+	ctx.info = info;
+	offset = sr_dmm_framer_parse(&port->framer, port->buf, port->buflen,
+			packet_found, &ctx);
 
 	/* If we have any data left, move it to the beginning of our buffer. */
-	for (i = 0; i < devc->buflen - offset; i++)
-		devc->buf[i] = devc->buf[offset + i];
-	devc->buflen -= offset;
+	for (i = 0; i < port->buflen - offset; i++)
+		port->buf[i] = port->buf[offset + i];
+	port->buflen -= offset;
 }
 
+/*
+ * Every port of the device is a source of its own, but whichever of them
+ * has data services all of them, so one wakeup handles all ports that
+ * are ready. Only the first port's source has a timeout.
+ */
 static int receive_data(int fd, int revents, int dmm, void *info, void *cb_data)
 {
 	struct sr_dev_inst *sdi;
 	struct dev_context *devc;
-	struct sr_serial_dev_inst *serial;
 	int64_t time;
+	unsigned int i;
 	int ret;
 
 	(void)fd;
@@ -120,15 +200,14 @@ static int receive_data(int fd, int revents, int dmm, void *info, void *cb_data)
 	if (!(devc = sdi->priv))
 		return TRUE;
 
-	serial = sdi->conn;
-
 	if (revents == G_IO_IN) {
 		/* Serial data arrived. */
-		handle_new_data(sdi, dmm, info);
-	} else {
+		for (i = 0; i < devc->num_ports; i++)
+			handle_new_data(sdi, &devc->ports[i], dmm, info);
+	} else if (dmms[dmm].packet_request) {
 		/* Timeout, send another packet request (if DMM needs it). */
-		if (dmms[dmm].packet_request) {
-			ret = dmms[dmm].packet_request(serial);
+		for (i = 0; i < devc->num_ports; i++) {
+			ret = dmms[dmm].packet_request(devc->ports[i].serial);
 			if (ret < 0) {
 				sr_err("Failed to request packet: %d.", ret);
 				return FALSE;
@@ -136,6 +215,8 @@ static int receive_data(int fd, int revents, int dmm, void *info, void *cb_data)
 		}
 	}
 
+	sr_analog_batch_poll(&devc->batch);
+
 	if (devc->limit_samples && devc->num_samples >= devc->limit_samples) {
 		sr_info("Requested number of samples reached.");
 		sdi->driver->dev_acquisition_stop(sdi, cb_data);
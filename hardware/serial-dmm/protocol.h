@@ -23,11 +23,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "serial-dmm: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 /* Note: When adding entries here, don't forget to update DMM_COUNT. */
 enum {
@@ -65,6 +65,7 @@ struct dmm_info {
 	char *conn;
 	uint32_t baudrate;
 	int packet_size;
+	struct sr_dmm_sync sync;
 	int (*packet_request)(struct sr_serial_dev_inst *);
 	gboolean (*packet_valid)(const uint8_t *);
 	int (*packet_parse)(const uint8_t *, float *,
@@ -78,6 +79,28 @@ extern SR_PRIV struct dmm_info dmms[DMM_COUNT];
 
 #define DMM_BUFSIZE 256
 
+/** Separator between the ports of one device in SR_CONF_CONN. */
+#define DMM_CONN_SEPARATOR ","
+
+/** One of the serial ports of a device, with one meter on it. */
+struct dmm_port {
+	struct sr_serial_dev_inst *serial;
+
+	/** The port's probe, alone in a list. */
+	GSList *probes;
+
+	uint8_t buf[DMM_BUFSIZE];
+	int buflen;
+	struct sr_dmm_framer framer;
+
+	/** The latest reading, until it's sent along with the others. */
+	gboolean fresh;
+	float value;
+	int mq;
+	int unit;
+	uint64_t mqflags;
+};
+
 /** Private, per-device-instance driver context. */
 struct dev_context {
 	/** The current sampling limit (in number of samples). */
@@ -92,11 +115,21 @@ struct dev_context {
 	/** The current number of already received samples. */
 	uint64_t num_samples;
 
+	/** Readings waiting to be sent together (SR_CONF_BATCH_*). */
+	struct sr_analog_batch batch;
+
 	int64_t starttime;
 
-	uint8_t buf[DMM_BUFSIZE];
-	int bufoffset;
-	int buflen;
+	/**
+	 * The meters of this device, one probe each. The first port is
+	 * sdi->conn. Readings of all ports are sent together once each
+	 * port has a new one.
+	 */
+	struct dmm_port *ports;
+	unsigned int num_ports;
+	unsigned int num_fresh;
+	/** One value per port, for sending them together. */
+	float *values;
 };
 
 SR_PRIV int receive_data_DIGITEK_DT4000ZC(int fd, int revents, void *cb_data);
@@ -0,0 +1,318 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Client of the sigrok network stream written by the "srnet" output
+ * module: the datafeed of a capture running on another host is turned
+ * back into the datafeed of this virtual device. The connection is
+ * conn=host:port, and a device is found once the server's stream has
+ * started.
+ *
+ * With conn=shm:<name>, the stream comes from another process on this
+ * host through the shared memory ring of sr_shm_writer_open() instead.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+#include "protocol.h"
+
+static const int32_t hwopts[] = {
+	SR_CONF_CONN,
+};
+
+static const int32_t hwcaps[] = {
+	SR_CONF_LOGIC_ANALYZER,
+	SR_CONF_SAMPLERATE,
+	SR_CONF_LIMIT_SAMPLES,
+	SR_CONF_CONTINUOUS,
+};
+
+SR_PRIV struct sr_dev_driver sigrok_net_driver_info;
+static struct sr_dev_driver *di = &sigrok_net_driver_info;
+
+static void clear_helper(void *priv)
+{
+	struct dev_context *devc;
+
+	devc = priv;
+	srnet_disconnect(devc);
+	g_free(devc->conn);
+	g_free(devc->buf);
+	g_free(devc->inflated);
+	g_free(devc->floats);
+	g_free(devc);
+}
+
+static int init(struct sr_context *sr_ctx)
+{
+	return std_init(sr_ctx, di, LOG_PREFIX);
+}
+
+static GSList *scan(GSList *options)
+{
+	struct drv_context *drvc;
+	struct dev_context *devc;
+	struct sr_dev_inst *sdi;
+	struct sr_config *src;
+	struct srnet_frame frame;
+	GSList *devices, *l;
+	const char *conn;
+	int64_t deadline, left;
+	int ret;
+
+	conn = NULL;
+	for (l = options; l; l = l->next) {
+		src = l->data;
+		if (src->key == SR_CONF_CONN)
+			conn = g_variant_get_string(src->data, NULL);
+	}
+	if (!conn)
+		return NULL;
+
+	if (!(devc = g_try_malloc0(sizeof(struct dev_context)))) {
+		sr_err("Device context malloc failed.");
+		return NULL;
+	}
+	devc->conn = g_strdup(conn);
+	devc->fd = -1;
+
+	sr_info("Connecting to %s.", conn);
+	if (srnet_connect(devc) != SR_OK) {
+		clear_helper(devc);
+		return NULL;
+	}
+
+	if (devc->ring) {
+		/* The producer keeps it next to the ring. */
+		ret = srnet_shm_device(devc, &frame);
+	} else {
+		/* The stream starts with the device frame. */
+		deadline = g_get_monotonic_time()
+				+ SRNET_CONNECT_TIMEOUT * 1000;
+		while ((ret = srnet_frame_next(devc, &frame)) == 0) {
+			left = (deadline - g_get_monotonic_time()) / 1000;
+			if (left <= 0 || srnet_read(devc, left) < 0)
+				break;
+		}
+	}
+	sdi = NULL;
+	if (ret == 1 && frame.type == SRNET_DEVICE)
+		sdi = srnet_device_new(&frame);
+	if (!sdi) {
+		sr_err("No device found at %s.", conn);
+		clear_helper(devc);
+		return NULL;
+	}
+
+	/* The connection stays open, with what followed the device frame. */
+	sdi->priv = devc;
+	sdi->driver = di;
+	sr_info("Found %s %s at %s.", sdi->vendor, sdi->model, conn);
+
+	drvc = di->priv;
+	drvc->instances = g_slist_append(drvc->instances, sdi);
+	devices = g_slist_append(NULL, sdi);
+
+	return devices;
+}
+
+static GSList *dev_list(void)
+{
+	return ((struct drv_context *)(di->priv))->instances;
+}
+
+static int dev_clear(void)
+{
+	return std_dev_clear(di, clear_helper);
+}
+
+static int dev_open(struct sr_dev_inst *sdi)
+{
+	struct dev_context *devc;
+	int ret;
+
+	devc = sdi->priv;
+	if (devc->fd < 0 && (ret = srnet_connect(devc)) != SR_OK)
+		return ret;
+
+	sdi->status = SR_ST_ACTIVE;
+
+	return SR_OK;
+}
+
+static int dev_close(struct sr_dev_inst *sdi)
+{
+	srnet_disconnect(sdi->priv);
+	sdi->status = SR_ST_INACTIVE;
+
+	return SR_OK;
+}
+
+static int cleanup(void)
+{
+	return dev_clear();
+}
+
+static int config_get(int key, GVariant **data, const struct sr_dev_inst *sdi,
+		const struct sr_probe_group *probe_group)
+{
+	struct dev_context *devc;
+
+	(void)probe_group;
+
+	if (!sdi || !(devc = sdi->priv))
+		return SR_ERR_ARG;
+
+	switch (key) {
+	case SR_CONF_SAMPLERATE:
+		/* As last announced by the server. */
+		if (!devc->samplerate)
+			return SR_ERR_NA;
+		*data = g_variant_new_uint64(devc->samplerate);
+		break;
+	case SR_CONF_LIMIT_SAMPLES:
+		*data = g_variant_new_uint64(devc->limit_samples);
+		break;
+	default:
+		return SR_ERR_NA;
+	}
+
+	return SR_OK;
+}
+
+static int config_set(int key, GVariant *data, const struct sr_dev_inst *sdi,
+		const struct sr_probe_group *probe_group)
+{
+	struct dev_context *devc;
+
+	(void)probe_group;
+
+	if (sdi->status != SR_ST_ACTIVE)
+		return SR_ERR_DEV_CLOSED;
+
+	if (!(devc = sdi->priv)) {
+		sr_err("sdi->priv was NULL.");
+		return SR_ERR_BUG;
+	}
+
+	switch (key) {
+	case SR_CONF_LIMIT_SAMPLES:
+		devc->limit_samples = g_variant_get_uint64(data);
+		sr_dbg("Setting sample limit to %" PRIu64 ".",
+		       devc->limit_samples);
+		break;
+	default:
+		return SR_ERR_NA;
+	}
+
+	return SR_OK;
+}
+
+static int config_list(int key, GVariant **data, const struct sr_dev_inst *sdi,
+		const struct sr_probe_group *probe_group)
+{
+	(void)sdi;
+	(void)probe_group;
+
+	switch (key) {
+	case SR_CONF_SCAN_OPTIONS:
+		*data = g_variant_new_fixed_array(G_VARIANT_TYPE_INT32,
+				hwopts, ARRAY_SIZE(hwopts), sizeof(int32_t));
+		break;
+	case SR_CONF_DEVICE_OPTIONS:
+		*data = g_variant_new_fixed_array(G_VARIANT_TYPE_INT32,
+				hwcaps, ARRAY_SIZE(hwcaps), sizeof(int32_t));
+		break;
+	default:
+		return SR_ERR_NA;
+	}
+
+	return SR_OK;
+}
+
+static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
+{
+	struct dev_context *devc;
+
+	(void)cb_data;
+
+	if (sdi->status != SR_ST_ACTIVE)
+		return SR_ERR_DEV_CLOSED;
+
+	if (!(devc = sdi->priv)) {
+		sr_err("sdi->priv was NULL.");
+		return SR_ERR_BUG;
+	}
+
+	devc->num_samples = 0;
+	devc->in_feed = FALSE;
+	srnet_shm_attach(devc, TRUE);
+
+	/*
+	 * The header comes from the server, along with the rest of the
+	 * datafeed. Frames read already are handled on the first timeout
+	 * at the latest.
+	 */
+	sr_source_add(devc->fd, G_IO_IN, 100, srnet_receive_data,
+			(void *)sdi);
+
+	return SR_OK;
+}
+
+static int dev_acquisition_stop(struct sr_dev_inst *sdi, void *cb_data)
+{
+	struct dev_context *devc;
+	struct sr_datafeed_packet packet;
+
+	(void)cb_data;
+
+	if (sdi->status != SR_ST_ACTIVE)
+		return SR_ERR_DEV_CLOSED;
+
+	devc = sdi->priv;
+	sr_dbg("Stopping acquisition.");
+	sr_source_remove(devc->fd);
+	srnet_shm_attach(devc, FALSE);
+
+	/* Send last packet. */
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	sr_session_send(sdi, &packet);
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_dev_driver sigrok_net_driver_info = {
+	.name = "sigrok-net",
+	.longname = "sigrok network stream",
+	.api_version = 1,
+	.init = init,
+	.cleanup = cleanup,
+	.scan = scan,
+	.dev_list = dev_list,
+	.dev_clear = dev_clear,
+	.config_get = config_get,
+	.config_set = config_set,
+	.config_list = config_list,
+	.dev_open = dev_open,
+	.dev_close = dev_close,
+	.dev_acquisition_start = dev_acquisition_start,
+	.dev_acquisition_stop = dev_acquisition_stop,
+};
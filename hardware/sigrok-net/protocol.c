@@ -0,0 +1,796 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <zlib.h>
+#include "protocol.h"
+
+/* Reading the payloads; each fails when running past the end. */
+static gboolean get_bytes(const uint8_t **p, const uint8_t *end, size_t n,
+		const uint8_t **bytes)
+{
+	if ((size_t)(end - *p) < n)
+		return FALSE;
+	*bytes = *p;
+	*p += n;
+
+	return TRUE;
+}
+
+static gboolean get_le16(const uint8_t **p, const uint8_t *end, uint16_t *v)
+{
+	const uint8_t *b;
+
+	if (!get_bytes(p, end, 2, &b))
+		return FALSE;
+	*v = b[0] | (b[1] << 8);
+
+	return TRUE;
+}
+
+static gboolean get_le32(const uint8_t **p, const uint8_t *end, uint32_t *v)
+{
+	uint16_t lo, hi;
+
+	if (!get_le16(p, end, &lo) || !get_le16(p, end, &hi))
+		return FALSE;
+	*v = lo | ((uint32_t)hi << 16);
+
+	return TRUE;
+}
+
+static gboolean get_le64(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	uint32_t lo, hi;
+
+	if (!get_le32(p, end, &lo) || !get_le32(p, end, &hi))
+		return FALSE;
+	*v = lo | ((uint64_t)hi << 32);
+
+	return TRUE;
+}
+
+/* Returns a new string, or NULL. */
+static char *get_string(const uint8_t **p, const uint8_t *end)
+{
+	const uint8_t *b;
+	uint16_t len;
+
+	if (!get_le16(p, end, &len) || !get_bytes(p, end, len, &b))
+		return NULL;
+
+	return g_strndup((const char *)b, len);
+}
+
+/**
+ * Read from the socket, waiting at most timeout milliseconds for data.
+ * With a shared memory ring, wait for the producer to write to it.
+ *
+ * @return The number of bytes read, 0 if there were none, or SR_ERR if
+ *         the connection was closed or failed.
+ */
+SR_PRIV int srnet_read(struct dev_context *devc, int timeout)
+{
+	struct pollfd pfd;
+	uint8_t *buf, drain[64];
+	size_t size;
+	ssize_t len;
+	int total;
+
+	total = 0;
+	pfd.fd = devc->fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, timeout) <= 0)
+		return 0;
+
+	if (devc->ring) {
+		/* The waiter thread's wakeups, the data is in the ring. */
+		while ((len = read(devc->fd, drain, sizeof(drain))) > 0)
+			total += len;
+		return total;
+	}
+
+	/* Frames already parsed may point into the buffer until now. */
+	if (devc->buf_start) {
+		memmove(devc->buf, devc->buf + devc->buf_start, devc->buf_len);
+		devc->buf_start = 0;
+	}
+	if (devc->buf_size - devc->buf_len < SRNET_READ_SIZE) {
+		size = devc->buf_len + SRNET_READ_SIZE;
+		if (!(buf = g_try_realloc(devc->buf, size))) {
+			sr_err("%s: buf realloc failed", __func__);
+			return SR_ERR;
+		}
+		devc->buf = buf;
+		devc->buf_size = size;
+	}
+
+	len = recv(devc->fd, devc->buf + devc->buf_len,
+			devc->buf_size - devc->buf_len, MSG_DONTWAIT);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (len < 0) {
+		sr_err("Failed to read from '%s': %s.", devc->conn,
+		       strerror(errno));
+		return SR_ERR;
+	}
+	if (len == 0) {
+		sr_info("Connection to '%s' closed.", devc->conn);
+		return SR_ERR;
+	}
+	devc->buf_len += len;
+
+	return len;
+}
+
+/*
+ * Parse the frame at p, of which avail bytes are there.
+ *
+ * @return The length of the frame, 0 if it's incomplete, or SR_ERR if it
+ *         is invalid.
+ */
+static int frame_parse(struct dev_context *devc, const uint8_t *p,
+		size_t avail, struct srnet_frame *frame)
+{
+	const uint8_t *end, *payload;
+	uint16_t type, flags;
+	uint32_t len, raw_len;
+	uLongf dlen;
+	uint8_t *inflated;
+
+	end = p + avail;
+	if (!get_le16(&p, end, &type) || !get_le16(&p, end, &flags)
+	    || !get_le32(&p, end, &len))
+		return 0;
+	if (len > SRNET_MAX_FRAME) {
+		sr_err("Frame of %u bytes is too large.", len);
+		return SR_ERR;
+	}
+	if (!get_bytes(&p, end, len, &payload))
+		return 0;
+
+	frame->type = type;
+	frame->payload = payload;
+	frame->len = len;
+	if (!(flags & SRNET_DEFLATED))
+		return SRNET_FRAME_HEADER_LEN + len;
+
+	end = payload + len;
+	if (!get_le32(&payload, end, &raw_len) || raw_len > SRNET_MAX_FRAME) {
+		sr_err("Invalid deflated frame.");
+		return SR_ERR;
+	}
+	if (raw_len > devc->inflated_size) {
+		if (!(inflated = g_try_realloc(devc->inflated, raw_len))) {
+			sr_err("%s: inflated realloc failed", __func__);
+			return SR_ERR;
+		}
+		devc->inflated = inflated;
+		devc->inflated_size = raw_len;
+	}
+	dlen = raw_len;
+	if (uncompress(devc->inflated, &dlen, payload, end - payload) != Z_OK
+	    || dlen != raw_len) {
+		sr_err("Failed to inflate frame.");
+		return SR_ERR;
+	}
+	frame->payload = devc->inflated;
+	frame->len = raw_len;
+
+	return SRNET_FRAME_HEADER_LEN + len;
+}
+
+/* The frames are passed on right from the ring, without copying them. */
+static int shm_frame_next(struct dev_context *devc, struct srnet_frame *frame)
+{
+	struct sr_shm_ring *ring;
+	const uint8_t *data;
+	uint64_t tail, avail, pos, room, skip;
+	int ret;
+
+	ring = devc->ring;
+	data = (const uint8_t *)ring + SR_SHM_DATA_OFFSET;
+
+	/* Done with the previous frame, so the producer may reuse it. */
+	if (devc->ring_pending) {
+		__atomic_store_n(&ring->tail, ring->tail + devc->ring_pending,
+				__ATOMIC_RELEASE);
+		devc->ring_pending = 0;
+		sr_shm_wake(&ring->tail_seq);
+	}
+
+	for (;;) {
+		tail = ring->tail;
+		if (!(avail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+				- tail))
+			return 0;
+		pos = tail % ring->size;
+		room = ring->size - pos;
+		skip = room;
+		if (room >= SRNET_FRAME_HEADER_LEN) {
+			/* Frames are written complete, and never wrap. */
+			ret = frame_parse(devc, data + pos, MIN(avail, room),
+					frame);
+			if (ret <= 0) {
+				sr_err("Invalid frame in the ring.");
+				return SR_ERR;
+			}
+			skip = (ret + SR_SHM_ALIGN - 1) & ~(SR_SHM_ALIGN - 1);
+			if (frame->type != SRNET_PAD) {
+				devc->ring_pending = skip;
+				return 1;
+			}
+		}
+		__atomic_store_n(&ring->tail, tail + skip, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * Take the next frame out of the bytes read so far. The frame is valid
+ * until the next call of srnet_read() or srnet_frame_next().
+ *
+ * @return 1 if there was a complete frame, 0 if more data is needed, or
+ *         SR_ERR if the stream is invalid.
+ */
+SR_PRIV int srnet_frame_next(struct dev_context *devc,
+		struct srnet_frame *frame)
+{
+	int ret;
+
+	if (devc->ring)
+		return shm_frame_next(devc, frame);
+
+	if ((ret = frame_parse(devc, devc->buf + devc->buf_start,
+			devc->buf_len, frame)) <= 0)
+		return ret;
+	devc->buf_start += ret;
+	devc->buf_len -= ret;
+
+	return 1;
+}
+
+/**
+ * Get the producer's device frame of a shared memory ring.
+ *
+ * @return 1 if there was one, 0 if not, or SR_ERR if it is invalid.
+ */
+SR_PRIV int srnet_shm_device(struct dev_context *devc,
+		struct srnet_frame *frame)
+{
+	uint32_t len;
+	int ret;
+
+	len = __atomic_load_n(&devc->ring->device_len, __ATOMIC_ACQUIRE);
+	if (!len || len > SR_SHM_DEVICE_SIZE)
+		return 0;
+	ret = frame_parse(devc, (const uint8_t *)devc->ring
+			+ SR_SHM_DEVICE_OFFSET, len, frame);
+
+	return ret > 0 ? 1 : SR_ERR;
+}
+
+/*
+ * Turn changes of the ring's head into readability of devc->fd, so that
+ * the ring fits into the session's main loop.
+ */
+static gpointer shm_waiter(gpointer data)
+{
+	struct dev_context *devc;
+	uint32_t seq, now;
+	ssize_t ret;
+
+	devc = data;
+	seq = __atomic_load_n(&devc->ring->head_seq, __ATOMIC_ACQUIRE);
+	while (!g_atomic_int_get(&devc->waiter_stop)) {
+		sr_shm_wait(&devc->ring->head_seq, seq, 100);
+		now = __atomic_load_n(&devc->ring->head_seq, __ATOMIC_ACQUIRE);
+		if (now == seq)
+			continue;
+		seq = now;
+		/* A full pipe is fine, the reader isn't done yet. */
+		ret = write(devc->wake_fd, "", 1);
+		(void)ret;
+	}
+
+	return NULL;
+}
+
+static int shm_connect(struct dev_context *devc)
+{
+	int fds[2];
+
+	if (sr_shm_ring_attach(devc->conn + 4, &devc->ring,
+			&devc->map_size) != SR_OK)
+		return SR_ERR;
+
+	if (pipe(fds) < 0) {
+		sr_err("Failed to create pipe: %s.", strerror(errno));
+		sr_shm_ring_detach(devc->ring, devc->map_size);
+		devc->ring = NULL;
+		return SR_ERR;
+	}
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	devc->fd = fds[0];
+	devc->wake_fd = fds[1];
+	devc->ring_pending = 0;
+	devc->waiter_stop = 0;
+	devc->waiter = g_thread_new("sigrok-net", shm_waiter, devc);
+
+	return SR_OK;
+}
+
+/**
+ * Start or stop consuming the ring. While attached, the producer waits
+ * for room in the ring instead of dropping the data.
+ */
+SR_PRIV void srnet_shm_attach(struct dev_context *devc, gboolean attach)
+{
+	struct sr_shm_ring *ring;
+
+	if (!(ring = devc->ring))
+		return;
+
+	if (attach) {
+		/* Start with what comes next. */
+		devc->ring_pending = 0;
+		__atomic_store_n(&ring->tail, __atomic_load_n(&ring->head,
+				__ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&ring->attached, attach, __ATOMIC_RELEASE);
+	sr_shm_wake(&ring->tail_seq);
+}
+
+/** Connect to the server, and wait for the start of the stream. */
+SR_PRIV int srnet_connect(struct dev_context *devc)
+{
+	struct addrinfo hints, *res, *ai;
+	char *host, *port;
+	int64_t deadline, left;
+	int fd, ret;
+
+	if (g_str_has_prefix(devc->conn, "shm:"))
+		return shm_connect(devc);
+
+	if (!(port = strrchr(devc->conn, ':')) || !port[1]) {
+		sr_err("Connection '%s' isn't of the form host:port.",
+		       devc->conn);
+		return SR_ERR_ARG;
+	}
+	host = g_strndup(devc->conn, port - devc->conn);
+	port++;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((ret = getaddrinfo(host, port, &hints, &res)) != 0) {
+		sr_err("Failed to resolve '%s': %s.", host, gai_strerror(ret));
+		g_free(host);
+		return SR_ERR;
+	}
+	g_free(host);
+
+	fd = -1;
+	for (ai = res; ai && fd < 0; ai = ai->ai_next) {
+		if ((fd = socket(ai->ai_family, ai->ai_socktype,
+				ai->ai_protocol)) < 0)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		sr_err("Failed to connect to '%s'.", devc->conn);
+		return SR_ERR;
+	}
+	devc->fd = fd;
+	devc->buf_start = devc->buf_len = 0;
+
+	deadline = g_get_monotonic_time() + SRNET_CONNECT_TIMEOUT * 1000;
+	while (devc->buf_len < SRNET_MAGIC_LEN) {
+		left = (deadline - g_get_monotonic_time()) / 1000;
+		if (left <= 0 || srnet_read(devc, left) < 0)
+			break;
+	}
+	if (devc->buf_len < SRNET_MAGIC_LEN
+	    || memcmp(devc->buf, SRNET_MAGIC, SRNET_MAGIC_LEN)) {
+		sr_err("No sigrok network stream at '%s'.", devc->conn);
+		srnet_disconnect(devc);
+		return SR_ERR;
+	}
+	devc->buf_start = SRNET_MAGIC_LEN;
+	devc->buf_len -= SRNET_MAGIC_LEN;
+
+	return SR_OK;
+}
+
+SR_PRIV void srnet_disconnect(struct dev_context *devc)
+{
+	if (devc->fd < 0)
+		return;
+
+	if (devc->ring) {
+		srnet_shm_attach(devc, FALSE);
+		g_atomic_int_set(&devc->waiter_stop, 1);
+		g_thread_join(devc->waiter);
+		close(devc->wake_fd);
+		sr_shm_ring_detach(devc->ring, devc->map_size);
+		devc->ring = NULL;
+	}
+	close(devc->fd);
+	devc->fd = -1;
+	devc->buf_start = devc->buf_len = 0;
+}
+
+/** Create a device instance from the server's device frame. */
+SR_PRIV struct sr_dev_inst *srnet_device_new(const struct srnet_frame *frame)
+{
+	struct sr_dev_inst *sdi;
+	struct sr_probe *probe;
+	const uint8_t *p, *end, *b;
+	char *vendor, *model, *name;
+	uint16_t num_probes, index, i;
+
+	p = frame->payload;
+	end = p + frame->len;
+	vendor = get_string(&p, end);
+	model = get_string(&p, end);
+	if (!vendor || !model || !get_le16(&p, end, &num_probes)) {
+		g_free(vendor);
+		g_free(model);
+		return NULL;
+	}
+	sdi = sr_dev_inst_new(0, SR_ST_INACTIVE, vendor, model, NULL);
+	g_free(vendor);
+	g_free(model);
+	if (!sdi)
+		return NULL;
+
+	for (i = 0; i < num_probes; i++) {
+		if (!get_le16(&p, end, &index) || !get_bytes(&p, end, 2, &b)
+		    || !(name = get_string(&p, end))) {
+			sr_err("Invalid device frame.");
+			sr_dev_inst_free(sdi);
+			return NULL;
+		}
+		probe = sr_probe_new(index, b[0], b[1], name);
+		g_free(name);
+		if (!probe) {
+			sr_dev_inst_free(sdi);
+			return NULL;
+		}
+		sdi->probes = g_slist_append(sdi->probes, probe);
+	}
+
+	return sdi;
+}
+
+static int send_header(const struct sr_dev_inst *sdi,
+		const struct srnet_frame *frame)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_header header;
+	const uint8_t *p, *end;
+	uint32_t version;
+	uint64_t sec, usec;
+
+	p = frame->payload;
+	end = p + frame->len;
+	if (!get_le32(&p, end, &version) || !get_le64(&p, end, &sec)
+	    || !get_le64(&p, end, &usec))
+		return SR_ERR;
+
+	header.feed_version = version;
+	header.starttime.tv_sec = sec;
+	header.starttime.tv_usec = usec;
+	packet.type = SR_DF_HEADER;
+	packet.payload = &header;
+
+	return sr_session_send(sdi, &packet);
+}
+
+static int send_meta(const struct sr_dev_inst *sdi,
+		const struct srnet_frame *frame)
+{
+	struct dev_context *devc;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_meta meta;
+	struct sr_config *src;
+	const uint8_t *p, *end, *data;
+	GVariant *v, *swapped;
+	GSList *l;
+	char *type;
+	uint32_t key, size;
+	uint16_t num, i;
+	int ret;
+
+	devc = sdi->priv;
+	p = frame->payload;
+	end = p + frame->len;
+	if (!get_le16(&p, end, &num))
+		return SR_ERR;
+
+	ret = SR_OK;
+	meta.config = NULL;
+	for (i = 0; ret == SR_OK && i < num; i++) {
+		type = NULL;
+		if (!get_le32(&p, end, &key) || !(type = get_string(&p, end))
+		    || !g_variant_type_string_is_valid(type)
+		    || !get_le32(&p, end, &size)
+		    || !get_bytes(&p, end, size, &data)) {
+			g_free(type);
+			ret = SR_ERR;
+			break;
+		}
+		v = g_variant_new_from_data(G_VARIANT_TYPE(type),
+				g_memdup(data, size), size, FALSE, g_free,
+				NULL);
+		g_free(type);
+		if (G_BYTE_ORDER == G_BIG_ENDIAN) {
+			swapped = g_variant_byteswap(v);
+			g_variant_unref(g_variant_ref_sink(v));
+			v = swapped;
+		}
+		if (!(src = sr_config_new(key, v))) {
+			ret = SR_ERR_MALLOC;
+			break;
+		}
+		if (key == SR_CONF_SAMPLERATE
+		    && g_variant_is_of_type(v, G_VARIANT_TYPE_UINT64))
+			devc->samplerate = g_variant_get_uint64(v);
+		meta.config = g_slist_append(meta.config, src);
+	}
+
+	if (ret == SR_OK) {
+		packet.type = SR_DF_META;
+		packet.payload = &meta;
+		ret = sr_session_send(sdi, &packet);
+	}
+
+	for (l = meta.config; l; l = l->next)
+		sr_config_free(l->data);
+	g_slist_free(meta.config);
+
+	return ret;
+}
+
+static int send_logic(const struct sr_dev_inst *sdi,
+		const struct srnet_frame *frame)
+{
+	struct dev_context *devc;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	const uint8_t *p, *end;
+	uint16_t unitsize;
+	uint64_t n;
+
+	devc = sdi->priv;
+	p = frame->payload;
+	end = p + frame->len;
+	if (!get_le16(&p, end, &unitsize) || !unitsize
+	    || (end - p) % unitsize)
+		return SR_ERR;
+
+	/* Stop right at the limit, even within a frame. */
+	n = (end - p) / unitsize;
+	if (devc->limit_samples)
+		n = MIN(n, devc->limit_samples - devc->num_samples);
+	devc->num_samples += n;
+
+	memset(&logic, 0, sizeof(logic));
+	logic.length = n * unitsize;
+	logic.unitsize = unitsize;
+	logic.data = (void *)p;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+
+	return sr_session_send(sdi, &packet);
+}
+
+static struct sr_probe *probe_find(const struct sr_dev_inst *sdi, int index)
+{
+	struct sr_probe *probe;
+	GSList *l;
+
+	for (l = sdi->probes; l; l = l->next) {
+		probe = l->data;
+		if (probe->index == index)
+			return probe;
+	}
+
+	return NULL;
+}
+
+static int send_analog(const struct sr_dev_inst *sdi,
+		const struct srnet_frame *frame)
+{
+	struct dev_context *devc;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+	struct sr_probe *probe;
+	const uint8_t *p, *end;
+	uint32_t num_samples, mq, unit, bits;
+	uint16_t num_probes, index, i;
+	uint64_t mqflags, n, k;
+	float *floats;
+	int ret;
+
+	devc = sdi->priv;
+	p = frame->payload;
+	end = p + frame->len;
+	if (!get_le16(&p, end, &num_probes))
+		return SR_ERR;
+
+	memset(&analog, 0, sizeof(analog));
+	ret = SR_OK;
+	for (i = 0; i < num_probes; i++) {
+		if (!get_le16(&p, end, &index)
+		    || !(probe = probe_find(sdi, index))) {
+			ret = SR_ERR;
+			break;
+		}
+		analog.probes = g_slist_append(analog.probes, probe);
+	}
+	if (ret != SR_OK || !get_le32(&p, end, &num_samples)
+	    || !get_le32(&p, end, &mq) || !get_le32(&p, end, &unit)
+	    || !get_le64(&p, end, &mqflags)
+	    || num_samples > G_MAXINT
+	    || (uint64_t)(end - p) != (uint64_t)num_samples * num_probes * 4) {
+		g_slist_free(analog.probes);
+		return SR_ERR;
+	}
+
+	n = (uint64_t)num_samples * num_probes;
+	if (n > devc->floats_size) {
+		floats = g_try_realloc(devc->floats, n * sizeof(float));
+		if (!floats) {
+			sr_err("%s: floats realloc failed", __func__);
+			g_slist_free(analog.probes);
+			return SR_ERR_MALLOC;
+		}
+		devc->floats = floats;
+		devc->floats_size = n;
+	}
+	for (k = 0; k < n; k++) {
+		get_le32(&p, end, &bits);
+		memcpy(&devc->floats[k], &bits, sizeof(float));
+	}
+
+	analog.num_samples = num_samples;
+	analog.mq = mq;
+	analog.unit = unit;
+	analog.mqflags = mqflags;
+	analog.data = devc->floats;
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	ret = sr_session_send(sdi, &packet);
+	g_slist_free(analog.probes);
+
+	return ret;
+}
+
+/* Returned by frame_send() for the end of the datafeed. */
+#define FEED_END 1
+
+/* Returns SR_OK while the capture goes on. */
+static int frame_send(const struct sr_dev_inst *sdi,
+		const struct srnet_frame *frame)
+{
+	struct dev_context *devc;
+	struct sr_datafeed_packet packet;
+	int ret;
+
+	/* A ring is joined anywhere, so wait for the start of a capture. */
+	devc = sdi->priv;
+	if (!devc->in_feed && frame->type != SRNET_HEADER)
+		return SR_OK;
+
+	packet.payload = NULL;
+	switch (frame->type) {
+	case SRNET_DEVICE:
+		/* Only of interest when connecting. */
+		return SR_OK;
+	case SRNET_HEADER:
+		devc->in_feed = TRUE;
+		ret = send_header(sdi, frame);
+		break;
+	case SRNET_END:
+		devc->in_feed = FALSE;
+		return FEED_END;
+	case SRNET_META:
+		ret = send_meta(sdi, frame);
+		break;
+	case SRNET_LOGIC:
+		ret = send_logic(sdi, frame);
+		break;
+	case SRNET_ANALOG:
+		ret = send_analog(sdi, frame);
+		break;
+	case SRNET_TRIGGER:
+		packet.type = SR_DF_TRIGGER;
+		ret = sr_session_send(sdi, &packet);
+		break;
+	case SRNET_FRAME_BEGIN:
+		packet.type = SR_DF_FRAME_BEGIN;
+		ret = sr_session_send(sdi, &packet);
+		break;
+	case SRNET_FRAME_END:
+		packet.type = SR_DF_FRAME_END;
+		ret = sr_session_send(sdi, &packet);
+		break;
+	default:
+		/* Newer servers may send more. */
+		sr_dbg("Ignoring frame type %d.", frame->type);
+		return SR_OK;
+	}
+
+	if (ret != SR_OK)
+		sr_err("Invalid frame of type %d.", frame->type);
+
+	return ret;
+}
+
+SR_PRIV int srnet_receive_data(int fd, int revents, void *cb_data)
+{
+	struct sr_dev_inst *sdi;
+	struct dev_context *devc;
+	struct srnet_frame frame;
+	gboolean have_read;
+	int ret;
+
+	(void)fd;
+	(void)revents;
+
+	if (!(sdi = cb_data) || !(devc = sdi->priv))
+		return TRUE;
+
+	/* Frames left over from connecting come first. */
+	ret = SR_OK;
+	have_read = FALSE;
+	while (ret == SR_OK && (!devc->limit_samples
+	       || devc->num_samples < devc->limit_samples)) {
+		if ((ret = srnet_frame_next(devc, &frame)) == 1) {
+			ret = frame_send(sdi, &frame);
+		} else if (ret == 0) {
+			/* One read per call, so others get their turn. */
+			if (have_read || (ret = srnet_read(devc, 0)) == 0)
+				return TRUE;
+			have_read = TRUE;
+			if (ret > 0)
+				ret = SR_OK;
+		}
+	}
+
+	if (ret == FEED_END)
+		sr_info("The server ended the capture.");
+	else if (ret == SR_OK)
+		sr_info("Requested number of samples reached.");
+	else
+		sr_err("Lost the stream from '%s'.", devc->conn);
+	sdi->driver->dev_acquisition_stop(sdi, sdi);
+
+	return TRUE;
+}
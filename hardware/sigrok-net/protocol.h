@@ -0,0 +1,98 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBSIGROK_HARDWARE_SIGROK_NET_PROTOCOL_H
+#define LIBSIGROK_HARDWARE_SIGROK_NET_PROTOCOL_H
+
+#include <stdint.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "sigrok-net: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/* How long to wait for the server's device frame when connecting. */
+#define SRNET_CONNECT_TIMEOUT 3000
+
+/* Bytes read from the socket at once. */
+#define SRNET_READ_SIZE (256 * 1024)
+
+/** A frame of the stream, see output/srnet.c. */
+struct srnet_frame {
+	int type;
+	/* Inflated if it was sent deflated. */
+	const uint8_t *payload;
+	uint32_t len;
+};
+
+/** Private, per-device-instance driver context. */
+struct dev_context {
+	/* Connection */
+	char *conn;
+	int fd;
+
+	/* The shared memory ring, with conn=shm:<name>. */
+	struct sr_shm_ring *ring;
+	size_t map_size;
+	/* Bytes of the frame passed on last, released on the next one. */
+	uint64_t ring_pending;
+	/* Makes fd readable when the producer writes to the ring. */
+	GThread *waiter;
+	gint waiter_stop;
+	int wake_fd;
+
+	/* Acquisition settings */
+	uint64_t limit_samples;
+
+	/* Operational state */
+	uint64_t samplerate;
+	uint64_t num_samples;
+	gboolean in_feed;
+
+	/* Bytes received, but not parsed yet. */
+	uint8_t *buf;
+	size_t buf_start;
+	size_t buf_len;
+	size_t buf_size;
+	/* The payload of the last deflated frame. */
+	uint8_t *inflated;
+	size_t inflated_size;
+	/* Analog samples, converted from the frame. */
+	float *floats;
+	size_t floats_size;
+};
+
+SR_PRIV int srnet_connect(struct dev_context *devc);
+SR_PRIV void srnet_disconnect(struct dev_context *devc);
+SR_PRIV int srnet_frame_next(struct dev_context *devc,
+		struct srnet_frame *frame);
+SR_PRIV int srnet_read(struct dev_context *devc, int timeout);
+SR_PRIV int srnet_shm_device(struct dev_context *devc,
+		struct srnet_frame *frame);
+SR_PRIV void srnet_shm_attach(struct dev_context *devc, gboolean attach);
+SR_PRIV struct sr_dev_inst *srnet_device_new(
+		const struct srnet_frame *frame);
+SR_PRIV int srnet_receive_data(int fd, int revents, void *cb_data);
+
+#endif
@@ -155,6 +155,8 @@ static GSList *scan(GSList *options)
 		goto scan_cleanup;
 	sdi->probes = g_slist_append(sdi->probes, probe);
 
+	teleinfo_index_probes(sdi);
+
 	drvc->instances = g_slist_append(drvc->instances, sdi);
 	devices = g_slist_append(devices, sdi);
 
@@ -278,6 +280,8 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 	 */
 	devc->num_samples = 0;
 	devc->start_time = g_get_monotonic_time();
+	devc->frame_labels = 0;
+	devc->frame_groups = 0;
 
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
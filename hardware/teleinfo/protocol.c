@@ -39,42 +39,102 @@ static gboolean teleinfo_control_check(char *label, char *data, char control)
 	return ((sum & 0x3F) + ' ') == control;
 }
 
-static gint teleinfo_probe_compare(gconstpointer a, gconstpointer b)
-{
-	const struct sr_probe *probe = a;
-	const char *name = b;
-	return strcmp(probe->name, name);
-}
+/* The values the driver reports, by the label the meter sends them with. */
+static const struct {
+	const char *label;
+	const char *probe_name;
+	int mq;
+	int unit;
+} teleinfo_labels[TELEINFO_NUM_LABELS] = {
+	{ "BASE",    "BASE",  SR_MQ_POWER,   SR_UNIT_WATT_HOUR },
+	{ "HCHP",    "HP",    SR_MQ_POWER,   SR_UNIT_WATT_HOUR },
+	{ "HCHC",    "HC",    SR_MQ_POWER,   SR_UNIT_WATT_HOUR },
+	{ "EJPHN",   "HN",    SR_MQ_POWER,   SR_UNIT_WATT_HOUR },
+	{ "EJPHPM",  "HPM",   SR_MQ_POWER,   SR_UNIT_WATT_HOUR },
+	{ "BBRHPJB", "HPJB",  SR_MQ_POWER,   SR_UNIT_WATT_HOUR },
+	{ "BBRHPJW", "HPJW",  SR_MQ_POWER,   SR_UNIT_WATT_HOUR },
+	{ "BBRHPJR", "HPJR",  SR_MQ_POWER,   SR_UNIT_WATT_HOUR },
+	{ "BBRHCJB", "HCJB",  SR_MQ_POWER,   SR_UNIT_WATT_HOUR },
+	{ "BBRHCJW", "HCJW",  SR_MQ_POWER,   SR_UNIT_WATT_HOUR },
+	{ "BBRHCJR", "HCJR",  SR_MQ_POWER,   SR_UNIT_WATT_HOUR },
+	{ "IINST",   "IINST", SR_MQ_CURRENT, SR_UNIT_AMPERE },
+	{ "PAPP",    "PAPP",  SR_MQ_POWER,   SR_UNIT_VOLT_AMPERE },
+};
 
-static struct sr_probe *teleinfo_find_probe(struct sr_dev_inst *sdi,
-                                            const char *name)
+/**
+ * Look up the probe of each label's value once, so frames don't need to
+ * search the probe list by name.
+ *
+ * @private
+ */
+SR_PRIV void teleinfo_index_probes(struct sr_dev_inst *sdi)
 {
-	GSList *elem = g_slist_find_custom(sdi->probes, name,
-	                                   teleinfo_probe_compare);
-	return elem ? elem->data : NULL;
+	struct dev_context *devc = sdi->priv;
+	struct sr_probe *probe;
+	const char *name;
+	GSList *l;
+	int i;
+
+	for (i = 0; i < TELEINFO_NUM_LABELS; i++) {
+		devc->label_probes[i] = NULL;
+		name = teleinfo_labels[i].probe_name;
+		for (l = sdi->probes; l; l = l->next) {
+			probe = l->data;
+			if (!strcmp(probe->name, name)) {
+				devc->label_probes[i] = probe;
+				break;
+			}
+		}
+	}
 }
 
-static void teleinfo_send_value(struct sr_dev_inst *sdi, const char *probe_name,
-                                float value, int mq, int unit)
+/*
+ * Send the values of a frame, in one packet per measured quantity and
+ * unit, since a packet's probes all share those.
+ */
+static void teleinfo_frame_end(struct sr_dev_inst *sdi)
 {
-	struct dev_context *devc = sdi->priv;
+	struct dev_context *devc;
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_analog analog = { 0 };
-	struct sr_probe *probe = teleinfo_find_probe(sdi, probe_name);
+	float data[TELEINFO_NUM_LABELS];
+	uint32_t pending;
+	int i, j, n;
 
-	if (!probe || !probe->enabled)
+	if (!sdi || !(devc = sdi->priv))
 		return;
 
-	analog.probes = g_slist_append(analog.probes, probe);
-	analog.num_samples = 1;
-	analog.mq = mq;
-	analog.unit = unit;
-	analog.data = &value;
+	pending = devc->frame_labels;
+	for (i = 0; i < TELEINFO_NUM_LABELS; i++) {
+		if (!(pending & (1 << i)))
+			continue;
+		analog.probes = NULL;
+		analog.num_samples = 1;
+		analog.mq = teleinfo_labels[i].mq;
+		analog.unit = teleinfo_labels[i].unit;
+		analog.data = data;
+		n = 0;
+		for (j = i; j < TELEINFO_NUM_LABELS; j++) {
+			if (!(pending & (1 << j))
+			    || teleinfo_labels[j].mq != analog.mq
+			    || teleinfo_labels[j].unit != analog.unit)
+				continue;
+			data[n++] = devc->frame_values[j];
+			analog.probes = g_slist_append(analog.probes,
+					devc->label_probes[j]);
+			pending &= ~(1 << j);
+		}
+
+		packet.type = SR_DF_ANALOG;
+		packet.payload = &analog;
+		sr_session_send(devc->session_cb_data, &packet);
+		g_slist_free(analog.probes);
+	}
 
-	packet.type = SR_DF_ANALOG;
-	packet.payload = &analog;
-	sr_session_send(devc->session_cb_data, &packet);
-	g_slist_free(analog.probes);
+	if (devc->frame_groups)
+		devc->num_samples++;
+	devc->frame_labels = 0;
+	devc->frame_groups = 0;
 }
 
 static void teleinfo_handle_mesurement(struct sr_dev_inst *sdi,
@@ -82,7 +142,8 @@ static void teleinfo_handle_mesurement(struct sr_dev_inst *sdi,
                                        char *optarif)
 {
 	struct dev_context *devc;
-	int v = atoi(data);
+	struct sr_probe *probe;
+	int i;
 
 	if (!sdi || !(devc = sdi->priv)) {
 		if (optarif && !strcmp(label, "OPTARIF"))
@@ -90,34 +151,16 @@ static void teleinfo_handle_mesurement(struct sr_dev_inst *sdi,
 		return;
 	}
 
-	if (!strcmp(label, "ADCO")) {
-		devc->num_samples++;
-	} else if (!strcmp(label, "BASE")) {
-		teleinfo_send_value(sdi, "BASE", v, SR_MQ_POWER, SR_UNIT_WATT_HOUR);
-	} else if (!strcmp(label, "HCHP")) {
-		teleinfo_send_value(sdi, "HP"  , v, SR_MQ_POWER, SR_UNIT_WATT_HOUR);
-	} else if (!strcmp(label, "HCHC")) {
-		teleinfo_send_value(sdi, "HC"  , v, SR_MQ_POWER, SR_UNIT_WATT_HOUR);
-	} else if (!strcmp(label, "EJPHN")) {
-		teleinfo_send_value(sdi, "HN"  , v, SR_MQ_POWER, SR_UNIT_WATT_HOUR);
-	} else if (!strcmp(label, "EJPHPM")) {
-		teleinfo_send_value(sdi, "HPM" , v, SR_MQ_POWER, SR_UNIT_WATT_HOUR);
-	} else if (!strcmp(label, "BBRHPJB")) {
-		teleinfo_send_value(sdi, "HPJB", v, SR_MQ_POWER, SR_UNIT_WATT_HOUR);
-	} else if (!strcmp(label, "BBRHPJW")) {
-		teleinfo_send_value(sdi, "HPJW", v, SR_MQ_POWER, SR_UNIT_WATT_HOUR);
-	} else if (!strcmp(label, "BBRHPJR")) {
-		teleinfo_send_value(sdi, "HPJR", v, SR_MQ_POWER, SR_UNIT_WATT_HOUR);
-	} else if (!strcmp(label, "BBRHCJB")) {
-		teleinfo_send_value(sdi, "HCJB", v, SR_MQ_POWER, SR_UNIT_WATT_HOUR);
-	} else if (!strcmp(label, "BBRHCJW")) {
-		teleinfo_send_value(sdi, "HCJW", v, SR_MQ_POWER, SR_UNIT_WATT_HOUR);
-	} else if (!strcmp(label, "BBRHCJR")) {
-		teleinfo_send_value(sdi, "HCJR", v, SR_MQ_POWER, SR_UNIT_WATT_HOUR);
-	} else if (!strcmp(label, "IINST")) {
-		teleinfo_send_value(sdi, "IINST", v, SR_MQ_CURRENT, SR_UNIT_AMPERE);
-	} else if (!strcmp(label, "PAPP")) {
-		teleinfo_send_value(sdi, "PAPP", v, SR_MQ_POWER, SR_UNIT_VOLT_AMPERE);
+	devc->frame_groups++;
+	for (i = 0; i < TELEINFO_NUM_LABELS; i++) {
+		if (strcmp(label, teleinfo_labels[i].label))
+			continue;
+		probe = devc->label_probes[i];
+		if (probe && probe->enabled) {
+			devc->frame_values[i] = atoi(data);
+			devc->frame_labels |= 1 << i;
+		}
+		break;
 	}
 }
 
@@ -140,6 +183,12 @@ static const uint8_t *teleinfo_parse_data(struct sr_dev_inst *sdi,
                                           char *optarif)
 {
 	const uint8_t *group_start = memchr(buf, LF, len);
+	const uint8_t *frame_end = memchr(buf, ETX, group_start ?
+	                                  group_start - buf : len);
+	if (frame_end) {
+		teleinfo_frame_end(sdi);
+		return frame_end + 1;
+	}
 	if (!group_start)
 		return NULL;
 
@@ -28,11 +28,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "teleinfo: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 enum optarif {
 	OPTARIF_NONE,
@@ -44,6 +44,9 @@ enum optarif {
 
 #define TELEINFO_BUF_SIZE 256
 
+/* The number of labels of values the driver reports, see teleinfo_labels. */
+#define TELEINFO_NUM_LABELS 13
+
 /** Private, per-device-instance driver context. */
 struct dev_context {
 	/* Acquisition settings */
@@ -56,13 +59,21 @@ struct dev_context {
 	uint64_t num_samples;     /**< The number of already received samples. */
 	int64_t start_time;       /**< The time at which sampling started. */
 
+	/* The probe each label's value goes to, NULL if there is none. */
+	struct sr_probe *label_probes[TELEINFO_NUM_LABELS];
+
 	/* Temporary state across callbacks */
 	uint8_t buf[TELEINFO_BUF_SIZE];
 	int buf_len;
+	/* The values of the current frame, sent when it ends. */
+	float frame_values[TELEINFO_NUM_LABELS];
+	uint32_t frame_labels;    /**< Labels with a value in frame_values. */
+	int frame_groups;         /**< Groups received of the current frame. */
 };
 
 SR_PRIV gboolean teleinfo_packet_valid(const uint8_t *buf);
 SR_PRIV int teleinfo_receive_data(int fd, int revents, void *cb_data);
 SR_PRIV int teleinfo_get_optarif(const uint8_t *buf);
+SR_PRIV void teleinfo_index_probes(struct sr_dev_inst *sdi);
 
 #endif
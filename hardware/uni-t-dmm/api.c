@@ -35,6 +35,8 @@ static const int32_t hwcaps[] = {
 	SR_CONF_LIMIT_SAMPLES,
 	SR_CONF_LIMIT_MSEC,
 	SR_CONF_CONTINUOUS,
+	SR_CONF_BATCH_SAMPLES,
+	SR_CONF_BATCH_MSEC,
 };
 
 SR_PRIV struct sr_dev_driver tecpel_dmm_8061_driver_info;
@@ -50,28 +52,28 @@ SR_PRIV struct sr_dev_driver tenma_72_7745_driver_info;
 SR_PRIV struct dmm_info udmms[] = {
 	{
 		"Tecpel", "DMM-8061", 2400,
-		FS9721_PACKET_SIZE,
+		FS9721_PACKET_SIZE, FS9721_PACKET_SYNC,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		sr_fs9721_00_temp_c,
 		&tecpel_dmm_8061_driver_info, receive_data_TECPEL_DMM_8061,
 	},
 	{
 		"UNI-T", "UT60A", 2400,
-		FS9721_PACKET_SIZE,
+		FS9721_PACKET_SIZE, FS9721_PACKET_SYNC,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		NULL,
 		&uni_t_ut60a_driver_info, receive_data_UNI_T_UT60A,
 	},
 	{
 		"UNI-T", "UT60E", 2400,
-		FS9721_PACKET_SIZE,
+		FS9721_PACKET_SIZE, FS9721_PACKET_SYNC,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		sr_fs9721_00_temp_c,
 		&uni_t_ut60e_driver_info, receive_data_UNI_T_UT60E,
 	},
 	{
 		"UNI-T", "UT61D", 2400,
-		FS9922_PACKET_SIZE,
+		FS9922_PACKET_SIZE, FS9922_PACKET_SYNC,
 		sr_fs9922_packet_valid, sr_fs9922_parse,
 		NULL,
 		&uni_t_ut61d_driver_info, receive_data_UNI_T_UT61D,
@@ -87,14 +89,14 @@ SR_PRIV struct dmm_info udmms[] = {
 		 * this DMM, of course).
 		 */
 		"UNI-T", "UT61E", 19200,
-		ES51922_PACKET_SIZE,
+		ES51922_PACKET_SIZE, ES51922_PACKET_SYNC,
 		sr_es51922_packet_valid, sr_es51922_parse,
 		NULL,
 		&uni_t_ut61e_driver_info, receive_data_UNI_T_UT61E,
 	},
 	{
 		"Voltcraft", "VC-820", 2400,
-		FS9721_PACKET_SIZE,
+		FS9721_PACKET_SIZE, FS9721_PACKET_SYNC,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		NULL,
 		&voltcraft_vc820_driver_info, receive_data_VOLTCRAFT_VC820,
@@ -106,21 +108,21 @@ SR_PRIV struct dmm_info udmms[] = {
 		 * bit "z1" to indicate "diode mode" and "voltage".
 		 */
 		"Voltcraft", "VC-830", 2400,
-		FS9922_PACKET_SIZE,
+		FS9922_PACKET_SIZE, FS9922_PACKET_SYNC,
 		sr_fs9922_packet_valid, sr_fs9922_parse,
 		&sr_fs9922_z1_diode,
 		&voltcraft_vc830_driver_info, receive_data_VOLTCRAFT_VC830,
 	},
 	{
 		"Voltcraft", "VC-840", 2400,
-		FS9721_PACKET_SIZE,
+		FS9721_PACKET_SIZE, FS9721_PACKET_SYNC,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		sr_fs9721_00_temp_c,
 		&voltcraft_vc840_driver_info, receive_data_VOLTCRAFT_VC840,
 	},
 	{
 		"Tenma", "72-7745", 2400,
-		FS9721_PACKET_SIZE,
+		FS9721_PACKET_SIZE, FS9721_PACKET_SYNC,
 		sr_fs9721_packet_valid, sr_fs9721_parse,
 		sr_fs9721_00_temp_c,
 		&tenma_72_7745_driver_info,
@@ -136,8 +138,13 @@ static int dev_clear(int dmm)
 
 static int init(struct sr_context *sr_ctx, int dmm)
 {
+	int ret;
+
 	sr_dbg("Selected '%s' subdriver.", udmms[dmm].di->name);
 
+	if ((ret = sr_usb_init(sr_ctx)) != SR_OK)
+		return ret;
+
 	return std_init(sr_ctx, udmms[dmm].di, LOG_PREFIX);
 }
 
@@ -167,7 +174,7 @@ static GSList *scan(GSList *options, int dmm)
 		return NULL;
 
 	devices = NULL;
-	if (!(usb_devices = sr_usb_find(drvc->sr_ctx->libusb_ctx, conn))) {
+	if (!(usb_devices = sr_usb_find(drvc->sr_ctx, conn))) {
 		g_slist_free_full(usb_devices, g_free);
 		return NULL;
 	}
@@ -267,6 +274,16 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 		sr_dbg("Setting sample limit to %" PRIu64 ".",
 		       devc->limit_samples);
 		break;
+	case SR_CONF_BATCH_SAMPLES:
+		devc->batch.max_samples = g_variant_get_uint64(data);
+		sr_dbg("Setting batch size to %" PRIu64 " readings.",
+		       devc->batch.max_samples);
+		break;
+	case SR_CONF_BATCH_MSEC:
+		devc->batch.max_wait = g_variant_get_uint64(data) * 1000;
+		sr_dbg("Setting batch time window to %" PRIu64 "ms.",
+		       g_variant_get_uint64(data));
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -300,37 +317,96 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 				    void *cb_data, int dmm)
 {
 	struct dev_context *devc;
+	struct drv_context *drvc;
+	struct sr_usb_dev_inst *usb;
+	struct libusb_transfer *transfer;
+	unsigned char *buf;
+	int i, ret;
 
 	devc = sdi->priv;
+	drvc = udmms[dmm].di->priv;
+	usb = sdi->conn;
 
 	devc->cb_data = cb_data;
+	devc->dmm = dmm;
+	devc->ctx = drvc->sr_ctx;
+	devc->num_samples = 0;
+	devc->stopping = FALSE;
+	devc->ring_head = devc->ring_len = 0;
+	sr_dmm_framer_init(&devc->framer, udmms[dmm].packet_size,
+			&udmms[dmm].sync, udmms[dmm].packet_valid);
+
+	/* On the first run, we need to init the HID chip. */
+	if (devc->first_run) {
+		if ((ret = uni_t_dmm_hid_chip_init((struct sr_dev_inst *)sdi,
+				udmms[dmm].baudrate)) != SR_OK) {
+			sr_err("HID chip init failed: %d.", ret);
+			return SR_ERR;
+		}
+		devc->first_run = FALSE;
+	}
 
 	devc->starttime = g_get_monotonic_time();
+	sr_analog_batch_start(&devc->batch, cb_data);
 
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
 
-	sr_source_add(0, 0, 10 /* poll_timeout */,
-		      udmms[dmm].receive_data, (void *)sdi);
+	if ((ret = sr_usb_source_add(devc->ctx, 10 /* poll_timeout */,
+			udmms[dmm].receive_data, (void *)sdi)) != SR_OK)
+		return ret;
 
-	return SR_OK;
+	/* Keep the USB thread from completing transfers meanwhile. */
+	libusb_lock_events(devc->ctx->libusb_ctx);
+	for (i = 0; i < NUM_TRANSFERS; i++) {
+		if (!(buf = g_try_malloc(CHUNK_SIZE))) {
+			sr_err("%s: buf malloc failed", __func__);
+			ret = SR_ERR_MALLOC;
+			break;
+		}
+		if (!(transfer = libusb_alloc_transfer(0))) {
+			sr_err("%s: transfer malloc failed", __func__);
+			g_free(buf);
+			ret = SR_ERR_MALLOC;
+			break;
+		}
+		/* Get data from EP2 using interrupt transfers. */
+		libusb_fill_interrupt_transfer(transfer, usb->devhdl,
+				LIBUSB_ENDPOINT_IN | 2, buf, CHUNK_SIZE,
+				uni_t_dmm_receive_transfer, (void *)sdi, 0);
+		if ((ret = libusb_submit_transfer(transfer)) < 0) {
+			sr_err("Failed to submit transfer: %s.",
+			       libusb_error_name(ret));
+			libusb_free_transfer(transfer);
+			g_free(buf);
+			ret = SR_ERR;
+			break;
+		}
+		devc->transfers[i] = transfer;
+		devc->num_transfers++;
+		ret = SR_OK;
+	}
+	if (ret != SR_OK)
+		uni_t_dmm_abort_acquisition((struct sr_dev_inst *)sdi);
+	libusb_unlock_events(devc->ctx->libusb_ctx);
+
+	return ret;
 }
 
 static int dev_acquisition_stop(struct sr_dev_inst *sdi, void *cb_data)
 {
-	struct sr_datafeed_packet packet;
+	struct dev_context *devc;
 
-	(void)sdi;
+	(void)cb_data;
 
-	sr_dbg("Stopping acquisition.");
+	devc = sdi->priv;
 
-	/* Send end packet to the session bus. */
-	sr_dbg("Sending SR_DF_END.");
-	packet.type = SR_DF_END;
-	sr_session_send(cb_data, &packet);
+	sr_dbg("Stopping acquisition.");
 
-	/* TODO? */
-	sr_source_remove(0);
+	/* The session feed ends once the cancelled transfers are freed. */
+	libusb_lock_events(devc->ctx->libusb_ctx);
+	uni_t_dmm_abort_acquisition(sdi);
+	libusb_unlock_events(devc->ctx->libusb_ctx);
 
 	return SR_OK;
 }
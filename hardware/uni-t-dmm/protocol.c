@@ -53,20 +53,19 @@ extern struct dmm_info udmms[];
  *  f1 d1 00 00 00 00 00 00 (1 data byte, 0xd1)
  */
 
-static void decode_packet(struct sr_dev_inst *sdi, int dmm, const uint8_t *buf,
-			  void *info)
+static void decode_packet(struct sr_dev_inst *sdi, const uint8_t *buf)
 {
 	struct dev_context *devc;
-	struct sr_datafeed_packet packet;
 	struct sr_datafeed_analog analog;
 	float floatval;
-	int ret;
+	int dmm, ret;
 
 	devc = sdi->priv;
+	dmm = devc->dmm;
 	memset(&analog, 0, sizeof(struct sr_datafeed_analog));
 
 	/* Parse the protocol packet. */
-	ret = udmms[dmm].packet_parse(buf, &floatval, &analog, info);
+	ret = udmms[dmm].packet_parse(buf, &floatval, &analog, &devc->info);
 	if (ret != SR_OK) {
 		sr_dbg("Invalid DMM packet, ignoring.");
 		return;
@@ -74,21 +73,20 @@ static void decode_packet(struct sr_dev_inst *sdi, int dmm, const uint8_t *buf,
 
 	/* If this DMM needs additional handling, call the resp. function. */
 	if (udmms[dmm].dmm_details)
-		udmms[dmm].dmm_details(&analog, info);
+		udmms[dmm].dmm_details(&analog, &devc->info);
 
-	/* Send a sample packet with one analog value. */
+	/* Send the analog value, or add it to the batch. */
 	analog.probes = sdi->probes;
 	analog.num_samples = 1;
 	analog.data = &floatval;
-	packet.type = SR_DF_ANALOG;
-	packet.payload = &analog;
-	sr_session_send(devc->cb_data, &packet);
+	sr_analog_batch_add(&devc->batch, &analog);
 
 	/* Increase sample count. */
 	devc->num_samples++;
 }
 
-static int hid_chip_init(struct sr_dev_inst *sdi, uint16_t baudrate)
+SR_PRIV int uni_t_dmm_hid_chip_init(struct sr_dev_inst *sdi,
+				     uint16_t baudrate)
 {
 	int ret;
 	uint8_t buf[5];
@@ -171,59 +169,50 @@ static void log_dmm_packet(const uint8_t *buf)
 	       buf[7], buf[8], buf[9], buf[10], buf[11], buf[12], buf[13]);
 }
 
-static int get_and_handle_data(struct sr_dev_inst *sdi, int dmm, void *info)
+static void ring_append(struct dev_context *devc, uint8_t byte)
 {
-	struct dev_context *devc;
-	uint8_t buf[CHUNK_SIZE], *pbuf;
-	int i, ret, len, num_databytes_in_chunk;
-	struct sr_usb_dev_inst *usb;
-
-	devc = sdi->priv;
-	usb = sdi->conn;
-	pbuf = devc->protocol_buf;
+	unsigned int pos;
 
-	/* On the first run, we need to init the HID chip. */
-	if (devc->first_run) {
-		if ((ret = hid_chip_init(sdi, udmms[dmm].baudrate)) != SR_OK) {
-			sr_err("HID chip init failed: %d.", ret);
-			return SR_ERR;
-		}
-		memset(pbuf, 0x00, DMM_BUFSIZE);
-		devc->first_run = FALSE;
+	/* Drop the oldest byte if no packet was found in a full ring. */
+	if (devc->ring_len == DMM_BUFSIZE) {
+		devc->ring_head = (devc->ring_head + 1) % DMM_BUFSIZE;
+		devc->ring_len--;
 	}
 
-	memset(&buf, 0x00, CHUNK_SIZE);
+	pos = (devc->ring_head + devc->ring_len) % DMM_BUFSIZE;
+	devc->ring[pos] = devc->ring[pos + DMM_BUFSIZE] = byte;
+	devc->ring_len++;
+}
 
-	/* Get data from EP2 using an interrupt transfer. */
-	ret = libusb_interrupt_transfer(
-		usb->devhdl, /* libusb device handle */
-		LIBUSB_ENDPOINT_IN | 2, /* EP2, IN */
-		(unsigned char *)&buf, /* receive buffer */
-		CHUNK_SIZE, /* wLength */
-		&len, /* actually received byte count */
-		1000 /* timeout (ms) */);
+static void ring_consume(struct dev_context *devc, unsigned int len)
+{
+	devc->ring_head = (devc->ring_head + len) % DMM_BUFSIZE;
+	devc->ring_len -= len;
+}
 
-	if (ret < 0) {
-		sr_err("USB receive error: %s.", libusb_error_name(ret));
-		return SR_ERR;
-	}
+static void packet_found(const uint8_t *buf, void *cb_data)
+{
+	log_dmm_packet(buf);
+	decode_packet(cb_data, buf);
+}
 
-	if (len != CHUNK_SIZE) {
-		sr_err("Short packet: received %d/%d bytes.", len, CHUNK_SIZE);
-		/* TODO: Print the bytes? */
-		return SR_ERR;
-	}
+static void handle_chunk(struct sr_dev_inst *sdi, const uint8_t *buf)
+{
+	struct dev_context *devc;
+	int i, dmm, num_databytes_in_chunk;
+	uint8_t byte;
+
+	devc = sdi->priv;
+	dmm = devc->dmm;
 
-	log_8byte_chunk((const uint8_t *)&buf);
+	log_8byte_chunk(buf);
 
 	/* If there are no data bytes just return (without error). */
 	if (buf[0] == 0xf0)
-		return SR_OK;
-
-	devc->bufoffset = 0;
+		return;
 
 	/*
-	 * Append the 1-7 data bytes of this chunk to pbuf.
+	 * Append the 1-7 data bytes of this chunk to the ring.
 	 *
 	 * Special case:
 	 * DMMs with Cyrustek ES51922 chip need serial settings of
@@ -235,36 +224,145 @@ static int get_and_handle_data(struct sr_dev_inst *sdi, int dmm, void *info)
 	 * work properly.
 	 */
 	num_databytes_in_chunk = buf[0] & 0x0f;
-	for (i = 0; i < num_databytes_in_chunk; i++, devc->buflen++) {
-		pbuf[devc->buflen] = buf[1 + i];
+	for (i = 0; i < num_databytes_in_chunk && i < CHUNK_SIZE - 1; i++) {
+		byte = buf[1 + i];
 		if (udmms[dmm].packet_parse == sr_es51922_parse)
-			pbuf[devc->buflen] &= ~(1 << 7);
+			byte &= ~(1 << 7);
+		ring_append(devc, byte);
 	}
 
 	/* Now look for packets in that data. */
-	while ((devc->buflen - devc->bufoffset) >= udmms[dmm].packet_size) {
-		if (udmms[dmm].packet_valid(pbuf + devc->bufoffset)) {
-			log_dmm_packet(pbuf + devc->bufoffset);
-			decode_packet(sdi, dmm, pbuf + devc->bufoffset, info);
-			devc->bufoffset += udmms[dmm].packet_size;
-		} else {
-			devc->bufoffset++;
+	ring_consume(devc, sr_dmm_framer_parse(&devc->framer,
+			devc->ring + devc->ring_head, devc->ring_len,
+			packet_found, sdi));
+}
+
+static void finish_acquisition(struct sr_dev_inst *sdi)
+{
+	struct sr_datafeed_packet packet;
+	struct dev_context *devc;
+
+	devc = sdi->priv;
+
+	/* Send what's left of the batch before SR_DF_END. */
+	sr_analog_batch_flush(&devc->batch);
+	sr_analog_batch_clear(&devc->batch);
+
+	/* Send end packet to the session bus. */
+	sr_dbg("Sending SR_DF_END.");
+	packet.type = SR_DF_END;
+	sr_session_send(devc->cb_data, &packet);
+
+	sr_usb_source_remove(devc->ctx, sdi);
+}
+
+static void free_transfer(struct libusb_transfer *transfer)
+{
+	struct sr_dev_inst *sdi;
+	struct dev_context *devc;
+	int i;
+
+	sdi = transfer->user_data;
+	devc = sdi->priv;
+
+	for (i = 0; i < NUM_TRANSFERS; i++) {
+		if (devc->transfers[i] == transfer) {
+			devc->transfers[i] = NULL;
+			break;
 		}
 	}
 
-	/* Move remaining bytes to beginning of buffer. */
-	for (i = 0; i < devc->buflen - devc->bufoffset; i++)
-		pbuf[i] = pbuf[devc->bufoffset + i];
-	devc->buflen -= devc->bufoffset;
+	g_free(transfer->buffer);
+	transfer->buffer = NULL;
+	libusb_free_transfer(transfer);
 
-	return SR_OK;
+	if (--devc->num_transfers == 0 && devc->stopping)
+		finish_acquisition(sdi);
 }
 
-static int receive_data(int fd, int revents, int dmm, void *info, void *cb_data)
+/**
+ * Stop the acquisition: cancel the queued transfers, and end the session
+ * feed once the last of them is freed.
+ *
+ * With the USB event thread, callers other than the completion callback
+ * must hold libusb_lock_events() around this.
+ */
+SR_PRIV void uni_t_dmm_abort_acquisition(struct sr_dev_inst *sdi)
 {
+	struct dev_context *devc;
+	int i;
+
+	devc = sdi->priv;
+
+	if (devc->stopping)
+		return;
+	devc->stopping = TRUE;
+
+	if (devc->num_transfers == 0) {
+		finish_acquisition(sdi);
+		return;
+	}
+
+	for (i = 0; i < NUM_TRANSFERS; i++) {
+		if (devc->transfers[i])
+			libusb_cancel_transfer(devc->transfers[i]);
+	}
+}
+
+/*
+ * Completion callback of the EP2 interrupt transfers. Each transfer is
+ * resubmitted right away, so the cable always has one queued while the
+ * previous chunk is being parsed, and no meter holds up the session.
+ */
+SR_PRIV void uni_t_dmm_receive_transfer(struct libusb_transfer *transfer)
+{
+	struct sr_dev_inst *sdi;
+	struct dev_context *devc;
 	int ret;
+
+	sdi = transfer->user_data;
+	devc = sdi->priv;
+
+	if (devc->stopping) {
+		free_transfer(transfer);
+		return;
+	}
+
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		sr_err("USB receive error: transfer status %d.",
+		       transfer->status);
+		uni_t_dmm_abort_acquisition(sdi);
+		free_transfer(transfer);
+		return;
+	}
+
+	if (transfer->actual_length == CHUNK_SIZE)
+		handle_chunk(sdi, transfer->buffer);
+	else
+		sr_err("Short packet: received %d/%d bytes.",
+		       transfer->actual_length, CHUNK_SIZE);
+
+	/* Abort acquisition if we acquired enough samples. */
+	if (devc->limit_samples && devc->num_samples >= devc->limit_samples) {
+		sr_info("Requested number of samples reached.");
+		uni_t_dmm_abort_acquisition(sdi);
+		free_transfer(transfer);
+		return;
+	}
+
+	if ((ret = libusb_submit_transfer(transfer)) < 0) {
+		sr_err("Failed to resubmit transfer: %s.",
+		       libusb_error_name(ret));
+		uni_t_dmm_abort_acquisition(sdi);
+		free_transfer(transfer);
+	}
+}
+
+static int receive_data(int fd, int revents, void *cb_data)
+{
 	struct sr_dev_inst *sdi;
 	struct dev_context *devc;
+	struct timeval tv;
 	int64_t time_ms;
 
 	(void)fd;
@@ -273,38 +371,36 @@ static int receive_data(int fd, int revents, int dmm, void *info, void *cb_data)
 	sdi = cb_data;
 	devc = sdi->priv;
 
-	if ((ret = get_and_handle_data(sdi, dmm, info)) != SR_OK)
-		return FALSE;
-
-	/* Abort acquisition if we acquired enough samples. */
-	if (devc->limit_samples && devc->num_samples >= devc->limit_samples) {
-		sr_info("Requested number of samples reached.");
-		sdi->driver->dev_acquisition_stop(sdi, cb_data);
+	/* Completions are handled elsewhere if the USB thread runs. */
+	if (!devc->ctx->usb_thread) {
+		tv.tv_sec = tv.tv_usec = 0;
+		libusb_handle_events_timeout(devc->ctx->libusb_ctx, &tv);
 	}
 
-	if (devc->limit_msec) {
+	libusb_lock_events(devc->ctx->libusb_ctx);
+	if (!devc->stopping) {
+		sr_analog_batch_poll(&devc->batch);
 		time_ms = (g_get_monotonic_time() - devc->starttime) / 1000;
-		if (time_ms > (int64_t)devc->limit_msec) {
+		if (devc->limit_msec && time_ms > (int64_t)devc->limit_msec) {
 			sr_info("Requested time limit reached.");
-			sdi->driver->dev_acquisition_stop(sdi, cb_data);
-			return TRUE;
+			uni_t_dmm_abort_acquisition(sdi);
 		}
 	}
+	libusb_unlock_events(devc->ctx->libusb_ctx);
 
 	return TRUE;
 }
 
-#define RECEIVE_DATA(ID_UPPER, DMM_DRIVER) \
+#define RECEIVE_DATA(ID_UPPER) \
 SR_PRIV int receive_data_##ID_UPPER(int fd, int revents, void *cb_data) { \
-	struct DMM_DRIVER##_info info; \
-	return receive_data(fd, revents, ID_UPPER, &info, cb_data); }
+	return receive_data(fd, revents, cb_data); }
 
 /* Driver-specific receive_data() wrappers */
-RECEIVE_DATA(TECPEL_DMM_8061, fs9721)
-RECEIVE_DATA(UNI_T_UT60A, fs9721)
-RECEIVE_DATA(UNI_T_UT60E, fs9721)
-RECEIVE_DATA(UNI_T_UT61D, fs9922)
-RECEIVE_DATA(UNI_T_UT61E, es51922)
-RECEIVE_DATA(VOLTCRAFT_VC820, fs9721)
-RECEIVE_DATA(VOLTCRAFT_VC830, fs9922)
-RECEIVE_DATA(VOLTCRAFT_VC840, fs9721)
+RECEIVE_DATA(TECPEL_DMM_8061)
+RECEIVE_DATA(UNI_T_UT60A)
+RECEIVE_DATA(UNI_T_UT60E)
+RECEIVE_DATA(UNI_T_UT61D)
+RECEIVE_DATA(UNI_T_UT61E)
+RECEIVE_DATA(VOLTCRAFT_VC820)
+RECEIVE_DATA(VOLTCRAFT_VC830)
+RECEIVE_DATA(VOLTCRAFT_VC840)
@@ -30,11 +30,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "uni-t-dmm: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 enum {
 	TECPEL_DMM_8061,
@@ -53,6 +53,7 @@ struct dmm_info {
 	char *device;
 	uint32_t baudrate;
 	int packet_size;
+	struct sr_dmm_sync sync;
 	gboolean (*packet_valid)(const uint8_t *);
 	int (*packet_parse)(const uint8_t *, float *,
 			    struct sr_datafeed_analog *, void *);
@@ -65,6 +66,9 @@ struct dmm_info {
 
 #define DMM_BUFSIZE		256
 
+/* Interrupt transfers kept queued on EP2 during an acquisition. */
+#define NUM_TRANSFERS		4
+
 /** Private, per-device-instance driver context. */
 struct dev_context {
 	/** The current sampling limit (in number of samples). */
@@ -79,15 +83,45 @@ struct dev_context {
 	/** The current number of already received samples. */
 	uint64_t num_samples;
 
+	/** Readings waiting to be sent together (SR_CONF_BATCH_*). */
+	struct sr_analog_batch batch;
+
 	int64_t starttime;
 
 	gboolean first_run;
 
-	uint8_t protocol_buf[DMM_BUFSIZE];
-	uint8_t bufoffset;
-	uint8_t buflen;
+	/** The DMM's index in udmms[]. */
+	int dmm;
+
+	/** Parser state, for whichever chip the DMM uses. */
+	union {
+		struct fs9721_info fs9721;
+		struct fs9922_info fs9922;
+		struct es51922_info es51922;
+	} info;
+
+	struct sr_context *ctx;
+	struct libusb_transfer *transfers[NUM_TRANSFERS];
+	/** The number of transfers not freed yet. */
+	int num_transfers;
+	gboolean stopping;
+
+	/*
+	 * Received data bytes, as a ring of DMM_BUFSIZE bytes. Every byte
+	 * is stored twice, at i and i + DMM_BUFSIZE, so the bytes from
+	 * ring_head on are always contiguous for the packet parsers.
+	 */
+	uint8_t ring[2 * DMM_BUFSIZE];
+	unsigned int ring_head;
+	unsigned int ring_len;
+	struct sr_dmm_framer framer;
 };
 
+SR_PRIV int uni_t_dmm_hid_chip_init(struct sr_dev_inst *sdi,
+				     uint16_t baudrate);
+SR_PRIV void uni_t_dmm_receive_transfer(struct libusb_transfer *transfer);
+SR_PRIV void uni_t_dmm_abort_acquisition(struct sr_dev_inst *sdi);
+
 SR_PRIV int receive_data_TECPEL_DMM_8061(int fd, int revents, void *cb_data);
 SR_PRIV int receive_data_UNI_T_UT60A(int fd, int revents, void *cb_data);
 SR_PRIV int receive_data_UNI_T_UT60E(int fd, int revents, void *cb_data);
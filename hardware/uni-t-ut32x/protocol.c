@@ -174,6 +174,7 @@ SR_PRIV void uni_t_ut32x_receive_transfer(struct libusb_transfer *transfer)
 			/* Guard against garbage from the device overrunning
 			 * our packet buffer. */
 			sr_dbg("Buffer overrun!");
+			sr_session_dev_stats_add(sdi, 1, 0);
 			devc->packet_len = 0;
 		}
 	}
@@ -40,19 +40,15 @@ static uint8_t decode_digit(uint8_t in)
 	return out;
 }
 
-static void decode_buf(struct sr_dev_inst *sdi, unsigned char *data)
+static int decode_buf(const uint8_t *data, float *floatval,
+		      struct sr_datafeed_analog *analog)
 {
-	struct sr_datafeed_packet packet;
-	struct sr_datafeed_analog analog;
-	struct dev_context *devc;
 	long factor, ivalue;
 	uint8_t digits[4];
 	gboolean is_duty, is_continuity, is_diode, is_ac, is_dc, is_auto;
 	gboolean is_hold, is_max, is_min, is_relative, minus;
 	float fvalue;
 
-	devc = sdi->priv;
-
 	digits[0] = decode_digit(data[12]);
 	digits[1] = decode_digit(data[11]);
 	digits[2] = decode_digit(data[10]);
@@ -164,52 +160,52 @@ static void decode_buf(struct sr_dev_inst *sdi, unsigned char *data)
 	if (minus)
 		fvalue = -fvalue;
 
-	memset(&analog, 0, sizeof(struct sr_datafeed_analog));
+	memset(analog, 0, sizeof(struct sr_datafeed_analog));
 
 	/* Measurement mode */
-	analog.mq = -1;
+	analog->mq = -1;
 	switch (data[3]) {
 	case 0x00:
 		if (is_duty) {
-			analog.mq = SR_MQ_DUTY_CYCLE;
-			analog.unit = SR_UNIT_PERCENTAGE;
+			analog->mq = SR_MQ_DUTY_CYCLE;
+			analog->unit = SR_UNIT_PERCENTAGE;
 		} else
 			sr_dbg("Unknown measurement mode: %.2x.", data[3]);
 		break;
 	case 0x01:
 		if (is_diode) {
-			analog.mq = SR_MQ_VOLTAGE;
-			analog.unit = SR_UNIT_VOLT;
-			analog.mqflags |= SR_MQFLAG_DIODE;
+			analog->mq = SR_MQ_VOLTAGE;
+			analog->unit = SR_UNIT_VOLT;
+			analog->mqflags |= SR_MQFLAG_DIODE;
 			if (ivalue < 0)
 				fvalue = NAN;
 		} else {
 			if (ivalue < 0)
 				break;
-			analog.mq = SR_MQ_VOLTAGE;
-			analog.unit = SR_UNIT_VOLT;
+			analog->mq = SR_MQ_VOLTAGE;
+			analog->unit = SR_UNIT_VOLT;
 			if (is_ac)
-				analog.mqflags |= SR_MQFLAG_AC;
+				analog->mqflags |= SR_MQFLAG_AC;
 			if (is_dc)
-				analog.mqflags |= SR_MQFLAG_DC;
+				analog->mqflags |= SR_MQFLAG_DC;
 		}
 		break;
 	case 0x02:
-		analog.mq = SR_MQ_CURRENT;
-		analog.unit = SR_UNIT_AMPERE;
+		analog->mq = SR_MQ_CURRENT;
+		analog->unit = SR_UNIT_AMPERE;
 		if (is_ac)
-			analog.mqflags |= SR_MQFLAG_AC;
+			analog->mqflags |= SR_MQFLAG_AC;
 		if (is_dc)
-			analog.mqflags |= SR_MQFLAG_DC;
+			analog->mqflags |= SR_MQFLAG_DC;
 		break;
 	case 0x04:
 		if (is_continuity) {
-			analog.mq = SR_MQ_CONTINUITY;
-			analog.unit = SR_UNIT_BOOLEAN;
+			analog->mq = SR_MQ_CONTINUITY;
+			analog->unit = SR_UNIT_BOOLEAN;
 			fvalue = ivalue < 0 ? 0.0 : 1.0;
 		} else {
-			analog.mq = SR_MQ_RESISTANCE;
-			analog.unit = SR_UNIT_OHM;
+			analog->mq = SR_MQ_RESISTANCE;
+			analog->unit = SR_UNIT_OHM;
 			if (ivalue < 0)
 				fvalue = INFINITY;
 		}
@@ -219,50 +215,52 @@ static void decode_buf(struct sr_dev_inst *sdi, unsigned char *data)
 		sr_dbg("Unknown measurement mode: 0x%.2x.", data[3]);
 		break;
 	case 0x10:
-		analog.mq = SR_MQ_FREQUENCY;
-		analog.unit = SR_UNIT_HERTZ;
+		analog->mq = SR_MQ_FREQUENCY;
+		analog->unit = SR_UNIT_HERTZ;
 		break;
 	case 0x20:
-		analog.mq = SR_MQ_CAPACITANCE;
-		analog.unit = SR_UNIT_FARAD;
+		analog->mq = SR_MQ_CAPACITANCE;
+		analog->unit = SR_UNIT_FARAD;
 		break;
 	case 0x40:
-		analog.mq = SR_MQ_TEMPERATURE;
-		analog.unit = SR_UNIT_CELSIUS;
+		analog->mq = SR_MQ_TEMPERATURE;
+		analog->unit = SR_UNIT_CELSIUS;
 		break;
 	case 0x80:
-		analog.mq = SR_MQ_TEMPERATURE;
-		analog.unit = SR_UNIT_FAHRENHEIT;
+		analog->mq = SR_MQ_TEMPERATURE;
+		analog->unit = SR_UNIT_FAHRENHEIT;
 		break;
 	default:
 		sr_dbg("Unknown/invalid measurement mode: 0x%.2x.", data[3]);
 		break;
 	}
-	if (analog.mq == -1)
-		return;
+	if (analog->mq == -1)
+		return SR_ERR;
 
 	if (is_auto)
-		analog.mqflags |= SR_MQFLAG_AUTORANGE;
+		analog->mqflags |= SR_MQFLAG_AUTORANGE;
 	if (is_hold)
-		analog.mqflags |= SR_MQFLAG_HOLD;
+		analog->mqflags |= SR_MQFLAG_HOLD;
 	if (is_max)
-		analog.mqflags |= SR_MQFLAG_MAX;
+		analog->mqflags |= SR_MQFLAG_MAX;
 	if (is_min)
-		analog.mqflags |= SR_MQFLAG_MIN;
+		analog->mqflags |= SR_MQFLAG_MIN;
 	if (is_relative)
-		analog.mqflags |= SR_MQFLAG_RELATIVE;
+		analog->mqflags |= SR_MQFLAG_RELATIVE;
 
-	analog.probes = sdi->probes;
-	analog.num_samples = 1;
-	analog.data = &fvalue;
-	packet.type = SR_DF_ANALOG;
-	packet.payload = &analog;
-	sr_session_send(devc->cb_data, &packet);
+	*floatval = fvalue;
 
-	devc->num_samples++;
+	return SR_OK;
 }
 
-SR_PRIV int victor_dmm_receive_data(struct sr_dev_inst *sdi, unsigned char *buf)
+/**
+ * Parse a packet as it comes from the DMM, still obfuscated.
+ *
+ * @return SR_OK upon success, SR_ERR if the packet has no value, as the
+ *         packets of all zeroes the DMM sends from time to time.
+ */
+SR_PRIV int victor_dmm_parse(const uint8_t *buf, float *floatval,
+			     struct sr_datafeed_analog *analog)
 {
 	GString *dbg;
 	int i;
@@ -276,7 +274,7 @@ SR_PRIV int victor_dmm_receive_data(struct sr_dev_inst *sdi, unsigned char *buf)
 	if (i == DMM_DATA_SIZE) {
 		/* This DMM outputs all zeroes from time to time, just ignore it. */
 		sr_dbg("Received all zeroes.");
-		return SR_OK;
+		return SR_ERR;
 	}
 
 	/* Deobfuscate and reorder data. */
@@ -292,7 +290,29 @@ SR_PRIV int victor_dmm_receive_data(struct sr_dev_inst *sdi, unsigned char *buf)
 		g_string_free(dbg, TRUE);
 	}
 
-	decode_buf(sdi, data);
+	return decode_buf(data, floatval, analog);
+}
+
+SR_PRIV int victor_dmm_receive_data(struct sr_dev_inst *sdi, unsigned char *buf)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+	struct dev_context *devc;
+	float fvalue;
+
+	devc = sdi->priv;
+
+	if (victor_dmm_parse(buf, &fvalue, &analog) != SR_OK)
+		return SR_OK;
+
+	analog.probes = sdi->probes;
+	analog.num_samples = 1;
+	analog.data = &fvalue;
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	sr_session_send(devc->cb_data, &packet);
+
+	devc->num_samples++;
 
 	return SR_OK;
 }
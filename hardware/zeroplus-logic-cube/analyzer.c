@@ -30,6 +30,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 #include "analyzer.h"
@@ -425,6 +426,24 @@ SR_PRIV int analyzer_read_data(libusb_device_handle *devh, void *buffer,
 	return gl_read_bulk(devh, buffer, size);
 }
 
+/*
+ * Read size bytes of data asynchronously: after this request, submit
+ * transfers set up by analyzer_fill_read_data() adding up to size.
+ */
+SR_PRIV int analyzer_read_data_request(libusb_device_handle *devh,
+				      unsigned int size)
+{
+	return gl_read_bulk_request(devh, size);
+}
+
+SR_PRIV void analyzer_fill_read_data(struct libusb_transfer *transfer,
+				     libusb_device_handle *devh, void *buffer,
+				     unsigned int size,
+				     libusb_transfer_cb_fn cb, void *user_data)
+{
+	gl_fill_read_bulk(transfer, devh, buffer, size, cb, user_data);
+}
+
 SR_PRIV void analyzer_read_stop(libusb_device_handle *devh)
 {
 	analyzer_write_status(devh, 3, STATUS_FLAG_20);
@@ -622,31 +641,58 @@ SR_PRIV int analyzer_decompress(void *input, unsigned int input_len,
 {
 	unsigned char *in = input;
 	unsigned char *out = output;
-	unsigned int A, B, C, count;
+	unsigned int count, done, n;
 	unsigned int written = 0;
 
-	while (input_len > 0) {
-		A = *in++;
-		B = *in++;
-		C = *in++;
-		count = (*in++) + 1;
-
+	while (input_len >= 4 && output_len > 0) {
+		count = in[3] + 1;
 		if (count > output_len)
 			count = output_len;
 		output_len -= count;
 		written += count;
 
-		while (count--) {
-			*out++ = A;
-			*out++ = B;
-			*out++ = C;
-			*out++ = 0; /* Channel D */
+		/* Channels A, B and C, there is no channel D. */
+		out[0] = in[0];
+		out[1] = in[1];
+		out[2] = in[2];
+		out[3] = 0;
+
+		/* Fill the run by doubling what's already there. */
+		for (done = 1; done < count; done += n) {
+			n = MIN(done, count - done);
+			memcpy(out + done * 4, out, n * 4);
 		}
+		out += count * 4;
 
+		in += 4;
 		input_len -= 4;
-		if (output_len == 0)
-			break;
 	}
 
 	return written;
 }
+
+/*
+ * Turn compressed capture data into runs of 4 byte samples as used by
+ * SR_DF_LOGIC_RLE packets, without expanding it. There is one run per
+ * 4 bytes of input, values and counts must have room for as many.
+ */
+SR_PRIV unsigned int analyzer_decompress_rle(const void *input,
+		unsigned int input_len, uint8_t *values, uint64_t *counts,
+		uint64_t *num_samples)
+{
+	const unsigned char *in = input;
+	unsigned int i, num_runs;
+
+	num_runs = input_len / 4;
+	*num_samples = 0;
+	for (i = 0; i < num_runs; i++) {
+		values[i * 4 + 0] = in[i * 4 + 0];
+		values[i * 4 + 1] = in[i * 4 + 1];
+		values[i * 4 + 2] = in[i * 4 + 2];
+		values[i * 4 + 3] = 0; /* Channel D */
+		counts[i] = in[i * 4 + 3] + 1;
+		*num_samples += counts[i];
+	}
+
+	return num_runs;
+}
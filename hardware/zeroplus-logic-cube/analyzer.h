@@ -92,6 +92,9 @@ SR_PRIV unsigned int analyzer_get_now_address(libusb_device_handle *devh);
 SR_PRIV unsigned int analyzer_get_trigger_address(libusb_device_handle *devh);
 SR_PRIV int analyzer_decompress(void *input, unsigned int input_len,
 				void *output, unsigned int output_len);
+SR_PRIV unsigned int analyzer_decompress_rle(const void *input,
+		unsigned int input_len, uint8_t *values, uint64_t *counts,
+		uint64_t *num_samples);
 
 SR_PRIV void analyzer_reset(libusb_device_handle *devh);
 SR_PRIV void analyzer_initialize(libusb_device_handle *devh);
@@ -99,6 +102,12 @@ SR_PRIV void analyzer_wait(libusb_device_handle *devh, int set, int unset);
 SR_PRIV void analyzer_read_start(libusb_device_handle *devh);
 SR_PRIV int analyzer_read_data(libusb_device_handle *devh, void *buffer,
 			       unsigned int size);
+SR_PRIV int analyzer_read_data_request(libusb_device_handle *devh,
+				      unsigned int size);
+SR_PRIV void analyzer_fill_read_data(struct libusb_transfer *transfer,
+				     libusb_device_handle *devh, void *buffer,
+				     unsigned int size,
+				     libusb_transfer_cb_fn cb, void *user_data);
 SR_PRIV void analyzer_read_stop(libusb_device_handle *devh);
 SR_PRIV void analyzer_start(libusb_device_handle *devh);
 SR_PRIV void analyzer_configure(libusb_device_handle *devh);
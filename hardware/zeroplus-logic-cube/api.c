@@ -24,7 +24,9 @@
 #define USB_CONFIGURATION		1
 #define NUM_TRIGGER_STAGES		4
 #define TRIGGER_TYPE 			"01"
-#define PACKET_SIZE			2048	/* ?? */
+/* The memory is read out in transfers of this size, this many at once. */
+#define TRANSFER_SIZE			(64 * 1024)
+#define NUM_TRANSFERS			8
 
 //#define ZP_EXPERIMENTAL
 
@@ -60,6 +62,7 @@ static const int32_t hwcaps[] = {
 	SR_CONF_SAMPLERATE,
 	SR_CONF_CAPTURE_RATIO,
 	SR_CONF_LIMIT_SAMPLES,
+	SR_CONF_RLE,
 };
 
 /*
@@ -245,6 +248,11 @@ static int dev_clear(void)
 
 static int init(struct sr_context *sr_ctx)
 {
+	int ret;
+
+	if ((ret = sr_usb_init(sr_ctx)) != SR_OK)
+		return ret;
+
 	return std_init(sr_ctx, di, LOG_PREFIX);
 }
 
@@ -268,7 +276,7 @@ static GSList *scan(GSList *options)
 
 	/* Find all ZEROPLUS analyzers and add them to device list. */
 	devcnt = 0;
-	libusb_get_device_list(drvc->sr_ctx->libusb_ctx, &devlist); /* TODO: Errors. */
+	sr_usb_get_device_list(drvc->sr_ctx, &devlist); /* TODO: Errors. */
 
 	for (i = 0; devlist[i]; i++) {
 		ret = libusb_get_device_descriptor(devlist[i], &des);
@@ -484,6 +492,12 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 		} else
 			return SR_ERR;
 		break;
+	case SR_CONF_RLE:
+		if (!sdi)
+			return SR_ERR;
+		devc = sdi->priv;
+		*data = g_variant_new_boolean(devc->rle);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -513,6 +527,10 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 		return set_limit_samples(devc, g_variant_get_uint64(data));
 	case SR_CONF_CAPTURE_RATIO:
 		return set_capture_ratio(devc, g_variant_get_uint64(data));
+	case SR_CONF_RLE:
+		devc->rle = g_variant_get_boolean(data);
+		sr_info("%s RLE.", devc->rle ? "Enabling" : "Disabling");
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -563,17 +581,193 @@ static int config_list(int key, GVariant **data, const struct sr_dev_inst *sdi,
 	return SR_OK;
 }
 
+/* The state of reading out the capture memory. */
+struct readout {
+	const struct dev_context *devc;
+	void *cb_data;
+	/* Bytes not asked for by a transfer yet. */
+	unsigned int left;
+	int num_pending;
+	int done;
+	gboolean failed;
+	struct libusb_transfer *transfers[NUM_TRANSFERS];
+	/* Where runs are decompressed to, with devc->rle. */
+	uint8_t *values;
+	uint64_t *counts;
+};
+
+static void send_data(struct readout *ro, uint8_t *buf, unsigned int len)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_datafeed_logic_rle rle;
+
+	if (ro->devc->rle) {
+		/* Every 4 bytes are a sample and its repeat count. */
+		packet.type = SR_DF_LOGIC_RLE;
+		packet.payload = &rle;
+		rle.unitsize = 4;
+		rle.values = ro->values;
+		rle.counts = ro->counts;
+		rle.num_runs = analyzer_decompress_rle(buf, len,
+				ro->values, ro->counts, &rle.num_samples);
+	} else {
+		packet.type = SR_DF_LOGIC;
+		packet.payload = &logic;
+		logic.length = len;
+		logic.unitsize = 4;
+		logic.data = buf;
+	}
+	sr_session_send(ro->cb_data, &packet);
+}
+
+/* Stop the readout, cancelling the transfers other than this one. */
+static void readout_fail(struct readout *ro, struct libusb_transfer *transfer)
+{
+	int i;
+
+	ro->failed = TRUE;
+	for (i = 0; i < NUM_TRANSFERS; i++)
+		if (ro->transfers[i] && ro->transfers[i] != transfer)
+			libusb_cancel_transfer(ro->transfers[i]);
+}
+
+static int submit_next(struct readout *ro, struct libusb_transfer *transfer)
+{
+	int ret;
+
+	transfer->length = MIN(ro->left, TRANSFER_SIZE);
+	if ((ret = libusb_submit_transfer(transfer)) != 0) {
+		sr_err("Failed to submit transfer: %s.",
+		       libusb_error_name(ret));
+		return SR_ERR;
+	}
+	ro->left -= transfer->length;
+	ro->num_pending++;
+
+	return SR_OK;
+}
+
+/*
+ * Transfers on the endpoint complete in the order they were submitted,
+ * so each one's data is passed on as it comes, and the transfer asks
+ * for the next part of the memory right after.
+ */
+static void receive_transfer(struct libusb_transfer *transfer)
+{
+	struct readout *ro;
+
+	ro = transfer->user_data;
+	ro->num_pending--;
+
+	if (!ro->failed && (transfer->status != LIBUSB_TRANSFER_COMPLETED
+	    || transfer->actual_length != transfer->length)) {
+		sr_err("Memory readout failed: status %d, %d of %d bytes.",
+		       transfer->status, transfer->actual_length,
+		       transfer->length);
+		readout_fail(ro, transfer);
+	}
+
+	if (!ro->failed) {
+		sr_spew("Read %d bytes of memory.", transfer->actual_length);
+		send_data(ro, transfer->buffer, transfer->actual_length);
+		if (ro->left && submit_next(ro, transfer) != SR_OK)
+			readout_fail(ro, transfer);
+	}
+
+	if (!ro->num_pending)
+		ro->done = 1;
+}
+
+/*
+ * Read out the capture memory with several large transfers outstanding,
+ * so the device always has one to send to. This blocks until all of it
+ * got in, as acquisition start always has with this device.
+ */
+static int read_memory(const struct sr_dev_inst *sdi, void *cb_data,
+		unsigned int size)
+{
+	struct drv_context *drvc;
+	struct sr_usb_dev_inst *usb;
+	struct readout ro;
+	struct timeval tv;
+	uint8_t *buf;
+	int ret, i;
+
+	drvc = di->priv;
+	usb = sdi->conn;
+
+	memset(&ro, 0, sizeof(ro));
+	ro.devc = sdi->priv;
+	ro.cb_data = cb_data;
+	ro.left = size;
+	ret = SR_OK;
+
+	if (ro.devc->rle && (!(ro.values = g_try_malloc(TRANSFER_SIZE))
+	    || !(ro.counts = g_try_malloc(TRANSFER_SIZE / 4
+			* sizeof(uint64_t))))) {
+		sr_err("Run buffer malloc failed.");
+		ret = SR_ERR_MALLOC;
+		goto out;
+	}
+
+	for (i = 0; i < NUM_TRANSFERS; i++) {
+		if (!(buf = g_try_malloc(TRANSFER_SIZE))) {
+			sr_err("Transfer buffer malloc failed.");
+			ret = SR_ERR_MALLOC;
+			goto out;
+		}
+		if (!(ro.transfers[i] = libusb_alloc_transfer(0))) {
+			sr_err("Transfer malloc failed.");
+			g_free(buf);
+			ret = SR_ERR_MALLOC;
+			goto out;
+		}
+		analyzer_fill_read_data(ro.transfers[i], usb->devhdl, buf,
+				TRANSFER_SIZE, receive_transfer, &ro);
+	}
+
+	if (analyzer_read_data_request(usb->devhdl, size) != 0) {
+		ret = SR_ERR;
+		goto out;
+	}
+
+	for (i = 0; i < NUM_TRANSFERS && ro.left; i++) {
+		if (submit_next(&ro, ro.transfers[i]) != SR_OK) {
+			readout_fail(&ro, ro.transfers[i]);
+			break;
+		}
+	}
+	if (!ro.num_pending)
+		ro.done = 1;
+
+	while (!ro.done) {
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		libusb_handle_events_timeout_completed(drvc->sr_ctx->libusb_ctx,
+				&tv, &ro.done);
+	}
+	if (ro.failed)
+		ret = SR_ERR;
+
+out:
+	for (i = 0; i < NUM_TRANSFERS && ro.transfers[i]; i++) {
+		g_free(ro.transfers[i]->buffer);
+		libusb_free_transfer(ro.transfers[i]);
+	}
+	g_free(ro.values);
+	g_free(ro.counts);
+
+	return ret;
+}
+
 static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 		void *cb_data)
 {
 	struct dev_context *devc;
 	struct sr_usb_dev_inst *usb;
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_logic logic;
-	//uint64_t samples_read;
-	int res;
-	unsigned int packet_num, n;
-	unsigned char *buf;
+	unsigned int n;
 
 	if (sdi->status != SR_ST_ACTIVE)
 		return SR_ERR_DEV_CLOSED;
@@ -591,6 +785,8 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 	usb = sdi->conn;
 
 	set_triggerbar(devc);
+	analyzer_set_compression(devc->rle ?
+			COMPRESSION_ENABLE : COMPRESSION_NONE);
 
 	/* Push configured settings to device. */
 	analyzer_configure(usb->devhdl);
@@ -609,32 +805,14 @@ static int dev_acquisition_start(const struct sr_dev_inst *sdi,
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
 
-	if (!(buf = g_try_malloc(PACKET_SIZE))) {
-		sr_err("Packet buffer malloc failed.");
-		return SR_ERR_MALLOC;
-	}
-
-	//samples_read = 0;
 	analyzer_read_start(usb->devhdl);
-	/* Send the incoming transfer to the session bus. */
+	/* Send the incoming transfers to the session bus. */
 	n = get_memory_size(devc->memory_size);
 	if (devc->max_memory_size * 4 < n)
 		n = devc->max_memory_size * 4;
-	for (packet_num = 0; packet_num < n / PACKET_SIZE; packet_num++) {
-		res = analyzer_read_data(usb->devhdl, buf, PACKET_SIZE);
-		sr_info("Tried to read %d bytes, actually read %d bytes.",
-			PACKET_SIZE, res);
-
-		packet.type = SR_DF_LOGIC;
-		packet.payload = &logic;
-		logic.length = PACKET_SIZE;
-		logic.unitsize = 4;
-		logic.data = buf;
-		sr_session_send(cb_data, &packet);
-		//samples_read += res / 4;
-	}
+	if (read_memory(sdi, cb_data, n) != SR_OK)
+		sr_err("Reading the capture memory failed.");
 	analyzer_read_stop(usb->devhdl);
-	g_free(buf);
 
 	packet.type = SR_DF_END;
 	sr_session_send(cb_data, &packet);
@@ -88,19 +88,46 @@ static int gl_read_data(libusb_device_handle *devh)
 	return (ret == 1) ? packet[0] : ret;
 }
 
-SR_PRIV int gl_read_bulk(libusb_device_handle *devh, void *buffer,
-			 unsigned int size)
+/* Tell the device how many bytes to send on the bulk endpoint next. */
+SR_PRIV int gl_read_bulk_request(libusb_device_handle *devh,
+				 unsigned int size)
 {
 	unsigned char packet[8] =
 	    { 0, 0, 0, 0, size & 0xff, (size & 0xff00) >> 8,
 	      (size & 0xff0000) >> 16, (size & 0xff000000) >> 24 };
-	int ret, transferred = 0;
+	int ret;
 
 	ret = libusb_control_transfer(devh, CTRL_OUT, 0x4, REQ_READBULK,
 				      0, packet, 8, TIMEOUT);
-	if (ret != 8)
+	if (ret != 8) {
 		sr_err("%s: libusb_control_transfer: %s.", __func__,
 		       libusb_error_name(ret));
+		return ret < 0 ? ret : LIBUSB_ERROR_IO;
+	}
+
+	return 0;
+}
+
+/*
+ * Set up an asynchronous read of part of what gl_read_bulk_request()
+ * asked for. Several of these can be submitted at once, they complete
+ * in order.
+ */
+SR_PRIV void gl_fill_read_bulk(struct libusb_transfer *transfer,
+			       libusb_device_handle *devh, void *buffer,
+			       unsigned int size, libusb_transfer_cb_fn cb,
+			       void *user_data)
+{
+	libusb_fill_bulk_transfer(transfer, devh, EP1_BULK_IN, buffer, size,
+				  cb, user_data, TIMEOUT);
+}
+
+SR_PRIV int gl_read_bulk(libusb_device_handle *devh, void *buffer,
+			 unsigned int size)
+{
+	int ret, transferred = 0;
+
+	gl_read_bulk_request(devh, size);
 
 	ret = libusb_bulk_transfer(devh, EP1_BULK_IN, buffer, size,
 				   &transferred, TIMEOUT);
@@ -31,11 +31,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "zeroplus: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 /* Private, per-device-instance driver context. */
 struct dev_context {
@@ -51,6 +51,8 @@ struct dev_context {
 	// uint8_t trigger_buffer[NUM_TRIGGER_STAGES];
 	int trigger;
 	unsigned int capture_ratio;
+	/* Have the device compress the capture, send it on as runs. */
+	gboolean rle;
 	const struct zp_model *prof;
 };
 
@@ -30,11 +30,41 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "hwdriver: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/* How many drivers sr_driver_scan_all() lets scan at the same time. */
+#define SCAN_THREADS 8
+
+/* One driver's part of sr_driver_scan_all(). */
+struct scan_job {
+	struct sr_dev_driver *driver;
+	GSList *devices;
+	gboolean done;
+	/* The deadline passed, whoever finishes last frees the job. */
+	gboolean abandoned;
+};
+
+/* A run of sr_driver_scan_async(), one pool job per port. */
+struct sr_scan {
+	struct sr_dev_driver *driver;
+	/* Copies of the caller's options, less any SR_CONF_CONN. */
+	GSList *options;
+	sr_scan_callback_t cb;
+	void *cb_data;
+	GThreadPool *pool;
+	/* Held around cb and the driver's instance list. */
+	GMutex cb_mutex;
+	/* Ports not done yet, under mutex. */
+	GMutex mutex;
+	GCond cond;
+	unsigned int pending;
+	/* Set atomically, so cb may cancel. */
+	gint cancelled;
+};
 
 /**
  * @file
@@ -55,6 +85,10 @@ static struct sr_config_info sr_config_info_data[] = {
 		"Connection", NULL},
 	{SR_CONF_SERIALCOMM, SR_T_CHAR, "serialcomm",
 		"Serial communication", NULL},
+	{SR_CONF_NUM_LOGIC_PROBES, SR_T_UINT64, "logic_probes",
+		"Number of logic probes", NULL},
+	{SR_CONF_NUM_ANALOG_PROBES, SR_T_UINT64, "analog_probes",
+		"Number of analog probes", NULL},
 	{SR_CONF_SAMPLERATE, SR_T_UINT64, "samplerate",
 		"Sample rate", NULL},
 	{SR_CONF_CAPTURE_RATIO, SR_T_UINT64, "captureratio",
@@ -77,6 +111,20 @@ static struct sr_config_info sr_config_info_data[] = {
 		"Horizontal trigger position", NULL},
 	{SR_CONF_BUFFERSIZE, SR_T_UINT64, "buffersize",
 		"Buffer size", NULL},
+	{SR_CONF_CAPTURE_UNITSIZE, SR_T_UINT64, "capture_unitsize",
+		"Capture unit size", NULL},
+	{SR_CONF_FREERUN, SR_T_BOOL, "freerun",
+		"Free-running mode", NULL},
+	{SR_CONF_BATCH_SAMPLES, SR_T_UINT64, "batch_samples",
+		"Readings per packet", NULL},
+	{SR_CONF_BATCH_MSEC, SR_T_UINT64, "batch_msec",
+		"Reading batch time window", NULL},
+	{SR_CONF_REPLAY_SPEED, SR_T_FLOAT, "replay_speed",
+		"Replay speed", NULL},
+	{SR_CONF_MAX_SAMPLERATE, SR_T_UINT64, "max_samplerate",
+		"Maximum samplerate", NULL},
+	{SR_CONF_TRIGGER_STAGES, SR_T_CHAR, "trigger_stages",
+		"Trigger stages", NULL},
 	{SR_CONF_TIMEBASE, SR_T_RATIONAL_PERIOD, "timebase",
 		"Time base", NULL},
 	{SR_CONF_FILTER, SR_T_CHAR, "filter",
@@ -103,6 +151,14 @@ static struct sr_config_info sr_config_info_data[] = {
 		"Power off", NULL},
 	{SR_CONF_DATA_SOURCE, SR_T_CHAR, "data_source",
 		"Data source", NULL},
+	{SR_CONF_USB_TRANSFERS, SR_T_UINT64_RANGE, "usb_transfers",
+		"USB transfers", NULL},
+	{SR_CONF_PROBE_PACKING, SR_T_BOOL, "probe_packing",
+		"Probe packing", NULL},
+	{SR_CONF_PACKED_PROBES, SR_T_UINT64, "packed_probes",
+		"Packed probes", NULL},
+	{SR_CONF_TRIGGER_WINDOW, SR_T_UINT64_RANGE, "trigger_window",
+		"Trigger window", NULL},
 	{0, 0, NULL, NULL, NULL},
 };
 
@@ -154,6 +210,9 @@ extern SR_PRIV struct sr_dev_driver rigol_ds_driver_info;
 #ifdef HAVE_HW_SALEAE_LOGIC16
 extern SR_PRIV struct sr_dev_driver saleae_logic16_driver_info;
 #endif
+#ifdef HAVE_HW_SIGROK_NET
+extern SR_PRIV struct sr_dev_driver sigrok_net_driver_info;
+#endif
 #ifdef HAVE_HW_TELEINFO
 extern SR_PRIV struct sr_dev_driver teleinfo_driver_info;
 #endif
@@ -280,6 +339,9 @@ static struct sr_dev_driver *drivers_list[] = {
 #ifdef HAVE_HW_SALEAE_LOGIC16
 	&saleae_logic16_driver_info,
 #endif
+#ifdef HAVE_HW_SIGROK_NET
+	&sigrok_net_driver_info,
+#endif
 #ifdef HAVE_HW_TELEINFO
 	&teleinfo_driver_info,
 #endif
@@ -370,6 +432,78 @@ SR_API struct sr_dev_driver **sr_driver_list(void)
 	return drivers_list;
 }
 
+/* Check a driver for missing fields, before it's used the first time. */
+static int sanity_check_driver(const struct sr_dev_driver *driver)
+{
+	int errors;
+	const char *d;
+
+	errors = 0;
+	d = driver->name ? driver->name : "NULL";
+
+	if (!driver->name) {
+		sr_err("No name in driver '%s'.", d);
+		errors++;
+	}
+	if (!driver->longname) {
+		sr_err("No longname in driver '%s'.", d);
+		errors++;
+	}
+	if (driver->api_version < 1) {
+		sr_err("API version in driver '%s' < 1.", d);
+		errors++;
+	}
+	if (!driver->init) {
+		sr_err("No init in driver '%s'.", d);
+		errors++;
+	}
+	if (!driver->cleanup) {
+		sr_err("No cleanup in driver '%s'.", d);
+		errors++;
+	}
+	if (!driver->scan) {
+		sr_err("No scan in driver '%s'.", d);
+		errors++;
+	}
+	if (!driver->dev_list) {
+		sr_err("No dev_list in driver '%s'.", d);
+		errors++;
+	}
+	if (!driver->dev_clear) {
+		sr_err("No dev_clear in driver '%s'.", d);
+		errors++;
+	}
+	/* Note: config_get() is optional. */
+	if (!driver->config_set) {
+		sr_err("No config_set in driver '%s'.", d);
+		errors++;
+	}
+	if (!driver->config_list) {
+		sr_err("No config_list in driver '%s'.", d);
+		errors++;
+	}
+	if (!driver->dev_open) {
+		sr_err("No dev_open in driver '%s'.", d);
+		errors++;
+	}
+	if (!driver->dev_close) {
+		sr_err("No dev_close in driver '%s'.", d);
+		errors++;
+	}
+	if (!driver->dev_acquisition_start) {
+		sr_err("No dev_acquisition_start in driver '%s'.", d);
+		errors++;
+	}
+	if (!driver->dev_acquisition_stop) {
+		sr_err("No dev_acquisition_stop in driver '%s'.", d);
+		errors++;
+	}
+
+	/* Note: 'priv' is allowed to be NULL. */
+
+	return errors ? SR_ERR : SR_OK;
+}
+
 /**
  * Initialize a hardware driver.
  *
@@ -377,6 +511,10 @@ SR_API struct sr_dev_driver **sr_driver_list(void)
  * within the driver, but _not_ scanning for attached devices.
  * The API call sr_driver_scan() is used for that.
  *
+ * This is also where the driver is checked for missing callbacks, and
+ * where libsigrok sets up its libusb context, when the driver is the
+ * first one of a USB device.
+ *
  * @param ctx A libsigrok context object allocated by a previous call to
  *            sr_init(). Must not be NULL.
  * @param driver The driver to initialize. This must be a pointer to one of
@@ -400,6 +538,11 @@ SR_API int sr_driver_init(struct sr_context *ctx, struct sr_dev_driver *driver)
 		return SR_ERR_ARG;
 	}
 
+	if (sanity_check_driver(driver) != SR_OK) {
+		sr_err("Internal driver error(s), aborting.");
+		return SR_ERR;
+	}
+
 	sr_spew("Initializing driver '%s'.", driver->name);
 	if ((ret = driver->init(ctx)) < 0)
 		sr_err("Failed to initialize the driver: %d.", ret);
@@ -452,6 +595,404 @@ SR_API GSList *sr_driver_scan(struct sr_dev_driver *driver, GSList *options)
 	return l;
 }
 
+static void scan_job_run(gpointer data, gpointer user_data)
+{
+	struct sr_context *ctx;
+	struct scan_job *job;
+	GSList *devices;
+
+	job = data;
+	ctx = user_data;
+
+	devices = sr_driver_scan(job->driver, NULL);
+
+	g_mutex_lock(&ctx->scan_mutex);
+	ctx->scan_busy = g_slist_remove(ctx->scan_busy, job->driver);
+#ifdef HAVE_LIBUSB_1_0
+	if (!ctx->scan_busy)
+		sr_usb_devlist_cache(ctx, FALSE);
+#endif
+	if (job->abandoned) {
+		g_slist_free(devices);
+		g_free(job);
+	} else {
+		job->devices = devices;
+		job->done = TRUE;
+		g_cond_broadcast(&ctx->scan_cond);
+	}
+	g_mutex_unlock(&ctx->scan_mutex);
+}
+
+/**
+ * Let all initialized drivers scan for devices, in parallel.
+ *
+ * This is the same as calling sr_driver_scan() without options for every
+ * driver that was initialized with sr_driver_init(), except that up to
+ * SCAN_THREADS drivers scan at the same time, and that the USB bus is only
+ * enumerated once for all of them.
+ *
+ * Drivers which haven't finished by the deadline keep scanning in the
+ * background. The devices they find don't show up in the returned list,
+ * but are available from sr_dev_list() once they're done. Such a driver
+ * is skipped by further calls until its scan has finished; sr_exit()
+ * waits for it.
+ *
+ * @param ctx A libsigrok context object allocated by a previous call to
+ *            sr_init(). Must not be NULL.
+ * @param timeout_ms How long to wait for the drivers, or 0 to wait until
+ *                   all of them are done.
+ *
+ * @return A GSList * of 'struct sr_dev_inst', or NULL if no devices were
+ *         found (or errors were encountered). This list must be freed by the
+ *         caller using g_slist_free(), but without freeing the data pointed
+ *         to in the list.
+ *
+ * @since 0.3.0
+ */
+SR_API GSList *sr_driver_scan_all(struct sr_context *ctx,
+		unsigned int timeout_ms)
+{
+	struct sr_dev_driver **drivers;
+	struct scan_job *job;
+	GSList *jobs, *devices, *l;
+	GError *error;
+	gint64 deadline;
+	int i;
+
+	if (!ctx) {
+		sr_err("%s(): libsigrok context was NULL.", __func__);
+		return NULL;
+	}
+
+	error = NULL;
+	if (!ctx->scan_pool && !(ctx->scan_pool = g_thread_pool_new(
+			scan_job_run, ctx, SCAN_THREADS, FALSE, &error))) {
+		sr_err("Failed to start the scan threads: %s.",
+		       error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	deadline = g_get_monotonic_time() + (gint64)timeout_ms * 1000;
+
+	jobs = NULL;
+	g_mutex_lock(&ctx->scan_mutex);
+#ifdef HAVE_LIBUSB_1_0
+	sr_usb_devlist_cache(ctx, TRUE);
+#endif
+	drivers = sr_driver_list();
+	for (i = 0; drivers[i]; i++) {
+		if (!drivers[i]->priv)
+			continue;
+		if (g_slist_find(ctx->scan_busy, drivers[i])) {
+			sr_warn("Scan of '%s' is still running, skipping it.",
+				drivers[i]->name);
+			continue;
+		}
+		if (!(job = g_try_malloc0(sizeof(struct scan_job)))) {
+			sr_err("%s: job malloc failed", __func__);
+			break;
+		}
+		job->driver = drivers[i];
+		ctx->scan_busy = g_slist_prepend(ctx->scan_busy, drivers[i]);
+		jobs = g_slist_prepend(jobs, job);
+	}
+	jobs = g_slist_reverse(jobs);
+#ifdef HAVE_LIBUSB_1_0
+	if (!ctx->scan_busy)
+		sr_usb_devlist_cache(ctx, FALSE);
+#endif
+	g_mutex_unlock(&ctx->scan_mutex);
+
+	for (l = jobs; l; l = l->next)
+		g_thread_pool_push(ctx->scan_pool, l->data, NULL);
+
+	devices = NULL;
+	g_mutex_lock(&ctx->scan_mutex);
+	for (l = jobs; l; l = l->next) {
+		job = l->data;
+		while (!job->done) {
+			if (!timeout_ms)
+				g_cond_wait(&ctx->scan_cond, &ctx->scan_mutex);
+			else if (!g_cond_wait_until(&ctx->scan_cond,
+					&ctx->scan_mutex, deadline))
+				break;
+		}
+	}
+	for (l = jobs; l; l = l->next) {
+		job = l->data;
+		if (!job->done) {
+			sr_warn("Scan of '%s' didn't finish in time.",
+				job->driver->name);
+			job->abandoned = TRUE;
+			continue;
+		}
+		devices = g_slist_concat(devices, job->devices);
+		g_free(job);
+	}
+	g_mutex_unlock(&ctx->scan_mutex);
+	g_slist_free(jobs);
+
+	sr_spew("Scan of all drivers found %d devices.",
+		g_slist_length(devices));
+
+	return devices;
+}
+
+static GSList *scan_port_probe(struct sr_scan *scan, const char *port)
+{
+	struct sr_dev_driver *driver;
+	struct drv_context *drvc;
+	struct sr_config *src;
+	GSList *devices, *options;
+
+	driver = scan->driver;
+	if (driver->scan_port) {
+		devices = driver->scan_port(port, scan->options);
+		drvc = driver->priv;
+		g_mutex_lock(&scan->cb_mutex);
+		drvc->instances = g_slist_concat(drvc->instances,
+						 g_slist_copy(devices));
+		g_mutex_unlock(&scan->cb_mutex);
+		return devices;
+	}
+
+	/* The pool only runs one of these at a time. */
+	if (!(src = sr_config_new(SR_CONF_CONN, g_variant_new_string(port)))) {
+		sr_err("%s: src malloc failed", __func__);
+		return NULL;
+	}
+	options = g_slist_prepend(scan->options, src);
+	devices = driver->scan(options);
+	g_slist_free_1(options);
+	sr_config_free(src);
+
+	return devices;
+}
+
+static void scan_port_run(gpointer data, gpointer user_data)
+{
+	struct sr_scan *scan;
+	GSList *devices, *l;
+	char *port;
+
+	port = data;
+	scan = user_data;
+
+	devices = NULL;
+	if (!g_atomic_int_get(&scan->cancelled)) {
+		devices = scan_port_probe(scan, port);
+		sr_spew("Scan of '%s' on %s found %d devices.",
+			scan->driver->name, port, g_slist_length(devices));
+	}
+
+	g_mutex_lock(&scan->cb_mutex);
+	for (l = devices; l; l = l->next) {
+		if (g_atomic_int_get(&scan->cancelled))
+			break;
+		scan->cb(l->data, scan->cb_data);
+	}
+	g_mutex_unlock(&scan->cb_mutex);
+	g_slist_free(devices);
+	g_free(port);
+
+	g_mutex_lock(&scan->mutex);
+	scan->pending--;
+	g_cond_broadcast(&scan->cond);
+	g_mutex_unlock(&scan->mutex);
+}
+
+/**
+ * Let a driver probe a list of ports in the background, and report the
+ * devices found on each one as soon as it is done.
+ *
+ * Drivers which can probe a single port on its own probe up to
+ * SCAN_THREADS ports at the same time, so a port that leaves the probe
+ * waiting for its timeout doesn't hold up the others. Other drivers are
+ * run with each port as SR_CONF_CONN in turn.
+ *
+ * The devices found are added to the driver's list, as sr_driver_scan()
+ * does, and passed to cb. Until the scan is done, the driver must not
+ * be used otherwise.
+ *
+ * @param driver The driver that should scan. Must have been initialized
+ *               with sr_driver_init(). Must not be NULL.
+ * @param ports A NULL-terminated array of ports, in the driver's
+ *              SR_CONF_CONN syntax. Must not be NULL or empty.
+ * @param options A list of 'struct sr_config' options to pass to the
+ *                driver's scanner. Can be NULL/empty. SR_CONF_CONN in
+ *                there is ignored. They are copied.
+ * @param cb The function to call for every device found. Must not be NULL.
+ * @param cb_data Opaque pointer passed to cb.
+ * @param scan The scan, which must be freed with sr_scan_free(), is
+ *             returned here. Must not be NULL.
+ *
+ * @retval SR_OK Success, the scan is running.
+ * @retval SR_ERR_ARG Invalid argument.
+ * @retval SR_ERR_MALLOC Memory allocation error.
+ * @retval SR_ERR The driver isn't initialized, or the scan threads
+ *                couldn't be started.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_driver_scan_async(struct sr_dev_driver *driver,
+		const char **ports, GSList *options, sr_scan_callback_t cb,
+		void *cb_data, struct sr_scan **scan)
+{
+	struct sr_scan *s;
+	struct sr_config *src, *copy;
+	GError *error;
+	GSList *l;
+	unsigned int num_ports, i;
+
+	if (!driver || !ports || !ports[0] || !cb || !scan) {
+		sr_err("%s(): invalid arguments.", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!driver->priv) {
+		sr_err("Driver not initialized, can't scan for devices.");
+		return SR_ERR;
+	}
+
+	if (!(s = g_try_malloc0(sizeof(struct sr_scan)))) {
+		sr_err("%s: scan malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	s->driver = driver;
+	s->cb = cb;
+	s->cb_data = cb_data;
+
+	for (l = options; l; l = l->next) {
+		src = l->data;
+		if (src->key == SR_CONF_CONN)
+			continue;
+		if (!(copy = sr_config_new(src->key, src->data))) {
+			sr_err("%s: option malloc failed", __func__);
+			g_slist_free_full(s->options,
+					  (GDestroyNotify)sr_config_free);
+			g_free(s);
+			return SR_ERR_MALLOC;
+		}
+		s->options = g_slist_append(s->options, copy);
+	}
+
+	num_ports = g_strv_length((gchar **)ports);
+	error = NULL;
+	if (!(s->pool = g_thread_pool_new(scan_port_run, s,
+			driver->scan_port ? MIN(num_ports, SCAN_THREADS) : 1,
+			FALSE, &error))) {
+		sr_err("Failed to start the scan threads: %s.",
+		       error->message);
+		g_error_free(error);
+		g_slist_free_full(s->options, (GDestroyNotify)sr_config_free);
+		g_free(s);
+		return SR_ERR;
+	}
+	g_mutex_init(&s->cb_mutex);
+	g_mutex_init(&s->mutex);
+	g_cond_init(&s->cond);
+	s->pending = num_ports;
+
+	/* Set before the first callback can run. */
+	*scan = s;
+	for (i = 0; i < num_ports; i++)
+		g_thread_pool_push(s->pool, g_strdup(ports[i]), NULL);
+
+	return SR_OK;
+}
+
+/**
+ * Wait for a scan started with sr_driver_scan_async() to be done.
+ *
+ * @param scan The scan. Must not be NULL.
+ * @param timeout_ms How long to wait, or 0 to wait until it is done.
+ *
+ * @retval SR_OK The scan is done, all of its callbacks have returned.
+ * @retval SR_ERR_TIMEOUT Ports were still being probed at the deadline.
+ * @retval SR_ERR_ARG Invalid argument.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_scan_wait(struct sr_scan *scan, unsigned int timeout_ms)
+{
+	gint64 deadline;
+	int ret;
+
+	if (!scan)
+		return SR_ERR_ARG;
+
+	deadline = g_get_monotonic_time() + (gint64)timeout_ms * 1000;
+
+	g_mutex_lock(&scan->mutex);
+	while (scan->pending) {
+		if (!timeout_ms)
+			g_cond_wait(&scan->cond, &scan->mutex);
+		else if (!g_cond_wait_until(&scan->cond, &scan->mutex,
+				deadline))
+			break;
+	}
+	ret = scan->pending ? SR_ERR_TIMEOUT : SR_OK;
+	g_mutex_unlock(&scan->mutex);
+
+	return ret;
+}
+
+/**
+ * Stop a scan started with sr_driver_scan_async().
+ *
+ * Ports not probed yet are skipped, and no more devices are passed to
+ * the callback. Probes already running can't be interrupted, and finish
+ * in the background; the devices they find still end up in the driver's
+ * list. This may be called from the callback.
+ *
+ * @param scan The scan. Must not be NULL.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_scan_cancel(struct sr_scan *scan)
+{
+	if (!scan)
+		return SR_ERR_ARG;
+
+	g_atomic_int_set(&scan->cancelled, TRUE);
+
+	return SR_OK;
+}
+
+/**
+ * Cancel a scan started with sr_driver_scan_async() if it's still
+ * running, wait for the probes in progress, and free it. This must not
+ * be called from the callback, and must be done before sr_exit().
+ *
+ * @param scan The scan. Must not be NULL.
+ *
+ * @retval SR_OK Success.
+ * @retval SR_ERR_ARG Invalid argument.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_scan_free(struct sr_scan *scan)
+{
+	if (!scan)
+		return SR_ERR_ARG;
+
+	g_atomic_int_set(&scan->cancelled, TRUE);
+	/* The ports still queued are skipped, but their jobs free them. */
+	g_thread_pool_free(scan->pool, FALSE, TRUE);
+
+	g_slist_free_full(scan->options, (GDestroyNotify)sr_config_free);
+	g_mutex_clear(&scan->cb_mutex);
+	g_mutex_clear(&scan->mutex);
+	g_cond_clear(&scan->cond);
+	g_free(scan);
+
+	return SR_OK;
+}
+
 /** @private */
 SR_PRIV void sr_hw_cleanup_all(void)
 {
@@ -493,6 +1034,97 @@ SR_PRIV void sr_config_free(struct sr_config *src)
 
 }
 
+/* Config cache entries are keyed by probe group and key. */
+struct config_cache_key {
+	const struct sr_probe_group *probe_group;
+	int key;
+};
+
+static guint config_cache_hash(gconstpointer v)
+{
+	const struct config_cache_key *ck;
+
+	ck = v;
+
+	return g_direct_hash(ck->probe_group) ^ (guint)ck->key;
+}
+
+static gboolean config_cache_equal(gconstpointer a, gconstpointer b)
+{
+	const struct config_cache_key *ca, *cb;
+
+	ca = a;
+	cb = b;
+
+	return ca->probe_group == cb->probe_group && ca->key == cb->key;
+}
+
+/**
+ * Turn caching of a device's config values on or off.
+ *
+ * While caching is on, sr_config_get() only asks the driver for a value
+ * the first time, and returns the value it got from then on. The cache is
+ * cleared by every sr_config_set() on the device (setting one key may
+ * change others), and when the device is opened, closed or starts an
+ * acquisition. Only turn caching on for devices whose settings can't be
+ * changed other than through libsigrok, e.g. with knobs on the front
+ * panel.
+ *
+ * @param sdi The device instance. Must not be NULL.
+ * @param enable TRUE to cache config values, FALSE to always ask the
+ *               driver.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_config_cache_set(struct sr_dev_inst *sdi, gboolean enable)
+{
+	if (!sdi)
+		return SR_ERR_ARG;
+
+	if (!enable) {
+		sr_config_cache_free(sdi);
+		return SR_OK;
+	}
+	if (sdi->config_cache)
+		return SR_OK;
+
+	sdi->config_cache = g_hash_table_new_full(config_cache_hash,
+			config_cache_equal, g_free,
+			(GDestroyNotify)g_variant_unref);
+
+	return SR_OK;
+}
+
+/**
+ * Drop all config values cached for a device, if caching is on.
+ *
+ * @param sdi The device instance. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_config_cache_clear(const struct sr_dev_inst *sdi)
+{
+	if (sdi->config_cache)
+		g_hash_table_remove_all(sdi->config_cache);
+}
+
+/**
+ * Turn off caching of a device's config values, and free the cache.
+ *
+ * @param sdi The device instance. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_config_cache_free(struct sr_dev_inst *sdi)
+{
+	if (sdi->config_cache) {
+		g_hash_table_destroy(sdi->config_cache);
+		sdi->config_cache = NULL;
+	}
+}
+
 /**
  * Returns information about the given driver or device instance.
  *
@@ -519,6 +1151,8 @@ SR_API int sr_config_get(const struct sr_dev_driver *driver,
 		const struct sr_probe_group *probe_group,
 		int key, GVariant **data)
 {
+	struct config_cache_key lookup, *ck;
+	GVariant *cached;
 	int ret;
 
 	if (!driver || !data)
@@ -527,18 +1161,85 @@ SR_API int sr_config_get(const struct sr_dev_driver *driver,
 	if (!driver->config_get)
 		return SR_ERR_ARG;
 
+	if (sdi && sdi->config_cache) {
+		lookup.probe_group = probe_group;
+		lookup.key = key;
+		cached = g_hash_table_lookup(sdi->config_cache, &lookup);
+		if (cached) {
+			*data = g_variant_ref(cached);
+			return SR_OK;
+		}
+	}
+
 	if ((ret = driver->config_get(key, data, sdi, probe_group)) == SR_OK) {
 		/* Got a floating reference from the driver. Sink it here,
 		 * caller will need to unref when done with it. */
 		g_variant_ref_sink(*data);
+		if (sdi && sdi->config_cache
+		    && (ck = g_try_malloc(sizeof(struct config_cache_key)))) {
+			ck->probe_group = probe_group;
+			ck->key = key;
+			g_hash_table_insert(sdi->config_cache, ck,
+					g_variant_ref(*data));
+		}
 	}
 
 	return ret;
 }
 
+/**
+ * Get several configuration keys of a driver or device instance at once.
+ *
+ * This works like calling sr_config_get() for every key, but in one call
+ * into the library. Keys which can't be read don't make the others fail.
+ *
+ * @param driver The sr_dev_driver struct to query.
+ * @param sdi (optional) If the keys are specific to a device, this must
+ *            contain a pointer to the struct sr_dev_inst to be checked.
+ *            Otherwise it must be NULL.
+ * @param probe_group The probe group on the device for which to get the
+ *                    values, or NULL.
+ * @param keys The configuration keys (SR_CONF_*). Must not be NULL.
+ * @param data Array of num_keys GVariant pointers. Must not be NULL. Each
+ *             is set to the value of the key at the same index, which the
+ *             caller must unref after use, or to NULL if the key couldn't
+ *             be read.
+ * @param num_keys The number of keys.
+ *
+ * @return The number of keys which were read, or SR_ERR upon invalid
+ *         arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_config_get_multi(const struct sr_dev_driver *driver,
+		const struct sr_dev_inst *sdi,
+		const struct sr_probe_group *probe_group,
+		const int *keys, GVariant **data, int num_keys)
+{
+	int i, num_read;
+
+	if (!driver || !keys || !data || num_keys < 0)
+		return SR_ERR;
+
+	num_read = 0;
+	for (i = 0; i < num_keys; i++) {
+		if (sr_config_get(driver, sdi, probe_group, keys[i],
+				&data[i]) == SR_OK)
+			num_read++;
+		else
+			data[i] = NULL;
+	}
+
+	return num_read;
+}
+
 /**
  * Set a configuration key in a device instance.
  *
+ * The session also holds the device's data to the SR_CONF_LIMIT_SAMPLES
+ * and SR_CONF_LIMIT_MSEC values accepted, however closely the driver
+ * manages to.
+ *
  * @param sdi The device instance.
  * @param probe_group The probe group on the device for which to list the
  *                    values, or NULL.
@@ -564,14 +1265,65 @@ SR_API int sr_config_set(const struct sr_dev_inst *sdi,
 		ret = SR_ERR;
 	else if (!sdi->driver->config_set)
 		ret = SR_ERR_ARG;
-	else
+	else {
+		sr_config_cache_clear(sdi);
 		ret = sdi->driver->config_set(key, data, sdi, probe_group);
+	}
+
+	/* The session enforces these on the device's data, too. */
+	if (ret == SR_OK && key == SR_CONF_LIMIT_SAMPLES)
+		((struct sr_dev_inst *)sdi)->limit_samples =
+				g_variant_get_uint64(data);
+	else if (ret == SR_OK && key == SR_CONF_LIMIT_MSEC)
+		((struct sr_dev_inst *)sdi)->limit_msec =
+				g_variant_get_uint64(data);
 
 	g_variant_unref(data);
 
 	return ret;
 }
 
+/**
+ * Set several configuration keys of a device instance at once.
+ *
+ * The keys are set in order, as with sr_config_set(), until one of them
+ * fails.
+ *
+ * @param sdi The device instance.
+ * @param probe_group The probe group on the device for which to set the
+ *                    values, or NULL.
+ * @param keys The configuration keys (SR_CONF_*). Must not be NULL.
+ * @param data The new values for the keys, at the same indices. Must not
+ *             be NULL. Floating references can be passed in; all of
+ *             them are sunk and unreferenced, including those of keys
+ *             which weren't set because an earlier one failed.
+ * @param num_keys The number of keys.
+ *
+ * @return SR_OK upon success, or the error code of the first key which
+ *         couldn't be set.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_config_set_multi(const struct sr_dev_inst *sdi,
+		const struct sr_probe_group *probe_group,
+		const int *keys, GVariant **data, int num_keys)
+{
+	int i, ret;
+
+	if (!keys || !data || num_keys < 0)
+		return SR_ERR;
+
+	ret = SR_OK;
+	for (i = 0; i < num_keys; i++) {
+		if (ret == SR_OK)
+			ret = sr_config_set(sdi, probe_group, keys[i], data[i]);
+		else if (data[i])
+			g_variant_unref(g_variant_ref_sink(data[i]));
+	}
+
+	return ret;
+}
+
 /**
  * List all possible values for a configuration key.
  *
@@ -609,6 +1361,101 @@ SR_API int sr_config_list(const struct sr_dev_driver *driver,
 	return ret;
 }
 
+/* The highest of the samplerates a device lists which isn't over max. */
+static uint64_t samplerate_pick(const struct sr_dev_inst *sdi, uint64_t max)
+{
+	GVariant *gvar, *list;
+	const uint64_t *rates;
+	gsize num_rates, i;
+	uint64_t best;
+
+	if (sr_config_list(sdi->driver, sdi, NULL, SR_CONF_SAMPLERATE,
+			&gvar) != SR_OK)
+		return max;
+
+	best = 0;
+	if ((list = g_variant_lookup_value(gvar, "samplerates",
+			G_VARIANT_TYPE("at")))) {
+		rates = g_variant_get_fixed_array(list, &num_rates,
+				sizeof(uint64_t));
+		for (i = 0; i < num_rates; i++) {
+			if (rates[i] <= max && rates[i] > best)
+				best = rates[i];
+		}
+		g_variant_unref(list);
+	} else if ((list = g_variant_lookup_value(gvar, "samplerate-steps",
+			G_VARIANT_TYPE("at")))) {
+		/* Lowest, highest and step. */
+		rates = g_variant_get_fixed_array(list, &num_rates,
+				sizeof(uint64_t));
+		if (num_rates == 3 && rates[0] <= max) {
+			best = MIN(max, rates[1]);
+			if (rates[2])
+				best -= (best - rates[0]) % rates[2];
+		}
+		g_variant_unref(list);
+	} else {
+		best = max;
+	}
+	g_variant_unref(gvar);
+
+	return best;
+}
+
+/**
+ * Find the highest samplerate a device can keep up with for the probes
+ * enabled now, and optionally set it.
+ *
+ * The limit comes from the device's SR_CONF_MAX_SAMPLERATE; the rate
+ * picked is the highest the device lists for SR_CONF_SAMPLERATE which
+ * doesn't exceed it. Drivers pick the narrowest unitsize for the probes
+ * enabled themselves, so the probes should be enabled first.
+ *
+ * @param sdi The device instance. Must not be NULL.
+ * @param set TRUE to also set the samplerate found on the device.
+ * @param samplerate Where to store the samplerate found, in Hz. Can be
+ *                   NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_NA if the device doesn't report its limit,
+ *         SR_ERR_SAMPLERATE if none of its samplerates is within it, or
+ *         the error setting the samplerate returned.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_config_samplerate_max(const struct sr_dev_inst *sdi,
+		gboolean set, uint64_t *samplerate)
+{
+	GVariant *gvar;
+	uint64_t max, best;
+	int ret;
+
+	if (!sdi || !sdi->driver) {
+		sr_err("%s: sdi was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (sr_config_get(sdi->driver, sdi, NULL, SR_CONF_MAX_SAMPLERATE,
+			&gvar) != SR_OK)
+		return SR_ERR_NA;
+	max = g_variant_get_uint64(gvar);
+	g_variant_unref(gvar);
+
+	if (!(best = samplerate_pick(sdi, max))) {
+		sr_err("No samplerate within %" PRIu64 " Hz.", max);
+		return SR_ERR_SAMPLERATE;
+	}
+
+	if (set && (ret = sr_config_set(sdi, NULL, SR_CONF_SAMPLERATE,
+			g_variant_new_uint64(best))) != SR_OK)
+		return ret;
+
+	if (samplerate)
+		*samplerate = best;
+
+	return SR_OK;
+}
+
 /**
  * Get information about a configuration key.
  *
@@ -654,14 +1501,15 @@ SR_API const struct sr_config_info *sr_config_info_name_get(const char *optname)
 /** @private */
 SR_PRIV int sr_source_remove(int fd)
 {
-	return sr_session_source_remove(fd);
+	return sr_session_source_remove(sr_session_cur_get(), fd);
 }
 
 /** @private */
 SR_PRIV int sr_source_add(int fd, int events, int timeout,
 			  sr_receive_data_callback_t cb, void *cb_data)
 {
-	return sr_session_source_add(fd, events, timeout, cb, cb_data);
+	return sr_session_source_add(sr_session_cur_get(), fd, events,
+			timeout, cb, cb_data);
 }
 
 /** @} */
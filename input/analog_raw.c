@@ -0,0 +1,479 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Loads the files written by the "analog-raw" output module, whose header
+ * describes the format. Interleaved samples are sent straight from the
+ * mapped file where the host is little-endian: float samples as analog
+ * packets, S16 samples as raw analog packets. Planar samples are put
+ * back together into analog packets.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "input/analog-raw: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/* Number of values (samples times probes) sent per packet. */
+#define CHUNK_SIZE (256 * 1024)
+
+struct context {
+	int encoding;
+	int layout;
+	uint64_t samplerate;
+	int mq;
+	int unit;
+	uint64_t mqflags;
+	int num_probes;
+	float *scale;
+	float *offset;
+	/* Where the samples start in the file. */
+	uint64_t data_offset;
+	struct sr_input_window window;
+};
+
+static inline uint16_t le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static inline uint32_t le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+			| (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t le64(const uint8_t *p)
+{
+	return le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+static inline float lefloat(const uint8_t *p)
+{
+	uint32_t v;
+	float f;
+
+	v = le32(p);
+	memcpy(&f, &v, sizeof(f));
+
+	return f;
+}
+
+static gboolean magic_match(const uint8_t *buf, size_t len)
+{
+	return len >= ANALOG_RAW_HEADER_LEN
+			&& !memcmp(buf, ANALOG_RAW_MAGIC, ANALOG_RAW_MAGIC_LEN);
+}
+
+static int format_match(const char *filename)
+{
+	uint8_t buf[ANALOG_RAW_HEADER_LEN];
+	ssize_t len;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) == -1)
+		return FALSE;
+	len = read(fd, buf, sizeof(buf));
+	close(fd);
+
+	return len > 0 && magic_match(buf, len);
+}
+
+static int format_match_header(const struct sr_input_header *header)
+{
+	return magic_match(header->buf, header->len);
+}
+
+/* Parse the whole header, and add the probes it names to the device. */
+static int parse_header(const uint8_t *buf, uint32_t len,
+		struct context *ctx, struct sr_dev_inst *sdi)
+{
+	struct sr_probe *probe;
+	uint32_t pos, name_len;
+	char *name;
+	int i;
+
+	ctx->encoding = le16(buf + 12);
+	ctx->layout = le16(buf + 14);
+	ctx->samplerate = le64(buf + 16);
+	ctx->mq = le32(buf + 24);
+	ctx->unit = le32(buf + 28);
+	ctx->mqflags = le64(buf + 32);
+	ctx->num_probes = le16(buf + 40);
+	ctx->data_offset = len;
+
+	if ((ctx->encoding != ANALOG_RAW_FLOAT
+	    && ctx->encoding != ANALOG_RAW_S16)
+	    || (ctx->layout != ANALOG_RAW_INTERLEAVED
+	    && ctx->layout != ANALOG_RAW_PLANAR) || !ctx->num_probes) {
+		sr_err("Unsupported encoding %d, layout %d or %d probes.",
+		       ctx->encoding, ctx->layout, ctx->num_probes);
+		return SR_ERR;
+	}
+
+	if (!(ctx->scale = g_try_malloc(ctx->num_probes * sizeof(float)))
+	    || !(ctx->offset = g_try_malloc(ctx->num_probes
+			* sizeof(float)))) {
+		sr_err("%s: scale malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	pos = ANALOG_RAW_HEADER_LEN;
+	for (i = 0; i < ctx->num_probes; i++) {
+		if (pos + 10 > len) {
+			sr_err("Header too short for the probes.");
+			return SR_ERR;
+		}
+		ctx->scale[i] = lefloat(buf + pos);
+		ctx->offset[i] = lefloat(buf + pos + 4);
+		name_len = le16(buf + pos + 8);
+		pos += 10;
+		if (pos + name_len > len) {
+			sr_err("Header too short for the probes.");
+			return SR_ERR;
+		}
+		name = g_strndup((const char *)buf + pos, name_len);
+		pos += name_len;
+		probe = sr_probe_new(i, SR_PROBE_ANALOG, TRUE, name);
+		g_free(name);
+		if (!probe)
+			return SR_ERR_MALLOC;
+		sdi->probes = g_slist_append(sdi->probes, probe);
+	}
+
+	return SR_OK;
+}
+
+static void context_free(struct context *ctx)
+{
+	sr_input_window_free(&ctx->window);
+	g_free(ctx->scale);
+	g_free(ctx->offset);
+	g_free(ctx);
+}
+
+static int init(struct sr_input *in, const char *filename)
+{
+	struct context *ctx;
+	uint8_t fixed[ANALOG_RAW_HEADER_LEN], *buf;
+	uint32_t len;
+	int fd, ret;
+
+	if ((fd = open(filename, O_RDONLY)) == -1) {
+		sr_err("Input file '%s' could not be opened.", filename);
+		return SR_ERR;
+	}
+	if (read(fd, fixed, sizeof(fixed)) != sizeof(fixed)
+	    || !magic_match(fixed, sizeof(fixed))) {
+		close(fd);
+		return SR_ERR;
+	}
+	len = le32(fixed + 8);
+	if (len < ANALOG_RAW_HEADER_LEN || len > ANALOG_RAW_MAX_HEADER
+	    || len % 8) {
+		sr_err("Invalid header length %u.", len);
+		close(fd);
+		return SR_ERR;
+	}
+	if (!(buf = g_try_malloc(len))) {
+		sr_err("%s: buf malloc failed", __func__);
+		close(fd);
+		return SR_ERR_MALLOC;
+	}
+	memcpy(buf, fixed, sizeof(fixed));
+	ret = read(fd, buf + sizeof(fixed), len - sizeof(fixed))
+			== (ssize_t)(len - sizeof(fixed)) ? SR_OK : SR_ERR;
+	close(fd);
+	if (ret != SR_OK) {
+		sr_err("Short header.");
+		g_free(buf);
+		return ret;
+	}
+
+	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
+		sr_err("%s: ctx malloc failed", __func__);
+		g_free(buf);
+		return SR_ERR_MALLOC;
+	}
+
+	/* Create a virtual device. */
+	in->sdi = sr_dev_inst_new(0, SR_ST_ACTIVE, NULL, NULL, NULL);
+	in->internal = ctx;
+	ret = parse_header(buf, len, ctx, in->sdi);
+	g_free(buf);
+	if (ret == SR_OK)
+		ret = sr_input_window_init(&ctx->window, in, TRUE);
+	if (ret != SR_OK) {
+		context_free(ctx);
+		in->internal = NULL;
+	}
+
+	return ret;
+}
+
+static int send_analog(struct sr_input *in, float *data, uint64_t n)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+	struct context *ctx;
+
+	ctx = in->internal;
+	memset(&analog, 0, sizeof(analog));
+	analog.probes = in->sdi->probes;
+	analog.num_samples = n;
+	analog.mq = ctx->mq;
+	analog.unit = ctx->unit;
+	analog.mqflags = ctx->mqflags;
+	analog.data = data;
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+
+	return sr_input_window_send(&ctx->window, in->sdi, &packet);
+}
+
+static int send_raw(struct sr_input *in, const uint8_t *data, uint64_t n)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog_raw raw;
+	struct context *ctx;
+
+	ctx = in->internal;
+	memset(&raw, 0, sizeof(raw));
+	raw.probes = in->sdi->probes;
+	raw.num_samples = n;
+	raw.mq = ctx->mq;
+	raw.unit = ctx->unit;
+	raw.mqflags = ctx->mqflags;
+	raw.encoding = SR_ANALOG_S16;
+	raw.scale = ctx->scale;
+	raw.offset = ctx->offset;
+	raw.data = (void *)data;
+	packet.type = SR_DF_ANALOG_RAW;
+	packet.payload = &raw;
+
+	return sr_input_window_send(&ctx->window, in->sdi, &packet);
+}
+
+/*
+ * Convert n samples of each probe to interleaved floats. The samples of
+ * a probe are stride values apart, the probes first apart.
+ */
+static void convert(const struct context *ctx, const uint8_t *in,
+		unsigned int stride, uint64_t first, float *out, uint64_t n)
+{
+	int j, size;
+
+	size = ctx->encoding == ANALOG_RAW_S16 ? 2 : 4;
+	for (j = 0; j < ctx->num_probes; j++) {
+		if (ctx->encoding == ANALOG_RAW_S16)
+			sr_analog_s16le_to_float(in + j * first * size,
+					stride, out + j, ctx->num_probes, n,
+					ctx->scale[j], ctx->offset[j]);
+		else
+			sr_analog_f32le_to_float(in + j * first * size,
+					stride, out + j, ctx->num_probes, n,
+					1.0, 0.0);
+	}
+}
+
+/* Send count samples from the skip-th on, or as many as there are. */
+static int send_interleaved(struct sr_input *in, const uint8_t *data,
+		uint64_t size, uint64_t skip, uint64_t count, float *fdata)
+{
+	struct context *ctx;
+	uint64_t frame_size, num_frames, chunk, done;
+	int value_size, ret;
+
+	ctx = in->internal;
+	value_size = ctx->encoding == ANALOG_RAW_S16 ? 2 : 4;
+	frame_size = value_size * ctx->num_probes;
+	num_frames = size / frame_size;
+	skip = MIN(skip, num_frames);
+	data += skip * frame_size;
+	num_frames = MIN(num_frames - skip, count);
+	chunk = MAX(CHUNK_SIZE / ctx->num_probes, 1);
+
+	ret = SR_OK;
+	for (done = 0; ret == SR_OK && done < num_frames; done += chunk) {
+		chunk = MIN(chunk, num_frames - done);
+		/* The header keeps the samples aligned in the mapping. */
+		if (G_BYTE_ORDER == G_LITTLE_ENDIAN
+		    && ctx->encoding == ANALOG_RAW_S16) {
+			ret = send_raw(in, data + done * frame_size, chunk);
+		} else if (G_BYTE_ORDER == G_LITTLE_ENDIAN) {
+			ret = send_analog(in, (float *)(data + done
+					* frame_size), chunk);
+		} else {
+			convert(ctx, data + done * frame_size,
+					ctx->num_probes, 1, fdata, chunk);
+			ret = send_analog(in, fdata, chunk);
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Likewise for planar data. The blocks before the skip-th sample are
+ * passed over without converting them.
+ */
+static int send_planar(struct sr_input *in, const uint8_t *data,
+		uint64_t size, uint64_t skip, uint64_t count)
+{
+	struct context *ctx;
+	float *fdata;
+	uint64_t pos, n, plane, fdata_size, chunk, done, sample;
+	int value_size, ret;
+
+	ctx = in->internal;
+	value_size = ctx->encoding == ANALOG_RAW_S16 ? 2 : 4;
+	fdata = NULL;
+	fdata_size = 0;
+
+	ret = SR_OK;
+	pos = sample = 0;
+	while (ret == SR_OK && pos + ANALOG_RAW_BLOCK_HEADER_LEN <= size
+	    && count) {
+		n = le32(data + pos);
+		plane = (n * value_size + 7) & ~(uint64_t)7;
+		pos += ANALOG_RAW_BLOCK_HEADER_LEN;
+		if (plane * ctx->num_probes > size - pos) {
+			sr_warn("Dropping a block cut off at the end.");
+			break;
+		}
+		done = MIN(n, skip - MIN(skip, sample));
+		sample += n;
+		if (done == n) {
+			pos += plane * ctx->num_probes;
+			continue;
+		}
+		n = done + MIN(n - done, count);
+		count -= n - done;
+
+		chunk = MAX(CHUNK_SIZE / ctx->num_probes, 1);
+		chunk = MIN(chunk, n);
+		if (chunk * ctx->num_probes > fdata_size) {
+			g_free(fdata);
+			fdata_size = chunk * ctx->num_probes;
+			if (!(fdata = g_try_malloc(fdata_size
+					* sizeof(float)))) {
+				sr_err("%s: fdata malloc failed", __func__);
+				return SR_ERR_MALLOC;
+			}
+		}
+		for (; ret == SR_OK && done < n; done += chunk) {
+			chunk = MIN(chunk, n - done);
+			convert(ctx, data + pos + done * value_size, 1,
+					plane / value_size, fdata, chunk);
+			ret = send_analog(in, fdata, chunk);
+		}
+		pos += plane * ctx->num_probes;
+	}
+	g_free(fdata);
+
+	return ret;
+}
+
+static int loadfile(struct sr_input *in, const char *filename)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_meta meta;
+	struct sr_config *src;
+	struct context *ctx;
+	GMappedFile *file;
+	GError *error;
+	const uint8_t *data;
+	float *fdata;
+	uint64_t size, skip, count;
+	int ret;
+
+	ctx = in->internal;
+	sr_input_window_seek(&ctx->window, ctx->samplerate, &skip, &count);
+
+	error = NULL;
+	if (!(file = g_mapped_file_new(filename, FALSE, &error))) {
+		sr_err("Input file '%s' could not be opened: %s.", filename,
+		       error->message);
+		g_error_free(error);
+		return SR_ERR;
+	}
+	data = (const uint8_t *)g_mapped_file_get_contents(file);
+	size = g_mapped_file_get_length(file);
+	size -= MIN(size, ctx->data_offset);
+	data += ctx->data_offset;
+
+	fdata = NULL;
+	if (G_BYTE_ORDER != G_LITTLE_ENDIAN && !(fdata = g_try_malloc(
+			MAX(CHUNK_SIZE / ctx->num_probes, 1)
+			* ctx->num_probes * sizeof(float)))) {
+		sr_err("%s: fdata malloc failed", __func__);
+		g_mapped_file_unref(file);
+		return SR_ERR_MALLOC;
+	}
+
+	/* Send header packet to the session bus. */
+	std_session_send_df_header(in->sdi, LOG_PREFIX);
+
+	if (ctx->samplerate) {
+		packet.type = SR_DF_META;
+		packet.payload = &meta;
+		src = sr_config_new(SR_CONF_SAMPLERATE,
+				g_variant_new_uint64(ctx->samplerate));
+		meta.config = g_slist_append(NULL, src);
+		sr_input_window_send(&ctx->window, in->sdi, &packet);
+		g_slist_free(meta.config);
+		sr_config_free(src);
+	}
+
+	if (ctx->layout == ANALOG_RAW_PLANAR)
+		ret = send_planar(in, data, size, skip, count);
+	else
+		ret = send_interleaved(in, data, size, skip, count, fdata);
+
+	g_free(fdata);
+	g_mapped_file_unref(file);
+
+	packet.type = SR_DF_END;
+	sr_session_send(in->sdi, &packet);
+
+	context_free(ctx);
+	in->internal = NULL;
+
+	return ret;
+}
+
+SR_PRIV struct sr_input_format input_analog_raw = {
+	.id = "analog-raw",
+	.description = "Raw analog samples",
+	.format_match = format_match,
+	.format_match_header = format_match_header,
+	.init = init,
+	.loadfile = loadfile,
+};
@@ -17,29 +17,64 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h" /* Needed for large file support. */
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <glib.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "input/binary: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define CHUNKSIZE             (512 * 1024)
+#define MAX_CHUNKSIZE         (256 * 1024 * 1024)
 #define DEFAULT_NUM_PROBES    8
 
 struct context {
 	uint64_t samplerate;
+	int unitsize;
+	/* Bytes per packet, a multiple of the unit size. */
+	uint64_t blocksize;
+	/* First sample to send, and how many (0 means up to the end). */
+	uint64_t offset;
+	uint64_t samples;
+	/* The bytes of those in the window, see byte_range(). */
+	uint64_t range_start;
+	uint64_t range_length;
+	struct sr_input_window window;
+	gboolean mmap;
+	/*
+	 * For data passed in with sr_input_send(): the bytes received so
+	 * far, and those of a sample split across calls.
+	 */
+	gboolean started;
+	uint64_t pos;
+	uint8_t *partial;
+	int partial_len;
+};
+
+/* One of the two buffers a file is read into, see loadfile_read(). */
+struct block {
+	int fd;
+	uint8_t *buf;
+	uint64_t size;
+	/* Bytes read, or -1 upon errors. */
+	int64_t len;
+	GThread *thread;
 };
 
 static int format_match(const char *filename)
@@ -50,12 +85,19 @@ static int format_match(const char *filename)
 	return TRUE;
 }
 
+static int format_match_header(const struct sr_input_header *header)
+{
+	(void)header;
+
+	return TRUE;
+}
+
 static int init(struct sr_input *in, const char *filename)
 {
 	struct sr_probe *probe;
 	int num_probes, i;
 	char name[SR_MAX_PROBENAME_LEN + 1];
-	char *param;
+	char *param, *end;
 	struct context *ctx;
 
 	(void)filename;
@@ -67,22 +109,66 @@ static int init(struct sr_input *in, const char *filename)
 
 	num_probes = DEFAULT_NUM_PROBES;
 	ctx->samplerate = 0;
+	ctx->blocksize = CHUNKSIZE;
 
 	if (in->param) {
 		param = g_hash_table_lookup(in->param, "numprobes");
 		if (param) {
 			num_probes = strtoul(param, NULL, 10);
-			if (num_probes < 1)
+			if (num_probes < 1) {
+				g_free(ctx);
 				return SR_ERR;
+			}
 		}
 
 		param = g_hash_table_lookup(in->param, "samplerate");
 		if (param) {
-			if (sr_parse_sizestring(param, &ctx->samplerate) != SR_OK)
+			if (sr_parse_sizestring(param, &ctx->samplerate) != SR_OK) {
+				g_free(ctx);
 				return SR_ERR;
+			}
+		}
+
+		param = g_hash_table_lookup(in->param, "blocksize");
+		if (param) {
+			if (sr_parse_sizestring(param, &ctx->blocksize) != SR_OK
+			    || ctx->blocksize < 1
+			    || ctx->blocksize > MAX_CHUNKSIZE) {
+				sr_err("Invalid block size: %s.", param);
+				g_free(ctx);
+				return SR_ERR_ARG;
+			}
 		}
+
+		param = g_hash_table_lookup(in->param, "offset");
+		if (param) {
+			ctx->offset = g_ascii_strtoull(param, &end, 10);
+			if (end == param || *end) {
+				sr_err("Invalid sample offset: %s.", param);
+				g_free(ctx);
+				return SR_ERR_ARG;
+			}
+		}
+
+		param = g_hash_table_lookup(in->param, "samples");
+		if (param) {
+			ctx->samples = g_ascii_strtoull(param, &end, 10);
+			if (end == param || *end) {
+				sr_err("Invalid number of samples: %s.", param);
+				g_free(ctx);
+				return SR_ERR_ARG;
+			}
+		}
+
+		param = g_hash_table_lookup(in->param, "mmap");
+		if (param)
+			ctx->mmap = sr_parse_boolstring(param);
 	}
 
+	/* Packets always hold whole samples. */
+	ctx->unitsize = (num_probes + 7) / 8;
+	ctx->blocksize = MAX(ctx->blocksize / ctx->unitsize, 1) * ctx->unitsize;
+
 	/* Create a virtual device. */
 	in->sdi = sr_dev_inst_new(0, SR_ST_ACTIVE, NULL, NULL, NULL);
 	in->internal = ctx;
@@ -95,25 +181,226 @@ static int init(struct sr_input *in, const char *filename)
 		in->sdi->probes = g_slist_append(in->sdi->probes, probe);
 	}
 
+	if (sr_input_window_init(&ctx->window, in, TRUE) != SR_OK) {
+		g_free(ctx);
+		in->internal = NULL;
+		return SR_ERR_ARG;
+	}
+
 	return SR_OK;
 }
 
-static int loadfile(struct sr_input *in, const char *filename)
+static int send_samples(struct sr_input *in, const uint8_t *buf,
+		int unitsize, uint64_t length)
 {
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_meta meta;
 	struct sr_datafeed_logic logic;
-	struct sr_config *src;
-	unsigned char buffer[CHUNKSIZE];
-	int fd, size, num_probes;
 	struct context *ctx;
 
 	ctx = in->internal;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.length = length;
+	logic.unitsize = unitsize;
+	logic.data = (void *)buf;
+
+	return sr_input_window_send(&ctx->window, in->sdi, &packet);
+}
 
-	if ((fd = open(filename, O_RDONLY)) == -1)
+/* Read until the buffer is full, or the end of the file. */
+static void *read_block(void *data)
+{
+	struct block *b;
+	uint64_t len;
+	ssize_t ret;
+
+	b = data;
+	len = 0;
+	while (len < b->size) {
+		ret = read(b->fd, b->buf + len, MIN(b->size - len, INT_MAX));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			sr_err("Read error: %s.", strerror(errno));
+			b->len = -1;
+			return NULL;
+		}
+		if (ret == 0)
+			break;
+		len += ret;
+	}
+	b->len = len;
+
+	return NULL;
+}
+
+/* Start reading the next block, in a thread of its own if possible. */
+static void read_block_start(struct block *b, uint64_t size)
+{
+	b->size = size;
+	b->thread = g_thread_try_new("sr-binary", read_block, b, NULL);
+	if (!b->thread)
+		read_block(b);
+}
+
+static void read_block_finish(struct block *b)
+{
+	if (b->thread)
+		g_thread_join(b->thread);
+	b->thread = NULL;
+}
+
+/*
+ * Send the file's data from a memory mapping, without copying it at
+ * all. Best for files in the page cache, or on fast storage.
+ */
+static int loadfile_mmap(struct sr_input *in, const char *filename,
+		uint64_t start, uint64_t length)
+{
+	struct context *ctx;
+	struct sr_input_file *file;
+	const uint8_t *base;
+	uint64_t size, chunk;
+	int ret;
+
+	ctx = in->internal;
+
+	if (!(file = sr_input_file_open(filename)))
 		return SR_ERR;
 
-	num_probes = g_slist_length(in->sdi->probes);
+	base = file->data;
+	size = file->size;
+	start = MIN(start, size);
+	length = MIN(length, size - start);
+	length -= length % ctx->unitsize;
+
+	ret = SR_OK;
+	while (ret == SR_OK && length > 0) {
+		chunk = MIN(length, ctx->blocksize);
+		ret = send_samples(in, base + start, ctx->unitsize, chunk);
+		start += chunk;
+		length -= chunk;
+	}
+
+	sr_input_file_close(file);
+
+	return ret;
+}
+
+/*
+ * Send the file's data read into two buffers in turn: while the
+ * samples in one of them are sent, the next block is read into the
+ * other, so that reading and processing the data overlap.
+ */
+static int loadfile_read(struct sr_input *in, const char *filename,
+		uint64_t start, uint64_t length)
+{
+	struct context *ctx;
+	struct block blocks[2], *cur, *next;
+	uint64_t len;
+	int fd, ret, i;
+
+	ctx = in->internal;
+
+	if ((fd = open(filename, O_RDONLY)) == -1) {
+		sr_err("Input file '%s' could not be opened: %s.", filename,
+		       strerror(errno));
+		return SR_ERR;
+	}
+
+	if (start && lseek(fd, start, SEEK_SET) == (off_t)-1) {
+		sr_err("Failed to seek to sample %" PRIu64 ": %s.",
+		       start / ctx->unitsize, strerror(errno));
+		close(fd);
+		return SR_ERR;
+	}
+
+#ifdef HAVE_POSIX_FADVISE
+	/* Have the kernel read ahead well beyond the next block. */
+	posix_fadvise(fd, start, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	memset(blocks, 0, sizeof(blocks));
+	for (i = 0; i < 2; i++) {
+		blocks[i].fd = fd;
+		if (!(blocks[i].buf = g_try_malloc(ctx->blocksize))) {
+			sr_err("%s: buf malloc failed", __func__);
+			g_free(blocks[0].buf);
+			close(fd);
+			return SR_ERR_MALLOC;
+		}
+	}
+
+	cur = &blocks[0];
+	next = &blocks[1];
+	read_block_start(cur, MIN(length, ctx->blocksize));
+
+	ret = SR_OK;
+	while (TRUE) {
+		read_block_finish(cur);
+		if (cur->len < 0) {
+			ret = SR_ERR;
+			break;
+		}
+		len = cur->len;
+		length -= len;
+
+		/* Read the next block while sending this one. */
+		if (len == cur->size && length > 0)
+			read_block_start(next, MIN(length, ctx->blocksize));
+		else
+			next->size = 0;
+
+		/* Only the file's last block can end in a partial sample. */
+		len -= len % ctx->unitsize;
+		if (len)
+			ret = send_samples(in, cur->buf, ctx->unitsize,
+					len);
+		if (!next->size) {
+			break;
+		} else if (ret != SR_OK) {
+			read_block_finish(next);
+			break;
+		}
+
+		cur = next;
+		next = (cur == &blocks[0]) ? &blocks[1] : &blocks[0];
+	}
+
+	for (i = 0; i < 2; i++)
+		g_free(blocks[i].buf);
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Byte range of the requested samples; the data may end earlier. The
+ * window is counted from the offset, and only what it takes is read.
+ */
+static void byte_range(struct context *ctx)
+{
+	uint64_t skip, count, samples;
+
+	sr_input_window_seek(&ctx->window, ctx->samplerate, &skip, &count);
+	samples = ctx->samples ? ctx->samples : G_MAXUINT64;
+	samples = samples > skip ? MIN(samples - skip, count) : 0;
+
+	ctx->range_start = (ctx->offset + skip) * ctx->unitsize;
+	ctx->range_length = G_MAXUINT64;
+	if (samples <= (G_MAXUINT64 - ctx->range_start) / ctx->unitsize)
+		ctx->range_length = samples * ctx->unitsize;
+}
+
+static void send_header(struct sr_input *in)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_meta meta;
+	struct sr_config *src;
+	struct context *ctx;
+
+	ctx = in->internal;
+	byte_range(ctx);
 
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(in->sdi, LOG_PREFIX);
@@ -124,27 +411,130 @@ static int loadfile(struct sr_input *in, const char *filename)
 		src = sr_config_new(SR_CONF_SAMPLERATE,
 				g_variant_new_uint64(ctx->samplerate));
 		meta.config = g_slist_append(NULL, src);
-		sr_session_send(in->sdi, &packet);
+		sr_input_window_send(&ctx->window, in->sdi, &packet);
+		g_slist_free(meta.config);
 		sr_config_free(src);
 	}
+}
 
-	/* Chop up the input file into chunks & send it to the session bus. */
-	packet.type = SR_DF_LOGIC;
-	packet.payload = &logic;
-	logic.unitsize = (num_probes + 7) / 8;
-	logic.data = buffer;
-	while ((size = read(fd, buffer, CHUNKSIZE)) > 0) {
-		logic.length = size;
-		sr_session_send(in->sdi, &packet);
-	}
-	close(fd);
+static void send_end(struct sr_input *in)
+{
+	struct sr_datafeed_packet packet;
+	struct context *ctx;
+
+	ctx = in->internal;
 
 	/* Send end packet to the session bus. */
 	packet.type = SR_DF_END;
 	sr_session_send(in->sdi, &packet);
 
+	sr_input_window_free(&ctx->window);
+	g_free(ctx->partial);
 	g_free(ctx);
 	in->internal = NULL;
+}
+
+static int loadfile(struct sr_input *in, const char *filename)
+{
+	struct context *ctx;
+	uint64_t start, length;
+	int ret;
+
+	ctx = in->internal;
+	send_header(in);
+	start = ctx->range_start;
+	length = ctx->range_length;
+
+	/*
+	 * Chop up the input file into chunks & send it to the session bus.
+	 * Compressed files are decompressed into memory to start with.
+	 */
+	if (ctx->mmap || sr_input_file_compressed(filename))
+		ret = loadfile_mmap(in, filename, start, length);
+	else
+		ret = loadfile_read(in, filename, start, length);
+
+	send_end(in);
+
+	return ret;
+}
+
+/*
+ * Send data passed in from memory. Whole samples are sent straight from
+ * the caller's buffer, only a sample split across calls is copied.
+ */
+static int receive(struct sr_input *in, const void *buf, size_t len)
+{
+	struct context *ctx;
+	const uint8_t *p;
+	uint64_t start, length, skip, n;
+	int ret;
+
+	ctx = in->internal;
+	if (!ctx->started) {
+		send_header(in);
+		ctx->started = TRUE;
+	}
+
+	/* Only the requested range of the data is of interest. */
+	start = ctx->range_start;
+	length = ctx->range_length;
+	p = buf;
+	if (ctx->pos < start) {
+		skip = MIN(len, start - ctx->pos);
+		p += skip;
+		len -= skip;
+		ctx->pos += skip;
+	}
+	if (ctx->pos < start || ctx->pos - start >= length)
+		return SR_OK;
+	len = MIN(len, length - (ctx->pos - start));
+	ctx->pos += len;
+
+	if (ctx->partial_len) {
+		n = MIN(len, (size_t)(ctx->unitsize - ctx->partial_len));
+		memcpy(ctx->partial + ctx->partial_len, p, n);
+		ctx->partial_len += n;
+		p += n;
+		len -= n;
+		if (ctx->partial_len < ctx->unitsize)
+			return SR_OK;
+		ctx->partial_len = 0;
+		if ((ret = send_samples(in, ctx->partial, ctx->unitsize,
+				ctx->unitsize)) != SR_OK)
+			return ret;
+	}
+
+	while (len >= (size_t)ctx->unitsize) {
+		n = MIN(len - len % ctx->unitsize, ctx->blocksize);
+		if ((ret = send_samples(in, p, ctx->unitsize, n)) != SR_OK)
+			return ret;
+		p += n;
+		len -= n;
+	}
+
+	if (len) {
+		if (!ctx->partial && !(ctx->partial = g_try_malloc(
+				ctx->unitsize))) {
+			sr_err("%s: partial malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		memcpy(ctx->partial, p, len);
+		ctx->partial_len = len;
+	}
+
+	return SR_OK;
+}
+
+static int end(struct sr_input *in)
+{
+	struct context *ctx;
+
+	ctx = in->internal;
+	if (!ctx->started)
+		send_header(in);
+	/* Like a file's, a trailing partial sample is dropped. */
+	send_end(in);
 
 	return SR_OK;
 }
@@ -153,6 +543,9 @@ SR_PRIV struct sr_input_format input_binary = {
 	.id = "binary",
 	.description = "Raw binary",
 	.format_match = format_match,
+	.format_match_header = format_match_header,
 	.init = init,
 	.loadfile = loadfile,
+	.receive = receive,
+	.end = end,
 };
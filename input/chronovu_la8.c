@@ -19,8 +19,7 @@
  */
 
 #include <stdlib.h>
-#include <fcntl.h>
-#include <unistd.h>
+#include <string.h>
 #include <sys/stat.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
@@ -28,16 +27,18 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "input/chronovu-la8: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
-
-#define NUM_PACKETS		2048
-#define PACKET_SIZE		4096
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+#define PACKET_SIZE		(1024 * 1024)
 #define DEFAULT_NUM_PROBES	8
 
+/* The divcount byte and the trigger point after the samples. */
+#define TRAILER_SIZE		(1 + 4)
+
 /**
  * Convert the LA8 'divcount' value to the respective samplerate (in Hz).
  *
@@ -57,6 +58,21 @@ static uint64_t divcount_to_samplerate(uint8_t divcount)
 	return SR_MHZ(100) / (divcount + 1);
 }
 
+/* Only accept files of length 8MB + 5 bytes. */
+static gboolean match_size(uint64_t size)
+{
+	if (size != (8 * 1024 * 1024 + 5)) {
+		sr_dbg("%s: File size must be exactly 8388613 bytes ("
+		       "it actually is %" PRIu64 " bytes in size), so this is "
+		       "not a ChronoVu LA8 file.", __func__, size);
+		return FALSE;
+	}
+
+	/* TODO: Check for divcount != 0xff. */
+
+	return TRUE;
+}
+
 static int format_match(const char *filename)
 {
 	struct stat stat_buf;
@@ -82,27 +98,24 @@ static int format_match(const char *filename)
 		return FALSE;
 	}
 
-	/* Only accept files of length 8MB + 5 bytes. */
 	ret = stat(filename, &stat_buf);
 	if (ret != 0) {
 		sr_err("%s: Error getting file size of '%s'",
 		       __func__, filename);
 		return FALSE;
 	}
-	if (stat_buf.st_size != (8 * 1024 * 1024 + 5)) {
-		sr_dbg("%s: File size must be exactly 8388613 bytes ("
-		       "it actually is %d bytes in size), so this is not a "
-		       "ChronoVu LA8 file.", __func__, stat_buf.st_size);
-		return FALSE;
-	}
 
-	/* TODO: Check for divcount != 0xff. */
+	return match_size(stat_buf.st_size);
+}
 
-	return TRUE;
+static int format_match_header(const struct sr_input_header *header)
+{
+	return match_size(header->filesize);
 }
 
 static int init(struct sr_input *in, const char *filename)
 {
+	struct sr_input_window *window;
 	struct sr_probe *probe;
 	int num_probes, i;
 	char name[SR_MAX_PROBENAME_LEN + 1];
@@ -134,6 +147,16 @@ static int init(struct sr_input *in, const char *filename)
 		in->sdi->probes = g_slist_append(in->sdi->probes, probe);
 	}
 
+	if (!(window = g_try_malloc(sizeof(struct sr_input_window)))) {
+		sr_err("%s: window malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if (sr_input_window_init(window, in, TRUE) != SR_OK) {
+		g_free(window);
+		return SR_ERR_ARG;
+	}
+	in->internal = window;
+
 	return SR_OK;
 }
 
@@ -143,25 +166,32 @@ static int loadfile(struct sr_input *in, const char *filename)
 	struct sr_datafeed_meta meta;
 	struct sr_datafeed_logic logic;
 	struct sr_config *src;
-	uint8_t buf[PACKET_SIZE], divcount;
-	int i, fd, size, num_probes;
-	uint64_t samplerate;
-
-	/* TODO: Use glib functions! GIOChannel, g_fopen, etc. */
-	if ((fd = open(filename, O_RDONLY)) == -1) {
-		sr_err("%s: file open failed", __func__);
+	struct sr_input_file *file;
+	struct sr_input_window *window;
+	uint64_t samplerate, pos, length, skip, count;
+	uint8_t divcount;
+	int num_probes, ret;
+
+	window = in->internal;
+	if (!(file = sr_input_file_open(filename)))
+		return SR_ERR;
+	if (file->size < TRAILER_SIZE) {
+		sr_err("%s: file too short", __func__);
+		sr_input_file_close(file);
 		return SR_ERR;
 	}
+	length = file->size - TRAILER_SIZE;
 
 	num_probes = g_slist_length(in->sdi->probes);
 
-	/* Seek to the end of the file, and read the divcount byte. */
-	divcount = 0x00; /* TODO: Don't hardcode! */
+	/* The divcount byte follows the samples. */
+	divcount = file->data[length];
 
 	/* Convert the divcount value to a samplerate. */
 	samplerate = divcount_to_samplerate(divcount);
 	if (samplerate == 0xffffffffffffffffULL) {
-		close(fd); /* FIXME */
+		sr_err("%s: invalid divcount", __func__);
+		sr_input_file_close(file);
 		return SR_ERR;
 	}
 	sr_dbg("%s: samplerate is %" PRIu64, __func__, samplerate);
@@ -174,26 +204,37 @@ static int loadfile(struct sr_input *in, const char *filename)
 	packet.payload = &meta;
 	src = sr_config_new(SR_CONF_SAMPLERATE, g_variant_new_uint64(samplerate));
 	meta.config = g_slist_append(NULL, src);
-	sr_session_send(in->sdi, &packet);
+	sr_input_window_send(window, in->sdi, &packet);
 	sr_config_free(src);
+	g_slist_free(meta.config);
 
 	/* TODO: Handle trigger point. */
 
-	/* Send data packets to the session bus. */
+	/*
+	 * Send the data to the session bus straight from the file's
+	 * mapping, in large packets.
+	 */
 	sr_dbg("%s: sending SR_DF_LOGIC data packets", __func__);
 	packet.type = SR_DF_LOGIC;
 	packet.payload = &logic;
+	memset(&logic, 0, sizeof(logic));
 	logic.unitsize = (num_probes + 7) / 8;
-	logic.data = buf;
-
-	/* Send 8MB of total data to the session bus in small chunks. */
-	for (i = 0; i < NUM_PACKETS; i++) {
-		/* TODO: Handle errors, handle incomplete reads. */
-		size = read(fd, buf, PACKET_SIZE);
-		logic.length = size;
-		sr_session_send(in->sdi, &packet);
+	length /= logic.unitsize;
+
+	/* Only the samples of the window are sent. */
+	sr_input_window_seek(window, samplerate, &skip, &count);
+	skip = MIN(skip, length);
+	count = MIN(length - skip, count);
+	pos = skip * logic.unitsize;
+	length = (skip + count) * logic.unitsize;
+
+	ret = SR_OK;
+	for (; pos < length && ret == SR_OK; pos += logic.length) {
+		logic.length = MIN(length - pos, PACKET_SIZE);
+		logic.data = (void *)(file->data + pos);
+		ret = sr_input_window_send(window, in->sdi, &packet);
 	}
-	close(fd); /* FIXME */
+	sr_input_file_close(file);
 
 	/* Send end packet to the session bus. */
 	sr_dbg("%s: sending SR_DF_END", __func__);
@@ -201,13 +242,18 @@ static int loadfile(struct sr_input *in, const char *filename)
 	packet.payload = NULL;
 	sr_session_send(in->sdi, &packet);
 
-	return SR_OK;
+	sr_input_window_free(window);
+	g_free(window);
+	in->internal = NULL;
+
+	return ret;
 }
 
 SR_PRIV struct sr_input_format input_chronovu_la8 = {
 	.id = "chronovu-la8",
 	.description = "ChronoVu LA8",
 	.format_match = format_match,
+	.format_match_header = format_match_header,
 	.init = init,
 	.loadfile = loadfile,
 };
@@ -26,11 +26,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "input/csv: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 /*
  * The CSV input module has the following options:
@@ -71,8 +71,25 @@
  *
  * startline:     Line number to start processing sample data. Must be greater
  *                than 0. The default line number to start processing is 1.
+ *
+ * threads:       Number of threads to parse the sample data with. Blocks of
+ *                lines are parsed in parallel and sent in file order. The
+ *                default is 1.
+ *
+ * The start, end, probes and downsample options of all input modules
+ * select the samples sent, see sr_input_window_init(). Parsing stops at
+ * the end of the window.
  */
 
+/* Maximum amount of sample data sent to the session bus in one packet. */
+#define CHUNK_SIZE (4 * 1024 * 1024)
+
+/* Maximum amount of text parsed as one block. */
+#define BLOCK_SIZE (4 * 1024 * 1024)
+
+/* Upper limit for the number of parser threads. */
+#define MAX_THREADS 64
+
 /* Single column formats. */
 enum {
 	FORMAT_BIN,
@@ -80,6 +97,12 @@ enum {
 	FORMAT_OCT
 };
 
+/* A line or column of the input file. Not NUL-terminated. */
+struct column {
+	const char *str;
+	gsize len;
+};
+
 struct context {
 	/* Current selected samplerate. */
 	uint64_t samplerate;
@@ -124,19 +147,47 @@ struct context {
 	/* Format sample data is stored in single column mode. */
 	int format;
 
-	/* Size of the sample buffer. */
-	gsize sample_buffer_size;
+	/* Number of threads to parse the sample data with. */
+	gsize num_threads;
+
+	/* Size of one sample in bytes. */
+	gsize unitsize;
+
+	/* The input file, mapped or decompressed into memory. */
+	struct sr_input_file *file;
 
-	/* Buffer to store sample data. */
-	uint8_t *sample_buffer;
+	/* Text of the input file not parsed yet. */
+	const char *pos;
+	const char *end;
 
-	GIOChannel *channel;
+	/* Number of the last line before 'pos'. */
+	gsize line_number;
+
+	/* The samples to send, see sr_input_window_init(). */
+	struct sr_input_window window;
+};
 
-	/* Buffer for the current line. */
-	GString *buffer;
+/* State of parsing one block of lines, possibly in its own thread. */
+struct parser {
+	const struct context *ctx;
 
-	/* Current line number. */
+	/* Text of the block not parsed yet. */
+	const char *pos;
+	const char *end;
+
+	/* Number of the line being parsed. */
 	gsize line_number;
+
+	/* Columns of the current line. */
+	struct column *columns;
+
+	/* Samples parsed from the block. */
+	uint8_t *samples;
+	gsize num_samples;
+	gsize max_samples;
+
+	GThread *thread;
+	int res;
 };
 
 static int format_match(const char *filename)
@@ -159,6 +210,14 @@ static int format_match(const char *filename)
 	return TRUE;
 }
 
+/* The header is only read from regular files, nothing left to check. */
+static int format_match_header(const struct sr_input_header *header)
+{
+	(void)header;
+
+	return TRUE;
+}
+
 static void free_context(struct context *ctx)
 {
 	if (!ctx)
@@ -170,56 +229,111 @@ static void free_context(struct context *ctx)
 	if (ctx->comment)
 		g_string_free(ctx->comment, TRUE);
 
-	if (ctx->channel) {
-		g_io_channel_shutdown(ctx->channel, FALSE, NULL);
-		g_io_channel_unref(ctx->channel);
+	sr_input_file_close(ctx->file);
+	sr_input_window_free(&ctx->window);
+
+	g_free(ctx);
+}
+
+/* Find the first occurrence of a string in the text up to 'end'. */
+static const char *find_str(const char *str, const char *end,
+		const GString *needle)
+{
+	/* Columns are short, a plain loop beats memchr() for them. */
+	if (needle->len == 1) {
+		for (; str < end; str++)
+			if (*str == needle->str[0])
+				return str;
+		return NULL;
 	}
 
-	if (ctx->sample_buffer)
-		g_free(ctx->sample_buffer);
+	for (; (str = memchr(str, needle->str[0], end - str)); str++) {
+		if ((gsize)(end - str) < needle->len)
+			return NULL;
+		if (!memcmp(str, needle->str, needle->len))
+			return str;
+	}
 
-	if (ctx->buffer)
-		g_string_free(ctx->buffer, TRUE);
+	return NULL;
+}
 
-	g_free(ctx);
+/* Get the next line, without its line termination character(s). */
+static gboolean next_line(const char **pos, const char *end,
+		struct column *line)
+{
+	const char *eol;
+
+	if (*pos >= end)
+		return FALSE;
+
+	line->str = *pos;
+
+	if ((eol = memchr(*pos, '\n', end - *pos)))
+		*pos = eol + 1;
+	else
+		*pos = eol = end;
+
+	line->len = eol - line->str;
+
+	if (line->len && line->str[line->len - 1] == '\r')
+		line->len--;
+
+	return TRUE;
 }
 
-static void strip_comment(GString *string, const GString *prefix)
+static void strip_comment(struct column *line, const GString *prefix)
 {
-	char *ptr;
+	const char *ptr;
 
 	if (!prefix->len)
 		return;
 
-	if (!(ptr = strstr(string->str, prefix->str)))
+	if (!(ptr = find_str(line->str, line->str + line->len, prefix)))
 		return;
 
-	g_string_truncate(string, ptr - string->str);
+	line->len = ptr - line->str;
+}
+
+static void strip_column(struct column *column)
+{
+	while (column->len && g_ascii_isspace(column->str[0])) {
+		column->str++;
+		column->len--;
+	}
+
+	while (column->len && g_ascii_isspace(column->str[column->len - 1]))
+		column->len--;
 }
 
-static int parse_binstr(const char *str, struct context *ctx)
+static int parse_binstr(struct parser *p, const struct column *column,
+		uint8_t *sample)
 {
+	const struct context *ctx;
+	const char *str;
 	gsize i, j, length;
 
-	length = strlen(str);
+	ctx = p->ctx;
+	str = column->str;
+	length = column->len;
 
 	if (!length) {
 		sr_err("Column %zu in line %zu is empty.", ctx->single_column,
-			ctx->line_number);
+			p->line_number);
 		return SR_ERR;
 	}
 
 	/* Clear buffer in order to set bits only. */
-	memset(ctx->sample_buffer, 0, (ctx->num_probes + 7) >> 3);
+	memset(sample, 0, ctx->unitsize);
 
 	i = ctx->first_probe;
 
 	for (j = 0; i < length && j < ctx->num_probes; i++, j++) {
 		if (str[length - i - 1] == '1') {
-			ctx->sample_buffer[j / 8] |= (1 << (j % 8));
+			sample[j / 8] |= (1 << (j % 8));
 		} else if (str[length - i - 1] != '0') {
-			sr_err("Invalid value '%s' in column %zu in line %zu.",
-				str, ctx->single_column, ctx->line_number);
+			sr_err("Invalid value '%.*s' in column %zu in line %zu.",
+				(int)length, str, ctx->single_column,
+				p->line_number);
 			return SR_ERR;
 		}
 	}
@@ -227,22 +341,27 @@ static int parse_binstr(const char *str, struct context *ctx)
 	return SR_OK;
 }
 
-static int parse_hexstr(const char *str, struct context *ctx)
+static int parse_hexstr(struct parser *p, const struct column *column,
+		uint8_t *sample)
 {
+	const struct context *ctx;
+	const char *str;
 	gsize i, j, k, length;
 	uint8_t value;
 	char c;
 
-	length = strlen(str);
+	ctx = p->ctx;
+	str = column->str;
+	length = column->len;
 
 	if (!length) {
 		sr_err("Column %zu in line %zu is empty.", ctx->single_column,
-			ctx->line_number);
+			p->line_number);
 		return SR_ERR;
 	}
 
 	/* Clear buffer in order to set bits only. */
-	memset(ctx->sample_buffer, 0, (ctx->num_probes + 7) >> 3);
+	memset(sample, 0, ctx->unitsize);
 
 	/* Calculate the position of the first hexadecimal digit. */
 	i = ctx->first_probe / 4;
@@ -251,8 +370,9 @@ static int parse_hexstr(const char *str, struct context *ctx)
 		c = str[length - i - 1];
 
 		if (!g_ascii_isxdigit(c)) {
-			sr_err("Invalid value '%s' in column %zu in line %zu.",
-				str, ctx->single_column, ctx->line_number);
+			sr_err("Invalid value '%.*s' in column %zu in line %zu.",
+				(int)length, str, ctx->single_column,
+				p->line_number);
 			return SR_ERR;
 		}
 
@@ -262,7 +382,7 @@ static int parse_hexstr(const char *str, struct context *ctx)
 
 		for (; j < ctx->num_probes && k < 4; k++) {
 			if (value & (1 << k))
-				ctx->sample_buffer[j / 8] |= (1 << (j % 8));
+				sample[j / 8] |= (1 << (j % 8));
 
 			j++;
 		}
@@ -271,22 +391,27 @@ static int parse_hexstr(const char *str, struct context *ctx)
 	return SR_OK;
 }
 
-static int parse_octstr(const char *str, struct context *ctx)
+static int parse_octstr(struct parser *p, const struct column *column,
+		uint8_t *sample)
 {
+	const struct context *ctx;
+	const char *str;
 	gsize i, j, k, length;
 	uint8_t value;
 	char c;
 
-	length = strlen(str);
+	ctx = p->ctx;
+	str = column->str;
+	length = column->len;
 
 	if (!length) {
 		sr_err("Column %zu in line %zu is empty.", ctx->single_column,
-			ctx->line_number);
+			p->line_number);
 		return SR_ERR;
 	}
 
 	/* Clear buffer in order to set bits only. */
-	memset(ctx->sample_buffer, 0, (ctx->num_probes + 7) >> 3);
+	memset(sample, 0, ctx->unitsize);
 
 	/* Calculate the position of the first octal digit. */
 	i = ctx->first_probe / 3;
@@ -295,8 +420,9 @@ static int parse_octstr(const char *str, struct context *ctx)
 		c = str[length - i - 1];
 
 		if (c < '0' || c > '7') {
-			sr_err("Invalid value '%s' in column %zu in line %zu.",
-				str, ctx->single_column, ctx->line_number);
+			sr_err("Invalid value '%.*s' in column %zu in line %zu.",
+				(int)length, str, ctx->single_column,
+				p->line_number);
 			return SR_ERR;
 		}
 
@@ -306,7 +432,7 @@ static int parse_octstr(const char *str, struct context *ctx)
 
 		for (; j < ctx->num_probes && k < 3; k++) {
 			if (value & (1 << k))
-				ctx->sample_buffer[j / 8] |= (1 << (j % 8));
+				sample[j / 8] |= (1 << (j % 8));
 
 			j++;
 		}
@@ -315,72 +441,68 @@ static int parse_octstr(const char *str, struct context *ctx)
 	return SR_OK;
 }
 
-static char **parse_line(const struct context *ctx, int max_columns)
+/*
+ * Split a line into columns, starting at the first column to parse. If
+ * 'columns' is NULL the columns are only counted.
+ */
+static gsize parse_line(const struct context *ctx, const struct column *line,
+		struct column *columns, gsize max_columns)
 {
-	const char *str, *remainder;
-	GSList *list, *l;
-	char **columns;
-	char *column;
+	const char *str, *end, *delim;
 	gsize n, k;
 
 	n = 0;
 	k = 0;
-	list = NULL;
 
-	remainder = ctx->buffer->str;
-	str = strstr(remainder, ctx->delimiter->str);
+	str = line->str;
+	end = line->str + line->len;
 
-	while (str && max_columns) {
-		if (n >= ctx->first_column) {
-			column = g_strndup(remainder, str - remainder);
-			list = g_slist_prepend(list, g_strstrip(column));
+	while (k < max_columns) {
+		delim = find_str(str, end, ctx->delimiter);
 
-			max_columns--;
+		if (n >= ctx->first_column) {
+			if (columns) {
+				columns[k].str = str;
+				columns[k].len = (delim ? delim : end) - str;
+				strip_column(&columns[k]);
+			}
 			k++;
 		}
 
-		remainder = str + ctx->delimiter->len;
-		str = strstr(remainder, ctx->delimiter->str);
-		n++;
-	}
+		if (!delim)
+			break;
 
-	if (ctx->buffer->len && max_columns && n >= ctx->first_column) {
-		column = g_strdup(remainder);
-		list = g_slist_prepend(list, g_strstrip(column));
-		k++;
+		str = delim + ctx->delimiter->len;
+		n++;
 	}
 
-	if (!(columns = g_try_new(char *, k + 1)))
-		return NULL;
-
-	columns[k--] = NULL;
-
-	for (l = list; l; l = l->next)
-		columns[k--] = l->data;
-
-	g_slist_free(list);
-
-	return columns;
+	return k;
 }
 
-static int parse_multi_columns(char **columns, struct context *ctx)
+static int parse_multi_columns(struct parser *p, uint8_t *sample)
 {
+	const struct context *ctx;
+	const struct column *column;
 	gsize i;
 
+	ctx = p->ctx;
+
 	/* Clear buffer in order to set bits only. */
-	memset(ctx->sample_buffer, 0, (ctx->num_probes + 7) >> 3);
+	memset(sample, 0, ctx->unitsize);
 
 	for (i = 0; i < ctx->num_probes; i++) {
-		if (columns[i][0] == '1') {
-			ctx->sample_buffer[i / 8] |= (1 << (i % 8));
-		} else if (!strlen(columns[i])) {
+		column = &p->columns[i];
+
+		if (!column->len) {
 			sr_err("Column %zu in line %zu is empty.",
-				ctx->first_probe + i, ctx->line_number);
+				ctx->first_probe + i, p->line_number);
 			return SR_ERR;
-		} else if (columns[i][0] != '0') {
-			sr_err("Invalid value '%s' in column %zu in line %zu.",
-				columns[i], ctx->first_probe + i,
-				ctx->line_number);
+		} else if (column->str[0] == '1') {
+			sample[i / 8] |= (1 << (i % 8));
+		} else if (column->str[0] != '0') {
+			sr_err("Invalid value '%.*s' in column %zu in line %zu.",
+				(int)column->len, column->str,
+				ctx->first_probe + i, p->line_number);
 			return SR_ERR;
 		}
 	}
@@ -388,47 +510,245 @@ static int parse_multi_columns(char **columns, struct context *ctx)
 	return SR_OK;
 }
 
-static int parse_single_column(const char *column, struct context *ctx)
+static int parse_single_column(struct parser *p, uint8_t *sample)
 {
 	int res;
 
 	res = SR_ERR;
 
-	switch(ctx->format) {
+	switch(p->ctx->format) {
 	case FORMAT_BIN:
-		res = parse_binstr(column, ctx);
+		res = parse_binstr(p, &p->columns[0], sample);
 		break;
 	case FORMAT_HEX:
-		res = parse_hexstr(column, ctx);
+		res = parse_hexstr(p, &p->columns[0], sample);
 		break;
 	case FORMAT_OCT:
-		res = parse_octstr(column, ctx);
+		res = parse_octstr(p, &p->columns[0], sample);
 		break;
 	}
 
 	return res;
 }
 
-static int send_samples(const struct sr_dev_inst *sdi, uint8_t *buffer,
-			gsize buffer_size, gsize count)
+/* Parse the lines of a block into samples. */
+static int parse_block(struct parser *p)
 {
+	const struct context *ctx;
+	struct column line;
+	gsize num_columns, max_columns;
+	uint8_t *sample;
 	int res;
+
+	ctx = p->ctx;
+	p->num_samples = 0;
+
+	/* Limit the number of columns to parse. */
+	if (ctx->multi_column_mode)
+		max_columns = ctx->num_probes;
+	else
+		max_columns = 1;
+
+	while (p->num_samples < p->max_samples
+			&& next_line(&p->pos, p->end, &line)) {
+		p->line_number++;
+
+		if (!line.len) {
+			sr_spew("Blank line %zu skipped.", p->line_number);
+			continue;
+		}
+
+		/* Remove trailing comment. */
+		strip_comment(&line, ctx->comment);
+
+		if (!line.len) {
+			sr_spew("Comment-only line %zu skipped.",
+				p->line_number);
+			continue;
+		}
+
+		num_columns = parse_line(ctx, &line, p->columns, max_columns);
+
+		/* Ensure that the first column is not out of bounds. */
+		if (!num_columns) {
+			sr_err("Column %zu in line %zu is out of bounds.",
+				ctx->first_column, p->line_number);
+			return SR_ERR;
+		}
+
+		/*
+		 * Ensure that the number of probes does not exceed the number
+		 * of columns in multi column mode.
+		 */
+		if (ctx->multi_column_mode && num_columns < ctx->num_probes) {
+			sr_err("Not enough columns for desired number of probes in line %zu.",
+				p->line_number);
+			return SR_ERR;
+		}
+
+		sample = p->samples + p->num_samples * ctx->unitsize;
+
+		if (ctx->multi_column_mode)
+			res = parse_multi_columns(p, sample);
+		else
+			res = parse_single_column(p, sample);
+
+		if (res != SR_OK)
+			return res;
+
+		/*
+		 * TODO: Parse sample numbers / timestamps and use it for
+		 * decompression.
+		 */
+
+		p->num_samples++;
+	}
+
+	return SR_OK;
+}
+
+static gpointer parse_thread(gpointer data)
+{
+	struct parser *p;
+
+	p = data;
+	p->res = parse_block(p);
+
+	return NULL;
+}
+
+/*
+ * Hand the next block of the file to a parser. A block ends on a line
+ * boundary and its samples always fit into a single packet.
+ */
+static void next_block(struct context *ctx, struct parser *p)
+{
+	const char *limit;
+	struct column line;
+	gsize num_lines;
+
+	p->pos = ctx->pos;
+	p->line_number = ctx->line_number;
+
+	if ((gsize)(ctx->end - ctx->pos) > BLOCK_SIZE)
+		limit = ctx->pos + BLOCK_SIZE;
+	else
+		limit = ctx->end;
+
+	for (num_lines = 0; ctx->pos < limit && num_lines < p->max_samples;
+			num_lines++)
+		next_line(&ctx->pos, ctx->end, &line);
+
+	p->end = ctx->pos;
+	ctx->line_number += num_lines;
+}
+
+static int send_samples(const struct sr_dev_inst *sdi,
+			struct sr_input_window *window, uint8_t *buffer,
+			gsize unitsize, gsize count)
+{
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_logic logic;
-	gsize i;
 
 	packet.type = SR_DF_LOGIC;
 	packet.payload = &logic;
-	logic.unitsize = buffer_size;
-	logic.length = buffer_size;
+	logic.unitsize = unitsize;
+	logic.length = count * unitsize;
 	logic.data = buffer;
 
-	for (i = 0; i < count; i++) {
-		if ((res = sr_session_send(sdi, &packet)) != SR_OK)
-			return res;
+	return sr_input_window_send(window, sdi, &packet);
+}
+
+static void free_parsers(struct parser *parsers, gsize num_parsers)
+{
+	gsize i;
+
+	for (i = 0; i < num_parsers; i++) {
+		g_free(parsers[i].columns);
+		g_free(parsers[i].samples);
 	}
 
-	return SR_OK;
+	g_free(parsers);
+}
+
+/*
+ * Parse the rest of the file and send it to the session bus. Each round
+ * hands one block to every parser, runs them in parallel and sends their
+ * samples in file order.
+ */
+static int parse_file(struct sr_input *in, struct context *ctx)
+{
+	struct parser *parsers, *p;
+	gsize i, n, max_columns;
+	int res;
+
+	if (ctx->multi_column_mode)
+		max_columns = ctx->num_probes;
+	else
+		max_columns = 1;
+
+	if (!(parsers = g_try_new0(struct parser, ctx->num_threads))) {
+		sr_err("Parser malloc failed.");
+		return SR_ERR_MALLOC;
+	}
+
+	for (i = 0; i < ctx->num_threads; i++) {
+		p = &parsers[i];
+		p->ctx = ctx;
+		p->max_samples = MAX(CHUNK_SIZE / ctx->unitsize, 1);
+		p->columns = g_try_new(struct column, max_columns);
+		p->samples = g_try_malloc(p->max_samples * ctx->unitsize);
+
+		if (!p->columns || !p->samples) {
+			sr_err("Sample buffer malloc failed.");
+			free_parsers(parsers, ctx->num_threads);
+			return SR_ERR_MALLOC;
+		}
+	}
+
+	res = SR_OK;
+
+	/* Parsing stops after the last sample of the window. */
+	while (res == SR_OK && ctx->pos < ctx->end
+			&& !sr_input_window_done(&ctx->window)) {
+		for (n = 0; n < ctx->num_threads && ctx->pos < ctx->end; n++) {
+			p = &parsers[n];
+			next_block(ctx, p);
+
+			/* Parse in this thread if no other one is needed. */
+			p->thread = NULL;
+			if (ctx->num_threads > 1)
+				p->thread = g_thread_try_new("sr-csv",
+					parse_thread, p, NULL);
+			if (!p->thread)
+				p->res = parse_block(p);
+		}
+
+		for (i = 0; i < n; i++) {
+			p = &parsers[i];
+
+			if (p->thread)
+				g_thread_join(p->thread);
+
+			/* Samples after a parse error are never sent. */
+			if (res != SR_OK)
+				continue;
+
+			if (p->num_samples && send_samples(in->sdi,
+					&ctx->window, p->samples,
+					ctx->unitsize, p->num_samples) != SR_OK) {
+				sr_err("Sending samples failed.");
+				res = SR_ERR;
+				continue;
+			}
+
+			res = p->res;
+		}
+	}
+
+	free_parsers(parsers, ctx->num_threads);
+
+	return res;
 }
 
 static int init(struct sr_input *in, const char *filename)
@@ -436,11 +756,11 @@ static int init(struct sr_input *in, const char *filename)
 	int res;
 	struct context *ctx;
 	const char *param;
-	GIOStatus status;
-	gsize i, term_pos;
+	gsize i;
 	char probe_name[SR_MAX_PROBENAME_LEN + 1];
 	struct sr_probe *probe;
-	char **columns;
+	struct column line, *columns;
+	const char *line_start;
 	gsize num_columns;
 	char *ptr;
 
@@ -501,11 +821,8 @@ static int init(struct sr_input *in, const char *filename)
 	/* Set default format for single column mode. */
 	ctx->format = FORMAT_BIN;
 
-	if (!(ctx->buffer = g_string_new(""))) {
-		sr_err("Line buffer malloc failed.");
-		free_context(ctx);
-		return SR_ERR_MALLOC;
-	}
+	/* Parse in a single thread by default. */
+	ctx->num_threads = 1;
 
 	if (in->param) {
 		if ((param = g_hash_table_lookup(in->param, "samplerate"))) {
@@ -578,6 +895,17 @@ static int init(struct sr_input *in, const char *filename)
 				return SR_ERR;
 			}
 		}
+
+		if ((param = g_hash_table_lookup(in->param, "threads"))) {
+			ctx->num_threads = g_ascii_strtoull(param, NULL, 10);
+
+			if (ctx->num_threads < 1
+					|| ctx->num_threads > MAX_THREADS) {
+				sr_err("Invalid number of threads: %s.", param);
+				free_context(ctx);
+				return SR_ERR_ARG;
+			}
+		}
 	}
 
 	if (ctx->multi_column_mode)
@@ -591,47 +919,39 @@ static int init(struct sr_input *in, const char *filename)
 		return SR_ERR;
 	}
 
-	if (!(ctx->channel = g_io_channel_new_file(filename, "r", NULL))) {
-		sr_err("Input file '%s' could not be opened.", filename);
+	if (!(ctx->file = sr_input_file_open(filename))) {
 		free_context(ctx);
 		return SR_ERR;
 	}
 
+	ctx->pos = (const char *)ctx->file->data;
+	ctx->end = ctx->pos + ctx->file->size;
+
 	while (TRUE) {
-		ctx->line_number++;
-		status = g_io_channel_read_line_string(ctx->channel,
-			ctx->buffer, &term_pos, NULL);
+		line_start = ctx->pos;
 
-		if (status == G_IO_STATUS_EOF) {
+		if (!next_line(&ctx->pos, ctx->end, &line)) {
 			sr_err("Input file is empty.");
 			free_context(ctx);
 			return SR_ERR;
 		}
 
-		if (status != G_IO_STATUS_NORMAL) {
-			sr_err("Error while reading line %zu.",
-				ctx->line_number);
-			free_context(ctx);
-			return SR_ERR;
-		}
+		ctx->line_number++;
 
 		if (ctx->start_line > ctx->line_number) {
 			sr_spew("Line %zu skipped.", ctx->line_number);
 			continue;
 		}
 
-		/* Remove line termination character(s). */
-		g_string_truncate(ctx->buffer, term_pos);
-
-		if (!ctx->buffer->len) {
+		if (!line.len) {
 			sr_spew("Blank line %zu skipped.", ctx->line_number);
 			continue;
 		}
 
 		/* Remove trailing comment. */
-		strip_comment(ctx->buffer, ctx->comment);
+		strip_comment(&line, ctx->comment);
 
-		if (ctx->buffer->len)
+		if (line.len)
 			break;
 
 		sr_spew("Comment-only line %zu skipped.", ctx->line_number);
@@ -641,19 +961,12 @@ static int init(struct sr_input *in, const char *filename)
 	 * In order to determine the number of columns parse the current line
 	 * without limiting the number of columns.
 	 */
-	if (!(columns = parse_line(ctx, -1))) {
-		sr_err("Error while parsing line %zu.", ctx->line_number);
-		free_context(ctx);
-		return SR_ERR;
-	}
-
-	num_columns = g_strv_length(columns);
+	num_columns = parse_line(ctx, &line, NULL, G_MAXSIZE);
 
 	/* Ensure that the first column is not out of bounds. */
 	if (!num_columns) {
 		sr_err("Column %zu in line %zu is out of bounds.",
 			ctx->first_column, ctx->line_number);
-		g_strfreev(columns);
 		free_context(ctx);
 		return SR_ERR;
 	}
@@ -676,16 +989,23 @@ static int init(struct sr_input *in, const char *filename)
 		if (num_columns < ctx->num_probes) {
 			sr_err("Not enough columns for desired number of probes in line %zu.",
 				ctx->line_number);
-			g_strfreev(columns);
 			free_context(ctx);
 			return SR_ERR;
 		}
 	}
 
+	if (!(columns = g_try_new(struct column, num_columns))) {
+		sr_err("Column malloc failed.");
+		free_context(ctx);
+		return SR_ERR_MALLOC;
+	}
+
+	parse_line(ctx, &line, columns, num_columns);
+
 	for (i = 0; i < ctx->num_probes; i++) {
-		if (ctx->header && ctx->multi_column_mode && strlen(columns[i]))
-			snprintf(probe_name, sizeof(probe_name), "%s",
-				columns[i]);
+		if (ctx->header && ctx->multi_column_mode && columns[i].len)
+			snprintf(probe_name, sizeof(probe_name), "%.*s",
+				(int)columns[i].len, columns[i].str);
 		else
 			snprintf(probe_name, sizeof(probe_name), "%zu", i);
 
@@ -694,26 +1014,34 @@ static int init(struct sr_input *in, const char *filename)
 		if (!probe) {
 			sr_err("Probe creation failed.");
 			free_context(ctx);
-			g_strfreev(columns);
+			g_free(columns);
 			return SR_ERR;
 		}
 
 		in->sdi->probes = g_slist_append(in->sdi->probes, probe);
 	}
 
-	g_strfreev(columns);
+	g_free(columns);
+
+	if (sr_input_window_init(&ctx->window, in, TRUE) != SR_OK) {
+		free_context(ctx);
+		return SR_ERR_ARG;
+	}
+
+	/*
+	 * Unless the current line is a header it holds the first sample,
+	 * so parsing starts over at its beginning.
+	 */
+	if (!ctx->header) {
+		ctx->pos = line_start;
+		ctx->line_number--;
+	}
 
 	/*
 	 * Calculate the minimum buffer size to store the sample data of the
 	 * probes.
 	 */
-	ctx->sample_buffer_size = (ctx->num_probes + 7) >> 3;
-
-	if (!(ctx->sample_buffer = g_try_malloc(ctx->sample_buffer_size))) {
-		sr_err("Sample buffer malloc failed.");
-		free_context(ctx);
-		return SR_ERR_MALLOC;
-	}
+	ctx->unitsize = (ctx->num_probes + 7) >> 3;
 
 	return SR_OK;
 }
@@ -725,12 +1053,6 @@ static int loadfile(struct sr_input *in, const char *filename)
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_meta meta;
 	struct sr_config *cfg;
-	GIOStatus status;
-	gboolean read_new_line;
-	gsize term_pos;
-	char **columns;
-	gsize num_columns;
-	int max_columns;
 
 	(void)filename;
 
@@ -745,116 +1067,13 @@ static int loadfile(struct sr_input *in, const char *filename)
 		cfg = sr_config_new(SR_CONF_SAMPLERATE,
 			g_variant_new_uint64(ctx->samplerate));
 		meta.config = g_slist_append(NULL, cfg);
-		sr_session_send(in->sdi, &packet);
+		sr_input_window_send(&ctx->window, in->sdi, &packet);
 		sr_config_free(cfg);
 	}
 
-	read_new_line = FALSE;
-
-	/* Limit the number of columns to parse. */
-	if (ctx->multi_column_mode)
-		max_columns = ctx->num_probes;
-	else
-		max_columns = 1;
-
-	while (TRUE) {
-		/*
-		 * Skip reading a new line for the first time if the last read
-		 * line was not a header because the sample data is not parsed
-		 * yet.
-		 */
-		if (read_new_line || ctx->header) {
-			ctx->line_number++;
-			status = g_io_channel_read_line_string(ctx->channel,
-				ctx->buffer, &term_pos, NULL);
-
-			if (status == G_IO_STATUS_EOF)
-				break;
-
-			if (status != G_IO_STATUS_NORMAL) {
-				sr_err("Error while reading line %zu.",
-					ctx->line_number);
-				free_context(ctx);
-				return SR_ERR;
-			}
-
-			/* Remove line termination character(s). */
-			g_string_truncate(ctx->buffer, term_pos);
-		}
-
-		read_new_line = TRUE;
-
-		if (!ctx->buffer->len) {
-			sr_spew("Blank line %zu skipped.", ctx->line_number);
-			continue;
-		}
-
-		/* Remove trailing comment. */
-		strip_comment(ctx->buffer, ctx->comment);
-
-		if (!ctx->buffer->len) {
-			sr_spew("Comment-only line %zu skipped.",
-				ctx->line_number);
-			continue;
-		}
-
-		if (!(columns = parse_line(ctx, max_columns))) {
-			sr_err("Error while parsing line %zu.",
-				ctx->line_number);
-			free_context(ctx);
-			return SR_ERR;
-		}
-
-		num_columns = g_strv_length(columns);
-
-		/* Ensure that the first column is not out of bounds. */
-		if (!num_columns) {
-			sr_err("Column %zu in line %zu is out of bounds.",
-				ctx->first_column, ctx->line_number);
-			g_strfreev(columns);
-			free_context(ctx);
-			return SR_ERR;
-		}
-
-		/*
-		 * Ensure that the number of probes does not exceed the number
-		 * of columns in multi column mode.
-		 */
-		if (ctx->multi_column_mode && num_columns < ctx->num_probes) {
-			sr_err("Not enough columns for desired number of probes in line %zu.",
-				ctx->line_number);
-			g_strfreev(columns);
-			free_context(ctx);
-			return SR_ERR;
-		}
-
-		if (ctx->multi_column_mode)
-			res = parse_multi_columns(columns, ctx);
-		else
-			res = parse_single_column(columns[0], ctx);
-
-		if (res != SR_OK) {
-			g_strfreev(columns);
-			free_context(ctx);
-			return SR_ERR;
-		}
-
-		g_strfreev(columns);
-
-		/*
-		 * TODO: Parse sample numbers / timestamps and use it for
-		 * decompression.
-		 */
-
-		/* Send sample data to the session bus. */
-		res = send_samples(in->sdi, ctx->sample_buffer,
-			ctx->sample_buffer_size, 1);
-
-		if (res != SR_OK) {
-			sr_err("Sending samples failed.");
-			free_context(ctx);
-			return SR_ERR;
-		}
+	if ((res = parse_file(in, ctx)) != SR_OK) {
+		free_context(ctx);
+		return SR_ERR;
 	}
 
 	/* Send end packet to the session bus. */
@@ -870,6 +1089,7 @@ SR_PRIV struct sr_input_format input_csv = {
 	.id = "csv",
 	.description = "Comma-separated values (CSV)",
 	.format_match = format_match,
+	.format_match_header = format_match_header,
 	.init = init,
 	.loadfile = loadfile,
 };
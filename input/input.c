@@ -17,15 +17,35 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <zlib.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "input: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
 /**
  * @file
  *
  * Input file/data format handling.
  */
 
+/* How much of a file sr_input_format_detect() reads for the modules. */
+#define HEADER_SIZE (16 * 1024)
+
+/* How much room to start decompressing a file into, before it grows. */
+#define INFLATE_MIN_SIZE (64 * 1024)
+
 /**
  * @defgroup grp_input Input formats
  *
@@ -55,6 +75,7 @@ extern SR_PRIV struct sr_input_format input_csv;
 extern SR_PRIV struct sr_input_format input_binary;
 extern SR_PRIV struct sr_input_format input_vcd;
 extern SR_PRIV struct sr_input_format input_wav;
+extern SR_PRIV struct sr_input_format input_analog_raw;
 /* @endcond */
 
 static struct sr_input_format *input_module_list[] = {
@@ -62,6 +83,7 @@ static struct sr_input_format *input_module_list[] = {
 	&input_chronovu_la8,
 	&input_wav,
 	&input_csv,
+	&input_analog_raw,
 	/* This one has to be last, because it will take any input. */
 	&input_binary,
 	NULL,
@@ -72,4 +94,903 @@ SR_API struct sr_input_format **sr_input_list(void)
 	return input_module_list;
 }
 
+/**
+ * Pass the next piece of input data to an input module.
+ *
+ * This is the streaming alternative to the module's loadfile(), for data
+ * which doesn't come from a named file: from a socket, a pipe, or
+ * decompressed in memory. The module must have been initialized with
+ * init(in, NULL). The first call sends SR_DF_HEADER; sr_input_end()
+ * finishes the input.
+ *
+ * The data is parsed and sent to the session bus before this returns,
+ * so a producer is held up for as long as the session takes to handle
+ * it. Nothing but the unparsed rest of a call, such as a partial sample,
+ * is buffered in between.
+ *
+ * @param in The input. Must not be NULL.
+ * @param buf The data. Can be NULL if len is 0.
+ * @param len The number of bytes in buf.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_NA if the module can only load files, or the error
+ *         returned by the module.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_input_send(struct sr_input *in, const void *buf, size_t len)
+{
+	if (!in || !in->format || (!buf && len)) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!in->format->receive || !in->format->end) {
+		sr_err("Input format '%s' can't be streamed.", in->format->id);
+		return SR_ERR_NA;
+	}
+
+	if (!len)
+		return SR_OK;
+
+	return in->format->receive(in, buf, len);
+}
+
+/**
+ * Finish the input passed in with sr_input_send(), and send SR_DF_END.
+ *
+ * This is also valid if no data was sent at all. The module must be
+ * initialized again before it can take more input.
+ *
+ * @param in The input. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_NA if the module can only load files, or the error
+ *         returned by the module.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_input_end(struct sr_input *in)
+{
+	if (!in || !in->format) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!in->format->receive || !in->format->end) {
+		sr_err("Input format '%s' can't be streamed.", in->format->id);
+		return SR_ERR_NA;
+	}
+
+	return in->format->end(in);
+}
+
+/**
+ * Find the input module for a file.
+ *
+ * The start of the file is read just once, and handed to all modules
+ * which can tell their format from it. Only modules without a
+ * format_match_header() callback check the file themselves. This is much
+ * faster than calling every module's format_match() in turn, which opens
+ * and reads the file each time, particularly on network filesystems.
+ *
+ * @param filename The name (and path) of the file. Must not be NULL.
+ *
+ * @return The first module in sr_input_list() order which can load the
+ *         file, or NULL if the file can't be read. The binary module takes
+ *         any file, so some module is always found otherwise.
+ *
+ * @since 0.3.0
+ */
+SR_API struct sr_input_format *sr_input_format_detect(const char *filename)
+{
+	struct sr_input_header header;
+	struct sr_input_format *format;
+	struct stat st;
+	uint8_t *buf;
+	char *name;
+	gzFile file;
+	int len, i;
+
+	if (!filename) {
+		sr_err("%s: filename was NULL", __func__);
+		return NULL;
+	}
+
+	if (g_stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) {
+		sr_err("Input file '%s' is not a regular file.", filename);
+		return NULL;
+	}
+
+	if (!(buf = g_try_malloc(HEADER_SIZE))) {
+		sr_err("%s: buf malloc failed", __func__);
+		return NULL;
+	}
+
+	/* This reads gzip compressed files decompressed, others as they are. */
+	if (!(file = gzopen(filename, "rb"))) {
+		sr_err("Failed to open '%s'.", filename);
+		g_free(buf);
+		return NULL;
+	}
+	len = gzread(file, buf, HEADER_SIZE);
+	gzclose(file);
+
+	/* Match compressed files by the name they decompress to. */
+	if (g_str_has_suffix(filename, ".gz"))
+		name = g_strndup(filename, strlen(filename) - 3);
+	else
+		name = g_strdup(filename);
+	header.filename = name;
+	header.buf = buf;
+	header.len = MAX(len, 0);
+	header.filesize = st.st_size;
+
+	format = NULL;
+	for (i = 0; input_module_list[i] && !format; i++) {
+		if (input_module_list[i]->format_match_header) {
+			if (input_module_list[i]->format_match_header(&header))
+				format = input_module_list[i];
+		} else if (input_module_list[i]->format_match(filename)) {
+			format = input_module_list[i];
+		}
+	}
+	g_free(buf);
+	g_free(name);
+
+	if (format)
+		sr_dbg("Detected format '%s' for '%s'.", format->id, filename);
+
+	return format;
+}
+
 /** @} */
+
+/* Whether a file starts with the gzip magic. */
+static gboolean gzip_magic(const uint8_t *data, uint64_t size)
+{
+	return size >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+}
+
+/**
+ * Check whether an input file is gzip compressed.
+ *
+ * @param filename The name (and path) of the file.
+ *
+ * @return TRUE if the file is gzip compressed, FALSE otherwise.
+ *
+ * @private
+ */
+SR_PRIV gboolean sr_input_file_compressed(const char *filename)
+{
+	uint8_t magic[2];
+	FILE *file;
+	size_t len;
+
+	if (!(file = g_fopen(filename, "rb")))
+		return FALSE;
+	len = fread(magic, 1, sizeof(magic), file);
+	fclose(file);
+
+	return gzip_magic(magic, len);
+}
+
+/*
+ * Decompress a gzip compressed file, of any number of gzip members
+ * one after the other, into a buffer of its own.
+ */
+static int file_inflate(struct sr_input_file *file, const char *filename)
+{
+	z_stream zs;
+	const uint8_t *in;
+	uint8_t *buf;
+	uint64_t in_left, size, len;
+	int ret;
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+		sr_err("Failed to start decompressing '%s'.", filename);
+		return SR_ERR;
+	}
+	in = file->data;
+	in_left = file->size;
+
+	size = len = 0;
+	for (;;) {
+		if (!zs.avail_in) {
+			zs.next_in = (Bytef *)in;
+			zs.avail_in = MIN(in_left, G_MAXUINT);
+			in += zs.avail_in;
+			in_left -= zs.avail_in;
+		}
+		if (len == size) {
+			size = MAX(INFLATE_MIN_SIZE, size * 2);
+			if (!(buf = g_try_realloc(file->buf, size))) {
+				sr_err("%s: buf malloc failed", __func__);
+				inflateEnd(&zs);
+				return SR_ERR_MALLOC;
+			}
+			file->buf = buf;
+		}
+		zs.next_out = file->buf + len;
+		zs.avail_out = MIN(size - len, G_MAXUINT);
+		ret = inflate(&zs, Z_NO_FLUSH);
+		len = zs.next_out - file->buf;
+		if (ret == Z_STREAM_END) {
+			if (!zs.avail_in && !in_left)
+				break;
+			/* Another member follows. */
+			inflateReset(&zs);
+		} else if (ret != Z_OK
+				&& !(ret == Z_BUF_ERROR && len == size)) {
+			sr_err("Failed to decompress '%s': %s.", filename,
+			       zs.msg ? zs.msg : "truncated data");
+			inflateEnd(&zs);
+			return SR_ERR;
+		}
+	}
+	inflateEnd(&zs);
+
+	file->data = file->buf;
+	file->size = len;
+
+	return SR_OK;
+}
+
+/**
+ * Open an input file to load it from memory.
+ *
+ * Input modules use this to take gzip compressed files as well as plain
+ * ones. A plain file is mapped into memory, a compressed one decompressed
+ * into memory in full.
+ *
+ * @param filename The name (and path) of the file.
+ *
+ * @return The file's contents, to be freed with sr_input_file_close(), or
+ *         NULL upon errors, which are logged.
+ *
+ * @private
+ */
+SR_PRIV struct sr_input_file *sr_input_file_open(const char *filename)
+{
+	struct sr_input_file *file;
+	GError *error;
+
+	if (!(file = g_try_malloc0(sizeof(struct sr_input_file)))) {
+		sr_err("%s: file malloc failed", __func__);
+		return NULL;
+	}
+
+	error = NULL;
+	if (!(file->mapped = g_mapped_file_new(filename, FALSE, &error))) {
+		sr_err("Input file '%s' could not be opened: %s.", filename,
+		       error->message);
+		g_error_free(error);
+		g_free(file);
+		return NULL;
+	}
+	file->data = (const uint8_t *)g_mapped_file_get_contents(file->mapped);
+	file->size = g_mapped_file_get_length(file->mapped);
+
+	if (gzip_magic(file->data, file->size)) {
+		if (file_inflate(file, filename) != SR_OK) {
+			sr_input_file_close(file);
+			return NULL;
+		}
+		g_mapped_file_unref(file->mapped);
+		file->mapped = NULL;
+	}
+
+	return file;
+}
+
+/**
+ * Free an input file opened with sr_input_file_open().
+ *
+ * @param file The file. May be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_input_file_close(struct sr_input_file *file)
+{
+	if (!file)
+		return;
+
+	if (file->mapped)
+		g_mapped_file_unref(file->mapped);
+	g_free(file->buf);
+	g_free(file);
+}
+
+/* Parse a window bound: a sample number, or a time such as "15ms". */
+static int window_bound(const char *str, uint64_t *samples, uint64_t *p,
+		uint64_t *q)
+{
+	*q = 0;
+	if (sr_parse_period(str, p, q) != SR_OK)
+		return SR_ERR_ARG;
+	if (!*q)
+		*samples = *p;
+
+	return SR_OK;
+}
+
+/**
+ * Set up the window of samples an input module sends.
+ *
+ * This parses the options all input modules take, from the input's
+ * parameters:
+ *
+ * start:       The first sample to send, as a sample number or a time
+ *              such as "2ms" from the first sample in the input.
+ * end:         The sample after the last one to send, likewise.
+ * probes:      A comma-separated list of the names of the probes to
+ *              send. All others are disabled.
+ * downsample:  Only send every n-th sample of the window, for a
+ *              samplerate divided by n.
+ *
+ * The module then sends its packets with sr_input_window_send(). Times
+ * need the samplerate, from sr_input_window_seek() or a META packet sent
+ * before the data.
+ *
+ * @param w The window to set up.
+ * @param in The input, with its device and probes created.
+ * @param downsample FALSE if the module handles "downsample" itself.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid options.
+ *
+ * @private
+ */
+SR_PRIV int sr_input_window_init(struct sr_input_window *w,
+		struct sr_input *in, gboolean downsample)
+{
+	struct sr_probe *probe;
+	const char *param;
+	char **names, *end;
+	GSList *l;
+	int i;
+
+	memset(w, 0, sizeof(*w));
+	w->end = G_MAXUINT64;
+	w->downsample = 1;
+
+	if (!in->param)
+		return SR_OK;
+
+	param = g_hash_table_lookup(in->param, "start");
+	if (param && window_bound(param, &w->start, &w->start_p,
+			&w->start_q) != SR_OK) {
+		sr_err("Invalid window start: %s.", param);
+		return SR_ERR_ARG;
+	}
+
+	param = g_hash_table_lookup(in->param, "end");
+	if (param && window_bound(param, &w->end, &w->end_p,
+			&w->end_q) != SR_OK) {
+		sr_err("Invalid window end: %s.", param);
+		return SR_ERR_ARG;
+	}
+
+	param = downsample ? g_hash_table_lookup(in->param, "downsample")
+			: NULL;
+	if (param) {
+		w->downsample = g_ascii_strtoull(param, &end, 10);
+		if (end == param || *end || !w->downsample) {
+			sr_err("Invalid downsample factor: %s.", param);
+			return SR_ERR_ARG;
+		}
+	}
+
+	param = g_hash_table_lookup(in->param, "probes");
+	if (!param)
+		return SR_OK;
+
+	names = g_strsplit(param, ",", 0);
+	for (i = 0; names[i]; i++) {
+		g_strstrip(names[i]);
+		for (l = in->sdi->probes; l; l = l->next) {
+			probe = l->data;
+			if (!strcmp(probe->name, names[i]))
+				break;
+		}
+		if (!l) {
+			sr_err("Unknown probe '%s'.", names[i]);
+			g_strfreev(names);
+			return SR_ERR_ARG;
+		}
+	}
+	for (l = in->sdi->probes; l; l = l->next) {
+		probe = l->data;
+		probe->enabled = FALSE;
+		for (i = 0; names[i]; i++)
+			if (!strcmp(probe->name, names[i]))
+				probe->enabled = TRUE;
+	}
+	g_strfreev(names);
+
+	return SR_OK;
+}
+
+/**
+ * Free what a window set up with sr_input_window_init() holds.
+ *
+ * @param w The window.
+ *
+ * @private
+ */
+SR_PRIV void sr_input_window_free(struct sr_input_window *w)
+{
+	g_free(w->buf);
+	g_free(w->aux);
+	g_free(w->raw);
+	g_free(w->columns);
+	w->buf = w->aux = w->raw = NULL;
+	w->columns = NULL;
+	w->buf_size = w->aux_size = w->raw_size = w->columns_size = 0;
+}
+
+/* The first sample at or after a time of p/q seconds. */
+static uint64_t time_to_samples(uint64_t p, uint64_t q, uint64_t samplerate)
+{
+	uint64_t n;
+	double r;
+
+	r = (double)(p % q) * samplerate / q;
+	n = (uint64_t)r;
+	if (n < r)
+		n++;
+
+	return p / q * samplerate + n;
+}
+
+/* Turn bounds given as times into sample numbers, once. */
+static void window_resolve(struct sr_input_window *w)
+{
+	if (w->resolved)
+		return;
+	w->resolved = TRUE;
+
+	if ((w->start_q || w->end_q) && !w->samplerate) {
+		sr_err("The samplerate is unknown, ignoring the window's "
+		       "times.");
+		if (w->start_q)
+			w->start = 0;
+		if (w->end_q)
+			w->end = G_MAXUINT64;
+		return;
+	}
+
+	if (w->start_q)
+		w->start = time_to_samples(w->start_p, w->start_q,
+				w->samplerate);
+	if (w->end_q)
+		w->end = time_to_samples(w->end_p, w->end_q, w->samplerate);
+}
+
+/**
+ * Find where an input module's data of the window starts.
+ *
+ * Modules which can seek in their input use this to skip everything
+ * before the window, and stop reading after it. The next samples they
+ * send must be the first of the window.
+ *
+ * @param w The window.
+ * @param samplerate The input's samplerate, or 0 if it isn't known.
+ * @param start The first sample to send.
+ * @param count The number of samples after it which can be of interest,
+ *              G_MAXUINT64 for up to the end.
+ *
+ * @private
+ */
+SR_PRIV void sr_input_window_seek(struct sr_input_window *w,
+		uint64_t samplerate, uint64_t *start, uint64_t *count)
+{
+	if (!w->resolved && samplerate)
+		w->samplerate = samplerate;
+	window_resolve(w);
+
+	w->logic_pos = w->analog_pos = w->start;
+	*start = w->start;
+	if (w->end == G_MAXUINT64)
+		*count = G_MAXUINT64;
+	else
+		*count = w->end > w->start ? w->end - w->start : 0;
+}
+
+/**
+ * Check whether all of the window has been sent.
+ *
+ * Modules which can't seek use this to stop parsing their input early.
+ * The logic and analog samples passed in are counted apart, whichever
+ * got further counts.
+ *
+ * @param w The window.
+ *
+ * @return TRUE if no more samples would be sent, FALSE otherwise.
+ *
+ * @private
+ */
+SR_PRIV gboolean sr_input_window_done(const struct sr_input_window *w)
+{
+	return w->resolved && w->end != G_MAXUINT64
+			&& MAX(w->logic_pos, w->analog_pos) >= w->end;
+}
+
+/* Make room for size bytes in one of the window's buffers. */
+static int window_buf(void **buf, uint64_t *buf_size, uint64_t size)
+{
+	void *p;
+
+	if (size <= *buf_size)
+		return SR_OK;
+
+	if (!(p = g_try_realloc(*buf, size))) {
+		sr_err("%s: buf malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	*buf = p;
+	*buf_size = size;
+
+	return SR_OK;
+}
+
+/*
+ * The samples of the window among n passed in from number pos on: the
+ * first one kept, as an offset from pos, and how many are kept. They are
+ * downsample samples apart.
+ */
+static void window_range(const struct sr_input_window *w, uint64_t pos,
+		uint64_t n, uint64_t *first, uint64_t *count)
+{
+	uint64_t a, b;
+
+	*first = *count = 0;
+	a = MAX(pos, w->start);
+	b = MIN(pos + n, w->end);
+	if (a >= b)
+		return;
+
+	/* Round up to the next sample kept. */
+	a += (w->downsample - (a - w->start) % w->downsample)
+			% w->downsample;
+	if (a >= b)
+		return;
+
+	*first = a - pos;
+	*count = (b - a - 1) / w->downsample + 1;
+}
+
+static int window_meta(struct sr_input_window *w,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_meta *meta;
+	struct sr_datafeed_packet out;
+	struct sr_datafeed_meta out_meta;
+	struct sr_config *src, *rate;
+	GSList *l;
+	uint64_t samplerate;
+	int ret;
+
+	meta = packet->payload;
+	src = NULL;
+	for (l = meta->config; l; l = l->next)
+		if (((struct sr_config *)l->data)->key == SR_CONF_SAMPLERATE)
+			src = l->data;
+	if (!src)
+		return sr_session_send(sdi, packet);
+
+	samplerate = g_variant_get_uint64(src->data);
+	if (!w->resolved)
+		w->samplerate = samplerate;
+	if (w->downsample == 1)
+		return sr_session_send(sdi, packet);
+
+	/* The samplerate sent is that of the samples kept. */
+	rate = sr_config_new(SR_CONF_SAMPLERATE,
+			g_variant_new_uint64(samplerate / w->downsample));
+	out_meta.config = NULL;
+	for (l = meta->config; l; l = l->next)
+		out_meta.config = g_slist_append(out_meta.config,
+				l->data == src ? rate : l->data);
+	out.type = SR_DF_META;
+	out.payload = &out_meta;
+	ret = sr_session_send(sdi, &out);
+	g_slist_free(out_meta.config);
+	sr_config_free(rate);
+
+	return ret;
+}
+
+static int window_logic(struct sr_input_window *w,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_logic *logic;
+	struct sr_datafeed_packet out;
+	struct sr_datafeed_logic out_logic;
+	const uint8_t *src;
+	uint8_t *dst;
+	uint64_t n, first, count, step, i;
+	int ret;
+
+	logic = packet->payload;
+	n = logic->length / logic->unitsize;
+	window_range(w, w->logic_pos, n, &first, &count);
+	w->logic_pos += n;
+	if (!count)
+		return SR_OK;
+	if (count == n)
+		return sr_session_send(sdi, packet);
+
+	out_logic = *logic;
+	out_logic.length = count * logic->unitsize;
+	src = (const uint8_t *)logic->data + first * logic->unitsize;
+	if (w->downsample == 1) {
+		/* A part of the packet is sent as it is. */
+		out_logic.data = (void *)src;
+	} else {
+		if ((ret = window_buf(&w->buf, &w->buf_size,
+				out_logic.length)) != SR_OK)
+			return ret;
+		dst = w->buf;
+		step = w->downsample * logic->unitsize;
+		for (i = 0; i < count; i++, src += step)
+			memcpy(dst + i * logic->unitsize, src,
+					logic->unitsize);
+		out_logic.data = dst;
+	}
+	out.type = SR_DF_LOGIC;
+	out.payload = &out_logic;
+
+	return sr_session_send(sdi, &out);
+}
+
+static int window_logic_rle(struct sr_input_window *w,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_logic_rle *rle;
+	struct sr_datafeed_packet out;
+	struct sr_datafeed_logic_rle out_rle;
+	const uint8_t *value;
+	uint8_t *values;
+	uint64_t *counts, pos, first, count, i;
+	int ret;
+
+	rle = packet->payload;
+	pos = w->logic_pos;
+	w->logic_pos += rle->num_samples;
+	if (w->downsample == 1 && pos >= w->start
+	    && w->logic_pos <= w->end)
+		return sr_session_send(sdi, packet);
+
+	if ((ret = window_buf(&w->buf, &w->buf_size,
+			rle->num_runs * rle->unitsize)) != SR_OK
+	    || (ret = window_buf(&w->aux, &w->aux_size,
+			rle->num_runs * sizeof(uint64_t))) != SR_OK)
+		return ret;
+	values = w->buf;
+	counts = w->aux;
+
+	/* Runs which are left with the same value are merged. */
+	out_rle = *rle;
+	out_rle.num_samples = out_rle.num_runs = 0;
+	for (i = 0; i < rle->num_runs && pos < w->end; i++) {
+		window_range(w, pos, rle->counts[i], &first, &count);
+		pos += rle->counts[i];
+		if (!count)
+			continue;
+		value = (const uint8_t *)rle->values + i * rle->unitsize;
+		if (out_rle.num_runs && !memcmp(values + (out_rle.num_runs
+				- 1) * rle->unitsize, value, rle->unitsize)) {
+			counts[out_rle.num_runs - 1] += count;
+		} else {
+			memcpy(values + out_rle.num_runs * rle->unitsize,
+					value, rle->unitsize);
+			counts[out_rle.num_runs++] = count;
+		}
+		out_rle.num_samples += count;
+	}
+	if (!out_rle.num_runs)
+		return SR_OK;
+
+	out_rle.values = values;
+	out_rle.counts = counts;
+	out.type = SR_DF_LOGIC_RLE;
+	out.payload = &out_rle;
+
+	return sr_session_send(sdi, &out);
+}
+
+static int window_analog(struct sr_input_window *w,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_analog *analog;
+	struct sr_datafeed_packet out;
+	struct sr_datafeed_analog out_analog;
+	struct sr_probe *probe;
+	const float *src;
+	float *dst;
+	GSList *l;
+	uint64_t n, first, count, i;
+	unsigned int num_probes, num_columns, j;
+	int ret;
+
+	analog = packet->payload;
+	n = analog->num_samples;
+	window_range(w, w->analog_pos, n, &first, &count);
+	w->analog_pos += n;
+	if (!count)
+		return SR_OK;
+
+	/* The values of the enabled probes are kept. */
+	num_probes = g_slist_length(analog->probes);
+	if ((ret = window_buf((void **)&w->columns, &w->columns_size,
+			num_probes * sizeof(unsigned int))) != SR_OK)
+		return ret;
+	out_analog = *analog;
+	out_analog.probes = NULL;
+	num_columns = 0;
+	for (l = analog->probes, j = 0; l; l = l->next, j++) {
+		probe = l->data;
+		if (!probe->enabled)
+			continue;
+		w->columns[num_columns++] = j;
+		out_analog.probes = g_slist_append(out_analog.probes, probe);
+	}
+	if (!num_columns)
+		return SR_OK;
+
+	out.type = SR_DF_ANALOG;
+	out.payload = &out_analog;
+	out_analog.num_samples = count;
+	src = analog->data + first * num_probes;
+	if (w->downsample == 1 && num_columns == num_probes) {
+		/* A part of the packet is sent as it is. */
+		g_slist_free(out_analog.probes);
+		if (count == n)
+			return sr_session_send(sdi, packet);
+		out_analog.probes = analog->probes;
+		out_analog.data = (float *)src;
+		if (analog->timestamps)
+			out_analog.timestamps = analog->timestamps + first;
+		return sr_session_send(sdi, &out);
+	}
+
+	if ((ret = window_buf(&w->buf, &w->buf_size,
+			count * num_columns * sizeof(float))) != SR_OK
+	    || (analog->timestamps && (ret = window_buf(&w->aux,
+			&w->aux_size, count * sizeof(int64_t))) != SR_OK)) {
+		g_slist_free(out_analog.probes);
+		return ret;
+	}
+	dst = w->buf;
+	for (i = 0; i < count; i++, src += w->downsample * num_probes)
+		for (j = 0; j < num_columns; j++)
+			*dst++ = src[w->columns[j]];
+	out_analog.data = w->buf;
+	if (analog->timestamps) {
+		out_analog.timestamps = w->aux;
+		for (i = 0; i < count; i++)
+			out_analog.timestamps[i] = analog->timestamps[first
+					+ i * w->downsample];
+	}
+	ret = sr_session_send(sdi, &out);
+	g_slist_free(out_analog.probes);
+
+	return ret;
+}
+
+static int window_analog_raw(struct sr_input_window *w,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_analog_raw *raw;
+	struct sr_datafeed_packet out;
+	struct sr_datafeed_analog_raw out_raw;
+	struct sr_datafeed_analog analog;
+	struct sr_probe *probe;
+	GSList *l;
+	uint64_t n, pos, first, count;
+	unsigned int num_probes;
+	gboolean all_enabled;
+	int size, ret;
+
+	raw = packet->payload;
+	n = raw->num_samples;
+	pos = w->analog_pos;
+	window_range(w, pos, n, &first, &count);
+	if (!count) {
+		w->analog_pos += n;
+		return SR_OK;
+	}
+
+	if (!(size = sr_analog_encoding_size(raw->encoding))) {
+		sr_err("Unknown analog encoding %d.", raw->encoding);
+		return SR_ERR_ARG;
+	}
+	num_probes = 0;
+	all_enabled = TRUE;
+	for (l = raw->probes; l; l = l->next, num_probes++) {
+		probe = l->data;
+		all_enabled &= probe->enabled;
+	}
+
+	/* Only the part of the raw samples sent is taken. */
+	out_raw = *raw;
+	out_raw.num_samples = (count - 1) * w->downsample + 1;
+	out_raw.data = (uint8_t *)raw->data + first * num_probes * size;
+	if (w->downsample == 1 && all_enabled) {
+		w->analog_pos += n;
+		if (count == n)
+			return sr_session_send(sdi, packet);
+		out.type = SR_DF_ANALOG_RAW;
+		out.payload = &out_raw;
+		return sr_session_send(sdi, &out);
+	}
+
+	/* Otherwise they are converted, for the values kept to be picked. */
+	if ((ret = window_buf(&w->raw, &w->raw_size, out_raw.num_samples
+			* num_probes * sizeof(float))) != SR_OK
+	    || (ret = sr_analog_raw_to_float(&out_raw, w->raw)) != SR_OK) {
+		w->analog_pos += n;
+		return ret;
+	}
+	memset(&analog, 0, sizeof(analog));
+	analog.probes = raw->probes;
+	analog.num_samples = out_raw.num_samples;
+	analog.mq = raw->mq;
+	analog.unit = raw->unit;
+	analog.mqflags = raw->mqflags;
+	analog.data = w->raw;
+	out.type = SR_DF_ANALOG;
+	out.payload = &analog;
+	w->analog_pos = pos + first;
+	ret = window_analog(w, sdi, &out);
+	w->analog_pos = pos + n;
+
+	return ret;
+}
+
+/**
+ * Send a packet of an input module to the session bus, cut to the
+ * window.
+ *
+ * Data packets only keep the window's samples, and values of enabled
+ * probes. Packets with none of them left aren't sent at all. META
+ * packets tell the samplerate of the samples kept. Other packets are sent
+ * as they are.
+ *
+ * @param w The window.
+ * @param sdi The input's device.
+ * @param packet The packet.
+ *
+ * @return SR_OK upon success, or an error code.
+ *
+ * @private
+ */
+SR_PRIV int sr_input_window_send(struct sr_input_window *w,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	switch (packet->type) {
+	case SR_DF_META:
+		return window_meta(w, sdi, packet);
+	case SR_DF_LOGIC:
+		window_resolve(w);
+		return window_logic(w, sdi, packet);
+	case SR_DF_LOGIC_RLE:
+		window_resolve(w);
+		return window_logic_rle(w, sdi, packet);
+	case SR_DF_ANALOG:
+		window_resolve(w);
+		return window_analog(w, sdi, packet);
+	case SR_DF_ANALOG_RAW:
+		window_resolve(w);
+		return window_analog_raw(w, sdi, packet);
+	default:
+		return sr_session_send(sdi, packet);
+	}
+}
@@ -19,8 +19,8 @@
 
 /* The VCD input module has the following options:
  *
- * numprobes:   Maximum number of probes to use. The probes are
- *              detected in the same order as they are listed
+ * numprobes:   Maximum number of probes to use, up to 1024. The probes
+ *              are detected in the same order as they are listed
  *              in the $var sections of the VCD file.
  *
  * skip:        Allows skipping until given timestamp in the file.
@@ -41,6 +41,14 @@
  *              This can speed up analyzing of long captures.
  *              Default 0 = don't compress.
  *
+ * threads:     Number of threads to parse the data section with. It is
+ *              split into blocks at timestamps, which are parsed in
+ *              parallel and sent in file order. The default is 1.
+ *
+ * The start, end and probes options of all input modules select the
+ * samples sent, counted after skip and downsample are applied, see
+ * sr_input_window_init(). Parsing stops at the end of the window.
+ *
  * Based on Verilog standard IEEE Std 1364-2001 Version C
  *
  * Supported features:
@@ -53,7 +61,6 @@
  * - analog, integer and real number variables
  * - $dumpvars initial value declaration
  * - $scope namespaces
- * - more than 64 probes
  */
 
 #include <stdlib.h>
@@ -66,15 +73,24 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "input/vcd: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 #define DEFAULT_NUM_PROBES 8
+#define MAX_PROBES 1024
 #define CHUNKSIZE 1024
 
+/* Amount of text parsed as one block, and the most threads doing so. */
+#define BLOCK_SIZE (4 * 1024 * 1024)
+#define MAX_THREADS 64
+
+/* Identifiers of one printable character are looked up directly. */
+#define SHORT_ID_FIRST '!'
+#define SHORT_ID_LAST '~'
+
 struct context {
 	uint64_t samplerate;
 	int maxprobes;
@@ -82,7 +98,22 @@ struct context {
 	int downsample;
 	unsigned compress;
 	int64_t skip;
+	gsize num_threads;
+	/* The timestamp the samples sent so far reach up to. */
+	uint64_t prev_timestamp;
 	GSList *probes;
+	/* Probe number + 1 of each one-character identifier, or 0. */
+	int short_ids[SHORT_ID_LAST - SHORT_ID_FIRST + 1];
+	/* Probe number + 1 of all longer identifiers. */
+	GHashTable *long_ids;
+	/* Bytes per sample, enough for maxprobes. */
+	int unitsize;
+	/* Runs of samples not sent yet, of unitsize bytes each. */
+	uint8_t *run_values;
+	uint64_t run_counts[CHUNKSIZE];
+	uint64_t num_samples;
+	unsigned int num_runs;
+	struct sr_input_window window;
 };
 
 struct probe {
@@ -90,84 +121,149 @@ struct probe {
 	gchar *identifier;
 };
 
+/* The part of the (memory-mapped) file still to be parsed. */
+struct reader {
+	const char *pos;
+	const char *end;
+};
+
+/* A part of the data section, see parse_contents(). */
+struct block {
+	struct context *ctx;
+	const struct sr_dev_inst *sdi;
+	struct reader r;
+	/* Whether the samples are sent right away, rather than collected. */
+	gboolean direct;
+	int64_t skip;
+	uint64_t first_timestamp;
+	uint64_t prev_timestamp;
+	/*
+	 * The current values, and which of them were set in the block so
+	 * far. The others are those at the end of the block before.
+	 */
+	uint8_t *values;
+	uint8_t *known;
+	gboolean known_changed;
+	/* Runs of samples, the first one up to the first timestamp. */
+	uint8_t *run_values;
+	uint64_t *run_counts;
+	uint64_t num_runs;
+	uint64_t max_runs;
+	/* The known values from the mark_runs[i]-th run on. */
+	uint64_t *mark_runs;
+	uint8_t *mark_known;
+	unsigned int num_marks;
+	GThread *thread;
+	int res;
+};
+
+/* Get the next whitespace-delimited token, FALSE at the end of the file. */
+static gboolean next_token(struct reader *r, const char **token, gsize *len)
+{
+	const char *p;
+
+	for (p = r->pos; p < r->end && g_ascii_isspace(*p); p++);
+	*token = p;
+	for (; p < r->end && !g_ascii_isspace(*p); p++);
+	*len = p - *token;
+	r->pos = p;
 
-/* Read until specific type of character occurs in file.
- * Skip input if dest is NULL.
- * Modes:
- * 'W' read until whitespace
- * 'N' read until non-whitespace, and ungetc() the character
- * '$' read until $end
+	return *len > 0;
+}
+
+static gboolean token_is(const char *token, gsize len, const char *str)
+{
+	return len == strlen(str) && !memcmp(token, str, len);
+}
+
+/*
+ * Skip past the next $end. If contents isn't NULL, it's set to whatever
+ * came before that.
  */
-static gboolean read_until(FILE *file, GString *dest, char mode)
+static gboolean skip_to_end(struct reader *r, const char **contents,
+		gsize *len)
 {
-	char prev[4] = "";
-	long startpos = ftell(file);
-	for(;;) {
-		int c = fgetc(file);
-
-		if (c == EOF) {
-			if (mode == '$')
-				sr_err("Unexpected EOF, read started at %ld.", startpos);
-			return FALSE;
-		}
-		
-		if (mode == 'W' && g_ascii_isspace(c))
-			return TRUE;
-		
-		if (mode == 'N' && !g_ascii_isspace(c)) {
-			ungetc(c, file);
-			return TRUE;
-		}
-		
-		if (mode == '$') {
-			prev[0] = prev[1]; prev[1] = prev[2]; prev[2] = prev[3]; prev[3] = c;
-			if (prev[0] == '$' && prev[1] == 'e' && prev[2] == 'n' && prev[3] == 'd') {
-				if (dest != NULL)
-					g_string_truncate(dest, dest->len - 3);
-					
-				return TRUE;
-			}
-		}
+	const char *p;
 
-		if (dest != NULL)
-			g_string_append_c(dest, c);
+	for (p = r->pos; (p = memchr(p, '$', r->end - p)); p++) {
+		if (r->end - p >= 4 && !memcmp(p, "$end", 4))
+			break;
+	}
+	if (!p) {
+		sr_err("Unexpected end of file, missing $end.");
+		return FALSE;
 	}
+
+	if (contents) {
+		*contents = r->pos;
+		*len = p - r->pos;
+	}
+	r->pos = p + 4;
+
+	return TRUE;
 }
 
 /*
  * Reads a single VCD section from input file and parses it to structure.
  * e.g. $timescale 1ps $end  => "timescale" "1ps"
  */
-static gboolean parse_section(FILE *file, gchar **name, gchar **contents)
+static gboolean parse_section(struct reader *r, gchar **name, gchar **contents)
 {
-	gboolean status;
-	GString *sname, *scontents;
-	
-	/* Skip any initial white-space */
-	if (!read_until(file, NULL, 'N')) return FALSE;
-	
+	const char *token, *text;
+	gsize len, text_len;
+
+	if (!next_token(r, &token, &len))
+		return FALSE;
+
 	/* Section tag should start with $. */
-	if (fgetc(file) != '$') {
+	if (*token != '$') {
 		sr_err("Expected $ at beginning of section.");
 		return FALSE;
 	}
-	
-	/* Read the section tag */	
-	sname = g_string_sized_new(32);
-	status = read_until(file, sname, 'W');
-	
-	/* Skip whitespace before content */
-	status = status && read_until(file, NULL, 'N');
-	
-	/* Read the content */
-	scontents = g_string_sized_new(128);
-	status = status && read_until(file, scontents, '$');
-	g_strchomp(scontents->str);
-
-	/* Release strings if status is FALSE, return them if status is TRUE */	
-	*name = g_string_free(sname, !status);
-	*contents = g_string_free(scontents, !status);
-	return status;
+
+	if (!skip_to_end(r, &text, &text_len))
+		return FALSE;
+
+	*name = g_strndup(token + 1, len - 1);
+	*contents = g_strstrip(g_strndup(text, text_len));
+
+	return TRUE;
+}
+
+/* Look up the probe an identifier stands for, -1 if there is none. */
+static int probe_lookup(const struct context *ctx, const char *id, gsize len)
+{
+	char buf[64];
+	gchar *key;
+	int index;
+
+	if (len == 1 && id[0] >= SHORT_ID_FIRST && id[0] <= SHORT_ID_LAST)
+		return ctx->short_ids[id[0] - SHORT_ID_FIRST] - 1;
+
+	if (len < sizeof(buf)) {
+		memcpy(buf, id, len);
+		buf[len] = '\0';
+		return GPOINTER_TO_INT(g_hash_table_lookup(ctx->long_ids, buf)) - 1;
+	}
+
+	key = g_strndup(id, len);
+	index = GPOINTER_TO_INT(g_hash_table_lookup(ctx->long_ids, key)) - 1;
+	g_free(key);
+
+	return index;
+}
+
+/* Make an identifier stand for a probe, unless it already has one. */
+static void probe_id_add(struct context *ctx, const char *id, int index)
+{
+	if (probe_lookup(ctx, id, strlen(id)) >= 0)
+		return;
+
+	if (strlen(id) == 1 && id[0] >= SHORT_ID_FIRST && id[0] <= SHORT_ID_LAST)
+		ctx->short_ids[id[0] - SHORT_ID_FIRST] = index + 1;
+	else
+		g_hash_table_insert(ctx->long_ids, g_strdup(id),
+				GINT_TO_POINTER(index + 1));
 }
 
 static void free_probe(void *data)
@@ -181,6 +277,10 @@ static void free_probe(void *data)
 static void release_context(struct context *ctx)
 {
 	g_slist_free_full(ctx->probes, free_probe);
+	if (ctx->long_ids)
+		g_hash_table_destroy(ctx->long_ids);
+	g_free(ctx->run_values);
+	sr_input_window_free(&ctx->window);
 	g_free(ctx);
 }
 
@@ -202,14 +302,14 @@ static void remove_empty_parts(gchar **parts)
  * Parse VCD header to get values for context structure.
  * The context structure should be zeroed before calling this.
  */
-static gboolean parse_header(FILE *file, struct context *ctx)
+static gboolean parse_header(struct reader *r, struct context *ctx)
 {
 	uint64_t p, q;
 	gchar *name = NULL, *contents = NULL;
 	gboolean status = FALSE;
 	struct probe *probe;
 
-	while (parse_section(file, &name, &contents)) {
+	while (parse_section(r, &name, &contents)) {
 		sr_dbg("Section '%s', contents '%s'.", name, contents);
 	
 		if (g_strcmp0(name, "enddefinitions") == 0) {
@@ -251,6 +351,7 @@ static gboolean parse_header(FILE *file, struct context *ctx)
 				probe->identifier = g_strdup(parts[2]);
 				probe->name = g_strdup(parts[3]);
 				ctx->probes = g_slist_append(ctx->probes, probe);
+				probe_id_add(ctx, parts[2], ctx->probecount);
 				ctx->probecount++;
 			}
 			
@@ -267,30 +368,46 @@ static gboolean parse_header(FILE *file, struct context *ctx)
 	return status;
 }
 
-static int format_match(const char *filename)
+/*
+ * If we can parse the first section correctly,
+ * then it is assumed to be a VCD file.
+ */
+static gboolean match_data(const char *data, gsize len)
 {
-	FILE *file;
+	struct reader r;
 	gchar *name = NULL, *contents = NULL;
 	gboolean status;
-	
-	file = fopen(filename, "r");
-	if (file == NULL)
-		return FALSE;
 
-	/*
-	 * If we can parse the first section correctly,
-	 * then it is assumed to be a VCD file.
-	 */
-	status = parse_section(file, &name, &contents);
+	r.pos = data;
+	r.end = data + len;
+	status = parse_section(&r, &name, &contents);
 	status = status && (*name != '\0');
-	
+
 	g_free(name);
 	g_free(contents);
-	fclose(file);
-	
+
 	return status;
 }
 
+static int format_match(const char *filename)
+{
+	struct sr_input_file *file;
+	gboolean status;
+
+	if (!(file = sr_input_file_open(filename)))
+		return FALSE;
+	status = match_data((const char *)file->data, file->size);
+	sr_input_file_close(file);
+
+	return status;
+}
+
+/* The first section is short, it's within the header of any VCD file. */
+static int format_match_header(const struct sr_input_header *header)
+{
+	return match_data((const char *)header->buf, header->len);
+}
+
 static int init(struct sr_input *in, const char *filename)
 {
 	struct sr_probe *probe;
@@ -307,9 +424,12 @@ static int init(struct sr_input *in, const char *filename)
 	}
 
 	num_probes = DEFAULT_NUM_PROBES;
+	ctx->long_ids = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
 	ctx->samplerate = 0;
 	ctx->downsample = 1;
 	ctx->skip = -1;
+	ctx->num_threads = 1;
 
 	if (in->param) {
 		param = g_hash_table_lookup(in->param, "numprobes");
@@ -318,8 +438,10 @@ static int init(struct sr_input *in, const char *filename)
 			if (num_probes < 1) {
 				release_context(ctx);
 				return SR_ERR;
-			} else if (num_probes > 64) {
-				sr_err("No more than 64 probes supported.");
+			} else if (num_probes > MAX_PROBES) {
+				sr_err("No more than %d probes supported.",
+				       MAX_PROBES);
+				release_context(ctx);
 				return SR_ERR;
 			}
 		}
@@ -338,10 +460,22 @@ static int init(struct sr_input *in, const char *filename)
 		param = g_hash_table_lookup(in->param, "skip");
 		if (param)
 			ctx->skip = strtoul(param, NULL, 10) / ctx->downsample;
+
+		param = g_hash_table_lookup(in->param, "threads");
+		if (param) {
+			ctx->num_threads = g_ascii_strtoull(param, NULL, 10);
+			if (ctx->num_threads < 1
+			    || ctx->num_threads > MAX_THREADS) {
+				sr_err("Invalid number of threads: %s.", param);
+				release_context(ctx);
+				return SR_ERR_ARG;
+			}
+		}
 	}
 	
 	/* Maximum number of probes to parse from the VCD */
 	ctx->maxprobes = num_probes;
+	ctx->unitsize = (num_probes + 7) / 8;
 
 	/* Create a virtual device. */
 	in->sdi = sr_dev_inst_new(0, SR_ST_ACTIVE, NULL, NULL, NULL);
@@ -358,145 +492,415 @@ static int init(struct sr_input *in, const char *filename)
 		in->sdi->probes = g_slist_append(in->sdi->probes, probe);
 	}
 
+	/* The module divides the timestamps for downsampling itself. */
+	if (sr_input_window_init(&ctx->window, in, FALSE) != SR_OK) {
+		release_context(ctx);
+		in->internal = NULL;
+		return SR_ERR_ARG;
+	}
+
 	return SR_OK;
 }
 
-/* Send N samples of the given value. */
-static void send_samples(const struct sr_dev_inst *sdi, uint64_t sample, uint64_t count)
+/* Send the collected runs of samples to the session bus. */
+static void flush_samples(const struct sr_dev_inst *sdi, struct context *ctx)
 {
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_logic logic;
-	uint64_t buffer[CHUNKSIZE];
-	uint64_t i;
-	unsigned chunksize = CHUNKSIZE;
-		
-	if (count < chunksize)
-		chunksize = count;
+	struct sr_datafeed_logic_rle rle;
+
+	if (!ctx->num_runs)
+		return;
+
+	packet.type = SR_DF_LOGIC_RLE;
+	packet.payload = &rle;
+	rle.num_samples = ctx->num_samples;
+	rle.num_runs = ctx->num_runs;
+	rle.unitsize = ctx->unitsize;
+	rle.values = ctx->run_values;
+	rle.counts = ctx->run_counts;
+	sr_input_window_send(&ctx->window, sdi, &packet);
+
+	ctx->num_samples = 0;
+	ctx->num_runs = 0;
+}
 
-	for (i = 0; i < chunksize; i++)
-		buffer[i] = sample;
-	
-	packet.type = SR_DF_LOGIC;
-	packet.payload = &logic;	
-	logic.unitsize = sizeof(uint64_t);
-	logic.data = buffer;
-	
-	while (count) {
-		if (count < chunksize)
-			chunksize = count;
-	
-		logic.length = sizeof(uint64_t) * chunksize;
-	
-		sr_session_send(sdi, &packet);
-		count -= chunksize;
+/* Add count samples of the given value, as a run of their own. */
+static void send_samples(const struct sr_dev_inst *sdi, struct context *ctx,
+		const uint8_t *sample, uint64_t count)
+{
+	uint8_t *last;
+
+	if (!count)
+		return;
+
+	last = ctx->run_values + ctx->num_runs * ctx->unitsize;
+	if (ctx->num_runs && !memcmp(last - ctx->unitsize, sample, ctx->unitsize)) {
+		ctx->run_counts[ctx->num_runs - 1] += count;
+	} else {
+		if (ctx->num_runs == CHUNKSIZE) {
+			flush_samples(sdi, ctx);
+			last = ctx->run_values;
+		}
+		memcpy(last, sample, ctx->unitsize);
+		ctx->run_counts[ctx->num_runs] = count;
+		ctx->num_runs++;
 	}
+	ctx->num_samples += count;
 }
 
-/* Parse the data section of VCD */
-static void parse_contents(FILE *file, const struct sr_dev_inst *sdi, struct context *ctx)
+/*
+ * Number of samples up to a new timestamp, from the one before it at
+ * *prev, which is updated.
+ *
+ * Skip < 0 => skip until first timestamp.
+ * Skip = 0 => don't skip
+ * Skip > 0 => skip until timestamp >= skip.
+ */
+static uint64_t timestamp_samples(const struct context *ctx, int64_t *skip,
+		uint64_t *prev, uint64_t timestamp)
 {
-	GString *token = g_string_sized_new(32);
-	
-	uint64_t prev_timestamp = 0;
-	uint64_t prev_values = 0;
-	
+	uint64_t count;
+
+	if (*skip < 0) {
+		*skip = timestamp;
+		*prev = timestamp;
+		return 0;
+	} else if (*skip > 0 && timestamp < (uint64_t)*skip) {
+		*prev = *skip;
+		return 0;
+	} else if (timestamp == *prev) {
+		/* Ignore repeated timestamps (e.g. sigrok outputs these) */
+		return 0;
+	}
+
+	if (ctx->compress != 0 && timestamp - *prev > ctx->compress) {
+		/* Compress long idle periods */
+		*prev = timestamp - ctx->compress;
+	}
+
+	sr_spew("New timestamp: %" PRIu64, timestamp);
+
+	/* Generate samples from prev_timestamp up to timestamp - 1. */
+	count = timestamp - *prev;
+	*prev = timestamp;
+
+	return count;
+}
+
+/*
+ * Find where a block of about BLOCK_SIZE bytes from pos ends: at the next
+ * timestamp after that, or the end of the data. A '#' which starts a
+ * token within a $comment would be taken for one; simulators don't write
+ * those.
+ */
+static const char *block_end(const char *pos, const char *end)
+{
+	const char *p;
+
+	if (end - pos <= BLOCK_SIZE)
+		return end;
+
+	for (p = pos + BLOCK_SIZE; (p = memchr(p, '#', end - p)); p++) {
+		if (p + 1 < end && g_ascii_isdigit(p[1])
+		    && g_ascii_isspace(p[-1]))
+			return p;
+	}
+
+	return end;
+}
+
+/* Add count samples of the current values, as a run of their own. */
+static int block_add_run(struct block *b, uint64_t count)
+{
+	struct context *ctx;
+	uint8_t *values;
+	uint64_t *counts;
+
+	ctx = b->ctx;
+	if (b->direct) {
+		send_samples(b->sdi, ctx, b->values, count);
+		return SR_OK;
+	}
+
+	/* Only the first run, up to the first timestamp, starts empty. */
+	if (!count && b->num_runs)
+		return SR_OK;
+
+	if (b->num_runs && !b->known_changed && !memcmp(b->run_values
+			+ (b->num_runs - 1) * ctx->unitsize, b->values,
+			ctx->unitsize)) {
+		b->run_counts[b->num_runs - 1] += count;
+		return SR_OK;
+	}
+
+	if (b->num_runs == b->max_runs) {
+		b->max_runs = MAX(b->max_runs * 2, CHUNKSIZE);
+		if (!(values = g_try_realloc(b->run_values,
+				b->max_runs * ctx->unitsize))) {
+			sr_err("%s: run_values malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		b->run_values = values;
+		if (!(counts = g_try_realloc(b->run_counts,
+				b->max_runs * sizeof(uint64_t)))) {
+			sr_err("%s: run_counts malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		b->run_counts = counts;
+	}
+
+	if (b->known_changed) {
+		b->mark_runs[b->num_marks] = b->num_runs;
+		memcpy(b->mark_known + b->num_marks * ctx->unitsize,
+				b->known, ctx->unitsize);
+		b->num_marks++;
+		b->known_changed = FALSE;
+	}
+	memcpy(b->run_values + b->num_runs * ctx->unitsize, b->values,
+			ctx->unitsize);
+	b->run_counts[b->num_runs++] = count;
+
+	return SR_OK;
+}
+
+/* Parse a block of the data section of VCD */
+static int parse_block(struct block *b)
+{
+	struct context *ctx;
+	const char *token, *id;
+	gsize len, id_len, i;
+	uint64_t timestamp;
+	int index, bit, ret;
+
+	ctx = b->ctx;
+
 	/* Read one space-delimited token at a time. */
-	while (read_until(file, NULL, 'N') && read_until(file, token, 'W')) {
-		if (token->str[0] == '#' && g_ascii_isdigit(token->str[1])) {
+	while (next_token(&b->r, &token, &len)) {
+		if (token[0] == '#' && len > 1 && g_ascii_isdigit(token[1])) {
+			/* Nothing after the end of the window is sent. */
+			if (b->direct && sr_input_window_done(&ctx->window))
+				break;
+
 			/* Numeric value beginning with # is a new timestamp value */
-			uint64_t timestamp;
-			timestamp = strtoull(token->str + 1, NULL, 10);
-			
+			timestamp = 0;
+			for (i = 1; i < len && g_ascii_isdigit(token[i]); i++)
+				timestamp = timestamp * 10 + token[i] - '0';
+
 			if (ctx->downsample > 1)
 				timestamp /= ctx->downsample;
-			
+
 			/*
-			 * Skip < 0 => skip until first timestamp.
-			 * Skip = 0 => don't skip
-			 * Skip > 0 => skip until timestamp >= skip.
+			 * The samples up to a block's first timestamp are
+			 * counted once the block before it is done.
 			 */
-			if (ctx->skip < 0) {
-				ctx->skip = timestamp;
-				prev_timestamp = timestamp;
-			} else if (ctx->skip > 0 && timestamp < (uint64_t)ctx->skip) {
-				prev_timestamp = ctx->skip;
+			if (!b->direct && !b->num_runs) {
+				b->first_timestamp = timestamp;
+				b->prev_timestamp = timestamp;
 			}
-			else if (timestamp == prev_timestamp) {
-				/* Ignore repeated timestamps (e.g. sigrok outputs these) */
-			}
-			else {
-				if (ctx->compress != 0 && timestamp - prev_timestamp > ctx->compress)
-				{
-					/* Compress long idle periods */
-					prev_timestamp = timestamp - ctx->compress;
-				}
-			
-				sr_dbg("New timestamp: %" PRIu64, timestamp);
-			
-				/* Generate samples from prev_timestamp up to timestamp - 1. */
-				send_samples(sdi, prev_values, timestamp - prev_timestamp);
-				prev_timestamp = timestamp;
-			}
-		} else if (token->str[0] == '$' && token->len > 1) {
+			ret = block_add_run(b, timestamp_samples(ctx, &b->skip,
+					&b->prev_timestamp, timestamp));
+			if (ret != SR_OK)
+				return ret;
+		} else if (token[0] == '$' && len > 1) {
 			/* This is probably a $dumpvars, $comment or similar.
 			 * $dump* contain useful data, but other tags will be skipped until $end. */
-			if (g_strcmp0(token->str, "$dumpvars") == 0
-					|| g_strcmp0(token->str, "$dumpon") == 0
-					|| g_strcmp0(token->str, "$dumpoff") == 0
-					|| g_strcmp0(token->str, "$end") == 0) {
+			if (token_is(token, len, "$dumpvars")
+					|| token_is(token, len, "$dumpon")
+					|| token_is(token, len, "$dumpoff")
+					|| token_is(token, len, "$end")) {
 				/* Ignore, parse contents as normally. */
-			} else {
-				/* Skip until $end */
-				read_until(file, NULL, '$');
+			} else if (!skip_to_end(&b->r, NULL, NULL)) {
+				break;
 			}
 		}
-		else if (strchr("bBrR", token->str[0]) != NULL) {
+		else if (strchr("bBrR", token[0]) != NULL) {
 			/* A vector value. Skip it and also the following identifier. */
-			read_until(file, NULL, 'N');
-			read_until(file, NULL, 'W');
-		} else if (strchr("01xXzZ", token->str[0]) != NULL) {
+			next_token(&b->r, &token, &len);
+		} else if (strchr("01xXzZ", token[0]) != NULL) {
 			/* A new 1-bit sample value */
-			int i, bit;
-			GSList *l;
-			struct probe *probe;
-
-			bit = (token->str[0] == '1');
-		
-			g_string_erase(token, 0, 1);
-			if (token->len == 0) {
+			id = token + 1;
+			id_len = len - 1;
+			if (id_len == 0) {
 				/* There was a space between value and identifier.
 				 * Read in the rest.
 				 */
-				read_until(file, NULL, 'N');
-				read_until(file, token, 'W');
+				if (!next_token(&b->r, &id, &id_len))
+					break;
 			}
-			
-			for (i = 0, l = ctx->probes; i < ctx->probecount && l; i++, l = l->next) {
-				probe = l->data;
 
-				if (g_strcmp0(token->str, probe->identifier) == 0) {
-					sr_dbg("Probe %d new value %d.", i, bit);
-				
-					/* Found our probe */
-					if (bit)
-						prev_values |= (1 << i);
-					else
-						prev_values &= ~(1 << i);
-					
-					break;
-				}
+			if ((index = probe_lookup(ctx, id, id_len)) < 0) {
+				sr_dbg("Did not find probe for identifier '%.*s'.",
+				       (int)id_len, id);
+				continue;
+			}
+
+			bit = 1 << (index % 8);
+			if (token[0] == '1')
+				b->values[index / 8] |= bit;
+			else
+				b->values[index / 8] &= ~bit;
+			if (!(b->known[index / 8] & bit)) {
+				b->known[index / 8] |= bit;
+				b->known_changed = TRUE;
 			}
-			
-			if (i == ctx->probecount)
-				sr_dbg("Did not find probe for identifier '%s'.", token->str);
 		} else {
-			sr_warn("Skipping unknown token '%s'.", token->str);
+			sr_warn("Skipping unknown token '%.*s'.", (int)len, token);
 		}
-		
-		g_string_truncate(token, 0);
 	}
-	
-	g_string_free(token, TRUE);
+
+	return SR_OK;
+}
+
+static gpointer parse_thread(gpointer data)
+{
+	struct block *b;
+
+	b = data;
+	b->res = parse_block(b);
+
+	return NULL;
+}
+
+/*
+ * Send the runs of a block parsed in parallel. The values it didn't set
+ * are those at the end of the block before, in state, which is updated
+ * to the values at the end of this block.
+ */
+static void send_block(struct context *ctx, struct block *b,
+		uint8_t *state, uint8_t *sample)
+{
+	const uint8_t *known, *value;
+	unsigned int m;
+	uint64_t i;
+	int j;
+
+	if (b->num_runs) {
+		b->run_counts[0] += timestamp_samples(ctx, &ctx->skip,
+				&ctx->prev_timestamp, b->first_timestamp);
+		ctx->prev_timestamp = b->prev_timestamp;
+	}
+
+	known = NULL;
+	m = 0;
+	for (i = 0; i < b->num_runs; i++) {
+		if (m < b->num_marks && b->mark_runs[m] == i)
+			known = b->mark_known + m++ * ctx->unitsize;
+		value = b->run_values + i * ctx->unitsize;
+		for (j = 0; j < ctx->unitsize; j++) {
+			if (known)
+				sample[j] = (value[j] & known[j])
+						| (state[j] & ~known[j]);
+			else
+				sample[j] = state[j];
+		}
+		send_samples(b->sdi, ctx, sample, b->run_counts[i]);
+	}
+
+	for (j = 0; j < ctx->unitsize; j++)
+		state[j] = (b->values[j] & b->known[j])
+				| (state[j] & ~b->known[j]);
+}
+
+static void free_blocks(struct block *blocks, gsize num_blocks)
+{
+	gsize i;
+
+	for (i = 0; i < num_blocks; i++) {
+		g_free(blocks[i].values);
+		g_free(blocks[i].known);
+		g_free(blocks[i].run_values);
+		g_free(blocks[i].run_counts);
+		g_free(blocks[i].mark_runs);
+		g_free(blocks[i].mark_known);
+	}
+	g_free(blocks);
+}
+
+/*
+ * Parse the data section of VCD. With more than one thread, each round
+ * hands a block, which starts at a timestamp, to every thread. They are
+ * parsed in parallel, without knowing the values at their start, and
+ * sent in file order with those filled in.
+ */
+static int parse_contents(struct reader *r, const struct sr_dev_inst *sdi,
+		struct context *ctx)
+{
+	struct block *blocks, *b;
+	uint8_t *state, *sample;
+	gsize i, n;
+	int ret;
+
+	blocks = g_try_new0(struct block, ctx->num_threads);
+	state = g_try_malloc0(ctx->unitsize);
+	sample = g_try_malloc(ctx->unitsize);
+	ret = blocks && state && sample ? SR_OK : SR_ERR_MALLOC;
+	for (i = 0; ret == SR_OK && i < ctx->num_threads; i++) {
+		b = &blocks[i];
+		b->ctx = ctx;
+		b->sdi = sdi;
+		b->direct = ctx->num_threads == 1;
+		b->values = g_try_malloc0(ctx->unitsize);
+		b->known = g_try_malloc0(ctx->unitsize);
+		b->mark_runs = g_try_new(uint64_t, ctx->maxprobes);
+		b->mark_known = g_try_malloc(ctx->maxprobes * ctx->unitsize);
+		if (!b->values || !b->known || !b->mark_runs || !b->mark_known)
+			ret = SR_ERR_MALLOC;
+	}
+	if (ret != SR_OK) {
+		sr_err("%s: blocks malloc failed", __func__);
+		if (blocks)
+			free_blocks(blocks, ctx->num_threads);
+		g_free(state);
+		g_free(sample);
+		return ret;
+	}
+
+	/* On its own, a block takes all of the data, its values known. */
+	if (blocks[0].direct)
+		memset(blocks[0].known, 0xff, ctx->unitsize);
+
+	while (ret == SR_OK && r->pos < r->end
+	    && !sr_input_window_done(&ctx->window)) {
+		for (n = 0; n < ctx->num_threads && r->pos < r->end; n++) {
+			b = &blocks[n];
+			b->r.pos = r->pos;
+			b->r.end = b->direct ? r->end
+					: block_end(r->pos, r->end);
+			r->pos = b->r.end;
+			b->skip = ctx->skip;
+			b->prev_timestamp = ctx->prev_timestamp;
+			b->num_runs = 0;
+			b->num_marks = 0;
+			b->known_changed = FALSE;
+
+			b->thread = NULL;
+			if (!b->direct) {
+				memset(b->known, 0, ctx->unitsize);
+				b->thread = g_thread_try_new("sr-vcd",
+						parse_thread, b, NULL);
+			}
+			if (!b->thread)
+				b->res = parse_block(b);
+		}
+
+		for (i = 0; i < n; i++) {
+			b = &blocks[i];
+			if (b->thread)
+				g_thread_join(b->thread);
+			if (ret != SR_OK)
+				continue;
+			if ((ret = b->res) == SR_OK && !b->direct)
+				send_block(ctx, b, state, sample);
+		}
+	}
+
+	flush_samples(sdi, ctx);
+
+	free_blocks(blocks, ctx->num_threads);
+	g_free(state);
+	g_free(sample);
+
+	return ret;
 }
 
 static int loadfile(struct sr_input *in, const char *filename)
@@ -504,51 +908,63 @@ static int loadfile(struct sr_input *in, const char *filename)
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_meta meta;
 	struct sr_config *src;
-	FILE *file;
+	struct sr_input_file *file;
+	struct reader r;
 	struct context *ctx;
 	uint64_t samplerate;
+	int ret;
 
 	ctx = in->internal;
 
-	if ((file = fopen(filename, "r")) == NULL)
+	if (!(file = sr_input_file_open(filename)))
 		return SR_ERR;
+	r.pos = (const char *)file->data;
+	r.end = r.pos + file->size;
 
-	if (!parse_header(file, ctx)) {
+	if (!parse_header(&r, ctx)) {
 		sr_err("VCD parsing failed");
-		fclose(file);
+		sr_input_file_close(file);
 		return SR_ERR;
 	}
 
+	if (!(ctx->run_values = g_try_malloc(CHUNKSIZE * ctx->unitsize))) {
+		sr_err("%s: run_values malloc failed", __func__);
+		sr_input_file_close(file);
+		return SR_ERR_MALLOC;
+	}
+
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(in->sdi, LOG_PREFIX);
 
-	/* Send metadata about the SR_DF_LOGIC packets to come. */
+	/* Send metadata about the SR_DF_LOGIC_RLE packets to come. */
 	packet.type = SR_DF_META;
 	packet.payload = &meta;
 	samplerate = ctx->samplerate / ctx->downsample;
 	src = sr_config_new(SR_CONF_SAMPLERATE, g_variant_new_uint64(samplerate));
 	meta.config = g_slist_append(NULL, src);
-	sr_session_send(in->sdi, &packet);
+	sr_input_window_send(&ctx->window, in->sdi, &packet);
+	g_slist_free(meta.config);
 	sr_config_free(src);
 
 	/* Parse the contents of the VCD file */
-	parse_contents(file, in->sdi, ctx);
-	
+	ret = parse_contents(&r, in->sdi, ctx);
+
 	/* Send end packet to the session bus. */
 	packet.type = SR_DF_END;
 	sr_session_send(in->sdi, &packet);
 
-	fclose(file);
+	sr_input_file_close(file);
 	release_context(ctx);
 	in->internal = NULL;
 
-	return SR_OK;
+	return ret;
 }
 
 SR_PRIV struct sr_input_format input_vcd = {
 	.id = "vcd",
 	.description = "Value Change Dump",
 	.format_match = format_match,
+	.format_match_header = format_match_header,
 	.init = init,
 	.loadfile = loadfile,
 };
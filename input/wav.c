@@ -22,111 +22,258 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <glib.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "input/wav: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
-#define CHUNK_SIZE 4096
+/* Number of values (samples times channels) sent per packet. */
+#define CHUNK_SIZE (256 * 1024)
+
+/* How much of the file format_match() and init() look at. */
+#define HEADER_SIZE 4096
+
+#define MAX_CHANNELS 20
+
+/* Values of the format tag of the "fmt " chunk. */
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_IEEE_FLOAT  0x0003
+#define WAVE_FORMAT_EXTENSIBLE  0xfffe
 
 struct context {
 	uint64_t samplerate;
+	/* Bytes per value, and values per sample (one for each channel). */
 	int samplesize;
 	int num_channels;
+	gboolean is_float;
+	/* Where the "data" chunk's contents are in the file. */
+	uint64_t data_offset;
+	uint64_t data_size;
+	struct sr_input_window window;
 };
 
-static int get_wav_header(const char *filename, char *buf)
+static inline uint16_t le16(const uint8_t *p)
 {
-	struct stat st;
-	int fd, l;
+	return p[0] | p[1] << 8;
+}
 
-	l = strlen(filename);
-	if (l <= 4 || strcasecmp(filename + l - 4, ".wav"))
+static inline uint32_t le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+			| (uint32_t)p[3] << 24;
+}
+
+static int parse_fmt(const uint8_t *fmt, uint32_t size, struct context *ctx)
+{
+	int format, bits;
+
+	if (size < 16) {
+		sr_dbg("Short fmt chunk.");
 		return SR_ERR;
+	}
 
-	if (stat(filename, &st) == -1)
+	format = le16(fmt);
+	if (format == WAVE_FORMAT_EXTENSIBLE) {
+		/* The actual format is in the first bytes of the GUID. */
+		if (size < 40) {
+			sr_dbg("Short extensible fmt chunk.");
+			return SR_ERR;
+		}
+		format = le16(fmt + 24);
+	}
+	if (format != WAVE_FORMAT_PCM && format != WAVE_FORMAT_IEEE_FLOAT) {
+		sr_dbg("Unsupported format %d.", format);
+		return SR_ERR;
+	}
+
+	ctx->is_float = (format == WAVE_FORMAT_IEEE_FLOAT);
+	ctx->num_channels = le16(fmt + 2);
+	ctx->samplerate = le32(fmt + 4);
+	bits = le16(fmt + 14);
+	ctx->samplesize = (bits + 7) / 8;
+
+	if (ctx->is_float && ctx->samplesize != 4) {
+		sr_err("Only 32-bit floating point samples are supported.");
 		return SR_ERR;
-	if (st.st_size <= 45)
-		/* Minimum size of header + 1 8-bit mono PCM sample. */
+	} else if (!ctx->is_float
+	    && (ctx->samplesize < 1 || ctx->samplesize > 4)) {
+		sr_err("Only 8, 16, 24 or 32 bits per sample supported.");
+		return SR_ERR;
+	}
+
+	/* Samples must be stored in whole bytes, without padding. */
+	if (le16(fmt + 12) != ctx->samplesize * ctx->num_channels) {
+		sr_err("Unsupported block alignment %d.", le16(fmt + 12));
+		return SR_ERR;
+	}
+
+	if (ctx->num_channels < 1 || ctx->num_channels > MAX_CHANNELS) {
+		sr_err("%d channels seems crazy.", ctx->num_channels);
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}
+
+/*
+ * Walk the RIFF chunks up to the "data" chunk, which must come after the
+ * "fmt " chunk. Only the start of the "data" chunk needs to be in buf.
+ */
+static int parse_header(const uint8_t *buf, uint64_t len, struct context *ctx)
+{
+	uint64_t pos, size;
+	gboolean have_fmt;
+
+	if (len < 12 || memcmp(buf, "RIFF", 4) || memcmp(buf + 8, "WAVE", 4))
+		return SR_ERR;
+
+	have_fmt = FALSE;
+	for (pos = 12; pos + 8 <= len; pos += 8 + size + (size & 1)) {
+		size = le32(buf + pos + 4);
+		if (!memcmp(buf + pos, "fmt ", 4)) {
+			if (pos + 8 + size > len)
+				return SR_ERR;
+			if (parse_fmt(buf + pos + 8, size, ctx) != SR_OK)
+				return SR_ERR;
+			have_fmt = TRUE;
+		} else if (!memcmp(buf + pos, "data", 4)) {
+			if (!have_fmt)
+				return SR_ERR;
+			ctx->data_offset = pos + 8;
+			ctx->data_size = size;
+			return SR_OK;
+		}
+	}
+
+	return SR_ERR;
+}
+
+static gboolean has_wav_extension(const char *filename)
+{
+	int l;
+
+	l = strlen(filename);
+
+	return l > 4 && !strcasecmp(filename + l - 4, ".wav");
+}
+
+static int get_wav_header(const char *filename, uint8_t *buf, int *len)
+{
+	int fd, l;
+
+	if (!has_wav_extension(filename))
 		return SR_ERR;
 
 	if ((fd = open(filename, O_RDONLY)) == -1)
 		return SR_ERR;
 
-	l = read(fd, buf, 40);
+	l = read(fd, buf, HEADER_SIZE);
 	close(fd);
-	if (l != 40)
+	if (l < 12)
 		return SR_ERR;
+	*len = l;
 
 	return SR_OK;
 }
 
 static int format_match(const char *filename)
 {
-	char buf[40];
+	struct context ctx;
+	uint8_t buf[HEADER_SIZE];
+	int len;
 
-	if (get_wav_header(filename, buf) != SR_OK)
+	if (get_wav_header(filename, buf, &len) != SR_OK)
 		return FALSE;
 
-	if (strncmp(buf, "RIFF", 4))
-		return FALSE;
-	if (strncmp(buf + 8, "WAVE", 4))
-		return FALSE;
-	if (strncmp(buf + 12, "fmt ", 4))
-		return FALSE;
-	if (GUINT16_FROM_LE(*(uint16_t *)(buf + 20)) != 1)
-		/* Not PCM. */
-		return FALSE;
-	if (strncmp(buf + 36, "data", 4))
+	return parse_header(buf, len, &ctx) == SR_OK;
+}
+
+static int format_match_header(const struct sr_input_header *header)
+{
+	struct context ctx;
+
+	if (!has_wav_extension(header->filename))
 		return FALSE;
 
-	return TRUE;
+	/* Only look at as much as init() will. */
+	return parse_header(header->buf, MIN(header->len, HEADER_SIZE),
+			&ctx) == SR_OK;
 }
 
 static int init(struct sr_input *in, const char *filename)
 {
 	struct sr_probe *probe;
 	struct context *ctx;
-	char buf[40], probename[8];
-	int i;
+	uint8_t buf[HEADER_SIZE];
+	char probename[8];
+	int len, i;
 
-	if (get_wav_header(filename, buf) != SR_OK)
+	if (get_wav_header(filename, buf, &len) != SR_OK)
 		return SR_ERR;
 
 	if (!(ctx = g_try_malloc0(sizeof(struct context))))
 		return SR_ERR_MALLOC;
 
-	/* Create a virtual device. */
-	in->sdi = sr_dev_inst_new(0, SR_ST_ACTIVE, NULL, NULL, NULL);
-	in->sdi->priv = ctx;
-
-   	ctx->samplerate = GUINT32_FROM_LE(*(uint32_t *)(buf + 24));
-	ctx->samplesize = GUINT16_FROM_LE(*(uint16_t *)(buf + 34)) / 8;
-	if (ctx->samplesize != 1 && ctx->samplesize != 2 && ctx->samplesize != 4) {
-		sr_err("only 8, 16 or 32 bits per sample supported.");
+	if (parse_header(buf, len, ctx) != SR_OK) {
+		g_free(ctx);
 		return SR_ERR;
 	}
 
-	if ((ctx->num_channels = GUINT16_FROM_LE(*(uint16_t *)(buf + 22))) > 20) {
-		sr_err("%d channels seems crazy.", ctx->num_channels);
-		return SR_ERR;
-	}
+	/* Create a virtual device. */
+	in->sdi = sr_dev_inst_new(0, SR_ST_ACTIVE, NULL, NULL, NULL);
+	in->sdi->priv = ctx;
 
 	for (i = 0; i < ctx->num_channels; i++) {
 		snprintf(probename, 8, "CH%d", i + 1);
-		if (!(probe = sr_probe_new(0, SR_PROBE_ANALOG, TRUE, probename)))
+		if (!(probe = sr_probe_new(i, SR_PROBE_ANALOG, TRUE,
+				probename)))
 			return SR_ERR;
 		in->sdi->probes = g_slist_append(in->sdi->probes, probe);
 	}
 
-	return SR_OK;
+	return sr_input_window_init(&ctx->window, in, TRUE);
+}
+
+/*
+ * Convert values to floats in the range [-1, 1). Values in the WAV file
+ * are interleaved like those in an analog packet, so they are converted
+ * as one dense run the compiler vectorizes.
+ */
+static void convert(const struct context *ctx, const uint8_t *in,
+		float *out, uint64_t count)
+{
+	if (ctx->is_float) {
+		sr_analog_f32le_to_float(in, 1, out, 1, count, 1.0, 0.0);
+		return;
+	}
+
+	switch (ctx->samplesize) {
+	case 1:
+		/* 8-bit PCM samples are unsigned. */
+		sr_analog_u8_to_float(in, 1, out, 1, count,
+				1.0 / 128, -1.0);
+		break;
+	case 2:
+		sr_analog_s16le_to_float(in, 1, out, 1, count,
+				1.0 / 32768, 0.0);
+		break;
+	case 3:
+		sr_analog_s24le_to_float(in, 1, out, 1, count,
+				1.0 / 8388608, 0.0);
+		break;
+	case 4:
+		sr_analog_s32le_to_float(in, 1, out, 1, count,
+				1.0 / 2147483648.0, 0.0);
+		break;
+	}
 }
 
 static int loadfile(struct sr_input *in, const char *filename)
@@ -136,13 +283,55 @@ static int loadfile(struct sr_input *in, const char *filename)
 	struct sr_datafeed_analog analog;
 	struct sr_config *src;
 	struct context *ctx;
-	float fdata[CHUNK_SIZE];
-	uint64_t sample;
-	int num_samples, chunk_samples, s, c, fd, l;
-	char buf[CHUNK_SIZE];
+	GMappedFile *file;
+	GError *error;
+	const uint8_t *data;
+	float *fdata;
+	uint64_t size, frame_size, num_frames, chunk_frames, done;
+	uint64_t skip, count;
+	int ret;
 
 	ctx = in->sdi->priv;
 
+	error = NULL;
+	if (!(file = g_mapped_file_new(filename, FALSE, &error))) {
+		sr_err("Input file '%s' could not be opened: %s.", filename,
+		       error->message);
+		g_error_free(error);
+		return SR_ERR;
+	}
+
+	data = (const uint8_t *)g_mapped_file_get_contents(file);
+	size = g_mapped_file_get_length(file);
+	if (parse_header(data, size, ctx) != SR_OK) {
+		sr_err("Input file '%s' is no valid WAV file.", filename);
+		g_mapped_file_unref(file);
+		return SR_ERR;
+	}
+
+	/*
+	 * Files written while recording may carry a bogus length, so the
+	 * data chunk is cut to what is actually in the file.
+	 */
+	size = MIN(ctx->data_size, size - ctx->data_offset);
+	data += ctx->data_offset;
+	frame_size = ctx->samplesize * ctx->num_channels;
+	num_frames = size / frame_size;
+
+	/* Only the frames of the window are converted. */
+	sr_input_window_seek(&ctx->window, ctx->samplerate, &skip, &count);
+	skip = MIN(skip, num_frames);
+	data += skip * frame_size;
+	num_frames = MIN(num_frames - skip, count);
+	chunk_frames = MAX(CHUNK_SIZE / ctx->num_channels, 1);
+
+	if (!(fdata = g_try_malloc(chunk_frames * ctx->num_channels
+			* sizeof(float)))) {
+		sr_err("%s: fdata malloc failed", __func__);
+		g_mapped_file_unref(file);
+		return SR_ERR_MALLOC;
+	}
+
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(in->sdi, LOG_PREFIX);
 
@@ -151,61 +340,41 @@ static int loadfile(struct sr_input *in, const char *filename)
 	src = sr_config_new(SR_CONF_SAMPLERATE,
 			g_variant_new_uint64(ctx->samplerate));
 	meta.config = g_slist_append(NULL, src);
-	sr_session_send(in->sdi, &packet);
+	sr_input_window_send(&ctx->window, in->sdi, &packet);
+	g_slist_free(meta.config);
 	sr_config_free(src);
 
-	if ((fd = open(filename, O_RDONLY)) == -1)
-		return SR_ERR;
-
-	lseek(fd, 40, SEEK_SET);
-	l = read(fd, buf, 4);
-	num_samples = GUINT32_FROM_LE((uint32_t)*(buf));
-	num_samples /= ctx->samplesize / ctx->num_channels;
-	while (TRUE) {
-		if ((l = read(fd, buf, CHUNK_SIZE)) < 1)
-			break;
-		chunk_samples = l / ctx->samplesize / ctx->num_channels;
-		for (s = 0; s < chunk_samples; s++) {
-			for (c = 0; c < ctx->num_channels; c++) {
-				sample = 0;
-				memcpy(&sample, buf + s * ctx->samplesize + c, ctx->samplesize);
-				switch (ctx->samplesize) {
-				case 1:
-					/* 8-bit PCM samples are unsigned. */
-					fdata[s + c] = (uint8_t)sample / 255.0;
-					break;
-				case 2:
-					fdata[s + c] = GINT16_FROM_LE(sample) / 32767.0;
-					break;
-				case 4:
-					fdata[s + c] = GINT32_FROM_LE(sample) / 65535.0;
-					break;
-				}
-			}
-		}
-		packet.type = SR_DF_ANALOG;
-		packet.payload = &analog;
-		analog.probes = in->sdi->probes;
-		analog.num_samples = chunk_samples;
-		analog.mq = 0;
-		analog.unit = 0;
-		analog.data = fdata;
-		sr_session_send(in->sdi, &packet);
+	ret = SR_OK;
+	memset(&analog, 0, sizeof(analog));
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	analog.probes = in->sdi->probes;
+	analog.data = fdata;
+	done = 0;
+	while (ret == SR_OK && done < num_frames) {
+		chunk_frames = MIN(chunk_frames, num_frames - done);
+		convert(ctx, data + done * frame_size, fdata,
+				chunk_frames * ctx->num_channels);
+		analog.num_samples = chunk_frames;
+		ret = sr_input_window_send(&ctx->window, in->sdi, &packet);
+		done += chunk_frames;
 	}
 
-	close(fd);
+	g_free(fdata);
+	g_mapped_file_unref(file);
+	sr_input_window_free(&ctx->window);
+
 	packet.type = SR_DF_END;
 	sr_session_send(in->sdi, &packet);
 
-	return SR_OK;
+	return ret;
 }
 
-
 SR_PRIV struct sr_input_format input_wav = {
 	.id = "wav",
 	.description = "WAV file",
 	.format_match = format_match,
+	.format_match_header = format_match_header,
 	.init = init,
 	.loadfile = loadfile,
 };
-
@@ -21,6 +21,7 @@
 #define LIBSIGROK_SIGROK_INTERNAL_H
 
 #include <stdarg.h>
+#include <string.h>
 #include <glib.h>
 #include "config.h" /* Needed for HAVE_LIBUSB_1_0 and others. */
 #ifdef HAVE_LIBUSB_1_0
@@ -29,6 +30,9 @@
 #ifdef HAVE_LIBSERIALPORT
 #include <libserialport.h>
 #endif
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
 
 /**
  * @file
@@ -46,6 +50,22 @@
 #define ARRAY_AND_SIZE(a) (a), ARRAY_SIZE(a)
 #endif
 
+/*
+ * Static tracepoints in the "libsigrok" provider, for perf, bpftrace and
+ * SystemTap. Each one is a single no-op instruction until it's attached.
+ */
+#ifdef HAVE_SYS_SDT_H
+#define SR_TRACE(name) DTRACE_PROBE(libsigrok, name)
+#define SR_TRACE1(name, a) DTRACE_PROBE1(libsigrok, name, a)
+#define SR_TRACE2(name, a, b) DTRACE_PROBE2(libsigrok, name, a, b)
+#define SR_TRACE3(name, a, b, c) DTRACE_PROBE3(libsigrok, name, a, b, c)
+#else
+#define SR_TRACE(name) do { } while (0)
+#define SR_TRACE1(name, a) do { } while (0)
+#define SR_TRACE2(name, a, b) do { } while (0)
+#define SR_TRACE3(name, a, b, c) do { } while (0)
+#endif
+
 /* Portability fixes for FreeBSD. */
 #ifdef __FreeBSD__
 #define LIBUSB_CLASS_APPLICATION 0xfe
@@ -53,10 +73,37 @@
 	libusb_handle_events_timeout(ctx, tv)
 #endif
 
+#ifdef HAVE_LIBUSB_1_0
+struct sr_usb_thread;
+#endif
+
 struct sr_context {
 #ifdef HAVE_LIBUSB_1_0
 	libusb_context *libusb_ctx;
+	/* Handle libusb events on a thread of their own. */
+	gboolean usb_thread_enabled;
+	struct sr_usb_thread *usb_thread;
+	/* The USB devices, enumerated once for all of a scan's drivers. */
+	libusb_device **usb_devlist;
+	/* Set with sr_hotplug_set(). */
+	sr_hotplug_callback_t hotplug_cb;
+	void *hotplug_cb_data;
+	int hotplug_handle;
+	/* Arrivals and removals not handled yet, under scan_mutex. */
+	GSList *hotplug_events;
 #endif
+	/* Driver scans run by sr_driver_scan_all(). */
+	GThreadPool *scan_pool;
+	GMutex scan_mutex;
+	GCond scan_cond;
+	/* Drivers whose scan is still running. */
+	GSList *scan_busy;
+	/* Scheduling of the acquisition threads, see sr_thread_tune(). */
+	int thread_priority;
+	int *thread_cpus;
+	int num_thread_cpus;
+	/* Set with sr_usb_buffer_lock_set(). */
+	gboolean usb_buffer_lock;
 };
 
 #ifdef HAVE_LIBUSB_1_0
@@ -71,18 +118,32 @@ struct sr_usb_dev_inst {
 #define SERIAL_PARITY_NONE SP_PARITY_NONE
 #define SERIAL_PARITY_EVEN SP_PARITY_EVEN
 #define SERIAL_PARITY_ODD  SP_PARITY_ODD
+#define SERIAL_RX_BUF_SIZE 4096
 struct sr_serial_dev_inst {
 	char *port;
 	char *serialcomm;
 	int fd;
 	int nonblocking;
 	struct sp_port *data;
+	/* Bytes read ahead by serial_readline() and friends. */
+	uint8_t *rx_buf;
+	size_t rx_start, rx_end;
 };
 #endif
 
 struct sr_usbtmc_dev_inst {
 	char *device;
 	int fd;
+#ifdef HAVE_LIBUSB_1_0
+	/* Set for devices driven through libusb, rather than the kernel. */
+	struct sr_usb_dev_inst *usb;
+	uint8_t intf, ep_in, ep_out;
+	uint8_t btag;
+	gboolean detached;
+	/* Part of the response not read yet, see sr_usbtmc_read(). */
+	uint8_t *rx_buf;
+	size_t rx_start, rx_end;
+#endif
 };
 
 /* Private driver context. */
@@ -91,8 +152,64 @@ struct drv_context {
 	GSList *instances;
 };
 
+/*--- backend.c -------------------------------------------------------------*/
+
+struct sr_thread_state;
+
+SR_PRIV struct sr_thread_state *sr_thread_tune(const struct sr_context *ctx);
+SR_PRIV void sr_thread_restore(struct sr_thread_state *state);
+
+/*--- cpu.c -----------------------------------------------------------------*/
+
+/*
+ * Whether SIMD kernels for x86 are built, whatever the compiler flags,
+ * and chosen at runtime.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SR_CPU_DISPATCH_X86
+#endif
+
+SR_PRIV void sr_cpu_init(void);
+
 /*--- log.c -----------------------------------------------------------------*/
 
+/* The most verbose loglevel compiled in, see configure --with-max-loglevel. */
+#ifndef SR_LOG_MAX
+#define SR_LOG_MAX SR_LOG_SPEW
+#endif
+
+/* The most verbose of the global and the per-module loglevels. */
+extern SR_PRIV int sr_loglevel_max;
+
+/* Whether messages of the given loglevel are output by any module. */
+#define sr_log_enabled(l) ((l) <= SR_LOG_MAX && (l) <= sr_loglevel_max)
+
+/*
+ * A log call site's module and effective loglevel. The loglevel is looked
+ * up by the module's LOG_PREFIX once, and again only after a loglevel was
+ * changed: "state" holds the generation of the settings it was looked up
+ * in, shifted left by 3, and the loglevel.
+ */
+struct sr_log_module {
+	const char *prefix;
+	gint state;
+};
+
+SR_PRIV gboolean sr_log_module_enabled(struct sr_log_module *mod,
+		int loglevel);
+
+/*
+ * Call a log function only if its messages are output for the calling
+ * module, so the arguments aren't even evaluated otherwise. Messages above
+ * SR_LOG_MAX compile to nothing, and those above every module's loglevel
+ * cost a single comparison. Used in each module's LOG_PREFIX wrappers, as
+ * in sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args).
+ */
+#define sr_log_lazy(l, fn, args...) \
+	(sr_log_enabled(SR_LOG_##l) && sr_log_module_enabled(({ \
+		static struct sr_log_module sr_log_mod = { LOG_PREFIX, 0 }; \
+		&sr_log_mod; }), SR_LOG_##l) ? fn(args) : SR_OK)
+
 SR_PRIV int sr_log(int loglevel, const char *format, ...);
 SR_PRIV int sr_spew(const char *format, ...);
 SR_PRIV int sr_dbg(const char *format, ...);
@@ -105,6 +222,37 @@ SR_PRIV int sr_err(const char *format, ...);
 SR_PRIV struct sr_probe *sr_probe_new(int index, int type,
 		gboolean enabled, const char *name);
 
+/**
+ * A device's probes, looked up by index rather than by walking the
+ * sdi->probes list. See sr_dev_probe_table_get().
+ */
+struct sr_probe_table {
+	/** Probes by index; NULL for indices the device has no probe for. */
+	struct sr_probe **probes;
+	/** The highest probe index plus one. */
+	int num_probes;
+	/**
+	 * Indices of the enabled probes, in ascending order. For logic
+	 * probes, these are also their bit positions in a sample.
+	 */
+	int *enabled;
+	int num_enabled;
+	/** Bitmap of the enabled probes: bit index % 64 of word index / 64. */
+	uint64_t *enabled_mask;
+	/** The number of words in enabled_mask. */
+	int num_words;
+	/** Set when the probe list changed, and the table must be rebuilt. */
+	gboolean probes_stale;
+	/** Set when probes were enabled or disabled. */
+	gboolean enabled_stale;
+};
+
+SR_PRIV const struct sr_probe_table *sr_dev_probe_table_get(
+		const struct sr_dev_inst *sdi);
+SR_PRIV void sr_dev_probe_table_invalidate(const struct sr_dev_inst *sdi);
+SR_PRIV struct sr_probe *sr_dev_probe_get(const struct sr_dev_inst *sdi,
+		int probenum);
+
 /* Generic device instances */
 SR_PRIV struct sr_dev_inst *sr_dev_inst_new(int index, int status,
 		const char *vendor, const char *model, const char *version);
@@ -114,7 +262,7 @@ SR_PRIV void sr_dev_inst_free(struct sr_dev_inst *sdi);
 /* USB-specific instances */
 SR_PRIV struct sr_usb_dev_inst *sr_usb_dev_inst_new(uint8_t bus,
 		uint8_t address, struct libusb_device_handle *hdl);
-SR_PRIV GSList *sr_usb_find_usbtmc(libusb_context *usb_ctx);
+SR_PRIV GSList *sr_usb_find_usbtmc(struct sr_context *ctx);
 SR_PRIV void sr_usb_dev_inst_free(struct sr_usb_dev_inst *usb);
 #endif
 
@@ -129,15 +277,270 @@ SR_PRIV void sr_serial_dev_inst_free(struct sr_serial_dev_inst *serial);
 SR_PRIV struct sr_usbtmc_dev_inst *sr_usbtmc_dev_inst_new(const char *device);
 SR_PRIV void sr_usbtmc_dev_inst_free(struct sr_usbtmc_dev_inst *usbtmc);
 
+/*--- memory.c --------------------------------------------------------------*/
+
+SR_PRIV int sr_dev_mem_charge(const struct sr_dev_inst *sdi, size_t size);
+SR_PRIV void sr_dev_mem_uncharge(const struct sr_dev_inst *sdi,
+		size_t size);
+SR_PRIV void *sr_dev_mem_alloc(const struct sr_dev_inst *sdi, size_t size);
+SR_PRIV void *sr_dev_mem_alloc0(const struct sr_dev_inst *sdi, size_t size);
+SR_PRIV void sr_dev_mem_free(const struct sr_dev_inst *sdi, void *mem);
+SR_PRIV void sr_dev_mem_session_set(struct sr_dev_inst *sdi,
+		struct sr_session *session);
+SR_PRIV void sr_session_mem_peak_reset(struct sr_session *session);
+SR_PRIV void sr_session_mem_get(const struct sr_session *session,
+		uint64_t *used, uint64_t *peak);
+
 /*--- hwdriver.c ------------------------------------------------------------*/
 
 SR_PRIV void sr_hw_cleanup_all(void);
 SR_PRIV struct sr_config *sr_config_new(int key, GVariant *data);
 SR_PRIV void sr_config_free(struct sr_config *src);
+SR_PRIV void sr_config_cache_clear(const struct sr_dev_inst *sdi);
+SR_PRIV void sr_config_cache_free(struct sr_dev_inst *sdi);
 SR_PRIV int sr_source_remove(int fd);
 SR_PRIV int sr_source_add(int fd, int events, int timeout,
 		sr_receive_data_callback_t cb, void *cb_data);
 
+/*--- datafeed.c ------------------------------------------------------------*/
+
+/** Reference-counted memory backing datafeed payloads. */
+struct sr_buffer {
+	void *data;
+	size_t size;
+	/** Only to be changed with the g_atomic_int_*() functions. */
+	gint refcount;
+	GDestroyNotify free_func;
+	/** The pool this buffer goes back to, or NULL. */
+	struct sr_buffer_pool *pool;
+	int pool_class;
+};
+
+SR_PRIV struct sr_buffer *sr_buffer_new(size_t size);
+SR_PRIV struct sr_buffer *sr_buffer_new_wrap(void *data, size_t size,
+		GDestroyNotify free_func);
+SR_PRIV struct sr_buffer *sr_buffer_ref(struct sr_buffer *buf);
+SR_PRIV void sr_buffer_unref(struct sr_buffer *buf);
+SR_PRIV void *sr_buffer_steal(struct sr_buffer *buf);
+SR_PRIV struct sr_buffer_pool *sr_buffer_pool_new(void);
+SR_PRIV void sr_buffer_pool_destroy(struct sr_buffer_pool *pool);
+SR_PRIV struct sr_buffer *sr_buffer_pool_acquire(size_t size);
+SR_PRIV struct sr_datafeed_packet *sr_packet_copy(
+		const struct sr_datafeed_packet *packet);
+SR_PRIV void sr_packet_free(struct sr_datafeed_packet *packet);
+SR_PRIV struct sr_buffer *sr_packet_buffer_get(
+		const struct sr_datafeed_packet *packet);
+SR_PRIV uint64_t sr_packet_samples(const struct sr_datafeed_packet *packet);
+SR_PRIV uint64_t sr_logic_rle_expand(const struct sr_datafeed_logic_rle *rle,
+		uint64_t *run, uint64_t *offset, void *buf, uint64_t max_samples);
+
+/** Turns a device's logic packets into SR_DF_LOGIC_EDGES payloads. */
+struct sr_edge_conv {
+	/* Sample number of the next sample to come. */
+	uint64_t sample;
+	uint16_t unitsize;
+	/* The current value, unitsize bytes; only valid once sample > 0. */
+	uint8_t *last;
+	/* Room for this many edges in the payload's arrays. */
+	uint64_t size;
+	struct sr_datafeed_logic_edges edges;
+};
+
+SR_PRIV struct sr_edge_conv *sr_edge_conv_new(void);
+SR_PRIV void sr_edge_conv_free(struct sr_edge_conv *conv);
+SR_PRIV void sr_edge_conv_reset(struct sr_edge_conv *conv);
+SR_PRIV const struct sr_datafeed_logic_edges *sr_edge_conv_logic(
+		struct sr_edge_conv *conv, const struct sr_datafeed_logic *logic);
+SR_PRIV const struct sr_datafeed_logic_edges *sr_edge_conv_rle(
+		struct sr_edge_conv *conv,
+		const struct sr_datafeed_logic_rle *rle);
+
+/*--- filter.c --------------------------------------------------------------*/
+
+/** The number of 64-bit words holding a logic sample of unitsize bytes. */
+#define SR_SAMPLE_WORDS(unitsize) (((unitsize) + 7) / 8)
+
+SR_PRIV uint64_t sr_sample_word_get(const uint8_t *sample,
+		unsigned int unitsize, unsigned int word);
+SR_PRIV void sr_sample_word_set(uint8_t *sample, unsigned int unitsize,
+		unsigned int word, uint64_t bits);
+SR_PRIV void sr_filter_kernels_select(unsigned int features);
+
+/*
+ * Load and store a logic sample of up to 8 bytes. With a constant unit
+ * size of 1, 2, 4 or 8, as in the kernels which are specialized on it,
+ * these come down to a single move.
+ */
+static inline uint64_t sr_sample_load(const uint8_t *sample,
+		unsigned int unitsize)
+{
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
+	switch (unitsize) {
+	case 1:
+		return sample[0];
+	case 2:
+		memcpy(&v16, sample, 2);
+		return GUINT16_FROM_LE(v16);
+	case 4:
+		memcpy(&v32, sample, 4);
+		return GUINT32_FROM_LE(v32);
+	case 8:
+		memcpy(&v64, sample, 8);
+		return GUINT64_FROM_LE(v64);
+	default:
+		return sr_sample_word_get(sample, unitsize, 0);
+	}
+}
+
+static inline void sr_sample_store(uint8_t *sample, unsigned int unitsize,
+		uint64_t bits)
+{
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
+	switch (unitsize) {
+	case 1:
+		sample[0] = bits;
+		break;
+	case 2:
+		v16 = GUINT16_TO_LE((uint16_t)bits);
+		memcpy(sample, &v16, 2);
+		break;
+	case 4:
+		v32 = GUINT32_TO_LE((uint32_t)bits);
+		memcpy(sample, &v32, 4);
+		break;
+	case 8:
+		v64 = GUINT64_TO_LE(bits);
+		memcpy(sample, &v64, 8);
+		break;
+	default:
+		sr_sample_word_set(sample, unitsize, 0, bits);
+	}
+}
+
+/*
+ * Call a kernel specialized on the unit size, with the unit size as a
+ * constant where it is 1, 2, 4 or 8, so the compiler can fold away the
+ * above.
+ */
+#define SR_UNITSIZE_DISPATCH(unitsize, kernel, args...) \
+	switch (unitsize) { \
+	case 1: kernel(1, ## args); break; \
+	case 2: kernel(2, ## args); break; \
+	case 4: kernel(4, ## args); break; \
+	case 8: kernel(8, ## args); break; \
+	default: kernel(unitsize, ## args); \
+	}
+
+/*--- soft_trigger.c --------------------------------------------------------*/
+
+#define SR_SOFT_TRIGGER_MAX_STAGES 16
+
+/* The trigger types sr_soft_trigger_compile() understands. */
+#define SR_SOFT_TRIGGER_TYPES "01rfc"
+
+/* A condition on one sample; all probes set in a mask must match. */
+struct sr_soft_trigger_stage {
+	/* Probes which must be at the level given in value. */
+	uint64_t mask;
+	uint64_t value;
+	/* Probes which must have a rising/falling edge, or any edge. */
+	uint64_t rising;
+	uint64_t falling;
+	uint64_t change;
+};
+
+/*
+ * A trigger on the first byte of a bus transaction, as set with
+ * sr_session_protocol_trigger_set(). The probes are single bits.
+ */
+struct sr_soft_trigger_proto {
+	/* One of SR_PROTOCOL_TRIGGER_*, or 0 for none. */
+	int type;
+	uint64_t data;
+	uint64_t clock;
+	uint64_t select;
+	uint64_t baudrate;
+	int spi_mode;
+	uint8_t value;
+	uint8_t mask;
+};
+
+struct sr_soft_trigger {
+	int unitsize;
+	int num_stages;
+	struct sr_soft_trigger_stage stages[SR_SOFT_TRIGGER_MAX_STAGES];
+	/* The stage to match next. */
+	int stage;
+	/* The last sample of the previous buffer, for edges. */
+	uint64_t prev;
+	gboolean have_prev;
+	/* The samples that matched the stages so far. */
+	uint8_t matched[SR_SOFT_TRIGGER_MAX_STAGES * 8];
+	/* A protocol trigger, if proto.type is set. */
+	struct sr_soft_trigger_proto proto;
+	/* UART bit time, in 1/256 samples. */
+	uint64_t bit_time;
+	/* The frame being decoded, if any. */
+	gboolean in_frame;
+	int num_bits;
+	unsigned int bits;
+	/* UART: where the next bit is sampled, in 1/256 samples. */
+	uint64_t bit_pos;
+	/*
+	 * The sample the frame began at, relative to the buffer; negative
+	 * if it began in an earlier one.
+	 */
+	int64_t frame_start;
+};
+
+SR_PRIV struct sr_soft_trigger *sr_soft_trigger_new(int unitsize,
+		const struct sr_soft_trigger_stage *stages, int num_stages);
+SR_PRIV struct sr_soft_trigger *sr_soft_trigger_proto_new(int unitsize,
+		const struct sr_soft_trigger_proto *proto, uint64_t samplerate);
+SR_PRIV void sr_soft_trigger_free(struct sr_soft_trigger *st);
+SR_PRIV void sr_soft_trigger_reset(struct sr_soft_trigger *st);
+SR_PRIV int64_t sr_soft_trigger_scan(struct sr_soft_trigger *st,
+		const uint8_t *buf, uint64_t num_samples);
+SR_PRIV int sr_soft_trigger_compile(const struct sr_dev_inst *sdi,
+		char **triggerlist, struct sr_soft_trigger_stage *stages,
+		int *num_stages);
+SR_PRIV void sr_soft_trigger_stages_pack(struct sr_soft_trigger_stage *stages,
+		int num_stages, uint64_t probes);
+SR_PRIV void sr_soft_trigger_proto_pack(struct sr_soft_trigger_proto *proto,
+		uint64_t probes);
+SR_PRIV void sr_soft_trigger_kernels_select(unsigned int features);
+
+/*--- analog_trigger.c ------------------------------------------------------*/
+
+/* Values from lo to hi, or the ones outside. */
+struct sr_analog_range {
+	float lo, hi;
+	gboolean inside;
+};
+
+struct sr_analog_matcher {
+	/* Two for SR_ANALOG_TRIGGER_EDGE: rising, then falling. */
+	int num_dirs;
+	/* Each direction fires on a value in fire, once armed by arm. */
+	struct sr_analog_range arm[2];
+	struct sr_analog_range fire[2];
+	gboolean armed[2];
+};
+
+SR_PRIV struct sr_analog_matcher *sr_analog_matcher_new(
+		const struct sr_analog_trigger *trigger);
+SR_PRIV void sr_analog_matcher_free(struct sr_analog_matcher *am);
+SR_PRIV void sr_analog_matcher_reset(struct sr_analog_matcher *am);
+SR_PRIV int64_t sr_analog_matcher_scan(struct sr_analog_matcher *am,
+		const float *data, uint64_t num_samples, unsigned int stride);
+SR_PRIV void sr_analog_trigger_kernels_select(unsigned int features);
+
 /*--- session.c -------------------------------------------------------------*/
 
 struct sr_session {
@@ -145,6 +548,10 @@ struct sr_session {
 	GSList *devs;
 	/** List of struct datafeed_callback pointers. */
 	GSList *datafeed_callbacks;
+	/*
+	 * Common start time for the SR_DF_HEADER packets of all devices
+	 * started together by sr_session_start(), zero otherwise.
+	 */
 	GTimeVal starttime;
 	gboolean running;
 
@@ -158,21 +565,233 @@ struct sr_session {
 	 */
 	struct source *sources;
 	GPollFD *pollfds;
-	int source_timeout;
+	/* Guards the sources against devices started in parallel. */
+	GMutex sources_mutex;
+
+	/*
+	 * Min-heap of indices into "sources", for those with a timeout,
+	 * ordered by when their timeout expires. Allocated alongside
+	 * "sources".
+	 */
+	unsigned int *timers;
+	unsigned int num_timers;
+	/* Main loop statistics, see sr_session_stats_get(). */
+	uint64_t iterations;
+	uint64_t poll_us;
+	uint64_t sources_us;
+	/* Memory of the devices in the session, see memory.c. */
+	uint64_t mem_used;
+	uint64_t mem_peak;
+	uint64_t mem_limit;
+	/* Bumped whenever sources are added or removed. */
+	unsigned int sources_gen;
+	/* Sources to dispatch in the current iteration. */
+	struct source_ready *ready;
+	unsigned int ready_size;
+
+	/*
+	 * Stopping the session in an async fashion: sr_session_stop() sets
+	 * the flag and writes to the pipe, which wakes up the session thread
+	 * in g_poll(), so the session is stopped from within that thread.
+	 * The pipe's read end is polled after the sources, in pollfds.
+	 */
+	gint abort_session;
+	int wake_fds[2];
+
+	/*
+	 * Optional queue decoupling the drivers from the datafeed callbacks,
+	 * which then run on a thread of their own. Only exists while the
+	 * session is running, and only if queue_depth is non-zero.
+	 */
+	unsigned int queue_depth;
+	struct packet_ring *queue;
+	GThread *queue_thread;
+	uint64_t queue_overruns;
+	unsigned int queue_max_used;
+
+	/*
+	 * Run every datafeed callback on a thread of its own, all of them
+	 * fed from one broadcast ring while the session is running.
+	 */
+	gboolean threaded_dispatch;
+	gboolean workers_running;
+	struct bcast_ring *bcast;
+	/* Hold up the datafeed rather than drop data for a slow thread. */
+	gboolean dispatch_blocking;
+
+	/*
+	 * Time the stages of the datafeed, see sr_session_stage_timing_set().
+	 * The stages are struct stage_entry, private to session.c, under
+	 * stage_mutex.
+	 */
+	gboolean stage_timing;
+	GMutex stage_mutex;
+	GSList *stages;
+	int64_t run_start;
+	int64_t run_end;
+
+	/*
+	 * Run every device's event sources on a thread of its own, see
+	 * sr_session_dev_threads_set(). While the session runs, each one
+	 * has a struct dev_loop in dev_loops, private to session.c. The
+	 * session thread sleeps in g_poll() with loops_waiting set. A
+	 * loop's parent is the session its device belongs to.
+	 */
+	gboolean dev_threads;
+	GSList *dev_loops;
+	struct sr_session *parent;
+	gint loops_running;
+	gint loops_waiting;
+
+	/* One of the SR_PROFILE_*, see sr_session_profile_set(). */
+	int profile;
+
+	/* While run from a GLib main context, see sr_session_attach(). */
+	GSource *gsource;
+
+	/* Set with sr_session_packet_queue_set(), private to session.c. */
+	struct packet_ring *pull_queue;
 
 	/*
-	 * These are our synchronization primitives for stopping the session in
-	 * an async fashion. We need to make sure the session is stopped from
-	 * within the session thread itself.
+	 * Set with sr_session_flight_recorder_set(), private to
+	 * session_file.c. It stays among the datafeed callbacks.
 	 */
-	GMutex stop_mutex;
-	gboolean abort_session;
+	struct flight_recorder *flight;
+
+	/*
+	 * The context of the session's devices while it's started, which
+	 * has the scheduling for its threads, or NULL.
+	 */
+	struct sr_context *ctx;
+
+	/* Recycles the drivers' packet payload buffers. */
+	struct sr_buffer_pool *buffer_pool;
+
+	/*
+	 * Packets sent by other threads (see sr_session_send_defer()),
+	 * waiting to be passed on by the session thread.
+	 */
+	GAsyncQueue *deferred;
+	gint num_deferred;
+
+	/*
+	 * Software trigger on one device's logic data, see
+	 * sr_session_trigger_set() and sr_session_protocol_trigger_set().
+	 * The matcher itself is (re)created for the unitsize of the data.
+	 */
+	const struct sr_dev_inst *trigger_sdi;
+	struct sr_soft_trigger_stage trigger_stages[SR_SOFT_TRIGGER_MAX_STAGES];
+	int trigger_num_stages;
+	/* The protocol trigger, if its type is set, by probe index. */
+	struct sr_soft_trigger_proto trigger_proto;
+	struct sr_soft_trigger *trigger;
+	gboolean trigger_fired;
+	/* The samplerate and packed probes of the data. */
+	struct sr_stream_params trigger_params;
+	/*
+	 * Software trigger on one analog probe, see
+	 * sr_session_analog_trigger_set(). Private to session.c.
+	 */
+	struct analog_trigger_state *analog_trigger;
+
+	/*
+	 * The last frames of each device, see sr_session_frame_history_set().
+	 * One struct frame_history per device, private to session.c. The
+	 * mutex guards which of their slots hold what.
+	 */
+	unsigned int frame_history_size;
+	GSList *frame_histories;
+	GMutex frame_mutex;
+
+	/* Where RLE data gets expanded for callbacks that don't take it. */
+	uint8_t *rle_buf;
+	/* Where raw analog data gets converted, for the same reason. */
+	float *analog_buf;
+	size_t analog_buf_size;
+	/* One struct edge_state per device, for SR_DF_LOGIC_EDGES. */
+	GSList *edge_states;
+	/*
+	 * One struct dev_state per device, numbering the samples of its
+	 * packets and counting them. The mutex guards the list, not the
+	 * states.
+	 */
+	GSList *dev_states;
+	GMutex dev_mutex;
+
+	/*
+	 * List of struct sr_transform pointers, in the order they see
+	 * the datafeed, see sr_session_transform_add().
+	 */
+	GSList *transforms;
 };
 
 SR_PRIV int sr_session_send(const struct sr_dev_inst *sdi,
 		const struct sr_datafeed_packet *packet);
-SR_PRIV int sr_session_stop_sync(void);
+SR_PRIV int sr_session_send_buffer(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, struct sr_buffer *buf);
+SR_PRIV int sr_session_send_timed(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet,
+		const int64_t *timestamps);
+SR_PRIV int sr_session_send_planar(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet);
+SR_PRIV struct sr_buffer *sr_session_cur_buffer_get(void);
+SR_PRIV struct sr_buffer_pool *sr_session_buffer_pool_get(void);
+SR_PRIV struct sr_session *sr_session_cur_get(void);
+SR_PRIV void sr_session_dev_stats_add(const struct sr_dev_inst *sdi,
+		uint64_t overruns, uint64_t empty_transfers);
+
+/* Times one run of a stage, see sr_stage_begin(). */
+struct sr_stage_timer {
+	int64_t start;
+	/* What the enclosing stage's inner stages took so far. */
+	int64_t outer_us;
+};
+
+SR_PRIV void sr_stage_begin(struct sr_session *session,
+		struct sr_stage_timer *timer);
+SR_PRIV int64_t sr_stage_end(struct sr_session *session,
+		struct sr_stage_timer *timer, const char *stage, const char *id,
+		uint64_t samples);
+SR_PRIV int sr_session_dev_profile(const struct sr_dev_inst *sdi);
+SR_PRIV unsigned int sr_session_buffer_ms(const struct sr_dev_inst *sdi,
+		unsigned int ms);
+SR_PRIV unsigned int sr_session_queue_ms(const struct sr_dev_inst *sdi,
+		unsigned int ms);
+SR_PRIV int sr_transform_send(struct sr_transform *t,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet);
+SR_PRIV void sr_session_send_defer(gboolean defer);
+SR_PRIV gboolean sr_session_deferred_pending(struct sr_session *session);
+SR_PRIV void sr_session_deferred_dispatch(struct sr_session *session);
+SR_PRIV int sr_session_stop_sync(struct sr_session *session);
+SR_PRIV int sr_session_datafeed_callback_add_full(struct sr_session *session,
+		sr_datafeed_callback_t cb, void *cb_data,
+		GDestroyNotify destroy);
 SR_PRIV int sr_sessionfile_check(const char *filename);
+SR_PRIV void sr_logic_planes_pack(const uint8_t *samples, int unitsize,
+		uint64_t num_bytes, uint8_t **planes);
+SR_PRIV void sr_logic_planes_unpack(const uint8_t **planes, int unitsize,
+		uint64_t num_bytes, uint8_t *samples);
+SR_PRIV uint8_t *sr_logic_rle_encode(const uint8_t *samples, int unitsize,
+		uint64_t num_samples, uint64_t *len);
+SR_PRIV uint64_t sr_logic_rle_count(const uint8_t *data, uint64_t len);
+SR_PRIV int sr_logic_rle_decode(const uint8_t *data, uint64_t len,
+		int unitsize, uint8_t *samples);
+SR_PRIV void sr_analog_delta_encode(const uint8_t *samples, int encoding,
+		uint64_t num_samples, uint8_t *out);
+SR_PRIV void sr_analog_delta_decode(const uint8_t *data, int encoding,
+		uint64_t num_samples, uint8_t *samples);
+
+/*--- session_driver.c ------------------------------------------------------*/
+
+SR_PRIV int sr_session_vdev_analog_add(struct sr_dev_inst *sdi,
+		struct sr_probe *probe, const char *capturefile,
+		const struct sr_datafeed_analog_raw *format, gboolean delta);
+SR_PRIV int sr_session_vdev_threads_set(struct sr_dev_inst *sdi,
+		int num_threads);
+SR_PRIV int sr_session_vdev_planar_set(struct sr_dev_inst *sdi,
+		uint64_t num_samples);
+SR_PRIV int sr_session_vdev_rle_set(struct sr_dev_inst *sdi);
 
 /*--- std.c -----------------------------------------------------------------*/
 
@@ -188,8 +807,236 @@ SR_PRIV int std_dev_acquisition_stop_serial(struct sr_dev_inst *sdi,
 #endif
 SR_PRIV int std_session_send_df_header(const struct sr_dev_inst *sdi,
 		const char *prefix);
+SR_PRIV int std_session_send_df_packed_probes(const struct sr_dev_inst *sdi,
+		uint64_t probes, const char *prefix);
 SR_PRIV int std_dev_clear(const struct sr_dev_driver *driver,
 		std_dev_clear_t clear_private);
+#ifdef HAVE_LIBUSB_1_0
+SR_PRIV int std_dev_check_usb(struct sr_dev_inst *sdi);
+#endif
+
+/*--- input/input.c ---------------------------------------------------------*/
+
+/*
+ * The contents of an input file, mapped into memory, or decompressed into
+ * memory if the file is gzip compressed.
+ */
+struct sr_input_file {
+	const uint8_t *data;
+	uint64_t size;
+	GMappedFile *mapped;
+	uint8_t *buf;
+};
+
+SR_PRIV gboolean sr_input_file_compressed(const char *filename);
+SR_PRIV struct sr_input_file *sr_input_file_open(const char *filename);
+SR_PRIV void sr_input_file_close(struct sr_input_file *file);
+
+/*
+ * The window of samples an input module sends, from the "start", "end",
+ * "probes" and "downsample" options, see sr_input_window_init().
+ */
+struct sr_input_window {
+	/* First sample, and the one after the last (G_MAXUINT64 for none). */
+	uint64_t start;
+	uint64_t end;
+	/* Bounds given as times of p/q seconds, or q 0. */
+	uint64_t start_p, start_q;
+	uint64_t end_p, end_q;
+	/* Only every downsample-th sample of the window is sent. */
+	uint64_t downsample;
+	uint64_t samplerate;
+	/* Whether the times were turned into sample numbers yet. */
+	gboolean resolved;
+	/* Number of the next logic and analog sample passed in. */
+	uint64_t logic_pos;
+	uint64_t analog_pos;
+	/* What the packets sent are put together in. */
+	void *buf;
+	uint64_t buf_size;
+	void *aux;
+	uint64_t aux_size;
+	void *raw;
+	uint64_t raw_size;
+	unsigned int *columns;
+	uint64_t columns_size;
+};
+
+SR_PRIV int sr_input_window_init(struct sr_input_window *w,
+		struct sr_input *in, gboolean downsample);
+SR_PRIV void sr_input_window_free(struct sr_input_window *w);
+SR_PRIV void sr_input_window_seek(struct sr_input_window *w,
+		uint64_t samplerate, uint64_t *start, uint64_t *count);
+SR_PRIV gboolean sr_input_window_done(const struct sr_input_window *w);
+SR_PRIV int sr_input_window_send(struct sr_input_window *w,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet);
+
+/*--- output/analog_raw.c ---------------------------------------------------*/
+
+/*
+ * The raw analog file format, written by the "analog-raw" output module and
+ * read by the input module of the same name. A little-endian header (see
+ * the output module) is followed by the samples, either interleaved as in
+ * an analog packet, or in blocks of one plane per probe.
+ */
+#define ANALOG_RAW_MAGIC "SRANLG1\n"
+#define ANALOG_RAW_MAGIC_LEN 8
+/* The part of the header before the probes. */
+#define ANALOG_RAW_HEADER_LEN 48
+/* Larger headers are considered garbage. */
+#define ANALOG_RAW_MAX_HEADER (1024 * 1024)
+#define ANALOG_RAW_BLOCK_HEADER_LEN 8
+
+enum {
+	ANALOG_RAW_FLOAT = 1,
+	ANALOG_RAW_S16,
+};
+
+enum {
+	ANALOG_RAW_INTERLEAVED,
+	ANALOG_RAW_PLANAR,
+};
+
+/*--- output/srnet.c --------------------------------------------------------*/
+
+/*
+ * The sigrok network stream, written by the "srnet" output module and read
+ * by the sigrok-net driver. It starts with SRNET_MAGIC, followed by frames
+ * of a little-endian header (type, flags and payload length: 16, 16 and 32
+ * bits) and the payload. A deflated payload is prefixed by its inflated
+ * length (32 bits).
+ */
+#define SRNET_MAGIC "SRNET01\n"
+#define SRNET_MAGIC_LEN 8
+#define SRNET_FRAME_HEADER_LEN 8
+/* Larger frames are considered garbage. */
+#define SRNET_MAX_FRAME (64 * 1024 * 1024)
+#define SRNET_DEFLATED (1 << 0)
+
+enum {
+	/* Vendor and model, and the probes, before each SR_DF_HEADER. */
+	SRNET_DEVICE = 1,
+	SRNET_HEADER,
+	SRNET_END,
+	SRNET_META,
+	SRNET_TRIGGER,
+	SRNET_LOGIC,
+	SRNET_ANALOG,
+	SRNET_FRAME_BEGIN,
+	SRNET_FRAME_END,
+};
+
+/*--- shm.c -----------------------------------------------------------------*/
+
+/*
+ * A shared memory ring carrying the sigrok network stream (without its
+ * magic) between processes, see sr_shm_writer_open(). Frames start at
+ * multiples of 8 bytes and never wrap around the end of the ring: the
+ * rest of the ring is skipped instead, marked by a frame of type
+ * SRNET_PAD if there's room for one.
+ */
+#define SR_SHM_MAGIC "SRSHM01\n"
+#define SR_SHM_ALIGN 8
+/* The device frame written last, for consumers attaching later. */
+#define SR_SHM_DEVICE_OFFSET 4096
+#define SR_SHM_DEVICE_SIZE (64 * 1024)
+#define SR_SHM_DATA_OFFSET (SR_SHM_DEVICE_OFFSET + SR_SHM_DEVICE_SIZE)
+#define SRNET_PAD 0
+
+struct sr_shm_ring {
+	char magic[8];
+	/* Size of the data area, a multiple of SR_SHM_ALIGN. */
+	uint64_t size;
+	/* Written by the producer: the bytes written so far. */
+	uint64_t head;
+	/* Incremented with every change of head, to wait on. */
+	uint32_t head_seq;
+	uint32_t device_len;
+	/* Keep the consumer's fields on a cache line of their own. */
+	uint8_t pad[32];
+	/* Written by the consumer: the bytes consumed so far. */
+	uint64_t tail;
+	uint32_t tail_seq;
+	/* Nonzero while a consumer is attached. */
+	uint32_t attached;
+};
+
+SR_PRIV int sr_shm_ring_attach(const char *name, struct sr_shm_ring **ring,
+		size_t *map_size);
+SR_PRIV void sr_shm_ring_detach(struct sr_shm_ring *ring, size_t map_size);
+SR_PRIV void sr_shm_wait(uint32_t *word, uint32_t val, int timeout);
+SR_PRIV void sr_shm_wake(uint32_t *word);
+
+/*--- hardware/common/analog.c ----------------------------------------------*/
+
+SR_PRIV void sr_analog_u8_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset);
+SR_PRIV void sr_analog_s8_to_float(const int8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset);
+SR_PRIV void sr_analog_s16_to_float(const int16_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset);
+SR_PRIV void sr_analog_u9_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset);
+SR_PRIV void sr_analog_s16le_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset);
+SR_PRIV void sr_analog_s24le_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset);
+SR_PRIV void sr_analog_s32le_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset);
+SR_PRIV void sr_analog_f32le_to_float(const uint8_t *in, unsigned int in_stride,
+		float *out, unsigned int out_stride, uint64_t count,
+		float gain, float offset);
+SR_PRIV int sr_analog_encoding_size(int encoding);
+SR_PRIV int sr_analog_raw_to_float(const struct sr_datafeed_analog_raw *raw,
+		float *out);
+SR_PRIV void sr_analog_transpose(const float *in, float *out, uint64_t rows,
+		uint64_t cols);
+
+/* Single readings collected into packets, see sr_analog_batch_add(). */
+struct sr_analog_batch {
+	/* Readings per packet, 0 or 1 to send each one right away. */
+	uint64_t max_samples;
+	/* Longest a reading waits for the packet to fill up, in us. */
+	int64_t max_wait;
+
+	void *cb_data;
+	/* The last reading added, for its probes, MQ, unit and flags. */
+	struct sr_datafeed_analog analog;
+	unsigned int num_probes;
+	uint64_t num_samples;
+	/* Room for size samples of num_probes values each. */
+	uint64_t size;
+	float *data;
+	int64_t *timestamps;
+};
+
+SR_PRIV void sr_analog_batch_start(struct sr_analog_batch *batch,
+		void *cb_data);
+SR_PRIV int sr_analog_batch_add(struct sr_analog_batch *batch,
+		const struct sr_datafeed_analog *analog);
+SR_PRIV int sr_analog_batch_add_stored(struct sr_analog_batch *batch,
+		const struct sr_datafeed_analog *analog, int64_t timestamp,
+		int64_t interval);
+SR_PRIV int sr_analog_batch_poll(struct sr_analog_batch *batch);
+SR_PRIV int sr_analog_batch_flush(struct sr_analog_batch *batch);
+SR_PRIV void sr_analog_batch_clear(struct sr_analog_batch *batch);
+
+/*--- hardware/common/firmware.c --------------------------------------------*/
+
+/** Turns a firmware file's contents into what gets uploaded. */
+typedef GBytes *(*sr_firmware_encode_t)(const uint8_t *data, size_t size);
+
+SR_PRIV GBytes *sr_firmware_get(const char *filename,
+		sr_firmware_encode_t encode);
+SR_PRIV void sr_firmware_cache_clear(void);
 
 /*--- hardware/common/serial.c ----------------------------------------------*/
 
@@ -201,6 +1048,7 @@ enum {
 };
 
 typedef gboolean (*packet_valid_t)(const uint8_t *buf);
+typedef void (*serial_line_cb_t)(char *line, int len, void *cb_data);
 
 SR_PRIV int serial_open(struct sr_serial_dev_inst *serial, int flags);
 SR_PRIV int serial_close(struct sr_serial_dev_inst *serial);
@@ -215,6 +1063,9 @@ SR_PRIV int serial_set_paramstr(struct sr_serial_dev_inst *serial,
 		const char *paramstr);
 SR_PRIV int serial_readline(struct sr_serial_dev_inst *serial, char **buf,
 		int *buflen, gint64 timeout_ms);
+SR_PRIV int serial_read_lines(struct sr_serial_dev_inst *serial, char *buf,
+		int *buflen, int bufsize, char eol, serial_line_cb_t line_cb,
+		void *cb_data);
 SR_PRIV int serial_stream_detect(struct sr_serial_dev_inst *serial,
 				 uint8_t *buf, size_t *buflen,
 				 size_t packet_size, packet_valid_t is_valid,
@@ -231,16 +1082,137 @@ SR_PRIV int ezusb_upload_firmware(libusb_device *dev, int configuration,
 				  const char *filename);
 #endif
 
+/*--- hardware/common/usbtmc.c ----------------------------------------------*/
+
+SR_PRIV int sr_usbtmc_open(struct sr_context *ctx,
+		struct sr_usbtmc_dev_inst *usbtmc);
+SR_PRIV void sr_usbtmc_close(struct sr_usbtmc_dev_inst *usbtmc);
+SR_PRIV gboolean sr_usbtmc_is_open(const struct sr_usbtmc_dev_inst *usbtmc);
+SR_PRIV int sr_usbtmc_write(struct sr_usbtmc_dev_inst *usbtmc,
+		const void *buf, int count);
+SR_PRIV int sr_usbtmc_read(struct sr_usbtmc_dev_inst *usbtmc, void *buf,
+		int count);
+
 /*--- hardware/common/usb.c -------------------------------------------------*/
 
 #ifdef HAVE_LIBUSB_1_0
-SR_PRIV GSList *sr_usb_find(libusb_context *usb_ctx, const char *conn);
+SR_PRIV int sr_usb_init(struct sr_context *ctx);
+SR_PRIV ssize_t sr_usb_get_device_list(struct sr_context *ctx,
+		libusb_device ***list);
+SR_PRIV void sr_usb_devlist_cache(struct sr_context *ctx, gboolean enable);
+SR_PRIV GSList *sr_usb_find(struct sr_context *ctx, const char *conn);
 SR_PRIV int sr_usb_open(libusb_context *usb_ctx, struct sr_usb_dev_inst *usb);
+SR_PRIV int sr_usb_source_add(struct sr_context *ctx, int timeout,
+		sr_receive_data_callback_t cb, void *cb_data);
+SR_PRIV int sr_usb_source_remove(struct sr_context *ctx, void *cb_data);
+SR_PRIV void sr_usb_thread_stop(struct sr_context *ctx);
+SR_PRIV int sr_usb_hotplug_set(struct sr_context *ctx,
+		sr_hotplug_callback_t cb, void *cb_data);
+SR_PRIV int sr_usb_hotplug_handle_events(struct sr_context *ctx,
+		int timeout_ms);
+SR_PRIV void *sr_usb_buffer_alloc(struct sr_context *ctx, size_t size);
+SR_PRIV void *sr_usb_dev_buffer_alloc(struct sr_context *ctx,
+		libusb_device_handle *devhdl, size_t size);
+SR_PRIV gboolean sr_usb_buffer_is_dev_mem(const void *buf);
+SR_PRIV void sr_usb_buffer_free(struct sr_context *ctx, void *buf,
+		size_t size);
+SR_PRIV struct libusb_transfer *sr_usb_transfer_get(struct sr_context *ctx,
+		GSList **pool, libusb_device_handle *devhdl, size_t size);
+SR_PRIV void sr_usb_transfer_put(GSList **pool,
+		struct libusb_transfer *transfer);
+SR_PRIV void sr_usb_transfer_pool_trim(struct sr_context *ctx,
+		GSList **pool, size_t keep_size);
 #endif
 
+/*--- hardware/common/dmm/dmm.c ---------------------------------------------*/
+
+/** A flag in a DMM chip's info struct, and the packet bit it is read from. */
+struct sr_dmm_flag {
+	/** Offset of the gboolean in the info struct. */
+	uint16_t offset;
+	uint8_t byte;
+	uint8_t mask;
+};
+
+#define SR_DMM_FLAG(type, field, byte, bit) \
+	{ G_STRUCT_OFFSET(type, field), byte, 1 << (bit) }
+
+/**
+ * What a set flag means for the analog packet. Entries with an mq of 0
+ * only add mqflags. Later entries override the mq and unit of earlier ones.
+ */
+struct sr_dmm_mode {
+	uint16_t offset;
+	int mq;
+	int unit;
+	uint64_t mqflags;
+};
+
+#define SR_DMM_MODE(type, field, mq, unit, mqflags) \
+	{ G_STRUCT_OFFSET(type, field), mq, unit, mqflags }
+
+/** A multiplier flag: the value is scaled by 10^exponent when it is set. */
+struct sr_dmm_factor {
+	uint16_t offset;
+	int exponent;
+};
+
+#define SR_DMM_FACTOR(type, field, exponent) \
+	{ G_STRUCT_OFFSET(type, field), exponent }
+
+/*
+ * A 7-segment digit map of 256 entries, indexed by the segment byte: each
+ * entry is the digit shown plus one, or 0 if the byte is no digit. Built
+ * by the compiler from the segment bytes of the digits 0 to 9, in order.
+ */
+#define SR_DMM_SEGMENTS(s0, s1, s2, s3, s4, s5, s6, s7, s8, s9) { \
+	[s0] = 1, [s1] = 2, [s2] = 3, [s3] = 4, [s4] = 5, \
+	[s5] = 6, [s6] = 7, [s7] = 8, [s8] = 9, [s9] = 10 }
+
+#define SR_DMM_SEGMENT_DIGIT(map, b) ((int)(map)[(uint8_t)(b)] - 1)
+
+SR_PRIV void sr_dmm_flags_parse(const uint8_t *buf,
+		const struct sr_dmm_flag *flags, int num_flags, void *info);
+SR_PRIV int sr_dmm_flags_count(const void *info, const uint16_t *offsets,
+		int num_offsets);
+SR_PRIV void sr_dmm_factors_apply(const void *info,
+		const struct sr_dmm_factor *factors, int num_factors,
+		float *floatval);
+SR_PRIV void sr_dmm_modes_apply(const void *info,
+		const struct sr_dmm_mode *modes, int num_modes,
+		struct sr_datafeed_analog *analog);
+
+/**
+ * A byte every packet of a chip has at a fixed offset, so candidate packet
+ * starts can be found without running the full packet check everywhere.
+ */
+struct sr_dmm_sync {
+	/** Offset of the byte in the packet, or -1 if the chip has none. */
+	int offset;
+	uint8_t mask;
+	uint8_t value;
+};
+
+/** Packet framing state of a DMM's receive stream. */
+struct sr_dmm_framer {
+	int packet_size;
+	struct sr_dmm_sync sync;
+	gboolean (*packet_valid)(const uint8_t *);
+	/** The last packet was valid, so the next one should follow it. */
+	gboolean locked;
+};
+
+SR_PRIV void sr_dmm_framer_init(struct sr_dmm_framer *framer,
+		int packet_size, const struct sr_dmm_sync *sync,
+		gboolean (*packet_valid)(const uint8_t *));
+SR_PRIV int sr_dmm_framer_parse(struct sr_dmm_framer *framer,
+		const uint8_t *buf, int len,
+		void (*packet_cb)(const uint8_t *, void *), void *cb_data);
+
 /*--- hardware/common/dmm/es51922.c -----------------------------------------*/
 
 #define ES51922_PACKET_SIZE 14
+#define ES51922_PACKET_SYNC { 13, 0xff, '\n' }
 
 struct es51922_info {
 	gboolean is_judge, is_vbar, is_voltage, is_auto, is_micro, is_current;
@@ -263,6 +1235,8 @@ SR_PRIV int sr_es51922_parse(const uint8_t *buf, float *floatval,
  */
 #define ES519XX_11B_PACKET_SIZE (11 * 2)
 #define ES519XX_14B_PACKET_SIZE 14
+#define ES519XX_11B_PACKET_SYNC { 10, 0xff, '\n' }
+#define ES519XX_14B_PACKET_SYNC { 13, 0xff, '\n' }
 
 struct es519xx_info {
 	gboolean is_judge, is_voltage, is_auto, is_micro, is_current;
@@ -300,6 +1274,7 @@ SR_PRIV int sr_es519xx_19200_14b_sel_lpf_parse(const uint8_t *buf,
 /*--- hardware/common/dmm/fs9922.c ------------------------------------------*/
 
 #define FS9922_PACKET_SIZE 14
+#define FS9922_PACKET_SYNC { 13, 0xff, '\n' }
 
 struct fs9922_info {
 	gboolean is_auto, is_dc, is_ac, is_rel, is_hold, is_bpn, is_z1, is_z2;
@@ -318,6 +1293,8 @@ SR_PRIV void sr_fs9922_z1_diode(struct sr_datafeed_analog *analog, void *info);
 /*--- hardware/common/dmm/fs9721.c ------------------------------------------*/
 
 #define FS9721_PACKET_SIZE 14
+/* The sync nibble of byte 0 is 1. */
+#define FS9721_PACKET_SYNC { 0, 0xf0, 0x10 }
 
 struct fs9721_info {
 	gboolean is_ac, is_dc, is_auto, is_rs232, is_micro, is_nano, is_kilo;
@@ -337,6 +1314,7 @@ SR_PRIV void sr_fs9721_01_10_temp_f_c(struct sr_datafeed_analog *analog, void *i
 /*--- hardware/common/dmm/metex14.c -----------------------------------------*/
 
 #define METEX14_PACKET_SIZE 14
+#define METEX14_PACKET_SYNC { 13, 0xff, '\r' }
 
 struct metex14_info {
 	gboolean is_ac, is_dc, is_resistance, is_capacity, is_temperature;
@@ -356,6 +1334,7 @@ SR_PRIV int sr_metex14_parse(const uint8_t *buf, float *floatval,
 /*--- hardware/common/dmm/rs9lcd.c ------------------------------------------*/
 
 #define RS9LCD_PACKET_SIZE 9
+#define RS9LCD_PACKET_SYNC { -1, 0, 0 }
 
 /* Dummy info struct. The parser does not use it. */
 struct rs9lcd_info { int dummy; };
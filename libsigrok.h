@@ -81,6 +81,26 @@ enum {
 	 */
 };
 
+/** CPU features libsigrok has SIMD kernels for, see sr_cpu_features_get(). */
+enum {
+	SR_CPU_SSE  = 1 << 0,
+	SR_CPU_SSE2 = 1 << 1,
+	SR_CPU_AVX  = 1 << 2,
+	SR_CPU_AVX2 = 1 << 3,
+	SR_CPU_BMI2 = 1 << 4,
+	SR_CPU_NEON = 1 << 5,
+};
+
+/** Buffering profiles of a session, see sr_session_profile_set(). */
+enum {
+	/** Each driver's own balance of latency and throughput. */
+	SR_PROFILE_DEFAULT,
+	/** Get the data to the datafeed callbacks within a few ms. */
+	SR_PROFILE_LOW_LATENCY,
+	/** Sustain the highest rates, holding back more data for it. */
+	SR_PROFILE_THROUGHPUT,
+};
+
 #define SR_MAX_PROBENAME_LEN 32
 
 /* Handy little macros */
@@ -133,6 +153,13 @@ enum {
 
 typedef int (*sr_receive_data_callback_t)(int fd, int revents, void *cb_data);
 
+/**
+ * Sink for output modules' output, see sr_output_send(). Must consume
+ * all len bytes at buf, and return SR_OK upon success.
+ */
+typedef int (*sr_output_write_callback_t)(const void *buf, uint64_t len,
+		void *cb_data);
+
 /** Data types used by sr_config_info(). */
 enum {
 	SR_T_UINT64 = 10000,
@@ -156,6 +183,11 @@ enum {
 	SR_DF_ANALOG,
 	SR_DF_FRAME_BEGIN,
 	SR_DF_FRAME_END,
+	SR_DF_LOGIC_RLE,
+	SR_DF_LOGIC_EDGES,
+	SR_DF_ANALOG_RAW,
+	SR_DF_ANALOG_STATS,
+	SR_DF_LOGIC_STATS,
 };
 
 /** Values for sr_datafeed_analog.mq. */
@@ -288,10 +320,87 @@ struct sr_datafeed_meta {
 	GSList *config;
 };
 
+/**
+ * The stream parameters SR_DF_META packets carry, decoded, see
+ * sr_stream_params_update(). Parameters which weren't sent are 0.
+ */
+struct sr_stream_params {
+	/** SR_CONF_SAMPLERATE, or the device's samplerate at the header. */
+	uint64_t samplerate;
+	/** SR_CONF_SAMPLE_INTERVAL, in ms. */
+	uint64_t sample_interval;
+	/** SR_CONF_PACKED_PROBES: the logic probes in the packed data. */
+	uint64_t packed_probes;
+	/**
+	 * Bumped on every SR_DF_HEADER or SR_DF_META packet, so consumers
+	 * caching anything derived from the parameters can tell they
+	 * need to redo it.
+	 */
+	uint64_t generation;
+};
+
 struct sr_datafeed_logic {
 	uint64_t length;
 	uint16_t unitsize;
 	void *data;
+	/**
+	 * Number of the first sample in this packet, counting from the
+	 * start of the acquisition, and when it was sent, in
+	 * g_get_monotonic_time() microseconds. Both are filled in by the
+	 * session, whatever the sender put there.
+	 */
+	uint64_t start_sample;
+	int64_t timestamp;
+};
+
+/**
+ * Run-length encoded logic data: run i consists of counts[i] samples,
+ * all of them equal to sample i in values.
+ *
+ * Only datafeed callbacks which asked for it with
+ * sr_session_datafeed_callback_rle_set() get these, all others get the
+ * same data as SR_DF_LOGIC packets.
+ */
+struct sr_datafeed_logic_rle {
+	/** Number of samples in all runs together. */
+	uint64_t num_samples;
+	uint64_t num_runs;
+	uint16_t unitsize;
+	/** One sample per run, unitsize bytes each. */
+	void *values;
+	/** The length of each run, none of them 0. */
+	uint64_t *counts;
+	/**
+	 * Number of the first sample in this packet, counting from the
+	 * start of the acquisition, and when it was sent, in
+	 * g_get_monotonic_time() microseconds. Both are filled in by the
+	 * session, whatever the sender put there.
+	 */
+	uint64_t start_sample;
+	int64_t timestamp;
+};
+
+/**
+ * Logic data as a list of transitions: at sample number timestamps[i],
+ * the logic value changes to sample i in values. Sample numbers count
+ * from the start of the acquisition, the first transition being the
+ * initial value at sample 0.
+ *
+ * These are made by the session from SR_DF_LOGIC and SR_DF_LOGIC_RLE
+ * packets, for datafeed callbacks which asked for it with
+ * sr_session_datafeed_callback_edges_set().
+ */
+struct sr_datafeed_logic_edges {
+	/** Sample number of the first sample this packet covers. */
+	uint64_t start;
+	/** Number of samples this packet covers, with or without edges. */
+	uint64_t num_samples;
+	uint64_t num_edges;
+	uint16_t unitsize;
+	/** Sample number of each transition, in ascending order. */
+	uint64_t *timestamps;
+	/** The new value at each transition, unitsize bytes each. */
+	void *values;
 };
 
 struct sr_datafeed_analog {
@@ -305,10 +414,263 @@ struct sr_datafeed_analog {
 	/** Bitmap with extra information about the MQ. */
 	uint64_t mqflags;
 	/** The analog value(s). The data is interleaved according to
-	 * the probes list. */
+	 * the probes list, or planar for datafeed callbacks which asked
+	 * for it with sr_session_datafeed_callback_planar_set(). */
+	float *data;
+	/**
+	 * Number of the first sample in this packet, counting from the
+	 * start of the acquisition, and when it was sent, in
+	 * g_get_monotonic_time() microseconds. Both are filled in by the
+	 * session, whatever the sender put there.
+	 */
+	uint64_t start_sample;
+	int64_t timestamp;
+	/**
+	 * When each sample was taken, in g_get_monotonic_time()
+	 * microseconds, or NULL if they were all taken about when the
+	 * packet was sent. Only set for packets which collect several
+	 * readings, such as a multimeter's with SR_CONF_BATCH_SAMPLES.
+	 */
+	int64_t *timestamps;
+};
+
+/** Values for sr_datafeed_analog_raw.encoding. */
+enum {
+	/** Unsigned 8-bit samples. */
+	SR_ANALOG_U8 = 10000,
+	/** Signed 8-bit samples. */
+	SR_ANALOG_S8,
+	/** Signed 16-bit samples, host byte order. */
+	SR_ANALOG_S16,
+	/** Unsigned 9-bit samples in the low bits of 16-bit LE words. */
+	SR_ANALOG_U9,
+};
+
+/**
+ * Analog data in the native integer format of the device. The value of
+ * a sample of the i-th probe is raw * scale[i] + offset[i].
+ *
+ * Only datafeed callbacks which asked for it with
+ * sr_session_datafeed_callback_analog_raw_set() get these, all others get
+ * the same data converted to SR_DF_ANALOG packets.
+ */
+struct sr_datafeed_analog_raw {
+	/** The probes for which data is included in this packet. */
+	GSList *probes;
+	int num_samples;
+	/** Measured quantity (voltage, current, temperature, and so on). */
+	int mq;
+	/** Unit in which the MQ is measured. */
+	int unit;
+	/** Bitmap with extra information about the MQ. */
+	uint64_t mqflags;
+	/** Format of the samples, one of SR_ANALOG_*. */
+	int encoding;
+	/** Scale and offset of each probe, in the order of the probes list. */
+	float *scale;
+	float *offset;
+	/** The raw samples, interleaved according to the probes list. */
+	void *data;
+	/**
+	 * Number of the first sample in this packet, counting from the
+	 * start of the acquisition, and when it was sent, in
+	 * g_get_monotonic_time() microseconds. Both are filled in by the
+	 * session, whatever the sender put there.
+	 */
+	uint64_t start_sample;
+	int64_t timestamp;
+};
+
+/** Statistics of one probe's values, see sr_datafeed_analog_stats. */
+struct sr_analog_stats {
+	/** Number of values. */
+	uint64_t count;
+	float min;
+	float max;
+	double mean;
+	/** Root mean square of the values. */
+	double rms;
+	/**
+	 * Frequency in Hz, from the rising crossings of the middle of the
+	 * values' range, or 0 if there were less than two or the samplerate
+	 * isn't known.
+	 */
+	double frequency;
+};
+
+/**
+ * Statistics of analog data, as sent by the "measure" transform after
+ * each window of samples.
+ */
+struct sr_datafeed_analog_stats {
+	/** The probes the statistics are of. */
+	GSList *probes;
+	/** Measured quantity, unit and flags of the data. */
+	int mq;
+	int unit;
+	uint64_t mqflags;
+	/**
+	 * Number of the first sample of the window, and when its last
+	 * packet was sent.
+	 */
+	uint64_t start_sample;
+	int64_t timestamp;
+	/** The window's statistics, in the order of the probes list. */
+	struct sr_analog_stats *window;
+	/** The same, since the start of the acquisition. */
+	struct sr_analog_stats *total;
+};
+
+/** Counts of one bit of logic data, see sr_datafeed_logic_stats. */
+struct sr_logic_stats {
+	/** Number of samples. */
+	uint64_t count;
+	/** Samples the bit was high in. */
+	uint64_t high;
+	/** Changes of the bit, either way. */
+	uint64_t edges;
+	uint64_t rising;
+	/** The share of high samples, from 0 to 1. */
+	double duty_cycle;
+	/** Rising edges per second, or 0 if the samplerate isn't known. */
+	double frequency;
+};
+
+/**
+ * Statistics of logic data, as sent by the "logic-stats" transform after
+ * each window of samples.
+ */
+struct sr_datafeed_logic_stats {
+	/** Size of the samples, there are counts for each of their bits. */
+	uint16_t unitsize;
+	/**
+	 * Number of the first sample of the window, and when its last
+	 * packet was sent.
+	 */
+	uint64_t start_sample;
+	int64_t timestamp;
+	/** The window's counts, unitsize * 8 of them, lowest bit first. */
+	struct sr_logic_stats *window;
+	/** The same, since the start of the acquisition. */
+	struct sr_logic_stats *total;
+};
+
+/** Conditions for sr_analog_trigger.type. */
+enum {
+	/** The value rises to the level. */
+	SR_ANALOG_TRIGGER_RISING = 10000,
+	/** The value falls to the level. */
+	SR_ANALOG_TRIGGER_FALLING,
+	/** The value crosses the level, either way. */
+	SR_ANALOG_TRIGGER_EDGE,
+	/** The value enters the window from level to high. */
+	SR_ANALOG_TRIGGER_WINDOW_ENTER,
+	/** The value leaves the window from level to high. */
+	SR_ANALOG_TRIGGER_WINDOW_LEAVE,
+};
+
+/** An analog software trigger, see sr_session_analog_trigger_set(). */
+struct sr_analog_trigger {
+	/** One of SR_ANALOG_TRIGGER_*. */
+	int type;
+	/** The level, or the lower bound of the window. */
+	float level;
+	/** The upper bound of the window. */
+	float high;
+	/**
+	 * How far the value must have been on the other side of the level
+	 * (or window bound) first, so that noise doesn't trigger.
+	 */
+	float hysteresis;
+	/** Samples sent before each trigger. */
+	uint64_t pre_samples;
+	/**
+	 * Samples sent from each trigger on, in a frame of their own, after
+	 * which the trigger is armed again. With 0, everything from the
+	 * first trigger on is passed on instead.
+	 */
+	uint64_t post_samples;
+};
+
+/** Buses for sr_protocol_trigger.type. */
+enum {
+	/** Asynchronous serial, 8N1, idle high, LSB first. */
+	SR_PROTOCOL_TRIGGER_UART = 10000,
+	/** I2C: the address byte after a (repeated) START. */
+	SR_PROTOCOL_TRIGGER_I2C,
+	/** SPI: the first byte after chip select goes low, MSB first. */
+	SR_PROTOCOL_TRIGGER_SPI,
+};
+
+/**
+ * A software trigger on the first byte of a bus transaction, see
+ * sr_session_protocol_trigger_set().
+ */
+struct sr_protocol_trigger {
+	/** One of SR_PROTOCOL_TRIGGER_*. */
+	int type;
+	/** UART RX/TX, I2C SDA, or SPI MOSI/MISO. */
+	const struct sr_probe *data;
+	/** I2C SCL or SPI SCK. Unused for UART. */
+	const struct sr_probe *clock;
+	/** SPI chip select, active low. Only used for SPI. */
+	const struct sr_probe *select;
+	/** UART baud rate. Only used for UART. */
+	uint64_t baudrate;
+	/**
+	 * SPI mode, 0-3. Bits are sampled on the rising clock edge in
+	 * modes 0 and 3, on the falling one in modes 1 and 2.
+	 */
+	int spi_mode;
+	/**
+	 * The byte to trigger on: the UART data byte, the I2C address byte
+	 * (address << 1 | R/W), or the first SPI byte. Only the bits set in
+	 * mask are compared.
+	 */
+	uint8_t value;
+	uint8_t mask;
+};
+
+/** One probe's data in a frame, see struct sr_frame. */
+struct sr_frame_probe {
+	/** The probe. */
+	const struct sr_probe *probe;
+	/** Measured quantity, unit and flags, as in sr_datafeed_analog. */
+	int mq;
+	int unit;
+	uint64_t mqflags;
+	/** Number of values in data. */
+	uint64_t num_samples;
+	/** The probe's values, in the order they were sent. */
 	float *data;
 };
 
+/** A frame kept in the frame history, see sr_session_frame_get(). */
+struct sr_frame {
+	/** Number of the frame, counting from 0 at each acquisition start. */
+	uint64_t frame_num;
+	/** When the frame began, in g_get_monotonic_time() microseconds. */
+	int64_t timestamp;
+	/** The analog probes with data in the frame, in the order seen. */
+	unsigned int num_probes;
+	struct sr_frame_probe *probes;
+};
+
+/**
+ * The start of an input file, read once by sr_input_format_detect() for
+ * all input modules to look at.
+ */
+struct sr_input_header {
+	/** The name (and path) of the file. */
+	const char *filename;
+	/** The first bytes of the file. */
+	const uint8_t *buf;
+	/** The number of bytes in buf, less than wanted for short files. */
+	size_t len;
+	/** The size of the whole file. */
+	uint64_t filesize;
+};
+
 /** Input (file) format struct. */
 struct sr_input {
 	/**
@@ -343,13 +705,27 @@ struct sr_input_format {
 	 */
 	int (*format_match) (const char *filename);
 
+	/**
+	 * Check if this input module can load and parse a file, given the
+	 * start of it. Optional; sr_input_format_detect() calls this rather
+	 * than format_match(), so the file is only read once for all
+	 * modules.
+	 *
+	 * @param header The start of the file, and its name and size.
+	 *
+	 * @return TRUE if this module knows the format, FALSE if it doesn't.
+	 */
+	int (*format_match_header) (const struct sr_input_header *header);
+
 	/**
 	 * Initialize the input module.
 	 *
 	 * @param in A pointer to a valid 'struct sr_input' that the caller
 	 *           has to allocate and provide to this function. It is also
 	 *           the responsibility of the caller to free it later.
-	 * @param filename The name (and path) of the file to use.
+	 * @param filename The name (and path) of the file to use. NULL if
+	 *                 the data will be passed in with receive() instead,
+	 *                 which modules without receive() needn't support.
 	 *
 	 * @return SR_OK upon success, a negative error code upon failure.
 	 */
@@ -375,6 +751,33 @@ struct sr_input_format {
 	 * @return SR_OK upon success, a negative error code upon failure.
 	 */
 	int (*loadfile) (struct sr_input *in, const char *filename);
+
+	/**
+	 * Parse the next piece of the input, rather than loading a file.
+	 * Optional, see sr_input_send().
+	 *
+	 * The first call sends SR_DF_HEADER, and whatever the data holds
+	 * so far is sent to the session bus before returning. Data that
+	 * can't be parsed yet, e.g. a partial sample, is kept for the
+	 * next call.
+	 *
+	 * @param in The input, as passed to init().
+	 * @param buf The data. Only valid during the call.
+	 * @param len The number of bytes in buf.
+	 *
+	 * @return SR_OK upon success, a negative error code upon failure.
+	 */
+	int (*receive) (struct sr_input *in, const void *buf, size_t len);
+
+	/**
+	 * Finish the input passed in with receive(), and send SR_DF_END.
+	 * Required if receive() is there.
+	 *
+	 * @param in The input, as passed to init().
+	 *
+	 * @return SR_OK upon success, a negative error code upon failure.
+	 */
+	int (*end) (struct sr_input *in);
 };
 
 /** Output (file) format struct. */
@@ -401,11 +804,58 @@ struct sr_output {
 	/**
 	 * A generic pointer which can be used by the module to keep internal
 	 * state between calls into its callback functions.
-	 *
-	 * For example, the module might store a pointer to a chunk of output
-	 * there, and only flush it when it reaches a certain size.
 	 */
 	void *internal;
+
+	/**
+	 * Output generated by the module which has not been written to
+	 * the frontend's sink yet. Created by sr_output_new(), and reused
+	 * for the whole datafeed.
+	 */
+	GString *buf;
+
+	/**
+	 * State used by sr_output_send() to feed logic data to modules
+	 * implementing encode(). Private to libsigrok.
+	 */
+	struct sr_output_encoder *encoder;
+
+	/**
+	 * State used to compress the output before it's written, see
+	 * sr_output_compress_set(). Private to libsigrok.
+	 */
+	struct sr_output_compressor *compressor;
+
+	/**
+	 * The parameters of the datafeed, updated by sr_output_send()
+	 * before the module sees an SR_DF_HEADER or SR_DF_META packet.
+	 */
+	struct sr_stream_params params;
+};
+
+/**
+ * A range of logic samples an output module encodes in one go, see the
+ * encode() callback of 'struct sr_output_format'.
+ */
+struct sr_output_chunk {
+	/** The samples. */
+	const uint8_t *data;
+	/** Number of samples at data. */
+	uint64_t num_samples;
+	/** Size of each sample, in bytes. */
+	uint16_t unitsize;
+	/**
+	 * Number of the first sample, counting all logic samples passed
+	 * to this output so far. 0 for the first chunk of the datafeed.
+	 */
+	uint64_t start_sample;
+	/**
+	 * The sample before the first one, with the same unitsize, or
+	 * NULL if there is none.
+	 */
+	const uint8_t *prev_sample;
+	/** TRUE if the chunk ends a SR_DF_LOGIC packet. */
+	gboolean packet_end;
 };
 
 struct sr_output_format {
@@ -446,88 +896,71 @@ struct sr_output_format {
 	int (*init) (struct sr_output *o);
 
 	/**
-	 * Whenever a chunk of data comes in, it will be passed to the
-	 * output module via this function. The <code>data_in</code> and
-	 * <code>length_in</code> values refers to this data; the module
-	 * must not alter or g_free() this buffer.
-	 *
-	 * The function must allocate a buffer for storing its output, and
-	 * pass along a pointer to this buffer in the <code>data_out</code>
-	 * parameter, as well as storing the length of the buffer in
-	 * <code>length_out</code>. The calling frontend will g_free()
-	 * this buffer when it's done with it.
-	 *
-	 * IMPORTANT: The memory allocation much happen using a glib memory
-	 * allocation call (not a "normal" malloc) since g_free() will be
-	 * used to free the memory!
-	 *
-	 * If there is no output, this function MUST store NULL in the
-	 * <code>data_out</code> parameter, so the caller knows not to try
-	 * and g_free() it.
+	 * This function is passed a copy of every packet in the data feed.
+	 * Any output generated by the output module in response to the
+	 * packet is appended to <code>out</code>, which belongs to the
+	 * caller and may already hold output from earlier packets.
 	 *
-	 * Note: This API call is obsolete, use receive() instead.
+	 * Packets not of interest to the output module can just be ignored.
+	 * After SR_DF_END no more packets are passed in until the next
+	 * datafeed starts.
 	 *
 	 * @param o Pointer to the respective 'struct sr_output'.
-	 * @param data_in Pointer to the input data buffer.
-	 * @param length_in Length of the input.
-	 * @param data_out Pointer to the allocated output buffer.
-	 * @param length_out Length (in bytes) of the output.
+	 * @param sdi The device instance that generated the packet.
+	 * @param packet The complete packet.
+	 * @param out The string to append output to.
 	 *
 	 * @return SR_OK upon success, a negative error code otherwise.
 	 */
-	int (*data) (struct sr_output *o, const uint8_t *data_in,
-		     uint64_t length_in, uint8_t **data_out,
-		     uint64_t *length_out);
+	int (*receive) (struct sr_output *o, const struct sr_dev_inst *sdi,
+			const struct sr_datafeed_packet *packet, GString *out);
 
 	/**
-	 * This function is called when an event occurs in the datafeed
-	 * which the output module may need to be aware of. No data is
-	 * passed in, only the fact that the event occurs. The following
-	 * events can currently be passed in:
+	 * Encode a range of logic samples. Modules implementing this get
+	 * SR_DF_LOGIC packets only through this callback, and all other
+	 * packets through receive().
 	 *
-	 *  - SR_DF_TRIGGER: At this point in the datafeed, the trigger
-	 *    matched. The output module may mark this in some way, e.g. by
-	 *    plotting a red line on a graph.
+	 * Everything the output depends on besides the samples themselves,
+	 * such as the previous sample or the sample number, is passed in
+	 * the chunk. The function must not change the module's state
+	 * other than from the chunk starting the datafeed, so that a large
+	 * packet can be split into ranges which are encoded at the same
+	 * time in several threads, see sr_output_threads_set(). Output of
+	 * the ranges is put together in order afterwards. The chunk
+	 * starting the datafeed is always encoded in the thread calling
+	 * sr_output_send(), before any other.
 	 *
-	 *  - SR_DF_END: This marks the end of the datafeed. No more calls
-	 *    into the output module will be done, so this is a good time to
-	 *    free up any memory used to keep state, for example.
-	 *
-	 * Any output generated by this function must have a reference to
-	 * it stored in the <code>data_out</code> and <code>length_out</code>
-	 * parameters, or NULL if no output was generated.
-	 *
-	 * Note: This API call is obsolete, use receive() instead.
+	 * Optional.
 	 *
 	 * @param o Pointer to the respective 'struct sr_output'.
-	 * @param event_type Type of event that occured.
-	 * @param data_out Pointer to the allocated output buffer.
-	 * @param length_out Length (in bytes) of the output.
+	 * @param chunk The samples, and the state they are encoded in.
+	 * @param out The string to append output to.
 	 *
 	 * @return SR_OK upon success, a negative error code otherwise.
 	 */
-	int (*event) (struct sr_output *o, int event_type, uint8_t **data_out,
-			uint64_t *length_out);
+	int (*encode) (struct sr_output *o, const struct sr_output_chunk *chunk,
+			GString *out);
 
 	/**
-	 * This function is passed a copy of every packed in the data feed.
-	 * Any output generated by the output module in response to the
-	 * packet should be returned in a newly allocated GString
-	 * <code>out</code>, which will be freed by the caller.
+	 * Like receive(), but instead of appending its output the module
+	 * hands it directly to the given sink, possibly in several pieces.
+	 * This lets a module pass on data it does not need to convert
+	 * (e.g. the packet's payload) without copying it first.
 	 *
-	 * Packets not of interest to the output module can just be ignored,
-	 * and the <code>out</code> parameter set to NULL.
+	 * Optional. sr_output_send() uses this instead of receive() if it
+	 * is implemented.
 	 *
 	 * @param o Pointer to the respective 'struct sr_output'.
 	 * @param sdi The device instance that generated the packet.
 	 * @param packet The complete packet.
-	 * @param out A pointer where a GString * should be stored if
-	 * the module generates output, or NULL if not.
+	 * @param cb The sink to write output to.
+	 * @param cb_data Opaque pointer passed to the sink.
 	 *
 	 * @return SR_OK upon success, a negative error code otherwise.
 	 */
-	int (*receive) (struct sr_output *o, const struct sr_dev_inst *sdi,
-			const struct sr_datafeed_packet *packet, GString **out);
+	int (*write) (struct sr_output *o, const struct sr_dev_inst *sdi,
+			const struct sr_datafeed_packet *packet,
+			sr_output_write_callback_t cb, void *cb_data);
 
 	/**
 	 * This function is called after the caller is finished using
@@ -539,6 +972,81 @@ struct sr_output_format {
 	int (*cleanup) (struct sr_output *o);
 };
 
+/** Transform (datafeed filter) struct, see sr_session_transform_add(). */
+struct sr_transform {
+	/**
+	 * A pointer to this transform's 'struct sr_transform_format'.
+	 */
+	struct sr_transform_format *format;
+
+	/** The session whose datafeed this transform works on. */
+	struct sr_session *session;
+
+	/**
+	 * Optional parameters, as a hash table of strings keyed by
+	 * option name. How they are interpreted is up to the module.
+	 * May be NULL.
+	 */
+	GHashTable *param;
+
+	/**
+	 * A generic pointer which can be used by the module to keep internal
+	 * state between calls into its callback functions.
+	 */
+	void *internal;
+};
+
+struct sr_transform_format {
+	/**
+	 * A unique ID for this transform module, suitable for use in
+	 * command-line clients, [a-z0-9-]. Must not be NULL.
+	 */
+	char *id;
+
+	/**
+	 * A short description of the transform module, which can (for
+	 * example) be displayed to the user by frontends. Must not be NULL.
+	 */
+	char *description;
+
+	/**
+	 * This function is called once, when the transform is added to the
+	 * session. It should parse the parameters and allocate any state
+	 * the module needs.
+	 *
+	 * @param t Pointer to the respective 'struct sr_transform'.
+	 *
+	 * @return SR_OK upon success, a negative error code otherwise.
+	 */
+	int (*init) (struct sr_transform *t);
+
+	/**
+	 * This function is passed every packet on the datafeed, on the
+	 * session thread, before it reaches any datafeed callbacks. The
+	 * module passes packets on with sr_transform_send(), as they are
+	 * or modified, as many times as it likes, or not at all. Packets
+	 * passed on only need to remain valid until that call returns.
+	 *
+	 * @param t Pointer to the respective 'struct sr_transform'.
+	 * @param sdi The device instance that generated the packet.
+	 * @param packet The complete packet.
+	 *
+	 * @return SR_OK upon success, a negative error code otherwise.
+	 */
+	int (*receive) (struct sr_transform *t, const struct sr_dev_inst *sdi,
+			const struct sr_datafeed_packet *packet);
+
+	/**
+	 * This function is called when the transform is removed from the
+	 * session, and should free any internal resources the module keeps.
+	 *
+	 * @param t Pointer to the respective 'struct sr_transform'.
+	 *
+	 * @return SR_OK upon success, a negative error code otherwise.
+	 */
+	int (*cleanup) (struct sr_transform *t);
+};
+
 enum {
 	SR_PROBE_LOGIC = 10000,
 	SR_PROBE_ANALOG,
@@ -638,6 +1146,12 @@ enum {
 	 */
 	SR_CONF_SERIALCOMM,
 
+	/** Number of logic probes a device with a variable number gets. */
+	SR_CONF_NUM_LOGIC_PROBES,
+
+	/** Number of analog probes a device with a variable number gets. */
+	SR_CONF_NUM_ANALOG_PROBES,
+
 	/*--- Device configuration ------------------------------------------*/
 
 	/** The device supports setting its samplerate, in Hz. */
@@ -715,6 +1229,55 @@ enum {
 	 */
 	SR_CONF_SWAP,
 
+	/**
+	 * The device generates data as fast as the host can take it,
+	 * rather than at the rate set with SR_CONF_SAMPLERATE.
+	 */
+	SR_CONF_FREERUN,
+
+	/**
+	 * Number of readings the device collects into one packet, 0 or 1
+	 * to send each reading as soon as it arrives.
+	 */
+	SR_CONF_BATCH_SAMPLES,
+
+	/**
+	 * Longest time (in ms) a reading waits for others to fill up its
+	 * packet, 0 for no limit.
+	 */
+	SR_CONF_BATCH_MSEC,
+
+	/**
+	 * Speed at which recorded data is replayed, relative to its
+	 * samplerate (1.0 is real time), or 0 to replay it as fast as
+	 * possible.
+	 */
+	SR_CONF_REPLAY_SPEED,
+
+	/**
+	 * Highest samplerate (in Hz) the device can keep up with, for the
+	 * probes enabled now. Can only be read, see
+	 * sr_config_samplerate_max().
+	 */
+	SR_CONF_MAX_SAMPLERATE,
+
+	/**
+	 * Settings of the hardware trigger's stages beyond the probes'
+	 * trigger strings, as a string. The stages are separated by ';',
+	 * the settings of each by ',':
+	 *
+	 * - delay=<n>: Let the stage fire n samples after it matched.
+	 * - level=<n>: The trigger level the stage is armed at, by default
+	 *   its number. Each stage that fires raises the level by one.
+	 * - serial=<probe>: Match the stage's mask and value against the
+	 *   latest samples of that probe, rather than all probes at once.
+	 * - mask=<n>, value=<n>: The stage's mask and value, in place of
+	 *   those from the probes' trigger strings.
+	 * - start: Start the capture when this stage fires, rather than at
+	 *   the last stage.
+	 */
+	SR_CONF_TRIGGER_STAGES,
+
 	/*--- Special stuff -------------------------------------------------*/
 
 	/** Scan options supported by the driver. */
@@ -750,6 +1313,37 @@ enum {
 	 * is always the default. */
 	SR_CONF_DATA_SOURCE,
 
+	/**
+	 * Lower and upper bound for the number of USB transfers the
+	 * driver keeps queued. The driver adapts the number within these
+	 * bounds to the load of the host.
+	 */
+	SR_CONF_USB_TRANSFERS,
+
+	/**
+	 * The driver packs the logic data to the enabled probes. The
+	 * samples then only hold those, from bit 0 on in the order of
+	 * their indices, and the SR_CONF_PACKED_PROBES in an SR_DF_META
+	 * packet after the header tell which probes they are. Receivers
+	 * need no sr_filter_probes() for that data anymore.
+	 */
+	SR_CONF_PROBE_PACKING,
+
+	/**
+	 * The probes packed logic data holds, as a mask of their indices:
+	 * bit n of each sample is the n-th probe set in the mask, counting
+	 * from the lowest. Only sent in SR_DF_META packets, see
+	 * SR_CONF_PROBE_PACKING and sr_filter_probes_pack_mask().
+	 */
+	SR_CONF_PACKED_PROBES,
+
+	/**
+	 * The number of samples before and after the trigger point to
+	 * read from the device's sample memory, rather than all of it.
+	 * (0, 0) reads the whole memory.
+	 */
+	SR_CONF_TRIGGER_WINDOW,
+
 	/*--- Acquisition modes ---------------------------------------------*/
 
 	/**
@@ -795,6 +1389,29 @@ struct sr_dev_inst {
 	GSList *probe_groups;
 	void *conn;
 	void *priv;
+	/** The session the device was added to, if any. */
+	struct sr_session *session;
+	/** Cached config values, or NULL if caching is off. */
+	GHashTable *config_cache;
+	/** The probes by index, built when first needed. */
+	struct sr_probe_table *probe_table;
+	/** Whether sr_dev_close() leaves the device open, see
+	 * sr_dev_keep_open(). */
+	gboolean keep_open;
+	/** Whether sr_dev_close() left the device open, for the next
+	 * sr_dev_open() to reuse. */
+	gboolean held_open;
+	/** The SR_CONF_LIMIT_SAMPLES and SR_CONF_LIMIT_MSEC values last
+	 * set with sr_config_set(), which the session holds the device's
+	 * data to, or 0 for no limit. */
+	uint64_t limit_samples;
+	uint64_t limit_msec;
+	/** Bytes the driver allocated for the device, the most it had in
+	 * use at once, and the limit set with sr_dev_mem_limit_set(), or
+	 * 0 for none. See sr_dev_mem_get(). */
+	uint64_t mem_used;
+	uint64_t mem_peak;
+	uint64_t mem_limit;
 };
 
 /** Types of device instances (sr_dev_inst). */
@@ -829,6 +1446,13 @@ struct sr_dev_driver {
 	int (*init) (struct sr_context *sr_ctx);
 	int (*cleanup) (void);
 	GSList *(*scan) (GSList *options);
+	/**
+	 * Probe one port, as scan() does with it for SR_CONF_CONN, but
+	 * without adding what it finds to the driver's instance list.
+	 * Must be safe to run for several ports at once. Optional; see
+	 * sr_driver_scan_async().
+	 */
+	GSList *(*scan_port) (const char *port, GSList *options);
 	GSList *(*dev_list) (void);
 	int (*dev_clear) (void);
 	int (*config_get) (int id, GVariant **data,
@@ -844,6 +1468,12 @@ struct sr_dev_driver {
 	/* Device-specific */
 	int (*dev_open) (struct sr_dev_inst *sdi);
 	int (*dev_close) (struct sr_dev_inst *sdi);
+	/**
+	 * Check that a device left open by sr_dev_close() is still there
+	 * and set up, without setting it up again. Optional; without it,
+	 * such a device is reused as it is.
+	 */
+	int (*dev_check) (struct sr_dev_inst *sdi);
 	int (*dev_acquisition_start) (const struct sr_dev_inst *sdi,
 			void *cb_data);
 	int (*dev_acquisition_stop) (struct sr_dev_inst *sdi,
@@ -853,12 +1483,167 @@ struct sr_dev_driver {
 	void *priv;
 };
 
+/** Events reported to the callback set with sr_hotplug_set(). */
+enum {
+	/** A device was plugged in, and a driver found an instance on it. */
+	SR_HOTPLUG_ARRIVED = 10000,
+	/** The device behind an instance was unplugged. */
+	SR_HOTPLUG_LEFT,
+};
+
+/**
+ * Called from sr_hotplug_handle_events() for every device instance that
+ * appeared or went away. Unplugged instances stay in their driver's list
+ * until the driver is cleared or rescanned.
+ */
+typedef void (*sr_hotplug_callback_t)(int event, struct sr_dev_inst *sdi,
+		void *cb_data);
+
+/**
+ * Called by sr_driver_scan_async() for every device instance found, from
+ * one of the scan's threads, but never for two instances at once.
+ */
+typedef void (*sr_scan_callback_t)(struct sr_dev_inst *sdi, void *cb_data);
+
+/**
+ * Opaque data structure representing a scan started with
+ * sr_driver_scan_async().
+ */
+struct sr_scan;
+
 /**
  * Opaque data structure representing a libsigrok session. None of the fields
  * of this structure are meant to be accessed directly.
  */
 struct sr_session;
 
+/** Number of buckets in each callback's histogram of call durations. */
+#define SR_STATS_HISTOGRAM_SIZE 24
+
+/** Datafeed statistics of one device, see sr_session_stats_get(). */
+struct sr_dev_stats {
+	const struct sr_dev_inst *sdi;
+	/** Packets the device sent, of any type. */
+	uint64_t packets;
+	/** Bytes of logic and analog data the device sent. */
+	uint64_t bytes;
+	/** Times the driver reported losing data to an overrun. */
+	uint64_t overruns;
+	/** Transfers from the device that came back empty or failed. */
+	uint64_t empty_transfers;
+	/** Frames the device completed, i.e. SR_DF_FRAME_END packets. */
+	uint64_t frames;
+	/**
+	 * Time from the end of the first frame to the end of the last one,
+	 * in us. The frame rate is (frames - 1) * 1000000 / frame_us.
+	 */
+	uint64_t frame_us;
+	/** Bytes the driver allocated for the device, and the most it had
+	 * in use at once. */
+	uint64_t mem_used;
+	uint64_t mem_peak;
+};
+
+/** Statistics of one datafeed callback, see sr_session_stats_get(). */
+struct sr_callback_stats {
+	void (*cb)(const struct sr_dev_inst *sdi,
+			const struct sr_datafeed_packet *packet, void *cb_data);
+	void *cb_data;
+	/** Number of packets passed to the callback. */
+	uint64_t calls;
+	/** Time spent in the callback in total, and at most per call, in us. */
+	uint64_t total_us;
+	uint64_t max_us;
+	/**
+	 * Number of calls by duration: histogram[0] counts calls of less
+	 * than 1 us, histogram[i] those of 2^(i-1) to 2^i us, and the last
+	 * one all longer calls as well.
+	 */
+	uint64_t histogram[SR_STATS_HISTOGRAM_SIZE];
+	/** Logic and analog samples passed to the callback. */
+	uint64_t samples;
+	/**
+	 * With stage timing, the part of total_us spent in the callback
+	 * itself, not in the stages it ran (e.g. an output module).
+	 */
+	uint64_t self_us;
+};
+
+/** Size of the name of a stage, see struct sr_stage_stats. */
+#define SR_STAGE_NAME_SIZE 48
+
+/**
+ * Time spent in one stage of the datafeed, see
+ * sr_session_stage_timing_set().
+ */
+struct sr_stage_stats {
+	/**
+	 * The stage, e.g. "trigger", "transform:invert", "output:vcd" or
+	 * "convert:saleae-logic16".
+	 */
+	char name[SR_STAGE_NAME_SIZE];
+	/** Number of times the stage ran. */
+	uint64_t calls;
+	/** Time spent in the stage itself, not in stages it ran, in us. */
+	uint64_t us;
+	/** Logic and analog samples the stage handled. */
+	uint64_t samples;
+};
+
+/**
+ * Statistics of a session, see sr_session_stats_get(). All counters are
+ * reset when the session is started.
+ */
+struct sr_session_stats {
+	/** Iterations of the session's main loop. */
+	uint64_t iterations;
+	/** Time spent waiting for events, in us. */
+	uint64_t poll_us;
+	/** Time spent in the drivers' event source callbacks, in us. */
+	uint64_t sources_us;
+	/** See sr_session_queue_stats_get(). */
+	uint64_t queue_overruns;
+	unsigned int queue_max_used;
+	/** Bytes allocated for all devices, and the most in use at once. */
+	uint64_t mem_used;
+	uint64_t mem_peak;
+	/** One entry for every device which sent packets. */
+	unsigned int num_devs;
+	struct sr_dev_stats *devs;
+	/** One entry for every datafeed callback. */
+	unsigned int num_callbacks;
+	struct sr_callback_stats *callbacks;
+	/** With stage timing, how long the session ran (or runs), in us. */
+	uint64_t run_us;
+	/** With stage timing, one entry for every stage which ran. */
+	unsigned int num_stages;
+	struct sr_stage_stats *stages;
+};
+
+/**
+ * Opaque data structure representing a session file being written, see
+ * sr_session_writer_open().
+ */
+struct sr_session_writer;
+
+/**
+ * Opaque data structure representing a session file opened for random
+ * access, see sr_session_reader_open().
+ */
+struct sr_session_reader;
+
+/**
+ * Opaque data structure representing a capture buffer which spills to a
+ * session file, see sr_session_spill_open().
+ */
+struct sr_session_spill;
+
+/**
+ * Opaque data structure representing the producer side of a shared memory
+ * ring, see sr_shm_writer_open().
+ */
+struct sr_shm_writer;
+
 #include "proto.h"
 #include "version.h"
 
@@ -20,6 +20,7 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
@@ -40,6 +41,22 @@
 /* Currently selected libsigrok loglevel. Default: SR_LOG_WARN. */
 static int sr_loglevel = SR_LOG_WARN; /* Show errors+warnings per default. */
 
+/* The most verbose of sr_loglevel and the module loglevels. */
+SR_PRIV int sr_loglevel_max = SR_LOG_WARN;
+
+/* A loglevel set with sr_log_module_loglevel_set(). */
+struct module_loglevel {
+	char *module;
+	int loglevel;
+};
+
+/* The module loglevels, guarded by the module_loglevels lock. */
+static GSList *module_loglevels = NULL;
+G_LOCK_DEFINE_STATIC(module_loglevels);
+
+/* Bumped whenever a loglevel changes, so call sites look theirs up again. */
+static gint loglevel_gen = 1;
+
 /* Function prototype. */
 static int sr_logv(void *cb_data, int loglevel, const char *format,
 		   va_list args);
@@ -60,6 +77,23 @@ static void *sr_log_callback_data = NULL;
 /** @endcond */
 static char sr_log_domain[LOGDOMAIN_MAXLEN + 1] = LOGDOMAIN_DEFAULT;
 
+/* Update after a loglevel changed, with the module_loglevels lock held. */
+static void loglevels_changed(void)
+{
+	struct module_loglevel *ml;
+	GSList *l;
+	int max;
+
+	max = sr_loglevel;
+	for (l = module_loglevels; l; l = l->next) {
+		ml = l->data;
+		max = MAX(max, ml->loglevel);
+	}
+	sr_loglevel_max = max;
+	/* The generation has to fit in the state bits above the loglevel. */
+	g_atomic_int_set(&loglevel_gen, loglevel_gen % (G_MAXINT >> 3) + 1);
+}
+
 /**
  * Set the libsigrok loglevel.
  *
@@ -84,7 +118,10 @@ SR_API int sr_log_loglevel_set(int loglevel)
 		return SR_ERR_ARG;
 	}
 
+	G_LOCK(module_loglevels);
 	sr_loglevel = loglevel;
+	loglevels_changed();
+	G_UNLOCK(module_loglevels);
 
 	sr_dbg("libsigrok loglevel set to %d.", loglevel);
 
@@ -103,6 +140,193 @@ SR_API int sr_log_loglevel_get(void)
 	return sr_loglevel;
 }
 
+/* Whether a module name covers the module with the given log prefix. */
+static gboolean module_match(const char *module, const char *prefix)
+{
+	size_t len;
+
+	len = strlen(module);
+
+	return !strncmp(prefix, module, len)
+			&& (prefix[len] == ':' || prefix[len] == '/');
+}
+
+/* The loglevel for a log prefix, with the module_loglevels lock held. */
+static int prefix_loglevel(const char *prefix)
+{
+	struct module_loglevel *ml;
+	GSList *l;
+	size_t len, best;
+	int loglevel;
+
+	loglevel = sr_loglevel;
+	best = 0;
+	for (l = module_loglevels; l; l = l->next) {
+		ml = l->data;
+		len = strlen(ml->module);
+		if (len > best && module_match(ml->module, prefix)) {
+			loglevel = ml->loglevel;
+			best = len;
+		}
+	}
+
+	return loglevel;
+}
+
+static struct module_loglevel *module_loglevel_find(const char *module)
+{
+	struct module_loglevel *ml;
+	GSList *l;
+
+	for (l = module_loglevels; l; l = l->next) {
+		ml = l->data;
+		if (!strcmp(ml->module, module))
+			return ml;
+	}
+
+	return NULL;
+}
+
+static void module_loglevel_free(void *data)
+{
+	struct module_loglevel *ml;
+
+	ml = data;
+	g_free(ml->module);
+	g_free(ml);
+}
+
+/**
+ * Set the loglevel of one libsigrok module, overriding the one set with
+ * sr_log_loglevel_set() for it.
+ *
+ * Modules are named like the prefixes of their messages, without the
+ * colon, e.g. "fx2lafw", "session" or "input/vcd". A name also covers the
+ * modules below it, so "output" applies to "output/vcd" unless that has
+ * a loglevel of its own. This allows debugging one driver or subsystem
+ * without the others spending time on formatting their messages.
+ *
+ * @param module The module name. Must not be NULL or empty.
+ * @param loglevel The loglevel to set (SR_LOG_NONE, SR_LOG_ERR, SR_LOG_WARN,
+ *                 SR_LOG_INFO, SR_LOG_DBG, or SR_LOG_SPEW).
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_MALLOC upon memory allocation errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_log_module_loglevel_set(const char *module, int loglevel)
+{
+	struct module_loglevel *ml;
+
+	if (!module || !*module) {
+		sr_err("log: %s: module was NULL or empty", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (loglevel < SR_LOG_NONE || loglevel > SR_LOG_SPEW) {
+		sr_err("Invalid loglevel %d.", loglevel);
+		return SR_ERR_ARG;
+	}
+
+	G_LOCK(module_loglevels);
+	if (!(ml = module_loglevel_find(module))) {
+		if (!(ml = g_try_malloc(sizeof(struct module_loglevel)))) {
+			G_UNLOCK(module_loglevels);
+			sr_err("log: %s: ml malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		ml->module = g_strdup(module);
+		module_loglevels = g_slist_prepend(module_loglevels, ml);
+	}
+	ml->loglevel = loglevel;
+	loglevels_changed();
+	G_UNLOCK(module_loglevels);
+
+	sr_dbg("Loglevel of module '%s' set to %d.", module, loglevel);
+
+	return SR_OK;
+}
+
+/**
+ * Get the loglevel of one libsigrok module.
+ *
+ * @param module The module name, see sr_log_module_loglevel_set(). Must
+ *               not be NULL.
+ *
+ * @return The loglevel the module's messages are output with: its own,
+ *         that of the nearest module above it, or the global one.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_log_module_loglevel_get(const char *module)
+{
+	char *prefix;
+	int loglevel;
+
+	if (!module)
+		return sr_loglevel;
+
+	prefix = g_strconcat(module, ":", NULL);
+	G_LOCK(module_loglevels);
+	loglevel = prefix_loglevel(prefix);
+	G_UNLOCK(module_loglevels);
+	g_free(prefix);
+
+	return loglevel;
+}
+
+/**
+ * Remove the loglevel set for a module, so it uses the global one again.
+ *
+ * @param module The module name, or NULL to remove the loglevels of all
+ *               modules.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG if the module has no loglevel
+ *         of its own.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_log_module_loglevel_unset(const char *module)
+{
+	struct module_loglevel *ml;
+
+	G_LOCK(module_loglevels);
+	if (!module) {
+		g_slist_free_full(module_loglevels, module_loglevel_free);
+		module_loglevels = NULL;
+	} else if ((ml = module_loglevel_find(module))) {
+		module_loglevels = g_slist_remove(module_loglevels, ml);
+		module_loglevel_free(ml);
+	} else {
+		G_UNLOCK(module_loglevels);
+		return SR_ERR_ARG;
+	}
+	loglevels_changed();
+	G_UNLOCK(module_loglevels);
+
+	return SR_OK;
+}
+
+/** @private */
+SR_PRIV gboolean sr_log_module_enabled(struct sr_log_module *mod,
+		int loglevel)
+{
+	gint state, gen;
+
+	state = g_atomic_int_get(&mod->state);
+	gen = g_atomic_int_get(&loglevel_gen);
+	if (state >> 3 != gen) {
+		G_LOCK(module_loglevels);
+		gen = g_atomic_int_get(&loglevel_gen);
+		state = gen << 3 | prefix_loglevel(mod->prefix);
+		G_UNLOCK(module_loglevels);
+		g_atomic_int_set(&mod->state, state);
+	}
+
+	return loglevel <= (state & 7);
+}
+
 /**
  * Set the libsigrok logdomain string.
  *
@@ -151,6 +375,10 @@ SR_API char *sr_log_logdomain_get(void)
 /**
  * Set the libsigrok log callback to the specified function.
  *
+ * Only messages up to the loglevel set with sr_log_loglevel_set(), or
+ * the module's one set with sr_log_module_loglevel_set(), are passed to
+ * the callback.
+ *
  * @param cb Function pointer to the log callback function to use.
  *           Must not be NULL.
  * @param cb_data Pointer to private data to be passed on. This can be used by
@@ -205,10 +433,8 @@ static int sr_logv(void *cb_data, int loglevel, const char *format, va_list args
 
 	/* This specific log callback doesn't need the void pointer data. */
 	(void)cb_data;
-
-	/* Only output messages of at least the selected loglevel(s). */
-	if (loglevel > sr_loglevel)
-		return SR_OK; /* TODO? */
+	/* The loglevels were checked before, per module. */
+	(void)loglevel;
 
 	if (sr_log_domain[0] != '\0')
 		fprintf(stderr, "%s", sr_log_domain);
@@ -218,14 +444,210 @@ static int sr_logv(void *cb_data, int loglevel, const char *format, va_list args
 	return ret;
 }
 
+/** @cond PRIVATE */
+/* Records in the async log ring, a power of two. */
+#define LOG_RING_SIZE 1024
+/* Longer messages are cut short in async mode. */
+#define LOG_RECORD_SIZE 256
+/** @endcond */
+
+/*
+ * One preformatted message. A record at ring position pos is free for
+ * writing when seq == pos, and holds a message when seq == pos + 1.
+ */
+struct log_record {
+	gint seq;
+	int loglevel;
+	char text[LOG_RECORD_SIZE];
+};
+
+static struct log_record *log_ring = NULL;
+/* Next position to write to (any thread) and to read from (drain thread). */
+static gint log_head, log_tail;
+static gint log_dropped;
+static gint log_stop;
+static GThread *log_thread = NULL;
+
+/* Take a free record, or NULL if the ring is full. */
+static struct log_record *ring_reserve(guint *pos)
+{
+	struct log_record *rec;
+	guint head;
+	gint diff;
+
+	head = g_atomic_int_get(&log_head);
+	while (TRUE) {
+		rec = &log_ring[head & (LOG_RING_SIZE - 1)];
+		diff = (gint)((guint)g_atomic_int_get(&rec->seq) - head);
+		if (diff == 0) {
+			if (g_atomic_int_compare_and_exchange(&log_head,
+					head, head + 1))
+				break;
+		} else if (diff < 0) {
+			/* The drain thread hasn't got to it yet. */
+			return NULL;
+		}
+		head = g_atomic_int_get(&log_head);
+	}
+	*pos = head;
+
+	return rec;
+}
+
+/* Pass a preformatted message to the log callback. */
+static int log_call(int loglevel, const char *format, ...)
+{
+	int ret;
+	va_list args;
+
+	va_start(args, format);
+	ret = sr_log_callback(sr_log_callback_data, loglevel, format, args);
+	va_end(args);
+
+	return ret;
+}
+
+/* Drain the ring; returns FALSE when it was empty. */
+static gboolean ring_drain(void)
+{
+	struct log_record *rec;
+	guint tail;
+	gboolean drained;
+
+	drained = FALSE;
+	tail = log_tail;
+	while (TRUE) {
+		rec = &log_ring[tail & (LOG_RING_SIZE - 1)];
+		if ((guint)g_atomic_int_get(&rec->seq) != tail + 1)
+			break;
+		log_call(rec->loglevel, "%s", rec->text);
+		g_atomic_int_set(&rec->seq, tail + LOG_RING_SIZE);
+		tail++;
+		drained = TRUE;
+	}
+	log_tail = tail;
+
+	return drained;
+}
+
+static gpointer log_thread_run(gpointer data)
+{
+	(void)data;
+
+	while (!g_atomic_int_get(&log_stop)) {
+		if (!ring_drain())
+			g_usleep(1000);
+	}
+	/* Everything logged before stopping still gets out. */
+	ring_drain();
+
+	return NULL;
+}
+
+/**
+ * Enable or disable asynchronous logging.
+ *
+ * When enabled, log messages are formatted on the thread which logs them
+ * and put on a lock-free queue, and a background thread passes them to the
+ * log callback. Logging then never waits for the callback, which makes it
+ * safe to enable verbose log levels while an acquisition runs, e.g. from
+ * USB transfer callbacks. Messages longer than 255 characters are cut
+ * short. If the queue is full, messages are dropped and counted, see
+ * sr_log_async_dropped_get().
+ *
+ * The log callback is called from the background thread in this mode. It
+ * should not be changed while asynchronous logging is enabled. Disabling
+ * it waits until all queued messages are passed on.
+ *
+ * @param enable TRUE to enable asynchronous logging, FALSE to disable it.
+ *
+ * @return SR_OK upon success, SR_ERR_MALLOC upon memory allocation errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_log_async_set(gboolean enable)
+{
+	GThread *thread;
+	int i;
+
+	if (enable && !log_thread) {
+		if (!log_ring && !(log_ring = g_try_malloc(LOG_RING_SIZE
+				* sizeof(struct log_record)))) {
+			sr_err("log: %s: log_ring malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		for (i = 0; i < LOG_RING_SIZE; i++)
+			log_ring[i].seq = i;
+		log_head = log_tail = 0;
+		g_atomic_int_set(&log_stop, 0);
+		g_atomic_pointer_set(&log_thread,
+				g_thread_new("sr-log", log_thread_run, NULL));
+	} else if (!enable && log_thread) {
+		/* Stop queueing before the thread drains the rest. */
+		thread = log_thread;
+		g_atomic_pointer_set(&log_thread, NULL);
+		g_atomic_int_set(&log_stop, 1);
+		g_thread_join(thread);
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Get the number of log messages dropped in asynchronous mode because
+ * the queue was full.
+ *
+ * @param dropped Pointer where the number of messages dropped since
+ *                libsigrok was loaded will be stored. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_log_async_dropped_get(uint64_t *dropped)
+{
+	if (!dropped) {
+		sr_err("log: %s: dropped was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	*dropped = (guint)g_atomic_int_get(&log_dropped);
+
+	return SR_OK;
+}
+
+static int log_va(int loglevel, const char *format, va_list args)
+{
+	struct log_record *rec;
+	guint pos;
+
+	if (!g_atomic_pointer_get(&log_thread))
+		return sr_log_callback(sr_log_callback_data, loglevel,
+				format, args);
+
+	if (!(rec = ring_reserve(&pos))) {
+		g_atomic_int_inc(&log_dropped);
+		return SR_OK;
+	}
+	rec->loglevel = loglevel;
+	vsnprintf(rec->text, LOG_RECORD_SIZE, format, args);
+	/* Hand the record over to the drain thread. */
+	g_atomic_int_set(&rec->seq, pos + 1);
+
+	return SR_OK;
+}
+
 /** @private */
 SR_PRIV int sr_log(int loglevel, const char *format, ...)
 {
 	int ret;
 	va_list args;
 
+	if (!sr_log_enabled(loglevel))
+		return SR_OK;
+
 	va_start(args, format);
-	ret = sr_log_callback(sr_log_callback_data, loglevel, format, args);
+	ret = log_va(loglevel, format, args);
 	va_end(args);
 
 	return ret;
@@ -237,8 +659,11 @@ SR_PRIV int sr_spew(const char *format, ...)
 	int ret;
 	va_list args;
 
+	if (!sr_log_enabled(SR_LOG_SPEW))
+		return SR_OK;
+
 	va_start(args, format);
-	ret = sr_log_callback(sr_log_callback_data, SR_LOG_SPEW, format, args);
+	ret = log_va(SR_LOG_SPEW, format, args);
 	va_end(args);
 
 	return ret;
@@ -250,8 +675,11 @@ SR_PRIV int sr_dbg(const char *format, ...)
 	int ret;
 	va_list args;
 
+	if (!sr_log_enabled(SR_LOG_DBG))
+		return SR_OK;
+
 	va_start(args, format);
-	ret = sr_log_callback(sr_log_callback_data, SR_LOG_DBG, format, args);
+	ret = log_va(SR_LOG_DBG, format, args);
 	va_end(args);
 
 	return ret;
@@ -263,8 +691,11 @@ SR_PRIV int sr_info(const char *format, ...)
 	int ret;
 	va_list args;
 
+	if (!sr_log_enabled(SR_LOG_INFO))
+		return SR_OK;
+
 	va_start(args, format);
-	ret = sr_log_callback(sr_log_callback_data, SR_LOG_INFO, format, args);
+	ret = log_va(SR_LOG_INFO, format, args);
 	va_end(args);
 
 	return ret;
@@ -276,8 +707,11 @@ SR_PRIV int sr_warn(const char *format, ...)
 	int ret;
 	va_list args;
 
+	if (!sr_log_enabled(SR_LOG_WARN))
+		return SR_OK;
+
 	va_start(args, format);
-	ret = sr_log_callback(sr_log_callback_data, SR_LOG_WARN, format, args);
+	ret = log_va(SR_LOG_WARN, format, args);
 	va_end(args);
 
 	return ret;
@@ -289,8 +723,11 @@ SR_PRIV int sr_err(const char *format, ...)
 	int ret;
 	va_list args;
 
+	if (!sr_log_enabled(SR_LOG_ERR))
+		return SR_OK;
+
 	va_start(args, format);
-	ret = sr_log_callback(sr_log_callback_data, SR_LOG_ERR, format, args);
+	ret = log_va(SR_LOG_ERR, format, args);
 	va_end(args);
 
 	return ret;
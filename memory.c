@@ -0,0 +1,366 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "memory: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/**
+ * @file
+ *
+ * Accounting of the memory drivers allocate for their devices.
+ */
+
+/**
+ * @defgroup grp_memory Memory accounting
+ *
+ * Accounting of the memory drivers allocate for their devices.
+ *
+ * Drivers allocate their sample buffers with sr_dev_mem_alloc(), or
+ * account for buffers they get elsewhere with sr_dev_mem_charge(). For
+ * every device, and every session with the devices in it, libsigrok
+ * keeps track of the bytes in use and the most that were in use at
+ * once, see sr_dev_mem_get() and sr_session_stats_get().
+ *
+ * With a limit set by sr_dev_mem_limit_set() or sr_session_mem_limit_set(),
+ * allocations which would exceed it fail as if the system was out of
+ * memory. Drivers allocate their buffers when an acquisition is started,
+ * so that fails cleanly instead of the host running out of memory later.
+ *
+ * @{
+ */
+
+/*
+ * Precedes every block from sr_dev_mem_alloc(), keeping the returned
+ * memory aligned for any type.
+ */
+union mem_header {
+	size_t size;
+	uint64_t align_u64;
+	double align_double;
+	void *align_ptr;
+};
+
+/* Guards the counters of all devices and sessions. */
+G_LOCK_DEFINE_STATIC(mem);
+
+static gboolean over_limit(uint64_t used, uint64_t size, uint64_t limit)
+{
+	return limit && (size > limit || used > limit - size);
+}
+
+/**
+ * Account for memory a driver allocated for a device.
+ *
+ * @param sdi The device. Must not be NULL.
+ * @param size The size of the allocation in bytes.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_MALLOC if the allocation would exceed the device's or
+ *         its session's memory limit.
+ *
+ * @private
+ */
+SR_PRIV int sr_dev_mem_charge(const struct sr_dev_inst *sdi, size_t size)
+{
+	struct sr_dev_inst *dev;
+	struct sr_session *session;
+
+	if (!sdi) {
+		sr_err("%s: sdi was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	/* The counters are the only thing changed here. */
+	dev = (struct sr_dev_inst *)sdi;
+
+	G_LOCK(mem);
+	session = dev->session;
+	if (over_limit(dev->mem_used, size, dev->mem_limit)
+			|| (session && over_limit(session->mem_used, size,
+			session->mem_limit))) {
+		G_UNLOCK(mem);
+		sr_err("%s: %zu bytes would exceed the memory limit.",
+		       __func__, size);
+		return SR_ERR_MALLOC;
+	}
+	dev->mem_used += size;
+	dev->mem_peak = MAX(dev->mem_peak, dev->mem_used);
+	if (session) {
+		session->mem_used += size;
+		session->mem_peak = MAX(session->mem_peak, session->mem_used);
+	}
+	G_UNLOCK(mem);
+
+	return SR_OK;
+}
+
+/**
+ * Account for memory a driver freed, which it charged to a device with
+ * sr_dev_mem_charge() before.
+ *
+ * @param sdi The device. Must not be NULL.
+ * @param size The size of the allocation in bytes.
+ *
+ * @private
+ */
+SR_PRIV void sr_dev_mem_uncharge(const struct sr_dev_inst *sdi,
+		size_t size)
+{
+	struct sr_dev_inst *dev;
+
+	if (!sdi)
+		return;
+
+	dev = (struct sr_dev_inst *)sdi;
+
+	G_LOCK(mem);
+	dev->mem_used -= MIN(size, dev->mem_used);
+	if (dev->session)
+		dev->session->mem_used -= MIN(size, dev->session->mem_used);
+	G_UNLOCK(mem);
+}
+
+/**
+ * Allocate memory for a device, and account for it.
+ *
+ * @param sdi The device. Must not be NULL.
+ * @param size The number of bytes to allocate.
+ *
+ * @return The memory, to be freed with sr_dev_mem_free(), or NULL if
+ *         it couldn't be allocated or would exceed a memory limit.
+ *
+ * @private
+ */
+SR_PRIV void *sr_dev_mem_alloc(const struct sr_dev_inst *sdi, size_t size)
+{
+	union mem_header *hdr;
+
+	if (size > G_MAXSIZE - sizeof(union mem_header))
+		return NULL;
+
+	if (sr_dev_mem_charge(sdi, size) != SR_OK)
+		return NULL;
+
+	if (!(hdr = g_try_malloc(sizeof(union mem_header) + size))) {
+		sr_dev_mem_uncharge(sdi, size);
+		return NULL;
+	}
+	hdr->size = size;
+
+	return hdr + 1;
+}
+
+/**
+ * Allocate zeroed memory for a device, and account for it.
+ *
+ * @see sr_dev_mem_alloc()
+ *
+ * @private
+ */
+SR_PRIV void *sr_dev_mem_alloc0(const struct sr_dev_inst *sdi, size_t size)
+{
+	void *mem;
+
+	if ((mem = sr_dev_mem_alloc(sdi, size)))
+		memset(mem, 0, size);
+
+	return mem;
+}
+
+/**
+ * Free memory allocated with sr_dev_mem_alloc().
+ *
+ * @param sdi The device the memory was allocated for.
+ * @param mem The memory. May be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_dev_mem_free(const struct sr_dev_inst *sdi, void *mem)
+{
+	union mem_header *hdr;
+
+	if (!mem)
+		return;
+
+	hdr = (union mem_header *)mem - 1;
+	sr_dev_mem_uncharge(sdi, hdr->size);
+	g_free(hdr);
+}
+
+/**
+ * Move a device to another session, or out of its session, taking the
+ * memory in use for it along.
+ *
+ * @param sdi The device. Must not be NULL.
+ * @param session The session, or NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_dev_mem_session_set(struct sr_dev_inst *sdi,
+		struct sr_session *session)
+{
+	G_LOCK(mem);
+	if (sdi->session)
+		sdi->session->mem_used -= MIN(sdi->mem_used,
+				sdi->session->mem_used);
+	sdi->session = session;
+	if (session) {
+		session->mem_used += sdi->mem_used;
+		session->mem_peak = MAX(session->mem_peak, session->mem_used);
+	}
+	G_UNLOCK(mem);
+}
+
+/**
+ * Start over counting the peak memory use of a session and its devices
+ * from the memory they currently use.
+ *
+ * @param session The session. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_session_mem_peak_reset(struct sr_session *session)
+{
+	struct sr_dev_inst *sdi;
+	GSList *l;
+
+	G_LOCK(mem);
+	session->mem_peak = session->mem_used;
+	for (l = session->devs; l; l = l->next) {
+		sdi = l->data;
+		sdi->mem_peak = sdi->mem_used;
+	}
+	G_UNLOCK(mem);
+}
+
+/**
+ * Get the memory use of a session.
+ *
+ * @param session The session. Must not be NULL.
+ * @param used Pointer where to store the bytes in use. Must not be NULL.
+ * @param peak Pointer where to store the most bytes in use at once.
+ *             Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_session_mem_get(const struct sr_session *session,
+		uint64_t *used, uint64_t *peak)
+{
+	G_LOCK(mem);
+	*used = session->mem_used;
+	*peak = session->mem_peak;
+	G_UNLOCK(mem);
+}
+
+/**
+ * Get the memory the driver allocated for a device.
+ *
+ * @param sdi The device. Must not be NULL.
+ * @param used Pointer where to store the bytes in use, or NULL.
+ * @param peak Pointer where to store the most bytes in use at once since
+ *             the device's session was last started, or NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_dev_mem_get(const struct sr_dev_inst *sdi, uint64_t *used,
+		uint64_t *peak)
+{
+	if (!sdi) {
+		sr_err("%s: sdi was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	G_LOCK(mem);
+	if (used)
+		*used = sdi->mem_used;
+	if (peak)
+		*peak = sdi->mem_peak;
+	G_UNLOCK(mem);
+
+	return SR_OK;
+}
+
+/**
+ * Limit the memory the driver may allocate for a device.
+ *
+ * Allocations beyond the limit fail, which makes starting an acquisition
+ * that needs more memory fail with SR_ERR_MALLOC. Memory already in use
+ * is not affected.
+ *
+ * @param sdi The device. Must not be NULL.
+ * @param limit The limit in bytes, or 0 for no limit.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_dev_mem_limit_set(struct sr_dev_inst *sdi, uint64_t limit)
+{
+	if (!sdi) {
+		sr_err("%s: sdi was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	G_LOCK(mem);
+	sdi->mem_limit = limit;
+	G_UNLOCK(mem);
+
+	return SR_OK;
+}
+
+/**
+ * Limit the memory the drivers may allocate for all the devices in a
+ * session together.
+ *
+ * @see sr_dev_mem_limit_set()
+ *
+ * @param session The session. Must not be NULL.
+ * @param limit The limit in bytes, or 0 for no limit.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_mem_limit_set(struct sr_session *session,
+		uint64_t limit)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	G_LOCK(mem);
+	session->mem_limit = limit;
+	G_UNLOCK(mem);
+
+	return SR_OK;
+}
+
+/** @} */
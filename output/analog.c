@@ -27,11 +27,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "output/analog: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 struct context {
 	int num_enabled_probes;
@@ -68,184 +68,317 @@ static int init(struct sr_output *o)
 	return SR_OK;
 }
 
-static void si_printf(float value, GString *out, char *unitstr)
+/* The most characters append_fixed() writes for any float. */
+#define MAX_NUMBER_LEN 48
+
+enum {
+	/* The value with an SI prefix, then the unit. */
+	FORMAT_SI,
+	FORMAT_PLAIN,
+	FORMAT_PPM,
+	FORMAT_BOOLEAN,
+};
+
+/*
+ * Write the value as printf("%f") does, and return the end. Most values
+ * are converted with integer arithmetic; if the nearest multiple of 1e-6
+ * can't be told for sure, or the value is too large, printf does it.
+ */
+static char *append_fixed(char *p, double value)
+{
+	unsigned long long u, ip;
+	unsigned int frac;
+	long long n;
+	char digits[12];
+	int i;
+
+	if (fabs(value) < 1e+9) {
+		n = llrint(value * 1e+6);
+		/* The product was rounded; check against the exact one. */
+		if (fabs(fma(value, 1e+6, -(double)n)) < 0.5) {
+			if (signbit(value))
+				*p++ = '-';
+			u = n < 0 ? -n : n;
+			ip = u / 1000000;
+			frac = u % 1000000;
+			i = 0;
+			do {
+				digits[i++] = '0' + ip % 10;
+				ip /= 10;
+			} while (ip);
+			while (i)
+				*p++ = digits[--i];
+			*p++ = '.';
+			for (i = 5; i >= 0; i--) {
+				p[i] = '0' + frac % 10;
+				frac /= 10;
+			}
+			return p + 6;
+		}
+	}
+
+	return p + g_snprintf(p, MAX_NUMBER_LEN + 1, "%f", value);
+}
+
+/* Pick the SI prefix for the value, and scale it to match. */
+static const char *si_prefix(float value, double *scaled)
 {
 	float v;
 
-	if (signbit(value))
-		v = -(value);
-	else
-		v = value;
-
-	if (v < 1e-12 || v > 1e+12)
-		g_string_append_printf(out, "%f %s", value, unitstr);
-	else if (v > 1e+9)
-		g_string_append_printf(out, "%f G%s", value / 1e+9, unitstr);
-	else if (v > 1e+6)
-		g_string_append_printf(out, "%f M%s", value / 1e+6, unitstr);
-	else if (v > 1e+3)
-		g_string_append_printf(out, "%f k%s", value / 1e+3, unitstr);
-	else if (v < 1e-9)
-		g_string_append_printf(out, "%f n%s", value * 1e+9, unitstr);
-	else if (v < 1e-6)
-		g_string_append_printf(out, "%f u%s", value * 1e+6, unitstr);
-	else if (v < 1e-3)
-		g_string_append_printf(out, "%f m%s", value * 1e+3, unitstr);
-	else
-		g_string_append_printf(out, "%f %s", value, unitstr);
+	v = fabsf(value);
+	if (v < 1e-12 || v > 1e+12) {
+		*scaled = value;
+		return "";
+	} else if (v > 1e+9) {
+		*scaled = value / 1e+9;
+		return "G";
+	} else if (v > 1e+6) {
+		*scaled = value / 1e+6;
+		return "M";
+	} else if (v > 1e+3) {
+		*scaled = value / 1e+3;
+		return "k";
+	} else if (v < 1e-9) {
+		*scaled = value * 1e+9;
+		return "n";
+	} else if (v < 1e-6) {
+		*scaled = value * 1e+6;
+		return "u";
+	} else if (v < 1e-3) {
+		*scaled = value * 1e+3;
+		return "m";
+	}
 
+	*scaled = value;
+	return "";
 }
 
-static void fancyprint(int unit, int mqflags, float value, GString *out)
+/*
+ * Put what follows the value of every sample of a packet into tail: the
+ * unit, the flags and the newline. Returns how the value is written.
+ */
+static int unit_format(int unit, uint64_t mqflags, GString *tail)
 {
+	int format;
+
+	format = FORMAT_SI;
 	switch (unit) {
 	case SR_UNIT_VOLT:
-		si_printf(value, out, "V");
+		g_string_append(tail, "V");
 		break;
 	case SR_UNIT_AMPERE:
-		si_printf(value, out, "A");
+		g_string_append(tail, "A");
 		break;
 	case SR_UNIT_OHM:
-		si_printf(value, out, "");
-		g_string_append_unichar(out, 0x2126);
+		g_string_append_unichar(tail, 0x2126);
 		break;
 	case SR_UNIT_FARAD:
-		si_printf(value, out, "F");
+		g_string_append(tail, "F");
 		break;
 	case SR_UNIT_KELVIN:
-		si_printf(value, out, "K");
+		g_string_append(tail, "K");
 		break;
 	case SR_UNIT_CELSIUS:
-		si_printf(value, out, "");
-		g_string_append_unichar(out, 0x00b0);
-		g_string_append_c(out, 'C');
+		g_string_append_unichar(tail, 0x00b0);
+		g_string_append_c(tail, 'C');
 		break;
 	case SR_UNIT_FAHRENHEIT:
-		si_printf(value, out, "");
-		g_string_append_unichar(out, 0x00b0);
-		g_string_append_c(out, 'F');
+		g_string_append_unichar(tail, 0x00b0);
+		g_string_append_c(tail, 'F');
 		break;
 	case SR_UNIT_HERTZ:
-		si_printf(value, out, "Hz");
+		g_string_append(tail, "Hz");
 		break;
 	case SR_UNIT_PERCENTAGE:
-		g_string_append_printf(out, "%f%%", value);
+		format = FORMAT_PLAIN;
+		g_string_append_c(tail, '%');
 		break;
 	case SR_UNIT_BOOLEAN:
-		if (value > 0)
-			g_string_append_printf(out, "TRUE");
-		else
-			g_string_append_printf(out, "FALSE");
+		format = FORMAT_BOOLEAN;
 		break;
 	case SR_UNIT_SECOND:
-		si_printf(value, out, "s");
+		g_string_append(tail, "s");
 		break;
 	case SR_UNIT_SIEMENS:
-		si_printf(value, out, "S");
+		g_string_append(tail, "S");
 		break;
 	case SR_UNIT_DECIBEL_MW:
-		si_printf(value, out, "dBu");
+		g_string_append(tail, "dBu");
 		break;
 	case SR_UNIT_DECIBEL_VOLT:
-		si_printf(value, out, "dBV");
+		g_string_append(tail, "dBV");
 		break;
 	case SR_UNIT_DECIBEL_SPL:
 		if (mqflags & SR_MQFLAG_SPL_FREQ_WEIGHT_A)
-			si_printf(value, out, "dB(A)");
+			g_string_append(tail, "dB(A)");
 		else if (mqflags & SR_MQFLAG_SPL_FREQ_WEIGHT_C)
-			si_printf(value, out, "dB(C)");
+			g_string_append(tail, "dB(C)");
 		else if (mqflags & SR_MQFLAG_SPL_FREQ_WEIGHT_Z)
-			si_printf(value, out, "dB(Z)");
+			g_string_append(tail, "dB(Z)");
 		else
 			/* No frequency weighting, or non-standard "flat" */
-			si_printf(value, out, "dB(SPL)");
+			g_string_append(tail, "dB(SPL)");
 		if (mqflags & SR_MQFLAG_SPL_TIME_WEIGHT_S)
-			g_string_append(out, " S");
+			g_string_append(tail, " S");
 		else if (mqflags & SR_MQFLAG_SPL_TIME_WEIGHT_F)
-			g_string_append(out, " F");
+			g_string_append(tail, " F");
 		if (mqflags & SR_MQFLAG_SPL_LAT)
-			g_string_append(out, " LAT");
+			g_string_append(tail, " LAT");
 		else if (mqflags & SR_MQFLAG_SPL_PCT_OVER_ALARM)
 			/* Not a standard function for SLMs, so this is
 			 * a made-up notation. */
-			g_string_append(out, " %oA");
+			g_string_append(tail, " %oA");
 		break;
 	case SR_UNIT_CONCENTRATION:
-		g_string_append_printf(out, "%f ppm", value * 1000000);
+		format = FORMAT_PPM;
+		g_string_append(tail, " ppm");
 		break;
 	case SR_UNIT_REVOLUTIONS_PER_MINUTE:
-		si_printf(value, out, "RPM");
+		g_string_append(tail, "RPM");
 		break;
 	case SR_UNIT_VOLT_AMPERE:
-		si_printf(value, out, "VA");
+		g_string_append(tail, "VA");
 		break;
 	case SR_UNIT_WATT:
-		si_printf(value, out, "W");
+		g_string_append(tail, "W");
 		break;
 	case SR_UNIT_WATT_HOUR:
-		si_printf(value, out, "Wh");
+		g_string_append(tail, "Wh");
 		break;
 	default:
-		si_printf(value, out, "");
 		break;
 	}
 
 	if (mqflags & SR_MQFLAG_AC)
-		g_string_append_printf(out, " AC");
+		g_string_append(tail, " AC");
 	if (mqflags & SR_MQFLAG_DC)
-		g_string_append_printf(out, " DC");
+		g_string_append(tail, " DC");
 	if (mqflags & SR_MQFLAG_RMS)
-		g_string_append_printf(out, " RMS");
+		g_string_append(tail, " RMS");
 	if (mqflags & SR_MQFLAG_DIODE)
-		g_string_append_printf(out, " DIODE");
+		g_string_append(tail, " DIODE");
 	if (mqflags & SR_MQFLAG_HOLD)
-		g_string_append_printf(out, " HOLD");
+		g_string_append(tail, " HOLD");
 	if (mqflags & SR_MQFLAG_MAX)
-		g_string_append_printf(out, " MAX");
+		g_string_append(tail, " MAX");
 	if (mqflags & SR_MQFLAG_MIN)
-		g_string_append_printf(out, " MIN");
+		g_string_append(tail, " MIN");
 	if (mqflags & SR_MQFLAG_AUTORANGE)
-		g_string_append_printf(out, " AUTO");
+		g_string_append(tail, " AUTO");
 	if (mqflags & SR_MQFLAG_RELATIVE)
-		g_string_append_printf(out, " REL");
-	g_string_append_c(out, '\n');
+		g_string_append(tail, " REL");
+	g_string_append_c(tail, '\n');
+
+	return format;
 }
 
-static int receive(struct sr_output *o, const struct sr_dev_inst *sdi,
-		const struct sr_datafeed_packet *packet, GString **out)
+static char *append_value(char *p, int format, float value)
+{
+	const char *prefix;
+	double scaled;
+
+	switch (format) {
+	case FORMAT_SI:
+		prefix = si_prefix(value, &scaled);
+		p = append_fixed(p, scaled);
+		*p++ = ' ';
+		while (*prefix)
+			*p++ = *prefix++;
+		break;
+	case FORMAT_PLAIN:
+		p = append_fixed(p, value);
+		break;
+	case FORMAT_PPM:
+		p = append_fixed(p, value * 1000000);
+		break;
+	case FORMAT_BOOLEAN:
+		if (value > 0) {
+			memcpy(p, "TRUE", 4);
+			p += 4;
+		} else {
+			memcpy(p, "FALSE", 5);
+			p += 5;
+		}
+		break;
+	}
+
+	return p;
+}
+
+static int receive_analog(const struct sr_datafeed_analog *analog,
+		GString *out)
 {
-	const struct sr_datafeed_analog *analog;
 	struct sr_probe *probe;
+	GString *names, *tail;
 	GSList *l;
 	const float *fdata;
-	int i, p;
+	gsize *offsets, len;
+	char *p;
+	int num_probes, format, i, j;
+
+	num_probes = g_slist_length(analog->probes);
+	if (!num_probes || analog->num_samples <= 0)
+		return SR_OK;
+
+	/* What goes before and after the values is the same for each sample. */
+	if (!(offsets = g_try_malloc((num_probes + 1) * sizeof(gsize)))) {
+		sr_err("%s: offsets malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	names = g_string_sized_new(num_probes * 16);
+	for (l = analog->probes, j = 0; l; l = l->next, j++) {
+		probe = l->data;
+		offsets[j] = names->len;
+		g_string_append_printf(names, "%s: ", probe->name);
+	}
+	offsets[j] = names->len;
+	tail = g_string_sized_new(32);
+	format = unit_format(analog->unit, analog->mqflags, tail);
+
+	/* Size the string for the longest values once, and trim it after. */
+	len = out->len;
+	g_string_set_size(out, len + 1 + (gsize)analog->num_samples
+			* (names->len + num_probes
+			* (MAX_NUMBER_LEN + 2 + tail->len)));
+	p = out->str + len;
 
+	fdata = analog->data;
+	for (i = 0; i < analog->num_samples; i++) {
+		for (j = 0; j < num_probes; j++) {
+			memcpy(p, names->str + offsets[j],
+					offsets[j + 1] - offsets[j]);
+			p += offsets[j + 1] - offsets[j];
+			p = append_value(p, format, *fdata++);
+			memcpy(p, tail->str, tail->len);
+			p += tail->len;
+		}
+	}
+
+	g_string_truncate(out, p - out->str);
+	g_string_free(tail, TRUE);
+	g_string_free(names, TRUE);
+	g_free(offsets);
+
+	return SR_OK;
+}
+
+static int receive(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, GString *out)
+{
 	(void)sdi;
 
-	*out = NULL;
 	if (!o || !o->sdi)
 		return SR_ERR_ARG;
 
 	switch (packet->type) {
 	case SR_DF_FRAME_BEGIN:
-		*out = g_string_new("FRAME-BEGIN\n");
+		g_string_append(out, "FRAME-BEGIN\n");
 		break;
 	case SR_DF_FRAME_END:
-		*out = g_string_new("FRAME-END\n");
+		g_string_append(out, "FRAME-END\n");
 		break;
 	case SR_DF_ANALOG:
-		analog = packet->payload;
-		fdata = (const float *)analog->data;
-		*out = g_string_sized_new(512);
-		for (i = 0; i < analog->num_samples; i++) {
-			for (l = analog->probes, p = 0; l; l = l->next, p++) {
-				probe = l->data;
-				g_string_append_printf(*out, "%s: ", probe->name);
-				fancyprint(analog->unit, analog->mqflags,
-						fdata[i + p], *out);
-			}
-		}
-		break;
+		return receive_analog(packet->payload, out);
 	}
 
 	return SR_OK;
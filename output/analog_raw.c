@@ -0,0 +1,433 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Writes analog samples as they are, for the "analog-raw" input module to
+ * load again. All numbers are little-endian. The header is written before
+ * the first samples:
+ *
+ *   ANALOG_RAW_MAGIC, the length of the whole header (32 bits, a multiple
+ *   of 8), the encoding (16, ANALOG_RAW_FLOAT or ANALOG_RAW_S16), the
+ *   layout (16, ANALOG_RAW_INTERLEAVED or ANALOG_RAW_PLANAR), samplerate
+ *   (64), mq (32), unit (32), mqflags (64), number of probes (16) and 6
+ *   zero bytes. Then for each probe the scale and offset of its raw
+ *   values (IEEE 754 floats, 32 bits each) and its name, prefixed by its
+ *   length (16). Zeroes pad the header to its length.
+ *
+ * Float samples are IEEE 754 floats (32 bits), S16 samples signed 16 bit
+ * numbers holding the value as raw * scale + offset. Interleaved samples
+ * follow the header up to the end of the file. Planar samples come in
+ * blocks of the number of samples (32) and 4 zero bytes, then each
+ * probe's samples, padded with zeroes to a multiple of 8 bytes.
+ *
+ * SR_DF_ANALOG packets are written as floats. The file is S16 if its first
+ * samples come in a SR_DF_ANALOG_RAW packet of SR_ANALOG_S16 samples;
+ * frontends get those with sr_session_datafeed_callback_analog_raw_set().
+ * Interleaved samples are written straight from the packets.
+ *
+ * Options, as a comma-separated list:
+ *   planar  Write planes per probe, rather than interleaved samples.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "output/analog-raw: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+struct context {
+	int layout;
+	uint64_t samplerate;
+	/* Set once the header is written. */
+	int encoding;
+	int num_probes;
+	float *scale;
+	float *offset;
+	/* Values of raw packets converted for a float file. */
+	float *fbuf;
+	gsize fbuf_size;
+	/* What write() hands to the sink before the packet's data. */
+	GString *buf;
+};
+
+static void put_le16(GString *s, uint16_t v)
+{
+	uint8_t b[2];
+
+	b[0] = v;
+	b[1] = v >> 8;
+	g_string_append_len(s, (const char *)b, sizeof(b));
+}
+
+static void put_le32(GString *s, uint32_t v)
+{
+	put_le16(s, v);
+	put_le16(s, v >> 16);
+}
+
+static void put_le64(GString *s, uint64_t v)
+{
+	put_le32(s, v);
+	put_le32(s, v >> 32);
+}
+
+static void put_float(GString *s, float f)
+{
+	uint32_t v;
+
+	memcpy(&v, &f, sizeof(v));
+	put_le32(s, v);
+}
+
+static void pad(GString *s, gsize from)
+{
+	while ((s->len - from) % 8)
+		g_string_append_c(s, 0);
+}
+
+static int init(struct sr_output *o)
+{
+	struct context *ctx;
+	char **opts;
+	int i;
+
+	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
+		sr_err("%s: ctx malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	o->internal = ctx;
+	ctx->layout = ANALOG_RAW_INTERLEAVED;
+	ctx->buf = g_string_sized_new(256);
+
+	opts = g_strsplit(o->param ? o->param : "", ",", 0);
+	for (i = 0; opts[i]; i++) {
+		if (!opts[i][0])
+			continue;
+		if (!strcmp(opts[i], "planar"))
+			ctx->layout = ANALOG_RAW_PLANAR;
+		else
+			sr_warn("Ignoring unknown option '%s'.", opts[i]);
+	}
+	g_strfreev(opts);
+
+	return SR_OK;
+}
+
+/* Write the header, with the raw values' scale and offset if there are. */
+static int header_add(struct context *ctx, GString *out, GSList *probes,
+		int mq, int unit, uint64_t mqflags, const float *scale,
+		const float *offset)
+{
+	const struct sr_probe *probe;
+	const char *name;
+	gsize start, len;
+	GSList *l;
+	int i;
+
+	if (!(ctx->scale = g_try_malloc(ctx->num_probes * sizeof(float)))
+	    || !(ctx->offset = g_try_malloc(ctx->num_probes
+			* sizeof(float)))) {
+		sr_err("%s: scale malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	for (i = 0; i < ctx->num_probes; i++) {
+		ctx->scale[i] = scale ? scale[i] : 1.0;
+		ctx->offset[i] = offset ? offset[i] : 0.0;
+	}
+
+	start = out->len;
+	g_string_append_len(out, ANALOG_RAW_MAGIC, ANALOG_RAW_MAGIC_LEN);
+	put_le32(out, 0);
+	put_le16(out, ctx->encoding);
+	put_le16(out, ctx->layout);
+	put_le64(out, ctx->samplerate);
+	put_le32(out, mq);
+	put_le32(out, unit);
+	put_le64(out, mqflags);
+	put_le16(out, ctx->num_probes);
+	g_string_append_len(out, "\0\0\0\0\0\0", 6);
+	for (l = probes, i = 0; l; l = l->next, i++) {
+		probe = l->data;
+		put_float(out, ctx->scale[i]);
+		put_float(out, ctx->offset[i]);
+		name = probe->name ? probe->name : "";
+		len = MIN(strlen(name), G_MAXUINT16);
+		put_le16(out, len);
+		g_string_append_len(out, name, len);
+	}
+	pad(out, start);
+
+	len = out->len - start;
+	out->str[start + 8] = len;
+	out->str[start + 9] = len >> 8;
+	out->str[start + 10] = len >> 16;
+	out->str[start + 11] = len >> 24;
+
+	return SR_OK;
+}
+
+/* Store a sample of size bytes, in host byte order, little-endian. */
+static inline void le_store(uint8_t *p, const uint8_t *src, int size)
+{
+	int k;
+
+	for (k = 0; k < size; k++)
+		p[k] = src[G_BYTE_ORDER == G_LITTLE_ENDIAN ? k : size - 1 - k];
+}
+
+/* Append count interleaved samples of size bytes each. */
+static void samples_add(GString *out, const uint8_t *data, int size,
+		uint64_t count)
+{
+	gsize start;
+	uint64_t i;
+
+	start = out->len;
+	g_string_set_size(out, start + count * size);
+	for (i = 0; i < count; i++)
+		le_store((uint8_t *)out->str + start + i * size,
+				data + i * size, size);
+}
+
+/* Append a block of planes of n samples of size bytes each. */
+static void planes_add(const struct context *ctx, GString *out,
+		const uint8_t *data, int size, uint64_t n)
+{
+	const uint8_t *src;
+	gsize start, plane;
+	uint8_t *p;
+	uint64_t i;
+	int j, stride;
+
+	start = out->len;
+	plane = (n * size + 7) & ~(gsize)7;
+	g_string_set_size(out, start + ANALOG_RAW_BLOCK_HEADER_LEN
+			+ plane * ctx->num_probes);
+	p = (uint8_t *)out->str + start;
+	memset(p, 0, out->len - start);
+	p[0] = n;
+	p[1] = n >> 8;
+	p[2] = n >> 16;
+	p[3] = n >> 24;
+	p += ANALOG_RAW_BLOCK_HEADER_LEN;
+
+	stride = size * ctx->num_probes;
+	for (j = 0; j < ctx->num_probes; j++, p += plane) {
+		src = data + j * size;
+		for (i = 0; i < n; i++, src += stride)
+			le_store(p + i * size, src, size);
+	}
+}
+
+/*
+ * Append what the packet turns into to out, except for interleaved
+ * samples which can be written as they are: those are returned in data
+ * and len instead.
+ */
+static int packet_build(struct sr_output *o,
+		const struct sr_datafeed_packet *packet, GString *out,
+		const void **data, gsize *len)
+{
+	struct context *ctx;
+	const struct sr_datafeed_analog *analog;
+	const struct sr_datafeed_analog_raw *raw;
+	const void *samples;
+	GSList *probes;
+	uint64_t mqflags;
+	int num_samples, encoding, mq, unit, size, ret, i;
+
+	ctx = o->internal;
+	*data = NULL;
+	*len = 0;
+
+	switch (packet->type) {
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		probes = analog->probes;
+		num_samples = analog->num_samples;
+		mq = analog->mq;
+		unit = analog->unit;
+		mqflags = analog->mqflags;
+		encoding = ANALOG_RAW_FLOAT;
+		samples = analog->data;
+		raw = NULL;
+		break;
+	case SR_DF_ANALOG_RAW:
+		raw = packet->payload;
+		probes = raw->probes;
+		num_samples = raw->num_samples;
+		mq = raw->mq;
+		unit = raw->unit;
+		mqflags = raw->mqflags;
+		encoding = raw->encoding == SR_ANALOG_S16 ? ANALOG_RAW_S16
+				: ANALOG_RAW_FLOAT;
+		samples = raw->data;
+		break;
+	default:
+		return SR_OK;
+	}
+
+	if (num_samples <= 0 || !probes)
+		return SR_OK;
+
+	if (!ctx->encoding) {
+		/* The file has the samplerate the data started with. */
+		ctx->samplerate = o->params.samplerate;
+		ctx->encoding = encoding;
+		ctx->num_probes = g_slist_length(probes);
+		if (encoding == ANALOG_RAW_S16)
+			ret = header_add(ctx, out, probes, mq, unit, mqflags,
+					raw->scale, raw->offset);
+		else
+			ret = header_add(ctx, out, probes, mq, unit, mqflags,
+					NULL, NULL);
+		if (ret != SR_OK)
+			return ret;
+	}
+
+	if ((int)g_slist_length(probes) != ctx->num_probes) {
+		sr_err("The number of probes changed.");
+		return SR_ERR_ARG;
+	}
+
+	if (ctx->encoding == ANALOG_RAW_S16) {
+		if (!raw || raw->encoding != SR_ANALOG_S16) {
+			sr_err("Can't write float samples to a S16 file.");
+			return SR_ERR_ARG;
+		}
+		for (i = 0; i < ctx->num_probes; i++) {
+			if (raw->scale[i] != ctx->scale[i]
+			    || raw->offset[i] != ctx->offset[i]) {
+				sr_err("The scale of the samples changed.");
+				return SR_ERR_ARG;
+			}
+		}
+		size = sizeof(int16_t);
+	} else {
+		size = sizeof(float);
+	}
+
+	if (ctx->encoding == ANALOG_RAW_FLOAT && raw) {
+		/* Other raw encodings are stored as floats. */
+		if ((gsize)num_samples * ctx->num_probes > ctx->fbuf_size) {
+			g_free(ctx->fbuf);
+			ctx->fbuf_size = (gsize)num_samples * ctx->num_probes;
+			if (!(ctx->fbuf = g_try_malloc(ctx->fbuf_size
+					* sizeof(float)))) {
+				sr_err("%s: fbuf malloc failed", __func__);
+				ctx->fbuf_size = 0;
+				return SR_ERR_MALLOC;
+			}
+		}
+		if ((ret = sr_analog_raw_to_float(raw, ctx->fbuf)) != SR_OK)
+			return ret;
+		samples = ctx->fbuf;
+	}
+
+	if (ctx->layout == ANALOG_RAW_PLANAR) {
+		planes_add(ctx, out, samples, size, num_samples);
+	} else if (G_BYTE_ORDER == G_LITTLE_ENDIAN) {
+		*data = samples;
+		*len = (gsize)num_samples * ctx->num_probes * size;
+	} else {
+		samples_add(out, samples, size,
+				(uint64_t)num_samples * ctx->num_probes);
+	}
+
+	return SR_OK;
+}
+
+static int receive(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, GString *out)
+{
+	const void *data;
+	gsize len;
+	int ret;
+
+	(void)sdi;
+
+	if (!o || !o->internal)
+		return SR_ERR_ARG;
+
+	if ((ret = packet_build(o, packet, out, &data, &len)) != SR_OK)
+		return ret;
+	g_string_append_len(out, data, len);
+
+	return SR_OK;
+}
+
+static int write_packet(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet,
+		sr_output_write_callback_t cb, void *cb_data)
+{
+	struct context *ctx;
+	const void *data;
+	gsize len;
+	int ret;
+
+	(void)sdi;
+
+	if (!o || !(ctx = o->internal))
+		return SR_ERR_ARG;
+
+	g_string_truncate(ctx->buf, 0);
+	if ((ret = packet_build(o, packet, ctx->buf, &data, &len)) != SR_OK)
+		return ret;
+	if (ctx->buf->len && (ret = cb(ctx->buf->str, ctx->buf->len,
+			cb_data)) != SR_OK)
+		return ret;
+	if (len)
+		return cb(data, len, cb_data);
+
+	return SR_OK;
+}
+
+static int cleanup(struct sr_output *o)
+{
+	struct context *ctx;
+
+	if (!o || !(ctx = o->internal))
+		return SR_OK;
+
+	g_free(ctx->scale);
+	g_free(ctx->offset);
+	g_free(ctx->fbuf);
+	g_string_free(ctx->buf, TRUE);
+	g_free(ctx);
+	o->internal = NULL;
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_output_format output_analog_raw = {
+	.id = "analog-raw",
+	.description = "Raw analog samples",
+	.df_type = SR_DF_ANALOG,
+	.init = init,
+	.receive = receive,
+	.write = write_packet,
+	.cleanup = cleanup,
+};
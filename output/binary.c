@@ -27,44 +27,47 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "output/binary: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
-static int data(struct sr_output *o, const uint8_t *data_in,
-		uint64_t length_in, uint8_t **data_out, uint64_t *length_out)
+static int receive(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, GString *out)
 {
-	uint8_t *outbuf;
+	const struct sr_datafeed_logic *logic;
 
 	(void)o;
+	(void)sdi;
 
-	if (!data_in) {
-		sr_err("%s: data_in was NULL", __func__);
-		return SR_ERR_ARG;
-	}
+	if (packet->type != SR_DF_LOGIC)
+		return SR_OK;
 
-	if (!length_out) {
-		sr_err("%s: length_out was NULL", __func__);
-		return SR_ERR_ARG;
-	}
+	logic = packet->payload;
+	g_string_append_len(out, logic->data, logic->length);
 
-	if (length_in == 0) {
-		sr_err("%s: length_in was 0", __func__);
-		return SR_ERR_ARG;
-	}
+	return SR_OK;
+}
 
-	if (!(outbuf = g_try_malloc0(length_in))) {
-		sr_err("%s: outbuf malloc failed", __func__);
-		return SR_ERR_MALLOC;
-	}
+static int write_packet(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet,
+		sr_output_write_callback_t cb, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
 
-	memcpy(outbuf, data_in, length_in);
-	*data_out = outbuf;
-	*length_out = length_in;
+	(void)o;
+	(void)sdi;
 
-	return SR_OK;
+	if (packet->type != SR_DF_LOGIC)
+		return SR_OK;
+
+	/* The samples are written out as they are, straight from the packet. */
+	logic = packet->payload;
+	if (!logic->length)
+		return SR_OK;
+
+	return cb(logic->data, logic->length, cb_data);
 }
 
 SR_PRIV struct sr_output_format output_binary = {
@@ -72,6 +75,6 @@ SR_PRIV struct sr_output_format output_binary = {
 	.description = "Raw binary",
 	.df_type = SR_DF_LOGIC,
 	.init = NULL,
-	.data = data,
-	.event = NULL,
+	.receive = receive,
+	.write = write_packet,
 };
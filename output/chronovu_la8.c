@@ -27,19 +27,24 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "output/chronovu-la8: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 struct context {
 	unsigned int num_enabled_probes;
 	unsigned int unitsize;
 	uint64_t trigger_point;
 	uint64_t samplerate;
+	/* The number of samples written so far. */
+	uint64_t num_samples;
 };
 
+/* The size of the trailer after the samples. */
+#define TRAILER_SIZE (1 + 4)
+
 /**
  * Check if the given samplerate is supported by the LA8 hardware.
  *
@@ -131,11 +136,35 @@ static int init(struct sr_output *o)
 	return SR_OK;
 }
 
-static int event(struct sr_output *o, int event_type, uint8_t **data_out,
-		 uint64_t *length_out)
+/*
+ * The trailer: one byte for the 'divcount' value, then four bytes
+ * (little endian) for the trigger point.
+ */
+static void trailer_get(const struct context *ctx, uint8_t *trailer)
+{
+	trailer[0] = samplerate_to_divcount(ctx->samplerate);
+	trailer[1] = (ctx->trigger_point >>  0) & 0xff;
+	trailer[2] = (ctx->trigger_point >>  8) & 0xff;
+	trailer[3] = (ctx->trigger_point >> 16) & 0xff;
+	trailer[4] = (ctx->trigger_point >> 24) & 0xff;
+}
+
+/* Keep track of where the data is, for the trigger point. */
+static void logic_count(struct context *ctx,
+		const struct sr_datafeed_logic *logic)
+{
+	if (logic->unitsize)
+		ctx->num_samples += logic->length / logic->unitsize;
+}
+
+static int receive(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, GString *out)
 {
 	struct context *ctx;
-	uint8_t *outbuf;
+	const struct sr_datafeed_logic *logic;
+	uint8_t trailer[TRAILER_SIZE];
+
+	(void)sdi;
 
 	if (!o) {
 		sr_warn("%s: o was NULL", __func__);
@@ -147,58 +176,41 @@ static int event(struct sr_output *o, int event_type, uint8_t **data_out,
 		return SR_ERR_ARG;
 	}
 
-	if (!data_out) {
-		sr_warn("%s: data_out was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
-	switch (event_type) {
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		logic_count(ctx, logic);
+		g_string_append_len(out, logic->data, logic->length);
+		break;
 	case SR_DF_TRIGGER:
 		sr_dbg("%s: SR_DF_TRIGGER event", __func__);
 		/* Save the trigger point for later (SR_DF_END). */
-		ctx->trigger_point = 0; /* TODO: Store _actual_ value. */
+		ctx->trigger_point = ctx->num_samples;
 		break;
 	case SR_DF_END:
 		sr_dbg("%s: SR_DF_END event", __func__);
-		if (!(outbuf = g_try_malloc(4 + 1))) {
-			sr_warn("la8 out: %s: outbuf malloc failed", __func__);
-			return SR_ERR_MALLOC;
-		}
-
-		/* One byte for the 'divcount' value. */
-		outbuf[0] = samplerate_to_divcount(ctx->samplerate);
-		// if (outbuf[0] == 0xff) {
-		// 	sr_warn("%s: invalid divcount", __func__);
-		// 	return SR_ERR;
-		// }
-
-		/* Four bytes (little endian) for the trigger point. */
-		outbuf[1] = (ctx->trigger_point >>  0) & 0xff;
-		outbuf[2] = (ctx->trigger_point >>  8) & 0xff;
-		outbuf[3] = (ctx->trigger_point >> 16) & 0xff;
-		outbuf[4] = (ctx->trigger_point >> 24) & 0xff;
-
-		*data_out = outbuf;
-		*length_out = 4 + 1;
-		g_free(o->internal);
-		o->internal = NULL;
-		break;
-	default:
-		sr_warn("%s: unsupported event type: %d", __func__,
-			event_type);
-		*data_out = NULL;
-		*length_out = 0;
+		trailer_get(ctx, trailer);
+		g_string_append_len(out, (const gchar *)trailer,
+				sizeof(trailer));
 		break;
 	}
 
 	return SR_OK;
 }
 
-static int data(struct sr_output *o, const uint8_t *data_in,
-		uint64_t length_in, uint8_t **data_out, uint64_t *length_out)
+/*
+ * The samples are written out as they come, straight from the packets,
+ * so that nothing but the trailer is kept until the end.
+ */
+static int write_packet(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet,
+		sr_output_write_callback_t cb, void *cb_data)
 {
 	struct context *ctx;
-	uint8_t *outbuf;
+	const struct sr_datafeed_logic *logic;
+	uint8_t trailer[TRAILER_SIZE];
+
+	(void)sdi;
 
 	if (!o) {
 		sr_warn("%s: o was NULL", __func__);
@@ -210,20 +222,33 @@ static int data(struct sr_output *o, const uint8_t *data_in,
 		return SR_ERR_ARG;
 	}
 
-	if (!data_in) {
-		sr_warn("%s: data_in was NULL", __func__);
-		return SR_ERR_ARG;
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		logic_count(ctx, logic);
+		if (logic->length)
+			return cb(logic->data, logic->length, cb_data);
+		break;
+	case SR_DF_TRIGGER:
+		sr_dbg("%s: SR_DF_TRIGGER event", __func__);
+		ctx->trigger_point = ctx->num_samples;
+		break;
+	case SR_DF_END:
+		sr_dbg("%s: SR_DF_END event", __func__);
+		trailer_get(ctx, trailer);
+		return cb(trailer, sizeof(trailer), cb_data);
 	}
 
-	if (!(outbuf = g_try_malloc0(length_in))) {
-		sr_warn("%s: outbuf malloc failed", __func__);
-		return SR_ERR_MALLOC;
-	}
+	return SR_OK;
+}
 
-	memcpy(outbuf, data_in, length_in);
+static int cleanup(struct sr_output *o)
+{
+	if (!o || !o->internal)
+		return SR_ERR_ARG;
 
-	*data_out = outbuf;
-	*length_out = length_in;
+	g_free(o->internal);
+	o->internal = NULL;
 
 	return SR_OK;
 }
@@ -233,6 +258,7 @@ SR_PRIV struct sr_output_format output_chronovu_la8 = {
 	.description = "ChronoVu LA8",
 	.df_type = SR_DF_LOGIC,
 	.init = init,
-	.data = data,
-	.event = event,
+	.receive = receive,
+	.write = write_packet,
+	.cleanup = cleanup,
 };
@@ -0,0 +1,486 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Writes the samples column by column, in record batches which dataframe
+ * tools can map without parsing them. All numbers are little-endian,
+ * strings are prefixed by their length (16 bits). The stream starts with
+ * the 8 byte magic "SRCOLS01", followed by blocks of a type (32 bits), a
+ * payload length (32) and the payload, padded with zeroes to a multiple
+ * of 8 bytes so that every column starts 8-byte aligned.
+ *
+ *   COLUMNAR_SCHEMA:  number of columns (32), then for each its type
+ *                     (8), the probe index (16, 0 for the sample column)
+ *                     and name. Column 0 is the sample number, followed
+ *                     by the enabled logic probes, then the enabled
+ *                     analog probes.
+ *   COLUMNAR_BATCH:   number of rows (32), number of columns (32), the
+ *                     first row's sample number (64) and when its
+ *                     packet was sent (64, g_get_monotonic_time()
+ *                     microseconds), the column numbers (32 each), then
+ *                     the columns. The sample column holds 64 bit
+ *                     numbers, a logic column one bit per row (row 0 in
+ *                     the lowest bit of the first 64 bit word), an
+ *                     analog column 32 bit IEEE 754 floats. Each column
+ *                     is padded to a multiple of 8 bytes.
+ *   COLUMNAR_TRIGGER: the number of the logic sample after the trigger
+ *                     (64).
+ *   COLUMNAR_END:     empty.
+ *
+ * A batch holds either the logic columns or those of one analog packet's
+ * probes. Samples of consecutive logic packets are collected into one
+ * batch.
+ *
+ * Options, as a comma-separated list:
+ *   batch=<rows>  Rows per batch (default 65536).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "output/columnar: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+#define COLUMNAR_MAGIC "SRCOLS01"
+#define COLUMNAR_MAGIC_LEN 8
+
+enum {
+	COLUMNAR_SCHEMA = 1,
+	COLUMNAR_BATCH,
+	COLUMNAR_TRIGGER,
+	COLUMNAR_END,
+};
+
+enum {
+	COLUMN_SAMPLE = 1,
+	COLUMN_LOGIC,
+	COLUMN_ANALOG,
+};
+
+#define DEFAULT_BATCH 65536
+#define MAX_BATCH (16 * 1024 * 1024)
+
+struct context {
+	uint32_t batch_rows;
+	gboolean started;
+	/* The enabled logic probes, then the enabled analog probes. */
+	GPtrArray *logic;
+	GPtrArray *analog;
+	/* The logic batch being collected, words_per_column per probe. */
+	uint64_t *bits;
+	uint32_t words_per_column;
+	uint32_t num_rows;
+	uint64_t first_sample;
+	int64_t timestamp;
+	/* Logic samples received since the header. */
+	uint64_t samplecount;
+	/* One analog column, taken out of the interleaved data. */
+	uint32_t *values;
+	/* The column numbers of the batch being written. */
+	uint32_t *columns;
+};
+
+static void put_le32(GString *s, uint32_t v)
+{
+	uint8_t b[4];
+
+	b[0] = v;
+	b[1] = v >> 8;
+	b[2] = v >> 16;
+	b[3] = v >> 24;
+	g_string_append_len(s, (const char *)b, sizeof(b));
+}
+
+static void put_le64(GString *s, uint64_t v)
+{
+	put_le32(s, v);
+	put_le32(s, v >> 32);
+}
+
+static void put_words(GString *s, const uint64_t *words, gsize num)
+{
+	gsize i;
+
+	if (G_BYTE_ORDER == G_LITTLE_ENDIAN) {
+		g_string_append_len(s, (const char *)words, num * 8);
+	} else {
+		for (i = 0; i < num; i++)
+			put_le64(s, words[i]);
+	}
+}
+
+static void pad(GString *s, gsize from)
+{
+	while ((s->len - from) % 8)
+		g_string_append_c(s, 0);
+}
+
+/* Start a block; block_end() fills in its length. */
+static gsize block_begin(GString *out, int type)
+{
+	put_le32(out, type);
+	put_le32(out, 0);
+
+	return out->len;
+}
+
+static void block_end(GString *out, gsize start)
+{
+	uint32_t len;
+
+	pad(out, start);
+	len = out->len - start;
+	out->str[start - 4] = len;
+	out->str[start - 3] = len >> 8;
+	out->str[start - 2] = len >> 16;
+	out->str[start - 1] = len >> 24;
+}
+
+static int init(struct sr_output *o)
+{
+	struct context *ctx;
+	struct sr_probe *probe;
+	char **opts, *val, *end;
+	unsigned long rows;
+	GSList *l;
+	int i;
+
+	if (!o || !o->sdi)
+		return SR_ERR_ARG;
+
+	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
+		sr_err("%s: ctx malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	o->internal = ctx;
+	ctx->batch_rows = DEFAULT_BATCH;
+	ctx->logic = g_ptr_array_new();
+	ctx->analog = g_ptr_array_new();
+
+	opts = g_strsplit(o->param ? o->param : "", ",", 0);
+	for (i = 0; opts[i]; i++) {
+		if (!opts[i][0])
+			continue;
+		if ((val = strchr(opts[i], '=')))
+			*val++ = '\0';
+		if (val && !strcmp(opts[i], "batch")) {
+			rows = strtoul(val, &end, 10);
+			if (!*val || *end || !rows || rows > MAX_BATCH) {
+				sr_err("Invalid batch size '%s'.", val);
+				g_strfreev(opts);
+				return SR_ERR_ARG;
+			}
+			ctx->batch_rows = rows;
+		} else {
+			sr_warn("Ignoring unknown option '%s'.", opts[i]);
+		}
+	}
+	g_strfreev(opts);
+
+	for (l = o->sdi->probes; l; l = l->next) {
+		probe = l->data;
+		if (!probe->enabled)
+			continue;
+		if (probe->type == SR_PROBE_LOGIC)
+			g_ptr_array_add(ctx->logic, probe);
+		else if (probe->type == SR_PROBE_ANALOG)
+			g_ptr_array_add(ctx->analog, probe);
+	}
+
+	ctx->words_per_column = (ctx->batch_rows + 63) / 64;
+	ctx->bits = g_try_malloc0((gsize)ctx->logic->len
+			* ctx->words_per_column * sizeof(uint64_t) + 1);
+	ctx->values = g_try_malloc(ctx->batch_rows * sizeof(uint32_t));
+	ctx->columns = g_try_malloc((1 + ctx->logic->len + ctx->analog->len)
+			* sizeof(uint32_t));
+	if (!ctx->bits || !ctx->values || !ctx->columns) {
+		sr_err("%s: batch malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	return SR_OK;
+}
+
+static void column_add(GString *s, int type, const struct sr_probe *probe)
+{
+	const char *name;
+	gsize len;
+
+	name = probe ? probe->name : "sample";
+	len = name ? MIN(strlen(name), G_MAXUINT16) : 0;
+	g_string_append_c(s, type);
+	g_string_append_c(s, probe ? probe->index : 0);
+	g_string_append_c(s, probe ? probe->index >> 8 : 0);
+	g_string_append_c(s, len);
+	g_string_append_c(s, len >> 8);
+	g_string_append_len(s, name, len);
+}
+
+static void schema_add(struct context *ctx, GString *out)
+{
+	gsize start;
+	guint i;
+
+	start = block_begin(out, COLUMNAR_SCHEMA);
+	put_le32(out, 1 + ctx->logic->len + ctx->analog->len);
+	column_add(out, COLUMN_SAMPLE, NULL);
+	for (i = 0; i < ctx->logic->len; i++)
+		column_add(out, COLUMN_LOGIC, ctx->logic->pdata[i]);
+	for (i = 0; i < ctx->analog->len; i++)
+		column_add(out, COLUMN_ANALOG, ctx->analog->pdata[i]);
+	block_end(out, start);
+}
+
+/* Everything of a batch up to the first data column. */
+static void batch_begin(GString *out, uint32_t num_rows,
+		const uint32_t *columns, uint32_t num_columns,
+		uint64_t first_sample, int64_t timestamp)
+{
+	gsize start;
+	uint32_t i;
+
+	put_le32(out, num_rows);
+	put_le32(out, num_columns + 1);
+	put_le64(out, first_sample);
+	put_le64(out, timestamp);
+	start = out->len;
+	put_le32(out, 0);
+	for (i = 0; i < num_columns; i++)
+		put_le32(out, columns[i]);
+	pad(out, start);
+	for (i = 0; i < num_rows; i++)
+		put_le64(out, first_sample + i);
+}
+
+static void logic_flush(struct context *ctx, GString *out)
+{
+	gsize start, words;
+	guint i;
+
+	if (!ctx->num_rows)
+		return;
+
+	for (i = 0; i < ctx->logic->len; i++)
+		ctx->columns[i] = i + 1;
+	words = (ctx->num_rows + 63) / 64;
+
+	start = block_begin(out, COLUMNAR_BATCH);
+	batch_begin(out, ctx->num_rows, ctx->columns, ctx->logic->len,
+			ctx->first_sample, ctx->timestamp);
+	for (i = 0; i < ctx->logic->len; i++)
+		put_words(out, ctx->bits + i * ctx->words_per_column, words);
+	block_end(out, start);
+
+	memset(ctx->bits, 0, (gsize)ctx->logic->len
+			* ctx->words_per_column * sizeof(uint64_t));
+	ctx->num_rows = 0;
+}
+
+/* Set the bits of n samples' probes, from the current row on. */
+static void logic_rows_add(struct context *ctx, const uint8_t *data,
+		uint16_t unitsize, uint32_t n)
+{
+	const struct sr_probe *probe;
+	uint64_t *words;
+	uint32_t row, r;
+	unsigned int offset;
+	uint8_t mask;
+	guint i;
+
+	for (i = 0; i < ctx->logic->len; i++) {
+		probe = ctx->logic->pdata[i];
+		offset = probe->index / 8;
+		if (offset >= unitsize)
+			continue;
+		mask = 1 << (probe->index % 8);
+		words = ctx->bits + i * ctx->words_per_column;
+		row = ctx->num_rows;
+		for (r = 0; r < n; r++, row++) {
+			if (data[r * unitsize + offset] & mask)
+				words[row / 64] |= (uint64_t)1 << (row % 64);
+		}
+	}
+	ctx->num_rows += n;
+}
+
+static void logic_add(struct context *ctx,
+		const struct sr_datafeed_logic *logic, GString *out)
+{
+	const uint8_t *data;
+	uint64_t left;
+	uint32_t n;
+
+	if (!logic->unitsize)
+		return;
+
+	data = logic->data;
+	left = logic->length / logic->unitsize;
+	while (left) {
+		if (!ctx->num_rows) {
+			ctx->first_sample = ctx->samplecount;
+			ctx->timestamp = logic->timestamp;
+		}
+		n = MIN(left, ctx->batch_rows - ctx->num_rows);
+		logic_rows_add(ctx, data, logic->unitsize, n);
+		data += (gsize)n * logic->unitsize;
+		left -= n;
+		ctx->samplecount += n;
+		if (ctx->num_rows == ctx->batch_rows)
+			logic_flush(ctx, out);
+	}
+}
+
+static int analog_add(struct context *ctx,
+		const struct sr_datafeed_analog *analog, GString *out)
+{
+	const float *data;
+	uint32_t rows, r;
+	uint64_t first;
+	gsize start;
+	GSList *l;
+	int num_probes, i, j;
+	guint k;
+
+	num_probes = g_slist_length(analog->probes);
+	if (!num_probes || analog->num_samples <= 0)
+		return SR_OK;
+
+	for (l = analog->probes, i = 0; l; l = l->next, i++) {
+		for (k = 0; k < ctx->analog->len; k++)
+			if (ctx->analog->pdata[k] == l->data)
+				break;
+		if (k == ctx->analog->len) {
+			sr_err("Analog packet for an unknown probe.");
+			return SR_ERR_ARG;
+		}
+		ctx->columns[i] = 1 + ctx->logic->len + k;
+	}
+
+	for (i = 0; i < analog->num_samples; i += rows) {
+		rows = MIN((uint32_t)(analog->num_samples - i),
+				ctx->batch_rows);
+		first = analog->start_sample + i;
+		start = block_begin(out, COLUMNAR_BATCH);
+		batch_begin(out, rows, ctx->columns, num_probes, first,
+				analog->timestamp);
+		for (j = 0; j < num_probes; j++) {
+			data = analog->data + (gsize)i * num_probes + j;
+			for (r = 0; r < rows; r++, data += num_probes)
+				memcpy(&ctx->values[r], data, sizeof(float));
+			if (G_BYTE_ORDER == G_LITTLE_ENDIAN) {
+				g_string_append_len(out,
+						(const char *)ctx->values,
+						rows * sizeof(uint32_t));
+			} else {
+				for (r = 0; r < rows; r++)
+					put_le32(out, ctx->values[r]);
+			}
+			pad(out, start);
+		}
+		block_end(out, start);
+	}
+
+	return SR_OK;
+}
+
+static int receive(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, GString *out)
+{
+	struct context *ctx;
+	gsize start;
+
+	(void)sdi;
+
+	if (!o || !(ctx = o->internal))
+		return SR_ERR_ARG;
+
+	if (packet->type == SR_DF_LOGIC) {
+		if (ctx->started)
+			logic_add(ctx, packet->payload, out);
+		return SR_OK;
+	}
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		if (!ctx->started) {
+			g_string_append_len(out, COLUMNAR_MAGIC,
+					COLUMNAR_MAGIC_LEN);
+			schema_add(ctx, out);
+			ctx->started = TRUE;
+		}
+		logic_flush(ctx, out);
+		ctx->samplecount = 0;
+		break;
+	case SR_DF_TRIGGER:
+		if (!ctx->started)
+			break;
+		logic_flush(ctx, out);
+		start = block_begin(out, COLUMNAR_TRIGGER);
+		put_le64(out, ctx->samplecount);
+		block_end(out, start);
+		break;
+	case SR_DF_ANALOG:
+		if (!ctx->started)
+			break;
+		return analog_add(ctx, packet->payload, out);
+	case SR_DF_END:
+		if (!ctx->started)
+			break;
+		logic_flush(ctx, out);
+		start = block_begin(out, COLUMNAR_END);
+		block_end(out, start);
+		break;
+	}
+
+	return SR_OK;
+}
+
+static int cleanup(struct sr_output *o)
+{
+	struct context *ctx;
+
+	if (!o || !(ctx = o->internal))
+		return SR_OK;
+
+	g_ptr_array_free(ctx->logic, TRUE);
+	g_ptr_array_free(ctx->analog, TRUE);
+	g_free(ctx->bits);
+	g_free(ctx->values);
+	g_free(ctx->columns);
+	g_free(ctx);
+	o->internal = NULL;
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_output_format output_columnar = {
+	.id = "columnar",
+	.description = "Columnar binary record batches",
+	.df_type = SR_DF_LOGIC,
+	.init = init,
+	.receive = receive,
+	.cleanup = cleanup,
+};
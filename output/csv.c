@@ -28,11 +28,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "output/csv: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 struct context {
 	unsigned int num_enabled_probes;
@@ -40,6 +40,8 @@ struct context {
 	uint64_t samplerate;
 	GString *header;
 	char separator;
+	/* Text of the 8 bits of a sample byte, LSB first. */
+	char bits[256][16];
 };
 
 /*
@@ -60,7 +62,7 @@ static int init(struct sr_output *o)
 	struct sr_probe *probe;
 	GSList *l;
 	GVariant *gvar;
-	int num_probes;
+	int num_probes, i, j;
 	time_t t;
 
 	if (!o) {
@@ -99,6 +101,13 @@ static int init(struct sr_output *o)
 		ctx->samplerate = 0;
 
 	ctx->separator = ',';
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < 8; j++) {
+			ctx->bits[i][j * 2] = '0' + ((i >> j) & 1);
+			ctx->bits[i][j * 2 + 1] = ctx->separator;
+		}
+	}
+
 	ctx->header = g_string_sized_new(512);
 
 	t = time(NULL);
@@ -122,94 +131,83 @@ static int init(struct sr_output *o)
 	return SR_OK;
 }
 
-static int event(struct sr_output *o, int event_type, uint8_t **data_out,
-		 uint64_t *length_out)
+static int receive(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, GString *out)
 {
-	struct context *ctx;
+	(void)sdi;
+	(void)out;
 
-	if (!o) {
-		sr_err("%s: o was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
-	if (!(ctx = o->internal)) {
+	if (!o || !o->internal) {
 		sr_err("%s: o->internal was NULL", __func__);
 		return SR_ERR_ARG;
 	}
 
-	if (!data_out) {
-		sr_err("%s: data_out was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
-	switch (event_type) {
-	case SR_DF_TRIGGER:
+	if (packet->type == SR_DF_TRIGGER) {
 		sr_dbg("%s: SR_DF_TRIGGER event", __func__);
 		/* TODO */
-		*data_out = NULL;
-		*length_out = 0;
-		break;
-	case SR_DF_END:
-		sr_dbg("%s: SR_DF_END event", __func__);
-		/* TODO */
-		*data_out = NULL;
-		*length_out = 0;
-		g_free(o->internal);
-		o->internal = NULL;
-		break;
-	default:
-		sr_err("%s: unsupported event type: %d", __func__, event_type);
-		*data_out = NULL;
-		*length_out = 0;
-		break;
 	}
 
 	return SR_OK;
 }
 
-static int data(struct sr_output *o, const uint8_t *data_in,
-		uint64_t length_in, uint8_t **data_out, uint64_t *length_out)
+static int encode(struct sr_output *o, const struct sr_output_chunk *chunk,
+		GString *out)
 {
 	struct context *ctx;
-	GString *outstr;
-	uint64_t sample, i, j;
+	const uint8_t *sample;
+	uint64_t i;
+	unsigned int num_bytes, num_bits, j;
+	gsize len;
+	char *p;
 
-	if (!o) {
-		sr_err("%s: o was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
-	if (!(ctx = o->internal)) {
+	if (!o || !(ctx = o->internal)) {
 		sr_err("%s: o->internal was NULL", __func__);
 		return SR_ERR_ARG;
 	}
 
-	if (!data_in) {
-		sr_err("%s: data_in was NULL", __func__);
+	if (chunk->unitsize < ctx->unitsize) {
+		sr_err("%s: unitsize %d too small", __func__, chunk->unitsize);
 		return SR_ERR_ARG;
 	}
 
-	if (ctx->header) {
+	if (chunk->start_sample == 0) {
 		/* First data packet. */
-		outstr = ctx->header;
-		ctx->header = NULL;
-	} else {
-		outstr = g_string_sized_new(512);
+		g_string_append_len(out, ctx->header->str, ctx->header->len);
 	}
 
-	for (i = 0; i <= length_in - ctx->unitsize; i += ctx->unitsize) {
-		memcpy(&sample, data_in + i, ctx->unitsize);
-		for (j = 0; j < ctx->num_enabled_probes; j++) {
-			g_string_append_printf(outstr, "%d%c",
-				(int)((sample & (1 << j)) >> j),
-				ctx->separator);
+	/* Every probe takes two characters, plus the newline per sample. */
+	len = out->len;
+	g_string_set_size(out, len + chunk->num_samples
+			* (ctx->num_enabled_probes * 2 + 1));
+	p = out->str + len;
+
+	num_bytes = ctx->num_enabled_probes / 8;
+	num_bits = ctx->num_enabled_probes % 8;
+	sample = chunk->data;
+	for (i = 0; i < chunk->num_samples; i++, sample += chunk->unitsize) {
+		for (j = 0; j < num_bytes; j++, p += 16)
+			memcpy(p, ctx->bits[sample[j]], 16);
+		if (num_bits) {
+			memcpy(p, ctx->bits[sample[j]], num_bits * 2);
+			p += num_bits * 2;
 		}
-		g_string_append_printf(outstr, "\n");
+		*p++ = '\n';
 	}
 
-	*data_out = (uint8_t *)outstr->str;
-	*length_out = outstr->len;
-	g_string_free(outstr, FALSE);
+	return SR_OK;
+}
+
+static int cleanup(struct sr_output *o)
+{
+	struct context *ctx;
+
+	if (!o || !o->internal)
+		return SR_ERR_ARG;
+
+	ctx = o->internal;
+	g_string_free(ctx->header, TRUE);
+	g_free(ctx);
+	o->internal = NULL;
 
 	return SR_OK;
 }
@@ -219,6 +217,7 @@ SR_PRIV struct sr_output_format output_csv = {
 	.description = "Comma-separated values (CSV)",
 	.df_type = SR_DF_LOGIC,
 	.init = init,
-	.data = data,
-	.event = event,
+	.receive = receive,
+	.encode = encode,
+	.cleanup = cleanup,
 };
@@ -28,17 +28,18 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "output/gnuplot: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 struct context {
 	unsigned int num_enabled_probes;
 	unsigned int unitsize;
 	char *header;
-	uint8_t *old_sample;
+	/* The value columns for every byte of a sample, "b b b ... ". */
+	char columns[256][16];
 };
 
 static const char *gnuplot_header = "\
@@ -62,7 +63,7 @@ static int init(struct sr_output *o)
 	GSList *l;
 	GVariant *gvar;
 	uint64_t samplerate;
-	unsigned int i;
+	unsigned int i, p;
 	int num_probes;
 	char *c, *frequency_s;
 	char wbuf[1000], comment[128];
@@ -130,138 +131,113 @@ static int init(struct sr_output *o)
 			ctime(&t), comment, frequency_s, (char *)&wbuf);
 	g_free(frequency_s);
 
-	if (!(ctx->old_sample = g_try_malloc0(ctx->unitsize))) {
-		sr_err("%s: ctx->old_sample malloc failed", __func__);
-		g_free(ctx->header);
-		g_free(ctx);
-		return SR_ERR_MALLOC;
+	for (i = 0; i < 256; i++) {
+		for (p = 0; p < 8; p++) {
+			ctx->columns[i][p * 2] = '0' + ((i >> p) & 1);
+			ctx->columns[i][p * 2 + 1] = ' ';
+		}
 	}
 
 	return 0;
 }
 
-static int event(struct sr_output *o, int event_type, uint8_t **data_out,
-		 uint64_t *length_out)
+/* Append a sample's line: its number, and the value of every probe. */
+static void append_line(GString *out, const struct context *ctx,
+		const uint8_t *sample, uint64_t samplenum)
 {
-	if (!o) {
-		sr_err("%s: o was NULL", __func__);
-		return SR_ERR_ARG;
-	}
+	char num[24], *c;
+	uint64_t n;
+	unsigned int b, full, rest;
+
+	/* The first column is a counter (needed for gnuplot). */
+	c = num + sizeof(num);
+	*--c = '\t';
+	n = samplenum;
+	do {
+		*--c = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	g_string_append_len(out, c, num + sizeof(num) - c);
+
+	/* The next columns are the values of all probes, 8 at a time. */
+	full = ctx->num_enabled_probes / 8;
+	rest = ctx->num_enabled_probes % 8;
+	for (b = 0; b < full; b++)
+		g_string_append_len(out, ctx->columns[sample[b]], 16);
+	if (rest)
+		g_string_append_len(out, ctx->columns[sample[b]], rest * 2);
+
+	g_string_append_c(out, '\n');
+}
 
-	if (!data_out) {
-		sr_err("%s: data_out was NULL", __func__);
-		return SR_ERR_ARG;
-	}
+static int receive(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, GString *out)
+{
+	(void)sdi;
+	(void)packet;
+	(void)out;
 
-	if (!length_out) {
-		sr_err("%s: length_out was NULL", __func__);
+	if (!o || !o->internal) {
+		sr_err("%s: o->internal was NULL", __func__);
 		return SR_ERR_ARG;
 	}
 
-	switch (event_type) {
-	case SR_DF_TRIGGER:
-		/* TODO: Can a trigger mark be in a gnuplot data file? */
-		break;
-	case SR_DF_END:
-		g_free(o->internal);
-		o->internal = NULL;
-		break;
-	default:
-		sr_err("%s: unsupported event type: %d", __func__, event_type);
-		break;
-	}
-
-	*data_out = NULL;
-	*length_out = 0;
+	/* TODO: Can a trigger mark be in a gnuplot data file? */
 
 	return SR_OK;
 }
 
-static int data(struct sr_output *o, const uint8_t *data_in,
-		uint64_t length_in, uint8_t **data_out, uint64_t *length_out)
+static int encode(struct sr_output *o, const struct sr_output_chunk *chunk,
+		GString *out)
 {
 	struct context *ctx;
-	unsigned int max_linelen, outsize, p, curbit, i;
-	const uint8_t *sample;
-	static uint64_t samplecount = 0;
-	uint8_t *outbuf, *c;
+	const uint8_t *sample, *prev, *last;
+	uint64_t i;
 
-	if (!o) {
-		sr_err("%s: o was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
-	if (!o->internal) {
+	if (!o || !o->internal) {
 		sr_err("%s: o->internal was NULL", __func__);
 		return SR_ERR_ARG;
 	}
 
-	if (!data_in) {
-		sr_err("%s: data_in was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
-	if (!data_out) {
-		sr_err("%s: data_out was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
-	if (!length_out) {
-		sr_err("%s: length_out was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
 	ctx = o->internal;
-	max_linelen = 16 + ctx->num_enabled_probes * 2;
-	outsize = length_in / ctx->unitsize * max_linelen;
-	if (ctx->header)
-		outsize += strlen(ctx->header);
-
-	if (!(outbuf = g_try_malloc0(outsize))) {
-		sr_err("%s: outbuf malloc failed", __func__);
-		return SR_ERR_MALLOC;
+	if (chunk->unitsize < ctx->unitsize) {
+		sr_err("%s: unitsize %d too small", __func__, chunk->unitsize);
+		return SR_ERR_ARG;
 	}
 
-	outbuf[0] = '\0';
-	if (ctx->header) {
-		/* The header is still here, this must be the first packet. */
-		strncpy((char *)outbuf, ctx->header, outsize);
-		g_free(ctx->header);
-		ctx->header = NULL;
+	if (chunk->start_sample == 0) {
+		/* This must be the first packet. */
+		g_string_append(out, ctx->header);
 	}
 
-	for (i = 0; i <= length_in - ctx->unitsize; i += ctx->unitsize) {
-
-		sample = data_in + i;
-
+	prev = chunk->prev_sample;
+	sample = chunk->data;
+	last = sample + (chunk->num_samples - 1) * chunk->unitsize;
+	for (i = 0; i < chunk->num_samples; i++, sample += chunk->unitsize) {
 		/*
 		 * Don't output the same samples multiple times. However, make
 		 * sure to output at least the first and last sample.
 		 */
-		if (samplecount++ != 0 &&
-				!memcmp(sample, ctx->old_sample, ctx->unitsize)) {
-			if (i != (length_in - ctx->unitsize))
-				continue;
-		}
-		memcpy(ctx->old_sample, sample, ctx->unitsize);
+		if (!prev || memcmp(sample, prev, ctx->unitsize)
+		    || (chunk->packet_end && sample == last))
+			append_line(out, ctx, sample, chunk->start_sample + i);
+		prev = sample;
+	}
 
-		/* The first column is a counter (needed for gnuplot). */
-		c = outbuf + strlen((const char *)outbuf);
-		sprintf((char *)c, "%" PRIu64 "\t", samplecount++);
+	return SR_OK;
+}
 
-		/* The next columns are the values of all channels. */
-		for (p = 0; p < ctx->num_enabled_probes; p++) {
-			curbit = (sample[p / 8] & ((uint8_t) (1 << (p % 8)))) >> (p % 8);
-			c = outbuf + strlen((const char *)outbuf);
-			sprintf((char *)c, "%d ", curbit);
-		}
+static int cleanup(struct sr_output *o)
+{
+	struct context *ctx;
 
-		c = outbuf + strlen((const char *)outbuf);
-		sprintf((char *)c, "\n");
-	}
+	if (!o || !o->internal)
+		return SR_ERR_ARG;
 
-	*data_out = outbuf;
-	*length_out = strlen((const char *)outbuf);
+	ctx = o->internal;
+	g_free(ctx->header);
+	g_free(ctx);
+	o->internal = NULL;
 
 	return SR_OK;
 }
@@ -271,6 +247,7 @@ SR_PRIV struct sr_output_format output_gnuplot = {
 	.description = "Gnuplot",
 	.df_type = SR_DF_LOGIC,
 	.init = init,
-	.data = data,
-	.event = event,
+	.receive = receive,
+	.encode = encode,
+	.cleanup = cleanup,
 };
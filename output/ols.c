@@ -34,107 +34,144 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "output/ols: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 struct context {
-	uint64_t samplerate;
-	uint64_t num_samples;
+	/*
+	 * Only write samples which differ from the one before them, and
+	 * the last one of every packet.
+	 */
+	gboolean rle;
 };
 
+static const char hexdigits[] = "0123456789abcdef";
+
+/* Longest line: 16 hex digits, '@', 20 decimal digits and a newline. */
+#define MAX_LINE_LEN (2 * 8 + 1 + 20 + 1)
+
 static int init(struct sr_output *o)
 {
 	struct context *ctx;
 
-	if (!(ctx = g_try_malloc(sizeof(struct context)))) {
+	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
 		sr_err("%s: ctx malloc failed", __func__);
 		return SR_ERR_MALLOC;
 	}
 	o->internal = ctx;
 
-	ctx->samplerate = 0;
-	ctx->num_samples = 0;
+	if (o->param && o->param[0]) {
+		if (!g_ascii_strcasecmp(o->param, "rle"))
+			ctx->rle = TRUE;
+		else
+			sr_warn("Ignoring unknown option '%s'.", o->param);
+	}
 
 	return SR_OK;
 }
 
-static GString *gen_header(const struct sr_dev_inst *sdi, struct context *ctx)
+static void gen_header(const struct sr_output *o, GString *s)
 {
 	struct sr_probe *probe;
 	GSList *l;
-	GString *s;
-	GVariant *gvar;
 	int num_enabled_probes;
 
-	if (!ctx->samplerate && sr_config_get(sdi->driver, sdi, NULL,
-			SR_CONF_SAMPLERATE, &gvar) == SR_OK) {
-		ctx->samplerate = g_variant_get_uint64(gvar);
-		g_variant_unref(gvar);
-	}
-
 	num_enabled_probes = 0;
-	for (l = sdi->probes; l; l = l->next) {
+	for (l = o->sdi->probes; l; l = l->next) {
 		probe = l->data;
 		if (probe->enabled)
 			num_enabled_probes++;
 	}
 
-	s = g_string_sized_new(512);
-	g_string_append_printf(s, ";Rate: %"PRIu64"\n", ctx->samplerate);
+	g_string_append_printf(s, ";Rate: %"PRIu64"\n", o->params.samplerate);
 	g_string_append_printf(s, ";Channels: %d\n", num_enabled_probes);
 	g_string_append_printf(s, ";EnabledChannels: -1\n");
 	g_string_append_printf(s, ";Compressed: true\n");
 	g_string_append_printf(s, ";CursorEnabled: false\n");
+}
 
-	return s;
+/* Write one "<hex>@<index>" line at p, and return the end of it. */
+static char *append_sample(char *p, const uint8_t *sample,
+		unsigned int unitsize, uint64_t index)
+{
+	char digits[20];
+	unsigned int i, n;
+
+	/* The OLS format wants the samples presented MSB first. */
+	for (i = unitsize; i > 0; i--) {
+		*p++ = hexdigits[sample[i - 1] >> 4];
+		*p++ = hexdigits[sample[i - 1] & 0x0f];
+	}
+	*p++ = '@';
+	n = 0;
+	do {
+		digits[n++] = '0' + index % 10;
+		index /= 10;
+	} while (index);
+	while (n)
+		*p++ = digits[--n];
+	*p++ = '\n';
+
+	return p;
 }
 
+/* The samplerate comes with o->params, there's nothing else to keep. */
 static int receive(struct sr_output *o, const struct sr_dev_inst *sdi,
-		const struct sr_datafeed_packet *packet, GString **out)
+		const struct sr_datafeed_packet *packet, GString *out)
+{
+	(void)sdi;
+	(void)packet;
+	(void)out;
+
+	if (!o || !o->sdi)
+		return SR_ERR_ARG;
+
+	return SR_OK;
+}
+
+static int encode(struct sr_output *o, const struct sr_output_chunk *chunk,
+		GString *out)
 {
 	struct context *ctx;
-	const struct sr_datafeed_meta *meta;
-	const struct sr_datafeed_logic *logic;
-	const struct sr_config *src;
-	GSList *l;
-	unsigned int i, j;
-	uint8_t c;
+	const uint8_t *sample, *prev, *last;
+	unsigned int unitsize;
+	uint64_t i;
+	gsize len;
+	char *p;
 
-	*out = NULL;
 	if (!o || !o->sdi)
 		return SR_ERR_ARG;
 	ctx = o->internal;
 
-	switch (packet->type) {
-	case SR_DF_META:
-		meta = packet->payload;
-		for (l = meta->config; l; l = l->next) {
-			src = l->data;
-			if (src->key == SR_CONF_SAMPLERATE)
-				ctx->samplerate = g_variant_get_uint64(src->data);
-		}
-		break;
-	case SR_DF_LOGIC:
-		logic = packet->payload;
-		if (ctx->num_samples == 0) {
-			/* First logic packet in the feed. */
-			*out = gen_header(sdi, ctx);
-		} else
-			*out = g_string_sized_new(512);
-		for (i = 0; i <= logic->length - logic->unitsize; i += logic->unitsize) {
-			for (j = 0; j < logic->unitsize; j++) {
-				/* The OLS format wants the samples presented MSB first. */
-				c = *((uint8_t *)logic->data + i + logic->unitsize - 1 - j);
-				g_string_append_printf(*out, "%02x", c);
-			}
-			g_string_append_printf(*out, "@%"PRIu64"\n", ctx->num_samples++);
-		}
-		break;
+	if (chunk->start_sample == 0) {
+		/* First logic packet in the feed. */
+		gen_header(o, out);
 	}
 
+	/* The format has no room for more than 64 probes. */
+	unitsize = MIN(chunk->unitsize, 8);
+
+	/* Size the string for the worst case once, and trim it after. */
+	len = out->len;
+	g_string_set_size(out, len + chunk->num_samples * MAX_LINE_LEN);
+	p = out->str + len;
+
+	prev = chunk->prev_sample;
+	sample = chunk->data;
+	last = sample + (chunk->num_samples - 1) * chunk->unitsize;
+	for (i = 0; i < chunk->num_samples; i++, sample += chunk->unitsize) {
+		if (!ctx->rle || !prev || memcmp(sample, prev, unitsize)
+		    || (chunk->packet_end && sample == last))
+			p = append_sample(p, sample, unitsize,
+					chunk->start_sample + i);
+		prev = sample;
+	}
+
+	g_string_truncate(out, p - out->str);
+
 	return SR_OK;
 }
 
@@ -158,5 +195,6 @@ SR_PRIV struct sr_output_format output_ols = {
 	.df_type = SR_DF_LOGIC,
 	.init = init,
 	.receive = receive,
+	.encode = encode,
 	.cleanup = cleanup
 };
@@ -17,15 +17,88 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <glib.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "output: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
 /**
  * @file
  *
  * Output file/data format handling.
  */
 
+/* Output is collected until there is at least this much to write. */
+#define OUTPUT_FLUSH_SIZE (64 * 1024)
+
+/* Logic packets are only split up for encode() in ranges this large. */
+#define MIN_CHUNK_SAMPLES (64 * 1024)
+
+/* One range of a packet, encoded in a thread of the pool. */
+struct encode_job {
+	struct sr_output *o;
+	struct sr_output_chunk chunk;
+	GString *out;
+	int ret;
+};
+
+struct sr_output_encoder {
+	/* Logic samples passed to the module so far, and the last one. */
+	uint64_t samplecount;
+	uint8_t *prev_sample;
+	uint16_t prev_unitsize;
+
+	/* Only used with more than one thread. */
+	int num_threads;
+	GThreadPool *pool;
+	struct encode_job *jobs;
+	GMutex mutex;
+	GCond cond;
+	int jobs_pending;
+};
+
+/* Output is compressed in blocks this large, one per thread. */
+#define COMPRESS_BLOCK_SIZE (1024 * 1024)
+
+/* One block of output, compressed in a thread of the pool. */
+struct compress_job {
+	const uint8_t *in;
+	uLong in_len;
+	uint8_t *out;
+	uLong out_size;
+	uLong out_len;
+	int level;
+	int ret;
+};
+
+struct sr_output_compressor {
+	int level;
+	/* Output collected for the next blocks, one after the other. */
+	uint8_t *buf;
+	gsize buf_len;
+	gsize buf_size;
+
+	int num_threads;
+	GThreadPool *pool;
+	struct compress_job *jobs;
+	GMutex mutex;
+	GCond cond;
+	int jobs_pending;
+};
+
 /**
  * @defgroup grp_output Output formats
  *
@@ -40,10 +113,12 @@
  * into libsigrok live, instead of storing and then transferring the whole
  * buffer, can thus generate output live.
  *
- * Output modules are responsible for allocating enough memory to store
- * their own output, and passing a pointer to that memory (and length) of
- * the allocated memory back to the caller. The caller is then expected to
- * free this memory when finished with it.
+ * Frontends create an output instance with sr_output_new(), and pass it
+ * every packet of the datafeed with sr_output_send(). Output modules
+ * append what they generate to a buffer owned by the instance, which is
+ * reused for the whole stream and written to the frontend's sink in
+ * large pieces. Modules supporting it hand data they don't convert to
+ * the sink directly, without an intermediate copy.
  *
  * @{
  */
@@ -59,6 +134,9 @@ extern SR_PRIV struct sr_output_format output_gnuplot;
 extern SR_PRIV struct sr_output_format output_chronovu_la8;
 extern SR_PRIV struct sr_output_format output_csv;
 extern SR_PRIV struct sr_output_format output_analog;
+extern SR_PRIV struct sr_output_format output_analog_raw;
+extern SR_PRIV struct sr_output_format output_srnet;
+extern SR_PRIV struct sr_output_format output_columnar;
 /* extern SR_PRIV struct sr_output_format output_analog_gnuplot; */
 /* @endcond */
 
@@ -73,6 +151,9 @@ static struct sr_output_format *output_module_list[] = {
 	&output_chronovu_la8,
 	&output_csv,
 	&output_analog,
+	&output_analog_raw,
+	&output_srnet,
+	&output_columnar,
 	/* &output_analog_gnuplot, */
 	NULL,
 };
@@ -82,4 +163,682 @@ SR_API struct sr_output_format **sr_output_list(void)
 	return output_module_list;
 }
 
+/**
+ * Create a new output instance, and initialize the output module for it.
+ *
+ * @param format The output module to use. Must not be NULL.
+ * @param param An optional parameter string for the module, or NULL.
+ * @param sdi The device instance whose data will be output.
+ *
+ * @return A new output instance, to be freed with sr_output_free(), or
+ *         NULL upon errors.
+ *
+ * @since 0.3.0
+ */
+SR_API struct sr_output *sr_output_new(struct sr_output_format *format,
+		const char *param, struct sr_dev_inst *sdi)
+{
+	struct sr_output *o;
+
+	if (!format) {
+		sr_err("%s: format was NULL", __func__);
+		return NULL;
+	}
+
+	if (!(o = g_try_malloc0(sizeof(struct sr_output)))) {
+		sr_err("%s: o malloc failed", __func__);
+		return NULL;
+	}
+
+	o->format = format;
+	o->sdi = sdi;
+	o->param = g_strdup(param);
+	if (!(o->buf = g_string_sized_new(OUTPUT_FLUSH_SIZE))) {
+		sr_err("%s: o->buf malloc failed", __func__);
+		g_free(o->param);
+		g_free(o);
+		return NULL;
+	}
+
+	if (format->encode) {
+		if (!(o->encoder = g_try_malloc0(sizeof(*o->encoder)))) {
+			sr_err("%s: o->encoder malloc failed", __func__);
+			g_string_free(o->buf, TRUE);
+			g_free(o->param);
+			g_free(o);
+			return NULL;
+		}
+		o->encoder->num_threads = 1;
+		g_mutex_init(&o->encoder->mutex);
+		g_cond_init(&o->encoder->cond);
+	}
+
+	if (format->init && format->init(o) != SR_OK) {
+		sr_err("Failed to initialize output module '%s'.",
+		       format->id);
+		sr_output_free(o);
+		return NULL;
+	}
+
+	return o;
+}
+
+static void encoder_threads_free(struct sr_output_encoder *enc)
+{
+	int i;
+
+	if (enc->pool)
+		g_thread_pool_free(enc->pool, FALSE, TRUE);
+	for (i = 0; enc->jobs && i < enc->num_threads - 1; i++)
+		g_string_free(enc->jobs[i].out, TRUE);
+	g_free(enc->jobs);
+	enc->pool = NULL;
+	enc->jobs = NULL;
+	enc->num_threads = 1;
+}
+
+static void compressor_free(struct sr_output_compressor *comp)
+{
+	int i;
+
+	if (comp->pool)
+		g_thread_pool_free(comp->pool, FALSE, TRUE);
+	for (i = 0; comp->jobs && i < comp->num_threads; i++)
+		g_free(comp->jobs[i].out);
+	g_free(comp->jobs);
+	g_free(comp->buf);
+	g_mutex_clear(&comp->mutex);
+	g_cond_clear(&comp->cond);
+	g_free(comp);
+}
+
+/**
+ * Free an output instance created with sr_output_new(). Output which
+ * has not been written yet is discarded, see sr_output_flush().
+ *
+ * @param o The output instance. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or the
+ *         error returned by the output module's cleanup.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_output_free(struct sr_output *o)
+{
+	int ret;
+
+	if (!o) {
+		sr_err("%s: o was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	ret = SR_OK;
+	if (o->format->cleanup && o->internal)
+		ret = o->format->cleanup(o);
+	if (o->encoder) {
+		encoder_threads_free(o->encoder);
+		g_mutex_clear(&o->encoder->mutex);
+		g_cond_clear(&o->encoder->cond);
+		g_free(o->encoder->prev_sample);
+		g_free(o->encoder);
+	}
+	if (o->compressor)
+		compressor_free(o->compressor);
+	if (o->buf)
+		g_string_free(o->buf, TRUE);
+	g_free(o->param);
+	g_free(o);
+
+	return ret;
+}
+
+static void encode_job_run(gpointer data, gpointer user_data)
+{
+	struct encode_job *job;
+	struct sr_output_encoder *enc;
+
+	job = data;
+	enc = user_data;
+	job->ret = job->o->format->encode(job->o, &job->chunk, job->out);
+
+	g_mutex_lock(&enc->mutex);
+	if (--enc->jobs_pending == 0)
+		g_cond_signal(&enc->cond);
+	g_mutex_unlock(&enc->mutex);
+}
+
+/**
+ * Set how many threads an output instance may use to encode logic data.
+ *
+ * Output modules implementing the encode() callback can have large
+ * SR_DF_LOGIC packets split into ranges which are encoded at the same
+ * time, e.g. when converting a large session file. Output is the same
+ * as with a single thread.
+ *
+ * @param o The output instance, as created by sr_output_new(). Must not
+ *          be NULL.
+ * @param num_threads The number of threads to use, including the one
+ *                    calling sr_output_send(). 1 encodes everything in
+ *                    the calling thread.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_NA if the output module can't encode in parallel, or
+ *         SR_ERR if the threads could not be created.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_output_threads_set(struct sr_output *o, int num_threads)
+{
+	struct sr_output_encoder *enc;
+	GError *error;
+	int i;
+
+	if (!o || num_threads < 1) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!(enc = o->encoder))
+		return num_threads == 1 ? SR_OK : SR_ERR_NA;
+
+	encoder_threads_free(enc);
+	if (num_threads == 1)
+		return SR_OK;
+
+	if (!(enc->jobs = g_try_new0(struct encode_job, num_threads - 1))) {
+		sr_err("%s: enc->jobs malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	for (i = 0; i < num_threads - 1; i++) {
+		enc->jobs[i].o = o;
+		enc->jobs[i].out = g_string_sized_new(OUTPUT_FLUSH_SIZE);
+	}
+	enc->num_threads = num_threads;
+
+	error = NULL;
+	if (!(enc->pool = g_thread_pool_new(encode_job_run, enc,
+			num_threads - 1, TRUE, &error))) {
+		sr_err("Failed to start encoder threads: %s.",
+		       error->message);
+		g_error_free(error);
+		encoder_threads_free(enc);
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}
+
+/* Deflate a block into a gzip member of its own. */
+static int compress_block(struct compress_job *job)
+{
+	z_stream zs;
+	int ret;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, job->level, Z_DEFLATED, 15 + 16, 8,
+			Z_DEFAULT_STRATEGY) != Z_OK)
+		return SR_ERR;
+	zs.next_in = (Bytef *)job->in;
+	zs.avail_in = job->in_len;
+	zs.next_out = job->out;
+	zs.avail_out = job->out_size;
+	ret = deflate(&zs, Z_FINISH);
+	job->out_len = zs.total_out;
+	deflateEnd(&zs);
+
+	return ret == Z_STREAM_END ? SR_OK : SR_ERR;
+}
+
+static void compress_job_run(gpointer data, gpointer user_data)
+{
+	struct compress_job *job;
+	struct sr_output_compressor *comp;
+
+	job = data;
+	comp = user_data;
+	job->ret = compress_block(job);
+
+	g_mutex_lock(&comp->mutex);
+	if (--comp->jobs_pending == 0)
+		g_cond_signal(&comp->cond);
+	g_mutex_unlock(&comp->mutex);
+}
+
+/*
+ * Compress the output collected so far, a block in each thread, and
+ * write the blocks to the sink in order.
+ */
+static int compress_flush(struct sr_output_compressor *comp,
+		sr_output_write_callback_t cb, void *cb_data)
+{
+	struct compress_job *job;
+	gsize pos;
+	int num_jobs, ret, i;
+
+	if (!comp->buf_len)
+		return SR_OK;
+
+	num_jobs = (comp->buf_len + COMPRESS_BLOCK_SIZE - 1)
+			/ COMPRESS_BLOCK_SIZE;
+	comp->jobs_pending = num_jobs - 1;
+	for (i = 0, pos = 0; i < num_jobs; i++, pos += COMPRESS_BLOCK_SIZE) {
+		job = &comp->jobs[i];
+		job->in = comp->buf + pos;
+		job->in_len = MIN(COMPRESS_BLOCK_SIZE, comp->buf_len - pos);
+		if (i > 0)
+			g_thread_pool_push(comp->pool, job, NULL);
+	}
+	comp->jobs[0].ret = compress_block(&comp->jobs[0]);
+
+	g_mutex_lock(&comp->mutex);
+	while (comp->jobs_pending > 0)
+		g_cond_wait(&comp->cond, &comp->mutex);
+	g_mutex_unlock(&comp->mutex);
+	comp->buf_len = 0;
+
+	ret = SR_OK;
+	for (i = 0; i < num_jobs && ret == SR_OK; i++) {
+		job = &comp->jobs[i];
+		if ((ret = job->ret) != SR_OK)
+			sr_err("Failed to compress output.");
+		else
+			ret = cb(job->out, job->out_len, cb_data);
+	}
+
+	return ret;
+}
+
+/* Write to the sink, through the compressor if there is one. */
+static int output_write(struct sr_output *o, const void *buf, uint64_t len,
+		sr_output_write_callback_t cb, void *cb_data)
+{
+	struct sr_output_compressor *comp;
+	const uint8_t *p;
+	uint64_t n;
+	int ret;
+
+	if (!(comp = o->compressor))
+		return cb(buf, len, cb_data);
+
+	p = buf;
+	while (len > 0) {
+		n = MIN(len, comp->buf_size - comp->buf_len);
+		memcpy(comp->buf + comp->buf_len, p, n);
+		comp->buf_len += n;
+		p += n;
+		len -= n;
+		if (comp->buf_len == comp->buf_size
+		    && (ret = compress_flush(comp, cb, cb_data)) != SR_OK)
+			return ret;
+	}
+
+	return SR_OK;
+}
+
+/* The sink handed to modules implementing write(), with a compressor. */
+struct compress_sink {
+	struct sr_output *o;
+	sr_output_write_callback_t cb;
+	void *cb_data;
+};
+
+static int compress_sink_write(const void *buf, uint64_t len, void *cb_data)
+{
+	struct compress_sink *sink;
+
+	sink = cb_data;
+
+	return output_write(sink->o, buf, len, sink->cb, sink->cb_data);
+}
+
+/**
+ * Have an output instance's output compressed before it's written.
+ *
+ * The output is compressed into gzip format, in blocks of 1 MiB which are
+ * compressed at the same time in the given number of threads. Each block
+ * is a gzip member of its own, which gzip and zlib read as one stream.
+ * Input modules loading files take such files as they are.
+ *
+ * This must be set before any output is written.
+ *
+ * @param o The output instance, as created by sr_output_new(). Must not
+ *          be NULL.
+ * @param level The compression level, 1 (fastest) to 9 (smallest), or
+ *              0 to write the output uncompressed.
+ * @param num_threads The number of threads to compress in, including
+ *                    the one calling sr_output_send().
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, or SR_ERR if the
+ *         threads could not be created.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_output_compress_set(struct sr_output *o, int level,
+		int num_threads)
+{
+	struct sr_output_compressor *comp;
+	GError *error;
+	uLong out_size;
+	int i;
+
+	if (!o || level < 0 || level > 9 || num_threads < 1) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (o->compressor) {
+		compressor_free(o->compressor);
+		o->compressor = NULL;
+	}
+	if (!level)
+		return SR_OK;
+
+	if (!(comp = g_try_malloc0(sizeof(struct sr_output_compressor)))) {
+		sr_err("%s: comp malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	g_mutex_init(&comp->mutex);
+	g_cond_init(&comp->cond);
+	comp->level = level;
+	comp->num_threads = num_threads;
+	comp->buf_size = (gsize)num_threads * COMPRESS_BLOCK_SIZE;
+
+	/* Room for the gzip header and trailer as well. */
+	out_size = compressBound(COMPRESS_BLOCK_SIZE) + 32;
+	if (!(comp->buf = g_try_malloc(comp->buf_size))
+	    || !(comp->jobs = g_try_new0(struct compress_job, num_threads))) {
+		sr_err("%s: buffer malloc failed", __func__);
+		compressor_free(comp);
+		return SR_ERR_MALLOC;
+	}
+	for (i = 0; i < num_threads; i++) {
+		comp->jobs[i].level = level;
+		comp->jobs[i].out_size = out_size;
+		if (!(comp->jobs[i].out = g_try_malloc(out_size))) {
+			sr_err("%s: buffer malloc failed", __func__);
+			compressor_free(comp);
+			return SR_ERR_MALLOC;
+		}
+	}
+
+	if (num_threads > 1) {
+		error = NULL;
+		if (!(comp->pool = g_thread_pool_new(compress_job_run, comp,
+				num_threads - 1, TRUE, &error))) {
+			sr_err("Failed to start compressor threads: %s.",
+			       error->message);
+			g_error_free(error);
+			compressor_free(comp);
+			return SR_ERR;
+		}
+	}
+	o->compressor = comp;
+
+	return SR_OK;
+}
+
+/* Write the module's output collected so far. */
+static int buf_write(struct sr_output *o, sr_output_write_callback_t cb,
+		void *cb_data)
+{
+	int ret;
+
+	if (!o->buf || !o->buf->len)
+		return SR_OK;
+
+	ret = output_write(o, o->buf->str, o->buf->len, cb, cb_data);
+	g_string_truncate(o->buf, 0);
+
+	return ret;
+}
+
+/**
+ * Write the output collected so far to the given sink.
+ *
+ * sr_output_send() does this by itself whenever enough output has been
+ * collected, and at the end of the datafeed. Frontends displaying the
+ * output live can call this to see it sooner.
+ *
+ * @param o The output instance. Must not be NULL.
+ * @param cb The sink to write output to. Must not be NULL.
+ * @param cb_data Opaque pointer passed to the sink.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or the
+ *         error returned by the sink.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_output_flush(struct sr_output *o,
+		sr_output_write_callback_t cb, void *cb_data)
+{
+	int ret;
+
+	if (!o || !cb) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if ((ret = buf_write(o, cb, cb_data)) != SR_OK)
+		return ret;
+
+	if (o->compressor)
+		return compress_flush(o->compressor, cb, cb_data);
+
+	return SR_OK;
+}
+
+/*
+ * Pass a logic packet to the module's encode(). Packets large enough are
+ * split into one range per thread, the first of which is encoded here.
+ */
+static int encode_logic(struct sr_output *o,
+		const struct sr_datafeed_logic *logic)
+{
+	struct sr_output_encoder *enc;
+	struct sr_output_chunk chunk;
+	struct encode_job *job;
+	const uint8_t *data;
+	uint64_t num_samples, per_chunk;
+	uint8_t *prev;
+	int num_chunks, ret, i;
+
+	enc = o->encoder;
+	if (!logic->unitsize)
+		return SR_ERR_ARG;
+	num_samples = logic->length / logic->unitsize;
+	if (!num_samples)
+		return SR_OK;
+	data = logic->data;
+
+	num_chunks = 1;
+	if (enc->pool)
+		num_chunks = MAX(1, MIN((uint64_t)enc->num_threads,
+				num_samples / MIN_CHUNK_SAMPLES));
+	per_chunk = num_samples / num_chunks;
+
+	enc->jobs_pending = num_chunks - 1;
+	for (i = 1; i < num_chunks; i++) {
+		job = &enc->jobs[i - 1];
+		job->chunk.data = data + i * per_chunk * logic->unitsize;
+		job->chunk.num_samples = i < num_chunks - 1 ? per_chunk
+				: num_samples - i * per_chunk;
+		job->chunk.unitsize = logic->unitsize;
+		job->chunk.start_sample = enc->samplecount + i * per_chunk;
+		job->chunk.prev_sample = job->chunk.data - logic->unitsize;
+		job->chunk.packet_end = i == num_chunks - 1;
+		g_string_truncate(job->out, 0);
+		g_thread_pool_push(enc->pool, job, NULL);
+	}
+
+	chunk.data = data;
+	chunk.num_samples = num_chunks > 1 ? per_chunk : num_samples;
+	chunk.unitsize = logic->unitsize;
+	chunk.start_sample = enc->samplecount;
+	chunk.prev_sample = enc->prev_unitsize == logic->unitsize
+			? enc->prev_sample : NULL;
+	chunk.packet_end = num_chunks == 1;
+	ret = o->format->encode(o, &chunk, o->buf);
+
+	g_mutex_lock(&enc->mutex);
+	while (enc->jobs_pending > 0)
+		g_cond_wait(&enc->cond, &enc->mutex);
+	g_mutex_unlock(&enc->mutex);
+
+	for (i = 1; i < num_chunks; i++) {
+		job = &enc->jobs[i - 1];
+		if (ret == SR_OK)
+			ret = job->ret;
+		if (ret == SR_OK)
+			g_string_append_len(o->buf, job->out->str,
+					job->out->len);
+	}
+	if (ret != SR_OK)
+		return ret;
+
+	/* The next packet carries on from this one's last sample. */
+	if (enc->prev_unitsize != logic->unitsize) {
+		if (!(prev = g_try_realloc(enc->prev_sample,
+				logic->unitsize))) {
+			sr_err("%s: prev_sample malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		enc->prev_sample = prev;
+		enc->prev_unitsize = logic->unitsize;
+	}
+	memcpy(enc->prev_sample, data + (num_samples - 1) * logic->unitsize,
+			logic->unitsize);
+	enc->samplecount += num_samples;
+
+	return SR_OK;
+}
+
+/* Encode a packet and write the output, for sr_output_send(). */
+static int output_send(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet,
+		sr_output_write_callback_t cb, void *cb_data)
+{
+	struct compress_sink sink;
+	int ret;
+
+	if (packet->type == SR_DF_HEADER || packet->type == SR_DF_META)
+		sr_stream_params_update(&o->params, sdi, packet);
+
+	if (o->format->write) {
+		if ((ret = buf_write(o, cb, cb_data)) != SR_OK)
+			return ret;
+		if (!o->compressor)
+			return o->format->write(o, sdi, packet, cb, cb_data);
+		sink.o = o;
+		sink.cb = cb;
+		sink.cb_data = cb_data;
+		ret = o->format->write(o, sdi, packet, compress_sink_write,
+				&sink);
+		if (ret == SR_OK && packet->type == SR_DF_END)
+			ret = compress_flush(o->compressor, cb, cb_data);
+		return ret;
+	}
+
+	if (!o->buf) {
+		sr_err("%s: no output buffer, use sr_output_new()", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (packet->type == SR_DF_LOGIC && o->encoder)
+		ret = encode_logic(o, packet->payload);
+	else
+		ret = o->format->receive(o, sdi, packet, o->buf);
+	if (ret != SR_OK)
+		return ret;
+
+	if (packet->type == SR_DF_END)
+		return sr_output_flush(o, cb, cb_data);
+	if (o->buf->len >= OUTPUT_FLUSH_SIZE)
+		return buf_write(o, cb, cb_data);
+
+	return SR_OK;
+}
+
+/**
+ * Pass a datafeed packet to an output module, and write the output it
+ * generates to the given sink.
+ *
+ * The output is appended to the instance's buffer, and written to the
+ * sink once enough of it has been collected, and at the end of the
+ * datafeed. Modules implementing the write() callback hand their output
+ * to the sink directly, after whatever is still in the buffer. Logic
+ * data for modules implementing encode() may be encoded in several
+ * threads, see sr_output_threads_set(). The instance's params are
+ * updated before the module sees a header or META packet.
+ *
+ * @param o The output instance, as created by sr_output_new(). Must not
+ *          be NULL.
+ * @param sdi The device instance that generated the packet.
+ * @param packet The packet. Must not be NULL.
+ * @param cb The sink to write output to, see sr_output_fd_write() for
+ *           writing to a file descriptor. Must not be NULL.
+ * @param cb_data Opaque pointer passed to the sink.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or the
+ *         error returned by the output module or the sink.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_output_send(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet,
+		sr_output_write_callback_t cb, void *cb_data)
+{
+	struct sr_session *session;
+	struct sr_stage_timer timer;
+	int ret;
+
+	if (!o || !o->format || !packet || !cb) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	session = sdi ? sdi->session : NULL;
+	sr_stage_begin(session, &timer);
+	ret = output_send(o, sdi, packet, cb, cb_data);
+	sr_stage_end(session, &timer, "output", o->format->id,
+		     sr_packet_samples(packet));
+
+	return ret;
+}
+
+/**
+ * Output sink writing to a file descriptor, for use with sr_output_send().
+ *
+ * @param buf The data to write.
+ * @param len The number of bytes to write.
+ * @param cb_data Pointer to the file descriptor, an int.
+ *
+ * @return SR_OK upon success, SR_ERR if writing failed.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_output_fd_write(const void *buf, uint64_t len, void *cb_data)
+{
+	const uint8_t *p;
+	ssize_t ret;
+	int fd;
+
+	fd = *(int *)cb_data;
+	p = buf;
+	while (len > 0) {
+		ret = write(fd, p, MIN(len, (uint64_t)INT_MAX));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			sr_err("Failed to write output: %s.",
+			       strerror(errno));
+			return SR_ERR;
+		}
+		p += ret;
+		len -= ret;
+	}
+
+	return SR_OK;
+}
+
 /** @} */
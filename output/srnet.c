@@ -0,0 +1,411 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Serializes the datafeed into the sigrok network stream, which the
+ * sigrok-net driver turns back into a datafeed on another host. The
+ * output can be sent over any byte stream, e.g. a TCP connection. All
+ * numbers are little-endian, strings are prefixed by their length
+ * (16 bits). The frame payloads are:
+ *
+ *   SRNET_DEVICE:  vendor, model, number of probes (16 bits), then for
+ *                  each probe its index (16), type (8), enabled (8) and
+ *                  name.
+ *   SRNET_HEADER:  feed version (32), start time seconds and
+ *                  microseconds (64 each).
+ *   SRNET_META:    number of items (16), then for each the config key
+ *                  (32), the GVariant type string, its serialized size
+ *                  (32) and data, in little-endian byte order.
+ *   SRNET_LOGIC:   unitsize (16) and the samples.
+ *   SRNET_ANALOG:  number of probes (16), their indices (16 each), number
+ *                  of samples (32), mq (32), unit (32), mqflags (64) and
+ *                  the samples as IEEE 754 floats (32 each).
+ *   Others:        empty.
+ *
+ * The samples of consecutive logic packets are batched into one frame.
+ *
+ * Options, as a comma-separated list:
+ *   compress=<level>  Deflate frames at level 1 to 9, 0 (the default)
+ *                     sends them as they are.
+ *   batch=<size>      Send logic samples once this many bytes were
+ *                     batched (default 64k), 0 sends every packet at
+ *                     once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "output/srnet: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+#define DEFAULT_BATCH (64 * 1024)
+
+/* Payloads shorter than this are never worth deflating. */
+#define MIN_DEFLATE 64
+
+struct context {
+	int level;
+	uint64_t batch_size;
+	gboolean started;
+	/* The unitsize and samples of logic packets not sent yet. */
+	GString *batch;
+	/* The payload of the frame being built. */
+	GString *payload;
+	uint8_t *zbuf;
+	uLong zbuf_size;
+};
+
+static void put_le16(GString *s, uint16_t v)
+{
+	uint8_t b[2];
+
+	b[0] = v;
+	b[1] = v >> 8;
+	g_string_append_len(s, (const char *)b, sizeof(b));
+}
+
+static void put_le32(GString *s, uint32_t v)
+{
+	put_le16(s, v);
+	put_le16(s, v >> 16);
+}
+
+static void put_le64(GString *s, uint64_t v)
+{
+	put_le32(s, v);
+	put_le32(s, v >> 32);
+}
+
+static void put_string(GString *s, const char *str)
+{
+	size_t len;
+
+	len = str ? MIN(strlen(str), G_MAXUINT16) : 0;
+	put_le16(s, len);
+	g_string_append_len(s, str, len);
+}
+
+static int init(struct sr_output *o)
+{
+	struct context *ctx;
+	char **opts, *val;
+	uint64_t size;
+	int i;
+
+	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
+		sr_err("%s: ctx malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	o->internal = ctx;
+	ctx->batch_size = DEFAULT_BATCH;
+	ctx->batch = g_string_sized_new(DEFAULT_BATCH + 2);
+	ctx->payload = g_string_sized_new(256);
+
+	opts = g_strsplit(o->param ? o->param : "", ",", 0);
+	for (i = 0; opts[i]; i++) {
+		if (!opts[i][0])
+			continue;
+		if ((val = strchr(opts[i], '=')))
+			*val++ = '\0';
+		if (val && !strcmp(opts[i], "compress")) {
+			ctx->level = strtol(val, NULL, 10);
+			if (ctx->level < 0 || ctx->level > 9) {
+				sr_err("Invalid compression level '%s'.", val);
+				g_strfreev(opts);
+				return SR_ERR_ARG;
+			}
+		} else if (val && !strcmp(opts[i], "batch")) {
+			if (sr_parse_sizestring(val, &size) != SR_OK
+			    || size > SRNET_MAX_FRAME / 2) {
+				sr_err("Invalid batch size '%s'.", val);
+				g_strfreev(opts);
+				return SR_ERR_ARG;
+			}
+			ctx->batch_size = size;
+		} else {
+			sr_warn("Ignoring unknown option '%s'.", opts[i]);
+		}
+	}
+	g_strfreev(opts);
+
+	return SR_OK;
+}
+
+/* Append a frame of the given payload, deflated if that's shorter. */
+static int frame_add(struct context *ctx, int type, const GString *payload,
+		GString *out)
+{
+	uLongf zlen;
+	int ret;
+
+	if (payload->len > SRNET_MAX_FRAME - 4) {
+		sr_err("Frame of %" G_GSIZE_FORMAT " bytes is too large.",
+		       payload->len);
+		return SR_ERR_ARG;
+	}
+
+	if (ctx->level && payload->len >= MIN_DEFLATE) {
+		zlen = compressBound(payload->len);
+		if (zlen > ctx->zbuf_size) {
+			g_free(ctx->zbuf);
+			if (!(ctx->zbuf = g_try_malloc(zlen))) {
+				sr_err("%s: zbuf malloc failed", __func__);
+				ctx->zbuf_size = 0;
+				return SR_ERR_MALLOC;
+			}
+			ctx->zbuf_size = zlen;
+		}
+		if ((ret = compress2(ctx->zbuf, &zlen,
+				(const Bytef *)payload->str, payload->len,
+				ctx->level)) != Z_OK) {
+			sr_err("Failed to deflate frame: %d.", ret);
+			return SR_ERR;
+		}
+		if (zlen + 4 < payload->len) {
+			put_le16(out, type);
+			put_le16(out, SRNET_DEFLATED);
+			put_le32(out, zlen + 4);
+			put_le32(out, payload->len);
+			g_string_append_len(out, (const char *)ctx->zbuf, zlen);
+			return SR_OK;
+		}
+	}
+
+	put_le16(out, type);
+	put_le16(out, 0);
+	put_le32(out, payload->len);
+	g_string_append_len(out, payload->str, payload->len);
+
+	return SR_OK;
+}
+
+static int batch_flush(struct context *ctx, GString *out)
+{
+	int ret;
+
+	if (!ctx->batch->len)
+		return SR_OK;
+
+	ret = frame_add(ctx, SRNET_LOGIC, ctx->batch, out);
+	g_string_truncate(ctx->batch, 0);
+
+	return ret;
+}
+
+static int logic_add(struct context *ctx,
+		const struct sr_datafeed_logic *logic, GString *out)
+{
+	const uint8_t *p;
+	uint64_t left, n, max;
+	int ret;
+
+	if (!logic->length)
+		return SR_OK;
+
+	/* A change of unitsize starts a new frame. */
+	if (ctx->batch->len && (uint8_t)ctx->batch->str[0]
+			+ ((uint8_t)ctx->batch->str[1] << 8) != logic->unitsize)
+		if ((ret = batch_flush(ctx, out)) != SR_OK)
+			return ret;
+
+	/* Whole samples only, so every frame can be sent on its own. */
+	max = SRNET_MAX_FRAME / 2;
+	max -= max % logic->unitsize;
+	p = logic->data;
+	left = logic->length;
+	while (left) {
+		if (!ctx->batch->len)
+			put_le16(ctx->batch, logic->unitsize);
+		n = MIN(left, max - (ctx->batch->len - 2));
+		g_string_append_len(ctx->batch, (const char *)p, n);
+		p += n;
+		left -= n;
+		if (ctx->batch->len - 2 >= ctx->batch_size)
+			if ((ret = batch_flush(ctx, out)) != SR_OK)
+				return ret;
+	}
+
+	return SR_OK;
+}
+
+static int device_add(struct sr_output *o, GString *out)
+{
+	struct context *ctx;
+	struct sr_probe *probe;
+	GSList *l;
+
+	ctx = o->internal;
+	g_string_truncate(ctx->payload, 0);
+	put_string(ctx->payload, o->sdi ? o->sdi->vendor : NULL);
+	put_string(ctx->payload, o->sdi ? o->sdi->model : NULL);
+	l = o->sdi ? o->sdi->probes : NULL;
+	put_le16(ctx->payload, g_slist_length(l));
+	for (; l; l = l->next) {
+		probe = l->data;
+		put_le16(ctx->payload, probe->index);
+		g_string_append_c(ctx->payload, probe->type);
+		g_string_append_c(ctx->payload, probe->enabled);
+		put_string(ctx->payload, probe->name);
+	}
+
+	return frame_add(ctx, SRNET_DEVICE, ctx->payload, out);
+}
+
+static void meta_build(GString *s, const struct sr_datafeed_meta *meta)
+{
+	const struct sr_config *src;
+	GVariant *v;
+	GSList *l;
+
+	put_le16(s, g_slist_length(meta->config));
+	for (l = meta->config; l; l = l->next) {
+		src = l->data;
+		if (G_BYTE_ORDER == G_BIG_ENDIAN)
+			v = g_variant_byteswap(src->data);
+		else
+			v = g_variant_ref(src->data);
+		put_le32(s, src->key);
+		put_string(s, g_variant_get_type_string(v));
+		put_le32(s, g_variant_get_size(v));
+		g_string_append_len(s, g_variant_get_data(v),
+				g_variant_get_size(v));
+		g_variant_unref(v);
+	}
+}
+
+static void analog_build(GString *s, const struct sr_datafeed_analog *analog)
+{
+	const struct sr_probe *probe;
+	GSList *l;
+	uint32_t bits;
+	int i, n;
+
+	n = g_slist_length(analog->probes);
+	put_le16(s, n);
+	for (l = analog->probes; l; l = l->next) {
+		probe = l->data;
+		put_le16(s, probe->index);
+	}
+	put_le32(s, analog->num_samples);
+	put_le32(s, analog->mq);
+	put_le32(s, analog->unit);
+	put_le64(s, analog->mqflags);
+	for (i = 0; i < analog->num_samples * n; i++) {
+		memcpy(&bits, &analog->data[i], sizeof(bits));
+		put_le32(s, bits);
+	}
+}
+
+static int receive(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, GString *out)
+{
+	struct context *ctx;
+	const struct sr_datafeed_header *header;
+	int type, ret;
+
+	(void)sdi;
+
+	ctx = o->internal;
+
+	if (packet->type == SR_DF_LOGIC)
+		return logic_add(ctx, packet->payload, out);
+
+	if ((ret = batch_flush(ctx, out)) != SR_OK)
+		return ret;
+
+	g_string_truncate(ctx->payload, 0);
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		if (!ctx->started) {
+			g_string_append_len(out, SRNET_MAGIC, SRNET_MAGIC_LEN);
+			ctx->started = TRUE;
+		}
+		if ((ret = device_add(o, out)) != SR_OK)
+			return ret;
+		header = packet->payload;
+		g_string_truncate(ctx->payload, 0);
+		put_le32(ctx->payload, header->feed_version);
+		put_le64(ctx->payload, header->starttime.tv_sec);
+		put_le64(ctx->payload, header->starttime.tv_usec);
+		type = SRNET_HEADER;
+		break;
+	case SR_DF_END:
+		type = SRNET_END;
+		break;
+	case SR_DF_META:
+		meta_build(ctx->payload, packet->payload);
+		type = SRNET_META;
+		break;
+	case SR_DF_TRIGGER:
+		type = SRNET_TRIGGER;
+		break;
+	case SR_DF_ANALOG:
+		analog_build(ctx->payload, packet->payload);
+		type = SRNET_ANALOG;
+		break;
+	case SR_DF_FRAME_BEGIN:
+		type = SRNET_FRAME_BEGIN;
+		break;
+	case SR_DF_FRAME_END:
+		type = SRNET_FRAME_END;
+		break;
+	default:
+		sr_dbg("Not sending packet type %d.", packet->type);
+		return SR_OK;
+	}
+
+	/* Nothing must arrive before the magic and device frame. */
+	if (!ctx->started)
+		return SR_OK;
+
+	return frame_add(ctx, type, ctx->payload, out);
+}
+
+static int cleanup(struct sr_output *o)
+{
+	struct context *ctx;
+
+	if (!o || !(ctx = o->internal))
+		return SR_OK;
+
+	g_string_free(ctx->batch, TRUE);
+	g_string_free(ctx->payload, TRUE);
+	g_free(ctx->zbuf);
+	g_free(ctx);
+	o->internal = NULL;
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_output_format output_srnet = {
+	.id = "srnet",
+	.description = "sigrok network stream",
+	.df_type = SR_DF_LOGIC,
+	.init = init,
+	.receive = receive,
+	.cleanup = cleanup,
+};
@@ -28,102 +28,67 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "output/ascii: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 SR_PRIV int init_ascii(struct sr_output *o)
 {
 	return init(o, DEFAULT_BPL_ASCII, MODE_ASCII);
 }
 
-SR_PRIV int data_ascii(struct sr_output *o, const uint8_t *data_in,
-		       uint64_t length_in, uint8_t **data_out,
-		       uint64_t *length_out)
+SR_PRIV void data_ascii(struct context *ctx, const uint8_t *data_in,
+		uint64_t length_in, GString *out)
 {
-	struct context *ctx;
-	unsigned int outsize, offset, p;
-	int max_linelen;
+	unsigned int offset, p;
 	const uint8_t *sample;
-	uint8_t *outbuf;
 
-	ctx = o->internal;
-	max_linelen = SR_MAX_PROBENAME_LEN + 3 + ctx->samples_per_line
-			+ ctx->samples_per_line / 8;
-        /*
-         * Calculate space needed for probes. Set aside 512 bytes for
-         * extra output, e.g. trigger.
-         */
-	outsize = 512 + (1 + (length_in / ctx->unitsize) / ctx->samples_per_line)
-            * (ctx->num_enabled_probes * max_linelen);
+	for (offset = 0; offset + ctx->unitsize <= length_in;
+	     offset += ctx->unitsize) {
+		sample = data_in + offset;
 
-	if (!(outbuf = g_try_malloc0(outsize + 1))) {
-		sr_err("%s: outbuf malloc failed", __func__);
-		return SR_ERR_MALLOC;
-	}
-
-	outbuf[0] = '\0';
-	if (ctx->header) {
-		/* The header is still here, this must be the first packet. */
-		strncpy((char *)outbuf, ctx->header, outsize);
-		g_free(ctx->header);
-		ctx->header = NULL;
-	}
-
-	if (length_in >= ctx->unitsize) {
-		for (offset = 0; offset <= length_in - ctx->unitsize;
-		     offset += ctx->unitsize) {
-			sample = data_in + offset;
-
-			char tmpval[ctx->num_enabled_probes];
-
-			for (p = 0; p < ctx->num_enabled_probes; p++) {
-				uint8_t curbit = (sample[p / 8] & ((uint8_t) 1 << (p % 8)));
-				uint8_t prevbit = (ctx->prevsample[p / 8] &
-						((uint8_t) 1 << (p % 8)));
-
-				if (curbit < prevbit && ctx->line_offset > 0) {
-					ctx->linebuf[p * ctx->linebuf_len +
-						ctx->line_offset-1] = '\\';
-				}
+		char tmpval[ctx->num_enabled_probes];
 
-				if (curbit > prevbit) {
-					tmpval[p] = '/';
-				} else {
-					if (curbit)
-						tmpval[p] = '"';
-					else
-						tmpval[p] = '.';
-				}
-			}
+		for (p = 0; p < ctx->num_enabled_probes; p++) {
+			uint8_t curbit = (sample[p / 8] &
+					((uint8_t) 1 << (p % 8)));
+			uint8_t prevbit = (ctx->prevsample[p / 8] &
+					((uint8_t) 1 << (p % 8)));
 
-			/* End of line. */
-			if (ctx->spl_cnt >= ctx->samples_per_line) {
-				flush_linebufs(ctx, outbuf);
-				ctx->line_offset = ctx->spl_cnt = 0;
-				ctx->mark_trigger = -1;
+			if (curbit < prevbit && ctx->line_offset > 0) {
+				ctx->linebuf[p * ctx->linebuf_len +
+					ctx->line_offset-1] = '\\';
 			}
 
-			for (p = 0; p < ctx->num_enabled_probes; p++) {
-				ctx->linebuf[p * ctx->linebuf_len +
-					     ctx->line_offset] = tmpval[p];
+			if (curbit > prevbit) {
+				tmpval[p] = '/';
+			} else {
+				if (curbit)
+					tmpval[p] = '"';
+				else
+					tmpval[p] = '.';
 			}
+		}
 
-			ctx->line_offset++;
-			ctx->spl_cnt++;
+		/* End of line. */
+		if (ctx->spl_cnt >= ctx->samples_per_line) {
+			flush_linebufs(ctx, out);
+			ctx->line_offset = ctx->spl_cnt = 0;
+			ctx->mark_trigger = -1;
+		}
 
-			memcpy(ctx->prevsample, sample, ctx->unitsize);
+		for (p = 0; p < ctx->num_enabled_probes; p++) {
+			ctx->linebuf[p * ctx->linebuf_len +
+				     ctx->line_offset] = tmpval[p];
 		}
-	} else {
-		sr_info("Short buffer (length_in=%" PRIu64 ").", length_in);
-	}
 
-	*data_out = outbuf;
-	*length_out = strlen((const char *)outbuf);
+		ctx->line_offset++;
+		ctx->spl_cnt++;
 
-	return SR_OK;
+		memcpy(ctx->prevsample, sample, ctx->unitsize);
+	}
 }
 
 SR_PRIV struct sr_output_format output_text_ascii = {
@@ -131,7 +96,6 @@ SR_PRIV struct sr_output_format output_text_ascii = {
 	.description = "ASCII",
 	.df_type = SR_DF_LOGIC,
 	.init = init_ascii,
-	.data = data_ascii,
-	.event = event,
+	.receive = text_receive,
 	.cleanup = text_cleanup,
 };
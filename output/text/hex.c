@@ -28,56 +28,36 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "output/hex: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+static const char hexdigits[] = "0123456789abcdef";
 
 SR_PRIV int init_hex(struct sr_output *o)
 {
 	return init(o, DEFAULT_BPL_HEX, MODE_HEX);
 }
 
-SR_PRIV int data_hex(struct sr_output *o, const uint8_t *data_in,
-		     uint64_t length_in, uint8_t **data_out,
-		     uint64_t *length_out)
+SR_PRIV void data_hex(struct context *ctx, const uint8_t *data_in,
+		uint64_t length_in, GString *out)
 {
-	struct context *ctx;
-	unsigned int outsize, offset, p;
-	int max_linelen;
+	unsigned int offset, p;
 	const uint8_t *sample;
-	uint8_t *outbuf;
-
-	ctx = o->internal;
-	max_linelen = SR_MAX_PROBENAME_LEN + 3 + ctx->samples_per_line
-			+ ctx->samples_per_line / 2;
-	outsize = length_in / ctx->unitsize * ctx->num_enabled_probes
-			/ ctx->samples_per_line * max_linelen + 512;
-
-	if (!(outbuf = g_try_malloc0(outsize + 1))) {
-		sr_err("%s: outbuf malloc failed", __func__);
-		return SR_ERR_MALLOC;
-	}
+	uint8_t *line, v;
 
-	outbuf[0] = '\0';
-	if (ctx->header) {
-		/* The header is still here, this must be the first packet. */
-		strncpy((char *)outbuf, ctx->header, outsize);
-		g_free(ctx->header);
-		ctx->header = NULL;
-	}
-
-	ctx->line_offset = 0;
-	for (offset = 0; offset <= length_in - ctx->unitsize;
+	for (offset = 0; offset + ctx->unitsize <= length_in;
 	     offset += ctx->unitsize) {
 		sample = data_in + offset;
+		line = ctx->linebuf + ctx->line_offset;
 		for (p = 0; p < ctx->num_enabled_probes; p++) {
-			ctx->linevalues[p] <<= 1;
-			if (sample[p / 8] & ((uint8_t) 1 << (p % 8)))
-				ctx->linevalues[p] |= 1;
-			sprintf((char *)ctx->linebuf + (p * ctx->linebuf_len) +
-				ctx->line_offset, "%.2x", ctx->linevalues[p]);
+			v = ctx->linevalues[p] << 1;
+			v |= (sample[p / 8] >> (p % 8)) & 1;
+			ctx->linevalues[p] = v;
+			line[p * ctx->linebuf_len] = hexdigits[v >> 4];
+			line[p * ctx->linebuf_len + 1] = hexdigits[v & 0xf];
 		}
 		ctx->spl_cnt++;
 
@@ -91,15 +71,10 @@ SR_PRIV int data_hex(struct sr_output *o, const uint8_t *data_in,
 
 		/* End of line. */
 		if (ctx->spl_cnt >= ctx->samples_per_line) {
-			flush_linebufs(ctx, outbuf);
+			flush_linebufs(ctx, out);
 			ctx->line_offset = ctx->spl_cnt = 0;
 		}
 	}
-
-	*data_out = outbuf;
-	*length_out = strlen((const char *)outbuf);
-
-	return SR_OK;
 }
 
 SR_PRIV struct sr_output_format output_text_hex = {
@@ -107,7 +82,6 @@ SR_PRIV struct sr_output_format output_text_hex = {
 	.description = "Hexadecimal",
 	.df_type = SR_DF_LOGIC,
 	.init = init_hex,
-	.data = data_hex,
-	.event = event,
+	.receive = text_receive,
 	.cleanup = text_cleanup,
 };
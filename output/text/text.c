@@ -30,82 +30,82 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "output/text: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
-SR_PRIV void flush_linebufs(struct context *ctx, uint8_t *outbuf)
+SR_PRIV void flush_linebufs(struct context *ctx, GString *out)
 {
-	static int max_probename_len = 0;
-	int len, i;
-	GSList *l;
-	char *probe_name;
+	int i, space_offset;
 
 	if (ctx->linebuf[0] == 0)
 		return;
 
-	if (max_probename_len == 0) {
-		/* First time through... */
-		for (l = ctx->probenames; l; l = l->next) {
-			probe_name = l->data;
-			len = strlen(probe_name);
-			if (len > max_probename_len)
-				max_probename_len = len;
-		}
-	}
-
-	for (i = 0, l = ctx->probenames; l; l = l->next, i++) {
-		probe_name = l->data;
-		sprintf((char *)outbuf + strlen((const char *)outbuf),
-			"%*s:%s\n", max_probename_len,
-			probe_name, ctx->linebuf + i * ctx->linebuf_len);
+	for (i = 0; ctx->line_prefixes[i]; i++) {
+		g_string_append(out, ctx->line_prefixes[i]);
+		g_string_append(out, (const char *)ctx->linebuf
+				+ i * ctx->linebuf_len);
+		g_string_append_c(out, '\n');
 	}
 
 	/* Mark trigger with a ^ character. */
-	if (ctx->mark_trigger != -1)
-	{
-		int space_offset = ctx->mark_trigger / 8;
+	if (ctx->mark_trigger != -1) {
+		space_offset = ctx->mark_trigger / 8;
 
 		if (ctx->mode == MODE_ASCII)
 			space_offset = 0;
 
-		sprintf((char *)outbuf + strlen((const char *)outbuf),
-			"T:%*s^\n", ctx->mark_trigger + space_offset, "");
+		g_string_append(out, "T:");
+		for (i = 0; i < ctx->mark_trigger + space_offset; i++)
+			g_string_append_c(out, ' ');
+		g_string_append(out, "^\n");
 	}
 
-	memset(ctx->linebuf, 0, i * ctx->linebuf_len);
+	memset(ctx->linebuf, 0, ctx->num_enabled_probes * ctx->linebuf_len);
 }
 
 SR_PRIV int init(struct sr_output *o, int default_spl, enum outputmode mode)
 {
 	struct context *ctx;
+	const struct sr_probe_table *table;
 	struct sr_probe *probe;
-	GSList *l;
 	GVariant *gvar;
 	uint64_t samplerate;
-	int num_probes, ret;
+	int num_probes, ret, len, max_len, i;
 	char *samplerate_s;
 
+	if (!(table = sr_dev_probe_table_get(o->sdi)))
+		return SR_ERR_MALLOC;
+
 	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
 		sr_err("%s: ctx malloc failed", __func__);
 		return SR_ERR_MALLOC;
 	}
 
 	o->internal = ctx;
-	ctx->num_enabled_probes = 0;
-	ctx->probenames = NULL;
-
-	for (l = o->sdi->probes; l; l = l->next) {
-		probe = l->data;
-		if (!probe->enabled)
-			continue;
-		ctx->probenames = g_slist_append(ctx->probenames, probe->name);
-		ctx->num_enabled_probes++;
+	ctx->num_enabled_probes = table->num_enabled;
+	ctx->unitsize = (ctx->num_enabled_probes + 7) / 8;
+
+	max_len = 0;
+	for (i = 0; i < table->num_enabled; i++) {
+		len = strlen(table->probes[table->enabled[i]]->name);
+		if (len > max_len)
+			max_len = len;
+	}
+	if (!(ctx->line_prefixes = g_try_new0(char *,
+			ctx->num_enabled_probes + 1))) {
+		sr_err("%s: ctx->line_prefixes malloc failed", __func__);
+		g_free(ctx);
+		return SR_ERR_MALLOC;
+	}
+	for (i = 0; i < table->num_enabled; i++) {
+		probe = table->probes[table->enabled[i]];
+		ctx->line_prefixes[i] = g_strdup_printf("%*s:", max_len,
+				probe->name);
 	}
 
-	ctx->unitsize = (ctx->num_enabled_probes + 7) / 8;
 	ctx->line_offset = 0;
 	ctx->spl_cnt = 0;
 	ctx->mark_trigger = -1;
@@ -157,7 +157,7 @@ SR_PRIV int init(struct sr_output *o, int default_spl, enum outputmode mode)
 	}
 
 	if (mode == MODE_ASCII &&
-			!(ctx->prevsample = g_try_malloc0(num_probes / 8))) {
+			!(ctx->prevsample = g_try_malloc0(ctx->unitsize))) {
 		sr_err("%s: ctx->prevsample malloc failed", __func__);
 		ret = SR_ERR_MALLOC;
 	}
@@ -165,7 +165,11 @@ SR_PRIV int init(struct sr_output *o, int default_spl, enum outputmode mode)
 err:
 	if (ret != SR_OK) {
 		g_free(ctx->header);
+		g_free(ctx->linebuf);
+		g_free(ctx->linevalues);
+		g_strfreev(ctx->line_prefixes);
 		g_free(ctx);
+		o->internal = NULL;
 	}
 
 	return ret;
@@ -187,7 +191,7 @@ SR_PRIV int text_cleanup(struct sr_output *o)
 	if (ctx->prevsample)
 		g_free(ctx->prevsample);
 
-	g_slist_free(ctx->probenames);
+	g_strfreev(ctx->line_prefixes);
 
 	g_free(ctx);
 
@@ -196,34 +200,44 @@ SR_PRIV int text_cleanup(struct sr_output *o)
 	return SR_OK;
 }
 
-SR_PRIV int event(struct sr_output *o, int event_type, uint8_t **data_out,
-		  uint64_t *length_out)
+SR_PRIV int text_receive(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, GString *out)
 {
 	struct context *ctx;
-	int outsize;
-	uint8_t *outbuf;
+	const struct sr_datafeed_logic *logic;
+
+	(void)sdi;
 
+	if (!o || !o->internal)
+		return SR_ERR_ARG;
 	ctx = o->internal;
-	switch (event_type) {
+
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		if (ctx->header) {
+			/* First data packet. */
+			g_string_append(out, ctx->header);
+			g_free(ctx->header);
+			ctx->header = NULL;
+		}
+		logic = packet->payload;
+		if (logic->length < ctx->unitsize) {
+			sr_info("Short buffer (length_in=%" PRIu64 ").",
+				logic->length);
+			break;
+		}
+		if (ctx->mode == MODE_BITS)
+			data_bits(ctx, logic->data, logic->length, out);
+		else if (ctx->mode == MODE_HEX)
+			data_hex(ctx, logic->data, logic->length, out);
+		else
+			data_ascii(ctx, logic->data, logic->length, out);
+		break;
 	case SR_DF_TRIGGER:
 		ctx->mark_trigger = ctx->spl_cnt;
-		*data_out = NULL;
-		*length_out = 0;
 		break;
 	case SR_DF_END:
-		outsize = ctx->num_enabled_probes
-				* (ctx->samples_per_line + 20) + 512;
-		if (!(outbuf = g_try_malloc0(outsize))) {
-			sr_err("%s: outbuf malloc failed", __func__);
-			return SR_ERR_MALLOC;
-		}
-		flush_linebufs(ctx, outbuf);
-		*data_out = outbuf;
-		*length_out = strlen((const char *)outbuf);
-		break;
-	default:
-		*data_out = NULL;
-		*length_out = 0;
+		flush_linebufs(ctx, out);
 		break;
 	}
 
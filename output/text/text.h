@@ -36,7 +36,6 @@ struct context {
 	unsigned int unitsize;
 	int line_offset;
 	int linebuf_len;
-	GSList *probenames;
 	uint8_t *linebuf;
 	int spl_cnt;
 	uint8_t *linevalues;
@@ -44,27 +43,26 @@ struct context {
 	int mark_trigger;
 	uint8_t *prevsample;
 	enum outputmode mode;
+	/* "name:" for each line, the names right-aligned. */
+	char **line_prefixes;
 };
 
-SR_PRIV void flush_linebufs(struct context *ctx, uint8_t *outbuf);
+SR_PRIV void flush_linebufs(struct context *ctx, GString *out);
 SR_PRIV int init(struct sr_output *o, int default_spl, enum outputmode mode);
+SR_PRIV int text_receive(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, GString *out);
 SR_PRIV int text_cleanup(struct sr_output *o);
-SR_PRIV int event(struct sr_output *o, int event_type, uint8_t **data_out,
-		  uint64_t *length_out);
 
 SR_PRIV int init_bits(struct sr_output *o);
-SR_PRIV int data_bits(struct sr_output *o, const uint8_t *data_in,
-		      uint64_t length_in, uint8_t **data_out,
-		      uint64_t *length_out);
+SR_PRIV void data_bits(struct context *ctx, const uint8_t *data_in,
+		uint64_t length_in, GString *out);
 
 SR_PRIV int init_hex(struct sr_output *o);
-SR_PRIV int data_hex(struct sr_output *o, const uint8_t *data_in,
-		     uint64_t length_in, uint8_t **data_out,
-		     uint64_t *length_out);
+SR_PRIV void data_hex(struct context *ctx, const uint8_t *data_in,
+		uint64_t length_in, GString *out);
 
 SR_PRIV int init_ascii(struct sr_output *o);
-SR_PRIV int data_ascii(struct sr_output *o, const uint8_t *data_in,
-		       uint64_t length_in, uint8_t **data_out,
-		       uint64_t *length_out);
+SR_PRIV void data_ascii(struct context *ctx, const uint8_t *data_in,
+		uint64_t length_in, GString *out);
 
 #endif
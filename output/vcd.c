@@ -19,6 +19,18 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+/*
+ * Options, as a comma-separated list:
+ *   bus=<name>:<first>-<last>  Write the enabled probes with indices from
+ *                              first to last as one vector variable, the
+ *                              lowest one its least significant bit.
+ *                              Only written when any of them changes.
+ *                              May be given more than once.
+ *
+ * Identifiers are one or more printable characters, so any number of
+ * probes fits.
+ */
+
 #include <stdlib.h>
 #include <string.h>
 #include <glib.h>
@@ -29,33 +41,168 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "output/vcd: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/* Room for an identifier: its length, then up to 7 characters. */
+#define ID_SIZE 8
+
+/* Identifier characters go from '!' to '~'. */
+#define ID_FIRST '!'
+#define ID_CHARS 94
+
+/* A group of probes written as one vector variable. */
+struct bus {
+	char *name;
+	/* The bits of its enabled probes, least significant first. */
+	int *bits;
+	int num_bits;
+	char id[ID_SIZE];
+};
 
 struct context {
 	int num_enabled_probes;
-	GArray *probeindices;
 	GString *header;
-	uint8_t *prevsample;
-	int period;
+	uint64_t period;
 	uint64_t samplerate;
-	unsigned int unitsize;
+	/* Number of the next sample to come, in SR_DF_LOGIC_EDGES data. */
+	uint64_t samplecount;
+	/* The samples are looked at in 64-bit words, this many of them. */
+	unsigned int num_words;
+	/* The bits of the enabled probes, per word. */
+	uint64_t *masks;
+	/* Those written one by one, and those of buses, per word. */
+	uint64_t *scalars;
+	uint64_t *bus_masks;
+	struct bus *buses;
+	int num_buses;
+	/* The last edge, per word; only valid once samplecount > 0. */
+	uint64_t *prevsample;
+	/* Which bus bits changed, per word, for receive(). */
+	uint64_t *diffs;
+	/* The identifier of each bit of a sample, ID_SIZE bytes each. */
+	char *ids;
 };
 
 static const char *vcd_header_comment = "\
 $comment\n  Acquisition with %d/%d probes at %s\n$end\n";
 
+static int cleanup(struct sr_output *o)
+{
+	struct context *ctx;
+	int i;
+
+	if (!o || !o->internal)
+		return SR_ERR_ARG;
+
+	ctx = o->internal;
+	if (ctx->header)
+		g_string_free(ctx->header, TRUE);
+	for (i = 0; i < ctx->num_buses; i++) {
+		g_free(ctx->buses[i].name);
+		g_free(ctx->buses[i].bits);
+	}
+	g_free(ctx->buses);
+	g_free(ctx->masks);
+	g_free(ctx->scalars);
+	g_free(ctx->bus_masks);
+	g_free(ctx->prevsample);
+	g_free(ctx->diffs);
+	g_free(ctx->ids);
+	g_free(ctx);
+	o->internal = NULL;
+
+	return SR_OK;
+}
+
+/*
+ * Make the n-th identifier: "!" to "~", then "!!", "!\"" and so on,
+ * counting in base 94 with the lowest digit first.
+ */
+static void id_make(char *id, int n)
+{
+	int len;
+
+	len = 0;
+	do {
+		id[1 + len++] = ID_FIRST + n % ID_CHARS;
+		n = n / ID_CHARS - 1;
+	} while (n >= 0 && len < ID_SIZE - 1);
+	id[0] = len;
+}
+
+/* Parse a "bus" option's value, <name>:<first>-<last>. */
+static int bus_parse(struct context *ctx, const struct sr_probe_table *table,
+		const char *val)
+{
+	struct bus *bus, *buses;
+	const char *colon;
+	char *end;
+	unsigned long first, last;
+	int i, bit;
+
+	first = last = 0;
+	if ((colon = strchr(val, ':')) && colon > val) {
+		first = strtoul(colon + 1, &end, 10);
+		if (end == colon + 1 || *end != '-')
+			colon = NULL;
+		else if ((last = strtoul(end + 1, &end, 10)), *end
+				|| last < first)
+			colon = NULL;
+	}
+	if (!colon) {
+		sr_err("Invalid bus '%s'.", val);
+		return SR_ERR_ARG;
+	}
+
+	if (!(buses = g_try_realloc(ctx->buses, (ctx->num_buses + 1)
+			* sizeof(struct bus)))) {
+		sr_err("%s: buses malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	ctx->buses = buses;
+	bus = &ctx->buses[ctx->num_buses];
+	memset(bus, 0, sizeof(*bus));
+	bus->name = g_strndup(val, colon - val);
+	ctx->num_buses++;
+	if (!(bus->bits = g_try_new(int, table->num_enabled))) {
+		sr_err("%s: bits malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	for (i = 0; i < table->num_enabled; i++) {
+		bit = table->enabled[i];
+		if ((unsigned long)bit < first || (unsigned long)bit > last)
+			continue;
+		if (ctx->bus_masks[bit / 64] & (1ULL << (bit % 64))) {
+			sr_err("Probe %d is in more than one bus.", bit);
+			return SR_ERR_ARG;
+		}
+		ctx->bus_masks[bit / 64] |= 1ULL << (bit % 64);
+		bus->bits[bus->num_bits++] = bit;
+	}
+	if (!bus->num_bits) {
+		sr_err("Bus '%s' has no enabled probes.", bus->name);
+		return SR_ERR_ARG;
+	}
+
+	return SR_OK;
+}
+
 static int init(struct sr_output *o)
 {
 	struct context *ctx;
+	const struct sr_probe_table *table;
 	struct sr_probe *probe;
-	GSList *l;
+	struct bus *bus;
 	GVariant *gvar;
-	int num_probes, i;
+	int num_probes, num_ids, ret, i, j;
+	char **opts, *val;
 	char *samplerate_s, *frequency_s, *timestamp;
+	const char *id;
 	time_t t;
 
 	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
@@ -64,25 +211,60 @@ static int init(struct sr_output *o)
 	}
 
 	o->internal = ctx;
-	ctx->num_enabled_probes = 0;
-	ctx->probeindices = g_array_new(FALSE, FALSE, sizeof(int));
+	if (!(table = sr_dev_probe_table_get(o->sdi))) {
+		cleanup(o);
+		return SR_ERR_MALLOC;
+	}
+	ctx->num_enabled_probes = table->num_enabled;
+	num_probes = table->num_probes;
+
+	ctx->num_words = table->num_words;
+	ctx->masks = g_try_malloc0(ctx->num_words * sizeof(uint64_t));
+	ctx->scalars = g_try_malloc0(ctx->num_words * sizeof(uint64_t));
+	ctx->bus_masks = g_try_malloc0(ctx->num_words * sizeof(uint64_t));
+	ctx->prevsample = g_try_malloc0(ctx->num_words * sizeof(uint64_t));
+	ctx->diffs = g_try_malloc0(ctx->num_words * sizeof(uint64_t));
+	ctx->ids = g_try_malloc0(ctx->num_words * 64 * ID_SIZE);
+	if (!ctx->masks || !ctx->scalars || !ctx->bus_masks
+	    || !ctx->prevsample || !ctx->diffs || !ctx->ids) {
+		sr_err("%s: ctx malloc failed", __func__);
+		cleanup(o);
+		return SR_ERR_MALLOC;
+	}
 
-	for (l = o->sdi->probes; l; l = l->next) {
-		probe = l->data;
-		if (!probe->enabled)
+	ret = SR_OK;
+	opts = g_strsplit(o->param ? o->param : "", ",", 0);
+	for (i = 0; opts[i] && ret == SR_OK; i++) {
+		if (!opts[i][0])
 			continue;
-		ctx->probeindices = g_array_append_val(
-				ctx->probeindices, probe->index);
-		ctx->num_enabled_probes++;
+		if ((val = strchr(opts[i], '=')))
+			*val++ = '\0';
+		if (val && !strcmp(opts[i], "bus"))
+			ret = bus_parse(ctx, table, val);
+		else
+			sr_warn("Ignoring unknown option '%s'.", opts[i]);
 	}
-	if (ctx->num_enabled_probes > 94) {
-		sr_err("VCD only supports 94 probes.");
-		return SR_ERR;
+	g_strfreev(opts);
+	if (ret != SR_OK) {
+		cleanup(o);
+		return ret;
+	}
+
+	/* Identifiers go by the order of the enabled probes, then buses. */
+	memcpy(ctx->masks, table->enabled_mask,
+			ctx->num_words * sizeof(uint64_t));
+	for (i = 0; i < (int)ctx->num_words; i++)
+		ctx->scalars[i] = ctx->masks[i] & ~ctx->bus_masks[i];
+	num_ids = 0;
+	for (i = 0; i < table->num_enabled; i++) {
+		j = table->enabled[i];
+		if (ctx->scalars[j / 64] & (1ULL << (j % 64)))
+			id_make(ctx->ids + j * ID_SIZE, num_ids++);
 	}
+	for (i = 0; i < ctx->num_buses; i++)
+		id_make(ctx->buses[i].id, num_ids++);
 
-	ctx->unitsize = (ctx->num_enabled_probes + 7) / 8;
 	ctx->header = g_string_sized_new(512);
-	num_probes = g_slist_length(o->sdi->probes);
 
 	/* timestamp */
 	t = time(NULL);
@@ -100,8 +282,7 @@ static int init(struct sr_output *o)
 		ctx->samplerate = g_variant_get_uint64(gvar);
 		g_variant_unref(gvar);
 		if (!((samplerate_s = sr_samplerate_string(ctx->samplerate)))) {
-			g_string_free(ctx->header, TRUE);
-			g_free(ctx);
+			cleanup(o);
 			return SR_ERR;
 		}
 		g_string_append_printf(ctx->header, vcd_header_comment,
@@ -118,8 +299,7 @@ static int init(struct sr_output *o)
 	else
 		ctx->period = SR_KHZ(1);
 	if (!(frequency_s = sr_period_string(ctx->period))) {
-		g_string_free(ctx->header, TRUE);
-		g_free(ctx);
+		cleanup(o);
 		return SR_ERR;
 	}
 	g_string_append_printf(ctx->header, "$timescale %s $end\n", frequency_s);
@@ -129,94 +309,286 @@ static int init(struct sr_output *o)
 	g_string_append_printf(ctx->header, "$scope module %s $end\n", PACKAGE);
 
 	/* Wires / channels */
-	for (i = 0, l = o->sdi->probes; l; l = l->next, i++) {
-		probe = l->data;
-		if (!probe->enabled)
+	for (i = 0; i < table->num_enabled; i++) {
+		probe = table->probes[table->enabled[i]];
+		j = probe->index;
+		if (!(ctx->scalars[j / 64] & (1ULL << (j % 64))))
 			continue;
-		g_string_append_printf(ctx->header, "$var wire 1 %c %s $end\n",
-				(char)('!' + i), probe->name);
+		id = ctx->ids + j * ID_SIZE;
+		g_string_append_printf(ctx->header,
+				"$var wire 1 %.*s %s $end\n",
+				id[0], id + 1, probe->name);
+	}
+	for (i = 0; i < ctx->num_buses; i++) {
+		bus = &ctx->buses[i];
+		g_string_append_printf(ctx->header,
+				"$var wire %d %.*s %s [%d:0] $end\n",
+				bus->num_bits, bus->id[0], bus->id + 1,
+				bus->name, bus->num_bits - 1);
 	}
 
 	g_string_append(ctx->header, "$upscope $end\n"
 			"$enddefinitions $end\n$dumpvars\n");
 
-	if (!(ctx->prevsample = g_try_malloc0(ctx->unitsize))) {
-		g_string_free(ctx->header, TRUE);
-		g_free(ctx);
-		sr_err("%s: ctx->prevsample malloc failed", __func__);
-		return SR_ERR_MALLOC;
+	return SR_OK;
+}
+
+/* The VCD time of a sample, in units of the period. */
+static uint64_t sample_time(const struct context *ctx, uint64_t sample)
+{
+	if (!ctx->samplerate)
+		return sample;
+
+	/* Split up, so this doesn't overflow on long captures. */
+	return sample / ctx->samplerate * ctx->period
+			+ sample % ctx->samplerate * ctx->period / ctx->samplerate;
+}
+
+static void append_uint64(GString *out, uint64_t value)
+{
+	char buf[20];
+	int i;
+
+	i = sizeof(buf);
+	do {
+		buf[--i] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	g_string_append_len(out, buf + i, sizeof(buf) - i);
+}
+
+/* Output the timestamp of a sample, before its first change. */
+static inline void append_timestamp(const struct context *ctx,
+		GString *out, uint64_t samplenum, gboolean *timestamped)
+{
+	if (*timestamped)
+		return;
+
+	g_string_append_c(out, '#');
+	append_uint64(out, sample_time(ctx, samplenum));
+	g_string_append_c(out, '\n');
+	*timestamped = TRUE;
+}
+
+/* Output which signals of word w changed (set in diff) to which value. */
+static inline void append_word_changes(const struct context *ctx,
+		GString *out, unsigned int w, uint64_t cur, uint64_t diff,
+		uint64_t samplenum, gboolean *timestamped)
+{
+	const char *id;
+	unsigned int bit;
+	char change[ID_SIZE + 1];
+
+	append_timestamp(ctx, out, samplenum, timestamped);
+
+	for (; diff; diff &= diff - 1) {
+		bit = __builtin_ctzll(diff);
+		id = ctx->ids + (w * 64 + bit) * ID_SIZE;
+		change[0] = (cur >> bit) & 1 ? '1' : '0';
+		memcpy(change + 1, id + 1, ID_SIZE - 1);
+		change[1 + id[0]] = '\n';
+		g_string_append_len(out, change, 2 + id[0]);
 	}
+}
 
-	return SR_OK;
+/*
+ * Output the buses with any bits set in diffs (a word per word of the
+ * sample), as binary numbers without leading zeroes.
+ */
+static void append_bus_changes(const struct context *ctx, GString *out,
+		const uint8_t *sample, const uint64_t *diffs,
+		uint64_t samplenum, gboolean *timestamped)
+{
+	const struct bus *bus;
+	int i, k, bit;
+	gboolean changed, digits;
+
+	for (i = 0; i < ctx->num_buses; i++) {
+		bus = &ctx->buses[i];
+		changed = FALSE;
+		for (k = 0; k < bus->num_bits && !changed; k++) {
+			bit = bus->bits[k];
+			changed = (diffs[bit / 64] >> (bit % 64)) & 1;
+		}
+		if (!changed)
+			continue;
+
+		append_timestamp(ctx, out, samplenum, timestamped);
+		g_string_append_c(out, 'b');
+		digits = FALSE;
+		for (k = bus->num_bits - 1; k >= 0; k--) {
+			bit = bus->bits[k];
+			if ((sample[bit / 8] >> (bit % 8)) & 1) {
+				g_string_append_c(out, '1');
+				digits = TRUE;
+			} else if (digits || k == 0) {
+				g_string_append_c(out, '0');
+			}
+		}
+		g_string_append_c(out, ' ');
+		g_string_append_len(out, bus->id + 1, bus->id[0]);
+		g_string_append_c(out, '\n');
+	}
+}
+
+/*
+ * Output the signals which changed since the previous sample, which is
+ * kept in prev, word by word. Changes are found a word at a time, so
+ * samples where nothing changes cost next to nothing. The first sample
+ * outputs all signals. The changes of bus bits are collected in diffs.
+ */
+static void append_changes(const struct context *ctx, GString *out,
+		const uint8_t *sample, unsigned int unitsize, uint64_t samplenum,
+		uint64_t *prev, uint64_t *diffs, gboolean first)
+{
+	uint64_t cur, diff, buses;
+	unsigned int w;
+	gboolean timestamped;
+
+	timestamped = FALSE;
+	buses = 0;
+	for (w = 0; w < ctx->num_words; w++) {
+		cur = sr_sample_word_get(sample, unitsize, w);
+		diff = ctx->masks[w];
+		if (!first)
+			diff &= cur ^ prev[w];
+		prev[w] = cur;
+		diffs[w] = diff & ctx->bus_masks[w];
+		buses |= diffs[w];
+		if (diff & ctx->scalars[w])
+			append_word_changes(ctx, out, w, cur,
+					diff & ctx->scalars[w], samplenum,
+					&timestamped);
+	}
+	if (buses)
+		append_bus_changes(ctx, out, sample, diffs, samplenum,
+				&timestamped);
+}
+
+/*
+ * The same for a chunk of samples with up to 64 probes, the common case.
+ * Instantiated by unit size, so that loading a sample is a single move.
+ */
+static inline void append_chunk_narrow(const unsigned int unitsize,
+		const struct context *ctx, GString *out,
+		const struct sr_output_chunk *chunk, uint64_t *prev)
+{
+	const uint8_t *sample;
+	uint64_t cur, last, diff, buses, i;
+	gboolean timestamped;
+
+	sample = chunk->data;
+	last = chunk->prev_sample ? *prev : 0;
+	for (i = 0; i < chunk->num_samples; i++, sample += unitsize) {
+		cur = sr_sample_load(sample, unitsize);
+		diff = ctx->masks[0];
+		if (chunk->prev_sample || i > 0)
+			diff &= cur ^ last;
+		last = cur;
+		if (!diff)
+			continue;
+		timestamped = FALSE;
+		if (diff & ctx->scalars[0])
+			append_word_changes(ctx, out, 0, cur,
+					diff & ctx->scalars[0],
+					chunk->start_sample + i, &timestamped);
+		if ((buses = diff & ctx->bus_masks[0]))
+			append_bus_changes(ctx, out, sample, &buses,
+					chunk->start_sample + i, &timestamped);
+	}
+	*prev = last;
 }
 
 static int receive(struct sr_output *o, const struct sr_dev_inst *sdi,
-		const struct sr_datafeed_packet *packet, GString **out)
+		const struct sr_datafeed_packet *packet, GString *out)
 {
-	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_edges *edges;
 	struct context *ctx;
-	unsigned int i;
-	int p, curbit, prevbit, index;
-	uint8_t *sample;
-	static uint64_t samplecount = 0;
+	const uint8_t *sample;
+	uint64_t i;
 
 	(void)sdi;
 
-	*out = NULL;
 	if (!o || !o->internal)
 		return SR_ERR_ARG;
 	ctx = o->internal;
 
 	if (packet->type == SR_DF_END) {
-		*out = g_string_new("$dumpoff\n$end\n");
+		g_string_append(out, "$dumpoff\n$end\n");
 		return SR_OK;
-	} else if (packet->type != SR_DF_LOGIC)
+	} else if (packet->type != SR_DF_LOGIC_EDGES)
 		return SR_OK;
 
 	if (ctx->header) {
 		/* The header is still here, this must be the first packet. */
-		*out = ctx->header;
+		g_string_append_len(out, ctx->header->str, ctx->header->len);
+		g_string_free(ctx->header, TRUE);
 		ctx->header = NULL;
-	} else {
-		*out = g_string_sized_new(512);
 	}
 
-	logic = packet->payload;
-	for (i = 0; i <= logic->length - logic->unitsize; i += logic->unitsize) {
-		samplecount++;
-
-		sample = logic->data + i;
-
-		for (p = 0; p < ctx->num_enabled_probes; p++) {
-			index = g_array_index(ctx->probeindices, int, p);
-			curbit = (sample[p / 8] & (((uint8_t) 1) << index)) >> index;
-			prevbit = (ctx->prevsample[p / 8] & (((uint8_t) 1) << index)) >> index;
-
-			/* VCD only contains deltas/changes of signals. */
-			if (prevbit == curbit)
-				continue;
-
-			/* Output which signal changed to which value. */
-			g_string_append_printf(*out, "#%" PRIu64 "\n%i%c\n",
-					(uint64_t)(((float)samplecount / ctx->samplerate)
-					* ctx->period), curbit, (char)('!' + p));
-		}
-
-		memcpy(ctx->prevsample, sample, ctx->unitsize);
+	/* Only the transitions, ready to be written out. */
+	edges = packet->payload;
+	sample = edges->values;
+	for (i = 0; i < edges->num_edges; i++, sample += edges->unitsize) {
+		append_changes(ctx, out, sample, edges->unitsize,
+				edges->timestamps[i], ctx->prevsample,
+				ctx->diffs, ctx->samplecount == 0);
+		ctx->samplecount = edges->timestamps[i] + 1;
 	}
+	ctx->samplecount = edges->start + edges->num_samples;
 
 	return SR_OK;
 }
 
-static int cleanup(struct sr_output *o)
+static int encode(struct sr_output *o, const struct sr_output_chunk *chunk,
+		GString *out)
 {
 	struct context *ctx;
+	const uint8_t *sample;
+	uint64_t *prev, i;
+	unsigned int w;
 
 	if (!o || !o->internal)
 		return SR_ERR_ARG;
-
 	ctx = o->internal;
-	g_free(ctx);
+
+	/*
+	 * The previous sample, while going through this chunk, and room for
+	 * which bus bits changed.
+	 */
+	if (!(prev = g_try_new(uint64_t, 2 * ctx->num_words))) {
+		sr_err("%s: prev malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	if (chunk->start_sample == 0 && ctx->header) {
+		/* This must be the first packet. */
+		g_string_append_len(out, ctx->header->str, ctx->header->len);
+		g_string_free(ctx->header, TRUE);
+		ctx->header = NULL;
+	}
+
+	if (chunk->prev_sample) {
+		for (w = 0; w < ctx->num_words; w++)
+			prev[w] = sr_sample_word_get(chunk->prev_sample,
+					chunk->unitsize, w);
+	}
+
+	if (ctx->num_words == 1) {
+		SR_UNITSIZE_DISPATCH(chunk->unitsize, append_chunk_narrow,
+				ctx, out, chunk, prev);
+		g_free(prev);
+		return SR_OK;
+	}
+
+	sample = chunk->data;
+	for (i = 0; i < chunk->num_samples; i++, sample += chunk->unitsize)
+		append_changes(ctx, out, sample, chunk->unitsize,
+				chunk->start_sample + i, prev,
+				prev + ctx->num_words,
+				!chunk->prev_sample && i == 0);
+	g_free(prev);
 
 	return SR_OK;
 }
@@ -227,5 +599,6 @@ struct sr_output_format output_vcd = {
 	.df_type = SR_DF_LOGIC,
 	.init = init,
 	.receive = receive,
+	.encode = encode,
 	.cleanup = cleanup,
 };
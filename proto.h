@@ -30,6 +30,21 @@
 
 SR_API int sr_init(struct sr_context **ctx);
 SR_API int sr_exit(struct sr_context *ctx);
+SR_API int sr_usb_thread_set(struct sr_context *ctx, gboolean enable);
+SR_API int sr_usb_thread_get(struct sr_context *ctx, gboolean *enable);
+SR_API int sr_thread_priority_set(struct sr_context *ctx, int priority);
+SR_API int sr_thread_priority_get(struct sr_context *ctx, int *priority);
+SR_API int sr_thread_affinity_set(struct sr_context *ctx, const int *cpus,
+		int num_cpus);
+SR_API int sr_usb_buffer_lock_set(struct sr_context *ctx, gboolean enable);
+SR_API int sr_hotplug_set(struct sr_context *ctx, sr_hotplug_callback_t cb,
+		void *cb_data);
+SR_API int sr_hotplug_handle_events(struct sr_context *ctx, int timeout_ms);
+
+/*--- cpu.c -----------------------------------------------------------------*/
+
+SR_API unsigned int sr_cpu_features_get(void);
+SR_API void sr_cpu_features_limit(unsigned int mask);
 
 /*--- log.c -----------------------------------------------------------------*/
 
@@ -38,10 +53,27 @@ typedef int (*sr_log_callback_t)(void *cb_data, int loglevel,
 
 SR_API int sr_log_loglevel_set(int loglevel);
 SR_API int sr_log_loglevel_get(void);
+SR_API int sr_log_module_loglevel_set(const char *module, int loglevel);
+SR_API int sr_log_module_loglevel_get(const char *module);
+SR_API int sr_log_module_loglevel_unset(const char *module);
 SR_API int sr_log_callback_set(sr_log_callback_t cb, void *cb_data);
 SR_API int sr_log_callback_set_default(void);
 SR_API int sr_log_logdomain_set(const char *logdomain);
 SR_API char *sr_log_logdomain_get(void);
+SR_API int sr_log_async_set(gboolean enable);
+SR_API int sr_log_async_dropped_get(uint64_t *dropped);
+
+/*--- datafeed.c ------------------------------------------------------------*/
+
+SR_API struct sr_datafeed_logic *sr_datafeed_logic_ref(
+		const struct sr_datafeed_logic *logic);
+SR_API void sr_datafeed_logic_unref(struct sr_datafeed_logic *logic);
+SR_API struct sr_datafeed_analog *sr_datafeed_analog_ref(
+		const struct sr_datafeed_analog *analog);
+SR_API void sr_datafeed_analog_unref(struct sr_datafeed_analog *analog);
+SR_API int sr_stream_params_update(struct sr_stream_params *params,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet);
 
 /*--- device.c --------------------------------------------------------------*/
 
@@ -56,6 +88,21 @@ SR_API GSList *sr_dev_list(const struct sr_dev_driver *driver);
 SR_API int sr_dev_clear(const struct sr_dev_driver *driver);
 SR_API int sr_dev_open(struct sr_dev_inst *sdi);
 SR_API int sr_dev_close(struct sr_dev_inst *sdi);
+SR_API int sr_dev_keep_open(struct sr_dev_inst *sdi, gboolean keep);
+
+typedef void (*sr_dev_open_callback_t)(struct sr_dev_inst *sdi, int ret,
+		void *cb_data);
+
+SR_API int sr_dev_open_all(GSList *devices, sr_dev_open_callback_t cb,
+		void *cb_data);
+
+/*--- memory.c --------------------------------------------------------------*/
+
+SR_API int sr_dev_mem_get(const struct sr_dev_inst *sdi, uint64_t *used,
+		uint64_t *peak);
+SR_API int sr_dev_mem_limit_set(struct sr_dev_inst *sdi, uint64_t limit);
+SR_API int sr_session_mem_limit_set(struct sr_session *session,
+		uint64_t limit);
 
 /*--- filter.c --------------------------------------------------------------*/
 
@@ -63,6 +110,11 @@ SR_API int sr_filter_probes(unsigned int in_unitsize, unsigned int out_unitsize,
 			    const GArray *probe_array, const uint8_t *data_in,
 			    uint64_t length_in, uint8_t **data_out,
 			    uint64_t *length_out);
+SR_API int sr_filter_probes_buf(unsigned int in_unitsize,
+		unsigned int out_unitsize, const GArray *probe_array,
+		const uint8_t *data_in, uint64_t length_in, uint8_t *data_out,
+		uint64_t *length_out);
+SR_API uint64_t sr_filter_probes_pack_mask(uint64_t mask, uint64_t packed);
 
 /*--- hwdriver.c ------------------------------------------------------------*/
 
@@ -70,17 +122,35 @@ SR_API struct sr_dev_driver **sr_driver_list(void);
 SR_API int sr_driver_init(struct sr_context *ctx,
 		struct sr_dev_driver *driver);
 SR_API GSList *sr_driver_scan(struct sr_dev_driver *driver, GSList *options);
+SR_API GSList *sr_driver_scan_all(struct sr_context *ctx,
+		unsigned int timeout_ms);
+SR_API int sr_driver_scan_async(struct sr_dev_driver *driver,
+		const char **ports, GSList *options, sr_scan_callback_t cb,
+		void *cb_data, struct sr_scan **scan);
+SR_API int sr_scan_wait(struct sr_scan *scan, unsigned int timeout_ms);
+SR_API int sr_scan_cancel(struct sr_scan *scan);
+SR_API int sr_scan_free(struct sr_scan *scan);
 SR_API int sr_config_get(const struct sr_dev_driver *driver,
 		const struct sr_dev_inst *sdi,
 		const struct sr_probe_group *probe_group,
 		int key, GVariant **data);
+SR_API int sr_config_get_multi(const struct sr_dev_driver *driver,
+		const struct sr_dev_inst *sdi,
+		const struct sr_probe_group *probe_group,
+		const int *keys, GVariant **data, int num_keys);
 SR_API int sr_config_set(const struct sr_dev_inst *sdi,
 		const struct sr_probe_group *probe_group,
 		int key, GVariant *data);
+SR_API int sr_config_set_multi(const struct sr_dev_inst *sdi,
+		const struct sr_probe_group *probe_group,
+		const int *keys, GVariant **data, int num_keys);
+SR_API int sr_config_cache_set(struct sr_dev_inst *sdi, gboolean enable);
 SR_API int sr_config_list(const struct sr_dev_driver *driver,
 		const struct sr_dev_inst *sdi,
 		const struct sr_probe_group *probe_group,
 		int key, GVariant **data);
+SR_API int sr_config_samplerate_max(const struct sr_dev_inst *sdi,
+		gboolean set, uint64_t *samplerate);
 SR_API const struct sr_config_info *sr_config_info_get(int key);
 SR_API const struct sr_config_info *sr_config_info_name_get(const char *optname);
 
@@ -90,43 +160,218 @@ typedef void (*sr_datafeed_callback_t)(const struct sr_dev_inst *sdi,
 		const struct sr_datafeed_packet *packet, void *cb_data);
 
 /* Session setup */
-SR_API int sr_session_load(const char *filename);
+SR_API int sr_session_load(const char *filename, struct sr_session **session);
+SR_API int sr_session_replay_threads_set(struct sr_session *session,
+		int num_threads);
 SR_API struct sr_session *sr_session_new(void);
-SR_API int sr_session_destroy(void);
-SR_API int sr_session_dev_remove_all(void);
-SR_API int sr_session_dev_add(const struct sr_dev_inst *sdi);
-SR_API int sr_session_dev_list(GSList **devlist);
+SR_API int sr_session_destroy(struct sr_session *session);
+SR_API int sr_session_dev_remove_all(struct sr_session *session);
+SR_API int sr_session_dev_add(struct sr_session *session,
+		struct sr_dev_inst *sdi);
+SR_API int sr_session_dev_list(struct sr_session *session, GSList **devlist);
 
 /* Datafeed setup */
-SR_API int sr_session_datafeed_callback_remove_all(void);
-SR_API int sr_session_datafeed_callback_add(sr_datafeed_callback_t cb,
-		void *cb_data);
+SR_API int sr_session_datafeed_callback_remove_all(struct sr_session *session);
+SR_API int sr_session_datafeed_callback_add(struct sr_session *session,
+		sr_datafeed_callback_t cb, void *cb_data);
+SR_API int sr_session_datafeed_callback_rle_set(struct sr_session *session,
+		sr_datafeed_callback_t cb, void *cb_data, gboolean enable);
+SR_API int sr_session_datafeed_callback_edges_set(struct sr_session *session,
+		sr_datafeed_callback_t cb, void *cb_data, gboolean enable);
+SR_API int sr_session_datafeed_callback_analog_raw_set(
+		struct sr_session *session, sr_datafeed_callback_t cb,
+		void *cb_data, gboolean enable);
+SR_API int sr_session_datafeed_callback_planar_set(
+		struct sr_session *session, sr_datafeed_callback_t cb,
+		void *cb_data, gboolean enable);
+SR_API int sr_session_datafeed_callback_decimate_set(
+		struct sr_session *session, sr_datafeed_callback_t cb,
+		void *cb_data, uint64_t factor);
+SR_API int sr_session_datafeed_callback_packet_size_set(
+		struct sr_session *session, sr_datafeed_callback_t cb,
+		void *cb_data, uint64_t size, unsigned int latency_ms);
+
+/* Transforms */
+SR_API int sr_session_transform_add(struct sr_session *session,
+		struct sr_transform_format *format, GHashTable *params);
+SR_API int sr_session_transform_remove_all(struct sr_session *session);
 
 /* Session control */
-SR_API int sr_session_start(void);
-SR_API int sr_session_run(void);
-SR_API int sr_session_stop(void);
+SR_API int sr_session_start(struct sr_session *session);
+SR_API int sr_session_run(struct sr_session *session);
+SR_API int sr_session_attach(struct sr_session *session,
+		GMainContext *context);
+SR_API int sr_session_stop(struct sr_session *session);
 SR_API int sr_session_save(const char *filename, const struct sr_dev_inst *sdi,
 		unsigned char *buf, int unitsize, int units);
 SR_API int sr_session_append(const char *filename, unsigned char *buf,
 		int unitsize, int units);
-SR_API int sr_session_source_add(int fd, int events, int timeout,
-		sr_receive_data_callback_t cb, void *cb_data);
-SR_API int sr_session_source_add_pollfd(GPollFD *pollfd, int timeout,
+SR_API int sr_session_writer_open(struct sr_session_writer **writer,
+		const char *filename, const struct sr_dev_inst *sdi, int unitsize);
+SR_API int sr_session_writer_dev_add(struct sr_session_writer *writer,
+		const struct sr_dev_inst *sdi, int unitsize);
+SR_API int sr_session_writer_compression_set(struct sr_session_writer *writer,
+		int level);
+SR_API int sr_session_writer_planar_set(struct sr_session_writer *writer,
+		gboolean planar);
+SR_API int sr_session_writer_rle_set(struct sr_session_writer *writer,
+		gboolean rle);
+SR_API int sr_session_writer_delta_set(struct sr_session_writer *writer,
+		gboolean delta);
+SR_API int sr_session_writer_notify_set(struct sr_session_writer *writer,
+		int fd);
+SR_API int sr_session_writer_summary_set(struct sr_session_writer *writer,
+		gboolean enable);
+SR_API int sr_session_writer_write(struct sr_session_writer *writer,
+		const void *buf, uint64_t units);
+SR_API int sr_session_writer_packet(struct sr_session_writer *writer,
+		const struct sr_datafeed_packet *packet);
+SR_API int sr_session_writer_dev_packet(struct sr_session_writer *writer,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet);
+SR_API int sr_session_writer_close(struct sr_session_writer *writer);
+SR_API int sr_session_reader_open(struct sr_session_reader **reader,
+		const char *filename);
+SR_API int sr_session_reader_tail_open(struct sr_session_reader **reader,
+		const char *filename, int unitsize);
+SR_API int sr_session_reader_tail_update(struct sr_session_reader *reader,
+		gboolean *done);
+SR_API int sr_session_reader_info(const struct sr_session_reader *reader,
+		uint64_t *num_samples, int *unitsize);
+SR_API int sr_session_reader_get(struct sr_session_reader *reader,
+		uint64_t start, uint64_t *count, const void **data);
+SR_API int sr_session_reader_probe_get(struct sr_session_reader *reader,
+		int probe, uint64_t start, uint64_t *count, const void **data);
+SR_API int sr_session_reader_summary_get(struct sr_session_reader *reader,
+		uint64_t start, uint64_t count, uint64_t *or_mask,
+		uint64_t *and_mask, uint64_t *transitions);
+SR_API int sr_session_reader_find_pattern(struct sr_session_reader *reader,
+		uint64_t start, uint64_t mask, uint64_t value, uint64_t *index);
+SR_API int sr_session_reader_find_edge(struct sr_session_reader *reader,
+		int probe, gboolean rising, uint64_t start, uint64_t *index);
+SR_API int sr_session_reader_close(struct sr_session_reader *reader);
+SR_API int sr_session_spill_open(struct sr_session_spill **spill,
+		const char *filename, const struct sr_dev_inst *sdi,
+		int unitsize, uint64_t window);
+SR_API int sr_session_spill_packet(struct sr_session_spill *spill,
+		const struct sr_datafeed_packet *packet);
+SR_API int sr_session_spill_end(struct sr_session_spill *spill);
+SR_API int sr_session_spill_get(struct sr_session_spill *spill,
+		uint64_t start, uint64_t *count, const void **data);
+SR_API int sr_session_spill_info(const struct sr_session_spill *spill,
+		uint64_t *num_samples, uint64_t *first_in_ram);
+SR_API int sr_session_spill_close(struct sr_session_spill *spill);
+SR_API int sr_session_record_to(struct sr_session *session,
+		const char *filename, const char *options);
+SR_API int sr_session_flight_recorder_set(struct sr_session *session,
+		uint64_t size);
+SR_API int sr_session_flight_save(struct sr_session *session,
+		const char *filename, const char *options);
+SR_API int sr_session_flight_replay(struct sr_session *session,
+		sr_datafeed_callback_t cb, void *cb_data);
+SR_API int sr_session_source_add(struct sr_session *session, int fd,
+		int events, int timeout, sr_receive_data_callback_t cb,
+		void *cb_data);
+SR_API int sr_session_source_add_pollfd(struct sr_session *session,
+		GPollFD *pollfd, int timeout, sr_receive_data_callback_t cb,
+		void *cb_data);
+SR_API int sr_session_source_add_channel(struct sr_session *session,
+		GIOChannel *channel, int events, int timeout,
 		sr_receive_data_callback_t cb, void *cb_data);
-SR_API int sr_session_source_add_channel(GIOChannel *channel, int events,
-		int timeout, sr_receive_data_callback_t cb, void *cb_data);
-SR_API int sr_session_source_remove(int fd);
-SR_API int sr_session_source_remove_pollfd(GPollFD *pollfd);
-SR_API int sr_session_source_remove_channel(GIOChannel *channel);
+SR_API int sr_session_source_remove(struct sr_session *session, int fd);
+SR_API int sr_session_source_remove_pollfd(struct sr_session *session,
+		GPollFD *pollfd);
+SR_API int sr_session_source_remove_channel(struct sr_session *session,
+		GIOChannel *channel);
+
+/* Datafeed queue */
+SR_API int sr_session_queue_depth_set(struct sr_session *session,
+		unsigned int depth);
+SR_API int sr_session_queue_depth_get(struct sr_session *session,
+		unsigned int *depth);
+SR_API int sr_session_queue_stats_get(struct sr_session *session,
+		uint64_t *overruns, unsigned int *max_used);
+SR_API int sr_session_profile_set(struct sr_session *session, int profile);
+SR_API int sr_session_profile_get(struct sr_session *session, int *profile);
+SR_API int sr_session_threaded_dispatch_set(struct sr_session *session,
+		gboolean enable);
+SR_API int sr_session_threaded_dispatch_get(struct sr_session *session,
+		gboolean *enable);
+SR_API int sr_session_dispatch_blocking_set(struct sr_session *session,
+		gboolean block);
+SR_API int sr_session_dispatch_blocking_get(struct sr_session *session,
+		gboolean *block);
+SR_API int sr_session_dev_threads_set(struct sr_session *session,
+		gboolean enable);
+SR_API int sr_session_dev_threads_get(struct sr_session *session,
+		gboolean *enable);
+SR_API int sr_session_packet_queue_set(struct sr_session *session,
+		unsigned int depth);
+SR_API int sr_session_packet_next(struct sr_session *session, int timeout_ms,
+		const struct sr_dev_inst **sdi,
+		struct sr_datafeed_packet **packet);
+SR_API void sr_session_packet_free(struct sr_datafeed_packet *packet);
+
+/* Statistics */
+SR_API int sr_session_stats_get(struct sr_session *session,
+		struct sr_session_stats **stats);
+SR_API int sr_session_stage_timing_set(struct sr_session *session,
+		gboolean enable);
+SR_API int sr_session_stage_timing_get(struct sr_session *session,
+		gboolean *enable);
+SR_API char *sr_session_stage_report(struct sr_session *session);
+
+/* Software trigger */
+SR_API int sr_session_trigger_set(struct sr_session *session,
+		const struct sr_dev_inst *sdi, const char *triggerstring);
+SR_API int sr_session_analog_trigger_set(struct sr_session *session,
+		const struct sr_dev_inst *sdi, const struct sr_probe *probe,
+		const struct sr_analog_trigger *trigger);
+SR_API int sr_session_protocol_trigger_set(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_protocol_trigger *trigger);
+
+/* Frame history */
+SR_API int sr_session_frame_history_set(struct sr_session *session,
+		unsigned int num_frames);
+SR_API int sr_session_frame_get(struct sr_session *session,
+		const struct sr_dev_inst *sdi, unsigned int index,
+		const struct sr_frame **frame);
+
+/*--- shm.c -----------------------------------------------------------------*/
+
+SR_API int sr_shm_writer_open(struct sr_shm_writer **writer,
+		const char *name, uint64_t size, struct sr_dev_inst *sdi);
+SR_API int sr_shm_writer_packet(struct sr_shm_writer *writer,
+		const struct sr_datafeed_packet *packet);
+SR_API int sr_shm_writer_close(struct sr_shm_writer *writer);
 
 /*--- input/input.c ---------------------------------------------------------*/
 
 SR_API struct sr_input_format **sr_input_list(void);
+SR_API struct sr_input_format *sr_input_format_detect(const char *filename);
+SR_API int sr_input_send(struct sr_input *in, const void *buf, size_t len);
+SR_API int sr_input_end(struct sr_input *in);
 
 /*--- output/output.c -------------------------------------------------------*/
 
 SR_API struct sr_output_format **sr_output_list(void);
+SR_API struct sr_output *sr_output_new(struct sr_output_format *format,
+		const char *param, struct sr_dev_inst *sdi);
+SR_API int sr_output_free(struct sr_output *o);
+SR_API int sr_output_threads_set(struct sr_output *o, int num_threads);
+SR_API int sr_output_compress_set(struct sr_output *o, int level,
+		int num_threads);
+SR_API int sr_output_flush(struct sr_output *o,
+		sr_output_write_callback_t cb, void *cb_data);
+SR_API int sr_output_send(struct sr_output *o, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet,
+		sr_output_write_callback_t cb, void *cb_data);
+SR_API int sr_output_fd_write(const void *buf, uint64_t len, void *cb_data);
+
+/*--- transform/transform.c -------------------------------------------------*/
+
+SR_API struct sr_transform_format **sr_transform_list(void);
 
 /*--- strutil.c -------------------------------------------------------------*/
 
@@ -19,8 +19,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <unistd.h>
 #include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
 #include <glib.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
@@ -28,553 +32,6527 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "session: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/**
+ * @file
+ *
+ * Creating, using, or destroying libsigrok sessions.
+ */
+
+/**
+ * @defgroup grp_session Session handling
+ *
+ * Creating, using, or destroying libsigrok sessions.
+ *
+ * @{
+ */
+
+struct source {
+	int timeout;
+	sr_receive_data_callback_t cb;
+	void *cb_data;
+
+	/* This is used to keep track of the object (fd, pollfd or channel) which is
+	 * being polled and will be used to match the source when removing it again.
+	 */
+	gintptr poll_object;
+
+	/* Monotonic time (in us) the timeout expires at, if it has one. */
+	int64_t due;
+	/* Position in the session's timer heap, or -1 without a timeout. */
+	int heap_pos;
+};
+
+struct source_ready {
+	unsigned int index;
+	gintptr poll_object;
+	int revents;
+};
+
+struct datafeed_callback {
+	sr_datafeed_callback_t cb;
+	void *cb_data;
+	/* Frees cb_data along with the callback, if set. */
+	GDestroyNotify destroy;
+	/* Takes SR_DF_LOGIC_RLE packets as they are. */
+	gboolean rle;
+	/* Gets all logic data as SR_DF_LOGIC_EDGES packets. */
+	gboolean edges;
+	/* Takes SR_DF_ANALOG_RAW packets as they are. */
+	gboolean analog_raw;
+	/* Gets analog data planar, transposed into planar_buf. */
+	gboolean planar;
+	float *planar_buf;
+	size_t planar_size;
+	/* Reduce logic and analog data by this factor, if above 1. */
+	uint64_t decimate;
+	/* One struct decim_state per device, while decimating. */
+	GSList *decim_states;
+	/*
+	 * Coalesce or split logic and analog data into packets of about
+	 * chunk_size bytes, holding back data for at most chunk_latency
+	 * microseconds if that's not 0. One struct chunk_state per device.
+	 */
+	uint64_t chunk_size;
+	int64_t chunk_latency;
+	GSList *chunk_states;
+
+	/*
+	 * Only used with threaded dispatch, while the session is running:
+	 * the broadcast ring the thread reads, and its cursor there.
+	 */
+	struct bcast_ring *bcast;
+	unsigned int reader;
+	GThread *thread;
+	struct sr_context *ctx;
+	uint64_t overruns;
+	unsigned int max_used;
+
+	/* How long the callback takes, see sr_session_stats_get(). */
+	struct sr_callback_stats stats;
+	/* The session it was added to, for stage timing. */
+	struct sr_session *session;
+};
+
+/* Largest supported depth of the session's packet queue. */
+#define MAX_QUEUE_DEPTH		(64 * 1024)
+
+/* Queue depth of each callback thread, unless a queue depth is set. */
+#define DEFAULT_WORKER_DEPTH	256
+#define LOW_LATENCY_WORKER_DEPTH	32
+#define THROUGHPUT_WORKER_DEPTH		4096
+
+/* Most callbacks threaded dispatch runs on threads, one reader bit each. */
+#define MAX_WORKERS		64
+
+/* Most data the low latency profile holds back, in ms. */
+#define LOW_LATENCY_MS		2
+/* How much larger the throughput profile makes transfers and queues. */
+#define THROUGHPUT_BUFFER_FACTOR	4
+#define THROUGHPUT_QUEUE_FACTOR		2
+
+/* How long the queue thread sleeps at most before re-checking the ring. */
+#define QUEUE_POLL_TIMEOUT_US	(10 * 1000)
+
+/* Size of the pieces RLE data is expanded in, if it needs to be. */
+#define RLE_EXPAND_SIZE		(256 * 1024)
+
+/* Where a device's logic data stands, for SR_DF_LOGIC_EDGES. */
+struct edge_state {
+	const struct sr_dev_inst *sdi;
+	struct sr_edge_conv *conv;
+};
+
+/*
+ * How many samples a device has sent, to number the next packet's, and
+ * its statistics.
+ */
+struct dev_state {
+	const struct sr_dev_inst *sdi;
+	uint64_t logic_samples;
+	/* One struct probe_samples per analog probe sent so far. */
+	GSList *analog;
+	struct sr_dev_stats stats;
+	/* When the device's first frame ended, in us. */
+	int64_t first_frame_end;
+	/*
+	 * The device's limits for this acquisition, see limit_apply():
+	 * samples per probe, from SR_CONF_LIMIT_SAMPLES and from
+	 * SR_CONF_LIMIT_MSEC at the samplerate, or without a samplerate,
+	 * when the time is up, in us. Each is 0 if there is none.
+	 */
+	uint64_t limit_samples;
+	uint64_t limit_msec;
+	uint64_t limit_rate_samples;
+	int64_t limit_end;
+	gboolean limit_reached;
+	/* The run lengths of a truncated RLE packet. */
+	uint64_t *limit_counts;
+	uint64_t limit_counts_size;
+	/* Planar data sent by the device, interleaved. */
+	float *planar_buf;
+	size_t planar_size;
+};
+
+struct probe_samples {
+	const struct sr_probe *probe;
+	uint64_t num_samples;
+};
+
+/* A frame of the history, with room kept for the next one in its place. */
+struct frame_slot {
+	struct sr_frame frame;
+	/* Entries in frame.probes, and values each of their data hold. */
+	unsigned int probes_size;
+	uint64_t *data_sizes;
+};
+
+/* The last frames of a device, see sr_session_frame_history_set(). */
+struct frame_history {
+	const struct sr_dev_inst *sdi;
+	/* session->frame_history_size slots, allocated at the first frame. */
+	struct frame_slot *slots;
+	/* The slot the next (or current) frame goes into. */
+	unsigned int next;
+	/* Complete frames in the slots before it. */
+	unsigned int num_frames;
+	uint64_t frame_num;
+	/* The frame being received, or NULL. */
+	struct frame_slot *cur;
+};
+
+/* A copy of a packet, with sample number and timestamp filled in. */
+struct stamped_packet {
+	struct sr_datafeed_packet packet;
+	union {
+		struct sr_datafeed_logic logic;
+		struct sr_datafeed_logic_rle rle;
+		struct sr_datafeed_analog analog;
+		struct sr_datafeed_analog_raw raw;
+	} payload;
+};
+
+/* Where a device's data stands, for a decimating datafeed callback. */
+struct decim_state {
+	const struct sr_dev_inst *sdi;
+
+	/* Samples in the current logic block, their AND and OR. */
+	uint64_t logic_count;
+	uint64_t logic_start;
+	int64_t logic_timestamp;
+	uint16_t unitsize;
+	uint8_t *logic_and;
+	uint8_t *logic_or;
+
+	/* Samples in the current analog block, their minimum and maximum. */
+	uint64_t analog_count;
+	uint64_t analog_start;
+	struct sr_datafeed_analog analog;
+	unsigned int num_probes;
+	float *analog_min;
+	float *analog_max;
+
+	/* Decimated data of the current packet. */
+	void *out;
+	size_t out_size;
+};
+
+/* The data a callback with a preferred packet size has yet to get. */
+struct chunk_state {
+	const struct sr_dev_inst *sdi;
+
+	/* Logic data held back, in logic_buf, and since when. */
+	struct sr_datafeed_logic logic;
+	uint8_t *logic_buf;
+	uint64_t logic_buf_size;
+	int64_t logic_since;
+
+	/* Analog data held back, in analog_buf, and since when. */
+	struct sr_datafeed_analog analog;
+	float *analog_buf;
+	uint64_t analog_buf_size;
+	int64_t analog_since;
+};
+
+/* Where the analog software trigger stands. */
+enum {
+	ATRIG_SEARCHING,
+	ATRIG_IN_FRAME,
+	ATRIG_PASS,
+};
+
+struct analog_trigger_state {
+	const struct sr_dev_inst *sdi;
+	const struct sr_probe *probe;
+	struct sr_analog_trigger conf;
+	struct sr_analog_matcher *matcher;
+	int state;
+	/* Samples still to send in the current frame. */
+	uint64_t post_left;
+	/*
+	 * The last pre_samples samples seen while searching, a ring of
+	 * hist_probes values each.
+	 */
+	float *hist;
+	uint64_t hist_start;
+	uint64_t hist_len;
+	unsigned int hist_probes;
+	/* Where raw data gets converted for the matcher. */
+	float *buf;
+	size_t buf_size;
+};
+
+struct queue_entry {
+	const struct sr_dev_inst *sdi;
+	struct sr_datafeed_packet *packet;
+};
+
+/* The time spent in one stage, see sr_stage_end(). */
+struct stage_entry {
+	/* The static strings the stage was reported with. */
+	const char *stage;
+	const char *id;
+	struct sr_stage_stats stats;
+};
+
+/* One device being started by sr_session_start(). */
+struct dev_start {
+	struct sr_session *session;
+	struct sr_dev_inst *sdi;
+	GThread *thread;
+	int ret;
+};
+
+/*
+ * A device polled on a thread of its own, see sr_session_dev_threads_set().
+ * The loop is a session of its own with just the device's sources; the
+ * device stays part of the session which sends its packets on.
+ */
+struct dev_loop {
+	struct sr_session *session;
+	struct sr_session *loop;
+	struct sr_dev_inst *sdi;
+	GThread *thread;
+	/* The result of starting the device, once started is set. */
+	int ret;
+	gboolean started;
+	GMutex mutex;
+	GCond cond;
+};
+
+/*
+ * Lock-free single-producer/single-consumer ring of packets. The session
+ * thread (where the drivers' callbacks run) is the only producer, the
+ * queue thread is the only consumer. The mutex and condition are only
+ * used to put the consumer to sleep while the ring is empty, neither
+ * side ever holds the mutex while touching the ring.
+ */
+struct packet_ring {
+	/* Number of slots, always a power of two. */
+	unsigned int size;
+	struct queue_entry *entries;
+	/* Free-running counters, only ever incremented by their owner. */
+	gint head;
+	gint tail;
+	gint shutdown;
+	gint waiting;
+	GMutex mutex;
+	GCond cond;
+};
+
+struct bcast_entry {
+	const struct sr_dev_inst *sdi;
+	struct sr_datafeed_packet *packet;
+	/* One bit for every reader which is to deliver the packet. */
+	guint64 readers;
+	/* Readers yet to deliver it, the last one frees the packet. */
+	gint refs;
+};
+
+struct bcast_cursor {
+	/* Free-running, only ever incremented by its reader. */
+	gint tail;
+	/* Keep each reader's cursor on a cache line of its own. */
+	uint8_t pad[60];
+};
+
+/*
+ * Lock-free single-producer/multi-consumer broadcast ring, feeding the
+ * callback threads of threaded dispatch. A packet going to several of
+ * them is put on the ring once, and every thread reads all entries with
+ * a cursor of its own, skipping those not meant for it. A slot is only
+ * reused once every reader is past it. As with struct packet_ring, the
+ * mutex and condition only put idle readers to sleep.
+ */
+struct bcast_ring {
+	/* Number of slots, always a power of two. */
+	unsigned int size;
+	struct bcast_entry *entries;
+	unsigned int num_readers;
+	struct bcast_cursor *cursors;
+	/* The callback behind each reader, for its counters. */
+	struct datafeed_callback **callbacks;
+	/* Free-running, only ever incremented by the producer. */
+	gint head;
+	gint shutdown;
+	gint waiting;
+	GMutex mutex;
+	GCond cond;
+
+	/* The rest is the producer's own. */
+	/* Wait for room rather than drop sample data when full. */
+	gboolean block;
+	/*
+	 * The packet being dispatched, and the readers it still needs to
+	 * be put on the ring for, so all of them share one entry.
+	 */
+	const struct sr_datafeed_packet *shared;
+	const struct sr_dev_inst *shared_sdi;
+	guint64 pending;
+};
+
+/* The buffer backing the packet currently being sent by this thread. */
+static GPrivate cur_buffer;
+
+/* The sample timestamps of the analog packet being sent by this thread. */
+static GPrivate cur_timestamps;
+
+/* Set on threads whose packets are handed over to the session thread. */
+static GPrivate defer_sends;
+
+/* Time this thread's inner stages took, see sr_stage_begin(). */
+static GPrivate stage_inner_us = G_PRIVATE_INIT(g_free);
+
+/* The session most recently started or run by this thread. */
+static GPrivate cur_session;
+
+static void datafeed_dispatch(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet);
+static int session_send(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet);
+static void deferred_drain(struct sr_session *session);
+static int64_t chunk_flush_due(struct sr_session *session);
+static void session_wake(struct sr_session *session);
+static int _sr_session_source_remove(struct sr_session *session,
+		gintptr poll_object);
+static gboolean trigger_filter(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet);
+static gboolean analog_trigger_filter(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet);
+
+static struct packet_ring *ring_new(unsigned int depth)
+{
+	struct packet_ring *ring;
+	unsigned int size;
+
+	for (size = 1; size < depth; size <<= 1);
+
+	if (!(ring = g_try_malloc0(sizeof(struct packet_ring))))
+		return NULL;
+
+	if (!(ring->entries = g_try_malloc(sizeof(struct queue_entry) * size))) {
+		g_free(ring);
+		return NULL;
+	}
+
+	ring->size = size;
+	g_mutex_init(&ring->mutex);
+	g_cond_init(&ring->cond);
+
+	return ring;
+}
+
+static void ring_free(struct packet_ring *ring)
+{
+	unsigned int i;
+
+	/* Anything left over was never delivered. */
+	for (i = ring->tail; i != (unsigned int)ring->head; i++)
+		sr_packet_free(ring->entries[i & (ring->size - 1)].packet);
+
+	g_mutex_clear(&ring->mutex);
+	g_cond_clear(&ring->cond);
+	g_free(ring->entries);
+	g_free(ring);
+}
+
+static unsigned int ring_used(struct packet_ring *ring)
+{
+	return (unsigned int)g_atomic_int_get(&ring->head)
+			- (unsigned int)g_atomic_int_get(&ring->tail);
+}
+
+/* Producer side. Returns FALSE if the ring is full. */
+static gboolean ring_push(struct packet_ring *ring,
+		const struct sr_dev_inst *sdi, struct sr_datafeed_packet *packet)
+{
+	unsigned int head;
+
+	head = g_atomic_int_get(&ring->head);
+	if (head - (unsigned int)g_atomic_int_get(&ring->tail) == ring->size)
+		return FALSE;
+
+	ring->entries[head & (ring->size - 1)].sdi = sdi;
+	ring->entries[head & (ring->size - 1)].packet = packet;
+	/* Publish the entry only after it has been completely written. */
+	g_atomic_int_set(&ring->head, head + 1);
+
+	if (g_atomic_int_get(&ring->waiting)) {
+		g_mutex_lock(&ring->mutex);
+		g_cond_signal(&ring->cond);
+		g_mutex_unlock(&ring->mutex);
+	}
+
+	return TRUE;
+}
+
+/* Consumer side. Returns FALSE if the ring stayed empty for timeout_us. */
+static gboolean ring_pop(struct packet_ring *ring, struct queue_entry *entry,
+		int64_t timeout_us)
+{
+	unsigned int tail;
+
+	tail = g_atomic_int_get(&ring->tail);
+	if ((unsigned int)g_atomic_int_get(&ring->head) == tail) {
+		g_mutex_lock(&ring->mutex);
+		g_atomic_int_set(&ring->waiting, TRUE);
+		/* Re-check, the producer may have pushed in the meantime. */
+		if ((unsigned int)g_atomic_int_get(&ring->head) == tail)
+			g_cond_wait_until(&ring->cond, &ring->mutex,
+				g_get_monotonic_time() + timeout_us);
+		g_atomic_int_set(&ring->waiting, FALSE);
+		g_mutex_unlock(&ring->mutex);
+		if ((unsigned int)g_atomic_int_get(&ring->head) == tail)
+			return FALSE;
+	}
+
+	*entry = ring->entries[tail & (ring->size - 1)];
+	g_atomic_int_set(&ring->tail, tail + 1);
+
+	return TRUE;
+}
+
+/* Producer side. Drops sample data if the ring is full. */
+static int ring_send(struct packet_ring *ring, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, uint64_t *overruns,
+		unsigned int *max_used)
+{
+	struct sr_datafeed_packet *copy;
+	unsigned int used;
+
+	if ((used = ring_used(ring)) > *max_used)
+		*max_used = used;
+
+	if (used == ring->size
+	    && (packet->type == SR_DF_LOGIC || packet->type == SR_DF_ANALOG
+	    || packet->type == SR_DF_LOGIC_RLE
+	    || packet->type == SR_DF_LOGIC_EDGES
+	    || packet->type == SR_DF_ANALOG_RAW)) {
+		/* Consumers can't keep up, drop the sample data. */
+		(*overruns)++;
+		sr_spew("Datafeed queue full, dropping packet.");
+		return SR_OK;
+	}
+
+	if (!(copy = sr_packet_copy(packet)))
+		return SR_ERR_MALLOC;
+
+	/*
+	 * Everything else must not be lost, wait for the consumer
+	 * to make room.
+	 */
+	while (!ring_push(ring, sdi, copy))
+		g_usleep(100);
+
+	return SR_OK;
+}
+
+/* Consumer side. Runs until the ring is shut down and empty. */
+static void ring_consume(struct packet_ring *ring, sr_datafeed_callback_t cb,
+		void *cb_data)
+{
+	struct queue_entry entry;
+
+	while (TRUE) {
+		if (!ring_pop(ring, &entry, QUEUE_POLL_TIMEOUT_US)) {
+			/* Only stop once everything got delivered. */
+			if (g_atomic_int_get(&ring->shutdown))
+				break;
+			continue;
+		}
+		g_private_set(&cur_buffer, sr_packet_buffer_get(entry.packet));
+		cb(entry.sdi, entry.packet, cb_data);
+		g_private_set(&cur_buffer, NULL);
+		sr_packet_free(entry.packet);
+	}
+}
+
+static void queue_dispatch(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	datafeed_dispatch(cb_data, sdi, packet);
+}
+
+static gpointer queue_thread(gpointer data)
+{
+	struct sr_session *session;
+	struct sr_thread_state *state;
+
+	session = data;
+	state = sr_thread_tune(session->ctx);
+	ring_consume(session->queue, queue_dispatch, session);
+	sr_thread_restore(state);
+
+	return NULL;
+}
+
+/* Call a datafeed callback, and keep track of how long it took. */
+static void callback_call(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	struct datafeed_callback *cb_struct;
+	struct sr_callback_stats *stats;
+	struct sr_stage_timer timer;
+	int64_t start;
+	uint64_t us;
+	int bucket;
+
+	cb_struct = cb_data;
+	stats = &cb_struct->stats;
+
+	SR_TRACE2(callback_enter, cb_struct->cb, packet->type);
+	sr_stage_begin(cb_struct->session, &timer);
+	start = g_get_monotonic_time();
+	cb_struct->cb(sdi, packet, cb_struct->cb_data);
+	us = g_get_monotonic_time() - start;
+	stats->self_us += sr_stage_end(cb_struct->session, &timer, NULL, NULL,
+				       0);
+	SR_TRACE3(callback_exit, cb_struct->cb, packet->type, us);
+
+	stats->calls++;
+	stats->samples += sr_packet_samples(packet);
+	stats->total_us += us;
+	stats->max_us = MAX(stats->max_us, us);
+	for (bucket = 0; us && bucket < SR_STATS_HISTOGRAM_SIZE - 1; bucket++)
+		us >>= 1;
+	stats->histogram[bucket]++;
+}
+
+static struct bcast_ring *bcast_new(unsigned int depth,
+		unsigned int num_readers)
+{
+	struct bcast_ring *ring;
+	unsigned int size;
+
+	for (size = 1; size < depth; size <<= 1);
+
+	if (!(ring = g_try_malloc0(sizeof(struct bcast_ring))))
+		return NULL;
+
+	ring->entries = g_try_malloc(sizeof(struct bcast_entry) * size);
+	ring->cursors = g_try_malloc0(sizeof(struct bcast_cursor)
+			* num_readers);
+	ring->callbacks = g_try_malloc0(sizeof(struct datafeed_callback *)
+			* num_readers);
+	if (!ring->entries || !ring->cursors || !ring->callbacks) {
+		g_free(ring->entries);
+		g_free(ring->cursors);
+		g_free(ring->callbacks);
+		g_free(ring);
+		return NULL;
+	}
+
+	ring->size = size;
+	ring->num_readers = num_readers;
+	g_mutex_init(&ring->mutex);
+	g_cond_init(&ring->cond);
+
+	return ring;
+}
+
+/* How far a reader is behind the producer. */
+static unsigned int bcast_lag(struct bcast_ring *ring, unsigned int reader)
+{
+	return (unsigned int)g_atomic_int_get(&ring->head) - (unsigned int)
+			g_atomic_int_get(&ring->cursors[reader].tail);
+}
+
+/* Producer side. The slowest reader decides how much is in use. */
+static unsigned int bcast_used(struct bcast_ring *ring)
+{
+	unsigned int used, r;
+
+	used = 0;
+	for (r = 0; r < ring->num_readers; r++)
+		used = MAX(used, bcast_lag(ring, r));
+
+	return used;
+}
+
+/* Only once the readers are gone. */
+static void bcast_free(struct bcast_ring *ring)
+{
+	struct bcast_entry *entry;
+	unsigned int i;
+
+	/* Anything left over was never delivered by some reader. */
+	for (i = ring->head - bcast_used(ring); i != (unsigned int)ring->head;
+	     i++) {
+		entry = &ring->entries[i & (ring->size - 1)];
+		if (entry->refs > 0)
+			sr_packet_free(entry->packet);
+	}
+
+	g_mutex_clear(&ring->mutex);
+	g_cond_clear(&ring->cond);
+	g_free(ring->entries);
+	g_free(ring->cursors);
+	g_free(ring->callbacks);
+	g_free(ring);
+}
+
+/* Producer side. Returns FALSE if the ring is full. */
+static gboolean bcast_push(struct bcast_ring *ring,
+		const struct sr_dev_inst *sdi,
+		struct sr_datafeed_packet *packet, guint64 readers)
+{
+	struct bcast_entry *entry;
+	unsigned int head;
+
+	if (bcast_used(ring) == ring->size)
+		return FALSE;
+
+	head = g_atomic_int_get(&ring->head);
+	entry = &ring->entries[head & (ring->size - 1)];
+	entry->sdi = sdi;
+	entry->packet = packet;
+	entry->readers = readers;
+	entry->refs = __builtin_popcountll(readers);
+	/* Publish the entry only after it has been completely written. */
+	g_atomic_int_set(&ring->head, head + 1);
+
+	if (g_atomic_int_get(&ring->waiting)) {
+		g_mutex_lock(&ring->mutex);
+		g_cond_broadcast(&ring->cond);
+		g_mutex_unlock(&ring->mutex);
+	}
+
+	return TRUE;
+}
+
+/*
+ * Producer side. Puts a packet on the ring for the given readers, unless
+ * it's full: then sample data is dropped, counted as an overrun of every
+ * one of them, or the producer waits for room if the ring blocks.
+ */
+static void bcast_send(struct bcast_ring *ring, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, guint64 readers)
+{
+	struct datafeed_callback *cb_struct;
+	struct sr_datafeed_packet *copy;
+	unsigned int used, r;
+	gboolean full;
+
+	full = FALSE;
+	for (r = 0; r < ring->num_readers; r++) {
+		used = bcast_lag(ring, r);
+		full = full || used == ring->size;
+		if (!(readers & ((guint64)1 << r)))
+			continue;
+		cb_struct = ring->callbacks[r];
+		cb_struct->max_used = MAX(cb_struct->max_used, used);
+	}
+
+	if (full && !ring->block
+	    && (packet->type == SR_DF_LOGIC || packet->type == SR_DF_ANALOG
+	    || packet->type == SR_DF_LOGIC_RLE
+	    || packet->type == SR_DF_LOGIC_EDGES
+	    || packet->type == SR_DF_ANALOG_RAW)) {
+		/* A consumer can't keep up, drop the sample data. */
+		for (r = 0; r < ring->num_readers; r++)
+			if (readers & ((guint64)1 << r))
+				ring->callbacks[r]->overruns++;
+		sr_spew("Datafeed queue full, dropping packet.");
+		return;
+	}
+
+	if (!(copy = sr_packet_copy(packet)))
+		return;
+
+	/* Everything else must not be lost, wait for the readers. */
+	while (!bcast_push(ring, sdi, copy, readers))
+		g_usleep(100);
+}
+
+/* Producer side. Put the shared packet on the ring, if it's pending. */
+static void bcast_flush(struct bcast_ring *ring)
+{
+	if (!ring->pending)
+		return;
+
+	bcast_send(ring, ring->shared_sdi, ring->shared, ring->pending);
+	ring->pending = 0;
+}
+
+/* Producer side. Send a packet on to one callback's thread. */
+static void bcast_queue(struct bcast_ring *ring,
+		struct datafeed_callback *cb_struct,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	guint64 bit;
+
+	bit = (guint64)1 << cb_struct->reader;
+	if (packet == ring->shared && sdi == ring->shared_sdi) {
+		/* Written once for all, when the dispatch is done. */
+		ring->pending |= bit;
+		return;
+	}
+
+	/* The reader must get what it was sent so far first. */
+	if (ring->pending & bit)
+		bcast_flush(ring);
+	bcast_send(ring, sdi, packet, bit);
+}
+
+/* Consumer side. Runs until the ring is shut down and empty. */
+static void bcast_consume(struct bcast_ring *ring, unsigned int reader,
+		sr_datafeed_callback_t cb, void *cb_data)
+{
+	struct bcast_entry *entry;
+	struct sr_datafeed_packet *packet;
+	unsigned int tail;
+	guint64 bit;
+
+	bit = (guint64)1 << reader;
+	tail = ring->cursors[reader].tail;
+	while (TRUE) {
+		if ((unsigned int)g_atomic_int_get(&ring->head) == tail) {
+			g_mutex_lock(&ring->mutex);
+			g_atomic_int_inc(&ring->waiting);
+			/* Re-check, the producer may have pushed meanwhile. */
+			if ((unsigned int)g_atomic_int_get(&ring->head) == tail)
+				g_cond_wait_until(&ring->cond, &ring->mutex,
+					g_get_monotonic_time()
+					+ QUEUE_POLL_TIMEOUT_US);
+			g_atomic_int_add(&ring->waiting, -1);
+			g_mutex_unlock(&ring->mutex);
+			if ((unsigned int)g_atomic_int_get(&ring->head)
+			    == tail) {
+				/* Only stop once everything got delivered. */
+				if (g_atomic_int_get(&ring->shutdown))
+					break;
+				continue;
+			}
+		}
+
+		entry = &ring->entries[tail & (ring->size - 1)];
+		if (entry->readers & bit) {
+			packet = entry->packet;
+			g_private_set(&cur_buffer,
+				      sr_packet_buffer_get(packet));
+			cb(entry->sdi, packet, cb_data);
+			g_private_set(&cur_buffer, NULL);
+			if (g_atomic_int_dec_and_test(&entry->refs))
+				sr_packet_free(packet);
+		}
+		/* The slot may be reused from here on. */
+		g_atomic_int_set(&ring->cursors[reader].tail, ++tail);
+	}
+}
+
+static gpointer callback_thread(gpointer data)
+{
+	struct datafeed_callback *cb_struct;
+	struct sr_thread_state *state;
+
+	cb_struct = data;
+	state = sr_thread_tune(cb_struct->ctx);
+	bcast_consume(cb_struct->bcast, cb_struct->reader, callback_call,
+		      cb_struct);
+	sr_thread_restore(state);
+
+	return NULL;
+}
+
+static void ring_stop(struct packet_ring *ring, GThread *thread)
+{
+	/* Let the thread deliver whatever is still queued, then end it. */
+	g_atomic_int_set(&ring->shutdown, TRUE);
+	g_thread_join(thread);
+	ring_free(ring);
+}
+
+static int queue_start(struct sr_session *session)
+{
+	GError *error;
+
+	session->queue_overruns = 0;
+	session->queue_max_used = 0;
+
+	if (!(session->queue = ring_new(session->queue_depth))) {
+		sr_err("%s: queue malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	error = NULL;
+	session->queue_thread = g_thread_try_new("sr-datafeed", queue_thread,
+			session, &error);
+	if (!session->queue_thread) {
+		sr_err("Failed to start datafeed thread: %s.", error->message);
+		g_error_free(error);
+		ring_free(session->queue);
+		session->queue = NULL;
+		return SR_ERR;
+	}
+
+	sr_dbg("Datafeed queue started, %u entries.", session->queue->size);
+
+	return SR_OK;
+}
+
+static void queue_stop(struct sr_session *session)
+{
+	if (!session->queue)
+		return;
+
+	ring_stop(session->queue, session->queue_thread);
+	session->queue = NULL;
+	session->queue_thread = NULL;
+
+	sr_dbg("Datafeed queue stopped, %" PRIu64 " overruns, "
+	       "at most %u entries used.", session->queue_overruns,
+	       session->queue_max_used);
+}
+
+static void workers_stop(struct sr_session *session)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+
+	if (!session->bcast)
+		return;
+
+	/* Let the threads deliver whatever is still queued, then end them. */
+	g_atomic_int_set(&session->bcast->shutdown, TRUE);
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		if (!cb_struct->thread)
+			continue;
+		g_thread_join(cb_struct->thread);
+		cb_struct->bcast = NULL;
+		cb_struct->thread = NULL;
+	}
+	bcast_free(session->bcast);
+	session->bcast = NULL;
+
+	session->workers_running = FALSE;
+}
+
+/*
+ * Give every datafeed callback a thread of its own, all of them reading
+ * one broadcast ring.
+ */
+static int workers_start(struct sr_session *session)
+{
+	GSList *l;
+	GError *error;
+	struct datafeed_callback *cb_struct;
+	unsigned int depth, num_callbacks, i;
+
+	if (session->queue_depth)
+		depth = session->queue_depth;
+	else if (session->profile == SR_PROFILE_LOW_LATENCY)
+		depth = LOW_LATENCY_WORKER_DEPTH;
+	else if (session->profile == SR_PROFILE_THROUGHPUT)
+		depth = THROUGHPUT_WORKER_DEPTH;
+	else
+		depth = DEFAULT_WORKER_DEPTH;
+
+	num_callbacks = g_slist_length(session->datafeed_callbacks);
+	if (num_callbacks > MAX_WORKERS) {
+		sr_err("Threaded dispatch supports at most %d callbacks.",
+		       MAX_WORKERS);
+		return SR_ERR;
+	}
+
+	if (!(session->bcast = bcast_new(depth, num_callbacks))) {
+		sr_err("%s: queue malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	session->bcast->block = session->dispatch_blocking;
+
+	for (i = 0, l = session->datafeed_callbacks; l; i++, l = l->next) {
+		cb_struct = l->data;
+		cb_struct->overruns = 0;
+		cb_struct->max_used = 0;
+		cb_struct->ctx = session->ctx;
+		cb_struct->bcast = session->bcast;
+		cb_struct->reader = i;
+		session->bcast->callbacks[i] = cb_struct;
+		error = NULL;
+		cb_struct->thread = g_thread_try_new("sr-callback",
+				callback_thread, cb_struct, &error);
+		if (!cb_struct->thread) {
+			sr_err("Failed to start callback thread: %s.",
+			       error->message);
+			g_error_free(error);
+			cb_struct->bcast = NULL;
+			workers_stop(session);
+			return SR_ERR;
+		}
+	}
+
+	session->workers_running = TRUE;
+	sr_dbg("Started %u callback threads, %u queue entries.",
+	       num_callbacks, session->bcast->size);
+
+	return SR_OK;
+}
+
+static void edge_state_free(gpointer data)
+{
+	struct edge_state *state;
+
+	state = data;
+	sr_edge_conv_free(state->conv);
+	g_free(state);
+}
+
+static void dev_state_free(gpointer data)
+{
+	struct dev_state *state;
+
+	state = data;
+	g_slist_free_full(state->analog, g_free);
+	g_free(state->limit_counts);
+	g_free(state->planar_buf);
+	g_free(state);
+}
+
+static void frame_history_free(struct sr_session *session, gpointer data)
+{
+	struct frame_history *hist;
+	struct frame_slot *slot;
+	unsigned int i, j;
+
+	hist = data;
+	for (i = 0; hist->slots && i < session->frame_history_size; i++) {
+		slot = &hist->slots[i];
+		for (j = 0; j < slot->probes_size; j++)
+			g_free(slot->frame.probes[j].data);
+		g_free(slot->frame.probes);
+		g_free(slot->data_sizes);
+	}
+	g_free(hist->slots);
+	g_free(hist);
+}
+
+static void frame_histories_free(struct sr_session *session)
+{
+	GSList *l;
+
+	for (l = session->frame_histories; l; l = l->next)
+		frame_history_free(session, l->data);
+	g_slist_free(session->frame_histories);
+	session->frame_histories = NULL;
+}
+
+static void decim_state_free(gpointer data)
+{
+	struct decim_state *state;
+
+	state = data;
+	g_free(state->logic_and);
+	g_slist_free(state->analog.probes);
+	g_free(state->analog_min);
+	g_free(state->out);
+	g_free(state);
+}
+
+static void chunk_state_free(gpointer data)
+{
+	struct chunk_state *state;
+
+	state = data;
+	g_free(state->logic_buf);
+	g_slist_free(state->analog.probes);
+	g_free(state->analog_buf);
+	g_free(state);
+}
+
+static void transform_free(gpointer data)
+{
+	struct sr_transform *t;
+
+	t = data;
+	if (t->format->cleanup)
+		t->format->cleanup(t);
+	if (t->param)
+		g_hash_table_unref(t->param);
+	g_free(t);
+}
+
+static void datafeed_callback_free(gpointer data)
+{
+	struct datafeed_callback *cb_struct;
+
+	cb_struct = data;
+	g_slist_free_full(cb_struct->decim_states, decim_state_free);
+	g_slist_free_full(cb_struct->chunk_states, chunk_state_free);
+	g_free(cb_struct->planar_buf);
+	if (cb_struct->destroy)
+		cb_struct->destroy(cb_struct->cb_data);
+	g_free(cb_struct);
+}
+
+/**
+ * Create a new session.
+ *
+ * Any number of sessions can exist at the same time. Each one is started
+ * and run by a thread of its own, independent of the others.
+ *
+ * @return A pointer to the newly allocated session, or NULL upon errors.
+ */
+SR_API struct sr_session *sr_session_new(void)
+{
+	struct sr_session *session;
+
+	if (!(session = g_try_malloc0(sizeof(struct sr_session)))) {
+		sr_err("Session malloc failed.");
+		return NULL;
+	}
+
+	session->running = FALSE;
+	session->abort_session = FALSE;
+	/* The wakeup pipe's entry follows the sources'. */
+	if (!(session->pollfds = g_try_new0(GPollFD, 1))) {
+		sr_err("Session pollfds malloc failed.");
+		g_free(session);
+		return NULL;
+	}
+	session->wake_fds[0] = session->wake_fds[1] = -1;
+#ifndef _WIN32
+	/* Not fatal, stopping then waits for the poll timeout. */
+	if (pipe(session->wake_fds) == 0) {
+		fcntl(session->wake_fds[0], F_SETFL, O_NONBLOCK);
+		fcntl(session->wake_fds[1], F_SETFL, O_NONBLOCK);
+	} else {
+		sr_warn("Failed to create the session's wakeup pipe.");
+		session->wake_fds[0] = session->wake_fds[1] = -1;
+	}
+#endif
+	g_mutex_init(&session->sources_mutex);
+	g_mutex_init(&session->dev_mutex);
+	g_mutex_init(&session->stage_mutex);
+	g_mutex_init(&session->frame_mutex);
+	/* Not fatal, buffers are then simply allocated as needed. */
+	session->buffer_pool = sr_buffer_pool_new();
+	session->deferred = g_async_queue_new();
+
+	return session;
+}
+
+/**
+ * Destroy a session.
+ *
+ * This frees up all memory used by the session.
+ *
+ * @param session The session to destroy. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL.
+ */
+SR_API int sr_session_destroy(struct sr_session *session)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (session->gsource)
+		g_source_destroy(session->gsource);
+	sr_session_dev_remove_all(session);
+	queue_stop(session);
+	workers_stop(session);
+	/* Their data may hold on to the session's, like a flight recorder. */
+	g_slist_free_full(session->datafeed_callbacks, datafeed_callback_free);
+	g_slist_free_full(session->transforms, transform_free);
+	if (session->pull_queue)
+		ring_free(session->pull_queue);
+
+	/* TODO: Error checks needed? */
+
+	if (session->wake_fds[0] >= 0) {
+		close(session->wake_fds[0]);
+		close(session->wake_fds[1]);
+	}
+	g_mutex_clear(&session->sources_mutex);
+	g_mutex_clear(&session->dev_mutex);
+	g_slist_free_full(session->stages, g_free);
+	g_mutex_clear(&session->stage_mutex);
+	frame_histories_free(session);
+	g_mutex_clear(&session->frame_mutex);
+	g_free(session->sources);
+	g_free(session->pollfds);
+	g_free(session->timers);
+	g_free(session->ready);
+	g_free(session->rle_buf);
+	g_free(session->analog_buf);
+	deferred_drain(session);
+	g_slist_free_full(session->edge_states, edge_state_free);
+	g_slist_free_full(session->dev_states, dev_state_free);
+	g_async_queue_unref(session->deferred);
+	if (session->buffer_pool)
+		sr_buffer_pool_destroy(session->buffer_pool);
+
+	if (g_private_get(&cur_session) == session)
+		g_private_set(&cur_session, NULL);
+	g_free(session);
+
+	return SR_OK;
+}
+
+/**
+ * Remove all the devices from a session.
+ *
+ * The session itself (i.e., the struct sr_session) is not free'd and still
+ * exists after this function returns.
+ *
+ * @param session The session. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL.
+ */
+SR_API int sr_session_dev_remove_all(struct sr_session *session)
+{
+	struct sr_dev_inst *sdi;
+	GSList *l;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	for (l = session->devs; l; l = l->next) {
+		sdi = l->data;
+		sr_dev_mem_session_set(sdi, NULL);
+	}
+	g_slist_free(session->devs);
+	session->devs = NULL;
+
+	/* The triggers were for one of them. */
+	sr_session_trigger_set(session, NULL, NULL);
+	sr_session_analog_trigger_set(session, NULL, NULL, NULL);
+
+	return SR_OK;
+}
+
+/**
+ * Add a device instance to a session.
+ *
+ * A device instance can only be part of one session at a time.
+ *
+ * @param session The session. Must not be NULL.
+ * @param sdi The device instance to add to the session. Must not
+ *            be NULL. Also, sdi->driver and sdi->driver->dev_open must
+ *            not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ */
+SR_API int sr_session_dev_add(struct sr_session *session,
+		struct sr_dev_inst *sdi)
+{
+	int ret;
+
+	if (!sdi) {
+		sr_err("%s: sdi was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (sdi->session) {
+		sr_err("%s: device already is in a session", __func__);
+		return SR_ERR_ARG;
+	}
+	sr_dev_mem_session_set(sdi, session);
+	/* Drivers and input modules are done adding probes by now. */
+	sr_dev_probe_table_invalidate(sdi);
+
+	/* If sdi->driver is NULL, this is a virtual device. */
+	if (!sdi->driver) {
+		sr_dbg("%s: sdi->driver was NULL, this seems to be "
+		       "a virtual device; continuing", __func__);
+		/* Just add the device, don't run dev_open(). */
+		session->devs = g_slist_append(session->devs, (gpointer)sdi);
+		return SR_OK;
+	}
+
+	/* sdi->driver is non-NULL (i.e. we have a real device). */
+	if (!sdi->driver->dev_open) {
+		sr_err("%s: sdi->driver->dev_open was NULL", __func__);
+		sr_dev_mem_session_set(sdi, NULL);
+		return SR_ERR_BUG;
+	}
+
+	session->devs = g_slist_append(session->devs, (gpointer)sdi);
+
+	if (session->running) {
+		/* Adding a device to a running session. Start acquisition
+		 * on that device now. */
+		g_private_set(&cur_session, session);
+		if ((ret = sdi->driver->dev_acquisition_start(sdi,
+						(void *)sdi)) != SR_OK)
+			sr_err("Failed to start acquisition of device in "
+					"running session: %d", ret);
+	}
+
+	return SR_OK;
+}
+
+/**
+ * List all device instances attached to a session.
+ *
+ * @param session The session. Must not be NULL.
+ * @param devlist A pointer where the device instance list will be
+ *                stored on return. If no devices are in the session,
+ *                this will be NULL. Each element in the list points
+ *                to a struct sr_dev_inst *.
+ *                The list must be freed by the caller, but not the
+ *                elements pointed to.
+ *
+ * @return SR_OK upon success, SR_ERR upon invalid arguments.
+ */
+SR_API int sr_session_dev_list(struct sr_session *session, GSList **devlist)
+{
+
+	*devlist = NULL;
+
+	if (!session)
+		return SR_ERR;
+
+	*devlist = g_slist_copy(session->devs);
+
+	return SR_OK;
+}
+
+/**
+ * Remove all datafeed callbacks in a session.
+ *
+ * @param session The session. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL.
+ */
+SR_API int sr_session_datafeed_callback_remove_all(struct sr_session *session)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	/* The callback threads must not outlive their callbacks. */
+	queue_stop(session);
+	workers_stop(session);
+
+	g_slist_free_full(session->datafeed_callbacks, datafeed_callback_free);
+	session->datafeed_callbacks = NULL;
+
+	return SR_OK;
+}
+
+/**
+ * Add a datafeed callback to a session.
+ *
+ * @param session The session. Must not be NULL.
+ * @param cb Function to call when a chunk of data is received.
+ *           Must not be NULL.
+ * @param cb_data Opaque pointer passed in by the caller.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL.
+ */
+SR_API int sr_session_datafeed_callback_add(struct sr_session *session,
+		sr_datafeed_callback_t cb, void *cb_data)
+{
+	return sr_session_datafeed_callback_add_full(session, cb, cb_data,
+			NULL);
+}
+
+/**
+ * Add a datafeed callback to a session, which owns its data.
+ *
+ * This works like sr_session_datafeed_callback_add(), and destroy is
+ * called on cb_data when the callback is removed, or the session is
+ * destroyed.
+ *
+ * @param session The session. Must not be NULL.
+ * @param cb Function to call when a chunk of data is received.
+ *           Must not be NULL.
+ * @param cb_data Opaque pointer passed in by the caller.
+ * @param destroy Function to free cb_data with, or NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_datafeed_callback_add_full(struct sr_session *session,
+		sr_datafeed_callback_t cb, void *cb_data,
+		GDestroyNotify destroy)
+{
+	struct datafeed_callback *cb_struct;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (!cb) {
+		sr_err("%s: cb was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!(cb_struct = g_try_malloc0(sizeof(struct datafeed_callback))))
+		return SR_ERR_MALLOC;
+
+	cb_struct->cb = cb;
+	cb_struct->cb_data = cb_data;
+	cb_struct->destroy = destroy;
+	cb_struct->session = session;
+
+	session->datafeed_callbacks =
+	    g_slist_append(session->datafeed_callbacks, cb_struct);
+
+	return SR_OK;
+}
+
+/**
+ * Set whether a datafeed callback takes run-length encoded logic data.
+ *
+ * Drivers may send logic data as SR_DF_LOGIC_RLE packets. Callbacks which
+ * enable this get those packets as they are; for all others, the data is
+ * expanded and sent as SR_DF_LOGIC packets, which is the default.
+ *
+ * @param session The session. Must not be NULL.
+ * @param cb The callback, as passed to sr_session_datafeed_callback_add().
+ * @param cb_data The callback data, as passed to
+ *                sr_session_datafeed_callback_add().
+ * @param enable TRUE to get SR_DF_LOGIC_RLE packets, FALSE to get
+ *               SR_DF_LOGIC packets only.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR_ARG
+ *         if there is no such callback.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_datafeed_callback_rle_set(struct sr_session *session,
+		sr_datafeed_callback_t cb, void *cb_data, gboolean enable)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		if (cb_struct->cb == cb && cb_struct->cb_data == cb_data) {
+			cb_struct->rle = enable;
+			return SR_OK;
+		}
+	}
+
+	sr_err("%s: no such callback", __func__);
+
+	return SR_ERR_ARG;
+}
+
+/**
+ * Set whether a datafeed callback gets logic data as a list of edges.
+ *
+ * Callbacks which enable this get all logic data (SR_DF_LOGIC and
+ * SR_DF_LOGIC_RLE packets) as SR_DF_LOGIC_EDGES packets instead, which
+ * only hold the transitions. This is cheaper for consumers that only care
+ * about those, when the signals change rarely compared to the samplerate.
+ *
+ * @param session The session. Must not be NULL.
+ * @param cb The callback, as passed to sr_session_datafeed_callback_add().
+ * @param cb_data The callback data, as passed to
+ *                sr_session_datafeed_callback_add().
+ * @param enable TRUE to get SR_DF_LOGIC_EDGES packets, FALSE to get the
+ *               logic data as it was sent.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR_ARG
+ *         if there is no such callback.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_datafeed_callback_edges_set(struct sr_session *session,
+		sr_datafeed_callback_t cb, void *cb_data, gboolean enable)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		if (cb_struct->cb == cb && cb_struct->cb_data == cb_data) {
+			cb_struct->edges = enable;
+			return SR_OK;
+		}
+	}
+
+	sr_err("%s: no such callback", __func__);
+
+	return SR_ERR_ARG;
+}
+
+/**
+ * Set whether a datafeed callback takes raw analog data.
+ *
+ * Drivers may send analog data in the native integer format of the
+ * device, as SR_DF_ANALOG_RAW packets. Callbacks which enable this get
+ * those packets as they are, and can keep or forward the data in that
+ * compact form. For all others the data is converted and sent as
+ * SR_DF_ANALOG packets, which is the default.
+ *
+ * @param session The session. Must not be NULL.
+ * @param cb The callback, as passed to sr_session_datafeed_callback_add().
+ * @param cb_data The callback data, as passed to
+ *                sr_session_datafeed_callback_add().
+ * @param enable TRUE to get SR_DF_ANALOG_RAW packets, FALSE to get
+ *               SR_DF_ANALOG packets only.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR_ARG
+ *         if there is no such callback.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_datafeed_callback_analog_raw_set(
+		struct sr_session *session, sr_datafeed_callback_t cb,
+		void *cb_data, gboolean enable)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		if (cb_struct->cb == cb && cb_struct->cb_data == cb_data) {
+			cb_struct->analog_raw = enable;
+			return SR_OK;
+		}
+	}
+
+	sr_err("%s: no such callback", __func__);
+
+	return SR_ERR_ARG;
+}
+
+/**
+ * Set whether a datafeed callback gets analog data in planar layout.
+ *
+ * The data of SR_DF_ANALOG packets is normally interleaved according to
+ * the probes list: the first sample of every probe, then the second of
+ * every probe, and so on. Callbacks which enable this get all samples of
+ * the packet's first probe instead, followed by all samples of its second
+ * probe, and so on, so a consumer working on one probe at a time (like a
+ * measurement or an FFT) finds each probe's samples in one array.
+ *
+ * Only this callback is affected; the data is transposed for it after
+ * decimation and packet sizing, if those are enabled too. This applies
+ * to SR_DF_ANALOG_RAW packets converted for the callback as well.
+ *
+ * @param session The session. Must not be NULL.
+ * @param cb The callback, as passed to sr_session_datafeed_callback_add().
+ * @param cb_data The callback data, as passed to
+ *                sr_session_datafeed_callback_add().
+ * @param enable TRUE to get planar analog data, FALSE to get it
+ *               interleaved.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR_ARG
+ *         if there is no such callback.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_datafeed_callback_planar_set(
+		struct sr_session *session, sr_datafeed_callback_t cb,
+		void *cb_data, gboolean enable)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		if (cb_struct->cb == cb && cb_struct->cb_data == cb_data) {
+			cb_struct->planar = enable;
+			return SR_OK;
+		}
+	}
+
+	sr_err("%s: no such callback", __func__);
+
+	return SR_ERR_ARG;
+}
+
+/**
+ * Set whether a datafeed callback gets decimated logic and analog data.
+ *
+ * This is meant for live displays, which only need a few thousand points
+ * per screen. Every block of factor samples is reduced to two: for logic
+ * data the AND and the OR of the block's samples, so a probe which was
+ * high and low in it shows as both; for analog data the minimum and the
+ * maximum of each probe. Blocks can span packets; the partial block
+ * left at the end of the acquisition is sent before SR_DF_END.
+ *
+ * Only this callback is affected, all others keep getting the data at
+ * full rate. SR_DF_LOGIC_RLE, SR_DF_LOGIC_EDGES and SR_DF_ANALOG_RAW
+ * packets, if the callback takes them, are passed on as they are.
+ *
+ * @param session The session. Must not be NULL.
+ * @param cb The callback, as passed to sr_session_datafeed_callback_add().
+ * @param cb_data The callback data, as passed to
+ *                sr_session_datafeed_callback_add().
+ * @param factor The number of samples per block, 0 or 1 to get the data
+ *               at full rate again.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR_ARG
+ *         if there is no such callback.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_datafeed_callback_decimate_set(
+		struct sr_session *session, sr_datafeed_callback_t cb,
+		void *cb_data, uint64_t factor)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		if (cb_struct->cb == cb && cb_struct->cb_data == cb_data) {
+			cb_struct->decimate = factor;
+			g_slist_free_full(cb_struct->decim_states,
+					decim_state_free);
+			cb_struct->decim_states = NULL;
+			return SR_OK;
+		}
+	}
+
+	sr_err("%s: no such callback", __func__);
+
+	return SR_ERR_ARG;
+}
+
+/**
+ * Set the size of the logic and analog packets a datafeed callback gets.
+ *
+ * Drivers and inputs send packets of whatever size suits them, from single
+ * samples to megabytes. A callback with a preferred size gets its data in
+ * packets of that many bytes instead: larger ones are split, and smaller
+ * ones held back until there is enough. Held back data is passed on
+ * early when the next packet of the device doesn't follow on from it, or
+ * isn't logic or analog data, and when it's been held for the given
+ * latency. That is checked as further packets arrive and, unless the
+ * session has a packet queue (see sr_session_queue_depth_set()), by the
+ * session's event loop as well.
+ *
+ * Only the data this callback gets is affected, after decimation if that
+ * is enabled too. Analog packets with timestamps of their own, and all
+ * other packet types, are passed on as they are.
+ *
+ * @param session The session. Must not be NULL.
+ * @param cb The callback, as passed to sr_session_datafeed_callback_add().
+ * @param cb_data The callback data, as passed to
+ *                sr_session_datafeed_callback_add().
+ * @param size The packet size in bytes, rounded down to whole samples
+ *             (of at least one), or 0 to get the packets as they are sent.
+ * @param latency_ms How long data may be held back at most, or 0 for
+ *                   as long as it takes to fill a packet.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR_ARG
+ *         if there is no such callback, or SR_ERR if the session is
+ *         running.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_datafeed_callback_packet_size_set(
+		struct sr_session *session, sr_datafeed_callback_t cb,
+		void *cb_data, uint64_t size, unsigned int latency_ms)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (session->running) {
+		sr_err("Cannot change the packet size while running.");
+		return SR_ERR;
+	}
+
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		if (cb_struct->cb == cb && cb_struct->cb_data == cb_data) {
+			cb_struct->chunk_size = size;
+			cb_struct->chunk_latency = (int64_t)latency_ms * 1000;
+			g_slist_free_full(cb_struct->chunk_states,
+					chunk_state_free);
+			cb_struct->chunk_states = NULL;
+			return SR_OK;
+		}
+	}
+
+	sr_err("%s: no such callback", __func__);
+
+	return SR_ERR_ARG;
+}
+
+/**
+ * Add a transform to a session.
+ *
+ * Transforms see every packet on the datafeed, in the order they were
+ * added, before the datafeed callbacks do. Each one may pass packets on
+ * unchanged, modified, or not at all, so work like filtering out probes
+ * is done once for all callbacks.
+ *
+ * @param session The session to use. Must not be NULL.
+ * @param format The transform module to use, see sr_transform_list().
+ *               Must not be NULL.
+ * @param params Options for the module, a hash table of strings keyed
+ *               by option name. Can be NULL. A reference to it is kept
+ *               as long as the transform exists.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR_ARG
+ *         upon invalid arguments, SR_ERR if the session is running,
+ *         SR_ERR_MALLOC upon memory allocation errors, or the error
+ *         returned by the module's init function.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_transform_add(struct sr_session *session,
+		struct sr_transform_format *format, GHashTable *params)
+{
+	struct sr_transform *t;
+	int ret;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (!format || !format->receive) {
+		sr_err("%s: format was NULL or incomplete", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (session->running) {
+		sr_err("Cannot add a transform while running.");
+		return SR_ERR;
+	}
+
+	if (!(t = g_try_malloc0(sizeof(struct sr_transform)))) {
+		sr_err("%s: t malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	t->format = format;
+	t->session = session;
+	t->param = params ? g_hash_table_ref(params) : NULL;
+
+	if (format->init && (ret = format->init(t)) != SR_OK) {
+		sr_err("Transform '%s' failed to initialize.", format->id);
+		if (t->param)
+			g_hash_table_unref(t->param);
+		g_free(t);
+		return ret;
+	}
+
+	session->transforms = g_slist_append(session->transforms, t);
+
+	return SR_OK;
+}
+
+/**
+ * Remove all transforms from a session.
+ *
+ * @param session The session to use. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, or SR_ERR
+ *         if the session is running.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_transform_remove_all(struct sr_session *session)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (session->running) {
+		sr_err("Cannot remove transforms while running.");
+		return SR_ERR;
+	}
+
+	g_slist_free_full(session->transforms, transform_free);
+	session->transforms = NULL;
+
+	return SR_OK;
+}
+
+#define TIMER_DUE(pos) (session->sources[session->timers[pos]].due)
+
+static void timer_swap(struct sr_session *session, unsigned int a,
+		unsigned int b)
+{
+	unsigned int tmp;
+
+	tmp = session->timers[a];
+	session->timers[a] = session->timers[b];
+	session->timers[b] = tmp;
+	session->sources[session->timers[a]].heap_pos = a;
+	session->sources[session->timers[b]].heap_pos = b;
+}
+
+static void timer_sift_up(struct sr_session *session, unsigned int pos)
+{
+	while (pos > 0 && TIMER_DUE(pos) < TIMER_DUE((pos - 1) / 2)) {
+		timer_swap(session, pos, (pos - 1) / 2);
+		pos = (pos - 1) / 2;
+	}
+}
+
+static void timer_sift_down(struct sr_session *session, unsigned int pos)
+{
+	unsigned int child;
+
+	while ((child = 2 * pos + 1) < session->num_timers) {
+		if (child + 1 < session->num_timers
+		    && TIMER_DUE(child + 1) < TIMER_DUE(child))
+			child++;
+		if (TIMER_DUE(pos) <= TIMER_DUE(child))
+			break;
+		timer_swap(session, pos, child);
+		pos = child;
+	}
+}
+
+/* Restart the timeout of the source at the given index, if it has one. */
+static void timer_rearm(struct sr_session *session, unsigned int index,
+		int64_t now)
+{
+	struct source *s;
+
+	s = &session->sources[index];
+	if (s->heap_pos < 0)
+		return;
+	s->due = now + (int64_t)s->timeout * 1000;
+	timer_sift_down(session, s->heap_pos);
+}
+
+/* Rebuild the timer heap, after the source indices have changed. */
+static void timers_rebuild(struct sr_session *session)
+{
+	unsigned int i;
+
+	session->num_timers = 0;
+	for (i = 0; i < session->num_sources; i++) {
+		if (session->sources[i].timeout > 0) {
+			session->sources[i].heap_pos = session->num_timers;
+			session->timers[session->num_timers++] = i;
+		} else {
+			session->sources[i].heap_pos = -1;
+		}
+	}
+	for (i = session->num_timers / 2; i-- > 0; )
+		timer_sift_down(session, i);
+}
+
+/* Checked after every source callback, so it must be cheap. */
+static void check_abort(struct sr_session *session)
+{
+	if (G_LIKELY(!g_atomic_int_get(&session->abort_session)))
+		return;
+
+	/* But once is enough. */
+	if (g_atomic_int_compare_and_exchange(&session->abort_session,
+			TRUE, FALSE))
+		sr_session_stop_sync(session);
+}
+
+/* Empty the wakeup pipe, after sr_session_stop() wrote to it. */
+static void wake_drain(struct sr_session *session)
+{
+	char buf[16];
+
+	while (read(session->wake_fds[0], buf, sizeof(buf)) > 0)
+		;
+}
+
+/**
+ * Call every device in the session's callback.
+ *
+ * For sessions not driven by select loops such as sr_session_run(),
+ * but driven by another scheduler, this can be used to poll the devices
+ * from within that scheduler.
+ *
+ * Every source's timeout is tracked on its own: a source's callback is
+ * invoked when its file descriptor has an event, or when its timeout
+ * passed since the callback last ran, whatever the other sources do.
+ *
+ * @param session The session.
+ * @param block If TRUE, this call will wait for any of the session's
+ *              sources to fire an event on the file descriptors, or
+ *              any of their timeouts to activate. In other words, this
+ *              can be used as a select loop.
+ *              If FALSE, only the callbacks of sources which are ready
+ *              right away are run.
+ *
+ * @return SR_OK upon success, SR_ERR on errors.
+ */
+static int sr_session_iteration(struct sr_session *session, gboolean block)
+{
+	struct source_ready *ready;
+	struct source *s;
+	GPollFD *wake;
+	unsigned int i, index, num_ready, gen;
+	int64_t start, now, wait, due;
+	int ret, timeout;
+
+	if (session->ready_size < session->num_sources) {
+		ready = g_try_realloc(session->ready,
+				sizeof(struct source_ready) * session->num_sources);
+		if (!ready) {
+			sr_err("%s: ready list malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		session->ready = ready;
+		session->ready_size = session->num_sources;
+	}
+	ready = session->ready;
+
+	start = g_get_monotonic_time();
+	timeout = -1;
+	if (!block) {
+		timeout = 0;
+	} else if (session->num_timers) {
+		wait = TIMER_DUE(0) - start;
+		if (wait <= 0)
+			timeout = 0;
+		else
+			timeout = MIN((wait + 999) / 1000, INT_MAX);
+	}
+
+	/* Wake up in time for data the callbacks hold back, if they're ours. */
+	if (!session->queue && (due = chunk_flush_due(session)) >= 0
+	    && timeout) {
+		wait = MAX((due - start + 999) / 1000, 0);
+		timeout = timeout < 0 ? MIN(wait, INT_MAX) : MIN(timeout, wait);
+	}
+
+	/* Sources added or removed moved the wakeup pipe's entry. */
+	wake = &session->pollfds[session->num_sources];
+	wake->fd = session->wake_fds[0];
+	wake->events = G_IO_IN;
+	wake->revents = 0;
+	SR_TRACE2(poll_enter, session->num_sources, timeout);
+	ret = g_poll(session->pollfds, session->num_sources
+			+ (wake->fd >= 0), timeout);
+	now = g_get_monotonic_time();
+	SR_TRACE2(poll_exit, ret, now - start);
+	session->iterations++;
+	session->poll_us += now - start;
+	if (ret > 0 && wake->revents) {
+		wake_drain(session);
+		ret--;
+	}
+
+	/* Sources with an event, which also restarts their timeout. */
+	num_ready = 0;
+	for (i = 0; ret > 0 && i < session->num_sources; i++) {
+		if (!session->pollfds[i].revents)
+			continue;
+		ready[num_ready].index = i;
+		ready[num_ready].poll_object = session->sources[i].poll_object;
+		ready[num_ready++].revents = session->pollfds[i].revents;
+		timer_rearm(session, i, now);
+		ret--;
+	}
+
+	/* Sources whose timeout expired, earliest first. */
+	while (session->num_timers && TIMER_DUE(0) <= now) {
+		index = session->timers[0];
+		if (!session->pollfds[index].revents) {
+			ready[num_ready].index = index;
+			ready[num_ready].poll_object =
+					session->sources[index].poll_object;
+			ready[num_ready++].revents = 0;
+		}
+		timer_rearm(session, index, now);
+	}
+
+	gen = session->sources_gen;
+	for (i = 0; i < num_ready; i++) {
+		index = ready[i].index;
+		if (session->sources_gen != gen) {
+			/* A callback added or removed sources, look it up again. */
+			for (index = 0; index < session->num_sources; index++) {
+				if (session->sources[index].poll_object
+						== ready[i].poll_object)
+					break;
+			}
+			if (index == session->num_sources)
+				continue;
+		}
+		s = &session->sources[index];
+		if (!s->cb(session->pollfds[index].fd, ready[i].revents,
+				s->cb_data))
+			_sr_session_source_remove(session, ready[i].poll_object);
+		/*
+		 * We want to take as little time as possible to stop
+		 * the session if we have been told to do so. Therefore,
+		 * we check the flag after processing every source, not
+		 * just once per main event loop.
+		 */
+		check_abort(session);
+	}
+	if (num_ready)
+		session->sources_us += g_get_monotonic_time() - now;
+	else
+		check_abort(session);
+
+	return SR_OK;
+}
+
+static void stats_reset(struct sr_session *session)
+{
+	struct datafeed_callback *cb_struct;
+	struct dev_state *state;
+	GSList *l;
+
+	session->iterations = session->poll_us = session->sources_us = 0;
+
+	g_mutex_lock(&session->stage_mutex);
+	g_slist_free_full(session->stages, g_free);
+	session->stages = NULL;
+	session->run_start = g_get_monotonic_time();
+	session->run_end = 0;
+	g_mutex_unlock(&session->stage_mutex);
+
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		memset(&cb_struct->stats, 0, sizeof(cb_struct->stats));
+	}
+
+	g_mutex_lock(&session->dev_mutex);
+	for (l = session->dev_states; l; l = l->next) {
+		state = l->data;
+		memset(&state->stats, 0, sizeof(state->stats));
+	}
+	g_mutex_unlock(&session->dev_mutex);
+
+	sr_session_mem_peak_reset(session);
+}
+
+static gpointer dev_start_thread(gpointer data)
+{
+	struct dev_start *start;
+
+	start = data;
+	/* Whatever the driver sends goes through the session thread. */
+	g_private_set(&cur_session, start->session);
+	sr_session_send_defer(TRUE);
+	start->ret = start->sdi->driver->dev_acquisition_start(start->sdi,
+			start->sdi);
+
+	return NULL;
+}
+
+/* Once its sources are gone, deliver whatever a run left pending. */
+static void run_finish(struct sr_session *session)
+{
+	char *report;
+
+	deferred_drain(session);
+	queue_stop(session);
+	workers_stop(session);
+
+	session->run_end = g_get_monotonic_time();
+	if ((report = sr_session_stage_report(session))) {
+		sr_info("Stage timing:\n%s", report);
+		g_free(report);
+	}
+}
+
+/* The context of the session's devices, for the scheduling of its threads. */
+static struct sr_context *session_ctx(struct sr_session *session)
+{
+	struct sr_dev_inst *sdi;
+	struct drv_context *drvc;
+	GSList *l;
+
+	for (l = session->devs; l; l = l->next) {
+		sdi = l->data;
+		if (sdi->driver && (drvc = sdi->driver->priv))
+			return drvc->sr_ctx;
+	}
+
+	return NULL;
+}
+
+/* Run the session's sources until they're all gone. */
+static void sources_run(struct sr_session *session)
+{
+	/* Do we have real sources? */
+	if (session->num_sources == 1 && session->pollfds[0].fd == -1) {
+		/* Dummy source, freewheel over it. */
+		while (session->num_sources) {
+			session->sources[0].cb(-1, 0,
+					session->sources[0].cb_data);
+			check_abort(session);
+		}
+	} else {
+		/* Real sources, use g_poll() main loop. */
+		while (session->num_sources)
+			sr_session_iteration(session, TRUE);
+	}
+}
+
+static void session_wake(struct sr_session *session)
+{
+	/* Interrupts g_poll() right away. A full pipe already does. */
+	if (session->wake_fds[1] >= 0 && write(session->wake_fds[1], "", 1) < 0)
+		sr_spew("Wakeup pipe full.");
+}
+
+static gpointer dev_loop_thread(gpointer data)
+{
+	struct dev_loop *dl;
+	struct sr_thread_state *state;
+	int ret;
+
+	dl = data;
+	/* The device's sources go to the loop, its packets to the session. */
+	g_private_set(&cur_session, dl->loop);
+	sr_session_send_defer(TRUE);
+	state = sr_thread_tune(dl->session->ctx);
+	ret = dl->sdi->driver->dev_acquisition_start(dl->sdi, dl->sdi);
+
+	g_mutex_lock(&dl->mutex);
+	dl->ret = ret;
+	dl->started = TRUE;
+	g_cond_signal(&dl->cond);
+	g_mutex_unlock(&dl->mutex);
+
+	if (ret == SR_OK)
+		sources_run(dl->loop);
+
+	sr_thread_restore(state);
+	g_atomic_int_add(&dl->session->loops_running, -1);
+	session_wake(dl->session);
+
+	return NULL;
+}
+
+/* Wait for the device threads to end, and free their loops. */
+static void dev_loops_free(struct sr_session *session)
+{
+	struct dev_loop *dl;
+	GSList *l;
+
+	for (l = session->dev_loops; l; l = l->next) {
+		dl = l->data;
+		if (dl->thread)
+			g_thread_join(dl->thread);
+		if (dl->loop) {
+			session->iterations += dl->loop->iterations;
+			session->poll_us += dl->loop->poll_us;
+			session->sources_us += dl->loop->sources_us;
+			/* The device is still part of this session. */
+			g_slist_free(dl->loop->devs);
+			dl->loop->devs = NULL;
+			sr_session_destroy(dl->loop);
+		}
+		g_mutex_clear(&dl->mutex);
+		g_cond_clear(&dl->cond);
+		g_free(dl);
+	}
+	g_slist_free(session->dev_loops);
+	session->dev_loops = NULL;
+}
+
+/* Start every device on a thread of its own, which then runs its loop. */
+static int dev_loops_start(struct sr_session *session)
+{
+	struct dev_loop *dl;
+	struct sr_dev_inst *sdi;
+	GSList *l;
+	int ret;
+
+	ret = SR_OK;
+	for (l = session->devs; l && ret == SR_OK; l = l->next) {
+		if (!(dl = g_try_malloc0(sizeof(struct dev_loop)))) {
+			sr_err("%s: dev_loop malloc failed", __func__);
+			ret = SR_ERR_MALLOC;
+			break;
+		}
+		dl->session = session;
+		dl->sdi = sdi = l->data;
+		g_mutex_init(&dl->mutex);
+		g_cond_init(&dl->cond);
+		session->dev_loops = g_slist_append(session->dev_loops, dl);
+		if (!(dl->loop = sr_session_new())) {
+			ret = SR_ERR_MALLOC;
+			break;
+		}
+		dl->loop->devs = g_slist_append(NULL, sdi);
+		dl->loop->parent = session;
+		dl->loop->running = TRUE;
+		sr_config_cache_clear(sdi);
+
+		g_atomic_int_inc(&session->loops_running);
+		if (!(dl->thread = g_thread_try_new("sr-device",
+				dev_loop_thread, dl, NULL))) {
+			g_atomic_int_add(&session->loops_running, -1);
+			sr_err("Failed to start the thread of %s device %d.",
+			       sdi->driver->name, sdi->index);
+			ret = SR_ERR;
+		}
+	}
+
+	for (l = session->dev_loops; l; l = l->next) {
+		dl = l->data;
+		if (!dl->thread)
+			continue;
+		g_mutex_lock(&dl->mutex);
+		while (!dl->started)
+			g_cond_wait(&dl->cond, &dl->mutex);
+		g_mutex_unlock(&dl->mutex);
+		sdi = dl->sdi;
+		if (dl->ret == SR_OK) {
+			sr_dbg("Started %s device %d on its own thread.",
+			       sdi->driver->name, sdi->index);
+			continue;
+		}
+		sr_err("%s: could not start %s device %d (%s)", __func__,
+		       sdi->driver->name, sdi->index, sr_strerror(dl->ret));
+		if (ret == SR_OK)
+			ret = dl->ret;
+	}
+
+	if (ret != SR_OK) {
+		/* The loops of the devices which did start stop them. */
+		for (l = session->dev_loops; l; l = l->next) {
+			dl = l->data;
+			if (dl->loop)
+				sr_session_stop(dl->loop);
+		}
+		dev_loops_free(session);
+	}
+
+	return ret;
+}
+
+/* Pass on the devices' packets until all of their loops ended. */
+static void dev_loops_run(struct sr_session *session)
+{
+	gboolean block;
+
+	while (g_atomic_int_get(&session->loops_running)
+	       || session->num_sources) {
+		/* Set before checking, see session_send(). */
+		g_atomic_int_set(&session->loops_waiting, TRUE);
+		block = !sr_session_deferred_pending(session)
+			&& session->wake_fds[0] >= 0;
+		if (!block && session->wake_fds[0] < 0)
+			g_usleep(1000);
+		sr_session_iteration(session, block);
+		g_atomic_int_set(&session->loops_waiting, FALSE);
+		deferred_drain(session);
+	}
+	dev_loops_free(session);
+}
+
+/**
+ * Start a session.
+ *
+ * The drivers add their event sources to the session here, so this must
+ * be called from the same thread as sr_session_run().
+ *
+ * With more than one device, all of them are started at the same time,
+ * each on a thread of its own, so slow devices don't delay the others.
+ * Their SR_DF_HEADER packets all carry the same start time. If any
+ * device fails to start, the ones which did are stopped again.
+ *
+ * @param session The session to start. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_MALLOC upon memory allocation
+ *         errors, or the error of the first device which failed to start.
+ */
+SR_API int sr_session_start(struct sr_session *session)
+{
+	struct dev_start *starts;
+	struct sr_dev_inst *sdi;
+	GSList *l;
+	unsigned int num_devs, i;
+	int ret;
+
+	if (!session) {
+		sr_err("%s: session was NULL; a session must be "
+		       "created before starting it.", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (!session->devs) {
+		sr_err("%s: session->devs was NULL; a session "
+		       "cannot be started without devices.", __func__);
+		return SR_ERR_BUG;
+	}
+
+	sr_info("Starting.");
+	g_private_set(&cur_session, session);
+	session->ctx = session_ctx(session);
+
+	num_devs = g_slist_length(session->devs);
+	if (!(starts = g_try_malloc0(sizeof(struct dev_start) * num_devs))) {
+		sr_err("%s: starts malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	if (session->threaded_dispatch && !session->workers_running
+	    && (ret = workers_start(session)) != SR_OK) {
+		g_free(starts);
+		return ret;
+	}
+
+	if (session->queue_depth && !session->queue
+	    && (ret = queue_start(session)) != SR_OK) {
+		workers_stop(session);
+		g_free(starts);
+		return ret;
+	}
+
+	stats_reset(session);
+	g_get_current_time(&session->starttime);
+
+	if (session->dev_threads) {
+		g_free(starts);
+		ret = dev_loops_start(session);
+		session->starttime.tv_sec = session->starttime.tv_usec = 0;
+		if (ret != SR_OK) {
+			queue_stop(session);
+			workers_stop(session);
+		}
+		return ret;
+	}
+
+	for (l = session->devs, i = 0; l; l = l->next, i++) {
+		starts[i].session = session;
+		starts[i].sdi = l->data;
+		sr_config_cache_clear(starts[i].sdi);
+		if (num_devs > 1)
+			starts[i].thread = g_thread_try_new("sr-start",
+					dev_start_thread, &starts[i], NULL);
+	}
+
+	/* Those which didn't get a thread are started here, one by one. */
+	for (i = 0; i < num_devs; i++) {
+		sdi = starts[i].sdi;
+		if (!starts[i].thread)
+			starts[i].ret = sdi->driver->dev_acquisition_start(sdi,
+					sdi);
+	}
+
+	ret = SR_OK;
+	for (i = 0; i < num_devs; i++) {
+		sdi = starts[i].sdi;
+		if (starts[i].thread)
+			g_thread_join(starts[i].thread);
+		if (starts[i].ret == SR_OK) {
+			sr_dbg("Started %s device %d.", sdi->driver->name,
+			       sdi->index);
+			continue;
+		}
+		sr_err("%s: could not start %s device %d (%s)", __func__,
+		       sdi->driver->name, sdi->index,
+		       sr_strerror(starts[i].ret));
+		if (ret == SR_OK)
+			ret = starts[i].ret;
+	}
+
+	session->starttime.tv_sec = session->starttime.tv_usec = 0;
+
+	if (ret != SR_OK) {
+		for (i = 0; i < num_devs; i++) {
+			sdi = starts[i].sdi;
+			if (starts[i].ret == SR_OK)
+				sdi->driver->dev_acquisition_stop(sdi, sdi);
+		}
+		queue_stop(session);
+		workers_stop(session);
+	}
+
+	g_free(starts);
+
+	return ret;
+}
+
+/*
+ * A session run from a GLib main context, see sr_session_attach(). The
+ * session's pollfds move whenever sources are added, so the main context
+ * polls copies of them.
+ */
+struct session_gsource {
+	GSource base;
+	struct sr_session *session;
+	GPollFD *fds;
+	unsigned int num_fds;
+	unsigned int gen;
+};
+
+/* A single source without a file descriptor is run over and over. */
+static gboolean session_freewheel(struct sr_session *session)
+{
+	return session->num_sources == 1 && session->pollfds[0].fd == -1;
+}
+
+static gboolean session_done(struct sr_session *session)
+{
+	return !session->num_sources
+		&& !g_atomic_int_get(&session->loops_running);
+}
+
+/* Poll what the session's sources and the wakeup pipe poll. */
+static void gsource_sync(struct session_gsource *gs)
+{
+	struct sr_session *session;
+	unsigned int i, num_fds;
+
+	session = gs->session;
+	if (gs->fds && gs->gen == session->sources_gen)
+		return;
+
+	for (i = 0; i < gs->num_fds; i++)
+		g_source_remove_poll(&gs->base, &gs->fds[i]);
+	g_free(gs->fds);
+	gs->num_fds = 0;
+
+	num_fds = session->num_sources + 1;
+	if (!(gs->fds = g_try_malloc0(sizeof(GPollFD) * num_fds))) {
+		sr_err("%s: fds malloc failed", __func__);
+		return;
+	}
+	for (i = 0; i < session->num_sources; i++) {
+		gs->fds[i].fd = session->pollfds[i].fd;
+		gs->fds[i].events = session->pollfds[i].events;
+	}
+	if (session->wake_fds[0] >= 0) {
+		gs->fds[i].fd = session->wake_fds[0];
+		gs->fds[i++].events = G_IO_IN;
+	}
+	gs->num_fds = i;
+	for (i = 0; i < gs->num_fds; i++) {
+		if (gs->fds[i].fd >= 0)
+			g_source_add_poll(&gs->base, &gs->fds[i]);
+	}
+	gs->gen = session->sources_gen;
+}
+
+static gboolean gsource_prepare(GSource *source, gint *timeout)
+{
+	struct session_gsource *gs;
+	struct sr_session *session;
+	int64_t wait;
+
+	gs = (struct session_gsource *)source;
+	session = gs->session;
+	gsource_sync(gs);
+	/* Have the device threads wake the main context. */
+	if (session->dev_loops)
+		g_atomic_int_set(&session->loops_waiting, TRUE);
+
+	*timeout = -1;
+	if (session_freewheel(session) || session_done(session)
+	    || sr_session_deferred_pending(session))
+		return TRUE;
+	if (session->num_timers) {
+		wait = TIMER_DUE(0) - g_get_monotonic_time();
+		if (wait <= 0)
+			return TRUE;
+		*timeout = MIN((wait + 999) / 1000, INT_MAX);
+	}
+
+	return FALSE;
+}
+
+static gboolean gsource_check(GSource *source)
+{
+	struct session_gsource *gs;
+	struct sr_session *session;
+	unsigned int i;
+
+	gs = (struct session_gsource *)source;
+	session = gs->session;
+	for (i = 0; i < gs->num_fds; i++) {
+		if (gs->fds[i].revents)
+			return TRUE;
+	}
+
+	return session_freewheel(session) || session_done(session)
+		|| sr_session_deferred_pending(session)
+		|| (session->num_timers
+		&& TIMER_DUE(0) <= g_get_monotonic_time());
+}
+
+static gboolean gsource_dispatch(GSource *source, GSourceFunc callback,
+		gpointer user_data)
+{
+	struct session_gsource *gs;
+	struct sr_session *session;
+
+	(void)callback;
+	(void)user_data;
+
+	gs = (struct session_gsource *)source;
+	session = gs->session;
+	g_private_set(&cur_session, session);
+
+	if (session_freewheel(session)) {
+		session->sources[0].cb(-1, 0, session->sources[0].cb_data);
+		check_abort(session);
+	} else if (session->num_sources) {
+		/* Polls again, but doesn't wait. */
+		sr_session_iteration(session, FALSE);
+	} else {
+		check_abort(session);
+	}
+	deferred_drain(session);
+
+	if (!session_done(session))
+		return G_SOURCE_CONTINUE;
+
+	if (session->dev_loops)
+		dev_loops_free(session);
+	run_finish(session);
+	session->gsource = NULL;
+
+	return G_SOURCE_REMOVE;
+}
+
+static void gsource_finalize(GSource *source)
+{
+	struct session_gsource *gs;
+
+	gs = (struct session_gsource *)source;
+	g_free(gs->fds);
+}
+
+static GSourceFuncs session_gsource_funcs = {
+	.prepare = gsource_prepare,
+	.check = gsource_check,
+	.dispatch = gsource_dispatch,
+	.finalize = gsource_finalize,
+};
+
+/**
+ * Run a session from a GLib main context, instead of sr_session_run().
+ *
+ * This returns right away. The session's event sources are then polled
+ * and their callbacks run by whatever thread iterates the main context,
+ * so an application with a main loop can host any number of sessions
+ * without a thread for each. Once the acquisition ended, the session is
+ * done with just as sr_session_run() would be, and detaches itself.
+ * Destroying the session detaches it too.
+ *
+ * @param session The session, started with sr_session_start(). Must not
+ *                be NULL.
+ * @param context The main context, or NULL for the default one.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR if
+ *         the session is running already, or SR_ERR_MALLOC upon memory
+ *         allocation errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_attach(struct sr_session *session,
+		GMainContext *context)
+{
+	struct session_gsource *gs;
+	GSource *source;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (session->running || session->gsource) {
+		sr_err("%s: session is running already", __func__);
+		return SR_ERR;
+	}
+
+	source = g_source_new(&session_gsource_funcs,
+			sizeof(struct session_gsource));
+	gs = (struct session_gsource *)source;
+	gs->session = session;
+	gsource_sync(gs);
+	if (!gs->fds) {
+		g_source_unref(source);
+		return SR_ERR_MALLOC;
+	}
+	g_source_set_name(source, "sr-session");
+
+	session->running = TRUE;
+	session->gsource = source;
+	g_source_attach(source, context);
+	g_source_unref(source);
+
+	return SR_OK;
+}
+
+/**
+ * Run a session.
+ *
+ * This returns once all of the session's event sources are gone, i.e. the
+ * acquisition ended. Sessions running on different threads don't block
+ * each other.
+ *
+ * @param session The session to run. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG upon errors.
+ */
+SR_API int sr_session_run(struct sr_session *session)
+{
+	struct sr_thread_state *state;
+
+	if (!session) {
+		sr_err("%s: session was NULL; a session must be "
+		       "created first, before running it.", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (!session->devs) {
+		/* TODO: Actually the case? */
+		sr_err("%s: session->devs was NULL; a session "
+		       "cannot be run without devices.", __func__);
+		return SR_ERR_BUG;
+	}
+	session->running = TRUE;
+	g_private_set(&cur_session, session);
+
+	sr_info("Running.");
+	state = sr_thread_tune(session->ctx);
+
+	if (session->dev_loops)
+		dev_loops_run(session);
+	else
+		sources_run(session);
+
+	sr_thread_restore(state);
+	run_finish(session);
+
+	return SR_OK;
+}
+
+/**
+ * Stop a session.
+ *
+ * The session is stopped immediately, with all acquisition sessions
+ * being stopped and hardware drivers cleaned up.
+ *
+ * This must be called from within the session thread, to prevent freeing
+ * resources that the session thread will try to use.
+ *
+ * @param session The session to stop.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_stop_sync(struct sr_session *session)
+{
+	struct sr_dev_inst *sdi;
+	struct dev_loop *dl;
+	GSList *l;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	sr_info("Stopping.");
+
+	/* Each device is stopped by its own thread. */
+	for (l = session->dev_loops; l; l = l->next) {
+		dl = l->data;
+		sr_session_stop(dl->loop);
+	}
+	if (session->dev_loops) {
+		session->running = FALSE;
+		return SR_OK;
+	}
+
+	for (l = session->devs; l; l = l->next) {
+		sdi = l->data;
+		if (sdi->driver) {
+			if (sdi->driver->dev_acquisition_stop)
+				sdi->driver->dev_acquisition_stop(sdi, sdi);
+		}
+	}
+	session->running = FALSE;
+
+	return SR_OK;
+}
+
+/**
+ * Stop a session.
+ *
+ * The session is stopped immediately, with all acquisition sessions
+ * being stopped and hardware drivers cleaned up.
+ *
+ * If the session is run in a separate thread, this function will not block
+ * until the session is finished executing. It is the caller's responsibility
+ * to wait for the session thread to return before assuming that the session is
+ * completely decommissioned.
+ *
+ * @param session The session to stop. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL.
+ */
+SR_API int sr_session_stop(struct sr_session *session)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	g_atomic_int_set(&session->abort_session, TRUE);
+	session_wake(session);
+
+	return SR_OK;
+}
+
+/**
+ * Debug helper.
+ *
+ * @param packet The packet to show debugging information for.
+ */
+static void datafeed_dump(const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+	const struct sr_datafeed_logic_edges *edges;
+	const struct sr_datafeed_analog *analog;
+	const struct sr_datafeed_analog_raw *raw;
+	const struct sr_datafeed_analog_stats *stats;
+	const struct sr_datafeed_logic_stats *logic_stats;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		sr_dbg("bus: Received SR_DF_HEADER packet.");
+		break;
+	case SR_DF_TRIGGER:
+		sr_dbg("bus: Received SR_DF_TRIGGER packet.");
+		break;
+	case SR_DF_META:
+		sr_dbg("bus: Received SR_DF_META packet.");
+		break;
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		sr_dbg("bus: Received SR_DF_LOGIC packet (%" PRIu64 " bytes).",
+		       logic->length);
+		break;
+	case SR_DF_LOGIC_EDGES:
+		edges = packet->payload;
+		sr_dbg("bus: Received SR_DF_LOGIC_EDGES packet (%" PRIu64
+		       " edges in %" PRIu64 " samples).", edges->num_edges,
+		       edges->num_samples);
+		break;
+	case SR_DF_LOGIC_RLE:
+		rle = packet->payload;
+		sr_dbg("bus: Received SR_DF_LOGIC_RLE packet (%" PRIu64
+		       " samples in %" PRIu64 " runs).", rle->num_samples,
+		       rle->num_runs);
+		break;
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		sr_dbg("bus: Received SR_DF_ANALOG packet (%d samples).",
+		       analog->num_samples);
+		break;
+	case SR_DF_ANALOG_RAW:
+		raw = packet->payload;
+		sr_dbg("bus: Received SR_DF_ANALOG_RAW packet (%d samples).",
+		       raw->num_samples);
+		break;
+	case SR_DF_ANALOG_STATS:
+		stats = packet->payload;
+		sr_dbg("bus: Received SR_DF_ANALOG_STATS packet (%" PRIu64
+		       " samples).", stats->window[0].count);
+		break;
+	case SR_DF_LOGIC_STATS:
+		logic_stats = packet->payload;
+		sr_dbg("bus: Received SR_DF_LOGIC_STATS packet (%" PRIu64
+		       " samples).", logic_stats->window[0].count);
+		break;
+	case SR_DF_END:
+		sr_dbg("bus: Received SR_DF_END packet.");
+		break;
+	case SR_DF_FRAME_BEGIN:
+		sr_dbg("bus: Received SR_DF_FRAME_BEGIN packet.");
+		break;
+	case SR_DF_FRAME_END:
+		sr_dbg("bus: Received SR_DF_FRAME_END packet.");
+		break;
+	default:
+		sr_dbg("bus: Received unknown packet type: %d.", packet->type);
+		break;
+	}
+}
+
+static struct dev_state *dev_state_get(struct sr_session *session,
+		const struct sr_dev_inst *sdi)
+{
+	struct dev_state *state;
+	GSList *l;
+
+	/* Devices may be sending from threads of their own. */
+	g_mutex_lock(&session->dev_mutex);
+	state = NULL;
+	for (l = session->dev_states; l; l = l->next) {
+		if (((struct dev_state *)l->data)->sdi == sdi) {
+			state = l->data;
+			break;
+		}
+	}
+	if (!state) {
+		if ((state = g_try_malloc0(sizeof(struct dev_state)))) {
+			state->sdi = sdi;
+			session->dev_states = g_slist_prepend(
+					session->dev_states, state);
+		} else {
+			sr_err("%s: state malloc failed", __func__);
+		}
+	}
+	g_mutex_unlock(&session->dev_mutex);
+
+	return state;
+}
+
+/* Number the analog probes' samples, from the first probe's count. */
+static uint64_t analog_stamp(struct dev_state *state, GSList *probes,
+		int num_samples)
+{
+	struct probe_samples *ps;
+	GSList *l, *m;
+	uint64_t start;
+
+	start = 0;
+	for (l = probes; l; l = l->next) {
+		for (m = state->analog; m; m = m->next) {
+			ps = m->data;
+			if (ps->probe == l->data)
+				break;
+		}
+		if (!m) {
+			if (!(ps = g_try_malloc0(sizeof(struct probe_samples)))) {
+				sr_err("%s: ps malloc failed", __func__);
+				continue;
+			}
+			ps->probe = l->data;
+			state->analog = g_slist_prepend(state->analog, ps);
+		}
+		if (l == probes)
+			start = ps->num_samples;
+		ps->num_samples += num_samples;
+	}
+
+	return start;
+}
+
+static void dev_state_count(struct dev_state *state,
+		const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+	const struct sr_datafeed_analog *analog;
+	const struct sr_datafeed_analog_raw *raw;
+	int64_t now;
+
+	state->stats.packets++;
+
+	switch (packet->type) {
+	case SR_DF_FRAME_END:
+		now = g_get_monotonic_time();
+		if (!state->stats.frames++)
+			state->first_frame_end = now;
+		state->stats.frame_us = now - state->first_frame_end;
+		break;
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		state->stats.bytes += logic->length;
+		break;
+	case SR_DF_LOGIC_RLE:
+		rle = packet->payload;
+		state->stats.bytes += rle->num_runs
+				* (rle->unitsize + sizeof(uint64_t));
+		break;
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		state->stats.bytes += (uint64_t)analog->num_samples
+				* g_slist_length(analog->probes) * sizeof(float);
+		break;
+	case SR_DF_ANALOG_RAW:
+		raw = packet->payload;
+		state->stats.bytes += (uint64_t)raw->num_samples
+				* g_slist_length(raw->probes)
+				* sr_analog_encoding_size(raw->encoding);
+		break;
+	}
+}
+
+/*
+ * Fill in the sample number and timestamp of a packet with sample data,
+ * on a copy in "stamped". Returns the packet to send on.
+ */
+static const struct sr_datafeed_packet *packet_stamp(
+		struct dev_state *state, const struct sr_datafeed_packet *packet,
+		struct stamped_packet *stamped)
+{
+	int64_t now;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+	case SR_DF_LOGIC:
+	case SR_DF_LOGIC_RLE:
+	case SR_DF_ANALOG:
+	case SR_DF_ANALOG_RAW:
+		break;
+	default:
+		return packet;
+	}
+
+	if (packet->type == SR_DF_HEADER) {
+		/* A new acquisition, so start counting from zero again. */
+		state->logic_samples = 0;
+		g_slist_free_full(state->analog, g_free);
+		state->analog = NULL;
+		return packet;
+	}
+
+	now = g_get_monotonic_time();
+	stamped->packet.type = packet->type;
+	stamped->packet.payload = &stamped->payload;
+
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		stamped->payload.logic = *(const struct sr_datafeed_logic *)
+				packet->payload;
+		stamped->payload.logic.start_sample = state->logic_samples;
+		stamped->payload.logic.timestamp = now;
+		if (stamped->payload.logic.unitsize)
+			state->logic_samples += stamped->payload.logic.length
+					/ stamped->payload.logic.unitsize;
+		break;
+	case SR_DF_LOGIC_RLE:
+		stamped->payload.rle = *(const struct sr_datafeed_logic_rle *)
+				packet->payload;
+		stamped->payload.rle.start_sample = state->logic_samples;
+		stamped->payload.rle.timestamp = now;
+		state->logic_samples += stamped->payload.rle.num_samples;
+		break;
+	case SR_DF_ANALOG:
+		stamped->payload.analog = *(const struct sr_datafeed_analog *)
+				packet->payload;
+		stamped->payload.analog.start_sample = analog_stamp(state,
+				stamped->payload.analog.probes,
+				stamped->payload.analog.num_samples);
+		stamped->payload.analog.timestamp = now;
+		/* Only sr_session_send_timed() may set these. */
+		stamped->payload.analog.timestamps =
+				g_private_get(&cur_timestamps);
+		break;
+	case SR_DF_ANALOG_RAW:
+		stamped->payload.raw = *(const struct sr_datafeed_analog_raw *)
+				packet->payload;
+		stamped->payload.raw.start_sample = analog_stamp(state,
+				stamped->payload.raw.probes,
+				stamped->payload.raw.num_samples);
+		stamped->payload.raw.timestamp = now;
+		break;
+	}
+
+	return &stamped->packet;
+}
+
+/* The samples of a probe the device has sent so far. */
+static uint64_t analog_count(struct dev_state *state,
+		const struct sr_probe *probe)
+{
+	struct probe_samples *ps;
+	GSList *l;
+
+	for (l = state->analog; l; l = l->next) {
+		ps = l->data;
+		if (ps->probe == probe)
+			return ps->num_samples;
+	}
+
+	return 0;
+}
+
+/* Turn the time limit into samples, or into an end time without a rate. */
+static void limit_samplerate_set(struct dev_state *state,
+		uint64_t samplerate)
+{
+	if (!state->limit_msec)
+		return;
+
+	if (samplerate) {
+		state->limit_rate_samples = state->limit_msec * samplerate
+				/ 1000;
+		state->limit_end = 0;
+	} else {
+		state->limit_rate_samples = 0;
+		state->limit_end = g_get_monotonic_time()
+				+ (int64_t)state->limit_msec * 1000;
+	}
+}
+
+/* Take the limits set on a device, at the start of an acquisition. */
+static void limit_start(struct dev_state *state,
+		const struct sr_dev_inst *sdi)
+{
+	GVariant *gvar;
+	uint64_t samplerate;
+
+	state->limit_samples = sdi->limit_samples;
+	state->limit_msec = sdi->limit_msec;
+	state->limit_rate_samples = 0;
+	state->limit_end = 0;
+	state->limit_reached = FALSE;
+
+	if (!state->limit_msec)
+		return;
+
+	samplerate = 0;
+	if (sdi->driver && sr_config_get(sdi->driver, sdi, NULL,
+			SR_CONF_SAMPLERATE, &gvar) == SR_OK) {
+		samplerate = g_variant_get_uint64(gvar);
+		g_variant_unref(gvar);
+	}
+	limit_samplerate_set(state, samplerate);
+}
+
+/*
+ * Note that a device has sent all it may, and stop the session once all
+ * its devices have. The driver gets stopped the usual way then.
+ */
+static void limit_reached(struct sr_session *session,
+		struct dev_state *state)
+{
+	struct dev_state *other;
+	GSList *l;
+
+	if (state->limit_reached)
+		return;
+
+	sr_dbg("Device reached its limit.");
+	state->limit_reached = TRUE;
+
+	for (l = session->devs; l; l = l->next) {
+		if (!(other = dev_state_get(session, l->data))
+		    || !other->limit_reached)
+			return;
+	}
+
+	sr_session_stop(session);
+}
+
+/* Cut RLE data short after num_samples samples. */
+static int limit_rle(struct dev_state *state,
+		struct sr_datafeed_logic_rle *rle, uint64_t num_samples)
+{
+	uint64_t *counts;
+	uint64_t i, n;
+
+	for (i = 0, n = 0; n + rle->counts[i] < num_samples; i++)
+		n += rle->counts[i];
+
+	if (i + 1 > state->limit_counts_size) {
+		if (!(counts = g_try_realloc(state->limit_counts,
+				(i + 1) * sizeof(uint64_t)))) {
+			sr_err("%s: counts malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		state->limit_counts = counts;
+		state->limit_counts_size = i + 1;
+	}
+	memcpy(state->limit_counts, rle->counts, i * sizeof(uint64_t));
+	state->limit_counts[i] = num_samples - n;
+	rle->counts = state->limit_counts;
+	rle->num_runs = i + 1;
+	rle->num_samples = num_samples;
+
+	return SR_OK;
+}
+
+/*
+ * Hold a device's data to the limits set on it with sr_config_set(), so
+ * that consumers get exactly SR_CONF_LIMIT_SAMPLES samples (or as many
+ * as fit in SR_CONF_LIMIT_MSEC), even if the driver only checks after
+ * whole transfers. The packet which reaches a limit is cut short, in a
+ * copy, and the session is stopped. Returns the packet to pass on, or
+ * NULL to drop it.
+ */
+static const struct sr_datafeed_packet *limit_apply(
+		struct sr_session *session, const struct sr_dev_inst *sdi,
+		struct dev_state *state,
+		const struct sr_datafeed_packet *packet,
+		struct stamped_packet *limited)
+{
+	const struct sr_datafeed_meta *meta;
+	const struct sr_config *src;
+	struct sr_datafeed_logic_rle *rle;
+	GSList *l, *probes;
+	uint64_t limit, done, n;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		limit_start(state, sdi);
+		return packet;
+	case SR_DF_META:
+		meta = packet->payload;
+		for (l = meta->config; l; l = l->next) {
+			src = l->data;
+			if (src->key == SR_CONF_SAMPLERATE)
+				limit_samplerate_set(state,
+					g_variant_get_uint64(src->data));
+		}
+		return packet;
+	case SR_DF_LOGIC:
+	case SR_DF_LOGIC_RLE:
+	case SR_DF_ANALOG:
+	case SR_DF_ANALOG_RAW:
+		break;
+	default:
+		return packet;
+	}
+
+	if (state->limit_end) {
+		if (!state->limit_reached
+		    && g_get_monotonic_time() >= state->limit_end)
+			limit_reached(session, state);
+		return state->limit_reached ? NULL : packet;
+	}
+
+	limit = state->limit_samples;
+	if (state->limit_rate_samples && (!limit
+	    || state->limit_rate_samples < limit))
+		limit = state->limit_rate_samples;
+	if (!limit)
+		return packet;
+
+	limited->packet.type = packet->type;
+	limited->packet.payload = &limited->payload;
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		limited->payload.logic = *(const struct sr_datafeed_logic *)
+				packet->payload;
+		if (!limited->payload.logic.unitsize)
+			return packet;
+		done = state->logic_samples;
+		n = limited->payload.logic.length
+				/ limited->payload.logic.unitsize;
+		break;
+	case SR_DF_LOGIC_RLE:
+		limited->payload.rle = *(const struct sr_datafeed_logic_rle *)
+				packet->payload;
+		done = state->logic_samples;
+		n = limited->payload.rle.num_samples;
+		break;
+	case SR_DF_ANALOG:
+		limited->payload.analog = *(const struct sr_datafeed_analog *)
+				packet->payload;
+		probes = limited->payload.analog.probes;
+		done = probes ? analog_count(state, probes->data) : 0;
+		n = limited->payload.analog.num_samples;
+		break;
+	default:
+		limited->payload.raw = *(const struct sr_datafeed_analog_raw *)
+				packet->payload;
+		probes = limited->payload.raw.probes;
+		done = probes ? analog_count(state, probes->data) : 0;
+		n = limited->payload.raw.num_samples;
+		break;
+	}
+
+	if (done + n < limit)
+		return packet;
+	limit_reached(session, state);
+	if (done + n == limit)
+		return packet;
+	if (done >= limit)
+		return NULL;
+
+	n = limit - done;
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		limited->payload.logic.length = n
+				* limited->payload.logic.unitsize;
+		break;
+	case SR_DF_LOGIC_RLE:
+		rle = &limited->payload.rle;
+		if (limit_rle(state, rle, n) != SR_OK)
+			return NULL;
+		break;
+	case SR_DF_ANALOG:
+		limited->payload.analog.num_samples = n;
+		break;
+	default:
+		limited->payload.raw.num_samples = n;
+		break;
+	}
+
+	return &limited->packet;
+}
+
+/**
+ * Send a packet to whatever is listening on the datafeed bus.
+ *
+ * Hardware drivers use this to send a data packet to the frontend.
+ *
+ * @param sdi The device instance the packet originates from. The packet
+ *            goes to the session the device was added to.
+ * @param packet The datafeed packet to send to the session bus.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, SR_ERR_BUG
+ *         if the device isn't part of a session.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_send(const struct sr_dev_inst *sdi,
+			    const struct sr_datafeed_packet *packet)
+{
+	struct sr_session *session;
+	struct dev_state *state;
+	struct stamped_packet stamped, limited;
+
+	if (!sdi) {
+		sr_err("%s: sdi was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!packet) {
+		sr_err("%s: packet was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!(session = sdi->session)) {
+		sr_err("%s: device is not in a session", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if ((state = dev_state_get(session, sdi))) {
+		if (!(packet = limit_apply(session, sdi, state, packet,
+				&limited)))
+			return SR_OK;
+		dev_state_count(state, packet);
+		packet = packet_stamp(state, packet, &stamped);
+	}
+
+	if (trigger_filter(session, sdi, packet))
+		return SR_OK;
+
+	if (analog_trigger_filter(session, sdi, packet))
+		return SR_OK;
+
+	return session_send(session, sdi, packet);
+}
+
+/**
+ * Count data lost by a device, for sr_session_stats_get().
+ *
+ * @param sdi The device which lost data. Must not be NULL.
+ * @param overruns Number of overruns to add to the device's count.
+ * @param empty_transfers Number of empty or failed transfers to add to
+ *                        the device's count.
+ *
+ * @private
+ */
+SR_PRIV void sr_session_dev_stats_add(const struct sr_dev_inst *sdi,
+		uint64_t overruns, uint64_t empty_transfers)
+{
+	struct dev_state *state;
+
+	if (!sdi || !sdi->session)
+		return;
+
+	if (!(state = dev_state_get(sdi->session, sdi)))
+		return;
+
+	state->stats.overruns += overruns;
+	state->stats.empty_transfers += empty_transfers;
+}
+
+/* Where this thread keeps the time its inner stages took. */
+static int64_t *stage_inner_get(void)
+{
+	int64_t *inner;
+
+	if (!(inner = g_private_get(&stage_inner_us))) {
+		if (!(inner = g_try_malloc0(sizeof(int64_t))))
+			return NULL;
+		g_private_set(&stage_inner_us, inner);
+	}
+
+	return inner;
+}
+
+/**
+ * Start timing a stage of the datafeed, if the session times its stages.
+ *
+ * Stages can nest, e.g. an output module run from a datafeed callback or
+ * a transform passing its packets on; each one is only charged for the
+ * time spent in itself. The timer must be ended on the same thread.
+ *
+ * @param session The session the data belongs to. Can be NULL.
+ * @param timer The timer to start. Must not be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_stage_begin(struct sr_session *session,
+		struct sr_stage_timer *timer)
+{
+	int64_t *inner;
+
+	timer->start = 0;
+	if (!session || !session->stage_timing || !(inner = stage_inner_get()))
+		return;
+
+	timer->outer_us = *inner;
+	*inner = 0;
+	timer->start = g_get_monotonic_time();
+}
+
+/**
+ * Stop timing a stage, and add the time to the session's stage statistics.
+ *
+ * @param session The session passed to sr_stage_begin().
+ * @param timer The timer started with sr_stage_begin(). Must not be NULL.
+ * @param stage The kind of stage, e.g. "transform", as a static string.
+ *              NULL to only get the time.
+ * @param id The module or driver it's run by, as a static string, or NULL.
+ * @param samples The number of samples the stage handled.
+ *
+ * @return The time spent in the stage itself, in us, or 0 if the session
+ *         doesn't time its stages.
+ *
+ * @private
+ */
+SR_PRIV int64_t sr_stage_end(struct sr_session *session,
+		struct sr_stage_timer *timer, const char *stage, const char *id,
+		uint64_t samples)
+{
+	struct stage_entry *entry;
+	GSList *l;
+	int64_t *inner, us, self_us;
+
+	if (!timer->start || !(inner = stage_inner_get()))
+		return 0;
+
+	us = g_get_monotonic_time() - timer->start;
+	self_us = MAX(us - *inner, 0);
+	*inner = timer->outer_us + us;
+	if (!stage)
+		return self_us;
+
+	g_mutex_lock(&session->stage_mutex);
+	for (l = session->stages; l; l = l->next) {
+		entry = l->data;
+		if (!strcmp(entry->stage, stage)
+		    && !g_strcmp0(entry->id, id))
+			break;
+	}
+	if (!l && (entry = g_try_malloc0(sizeof(struct stage_entry)))) {
+		entry->stage = stage;
+		entry->id = id;
+		if (id)
+			g_snprintf(entry->stats.name, SR_STAGE_NAME_SIZE,
+				   "%s:%s", stage, id);
+		else
+			g_strlcpy(entry->stats.name, stage,
+				  SR_STAGE_NAME_SIZE);
+		session->stages = g_slist_append(session->stages, entry);
+	} else if (!l) {
+		entry = NULL;
+	}
+	if (entry) {
+		entry->stats.calls++;
+		entry->stats.us += self_us;
+		entry->stats.samples += samples;
+	}
+	g_mutex_unlock(&session->stage_mutex);
+
+	return self_us;
+}
+
+/* Run a transform on a packet, timing it as a stage. */
+static int transform_receive(struct sr_transform *t,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct sr_stage_timer timer;
+	int ret;
+
+	sr_stage_begin(t->session, &timer);
+	ret = t->format->receive(t, sdi, packet);
+	sr_stage_end(t->session, &timer, "transform", t->format->id,
+		     sr_packet_samples(packet));
+
+	return ret;
+}
+
+/* Hand a packet which made it through all transforms to the callbacks. */
+static int session_deliver(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	if (session->queue)
+		return ring_send(session->queue, sdi, packet,
+				&session->queue_overruns, &session->queue_max_used);
+
+	datafeed_dispatch(session, sdi, packet);
+
+	return SR_OK;
+}
+
+static int session_dispatch(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct sr_transform *t;
+
+	if (!session->transforms)
+		return session_deliver(session, sdi, packet);
+
+	t = session->transforms->data;
+
+	return transform_receive(t, sdi, packet);
+}
+
+/**
+ * Pass a packet on from a transform to the next one in the session, or
+ * to the datafeed callbacks if it is the last.
+ *
+ * @param t The transform sending the packet. Must not be NULL.
+ * @param sdi The device instance the packet came from.
+ * @param packet The packet to pass on. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_BUG if the transform isn't part of its session.
+ *
+ * @private
+ */
+SR_PRIV int sr_transform_send(struct sr_transform *t,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct sr_transform *next;
+	GSList *l;
+
+	if (!t) {
+		sr_err("%s: t was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!packet) {
+		sr_err("%s: packet was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!(l = g_slist_find(t->session->transforms, t))) {
+		sr_err("%s: transform is not in its session", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (!l->next)
+		return session_deliver(t->session, sdi, packet);
+
+	next = l->next->data;
+
+	return transform_receive(next, sdi, packet);
+}
+
+static int session_send(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct queue_entry *entry;
+
+	if (g_private_get(&defer_sends)) {
+		if (!(entry = g_try_malloc(sizeof(struct queue_entry)))) {
+			sr_err("%s: entry malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		if (!(entry->packet = sr_packet_copy(packet))) {
+			g_free(entry);
+			return SR_ERR_MALLOC;
+		}
+		entry->sdi = sdi;
+		g_async_queue_push(session->deferred, entry);
+		g_atomic_int_inc(&session->num_deferred);
+		/* The session thread waits for the device threads' packets. */
+		if (g_atomic_int_get(&session->loops_waiting))
+			session_wake(session);
+		return SR_OK;
+	}
+
+	/* Keep the packets in order: the deferred ones were sent first. */
+	if (g_atomic_int_get(&session->num_deferred))
+		deferred_drain(session);
+
+	return session_dispatch(session, sdi, packet);
+}
+
+/* Pass on the packets handed over by other threads. */
+static void deferred_drain(struct sr_session *session)
+{
+	struct queue_entry *entry;
+	struct sr_buffer *buf;
+
+	buf = g_private_get(&cur_buffer);
+	while ((entry = g_async_queue_try_pop(session->deferred))) {
+		g_atomic_int_add(&session->num_deferred, -1);
+		g_private_set(&cur_buffer, sr_packet_buffer_get(entry->packet));
+		session_dispatch(session, entry->sdi, entry->packet);
+		sr_packet_free(entry->packet);
+		g_free(entry);
+	}
+	g_private_set(&cur_buffer, buf);
+}
+
+/**
+ * Hand the packets sent by the calling thread over to the session thread.
+ *
+ * This is for threads other than the one running the session, such as the
+ * USB event thread. Their packets are queued, and passed on in order by
+ * sr_session_deferred_dispatch(), or the next packet sent by the session
+ * thread.
+ *
+ * @param defer TRUE to queue the calling thread's packets, FALSE to send
+ *              them directly again.
+ *
+ * @private
+ */
+SR_PRIV void sr_session_send_defer(gboolean defer)
+{
+	g_private_set(&defer_sends, defer ? GINT_TO_POINTER(1) : NULL);
+}
+
+/**
+ * Check whether other threads handed over packets that are yet to be sent.
+ *
+ * @param session The session.
+ *
+ * @return TRUE if there are packets waiting for sr_session_deferred_dispatch().
+ *
+ * @private
+ */
+SR_PRIV gboolean sr_session_deferred_pending(struct sr_session *session)
+{
+	return g_atomic_int_get(&session->num_deferred) > 0;
+}
+
+/**
+ * Send the packets other threads handed over to the session thread.
+ *
+ * Must be called from the thread running the session.
+ *
+ * @param session The session.
+ *
+ * @private
+ */
+SR_PRIV void sr_session_deferred_dispatch(struct sr_session *session)
+{
+	deferred_drain(session);
+}
+
+/*
+ * The matcher only works on plain samples, so feed it RLE data in expanded
+ * pieces until it fires. Whatever comes after that still goes out as RLE.
+ */
+static gboolean trigger_filter_rle(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_logic_rle *rle)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_datafeed_logic_rle rest;
+	uint64_t run, offset, done, count, max, n;
+	void *buf;
+
+	max = RLE_EXPAND_SIZE / rle->unitsize;
+	if (!(buf = g_try_malloc(RLE_EXPAND_SIZE))) {
+		sr_err("%s: buf malloc failed", __func__);
+		return FALSE;
+	}
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.unitsize = rle->unitsize;
+	logic.data = buf;
+	logic.timestamp = rle->timestamp;
+	run = offset = done = 0;
+	while (!session->trigger_fired
+	    && (n = sr_logic_rle_expand(rle, &run, &offset, buf, max))) {
+		logic.length = n * rle->unitsize;
+		logic.start_sample = rle->start_sample + done;
+		done += n;
+		if (!trigger_filter(session, sdi, &packet))
+			session_send(session, sdi, &packet);
+	}
+	g_free(buf);
+
+	packet.type = SR_DF_LOGIC_RLE;
+	packet.payload = &rest;
+	rest.unitsize = rle->unitsize;
+	rest.timestamp = rle->timestamp;
+	if (offset) {
+		/* The rest of the run the trigger fired in. */
+		count = rle->counts[run] - offset;
+		rest.num_samples = count;
+		rest.num_runs = 1;
+		rest.values = (uint8_t *)rle->values + run * rle->unitsize;
+		rest.counts = &count;
+		rest.start_sample = rle->start_sample + done;
+		session_send(session, sdi, &packet);
+		done += count;
+		run++;
+	}
+	if (run < rle->num_runs) {
+		rest.num_samples = rle->num_samples - done;
+		rest.num_runs = rle->num_runs - run;
+		rest.values = (uint8_t *)rle->values + run * rle->unitsize;
+		rest.counts = rle->counts + run;
+		rest.start_sample = rle->start_sample + done;
+		session_send(session, sdi, &packet);
+	}
+
+	return TRUE;
+}
+
+/*
+ * Make the matcher for the trigger device's data. The stages and the
+ * protocol trigger's probes go by probe index, so for packed data they
+ * are moved to the bits of the probes.
+ */
+static struct sr_soft_trigger *trigger_new(struct sr_session *session,
+		int unitsize)
+{
+	struct sr_soft_trigger_stage stages[SR_SOFT_TRIGGER_MAX_STAGES];
+	struct sr_soft_trigger_proto proto;
+	uint64_t packed;
+
+	packed = session->trigger_params.packed_probes;
+	if (session->trigger_proto.type) {
+		proto = session->trigger_proto;
+		if (packed)
+			sr_soft_trigger_proto_pack(&proto, packed);
+		if (!proto.data || (!proto.clock
+		    && proto.type != SR_PROTOCOL_TRIGGER_UART)
+		    || (!proto.select
+		    && proto.type == SR_PROTOCOL_TRIGGER_SPI)) {
+			sr_err("The trigger's probes aren't in the data.");
+			return NULL;
+		}
+		return sr_soft_trigger_proto_new(unitsize, &proto,
+				session->trigger_params.samplerate);
+	}
+
+	memcpy(stages, session->trigger_stages, sizeof(stages));
+	if (packed)
+		sr_soft_trigger_stages_pack(stages,
+				session->trigger_num_stages, packed);
+
+	return sr_soft_trigger_new(unitsize, stages,
+			session->trigger_num_stages);
+}
+
+/*
+ * Hold back the trigger device's logic data until the software trigger
+ * fires, then send SR_DF_TRIGGER followed by the data from the samples
+ * that matched onwards. For a protocol trigger, that is from the start
+ * of the transaction if it is in the same packet, or else from the start
+ * of the packet. Returns TRUE if the packet was taken care of.
+ */
+static gboolean trigger_filter(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct sr_soft_trigger *st;
+	struct sr_datafeed_packet trig;
+	struct sr_datafeed_logic rest;
+	const struct sr_datafeed_logic *logic;
+	struct sr_stream_params params;
+	struct sr_stage_timer timer;
+	int64_t match, start;
+
+	if ((!session->trigger_num_stages && !session->trigger_proto.type)
+	    || sdi != session->trigger_sdi)
+		return FALSE;
+
+	if (packet->type == SR_DF_HEADER || packet->type == SR_DF_META) {
+		/*
+		 * The samplerate or packed probes may have changed, see
+		 * trigger_new(). A new acquisition arms the trigger again.
+		 */
+		params = session->trigger_params;
+		sr_stream_params_update(&session->trigger_params, sdi, packet);
+		if (params.samplerate != session->trigger_params.samplerate
+		    || params.packed_probes
+				!= session->trigger_params.packed_probes) {
+			sr_soft_trigger_free(session->trigger);
+			session->trigger = NULL;
+		}
+		if (packet->type == SR_DF_HEADER) {
+			session->trigger_fired = FALSE;
+			if (session->trigger)
+				sr_soft_trigger_reset(session->trigger);
+		}
+		return FALSE;
+	}
+
+	if (packet->type == SR_DF_LOGIC_RLE && !session->trigger_fired)
+		return trigger_filter_rle(session, sdi, packet->payload);
+
+	if (packet->type != SR_DF_LOGIC || session->trigger_fired)
+		return FALSE;
+
+	logic = packet->payload;
+	st = session->trigger;
+	if (!st || st->unitsize != (int)logic->unitsize) {
+		sr_soft_trigger_free(st);
+		if (!(st = trigger_new(session, logic->unitsize))) {
+			sr_err("Can't trigger on this data, passing it on.");
+			session->trigger = NULL;
+			session->trigger_fired = TRUE;
+			return FALSE;
+		}
+		session->trigger = st;
+	}
+
+	sr_stage_begin(session, &timer);
+	match = sr_soft_trigger_scan(st, logic->data,
+			logic->length / logic->unitsize);
+	sr_stage_end(session, &timer, "trigger", NULL,
+		     logic->length / logic->unitsize);
+	if (match < 0)
+		return TRUE;
+
+	session->trigger_fired = TRUE;
+	sr_dbg("Software trigger fired.");
+
+	trig.type = SR_DF_TRIGGER;
+	trig.payload = NULL;
+	session_send(session, sdi, &trig);
+
+	trig.type = SR_DF_LOGIC;
+	trig.payload = &rest;
+	rest.unitsize = logic->unitsize;
+	rest.timestamp = logic->timestamp;
+	if (st->proto.type)
+		start = MAX(st->frame_start, 0);
+	else
+		start = match - st->num_stages;
+	if (start < 0) {
+		/* The match began in an earlier packet. */
+		rest.length = st->num_stages * logic->unitsize;
+		rest.data = st->matched;
+		rest.start_sample = logic->start_sample + start;
+		session_send(session, sdi, &trig);
+		start = match;
+	}
+	rest.length = logic->length - start * logic->unitsize;
+	rest.data = (uint8_t *)logic->data + start * logic->unitsize;
+	rest.start_sample = logic->start_sample + start;
+	if (rest.length)
+		session_send(session, sdi, &trig);
+
+	return TRUE;
+}
+
+/* Send count samples of an analog packet, from sample pos on. */
+static void analog_trigger_send(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_analog *analog, unsigned int stride,
+		uint64_t pos, uint64_t count)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog part;
+
+	if (!count)
+		return;
+
+	part = *analog;
+	part.num_samples = count;
+	part.data = analog->data + pos * stride;
+	part.start_sample = analog->start_sample + pos;
+	if (analog->timestamps)
+		part.timestamps = analog->timestamps + pos;
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &part;
+	session_send(session, sdi, &packet);
+}
+
+static void analog_trigger_send_type(struct sr_session *session,
+		const struct sr_dev_inst *sdi, int type)
+{
+	struct sr_datafeed_packet packet;
+
+	packet.type = type;
+	packet.payload = NULL;
+	session_send(session, sdi, &packet);
+}
+
+/* Keep the last pre_samples of these samples, in the history ring. */
+static void analog_trigger_keep(struct analog_trigger_state *at,
+		const float *data, uint64_t count, unsigned int stride)
+{
+	uint64_t cap, end, n;
+	float *hist;
+
+	if (!(cap = at->conf.pre_samples))
+		return;
+
+	if (at->hist_probes != stride) {
+		/* The first data, or other probes than before. */
+		at->hist_start = at->hist_len = 0;
+		at->hist_probes = 0;
+		if (!(hist = g_try_realloc(at->hist,
+				cap * stride * sizeof(float)))) {
+			sr_err("%s: hist malloc failed", __func__);
+			return;
+		}
+		at->hist = hist;
+		at->hist_probes = stride;
+	}
+
+	if (count >= cap) {
+		data += (count - cap) * stride;
+		count = cap;
+		at->hist_start = at->hist_len = 0;
+	}
+	while (count) {
+		end = (at->hist_start + at->hist_len) % cap;
+		n = MIN(count, cap - end);
+		memcpy(at->hist + end * stride, data,
+				n * stride * sizeof(float));
+		at->hist_len += n;
+		if (at->hist_len > cap) {
+			/* Overwrote the oldest ones. */
+			at->hist_start = (at->hist_start + at->hist_len - cap)
+					% cap;
+			at->hist_len = cap;
+		}
+		data += n * stride;
+		count -= n;
+	}
+}
+
+/* Send the history, which ends right before sample pos of the packet. */
+static void analog_trigger_send_history(struct sr_session *session,
+		struct analog_trigger_state *at,
+		const struct sr_datafeed_analog *analog, uint64_t pos)
+{
+	struct sr_datafeed_analog part;
+	uint64_t cap, start, n;
+
+	if (!at->hist_len)
+		return;
+
+	cap = at->conf.pre_samples;
+	start = analog->start_sample + pos - at->hist_len;
+	part = *analog;
+	part.data = at->hist;
+	part.start_sample = start - at->hist_start;
+	part.timestamps = NULL;
+	n = MIN(at->hist_len, cap - at->hist_start);
+	analog_trigger_send(session, at->sdi, &part, at->hist_probes,
+			at->hist_start, n);
+	/* The part which wrapped around. */
+	part.start_sample = start + n;
+	analog_trigger_send(session, at->sdi, &part, at->hist_probes,
+			0, at->hist_len - n);
+	at->hist_start = at->hist_len = 0;
+}
+
+static void analog_trigger_data(struct sr_session *session,
+		struct analog_trigger_state *at,
+		const struct sr_datafeed_analog *analog, int index)
+{
+	struct sr_stage_timer timer;
+	uint64_t num_samples, pos, n;
+	unsigned int stride;
+	int64_t match;
+
+	stride = g_slist_length(analog->probes);
+	num_samples = analog->num_samples;
+	pos = 0;
+	while (pos < num_samples) {
+		if (at->state == ATRIG_PASS) {
+			analog_trigger_send(session, at->sdi, analog, stride,
+					pos, num_samples - pos);
+			break;
+		}
+
+		if (at->state == ATRIG_IN_FRAME) {
+			n = MIN(at->post_left, num_samples - pos);
+			analog_trigger_send(session, at->sdi, analog, stride,
+					pos, n);
+			pos += n;
+			if (!(at->post_left -= n)) {
+				analog_trigger_send_type(session, at->sdi,
+						SR_DF_FRAME_END);
+				at->state = ATRIG_SEARCHING;
+			}
+			continue;
+		}
+
+		sr_stage_begin(session, &timer);
+		match = sr_analog_matcher_scan(at->matcher,
+				analog->data + pos * stride + index,
+				num_samples - pos, stride);
+		sr_stage_end(session, &timer, "trigger", NULL,
+			     num_samples - pos);
+		if (match < 0) {
+			analog_trigger_keep(at, analog->data + pos * stride,
+					num_samples - pos, stride);
+			break;
+		}
+
+		analog_trigger_keep(at, analog->data + pos * stride,
+				match, stride);
+		pos += match;
+		sr_dbg("Analog software trigger fired.");
+
+		if (at->conf.post_samples)
+			analog_trigger_send_type(session, at->sdi,
+					SR_DF_FRAME_BEGIN);
+		if (at->hist_probes == stride)
+			analog_trigger_send_history(session, at, analog, pos);
+		at->hist_start = at->hist_len = 0;
+		analog_trigger_send_type(session, at->sdi, SR_DF_TRIGGER);
+		if (at->conf.post_samples) {
+			at->state = ATRIG_IN_FRAME;
+			at->post_left = at->conf.post_samples;
+		} else {
+			at->state = ATRIG_PASS;
+		}
+	}
+}
+
+/*
+ * Hold back the trigger device's data of the trigger probe until the
+ * analog software trigger fires, and send it on in frames around each
+ * trigger, or all of it from the first one on. Returns TRUE if the
+ * packet was taken care of.
+ */
+static gboolean analog_trigger_filter(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct analog_trigger_state *at;
+	const struct sr_datafeed_analog_raw *raw;
+	struct sr_datafeed_analog analog;
+	size_t size;
+	float *buf;
+	GSList *probes;
+	int index;
+
+	if (!(at = session->analog_trigger) || sdi != at->sdi)
+		return FALSE;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		/* A new acquisition, so arm the trigger again. */
+		sr_analog_matcher_reset(at->matcher);
+		at->state = ATRIG_SEARCHING;
+		at->hist_start = at->hist_len = 0;
+		return FALSE;
+	case SR_DF_END:
+		if (at->state == ATRIG_IN_FRAME)
+			analog_trigger_send_type(session, sdi, SR_DF_FRAME_END);
+		at->state = ATRIG_SEARCHING;
+		return FALSE;
+	case SR_DF_FRAME_BEGIN:
+	case SR_DF_FRAME_END:
+		/* The trigger makes the frames, unless passing all on. */
+		return at->conf.post_samples != 0;
+	case SR_DF_ANALOG:
+		probes = ((const struct sr_datafeed_analog *)
+				packet->payload)->probes;
+		break;
+	case SR_DF_ANALOG_RAW:
+		probes = ((const struct sr_datafeed_analog_raw *)
+				packet->payload)->probes;
+		break;
+	default:
+		return FALSE;
+	}
+
+	if ((index = g_slist_index(probes, at->probe)) < 0)
+		return FALSE;
+
+	if (packet->type == SR_DF_ANALOG) {
+		analog_trigger_data(session, at, packet->payload, index);
+		return TRUE;
+	}
+
+	/* The matcher needs the values, so convert raw data first. */
+	raw = packet->payload;
+	size = (size_t)raw->num_samples * g_slist_length(raw->probes)
+			* sizeof(float);
+	if (size > at->buf_size) {
+		if (!(buf = g_try_realloc(at->buf, size))) {
+			sr_err("%s: buf malloc failed", __func__);
+			return TRUE;
+		}
+		at->buf = buf;
+		at->buf_size = size;
+	}
+	if (sr_analog_raw_to_float(raw, at->buf) != SR_OK)
+		return TRUE;
+
+	analog.probes = raw->probes;
+	analog.num_samples = raw->num_samples;
+	analog.mq = raw->mq;
+	analog.unit = raw->unit;
+	analog.mqflags = raw->mqflags;
+	analog.data = at->buf;
+	analog.start_sample = raw->start_sample;
+	analog.timestamp = raw->timestamp;
+	analog.timestamps = NULL;
+	analog_trigger_data(session, at, &analog, index);
+
+	return TRUE;
+}
+
+/* Make sure a transpose buffer holds at least size bytes. */
+static gboolean planar_reserve(float **buf, size_t *buf_size, size_t size)
+{
+	float *p;
+
+	if (size <= *buf_size)
+		return TRUE;
+	if (!(p = g_try_realloc(*buf, size))) {
+		sr_err("%s: buf malloc failed", __func__);
+		return FALSE;
+	}
+	*buf = p;
+	*buf_size = size;
+
+	return TRUE;
+}
+
+static void callback_pass(struct datafeed_callback *cb_struct,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_analog *analog;
+	struct sr_datafeed_analog planar_analog;
+	struct sr_datafeed_packet planar;
+	uint64_t num_probes;
+
+	if (cb_struct->planar && packet->type == SR_DF_ANALOG) {
+		analog = packet->payload;
+		num_probes = g_slist_length(analog->probes);
+		/* One probe or one sample look the same either way. */
+		if (num_probes > 1 && analog->num_samples > 1) {
+			if (!planar_reserve(&cb_struct->planar_buf,
+					&cb_struct->planar_size,
+					num_probes * analog->num_samples
+					* sizeof(float)))
+				return;
+			sr_analog_transpose(analog->data,
+					cb_struct->planar_buf,
+					analog->num_samples, num_probes);
+			planar_analog = *analog;
+			planar_analog.data = cb_struct->planar_buf;
+			planar.type = SR_DF_ANALOG;
+			planar.payload = &planar_analog;
+			packet = &planar;
+		}
+	}
+
+	if (cb_struct->bcast)
+		bcast_queue(cb_struct->bcast, cb_struct, sdi, packet);
+	else
+		callback_call(sdi, packet, cb_struct);
+}
+
+static struct chunk_state *chunk_state_get(
+		struct datafeed_callback *cb_struct,
+		const struct sr_dev_inst *sdi)
+{
+	GSList *l;
+	struct chunk_state *state;
+
+	for (l = cb_struct->chunk_states; l; l = l->next) {
+		state = l->data;
+		if (state->sdi == sdi)
+			return state;
+	}
+
+	if (!(state = g_try_malloc0(sizeof(struct chunk_state)))) {
+		sr_err("%s: state malloc failed", __func__);
+		return NULL;
+	}
+	state->sdi = sdi;
+	cb_struct->chunk_states = g_slist_prepend(cb_struct->chunk_states,
+			state);
+
+	return state;
+}
+
+/* Make sure a buffer holds at least size bytes. */
+static gboolean chunk_reserve(void **buf, uint64_t *buf_size, uint64_t size)
+{
+	void *p;
+
+	if (size <= *buf_size)
+		return TRUE;
+	if (!(p = g_try_realloc(*buf, size))) {
+		sr_err("%s: buf malloc failed", __func__);
+		return FALSE;
+	}
+	*buf = p;
+	*buf_size = size;
+
+	return TRUE;
+}
+
+static void chunk_logic_flush(struct datafeed_callback *cb_struct,
+		struct chunk_state *state)
+{
+	struct sr_datafeed_packet packet;
+
+	if (!state->logic.length)
+		return;
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &state->logic;
+	callback_pass(cb_struct, state->sdi, &packet);
+	state->logic.length = 0;
+}
+
+static void chunk_analog_flush(struct datafeed_callback *cb_struct,
+		struct chunk_state *state)
+{
+	struct sr_datafeed_packet packet;
+
+	if (!state->analog.num_samples)
+		return;
+
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &state->analog;
+	callback_pass(cb_struct, state->sdi, &packet);
+	state->analog.num_samples = 0;
+}
+
+/*
+ * Coalesce logic data into packets of the callback's size, or split it.
+ * Whole packets are passed on from the sender's buffer, only the rest is
+ * copied to be sent with the next data.
+ */
+static void chunk_logic(struct datafeed_callback *cb_struct,
+		struct chunk_state *state, const struct sr_datafeed_logic *logic)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic part;
+	uint64_t size, length, offset, n;
+	uint16_t unitsize;
+
+	unitsize = logic->unitsize;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = logic;
+	if (!unitsize) {
+		chunk_logic_flush(cb_struct, state);
+		callback_pass(cb_struct, state->sdi, &packet);
+		return;
+	}
+
+	/* What's held back only goes on with the samples right after it. */
+	if (state->logic.length && (state->logic.unitsize != unitsize
+	    || state->logic.start_sample + state->logic.length / unitsize
+	    != logic->start_sample))
+		chunk_logic_flush(cb_struct, state);
+
+	size = MAX(cb_struct->chunk_size / unitsize, 1) * unitsize;
+	length = logic->length - logic->length % unitsize;
+	offset = 0;
+	if (state->logic.length) {
+		n = MIN(size - state->logic.length, length);
+		memcpy(state->logic_buf + state->logic.length, logic->data, n);
+		state->logic.length += n;
+		offset = n;
+		if (state->logic.length == size)
+			chunk_logic_flush(cb_struct, state);
+	}
+
+	packet.payload = &part;
+	part = *logic;
+	for (; length - offset >= size; offset += size) {
+		part.data = (uint8_t *)logic->data + offset;
+		part.length = size;
+		part.start_sample = logic->start_sample + offset / unitsize;
+		callback_pass(cb_struct, state->sdi, &packet);
+	}
+	if (offset == length)
+		return;
+
+	part.data = (uint8_t *)logic->data + offset;
+	part.length = length - offset;
+	part.start_sample = logic->start_sample + offset / unitsize;
+	if (!chunk_reserve((void **)&state->logic_buf, &state->logic_buf_size,
+			size)) {
+		callback_pass(cb_struct, state->sdi, &packet);
+		return;
+	}
+	state->logic = part;
+	state->logic.data = state->logic_buf;
+	memcpy(state->logic_buf, part.data, part.length);
+	state->logic_since = g_get_monotonic_time();
+}
+
+/* Whether analog data can go in the same packet as what's held back. */
+static gboolean chunk_analog_continues(const struct chunk_state *state,
+		const struct sr_datafeed_analog *analog)
+{
+	const struct sr_datafeed_analog *held;
+	const GSList *a, *b;
+
+	held = &state->analog;
+	if (analog->timestamps || analog->mq != held->mq
+	    || analog->unit != held->unit || analog->mqflags != held->mqflags
+	    || analog->start_sample != held->start_sample
+	    + (uint64_t)held->num_samples)
+		return FALSE;
+
+	for (a = analog->probes, b = held->probes; a && b;
+			a = a->next, b = b->next)
+		if (a->data != b->data)
+			return FALSE;
+
+	return !a && !b;
+}
+
+/* The same as chunk_logic(), for analog data. */
+static void chunk_analog(struct datafeed_callback *cb_struct,
+		struct chunk_state *state, const struct sr_datafeed_analog *analog)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog part;
+	uint64_t size, num_samples, offset, n;
+	unsigned int num_probes;
+
+	num_probes = g_slist_length(analog->probes);
+	packet.type = SR_DF_ANALOG;
+	packet.payload = analog;
+	if (state->analog.num_samples && !chunk_analog_continues(state,
+			analog))
+		chunk_analog_flush(cb_struct, state);
+	/* Samples taken at times of their own are passed on as they are. */
+	if (!num_probes || analog->timestamps || analog->num_samples <= 0) {
+		chunk_analog_flush(cb_struct, state);
+		callback_pass(cb_struct, state->sdi, &packet);
+		return;
+	}
+
+	size = MAX(cb_struct->chunk_size / (num_probes * sizeof(float)), 1);
+	num_samples = analog->num_samples;
+	offset = 0;
+	if (state->analog.num_samples) {
+		n = MIN(size - state->analog.num_samples, num_samples);
+		memcpy(state->analog_buf + state->analog.num_samples
+				* num_probes, analog->data,
+				n * num_probes * sizeof(float));
+		state->analog.num_samples += n;
+		offset = n;
+		if ((uint64_t)state->analog.num_samples == size)
+			chunk_analog_flush(cb_struct, state);
+	}
+
+	packet.payload = &part;
+	part = *analog;
+	for (; num_samples - offset >= size; offset += size) {
+		part.data = analog->data + offset * num_probes;
+		part.num_samples = size;
+		part.start_sample = analog->start_sample + offset;
+		callback_pass(cb_struct, state->sdi, &packet);
+	}
+	if (offset == num_samples)
+		return;
+
+	part.data = analog->data + offset * num_probes;
+	part.num_samples = num_samples - offset;
+	part.start_sample = analog->start_sample + offset;
+	if (!chunk_reserve((void **)&state->analog_buf,
+			&state->analog_buf_size,
+			size * num_probes * sizeof(float))) {
+		callback_pass(cb_struct, state->sdi, &packet);
+		return;
+	}
+	g_slist_free(state->analog.probes);
+	state->analog = part;
+	state->analog.probes = g_slist_copy(analog->probes);
+	state->analog.data = state->analog_buf;
+	memcpy(state->analog_buf, part.data,
+			part.num_samples * num_probes * sizeof(float));
+	state->analog_since = g_get_monotonic_time();
+}
+
+/* Pass a packet on to a callback with a preferred packet size. */
+static void chunk_send(struct datafeed_callback *cb_struct,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct chunk_state *state;
+
+	if (!(state = chunk_state_get(cb_struct, sdi))) {
+		callback_pass(cb_struct, sdi, packet);
+		return;
+	}
+
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		chunk_logic(cb_struct, state, packet->payload);
+		return;
+	case SR_DF_ANALOG:
+		chunk_analog(cb_struct, state, packet->payload);
+		return;
+	default:
+		/* Anything else comes after the data sent before it. */
+		chunk_logic_flush(cb_struct, state);
+		chunk_analog_flush(cb_struct, state);
+		break;
+	}
+
+	callback_pass(cb_struct, sdi, packet);
+}
+
+/*
+ * Pass on the data the callbacks held back for as long as they allow.
+ * Returns when the next is due, or -1 if none of them is waiting.
+ */
+static int64_t chunk_flush_due(struct sr_session *session)
+{
+	GSList *l, *s;
+	struct datafeed_callback *cb_struct;
+	struct chunk_state *state;
+	int64_t now, next, due, latency;
+
+	now = next = -1;
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		latency = cb_struct->chunk_latency;
+		/* The low latency profile bounds what any callback waits. */
+		if (cb_struct->chunk_size
+		    && session->profile == SR_PROFILE_LOW_LATENCY
+		    && (!latency || latency > LOW_LATENCY_MS * 1000))
+			latency = LOW_LATENCY_MS * 1000;
+		if (!latency)
+			continue;
+		for (s = cb_struct->chunk_states; s; s = s->next) {
+			state = s->data;
+			if (!state->logic.length && !state->analog.num_samples)
+				continue;
+			if (now < 0)
+				now = g_get_monotonic_time();
+			due = state->logic_since + latency;
+			if (state->logic.length && due <= now)
+				chunk_logic_flush(cb_struct, state);
+			else if (state->logic.length)
+				next = next < 0 ? due : MIN(next, due);
+			due = state->analog_since + latency;
+			if (state->analog.num_samples && due <= now)
+				chunk_analog_flush(cb_struct, state);
+			else if (state->analog.num_samples)
+				next = next < 0 ? due : MIN(next, due);
+		}
+	}
+
+	return next;
+}
+
+static void callback_deliver(struct datafeed_callback *cb_struct,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	if (cb_struct->chunk_size)
+		chunk_send(cb_struct, sdi, packet);
+	else
+		callback_pass(cb_struct, sdi, packet);
+}
+
+static struct decim_state *decim_state_get(
+		struct datafeed_callback *cb_struct,
+		const struct sr_dev_inst *sdi)
+{
+	GSList *l;
+	struct decim_state *state;
+
+	for (l = cb_struct->decim_states; l; l = l->next) {
+		state = l->data;
+		if (state->sdi == sdi)
+			return state;
+	}
+
+	if (!(state = g_try_malloc0(sizeof(struct decim_state)))) {
+		sr_err("%s: state malloc failed", __func__);
+		return NULL;
+	}
+	state->sdi = sdi;
+	cb_struct->decim_states = g_slist_prepend(cb_struct->decim_states,
+			state);
+
+	return state;
+}
+
+/* Make sure the output buffer holds at least size bytes. */
+static gboolean decim_out_reserve(struct decim_state *state, size_t size)
+{
+	void *out;
+
+	if (size <= state->out_size)
+		return TRUE;
+	if (!(out = g_try_realloc(state->out, size))) {
+		sr_err("%s: out malloc failed", __func__);
+		return FALSE;
+	}
+	state->out = out;
+	state->out_size = size;
+
+	return TRUE;
+}
+
+static void decim_logic_flush(struct datafeed_callback *cb_struct,
+		struct decim_state *state, uint8_t *out, uint64_t num_blocks,
+		uint64_t start_sample)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+
+	if (!num_blocks)
+		return;
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.length = num_blocks * 2 * state->unitsize;
+	logic.unitsize = state->unitsize;
+	logic.data = out;
+	logic.start_sample = start_sample;
+	logic.timestamp = state->logic_timestamp;
+	callback_deliver(cb_struct, state->sdi, &packet);
+}
+
+static void decim_logic(struct datafeed_callback *cb_struct,
+		struct decim_state *state, const struct sr_datafeed_logic *logic)
+{
+	const uint8_t *sample;
+	uint8_t *out;
+	uint64_t num_samples, num_blocks, first, i;
+	unsigned int unitsize, j;
+
+	unitsize = logic->unitsize;
+	if (unitsize != state->unitsize) {
+		g_free(state->logic_and);
+		if (!(state->logic_and = g_try_malloc(2 * unitsize))) {
+			sr_err("%s: block malloc failed", __func__);
+			state->unitsize = 0;
+			return;
+		}
+		state->logic_or = state->logic_and + unitsize;
+		state->unitsize = unitsize;
+		state->logic_count = 0;
+	}
+
+	num_samples = logic->length / unitsize;
+	if (!decim_out_reserve(state,
+			(num_samples / cb_struct->decimate + 1) * 2 * unitsize))
+		return;
+
+	state->logic_timestamp = logic->timestamp;
+	out = state->out;
+	num_blocks = first = 0;
+	sample = logic->data;
+	for (i = 0; i < num_samples; i++, sample += unitsize) {
+		if (!state->logic_count) {
+			state->logic_start = logic->start_sample + i;
+			memcpy(state->logic_and, sample, unitsize);
+			memcpy(state->logic_or, sample, unitsize);
+		} else {
+			for (j = 0; j < unitsize; j++) {
+				state->logic_and[j] &= sample[j];
+				state->logic_or[j] |= sample[j];
+			}
+		}
+		if (++state->logic_count == cb_struct->decimate) {
+			if (!num_blocks)
+				first = state->logic_start;
+			memcpy(out, state->logic_and, 2 * unitsize);
+			out += 2 * unitsize;
+			num_blocks++;
+			state->logic_count = 0;
+		}
+	}
+
+	decim_logic_flush(cb_struct, state, state->out, num_blocks, first);
+}
+
+static void decim_analog_flush(struct datafeed_callback *cb_struct,
+		struct decim_state *state, float *out, uint64_t num_blocks,
+		uint64_t start_sample)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+
+	if (!num_blocks)
+		return;
+
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	analog = state->analog;
+	analog.num_samples = num_blocks * 2;
+	analog.data = out;
+	analog.start_sample = start_sample;
+	analog.timestamps = NULL;
+	callback_deliver(cb_struct, state->sdi, &packet);
+}
+
+static void decim_analog(struct datafeed_callback *cb_struct,
+		struct decim_state *state, const struct sr_datafeed_analog *analog)
+{
+	const float *sample;
+	float *out;
+	uint64_t num_blocks, first;
+	unsigned int num_probes, i, j;
+
+	num_probes = g_slist_length(analog->probes);
+	if (num_probes != state->num_probes) {
+		g_free(state->analog_min);
+		if (!(state->analog_min = g_try_malloc(2 * num_probes
+				* sizeof(float)))) {
+			sr_err("%s: block malloc failed", __func__);
+			state->num_probes = 0;
+			return;
+		}
+		state->analog_max = state->analog_min + num_probes;
+		state->num_probes = num_probes;
+		state->analog_count = 0;
+	}
+	/* Keep what the partial block needs to be sent later on. */
+	g_slist_free(state->analog.probes);
+	state->analog = *analog;
+	state->analog.probes = g_slist_copy(analog->probes);
+
+	if (!decim_out_reserve(state, (analog->num_samples
+			/ cb_struct->decimate + 1) * 2 * num_probes
+			* sizeof(float)))
+		return;
+
+	out = state->out;
+	num_blocks = first = 0;
+	sample = analog->data;
+	for (i = 0; i < (unsigned int)analog->num_samples;
+			i++, sample += num_probes) {
+		if (!state->analog_count) {
+			state->analog_start = analog->start_sample + i;
+			memcpy(state->analog_min, sample,
+					num_probes * sizeof(float));
+			memcpy(state->analog_max, sample,
+					num_probes * sizeof(float));
+		} else {
+			for (j = 0; j < num_probes; j++) {
+				if (sample[j] < state->analog_min[j])
+					state->analog_min[j] = sample[j];
+				if (sample[j] > state->analog_max[j])
+					state->analog_max[j] = sample[j];
+			}
+		}
+		if (++state->analog_count == cb_struct->decimate) {
+			if (!num_blocks)
+				first = state->analog_start;
+			memcpy(out, state->analog_min,
+					2 * num_probes * sizeof(float));
+			out += 2 * num_probes;
+			num_blocks++;
+			state->analog_count = 0;
+		}
+	}
+
+	decim_analog_flush(cb_struct, state, state->out, num_blocks, first);
+}
+
+/* Pass a packet on to a decimating callback. */
+static void decim_send(struct datafeed_callback *cb_struct,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct decim_state *state;
+
+	if (!(state = decim_state_get(cb_struct, sdi))) {
+		callback_deliver(cb_struct, sdi, packet);
+		return;
+	}
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		state->logic_count = state->analog_count = 0;
+		break;
+	case SR_DF_LOGIC:
+		decim_logic(cb_struct, state, packet->payload);
+		return;
+	case SR_DF_ANALOG:
+		decim_analog(cb_struct, state, packet->payload);
+		return;
+	case SR_DF_END:
+		/* Send whatever is left of the last blocks. */
+		if (state->logic_count) {
+			decim_logic_flush(cb_struct, state,
+					state->logic_and, 1, state->logic_start);
+			state->logic_count = 0;
+		}
+		if (state->analog_count) {
+			decim_analog_flush(cb_struct, state,
+					state->analog_min, 1, state->analog_start);
+			state->analog_count = 0;
+		}
+		break;
+	}
+
+	callback_deliver(cb_struct, sdi, packet);
+}
+
+static void callback_send(struct datafeed_callback *cb_struct,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	if (cb_struct->decimate > 1)
+		decim_send(cb_struct, sdi, packet);
+	else
+		callback_deliver(cb_struct, sdi, packet);
+}
+
+/* Send RLE data as SR_DF_LOGIC packets to the callbacks that need it so. */
+static void rle_dispatch(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_logic_rle *rle)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	uint64_t run, offset, max, n;
+
+	if (!session->rle_buf
+	    && !(session->rle_buf = g_try_malloc(RLE_EXPAND_SIZE))) {
+		sr_err("%s: buf malloc failed", __func__);
+		return;
+	}
+
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.unitsize = rle->unitsize;
+	logic.data = session->rle_buf;
+	logic.start_sample = rle->start_sample;
+	logic.timestamp = rle->timestamp;
+	max = RLE_EXPAND_SIZE / rle->unitsize;
+	run = offset = 0;
+	while ((n = sr_logic_rle_expand(rle, &run, &offset,
+			session->rle_buf, max))) {
+		logic.length = n * rle->unitsize;
+		for (l = session->datafeed_callbacks; l; l = l->next) {
+			cb_struct = l->data;
+			if (!cb_struct->rle)
+				callback_send(cb_struct, sdi, &packet);
+		}
+		logic.start_sample += n;
+	}
+}
+
+/* Convert raw analog data to floats, in the session's analog buffer. */
+static float *analog_raw_convert(struct sr_session *session,
+		const struct sr_datafeed_analog_raw *raw)
+{
+	size_t size;
+	float *buf;
+
+	size = (size_t)raw->num_samples * g_slist_length(raw->probes)
+			* sizeof(float);
+	if (size > session->analog_buf_size) {
+		if (!(buf = g_try_realloc(session->analog_buf, size))) {
+			sr_err("%s: buf malloc failed", __func__);
+			return NULL;
+		}
+		session->analog_buf = buf;
+		session->analog_buf_size = size;
+	}
+
+	if (sr_analog_raw_to_float(raw, session->analog_buf) != SR_OK)
+		return NULL;
+
+	return session->analog_buf;
+}
+
+/*
+ * Send raw analog data as SR_DF_ANALOG packets to the callbacks that
+ * need it so.
+ */
+static void analog_raw_dispatch(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_analog_raw *raw)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+
+	if (!analog_raw_convert(session, raw))
+		return;
+
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	analog.probes = raw->probes;
+	analog.num_samples = raw->num_samples;
+	analog.mq = raw->mq;
+	analog.unit = raw->unit;
+	analog.mqflags = raw->mqflags;
+	analog.data = session->analog_buf;
+	analog.start_sample = raw->start_sample;
+	analog.timestamp = raw->timestamp;
+	analog.timestamps = NULL;
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		if (!cb_struct->analog_raw)
+			callback_send(cb_struct, sdi, &packet);
+	}
+}
+
+static struct sr_edge_conv *edge_conv_get(struct sr_session *session,
+		const struct sr_dev_inst *sdi)
+{
+	GSList *l;
+	struct edge_state *state;
+
+	for (l = session->edge_states; l; l = l->next) {
+		state = l->data;
+		if (state->sdi == sdi)
+			return state->conv;
+	}
+
+	if (!(state = g_try_malloc(sizeof(struct edge_state)))) {
+		sr_err("%s: state malloc failed", __func__);
+		return NULL;
+	}
+	if (!(state->conv = sr_edge_conv_new())) {
+		g_free(state);
+		return NULL;
+	}
+	state->sdi = sdi;
+	session->edge_states = g_slist_prepend(session->edge_states, state);
+
+	return state->conv;
+}
+
+/*
+ * Send logic data as SR_DF_LOGIC_EDGES packets to the callbacks that want
+ * it so. A header packet starts the sample numbers over.
+ */
+static void edges_dispatch(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+	struct sr_datafeed_packet edges_packet;
+	struct sr_edge_conv *conv;
+
+	if (!(conv = edge_conv_get(session, sdi)))
+		return;
+
+	if (packet->type == SR_DF_HEADER) {
+		sr_edge_conv_reset(conv);
+		return;
+	}
+
+	edges_packet.type = SR_DF_LOGIC_EDGES;
+	if (packet->type == SR_DF_LOGIC)
+		edges_packet.payload = sr_edge_conv_logic(conv, packet->payload);
+	else
+		edges_packet.payload = sr_edge_conv_rle(conv, packet->payload);
+	if (!edges_packet.payload)
+		return;
+
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		if (cb_struct->edges)
+			callback_send(cb_struct, sdi, &edges_packet);
+	}
+}
+
+/* The entry of a probe in a frame, added if it isn't there yet, or -1. */
+static int frame_probe_get(struct frame_slot *slot,
+		const struct sr_probe *probe)
+{
+	struct sr_frame *frame;
+	struct sr_frame_probe *probes;
+	uint64_t *sizes;
+	unsigned int i;
+
+	frame = &slot->frame;
+	for (i = 0; i < frame->num_probes; i++) {
+		if (frame->probes[i].probe == probe)
+			return i;
+	}
+
+	/* Entries past num_probes keep their data from earlier frames. */
+	if (i == slot->probes_size) {
+		if (!(probes = g_try_realloc(frame->probes,
+				(i + 1) * sizeof(struct sr_frame_probe)))) {
+			sr_err("%s: probes malloc failed", __func__);
+			return -1;
+		}
+		frame->probes = probes;
+		if (!(sizes = g_try_realloc(slot->data_sizes,
+				(i + 1) * sizeof(uint64_t)))) {
+			sr_err("%s: sizes malloc failed", __func__);
+			return -1;
+		}
+		slot->data_sizes = sizes;
+		probes[i].data = NULL;
+		sizes[i] = 0;
+		slot->probes_size++;
+	}
+	frame->probes[i].probe = probe;
+	frame->probes[i].num_samples = 0;
+	frame->num_probes++;
+
+	return i;
+}
+
+/* Make room for size values in the data of a probe's entry. */
+static int frame_probe_grow(struct frame_slot *slot, int i, uint64_t size)
+{
+	float *data;
+
+	if (size <= slot->data_sizes[i])
+		return SR_OK;
+
+	size = MAX(size, 2 * slot->data_sizes[i]);
+	if (!(data = g_try_realloc(slot->frame.probes[i].data,
+			size * sizeof(float)))) {
+		sr_err("%s: data malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	slot->frame.probes[i].data = data;
+	slot->data_sizes[i] = size;
+
+	return SR_OK;
+}
+
+/* Add the values of an analog packet to a frame, probe by probe. */
+static void frame_append(struct frame_slot *slot, GSList *probes,
+		int mq, int unit, uint64_t mqflags, const float *data,
+		int num_samples)
+{
+	struct sr_frame_probe *fp;
+	unsigned int num_probes, j;
+	GSList *l;
+	float *dst;
+	int i, k;
+
+	num_probes = g_slist_length(probes);
+	for (l = probes, j = 0; l; l = l->next, j++) {
+		if ((i = frame_probe_get(slot, l->data)) < 0)
+			continue;
+		fp = &slot->frame.probes[i];
+		if (frame_probe_grow(slot, i,
+				fp->num_samples + num_samples) != SR_OK)
+			continue;
+		fp->mq = mq;
+		fp->unit = unit;
+		fp->mqflags = mqflags;
+		dst = fp->data + fp->num_samples;
+		for (k = 0; k < num_samples; k++)
+			dst[k] = data[k * num_probes + j];
+		fp->num_samples += num_samples;
+	}
+}
+
+/*
+ * Allocate a device's frame slots. If the device tells its memory depth
+ * (SR_CONF_BUFFERSIZE), each slot gets room for that many values of each
+ * enabled analog probe, so frames needn't grow them later.
+ */
+static int frame_history_alloc(struct sr_session *session,
+		struct frame_history *hist)
+{
+	const struct sr_dev_inst *sdi;
+	const struct sr_probe *probe;
+	struct frame_slot *slot;
+	GVariant *gvar;
+	GSList *l;
+	uint64_t depth;
+	unsigned int i;
+	int j;
+
+	if (!(hist->slots = g_try_malloc0(session->frame_history_size
+			* sizeof(struct frame_slot)))) {
+		sr_err("%s: slots malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	sdi = hist->sdi;
+	depth = 0;
+	if (sdi && sdi->driver && sr_config_get(sdi->driver, sdi, NULL,
+			SR_CONF_BUFFERSIZE, &gvar) == SR_OK) {
+		depth = g_variant_get_uint64(gvar);
+		g_variant_unref(gvar);
+	}
+	if (!depth)
+		return SR_OK;
+
+	for (i = 0; i < session->frame_history_size; i++) {
+		slot = &hist->slots[i];
+		for (l = sdi->probes; l; l = l->next) {
+			probe = l->data;
+			if (probe->type != SR_PROBE_ANALOG || !probe->enabled)
+				continue;
+			if ((j = frame_probe_get(slot, probe)) < 0
+			    || frame_probe_grow(slot, j, depth) != SR_OK)
+				break;
+		}
+		slot->frame.num_probes = 0;
+	}
+
+	return SR_OK;
+}
+
+/* Keep the analog data of a device's frames in its frame history. */
+static void frame_history_record(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct frame_history *hist;
+	struct frame_slot *slot;
+	const struct sr_datafeed_analog *analog;
+	const struct sr_datafeed_analog_raw *raw;
+	const float *data;
+	GSList *l;
+
+	if (!session->frame_history_size)
+		return;
+
+	if (packet->type != SR_DF_HEADER && packet->type != SR_DF_END
+	    && packet->type != SR_DF_FRAME_BEGIN
+	    && packet->type != SR_DF_FRAME_END
+	    && packet->type != SR_DF_ANALOG
+	    && packet->type != SR_DF_ANALOG_RAW)
+		return;
+
+	hist = NULL;
+	for (l = session->frame_histories; l; l = l->next) {
+		if (((struct frame_history *)l->data)->sdi == sdi) {
+			hist = l->data;
+			break;
+		}
+	}
+	if (!hist) {
+		if (packet->type != SR_DF_HEADER
+		    && packet->type != SR_DF_FRAME_BEGIN)
+			return;
+		if (!(hist = g_try_malloc0(sizeof(struct frame_history)))) {
+			sr_err("%s: hist malloc failed", __func__);
+			return;
+		}
+		hist->sdi = sdi;
+		g_mutex_lock(&session->frame_mutex);
+		session->frame_histories = g_slist_prepend(
+				session->frame_histories, hist);
+		g_mutex_unlock(&session->frame_mutex);
+	}
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		g_mutex_lock(&session->frame_mutex);
+		hist->next = hist->num_frames = 0;
+		hist->frame_num = 0;
+		hist->cur = NULL;
+		g_mutex_unlock(&session->frame_mutex);
+		break;
+	case SR_DF_END:
+		/* An unfinished frame is dropped. */
+		hist->cur = NULL;
+		break;
+	case SR_DF_FRAME_BEGIN:
+		if (!hist->slots && frame_history_alloc(session, hist) != SR_OK)
+			break;
+		g_mutex_lock(&session->frame_mutex);
+		/* The oldest frame makes way. */
+		if (!hist->cur
+		    && hist->num_frames == session->frame_history_size)
+			hist->num_frames--;
+		slot = hist->cur = &hist->slots[hist->next];
+		g_mutex_unlock(&session->frame_mutex);
+		slot->frame.frame_num = hist->frame_num++;
+		slot->frame.timestamp = g_get_monotonic_time();
+		slot->frame.num_probes = 0;
+		break;
+	case SR_DF_FRAME_END:
+		if (!hist->cur)
+			break;
+		g_mutex_lock(&session->frame_mutex);
+		hist->cur = NULL;
+		hist->next = (hist->next + 1) % session->frame_history_size;
+		hist->num_frames++;
+		g_mutex_unlock(&session->frame_mutex);
+		break;
+	case SR_DF_ANALOG:
+		if (!(slot = hist->cur))
+			break;
+		analog = packet->payload;
+		frame_append(slot, analog->probes, analog->mq, analog->unit,
+				analog->mqflags, analog->data,
+				analog->num_samples);
+		break;
+	case SR_DF_ANALOG_RAW:
+		if (!(slot = hist->cur))
+			break;
+		raw = packet->payload;
+		if (!(data = analog_raw_convert(session, raw)))
+			break;
+		frame_append(slot, raw->probes, raw->mq, raw->unit,
+				raw->mqflags, data, raw->num_samples);
+		break;
+	}
+}
+
+/* Run all datafeed callbacks on a packet. */
+static void datafeed_dispatch(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+	struct sr_datafeed_packet *shared;
+	struct bcast_ring *bcast;
+	const struct sr_datafeed_packet *outer;
+	const struct sr_dev_inst *outer_sdi;
+	gboolean expand, edges, convert;
+
+	shared = NULL;
+	if (session->workers_running && !sr_session_cur_buffer_get()
+	    && (packet->type == SR_DF_LOGIC || packet->type == SR_DF_ANALOG)) {
+		/* Copy the sample data only once, for all callback threads. */
+		if ((shared = sr_packet_copy(packet))) {
+			packet = shared;
+			g_private_set(&cur_buffer, sr_packet_buffer_get(shared));
+		}
+	}
+
+	/*
+	 * The callback threads getting the packet as it is share one entry
+	 * of the ring. Whatever an outer dispatch holds back goes first.
+	 */
+	outer = NULL;
+	outer_sdi = NULL;
+	if ((bcast = session->workers_running ? session->bcast : NULL)) {
+		bcast_flush(bcast);
+		outer = bcast->shared;
+		outer_sdi = bcast->shared_sdi;
+		bcast->shared = packet;
+		bcast->shared_sdi = sdi;
+	}
+
+	if (sr_log_enabled(SR_LOG_DBG))
+		datafeed_dump(packet);
+
+	frame_history_record(session, sdi, packet);
+	chunk_flush_due(session);
+
+	expand = edges = convert = FALSE;
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		if (cb_struct->edges && (packet->type == SR_DF_HEADER
+		    || packet->type == SR_DF_LOGIC
+		    || packet->type == SR_DF_LOGIC_RLE))
+			edges = TRUE;
+		if (cb_struct->edges && (packet->type == SR_DF_LOGIC
+		    || packet->type == SR_DF_LOGIC_RLE))
+			continue;
+		if (packet->type == SR_DF_LOGIC_RLE && !cb_struct->rle)
+			expand = TRUE;
+		else if (packet->type == SR_DF_ANALOG_RAW
+		    && !cb_struct->analog_raw)
+			convert = TRUE;
+		else
+			callback_send(cb_struct, sdi, packet);
+	}
+
+	if (edges)
+		edges_dispatch(session, sdi, packet);
+	if (expand)
+		rle_dispatch(session, sdi, packet->payload);
+	if (convert)
+		analog_raw_dispatch(session, sdi, packet->payload);
+
+	if (bcast) {
+		bcast_flush(bcast);
+		bcast->shared = outer;
+		bcast->shared_sdi = outer_sdi;
+	}
+
+	if (shared) {
+		g_private_set(&cur_buffer, NULL);
+		sr_packet_free(shared);
+	}
+}
+
+/**
+ * Send a packet whose payload data lives in a reference-counted buffer.
+ *
+ * This works like sr_session_send(), but datafeed consumers calling
+ * sr_datafeed_logic_ref() or sr_datafeed_analog_ref() on the payload will
+ * share the buffer instead of copying the data. The caller keeps its own
+ * reference to the buffer; sr_buffer_steal() can be used afterwards to
+ * find out whether the memory can be reused right away.
+ *
+ * @param sdi The device instance the packet originates from.
+ * @param packet The datafeed packet to send to the session bus.
+ * @param buf The buffer containing the payload's data. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_send_buffer(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, struct sr_buffer *buf)
+{
+	int ret;
+
+	if (!buf) {
+		sr_err("%s: buf was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	g_private_set(&cur_buffer, buf);
+	ret = sr_session_send(sdi, packet);
+	g_private_set(&cur_buffer, NULL);
+
+	return ret;
+}
+
+/**
+ * Send an SR_DF_ANALOG packet with the time each of its samples was taken.
+ *
+ * This works like sr_session_send(), and sets the timestamps field of the
+ * payload, which is NULL for packets sent any other way.
+ *
+ * @param sdi The device instance the packet originates from.
+ * @param packet The SR_DF_ANALOG packet to send to the session bus.
+ * @param timestamps One g_get_monotonic_time() timestamp for each of the
+ *                   packet's samples. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_send_timed(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet,
+		const int64_t *timestamps)
+{
+	int ret;
+
+	if (!packet || packet->type != SR_DF_ANALOG || !timestamps) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	g_private_set(&cur_timestamps, (gpointer)timestamps);
+	ret = sr_session_send(sdi, packet);
+	g_private_set(&cur_timestamps, NULL);
+
+	return ret;
+}
+
+/**
+ * Send an SR_DF_ANALOG packet with its data in planar layout.
+ *
+ * This works like sr_session_send(), but the packet's data holds all
+ * samples of its first probe, followed by all samples of its second probe,
+ * and so on, as drivers reading each probe into a buffer of its own have
+ * it. The data is interleaved once, for the transforms and the callbacks;
+ * callbacks which want it planar get it so with
+ * sr_session_datafeed_callback_planar_set().
+ *
+ * @param sdi The device instance the packet originates from.
+ * @param packet The SR_DF_ANALOG packet to send to the session bus.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_MALLOC upon memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_send_planar(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_analog *analog;
+	struct sr_datafeed_analog interleaved;
+	struct sr_datafeed_packet out;
+	struct dev_state *state;
+	uint64_t num_probes;
+
+	if (!sdi || !sdi->session || !packet
+	    || packet->type != SR_DF_ANALOG) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	analog = packet->payload;
+	num_probes = g_slist_length(analog->probes);
+	if (num_probes < 2 || analog->num_samples < 2)
+		return sr_session_send(sdi, packet);
+
+	if (!(state = dev_state_get(sdi->session, sdi)))
+		return SR_ERR_MALLOC;
+	if (!planar_reserve(&state->planar_buf, &state->planar_size,
+			num_probes * analog->num_samples * sizeof(float)))
+		return SR_ERR_MALLOC;
+	sr_analog_transpose(analog->data, state->planar_buf, num_probes,
+			analog->num_samples);
+
+	interleaved = *analog;
+	interleaved.data = state->planar_buf;
+	out.type = SR_DF_ANALOG;
+	out.payload = &interleaved;
+
+	return sr_session_send(sdi, &out);
+}
+
+/**
+ * Get the buffer backing the packet currently being sent.
+ *
+ * @return The buffer passed to sr_session_send_buffer() by the calling
+ *         thread, or NULL if the packet isn't backed by a buffer.
+ *
+ * @private
+ */
+SR_PRIV struct sr_buffer *sr_session_cur_buffer_get(void)
+{
+	return g_private_get(&cur_buffer);
+}
+
+/**
+ * Get the buffer pool of the session run by the calling thread.
+ *
+ * @return The pool, or NULL if there is no such session (or it has no pool).
+ *
+ * @private
+ */
+SR_PRIV struct sr_buffer_pool *sr_session_buffer_pool_get(void)
+{
+	struct sr_session *session;
+
+	session = g_private_get(&cur_session);
+
+	return session ? session->buffer_pool : NULL;
+}
+
+/**
+ * Get the session most recently started or run by the calling thread.
+ *
+ * Drivers add their event sources from their dev_acquisition_start() and
+ * receive callbacks, so this is the session those sources belong to.
+ *
+ * @return The session, or NULL if there is none.
+ *
+ * @private
+ */
+SR_PRIV struct sr_session *sr_session_cur_get(void)
+{
+	return g_private_get(&cur_session);
+}
+
+/**
+ * Set the depth of the datafeed queue.
+ *
+ * With a non-zero depth, packets sent by the drivers are put on a queue of
+ * the given number of entries while the session runs, and the datafeed
+ * callbacks are run on a separate thread. A slow callback then doesn't hold
+ * up the drivers anymore. If the callbacks can't keep up and the queue
+ * fills up, logic and analog packets are dropped and counted as overruns;
+ * all other packets are always delivered.
+ *
+ * Note that the datafeed callbacks will be called from a different thread
+ * than the one running sr_session_run() if the queue is enabled.
+ *
+ * @param session The session. Must not be NULL.
+ * @param depth The number of queue entries, rounded up to a power of two,
+ *              or 0 to run the callbacks directly from the drivers (the
+ *              default).
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, SR_ERR_BUG
+ *         if session is NULL, or SR_ERR if the session is running.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_queue_depth_set(struct sr_session *session,
+		unsigned int depth)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (depth > MAX_QUEUE_DEPTH) {
+		sr_err("%s: depth %u too large (max %d)", __func__,
+		       depth, MAX_QUEUE_DEPTH);
+		return SR_ERR_ARG;
+	}
+
+	if (session->queue) {
+		sr_err("Cannot change the queue depth while running.");
+		return SR_ERR;
+	}
+
+	session->queue_depth = depth;
+
+	return SR_OK;
+}
+
+/**
+ * Get the depth of the datafeed queue.
+ *
+ * @param session The session. Must not be NULL.
+ * @param depth Pointer where the depth set with sr_session_queue_depth_set()
+ *              will be stored. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_BUG if session is NULL.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_queue_depth_get(struct sr_session *session,
+		unsigned int *depth)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (!depth)
+		return SR_ERR_ARG;
+
+	*depth = session->queue_depth;
+
+	return SR_OK;
+}
+
+/**
+ * Get statistics about the datafeed queue.
+ *
+ * The counters are reset whenever the session is started. They can be
+ * read while the session is running, or after it ended. With threaded
+ * dispatch, the counters of all callback queues are included.
+ *
+ * @param session The session. Must not be NULL.
+ * @param overruns Pointer where the number of dropped packets will be
+ *                 stored. Can be NULL.
+ * @param max_used Pointer where the highest number of queue entries in use
+ *                 at the same time will be stored. Can be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_queue_stats_get(struct sr_session *session,
+		uint64_t *overruns, unsigned int *max_used)
+{
+	GSList *l;
+	struct datafeed_callback *cb_struct;
+	uint64_t total;
+	unsigned int most;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	total = session->queue_overruns;
+	most = session->queue_max_used;
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		total += cb_struct->overruns;
+		most = MAX(most, cb_struct->max_used);
+	}
+
+	if (overruns)
+		*overruns = total;
+	if (max_used)
+		*max_used = most;
+
+	return SR_OK;
+}
+
+/**
+ * Set the buffering profile of a session.
+ *
+ * Drivers collect some data before they pass it on, in every USB
+ * transfer or serial read, and keep some more queued up, so the host
+ * can fall behind for a moment without the device losing data. How much
+ * is a trade-off between latency and the rate the session can sustain,
+ * which each driver makes on its own by default. A profile makes that
+ * choice for all devices in the session the same way.
+ *
+ * With SR_PROFILE_LOW_LATENCY, drivers collect at most a couple of
+ * milliseconds of data at a time, callbacks with a packet size (see
+ * sr_session_datafeed_callback_packet_size_set()) don't get data held back
+ * for longer than that either, and the callback queues of threaded
+ * dispatch are shallow, so a slow callback gets data dropped rather than
+ * late. With SR_PROFILE_THROUGHPUT, drivers use larger transfers and
+ * more of them, and the callback queues are deeper.
+ *
+ * The profile takes effect when the devices are started.
+ *
+ * @param session The session. Must not be NULL.
+ * @param profile One of the SR_PROFILE_* values.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, SR_ERR_BUG
+ *         if session is NULL, or SR_ERR if the session is running.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_profile_set(struct sr_session *session, int profile)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (profile < SR_PROFILE_DEFAULT || profile > SR_PROFILE_THROUGHPUT) {
+		sr_err("%s: invalid profile %d", __func__, profile);
+		return SR_ERR_ARG;
+	}
+
+	if (session->running) {
+		sr_err("Cannot change the profile while running.");
+		return SR_ERR;
+	}
+
+	session->profile = profile;
+
+	return SR_OK;
+}
+
+/**
+ * Get the buffering profile of a session.
+ *
+ * @param session The session. Must not be NULL.
+ * @param profile Pointer where the profile set with
+ *                sr_session_profile_set() will be stored. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_BUG if session is NULL.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_profile_get(struct sr_session *session, int *profile)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (!profile)
+		return SR_ERR_ARG;
+
+	*profile = session->profile;
+
+	return SR_OK;
+}
+
+/**
+ * Get the buffering profile of the session a device runs in.
+ *
+ * @param sdi The device. Must not be NULL.
+ *
+ * @return One of the SR_PROFILE_* values, SR_PROFILE_DEFAULT for a
+ *         device which isn't in a session.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_dev_profile(const struct sr_dev_inst *sdi)
+{
+	if (!sdi || !sdi->session)
+		return SR_PROFILE_DEFAULT;
+
+	return sdi->session->profile;
+}
+
+/**
+ * Get how much data a device should collect in one transfer or read.
+ *
+ * @param sdi The device. Must not be NULL.
+ * @param ms The time the driver's data covers by default, in ms.
+ *
+ * @return The time the data should cover in the session's profile, in ms.
+ *
+ * @private
+ */
+SR_PRIV unsigned int sr_session_buffer_ms(const struct sr_dev_inst *sdi,
+		unsigned int ms)
+{
+	switch (sr_session_dev_profile(sdi)) {
+	case SR_PROFILE_LOW_LATENCY:
+		return MIN(ms, LOW_LATENCY_MS);
+	case SR_PROFILE_THROUGHPUT:
+		return ms * THROUGHPUT_BUFFER_FACTOR;
+	default:
+		return ms;
+	}
+}
+
+/**
+ * Get how much data a device should keep queued up in all, in transfers
+ * or reads waiting to be filled.
+ *
+ * Queued up transfers don't hold data back, they only give the host time
+ * to catch up, so only the throughput profile changes this.
+ *
+ * @param sdi The device. Must not be NULL.
+ * @param ms The time the driver's queue covers by default, in ms.
+ *
+ * @return The time the queue should cover in the session's profile, in ms.
+ *
+ * @private
+ */
+SR_PRIV unsigned int sr_session_queue_ms(const struct sr_dev_inst *sdi,
+		unsigned int ms)
+{
+	if (sr_session_dev_profile(sdi) == SR_PROFILE_THROUGHPUT)
+		return ms * THROUGHPUT_QUEUE_FACTOR;
+
+	return ms;
+}
+
+/**
+ * Get statistics about the session's main loop, the devices, the
+ * datafeed callbacks and, with stage timing, the stages of the datafeed.
+ *
+ * The counters are reset whenever the session is started. They can be
+ * read while the session is running, or after it ended.
+ *
+ * @param session The session. Must not be NULL.
+ * @param stats Pointer where a newly allocated struct sr_session_stats
+ *              will be stored, to be freed with g_free() by the caller.
+ *              Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR_ARG
+ *         upon invalid arguments, or SR_ERR_MALLOC upon memory allocation
+ *         errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_stats_get(struct sr_session *session,
+		struct sr_session_stats **stats)
+{
+	struct sr_session_stats *st;
+	struct datafeed_callback *cb_struct;
+	struct dev_state *state;
+	GSList *l;
+	unsigned int num_devs, num_callbacks, num_stages, i;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (!stats) {
+		sr_err("%s: stats was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	g_mutex_lock(&session->dev_mutex);
+	g_mutex_lock(&session->stage_mutex);
+
+	num_devs = g_slist_length(session->dev_states);
+	num_callbacks = g_slist_length(session->datafeed_callbacks);
+	num_stages = g_slist_length(session->stages);
+	/* All in one piece, so a g_free() takes care of it. */
+	if (!(st = g_try_malloc0(sizeof(struct sr_session_stats)
+			+ num_devs * sizeof(struct sr_dev_stats)
+			+ num_callbacks * sizeof(struct sr_callback_stats)
+			+ num_stages * sizeof(struct sr_stage_stats)))) {
+		g_mutex_unlock(&session->stage_mutex);
+		g_mutex_unlock(&session->dev_mutex);
+		sr_err("%s: stats malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	st->callbacks = (struct sr_callback_stats *)(st + 1);
+	st->devs = (struct sr_dev_stats *)(st->callbacks + num_callbacks);
+	st->stages = (struct sr_stage_stats *)(st->devs + num_devs);
+
+	for (l = session->stages, i = 0; l; l = l->next, i++)
+		st->stages[i] = ((struct stage_entry *)l->data)->stats;
+	st->num_stages = num_stages;
+	if (session->stage_timing && session->run_start)
+		st->run_us = (session->run_end ? session->run_end
+				: g_get_monotonic_time()) - session->run_start;
+
+	g_mutex_unlock(&session->stage_mutex);
+
+	for (l = session->dev_states, i = 0; l; l = l->next, i++) {
+		state = l->data;
+		st->devs[i] = state->stats;
+		st->devs[i].sdi = state->sdi;
+		sr_dev_mem_get(state->sdi, &st->devs[i].mem_used,
+				&st->devs[i].mem_peak);
+	}
+	st->num_devs = num_devs;
+
+	g_mutex_unlock(&session->dev_mutex);
+
+	for (l = session->datafeed_callbacks, i = 0; l; l = l->next, i++) {
+		cb_struct = l->data;
+		st->callbacks[i] = cb_struct->stats;
+		st->callbacks[i].cb = cb_struct->cb;
+		st->callbacks[i].cb_data = cb_struct->cb_data;
+	}
+	st->num_callbacks = num_callbacks;
+
+	st->iterations = session->iterations;
+	st->poll_us = session->poll_us;
+	st->sources_us = session->sources_us;
+	sr_session_mem_get(session, &st->mem_used, &st->mem_peak);
+	sr_session_queue_stats_get(session, &st->queue_overruns,
+			&st->queue_max_used);
+
+	*stats = st;
+
+	return SR_OK;
+}
+
+/**
+ * Enable or disable timing the stages of the datafeed.
+ *
+ * With stage timing, the session keeps track of the time spent in every
+ * stage the data goes through: the drivers' conversion of the data from
+ * the device, the software trigger, each transform, each datafeed
+ * callback and the output modules they run. Every stage is only charged
+ * for the time spent in itself, not in the stages it runs in turn. The
+ * results are part of sr_session_stats_get(), and
+ * sr_session_stage_report() formats them; that report is also logged at
+ * the info level when the session ends. Stage timing costs a clock read
+ * on every stage, so it's off by default.
+ *
+ * @param session The session. Must not be NULL.
+ * @param enable TRUE to time the stages, FALSE not to (the default).
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, or SR_ERR
+ *         if the session is running.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_stage_timing_set(struct sr_session *session,
+		gboolean enable)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (session->running) {
+		sr_err("Cannot change stage timing while running.");
+		return SR_ERR;
+	}
+
+	session->stage_timing = enable;
+
+	return SR_OK;
+}
 
 /**
- * @file
+ * Get whether the stages of the datafeed are timed.
  *
- * Creating, using, or destroying libsigrok sessions.
- */
-
-/**
- * @defgroup grp_session Session handling
+ * @param session The session. Must not be NULL.
+ * @param enable Pointer where the setting will be stored. Must not be NULL.
  *
- * Creating, using, or destroying libsigrok sessions.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_BUG if session is NULL.
  *
- * @{
+ * @since 0.3.0
  */
+SR_API int sr_session_stage_timing_get(struct sr_session *session,
+		gboolean *enable)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
 
-struct source {
-	int timeout;
-	sr_receive_data_callback_t cb;
-	void *cb_data;
+	if (!enable)
+		return SR_ERR_ARG;
 
-	/* This is used to keep track of the object (fd, pollfd or channel) which is
-	 * being polled and will be used to match the source when removing it again.
-	 */
-	gintptr poll_object;
-};
+	*enable = session->stage_timing;
 
-struct datafeed_callback {
-	sr_datafeed_callback_t cb;
-	void *cb_data;
-};
+	return SR_OK;
+}
 
-/* There can only be one session at a time. */
-/* 'session' is not static, it's used elsewhere (via 'extern'). */
-struct sr_session *session;
+static void stage_report_line(GString *s, const char *name, uint64_t us,
+		uint64_t samples, uint64_t calls, uint64_t run_us)
+{
+	g_string_append_printf(s, "%-32s %6.1f%% %12" PRIu64 " us %10"
+			       PRIu64 " calls", name, us * 100.0 / run_us, us,
+			       calls);
+	if (samples && us)
+		g_string_append_printf(s, " %10.2f Msamples/s",
+				       (double)samples / us);
+	g_string_append_c(s, '\n');
+}
 
 /**
- * Create a new session.
+ * Format the stage timing of a session as a report, one line per stage.
  *
- * @todo Should it use the file-global "session" variable or take an argument?
- *       The same question applies to all the other session functions.
+ * Each line has the share of the session's run time spent in the stage,
+ * the time itself, the number of times the stage ran, and the rate at
+ * which it handled samples while it ran. Stages running on different
+ * threads (e.g. with threaded dispatch) can add up to more than 100%.
+ * The datafeed callbacks are numbered in the order they were added.
  *
- * @return A pointer to the newly allocated session, or NULL upon errors.
+ * @param session The session. Must not be NULL.
+ *
+ * @return The report, to be freed with g_free() by the caller, or NULL
+ *         if stage timing isn't enabled or upon errors.
+ *
+ * @since 0.3.0
  */
-SR_API struct sr_session *sr_session_new(void)
+SR_API char *sr_session_stage_report(struct sr_session *session)
 {
-	if (!(session = g_try_malloc0(sizeof(struct sr_session)))) {
-		sr_err("Session malloc failed.");
+	struct sr_session_stats *stats;
+	struct sr_callback_stats *cs;
+	GString *s;
+	char name[SR_STAGE_NAME_SIZE];
+	uint64_t run_us;
+	unsigned int i;
+
+	if (!session || !session->stage_timing)
 		return NULL;
-	}
 
-	session->source_timeout = -1;
-	session->running = FALSE;
-	session->abort_session = FALSE;
-	g_mutex_init(&session->stop_mutex);
+	if (sr_session_stats_get(session, &stats) != SR_OK)
+		return NULL;
 
-	return session;
+	run_us = MAX(stats->run_us, 1);
+	s = g_string_sized_new(1024);
+	g_string_append_printf(s, "%" PRIu64 " us run time\n", stats->run_us);
+	for (i = 0; i < stats->num_stages; i++)
+		stage_report_line(s, stats->stages[i].name,
+				  stats->stages[i].us,
+				  stats->stages[i].samples,
+				  stats->stages[i].calls, run_us);
+	for (i = 0; i < stats->num_callbacks; i++) {
+		cs = &stats->callbacks[i];
+		g_snprintf(name, sizeof(name), "callback:%u", i + 1);
+		stage_report_line(s, name, cs->self_us, cs->samples,
+				  cs->calls, run_us);
+	}
+	g_free(stats);
+
+	return g_string_free(s, FALSE);
 }
 
 /**
- * Destroy the current session.
+ * Enable or disable threaded dispatch of the datafeed.
  *
- * This frees up all memory used by the session.
+ * With threaded dispatch, every datafeed callback gets a thread of its own
+ * while the session runs, so independent consumers (e.g. a file writer and
+ * a live display) process the packets in parallel. Every callback still
+ * sees all packets in the order they were sent. The threads all read one
+ * queue, on which a packet is put once for all the callbacks getting it
+ * unchanged. Its depth is the one set with sr_session_queue_depth_set(),
+ * or a default if that is 0. When the slowest callback falls that far
+ * behind, the same overrun rules apply, to all callbacks the dropped
+ * packet was for; see sr_session_dispatch_blocking_set() to wait instead.
+ * At most 64 callbacks can be run this way.
+ *
+ * Callbacks added while the session is running are called directly.
+ *
+ * @param session The session. Must not be NULL.
+ * @param enable TRUE to run each datafeed callback on its own thread,
+ *               FALSE to run them one after the other (the default).
  *
- * @return SR_OK upon success, SR_ERR_BUG if no session exists.
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, or SR_ERR
+ *         if the session is running.
+ *
+ * @since 0.3.0
  */
-SR_API int sr_session_destroy(void)
+SR_API int sr_session_threaded_dispatch_set(struct sr_session *session,
+		gboolean enable)
 {
 	if (!session) {
 		sr_err("%s: session was NULL", __func__);
 		return SR_ERR_BUG;
 	}
 
-	sr_session_dev_remove_all();
-
-	/* TODO: Error checks needed? */
-
-	g_mutex_clear(&session->stop_mutex);
+	if (session->workers_running) {
+		sr_err("Cannot change the dispatch mode while running.");
+		return SR_ERR;
+	}
 
-	g_free(session);
-	session = NULL;
+	session->threaded_dispatch = enable;
 
 	return SR_OK;
 }
 
 /**
- * Remove all the devices from the current session.
+ * Get whether threaded dispatch of the datafeed is enabled.
  *
- * The session itself (i.e., the struct sr_session) is not free'd and still
- * exists after this function returns.
+ * @param session The session. Must not be NULL.
+ * @param enable Pointer where the setting will be stored. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_BUG if session is NULL.
  *
- * @return SR_OK upon success, SR_ERR_BUG if no session exists.
+ * @since 0.3.0
  */
-SR_API int sr_session_dev_remove_all(void)
+SR_API int sr_session_threaded_dispatch_get(struct sr_session *session,
+		gboolean *enable)
 {
 	if (!session) {
 		sr_err("%s: session was NULL", __func__);
 		return SR_ERR_BUG;
 	}
 
-	g_slist_free(session->devs);
-	session->devs = NULL;
+	if (!enable)
+		return SR_ERR_ARG;
+
+	*enable = session->threaded_dispatch;
 
 	return SR_OK;
 }
 
 /**
- * Add a device instance to the current session.
+ * Set whether threaded dispatch waits for slow callbacks.
  *
- * @param sdi The device instance to add to the current session. Must not
- *            be NULL. Also, sdi->driver and sdi->driver->dev_open must
- *            not be NULL.
+ * By default, logic and analog packets are dropped and counted as overruns
+ * when the queue of threaded dispatch is full, see
+ * sr_session_threaded_dispatch_set(). With blocking enabled, the datafeed
+ * is held up until the slowest callback has made room instead, so no data
+ * is lost but the drivers may overrun.
  *
- * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ * @param session The session. Must not be NULL.
+ * @param block TRUE to wait for room, FALSE to drop sample data (the
+ *              default).
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, or SR_ERR
+ *         if the session is running.
+ *
+ * @since 0.3.0
  */
-SR_API int sr_session_dev_add(const struct sr_dev_inst *sdi)
+SR_API int sr_session_dispatch_blocking_set(struct sr_session *session,
+		gboolean block)
 {
-	int ret;
-
-	if (!sdi) {
-		sr_err("%s: sdi was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
 	if (!session) {
 		sr_err("%s: session was NULL", __func__);
 		return SR_ERR_BUG;
 	}
 
-	/* If sdi->driver is NULL, this is a virtual device. */
-	if (!sdi->driver) {
-		sr_dbg("%s: sdi->driver was NULL, this seems to be "
-		       "a virtual device; continuing", __func__);
-		/* Just add the device, don't run dev_open(). */
-		session->devs = g_slist_append(session->devs, (gpointer)sdi);
-		return SR_OK;
-	}
-
-	/* sdi->driver is non-NULL (i.e. we have a real device). */
-	if (!sdi->driver->dev_open) {
-		sr_err("%s: sdi->driver->dev_open was NULL", __func__);
-		return SR_ERR_BUG;
+	if (session->workers_running) {
+		sr_err("Cannot change the dispatch mode while running.");
+		return SR_ERR;
 	}
 
-	session->devs = g_slist_append(session->devs, (gpointer)sdi);
-
-	if (session->running) {
-		/* Adding a device to a running session. Start acquisition
-		 * on that device now. */
-		if ((ret = sdi->driver->dev_acquisition_start(sdi,
-						(void *)sdi)) != SR_OK)
-			sr_err("Failed to start acquisition of device in "
-					"running session: %d", ret);
-	}
+	session->dispatch_blocking = block;
 
 	return SR_OK;
 }
 
 /**
- * List all device instances attached to the current session.
+ * Get whether threaded dispatch waits for slow callbacks.
  *
- * @param devlist A pointer where the device instance list will be
- *                stored on return. If no devices are in the session,
- *                this will be NULL. Each element in the list points
- *                to a struct sr_dev_inst *.
- *                The list must be freed by the caller, but not the
- *                elements pointed to.
+ * @param session The session. Must not be NULL.
+ * @param block Pointer where the setting will be stored. Must not be NULL.
  *
- * @return SR_OK upon success, SR_ERR upon invalid arguments.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_BUG if session is NULL.
+ *
+ * @since 0.3.0
  */
-SR_API int sr_session_dev_list(GSList **devlist)
+SR_API int sr_session_dispatch_blocking_get(struct sr_session *session,
+		gboolean *block)
 {
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
 
-	*devlist = NULL;
-
-	if (!session)
-		return SR_ERR;
+	if (!block)
+		return SR_ERR_ARG;
 
-	*devlist = g_slist_copy(session->devs);
+	*block = session->dispatch_blocking;
 
 	return SR_OK;
 }
 
 /**
- * Remove all datafeed callbacks in the current session.
+ * Enable or disable polling each device on a thread of its own.
+ *
+ * With device threads, every device of the session is started on a thread
+ * of its own, which then runs the event sources the device's driver adds,
+ * so the devices of a large session are handled on several cores. Their
+ * packets are passed on in the session thread, each device's in the order
+ * it sent them. Drivers whose devices share an event source, such as the
+ * session file driver's, have it run on the thread of the device which
+ * added it. USB transfers still complete on the USB event thread.
+ *
+ * @param session The session. Must not be NULL.
+ * @param enable TRUE to poll each device on its own thread, FALSE to poll
+ *               all of them in the session thread (the default).
  *
- * @return SR_OK upon success, SR_ERR_BUG if no session exists.
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, or SR_ERR
+ *         if the session is running.
+ *
+ * @since 0.3.0
  */
-SR_API int sr_session_datafeed_callback_remove_all(void)
+SR_API int sr_session_dev_threads_set(struct sr_session *session,
+		gboolean enable)
 {
 	if (!session) {
 		sr_err("%s: session was NULL", __func__);
 		return SR_ERR_BUG;
 	}
 
-	g_slist_free_full(session->datafeed_callbacks, g_free);
-	session->datafeed_callbacks = NULL;
+	if (session->running || session->dev_loops) {
+		sr_err("Cannot change the device threads while running.");
+		return SR_ERR;
+	}
+
+	session->dev_threads = enable;
 
 	return SR_OK;
 }
 
 /**
- * Add a datafeed callback to the current session.
+ * Get whether each device is polled on a thread of its own.
  *
- * @param cb Function to call when a chunk of data is received.
- *           Must not be NULL.
- * @param cb_data Opaque pointer passed in by the caller.
+ * @param session The session. Must not be NULL.
+ * @param enable Pointer where the setting will be stored. Must not be NULL.
  *
- * @return SR_OK upon success, SR_ERR_BUG if no session exists.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_BUG if session is NULL.
+ *
+ * @since 0.3.0
  */
-SR_API int sr_session_datafeed_callback_add(sr_datafeed_callback_t cb, void *cb_data)
+SR_API int sr_session_dev_threads_get(struct sr_session *session,
+		gboolean *enable)
 {
-	struct datafeed_callback *cb_struct;
-
 	if (!session) {
 		sr_err("%s: session was NULL", __func__);
 		return SR_ERR_BUG;
 	}
 
-	if (!cb) {
-		sr_err("%s: cb was NULL", __func__);
+	if (!enable)
 		return SR_ERR_ARG;
-	}
 
-	if (!(cb_struct = g_try_malloc0(sizeof(struct datafeed_callback))))
-		return SR_ERR_MALLOC;
+	*enable = session->dev_threads;
 
-	cb_struct->cb = cb;
-	cb_struct->cb_data = cb_data;
+	return SR_OK;
+}
 
-	session->datafeed_callbacks =
-	    g_slist_append(session->datafeed_callbacks, cb_struct);
+/* The datafeed callback filling the packet queue. */
+static void pull_receive(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	struct sr_session *session;
+	struct sr_datafeed_packet *copy;
 
-	return SR_OK;
+	session = cb_data;
+	if (!(copy = sr_packet_copy(packet))) {
+		sr_err("Failed to queue a packet.");
+		return;
+	}
+
+	/* Wait for the consumer to make room, unless the session stops. */
+	while (!ring_push(session->pull_queue, sdi, copy)) {
+		if (g_atomic_int_get(&session->abort_session)) {
+			sr_spew("Packet queue full, dropping packet.");
+			sr_packet_free(copy);
+			return;
+		}
+		g_usleep(100);
+	}
 }
 
 /**
- * Call every device in the session's callback.
+ * Set up a queue for pulling the datafeed with sr_session_packet_next().
  *
- * For sessions not driven by select loops such as sr_session_run(),
- * but driven by another scheduler, this can be used to poll the devices
- * from within that scheduler.
+ * This is an alternative to a datafeed callback, for consumers which
+ * rather take the packets from a thread of their own, and in batches.
+ * The queue holds up to the given number of packets, which each reference
+ * the data of the packet sent rather than copying it where the driver
+ * supports that. Once it is full, the thread sending the packets waits
+ * for the consumer to make room, so a slow consumer holds up the devices
+ * instead of losing data; only when the session is stopped are packets
+ * dropped. The queue is like a datafeed callback with the default settings
+ * otherwise, among the others of the session.
  *
- * @param block If TRUE, this call will wait for any of the session's
- *              sources to fire an event on the file descriptors, or
- *              any of their timeouts to activate. In other words, this
- *              can be used as a select loop.
- *              If FALSE, all sources have their callback run, regardless
- *              of file descriptor or timeout status.
+ * Only one thread at a time may call sr_session_packet_next(). It must not
+ * be the thread running the session, unless the queue is deep enough.
  *
- * @return SR_OK upon success, SR_ERR on errors.
+ * @param session The session. Must not be NULL.
+ * @param depth The number of packets the queue holds, or 0 to remove it
+ *              along with the packets still in it.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR_ARG
+ *         upon invalid arguments, SR_ERR if the session is running, or
+ *         SR_ERR_MALLOC upon memory allocation errors.
+ *
+ * @since 0.3.0
  */
-static int sr_session_iteration(gboolean block)
+SR_API int sr_session_packet_queue_set(struct sr_session *session,
+		unsigned int depth)
 {
-	unsigned int i;
+	struct datafeed_callback *cb_struct;
+	GSList *l;
 	int ret;
 
-	ret = g_poll(session->pollfds, session->num_sources,
-			block ? session->source_timeout : 0);
-	for (i = 0; i < session->num_sources; i++) {
-		if (session->pollfds[i].revents > 0 || (ret == 0
-			&& session->source_timeout == session->sources[i].timeout)) {
-			/*
-			 * Invoke the source's callback on an event,
-			 * or if the poll timed out and this source
-			 * asked for that timeout.
-			 */
-			if (!session->sources[i].cb(session->pollfds[i].fd,
-					session->pollfds[i].revents,
-					session->sources[i].cb_data))
-				sr_session_source_remove(session->sources[i].poll_object);
-		}
-		/*
-		 * We want to take as little time as possible to stop
-		 * the session if we have been told to do so. Therefore,
-		 * we check the flag after processing every source, not
-		 * just once per main event loop.
-		 */
-		g_mutex_lock(&session->stop_mutex);
-		if (session->abort_session) {
-			sr_session_stop_sync();
-			/* But once is enough. */
-			session->abort_session = FALSE;
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (depth > MAX_QUEUE_DEPTH) {
+		sr_err("%s: depth %u too large", __func__, depth);
+		return SR_ERR_ARG;
+	}
+
+	if (session->running || session->workers_running) {
+		sr_err("Cannot change the packet queue while running.");
+		return SR_ERR;
+	}
+
+	for (l = session->datafeed_callbacks; l; l = l->next) {
+		cb_struct = l->data;
+		if (cb_struct->cb == pull_receive) {
+			session->datafeed_callbacks = g_slist_delete_link(
+					session->datafeed_callbacks, l);
+			datafeed_callback_free(cb_struct);
+			break;
 		}
-		g_mutex_unlock(&session->stop_mutex);
+	}
+	if (session->pull_queue) {
+		ring_free(session->pull_queue);
+		session->pull_queue = NULL;
+	}
+
+	if (!depth)
+		return SR_OK;
+
+	if (!(session->pull_queue = ring_new(depth))) {
+		sr_err("%s: queue malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if ((ret = sr_session_datafeed_callback_add(session, pull_receive,
+			session)) != SR_OK) {
+		ring_free(session->pull_queue);
+		session->pull_queue = NULL;
+		return ret;
 	}
 
 	return SR_OK;
 }
 
 /**
- * Start a session.
+ * Take the next packet from the session's packet queue.
  *
- * There can only be one session at a time.
+ * @param session The session, with a queue set up with
+ *                sr_session_packet_queue_set(). Must not be NULL.
+ * @param timeout_ms How long to wait for a packet, 0 not to wait, or
+ *                   negative to wait for as long as it takes.
+ * @param sdi Pointer where the device the packet came from is stored.
+ *            Must not be NULL.
+ * @param packet Pointer where the packet is stored. It must be freed with
+ *               sr_session_packet_free(). Must not be NULL.
  *
- * @return SR_OK upon success, SR_ERR upon errors.
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR_ARG
+ *         upon invalid arguments, SR_ERR_NA if the session has no packet
+ *         queue, or SR_ERR_TIMEOUT if no packet came in time.
+ *
+ * @since 0.3.0
  */
-SR_API int sr_session_start(void)
+SR_API int sr_session_packet_next(struct sr_session *session, int timeout_ms,
+		const struct sr_dev_inst **sdi,
+		struct sr_datafeed_packet **packet)
 {
-	struct sr_dev_inst *sdi;
-	GSList *l;
-	int ret;
+	struct queue_entry entry;
+	int64_t end, wait;
 
 	if (!session) {
-		sr_err("%s: session was NULL; a session must be "
-		       "created before starting it.", __func__);
+		sr_err("%s: session was NULL", __func__);
 		return SR_ERR_BUG;
 	}
 
-	if (!session->devs) {
-		sr_err("%s: session->devs was NULL; a session "
-		       "cannot be started without devices.", __func__);
-		return SR_ERR_BUG;
-	}
+	if (!sdi || !packet)
+		return SR_ERR_ARG;
 
-	sr_info("Starting.");
+	if (!session->pull_queue)
+		return SR_ERR_NA;
 
-	ret = SR_OK;
-	for (l = session->devs; l; l = l->next) {
-		sdi = l->data;
-		if ((ret = sdi->driver->dev_acquisition_start(sdi, sdi)) != SR_OK) {
-			sr_err("%s: could not start an acquisition "
-			       "(%s)", __func__, sr_strerror(ret));
+	end = timeout_ms < 0 ? -1
+			: g_get_monotonic_time() + (int64_t)timeout_ms * 1000;
+	for (;;) {
+		wait = end < 0 ? QUEUE_POLL_TIMEOUT_US
+				: MAX(end - g_get_monotonic_time(), 0);
+		if (ring_pop(session->pull_queue, &entry, wait))
 			break;
-		}
+		if (end >= 0 && g_get_monotonic_time() >= end)
+			return SR_ERR_TIMEOUT;
 	}
 
-	/* TODO: What if there are multiple devices? Which return code? */
+	*sdi = entry.sdi;
+	*packet = entry.packet;
 
-	return ret;
+	return SR_OK;
 }
 
 /**
- * Run the session.
+ * Free a packet taken with sr_session_packet_next().
  *
- * @return SR_OK upon success, SR_ERR_BUG upon errors.
+ * @param packet The packet, can be NULL.
+ *
+ * @since 0.3.0
+ */
+SR_API void sr_session_packet_free(struct sr_datafeed_packet *packet)
+{
+	if (packet)
+		sr_packet_free(packet);
+}
+
+/**
+ * Trigger on a device's logic data in software.
+ *
+ * Until the trigger fires, the logic packets from the device are dropped
+ * instead of being passed to the datafeed callbacks. Once it fires, an
+ * SR_DF_TRIGGER packet is sent, followed by the data from the samples that
+ * matched the trigger onwards. All other packets are passed on as usual.
+ * The trigger is armed again at the start of each acquisition.
+ *
+ * This works with any device sending logic data, including ones without
+ * hardware trigger support. The trigger string is parsed with
+ * sr_parse_triggerstring(). Each character of a probe's trigger is one
+ * stage: '0' and '1' match a level, 'r' and 'f' a rising or falling edge,
+ * 'c' any edge. The conditions of all probes must hold on the same sample,
+ * and the stages must match on consecutive samples, in order.
+ *
+ * @param session The session. Must not be NULL.
+ * @param sdi The device instance to trigger on, which must be part of the
+ *            session. Can be NULL if triggerstring is NULL.
+ * @param triggerstring The trigger specification, or NULL to disable
+ *                      the software trigger.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_BUG if session is NULL, or SR_ERR if the session
+ *         is running.
+ *
+ * @since 0.3.0
  */
-SR_API int sr_session_run(void)
+SR_API int sr_session_trigger_set(struct sr_session *session,
+		const struct sr_dev_inst *sdi, const char *triggerstring)
 {
+	struct sr_soft_trigger_stage stages[SR_SOFT_TRIGGER_MAX_STAGES];
+	char **triggerlist;
+	int num_stages, max_probes, ret, i;
+
 	if (!session) {
-		sr_err("%s: session was NULL; a session must be "
-		       "created first, before running it.", __func__);
+		sr_err("%s: session was NULL", __func__);
 		return SR_ERR_BUG;
 	}
 
-	if (!session->devs) {
-		/* TODO: Actually the case? */
-		sr_err("%s: session->devs was NULL; a session "
-		       "cannot be run without devices.", __func__);
-		return SR_ERR_BUG;
+	if (session->running) {
+		sr_err("Cannot change the trigger while running.");
+		return SR_ERR;
 	}
-	session->running = TRUE;
 
-	sr_info("Running.");
+	if (!triggerstring) {
+		sr_soft_trigger_free(session->trigger);
+		session->trigger = NULL;
+		session->trigger_sdi = NULL;
+		session->trigger_num_stages = 0;
+		session->trigger_proto.type = 0;
+		return SR_OK;
+	}
+
+	if (!sdi) {
+		sr_err("%s: sdi was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (sdi->session != session) {
+		sr_err("%s: device is not in this session", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!(triggerlist = sr_parse_triggerstring(sdi, triggerstring)))
+		return SR_ERR_ARG;
+
+	ret = sr_soft_trigger_compile(sdi, triggerlist, stages, &num_stages);
+
+	max_probes = g_slist_length(sdi->probes);
+	for (i = 0; i < max_probes; i++)
+		g_free(triggerlist[i]);
+	g_free(triggerlist);
 
-	/* Do we have real sources? */
-	if (session->num_sources == 1 && session->pollfds[0].fd == -1) {
-		/* Dummy source, freewheel over it. */
-		while (session->num_sources)
-			session->sources[0].cb(-1, 0, session->sources[0].cb_data);
-	} else {
-		/* Real sources, use g_poll() main loop. */
-		while (session->num_sources)
-			sr_session_iteration(TRUE);
+	if (ret != SR_OK)
+		return ret;
+
+	if (!num_stages) {
+		sr_err("No trigger conditions given.");
+		return SR_ERR_ARG;
 	}
 
+	sr_soft_trigger_free(session->trigger);
+	session->trigger = NULL;
+	session->trigger_sdi = sdi;
+	memcpy(session->trigger_stages, stages, sizeof(stages));
+	session->trigger_num_stages = num_stages;
+	session->trigger_proto.type = 0;
+
 	return SR_OK;
 }
 
+/* The bit of a logic probe of the device, or 0 if it isn't one. */
+static uint64_t trigger_probe_bit(const struct sr_dev_inst *sdi,
+		const struct sr_probe *probe)
+{
+	if (!probe || !g_slist_find(sdi->probes, probe)
+	    || probe->type != SR_PROBE_LOGIC || probe->index > 63)
+		return 0;
+
+	return (uint64_t)1 << probe->index;
+}
+
 /**
- * Stop the current session.
+ * Trigger on the first byte of a bus transaction in a device's logic data.
  *
- * The current session is stopped immediately, with all acquisition sessions
- * being stopped and hardware drivers cleaned up.
+ * This works like sr_session_trigger_set(), but the trigger fires at the
+ * end of the first UART frame, I2C address byte or SPI byte matching the
+ * given value. The data is then passed on from the start of that frame
+ * or transaction, if it was in the same packet, or else from the start of
+ * the packet. A UART trigger needs the samplerate of the data, which must
+ * be at least four times the baud rate; otherwise the data is passed on
+ * untriggered.
  *
- * This must be called from within the session thread, to prevent freeing
- * resources that the session thread will try to use.
+ * There is one logic software trigger per session, so this replaces the
+ * one set with sr_session_trigger_set(), and the other way around.
  *
- * @return SR_OK upon success, SR_ERR_BUG if no session exists.
+ * @param session The session. Must not be NULL.
+ * @param sdi The device instance to trigger on, which must be part of the
+ *            session. Can be NULL if trigger is NULL.
+ * @param trigger The bus, probes and byte to trigger on, or NULL to
+ *                disable the software trigger. It is copied.
  *
- * @private
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_BUG if session is NULL, or SR_ERR if the session
+ *         is running.
+ *
+ * @since 0.3.0
  */
-SR_PRIV int sr_session_stop_sync(void)
+SR_API int sr_session_protocol_trigger_set(struct sr_session *session,
+		const struct sr_dev_inst *sdi,
+		const struct sr_protocol_trigger *trigger)
 {
-	struct sr_dev_inst *sdi;
-	GSList *l;
+	struct sr_soft_trigger_proto proto;
 
 	if (!session) {
 		sr_err("%s: session was NULL", __func__);
 		return SR_ERR_BUG;
 	}
 
-	sr_info("Stopping.");
+	if (session->running) {
+		sr_err("Cannot change the trigger while running.");
+		return SR_ERR;
+	}
 
-	for (l = session->devs; l; l = l->next) {
-		sdi = l->data;
-		if (sdi->driver) {
-			if (sdi->driver->dev_acquisition_stop)
-				sdi->driver->dev_acquisition_stop(sdi, sdi);
+	if (!trigger)
+		return sr_session_trigger_set(session, NULL, NULL);
+
+	if (!sdi) {
+		sr_err("%s: sdi was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (sdi->session != session) {
+		sr_err("%s: device is not in this session", __func__);
+		return SR_ERR_ARG;
+	}
+
+	memset(&proto, 0, sizeof(proto));
+	proto.type = trigger->type;
+	proto.data = trigger_probe_bit(sdi, trigger->data);
+	proto.clock = trigger_probe_bit(sdi, trigger->clock);
+	proto.select = trigger_probe_bit(sdi, trigger->select);
+	proto.baudrate = trigger->baudrate;
+	proto.spi_mode = trigger->spi_mode;
+	proto.value = trigger->value;
+	proto.mask = trigger->mask;
+
+	switch (trigger->type) {
+	case SR_PROTOCOL_TRIGGER_UART:
+		if (!proto.data || !proto.baudrate) {
+			sr_err("A UART trigger needs a data probe and a "
+			       "baud rate.");
+			return SR_ERR_ARG;
+		}
+		break;
+	case SR_PROTOCOL_TRIGGER_I2C:
+		if (!proto.data || !proto.clock) {
+			sr_err("An I2C trigger needs data and clock probes.");
+			return SR_ERR_ARG;
+		}
+		break;
+	case SR_PROTOCOL_TRIGGER_SPI:
+		if (!proto.data || !proto.clock || !proto.select) {
+			sr_err("An SPI trigger needs data, clock and chip "
+			       "select probes.");
+			return SR_ERR_ARG;
+		}
+		if (proto.spi_mode < 0 || proto.spi_mode > 3) {
+			sr_err("Invalid SPI mode %d.", proto.spi_mode);
+			return SR_ERR_ARG;
 		}
+		break;
+	default:
+		sr_err("%s: invalid protocol %d", __func__, trigger->type);
+		return SR_ERR_ARG;
 	}
-	session->running = FALSE;
+
+	sr_soft_trigger_free(session->trigger);
+	session->trigger = NULL;
+	session->trigger_sdi = sdi;
+	session->trigger_num_stages = 0;
+	session->trigger_proto = proto;
 
 	return SR_OK;
 }
 
 /**
- * Stop the current session.
+ * Set up an analog software trigger on one probe of a device.
  *
- * The current session is stopped immediately, with all acquisition sessions
- * being stopped and hardware drivers cleaned up.
+ * Until the trigger fires, the device's analog packets with data of the
+ * probe are held back. Each time it fires, an SR_DF_FRAME_BEGIN packet is
+ * sent, followed by the pre_samples samples before the trigger, an
+ * SR_DF_TRIGGER packet, the post_samples samples from the trigger on, and
+ * an SR_DF_FRAME_END packet; the trigger is then armed again. The device's
+ * own frame packets are dropped. With post_samples 0, there is only one
+ * trigger, and all the data from it on is passed on as it comes instead.
  *
- * If the session is run in a separate thread, this function will not block
- * until the session is finished executing. It is the caller's responsibility
- * to wait for the session thread to return before assuming that the session is
- * completely decommissioned.
+ * Raw analog data of the probe is passed on converted to SR_DF_ANALOG
+ * packets. The device's other packets are passed on as usual, and the
+ * trigger is armed again at the start of each acquisition.
  *
- * @return SR_OK upon success, SR_ERR_BUG if no session exists.
+ * @param session The session. Must not be NULL.
+ * @param sdi The device instance to trigger on, which must be part of the
+ *            session. Can be NULL if trigger is NULL.
+ * @param probe The analog probe of the device to trigger on. Can be NULL
+ *              if trigger is NULL.
+ * @param trigger The trigger conditions, or NULL to disable the analog
+ *                software trigger. They are copied.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_BUG if session is NULL, SR_ERR_MALLOC upon memory
+ *         allocation errors, or SR_ERR if the session is running.
+ *
+ * @since 0.3.0
  */
-SR_API int sr_session_stop(void)
+SR_API int sr_session_analog_trigger_set(struct sr_session *session,
+		const struct sr_dev_inst *sdi, const struct sr_probe *probe,
+		const struct sr_analog_trigger *trigger)
 {
+	struct analog_trigger_state *at;
+
 	if (!session) {
 		sr_err("%s: session was NULL", __func__);
 		return SR_ERR_BUG;
 	}
 
-	g_mutex_lock(&session->stop_mutex);
-	session->abort_session = TRUE;
-	g_mutex_unlock(&session->stop_mutex);
+	if (session->running) {
+		sr_err("Cannot change the trigger while running.");
+		return SR_ERR;
+	}
+
+	if ((at = session->analog_trigger)) {
+		sr_analog_matcher_free(at->matcher);
+		g_free(at->hist);
+		g_free(at->buf);
+		g_free(at);
+		session->analog_trigger = NULL;
+	}
+
+	if (!trigger)
+		return SR_OK;
+
+	if (!sdi || !probe) {
+		sr_err("%s: sdi or probe was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (sdi->session != session) {
+		sr_err("%s: device is not in this session", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!g_slist_find(sdi->probes, probe)
+			|| probe->type != SR_PROBE_ANALOG) {
+		sr_err("%s: not an analog probe of the device", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!(at = g_try_malloc0(sizeof(struct analog_trigger_state)))) {
+		sr_err("%s: at malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	if (!(at->matcher = sr_analog_matcher_new(trigger))) {
+		g_free(at);
+		return SR_ERR_ARG;
+	}
+	at->sdi = sdi;
+	at->probe = probe;
+	at->conf = *trigger;
+	session->analog_trigger = at;
 
 	return SR_OK;
 }
 
 /**
- * Debug helper.
+ * Keep the last frames of each device in the session in a frame history.
  *
- * @param packet The packet to show debugging information for.
+ * The analog data each device sends between SR_DF_FRAME_BEGIN and
+ * SR_DF_FRAME_END packets (its own, or those of the analog software
+ * trigger) is kept as floats, probe by probe, for sr_session_frame_get().
+ * The memory of a frame is reused for the frame which takes its place, so
+ * once the history is full, new frames cost no allocations. It's sized
+ * for the device's SR_CONF_BUFFERSIZE, if it has one, at its first frame.
+ *
+ * @param session The session. Must not be NULL.
+ * @param num_frames How many frames to keep of each device, or 0 to keep
+ *                   none. Any frames kept so far are dropped.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, or SR_ERR
+ *         if the session is running.
+ *
+ * @since 0.3.0
  */
-static void datafeed_dump(const struct sr_datafeed_packet *packet)
+SR_API int sr_session_frame_history_set(struct sr_session *session,
+		unsigned int num_frames)
 {
-	const struct sr_datafeed_logic *logic;
-	const struct sr_datafeed_analog *analog;
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
 
-	switch (packet->type) {
-	case SR_DF_HEADER:
-		sr_dbg("bus: Received SR_DF_HEADER packet.");
-		break;
-	case SR_DF_TRIGGER:
-		sr_dbg("bus: Received SR_DF_TRIGGER packet.");
-		break;
-	case SR_DF_META:
-		sr_dbg("bus: Received SR_DF_META packet.");
-		break;
-	case SR_DF_LOGIC:
-		logic = packet->payload;
-		sr_dbg("bus: Received SR_DF_LOGIC packet (%" PRIu64 " bytes).",
-		       logic->length);
-		break;
-	case SR_DF_ANALOG:
-		analog = packet->payload;
-		sr_dbg("bus: Received SR_DF_ANALOG packet (%d samples).",
-		       analog->num_samples);
-		break;
-	case SR_DF_END:
-		sr_dbg("bus: Received SR_DF_END packet.");
-		break;
-	case SR_DF_FRAME_BEGIN:
-		sr_dbg("bus: Received SR_DF_FRAME_BEGIN packet.");
-		break;
-	case SR_DF_FRAME_END:
-		sr_dbg("bus: Received SR_DF_FRAME_END packet.");
-		break;
-	default:
-		sr_dbg("bus: Received unknown packet type: %d.", packet->type);
-		break;
+	if (session->running) {
+		sr_err("Cannot change the frame history while running.");
+		return SR_ERR;
 	}
+
+	g_mutex_lock(&session->frame_mutex);
+	frame_histories_free(session);
+	session->frame_history_size = num_frames;
+	g_mutex_unlock(&session->frame_mutex);
+
+	return SR_OK;
 }
 
 /**
- * Send a packet to whatever is listening on the datafeed bus.
+ * Get one of the last complete frames of a device from the frame history.
  *
- * Hardware drivers use this to send a data packet to the frontend.
+ * With a history of N frames, see sr_session_frame_history_set(), the
+ * frame stays intact until the device begins another N - index frames,
+ * or the next acquisition starts. A datafeed callback can thus look at
+ * the latest frame, and those before, as it gets an SR_DF_FRAME_END.
  *
- * @param sdi TODO.
- * @param packet The datafeed packet to send to the session bus.
+ * @param session The session. Must not be NULL.
+ * @param sdi The device the frame came from.
+ * @param index Which frame to get, 0 for the latest, 1 for the one before
+ *              it, and so on.
+ * @param frame Where to store a pointer to the frame. Must not be NULL.
+ *              It is owned by the session.
  *
- * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_BUG if session is NULL, or SR_ERR_NA if there is no
+ *         such frame of the device.
  *
- * @private
+ * @since 0.3.0
  */
-SR_PRIV int sr_session_send(const struct sr_dev_inst *sdi,
-			    const struct sr_datafeed_packet *packet)
+SR_API int sr_session_frame_get(struct sr_session *session,
+		const struct sr_dev_inst *sdi, unsigned int index,
+		const struct sr_frame **frame)
 {
+	struct frame_history *hist;
+	unsigned int size;
 	GSList *l;
-	struct datafeed_callback *cb_struct;
+	int ret;
 
-	if (!sdi) {
-		sr_err("%s: sdi was NULL", __func__);
-		return SR_ERR_ARG;
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
 	}
 
-	if (!packet) {
-		sr_err("%s: packet was NULL", __func__);
+	if (!frame) {
+		sr_err("%s: frame was NULL", __func__);
 		return SR_ERR_ARG;
 	}
 
-	for (l = session->datafeed_callbacks; l; l = l->next) {
-		if (sr_log_loglevel_get() >= SR_LOG_DBG)
-			datafeed_dump(packet);
-		cb_struct = l->data;
-		cb_struct->cb(sdi, packet, cb_struct->cb_data);
+	ret = SR_ERR_NA;
+	g_mutex_lock(&session->frame_mutex);
+	size = session->frame_history_size;
+	for (l = session->frame_histories; l; l = l->next) {
+		hist = l->data;
+		if (hist->sdi != sdi || index >= hist->num_frames)
+			continue;
+		*frame = &hist->slots[(hist->next + size - 1 - index)
+				% size].frame;
+		ret = SR_OK;
+		break;
 	}
+	g_mutex_unlock(&session->frame_mutex);
 
-	return SR_OK;
+	return ret;
 }
 
-/**
- * Add an event source for a file descriptor.
- *
- * @param pollfd The GPollFD.
- * @param timeout Max time to wait before the callback is called, ignored if 0.
- * @param cb Callback function to add. Must not be NULL.
- * @param cb_data Data for the callback function. Can be NULL.
- * @param poll_object TODO.
- *
- * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
- *         SR_ERR_MALLOC upon memory allocation errors.
- */
-static int _sr_session_source_add(GPollFD *pollfd, int timeout,
-	sr_receive_data_callback_t cb, void *cb_data, gintptr poll_object)
+/* Called with sources_mutex held. */
+static int source_add(struct sr_session *session,
+	GPollFD *pollfd, int timeout, sr_receive_data_callback_t cb,
+	void *cb_data, gintptr poll_object)
 {
 	struct source *new_sources, *s;
 	GPollFD *new_pollfds;
+	unsigned int *new_timers;
 
-	if (!cb) {
-		sr_err("%s: cb was NULL", __func__);
-		return SR_ERR_ARG;
-	}
-
-	/* Note: cb_data can be NULL, that's not a bug. */
-
+	/* With room for the wakeup pipe's entry after the sources. */
 	new_pollfds = g_try_realloc(session->pollfds,
-			sizeof(GPollFD) * (session->num_sources + 1));
+			sizeof(GPollFD) * (session->num_sources + 2));
 	if (!new_pollfds) {
 		sr_err("%s: new_pollfds malloc failed", __func__);
 		return SR_ERR_MALLOC;
@@ -587,25 +6565,94 @@ static int _sr_session_source_add(GPollFD *pollfd, int timeout,
 		return SR_ERR_MALLOC;
 	}
 
+	/* Only allocated here, so it's as large as the other two. */
+	new_timers = g_try_realloc(session->timers, sizeof(unsigned int) *
+			(session->num_sources + 1));
+	if (!new_timers) {
+		sr_err("%s: new_timers malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	session->timers = new_timers;
+
 	new_pollfds[session->num_sources] = *pollfd;
-	s = &new_sources[session->num_sources++];
+	s = &new_sources[session->num_sources];
 	s->timeout = timeout;
 	s->cb = cb;
 	s->cb_data = cb_data;
 	s->poll_object = poll_object;
+	s->heap_pos = -1;
 	session->pollfds = new_pollfds;
 	session->sources = new_sources;
 
-	if (timeout != session->source_timeout && timeout > 0
-	    && (session->source_timeout == -1 || timeout < session->source_timeout))
-		session->source_timeout = timeout;
+	if (timeout > 0) {
+		s->due = g_get_monotonic_time() + (int64_t)timeout * 1000;
+		s->heap_pos = session->num_timers;
+		session->timers[session->num_timers++] = session->num_sources;
+		timer_sift_up(session, s->heap_pos);
+	}
+	session->num_sources++;
+	session->sources_gen++;
 
 	return SR_OK;
 }
 
+/*
+ * On a device thread, the sources drivers add to their device's session
+ * go to the thread's loop instead.
+ */
+static struct sr_session *source_session(struct sr_session *session)
+{
+	struct sr_session *cur;
+
+	cur = sr_session_cur_get();
+	if (cur && cur->parent == session)
+		return cur;
+
+	return session;
+}
+
+/**
+ * Add an event source for a file descriptor.
+ *
+ * @param pollfd The GPollFD.
+ * @param timeout Max time to wait before the callback is called, ignored if 0.
+ * @param cb Callback function to add. Must not be NULL.
+ * @param cb_data Data for the callback function. Can be NULL.
+ * @param poll_object TODO.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_MALLOC upon memory allocation errors.
+ */
+static int _sr_session_source_add(struct sr_session *session,
+	GPollFD *pollfd, int timeout, sr_receive_data_callback_t cb,
+	void *cb_data, gintptr poll_object)
+{
+	int ret;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (!cb) {
+		sr_err("%s: cb was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	/* Note: cb_data can be NULL, that's not a bug. */
+
+	session = source_session(session);
+	g_mutex_lock(&session->sources_mutex);
+	ret = source_add(session, pollfd, timeout, cb, cb_data, poll_object);
+	g_mutex_unlock(&session->sources_mutex);
+
+	return ret;
+}
+
 /**
  * Add an event source for a file descriptor.
  *
+ * @param session The session the source belongs to.
  * @param fd The file descriptor.
  * @param events Events to check for.
  * @param timeout Max time to wait before the callback is called, ignored if 0.
@@ -615,20 +6662,23 @@ static int _sr_session_source_add(GPollFD *pollfd, int timeout,
  * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
  *         SR_ERR_MALLOC upon memory allocation errors.
  */
-SR_API int sr_session_source_add(int fd, int events, int timeout,
-		sr_receive_data_callback_t cb, void *cb_data)
+SR_API int sr_session_source_add(struct sr_session *session, int fd,
+		int events, int timeout, sr_receive_data_callback_t cb,
+		void *cb_data)
 {
 	GPollFD p;
 
 	p.fd = fd;
 	p.events = events;
 
-	return _sr_session_source_add(&p, timeout, cb, cb_data, (gintptr)fd);
+	return _sr_session_source_add(session, &p, timeout, cb, cb_data,
+				      (gintptr)fd);
 }
 
 /**
  * Add an event source for a GPollFD.
  *
+ * @param session The session the source belongs to.
  * @param pollfd The GPollFD.
  * @param timeout Max time to wait before the callback is called, ignored if 0.
  * @param cb Callback function to add. Must not be NULL.
@@ -637,16 +6687,18 @@ SR_API int sr_session_source_add(int fd, int events, int timeout,
  * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
  *         SR_ERR_MALLOC upon memory allocation errors.
  */
-SR_API int sr_session_source_add_pollfd(GPollFD *pollfd, int timeout,
-		sr_receive_data_callback_t cb, void *cb_data)
+SR_API int sr_session_source_add_pollfd(struct sr_session *session,
+		GPollFD *pollfd, int timeout, sr_receive_data_callback_t cb,
+		void *cb_data)
 {
-	return _sr_session_source_add(pollfd, timeout, cb,
+	return _sr_session_source_add(session, pollfd, timeout, cb,
 				      cb_data, (gintptr)pollfd);
 }
 
 /**
  * Add an event source for a GIOChannel.
  *
+ * @param session The session the source belongs to.
  * @param channel The GIOChannel.
  * @param events Events to poll on.
  * @param timeout Max time to wait before the callback is called, ignored if 0.
@@ -656,8 +6708,9 @@ SR_API int sr_session_source_add_pollfd(GPollFD *pollfd, int timeout,
  * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
  *         SR_ERR_MALLOC upon memory allocation errors.
  */
-SR_API int sr_session_source_add_channel(GIOChannel *channel, int events,
-		int timeout, sr_receive_data_callback_t cb, void *cb_data)
+SR_API int sr_session_source_add_channel(struct sr_session *session,
+		GIOChannel *channel, int events, int timeout,
+		sr_receive_data_callback_t cb, void *cb_data)
 {
 	GPollFD p;
 
@@ -668,21 +6721,12 @@ SR_API int sr_session_source_add_channel(GIOChannel *channel, int events,
 	p.events = events;
 #endif
 
-	return _sr_session_source_add(&p, timeout, cb, cb_data, (gintptr)channel);
+	return _sr_session_source_add(session, &p, timeout, cb, cb_data,
+				      (gintptr)channel);
 }
 
-/**
- * Remove the source belonging to the specified channel.
- *
- * @todo Add more error checks and logging.
- *
- * @param channel The channel for which the source should be removed.
- *
- * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
- *         SR_ERR_MALLOC upon memory allocation errors, SR_ERR_BUG upon
- *         internal errors.
- */
-static int _sr_session_source_remove(gintptr poll_object)
+/* Called with sources_mutex held. */
+static int source_remove(struct sr_session *session, gintptr poll_object)
 {
 	struct source *new_sources;
 	GPollFD *new_pollfds;
@@ -710,9 +6754,12 @@ static int _sr_session_source_remove(gintptr poll_object)
 		memmove(&session->sources[old], &session->sources[old+1],
 			(session->num_sources - old) * sizeof(struct source));
 	}
+	session->sources_gen++;
+	timers_rebuild(session);
 
-	new_pollfds = g_try_realloc(session->pollfds, sizeof(GPollFD) * session->num_sources);
-	if (!new_pollfds && session->num_sources > 0) {
+	new_pollfds = g_try_realloc(session->pollfds,
+			sizeof(GPollFD) * (session->num_sources + 1));
+	if (!new_pollfds) {
 		sr_err("%s: new_pollfds malloc failed", __func__);
 		return SR_ERR_MALLOC;
 	}
@@ -729,46 +6776,80 @@ static int _sr_session_source_remove(gintptr poll_object)
 	return SR_OK;
 }
 
+/**
+ * Remove the source belonging to the specified channel.
+ *
+ * @todo Add more error checks and logging.
+ *
+ * @param channel The channel for which the source should be removed.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_MALLOC upon memory allocation errors, SR_ERR_BUG upon
+ *         internal errors.
+ */
+static int _sr_session_source_remove(struct sr_session *session,
+		gintptr poll_object)
+{
+	int ret;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	session = source_session(session);
+	g_mutex_lock(&session->sources_mutex);
+	ret = source_remove(session, poll_object);
+	g_mutex_unlock(&session->sources_mutex);
+
+	return ret;
+}
+
 /**
  * Remove the source belonging to the specified file descriptor.
  *
+ * @param session The session the source belongs to.
  * @param fd The file descriptor for which the source should be removed.
  *
  * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
  *         SR_ERR_MALLOC upon memory allocation errors, SR_ERR_BUG upon
  *         internal errors.
  */
-SR_API int sr_session_source_remove(int fd)
+SR_API int sr_session_source_remove(struct sr_session *session, int fd)
 {
-	return _sr_session_source_remove((gintptr)fd);
+	return _sr_session_source_remove(session, (gintptr)fd);
 }
 
 /**
  * Remove the source belonging to the specified poll descriptor.
  *
+ * @param session The session the source belongs to.
  * @param pollfd The poll descriptor for which the source should be removed.
  *
  * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
  *         SR_ERR_MALLOC upon memory allocation errors, SR_ERR_BUG upon
  *         internal errors.
  */
-SR_API int sr_session_source_remove_pollfd(GPollFD *pollfd)
+SR_API int sr_session_source_remove_pollfd(struct sr_session *session,
+		GPollFD *pollfd)
 {
-	return _sr_session_source_remove((gintptr)pollfd);
+	return _sr_session_source_remove(session, (gintptr)pollfd);
 }
 
 /**
  * Remove the source belonging to the specified channel.
  *
+ * @param session The session the source belongs to.
  * @param channel The channel for which the source should be removed.
  *
  * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
  *         SR_ERR_MALLOC upon memory allocation errors, SR_ERR_BUG upon
  *         internal errors.
  */
-SR_API int sr_session_source_remove_channel(GIOChannel *channel)
+SR_API int sr_session_source_remove_channel(struct sr_session *session,
+		GIOChannel *channel)
 {
-	return _sr_session_source_remove((gintptr)channel);
+	return _sr_session_source_remove(session, (gintptr)channel);
 }
 
 /** @} */
@@ -22,6 +22,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <string.h>
 #include <zip.h>
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
@@ -29,148 +30,1021 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "virtual-session: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 /* size of payloads sent across the session bus */
 /** @cond PRIVATE */
 #define CHUNKSIZE (512 * 1024)
 /** @endcond */
 
+/* Largest packet size which can be set with SR_CONF_BUFFERSIZE. */
+#define MAX_CHUNKSIZE (64 * 1024 * 1024)
+
+/* How often a paced replay sends what is due, in ms. */
+#define PACE_INTERVAL 10
+
+/* Chunks decompressed ahead of time per stream, for each replay thread. */
+#define READAHEAD_PER_THREAD 2
+
+/* A chunk of a stream, decompressed by a thread of the replay pool. */
+struct chunk_job {
+	char *name;
+	uint64_t size;
+	uint8_t *data;
+	/* Bytes of the data already delivered. */
+	uint64_t pos;
+	/* The stream the chunk is of, for how it's coded. */
+	const struct session_stream *stream;
+	int ret;
+	gboolean done;
+};
+
+/* The capture data of a logic or analog stream, which may be chunked. */
+struct session_stream {
+	/* Base name of the archive member, chunks are "<name>-N". */
+	char *name;
+	struct zip_file *file;
+	/* 0 before the first chunk, -1 if the data isn't chunked. */
+	int cur_chunk;
+	gboolean done;
+	/*
+	 * The chunks queued for decompression in the replay pool, in order,
+	 * or NULL if the stream is read here.
+	 */
+	GQueue *jobs;
+	int next_chunk;
+	gboolean last_queued;
+	/*
+	 * Unitsize of the samples if the members are coded with
+	 * sr_logic_rle_encode(), 0 otherwise. Such a member is read and
+	 * decoded whole, and then handed out from the decoded samples.
+	 */
+	int rle_unitsize;
+	/* Analog members coded with sr_analog_delta_encode(), likewise. */
+	gboolean delta;
+	int delta_encoding;
+	uint8_t *decoded;
+	uint64_t decoded_size;
+	uint64_t decoded_pos;
+};
+
+struct session_analog {
+	struct session_stream stream;
+	/* Just the analog probe, for the packets. */
+	GSList *probes;
+	/* 0 for floats, otherwise one of SR_ANALOG_*. */
+	int encoding;
+	int sample_size;
+	float scale;
+	float offset;
+	int mq;
+	int unit;
+	uint64_t mqflags;
+};
+
 struct session_vdev {
 	char *sessionfile;
-	char *capturefile;
 	struct zip *archive;
-	struct zip_file *capfile;
-	int bytes_read;
+	struct session_stream logic;
+	/*
+	 * In the planar layout, the logic data is read from one bit-packed
+	 * stream "<logic>-p<k>" per bit of the samples instead, which are
+	 * interleaved here. Only the file knows the number of samples.
+	 */
+	struct session_stream *planes;
+	int num_planes;
+	uint64_t num_samples;
+	uint64_t plane_bytes;
+	uint8_t *plane_buf;
+	const uint8_t **plane_ptrs;
+	/* List of struct session_analog, one for each analog probe. */
+	GSList *analog;
+	uint64_t bytes_read;
 	uint64_t samplerate;
 	int unitsize;
 	int num_probes;
-	int cur_chunk;
+	/* Bytes per logic packet, except in the planar layout. */
+	uint64_t chunksize;
+	/*
+	 * Replay speed relative to the samplerate, 0 for as fast as
+	 * possible, and how many samples went out since the start.
+	 */
+	double speed;
+	int64_t start_time;
+	uint64_t samples_sent;
+	/* Set while an acquisition replays the device. */
+	gboolean running;
+	/* Replay threads, only used if there are more than one. */
+	int num_threads;
+	GThreadPool *pool;
+	/* Protects the jobs and the idle archives of the pool's threads. */
+	GMutex mutex;
+	GCond cond;
+	GQueue *idle_archives;
+	gboolean cancelled;
 };
 
 static GSList *dev_insts = NULL;
+/* Protects the running flags, devices may be started concurrently. */
+G_LOCK_DEFINE_STATIC(running);
 static const int hwcaps[] = {
 	SR_CONF_CAPTUREFILE,
 	SR_CONF_CAPTURE_UNITSIZE,
+	SR_CONF_BUFFERSIZE,
+	SR_CONF_REPLAY_SPEED,
 	0,
 };
 
-static int receive_data(int fd, int revents, void *cb_data)
+/* Whether the members of a stream need decoding after reading them. */
+static gboolean stream_coded(const struct session_stream *stream)
 {
-	struct sr_dev_inst *sdi;
+	return stream->rle_unitsize || stream->delta;
+}
+
+/* Replace the coded data of a member of a stream with its samples. */
+static int member_decode(const struct session_stream *stream,
+		const char *name, uint8_t **data, uint64_t *size)
+{
+	uint8_t *samples;
+	uint64_t num_samples;
+	int unitsize, ret;
+
+	if (stream->rle_unitsize) {
+		unitsize = stream->rle_unitsize;
+		num_samples = sr_logic_rle_count(*data, *size);
+	} else {
+		unitsize = stream->delta_encoding ? sr_analog_encoding_size(
+				stream->delta_encoding) : (int)sizeof(float);
+		num_samples = *size / unitsize;
+	}
+	if (!(samples = g_try_malloc(MAX(1, num_samples * unitsize)))) {
+		sr_err("%s: samples malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if (stream->rle_unitsize) {
+		if ((ret = sr_logic_rle_decode(*data, *size, unitsize,
+				samples)) != SR_OK) {
+			sr_err("Failed to decode '%s'.", name);
+			g_free(samples);
+			return ret;
+		}
+	} else {
+		sr_analog_delta_decode(*data, stream->delta_encoding,
+				num_samples, samples);
+	}
+	g_free(*data);
+	*data = samples;
+	*size = num_samples * unitsize;
+
+	return SR_OK;
+}
+
+/*
+ * Decompress a chunk in a thread of the replay pool. Each thread needs an
+ * archive of its own, libzip archives can't be shared between threads.
+ */
+static void chunk_job_run(gpointer data, gpointer user_data)
+{
+	struct chunk_job *job;
 	struct session_vdev *vdev;
-	struct sr_datafeed_packet packet;
-	struct sr_datafeed_logic logic;
+	struct zip *archive;
+	struct zip_file *zf;
+	zip_int64_t len;
+	gboolean cancelled;
+	int ret, zerr;
+
+	job = data;
+	vdev = user_data;
+
+	g_mutex_lock(&vdev->mutex);
+	cancelled = vdev->cancelled;
+	archive = g_queue_pop_head(vdev->idle_archives);
+	g_mutex_unlock(&vdev->mutex);
+
+	ret = SR_ERR;
+	if (cancelled) {
+		/* Nobody will look at the data anymore. */
+	} else if (!archive && !(archive = zip_open(vdev->sessionfile,
+			0, &zerr))) {
+		sr_err("Failed to open session file '%s': zip error %d.",
+		       vdev->sessionfile, zerr);
+	} else if (job->size && !(job->data = g_try_malloc(job->size))) {
+		sr_err("%s: job->data malloc failed", __func__);
+		ret = SR_ERR_MALLOC;
+	} else if (!(zf = zip_fopen(archive, job->name, 0))) {
+		sr_err("Failed to open '%s'.", job->name);
+	} else {
+		while (job->pos < job->size) {
+			if ((len = zip_fread(zf, job->data + job->pos,
+					job->size - job->pos)) <= 0)
+				break;
+			job->pos += len;
+		}
+		zip_fclose(zf);
+		if (job->pos != job->size)
+			sr_err("Failed to read '%s'.", job->name);
+		else if (stream_coded(job->stream))
+			ret = member_decode(job->stream, job->name,
+					&job->data, &job->size);
+		else
+			ret = SR_OK;
+		job->pos = 0;
+	}
+
+	g_mutex_lock(&vdev->mutex);
+	if (archive)
+		g_queue_push_tail(vdev->idle_archives, archive);
+	job->ret = ret;
+	job->done = TRUE;
+	g_cond_broadcast(&vdev->cond);
+	g_mutex_unlock(&vdev->mutex);
+}
+
+static void chunk_job_free(struct session_vdev *vdev, struct chunk_job *job)
+{
+	g_mutex_lock(&vdev->mutex);
+	while (!job->done)
+		g_cond_wait(&vdev->cond, &vdev->mutex);
+	g_mutex_unlock(&vdev->mutex);
+
+	g_free(job->name);
+	g_free(job->data);
+	g_free(job);
+}
+
+/* Queue chunks of a stream in the replay pool, up to the read-ahead. */
+static int stream_queue(struct session_vdev *vdev,
+		struct session_stream *stream)
+{
+	struct chunk_job *job;
 	struct zip_stat zs;
-	GSList *l;
-	int ret, got_data;
-	char capturefile[16];
-	void *buf;
+	char *name;
 
-	(void)fd;
-	(void)revents;
+	while (!stream->last_queued && g_queue_get_length(stream->jobs)
+			< (guint)(vdev->num_threads * READAHEAD_PER_THREAD)) {
+		name = g_strdup_printf("%s-%d", stream->name,
+				++stream->next_chunk);
+		if (zip_stat(vdev->archive, name, 0, &zs) == -1) {
+			g_free(name);
+			stream->last_queued = TRUE;
+			if (stream->next_chunk == 1) {
+				sr_err("No capture file '%s' in session "
+				       "file '%s'.", stream->name,
+				       vdev->sessionfile);
+				return SR_ERR;
+			}
+			break;
+		}
+		if (!(job = g_try_malloc0(sizeof(struct chunk_job)))) {
+			g_free(name);
+			sr_err("%s: job malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		job->name = name;
+		job->size = zs.size;
+		job->stream = stream;
+		g_queue_push_tail(stream->jobs, job);
+		g_thread_pool_push(vdev->pool, job, NULL);
+	}
 
-	got_data = FALSE;
-	for (l = dev_insts; l; l = l->next) {
-		sdi = l->data;
-		if (!(vdev = sdi->priv))
-			/* Already done with this instance. */
-			continue;
+	return SR_OK;
+}
+
+/*
+ * Read up to len bytes of the stream's next decompressed chunk, waiting
+ * for it if need be. Returns how many bytes were read, or -1 on errors.
+ */
+static int stream_read_queued(struct session_vdev *vdev,
+		struct session_stream *stream, uint8_t *buf, int len)
+{
+	struct chunk_job *job;
+	int n;
+
+	if (!(job = g_queue_peek_head(stream->jobs))) {
+		stream->done = TRUE;
+		return 0;
+	}
+
+	g_mutex_lock(&vdev->mutex);
+	while (!job->done)
+		g_cond_wait(&vdev->cond, &vdev->mutex);
+	g_mutex_unlock(&vdev->mutex);
+	if (job->ret != SR_OK)
+		return -1;
+
+	if ((n = MIN((uint64_t)len, job->size - job->pos)) > 0)
+		memcpy(buf, job->data + job->pos, n);
+	job->pos += n;
+	if (job->pos == job->size) {
+		chunk_job_free(vdev, g_queue_pop_head(stream->jobs));
+		if (stream_queue(vdev, stream) != SR_OK)
+			return -1;
+	}
+
+	return n;
+}
+
+/* Read a coded member whole, and decode it for the stream. */
+static int stream_decode(struct session_vdev *vdev,
+		struct session_stream *stream, const char *name,
+		uint64_t size)
+{
+	struct zip_file *zf;
+	zip_int64_t len;
+	uint64_t pos;
+	int ret;
+
+	if (!(stream->decoded = g_try_malloc(MAX(1, size)))) {
+		sr_err("%s: stream->decoded malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if (!(zf = zip_fopen(vdev->archive, name, 0))) {
+		sr_err("Failed to open '%s'.", name);
+		return SR_ERR;
+	}
+	for (pos = 0; pos < size; pos += len)
+		if ((len = zip_fread(zf, stream->decoded + pos,
+				size - pos)) <= 0)
+			break;
+	zip_fclose(zf);
+	if (pos != size) {
+		sr_err("Failed to read '%s'.", name);
+		return SR_ERR;
+	}
+	if ((ret = member_decode(stream, name, &stream->decoded,
+			&size)) != SR_OK)
+		return ret;
+	stream->decoded_size = size;
+	stream->decoded_pos = 0;
+	sr_dbg("Decoded %s.", name);
 
-		if (!vdev->capfile) {
-			/* No capture file opened yet, or finished with the last
-			 * chunked one. */
-			if (vdev->cur_chunk == 0) {
-				/* capturefile is always the unchunked base name. */
-				if (zip_stat(vdev->archive, vdev->capturefile, 0, &zs) != -1) {
-					/* No chunks, just a single capture file. */
-					vdev->cur_chunk = 0;
-					if (!(vdev->capfile = zip_fopen(vdev->archive,
-							vdev->capturefile, 0)))
-						return FALSE;
-						sr_dbg("Opened %s.", vdev->capturefile);
-				} else {
-					/* Try as first chunk filename. */
-					snprintf(capturefile, 15, "%s-1", vdev->capturefile);
-					if (zip_stat(vdev->archive, capturefile, 0, &zs) != -1) {
-						vdev->cur_chunk = 1;
-						if (!(vdev->capfile = zip_fopen(vdev->archive,
-								capturefile, 0)))
-							return FALSE;
-						sr_dbg("Opened %s.", capturefile);
-					} else {
-						sr_err("No capture file '%s' in " "session file '%s'.",
-								vdev->capturefile, vdev->sessionfile);
-						return FALSE;
-					}
-				}
-			} else {
-				/* Capture data is chunked, advance to the next chunk. */
-				vdev->cur_chunk++;
-				snprintf(capturefile, 15, "%s-%d", vdev->capturefile,
-						vdev->cur_chunk);
-				if (zip_stat(vdev->archive, capturefile, 0, &zs) != -1) {
-					if (!(vdev->capfile = zip_fopen(vdev->archive,
-							capturefile, 0)))
-						return FALSE;
-					sr_dbg("Opened %s.", capturefile);
-				} else {
-					/* We got all the chunks, finish up. */
-					g_free(vdev->capturefile);
-					g_free(vdev);
-					sdi->priv = NULL;
-					continue;
-				}
+	return SR_OK;
+}
+
+/* Open the next member of a stream, or mark it done if there is none. */
+static int stream_open(struct session_vdev *vdev,
+		struct session_stream *stream)
+{
+	struct zip_stat zs;
+	char *name;
+	int ret;
+
+	if (stream->cur_chunk == 0
+	    && zip_stat(vdev->archive, stream->name, 0, &zs) != -1) {
+		/* No chunks, just a single capture file. */
+		stream->cur_chunk = -1;
+		name = g_strdup(stream->name);
+	} else if (stream->cur_chunk == 0 && vdev->pool) {
+		/* Chunks are decompressed in the pool and handed over. */
+		if (!(stream->jobs = g_queue_new())) {
+			sr_err("%s: stream->jobs malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		return stream_queue(vdev, stream);
+	} else if (stream->cur_chunk >= 0) {
+		stream->cur_chunk++;
+		name = g_strdup_printf("%s-%d", stream->name,
+				stream->cur_chunk);
+		if (zip_stat(vdev->archive, name, 0, &zs) == -1) {
+			g_free(name);
+			if (stream->cur_chunk == 1) {
+				sr_err("No capture file '%s' in session "
+				       "file '%s'.", stream->name,
+				       vdev->sessionfile);
+				return SR_ERR;
 			}
+			/* We got all the chunks. */
+			stream->done = TRUE;
+			return SR_OK;
 		}
+	} else {
+		stream->done = TRUE;
+		return SR_OK;
+	}
 
-		if (!(buf = g_try_malloc(CHUNKSIZE))) {
-			sr_err("%s: buf malloc failed", __func__);
-			return FALSE;
+	if (stream_coded(stream)) {
+		ret = stream_decode(vdev, stream, name, zs.size);
+		g_free(name);
+		return ret;
+	}
+
+	if (!(stream->file = zip_fopen(vdev->archive, name, 0))) {
+		sr_err("Failed to open '%s'.", name);
+		g_free(name);
+		return SR_ERR;
+	}
+	sr_dbg("Opened %s.", name);
+	g_free(name);
+
+	return SR_OK;
+}
+
+/* Read up to len bytes of a stream, continuing across its chunks. */
+static int stream_read(struct session_vdev *vdev,
+		struct session_stream *stream, uint8_t *buf, int len)
+{
+	int got, ret;
+
+	got = 0;
+	while (got < len && !stream->done) {
+		if (stream->jobs) {
+			if ((ret = stream_read_queued(vdev, stream,
+					buf + got, len - got)) < 0)
+				return -1;
+			got += ret;
+			continue;
+		}
+		if (stream->decoded) {
+			ret = MIN((uint64_t)(len - got),
+				stream->decoded_size - stream->decoded_pos);
+			memcpy(buf + got, stream->decoded
+					+ stream->decoded_pos, ret);
+			got += ret;
+			if ((stream->decoded_pos += ret)
+					== stream->decoded_size) {
+				g_free(stream->decoded);
+				stream->decoded = NULL;
+			}
+			continue;
+		}
+		if (!stream->file) {
+			if (stream_open(vdev, stream) != SR_OK)
+				return -1;
+			continue;
+		}
+		if ((ret = zip_fread(stream->file, buf + got, len - got)) > 0) {
+			got += ret;
+		} else {
+			/* Done with this capture file. */
+			zip_fclose(stream->file);
+			stream->file = NULL;
 		}
+	}
+
+	return got;
+}
+
+/* Close a stream, so it can be read again from the start. */
+static void stream_reset(struct session_vdev *vdev,
+		struct session_stream *stream)
+{
+	if (stream->file)
+		zip_fclose(stream->file);
+	stream->file = NULL;
+	g_free(stream->decoded);
+	stream->decoded = NULL;
+	stream->cur_chunk = 0;
+	stream->done = FALSE;
+	if (stream->jobs) {
+		while (!g_queue_is_empty(stream->jobs))
+			chunk_job_free(vdev, g_queue_pop_head(stream->jobs));
+		g_queue_free(stream->jobs);
+	}
+	stream->jobs = NULL;
+	stream->next_chunk = 0;
+	stream->last_queued = FALSE;
+}
+
+/* Reset all streams of a device, and close the pool threads' archives. */
+static void streams_reset(struct session_vdev *vdev)
+{
+	GSList *l;
+	int k;
+
+	/* Queued chunks nobody waits for anymore needn't be read. */
+	g_mutex_lock(&vdev->mutex);
+	vdev->cancelled = TRUE;
+	g_mutex_unlock(&vdev->mutex);
+
+	stream_reset(vdev, &vdev->logic);
+	for (k = 0; k < vdev->num_planes; k++)
+		stream_reset(vdev, &vdev->planes[k]);
+	for (l = vdev->analog; l; l = l->next)
+		stream_reset(vdev, &((struct session_analog *)l->data)->stream);
 
-		ret = zip_fread(vdev->capfile, buf, CHUNKSIZE);
-		if (ret > 0) {
-			got_data = TRUE;
+	while (!g_queue_is_empty(vdev->idle_archives))
+		zip_close(g_queue_pop_head(vdev->idle_archives));
+	vdev->cancelled = FALSE;
+}
+
+/* Analog samples are stored little endian, except for SR_ANALOG_U9. */
+static void analog_to_host(const struct session_analog *analog,
+		uint8_t *buf, int count)
+{
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+	uint8_t tmp;
+	int size, i, j;
+
+	size = analog->sample_size;
+	if (size == 1 || analog->encoding == SR_ANALOG_U9)
+		return;
+	for (i = 0; i < count; i++, buf += size) {
+		for (j = 0; j < size / 2; j++) {
+			tmp = buf[j];
+			buf[j] = buf[size - 1 - j];
+			buf[size - 1 - j] = tmp;
+		}
+	}
+#else
+	(void)analog;
+	(void)buf;
+	(void)count;
+#endif
+}
+
+/*
+ * Read up to max_samples of the logic data of the planar layout into buf,
+ * which takes up to CHUNKSIZE bytes. Short of the end, only multiples of
+ * 8 samples are read, whole bytes of each plane. Returns the number of
+ * bytes read, or -1 on errors.
+ */
+static int planes_read(struct session_vdev *vdev, uint8_t *buf,
+		uint64_t max_samples)
+{
+	uint64_t num_samples, num_bytes, left;
+	int got, k;
+
+	left = vdev->num_samples - vdev->bytes_read / vdev->unitsize;
+	num_samples = MIN(vdev->plane_bytes * 8, left);
+	if (max_samples < num_samples)
+		num_samples = max_samples - max_samples % 8;
+	num_bytes = (num_samples + 7) / 8;
+	for (k = 0; k < vdev->num_planes; k++) {
+		if ((got = stream_read(vdev, &vdev->planes[k],
+				vdev->plane_buf + k * vdev->plane_bytes,
+				num_bytes)) < 0)
+			return -1;
+		if ((uint64_t)got < num_bytes) {
+			/* Don't give out more than all planes have. */
+			num_bytes = got;
+			num_samples = MIN(num_samples, num_bytes * 8);
+		}
+	}
+
+	sr_logic_planes_unpack(vdev->plane_ptrs, vdev->unitsize, num_bytes,
+			buf);
+
+	return num_samples * vdev->unitsize;
+}
+
+static int send_analog(const struct sr_dev_inst *sdi,
+		struct session_analog *a, struct sr_buffer *buf, int count)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+	struct sr_datafeed_analog_raw raw;
+
+	analog_to_host(a, buf->data, count);
+
+	if (a->encoding) {
+		memset(&raw, 0, sizeof(raw));
+		raw.probes = a->probes;
+		raw.num_samples = count;
+		raw.mq = a->mq;
+		raw.unit = a->unit;
+		raw.mqflags = a->mqflags;
+		raw.encoding = a->encoding;
+		raw.scale = &a->scale;
+		raw.offset = &a->offset;
+		raw.data = buf->data;
+		packet.type = SR_DF_ANALOG_RAW;
+		packet.payload = &raw;
+	} else {
+		memset(&analog, 0, sizeof(analog));
+		analog.probes = a->probes;
+		analog.num_samples = count;
+		analog.mq = a->mq;
+		analog.unit = a->unit;
+		analog.mqflags = a->mqflags;
+		analog.data = (float *)buf->data;
+		packet.type = SR_DF_ANALOG;
+		packet.payload = &analog;
+	}
+
+	return sr_session_send_buffer(sdi, &packet, buf);
+}
+
+/*
+ * Send the next piece of a device's capture data, up to max_samples. The
+ * analog streams follow the logic one sample for sample, so that the data
+ * of mixed-signal captures is replayed in step. Once the logic data is
+ * done, the rest of the analog data goes in packets of its own size.
+ */
+static int send_next(const struct sr_dev_inst *sdi, uint64_t max_samples,
+		gboolean *got_data)
+{
+	struct session_vdev *vdev;
+	struct session_analog *a;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_buffer *buf;
+	GSList *l;
+	uint64_t size;
+	int num_samples, sent, len, count;
+
+	vdev = sdi->priv;
+	*got_data = FALSE;
+
+	if (vdev->planes && !vdev->logic.done && max_samples < 8
+	    && max_samples < vdev->num_samples
+			- vdev->bytes_read / vdev->unitsize) {
+		/* Not a whole byte of each plane due yet. */
+		*got_data = TRUE;
+		return SR_OK;
+	}
+
+	num_samples = 0;
+	if (!vdev->logic.done) {
+		if (vdev->planes)
+			size = CHUNKSIZE;
+		else
+			size = MAX(MIN(vdev->chunksize / vdev->unitsize,
+					max_samples), 1) * vdev->unitsize;
+		if (!(buf = sr_buffer_pool_acquire(size))) {
+			sr_err("%s: buf malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		if (vdev->planes) {
+			if (!(len = planes_read(vdev, buf->data,
+					max_samples)))
+				vdev->logic.done = TRUE;
+		} else {
+			/* Only whole samples, chunks needn't end on one. */
+			len = stream_read(vdev, &vdev->logic, buf->data, size);
+		}
+		if (len > 0) {
+			*got_data = TRUE;
 			packet.type = SR_DF_LOGIC;
 			packet.payload = &logic;
-			logic.length = ret;
+			logic.length = len;
 			logic.unitsize = vdev->unitsize;
-			logic.data = buf;
-			vdev->bytes_read += ret;
-			sr_session_send(cb_data, &packet);
-		} else {
-			/* done with this capture file */
-			zip_fclose(vdev->capfile);
-			vdev->capfile = NULL;
-			if (vdev->cur_chunk == 0) {
-				/* It was the only file. */
-				g_free(vdev->capturefile);
-				g_free(vdev);
-				sdi->priv = NULL;
-			} else {
-				/* There might be more chunks, so don't fall through
-				 * to the SR_DF_END here. */
-				g_free(buf);
-				return TRUE;
-			}
+			logic.data = buf->data;
+			vdev->bytes_read += len;
+			num_samples = len / vdev->unitsize;
+			sr_session_send_buffer(sdi, &packet, buf);
 		}
-		g_free(buf);
+		sr_buffer_unref(buf);
+		if (len < 0)
+			return SR_ERR;
 	}
 
-	if (!got_data) {
-		packet.type = SR_DF_END;
-		sr_session_send(cb_data, &packet);
-		sr_session_source_remove(-1);
+	sent = num_samples;
+	for (l = vdev->analog; l; l = l->next) {
+		a = l->data;
+		if (a->stream.done)
+			continue;
+		count = num_samples;
+		if (!count)
+			count = MAX(MIN(vdev->chunksize / a->sample_size,
+					max_samples), 1);
+		if (!(buf = sr_buffer_pool_acquire(count * a->sample_size))) {
+			sr_err("%s: buf malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		len = stream_read(vdev, &a->stream, buf->data,
+				count * a->sample_size);
+		if ((count = len / a->sample_size) > 0) {
+			*got_data = TRUE;
+			send_analog(sdi, a, buf, count);
+			sent = MAX(sent, count);
+		}
+		sr_buffer_unref(buf);
+		if (len < 0)
+			return SR_ERR;
 	}
+	vdev->samples_sent += sent;
+
+	return SR_OK;
+}
+
+/*
+ * How many samples of a paced device are due by now. Without pacing,
+ * that's as many as there are.
+ */
+static uint64_t samples_due(const struct session_vdev *vdev)
+{
+	double due;
+
+	if (vdev->speed <= 0 || !vdev->samplerate)
+		return UINT64_MAX;
+
+	due = (g_get_monotonic_time() - vdev->start_time) / 1000000.0
+			* vdev->samplerate * vdev->speed;
+	if (due <= vdev->samples_sent)
+		return 0;
+
+	return MIN(due - vdev->samples_sent, (double)UINT64_MAX);
+}
+
+/* Finish replaying a device. Returns FALSE if it wasn't running. */
+static gboolean dev_finish(const struct sr_dev_inst *sdi)
+{
+	struct session_vdev *vdev;
+	struct sr_datafeed_packet packet;
+	gboolean was_running;
+
+	vdev = sdi->priv;
+
+	G_LOCK(running);
+	was_running = vdev->running;
+	vdev->running = FALSE;
+	G_UNLOCK(running);
+	if (!was_running)
+		return FALSE;
+
+	streams_reset(vdev);
+	zip_close(vdev->archive);
+	vdev->archive = NULL;
+
+	packet.type = SR_DF_END;
+	sr_session_send(sdi, &packet);
 
 	return TRUE;
 }
 
+/* Whether any device of the session is still being replayed. */
+static gboolean session_running(const struct sr_session *session)
+{
+	struct sr_dev_inst *sdi;
+	struct session_vdev *vdev;
+	GSList *l;
+
+	for (l = dev_insts; l; l = l->next) {
+		sdi = l->data;
+		vdev = sdi->priv;
+		if (sdi->session == session && vdev->running)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* One source replays all devices of a session, cb_data is the session. */
+static int receive_data(int fd, int revents, void *cb_data)
+{
+	struct sr_session *session;
+	struct sr_dev_inst *sdi;
+	struct session_vdev *vdev;
+	GSList *l;
+	uint64_t due;
+	gboolean got_data, sent, idle;
+
+	(void)fd;
+	(void)revents;
+
+	session = cb_data;
+	sent = idle = FALSE;
+	for (l = dev_insts; l; l = l->next) {
+		sdi = l->data;
+		vdev = sdi->priv;
+		if (sdi->session != session || !vdev->running)
+			continue;
+		/* Paced devices wait until some of their data is due. */
+		if (!(due = samples_due(vdev))) {
+			idle = TRUE;
+			continue;
+		}
+		sent = TRUE;
+		if (send_next(sdi, due, &got_data) != SR_OK || !got_data)
+			dev_finish(sdi);
+	}
+
+	/*
+	 * The session may be calling back right away, spinning around a
+	 * source without a file descriptor.
+	 */
+	if (idle && !sent)
+		g_usleep(1000);
+
+	G_LOCK(running);
+	if (!session_running(session))
+		sr_session_source_remove(session, -1);
+	G_UNLOCK(running);
+
+	return TRUE;
+}
+
+static void vdev_free(struct session_vdev *vdev)
+{
+	struct session_analog *a;
+	GSList *l;
+	int k;
+
+	if (vdev->pool)
+		g_thread_pool_free(vdev->pool, FALSE, TRUE);
+	for (k = 0; k < vdev->num_planes; k++)
+		g_free(vdev->planes[k].name);
+	g_free(vdev->planes);
+	g_free(vdev->plane_buf);
+	g_free(vdev->plane_ptrs);
+	g_queue_free(vdev->idle_archives);
+	g_mutex_clear(&vdev->mutex);
+	g_cond_clear(&vdev->cond);
+	for (l = vdev->analog; l; l = l->next) {
+		a = l->data;
+		g_free(a->stream.name);
+		g_slist_free(a->probes);
+		g_free(a);
+	}
+	g_slist_free(vdev->analog);
+	g_free(vdev->logic.name);
+	g_free(vdev->sessionfile);
+	g_free(vdev);
+}
+
+/**
+ * Add the capture data of an analog probe to a session file's virtual
+ * device.
+ *
+ * @param sdi The virtual device. Must not be NULL.
+ * @param probe The analog probe the data is of. Must not be NULL.
+ * @param capturefile The base name of the data in the session file. Must
+ *                    not be NULL.
+ * @param format The mq, unit, mqflags and encoding of the data, with the
+ *               scale and offset of the probe for raw samples. An encoding
+ *               of 0 means float samples. The other fields are ignored.
+ * @param delta TRUE if the data is coded with sr_analog_delta_encode().
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_MALLOC upon memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_vdev_analog_add(struct sr_dev_inst *sdi,
+		struct sr_probe *probe, const char *capturefile,
+		const struct sr_datafeed_analog_raw *format, gboolean delta)
+{
+	struct session_vdev *vdev;
+	struct session_analog *a;
+	int size;
+
+	if (!sdi || !(vdev = sdi->priv) || !probe || !capturefile || !format) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (format->encoding)
+		size = sr_analog_encoding_size(format->encoding);
+	else
+		size = sizeof(float);
+	if (!size) {
+		sr_err("Unknown analog encoding %d.", format->encoding);
+		return SR_ERR_ARG;
+	}
+
+	if (!(a = g_try_malloc0(sizeof(struct session_analog)))) {
+		sr_err("%s: analog malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	a->stream.name = g_strdup(capturefile);
+	a->stream.delta = delta;
+	a->stream.delta_encoding = format->encoding;
+	a->probes = g_slist_append(NULL, probe);
+	a->encoding = format->encoding;
+	a->sample_size = size;
+	if (format->encoding) {
+		a->scale = format->scale[0];
+		a->offset = format->offset[0];
+	}
+	a->mq = format->mq;
+	a->unit = format->unit;
+	a->mqflags = format->mqflags;
+	vdev->analog = g_slist_append(vdev->analog, a);
+
+	return SR_OK;
+}
+
+/**
+ * Switch a session file's virtual device to the planar layout, where its
+ * logic data is stored as one bit-packed stream per bit of the samples.
+ *
+ * The device's capture file and unitsize must have been set before.
+ *
+ * @param sdi The virtual device. Must not be NULL.
+ * @param num_samples The number of samples in the streams.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_MALLOC upon memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_vdev_planar_set(struct sr_dev_inst *sdi,
+		uint64_t num_samples)
+{
+	struct session_vdev *vdev;
+	int k;
+
+	if (!sdi || !(vdev = sdi->priv) || !vdev->logic.name
+	    || vdev->unitsize <= 0 || vdev->planes) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	vdev->num_planes = vdev->unitsize * 8;
+	vdev->num_samples = num_samples;
+	vdev->plane_bytes = MAX(1, CHUNKSIZE / vdev->num_planes);
+	if (!(vdev->planes = g_try_new0(struct session_stream,
+			vdev->num_planes))
+	    || !(vdev->plane_buf = g_try_malloc(vdev->num_planes
+			* vdev->plane_bytes))
+	    || !(vdev->plane_ptrs = g_try_new(const uint8_t *,
+			vdev->num_planes))) {
+		sr_err("%s: planes malloc failed", __func__);
+		g_free(vdev->planes);
+		g_free(vdev->plane_buf);
+		vdev->planes = NULL;
+		vdev->plane_buf = NULL;
+		vdev->num_planes = 0;
+		return SR_ERR_MALLOC;
+	}
+	for (k = 0; k < vdev->num_planes; k++) {
+		vdev->planes[k].name = g_strdup_printf("%s-p%d",
+				vdev->logic.name, k + 1);
+		vdev->plane_ptrs[k] = vdev->plane_buf + k * vdev->plane_bytes;
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Mark the logic data of a session file's virtual device as coded with
+ * sr_logic_rle_encode(), every member of it is decoded as it is read.
+ *
+ * The device's capture file and unitsize must have been set before.
+ *
+ * @param sdi The virtual device. Must not be NULL, and must not be running.
+ *
+ * @return SR_OK upon success, or SR_ERR_ARG upon invalid arguments.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_vdev_rle_set(struct sr_dev_inst *sdi)
+{
+	struct session_vdev *vdev;
+
+	if (!sdi || !(vdev = sdi->priv) || !vdev->logic.name
+	    || vdev->unitsize <= 0 || vdev->planes || vdev->running) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	vdev->logic.rle_unitsize = vdev->unitsize;
+
+	return SR_OK;
+}
+
+/**
+ * Set how many threads decompress the chunks of a session file's virtual
+ * device while it is replayed.
+ *
+ * @param sdi The virtual device. Must not be NULL, and must not be running.
+ * @param num_threads The number of threads. 1 decompresses everything in
+ *                    the session's thread.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         if the device is running or the threads could not be created.
+ *
+ * @private
+ */
+SR_PRIV int sr_session_vdev_threads_set(struct sr_dev_inst *sdi,
+		int num_threads)
+{
+	struct session_vdev *vdev;
+	GError *error;
+
+	if (!sdi || !(vdev = sdi->priv) || num_threads < 1) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (vdev->running) {
+		sr_err("Can't change the threads of a running device.");
+		return SR_ERR;
+	}
+
+	if (vdev->pool)
+		g_thread_pool_free(vdev->pool, FALSE, TRUE);
+	vdev->pool = NULL;
+	vdev->num_threads = num_threads;
+	if (num_threads == 1)
+		return SR_OK;
+
+	error = NULL;
+	if (!(vdev->pool = g_thread_pool_new(chunk_job_run, vdev,
+			num_threads, FALSE, &error))) {
+		sr_err("Failed to start replay threads: %s.", error->message);
+		g_error_free(error);
+		vdev->num_threads = 1;
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}
+
 /* driver callbacks */
 
 static int init(struct sr_context *sr_ctx)
@@ -182,10 +1056,14 @@ static int init(struct sr_context *sr_ctx)
 
 static int cleanup(void)
 {
+	struct sr_dev_inst *sdi;
 	GSList *l;
 
-	for (l = dev_insts; l; l = l->next)
-		sr_dev_inst_free(l->data);
+	for (l = dev_insts; l; l = l->next) {
+		sdi = l->data;
+		vdev_free(sdi->priv);
+		sr_dev_inst_free(sdi);
+	}
 	g_slist_free(dev_insts);
 	dev_insts = NULL;
 
@@ -194,10 +1072,18 @@ static int cleanup(void)
 
 static int dev_open(struct sr_dev_inst *sdi)
 {
-	if (!(sdi->priv = g_try_malloc0(sizeof(struct session_vdev)))) {
+	struct session_vdev *vdev;
+
+	if (!(vdev = g_try_malloc0(sizeof(struct session_vdev)))) {
 		sr_err("Device context malloc failed.");
 		return SR_ERR_MALLOC;
 	}
+	vdev->num_threads = 1;
+	vdev->chunksize = CHUNKSIZE;
+	vdev->idle_archives = g_queue_new();
+	g_mutex_init(&vdev->mutex);
+	g_cond_init(&vdev->cond);
+	sdi->priv = vdev;
 
 	dev_insts = g_slist_append(dev_insts, sdi);
 
@@ -219,6 +1105,18 @@ static int config_get(int id, GVariant **data, const struct sr_dev_inst *sdi,
 		} else
 			return SR_ERR;
 		break;
+	case SR_CONF_BUFFERSIZE:
+		if (!sdi)
+			return SR_ERR;
+		vdev = sdi->priv;
+		*data = g_variant_new_uint64(vdev->chunksize);
+		break;
+	case SR_CONF_REPLAY_SPEED:
+		if (!sdi)
+			return SR_ERR;
+		vdev = sdi->priv;
+		*data = g_variant_new_double(vdev->speed);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -230,6 +1128,8 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 		const struct sr_probe_group *probe_group)
 {
 	struct session_vdev *vdev;
+	uint64_t chunksize;
+	double speed;
 
 	(void)probe_group;
 
@@ -245,8 +1145,9 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 		sr_info("Setting sessionfile to '%s'.", vdev->sessionfile);
 		break;
 	case SR_CONF_CAPTUREFILE:
-		vdev->capturefile = g_strdup(g_variant_get_string(data, NULL));
-		sr_info("Setting capturefile to '%s'.", vdev->capturefile);
+		g_free(vdev->logic.name);
+		vdev->logic.name = g_strdup(g_variant_get_string(data, NULL));
+		sr_info("Setting capturefile to '%s'.", vdev->logic.name);
 		break;
 	case SR_CONF_CAPTURE_UNITSIZE:
 		vdev->unitsize = g_variant_get_uint64(data);
@@ -254,6 +1155,23 @@ static int config_set(int id, GVariant *data, const struct sr_dev_inst *sdi,
 	case SR_CONF_CAPTURE_NUM_PROBES:
 		vdev->num_probes = g_variant_get_uint64(data);
 		break;
+	case SR_CONF_BUFFERSIZE:
+		chunksize = g_variant_get_uint64(data);
+		if (chunksize < 1 || chunksize > MAX_CHUNKSIZE) {
+			sr_err("Invalid buffer size %" PRIu64 ".", chunksize);
+			return SR_ERR_ARG;
+		}
+		vdev->chunksize = chunksize;
+		break;
+	case SR_CONF_REPLAY_SPEED:
+		speed = g_variant_get_double(data);
+		if (!(speed >= 0)) {
+			sr_err("Invalid replay speed %g.", speed);
+			return SR_ERR_ARG;
+		}
+		vdev->speed = speed;
+		sr_info("Setting replay speed to %g.", speed);
+		break;
 	default:
 		return SR_ERR_NA;
 	}
@@ -282,24 +1200,55 @@ static int config_list(int key, GVariant **data, const struct sr_dev_inst *sdi,
 static int dev_acquisition_start(const struct sr_dev_inst *sdi, void *cb_data)
 {
 	struct session_vdev *vdev;
+	gboolean add_source;
 	int ret;
 
 	vdev = sdi->priv;
 
 	sr_info("Opening archive %s file %s", vdev->sessionfile,
-		vdev->capturefile);
+		vdev->logic.name);
 
 	if (!(vdev->archive = zip_open(vdev->sessionfile, 0, &ret))) {
 		sr_err("Failed to open session file '%s': "
 		       "zip error %d\n", vdev->sessionfile, ret);
 		return SR_ERR;
 	}
+	streams_reset(vdev);
+	vdev->bytes_read = 0;
+	vdev->samples_sent = 0;
+	if (vdev->speed > 0 && !vdev->samplerate)
+		sr_warn("No samplerate to pace the replay with.");
 
 	/* Send header packet to the session bus. */
 	std_session_send_df_header(cb_data, LOG_PREFIX);
 
-	/* freewheeling source */
-	sr_session_source_add(-1, 0, 0, receive_data, cb_data);
+	/*
+	 * The first device of the session to start adds the source, which
+	 * freewheels unless the replay is paced.
+	 */
+	G_LOCK(running);
+	add_source = !session_running(sdi->session);
+	vdev->running = TRUE;
+	vdev->start_time = g_get_monotonic_time();
+	if (add_source)
+		sr_session_source_add(sdi->session, -1, 0,
+				vdev->speed > 0 ? PACE_INTERVAL : 0,
+				receive_data, sdi->session);
+	G_UNLOCK(running);
+
+	return SR_OK;
+}
+
+static int dev_acquisition_stop(struct sr_dev_inst *sdi, void *cb_data)
+{
+	(void)cb_data;
+
+	if (dev_finish(sdi)) {
+		G_LOCK(running);
+		if (!session_running(sdi->session))
+			sr_session_source_remove(sdi->session, -1);
+		G_UNLOCK(running);
+	}
 
 	return SR_OK;
 }
@@ -320,6 +1269,6 @@ SR_PRIV struct sr_dev_driver session_driver = {
 	.dev_open = dev_open,
 	.dev_close = NULL,
 	.dev_acquisition_start = dev_acquisition_start,
-	.dev_acquisition_stop = NULL,
+	.dev_acquisition_stop = dev_acquisition_stop,
 	.priv = NULL,
 };
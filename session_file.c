@@ -20,7 +20,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <zip.h>
+#include <zlib.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include "config.h" /* Needed for PACKAGE_VERSION and others. */
@@ -30,11 +32,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "session-file: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 /**
  * @file
@@ -48,9 +50,31 @@
  * @{
  */
 
-extern struct sr_session *session;
 extern SR_PRIV struct sr_dev_driver session_driver;
 
+/* Names of the analog encodings in "metadata", 0 is for floats. */
+static const struct {
+	int encoding;
+	const char *name;
+} analog_encodings[] = {
+	{ 0, "float" },
+	{ SR_ANALOG_U8, "u8" },
+	{ SR_ANALOG_S8, "s8" },
+	{ SR_ANALOG_S16, "s16" },
+	{ SR_ANALOG_U9, "u9" },
+};
+
+/* An analog probe of a device section, read from "analogN" keys. */
+struct load_analog {
+	gboolean present;
+	char *name;
+	struct sr_datafeed_analog_raw format;
+	float scale;
+	float offset;
+	/* Coded with sr_analog_delta_encode(). */
+	gboolean delta;
+};
+
 /** @private */
 SR_PRIV int sr_sessionfile_check(const char *filename)
 {
@@ -93,29 +117,553 @@ SR_PRIV int sr_sessionfile_check(const char *filename)
 	return SR_OK;
 }
 
+/* Transpose an 8x8 bit matrix, one row per byte. */
+static uint64_t transpose8(uint64_t x)
+{
+	uint64_t t;
+
+	t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+	x ^= t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+	x ^= t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+	x ^= t ^ (t << 28);
+
+	return x;
+}
+
+/**
+ * Split logic samples into bit planes, one per bit of the samples.
+ *
+ * Bit j of byte i of a plane is that bit of sample 8 * i + j.
+ *
+ * @param samples The samples, 8 * num_bytes of them.
+ * @param unitsize The number of bytes per sample.
+ * @param num_bytes The number of bytes to store in each plane.
+ * @param planes Array of unitsize * 8 planes, each of at least num_bytes.
+ *
+ * @private
+ */
+SR_PRIV void sr_logic_planes_pack(const uint8_t *samples, int unitsize,
+		uint64_t num_bytes, uint8_t **planes)
+{
+	uint64_t i, x;
+	int b, j;
+
+	for (i = 0; i < num_bytes; i++, samples += 8 * unitsize) {
+		for (b = 0; b < unitsize; b++) {
+			/* Byte b of the 8 samples, one per row. */
+			for (x = 0, j = 7; j >= 0; j--)
+				x = (x << 8) | samples[j * unitsize + b];
+			x = transpose8(x);
+			for (j = 0; j < 8; j++, x >>= 8)
+				planes[b * 8 + j][i] = x & 0xff;
+		}
+	}
+}
+
+/**
+ * Interleave bit planes into logic samples, undoing sr_logic_planes_pack().
+ *
+ * @param planes Array of unitsize * 8 planes, each of at least num_bytes.
+ * @param unitsize The number of bytes per sample.
+ * @param num_bytes The number of bytes to take from each plane.
+ * @param samples Where the 8 * num_bytes samples will be stored.
+ *
+ * @private
+ */
+SR_PRIV void sr_logic_planes_unpack(const uint8_t **planes, int unitsize,
+		uint64_t num_bytes, uint8_t *samples)
+{
+	uint64_t i, x;
+	int b, j;
+
+	for (i = 0; i < num_bytes; i++, samples += 8 * unitsize) {
+		for (b = 0; b < unitsize; b++) {
+			for (x = 0, j = 7; j >= 0; j--)
+				x = (x << 8) | planes[b * 8 + j][i];
+			x = transpose8(x);
+			for (j = 0; j < 8; j++, x >>= 8)
+				samples[j * unitsize + b] = x & 0xff;
+		}
+	}
+}
+
+/*
+ * Logic chunks coded with sr_logic_rle_encode() start with the number of
+ * samples, as a little endian 32-bit number, followed by each bit plane
+ * (see sr_logic_planes_pack()) in turn. A plane starts with its mode:
+ *
+ *  - RLE_RUNS_0 or RLE_RUNS_1: the little endian 32-bit length of the
+ *    runs that follow, as LEB128 numbers. They alternate in value, the
+ *    first one being 0 or 1 as the mode says, and add up to the samples.
+ *  - RLE_RAW: the bytes of the plane as they are, for planes whose runs
+ *    would take more space than that.
+ */
+#define RLE_RUNS_0	0
+#define RLE_RUNS_1	1
+#define RLE_RAW		2
+
+/* Runs of a plane of num_samples bits, or 0 if they don't fit in max. */
+static uint64_t rle_runs(const uint8_t *plane, uint64_t num_samples,
+		uint8_t *out, uint64_t max)
+{
+	uint64_t i, run, len;
+	int bit, cur;
+
+	cur = plane[0] & 1;
+	run = len = 0;
+	for (i = 0; i < num_samples; ) {
+		/* Whole bytes which go on with the run are the common case. */
+		if (!(i & 7) && i + 8 <= num_samples
+		    && plane[i / 8] == (cur ? 0xff : 0x00)) {
+			run += 8;
+			i += 8;
+			continue;
+		}
+		bit = (plane[i / 8] >> (i & 7)) & 1;
+		if (bit != cur) {
+			for (; run >= 0x80; run >>= 7) {
+				if (len == max)
+					return 0;
+				out[len++] = (run & 0x7f) | 0x80;
+			}
+			if (len == max)
+				return 0;
+			out[len++] = run;
+			cur = bit;
+			run = 0;
+		}
+		run++;
+		i++;
+	}
+	for (; run >= 0x80; run >>= 7) {
+		if (len == max)
+			return 0;
+		out[len++] = (run & 0x7f) | 0x80;
+	}
+	if (len == max)
+		return 0;
+	out[len++] = run;
+
+	return len;
+}
+
+/**
+ * Code logic samples as run-length coded bit planes.
+ *
+ * Probes which hardly change take a few bytes per chunk this way, and
+ * the others no more than their bits.
+ *
+ * @param samples The samples to code.
+ * @param unitsize The number of bytes per sample.
+ * @param num_samples The number of samples, less than 2^32.
+ * @param len Pointer where the length of the coded data will be stored.
+ *
+ * @return The newly allocated coded data, or NULL upon errors.
+ *
+ * @private
+ */
+SR_PRIV uint8_t *sr_logic_rle_encode(const uint8_t *samples, int unitsize,
+		uint64_t num_samples, uint64_t *len)
+{
+	uint8_t *out, *planes, **plane_ptrs, *padded, *p;
+	uint64_t num_bytes, whole, n;
+	int num_planes, k;
+
+	num_planes = unitsize * 8;
+	num_bytes = (num_samples + 7) / 8;
+	whole = num_samples / 8;
+	out = g_try_malloc(4 + num_planes * (5 + num_bytes));
+	planes = g_try_malloc(num_planes * MAX(num_bytes, 1));
+	plane_ptrs = g_try_new(uint8_t *, num_planes);
+	padded = g_try_malloc0(8 * unitsize);
+	if (!out || !planes || !plane_ptrs || !padded) {
+		sr_err("%s: malloc failed", __func__);
+		g_free(out);
+		g_free(planes);
+		g_free(plane_ptrs);
+		g_free(padded);
+		return NULL;
+	}
+
+	for (k = 0; k < num_planes; k++)
+		plane_ptrs[k] = planes + k * MAX(num_bytes, 1);
+	sr_logic_planes_pack(samples, unitsize, whole, plane_ptrs);
+	if (whole < num_bytes) {
+		/* The last samples, padded to a whole byte of each plane. */
+		memcpy(padded, samples + whole * 8 * unitsize,
+				(num_samples - whole * 8) * unitsize);
+		for (k = 0; k < num_planes; k++)
+			plane_ptrs[k] += whole;
+		sr_logic_planes_pack(padded, unitsize, 1, plane_ptrs);
+		for (k = 0; k < num_planes; k++)
+			plane_ptrs[k] -= whole;
+	}
+	g_free(padded);
+
+	p = out;
+	*p++ = num_samples & 0xff;
+	*p++ = (num_samples >> 8) & 0xff;
+	*p++ = (num_samples >> 16) & 0xff;
+	*p++ = (num_samples >> 24) & 0xff;
+	for (k = 0; k < num_planes && num_samples; k++) {
+		if ((n = rle_runs(plane_ptrs[k], num_samples, p + 5,
+				num_bytes))) {
+			p[0] = plane_ptrs[k][0] & 1 ? RLE_RUNS_1 : RLE_RUNS_0;
+			p[1] = n & 0xff;
+			p[2] = (n >> 8) & 0xff;
+			p[3] = (n >> 16) & 0xff;
+			p[4] = (n >> 24) & 0xff;
+			p += 5 + n;
+		} else {
+			*p++ = RLE_RAW;
+			memcpy(p, plane_ptrs[k], num_bytes);
+			p += num_bytes;
+		}
+	}
+	g_free(planes);
+	g_free(plane_ptrs);
+
+	*len = p - out;
+
+	return out;
+}
+
+/**
+ * Get the number of samples in data coded with sr_logic_rle_encode().
+ *
+ * @param data The coded data.
+ * @param len The length of the coded data.
+ *
+ * @return The number of samples, 0 if the data is too short to tell.
+ *
+ * @private
+ */
+SR_PRIV uint64_t sr_logic_rle_count(const uint8_t *data, uint64_t len)
+{
+	if (len < 4)
+		return 0;
+
+	return data[0] | (data[1] << 8) | (data[2] << 16)
+			| ((uint64_t)data[3] << 24);
+}
+
+/* Set count bits of a plane, starting at bit start. */
+static void plane_fill(uint8_t *plane, uint64_t start, uint64_t count)
+{
+	uint64_t end;
+
+	end = start + count;
+	for (; start < end && (start & 7); start++)
+		plane[start / 8] |= 1 << (start & 7);
+	if (end - start >= 8) {
+		memset(plane + start / 8, 0xff, (end - start) / 8);
+		start += (end - start) & ~(uint64_t)7;
+	}
+	for (; start < end; start++)
+		plane[start / 8] |= 1 << (start & 7);
+}
+
+/**
+ * Decode logic samples coded with sr_logic_rle_encode().
+ *
+ * @param data The coded data.
+ * @param len The length of the coded data.
+ * @param unitsize The number of bytes per sample.
+ * @param samples Where the samples will be stored, as many as
+ *                sr_logic_rle_count() tells.
+ *
+ * @return SR_OK upon success, SR_ERR_MALLOC upon memory allocation errors,
+ *         or SR_ERR if the data is broken.
+ *
+ * @private
+ */
+SR_PRIV int sr_logic_rle_decode(const uint8_t *data, uint64_t len,
+		int unitsize, uint8_t *samples)
+{
+	const uint8_t *p, *end, *runs_end;
+	uint8_t *planes, *last;
+	const uint8_t **plane_ptrs;
+	uint64_t num_samples, num_bytes, whole, pos, run, n;
+	int num_planes, k, value, shift;
+
+	if (len < 4)
+		return SR_ERR;
+	num_samples = sr_logic_rle_count(data, len);
+	if (!num_samples)
+		return SR_OK;
+
+	num_planes = unitsize * 8;
+	num_bytes = (num_samples + 7) / 8;
+	whole = num_samples / 8;
+	/* Room for the last samples after the planes, they may be padded. */
+	planes = g_try_malloc0(num_planes * num_bytes + 8 * unitsize);
+	plane_ptrs = g_try_new(const uint8_t *, num_planes);
+	if (!planes || !plane_ptrs) {
+		sr_err("%s: planes malloc failed", __func__);
+		g_free(planes);
+		g_free(plane_ptrs);
+		return SR_ERR_MALLOC;
+	}
+
+	p = data + 4;
+	end = data + len;
+	for (k = 0; k < num_planes; k++) {
+		plane_ptrs[k] = planes + k * num_bytes;
+		if (p == end)
+			break;
+		if (*p == RLE_RAW) {
+			if ((uint64_t)(end - p - 1) < num_bytes)
+				break;
+			memcpy(planes + k * num_bytes, p + 1, num_bytes);
+			p += 1 + num_bytes;
+			continue;
+		}
+		if (*p > RLE_RUNS_1 || end - p < 5)
+			break;
+		value = *p;
+		n = p[1] | (p[2] << 8) | (p[3] << 16) | ((uint64_t)p[4] << 24);
+		p += 5;
+		if ((uint64_t)(end - p) < n)
+			break;
+		runs_end = p + n;
+		for (pos = 0; pos < num_samples && p < runs_end; value ^= 1) {
+			run = 0;
+			for (shift = 0; p < runs_end && shift < 64;
+					shift += 7) {
+				run |= (uint64_t)(*p & 0x7f) << shift;
+				if (!(*p++ & 0x80))
+					break;
+			}
+			if (!run || run > num_samples - pos)
+				break;
+			if (value)
+				plane_fill(planes + k * num_bytes, pos, run);
+			pos += run;
+		}
+		if (pos != num_samples || p != runs_end)
+			break;
+	}
+	if (k < num_planes) {
+		sr_err("Broken RLE coded logic chunk.");
+		g_free(planes);
+		g_free(plane_ptrs);
+		return SR_ERR;
+	}
+
+	sr_logic_planes_unpack(plane_ptrs, unitsize, whole, samples);
+	if (whole < num_bytes) {
+		for (k = 0; k < num_planes; k++)
+			plane_ptrs[k] += whole;
+		last = planes + num_planes * num_bytes;
+		sr_logic_planes_unpack(plane_ptrs, unitsize, 1, last);
+		memcpy(samples + whole * 8 * unitsize, last,
+				(num_samples - whole * 8) * unitsize);
+	}
+	g_free(planes);
+	g_free(plane_ptrs);
+
+	return SR_OK;
+}
+
+/**
+ * Code analog samples for compression.
+ *
+ * Raw samples are replaced by their difference to the previous one, and
+ * float samples by their bits XORed with those of the previous one, so
+ * that slowly changing signals turn into mostly zero bits. The bytes of
+ * the results are then grouped by their position in the sample, which
+ * keeps the mostly zero high bytes together for deflate.
+ *
+ * @param samples The samples, little endian.
+ * @param encoding One of SR_ANALOG_*, or 0 for float samples.
+ * @param num_samples The number of samples.
+ * @param out Where the coded data will be stored, as long as the samples.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_delta_encode(const uint8_t *samples, int encoding,
+		uint64_t num_samples, uint8_t *out)
+{
+	uint64_t i;
+	uint32_t v, prev, d;
+	int size, b;
+
+	size = encoding ? sr_analog_encoding_size(encoding) : sizeof(float);
+	prev = 0;
+	for (i = 0; i < num_samples; i++, samples += size) {
+		for (v = 0, b = size - 1; b >= 0; b--)
+			v = (v << 8) | samples[b];
+		d = encoding ? v - prev : v ^ prev;
+		prev = v;
+		for (b = 0; b < size; b++, d >>= 8)
+			out[b * num_samples + i] = d & 0xff;
+	}
+}
+
+/**
+ * Decode analog samples coded with sr_analog_delta_encode().
+ *
+ * @param data The coded data.
+ * @param encoding One of SR_ANALOG_*, or 0 for float samples.
+ * @param num_samples The number of samples.
+ * @param samples Where the samples will be stored, little endian.
+ *
+ * @private
+ */
+SR_PRIV void sr_analog_delta_decode(const uint8_t *data, int encoding,
+		uint64_t num_samples, uint8_t *samples)
+{
+	uint64_t i;
+	uint32_t v, prev, d;
+	int size, b;
+
+	size = encoding ? sr_analog_encoding_size(encoding) : sizeof(float);
+	prev = 0;
+	for (i = 0; i < num_samples; i++, samples += size) {
+		for (d = 0, b = size - 1; b >= 0; b--)
+			d = (d << 8) | data[b * num_samples + i];
+		v = encoding ? prev + d : prev ^ d;
+		prev = v;
+		for (b = 0; b < size; b++, v >>= 8)
+			samples[b] = v & 0xff;
+	}
+}
+
+/*
+ * Parse an "analogN" key, which has the name of the N-th analog probe, or
+ * an "analogN <field>" key, which has one of the fields of its format.
+ */
+static int analog_key_parse(GArray *analogs, const char *key,
+		const char *val)
+{
+	struct load_analog *la;
+	unsigned long num;
+	unsigned int i;
+	char *field;
+
+	num = strtoul(key, &field, 10);
+	if (num == 0 || num > G_MAXINT)
+		return SR_OK;
+	if (analogs->len < num)
+		g_array_set_size(analogs, num);
+	la = &g_array_index(analogs, struct load_analog, num - 1);
+
+	la->present = TRUE;
+	if (!*field) {
+		g_free(la->name);
+		la->name = g_strdup(val);
+	} else if (!strcmp(field, " encoding")) {
+		for (i = 0; i < ARRAY_SIZE(analog_encodings); i++) {
+			if (!strcmp(val, analog_encodings[i].name))
+				break;
+		}
+		if (i == ARRAY_SIZE(analog_encodings)) {
+			sr_err("Unsupported analog encoding '%s'.", val);
+			return SR_ERR;
+		}
+		la->format.encoding = analog_encodings[i].encoding;
+	} else if (!strcmp(field, " scale")) {
+		la->scale = g_ascii_strtod(val, NULL);
+	} else if (!strcmp(field, " offset")) {
+		la->offset = g_ascii_strtod(val, NULL);
+	} else if (!strcmp(field, " coding")) {
+		if (strcmp(val, "delta")) {
+			sr_err("Unsupported analog coding '%s'.", val);
+			return SR_ERR;
+		}
+		la->delta = TRUE;
+	} else if (!strcmp(field, " mq")) {
+		la->format.mq = strtol(val, NULL, 10);
+	} else if (!strcmp(field, " unit")) {
+		la->format.unit = strtol(val, NULL, 10);
+	} else if (!strcmp(field, " mqflags")) {
+		la->format.mqflags = strtoull(val, NULL, 10);
+	}
+
+	return SR_OK;
+}
+
+/*
+ * Add the analog probes of a device section to the loaded device, after
+ * its logic probes. Their data is named like the session writer does.
+ */
+static int analog_probes_add(struct sr_dev_inst *sdi, GArray *analogs,
+		int first_index, int devnum)
+{
+	struct load_analog *la;
+	struct sr_probe *probe;
+	char *capturefile, probename[SR_MAX_PROBENAME_LEN + 1];
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < analogs->len; i++) {
+		la = &g_array_index(analogs, struct load_analog, i);
+		if (!la->present)
+			continue;
+		snprintf(probename, SR_MAX_PROBENAME_LEN, "A%u", i);
+		if (!(probe = sr_probe_new(first_index + i, SR_PROBE_ANALOG,
+				TRUE, la->name ? la->name : probename)))
+			return SR_ERR_MALLOC;
+		sdi->probes = g_slist_append(sdi->probes, probe);
+		sr_dev_probe_table_invalidate(sdi);
+
+		la->format.scale = &la->scale;
+		la->format.offset = &la->offset;
+		capturefile = g_strdup_printf("analog-%d-%u", devnum, i + 1);
+		ret = sr_session_vdev_analog_add(sdi, probe, capturefile,
+				&la->format, la->delta);
+		g_free(capturefile);
+		if (ret != SR_OK)
+			return ret;
+	}
+
+	return SR_OK;
+}
+
+static void analogs_free(GArray *analogs)
+{
+	unsigned int i;
+
+	for (i = 0; i < analogs->len; i++)
+		g_free(g_array_index(analogs, struct load_analog, i).name);
+	g_array_free(analogs, TRUE);
+}
+
 /**
  * Load the session from the specified filename.
  *
  * @param filename The name of the session file to load. Must not be NULL.
+ * @param session Pointer where the new session, with a virtual device for
+ *                each capture in the file, will be stored. Must not be NULL.
+ *                The session must be freed with sr_session_destroy().
  *
  * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
  *         SR_ERR_MALLOC upon memory allocation errors, or SR_ERR upon
  *         other errors.
  */
-SR_API int sr_session_load(const char *filename)
+SR_API int sr_session_load(const char *filename, struct sr_session **session)
 {
 	GKeyFile *kf;
 	GPtrArray *capturefiles;
+	GArray *analogs;
 	struct zip *archive;
 	struct zip_file *zf;
 	struct zip_stat zs;
 	struct sr_dev_inst *sdi;
 	struct sr_probe *probe;
 	int ret, probenum, devcnt, i, j;
-	uint64_t tmp_u64, total_probes, enabled_probes, p;
+	uint64_t tmp_u64, total_probes, enabled_probes, p, num_samples;
+	gboolean planar, rle;
 	char **sections, **keys, *metafile, *val;
 	char probename[SR_MAX_PROBENAME_LEN + 1];
 
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
 	if ((ret = sr_sessionfile_check(filename)) != SR_OK)
 		return ret;
 
@@ -140,7 +688,8 @@ SR_API int sr_session_load(const char *filename)
 		return SR_ERR;
 	}
 
-	sr_session_new();
+	if (!(*session = sr_session_new()))
+		return SR_ERR_MALLOC;
 
 	devcnt = 0;
 	capturefiles = g_ptr_array_new_with_free_func(g_free);
@@ -153,6 +702,10 @@ SR_API int sr_session_load(const char *filename)
 			/* device section */
 			sdi = NULL;
 			enabled_probes = total_probes = 0;
+			planar = rle = FALSE;
+			num_samples = 0;
+			analogs = g_array_new(FALSE, TRUE,
+					sizeof(struct load_analog));
 			keys = g_key_file_get_keys(kf, sections[i], NULL, NULL);
 			for (j = 0; keys[j]; j++) {
 				val = g_key_file_get_string(kf, sections[i], keys[j], NULL);
@@ -163,7 +716,7 @@ SR_API int sr_session_load(const char *filename)
 						/* first device, init the driver */
 						sdi->driver->init(NULL);
 					sr_dev_open(sdi);
-					sr_session_dev_add(sdi);
+					sr_session_dev_add(*session, sdi);
 					sdi->driver->config_set(SR_CONF_SESSIONFILE,
 							g_variant_new_string(filename), sdi, NULL);
 					sdi->driver->config_set(SR_CONF_CAPTUREFILE,
@@ -173,6 +726,24 @@ SR_API int sr_session_load(const char *filename)
 					sr_parse_sizestring(val, &tmp_u64);
 					sdi->driver->config_set(SR_CONF_SAMPLERATE,
 							g_variant_new_uint64(tmp_u64), sdi, NULL);
+				} else if (!strcmp(keys[j], "compression")) {
+					/* libzip decompresses deflated chunks itself. */
+					if (!strcmp(val, "rle")) {
+						rle = TRUE;
+					} else if (strcmp(val, "none")
+					    && strcmp(val, "deflate")) {
+						sr_err("Unsupported compression '%s'.", val);
+						return SR_ERR;
+					}
+				} else if (!strcmp(keys[j], "layout")) {
+					if (!strcmp(val, "planar")) {
+						planar = TRUE;
+					} else if (strcmp(val, "interleaved")) {
+						sr_err("Unsupported layout '%s'.", val);
+						return SR_ERR;
+					}
+				} else if (!strcmp(keys[j], "samples")) {
+					num_samples = strtoull(val, NULL, 10);
 				} else if (!strcmp(keys[j], "unitsize")) {
 					tmp_u64 = strtoull(val, NULL, 10);
 					sdi->driver->config_set(SR_CONF_CAPTURE_UNITSIZE,
@@ -198,6 +769,13 @@ SR_API int sr_session_load(const char *filename)
 				} else if (!strncmp(keys[j], "trigger", 7)) {
 					probenum = strtoul(keys[j]+7, NULL, 10);
 					sr_dev_trigger_set(sdi, probenum, val);
+				} else if (!strncmp(keys[j], "analog", 6)) {
+					if (!sdi)
+						continue;
+					ret = analog_key_parse(analogs,
+							keys[j] + 6, val);
+					if (ret != SR_OK)
+						return ret;
 				}
 			}
 			g_strfreev(keys);
@@ -205,6 +783,19 @@ SR_API int sr_session_load(const char *filename)
 			if (total_probes)
 				for (p = enabled_probes; p < total_probes; p++)
 					sr_dev_probe_enable(sdi, p, FALSE);
+			ret = SR_OK;
+			if (sdi)
+				ret = analog_probes_add(sdi, analogs,
+						total_probes, strtoul(
+						sections[i] + 7, NULL, 10));
+			if (ret == SR_OK && sdi && planar)
+				ret = sr_session_vdev_planar_set(sdi,
+						num_samples);
+			if (ret == SR_OK && sdi && rle)
+				ret = sr_session_vdev_rle_set(sdi);
+			analogs_free(analogs);
+			if (ret != SR_OK)
+				return ret;
 		}
 		devcnt++;
 	}
@@ -214,9 +805,58 @@ SR_API int sr_session_load(const char *filename)
 	return SR_OK;
 }
 
+/**
+ * Set how many threads decompress the capture data of a loaded session
+ * file while it is replayed.
+ *
+ * Chunks of the capture data are decompressed ahead of time, a few per
+ * thread, and sent in order. The datafeed is the same as with a single
+ * thread. Capture data which isn't chunked, as in files which weren't
+ * written by the streaming session writer, is always read in the session's
+ * thread.
+ *
+ * @param session A session created by sr_session_load(), which must not be
+ *                running. Must not be NULL.
+ * @param num_threads The number of threads to use. 1 decompresses
+ *                    everything in the session's thread, which is the
+ *                    default.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_replay_threads_set(struct sr_session *session,
+		int num_threads)
+{
+	struct sr_dev_inst *sdi;
+	GSList *l;
+	int ret;
+
+	if (!session || num_threads < 1) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	for (l = session->devs; l; l = l->next) {
+		sdi = l->data;
+		if (sdi->driver != &session_driver)
+			continue;
+		if ((ret = sr_session_vdev_threads_set(sdi,
+				num_threads)) != SR_OK)
+			return ret;
+	}
+
+	return SR_OK;
+}
+
 /**
  * Save the current session to the specified file.
  *
+ * The data is stored uncompressed. Use sr_session_writer_open() and its
+ * companions to save captures which don't fit in memory, or to choose a
+ * compression level.
+ *
  * @param filename The name of the filename to save the current session as.
  *                 Must not be NULL.
  * @param sdi The device instance from which the data was captured.
@@ -230,158 +870,5085 @@ SR_API int sr_session_load(const char *filename)
 SR_API int sr_session_save(const char *filename, const struct sr_dev_inst *sdi,
 		unsigned char *buf, int unitsize, int units)
 {
-	GSList *l;
-	GVariant *gvar;
-	FILE *meta;
-	struct sr_probe *probe;
-	struct zip *zipfile;
-	struct zip_source *versrc, *metasrc, *logicsrc;
-	int tmpfile, ret, probecnt;
-	uint64_t samplerate;
-	char version[1], rawname[16], metafile[32], *s;
+	struct sr_session_writer *writer;
+	int ret;
 
 	if (!filename) {
 		sr_err("%s: filename was NULL", __func__);
 		return SR_ERR_ARG;
 	}
 
-	/* Quietly delete it first, libzip wants replace ops otherwise. */
-	unlink(filename);
-	if (!(zipfile = zip_open(filename, ZIP_CREATE, &ret)))
-		return SR_ERR;
+	if ((ret = sr_session_writer_open(&writer, filename, sdi,
+			unitsize)) != SR_OK)
+		return ret;
 
-	/* "version" */
-	version[0] = '1';
-	if (!(versrc = zip_source_buffer(zipfile, version, 1, 0)))
-		return SR_ERR;
-	if (zip_add(zipfile, "version", versrc) == -1) {
-		sr_info("error saving version into zipfile: %s",
-			zip_strerror(zipfile));
-		return SR_ERR;
+	if ((ret = sr_session_writer_write(writer, buf, units)) != SR_OK) {
+		sr_session_writer_close(writer);
+		unlink(filename);
+		return ret;
 	}
 
-	/* init "metadata" */
-	strcpy(metafile, "sigrok-meta-XXXXXX");
-	if ((tmpfile = g_mkstemp(metafile)) == -1)
-		return SR_ERR;
-	close(tmpfile);
-	meta = g_fopen(metafile, "wb");
-	fprintf(meta, "[global]\n");
-	fprintf(meta, "sigrok version = %s\n", PACKAGE_VERSION);
+	return sr_session_writer_close(writer);
+}
 
-	/* metadata */
-	fprintf(meta, "[device 1]\n");
-	if (sdi->driver)
-		fprintf(meta, "driver = %s\n", sdi->driver->name);
+/** @cond PRIVATE */
+/* Size of each capture chunk written by the session writer. */
+#define WRITER_CHUNKSIZE (4 * 1024 * 1024)
 
-	/* metadata */
-	fprintf(meta, "capturefile = logic-1\n");
-	fprintf(meta, "unitsize = %d\n", unitsize);
-	fprintf(meta, "total probes = %d\n", g_slist_length(sdi->probes));
-	if (sr_dev_has_option(sdi, SR_CONF_SAMPLERATE)) {
-		if (sr_config_get(sdi->driver, sdi, NULL,
-					SR_CONF_SAMPLERATE, &gvar) == SR_OK) {
-			samplerate = g_variant_get_uint64(gvar);
-			s = sr_samplerate_string(samplerate);
-			fprintf(meta, "samplerate = %s\n", s);
-			g_free(s);
-			g_variant_unref(gvar);
-		}
-	}
-	probecnt = 1;
-	for (l = sdi->probes; l; l = l->next) {
-		probe = l->data;
-		if (probe->enabled) {
-			if (probe->name)
-				fprintf(meta, "probe%d = %s\n", probecnt, probe->name);
-			if (probe->trigger)
-				fprintf(meta, " trigger%d = %s\n", probecnt, probe->trigger);
-			probecnt++;
-		}
-	}
+/* Size of the pieces RLE packets are expanded in for writing. */
+#define WRITER_RLE_SIZE (64 * 1024)
 
-	if (!(logicsrc = zip_source_buffer(zipfile, buf,
-			   units * unitsize, FALSE)))
-		return SR_ERR;
-	snprintf(rawname, 15, "logic-1");
-	if (zip_add(zipfile, rawname, logicsrc) == -1)
-		return SR_ERR;
-	fclose(meta);
+/* Bytes of each plane packed at once, in the planar layout. */
+#define WRITER_PLANAR_BATCH 4096
 
-	if (!(metasrc = zip_source_file(zipfile, metafile, 0, -1)))
-		return SR_ERR;
-	if (zip_add(zipfile, "metadata", metasrc) == -1)
-		return SR_ERR;
+#define ZIP_LOCAL_HEADER_SIG	0x04034b50
+#define ZIP_CENTRAL_HEADER_SIG	0x02014b50
+#define ZIP_END_SIG		0x06054b50
+#define ZIP64_END_SIG		0x06064b50
+#define ZIP64_LOCATOR_SIG	0x07064b50
 
-	if ((ret = zip_close(zipfile)) == -1) {
-		sr_info("error saving zipfile: %s", zip_strerror(zipfile));
-		return SR_ERR;
-	}
+/* Samples per block in the lowest level of the summary. */
+#define SUMMARY_BLOCK_SHIFT	16
+/* Blocks of one level combined into one block of the next level. */
+#define SUMMARY_FANOUT_SHIFT	4
+#define SUMMARY_MAX_LEVELS	16
+#define SUMMARY_HEADER_SIZE	32
+#define SUMMARY_VERSION		1
 
-	unlink(metafile);
+/* Encoding of analog probes which didn't get any samples yet. */
+#define ANALOG_UNSET		-1
 
-	return SR_OK;
-}
+/* Samples the reader interleaves at once, in the planar layout. */
+#define READER_PLANAR_SIZE	(64 * 1024)
+/** @endcond */
 
-/**
- * Append data to an existing session file.
- *
- * @param filename The name of the filename to append to. Must not be NULL.
- * @param buf The data to be appended.
- * @param unitsize The number of bytes per sample.
- * @param units The number of samples.
- *
- * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
- *         upon other errors.
+
+struct writer_entry {
+	char *name;
+	uint16_t method;
+	uint32_t crc;
+	uint64_t csize;
+	uint64_t size;
+	uint64_t offset;
+};
+
+/* A logic or analog capture stream, written in chunks "<name>-N". */
+struct writer_stream {
+	char *name;
+	uint8_t *chunk;
+	size_t chunk_size;
+	size_t chunk_used;
+	int num_chunks;
+	/*
+	 * Unitsize of the samples if the chunks are coded with
+	 * sr_logic_rle_encode(), 0 otherwise.
+	 */
+	int rle_unitsize;
+	/* Analog chunks are coded with sr_analog_delta_encode(). */
+	gboolean delta;
+	int delta_encoding;
+};
+
+/* The data of an analog probe, whose format is set by its first packet. */
+struct writer_analog {
+	const struct sr_probe *probe;
+	struct writer_stream stream;
+	/* ANALOG_UNSET until samples were written, 0 for floats. */
+	int encoding;
+	float scale;
+	float offset;
+	int mq;
+	int unit;
+	uint64_t mqflags;
+};
+
+struct writer_dev {
+	const struct sr_dev_inst *sdi;
+	/* Everything in the device section of "metadata" but the samplerate. */
+	GString *probe_meta;
+	uint64_t samplerate;
+	int unitsize;
+	uint64_t num_samples;
+	struct writer_stream logic;
+	/*
+	 * In the planar layout, the logic data goes to one bit-packed
+	 * stream "<logic>-p<k>" per bit of the samples instead, set up
+	 * with the first samples. Samples are packed 8 at a time, the
+	 * ones left over wait in pending.
+	 */
+	struct writer_stream *planes;
+	int num_planes;
+	uint8_t *packed;
+	uint8_t **packed_planes;
+	uint8_t *pending;
+	int num_pending;
+	/* One struct writer_analog for every enabled analog probe. */
+	GPtrArray *analog;
+};
+
+struct sr_session_writer {
+	FILE *file;
+	char *filename;
+	/* The devices written, the first one is "device 1" in "metadata". */
+	GPtrArray *devs;
+	/* Unitsize of the first device, which the summary is of. */
+	int unitsize;
+	/* Current write position in the archive. */
+	uint64_t offset;
+	/* Entries written so far, needed for the central directory. */
+	GArray *entries;
+	/*
+	 * When appending, the central directory records of the entries
+	 * which were in the archive already, written before the others.
+	 */
+	uint8_t *kept;
+	uint64_t kept_size;
+	uint64_t num_kept;
+	/* Deflate level of the capture chunks, 0 stores them uncompressed. */
+	int level;
+	/* Store the logic data of the devices as bit planes. */
+	gboolean planar;
+	/* Code the logic chunks with sr_logic_rle_encode(). */
+	gboolean rle;
+	/* Code the analog chunks with sr_analog_delta_encode(). */
+	gboolean delta;
+	uint8_t *zbuf;
+	size_t zbuf_size;
+	/* Samples of one probe, taken out of an interleaved analog packet. */
+	uint8_t *abuf;
+	size_t abuf_size;
+	/*
+	 * Gets a byte whenever a member was written and flushed, see
+	 * sr_session_writer_notify_set().
+	 */
+	gboolean notify;
+	int notify_fd;
+	/* Per-block summary of the samples written so far, if enabled. */
+	gboolean summary;
+	uint64_t num_samples;
+	GArray *sum_blocks;
+	uint64_t cur_or, cur_and, prev;
+	uint64_t cur_trans[64];
+	uint64_t cur_fill;
+};
+
+/*
+ * A summary record covers a block of samples. It has the OR and AND of
+ * all samples in the block, followed by one transition count per probe.
+ * A transition is counted at the sample where a probe changed compared
+ * to the previous sample, which may be in the block before.
  */
-SR_API int sr_session_append(const char *filename, unsigned char *buf,
-		int unitsize, int units)
+struct summary_block {
+	uint64_t or_mask;
+	uint64_t and_mask;
+	uint64_t trans[64];
+};
+
+static uint8_t *put_le16(uint8_t *p, uint16_t v)
 {
-	struct zip *archive;
-	struct zip_source *logicsrc;
-	zip_int64_t num_files;
-	int chunk_num, next_chunk_num, ret, i;
-	const char *entry_name;
-	char chunkname[16];
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
 
-	if ((ret = sr_sessionfile_check(filename)) != SR_OK)
-		return ret;
+	return p + 2;
+}
 
-	if (!(archive = zip_open(filename, 0, &ret)))
-		return SR_ERR;
+static uint8_t *put_le32(uint8_t *p, uint32_t v)
+{
+	p = put_le16(p, v & 0xffff);
 
-	next_chunk_num = 1;
-	num_files = zip_get_num_entries(archive, 0);
-	for (i = 0; i < num_files; i++) {
-		entry_name = zip_get_name(archive, i, 0);
-		if (strncmp(entry_name, "logic-1", 7))
-			continue;
-		if (strlen(entry_name) == 7) {
-			/* This file has no extra chunks, just a single "logic-1".
-			 * Rename it to "logic-1-1" * and continue with chunk 2. */
-			if (zip_rename(archive, i, "logic-1-1") == -1) {
-				sr_err("Failed to rename 'logic-1' to 'logic-1-1'.");
-				return SR_ERR;
-			}
-			next_chunk_num = 2;
-			break;
-		} else if (strlen(entry_name) > 8 && entry_name[7] == '-') {
-			chunk_num = strtoull(entry_name + 8, NULL, 10);
-			if (chunk_num >= next_chunk_num)
-				next_chunk_num = chunk_num + 1;
-		}
-	}
-	snprintf(chunkname, 15, "logic-1-%d", next_chunk_num);
-	if (!(logicsrc = zip_source_buffer(archive, buf, units * unitsize, FALSE)))
-		return SR_ERR;
-	if (zip_add(archive, chunkname, logicsrc) == -1)
-		return SR_ERR;
-	if ((ret = zip_close(archive)) == -1) {
-		sr_info("error saving session file: %s", zip_strerror(archive));
-		return SR_ERR;
-	}
+	return put_le16(p, v >> 16);
+}
+
+static uint8_t *put_le64(uint8_t *p, uint64_t v)
+{
+	p = put_le32(p, v & 0xffffffff);
+
+	return put_le32(p, v >> 32);
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return get_le16(p) | ((uint32_t)get_le16(p + 2) << 16);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static int writer_write(struct sr_session_writer *writer, const void *buf,
+		size_t len)
+{
+	if (len && fwrite(buf, len, 1, writer->file) != 1) {
+		sr_err("Failed to write to '%s'.", writer->filename);
+		return SR_ERR;
+	}
+	writer->offset += len;
+
+	return SR_OK;
+}
+
+/*
+ * Deflate a buffer into writer->zbuf. Returns the compressed size, or 0 if
+ * the data should rather be stored as is.
+ */
+static size_t writer_deflate(struct sr_session_writer *writer,
+		const void *buf, size_t len)
+{
+	z_stream strm;
+	size_t size;
+
+	memset(&strm, 0, sizeof(strm));
+	/* Zip members are raw deflate streams, without zlib header. */
+	if (deflateInit2(&strm, writer->level, Z_DEFLATED, -MAX_WBITS, 8,
+			Z_DEFAULT_STRATEGY) != Z_OK) {
+		sr_err("Failed to initialize deflate: %s.", strm.msg);
+		return 0;
+	}
+
+	size = deflateBound(&strm, len);
+	if (size > writer->zbuf_size) {
+		g_free(writer->zbuf);
+		if (!(writer->zbuf = g_try_malloc(size))) {
+			sr_err("%s: zbuf malloc failed", __func__);
+			writer->zbuf_size = 0;
+			deflateEnd(&strm);
+			return 0;
+		}
+		writer->zbuf_size = size;
+	}
+
+	strm.next_in = (Bytef *)buf;
+	strm.avail_in = len;
+	strm.next_out = writer->zbuf;
+	strm.avail_out = writer->zbuf_size;
+	size = 0;
+	if (deflate(&strm, Z_FINISH) == Z_STREAM_END)
+		size = strm.total_out;
+	deflateEnd(&strm);
+
+	/* Not worth it for data that doesn't compress. */
+	return size < len ? size : 0;
+}
+
+/* Tell whoever follows the file that it grew, once it's on disk. */
+static void writer_notify(struct sr_session_writer *writer)
+{
+	char c;
+
+	if (!writer->notify || (writer->file && fflush(writer->file) != 0))
+		return;
+
+	/* If the pipe is full, the reader will look soon anyway. */
+	c = 0;
+	if (write(writer->notify_fd, &c, 1) < 0 && errno != EAGAIN)
+		sr_dbg("Failed to notify about '%s'.", writer->filename);
+}
+
+/*
+ * Write a complete archive member, compressed with the writer's current
+ * deflate level if compress is TRUE. Since the whole member is known by
+ * now, no data descriptor is needed after it.
+ */
+static int writer_add(struct sr_session_writer *writer, const char *name,
+		const void *buf, size_t len, gboolean compress)
+{
+	struct writer_entry entry;
+	const void *data;
+	uint8_t hdr[30], *p;
+	int ret;
+
+	entry.name = g_strdup(name);
+	entry.crc = crc32(0L, buf, len);
+	entry.size = len;
+	entry.offset = writer->offset;
+
+	data = buf;
+	entry.method = 0;
+	if (compress && writer->level > 0 && len > 0
+	    && (entry.csize = writer_deflate(writer, buf, len))) {
+		entry.method = Z_DEFLATED;
+		data = writer->zbuf;
+	} else {
+		entry.csize = len;
+	}
+
+	p = put_le32(hdr, ZIP_LOCAL_HEADER_SIG);
+	p = put_le16(p, entry.method ? 20 : 10); /* Version needed */
+	p = put_le16(p, 0);		/* Flags */
+	p = put_le16(p, entry.method);	/* Compression method */
+	p = put_le16(p, 0);		/* Modification time */
+	p = put_le16(p, 0x21);		/* Modification date: 1980-01-01 */
+	p = put_le32(p, entry.crc);
+	p = put_le32(p, entry.csize);	/* Compressed size */
+	p = put_le32(p, len);		/* Uncompressed size */
+	p = put_le16(p, strlen(name));
+	put_le16(p, 0);			/* Extra field length */
+
+	if ((ret = writer_write(writer, hdr, sizeof(hdr))) != SR_OK
+	    || (ret = writer_write(writer, name, strlen(name))) != SR_OK
+	    || (ret = writer_write(writer, data, entry.csize)) != SR_OK) {
+		g_free(entry.name);
+		return ret;
+	}
+
+	g_array_append_val(writer->entries, entry);
+	writer_notify(writer);
+
+	return SR_OK;
+}
+
+/* Write the central directory, end records and close the file. */
+static int writer_finish(struct sr_session_writer *writer)
+{
+	struct writer_entry *entry;
+	uint64_t cd_offset, cd_size;
+	uint8_t hdr[56], *p;
+	unsigned int i, num;
+	gboolean zip64;
+	int ret;
+
+	cd_offset = writer->offset;
+	num = writer->num_kept + writer->entries->len;
+
+	if ((ret = writer_write(writer, writer->kept,
+			writer->kept_size)) != SR_OK)
+		return ret;
+	for (i = 0; i < writer->entries->len; i++) {
+		entry = &g_array_index(writer->entries, struct writer_entry, i);
+		/* Only offsets can grow past 4GB, chunks are much smaller. */
+		zip64 = entry->offset >= 0xffffffff;
+		p = put_le32(hdr, ZIP_CENTRAL_HEADER_SIG);
+		p = put_le16(p, (3 << 8) | 45);	/* Made by: UNIX, 4.5 */
+		p = put_le16(p, zip64 ? 45 : entry->method ? 20 : 10);
+		p = put_le16(p, 0);
+		p = put_le16(p, entry->method);
+		p = put_le16(p, 0);
+		p = put_le16(p, 0x21);
+		p = put_le32(p, entry->crc);
+		p = put_le32(p, entry->csize);
+		p = put_le32(p, entry->size);
+		p = put_le16(p, strlen(entry->name));
+		p = put_le16(p, zip64 ? 12 : 0);	/* Extra field length */
+		p = put_le16(p, 0);			/* Comment length */
+		p = put_le16(p, 0);			/* Disk number */
+		p = put_le16(p, 0);			/* Internal attributes */
+		p = put_le32(p, 0100644 << 16);		/* External attributes */
+		p = put_le32(p, zip64 ? 0xffffffff : entry->offset);
+		if ((ret = writer_write(writer, hdr, p - hdr)) != SR_OK)
+			return ret;
+		if ((ret = writer_write(writer, entry->name,
+				strlen(entry->name))) != SR_OK)
+			return ret;
+		if (zip64) {
+			p = put_le16(hdr, 0x0001);	/* ZIP64 extended info */
+			p = put_le16(p, 8);
+			p = put_le64(p, entry->offset);
+			if ((ret = writer_write(writer, hdr, p - hdr)) != SR_OK)
+				return ret;
+		}
+	}
+	cd_size = writer->offset - cd_offset;
+
+	zip64 = cd_offset >= 0xffffffff || num >= 0xffff;
+	if (zip64) {
+		p = put_le32(hdr, ZIP64_END_SIG);
+		p = put_le64(p, 44);		/* Size of the remaining record */
+		p = put_le16(p, (3 << 8) | 45);
+		p = put_le16(p, 45);
+		p = put_le32(p, 0);
+		p = put_le32(p, 0);
+		p = put_le64(p, num);
+		p = put_le64(p, num);
+		p = put_le64(p, cd_size);
+		p = put_le64(p, cd_offset);
+		p = put_le32(p, ZIP64_LOCATOR_SIG);
+		p = put_le32(p, 0);
+		p = put_le64(p, cd_offset + cd_size);
+		p = put_le32(p, 1);		/* Total number of disks */
+		if ((ret = writer_write(writer, hdr, p - hdr)) != SR_OK)
+			return ret;
+	}
+
+	p = put_le32(hdr, ZIP_END_SIG);
+	p = put_le16(p, 0);
+	p = put_le16(p, 0);
+	p = put_le16(p, zip64 ? 0xffff : num);
+	p = put_le16(p, zip64 ? 0xffff : num);
+	p = put_le32(p, zip64 ? 0xffffffff : cd_size);
+	p = put_le32(p, zip64 ? 0xffffffff : cd_offset);
+	p = put_le16(p, 0);			/* Comment length */
+	if ((ret = writer_write(writer, hdr, p - hdr)) != SR_OK)
+		return ret;
+
+	/* An archive appended to may have had a longer comment. */
+	if (writer->num_kept && (fflush(writer->file) != 0
+	    || ftruncate(fileno(writer->file), writer->offset) != 0)) {
+		sr_err("Failed to truncate '%s'.", writer->filename);
+		return SR_ERR;
+	}
+
+	if (fclose(writer->file) != 0) {
+		writer->file = NULL;
+		sr_err("Failed to close '%s'.", writer->filename);
+		return SR_ERR;
+	}
+	writer->file = NULL;
+	writer_notify(writer);
+
+	return SR_OK;
+}
+
+static int stream_flush(struct sr_session_writer *writer,
+		struct writer_stream *stream)
+{
+	char *chunkname;
+	uint8_t *coded;
+	uint64_t len;
+	int size, ret;
+
+	chunkname = g_strdup_printf("%s-%d", stream->name,
+			stream->num_chunks + 1);
+	if (stream->delta) {
+		len = stream->chunk_used;
+		size = stream->delta_encoding ? sr_analog_encoding_size(
+				stream->delta_encoding) : (int)sizeof(float);
+		if ((coded = g_try_malloc(MAX(len, 1)))) {
+			sr_analog_delta_encode(stream->chunk,
+					stream->delta_encoding, len / size,
+					coded);
+			ret = writer_add(writer, chunkname, coded, len, TRUE);
+			g_free(coded);
+		} else {
+			sr_err("%s: coded malloc failed", __func__);
+			ret = SR_ERR_MALLOC;
+		}
+	} else if (stream->rle_unitsize) {
+		/* Stored as they are, so readers can index them in place. */
+		if ((coded = sr_logic_rle_encode(stream->chunk,
+				stream->rle_unitsize, stream->chunk_used
+				/ stream->rle_unitsize, &len))) {
+			ret = writer_add(writer, chunkname, coded, len,
+					FALSE);
+			g_free(coded);
+		} else {
+			ret = SR_ERR_MALLOC;
+		}
+	} else {
+		ret = writer_add(writer, chunkname, stream->chunk,
+				stream->chunk_used, TRUE);
+	}
+	g_free(chunkname);
+	if (ret != SR_OK)
+		return ret;
+
+	stream->num_chunks++;
+	stream->chunk_used = 0;
+
+	return SR_OK;
+}
+
+static int stream_write(struct sr_session_writer *writer,
+		struct writer_stream *stream, const uint8_t *data, uint64_t len)
+{
+	size_t n;
+	int ret;
+
+	/* Allocated on first use, devices may not have data of every kind. */
+	if (len && !stream->chunk
+	    && !(stream->chunk = g_try_malloc(stream->chunk_size))) {
+		sr_err("%s: chunk malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	while (len) {
+		n = MIN(len, stream->chunk_size - stream->chunk_used);
+		memcpy(stream->chunk + stream->chunk_used, data, n);
+		stream->chunk_used += n;
+		data += n;
+		len -= n;
+		if (stream->chunk_used == stream->chunk_size
+		    && (ret = stream_flush(writer, stream)) != SR_OK)
+			return ret;
+	}
+
+	return SR_OK;
+}
+
+static uint64_t sample_get(const uint8_t *p, int unitsize)
+{
+	uint64_t v;
+	int i;
+
+	v = 0;
+	for (i = unitsize - 1; i >= 0; i--)
+		v = (v << 8) | p[i];
+
+	return v;
+}
+
+static void summary_block_end(struct sr_session_writer *writer)
+{
+	struct summary_block block;
+
+	block.or_mask = writer->cur_or;
+	block.and_mask = writer->cur_and;
+	memcpy(block.trans, writer->cur_trans, sizeof(block.trans));
+	g_array_append_val(writer->sum_blocks, block);
+
+	writer->cur_or = 0;
+	writer->cur_and = ~(uint64_t)0;
+	memset(writer->cur_trans, 0, sizeof(writer->cur_trans));
+	writer->cur_fill = 0;
+}
+
+static void summary_update(struct sr_session_writer *writer,
+		const uint8_t *data, uint64_t units)
+{
+	uint64_t i, v, diff;
+
+	for (i = 0; i < units; i++, data += writer->unitsize) {
+		v = sample_get(data, writer->unitsize);
+		writer->cur_or |= v;
+		writer->cur_and &= v;
+		if (writer->num_samples + i > 0) {
+			/* Only visit the probes which actually changed. */
+			for (diff = v ^ writer->prev; diff; diff &= diff - 1)
+				writer->cur_trans[__builtin_ctzll(diff)]++;
+		}
+		writer->prev = v;
+		if (++writer->cur_fill == 1 << SUMMARY_BLOCK_SHIFT)
+			summary_block_end(writer);
+	}
+}
+
+/*
+ * Build all levels of the summary from the lowest one, and serialize it:
+ * a header, the number of records on each level, then the records of all
+ * levels, starting with the lowest one.
+ */
+static uint8_t *summary_build(struct sr_session_writer *writer, size_t *len)
+{
+	struct summary_block *blocks, *dst, *src;
+	uint64_t counts[SUMMARY_MAX_LEVELS], total, i, j;
+	unsigned int num_levels, l, k, num_probes;
+	uint8_t *buf, *p;
+	size_t rec_size;
+
+	if (writer->cur_fill)
+		summary_block_end(writer);
+
+	/* Count the records needed for all levels. */
+	num_levels = 0;
+	total = 0;
+	counts[0] = writer->sum_blocks->len;
+	while (TRUE) {
+		total += counts[num_levels];
+		if (counts[num_levels] <= 1 || num_levels + 1 == SUMMARY_MAX_LEVELS)
+			break;
+		counts[num_levels + 1] = (counts[num_levels]
+				+ (1 << SUMMARY_FANOUT_SHIFT) - 1) >> SUMMARY_FANOUT_SHIFT;
+		num_levels++;
+	}
+	num_levels++;
+
+	/* The higher levels are appended to the lowest one. */
+	g_array_set_size(writer->sum_blocks, total);
+	blocks = (struct summary_block *)writer->sum_blocks->data;
+	src = blocks;
+	for (l = 1; l < num_levels; l++) {
+		dst = src + counts[l - 1];
+		for (i = 0; i < counts[l]; i++) {
+			dst[i].or_mask = 0;
+			dst[i].and_mask = ~(uint64_t)0;
+			memset(dst[i].trans, 0, sizeof(dst[i].trans));
+			for (j = i << SUMMARY_FANOUT_SHIFT;
+			     j < MIN((i + 1) << SUMMARY_FANOUT_SHIFT, counts[l - 1]); j++) {
+				dst[i].or_mask |= src[j].or_mask;
+				dst[i].and_mask &= src[j].and_mask;
+				for (k = 0; k < 64; k++)
+					dst[i].trans[k] += src[j].trans[k];
+			}
+		}
+		src = dst;
+	}
+
+	num_probes = writer->unitsize * 8;
+	rec_size = 16 + 8 * num_probes;
+	*len = SUMMARY_HEADER_SIZE + 8 * num_levels + total * rec_size;
+	if (!(buf = g_try_malloc(*len))) {
+		sr_err("%s: summary malloc failed", __func__);
+		return NULL;
+	}
+
+	p = put_le32(buf, SUMMARY_VERSION);
+	p = put_le32(p, writer->unitsize);
+	p = put_le32(p, SUMMARY_BLOCK_SHIFT);
+	p = put_le32(p, SUMMARY_FANOUT_SHIFT);
+	p = put_le32(p, num_levels);
+	p = put_le32(p, 0);
+	p = put_le64(p, writer->num_samples);
+	for (l = 0; l < num_levels; l++)
+		p = put_le64(p, counts[l]);
+	for (i = 0; i < total; i++) {
+		p = put_le64(p, blocks[i].or_mask);
+		p = put_le64(p, blocks[i].and_mask);
+		for (k = 0; k < num_probes; k++)
+			p = put_le64(p, blocks[i].trans[k]);
+	}
+
+	return buf;
+}
+
+static void analog_free(gpointer data)
+{
+	struct writer_analog *analog;
+
+	analog = data;
+	g_free(analog->stream.name);
+	g_free(analog->stream.chunk);
+	g_free(analog);
+}
+
+static void dev_free(gpointer data)
+{
+	struct writer_dev *dev;
+	int k;
+
+	dev = data;
+	for (k = 0; dev->planes && k < dev->num_planes; k++) {
+		g_free(dev->planes[k].name);
+		g_free(dev->planes[k].chunk);
+	}
+	g_free(dev->planes);
+	g_free(dev->packed);
+	g_free(dev->packed_planes);
+	g_free(dev->pending);
+	g_string_free(dev->probe_meta, TRUE);
+	g_free(dev->logic.name);
+	g_free(dev->logic.chunk);
+	g_ptr_array_free(dev->analog, TRUE);
+	g_free(dev);
+}
+
+static void writer_free(struct sr_session_writer *writer)
+{
+	unsigned int i;
+
+	if (writer->file)
+		fclose(writer->file);
+	for (i = 0; i < writer->entries->len; i++)
+		g_free(g_array_index(writer->entries, struct writer_entry, i).name);
+	g_array_free(writer->entries, TRUE);
+	g_ptr_array_free(writer->devs, TRUE);
+	g_free(writer->kept);
+	g_free(writer->zbuf);
+	g_free(writer->abuf);
+	if (writer->sum_blocks)
+		g_array_free(writer->sum_blocks, TRUE);
+	g_free(writer->filename);
+	g_free(writer);
+}
+
+/*
+ * Set up the writing of a device's data, as "device <num>". Its logic
+ * data goes to "logic-<num>", the data of its k-th enabled analog probe
+ * to "analog-<num>-<k>".
+ */
+static struct writer_dev *dev_new(const struct sr_dev_inst *sdi,
+		int unitsize, int num)
+{
+	struct writer_dev *dev;
+	struct writer_analog *analog;
+	const struct sr_probe_table *table;
+	struct sr_probe *probe;
+	GVariant *gvar;
+	int i, n;
+
+	/* The probe setup can't change anymore once capturing started. */
+	if (!(table = sr_dev_probe_table_get(sdi)))
+		return NULL;
+
+	if (!(dev = g_try_malloc0(sizeof(struct writer_dev)))) {
+		sr_err("%s: dev malloc failed", __func__);
+		return NULL;
+	}
+	dev->sdi = sdi;
+	dev->unitsize = unitsize;
+	dev->logic.name = g_strdup_printf("logic-%d", num);
+	dev->logic.chunk_size = WRITER_CHUNKSIZE;
+	dev->analog = g_ptr_array_new_with_free_func(analog_free);
+	dev->probe_meta = g_string_sized_new(256);
+
+	if (sr_dev_has_option(sdi, SR_CONF_SAMPLERATE)) {
+		if (sr_config_get(sdi->driver, sdi, NULL,
+					SR_CONF_SAMPLERATE, &gvar) == SR_OK) {
+			dev->samplerate = g_variant_get_uint64(gvar);
+			g_variant_unref(gvar);
+		}
+	}
+
+	if (sdi->driver)
+		g_string_append_printf(dev->probe_meta, "driver = %s\n",
+				sdi->driver->name);
+	for (i = 0, n = 0; i < table->num_probes; i++) {
+		if (table->probes[i]->type == SR_PROBE_LOGIC)
+			n++;
+	}
+	g_string_append_printf(dev->probe_meta, "total probes = %d\n", n);
+	for (i = 0, n = 0; i < table->num_enabled; i++) {
+		probe = table->probes[table->enabled[i]];
+		if (probe->type == SR_PROBE_ANALOG) {
+			if (!(analog = g_try_malloc0(sizeof(*analog)))) {
+				sr_err("%s: analog malloc failed", __func__);
+				dev_free(dev);
+				return NULL;
+			}
+			analog->probe = probe;
+			analog->encoding = ANALOG_UNSET;
+			analog->stream.name = g_strdup_printf("analog-%d-%d",
+					num, dev->analog->len + 1);
+			analog->stream.chunk_size = WRITER_CHUNKSIZE;
+			g_ptr_array_add(dev->analog, analog);
+			continue;
+		}
+		n++;
+		if (probe->name)
+			g_string_append_printf(dev->probe_meta,
+				"probe%d = %s\n", n, probe->name);
+		if (probe->trigger)
+			g_string_append_printf(dev->probe_meta,
+				" trigger%d = %s\n", n, probe->trigger);
+	}
+
+	return dev;
+}
+
+/*
+ * Set up the coding of a device's chunks as the writer says. Coded logic
+ * chunks are cut at whole samples.
+ */
+static void dev_coding_set(const struct sr_session_writer *writer,
+		struct writer_dev *dev)
+{
+	unsigned int i;
+
+	dev->logic.rle_unitsize = writer->rle ? dev->unitsize : 0;
+	dev->logic.chunk_size = WRITER_CHUNKSIZE;
+	if (writer->rle)
+		dev->logic.chunk_size -= WRITER_CHUNKSIZE % dev->unitsize;
+	for (i = 0; i < dev->analog->len; i++)
+		((struct writer_analog *)g_ptr_array_index(dev->analog,
+				i))->stream.delta = writer->delta;
+}
+
+/* Whether a device got analog samples yet, whose coding is settled. */
+static gboolean dev_analog_written(const struct writer_dev *dev)
+{
+	const struct writer_analog *analog;
+	unsigned int i;
+
+	for (i = 0; i < dev->analog->len; i++) {
+		analog = g_ptr_array_index(dev->analog, i);
+		if (analog->encoding != ANALOG_UNSET)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Set up the bit planes of a device. Plane chunks hold as many samples as
+ * interleaved ones, so the chunks of all planes cover the same samples.
+ */
+static int dev_planes_new(struct writer_dev *dev)
+{
+	int k;
+
+	dev->num_planes = dev->unitsize * 8;
+	if (!(dev->planes = g_try_new0(struct writer_stream, dev->num_planes))
+	    || !(dev->packed = g_try_malloc(dev->num_planes
+			* WRITER_PLANAR_BATCH))
+	    || !(dev->packed_planes = g_try_new(uint8_t *, dev->num_planes))
+	    || !(dev->pending = g_try_malloc0(8 * dev->unitsize))) {
+		sr_err("%s: planes malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	for (k = 0; k < dev->num_planes; k++) {
+		dev->planes[k].name = g_strdup_printf("%s-p%d",
+				dev->logic.name, k + 1);
+		dev->planes[k].chunk_size = MAX(1,
+				WRITER_CHUNKSIZE / dev->num_planes);
+		dev->packed_planes[k] = dev->packed + k * WRITER_PLANAR_BATCH;
+	}
+
+	return SR_OK;
+}
+
+/* Pack groups of 8 samples, and append them to the planes. */
+static int dev_planes_write(struct sr_session_writer *writer,
+		struct writer_dev *dev, const uint8_t *buf, uint64_t num_bytes)
+{
+	uint64_t n;
+	int ret, k;
+
+	while (num_bytes) {
+		n = MIN(num_bytes, WRITER_PLANAR_BATCH);
+		sr_logic_planes_pack(buf, dev->unitsize, n,
+				dev->packed_planes);
+		for (k = 0; k < dev->num_planes; k++)
+			if ((ret = stream_write(writer, &dev->planes[k],
+					dev->packed_planes[k], n)) != SR_OK)
+				return ret;
+		buf += n * 8 * dev->unitsize;
+		num_bytes -= n;
+	}
+
+	return SR_OK;
+}
+
+static int dev_planar_write(struct sr_session_writer *writer,
+		struct writer_dev *dev, const uint8_t *buf, uint64_t units)
+{
+	uint64_t n;
+	int ret;
+
+	if (!dev->planes && (ret = dev_planes_new(dev)) != SR_OK)
+		return ret;
+
+	/* Complete the group left over from before. */
+	if (dev->num_pending) {
+		n = MIN(units, (uint64_t)(8 - dev->num_pending));
+		memcpy(dev->pending + dev->num_pending * dev->unitsize, buf,
+				n * dev->unitsize);
+		dev->num_pending += n;
+		buf += n * dev->unitsize;
+		units -= n;
+		if (dev->num_pending < 8)
+			return SR_OK;
+		dev->num_pending = 0;
+		if ((ret = dev_planes_write(writer, dev, dev->pending,
+				1)) != SR_OK)
+			return ret;
+	}
+
+	if ((ret = dev_planes_write(writer, dev, buf, units / 8)) != SR_OK)
+		return ret;
+
+	dev->num_pending = units % 8;
+	memcpy(dev->pending, buf + (units - dev->num_pending) * dev->unitsize,
+			dev->num_pending * dev->unitsize);
+
+	return SR_OK;
+}
+
+static int dev_logic_write(struct sr_session_writer *writer,
+		struct writer_dev *dev, const void *buf, uint64_t units)
+{
+	if (dev == g_ptr_array_index(writer->devs, 0)) {
+		if (writer->summary)
+			summary_update(writer, buf, units);
+		writer->num_samples += units;
+	}
+	dev->num_samples += units;
+
+	if (writer->planar)
+		return dev_planar_write(writer, dev, buf, units);
+
+	return stream_write(writer, &dev->logic, buf, units * dev->unitsize);
+}
+
+static struct writer_analog *analog_get(const struct writer_dev *dev,
+		const struct sr_probe *probe)
+{
+	struct writer_analog *analog;
+	unsigned int i;
+
+	for (i = 0; i < dev->analog->len; i++) {
+		analog = g_ptr_array_index(dev->analog, i);
+		if (analog->probe == probe)
+			return analog;
+	}
+
+	return NULL;
+}
+
+/*
+ * Append the samples of one probe out of an interleaved packet, stored
+ * little endian if swap is TRUE on this host.
+ */
+static int analog_write(struct sr_session_writer *writer,
+		struct writer_analog *analog, const uint8_t *data, int stride,
+		int size, int count, gboolean swap)
+{
+	uint8_t *p;
+	size_t len;
+	int i, j;
+
+	swap = swap && G_BYTE_ORDER == G_BIG_ENDIAN;
+	len = (size_t)count * size;
+	if (stride == size && !swap)
+		return stream_write(writer, &analog->stream, data, len);
+
+	if (len > writer->abuf_size) {
+		g_free(writer->abuf);
+		if (!(writer->abuf = g_try_malloc(len))) {
+			sr_err("%s: abuf malloc failed", __func__);
+			writer->abuf_size = 0;
+			return SR_ERR_MALLOC;
+		}
+		writer->abuf_size = len;
+	}
+
+	p = writer->abuf;
+	for (i = 0; i < count; i++, data += stride) {
+		for (j = 0; j < size; j++)
+			*p++ = data[swap ? size - 1 - j : j];
+	}
+
+	return stream_write(writer, &analog->stream, writer->abuf, len);
+}
+
+static int dev_analog_write(struct sr_session_writer *writer,
+		struct writer_dev *dev, const struct sr_datafeed_analog *analog)
+{
+	struct writer_analog *a;
+	GSList *l;
+	int num_probes, i, ret;
+
+	num_probes = g_slist_length(analog->probes);
+	for (l = analog->probes, i = 0; l; l = l->next, i++) {
+		if (!(a = analog_get(dev, l->data)))
+			continue;
+		if (a->encoding == ANALOG_UNSET) {
+			a->encoding = 0;
+			a->stream.delta_encoding = 0;
+			a->mq = analog->mq;
+			a->unit = analog->unit;
+			a->mqflags = analog->mqflags;
+		} else if (a->encoding != 0) {
+			sr_err("Probe %s changed from raw to float samples.",
+			       a->probe->name);
+			return SR_ERR_ARG;
+		}
+		if ((ret = analog_write(writer, a,
+				(const uint8_t *)(analog->data + i),
+				num_probes * sizeof(float), sizeof(float),
+				analog->num_samples, TRUE)) != SR_OK)
+			return ret;
+	}
+
+	return SR_OK;
+}
+
+static int dev_analog_raw_write(struct sr_session_writer *writer,
+		struct writer_dev *dev,
+		const struct sr_datafeed_analog_raw *raw)
+{
+	struct writer_analog *a;
+	GSList *l;
+	int num_probes, size, i, ret;
+
+	if (!(size = sr_analog_encoding_size(raw->encoding))) {
+		sr_err("Unknown analog encoding %d.", raw->encoding);
+		return SR_ERR_ARG;
+	}
+
+	num_probes = g_slist_length(raw->probes);
+	for (l = raw->probes, i = 0; l; l = l->next, i++) {
+		if (!(a = analog_get(dev, l->data)))
+			continue;
+		if (a->encoding == ANALOG_UNSET) {
+			a->encoding = raw->encoding;
+			a->stream.delta_encoding = raw->encoding;
+			a->scale = raw->scale[i];
+			a->offset = raw->offset[i];
+			a->mq = raw->mq;
+			a->unit = raw->unit;
+			a->mqflags = raw->mqflags;
+		} else if (a->encoding != raw->encoding
+			   || a->scale != raw->scale[i]
+			   || a->offset != raw->offset[i]) {
+			/* Only one format per probe fits in "metadata". */
+			sr_err("The sample format of probe %s changed.",
+			       a->probe->name);
+			return SR_ERR_ARG;
+		}
+		if ((ret = analog_write(writer, a,
+				(const uint8_t *)raw->data + i * size,
+				num_probes * size, size, raw->num_samples,
+				raw->encoding != SR_ANALOG_U9)) != SR_OK)
+			return ret;
+	}
+
+	return SR_OK;
+}
+
+static void analog_meta(GString *meta, const struct writer_analog *analog,
+		int num)
+{
+	char buf[G_ASCII_DTOSTR_BUF_SIZE];
+	unsigned int i;
+	int encoding;
+
+	/* Probes which didn't get any samples are written as floats. */
+	encoding = analog->encoding == ANALOG_UNSET ? 0 : analog->encoding;
+	if (analog->probe->name)
+		g_string_append_printf(meta, "analog%d = %s\n", num,
+				analog->probe->name);
+	for (i = 0; i < ARRAY_SIZE(analog_encodings); i++) {
+		if (analog_encodings[i].encoding == encoding)
+			g_string_append_printf(meta, "analog%d encoding = %s\n",
+					num, analog_encodings[i].name);
+	}
+	if (encoding) {
+		/* Independent of the locale, and exact when read back. */
+		g_ascii_dtostr(buf, sizeof(buf), analog->scale);
+		g_string_append_printf(meta, "analog%d scale = %s\n", num, buf);
+		g_ascii_dtostr(buf, sizeof(buf), analog->offset);
+		g_string_append_printf(meta, "analog%d offset = %s\n", num,
+				buf);
+	}
+	if (analog->stream.delta)
+		g_string_append_printf(meta, "analog%d coding = delta\n",
+				num);
+	g_string_append_printf(meta, "analog%d mq = %d\n", num, analog->mq);
+	g_string_append_printf(meta, "analog%d unit = %d\n", num,
+			analog->unit);
+	g_string_append_printf(meta, "analog%d mqflags = %" PRIu64 "\n", num,
+			analog->mqflags);
+}
+
+/* Write a device's remaining data, and add its section to "metadata". */
+static int dev_finish(struct sr_session_writer *writer,
+		struct writer_dev *dev, int num, GString *meta)
+{
+	struct writer_analog *analog;
+	unsigned int i;
+	char *s;
+	int ret, k, n;
+
+	if (writer->planar) {
+		if (!dev->planes && (ret = dev_planes_new(dev)) != SR_OK)
+			return ret;
+		/* The rest of the last byte isn't part of the samples. */
+		if (dev->num_pending) {
+			n = 8 - dev->num_pending;
+			memset(dev->pending + dev->num_pending * dev->unitsize,
+					0, n * dev->unitsize);
+			dev->num_pending = 0;
+			if ((ret = dev_planes_write(writer, dev,
+					dev->pending, 1)) != SR_OK)
+				return ret;
+		}
+		for (k = 0; k < dev->num_planes; k++)
+			if (dev->planes[k].chunk_used
+			    || !dev->planes[k].num_chunks)
+				if ((ret = stream_flush(writer,
+						&dev->planes[k])) != SR_OK)
+					return ret;
+	} else if (dev->logic.chunk_used || !dev->logic.num_chunks) {
+		/* The session driver needs at least one chunk. */
+		if ((ret = stream_flush(writer, &dev->logic)) != SR_OK)
+			return ret;
+	}
+	for (i = 0; i < dev->analog->len; i++) {
+		analog = g_ptr_array_index(dev->analog, i);
+		if (analog->stream.chunk_used || !analog->stream.num_chunks)
+			if ((ret = stream_flush(writer,
+					&analog->stream)) != SR_OK)
+				return ret;
+	}
+
+	g_string_append_printf(meta, "[device %d]\n", num);
+	/* Must come first, it's what creates the device when loading. */
+	g_string_append_printf(meta, "capturefile = %s\n", dev->logic.name);
+	g_string_append(meta, dev->probe_meta->str);
+	g_string_append_printf(meta, "unitsize = %d\n", dev->unitsize);
+	if (writer->planar) {
+		/* The planes are whole bytes, they can't tell the count. */
+		g_string_append_printf(meta, "layout = planar\n");
+		g_string_append_printf(meta, "samples = %" PRIu64 "\n",
+				dev->num_samples);
+	}
+	if (writer->rle && !writer->planar)
+		g_string_append_printf(meta, "compression = rle\n");
+	else
+		g_string_append_printf(meta, "compression = %s\n",
+				writer->level ? "deflate" : "none");
+	if (num == 1 && writer->summary)
+		g_string_append_printf(meta, "summaryfile = summary-1\n");
+	if (dev->samplerate) {
+		s = sr_samplerate_string(dev->samplerate);
+		g_string_append_printf(meta, "samplerate = %s\n", s);
+		g_free(s);
+	}
+	for (i = 0; i < dev->analog->len; i++)
+		analog_meta(meta, g_ptr_array_index(dev->analog, i), i + 1);
+
+	return SR_OK;
+}
+
+/**
+ * Open a session file for writing the capture data incrementally.
+ *
+ * Unlike sr_session_save(), the data doesn't need to be available all at
+ * once: it is collected in chunks of fixed size, each of which is written
+ * out as soon as it's full. The memory needed is thus bounded, no matter
+ * how large the capture gets. The "metadata" is written when the file is
+ * closed with sr_session_writer_close().
+ *
+ * The capture data is stored uncompressed by default, which is the fastest
+ * option, see sr_session_writer_compression_set().
+ *
+ * @param writer Pointer where the new writer will be stored. Must not be
+ *               NULL.
+ * @param filename The name of the session file to create. An existing file
+ *                 is overwritten. Must not be NULL.
+ * @param sdi The device instance from which the data is captured. Must not
+ *            be NULL.
+ * @param unitsize The number of bytes per sample.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, or SR_ERR upon
+ *         other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_open(struct sr_session_writer **writer,
+		const char *filename, const struct sr_dev_inst *sdi, int unitsize)
+{
+	struct sr_session_writer *w;
+	struct writer_dev *dev;
+	int ret;
+
+	if (!writer || !filename || !sdi || unitsize <= 0) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!(w = g_try_malloc0(sizeof(struct sr_session_writer)))) {
+		sr_err("%s: writer malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	w->filename = g_strdup(filename);
+	w->unitsize = unitsize;
+	w->entries = g_array_new(FALSE, FALSE, sizeof(struct writer_entry));
+	w->devs = g_ptr_array_new_with_free_func(dev_free);
+
+	if (!(dev = dev_new(sdi, unitsize, 1))) {
+		writer_free(w);
+		return SR_ERR_MALLOC;
+	}
+	g_ptr_array_add(w->devs, dev);
+
+	if (!(w->file = g_fopen(filename, "wb"))) {
+		sr_err("Failed to open '%s' for writing.", filename);
+		writer_free(w);
+		return SR_ERR;
+	}
+
+	if ((ret = writer_add(w, "version", "1", 1, FALSE)) != SR_OK) {
+		writer_free(w);
+		return ret;
+	}
+
+	*writer = w;
+
+	return SR_OK;
+}
+
+/**
+ * Add another device to a session file opened for writing.
+ *
+ * Its data is stored in a device section of its own, and written with
+ * sr_session_writer_dev_packet() while the data of the other devices is
+ * written too, so that captures from several devices end up in one file
+ * which sr_session_load() replays together.
+ *
+ * @param writer The writer returned by sr_session_writer_open(). Must not
+ *               be NULL.
+ * @param sdi The device instance from which the data is captured. Must not
+ *            be NULL, nor already be part of the file.
+ * @param unitsize The number of bytes per logic sample, 1 for devices
+ *                 without logic probes.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_MALLOC upon memory allocation errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_dev_add(struct sr_session_writer *writer,
+		const struct sr_dev_inst *sdi, int unitsize)
+{
+	struct writer_dev *dev;
+	unsigned int i;
+
+	if (!writer || !sdi || unitsize <= 0) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	for (i = 0; i < writer->devs->len; i++) {
+		dev = g_ptr_array_index(writer->devs, i);
+		if (dev->sdi == sdi) {
+			sr_err("%s: device was already added", __func__);
+			return SR_ERR_ARG;
+		}
+	}
+
+	if (!(dev = dev_new(sdi, unitsize, writer->devs->len + 1)))
+		return SR_ERR_MALLOC;
+	dev_coding_set(writer, dev);
+	g_ptr_array_add(writer->devs, dev);
+
+	return SR_OK;
+}
+
+/**
+ * Set the compression of the capture data written to a session file.
+ *
+ * This applies to all chunks written after the call. Chunks which don't
+ * get any smaller are always stored uncompressed.
+ *
+ * @param writer The writer returned by sr_session_writer_open(). Must not
+ *               be NULL.
+ * @param level 0 to store the data uncompressed (the default), or the
+ *              deflate level from 1 (fastest) to 9 (smallest files).
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_compression_set(struct sr_session_writer *writer,
+		int level)
+{
+	if (!writer || level < 0 || level > 9) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	writer->level = level;
+
+	return SR_OK;
+}
+
+/**
+ * Set the layout of the logic data written to a session file.
+ *
+ * By default, samples are stored as they come in, all probes of a sample
+ * next to each other. In the planar layout, every probe is stored as its
+ * own bit-packed stream instead. This compresses better, particularly for
+ * probes which hardly change, and sr_session_reader_probe_get() only needs
+ * to decompress the data of the probe asked for. sr_session_load() and
+ * sr_session_reader_get() turn the planes back into samples.
+ *
+ * This must be called before any samples have been written, and applies
+ * to the logic data of all devices in the file.
+ *
+ * @param writer The writer returned by sr_session_writer_open(). Must not
+ *               be NULL.
+ * @param planar TRUE for the planar layout, FALSE for interleaved samples
+ *               (the default).
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         if samples were already written.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_planar_set(struct sr_session_writer *writer,
+		gboolean planar)
+{
+	struct writer_dev *dev;
+	unsigned int i;
+
+	if (!writer) {
+		sr_err("%s: writer was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	for (i = 0; i < writer->devs->len; i++) {
+		dev = g_ptr_array_index(writer->devs, i);
+		if (dev->num_samples) {
+			sr_err("Cannot change the layout after writing "
+			       "samples.");
+			return SR_ERR;
+		}
+	}
+
+	writer->planar = planar;
+
+	return SR_OK;
+}
+
+/**
+ * Code the logic data written to a session file as run-length coded bit
+ * planes.
+ *
+ * Every chunk of samples is split into one bit plane per probe, and each
+ * plane is stored as the lengths of its runs of equal bits, or as it is if
+ * that's smaller. For the usual captures, where most probes hardly change,
+ * this is much smaller and faster than deflate. Coded chunks aren't
+ * deflated on top of it, the level set with
+ * sr_session_writer_compression_set() then only applies to the analog
+ * data. sr_session_load() and the session reader decode the chunks again.
+ *
+ * This must be called before any samples have been written, and applies
+ * to the logic data of all devices in the file. It has no effect in the
+ * planar layout.
+ *
+ * @param writer The writer returned by sr_session_writer_open(). Must not
+ *               be NULL.
+ * @param rle TRUE to code the logic chunks, FALSE to store them as they
+ *            are (the default).
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         if samples were already written.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_rle_set(struct sr_session_writer *writer,
+		gboolean rle)
+{
+	struct writer_dev *dev;
+	unsigned int i;
+
+	if (!writer) {
+		sr_err("%s: writer was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	for (i = 0; i < writer->devs->len; i++) {
+		dev = g_ptr_array_index(writer->devs, i);
+		if (dev->num_samples) {
+			sr_err("Cannot change the coding after writing "
+			       "samples.");
+			return SR_ERR;
+		}
+	}
+
+	writer->rle = rle;
+	for (i = 0; i < writer->devs->len; i++)
+		dev_coding_set(writer, g_ptr_array_index(writer->devs, i));
+
+	return SR_OK;
+}
+
+/**
+ * Code the analog data written to a session file for compression.
+ *
+ * The samples of every analog chunk are replaced by their differences to
+ * the previous one, or for float samples by their bits XORed with those
+ * of the previous one, before the chunk is deflated. Slowly changing
+ * signals compress much better this way. Raw samples, as sent with
+ * SR_DF_ANALOG_RAW packets, are stored as the device's codes along with
+ * their scale and offset either way. sr_session_load() decodes the chunks
+ * again.
+ *
+ * This only makes a difference if the data is compressed, see
+ * sr_session_writer_compression_set(). It must be called before any
+ * samples have been written, and applies to the analog data of all
+ * devices in the file.
+ *
+ * @param writer The writer returned by sr_session_writer_open(). Must not
+ *               be NULL.
+ * @param delta TRUE to code the analog chunks, FALSE to store the
+ *              samples as they are (the default).
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         if samples were already written.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_delta_set(struct sr_session_writer *writer,
+		gboolean delta)
+{
+	struct writer_dev *dev;
+	unsigned int i;
+
+	if (!writer) {
+		sr_err("%s: writer was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	for (i = 0; i < writer->devs->len; i++) {
+		dev = g_ptr_array_index(writer->devs, i);
+		if (dev->num_samples || dev_analog_written(dev)) {
+			sr_err("Cannot change the coding after writing "
+			       "samples.");
+			return SR_ERR;
+		}
+	}
+
+	writer->delta = delta;
+	for (i = 0; i < writer->devs->len; i++)
+		dev_coding_set(writer, g_ptr_array_index(writer->devs, i));
+
+	return SR_OK;
+}
+
+/**
+ * Get notified whenever a session file being written grew.
+ *
+ * After every archive member, such as a chunk of capture data, is written
+ * and flushed to the file, and once more when the file is complete, a byte
+ * is written to the given file descriptor. Typically it's the write end
+ * of a pipe whose read end is polled by something following the capture
+ * with sr_session_reader_tail_open(), in this or another process. It
+ * should be non-blocking, so that the writer doesn't wait for the reader.
+ *
+ * @param writer The writer returned by sr_session_writer_open(). Must not
+ *               be NULL.
+ * @param fd The file descriptor, or -1 to stop notifying.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_notify_set(struct sr_session_writer *writer,
+		int fd)
+{
+	if (!writer) {
+		sr_err("%s: writer was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	writer->notify = fd >= 0;
+	writer->notify_fd = fd;
+
+	return SR_OK;
+}
+
+/**
+ * Enable generating a summary of the capture data written to a session file.
+ *
+ * The summary holds the OR and AND of all samples, and the number of
+ * transitions of every probe, for blocks of samples at multiple
+ * resolutions. It's stored in the session file alongside the capture data,
+ * and allows sr_session_reader_summary_get() to quickly get an overview of
+ * any range of samples, no matter how large.
+ *
+ * This must be called before any samples have been written, and is only
+ * supported for unitsizes of up to 8 bytes.
+ *
+ * @param writer The writer returned by sr_session_writer_open(). Must not
+ *               be NULL.
+ * @param enable TRUE to generate a summary, FALSE to not generate one
+ *               (the default).
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         if samples were already written.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_summary_set(struct sr_session_writer *writer,
+		gboolean enable)
+{
+	if (!writer) {
+		sr_err("%s: writer was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (writer->num_samples) {
+		sr_err("Cannot change the summary after writing samples.");
+		return SR_ERR;
+	}
+
+	if (enable && writer->unitsize > 8) {
+		sr_err("Summaries are only supported up to unitsize 8.");
+		return SR_ERR_ARG;
+	}
+
+	if (enable && !writer->sum_blocks)
+		writer->sum_blocks = g_array_new(FALSE, FALSE,
+				sizeof(struct summary_block));
+	writer->summary = enable;
+	writer->cur_or = 0;
+	writer->cur_and = ~(uint64_t)0;
+
+	return SR_OK;
+}
+
+/**
+ * Append logic samples to a session file opened for writing.
+ *
+ * The samples are of the device the writer was opened with.
+ *
+ * @param writer The writer returned by sr_session_writer_open(). Must not
+ *               be NULL.
+ * @param buf The samples to be written. Must not be NULL.
+ * @param units The number of samples.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_write(struct sr_session_writer *writer,
+		const void *buf, uint64_t units)
+{
+	if (!writer || (!buf && units)) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	return dev_logic_write(writer, g_ptr_array_index(writer->devs, 0),
+			buf, units);
+}
+
+/**
+ * Write a datafeed packet to a session file opened for writing.
+ *
+ * This can be called straight from a datafeed callback. The samples of
+ * logic packets (SR_DF_LOGIC or SR_DF_LOGIC_RLE) are appended to the
+ * capture data, and a samplerate passed in meta packets is recorded.
+ *
+ * The samples of analog packets are appended to the data of their probes,
+ * if these were enabled when the writer was opened. A probe's data is
+ * stored as floats if its first packet is SR_DF_ANALOG, otherwise in the
+ * raw format of its first SR_DF_ANALOG_RAW packet, which must not change
+ * after that. All other packets are ignored.
+ *
+ * The packet is of the device the writer was opened with, use
+ * sr_session_writer_dev_packet() for those of other devices.
+ *
+ * @param writer The writer returned by sr_session_writer_open(). Must not
+ *               be NULL.
+ * @param packet The packet to be written. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_packet(struct sr_session_writer *writer,
+		const struct sr_datafeed_packet *packet)
+{
+	struct writer_dev *dev;
+
+	if (!writer || !packet) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	dev = g_ptr_array_index(writer->devs, 0);
+
+	return sr_session_writer_dev_packet(writer, dev->sdi, packet);
+}
+
+/**
+ * Write a datafeed packet of one of the devices of a session file opened
+ * for writing.
+ *
+ * This works like sr_session_writer_packet(), and can be called straight
+ * from a datafeed callback, which gets the device along with the packet.
+ *
+ * @param writer The writer returned by sr_session_writer_open(). Must not
+ *               be NULL.
+ * @param sdi The device the packet is from. Must be the one the writer was
+ *            opened with, or added with sr_session_writer_dev_add().
+ * @param packet The packet to be written. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_dev_packet(struct sr_session_writer *writer,
+		const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct writer_dev *dev;
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+	const struct sr_datafeed_meta *meta;
+	const struct sr_config *src;
+	GSList *l;
+	uint64_t run, offset, n;
+	unsigned int i;
+	uint8_t *buf;
+	int ret;
+
+	if (!writer || !packet) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	dev = NULL;
+	for (i = 0; i < writer->devs->len; i++) {
+		dev = g_ptr_array_index(writer->devs, i);
+		if (dev->sdi == sdi)
+			break;
+	}
+	if (i == writer->devs->len) {
+		sr_err("%s: device is not part of the file", __func__);
+		return SR_ERR_ARG;
+	}
+
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		if (logic->unitsize != dev->unitsize) {
+			sr_err("Unitsize %d doesn't match the file's %d.",
+			       logic->unitsize, dev->unitsize);
+			return SR_ERR_ARG;
+		}
+		return dev_logic_write(writer, dev, logic->data,
+				logic->length / logic->unitsize);
+	case SR_DF_LOGIC_RLE:
+		rle = packet->payload;
+		if (rle->unitsize != dev->unitsize) {
+			sr_err("Unitsize %d doesn't match the file's %d.",
+			       rle->unitsize, dev->unitsize);
+			return SR_ERR_ARG;
+		}
+		if (!(buf = g_try_malloc(WRITER_RLE_SIZE))) {
+			sr_err("%s: buf malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		ret = SR_OK;
+		run = offset = 0;
+		while (ret == SR_OK && (n = sr_logic_rle_expand(rle, &run,
+				&offset, buf, WRITER_RLE_SIZE / rle->unitsize)))
+			ret = dev_logic_write(writer, dev, buf, n);
+		g_free(buf);
+		return ret;
+	case SR_DF_ANALOG:
+		return dev_analog_write(writer, dev, packet->payload);
+	case SR_DF_ANALOG_RAW:
+		return dev_analog_raw_write(writer, dev, packet->payload);
+	case SR_DF_META:
+		meta = packet->payload;
+		for (l = meta->config; l; l = l->next) {
+			src = l->data;
+			if (src->key == SR_CONF_SAMPLERATE)
+				dev->samplerate =
+					g_variant_get_uint64(src->data);
+		}
+		break;
+	default:
+		break;
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Finish writing a session file, and free the writer.
+ *
+ * The last, partially filled chunks and the "metadata" are written,
+ * followed by the archive's central directory. The writer is freed in any
+ * case.
+ *
+ * @param writer The writer returned by sr_session_writer_open(). Must not
+ *               be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_writer_close(struct sr_session_writer *writer)
+{
+	GString *meta;
+	uint8_t *summary;
+	unsigned int i;
+	size_t len;
+	int ret;
+
+	if (!writer) {
+		sr_err("%s: writer was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	/* Stored as is, so readers can use it straight from the file. */
+	ret = SR_OK;
+	if (writer->summary) {
+		if ((summary = summary_build(writer, &len))) {
+			ret = writer_add(writer, "summary-1", summary, len, FALSE);
+			g_free(summary);
+		} else {
+			ret = SR_ERR_MALLOC;
+		}
+	}
+
+	if (ret == SR_OK) {
+		meta = g_string_sized_new(512);
+		g_string_append_printf(meta, "[global]\n");
+		g_string_append_printf(meta, "sigrok version = %s\n",
+				PACKAGE_VERSION);
+		for (i = 0; ret == SR_OK && i < writer->devs->len; i++)
+			ret = dev_finish(writer,
+					g_ptr_array_index(writer->devs, i),
+					i + 1, meta);
+		if (ret == SR_OK)
+			ret = writer_add(writer, "metadata", meta->str,
+					meta->len, FALSE);
+		g_string_free(meta, TRUE);
+	}
+
+	if (ret == SR_OK)
+		ret = writer_finish(writer);
+
+	if (ret != SR_OK)
+		unlink(writer->filename);
+
+	writer_free(writer);
+
+	return ret;
+}
+
+/*
+ * Append to a file whose capture data isn't chunked yet, through libzip:
+ * "logic-1" becomes "logic-1-1", and the new data "logic-1-2". Renaming
+ * has the whole archive rewritten, but only once.
+ */
+static int append_unchunked(const char *filename, unsigned char *buf,
+		int unitsize, int units)
+{
+	struct zip *archive;
+	struct zip_source *logicsrc;
+	int ret;
+
+	if (!(archive = zip_open(filename, 0, &ret)))
+		return SR_ERR;
+
+	if (zip_rename(archive, zip_name_locate(archive, "logic-1", 0),
+			"logic-1-1") == -1) {
+		sr_err("Failed to rename 'logic-1' to 'logic-1-1'.");
+		zip_close(archive);
+		return SR_ERR;
+	}
+	if (!(logicsrc = zip_source_buffer(archive, buf,
+			(zip_uint64_t)units * unitsize, FALSE))
+	    || zip_add(archive, "logic-1-2", logicsrc) == -1) {
+		zip_unchange_all(archive);
+		zip_close(archive);
+		return SR_ERR;
+	}
+	if (zip_close(archive) == -1) {
+		sr_info("error saving session file: %s", zip_strerror(archive));
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}
+
+/*
+ * Read the central directory of the archive in file, as found through
+ * its end records.
+ */
+static int archive_cd_read(FILE *file, uint8_t **cd, uint64_t *cd_offset,
+		uint64_t *cd_size, uint64_t *num_entries)
+{
+	uint8_t *tail, *p, rec[56];
+	int64_t size, tail_size, end_offset;
+
+	if (fseeko(file, 0, SEEK_END) != 0 || (size = ftello(file)) < 22)
+		return SR_ERR;
+
+	/* The end record is only followed by its comment. */
+	tail_size = MIN(size, 22 + 0xffff);
+	if (!(tail = g_try_malloc(tail_size))) {
+		sr_err("%s: tail malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if (fseeko(file, size - tail_size, SEEK_SET) != 0
+	    || fread(tail, tail_size, 1, file) != 1) {
+		g_free(tail);
+		return SR_ERR;
+	}
+	for (p = tail + tail_size - 22; p > tail; p--) {
+		if (get_le32(p) == ZIP_END_SIG)
+			break;
+	}
+	if (get_le32(p) != ZIP_END_SIG) {
+		g_free(tail);
+		return SR_ERR;
+	}
+	*num_entries = get_le16(p + 10);
+	*cd_size = get_le32(p + 12);
+	*cd_offset = get_le32(p + 16);
+	end_offset = size - tail_size + (p - tail);
+	g_free(tail);
+
+	if (end_offset >= 20 && fseeko(file, end_offset - 20, SEEK_SET) == 0
+	    && fread(rec, 20, 1, file) == 1
+	    && get_le32(rec) == ZIP64_LOCATOR_SIG) {
+		if (fseeko(file, get_le64(rec + 8), SEEK_SET) != 0
+		    || fread(rec, 56, 1, file) != 1
+		    || get_le32(rec) != ZIP64_END_SIG)
+			return SR_ERR;
+		*num_entries = get_le64(rec + 32);
+		*cd_size = get_le64(rec + 40);
+		*cd_offset = get_le64(rec + 48);
+	}
+	if (*cd_offset + *cd_size > (uint64_t)end_offset)
+		return SR_ERR;
+
+	if (!(*cd = g_try_malloc(*cd_size + 1))) {
+		sr_err("%s: cd malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if (fseeko(file, *cd_offset, SEEK_SET) != 0
+	    || (*cd_size && fread(*cd, *cd_size, 1, file) != 1)) {
+		g_free(*cd);
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}
+
+/*
+ * Find the number the next logic chunk gets, from the names in the
+ * central directory. Returns 0 if the capture data isn't chunked, or -1
+ * if the directory is broken.
+ */
+static int cd_next_chunk(const uint8_t *cd, uint64_t cd_size,
+		uint64_t num_entries)
+{
+	const uint8_t *p, *end, *name;
+	unsigned int namelen, k;
+	uint64_t i;
+	int num, next;
+
+	next = 1;
+	p = cd;
+	end = cd + cd_size;
+	for (i = 0; i < num_entries; i++) {
+		if (p + 46 > end || get_le32(p) != ZIP_CENTRAL_HEADER_SIG)
+			return -1;
+		namelen = get_le16(p + 28);
+		name = p + 46;
+		p = name + namelen + get_le16(p + 30) + get_le16(p + 32);
+		if (p > end)
+			return -1;
+
+		if (namelen == 7 && !memcmp(name, "logic-1", 7))
+			return 0;
+		if (namelen <= 8 || memcmp(name, "logic-1-", 8))
+			continue;
+		num = 0;
+		for (k = 8; k < namelen && g_ascii_isdigit(name[k]); k++)
+			num = num * 10 + name[k] - '0';
+		if (k == namelen && num >= next)
+			next = num + 1;
+	}
+
+	return next;
+}
+
+/*
+ * Get the name, unitsize, layout and coding of the first device's capture
+ * file. The number of samples is only known for the planar layout.
+ */
+static int reader_metadata(const char *filename, char **capturefile,
+		char **summaryfile, int *unitsize, gboolean *planar,
+		gboolean *rle, uint64_t *num_samples)
+{
+	GKeyFile *kf;
+	struct zip *archive;
+	struct zip_file *zf;
+	struct zip_stat zs;
+	char **sections, *metafile, *val;
+	int ret, i;
+
+	if ((ret = sr_sessionfile_check(filename)) != SR_OK)
+		return ret;
+
+	if (!(archive = zip_open(filename, 0, &ret)))
+		return SR_ERR;
+
+	if (zip_stat(archive, "metadata", 0, &zs) == -1
+	    || !(metafile = g_try_malloc(zs.size))) {
+		zip_close(archive);
+		return SR_ERR;
+	}
+
+	if (!(zf = zip_fopen_index(archive, zs.index, 0))) {
+		sr_err("Failed to open the metadata of '%s'.", filename);
+		g_free(metafile);
+		zip_close(archive);
+		return SR_ERR;
+	}
+	if (zip_fread(zf, metafile, zs.size) != (zip_int64_t)zs.size) {
+		sr_err("Failed to read the metadata of '%s'.", filename);
+		zip_fclose(zf);
+		g_free(metafile);
+		zip_close(archive);
+		return SR_ERR;
+	}
+	zip_fclose(zf);
+	zip_close(archive);
+
+	kf = g_key_file_new();
+	if (!g_key_file_load_from_data(kf, metafile, zs.size, 0, NULL)) {
+		sr_dbg("Failed to parse metadata.");
+		g_key_file_free(kf);
+		g_free(metafile);
+		return SR_ERR;
+	}
+	g_free(metafile);
+
+	*capturefile = NULL;
+	*summaryfile = NULL;
+	*unitsize = 1;
+	*planar = *rle = FALSE;
+	*num_samples = 0;
+	sections = g_key_file_get_groups(kf, NULL);
+	for (i = 0; sections[i]; i++) {
+		if (strncmp(sections[i], "device ", 7))
+			continue;
+		*capturefile = g_key_file_get_string(kf, sections[i],
+				"capturefile", NULL);
+		*summaryfile = g_key_file_get_string(kf, sections[i],
+				"summaryfile", NULL);
+		if ((val = g_key_file_get_string(kf, sections[i],
+				"unitsize", NULL))) {
+			*unitsize = strtoul(val, NULL, 10);
+			g_free(val);
+		}
+		if ((val = g_key_file_get_string(kf, sections[i],
+				"layout", NULL))) {
+			*planar = !strcmp(val, "planar");
+			g_free(val);
+		}
+		if ((val = g_key_file_get_string(kf, sections[i],
+				"compression", NULL))) {
+			*rle = !strcmp(val, "rle");
+			g_free(val);
+		}
+		if ((val = g_key_file_get_string(kf, sections[i],
+				"samples", NULL))) {
+			*num_samples = strtoull(val, NULL, 10);
+			g_free(val);
+		}
+		break;
+	}
+	g_strfreev(sections);
+	g_key_file_free(kf);
+
+	if (!*capturefile) {
+		sr_err("No capture file in '%s'.", filename);
+		g_free(*summaryfile);
+		return SR_ERR;
+	}
+
+	if (*unitsize <= 0) {
+		sr_err("Invalid unitsize in '%s'.", filename);
+		g_free(*capturefile);
+		g_free(*summaryfile);
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Append data to an existing session file.
+ *
+ * The data goes to a new chunk of the capture data. Only the central
+ * directory of the archive is read and written again, so appending takes
+ * the same time however large the file already is. The chunk is coded
+ * like the others if the file was written with sr_session_writer_rle_set(),
+ * files in the planar layout can't be appended to.
+ *
+ * @param filename The name of the filename to append to. Must not be NULL.
+ * @param buf The data to be appended.
+ * @param unitsize The number of bytes per sample.
+ * @param units The number of samples.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         upon other errors.
+ */
+SR_API int sr_session_append(const char *filename, unsigned char *buf,
+		int unitsize, int units)
+{
+	struct sr_session_writer *w;
+	FILE *file;
+	uint8_t *cd, *coded;
+	uint64_t cd_offset, cd_size, num_entries, planar_samples, len;
+	int next_chunk_num, file_unitsize, ret;
+	char *chunkname, *capturefile, *summaryfile;
+	gboolean planar, rle;
+
+	if ((ret = reader_metadata(filename, &capturefile, &summaryfile,
+			&file_unitsize, &planar, &rle,
+			&planar_samples)) != SR_OK)
+		return ret;
+	g_free(capturefile);
+	g_free(summaryfile);
+	if (planar) {
+		sr_err("Can't append to a session file in the planar "
+		       "layout.");
+		return SR_ERR_ARG;
+	}
+	if (rle && unitsize != file_unitsize) {
+		sr_err("Unitsize %d doesn't match the session file's %d.",
+		       unitsize, file_unitsize);
+		return SR_ERR_ARG;
+	}
+
+	if (!(file = g_fopen(filename, "r+b")))
+		return SR_ERR;
+	if ((ret = archive_cd_read(file, &cd, &cd_offset, &cd_size,
+			&num_entries)) != SR_OK) {
+		fclose(file);
+		return ret;
+	}
+	if ((next_chunk_num = cd_next_chunk(cd, cd_size, num_entries)) <= 0) {
+		g_free(cd);
+		fclose(file);
+		if (next_chunk_num < 0)
+			return SR_ERR;
+		return append_unchunked(filename, buf, unitsize, units);
+	}
+
+	if (!(w = g_try_malloc0(sizeof(struct sr_session_writer)))) {
+		sr_err("%s: writer malloc failed", __func__);
+		g_free(cd);
+		fclose(file);
+		return SR_ERR_MALLOC;
+	}
+	w->file = file;
+	w->filename = g_strdup(filename);
+	w->entries = g_array_new(FALSE, FALSE, sizeof(struct writer_entry));
+	w->devs = g_ptr_array_new_with_free_func(dev_free);
+	w->kept = cd;
+	w->kept_size = cd_size;
+	w->num_kept = num_entries;
+
+	/* The new chunk goes where the central directory was. */
+	w->offset = cd_offset;
+	ret = SR_ERR;
+	coded = NULL;
+	len = (uint64_t)units * unitsize;
+	if (rle && !(coded = sr_logic_rle_encode(buf, unitsize, units,
+			&len))) {
+		ret = SR_ERR_MALLOC;
+	} else if (fseeko(file, cd_offset, SEEK_SET) == 0) {
+		chunkname = g_strdup_printf("logic-1-%d", next_chunk_num);
+		ret = writer_add(w, chunkname, coded ? coded : buf, len,
+				FALSE);
+		g_free(chunkname);
+	}
+	g_free(coded);
+	if (ret == SR_OK)
+		ret = writer_finish(w);
+	writer_free(w);
+
+	return ret;
+}
+
+struct reader_chunk {
+	/* Chunk number, 0 for an unchunked capture file. */
+	int num;
+	uint64_t first_sample;
+	uint64_t num_samples;
+	uint16_t method;
+	/* Points into the mapped file. */
+	const uint8_t *data;
+	uint64_t csize;
+	/* Uncompressed size. */
+	uint64_t size;
+	/* Unitsize of the samples if coded with sr_logic_rle_encode(). */
+	int rle_unitsize;
+};
+
+/* The last chunk of a stream that had to be inflated, if any. */
+struct reader_cache {
+	const struct reader_chunk *chunk;
+	uint8_t *data;
+	uint64_t size;
+};
+
+struct sr_session_reader {
+	GMappedFile *mapped;
+	int unitsize;
+	uint64_t num_samples;
+	GArray *chunks;
+	/* The chunks are coded with sr_logic_rle_encode(). */
+	gboolean rle;
+	/*
+	 * For a file still being written, see sr_session_reader_tail_open():
+	 * the file and the capture file in it followed, where the next
+	 * archive member starts, and whether the writer closed the file.
+	 */
+	char *tail_file;
+	char *tail_name;
+	uint64_t tail_offset;
+	gboolean tail_done;
+	struct reader_cache cache;
+	/* In the planar layout, the chunks and cache of every plane. */
+	int num_planes;
+	GArray **plane_chunks;
+	struct reader_cache *plane_cache;
+	const uint8_t **plane_ptrs;
+	/* Samples interleaved from planes, or a plane taken from samples. */
+	uint8_t *conv;
+	uint64_t conv_size;
+	/* The summary, if the file has one. Points into the mapped file. */
+	unsigned int sum_levels;
+	unsigned int sum_block_shift;
+	unsigned int sum_fanout_shift;
+	size_t sum_rec_size;
+	uint64_t sum_counts[SUMMARY_MAX_LEVELS];
+	const uint8_t *sum_level[SUMMARY_MAX_LEVELS];
+};
+
+static gint chunk_compare(gconstpointer a, gconstpointer b)
+{
+	const struct reader_chunk *ca, *cb;
+
+	ca = a;
+	cb = b;
+
+	return ca->num - cb->num;
+}
+
+/* Set up access to a summary, returns FALSE if it can't be used. */
+static gboolean reader_summary(struct sr_session_reader *reader,
+		const uint8_t *data, uint64_t size)
+{
+	const uint8_t *p;
+	uint64_t total;
+	unsigned int l;
+
+	if (size < SUMMARY_HEADER_SIZE || get_le32(data) != SUMMARY_VERSION
+	    || (int)get_le32(data + 4) != reader->unitsize
+	    || get_le64(data + 24) != reader->num_samples)
+		return FALSE;
+
+	reader->sum_block_shift = get_le32(data + 8);
+	reader->sum_fanout_shift = get_le32(data + 12);
+	reader->sum_levels = get_le32(data + 16);
+	if (reader->sum_levels == 0 || reader->sum_levels > SUMMARY_MAX_LEVELS
+	    || reader->sum_block_shift > 40 || reader->sum_fanout_shift == 0
+	    || size < SUMMARY_HEADER_SIZE + 8 * reader->sum_levels)
+		return FALSE;
+
+	reader->sum_rec_size = 16 + 8 * reader->unitsize * 8;
+	p = data + SUMMARY_HEADER_SIZE + 8 * reader->sum_levels;
+	total = 0;
+	for (l = 0; l < reader->sum_levels; l++) {
+		reader->sum_counts[l] = get_le64(data + SUMMARY_HEADER_SIZE + 8 * l);
+		reader->sum_level[l] = p + total * reader->sum_rec_size;
+		total += reader->sum_counts[l];
+	}
+	if (SUMMARY_HEADER_SIZE + 8 * reader->sum_levels
+	    + total * reader->sum_rec_size > size)
+		return FALSE;
+
+	return TRUE;
+}
+
+/* Sort the chunks of a stream, and number their samples. */
+static uint64_t chunks_index(GArray *chunks)
+{
+	struct reader_chunk *chunk;
+	uint64_t num_samples;
+	unsigned int i;
+
+	g_array_sort(chunks, chunk_compare);
+	num_samples = 0;
+	for (i = 0; i < chunks->len; i++) {
+		chunk = &g_array_index(chunks, struct reader_chunk, i);
+		chunk->first_sample = num_samples;
+		num_samples += chunk->num_samples;
+	}
+
+	return num_samples;
+}
+
+/*
+ * Number the samples of the planes. Their last bytes may be padding, so
+ * the samples are cut off at the count from the metadata.
+ */
+static int planes_index(struct sr_session_reader *reader,
+		uint64_t num_samples)
+{
+	struct reader_chunk *chunk;
+	unsigned int i;
+	int k;
+
+	reader->num_samples = num_samples;
+	for (k = 0; k < reader->num_planes; k++) {
+		if (!reader->plane_chunks[k]->len) {
+			sr_err("No capture data found for plane %d.", k + 1);
+			return SR_ERR;
+		}
+		reader->num_samples = MIN(reader->num_samples,
+				chunks_index(reader->plane_chunks[k]));
+	}
+
+	for (k = 0; k < reader->num_planes; k++) {
+		for (i = 0; i < reader->plane_chunks[k]->len; i++) {
+			chunk = &g_array_index(reader->plane_chunks[k],
+					struct reader_chunk, i);
+			if (chunk->first_sample >= reader->num_samples)
+				chunk->num_samples = 0;
+			else
+				chunk->num_samples = MIN(chunk->num_samples,
+						reader->num_samples
+						- chunk->first_sample);
+		}
+	}
+
+	return SR_OK;
+}
+
+/* Parse the zip central directory, collecting the capture file's chunks. */
+static int reader_index(struct sr_session_reader *reader,
+		const char *capturefile, const char *summaryfile,
+		uint64_t planar_samples)
+{
+	struct reader_chunk chunk;
+	const uint8_t *base, *p, *end, *extra, *name;
+	uint64_t size, num_entries, cd_offset, cd_size, usize, offset;
+	uint64_t sum_size;
+	const uint8_t *sum_data;
+	unsigned int i, namelen, extralen, len;
+	gboolean is_summary;
+	long plane;
+	char *s, *end_num;
+
+	base = (const uint8_t *)g_mapped_file_get_contents(reader->mapped);
+	size = g_mapped_file_get_length(reader->mapped);
+	len = strlen(capturefile);
+
+	/* Find the end of central directory record, past any comment. */
+	if (size < 22)
+		return SR_ERR;
+	for (p = base + size - 22; p > base; p--) {
+		if (get_le32(p) == ZIP_END_SIG)
+			break;
+		if (base + size - p > 22 + 0xffff)
+			return SR_ERR;
+	}
+	if (get_le32(p) != ZIP_END_SIG)
+		return SR_ERR;
+
+	num_entries = get_le16(p + 10);
+	cd_size = get_le32(p + 12);
+	cd_offset = get_le32(p + 16);
+	if (p - base >= 20 && get_le32(p - 20) == ZIP64_LOCATOR_SIG) {
+		offset = get_le64(p - 20 + 8);
+		if (offset + 56 > size || get_le32(base + offset) != ZIP64_END_SIG)
+			return SR_ERR;
+		num_entries = get_le64(base + offset + 32);
+		cd_size = get_le64(base + offset + 40);
+		cd_offset = get_le64(base + offset + 48);
+	}
+	if (cd_offset + cd_size > size)
+		return SR_ERR;
+
+	sum_data = NULL;
+	sum_size = 0;
+	p = base + cd_offset;
+	end = p + cd_size;
+	for (i = 0; i < num_entries; i++) {
+		if (p + 46 > end || get_le32(p) != ZIP_CENTRAL_HEADER_SIG)
+			return SR_ERR;
+		chunk.method = get_le16(p + 10);
+		chunk.csize = get_le32(p + 20);
+		usize = get_le32(p + 24);
+		namelen = get_le16(p + 28);
+		extralen = get_le16(p + 30);
+		offset = get_le32(p + 42);
+		name = p + 46;
+		extra = name + namelen;
+		p = extra + extralen + get_le16(p + 32);
+		if (p > end)
+			return SR_ERR;
+
+		/* Only "<capturefile>" or "<capturefile>-N" are of interest. */
+		is_summary = summaryfile && namelen == strlen(summaryfile)
+				&& !memcmp(name, summaryfile, namelen);
+		if (!is_summary && (namelen < len || memcmp(name, capturefile, len)))
+			continue;
+		plane = -1;
+		if (is_summary) {
+			chunk.num = -1;
+		} else if (namelen == len) {
+			chunk.num = 0;
+		} else {
+			if (name[len] != '-')
+				continue;
+			s = g_strndup((const char *)name + len + 1,
+					namelen - len - 1);
+			if (reader->num_planes && s[0] == 'p') {
+				/* "<capturefile>-p<k>-N", i.e. a plane. */
+				plane = strtol(s + 1, &end_num, 10) - 1;
+				chunk.num = 0;
+				if (*end_num == '-' && plane >= 0
+				    && plane < reader->num_planes)
+					chunk.num = strtoul(end_num + 1,
+							NULL, 10);
+			} else {
+				chunk.num = strtoul(s, NULL, 10);
+			}
+			g_free(s);
+			if (chunk.num <= 0)
+				continue;
+		}
+		/* Samples which aren't in planes belong to another layout. */
+		if (!is_summary && reader->num_planes && plane < 0)
+			continue;
+
+		/* Replace the fields which didn't fit with their zip64 versions. */
+		while (extra + 4 <= name + namelen + extralen) {
+			if (get_le16(extra) == 0x0001) {
+				extra += 4;
+				if (usize == 0xffffffff) {
+					usize = get_le64(extra);
+					extra += 8;
+				}
+				if (chunk.csize == 0xffffffff) {
+					chunk.csize = get_le64(extra);
+					extra += 8;
+				}
+				if (offset == 0xffffffff)
+					offset = get_le64(extra);
+				break;
+			}
+			extra += 4 + get_le16(extra + 2);
+		}
+
+		if (chunk.method != 0 && chunk.method != Z_DEFLATED) {
+			sr_err("Unsupported compression method %d.", chunk.method);
+			return SR_ERR;
+		}
+
+		/* The data follows the local header, whose extra field can differ. */
+		if (offset + 30 > size || get_le32(base + offset) != ZIP_LOCAL_HEADER_SIG)
+			return SR_ERR;
+		offset += 30 + get_le16(base + offset + 26)
+				+ get_le16(base + offset + 28);
+		if (offset + chunk.csize > size)
+			return SR_ERR;
+		if (is_summary) {
+			/* Only usable in place, i.e. when stored. */
+			if (chunk.method == 0) {
+				sum_data = base + offset;
+				sum_size = chunk.csize;
+			}
+			continue;
+		}
+		chunk.data = base + offset;
+		chunk.size = usize;
+		chunk.rle_unitsize = 0;
+		if (plane < 0 && reader->rle) {
+			/* Coded chunks are stored, and decoded on demand. */
+			if (chunk.method != 0) {
+				sr_err("Coded chunk %d is compressed.",
+				       chunk.num);
+				return SR_ERR;
+			}
+			chunk.rle_unitsize = reader->unitsize;
+			usize = sr_logic_rle_count(chunk.data, chunk.csize)
+					* reader->unitsize;
+			chunk.size = usize;
+		}
+		if (plane >= 0) {
+			chunk.num_samples = usize * 8;
+			g_array_append_val(reader->plane_chunks[plane], chunk);
+		} else {
+			chunk.num_samples = usize / reader->unitsize;
+			g_array_append_val(reader->chunks, chunk);
+		}
+	}
+
+	if (reader->num_planes) {
+		if (planes_index(reader, planar_samples) != SR_OK)
+			return SR_ERR;
+	} else if (!reader->chunks->len) {
+		sr_err("No capture data found.");
+		return SR_ERR;
+	} else {
+		reader->num_samples = chunks_index(reader->chunks);
+	}
+
+	if (sum_data && !reader_summary(reader, sum_data, sum_size)) {
+		sr_warn("Ignoring invalid summary.");
+		reader->sum_levels = 0;
+	}
+
+	return SR_OK;
+}
+
+/*
+ * Get the uncompressed data of a chunk, inflating or decoding it into the
+ * cache.
+ */
+static const uint8_t *reader_inflate(const struct reader_chunk *chunk,
+		struct reader_cache *cache)
+{
+	z_stream strm;
+	uint64_t size;
+	int ret;
+
+	if (chunk->method != Z_DEFLATED && !chunk->rle_unitsize)
+		return chunk->data;
+
+	if (cache->chunk == chunk)
+		return cache->data;
+
+	size = chunk->size;
+	if (size > cache->size) {
+		g_free(cache->data);
+		cache->chunk = NULL;
+		cache->size = 0;
+		if (!(cache->data = g_try_malloc(size))) {
+			sr_err("%s: cache malloc failed", __func__);
+			return NULL;
+		}
+		cache->size = size;
+	}
+
+	if (chunk->rle_unitsize) {
+		if (sr_logic_rle_decode(chunk->data, chunk->csize,
+				chunk->rle_unitsize, cache->data) != SR_OK) {
+			sr_err("Failed to decode capture chunk %d.",
+			       chunk->num);
+			return NULL;
+		}
+		cache->chunk = chunk;
+		return cache->data;
+	}
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+		return NULL;
+	strm.next_in = (Bytef *)chunk->data;
+	strm.avail_in = chunk->csize;
+	strm.next_out = cache->data;
+	strm.avail_out = size;
+	ret = inflate(&strm, Z_FINISH);
+	inflateEnd(&strm);
+	if (ret != Z_STREAM_END && !(ret == Z_BUF_ERROR && !strm.avail_out)) {
+		sr_err("Failed to inflate capture chunk %d.", chunk->num);
+		return NULL;
+	}
+
+	cache->chunk = chunk;
+
+	return cache->data;
+}
+
+/* Find the last chunk starting at or before the wanted sample. */
+static const struct reader_chunk *chunk_find(const GArray *chunks,
+		uint64_t start)
+{
+	const struct reader_chunk *chunk;
+	unsigned int lo, hi, mid;
+
+	lo = 0;
+	hi = chunks->len - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		chunk = &g_array_index(chunks, struct reader_chunk, mid);
+		if (chunk->first_sample <= start)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return &g_array_index(chunks, struct reader_chunk, lo);
+}
+
+static uint8_t *conv_get(struct sr_session_reader *reader, uint64_t size)
+{
+	if (size > reader->conv_size) {
+		g_free(reader->conv);
+		reader->conv_size = 0;
+		if (!(reader->conv = g_try_malloc(size))) {
+			sr_err("%s: conv malloc failed", __func__);
+			return NULL;
+		}
+		reader->conv_size = size;
+	}
+
+	return reader->conv;
+}
+
+/* Interleave samples from the planes, see sr_session_reader_get(). */
+static int planes_get(struct sr_session_reader *reader, uint64_t start,
+		uint64_t *count, const void **data)
+{
+	const struct reader_chunk *first, *chunk;
+	const uint8_t *buf;
+	uint64_t offset, skip, n, num_bytes;
+	uint8_t *conv;
+	int k;
+
+	first = chunk_find(reader->plane_chunks[0], start);
+	offset = start - first->first_sample;
+	skip = offset % 8;
+	n = MIN(*count, first->num_samples - offset);
+	n = MIN(n, READER_PLANAR_SIZE);
+	num_bytes = (skip + n + 7) / 8;
+
+	for (k = 0; k < reader->num_planes; k++) {
+		chunk = chunk_find(reader->plane_chunks[k], start);
+		if (chunk->first_sample != first->first_sample
+		    || chunk->size < offset / 8 + num_bytes) {
+			sr_err("The chunks of the planes don't line up.");
+			return SR_ERR;
+		}
+		if (!(buf = reader_inflate(chunk, &reader->plane_cache[k])))
+			return SR_ERR;
+		reader->plane_ptrs[k] = buf + offset / 8;
+	}
+
+	if (!(conv = conv_get(reader, num_bytes * 8 * reader->unitsize)))
+		return SR_ERR_MALLOC;
+	sr_logic_planes_unpack(reader->plane_ptrs, reader->unitsize,
+			num_bytes, conv);
+
+	*count = n;
+	*data = conv + skip * reader->unitsize;
+
+	return SR_OK;
+}
+
+/**
+ * Open a session file for random access to its capture data.
+ *
+ * The file is mapped into memory, and an index of its capture chunks is
+ * built, so that any sample can be accessed directly. Uncompressed chunks,
+ * such as written by sr_session_save(), are accessed in place. Of
+ * compressed chunks, and the ones coded as set with
+ * sr_session_writer_rle_set(), only the one containing the requested
+ * samples is decompressed. Only the capture data of the first device in
+ * the session file is accessible.
+ *
+ * Files in the planar layout (see sr_session_writer_planar_set()) are
+ * read just the same, the samples are put back together from the planes
+ * as needed. sr_session_reader_probe_get() gets at the data of a single
+ * probe without that.
+ *
+ * @param reader Pointer where the new reader will be stored. Must not be
+ *               NULL.
+ * @param filename The name of the session file. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, or SR_ERR if the file
+ *         couldn't be read or isn't a valid session file.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_reader_open(struct sr_session_reader **reader,
+		const char *filename)
+{
+	struct sr_session_reader *r;
+	GError *error;
+	char *capturefile, *summaryfile;
+	uint64_t planar_samples;
+	gboolean planar, rle;
+	int unitsize, ret, k;
+
+	if (!reader || !filename) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if ((ret = reader_metadata(filename, &capturefile, &summaryfile,
+			&unitsize, &planar, &rle, &planar_samples)) != SR_OK)
+		return ret;
+
+	if (!(r = g_try_malloc0(sizeof(struct sr_session_reader)))) {
+		sr_err("%s: reader malloc failed", __func__);
+		g_free(capturefile);
+		g_free(summaryfile);
+		return SR_ERR_MALLOC;
+	}
+
+	error = NULL;
+	if (!(r->mapped = g_mapped_file_new(filename, FALSE, &error))) {
+		sr_err("Failed to map '%s': %s.", filename, error->message);
+		g_error_free(error);
+		g_free(capturefile);
+		g_free(summaryfile);
+		g_free(r);
+		return SR_ERR;
+	}
+
+	r->unitsize = unitsize;
+	r->rle = rle && !planar;
+	r->chunks = g_array_new(FALSE, FALSE, sizeof(struct reader_chunk));
+	ret = SR_OK;
+	if (planar) {
+		r->num_planes = unitsize * 8;
+		r->plane_chunks = g_try_new0(GArray *, r->num_planes);
+		r->plane_cache = g_try_new0(struct reader_cache,
+				r->num_planes);
+		r->plane_ptrs = g_try_new(const uint8_t *, r->num_planes);
+		if (!r->plane_chunks || !r->plane_cache || !r->plane_ptrs) {
+			sr_err("%s: planes malloc failed", __func__);
+			ret = SR_ERR_MALLOC;
+		}
+		for (k = 0; ret == SR_OK && k < r->num_planes; k++)
+			r->plane_chunks[k] = g_array_new(FALSE, FALSE,
+					sizeof(struct reader_chunk));
+	}
+	if (ret == SR_OK)
+		ret = reader_index(r, capturefile, summaryfile,
+				planar_samples);
+	g_free(capturefile);
+	g_free(summaryfile);
+	if (ret != SR_OK) {
+		sr_err("Failed to index '%s'.", filename);
+		sr_session_reader_close(r);
+		return ret;
+	}
+
+	sr_dbg("Indexed %u chunks, %" PRIu64 " samples.", r->chunks->len,
+	       r->num_samples);
+
+	*reader = r;
+
+	return SR_OK;
+}
+
+/*
+ * Index the capture chunks written since the last time, going from one
+ * local header to the next as the writer put them. A member which isn't
+ * complete yet is left for the next time.
+ */
+static int reader_tail_index(struct sr_session_reader *reader)
+{
+	struct reader_chunk chunk;
+	const uint8_t *base, *p, *name;
+	uint64_t size, end;
+	unsigned int namelen, len, k;
+	int num;
+
+	base = (const uint8_t *)g_mapped_file_get_contents(reader->mapped);
+	size = g_mapped_file_get_length(reader->mapped);
+	len = strlen(reader->tail_name);
+
+	while (reader->tail_offset + 4 <= size) {
+		p = base + reader->tail_offset;
+		if (get_le32(p) == ZIP_CENTRAL_HEADER_SIG
+		    || get_le32(p) == ZIP_END_SIG) {
+			/* The writer is done. */
+			reader->tail_done = TRUE;
+			break;
+		}
+		if (get_le32(p) != ZIP_LOCAL_HEADER_SIG) {
+			sr_err("No archive member at %" PRIu64 ".",
+			       reader->tail_offset);
+			return SR_ERR;
+		}
+		if (reader->tail_offset + 30 > size)
+			break;
+		namelen = get_le16(p + 26);
+		chunk.method = get_le16(p + 8);
+		chunk.csize = get_le32(p + 18);
+		chunk.size = get_le32(p + 22);
+		end = reader->tail_offset + 30 + namelen + get_le16(p + 28)
+				+ chunk.csize;
+		if (end > size)
+			break;
+		reader->tail_offset = end;
+
+		/* Only "<capturefile>-N" is of interest. */
+		name = p + 30;
+		if (namelen <= len + 1 || memcmp(name, reader->tail_name, len)
+		    || name[len] != '-')
+			continue;
+		num = 0;
+		for (k = len + 1; k < namelen && g_ascii_isdigit(name[k]); k++)
+			num = num * 10 + name[k] - '0';
+		if (k < namelen || num <= 0)
+			continue;
+
+		if (chunk.method != 0 && chunk.method != Z_DEFLATED) {
+			sr_err("Unsupported compression method %d.",
+			       chunk.method);
+			return SR_ERR;
+		}
+		chunk.num = num;
+		chunk.data = base + end - chunk.csize;
+		chunk.num_samples = chunk.size / reader->unitsize;
+		chunk.rle_unitsize = 0;
+		g_array_append_val(reader->chunks, chunk);
+	}
+
+	reader->num_samples = chunks_index(reader->chunks);
+
+	return SR_OK;
+}
+
+/**
+ * Open a session file which is still being written, to read the capture
+ * data written so far.
+ *
+ * The file must be written by a session writer (see
+ * sr_session_writer_open()), with its logic data neither in the planar
+ * layout nor run-length coded, which is what the writer does by default.
+ * Since the "metadata" member only comes when the writer is done, the
+ * unitsize of the samples has to be known. Only the capture data of the
+ * first device is accessible.
+ *
+ * The reader starts out with the chunks already written, and
+ * sr_session_reader_tail_update() adds the ones written since. Samples are
+ * accessed just like with sr_session_reader_open(), except that the file
+ * has no summary yet.
+ *
+ * @param reader Pointer where the new reader will be stored. Must not be
+ *               NULL.
+ * @param filename The name of the session file. Must not be NULL.
+ * @param unitsize The number of bytes per sample, as given to the writer.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, or SR_ERR if the file
+ *         couldn't be read or isn't a session file being written.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_reader_tail_open(struct sr_session_reader **reader,
+		const char *filename, int unitsize)
+{
+	struct sr_session_reader *r;
+	GError *error;
+	int ret;
+
+	if (!reader || !filename || unitsize <= 0) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!(r = g_try_malloc0(sizeof(struct sr_session_reader)))) {
+		sr_err("%s: reader malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	error = NULL;
+	if (!(r->mapped = g_mapped_file_new(filename, FALSE, &error))) {
+		sr_err("Failed to map '%s': %s.", filename, error->message);
+		g_error_free(error);
+		g_free(r);
+		return SR_ERR;
+	}
+
+	r->unitsize = unitsize;
+	r->chunks = g_array_new(FALSE, FALSE, sizeof(struct reader_chunk));
+	r->tail_file = g_strdup(filename);
+	/* The first device's, as the session writer names it. */
+	r->tail_name = g_strdup("logic-1");
+	if ((ret = reader_tail_index(r)) != SR_OK) {
+		sr_err("Failed to index '%s'.", filename);
+		sr_session_reader_close(r);
+		return ret;
+	}
+
+	*reader = r;
+
+	return SR_OK;
+}
+
+/**
+ * Pick up the capture data written since a session file was opened with
+ * sr_session_reader_tail_open(), or since the last call.
+ *
+ * This is cheap enough to be called whenever the writer notifies (see
+ * sr_session_writer_notify_set()), or just periodically. Data got from
+ * the reader before is not valid anymore afterwards.
+ *
+ * @param reader The reader returned by sr_session_reader_tail_open(). Must
+ *               not be NULL.
+ * @param done Pointer where TRUE will be stored once the writer closed the
+ *             file, so nothing more will come. Can be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or SR_ERR
+ *         if the file couldn't be read.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_reader_tail_update(struct sr_session_reader *reader,
+		gboolean *done)
+{
+	struct reader_chunk *chunk;
+	GMappedFile *mapped;
+	GError *error;
+	const uint8_t *base, *old_base;
+	unsigned int i;
+	int ret;
+
+	if (!reader || !reader->tail_name) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!reader->tail_done) {
+		error = NULL;
+		if (!(mapped = g_mapped_file_new(reader->tail_file, FALSE,
+				&error))) {
+			sr_err("Failed to map '%s': %s.", reader->tail_file,
+			       error->message);
+			g_error_free(error);
+			return SR_ERR;
+		}
+
+		/* The chunks found so far are still there, in the new map. */
+		old_base = (const uint8_t *)g_mapped_file_get_contents(
+				reader->mapped);
+		base = (const uint8_t *)g_mapped_file_get_contents(mapped);
+		for (i = 0; i < reader->chunks->len; i++) {
+			chunk = &g_array_index(reader->chunks,
+					struct reader_chunk, i);
+			chunk->data = base + (chunk->data - old_base);
+		}
+		g_mapped_file_unref(reader->mapped);
+		reader->mapped = mapped;
+
+		/* New chunks may move the old ones in memory. */
+		reader->cache.chunk = NULL;
+		if ((ret = reader_tail_index(reader)) != SR_OK)
+			return ret;
+	}
+
+	if (done)
+		*done = reader->tail_done;
+
+	return SR_OK;
+}
+
+/**
+ * Get the size of the capture data of a session file opened for reading.
+ *
+ * @param reader The reader returned by sr_session_reader_open(). Must not
+ *               be NULL.
+ * @param num_samples Pointer where the number of samples will be stored.
+ *                    Can be NULL.
+ * @param unitsize Pointer where the number of bytes per sample will be
+ *                 stored. Can be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_reader_info(const struct sr_session_reader *reader,
+		uint64_t *num_samples, int *unitsize)
+{
+	if (!reader) {
+		sr_err("%s: reader was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (num_samples)
+		*num_samples = reader->num_samples;
+	if (unitsize)
+		*unitsize = reader->unitsize;
+
+	return SR_OK;
+}
+
+/**
+ * Get direct access to samples of a session file opened for reading.
+ *
+ * Since the capture data is stored in chunks, fewer samples than requested
+ * may be returned; just call this again for the remaining ones.
+ *
+ * @param reader The reader returned by sr_session_reader_open(). Must not
+ *               be NULL.
+ * @param start The index of the first sample to get.
+ * @param count Pointer to the number of samples wanted. Upon return, it
+ *              holds the number of samples actually available at data.
+ *              Must not be NULL.
+ * @param data Pointer where a pointer to the samples will be stored. The
+ *             samples remain valid until the next call or until the reader
+ *             is closed, and must not be modified. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments (including
+ *         a start past the end of the capture data), or SR_ERR upon other
+ *         errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_reader_get(struct sr_session_reader *reader,
+		uint64_t start, uint64_t *count, const void **data)
+{
+	const struct reader_chunk *chunk;
+	const uint8_t *buf;
+
+	if (!reader || !count || !data || start >= reader->num_samples) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (reader->num_planes)
+		return planes_get(reader, start, count, data);
+
+	chunk = chunk_find(reader->chunks, start);
+	if (!(buf = reader_inflate(chunk, &reader->cache)))
+		return SR_ERR;
+
+	start -= chunk->first_sample;
+	*count = MIN(*count, chunk->num_samples - start);
+	*data = buf + start * reader->unitsize;
+
+	return SR_OK;
+}
+
+/**
+ * Get direct access to the samples of one probe of a session file opened
+ * for reading.
+ *
+ * The samples are bit-packed: bit j of byte i is the probe's value at
+ * sample start + 8 * i + j. In files of the planar layout, the probe is
+ * read straight from its plane, decompressing nothing of the other
+ * probes. Otherwise it's taken out of the samples.
+ *
+ * Since the capture data is stored in chunks, fewer samples than requested
+ * may be returned; just call this again for the remaining ones.
+ *
+ * @param reader The reader returned by sr_session_reader_open(). Must not
+ *               be NULL.
+ * @param probe The bit of the probe in the samples, from 0 to
+ *              unitsize * 8 - 1.
+ * @param start The index of the first sample to get. Must be a multiple
+ *              of 8.
+ * @param count Pointer to the number of samples wanted. Upon return, it
+ *              holds the number of samples actually available at data.
+ *              Must not be NULL.
+ * @param data Pointer where a pointer to the samples will be stored. The
+ *             samples remain valid until the next call or until the reader
+ *             is closed, and must not be modified. Bits past the returned
+ *             count are undefined. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments (including
+ *         a start past the end of the capture data), SR_ERR_MALLOC upon
+ *         memory allocation errors, or SR_ERR upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_reader_probe_get(struct sr_session_reader *reader,
+		int probe, uint64_t start, uint64_t *count, const void **data)
+{
+	const struct reader_chunk *chunk;
+	const uint8_t *buf;
+	const void *p;
+	uint64_t i;
+	uint8_t *conv;
+	int ret;
+
+	if (!reader || probe < 0 || probe >= reader->unitsize * 8 || !count
+	    || !data || start >= reader->num_samples || start % 8) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (reader->num_planes) {
+		chunk = chunk_find(reader->plane_chunks[probe], start);
+		if (!(buf = reader_inflate(chunk, &reader->plane_cache[probe])))
+			return SR_ERR;
+		start -= chunk->first_sample;
+		*count = MIN(*count, chunk->num_samples - start);
+		*data = buf + start / 8;
+		return SR_OK;
+	}
+
+	if ((ret = sr_session_reader_get(reader, start, count, &p)) != SR_OK)
+		return ret;
+	if (!(conv = conv_get(reader, (*count + 7) / 8)))
+		return SR_ERR_MALLOC;
+	memset(conv, 0, (*count + 7) / 8);
+	buf = (const uint8_t *)p + probe / 8;
+	for (i = 0; i < *count; i++, buf += reader->unitsize)
+		conv[i / 8] |= ((*buf >> (probe % 8)) & 1) << (i % 8);
+	*data = conv;
+
+	return SR_OK;
+}
+
+/* Add the summary of samples [start, end) by scanning the capture data. */
+static int summary_scan(struct sr_session_reader *reader, uint64_t start,
+		uint64_t end, struct summary_block *sum)
+{
+	const uint8_t *data;
+	const void *p;
+	uint64_t count, i, v, prev, diff;
+	int ret;
+
+	prev = 0;
+	if (start > 0) {
+		count = 1;
+		if ((ret = sr_session_reader_get(reader, start - 1, &count,
+				&p)) != SR_OK)
+			return ret;
+		prev = sample_get(p, reader->unitsize);
+	}
+
+	while (start < end) {
+		count = end - start;
+		if ((ret = sr_session_reader_get(reader, start, &count,
+				&p)) != SR_OK)
+			return ret;
+		data = p;
+		for (i = 0; i < count; i++, data += reader->unitsize) {
+			v = sample_get(data, reader->unitsize);
+			sum->or_mask |= v;
+			sum->and_mask &= v;
+			if (start + i > 0)
+				for (diff = v ^ prev; diff; diff &= diff - 1)
+					sum->trans[__builtin_ctzll(diff)]++;
+			prev = v;
+		}
+		start += count;
+	}
+
+	return SR_OK;
+}
+
+static void summary_add(struct sr_session_reader *reader, unsigned int level,
+		uint64_t index, struct summary_block *sum)
+{
+	const uint8_t *p;
+	int k;
+
+	p = reader->sum_level[level] + index * reader->sum_rec_size;
+	sum->or_mask |= get_le64(p);
+	sum->and_mask &= get_le64(p + 8);
+	for (k = 0; k < reader->unitsize * 8; k++)
+		sum->trans[k] += get_le64(p + 16 + 8 * k);
+}
+
+/**
+ * Get a summary of a range of samples of a session file opened for reading.
+ *
+ * If the session file has a summary (see sr_session_writer_summary_set()),
+ * it is used for all whole blocks within the range, so this is fast no
+ * matter how many samples there are: only O(log n) summary records and at
+ * most two partial blocks of samples are looked at. A decimated view of a
+ * capture, e.g. for drawing it zoomed out, is thus obtained by calling this
+ * once for every pixel column. Without a summary, all samples in the range
+ * are scanned.
+ *
+ * @param reader The reader returned by sr_session_reader_open(). Must not
+ *               be NULL.
+ * @param start The index of the first sample of the range.
+ * @param count The number of samples in the range. Must not be 0.
+ * @param or_mask Pointer where the OR of all samples in the range will be
+ *                stored, i.e. the probes which were high at least once.
+ *                Can be NULL.
+ * @param and_mask Pointer where the AND of all samples in the range will be
+ *                 stored, i.e. the probes which were high all the time.
+ *                 Can be NULL.
+ * @param transitions Array of unitsize * 8 elements, where the number of
+ *                    transitions of each probe within the range will be
+ *                    stored. A transition at the first sample (compared to
+ *                    the sample before it) counts as within the range.
+ *                    Can be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments (including
+ *         a range extending past the end of the capture data, or unitsizes
+ *         larger than 8), or SR_ERR upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_reader_summary_get(struct sr_session_reader *reader,
+		uint64_t start, uint64_t count, uint64_t *or_mask,
+		uint64_t *and_mask, uint64_t *transitions)
+{
+	struct summary_block sum;
+	uint64_t end, b0, b1, fanout_mask;
+	unsigned int level, block_shift;
+	int ret;
+
+	if (!reader || !count || start + count > reader->num_samples
+	    || reader->unitsize > 8) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	sum.or_mask = 0;
+	sum.and_mask = ~(uint64_t)0;
+	memset(sum.trans, 0, sizeof(sum.trans));
+	end = start + count;
+
+	block_shift = reader->sum_block_shift;
+	b0 = reader->sum_levels ? (start + (1ULL << block_shift) - 1) >> block_shift : 0;
+	b1 = reader->sum_levels ? end >> block_shift : 0;
+	if (b0 >= b1) {
+		/* No whole block in the range, or no summary at all. */
+		if ((ret = summary_scan(reader, start, end, &sum)) != SR_OK)
+			return ret;
+	} else {
+		/* The partial blocks at either end. */
+		if ((ret = summary_scan(reader, start, b0 << block_shift,
+				&sum)) != SR_OK)
+			return ret;
+		if ((ret = summary_scan(reader, b1 << block_shift, end,
+				&sum)) != SR_OK)
+			return ret;
+		/*
+		 * The whole blocks in between: move up a level as soon as
+		 * the remaining range is aligned to the next level's blocks.
+		 */
+		fanout_mask = (1 << reader->sum_fanout_shift) - 1;
+		for (level = 0; b0 < b1; level++) {
+			if (level == reader->sum_levels - 1) {
+				while (b0 < b1)
+					summary_add(reader, level, b0++, &sum);
+				break;
+			}
+			while ((b0 & fanout_mask) && b0 < b1)
+				summary_add(reader, level, b0++, &sum);
+			while ((b1 & fanout_mask) && b1 > b0)
+				summary_add(reader, level, --b1, &sum);
+			b0 >>= reader->sum_fanout_shift;
+			b1 >>= reader->sum_fanout_shift;
+		}
+	}
+
+	if (or_mask)
+		*or_mask = sum.or_mask;
+	if (and_mask)
+		*and_mask = sum.and_mask;
+	if (transitions)
+		memcpy(transitions, sum.trans, reader->unitsize * 8 * sizeof(uint64_t));
+
+	return SR_OK;
+}
+
+/* What sr_session_reader_find_pattern() or _find_edge() looks for. */
+struct reader_search {
+	gboolean edge;
+	uint64_t mask;
+	uint64_t value;
+	int probe;
+	gboolean rising;
+};
+
+/* The bit pattern 1 in every lane of a sample in a 64-bit word, or 0. */
+static uint64_t lane_ones(int unitsize)
+{
+	switch (unitsize) {
+	case 1:
+		return 0x0101010101010101ULL;
+	case 2:
+		return 0x0001000100010001ULL;
+	case 4:
+		return 0x0000000100000001ULL;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Find the first of count samples matching the pattern, returning count if
+ * there is none. Eight bytes of samples are compared at once: after XORing
+ * the value and masking, a lane is zero exactly for a matching sample, and
+ * the lowest lane flagged by the zero-lane test is always a true match.
+ */
+static uint64_t scan_pattern(const uint8_t *data, uint64_t count,
+		int unitsize, uint64_t mask, uint64_t value)
+{
+	uint64_t ones, highs, vmask, vvalue, x, found, i, lanes;
+
+	i = 0;
+	if ((ones = lane_ones(unitsize))) {
+		lanes = 8 / unitsize;
+		highs = ones << (unitsize * 8 - 1);
+		vmask = ones * mask;
+		vvalue = ones * value;
+		for (; i + lanes <= count; i += lanes) {
+			x = (get_le64(data + i * unitsize) ^ vvalue) & vmask;
+			if ((found = (x - ones) & ~x & highs))
+				return i + __builtin_ctzll(found)
+					/ (unitsize * 8);
+		}
+	}
+	for (; i < count; i++)
+		if ((sample_get(data + i * unitsize, unitsize) & mask) == value)
+			return i;
+
+	return count;
+}
+
+/*
+ * Find the first of count samples where the probe has the wanted edge,
+ * compared to the sample before it, *prev for the first one. Returns count
+ * if there is none, and leaves the last sample in *prev.
+ */
+static uint64_t scan_edge(const uint8_t *data, uint64_t count, int unitsize,
+		int probe, gboolean rising, uint64_t *prev)
+{
+	uint64_t ones, bits, cur, x, i, lanes, v;
+
+	v = sample_get(data, unitsize);
+	if (((v ^ *prev) >> probe) & 1 && ((v >> probe) & 1) == !!rising)
+		return 0;
+	i = 1;
+	if ((ones = lane_ones(unitsize))) {
+		/* Sample i against sample i - 1, in every lane at once. */
+		lanes = 8 / unitsize;
+		bits = ones << probe;
+		for (; i + lanes <= count; i += lanes) {
+			cur = get_le64(data + i * unitsize);
+			x = (cur ^ get_le64(data + (i - 1) * unitsize)) & bits;
+			x &= rising ? cur : ~cur;
+			if (x)
+				return i + __builtin_ctzll(x) / (unitsize * 8);
+		}
+	}
+	for (; i < count; i++) {
+		v = sample_get(data + i * unitsize, unitsize);
+		*prev = sample_get(data + (i - 1) * unitsize, unitsize);
+		if (((v ^ *prev) >> probe) & 1
+		    && ((v >> probe) & 1) == !!rising)
+			return i;
+	}
+	*prev = sample_get(data + (count - 1) * unitsize, unitsize);
+
+	return count;
+}
+
+/* Find an edge in samples [start, end) straight from the probe's plane. */
+static int scan_edge_plane(struct sr_session_reader *reader,
+		const struct reader_search *s, uint64_t start, uint64_t end,
+		uint64_t *index)
+{
+	const uint8_t *data;
+	const void *p;
+	uint64_t pos, count, i, n, valid, w, x, prev;
+	int ret;
+
+	/* The plane is read from the byte holding the first sample. */
+	pos = start & ~(uint64_t)7;
+	prev = 0;
+	if (pos > 0) {
+		count = 8;
+		if ((ret = sr_session_reader_probe_get(reader, s->probe,
+				pos - 8, &count, &p)) != SR_OK)
+			return ret;
+		prev = *(const uint8_t *)p >> 7;
+	}
+
+	while (pos < end) {
+		count = end - pos;
+		if ((ret = sr_session_reader_probe_get(reader, s->probe, pos,
+				&count, &p)) != SR_OK)
+			return ret;
+		data = p;
+		for (i = 0; i < count; i += 64) {
+			valid = MIN(64, count - i);
+			if (valid == 64) {
+				w = get_le64(data + i / 8);
+			} else {
+				w = 0;
+				for (n = 0; n * 8 < valid; n++)
+					w |= (uint64_t)data[i / 8 + n]
+						<< (n * 8);
+				w &= (1ULL << valid) - 1;
+			}
+			/* Bit j of x: the probe changed at sample j. */
+			x = (w ^ ((w << 1) | prev)) & (s->rising ? w : ~w);
+			if (valid < 64)
+				x &= (1ULL << valid) - 1;
+			if (pos + i < start)
+				x &= ~0ULL << (start - pos - i);
+			if (pos + i == 0)
+				x &= ~1ULL;
+			if (x) {
+				*index = pos + i + __builtin_ctzll(x);
+				return SR_OK;
+			}
+			prev = (w >> (valid - 1)) & 1;
+		}
+		pos += count;
+	}
+
+	return SR_ERR_NA;
+}
+
+/* Look for a match in samples [start, end) by scanning the capture data. */
+static int search_scan(struct sr_session_reader *reader,
+		const struct reader_search *s, uint64_t start, uint64_t end,
+		uint64_t *index)
+{
+	const void *p;
+	uint64_t count, i, prev;
+	int ret;
+
+	if (s->edge && reader->num_planes)
+		return scan_edge_plane(reader, s, start, end, index);
+
+	prev = 0;
+	if (s->edge) {
+		/* No edge at the first sample, there's none before it. */
+		count = 1;
+		if ((ret = sr_session_reader_get(reader, start ? start - 1 : 0,
+				&count, &p)) != SR_OK)
+			return ret;
+		prev = sample_get(p, reader->unitsize);
+	}
+
+	while (start < end) {
+		count = end - start;
+		if ((ret = sr_session_reader_get(reader, start, &count,
+				&p)) != SR_OK)
+			return ret;
+		if (s->edge)
+			i = scan_edge(p, count, reader->unitsize, s->probe,
+					s->rising, &prev);
+		else
+			i = scan_pattern(p, count, reader->unitsize, s->mask,
+					s->value);
+		if (i < count) {
+			*index = start + i;
+			return SR_OK;
+		}
+		start += count;
+	}
+
+	return SR_ERR_NA;
+}
+
+/* Whether the summary record rules out a match in the samples it covers. */
+static gboolean search_skip(const struct reader_search *s, const uint8_t *rec)
+{
+	uint64_t or_mask, and_mask, bit;
+
+	or_mask = get_le64(rec);
+	and_mask = get_le64(rec + 8);
+
+	if (!s->edge)
+		return (s->mask & s->value & ~or_mask)
+			|| (s->mask & ~s->value & and_mask);
+
+	bit = 1ULL << s->probe;
+	if (!get_le64(rec + 16 + 8 * s->probe))
+		return TRUE;
+
+	return s->rising ? !(or_mask & bit) : (and_mask & bit) != 0;
+}
+
+/*
+ * Find the first match at or after start. Blocks are only scanned when
+ * their summary records at every level allow for a match; whole runs of
+ * them are skipped at the highest level that rules a match out.
+ */
+static int search_run(struct sr_session_reader *reader,
+		const struct reader_search *s, uint64_t start, uint64_t *index)
+{
+	const uint8_t *rec;
+	uint64_t pos, end, idx, fanout_mask;
+	unsigned int level, block_shift, span_shift;
+	int ret;
+
+	if (start >= reader->num_samples)
+		return SR_ERR_NA;
+
+	if (!reader->sum_levels)
+		return search_scan(reader, s, start, reader->num_samples,
+				index);
+
+	block_shift = reader->sum_block_shift;
+	fanout_mask = (1 << reader->sum_fanout_shift) - 1;
+	pos = start;
+	while (pos < reader->num_samples) {
+		if (pos & ((1ULL << block_shift) - 1)) {
+			/* The partial block at the start. */
+			end = MIN(((pos >> block_shift) + 1) << block_shift,
+					reader->num_samples);
+			if ((ret = search_scan(reader, s, pos, end,
+					index)) != SR_ERR_NA)
+				return ret;
+			pos = end;
+			continue;
+		}
+		/* Move up as long as pos starts a block of the next level. */
+		idx = pos >> block_shift;
+		level = 0;
+		while (level < reader->sum_levels - 1 && !(idx & fanout_mask)) {
+			idx >>= reader->sum_fanout_shift;
+			level++;
+		}
+		/* Move down until a record rules a match out, or scan. */
+		while (TRUE) {
+			if (idx >= reader->sum_counts[level])
+				return search_scan(reader, s, pos,
+						reader->num_samples, index);
+			rec = reader->sum_level[level]
+				+ idx * reader->sum_rec_size;
+			if (search_skip(s, rec)) {
+				span_shift = block_shift
+					+ level * reader->sum_fanout_shift;
+				pos = span_shift < 64 ? (idx + 1) << span_shift
+					: reader->num_samples;
+				break;
+			}
+			if (level == 0) {
+				end = MIN(pos + (1ULL << block_shift),
+						reader->num_samples);
+				if ((ret = search_scan(reader, s, pos, end,
+						index)) != SR_ERR_NA)
+					return ret;
+				pos = end;
+				break;
+			}
+			level--;
+			idx <<= reader->sum_fanout_shift;
+		}
+	}
+
+	return SR_ERR_NA;
+}
+
+/**
+ * Find the next occurrence of a pattern in a session file opened for
+ * reading.
+ *
+ * If the session file has a summary (see sr_session_writer_summary_set()),
+ * blocks of samples whose OR and AND of all samples rule out a match are
+ * skipped without decompressing or reading them, so this is fast even for
+ * huge captures as long as the pattern is rare. Without a summary, all
+ * samples from start on are scanned.
+ *
+ * @param reader The reader returned by sr_session_reader_open(). Must not
+ *               be NULL.
+ * @param start The index of the first sample to look at.
+ * @param mask The probes the pattern consists of.
+ * @param value The values of the probes in mask. Must not have bits
+ *              outside of mask.
+ * @param index Pointer where the index of the first sample at or after
+ *              start with (sample & mask) == value will be stored. Must not
+ *              be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_NA if no sample matches, SR_ERR_ARG
+ *         upon invalid arguments (including unitsizes larger than 8), or
+ *         SR_ERR upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_reader_find_pattern(struct sr_session_reader *reader,
+		uint64_t start, uint64_t mask, uint64_t value, uint64_t *index)
+{
+	struct reader_search s;
+
+	if (!reader || !index || reader->unitsize > 8 || (value & ~mask)) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	/* Probes the samples don't have are never high. */
+	if (reader->unitsize < 8)
+		mask &= (1ULL << (reader->unitsize * 8)) - 1;
+	if (value & ~mask)
+		return SR_ERR_NA;
+
+	s.edge = FALSE;
+	s.mask = mask;
+	s.value = value;
+
+	return search_run(reader, &s, start, index);
+}
+
+/**
+ * Find the next edge of a probe in a session file opened for reading.
+ *
+ * If the session file has a summary (see sr_session_writer_summary_set()),
+ * blocks of samples in which the probe doesn't change are skipped, without
+ * decompressing or reading them. In files of the planar layout, only the
+ * probe's own plane is read. Without a summary, all samples from start on
+ * are scanned.
+ *
+ * @param reader The reader returned by sr_session_reader_open(). Must not
+ *               be NULL.
+ * @param probe The bit of the probe in the samples, from 0 to
+ *              unitsize * 8 - 1.
+ * @param rising TRUE to find a rising edge, FALSE to find a falling edge.
+ * @param start The index of the first sample to look at. An edge at it
+ *              (compared to the sample before it) is found.
+ * @param index Pointer where the index of the first sample with the edge,
+ *              i.e. with the probe's new value, will be stored. Must not be
+ *              NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_NA if there is no such edge,
+ *         SR_ERR_ARG upon invalid arguments (including unitsizes larger
+ *         than 8), SR_ERR_MALLOC upon memory allocation errors, or SR_ERR
+ *         upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_reader_find_edge(struct sr_session_reader *reader,
+		int probe, gboolean rising, uint64_t start, uint64_t *index)
+{
+	struct reader_search s;
+
+	if (!reader || !index || reader->unitsize > 8 || probe < 0
+	    || probe >= reader->unitsize * 8) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	s.edge = TRUE;
+	s.probe = probe;
+	s.rising = rising;
+
+	return search_run(reader, &s, start, index);
+}
+
+/**
+ * Close a session file opened for reading, and free the reader.
+ *
+ * @param reader The reader returned by sr_session_reader_open(). Must not
+ *               be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_reader_close(struct sr_session_reader *reader)
+{
+	int k;
+
+	if (!reader) {
+		sr_err("%s: reader was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	for (k = 0; reader->plane_chunks && k < reader->num_planes; k++)
+		if (reader->plane_chunks[k])
+			g_array_free(reader->plane_chunks[k], TRUE);
+	for (k = 0; reader->plane_cache && k < reader->num_planes; k++)
+		g_free(reader->plane_cache[k].data);
+	g_free(reader->plane_chunks);
+	g_free(reader->plane_cache);
+	g_free(reader->plane_ptrs);
+	g_mapped_file_unref(reader->mapped);
+	g_array_free(reader->chunks, TRUE);
+	g_free(reader->tail_file);
+	g_free(reader->tail_name);
+	g_free(reader->cache.data);
+	g_free(reader->conv);
+	g_free(reader);
+
+	return SR_OK;
+}
+
+struct sr_session_spill {
+	struct sr_session_writer *writer;
+	/* Once the capture ended, all samples are read back from the file. */
+	struct sr_session_reader *reader;
+	char *filename;
+	int unitsize;
+	/* Ring buffer of the most recent samples. */
+	uint8_t *window;
+	uint64_t window_size;
+	uint64_t window_head;
+	uint64_t window_used;
+	/* All samples so far, of which the oldest were spilled. */
+	uint64_t num_samples;
+};
+
+/* Write the oldest n samples of the window to the file. */
+static int spill_evict(struct sr_session_spill *spill, uint64_t n)
+{
+	uint8_t *oldest;
+	uint64_t first;
+	int ret;
+
+	oldest = spill->window + spill->window_head * spill->unitsize;
+	first = MIN(n, spill->window_size - spill->window_head);
+	if ((ret = sr_session_writer_write(spill->writer, oldest,
+			first)) != SR_OK)
+		return ret;
+	if (n > first && (ret = sr_session_writer_write(spill->writer,
+			spill->window, n - first)) != SR_OK)
+		return ret;
+
+	spill->window_head = (spill->window_head + n) % spill->window_size;
+	spill->window_used -= n;
+
+	return SR_OK;
+}
+
+static int spill_write(struct sr_session_spill *spill, const uint8_t *buf,
+		uint64_t units)
+{
+	uint64_t tail, n, excess;
+	int ret;
+
+	/* Make room, spilling what is pushed out of the window. */
+	if ((excess = spill->window_used + units) > spill->window_size) {
+		excess -= spill->window_size;
+		n = MIN(excess, spill->window_used);
+		if ((ret = spill_evict(spill, n)) != SR_OK)
+			return ret;
+		/* More than the window: the rest goes straight to the file. */
+		if (excess > n) {
+			if ((ret = sr_session_writer_write(spill->writer, buf,
+					excess - n)) != SR_OK)
+				return ret;
+			buf += (excess - n) * spill->unitsize;
+			units -= excess - n;
+			spill->num_samples += excess - n;
+			spill->window_head = 0;
+		}
+	}
+
+	while (units) {
+		tail = (spill->window_head + spill->window_used)
+				% spill->window_size;
+		n = MIN(units, spill->window_size - tail);
+		memcpy(spill->window + tail * spill->unitsize, buf,
+				n * spill->unitsize);
+		buf += n * spill->unitsize;
+		units -= n;
+		spill->window_used += n;
+		spill->num_samples += n;
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Create a memory-bounded buffer for the logic samples of a capture.
+ *
+ * The most recent samples are kept in RAM, and older ones are written to
+ * a session file as they are pushed out, so the memory used doesn't grow
+ * with the length of the capture. The file is the same as one written
+ * with sr_session_writer_open(), and complete once the capture ended (see
+ * sr_session_spill_end()).
+ *
+ * @param spill Pointer where the new buffer will be stored. Must not be
+ *              NULL.
+ * @param filename The name of the session file to create. An existing file
+ *                 is overwritten. Must not be NULL.
+ * @param sdi The device instance from which the data is captured. Must not
+ *            be NULL.
+ * @param unitsize The number of bytes per sample.
+ * @param window The number of samples to keep in RAM. Must not be 0.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, or SR_ERR upon
+ *         other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_spill_open(struct sr_session_spill **spill,
+		const char *filename, const struct sr_dev_inst *sdi,
+		int unitsize, uint64_t window)
+{
+	struct sr_session_spill *s;
+	int ret;
+
+	if (!spill || !filename || !sdi || unitsize <= 0 || !window
+	    || window > G_MAXSIZE / unitsize) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!(s = g_try_malloc0(sizeof(struct sr_session_spill)))) {
+		sr_err("%s: spill malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	if (!(s->window = g_try_malloc(window * unitsize))) {
+		sr_err("%s: window malloc failed", __func__);
+		g_free(s);
+		return SR_ERR_MALLOC;
+	}
+
+	if ((ret = sr_session_writer_open(&s->writer, filename, sdi,
+			unitsize)) != SR_OK) {
+		g_free(s->window);
+		g_free(s);
+		return ret;
+	}
+
+	s->filename = g_strdup(filename);
+	s->unitsize = unitsize;
+	s->window_size = window;
+	*spill = s;
+
+	return SR_OK;
+}
+
+/**
+ * Pass a datafeed packet to a capture buffer.
+ *
+ * This can be called straight from a datafeed callback. The samples of
+ * logic packets (SR_DF_LOGIC or SR_DF_LOGIC_RLE) are appended to the
+ * buffer, SR_DF_END ends the capture like sr_session_spill_end(), and
+ * all other packets are written to the file as with
+ * sr_session_writer_packet(). Analog samples thus aren't kept in RAM.
+ *
+ * @param spill The buffer returned by sr_session_spill_open(). Must not be
+ *              NULL.
+ * @param packet The packet. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments (including
+ *         logic packets after the capture ended), SR_ERR_MALLOC upon
+ *         memory allocation errors, or SR_ERR upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_spill_packet(struct sr_session_spill *spill,
+		const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+	uint64_t run, offset, n;
+	uint8_t *buf;
+	int ret;
+
+	if (!spill || !packet) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (packet->type == SR_DF_END)
+		return spill->writer ? sr_session_spill_end(spill) : SR_OK;
+
+	if (!spill->writer) {
+		sr_err("%s: the capture has ended", __func__);
+		return SR_ERR_ARG;
+	}
+
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		if (logic->unitsize != spill->unitsize) {
+			sr_err("Unitsize %d doesn't match the buffer's %d.",
+			       logic->unitsize, spill->unitsize);
+			return SR_ERR_ARG;
+		}
+		return spill_write(spill, logic->data,
+				logic->length / logic->unitsize);
+	case SR_DF_LOGIC_RLE:
+		rle = packet->payload;
+		if (rle->unitsize != spill->unitsize) {
+			sr_err("Unitsize %d doesn't match the buffer's %d.",
+			       rle->unitsize, spill->unitsize);
+			return SR_ERR_ARG;
+		}
+		if (!(buf = g_try_malloc(WRITER_RLE_SIZE))) {
+			sr_err("%s: buf malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		ret = SR_OK;
+		run = offset = 0;
+		while (ret == SR_OK && (n = sr_logic_rle_expand(rle, &run,
+				&offset, buf, WRITER_RLE_SIZE / rle->unitsize)))
+			ret = spill_write(spill, buf, n);
+		g_free(buf);
+		return ret;
+	default:
+		return sr_session_writer_packet(spill->writer, packet);
+	}
+}
+
+/**
+ * End the capture of a buffer, and complete its session file.
+ *
+ * The samples still in RAM are written to the file, and the RAM is freed.
+ * From then on, sr_session_spill_get() reads all samples from the file.
+ *
+ * @param spill The buffer returned by sr_session_spill_open(). Must not be
+ *              NULL, nor have ended already.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, or SR_ERR upon
+ *         other errors. On failure the file is gone and no samples can
+ *         be read.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_spill_end(struct sr_session_spill *spill)
+{
+	struct sr_session_writer *writer;
+	int ret;
+
+	if (!spill || !spill->writer) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	ret = spill_evict(spill, spill->window_used);
+	g_free(spill->window);
+	spill->window = NULL;
+
+	writer = spill->writer;
+	spill->writer = NULL;
+	if (ret != SR_OK) {
+		sr_session_writer_close(writer);
+		unlink(spill->filename);
+		return ret;
+	}
+	if ((ret = sr_session_writer_close(writer)) != SR_OK)
+		return ret;
+
+	/* An empty capture has nothing to read back. */
+	if (!spill->num_samples)
+		return SR_OK;
+
+	return sr_session_reader_open(&spill->reader, spill->filename);
+}
+
+/**
+ * Get direct access to samples of a capture buffer.
+ *
+ * While capturing, only the samples still in RAM can be accessed; once the
+ * capture ended, all of them can, straight from the session file. Fewer
+ * samples than requested may be returned as with sr_session_reader_get():
+ * just call this again for the remaining ones.
+ *
+ * @param spill The buffer returned by sr_session_spill_open(). Must not be
+ *              NULL.
+ * @param start The index of the first sample to get, counting from the
+ *              start of the capture.
+ * @param count Pointer to the number of samples wanted. Upon return, it
+ *              holds the number of samples actually available at data.
+ *              Must not be NULL.
+ * @param data Pointer where a pointer to the samples will be stored. The
+ *             samples remain valid until the next call to any function of
+ *             the buffer, and must not be modified. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments (including
+ *         a start past the samples so far), SR_ERR_NA if the samples were
+ *         already spilled to the file during the capture, or SR_ERR upon
+ *         other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_spill_get(struct sr_session_spill *spill,
+		uint64_t start, uint64_t *count, const void **data)
+{
+	uint64_t first, i;
+
+	if (!spill || !count || !data || start >= spill->num_samples) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (spill->reader)
+		return sr_session_reader_get(spill->reader, start, count,
+				data);
+
+	if (!spill->window)
+		return SR_ERR;
+
+	first = spill->num_samples - spill->window_used;
+	if (start < first)
+		return SR_ERR_NA;
+
+	i = (spill->window_head + start - first) % spill->window_size;
+	*count = MIN(MIN(*count, spill->num_samples - start),
+			spill->window_size - i);
+	*data = spill->window + i * spill->unitsize;
+
+	return SR_OK;
+}
+
+/**
+ * Get the number of samples of a capture buffer.
+ *
+ * @param spill The buffer returned by sr_session_spill_open(). Must not be
+ *              NULL.
+ * @param num_samples Pointer where the number of samples so far will be
+ *                    stored. Can be NULL.
+ * @param first_in_ram Pointer where the index of the oldest sample still
+ *                     in RAM will be stored, or the number of samples if
+ *                     the capture ended. Can be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_spill_info(const struct sr_session_spill *spill,
+		uint64_t *num_samples, uint64_t *first_in_ram)
+{
+	if (!spill) {
+		sr_err("%s: spill was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (num_samples)
+		*num_samples = spill->num_samples;
+	if (first_in_ram)
+		*first_in_ram = spill->num_samples - spill->window_used;
+
+	return SR_OK;
+}
+
+/**
+ * Free a capture buffer.
+ *
+ * If the capture didn't end yet, it is ended first, see
+ * sr_session_spill_end(). The session file is left in place.
+ *
+ * @param spill The buffer returned by sr_session_spill_open(). Must not be
+ *              NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or the
+ *         error of ending the capture.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_spill_close(struct sr_session_spill *spill)
+{
+	int ret;
+
+	if (!spill) {
+		sr_err("%s: spill was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	ret = SR_OK;
+	if (spill->writer)
+		ret = sr_session_spill_end(spill);
+	if (spill->reader)
+		sr_session_reader_close(spill->reader);
+	g_free(spill->window);
+	g_free(spill->filename);
+	g_free(spill);
+
+	return ret;
+}
+
+/** @cond PRIVATE */
+/* Bytes of packets queued for the recorder's thread, before sending waits. */
+#define RECORD_MAX_QUEUED	(64 * 1024 * 1024)
+/** @endcond */
+
+/* A device whose packets are recorded. */
+struct record_dev {
+	const struct sr_dev_inst *sdi;
+	/* Without logic probes, the device's unitsize is known to be 1. */
+	gboolean has_logic;
+	/* Sent its header, but not its end yet. */
+	gboolean running;
+	/*
+	 * Only used by the recorder's thread: whether the device is part of
+	 * the file yet, and its packets which came before its unitsize was
+	 * known from a logic packet.
+	 */
+	gboolean added;
+	int unitsize;
+	GQueue *pending;
+};
+
+/* A finished file of a recording ring, as listed in its index. */
+struct record_file {
+	char *name;
+	/* Of the first device's samples, from the start of the recording. */
+	uint64_t first_sample;
+	uint64_t num_samples;
+	/* When the first and last packet in it were sent, in real time. */
+	int64_t start_time;
+	int64_t end_time;
+};
+
+/* A packet handed to the recorder's thread. */
+struct record_job {
+	struct record_dev *dev;
+	struct sr_datafeed_packet *packet;
+	uint64_t size;
+};
+
+struct session_recorder {
+	char *filename;
+	int level;
+	gboolean planar;
+	gboolean rle;
+	gboolean delta;
+	gboolean summary;
+	/* All devices which sent packets, and how many are still running. */
+	GPtrArray *devs;
+	int num_running;
+	/* Set once the file is finished, the packets of later runs are not. */
+	gboolean done;
+	GThread *thread;
+	GAsyncQueue *jobs;
+	/* Queued last, to finish the file. */
+	struct record_job stop;
+	/* Bytes in the queued packets, guarded by the mutex. */
+	GMutex mutex;
+	GCond cond;
+	uint64_t queued;
+	/*
+	 * With rotate set, a file is only written until it holds that many
+	 * samples of its first device. The recording then goes on in the
+	 * next one, "<name>-<N><ext>" for the filename "<name><ext>", and
+	 * of the finished ones only the last max_files are kept (all of
+	 * them for 0), listed in "<name>.index".
+	 */
+	uint64_t rotate;
+	unsigned int max_files;
+	/* Added to packet timestamps to get the real time. */
+	int64_t clock_offset;
+	/* Only used by the recorder's thread. */
+	struct sr_session_writer *writer;
+	int ret;
+	/* The devices in the file, in the order they were added. */
+	GPtrArray *file_devs;
+	char *cur_filename;
+	uint64_t file_num;
+	struct record_file cur;
+	/* The finished files still kept, oldest first. */
+	GQueue *ring;
+};
+
+/* Roughly how much memory the sample data of a packet takes. */
+static uint64_t record_packet_size(const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+	const struct sr_datafeed_analog *analog;
+	const struct sr_datafeed_analog_raw *raw;
+
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		return logic->length;
+	case SR_DF_LOGIC_RLE:
+		rle = packet->payload;
+		return rle->num_runs * (rle->unitsize + sizeof(uint64_t));
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		return (uint64_t)analog->num_samples * sizeof(float)
+				* g_slist_length(analog->probes);
+	case SR_DF_ANALOG_RAW:
+		raw = packet->payload;
+		return (uint64_t)raw->num_samples
+				* g_slist_length(raw->probes) * sizeof(float);
+	default:
+		return 0;
+	}
+}
+
+/* The unitsize a packet shows its device has, or 0 if it doesn't tell. */
+static int record_packet_unitsize(const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		return logic->unitsize;
+	} else if (packet->type == SR_DF_LOGIC_RLE) {
+		rle = packet->payload;
+		return rle->unitsize;
+	}
+
+	return 0;
+}
+
+/* Open the current file, with the devices which are part of it so far. */
+static int record_writer_open(struct session_recorder *rec)
+{
+	struct record_dev *dev;
+	unsigned int i;
+	int ret;
+
+	dev = g_ptr_array_index(rec->file_devs, 0);
+	if ((ret = sr_session_writer_open(&rec->writer, rec->cur_filename,
+			dev->sdi, dev->unitsize)) != SR_OK)
+		return ret;
+	for (i = 1; ret == SR_OK && i < rec->file_devs->len; i++) {
+		dev = g_ptr_array_index(rec->file_devs, i);
+		ret = sr_session_writer_dev_add(rec->writer, dev->sdi,
+				dev->unitsize);
+	}
+	if (ret != SR_OK
+	    || (ret = sr_session_writer_compression_set(rec->writer,
+			rec->level)) != SR_OK
+	    || (ret = sr_session_writer_planar_set(rec->writer,
+			rec->planar)) != SR_OK
+	    || (ret = sr_session_writer_rle_set(rec->writer,
+			rec->rle)) != SR_OK
+	    || (ret = sr_session_writer_delta_set(rec->writer,
+			rec->delta)) != SR_OK
+	    || (ret = sr_session_writer_summary_set(rec->writer,
+			rec->summary)) != SR_OK) {
+		sr_session_writer_close(rec->writer);
+		rec->writer = NULL;
+		unlink(rec->cur_filename);
+	}
+
+	return ret;
+}
+
+/* Make a device part of the file, opening it with the first one. */
+static int record_dev_add(struct session_recorder *rec,
+		struct record_dev *dev, int unitsize)
+{
+	dev->unitsize = unitsize;
+	g_ptr_array_add(rec->file_devs, dev);
+	if (rec->writer)
+		return sr_session_writer_dev_add(rec->writer, dev->sdi,
+				unitsize);
+
+	return record_writer_open(rec);
+}
+
+/* The name of a file of the ring, with the number before the extension. */
+static char *record_file_name(const struct session_recorder *rec,
+		const char *suffix)
+{
+	const char *dot;
+
+	dot = strrchr(rec->filename, '.');
+	if (!dot || strchr(dot, G_DIR_SEPARATOR) || strchr(dot, '/'))
+		dot = rec->filename + strlen(rec->filename);
+
+	return g_strdup_printf("%.*s%s%s", (int)(dot - rec->filename),
+			rec->filename, suffix, suffix[0] == '.' ? "" : dot);
+}
+
+/* List the files of the ring, replacing the index in one go. */
+static int record_index_write(struct session_recorder *rec)
+{
+	struct record_file *file;
+	GString *index;
+	GError *error;
+	GList *l;
+	char *name, *base;
+	int ret;
+
+	index = g_string_new("# file first_sample samples "
+			"start_time end_time\n");
+	for (l = rec->ring->head; l; l = l->next) {
+		file = l->data;
+		base = g_path_get_basename(file->name);
+		g_string_append_printf(index, "%s %" PRIu64 " %" PRIu64
+				" %" PRId64 " %" PRId64 "\n", base,
+				file->first_sample, file->num_samples,
+				file->start_time, file->end_time);
+		g_free(base);
+	}
+
+	ret = SR_OK;
+	error = NULL;
+	name = record_file_name(rec, ".index");
+	if (!g_file_set_contents(name, index->str, index->len, &error)) {
+		sr_err("Failed to write '%s': %s.", name, error->message);
+		g_error_free(error);
+		ret = SR_ERR;
+	}
+	g_free(name);
+	g_string_free(index, TRUE);
+
+	return ret;
+}
+
+static void record_file_free(gpointer data)
+{
+	struct record_file *file;
+
+	file = data;
+	g_free(file->name);
+	g_free(file);
+}
+
+/*
+ * Finish the current file of a ring. It goes into the index, and the
+ * oldest file goes if there are too many.
+ */
+static int record_file_done(struct session_recorder *rec)
+{
+	struct record_file *file;
+	int ret;
+
+	ret = SR_OK;
+	if (rec->writer) {
+		ret = sr_session_writer_close(rec->writer);
+		rec->writer = NULL;
+	}
+	if (!rec->rotate || !rec->file_num)
+		return ret;
+
+	if (!(file = g_try_malloc(sizeof(struct record_file)))) {
+		sr_err("%s: file malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	*file = rec->cur;
+	file->name = g_strdup(rec->cur_filename);
+	g_queue_push_tail(rec->ring, file);
+	while (rec->max_files && g_queue_get_length(rec->ring)
+			> rec->max_files) {
+		file = g_queue_pop_head(rec->ring);
+		unlink(file->name);
+		record_file_free(file);
+	}
+
+	if (record_index_write(rec) != SR_OK && ret == SR_OK)
+		ret = SR_ERR;
+
+	return ret;
+}
+
+/* Go on in the next file of the ring. */
+static int record_rotate(struct session_recorder *rec)
+{
+	char suffix[32];
+	int ret;
+
+	if ((ret = record_file_done(rec)) != SR_OK)
+		return ret;
+
+	rec->cur.first_sample += rec->cur.num_samples;
+	rec->cur.num_samples = 0;
+	rec->file_num++;
+	g_free(rec->cur_filename);
+	snprintf(suffix, sizeof(suffix), "-%" PRIu64, rec->file_num);
+	rec->cur_filename = record_file_name(rec, suffix);
+
+	return record_writer_open(rec);
+}
+
+/* Count samples of the first device written to the current file. */
+static void record_file_samples(struct session_recorder *rec,
+		uint64_t num_samples, int64_t timestamp)
+{
+	if (!rec->cur.num_samples)
+		rec->cur.start_time = timestamp + rec->clock_offset;
+	rec->cur.end_time = timestamp + rec->clock_offset;
+	rec->cur.num_samples += num_samples;
+}
+
+/*
+ * Write logic data of the first device of a ring's files, split where a
+ * file is full. The next file only starts with the next samples, so no
+ * file is left empty at the end.
+ */
+static int record_logic_write(struct session_recorder *rec,
+		const struct record_job *job)
+{
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+	struct sr_datafeed_logic plogic;
+	struct sr_datafeed_logic_rle prle;
+	struct sr_datafeed_packet part;
+	uint64_t *counts, total, done, n, left, c, r, off;
+	int ret;
+
+	logic = NULL;
+	rle = NULL;
+	counts = NULL;
+	if (job->packet->type == SR_DF_LOGIC) {
+		logic = job->packet->payload;
+		total = logic->unitsize ? logic->length / logic->unitsize : 0;
+	} else {
+		rle = job->packet->payload;
+		total = rle->num_samples;
+		if (!(counts = g_try_new(uint64_t, MAX(rle->num_runs, 1)))) {
+			sr_err("%s: counts malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+	}
+
+	ret = SR_OK;
+	r = off = 0;
+	for (done = 0; done < total && ret == SR_OK; done += n) {
+		if (rec->cur.num_samples == rec->rotate
+		    && (ret = record_rotate(rec)) != SR_OK)
+			break;
+		n = MIN(total - done, rec->rotate - rec->cur.num_samples);
+		if (logic) {
+			plogic = *logic;
+			plogic.data = (uint8_t *)logic->data
+					+ done * logic->unitsize;
+			plogic.length = n * logic->unitsize;
+			plogic.start_sample += done;
+			part.type = SR_DF_LOGIC;
+			part.payload = &plogic;
+		} else {
+			prle = *rle;
+			prle.values = (uint8_t *)rle->values
+					+ r * rle->unitsize;
+			prle.counts = counts;
+			prle.num_samples = n;
+			prle.start_sample += done;
+			/* The runs of the part, the outer ones cut short. */
+			for (prle.num_runs = 0, left = n; left; left -= c) {
+				c = MIN(rle->counts[r] - off, left);
+				counts[prle.num_runs++] = c;
+				if ((off += c) == rle->counts[r]) {
+					r++;
+					off = 0;
+				}
+			}
+			part.type = SR_DF_LOGIC_RLE;
+			part.payload = &prle;
+		}
+		ret = sr_session_writer_dev_packet(rec->writer, job->dev->sdi,
+				&part);
+		record_file_samples(rec, n, logic ? logic->timestamp
+				: rle->timestamp);
+	}
+	g_free(counts);
+
+	return ret;
+}
+
+static void record_job_write(struct session_recorder *rec,
+		struct record_job *job)
+{
+	if (rec->ret != SR_OK) {
+		/* Nothing more is written. */
+	} else if (rec->rotate && job->dev == g_ptr_array_index(
+			rec->file_devs, 0)
+		   && (job->packet->type == SR_DF_LOGIC
+		       || job->packet->type == SR_DF_LOGIC_RLE)) {
+		rec->ret = record_logic_write(rec, job);
+	} else {
+		rec->ret = sr_session_writer_dev_packet(rec->writer,
+				job->dev->sdi, job->packet);
+	}
+	sr_packet_free(job->packet);
+
+	g_mutex_lock(&rec->mutex);
+	rec->queued -= job->size;
+	g_cond_signal(&rec->cond);
+	g_mutex_unlock(&rec->mutex);
+
+	g_free(job);
+}
+
+/* Add a device to the file, and write the packets it held back. */
+static void record_dev_flush(struct session_recorder *rec,
+		struct record_dev *dev, int unitsize)
+{
+	struct record_job *job;
+
+	if (rec->ret == SR_OK)
+		rec->ret = record_dev_add(rec, dev, unitsize);
+	dev->added = TRUE;
+	while ((job = g_queue_pop_head(dev->pending)))
+		record_job_write(rec, job);
+}
+
+static void record_job_run(struct session_recorder *rec,
+		struct record_job *job)
+{
+	struct record_dev *dev;
+	int unitsize;
+
+	dev = job->dev;
+	if (!dev->added) {
+		unitsize = 1;
+		if (dev->has_logic)
+			unitsize = record_packet_unitsize(job->packet);
+		if (!unitsize && job->packet->type != SR_DF_END) {
+			g_queue_push_tail(dev->pending, job);
+			return;
+		}
+		/* A device whose logic data never came still gets a section. */
+		record_dev_flush(rec, dev, MAX(unitsize, 1));
+	}
+
+	record_job_write(rec, job);
+}
+
+static gpointer record_thread(gpointer data)
+{
+	struct session_recorder *rec;
+	struct record_dev *dev;
+	struct record_job *job;
+	unsigned int i;
+
+	rec = data;
+	while ((job = g_async_queue_pop(rec->jobs)) != &rec->stop)
+		record_job_run(rec, job);
+
+	/* Devices which didn't end, nor tell their unitsize. */
+	for (i = 0; i < rec->devs->len; i++) {
+		dev = g_ptr_array_index(rec->devs, i);
+		if (!dev->added && !g_queue_is_empty(dev->pending))
+			record_dev_flush(rec, dev, 1);
+	}
+
+	if (rec->writer) {
+		if (rec->ret == SR_OK)
+			rec->ret = record_file_done(rec);
+		else
+			sr_session_writer_close(rec->writer);
+		rec->writer = NULL;
+	}
+	if (rec->ret != SR_OK)
+		sr_err("Recording to '%s' failed: %d.", rec->filename,
+		       rec->ret);
+
+	return NULL;
+}
+
+/* Finish the file, once everything queued got written. */
+static void record_finish(struct session_recorder *rec)
+{
+	if (rec->done)
+		return;
+
+	g_async_queue_push(rec->jobs, &rec->stop);
+	g_thread_join(rec->thread);
+	rec->thread = NULL;
+	rec->done = TRUE;
+}
+
+static void record_dev_free(gpointer data)
+{
+	struct record_dev *dev;
+
+	dev = data;
+	g_queue_free(dev->pending);
+	g_free(dev);
+}
+
+static void record_free(gpointer data)
+{
+	struct session_recorder *rec;
+
+	rec = data;
+	record_finish(rec);
+	g_ptr_array_free(rec->devs, TRUE);
+	g_ptr_array_free(rec->file_devs, TRUE);
+	g_queue_free_full(rec->ring, record_file_free);
+	g_free(rec->cur_filename);
+	g_async_queue_unref(rec->jobs);
+	g_mutex_clear(&rec->mutex);
+	g_cond_clear(&rec->cond);
+	g_free(rec->filename);
+	g_free(rec);
+}
+
+static struct record_dev *record_dev_get(struct session_recorder *rec,
+		const struct sr_dev_inst *sdi)
+{
+	struct record_dev *dev;
+	const struct sr_probe_table *table;
+	unsigned int i;
+	int k;
+
+	for (i = 0; i < rec->devs->len; i++) {
+		dev = g_ptr_array_index(rec->devs, i);
+		if (dev->sdi == sdi)
+			return dev;
+	}
+
+	if (!(table = sr_dev_probe_table_get(sdi)))
+		return NULL;
+	if (!(dev = g_try_malloc0(sizeof(struct record_dev)))) {
+		sr_err("%s: dev malloc failed", __func__);
+		return NULL;
+	}
+	dev->sdi = sdi;
+	dev->pending = g_queue_new();
+	for (k = 0; k < table->num_enabled; k++) {
+		if (table->probes[table->enabled[k]]->type == SR_PROBE_LOGIC)
+			dev->has_logic = TRUE;
+	}
+	g_ptr_array_add(rec->devs, dev);
+
+	return dev;
+}
+
+static void record_datafeed(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	struct session_recorder *rec;
+	struct record_dev *dev;
+	struct record_job *job;
+
+	rec = cb_data;
+	if (rec->done || !(dev = record_dev_get(rec, sdi)))
+		return;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		if (!dev->running)
+			rec->num_running++;
+		dev->running = TRUE;
+		return;
+	case SR_DF_END:
+	case SR_DF_LOGIC:
+	case SR_DF_LOGIC_RLE:
+	case SR_DF_ANALOG:
+	case SR_DF_ANALOG_RAW:
+	case SR_DF_META:
+		break;
+	default:
+		/* Nothing the file keeps. */
+		return;
+	}
+
+	if (!(job = g_try_malloc0(sizeof(struct record_job)))
+	    || !(job->packet = sr_packet_copy(packet))) {
+		sr_err("Failed to queue a packet for recording.");
+		g_free(job);
+		return;
+	}
+	job->dev = dev;
+	job->size = record_packet_size(packet);
+
+	/* Wait for the disk if it falls behind, rather than pile up data. */
+	g_mutex_lock(&rec->mutex);
+	while (rec->queued && rec->queued + job->size > RECORD_MAX_QUEUED)
+		g_cond_wait(&rec->cond, &rec->mutex);
+	rec->queued += job->size;
+	g_mutex_unlock(&rec->mutex);
+	g_async_queue_push(rec->jobs, job);
+
+	if (packet->type == SR_DF_END && dev->running) {
+		dev->running = FALSE;
+		if (--rec->num_running == 0)
+			record_finish(rec);
+	}
+}
+
+/*
+ * Make a recorder to a file with the given options, see
+ * sr_session_record_to(), and start its thread.
+ */
+static int record_new(const char *filename, const char *options,
+		struct session_recorder **recp)
+{
+	struct session_recorder *rec;
+	GError *error;
+	char **opts, *val, *end;
+	int ret, i;
+
+	if (!(rec = g_try_malloc0(sizeof(struct session_recorder)))) {
+		sr_err("%s: rec malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	ret = SR_OK;
+	opts = g_strsplit(options ? options : "", ",", 0);
+	for (i = 0; opts[i] && ret == SR_OK; i++) {
+		if (!opts[i][0])
+			continue;
+		if ((val = strchr(opts[i], '=')))
+			*val++ = '\0';
+		if (!strcmp(opts[i], "compression") && val) {
+			rec->level = strtol(val, &end, 10);
+			if (end == val || *end || rec->level < 0
+			    || rec->level > 9) {
+				sr_err("Invalid compression level '%s'.", val);
+				ret = SR_ERR_ARG;
+			}
+		} else if (!strcmp(opts[i], "planar") && !val) {
+			rec->planar = TRUE;
+		} else if (!strcmp(opts[i], "rle") && !val) {
+			rec->rle = TRUE;
+		} else if (!strcmp(opts[i], "delta") && !val) {
+			rec->delta = TRUE;
+		} else if (!strcmp(opts[i], "summary") && !val) {
+			rec->summary = TRUE;
+		} else if (!strcmp(opts[i], "rotate") && val) {
+			rec->rotate = strtoull(val, &end, 10);
+			if (end == val || *end || !rec->rotate) {
+				sr_err("Invalid rotation size '%s'.", val);
+				ret = SR_ERR_ARG;
+			}
+		} else if (!strcmp(opts[i], "files") && val) {
+			rec->max_files = strtoul(val, &end, 10);
+			if (end == val || *end || !rec->max_files) {
+				sr_err("Invalid number of files '%s'.", val);
+				ret = SR_ERR_ARG;
+			}
+		} else {
+			sr_err("Unknown recording option '%s'.", opts[i]);
+			ret = SR_ERR_ARG;
+		}
+	}
+	g_strfreev(opts);
+	if (ret != SR_OK) {
+		g_free(rec);
+		return ret;
+	}
+
+	rec->filename = g_strdup(filename);
+	rec->cur_filename = g_strdup(filename);
+	if (rec->rotate) {
+		g_free(rec->cur_filename);
+		rec->cur_filename = record_file_name(rec, "-1");
+		rec->file_num = 1;
+		rec->clock_offset = g_get_real_time() - g_get_monotonic_time();
+	}
+	rec->ring = g_queue_new();
+	rec->file_devs = g_ptr_array_new();
+	rec->devs = g_ptr_array_new_with_free_func(record_dev_free);
+	rec->jobs = g_async_queue_new();
+	g_mutex_init(&rec->mutex);
+	g_cond_init(&rec->cond);
+
+	error = NULL;
+	if (!(rec->thread = g_thread_try_new("sr-record", record_thread, rec,
+			&error))) {
+		sr_err("Failed to start recording thread: %s.", error->message);
+		g_error_free(error);
+		rec->done = TRUE;
+		record_free(rec);
+		return SR_ERR;
+	}
+
+	*recp = rec;
+
+	return SR_OK;
+}
+
+/**
+ * Record the next run of a session to a session file.
+ *
+ * All the packets of the session's devices are written to the file with a
+ * session writer (see sr_session_writer_open()) in a thread of its own,
+ * so that the datafeed doesn't wait for the disk. Sending only waits when
+ * more than 64 MiB of sample data are queued for writing. The file is
+ * complete once every device sent its SR_DF_END packet, and isn't written
+ * to by later runs.
+ *
+ * Options are given as a comma-separated list:
+ * - compression=<level>: Deflate level of the capture data, 0 (the
+ *   default) stores it uncompressed.
+ * - planar: Store the logic data as bit planes.
+ * - rle: Code the logic data as run-length coded bit planes.
+ * - delta: Code the analog data for compression.
+ * - summary: Add a summary of the first device's logic data.
+ * - rotate=<samples>: Write a ring of files instead, each holding that
+ *   many samples of the first device's logic data. They are named after
+ *   the filename with "-1", "-2" and so on before its extension. The
+ *   other devices' packets go to the file being written when they come,
+ *   so only the first device's data is split exactly. The finished files
+ *   are listed in "<name>.index", one line each with its name, its first
+ *   sample and number of samples, and the real time in microseconds its
+ *   first and last packet were sent.
+ * - files=<N>: With rotate, keep only the last N files, removing the
+ *   oldest one when another is finished.
+ *
+ * @param session The session, which must not be running. Must not be NULL.
+ * @param filename The name of the file to write. Must not be NULL.
+ * @param options The options, or NULL for the defaults.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR upon other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_record_to(struct sr_session *session,
+		const char *filename, const char *options)
+{
+	struct session_recorder *rec;
+	int ret;
+
+	if (!session || !filename) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (session->running) {
+		sr_err("Cannot start recording while the session runs.");
+		return SR_ERR;
+	}
+
+	if ((ret = record_new(filename, options, &rec)) != SR_OK)
+		return ret;
+
+	/* The file takes either as they are. */
+	if ((ret = sr_session_datafeed_callback_add_full(session,
+			record_datafeed, rec, record_free)) != SR_OK) {
+		record_free(rec);
+		return ret;
+	}
+	sr_session_datafeed_callback_rle_set(session, record_datafeed, rec,
+			TRUE);
+	sr_session_datafeed_callback_analog_raw_set(session, record_datafeed,
+			rec, TRUE);
+
+	return SR_OK;
+}
+
+/* A packet kept by a flight recorder, shared with its snapshots. */
+struct flight_entry {
+	gint refcount;
+	const struct sr_dev_inst *sdi;
+	struct sr_datafeed_packet *packet;
+	uint64_t size;
+};
+
+/* What a flight recorder keeps of a device besides the ring. */
+struct flight_dev {
+	const struct sr_dev_inst *sdi;
+	/* The header of its acquisition, or NULL. */
+	struct flight_entry *header;
+	/* The last meta packet that fell out of the ring, or NULL. */
+	struct flight_entry *meta;
+};
+
+struct flight_recorder {
+	struct sr_session *session;
+	/* Guards all of the below, which the datafeed changes. */
+	GMutex mutex;
+	uint64_t max_size;
+	/* The packets, oldest first, and the size of their sample data. */
+	GQueue *entries;
+	uint64_t size;
+	GPtrArray *devs;
+};
+
+static void flight_entry_unref(struct flight_entry *entry)
+{
+	if (!entry || !g_atomic_int_dec_and_test(&entry->refcount))
+		return;
+
+	sr_packet_free(entry->packet);
+	g_free(entry);
+}
+
+static void flight_dev_free(gpointer data)
+{
+	struct flight_dev *dev;
+
+	dev = data;
+	flight_entry_unref(dev->header);
+	flight_entry_unref(dev->meta);
+	g_free(dev);
+}
+
+static struct flight_dev *flight_dev_get(struct flight_recorder *fr,
+		const struct sr_dev_inst *sdi)
+{
+	struct flight_dev *dev;
+	unsigned int i;
+
+	for (i = 0; i < fr->devs->len; i++) {
+		dev = g_ptr_array_index(fr->devs, i);
+		if (dev->sdi == sdi)
+			return dev;
+	}
+
+	if (!(dev = g_try_malloc0(sizeof(struct flight_dev)))) {
+		sr_err("%s: dev malloc failed", __func__);
+		return NULL;
+	}
+	dev->sdi = sdi;
+	g_ptr_array_add(fr->devs, dev);
+
+	return dev;
+}
+
+/* Drop the packets of a device, or all of them for NULL. */
+static void flight_drop(struct flight_recorder *fr,
+		const struct sr_dev_inst *sdi)
+{
+	struct flight_entry *entry;
+	GList *l, *next;
+
+	for (l = fr->entries->head; l; l = next) {
+		next = l->next;
+		entry = l->data;
+		if (sdi && entry->sdi != sdi)
+			continue;
+		fr->size -= entry->size;
+		flight_entry_unref(entry);
+		g_queue_delete_link(fr->entries, l);
+	}
+	if (!sdi)
+		g_ptr_array_set_size(fr->devs, 0);
+}
+
+/* Make room for the newest packets, keeping track of the device state. */
+static void flight_evict(struct flight_recorder *fr)
+{
+	struct flight_entry *entry;
+	struct flight_dev *dev;
+
+	while (fr->size > fr->max_size
+	       && (entry = g_queue_pop_head(fr->entries))) {
+		fr->size -= entry->size;
+		if (entry->packet->type == SR_DF_META
+		    && (dev = flight_dev_get(fr, entry->sdi))) {
+			flight_entry_unref(dev->meta);
+			dev->meta = entry;
+		} else {
+			flight_entry_unref(entry);
+		}
+	}
+}
+
+static void flight_datafeed(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	struct flight_recorder *fr;
+	struct flight_entry *entry;
+	struct flight_dev *dev;
+
+	fr = cb_data;
+	if (!fr->max_size)
+		return;
+
+	/* Taking a reference on the driver's buffer, where it can. */
+	if (!(entry = g_try_malloc(sizeof(struct flight_entry)))
+	    || !(entry->packet = sr_packet_copy(packet))) {
+		sr_err("Failed to keep a packet in the flight recorder.");
+		g_free(entry);
+		return;
+	}
+	entry->refcount = 1;
+	entry->sdi = sdi;
+	entry->size = record_packet_size(packet);
+
+	g_mutex_lock(&fr->mutex);
+	if (!(dev = flight_dev_get(fr, sdi))) {
+		flight_entry_unref(entry);
+	} else if (packet->type == SR_DF_HEADER) {
+		/* A new acquisition, the device's earlier one is of no use. */
+		flight_drop(fr, sdi);
+		flight_entry_unref(dev->header);
+		flight_entry_unref(dev->meta);
+		dev->header = entry;
+		dev->meta = NULL;
+	} else {
+		g_queue_push_tail(fr->entries, entry);
+		fr->size += entry->size;
+		flight_evict(fr);
+	}
+	g_mutex_unlock(&fr->mutex);
+}
+
+static void flight_free(gpointer data)
+{
+	struct flight_recorder *fr;
+
+	fr = data;
+	if (fr->session->flight == fr)
+		fr->session->flight = NULL;
+	flight_drop(fr, NULL);
+	g_queue_free(fr->entries);
+	g_ptr_array_free(fr->devs, TRUE);
+	g_mutex_clear(&fr->mutex);
+	g_free(fr);
+}
+
+/*
+ * Pass what the flight recorder holds to a callback: each device's header
+ * and its last meta packet before the ring, then the ring's packets, then
+ * an SR_DF_END for each device that didn't end yet. The packets stay
+ * shared with the ring, which goes on meanwhile.
+ *
+ * Returns SR_ERR_NA if there was nothing to pass.
+ */
+static int flight_play(struct flight_recorder *fr, sr_datafeed_callback_t cb,
+		void *cb_data)
+{
+	struct sr_datafeed_packet end;
+	struct flight_entry *entry;
+	struct flight_dev *dev;
+	GPtrArray *snap;
+	GHashTable *running;
+	GList *l, *sdis;
+	unsigned int i;
+
+	snap = g_ptr_array_new();
+	g_mutex_lock(&fr->mutex);
+	for (i = 0; i < fr->devs->len; i++) {
+		dev = g_ptr_array_index(fr->devs, i);
+		if (!dev->header)
+			continue;
+		g_ptr_array_add(snap, dev->header);
+		if (dev->meta)
+			g_ptr_array_add(snap, dev->meta);
+	}
+	for (l = fr->entries->head; snap->len && l; l = l->next)
+		g_ptr_array_add(snap, l->data);
+	for (i = 0; i < snap->len; i++) {
+		entry = g_ptr_array_index(snap, i);
+		g_atomic_int_inc(&entry->refcount);
+	}
+	g_mutex_unlock(&fr->mutex);
+
+	if (!snap->len) {
+		g_ptr_array_free(snap, TRUE);
+		return SR_ERR_NA;
+	}
+
+	/* Nothing of a device after it ended. */
+	running = g_hash_table_new(NULL, NULL);
+	for (i = 0; i < snap->len; i++) {
+		entry = g_ptr_array_index(snap, i);
+		if (entry->packet->type == SR_DF_HEADER)
+			g_hash_table_add(running, (gpointer)entry->sdi);
+		if (g_hash_table_contains(running, entry->sdi)) {
+			if (entry->packet->type == SR_DF_END)
+				g_hash_table_remove(running, entry->sdi);
+			cb(entry->sdi, entry->packet, cb_data);
+		}
+		flight_entry_unref(entry);
+	}
+	end.type = SR_DF_END;
+	end.payload = NULL;
+	sdis = g_hash_table_get_keys(running);
+	for (l = sdis; l; l = l->next)
+		cb(l->data, &end, cb_data);
+	g_list_free(sdis);
+	g_hash_table_destroy(running);
+	g_ptr_array_free(snap, TRUE);
+
+	return SR_OK;
+}
+
+/**
+ * Keep the latest packets of a session in memory, like a flight recorder.
+ *
+ * The packets of the session's devices are kept in a ring holding up to
+ * the given amount of sample data, the oldest ones making room for new
+ * ones. Logic and analog packets share the drivers' buffers rather than
+ * copying them, where the drivers support that. When something of
+ * interest happened, sr_session_flight_save() or
+ * sr_session_flight_replay() take what the ring holds right then, while
+ * the acquisition goes on. Each device's SR_DF_HEADER, and its last
+ * SR_DF_META packet older than the ring, are kept as well, and a new
+ * acquisition of a device drops the packets of its last one.
+ *
+ * @param session The session. Must not be NULL.
+ * @param size The number of bytes of sample data to keep, or 0 to keep
+ *             none. Anything kept so far is dropped.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if session is NULL, SR_ERR if the
+ *         session is running, or SR_ERR_MALLOC upon memory allocation
+ *         errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_flight_recorder_set(struct sr_session *session,
+		uint64_t size)
+{
+	struct flight_recorder *fr;
+	int ret;
+
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (session->running) {
+		sr_err("Cannot change the flight recorder while running.");
+		return SR_ERR;
+	}
+
+	/* Once added, it stays among the callbacks, keeping nothing for 0. */
+	if ((fr = session->flight)) {
+		g_mutex_lock(&fr->mutex);
+		flight_drop(fr, NULL);
+		fr->max_size = size;
+		g_mutex_unlock(&fr->mutex);
+		return SR_OK;
+	}
+	if (!size)
+		return SR_OK;
+
+	if (!(fr = g_try_malloc0(sizeof(struct flight_recorder)))) {
+		sr_err("%s: fr malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	fr->session = session;
+	g_mutex_init(&fr->mutex);
+	fr->max_size = size;
+	fr->entries = g_queue_new();
+	fr->devs = g_ptr_array_new_with_free_func(flight_dev_free);
+
+	/* Keeping the packets as they were sent. */
+	if ((ret = sr_session_datafeed_callback_add_full(session,
+			flight_datafeed, fr, flight_free)) != SR_OK) {
+		flight_free(fr);
+		return ret;
+	}
+	sr_session_datafeed_callback_rle_set(session, flight_datafeed, fr,
+			TRUE);
+	sr_session_datafeed_callback_analog_raw_set(session, flight_datafeed,
+			fr, TRUE);
+	session->flight = fr;
 
 	return SR_OK;
 }
 
+/**
+ * Save what the flight recorder of a session holds to a session file.
+ *
+ * The packets are written like sr_session_record_to() would, with the
+ * same options, and the file ends where the ring did as this was called.
+ * This can be called from any thread, also while the session runs, but
+ * not from a datafeed callback.
+ *
+ * @param session The session, with a flight recorder set up with
+ *                sr_session_flight_recorder_set(). Must not be NULL.
+ * @param filename The name of the file to write. Must not be NULL.
+ * @param options The options, or NULL for the defaults.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, SR_ERR_NA
+ *         if the flight recorder holds nothing, or SR_ERR upon other
+ *         errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_flight_save(struct sr_session *session,
+		const char *filename, const char *options)
+{
+	struct session_recorder *rec;
+	int ret;
+
+	if (!session || !filename) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!session->flight)
+		return SR_ERR_NA;
+
+	if ((ret = record_new(filename, options, &rec)) != SR_OK)
+		return ret;
+	ret = flight_play(session->flight, record_datafeed, rec);
+	record_finish(rec);
+	if (ret == SR_OK)
+		ret = rec->ret;
+	record_free(rec);
+
+	return ret;
+}
+
+/**
+ * Pass what the flight recorder of a session holds to a callback.
+ *
+ * The callback gets each device's SR_DF_HEADER and last SR_DF_META packet
+ * from before the ring first, then the packets of the ring in the order
+ * they were sent, and an SR_DF_END for each device whose acquisition
+ * goes on. The packets are as the drivers sent them, SR_DF_LOGIC_RLE and
+ * SR_DF_ANALOG_RAW included. All calls are made from the calling thread
+ * before this returns, while the session goes on as usual.
+ *
+ * @param session The session, with a flight recorder set up with
+ *                sr_session_flight_recorder_set(). Must not be NULL.
+ * @param cb The function to pass the packets to. Must not be NULL.
+ * @param cb_data Passed to cb. Can be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or
+ *         SR_ERR_NA if the flight recorder holds nothing.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_session_flight_replay(struct sr_session *session,
+		sr_datafeed_callback_t cb, void *cb_data)
+{
+	if (!session || !cb) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!session->flight)
+		return SR_ERR_NA;
+
+	return flight_play(session->flight, cb, cb_data);
+}
+
 /** @} */
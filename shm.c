@@ -0,0 +1,472 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "shm: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/**
+ * @file
+ *
+ * Passing a datafeed to another process through shared memory.
+ */
+
+/**
+ * @defgroup grp_shm Shared memory transport
+ *
+ * Passing a datafeed to another process through shared memory.
+ *
+ * The producer writes the packets into a ring in a POSIX shared memory
+ * object with sr_shm_writer_packet(), and the sigrok-net driver replays
+ * them in the consumer, with conn=shm:<name>. Logic samples are copied
+ * once, into the ring, and passed on from there; waiting for the other
+ * side uses futexes on Linux.
+ *
+ * @{
+ */
+
+/* The smallest ring, so that logic frames of a useful size fit. */
+#define MIN_RING_SIZE (64 * 1024)
+
+/* How long to wait for the consumer at once, in milliseconds. */
+#define WAIT_TIMEOUT 100
+
+#define ALIGN_UP(n) (((n) + SR_SHM_ALIGN - 1) & ~(uint64_t)(SR_SHM_ALIGN - 1))
+
+extern SR_PRIV struct sr_output_format output_srnet;
+
+static void frame_header_set(uint8_t *p, int type, int flags, uint32_t len)
+{
+	p[0] = type;
+	p[1] = type >> 8;
+	p[2] = flags;
+	p[3] = flags >> 8;
+	p[4] = len;
+	p[5] = len >> 8;
+	p[6] = len >> 16;
+	p[7] = len >> 24;
+}
+
+struct sr_shm_writer {
+	char *name;
+	int fd;
+	struct sr_shm_ring *ring;
+	uint8_t *data;
+	size_t map_size;
+	/* Encodes all packets but the logic ones, which go straight in. */
+	struct sr_output *output;
+	GString *frames;
+	/* Frames dropped for lack of a consumer. */
+	uint64_t dropped;
+};
+
+/** @private */
+SR_PRIV void sr_shm_wait(uint32_t *word, uint32_t val, int timeout)
+{
+#ifdef __linux__
+	struct timespec ts;
+
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000L;
+	syscall(SYS_futex, word, FUTEX_WAIT, val, &ts, NULL, 0);
+#else
+	/* Polling, at a millisecond at most. */
+	if (__atomic_load_n(word, __ATOMIC_ACQUIRE) == val)
+		g_usleep(MIN(timeout, 1) * 1000);
+#endif
+}
+
+/** @private */
+SR_PRIV void sr_shm_wake(uint32_t *word)
+{
+	__atomic_add_fetch(word, 1, __ATOMIC_RELEASE);
+#ifdef __linux__
+	syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/**
+ * Map the ring of an existing shared memory object.
+ *
+ * @private
+ */
+SR_PRIV int sr_shm_ring_attach(const char *name, struct sr_shm_ring **ring,
+		size_t *map_size)
+{
+	struct stat st;
+	struct sr_shm_ring *r;
+	void *map;
+	int fd;
+
+	if ((fd = shm_open(name, O_RDWR, 0)) < 0) {
+		sr_err("Failed to open '%s': %s.", name, strerror(errno));
+		return SR_ERR;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < SR_SHM_DATA_OFFSET) {
+		sr_err("'%s' is no sigrok ring.", name);
+		close(fd);
+		return SR_ERR;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		sr_err("Failed to map '%s': %s.", name, strerror(errno));
+		return SR_ERR;
+	}
+
+	r = map;
+	if (memcmp(r->magic, SR_SHM_MAGIC, sizeof(r->magic))
+	    || r->size > (uint64_t)st.st_size - SR_SHM_DATA_OFFSET) {
+		sr_err("'%s' is no sigrok ring.", name);
+		munmap(map, st.st_size);
+		return SR_ERR;
+	}
+
+	*ring = r;
+	*map_size = st.st_size;
+
+	return SR_OK;
+}
+
+/** @private */
+SR_PRIV void sr_shm_ring_detach(struct sr_shm_ring *ring, size_t map_size)
+{
+	munmap(ring, map_size);
+}
+
+/*
+ * Get room for a frame of len bytes at the head of the ring, waiting for
+ * the consumer to make room. Returns NULL if there is no consumer.
+ */
+static uint8_t *ring_reserve(struct sr_shm_writer *w, uint64_t len)
+{
+	struct sr_shm_ring *ring;
+	uint64_t head, pos, skip, tail;
+	uint32_t seq;
+	uint8_t *p;
+
+	ring = w->ring;
+	len = ALIGN_UP(len);
+	for (;;) {
+		if (!__atomic_load_n(&ring->attached, __ATOMIC_ACQUIRE))
+			return NULL;
+
+		head = ring->head;
+		pos = head % ring->size;
+		skip = ring->size - pos < len ? ring->size - pos : 0;
+		seq = __atomic_load_n(&ring->tail_seq, __ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (ring->size - (head - tail) >= skip + len)
+			break;
+		sr_shm_wait(&ring->tail_seq, seq, WAIT_TIMEOUT);
+	}
+
+	if (skip) {
+		/* A frame never wraps, the consumer skips the rest. */
+		if (skip >= SRNET_FRAME_HEADER_LEN) {
+			p = w->data + pos;
+			frame_header_set(p, SRNET_PAD, 0,
+					skip - SRNET_FRAME_HEADER_LEN);
+		}
+		__atomic_store_n(&ring->head, head + skip, __ATOMIC_RELEASE);
+	}
+
+	return w->data + ring->head % ring->size;
+}
+
+static void ring_commit(struct sr_shm_writer *w, uint64_t len)
+{
+	__atomic_store_n(&w->ring->head, w->ring->head + ALIGN_UP(len),
+			__ATOMIC_RELEASE);
+	sr_shm_wake(&w->ring->head_seq);
+}
+
+/* Write a frame whose payload is the given two pieces. */
+static int frame_write(struct sr_shm_writer *w, int type, int flags,
+		const void *a, uint64_t alen, const void *b, uint64_t blen)
+{
+	uint8_t *p;
+
+	if (!(p = ring_reserve(w, SRNET_FRAME_HEADER_LEN + alen + blen))) {
+		if (!w->dropped++)
+			sr_info("No consumer attached, dropping data.");
+		return SR_OK;
+	}
+	w->dropped = 0;
+
+	frame_header_set(p, type, flags, alen + blen);
+	memcpy(p + SRNET_FRAME_HEADER_LEN, a, alen);
+	if (blen)
+		memcpy(p + SRNET_FRAME_HEADER_LEN + alen, b, blen);
+	ring_commit(w, SRNET_FRAME_HEADER_LEN + alen + blen);
+
+	return SR_OK;
+}
+
+static int logic_write(struct sr_shm_writer *w,
+		const struct sr_datafeed_logic *logic)
+{
+	const uint8_t *p;
+	uint64_t left, n, max;
+	uint8_t unitsize[2];
+	int ret;
+
+	if (!logic->unitsize)
+		return SR_ERR_ARG;
+
+	/* A quarter of the ring, so that the consumer can keep up. */
+	max = MIN(w->ring->size / 4, SRNET_MAX_FRAME / 2);
+	max = MAX(max - max % logic->unitsize, logic->unitsize);
+	unitsize[0] = logic->unitsize;
+	unitsize[1] = logic->unitsize >> 8;
+	p = logic->data;
+	for (left = logic->length; left; left -= n, p += n) {
+		n = MIN(left, max);
+		if ((ret = frame_write(w, SRNET_LOGIC, 0, unitsize, 2,
+				p, n)) != SR_OK)
+			return ret;
+	}
+
+	return SR_OK;
+}
+
+/* Keep the device frame, for consumers attaching later. */
+static void device_set(struct sr_shm_writer *w, const uint8_t *frame,
+		uint32_t len)
+{
+	if (len > SR_SHM_DEVICE_SIZE) {
+		sr_warn("Device frame of %u bytes is too large.", len);
+		return;
+	}
+
+	__atomic_store_n(&w->ring->device_len, 0, __ATOMIC_RELEASE);
+	memcpy((uint8_t *)w->ring + SR_SHM_DEVICE_OFFSET, frame, len);
+	__atomic_store_n(&w->ring->device_len, len, __ATOMIC_RELEASE);
+}
+
+/**
+ * Create a shared memory ring for passing a datafeed to another process.
+ *
+ * The ring is a POSIX shared memory object of the given name, which the
+ * consumer opens with the sigrok-net driver and conn=shm:<name>. While no
+ * consumer is attached, the packets are dropped rather than blocking the
+ * producer; otherwise sr_shm_writer_packet() waits for room in the ring.
+ *
+ * @param writer Pointer where the new writer will be stored. Must not be
+ *               NULL.
+ * @param name The name of the shared memory object, starting with a slash.
+ *             An existing one is replaced. Must not be NULL.
+ * @param size The size of the ring in bytes, at least 64k. Larger rings
+ *             bridge longer stalls of the consumer.
+ * @param sdi The device instance whose datafeed will be written. Must not
+ *            be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, or SR_ERR upon
+ *         other errors.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_shm_writer_open(struct sr_shm_writer **writer,
+		const char *name, uint64_t size, struct sr_dev_inst *sdi)
+{
+	struct sr_shm_writer *w;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_header header;
+	void *map;
+
+	if (!writer || !name || name[0] != '/' || !sdi
+	    || size < MIN_RING_SIZE || size > G_MAXSIZE - SR_SHM_DATA_OFFSET) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+	size = ALIGN_UP(size);
+
+	if (!(w = g_try_malloc0(sizeof(struct sr_shm_writer)))) {
+		sr_err("%s: writer malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	if (!(w->output = sr_output_new(&output_srnet, NULL, sdi))) {
+		g_free(w);
+		return SR_ERR;
+	}
+	w->frames = g_string_sized_new(256);
+
+	shm_unlink(name);
+	if ((w->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600)) < 0) {
+		sr_err("Failed to create '%s': %s.", name, strerror(errno));
+		sr_output_free(w->output);
+		g_string_free(w->frames, TRUE);
+		g_free(w);
+		return SR_ERR;
+	}
+	w->name = g_strdup(name);
+	w->map_size = SR_SHM_DATA_OFFSET + size;
+	map = MAP_FAILED;
+	if (ftruncate(w->fd, w->map_size) == 0)
+		map = mmap(NULL, w->map_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, w->fd, 0);
+	if (map == MAP_FAILED) {
+		sr_err("Failed to map '%s': %s.", name, strerror(errno));
+		w->ring = NULL;
+		sr_shm_writer_close(w);
+		return SR_ERR;
+	}
+
+	w->ring = map;
+	w->data = (uint8_t *)map + SR_SHM_DATA_OFFSET;
+	w->ring->size = size;
+	/* Consumers look for the magic, so that goes last. */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(w->ring->magic, SR_SHM_MAGIC, sizeof(w->ring->magic));
+
+	/*
+	 * Consumers can attach before the capture starts: the device frame
+	 * comes with a header, which goes nowhere without a consumer.
+	 */
+	header.feed_version = 1;
+	gettimeofday(&header.starttime, NULL);
+	packet.type = SR_DF_HEADER;
+	packet.payload = &header;
+	sr_shm_writer_packet(w, &packet);
+	w->dropped = 0;
+
+	*writer = w;
+
+	return SR_OK;
+}
+
+/**
+ * Write a datafeed packet to a shared memory ring.
+ *
+ * This can be called straight from a datafeed callback. Logic samples are
+ * copied into the ring as they are; all other packets are encoded in the
+ * format of the "srnet" output module. Packets only used within
+ * libsigrok, such as logic data in RLE or edges form, aren't passed on.
+ *
+ * @param writer The writer returned by sr_shm_writer_open(). Must not be
+ *               NULL.
+ * @param packet The packet. Must not be NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, or the
+ *         error of encoding the packet.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_shm_writer_packet(struct sr_shm_writer *writer,
+		const struct sr_datafeed_packet *packet)
+{
+	const uint8_t *p, *end;
+	uint32_t len;
+	int type, flags, ret;
+
+	if (!writer || !packet) {
+		sr_err("%s: invalid arguments", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (packet->type == SR_DF_LOGIC)
+		return logic_write(writer, packet->payload);
+
+	g_string_truncate(writer->frames, 0);
+	if ((ret = writer->output->format->receive(writer->output,
+			writer->output->sdi, packet, writer->frames)) != SR_OK)
+		return ret;
+
+	/* The ring itself tells the stream apart, so no magic. */
+	p = (const uint8_t *)writer->frames->str;
+	end = p + writer->frames->len;
+	if (writer->frames->len >= SRNET_MAGIC_LEN
+	    && !memcmp(p, SRNET_MAGIC, SRNET_MAGIC_LEN))
+		p += SRNET_MAGIC_LEN;
+
+	while (end - p >= SRNET_FRAME_HEADER_LEN) {
+		type = p[0] | (p[1] << 8);
+		flags = p[2] | (p[3] << 8);
+		len = p[4] | (p[5] << 8) | (p[6] << 16)
+				| ((uint32_t)p[7] << 24);
+		p += SRNET_FRAME_HEADER_LEN;
+		if (type == SRNET_DEVICE)
+			device_set(writer, p - SRNET_FRAME_HEADER_LEN,
+					SRNET_FRAME_HEADER_LEN + len);
+		if ((ret = frame_write(writer, type, flags, p, len, NULL,
+				0)) != SR_OK)
+			return ret;
+		p += len;
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Remove a shared memory ring, and free the writer.
+ *
+ * A consumer still attached keeps its mapping until it detaches.
+ *
+ * @param writer The writer returned by sr_shm_writer_open(). Must not be
+ *               NULL.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ *
+ * @since 0.3.0
+ */
+SR_API int sr_shm_writer_close(struct sr_shm_writer *writer)
+{
+	if (!writer) {
+		sr_err("%s: writer was NULL", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (writer->ring)
+		munmap(writer->ring, writer->map_size);
+	if (writer->name)
+		shm_unlink(writer->name);
+	if (writer->fd >= 0)
+		close(writer->fd);
+	sr_output_free(writer->output);
+	g_string_free(writer->frames, TRUE);
+	g_free(writer->name);
+	g_free(writer);
+
+	return SR_OK;
+}
+
+/** @} */
@@ -0,0 +1,787 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+#ifdef SR_CPU_DISPATCH_X86
+#include <immintrin.h>
+#endif
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "soft-trigger: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+/**
+ * @file
+ *
+ * Software trigger matching for drivers without (sufficient) hardware
+ * trigger support.
+ */
+
+/**
+ * @defgroup grp_soft_trigger Software trigger
+ *
+ * Software trigger matching for drivers without (sufficient) hardware
+ * trigger support.
+ *
+ * A trigger consists of up to SR_SOFT_TRIGGER_MAX_STAGES stages. Each
+ * stage is a condition on a sample: a pattern of probe levels, plus
+ * rising, falling and changing edges relative to the preceding sample.
+ * The trigger fires when consecutive samples match all stages in order.
+ *
+ * Most of the time is spent looking for a match on the first stage,
+ * which is done many samples at a time where the CPU has SSE2 or AVX2
+ * (see sr_cpu_features_get()). The later stages are checked one sample
+ * at a time.
+ *
+ * A protocol trigger instead fires on the first byte of a UART, I2C or
+ * SPI transaction. The start condition of the bus is looked for the
+ * same way, then the bits of the transaction are decoded from there.
+ *
+ * @{
+ */
+
+static inline gboolean has_edges(const struct sr_soft_trigger_stage *stage)
+{
+	return (stage->rising | stage->falling | stage->change) != 0;
+}
+
+static inline gboolean stage_match(const struct sr_soft_trigger_stage *stage,
+		uint64_t cur, uint64_t prev, gboolean have_prev)
+{
+	if ((cur & stage->mask) != stage->value)
+		return FALSE;
+
+	if (!has_edges(stage))
+		return TRUE;
+
+	/* An edge needs a sample to compare against. */
+	if (!have_prev)
+		return FALSE;
+
+	return (~prev & cur & stage->rising) == stage->rising
+		&& (prev & ~cur & stage->falling) == stage->falling
+		&& ((prev ^ cur) & stage->change) == stage->change;
+}
+
+#ifdef SR_CPU_DISPATCH_X86
+/*
+ * The body of a SIMD variant of the first stage search, for a constant
+ * unitsize of 1, 2 or 4, with vec_t and the vec_*() operations defined
+ * for its instruction set. It compares a full vector of samples at once,
+ * from sample i >= 1 on. The cmpeq variant matching the unit size sets
+ * all bytes of a matching sample, so the lowest set bit of the byte mask
+ * is at the first match. For edges, the same vector shifted back by one
+ * sample is loaded to compare against. Returns the match, or with *found
+ * FALSE, the sample to go on from one at a time.
+ */
+#define FIND_FIRST_VEC \
+	const gboolean edges = has_edges(stage); \
+	const uint64_t lanes = sizeof(vec_t) / unitsize; \
+	vec_t vmask, vvalue, vrising, vfalling, vchange, v, vprev, m; \
+	unsigned int bits; \
+	\
+	vmask = vec_set1(stage->mask); \
+	vvalue = vec_set1(stage->value); \
+	vrising = vec_set1(stage->rising); \
+	vfalling = vec_set1(stage->falling); \
+	vchange = vec_set1(stage->change); \
+	for (; i + lanes <= end; i += lanes) { \
+		v = vec_load(buf + i * unitsize); \
+		m = vec_cmpeq(vec_and(v, vmask), vvalue); \
+		if (edges) { \
+			vprev = vec_load(buf + (i - 1) * unitsize); \
+			m = vec_and(m, vec_cmpeq(vec_and(vec_andnot(vprev, \
+					v), vrising), vrising)); \
+			m = vec_and(m, vec_cmpeq(vec_and(vec_andnot(v, \
+					vprev), vfalling), vfalling)); \
+			m = vec_and(m, vec_cmpeq(vec_and(vec_xor(vprev, \
+					v), vchange), vchange)); \
+		} \
+		if ((bits = vec_movemask(m))) { \
+			*found = TRUE; \
+			return i + __builtin_ctz(bits) / unitsize; \
+		} \
+	} \
+	*found = FALSE; \
+	\
+	return i;
+
+#define vec_set1(x) (unitsize == 1 ? vec_set1_8((char)(x)) \
+	: unitsize == 2 ? vec_set1_16((short)(x)) : vec_set1_32((int)(x)))
+#define vec_cmpeq(a, b) (unitsize == 1 ? vec_cmpeq_8(a, b) \
+	: unitsize == 2 ? vec_cmpeq_16(a, b) : vec_cmpeq_32(a, b))
+
+#define FIND_FIRST_KERNEL(isa, u) \
+__attribute__((target(#isa))) \
+static uint64_t find_first_##isa##_##u( \
+		const struct sr_soft_trigger_stage *stage, const uint8_t *buf, \
+		uint64_t i, uint64_t end, gboolean *found) \
+{ \
+	const unsigned int unitsize = u; \
+	FIND_FIRST_VEC \
+}
+
+#define vec_t			__m128i
+#define vec_load(p)		_mm_loadu_si128((const __m128i *)(p))
+#define vec_and(a, b)		_mm_and_si128(a, b)
+#define vec_andnot(a, b)	_mm_andnot_si128(a, b)
+#define vec_xor(a, b)		_mm_xor_si128(a, b)
+#define vec_movemask(a)		((unsigned int)_mm_movemask_epi8(a))
+#define vec_set1_8(x)		_mm_set1_epi8(x)
+#define vec_set1_16(x)		_mm_set1_epi16(x)
+#define vec_set1_32(x)		_mm_set1_epi32(x)
+#define vec_cmpeq_8(a, b)	_mm_cmpeq_epi8(a, b)
+#define vec_cmpeq_16(a, b)	_mm_cmpeq_epi16(a, b)
+#define vec_cmpeq_32(a, b)	_mm_cmpeq_epi32(a, b)
+
+FIND_FIRST_KERNEL(sse2, 1)
+FIND_FIRST_KERNEL(sse2, 2)
+FIND_FIRST_KERNEL(sse2, 4)
+
+#undef vec_t
+#undef vec_load
+#undef vec_and
+#undef vec_andnot
+#undef vec_xor
+#undef vec_movemask
+#undef vec_set1_8
+#undef vec_set1_16
+#undef vec_set1_32
+#undef vec_cmpeq_8
+#undef vec_cmpeq_16
+#undef vec_cmpeq_32
+
+#define vec_t			__m256i
+#define vec_load(p)		_mm256_loadu_si256((const __m256i *)(p))
+#define vec_and(a, b)		_mm256_and_si256(a, b)
+#define vec_andnot(a, b)	_mm256_andnot_si256(a, b)
+#define vec_xor(a, b)		_mm256_xor_si256(a, b)
+#define vec_movemask(a)		((unsigned int)_mm256_movemask_epi8(a))
+#define vec_set1_8(x)		_mm256_set1_epi8(x)
+#define vec_set1_16(x)		_mm256_set1_epi16(x)
+#define vec_set1_32(x)		_mm256_set1_epi32(x)
+#define vec_cmpeq_8(a, b)	_mm256_cmpeq_epi8(a, b)
+#define vec_cmpeq_16(a, b)	_mm256_cmpeq_epi16(a, b)
+#define vec_cmpeq_32(a, b)	_mm256_cmpeq_epi32(a, b)
+
+FIND_FIRST_KERNEL(avx2, 1)
+FIND_FIRST_KERNEL(avx2, 2)
+FIND_FIRST_KERNEL(avx2, 4)
+
+#undef vec_t
+#undef vec_load
+#undef vec_and
+#undef vec_andnot
+#undef vec_xor
+#undef vec_movemask
+#undef vec_set1_8
+#undef vec_set1_16
+#undef vec_set1_32
+#undef vec_cmpeq_8
+#undef vec_cmpeq_16
+#undef vec_cmpeq_32
+#undef vec_set1
+#undef vec_cmpeq
+#endif
+
+/*
+ * Set by sr_soft_trigger_kernels_select(): the SIMD first stage search
+ * by log2 of the unit size 1, 2 or 4, NULL for the plain C loop only.
+ */
+static uint64_t (*find_first_vec[3])(const struct sr_soft_trigger_stage *stage,
+		const uint8_t *buf, uint64_t i, uint64_t end, gboolean *found);
+
+/**
+ * Choose the software trigger's kernels for a set of CPU features.
+ *
+ * @param features The SR_CPU_* flags of the features to use.
+ *
+ * @private
+ */
+SR_PRIV void sr_soft_trigger_kernels_select(unsigned int features)
+{
+	memset(find_first_vec, 0, sizeof(find_first_vec));
+#ifdef SR_CPU_DISPATCH_X86
+	if (features & SR_CPU_AVX2) {
+		find_first_vec[0] = find_first_avx2_1;
+		find_first_vec[1] = find_first_avx2_2;
+		find_first_vec[2] = find_first_avx2_4;
+	} else if (features & SR_CPU_SSE2) {
+		find_first_vec[0] = find_first_sse2_1;
+		find_first_vec[1] = find_first_sse2_2;
+		find_first_vec[2] = find_first_sse2_4;
+	}
+#else
+	(void)features;
+#endif
+}
+
+/*
+ * Return the index of the first sample in [start, end) matching the
+ * first stage, or end if there is none. Instantiated by unit size
+ * through find_first(), so the scalar loop loads a sample in one move.
+ */
+static inline uint64_t find_first_unit(const int unitsize,
+		const struct sr_soft_trigger *st, const uint8_t *buf,
+		uint64_t start, uint64_t end)
+{
+	const struct sr_soft_trigger_stage *stage = &st->stages[0];
+	const gboolean edges = has_edges(stage);
+	uint64_t (*vec)(const struct sr_soft_trigger_stage *stage,
+			const uint8_t *buf, uint64_t i, uint64_t end,
+			gboolean *found);
+	uint64_t i, prev;
+	gboolean found;
+
+	i = start;
+
+	/* The first sample's predecessor is from the previous buffer. */
+	if (i == 0 && i < end) {
+		if (stage_match(stage, sr_sample_load(buf, unitsize), st->prev,
+				st->have_prev))
+			return 0;
+		i++;
+	}
+
+	/* Many samples at a time, where the CPU can. */
+	vec = NULL;
+	if (unitsize == 1 || unitsize == 2 || unitsize == 4)
+		vec = find_first_vec[__builtin_ctz(unitsize)];
+	if (vec && i < end) {
+		i = vec(stage, buf, i, end, &found);
+		if (found)
+			return i;
+	}
+
+	for (; i < end; i++) {
+		prev = edges ? sr_sample_load(buf + (i - 1) * unitsize,
+				unitsize) : 0;
+		if (stage_match(stage, sr_sample_load(buf + i * unitsize,
+				unitsize), prev, TRUE))
+			return i;
+	}
+
+	return end;
+}
+
+#define FIND_FIRST(unitsize, i, st, buf, start, end) \
+	i = find_first_unit(unitsize, st, buf, start, end)
+
+static uint64_t find_first(const struct sr_soft_trigger *st,
+		const uint8_t *buf, uint64_t start, uint64_t end)
+{
+	uint64_t i;
+
+	SR_UNITSIZE_DISPATCH(st->unitsize, FIND_FIRST, i, st, buf, start, end);
+
+	return i;
+}
+
+/* A transaction may begin at sample i of the buffer. */
+static void frame_begin(struct sr_soft_trigger *st, uint64_t i)
+{
+	st->in_frame = TRUE;
+	st->bits = 0;
+	st->frame_start = i;
+	if (st->proto.type == SR_PROTOCOL_TRIGGER_UART) {
+		/* Check the start bit in its middle first, for glitches. */
+		st->num_bits = -1;
+		st->bit_pos = (i << 8) + st->bit_time / 2;
+	} else {
+		st->num_bits = 0;
+	}
+}
+
+static gboolean frame_match(const struct sr_soft_trigger *st)
+{
+	return (st->bits & st->proto.mask) == st->proto.value;
+}
+
+/*
+ * Decode a UART frame from sample *i on, with the bits sampled in their
+ * middle. Returns TRUE on a match, with *i at the stop bit. Otherwise
+ * *i is where to look for the next start bit, or num_samples if the
+ * frame goes on in the next buffer.
+ */
+static gboolean uart_decode(struct sr_soft_trigger *st, const uint8_t *buf,
+		uint64_t num_samples, uint64_t *i)
+{
+	uint64_t idx;
+	unsigned int bit;
+
+	while ((idx = st->bit_pos >> 8) < num_samples) {
+		bit = (sr_sample_load(buf + idx * st->unitsize, st->unitsize)
+			& st->proto.data) != 0;
+		*i = idx;
+		if (st->num_bits < 0 && bit) {
+			/* Not a start bit after all. */
+			st->in_frame = FALSE;
+			return FALSE;
+		}
+		if (st->num_bits == 8) {
+			st->in_frame = FALSE;
+			return bit && frame_match(st);
+		}
+		if (st->num_bits >= 0)
+			st->bits |= bit << st->num_bits;
+		st->num_bits++;
+		st->bit_pos += st->bit_time;
+	}
+	*i = num_samples;
+
+	return FALSE;
+}
+
+/*
+ * Decode an I2C or SPI transaction from sample *i on, one clock edge
+ * at a time. Returns TRUE on a match, with *i at the edge of the last
+ * bit. Otherwise *i is where to look for the next transaction.
+ */
+static gboolean sync_decode(struct sr_soft_trigger *st, const uint8_t *buf,
+		uint64_t num_samples, uint64_t *i)
+{
+	const struct sr_soft_trigger_proto *proto = &st->proto;
+	const int unitsize = st->unitsize;
+	const gboolean i2c = proto->type == SR_PROTOCOL_TRIGGER_I2C;
+	uint64_t cur, prev, edge;
+
+	for (; *i < num_samples; (*i)++) {
+		cur = sr_sample_load(buf + *i * unitsize, unitsize);
+		prev = *i ? sr_sample_load(buf + (*i - 1) * unitsize, unitsize)
+			: st->prev;
+		if (i2c && (prev & cur & proto->clock)
+		    && ((prev ^ cur) & proto->data)) {
+			/* SDA changed with SCL high: START or STOP. */
+			if (cur & proto->data) {
+				st->in_frame = FALSE;
+				return FALSE;
+			}
+			frame_begin(st, *i);
+			continue;
+		}
+		if (!i2c && (cur & proto->select)) {
+			/* Chip select went away. */
+			st->in_frame = FALSE;
+			return FALSE;
+		}
+
+		if (i2c || proto->spi_mode == 0 || proto->spi_mode == 3)
+			edge = ~prev & cur & proto->clock;
+		else
+			edge = prev & ~cur & proto->clock;
+		if (!edge)
+			continue;
+
+		st->bits = st->bits << 1 | ((cur & proto->data) != 0);
+		if (++st->num_bits == 8) {
+			st->in_frame = FALSE;
+			if (frame_match(st))
+				return TRUE;
+			(*i)++;
+			return FALSE;
+		}
+	}
+
+	return FALSE;
+}
+
+/*
+ * Look for a bus transaction whose first byte matches. The start
+ * condition of the bus is the trigger's only stage, so transactions
+ * are looked for as fast as with any other trigger; only the samples
+ * within one are decoded singly.
+ */
+static int64_t proto_scan(struct sr_soft_trigger *st, const uint8_t *buf,
+		uint64_t num_samples)
+{
+	const int unitsize = st->unitsize;
+	gboolean match;
+	uint64_t i;
+
+	i = 0;
+	while (i < num_samples) {
+		if (!st->in_frame) {
+			i = find_first(st, buf, i, num_samples);
+			if (i == num_samples)
+				break;
+			frame_begin(st, i);
+			i++;
+		}
+
+		if (st->proto.type == SR_PROTOCOL_TRIGGER_UART)
+			match = uart_decode(st, buf, num_samples, &i);
+		else
+			match = sync_decode(st, buf, num_samples, &i);
+		if (match) {
+			st->prev = sr_sample_load(buf + i * unitsize,
+					unitsize);
+			st->have_prev = TRUE;
+			return i + 1;
+		}
+	}
+
+	if (num_samples) {
+		st->prev = sr_sample_load(buf + (num_samples - 1) * unitsize,
+				unitsize);
+		st->have_prev = TRUE;
+	}
+	if (st->in_frame) {
+		st->frame_start -= num_samples;
+		st->bit_pos -= num_samples << 8;
+	}
+
+	return -1;
+}
+
+/**
+ * Create a new software trigger.
+ *
+ * @param unitsize The size of a sample in bytes, 1-8.
+ * @param stages Array of num_stages trigger conditions.
+ * @param num_stages The number of stages, 1-SR_SOFT_TRIGGER_MAX_STAGES.
+ *
+ * @return A new trigger, or NULL on error.
+ *
+ * @private
+ */
+SR_PRIV struct sr_soft_trigger *sr_soft_trigger_new(int unitsize,
+		const struct sr_soft_trigger_stage *stages, int num_stages)
+{
+	struct sr_soft_trigger *st;
+	int i;
+
+	if (unitsize < 1 || unitsize > 8) {
+		sr_err("%s: invalid unitsize %d", __func__, unitsize);
+		return NULL;
+	}
+
+	if (!stages || num_stages < 1
+	    || num_stages > SR_SOFT_TRIGGER_MAX_STAGES) {
+		sr_err("%s: invalid trigger stages", __func__);
+		return NULL;
+	}
+
+	if (!(st = g_try_malloc0(sizeof(struct sr_soft_trigger)))) {
+		sr_err("%s: st malloc failed", __func__);
+		return NULL;
+	}
+
+	st->unitsize = unitsize;
+	st->num_stages = num_stages;
+	for (i = 0; i < num_stages; i++) {
+		st->stages[i] = stages[i];
+		st->stages[i].value &= stages[i].mask;
+	}
+
+	return st;
+}
+
+/**
+ * Create a new protocol trigger.
+ *
+ * @param unitsize The size of a sample in bytes, 1-8.
+ * @param proto The bus, probe bits and byte to trigger on.
+ * @param samplerate The samplerate of the data, needed for UART only.
+ *
+ * @return A new trigger, or NULL on error.
+ *
+ * @private
+ */
+SR_PRIV struct sr_soft_trigger *sr_soft_trigger_proto_new(int unitsize,
+		const struct sr_soft_trigger_proto *proto, uint64_t samplerate)
+{
+	struct sr_soft_trigger_stage start;
+	struct sr_soft_trigger *st;
+
+	memset(&start, 0, sizeof(start));
+	switch (proto->type) {
+	case SR_PROTOCOL_TRIGGER_UART:
+		/* Fewer samples per bit can't find the middle of one. */
+		if (!proto->baudrate || samplerate / 4 < proto->baudrate) {
+			sr_err("A UART trigger at %" PRIu64 " baud needs a "
+			       "samplerate of at least four times that.",
+			       proto->baudrate);
+			return NULL;
+		}
+		start.falling = proto->data;
+		break;
+	case SR_PROTOCOL_TRIGGER_I2C:
+		/* SDA falls while SCL is high. */
+		start.mask = start.value = proto->clock;
+		start.falling = proto->data;
+		break;
+	case SR_PROTOCOL_TRIGGER_SPI:
+		start.falling = proto->select;
+		break;
+	default:
+		sr_err("%s: invalid protocol %d", __func__, proto->type);
+		return NULL;
+	}
+
+	if (!(st = sr_soft_trigger_new(unitsize, &start, 1)))
+		return NULL;
+
+	st->proto = *proto;
+	st->proto.value &= proto->mask;
+	if (proto->type == SR_PROTOCOL_TRIGGER_UART)
+		st->bit_time = (samplerate << 8) / proto->baudrate;
+
+	return st;
+}
+
+/**
+ * Free a software trigger.
+ *
+ * @param st The trigger to free. May be NULL.
+ *
+ * @private
+ */
+SR_PRIV void sr_soft_trigger_free(struct sr_soft_trigger *st)
+{
+	g_free(st);
+}
+
+/**
+ * Reset a software trigger, discarding any partial match and the
+ * previous sample edges are detected against.
+ *
+ * @param st The trigger to reset.
+ *
+ * @private
+ */
+SR_PRIV void sr_soft_trigger_reset(struct sr_soft_trigger *st)
+{
+	st->stage = 0;
+	st->have_prev = FALSE;
+	st->in_frame = FALSE;
+}
+
+/**
+ * Look for a trigger match in a buffer of samples.
+ *
+ * A partial match at the end of the buffer is carried over to the next
+ * call, as is the last sample for edge detection. Once all stages match,
+ * the samples that matched are available in st->matched (st->num_stages
+ * samples of st->unitsize bytes), and the trigger is reset so that a
+ * call on the remaining samples looks for the next match. For a protocol
+ * trigger, st->frame_start is the sample the transaction began at
+ * instead.
+ *
+ * @param st The trigger.
+ * @param buf The samples to scan.
+ * @param num_samples The number of samples in buf.
+ *
+ * @return The index of the sample following the one that completed the
+ *         match, or -1 if the trigger didn't fire in this buffer.
+ *
+ * @private
+ */
+SR_PRIV int64_t sr_soft_trigger_scan(struct sr_soft_trigger *st,
+		const uint8_t *buf, uint64_t num_samples)
+{
+	const int unitsize = st->unitsize;
+	uint64_t i, cur, prev;
+
+	if (st->proto.type)
+		return proto_scan(st, buf, num_samples);
+
+	i = 0;
+	while (i < num_samples) {
+		if (st->stage == 0) {
+			i = find_first(st, buf, i, num_samples);
+			if (i == num_samples)
+				break;
+		}
+
+		cur = sr_sample_load(buf + i * unitsize, unitsize);
+		prev = i ? sr_sample_load(buf + (i - 1) * unitsize, unitsize)
+			: st->prev;
+		if (stage_match(&st->stages[st->stage], cur, prev,
+				i ? TRUE : st->have_prev)) {
+			/* Match on this trigger stage. */
+			memcpy(st->matched + st->stage * unitsize,
+					buf + i * unitsize, unitsize);
+			if (++st->stage == st->num_stages) {
+				st->stage = 0;
+				st->prev = cur;
+				st->have_prev = TRUE;
+				return i + 1;
+			}
+			i++;
+		} else {
+			/*
+			 * We had a match before, but not on this sample.
+			 * The next stage 0 match may start at the sample
+			 * after the one that matched originally, if that
+			 * is still in this buffer.
+			 */
+			if (i >= (uint64_t)st->stage)
+				i -= st->stage - 1;
+			else
+				i = 0;
+			st->stage = 0;
+		}
+	}
+
+	if (num_samples) {
+		st->prev = sr_sample_load(buf + (num_samples - 1) * unitsize,
+				unitsize);
+		st->have_prev = TRUE;
+	}
+
+	return -1;
+}
+
+/**
+ * Turn a trigger specification into trigger stages.
+ *
+ * Character n of a probe's trigger string is the condition on that probe
+ * in stage n: '0' or '1' for a level, 'r' or 'f' for a rising or falling
+ * edge, 'c' for any change.
+ *
+ * @param sdi The device instance the triggers were parsed for.
+ * @param triggerlist The triggers, as returned by sr_parse_triggerstring().
+ * @param stages Array of SR_SOFT_TRIGGER_MAX_STAGES stages to fill in.
+ * @param num_stages Will be set to the number of stages used.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid triggers,
+ *         SR_ERR_MALLOC upon memory allocation errors.
+ *
+ * @private
+ */
+SR_PRIV int sr_soft_trigger_compile(const struct sr_dev_inst *sdi,
+		char **triggerlist, struct sr_soft_trigger_stage *stages,
+		int *num_stages)
+{
+	const struct sr_probe_table *table;
+	struct sr_probe *probe;
+	const char *tc;
+	uint64_t probe_bit;
+	int max_probes, stage, i;
+
+	memset(stages, 0, SR_SOFT_TRIGGER_MAX_STAGES * sizeof(*stages));
+	*num_stages = 0;
+
+	if (!(table = sr_dev_probe_table_get(sdi)))
+		return SR_ERR_MALLOC;
+
+	/* Only enabled probes get triggers, see sr_parse_triggerstring(). */
+	max_probes = g_slist_length(sdi->probes);
+	for (i = 0; i < table->num_enabled; i++) {
+		probe = table->probes[table->enabled[i]];
+		if (probe->index >= max_probes)
+			break;
+		if (!triggerlist[probe->index])
+			continue;
+
+		if (probe->index > 63) {
+			sr_err("Probe %s can't be used for triggering.",
+			       probe->name);
+			return SR_ERR_ARG;
+		}
+
+		probe_bit = (uint64_t)1 << probe->index;
+		for (tc = triggerlist[probe->index], stage = 0; *tc; tc++, stage++) {
+			if (stage == SR_SOFT_TRIGGER_MAX_STAGES) {
+				sr_err("Too many trigger stages.");
+				return SR_ERR_ARG;
+			}
+			switch (*tc) {
+			case '1':
+				stages[stage].value |= probe_bit;
+				/* Fall through. */
+			case '0':
+				stages[stage].mask |= probe_bit;
+				break;
+			case 'r':
+				stages[stage].rising |= probe_bit;
+				break;
+			case 'f':
+				stages[stage].falling |= probe_bit;
+				break;
+			case 'c':
+				stages[stage].change |= probe_bit;
+				break;
+			default:
+				sr_err("Unsupported trigger type '%c'.", *tc);
+				return SR_ERR_ARG;
+			}
+		}
+		*num_stages = MAX(*num_stages, stage);
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Move trigger stages to the bits of the probes in packed logic data.
+ *
+ * @param stages The stages, by probe index, as sr_soft_trigger_compile()
+ *               makes them. They are changed in place.
+ * @param num_stages The number of stages.
+ * @param probes The SR_CONF_PACKED_PROBES of the data.
+ *
+ * @private
+ */
+SR_PRIV void sr_soft_trigger_stages_pack(struct sr_soft_trigger_stage *stages,
+		int num_stages, uint64_t probes)
+{
+	struct sr_soft_trigger_stage *stage;
+	int i;
+
+	for (i = 0; i < num_stages; i++) {
+		stage = &stages[i];
+		stage->mask = sr_filter_probes_pack_mask(stage->mask, probes);
+		stage->value = sr_filter_probes_pack_mask(stage->value, probes);
+		stage->rising = sr_filter_probes_pack_mask(stage->rising,
+				probes);
+		stage->falling = sr_filter_probes_pack_mask(stage->falling,
+				probes);
+		stage->change = sr_filter_probes_pack_mask(stage->change,
+				probes);
+	}
+}
+
+/**
+ * Move the probes of a protocol trigger to their bits in packed logic
+ * data.
+ *
+ * @param proto The trigger, with the probes by index. Changed in place.
+ * @param probes The SR_CONF_PACKED_PROBES of the data.
+ *
+ * @private
+ */
+SR_PRIV void sr_soft_trigger_proto_pack(struct sr_soft_trigger_proto *proto,
+		uint64_t probes)
+{
+	proto->data = sr_filter_probes_pack_mask(proto->data, probes);
+	proto->clock = sr_filter_probes_pack_mask(proto->clock, probes);
+	proto->select = sr_filter_probes_pack_mask(proto->select, probes);
+}
+
+/** @} */
@@ -91,7 +91,13 @@ SR_PRIV int std_session_send_df_header(const struct sr_dev_inst *sdi,
 	packet.type = SR_DF_HEADER;
 	packet.payload = (uint8_t *)&header;
 	header.feed_version = 1;
-	gettimeofday(&header.starttime, NULL);
+	/* Devices started together share their start time. */
+	if (sdi && sdi->session && sdi->session->starttime.tv_sec) {
+		header.starttime.tv_sec = sdi->session->starttime.tv_sec;
+		header.starttime.tv_usec = sdi->session->starttime.tv_usec;
+	} else {
+		gettimeofday(&header.starttime, NULL);
+	}
 
 	if ((ret = sr_session_send(sdi, &packet)) < 0) {
 		sr_err("%sFailed to send header packet: %d.", prefix, ret);
@@ -101,6 +107,56 @@ SR_PRIV int std_session_send_df_header(const struct sr_dev_inst *sdi,
 	return SR_OK;
 }
 
+/**
+ * Standard API helper for telling which probes packed logic data holds.
+ *
+ * Drivers supporting SR_CONF_PROBE_PACKING call this right after sending
+ * the header, whenever they pack the data.
+ *
+ * @param sdi The device instance to use.
+ * @param probes Mask of the indices of the probes the samples hold.
+ * @param prefix A driver-specific prefix string used for log messages.
+ * 		 Must not be NULL. An empty string is allowed.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, or SR_ERR upon
+ *         other errors.
+ */
+SR_PRIV int std_session_send_df_packed_probes(const struct sr_dev_inst *sdi,
+		uint64_t probes, const char *prefix)
+{
+	int ret;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_meta meta;
+	struct sr_config *src;
+
+	if (!prefix) {
+		sr_err("Invalid prefix.");
+		return SR_ERR_ARG;
+	}
+
+	sr_dbg("%sPacking probes 0x%" PRIx64 ".", prefix, probes);
+
+	if (!(src = sr_config_new(SR_CONF_PACKED_PROBES,
+			g_variant_new_uint64(probes)))) {
+		sr_err("%s: src malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	packet.type = SR_DF_META;
+	packet.payload = &meta;
+	meta.config = g_slist_append(NULL, src);
+	ret = sr_session_send(sdi, &packet);
+	g_slist_free(meta.config);
+	sr_config_free(src);
+
+	if (ret < 0) {
+		sr_err("%sFailed to send meta packet: %d.", prefix, ret);
+		return ret;
+	}
+
+	return SR_OK;
+}
+
 #ifdef HAVE_LIBSERIALPORT
 
 /*
@@ -167,6 +223,39 @@ SR_PRIV int std_dev_acquisition_stop_serial(struct sr_dev_inst *sdi,
 
 #endif
 
+#ifdef HAVE_LIBUSB_1_0
+
+/*
+ * Standard dev_check() driver API helper for USB devices.
+ *
+ * Checks that a USB device left open by sr_dev_close() still answers,
+ * for drivers whose devices keep their setup as long as they do.
+ *
+ * @param sdi The device instance. Must not be NULL.
+ *
+ * @retval SR_OK The device is still there.
+ * @retval SR_ERR_DEV_CLOSED The device is closed, or is gone.
+ */
+SR_PRIV int std_dev_check_usb(struct sr_dev_inst *sdi)
+{
+	struct sr_usb_dev_inst *usb;
+	int config, ret;
+
+	usb = sdi->conn;
+	if (sdi->status != SR_ST_ACTIVE || !usb || !usb->devhdl)
+		return SR_ERR_DEV_CLOSED;
+
+	if ((ret = libusb_get_configuration(usb->devhdl, &config)) != 0) {
+		sr_dbg("Device left open is gone: %s.",
+		       libusb_error_name(ret));
+		return SR_ERR_DEV_CLOSED;
+	}
+
+	return SR_OK;
+}
+
+#endif
+
 /*
  * Standard driver dev_clear() helper.
  *
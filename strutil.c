@@ -27,11 +27,11 @@
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "strutil: "
 #define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
-#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
-#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
-#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
-#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
-#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
 
 /**
  * @file
@@ -202,6 +202,8 @@ SR_API char *sr_voltage_string(uint64_t v_p, uint64_t v_q)
  *        include 'r' (rising edge), 'f' (falling edge), 'c' (any pin value
  *        change), '0' (low value), or '1' (high value).
  *        Example: "1=r,sck=f,miso=0,7=c"
+ *        If the device doesn't support triggers itself, all of these
+ *        are accepted, for use with sr_session_trigger_set().
  *
  * @return Pointer to a list of trigger types (strings), or NULL upon errors.
  *         The pointer list (if non-NULL) has as many entries as the
@@ -230,12 +232,21 @@ SR_API char **sr_parse_triggerstring(const struct sr_dev_inst *sdi,
 		return NULL;
 	}
 
-	if (sdi->driver->config_list(SR_CONF_TRIGGER_TYPE,
+	/*
+	 * Without hardware triggers, the session can still trigger on the
+	 * device's data in software, see sr_session_trigger_set().
+	 */
+	gvar = NULL;
+	if (!sdi->driver || !sdi->driver->config_list
+	    || sdi->driver->config_list(SR_CONF_TRIGGER_TYPE,
 				&gvar, sdi, NULL) != SR_OK) {
-		sr_err("%s: Device doesn't support any triggers.", __func__);
-		return NULL;
+		sr_dbg("%s: Device doesn't support any triggers, using "
+		       "software triggers.", __func__);
+		gvar = NULL;
+		trigger_types = SR_SOFT_TRIGGER_TYPES;
+	} else {
+		trigger_types = g_variant_get_string(gvar, NULL);
 	}
-	trigger_types = g_variant_get_string(gvar, NULL);
 
 	tokens = g_strsplit(triggerstring, ",", max_probes);
 	for (i = 0; tokens[i]; i++) {
@@ -270,7 +281,8 @@ SR_API char **sr_parse_triggerstring(const struct sr_dev_inst *sdi,
 		}
 	}
 	g_strfreev(tokens);
-	g_variant_unref(gvar);
+	if (gvar)
+		g_variant_unref(gvar);
 
 	if (error) {
 		for (i = 0; i < max_probes; i++)
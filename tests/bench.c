@@ -0,0 +1,249 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Datafeed throughput benchmark. Runs the demo driver in free-running
+ * mode through the "probes" transform into every output module (or
+ * the one given with -o), and reports how many MB/s of logic data
+ * each pipeline handles. With -t, output modules which support it
+ * encode with that many threads. Build with "make -C tests bench".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "../libsigrok.h"
+
+static gint64 opt_samples = 16 * 1024 * 1024;
+static gint opt_unitsize = 1;
+static gint opt_bufsize = 4096;
+static gchar *opt_probes = "0,1,2,3,4,5,6,7";
+static gchar *opt_output = NULL;
+static gint opt_threads = 1;
+
+static GOptionEntry optargs[] = {
+	{"samples", 'n', 0, G_OPTION_ARG_INT64, &opt_samples,
+		"Number of samples to generate per run", NULL},
+	{"unitsize", 'u', 0, G_OPTION_ARG_INT, &opt_unitsize,
+		"Bytes per sample", NULL},
+	{"bufsize", 'b', 0, G_OPTION_ARG_INT, &opt_bufsize,
+		"Bytes per datafeed packet", NULL},
+	{"probes", 'p', 0, G_OPTION_ARG_STRING, &opt_probes,
+		"Probes the filter keeps (empty for no filter)", NULL},
+	{"output", 'o', 0, G_OPTION_ARG_STRING, &opt_output,
+		"Only benchmark this output module", NULL},
+	{"threads", 't', 0, G_OPTION_ARG_INT, &opt_threads,
+		"Threads output modules may encode with", NULL},
+	{NULL, 0, 0, 0, NULL, NULL, NULL}
+};
+
+struct bench_run {
+	struct sr_output *o;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	int ret;
+};
+
+/* Output sink which only counts the bytes it is given. */
+static int output_count(const void *buf, uint64_t len, void *cb_data)
+{
+	struct bench_run *run;
+
+	(void)buf;
+
+	run = cb_data;
+	run->bytes_out += len;
+
+	return SR_OK;
+}
+
+static void datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	struct bench_run *run;
+	const struct sr_datafeed_logic *logic;
+
+	run = cb_data;
+	if (run->ret != SR_OK)
+		return;
+
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		run->bytes_in += logic->length;
+	}
+
+	run->ret = sr_output_send(run->o, sdi, packet, output_count, run);
+}
+
+static int config_set_uint64(struct sr_dev_inst *sdi, int key, uint64_t value)
+{
+	return sr_config_set(sdi, NULL, key, g_variant_new_uint64(value));
+}
+
+static struct sr_transform_format *transform_get(const char *id)
+{
+	struct sr_transform_format **transforms;
+	int i;
+
+	transforms = sr_transform_list();
+	for (i = 0; transforms[i]; i++) {
+		if (!strcmp(transforms[i]->id, id))
+			return transforms[i];
+	}
+
+	return NULL;
+}
+
+/* Run one acquisition into the given output module, and print its rate. */
+static int bench_output(struct sr_dev_inst *sdi,
+		struct sr_output_format *format)
+{
+	struct sr_session *session;
+	struct sr_output *o;
+	struct bench_run run;
+	GHashTable *params;
+	gint64 start, elapsed;
+	int ret;
+
+	if (!(o = sr_output_new(format, NULL, sdi))) {
+		printf("%-16s init failed\n", format->id);
+		return SR_ERR;
+	}
+	/* Modules which can't encode in parallel just run with one. */
+	sr_output_threads_set(o, opt_threads);
+
+	memset(&run, 0, sizeof(run));
+	run.o = o;
+	run.ret = SR_OK;
+
+	if (!(session = sr_session_new())) {
+		ret = SR_ERR_MALLOC;
+		goto out;
+	}
+	if ((ret = sr_session_dev_add(session, sdi)) != SR_OK)
+		goto out_session;
+	if (*opt_probes) {
+		params = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(params, "probes", opt_probes);
+		ret = sr_session_transform_add(session,
+				transform_get("probes"), params);
+		g_hash_table_unref(params);
+		if (ret != SR_OK)
+			goto out_session;
+	}
+	sr_session_datafeed_callback_add(session, datafeed_in, &run);
+
+	start = g_get_monotonic_time();
+	if ((ret = sr_session_start(session)) != SR_OK)
+		goto out_session;
+	if ((ret = sr_session_run(session)) != SR_OK)
+		goto out_session;
+	elapsed = MAX(g_get_monotonic_time() - start, 1);
+
+	if ((ret = run.ret) != SR_OK)
+		printf("%-16s failed: %d\n", format->id, ret);
+	else
+		printf("%-16s %10.1f MB/s in, %10.1f MB/s out\n", format->id,
+		       (double)run.bytes_in / elapsed,
+		       (double)run.bytes_out / elapsed);
+
+out_session:
+	sr_session_destroy(session);
+out:
+	sr_output_free(o);
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	GOptionContext *context;
+	GError *error;
+	struct sr_context *sr_ctx;
+	struct sr_dev_driver **drivers, *driver;
+	struct sr_output_format **outputs;
+	struct sr_dev_inst *sdi;
+	GSList *devices;
+	int i, ret;
+
+	error = NULL;
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, optargs, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (sr_init(&sr_ctx) != SR_OK)
+		return 1;
+
+	driver = NULL;
+	drivers = sr_driver_list();
+	for (i = 0; drivers[i]; i++) {
+		if (!strcmp(drivers[i]->name, "demo"))
+			driver = drivers[i];
+	}
+	if (!driver || sr_driver_init(sr_ctx, driver) != SR_OK
+	    || !(devices = sr_driver_scan(driver, NULL))) {
+		fprintf(stderr, "The demo driver is not available.\n");
+		sr_exit(sr_ctx);
+		return 1;
+	}
+	sdi = devices->data;
+	g_slist_free(devices);
+
+	if ((ret = sr_dev_open(sdi)) == SR_OK)
+		ret = sr_config_set(sdi, NULL, SR_CONF_FREERUN,
+				g_variant_new_boolean(TRUE));
+	if (ret == SR_OK)
+		ret = config_set_uint64(sdi, SR_CONF_CAPTURE_UNITSIZE,
+				opt_unitsize);
+	if (ret == SR_OK)
+		ret = config_set_uint64(sdi, SR_CONF_BUFFERSIZE, opt_bufsize);
+	if (ret == SR_OK)
+		ret = config_set_uint64(sdi, SR_CONF_LIMIT_SAMPLES,
+				opt_samples);
+	if (ret != SR_OK) {
+		fprintf(stderr, "Failed to configure the demo device: %d.\n",
+			ret);
+		sr_exit(sr_ctx);
+		return 1;
+	}
+
+	printf("%" G_GINT64_FORMAT " samples, unit size %d, %d byte "
+	       "packets, filter '%s'\n", opt_samples, opt_unitsize,
+	       opt_bufsize, opt_probes);
+
+	ret = 0;
+	outputs = sr_output_list();
+	for (i = 0; outputs[i]; i++) {
+		if (opt_output && strcmp(outputs[i]->id, opt_output))
+			continue;
+		if (bench_output(sdi, outputs[i]) != SR_OK)
+			ret = 1;
+	}
+
+	sr_dev_close(sdi);
+	sr_exit(sr_ctx);
+
+	return ret;
+}
@@ -19,6 +19,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "../libsigrok.h"
 
@@ -28,7 +29,8 @@
  *  - Check whether an sr_init() call with a proper sr_ctx works.
  *    If it returns != SR_OK (or segfaults) this test will fail.
  *    The sr_init() call (among other things) also runs sanity checks on
- *    all libsigrok hardware drivers and errors out upon issues.
+ *    all libsigrok input and output modules and errors out upon issues.
+ *    Drivers are checked by sr_driver_init(), see check_driver_all.c.
  *
  *  - Check whether a subsequent sr_exit() with that sr_ctx works.
  *    If it returns != SR_OK (or segfaults) this test will fail.
@@ -161,6 +163,134 @@ START_TEST(test_exit_null)
 }
 END_TEST
 
+static int async_log_calls;
+static GThread *async_log_thread;
+
+static int async_log_cb(void *cb_data, int loglevel, const char *format,
+		va_list args)
+{
+	(void)cb_data;
+	(void)loglevel;
+	(void)format;
+	(void)args;
+
+	async_log_calls++;
+	async_log_thread = g_thread_self();
+
+	return SR_OK;
+}
+
+/* Check that async log messages reach the callback on another thread. */
+START_TEST(test_log_async)
+{
+	uint64_t dropped;
+	int ret;
+
+	async_log_calls = 0;
+	async_log_thread = NULL;
+	sr_log_callback_set(async_log_cb, NULL);
+	ret = sr_log_async_set(TRUE);
+	fail_unless(ret == SR_OK, "sr_log_async_set() failed: %d.", ret);
+
+	/* Setting the loglevel logs a debug message. */
+	sr_log_loglevel_set(SR_LOG_DBG);
+	sr_log_loglevel_set(SR_LOG_NONE);
+
+	ret = sr_log_async_set(FALSE);
+	fail_unless(ret == SR_OK, "sr_log_async_set() failed: %d.", ret);
+	sr_log_callback_set_default();
+
+	fail_unless(async_log_calls == 1, "Expected one message, got %d.",
+			async_log_calls);
+	fail_unless(async_log_thread != g_thread_self(),
+			"Callback ran on the logging thread.");
+	ret = sr_log_async_dropped_get(&dropped);
+	fail_unless(ret == SR_OK && dropped == 0, "Messages were dropped.");
+}
+END_TEST
+
+static int module_log_calls;
+
+static int module_log_cb(void *cb_data, int loglevel, const char *format,
+		va_list args)
+{
+	(void)cb_data;
+	(void)loglevel;
+	(void)args;
+
+	/* Count only the messages of the module under test. */
+	if (!strncmp(format, "session: ", 9))
+		module_log_calls++;
+
+	return SR_OK;
+}
+
+/* Check that a module's loglevel overrides the global one. */
+START_TEST(test_log_module)
+{
+	struct sr_session_stats *stats;
+	int ret;
+
+	module_log_calls = 0;
+	sr_log_callback_set(module_log_cb, NULL);
+	sr_log_loglevel_set(SR_LOG_NONE);
+
+	/* A NULL session is an error in the "session" module. */
+	ret = sr_log_module_loglevel_set("session", SR_LOG_ERR);
+	fail_unless(ret == SR_OK, "Setting the loglevel failed: %d.", ret);
+	fail_unless(sr_log_module_loglevel_get("session") == SR_LOG_ERR);
+	fail_unless(sr_log_module_loglevel_get("device") == SR_LOG_NONE);
+	sr_session_stats_get(NULL, &stats);
+	fail_unless(module_log_calls == 1, "Expected one message, got %d.",
+			module_log_calls);
+
+	/* Quieter than the global loglevel works as well. */
+	sr_log_loglevel_set(SR_LOG_ERR);
+	sr_log_module_loglevel_set("session", SR_LOG_NONE);
+	sr_session_stats_get(NULL, &stats);
+	fail_unless(module_log_calls == 1, "Message wasn't filtered.");
+
+	ret = sr_log_module_loglevel_unset("session");
+	fail_unless(ret == SR_OK, "Unsetting the loglevel failed: %d.", ret);
+	sr_session_stats_get(NULL, &stats);
+	fail_unless(module_log_calls == 2, "Expected two messages, got %d.",
+			module_log_calls);
+	fail_unless(sr_log_module_loglevel_unset("session") == SR_ERR_ARG);
+	fail_unless(sr_log_module_loglevel_set(NULL, SR_LOG_DBG)
+			== SR_ERR_ARG);
+
+	sr_log_loglevel_set(SR_LOG_NONE);
+	sr_log_callback_set_default();
+}
+END_TEST
+
+/* Check the settings for the scheduling of the acquisition threads. */
+START_TEST(test_thread_settings)
+{
+	struct sr_context *sr_ctx;
+	int ret, priority;
+
+	ret = sr_init(&sr_ctx);
+	fail_unless(ret == SR_OK, "sr_init() failed: %d.", ret);
+
+	fail_unless(sr_thread_priority_set(sr_ctx, -1) == SR_ERR_ARG,
+			"Negative priority accepted.");
+	ret = sr_thread_priority_set(sr_ctx, 0);
+	fail_unless(ret == SR_OK, "sr_thread_priority_set() failed: %d.", ret);
+	ret = sr_thread_priority_get(sr_ctx, &priority);
+	fail_unless(ret == SR_OK && priority == 0, "Wrong priority.");
+	fail_unless(sr_thread_affinity_set(sr_ctx, NULL, 1) == SR_ERR_ARG,
+			"Missing CPUs accepted.");
+	ret = sr_thread_affinity_set(sr_ctx, NULL, 0);
+	fail_unless(ret == SR_OK, "sr_thread_affinity_set() failed: %d.", ret);
+	ret = sr_usb_buffer_lock_set(sr_ctx, FALSE);
+	fail_unless(ret == SR_OK, "sr_usb_buffer_lock_set() failed: %d.", ret);
+
+	ret = sr_exit(sr_ctx);
+	fail_unless(ret == SR_OK, "sr_exit() failed: %d.", ret);
+}
+END_TEST
+
 Suite *suite_core(void)
 {
 	Suite *s;
@@ -176,6 +306,12 @@ Suite *suite_core(void)
 	tcase_add_test(tc, test_init_exit_3_reverse);
 	tcase_add_test(tc, test_init_null);
 	tcase_add_test(tc, test_exit_null);
+	tcase_add_test(tc, test_thread_settings);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("log");
+	tcase_add_test(tc, test_log_async);
+	tcase_add_test(tc, test_log_module);
 	suite_add_tcase(s, tc);
 
 	return s;
@@ -0,0 +1,1474 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <check.h>
+#include <glib/gstdio.h>
+#include <zlib.h>
+#include "../libsigrok.h"
+#include "lib.h"
+
+#define FILENAME "check-rle.vcd"
+#define GZ_FILENAME "check-rle.vcd.gz"
+
+/* Probe 0 is high for 10 samples, low for a long time, then high for 5. */
+static const char vcd_file[] =
+	"$timescale 1 us $end\n"
+	"$var wire 1 ! CLK $end\n"
+	"$enddefinitions $end\n"
+	"#0\n1!\n#10\n0!\n#1000000\n1!\n#1000005\n";
+
+static struct sr_context *sr_ctx;
+
+/* What the datafeed callbacks saw. */
+static uint64_t rle_samples, rle_runs, logic_samples, logic_high;
+static uint64_t edge_samples, num_edges, edge_timestamps[4];
+static uint64_t decim_samples, decim_high;
+static uint64_t chunk_samples, chunk_high, chunk_packets;
+static gboolean chunk_short;
+
+/*
+ * Check whether taking a reference on a logic payload which isn't backed
+ * by a shared buffer (as sent by most drivers) yields a private copy of
+ * the data, which stays valid after the original buffer is gone.
+ */
+START_TEST(test_logic_ref_copy)
+{
+	struct sr_datafeed_logic logic, *ref;
+	uint8_t *buf;
+
+	buf = g_try_malloc(16);
+	fail_unless(buf != NULL);
+	memset(buf, 0x55, 16);
+	logic.length = 16;
+	logic.unitsize = 2;
+	logic.data = buf;
+
+	ref = sr_datafeed_logic_ref(&logic);
+	fail_unless(ref != NULL, "sr_datafeed_logic_ref() failed.");
+	fail_unless(ref->data != logic.data, "Data was not copied.");
+	fail_unless(ref->length == 16 && ref->unitsize == 2);
+
+	memset(buf, 0, 16);
+	g_free(buf);
+	fail_unless(((uint8_t *)ref->data)[15] == 0x55, "Copy was modified.");
+
+	sr_datafeed_logic_unref(ref);
+}
+END_TEST
+
+/* Same as above, for analog payloads. */
+START_TEST(test_analog_ref_copy)
+{
+	struct sr_datafeed_analog analog, *ref;
+	struct sr_probe probe;
+	float data[4] = { 1.0, 2.0, 3.0, 4.0 };
+	int64_t timestamps[4] = { 10, 20, 30, 40 };
+
+	memset(&analog, 0, sizeof(analog));
+	analog.probes = g_slist_append(NULL, &probe);
+	analog.num_samples = 4;
+	analog.mq = SR_MQ_VOLTAGE;
+	analog.unit = SR_UNIT_VOLT;
+	analog.data = data;
+	analog.timestamps = timestamps;
+
+	ref = sr_datafeed_analog_ref(&analog);
+	fail_unless(ref != NULL, "sr_datafeed_analog_ref() failed.");
+	fail_unless(ref->data != analog.data, "Data was not copied.");
+	fail_unless(ref->probes != analog.probes, "Probes were not copied.");
+	fail_unless(ref->probes->data == &probe);
+	fail_unless(ref->timestamps != analog.timestamps,
+		    "Timestamps were not copied.");
+
+	g_slist_free(analog.probes);
+	data[3] = 0.0;
+	timestamps[3] = 0;
+	fail_unless(ref->data[3] == 4.0, "Copy was modified.");
+	fail_unless(ref->timestamps[3] == 40, "Timestamps were modified.");
+
+	sr_datafeed_analog_unref(ref);
+}
+END_TEST
+
+/*
+ * Check whether the stream parameters are decoded from META packets,
+ * including rational sample intervals, and start over at the header.
+ */
+START_TEST(test_stream_params)
+{
+	struct sr_stream_params params;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_header header;
+	struct sr_datafeed_meta meta;
+	struct sr_config rate, interval, packed;
+	GVariant *rational[2];
+	int ret;
+
+	memset(&params, 0, sizeof(params));
+	rate.key = SR_CONF_SAMPLERATE;
+	rate.data = g_variant_ref_sink(g_variant_new_uint64(SR_MHZ(1)));
+	rational[0] = g_variant_new_uint64(1);
+	rational[1] = g_variant_new_uint64(8);
+	interval.key = SR_CONF_SAMPLE_INTERVAL;
+	interval.data = g_variant_ref_sink(g_variant_new_tuple(rational, 2));
+	packed.key = SR_CONF_PACKED_PROBES;
+	packed.data = g_variant_ref_sink(g_variant_new_uint64(0x0c));
+
+	packet.type = SR_DF_META;
+	packet.payload = &meta;
+	meta.config = g_slist_append(NULL, &rate);
+	meta.config = g_slist_append(meta.config, &interval);
+	meta.config = g_slist_append(meta.config, &packed);
+	ret = sr_stream_params_update(&params, NULL, &packet);
+	fail_unless(ret == SR_OK, "sr_stream_params_update() failed: %d.",
+		    ret);
+	fail_unless(params.samplerate == SR_MHZ(1), "Wrong samplerate.");
+	fail_unless(params.sample_interval == 125, "Wrong sample interval.");
+	fail_unless(params.packed_probes == 0x0c, "Wrong packed probes.");
+	fail_unless(params.generation == 1, "Generation wasn't bumped.");
+
+	/* Other packets leave the parameters alone. */
+	packet.type = SR_DF_TRIGGER;
+	packet.payload = NULL;
+	sr_stream_params_update(&params, NULL, &packet);
+	fail_unless(params.samplerate == SR_MHZ(1) && params.generation == 1,
+		    "A trigger changed the parameters.");
+
+	packet.type = SR_DF_HEADER;
+	packet.payload = &header;
+	sr_stream_params_update(&params, NULL, &packet);
+	fail_unless(!params.samplerate && !params.sample_interval
+		    && !params.packed_probes, "The header didn't reset them.");
+	fail_unless(params.generation == 2, "Generation wasn't bumped.");
+
+	fail_unless(sr_stream_params_update(NULL, NULL, &packet) == SR_ERR_ARG);
+	fail_unless(sr_stream_params_update(&params, NULL, NULL) == SR_ERR_ARG);
+
+	g_slist_free(meta.config);
+	g_variant_unref(rate.data);
+	g_variant_unref(interval.data);
+	g_variant_unref(packed.data);
+}
+END_TEST
+
+static void setup(void)
+{
+	int ret;
+
+	ret = sr_init(&sr_ctx);
+	fail_unless(ret == SR_OK, "sr_init() failed: %d.", ret);
+}
+
+static void teardown(void)
+{
+	sr_exit(sr_ctx);
+	g_unlink(FILENAME);
+	g_unlink(GZ_FILENAME);
+}
+
+static void datafeed_rle(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic_rle *rle;
+
+	(void)sdi;
+	(void)cb_data;
+
+	fail_unless(packet->type != SR_DF_LOGIC, "Got expanded data.");
+	if (packet->type != SR_DF_LOGIC_RLE)
+		return;
+	rle = packet->payload;
+	fail_unless(rle->start_sample == rle_samples, "Wrong start sample.");
+	rle_samples += rle->num_samples;
+	rle_runs += rle->num_runs;
+}
+
+static void datafeed_logic(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	const uint8_t *samples;
+	uint64_t i;
+
+	(void)sdi;
+	(void)cb_data;
+
+	fail_unless(packet->type != SR_DF_LOGIC_RLE, "Got RLE data.");
+	if (packet->type != SR_DF_LOGIC)
+		return;
+	logic = packet->payload;
+	fail_unless(logic->unitsize == 1, "Wrong unitsize.");
+	fail_unless(logic->start_sample == logic_samples,
+			"Wrong start sample.");
+	samples = logic->data;
+	for (i = 0; i < logic->length / logic->unitsize; i++)
+		logic_high += samples[i] & 1;
+	logic_samples += logic->length / logic->unitsize;
+}
+
+static void datafeed_edges(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic_edges *edges;
+	uint64_t i;
+
+	(void)sdi;
+	(void)cb_data;
+
+	fail_unless(packet->type != SR_DF_LOGIC
+			&& packet->type != SR_DF_LOGIC_RLE, "Got sample data.");
+	if (packet->type != SR_DF_LOGIC_EDGES)
+		return;
+	edges = packet->payload;
+	fail_unless(edges->start == edge_samples, "Wrong start sample.");
+	for (i = 0; i < edges->num_edges && num_edges < 4; i++)
+		edge_timestamps[num_edges++] = edges->timestamps[i];
+	edge_samples += edges->num_samples;
+}
+
+static void datafeed_decimated(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	const uint8_t *samples;
+	uint64_t i;
+
+	(void)sdi;
+	(void)cb_data;
+
+	if (packet->type != SR_DF_LOGIC)
+		return;
+	logic = packet->payload;
+	/* Each block of 1000 samples comes out as two. */
+	fail_unless(logic->start_sample == decim_samples / 2 * 1000,
+			"Wrong start sample.");
+	samples = logic->data;
+	for (i = 0; i < logic->length / logic->unitsize; i++)
+		decim_high += samples[i] & 1;
+	decim_samples += logic->length / logic->unitsize;
+}
+
+/* The test's packet size, less than the pieces the RLE data comes in. */
+#define CHUNK_SIZE 100000
+
+static void datafeed_chunked(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	const uint8_t *samples;
+	uint64_t i;
+
+	(void)sdi;
+
+	if (packet->type != SR_DF_LOGIC)
+		return;
+	logic = packet->payload;
+	fail_unless(logic->start_sample == chunk_samples,
+			"Wrong start sample.");
+	/* Only the last packet may be short, unless cb_data allows it. */
+	fail_unless(!chunk_short || cb_data, "Short packet before the last.");
+	fail_unless(logic->length <= CHUNK_SIZE, "Packet too large.");
+	chunk_short = logic->length < CHUNK_SIZE;
+	samples = logic->data;
+	for (i = 0; i < logic->length; i++)
+		chunk_high += samples[i] & 1;
+	chunk_samples += logic->length;
+	chunk_packets++;
+}
+
+/*
+ * Check that RLE data from the VCD input reaches a callback which takes
+ * it as it is, a callback which doesn't as the same samples expanded, and
+ * one asking for edges as just the transitions.
+ */
+START_TEST(test_logic_formats)
+{
+	struct sr_session *session;
+	struct sr_input *in;
+	int ret;
+
+	fail_unless(g_file_set_contents(FILENAME, vcd_file, -1, NULL));
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("vcd");
+	ret = in->format->init(in, FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	rle_samples = rle_runs = logic_samples = logic_high = 0;
+	edge_samples = num_edges = 0;
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_rle, NULL);
+	sr_session_datafeed_callback_add(session, datafeed_logic, NULL);
+	sr_session_datafeed_callback_add(session, datafeed_edges, NULL);
+	ret = sr_session_datafeed_callback_edges_set(session, datafeed_edges,
+			NULL, TRUE);
+	fail_unless(ret == SR_OK, "Enabling edges failed: %d.", ret);
+	ret = sr_session_datafeed_callback_rle_set(session, datafeed_rle,
+			NULL, TRUE);
+	fail_unless(ret == SR_OK, "Enabling RLE failed: %d.", ret);
+	fail_unless(sr_session_datafeed_callback_rle_set(session,
+			datafeed_logic, session, TRUE) != SR_OK,
+			"Unknown callback accepted.");
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, FILENAME);
+	sr_session_destroy(session);
+
+	fail_unless(rle_runs == 3, "Expected 3 runs, got %" PRIu64 ".",
+			rle_runs);
+	fail_unless(rle_samples == 1000005, "Wrong number of RLE samples.");
+	fail_unless(logic_samples == 1000005, "Wrong number of samples.");
+	fail_unless(logic_high == 15, "Wrong sample values.");
+	fail_unless(edge_samples == 1000005, "Wrong number of edge samples.");
+	fail_unless(num_edges == 3, "Expected 3 edges, got %" PRIu64 ".",
+			num_edges);
+	fail_unless(edge_timestamps[0] == 0 && edge_timestamps[1] == 10
+			&& edge_timestamps[2] == 1000000, "Wrong edge timestamps.");
+	g_free(in);
+}
+END_TEST
+
+/*
+ * Check that a decimating callback gets the AND and OR of every block,
+ * the partial last one included, while another one gets the full data.
+ */
+START_TEST(test_logic_decimate)
+{
+	struct sr_session *session;
+	struct sr_input *in;
+	int ret;
+
+	fail_unless(g_file_set_contents(FILENAME, vcd_file, -1, NULL));
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("vcd");
+	ret = in->format->init(in, FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	logic_samples = logic_high = decim_samples = decim_high = 0;
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_logic, NULL);
+	sr_session_datafeed_callback_add(session, datafeed_decimated, NULL);
+	ret = sr_session_datafeed_callback_decimate_set(session,
+			datafeed_decimated, NULL, 1000);
+	fail_unless(ret == SR_OK, "Enabling decimation failed: %d.", ret);
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, FILENAME);
+	sr_session_destroy(session);
+
+	fail_unless(logic_samples == 1000005, "Full rate data was decimated.");
+	fail_unless(decim_samples == 2 * 1001, "Expected 2002 samples, got %"
+			PRIu64 ".", decim_samples);
+	/* Only the first block's OR, and both of the last one are high. */
+	fail_unless(decim_high == 3, "Wrong decimated values.");
+	g_free(in);
+}
+END_TEST
+
+/*
+ * Check that a callback with a preferred packet size gets the samples in
+ * packets of that size, but for the last one.
+ */
+START_TEST(test_logic_packet_size)
+{
+	struct sr_session *session;
+	struct sr_input *in;
+	int ret;
+
+	fail_unless(g_file_set_contents(FILENAME, vcd_file, -1, NULL));
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("vcd");
+	ret = in->format->init(in, FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	chunk_samples = chunk_high = chunk_packets = 0;
+	chunk_short = FALSE;
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_chunked, NULL);
+	fail_unless(sr_session_datafeed_callback_packet_size_set(session,
+			datafeed_logic, NULL, CHUNK_SIZE, 0) != SR_OK,
+			"Unknown callback accepted.");
+	ret = sr_session_datafeed_callback_packet_size_set(session,
+			datafeed_chunked, NULL, CHUNK_SIZE, 1000);
+	fail_unless(ret == SR_OK, "Setting the packet size failed: %d.", ret);
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, FILENAME);
+	sr_session_destroy(session);
+
+	fail_unless(chunk_samples == 1000005, "Wrong number of samples.");
+	fail_unless(chunk_high == 15, "Wrong sample values.");
+	fail_unless(chunk_packets == 1000005 / CHUNK_SIZE + 1,
+			"Expected %d packets, got %" PRIu64 ".",
+			1000005 / CHUNK_SIZE + 1, chunk_packets);
+	g_free(in);
+}
+END_TEST
+
+/*
+ * Check that the session's profile can be set and read back, and that the
+ * low latency profile only breaks up held back packets.
+ */
+START_TEST(test_session_profile)
+{
+	struct sr_session *session;
+	struct sr_input *in;
+	int ret, profile;
+
+	fail_unless(g_file_set_contents(FILENAME, vcd_file, -1, NULL));
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("vcd");
+	ret = in->format->init(in, FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	chunk_samples = chunk_high = chunk_packets = 0;
+	chunk_short = FALSE;
+	session = sr_session_new();
+	ret = sr_session_profile_get(session, &profile);
+	fail_unless(ret == SR_OK && profile == SR_PROFILE_DEFAULT,
+			"Wrong default profile.");
+	fail_unless(sr_session_profile_set(session, -1) == SR_ERR_ARG,
+			"Invalid profile accepted.");
+	ret = sr_session_profile_set(session, SR_PROFILE_LOW_LATENCY);
+	fail_unless(ret == SR_OK, "Setting the profile failed: %d.", ret);
+	ret = sr_session_profile_get(session, &profile);
+	fail_unless(ret == SR_OK && profile == SR_PROFILE_LOW_LATENCY,
+			"Profile not set.");
+	sr_session_datafeed_callback_add(session, datafeed_chunked, session);
+	ret = sr_session_datafeed_callback_packet_size_set(session,
+			datafeed_chunked, session, CHUNK_SIZE, 0);
+	fail_unless(ret == SR_OK, "Setting the packet size failed: %d.", ret);
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, FILENAME);
+	sr_session_destroy(session);
+
+	fail_unless(chunk_samples == 1000005, "Wrong number of samples.");
+	fail_unless(chunk_high == 15, "Wrong sample values.");
+	fail_unless(chunk_packets >= 1000005 / CHUNK_SIZE + 1,
+			"Packets were merged.");
+	fail_unless(sr_session_profile_set(NULL, SR_PROFILE_DEFAULT)
+			== SR_ERR_BUG, "NULL session accepted.");
+	g_free(in);
+}
+END_TEST
+
+/* Check that a gzip compressed VCD file is detected and loaded as such. */
+START_TEST(test_logic_compressed)
+{
+	struct sr_session *session;
+	struct sr_input *in;
+	gzFile file;
+	int ret;
+
+	file = gzopen(GZ_FILENAME, "wb");
+	fail_unless(file != NULL, "Failed to create '%s'.", GZ_FILENAME);
+	ret = gzputs(file, vcd_file);
+	fail_unless(ret == (int)strlen(vcd_file), "Failed to write file.");
+	gzclose(file);
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = sr_input_format_detect(GZ_FILENAME);
+	fail_unless(in->format == srtest_input_get("vcd"),
+			"Compressed VCD file not detected.");
+	ret = in->format->init(in, GZ_FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	logic_samples = logic_high = 0;
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_logic, NULL);
+	sr_session_dev_add(session, in->sdi);
+	ret = in->format->loadfile(in, GZ_FILENAME);
+	fail_unless(ret == SR_OK, "Loading the file failed: %d.", ret);
+	sr_session_destroy(session);
+
+	fail_unless(logic_samples == 1000005, "Wrong number of samples.");
+	fail_unless(logic_high == 15, "Wrong sample values.");
+	g_free(in);
+}
+END_TEST
+
+/*
+ * Check that a VCD file parsed by several threads, in blocks of which all
+ * but the first start without knowing the values, gives the same samples.
+ */
+START_TEST(test_logic_vcd_threads)
+{
+	struct sr_session *session;
+	struct sr_input *in;
+	GString *vcd;
+	uint64_t i, n, high;
+	int ret, t;
+
+	/* Large enough for more than one block, with probe 0 high 1 in 3. */
+	n = 500000;
+	vcd = g_string_new("$timescale 1 us $end\n"
+			"$var wire 1 ! CLK $end\n"
+			"$enddefinitions $end\n");
+	for (i = 0; i < n; i++)
+		g_string_append_printf(vcd, "#%" PRIu64 "\n%d!\n", 2 * i,
+				i % 3 == 0);
+	g_string_append_printf(vcd, "#%" PRIu64 "\n", 2 * n);
+	fail_unless(g_file_set_contents(FILENAME, vcd->str, vcd->len, NULL));
+	g_string_free(vcd, TRUE);
+	high = 2 * ((n + 2) / 3);
+
+	for (t = 1; t <= 4; t += 3) {
+		in = g_try_malloc0(sizeof(struct sr_input));
+		fail_unless(in != NULL);
+		in->format = srtest_input_get("vcd");
+		in->param = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, g_free);
+		g_hash_table_insert(in->param, g_strdup("threads"),
+				g_strdup_printf("%d", t));
+		ret = in->format->init(in, FILENAME);
+		fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+		logic_samples = logic_high = 0;
+		session = sr_session_new();
+		sr_session_datafeed_callback_add(session, datafeed_logic, NULL);
+		sr_session_dev_add(session, in->sdi);
+		ret = in->format->loadfile(in, FILENAME);
+		fail_unless(ret == SR_OK, "Loading the file failed: %d.", ret);
+		sr_session_destroy(session);
+
+		fail_unless(logic_samples == 2 * n,
+				"Wrong number of samples with %d threads.", t);
+		fail_unless(logic_high == high,
+				"Wrong sample values with %d threads.", t);
+		g_hash_table_destroy(in->param);
+		g_free(in);
+	}
+}
+END_TEST
+
+/*
+ * Check that the probes transform is found and set up from its options,
+ * and that RLE and expanded data still arrive through it.
+ */
+START_TEST(test_transform_probes)
+{
+	struct sr_session *session;
+	struct sr_transform_format **formats, *format;
+	struct sr_input *in;
+	GHashTable *params;
+	int ret, i;
+
+	format = NULL;
+	formats = sr_transform_list();
+	for (i = 0; formats[i]; i++) {
+		if (!strcmp(formats[i]->id, "probes"))
+			format = formats[i];
+	}
+	fail_unless(format != NULL, "No probes transform.");
+
+	fail_unless(g_file_set_contents(FILENAME, vcd_file, -1, NULL));
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("vcd");
+	ret = in->format->init(in, FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	rle_samples = rle_runs = logic_samples = logic_high = 0;
+	session = sr_session_new();
+	fail_unless(sr_session_transform_add(session, format, NULL) != SR_OK,
+			"Transform without probes accepted.");
+	params = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_insert(params, "probes", "CLK");
+	ret = sr_session_transform_add(session, format, params);
+	fail_unless(ret == SR_OK, "Adding the transform failed: %d.", ret);
+	g_hash_table_unref(params);
+	sr_session_datafeed_callback_add(session, datafeed_rle, NULL);
+	sr_session_datafeed_callback_add(session, datafeed_logic, NULL);
+	ret = sr_session_datafeed_callback_rle_set(session, datafeed_rle,
+			NULL, TRUE);
+	fail_unless(ret == SR_OK, "Enabling RLE failed: %d.", ret);
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, FILENAME);
+	sr_session_destroy(session);
+
+	fail_unless(rle_runs == 3, "Expected 3 runs, got %" PRIu64 ".",
+			rle_runs);
+	fail_unless(rle_samples == 1000005, "Wrong number of RLE samples.");
+	fail_unless(logic_samples == 1000005, "Wrong number of samples.");
+	fail_unless(logic_high == 15, "Wrong sample values.");
+	g_free(in);
+}
+END_TEST
+
+#define WAV_FILENAME "check-measure.wav"
+
+/* 8 kHz samples of a 100 Hz square wave from -0.5 to 0.5, for a second. */
+#define WAV_RATE 8000
+#define WAV_PERIOD 80
+
+static int num_stats;
+static gboolean stats_ok;
+static uint64_t stats_samples;
+
+static void wav_file_write(void)
+{
+	static const uint8_t header[] = {
+		'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+		'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0,
+		0x40, 0x1f, 0, 0, 0x80, 0x3e, 0, 0, 2, 0, 16, 0,
+		'd', 'a', 't', 'a', 0, 0, 0, 0,
+	};
+	uint8_t buf[sizeof(header) + 2 * WAV_RATE];
+	int16_t v;
+	int i;
+
+	memcpy(buf, header, sizeof(header));
+	buf[4] = (36 + 2 * WAV_RATE) & 0xff;
+	buf[5] = (36 + 2 * WAV_RATE) >> 8;
+	buf[40] = (2 * WAV_RATE) & 0xff;
+	buf[41] = (2 * WAV_RATE) >> 8;
+	for (i = 0; i < WAV_RATE; i++) {
+		v = (i % WAV_PERIOD) < WAV_PERIOD / 2 ? 0x4000 : -0x4000;
+		buf[sizeof(header) + 2 * i] = v & 0xff;
+		buf[sizeof(header) + 2 * i + 1] = (v >> 8) & 0xff;
+	}
+	fail_unless(g_file_set_contents(WAV_FILENAME, (const char *)buf,
+			sizeof(buf), NULL));
+}
+
+static gboolean stats_check(const struct sr_analog_stats *stats,
+		uint64_t count)
+{
+	return stats->count == count && stats->min == -0.5
+			&& stats->max == 0.5 && fabs(stats->mean) < 1e-6
+			&& fabs(stats->rms - 0.5) < 1e-6
+			&& fabs(stats->frequency - 100) < 1e-6;
+}
+
+static void datafeed_stats(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_analog_stats *stats;
+
+	(void)sdi;
+	(void)cb_data;
+
+	fail_unless(packet->type != SR_DF_ANALOG, "Got analog data.");
+	if (packet->type != SR_DF_ANALOG_STATS)
+		return;
+	stats = packet->payload;
+	fail_unless(g_slist_length(stats->probes) == 1, "Expected one probe.");
+	fail_unless(stats->start_sample == stats_samples,
+			"Wrong start sample.");
+	stats_samples += stats->window[0].count;
+	if (!stats_check(&stats->window[0], WAV_RATE / 10)
+			|| !stats_check(&stats->total[0], stats_samples))
+		stats_ok = FALSE;
+	num_stats++;
+}
+
+/*
+ * Check that the measure transform sends the statistics of each window,
+ * and of all the data so far, in place of the data.
+ */
+START_TEST(test_transform_measure)
+{
+	struct sr_session *session;
+	struct sr_transform_format **formats, *format;
+	struct sr_input *in;
+	GHashTable *params;
+	int ret, i;
+
+	format = NULL;
+	formats = sr_transform_list();
+	for (i = 0; formats[i]; i++) {
+		if (!strcmp(formats[i]->id, "measure"))
+			format = formats[i];
+	}
+	fail_unless(format != NULL, "No measure transform.");
+
+	wav_file_write();
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("wav");
+	ret = in->format->init(in, WAV_FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	num_stats = stats_samples = 0;
+	stats_ok = TRUE;
+	session = sr_session_new();
+	params = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_insert(params, "window", "0");
+	fail_unless(sr_session_transform_add(session, format, params)
+			!= SR_OK, "Empty window accepted.");
+	g_hash_table_insert(params, "window", "800");
+	g_hash_table_insert(params, "data", "drop");
+	ret = sr_session_transform_add(session, format, params);
+	fail_unless(ret == SR_OK, "Adding the transform failed: %d.", ret);
+	g_hash_table_unref(params);
+	sr_session_datafeed_callback_add(session, datafeed_stats, NULL);
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, WAV_FILENAME);
+	sr_session_destroy(session);
+	g_unlink(WAV_FILENAME);
+
+	fail_unless(num_stats == 10, "Expected 10 windows, got %d.",
+			num_stats);
+	fail_unless(stats_samples == WAV_RATE, "Wrong number of samples.");
+	fail_unless(stats_ok, "Wrong statistics.");
+	g_free(in);
+}
+END_TEST
+
+#define STEREO_FILENAME "check-planar.wav"
+#define STEREO_FRAMES 3000
+
+/* What a layout's callback saw. */
+struct layout_check {
+	gboolean planar;
+	uint64_t num_samples;
+	gboolean ok;
+};
+
+/* The left channel counts 1 to 1000 over and over, the right one -1 on. */
+static void stereo_file_write(void)
+{
+	static const uint8_t header[] = {
+		'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+		'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 2, 0,
+		0x40, 0x1f, 0, 0, 0x00, 0x7d, 0, 0, 4, 0, 16, 0,
+		'd', 'a', 't', 'a', 0, 0, 0, 0,
+	};
+	uint8_t buf[sizeof(header) + 4 * STEREO_FRAMES];
+	uint8_t *p;
+	int16_t v;
+	int i;
+
+	memcpy(buf, header, sizeof(header));
+	buf[4] = (36 + 4 * STEREO_FRAMES) & 0xff;
+	buf[5] = (36 + 4 * STEREO_FRAMES) >> 8;
+	buf[40] = (4 * STEREO_FRAMES) & 0xff;
+	buf[41] = (4 * STEREO_FRAMES) >> 8;
+	p = buf + sizeof(header);
+	for (i = 0; i < STEREO_FRAMES; i++) {
+		v = i % 1000 + 1;
+		*p++ = v & 0xff;
+		*p++ = (v >> 8) & 0xff;
+		*p++ = -v & 0xff;
+		*p++ = (-v >> 8) & 0xff;
+	}
+	fail_unless(g_file_set_contents(STEREO_FILENAME, (const char *)buf,
+			sizeof(buf), NULL));
+}
+
+static void datafeed_layout(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_analog *analog;
+	struct layout_check *check;
+	float left, right, expected;
+	int n, i;
+
+	(void)sdi;
+
+	if (packet->type != SR_DF_ANALOG)
+		return;
+	check = cb_data;
+	analog = packet->payload;
+	n = analog->num_samples;
+	for (i = 0; i < n; i++) {
+		if (check->planar) {
+			left = analog->data[i];
+			right = analog->data[n + i];
+		} else {
+			left = analog->data[2 * i];
+			right = analog->data[2 * i + 1];
+		}
+		expected = ((analog->start_sample + i) % 1000 + 1) / 32768.0;
+		if (left != expected || right != -expected)
+			check->ok = FALSE;
+	}
+	check->num_samples += n;
+}
+
+/*
+ * Check that a callback which asked for planar analog data gets it so,
+ * while another one keeps getting the same data interleaved.
+ */
+START_TEST(test_analog_planar)
+{
+	struct sr_session *session;
+	struct sr_input *in;
+	struct layout_check interleaved, planar;
+	int ret;
+
+	stereo_file_write();
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("wav");
+	ret = in->format->init(in, STEREO_FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	memset(&interleaved, 0, sizeof(interleaved));
+	interleaved.ok = TRUE;
+	planar = interleaved;
+	planar.planar = TRUE;
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_layout,
+			&interleaved);
+	sr_session_datafeed_callback_add(session, datafeed_layout, &planar);
+	ret = sr_session_datafeed_callback_planar_set(session,
+			datafeed_layout, &planar, TRUE);
+	fail_unless(ret == SR_OK, "Setting planar layout failed: %d.", ret);
+	/* Small packets, so the data is transposed more than once. */
+	ret = sr_session_datafeed_callback_packet_size_set(session,
+			datafeed_layout, &planar, 1000 * sizeof(float), 0);
+	fail_unless(ret == SR_OK, "Setting the packet size failed: %d.", ret);
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, STEREO_FILENAME);
+	sr_session_destroy(session);
+	g_unlink(STEREO_FILENAME);
+
+	fail_unless(interleaved.num_samples == STEREO_FRAMES
+		    && planar.num_samples == STEREO_FRAMES,
+		    "Wrong number of samples.");
+	fail_unless(interleaved.ok, "Wrong interleaved data.");
+	fail_unless(planar.ok, "Wrong planar data.");
+	g_free(in);
+}
+END_TEST
+
+#define BIN_FILENAME "check-logic-stats.bin"
+
+/* 16-bit samples counting up, so bit b toggles every 2^b samples. */
+#define BIN_SAMPLES 4096
+
+static struct sr_logic_stats bin_stats[16];
+
+static void datafeed_logic_stats(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic_stats *stats;
+
+	(void)sdi;
+	(void)cb_data;
+
+	fail_unless(packet->type != SR_DF_LOGIC, "Got logic data.");
+	if (packet->type != SR_DF_LOGIC_STATS)
+		return;
+	stats = packet->payload;
+	fail_unless(stats->unitsize == 2, "Wrong unitsize.");
+	fail_unless(num_stats++ == 0, "More than one window.");
+	memcpy(bin_stats, stats->total, sizeof(bin_stats));
+}
+
+/*
+ * Check the logic-stats transform's counts of each bit, with packets
+ * that don't end on a 64-bit word.
+ */
+START_TEST(test_transform_logic_stats)
+{
+	struct sr_session *session;
+	struct sr_transform_format **formats, *format;
+	struct sr_input *in;
+	GHashTable *params;
+	uint8_t buf[2 * BIN_SAMPLES];
+	uint64_t period;
+	int ret, i;
+
+	format = NULL;
+	formats = sr_transform_list();
+	for (i = 0; formats[i]; i++) {
+		if (!strcmp(formats[i]->id, "logic-stats"))
+			format = formats[i];
+	}
+	fail_unless(format != NULL, "No logic-stats transform.");
+
+	for (i = 0; i < BIN_SAMPLES; i++) {
+		buf[2 * i] = i & 0xff;
+		buf[2 * i + 1] = i >> 8;
+	}
+	fail_unless(g_file_set_contents(BIN_FILENAME, (const char *)buf,
+			sizeof(buf), NULL));
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("binary");
+	in->param = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_insert(in->param, "numprobes", "16");
+	g_hash_table_insert(in->param, "samplerate", "4096");
+	g_hash_table_insert(in->param, "blocksize", "1002");
+	ret = in->format->init(in, BIN_FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	num_stats = 0;
+	memset(bin_stats, 0, sizeof(bin_stats));
+	session = sr_session_new();
+	params = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_insert(params, "data", "drop");
+	ret = sr_session_transform_add(session, format, params);
+	fail_unless(ret == SR_OK, "Adding the transform failed: %d.", ret);
+	g_hash_table_unref(params);
+	sr_session_datafeed_callback_add(session, datafeed_logic_stats, NULL);
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, BIN_FILENAME);
+	sr_session_destroy(session);
+	g_unlink(BIN_FILENAME);
+	g_hash_table_unref(in->param);
+
+	fail_unless(num_stats == 1, "No statistics sent.");
+	for (i = 0; i < 16; i++) {
+		period = (uint64_t)1 << (i + 1);
+		fail_unless(bin_stats[i].count == BIN_SAMPLES,
+				"Wrong count of bit %d.", i);
+		if (period > BIN_SAMPLES) {
+			fail_unless(!bin_stats[i].high && !bin_stats[i].edges,
+					"Bit %d toggled.", i);
+			continue;
+		}
+		fail_unless(bin_stats[i].high == BIN_SAMPLES / 2,
+				"Wrong high count of bit %d.", i);
+		fail_unless(bin_stats[i].edges == 2 * BIN_SAMPLES / period - 1,
+				"Wrong edge count of bit %d.", i);
+		fail_unless(bin_stats[i].rising == BIN_SAMPLES / period,
+				"Wrong rising edge count of bit %d.", i);
+		fail_unless(bin_stats[i].duty_cycle == 0.5,
+				"Wrong duty cycle of bit %d.", i);
+		fail_unless(bin_stats[i].frequency == BIN_SAMPLES / period,
+				"Wrong frequency of bit %d.", i);
+	}
+	g_free(in);
+}
+END_TEST
+
+static struct sr_transform_format *transform_find(const char *id)
+{
+	struct sr_transform_format **formats;
+	int i;
+
+	formats = sr_transform_list();
+	for (i = 0; formats[i]; i++) {
+		if (!strcmp(formats[i]->id, id))
+			return formats[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Check that the deglitch transform drops the one-sample pulses of bit 0,
+ * and keeps the edges of all other bits, as counted by logic-stats.
+ */
+START_TEST(test_transform_deglitch)
+{
+	struct sr_session *session;
+	struct sr_transform_format *deglitch, *logic_stats;
+	struct sr_input *in;
+	GHashTable *params;
+	uint8_t buf[2 * BIN_SAMPLES];
+	uint64_t period;
+	int ret, i;
+
+	deglitch = transform_find("deglitch");
+	fail_unless(deglitch != NULL, "No deglitch transform.");
+	logic_stats = transform_find("logic-stats");
+	fail_unless(logic_stats != NULL, "No logic-stats transform.");
+
+	for (i = 0; i < BIN_SAMPLES; i++) {
+		buf[2 * i] = i & 0xff;
+		buf[2 * i + 1] = i >> 8;
+	}
+	fail_unless(g_file_set_contents(BIN_FILENAME, (const char *)buf,
+			sizeof(buf), NULL));
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("binary");
+	in->param = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_insert(in->param, "numprobes", "16");
+	g_hash_table_insert(in->param, "blocksize", "1002");
+	ret = in->format->init(in, BIN_FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	num_stats = 0;
+	memset(bin_stats, 0, sizeof(bin_stats));
+	session = sr_session_new();
+	params = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_insert(params, "width", "0");
+	fail_unless(sr_session_transform_add(session, deglitch, params)
+			!= SR_OK, "Width 0 accepted.");
+	g_hash_table_insert(params, "width", "2");
+	ret = sr_session_transform_add(session, deglitch, params);
+	fail_unless(ret == SR_OK, "Adding the transform failed: %d.", ret);
+	g_hash_table_remove(params, "width");
+	g_hash_table_insert(params, "data", "drop");
+	ret = sr_session_transform_add(session, logic_stats, params);
+	fail_unless(ret == SR_OK, "Adding the transform failed: %d.", ret);
+	g_hash_table_unref(params);
+	sr_session_datafeed_callback_add(session, datafeed_logic_stats, NULL);
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, BIN_FILENAME);
+	sr_session_destroy(session);
+	g_unlink(BIN_FILENAME);
+	g_hash_table_unref(in->param);
+
+	fail_unless(num_stats == 1, "No statistics sent.");
+	fail_unless(!bin_stats[0].edges, "Glitches on bit 0 kept.");
+	for (i = 1; i < 16; i++) {
+		period = (uint64_t)1 << (i + 1);
+		if (period > BIN_SAMPLES)
+			continue;
+		fail_unless(bin_stats[i].edges == 2 * BIN_SAMPLES / period - 1,
+				"Wrong edge count of bit %d.", i);
+	}
+	g_free(in);
+}
+END_TEST
+
+static uint64_t decim_rate;
+
+static void datafeed_decimate(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_meta *meta;
+	const struct sr_datafeed_logic *logic;
+	const struct sr_config *src;
+	const uint8_t *data;
+	uint64_t i, v;
+	gboolean *logic_or;
+
+	(void)sdi;
+	logic_or = cb_data;
+
+	if (packet->type == SR_DF_META) {
+		meta = packet->payload;
+		src = meta->config->data;
+		if (src->key == SR_CONF_SAMPLERATE)
+			decim_rate = g_variant_get_uint64(src->data);
+	} else if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		fail_unless(logic->start_sample == decim_samples,
+				"Wrong start sample.");
+		data = logic->data;
+		for (i = 0; i < logic->length / 2; i++, decim_samples++) {
+			v = data[2 * i] | (data[2 * i + 1] << 8);
+			fail_unless(v == (4 * decim_samples
+					| (*logic_or ? 3 : 0)),
+					"Wrong sample %" PRIu64 ".",
+					decim_samples);
+		}
+	}
+}
+
+/*
+ * Check that the decimate transform keeps every fourth sample, or the OR
+ * of every four, and sends the new samplerate.
+ */
+START_TEST(test_transform_decimate)
+{
+	struct sr_session *session;
+	struct sr_transform_format *format;
+	struct sr_input *in;
+	GHashTable *params;
+	uint8_t buf[2 * BIN_SAMPLES];
+	gboolean logic_or;
+	int ret, i;
+
+	format = transform_find("decimate");
+	fail_unless(format != NULL, "No decimate transform.");
+
+	for (i = 0; i < BIN_SAMPLES; i++) {
+		buf[2 * i] = i & 0xff;
+		buf[2 * i + 1] = i >> 8;
+	}
+	fail_unless(g_file_set_contents(BIN_FILENAME, (const char *)buf,
+			sizeof(buf), NULL));
+
+	for (logic_or = FALSE; logic_or <= TRUE; logic_or++) {
+		in = g_try_malloc0(sizeof(struct sr_input));
+		fail_unless(in != NULL);
+		in->format = srtest_input_get("binary");
+		in->param = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(in->param, "numprobes", "16");
+		g_hash_table_insert(in->param, "samplerate", "4096");
+		g_hash_table_insert(in->param, "blocksize", "1002");
+		ret = in->format->init(in, BIN_FILENAME);
+		fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+		decim_samples = decim_rate = 0;
+		session = sr_session_new();
+		params = g_hash_table_new(g_str_hash, g_str_equal);
+		fail_unless(sr_session_transform_add(session, format, params)
+				!= SR_OK, "Transform without a rate accepted.");
+		g_hash_table_insert(params, "samplerate", "1024");
+		if (logic_or)
+			g_hash_table_insert(params, "logic", "or");
+		ret = sr_session_transform_add(session, format, params);
+		fail_unless(ret == SR_OK, "Adding the transform failed: %d.",
+				ret);
+		g_hash_table_unref(params);
+		sr_session_datafeed_callback_add(session, datafeed_decimate,
+				&logic_or);
+		sr_session_dev_add(session, in->sdi);
+		in->format->loadfile(in, BIN_FILENAME);
+		sr_session_destroy(session);
+		g_hash_table_unref(in->param);
+		g_free(in);
+
+		fail_unless(decim_rate == 1024, "Wrong samplerate sent.");
+		fail_unless(decim_samples == BIN_SAMPLES / 4,
+				"Wrong number of samples.");
+	}
+	g_unlink(BIN_FILENAME);
+}
+END_TEST
+
+#define RAW_FILENAME "check-analog.raw"
+#define RAW_SAMPLES 1000
+#define RAW_RATE 1000
+
+static int raw_samples;
+static uint64_t raw_rate;
+static gboolean raw_ok;
+
+static int raw_sink(const void *buf, uint64_t len, void *cb_data)
+{
+	g_string_append_len(cb_data, buf, len);
+
+	return SR_OK;
+}
+
+static void datafeed_analog_raw(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_analog *analog;
+	const struct sr_datafeed_meta *meta;
+	const struct sr_config *src;
+	int i;
+
+	(void)sdi;
+	(void)cb_data;
+
+	if (packet->type == SR_DF_META) {
+		meta = packet->payload;
+		src = meta->config->data;
+		if (src->key == SR_CONF_SAMPLERATE)
+			raw_rate = g_variant_get_uint64(src->data);
+	} else if (packet->type == SR_DF_ANALOG) {
+		analog = packet->payload;
+		if (analog->unit != SR_UNIT_VOLT
+		    || g_slist_length(analog->probes) != 2)
+			raw_ok = FALSE;
+		for (i = 0; i < analog->num_samples; i++, raw_samples++) {
+			if (analog->data[2 * i] != raw_samples
+			    || analog->data[2 * i + 1] != -raw_samples)
+				raw_ok = FALSE;
+		}
+	}
+}
+
+/* Write two probes' samples with the analog-raw output, and load them. */
+static void analog_raw_check(const char *param)
+{
+	struct sr_output *o;
+	struct sr_input *in;
+	struct sr_session *session;
+	struct sr_dev_inst sdi;
+	struct sr_probe probes[2];
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_header header;
+	struct sr_datafeed_meta meta;
+	struct sr_datafeed_analog analog;
+	struct sr_config src;
+	struct sr_probe *probe;
+	GString *out;
+	float data[2 * RAW_SAMPLES];
+	int ret, i;
+
+	memset(&sdi, 0, sizeof(sdi));
+	memset(probes, 0, sizeof(probes));
+	for (i = 0; i < 2; i++) {
+		probes[i].index = i;
+		probes[i].type = SR_PROBE_ANALOG;
+		probes[i].enabled = TRUE;
+		probes[i].name = i ? "CH2" : "CH1";
+		sdi.probes = g_slist_append(sdi.probes, &probes[i]);
+	}
+	for (i = 0; i < RAW_SAMPLES; i++) {
+		data[2 * i] = i;
+		data[2 * i + 1] = -i;
+	}
+
+	o = sr_output_new(srtest_output_get("analog-raw"), param, &sdi);
+	fail_unless(o != NULL, "sr_output_new() failed.");
+	out = g_string_new(NULL);
+	memset(&header, 0, sizeof(header));
+	packet.type = SR_DF_HEADER;
+	packet.payload = &header;
+	ret = sr_output_send(o, &sdi, &packet, raw_sink, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	src.key = SR_CONF_SAMPLERATE;
+	src.data = g_variant_ref_sink(g_variant_new_uint64(RAW_RATE));
+	meta.config = g_slist_append(NULL, &src);
+	packet.type = SR_DF_META;
+	packet.payload = &meta;
+	ret = sr_output_send(o, &sdi, &packet, raw_sink, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	g_slist_free(meta.config);
+	g_variant_unref(src.data);
+	/* In two packets, to get two blocks of planes. */
+	memset(&analog, 0, sizeof(analog));
+	analog.probes = sdi.probes;
+	analog.unit = SR_UNIT_VOLT;
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	for (i = 0; i < 2; i++) {
+		analog.num_samples = RAW_SAMPLES / 2;
+		analog.data = data + i * RAW_SAMPLES;
+		ret = sr_output_send(o, &sdi, &packet, raw_sink, out);
+		fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	}
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	ret = sr_output_send(o, &sdi, &packet, raw_sink, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	ret = sr_output_flush(o, raw_sink, out);
+	fail_unless(ret == SR_OK, "sr_output_flush() failed: %d.", ret);
+	sr_output_free(o);
+	g_slist_free(sdi.probes);
+	fail_unless(g_file_set_contents(RAW_FILENAME, out->str, out->len,
+			NULL));
+	g_string_free(out, TRUE);
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = sr_input_format_detect(RAW_FILENAME);
+	fail_unless(in->format == srtest_input_get("analog-raw"),
+			"The file wasn't detected.");
+	ret = in->format->init(in, RAW_FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+	fail_unless(g_slist_length(in->sdi->probes) == 2, "Wrong probes.");
+	probe = in->sdi->probes->next->data;
+	fail_unless(!strcmp(probe->name, "CH2"), "Wrong probe name.");
+
+	raw_samples = 0;
+	raw_rate = 0;
+	raw_ok = TRUE;
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_analog_raw, NULL);
+	sr_session_dev_add(session, in->sdi);
+	ret = in->format->loadfile(in, RAW_FILENAME);
+	fail_unless(ret == SR_OK, "Loading failed: %d.", ret);
+	sr_session_destroy(session);
+	g_unlink(RAW_FILENAME);
+
+	fail_unless(raw_samples == RAW_SAMPLES, "Got %d samples.",
+			raw_samples);
+	fail_unless(raw_rate == RAW_RATE, "Wrong samplerate.");
+	fail_unless(raw_ok, "Wrong samples.");
+	g_free(in);
+}
+
+/* Check that analog samples survive the trip through a raw file. */
+START_TEST(test_analog_raw_file)
+{
+	analog_raw_check(NULL);
+	analog_raw_check("planar");
+}
+END_TEST
+
+/* Check that the packets sent and the callbacks' calls get counted. */
+START_TEST(test_session_stats)
+{
+	struct sr_session *session;
+	struct sr_session_stats *stats;
+	struct sr_input *in;
+	uint64_t calls;
+	int ret, i;
+
+	fail_unless(g_file_set_contents(FILENAME, vcd_file, -1, NULL));
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("vcd");
+	ret = in->format->init(in, FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	logic_samples = logic_high = 0;
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_logic, NULL);
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, FILENAME);
+
+	ret = sr_session_stats_get(session, &stats);
+	fail_unless(ret == SR_OK, "sr_session_stats_get() failed: %d.", ret);
+	fail_unless(stats->num_devs == 1, "Expected one device.");
+	fail_unless(stats->devs[0].sdi == in->sdi, "Wrong device.");
+	fail_unless(stats->devs[0].packets > 0, "No packets counted.");
+	fail_unless(stats->devs[0].bytes > 0, "No data counted.");
+	fail_unless(stats->devs[0].frames == 0, "Frames counted without any.");
+	fail_unless(stats->num_callbacks == 1, "Expected one callback.");
+	fail_unless(stats->callbacks[0].cb == datafeed_logic, "Wrong callback.");
+	fail_unless(stats->callbacks[0].calls > 0, "No calls counted.");
+	calls = 0;
+	for (i = 0; i < SR_STATS_HISTOGRAM_SIZE; i++)
+		calls += stats->callbacks[0].histogram[i];
+	fail_unless(calls == stats->callbacks[0].calls,
+			"Histogram doesn't add up.");
+	g_free(stats);
+
+	sr_session_destroy(session);
+	g_free(in);
+}
+END_TEST
+
+static void limit_check(uint64_t limit_samples, uint64_t limit_msec,
+		uint64_t expected, uint64_t expected_high)
+{
+	struct sr_session *session;
+	struct sr_input *in;
+	int ret;
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("vcd");
+	ret = in->format->init(in, FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+	in->sdi->limit_samples = limit_samples;
+	in->sdi->limit_msec = limit_msec;
+
+	logic_samples = logic_high = 0;
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_logic, NULL);
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, FILENAME);
+	fail_unless(logic_samples == expected, "Expected %" PRIu64
+			" samples, got %" PRIu64 ".", expected, logic_samples);
+	fail_unless(logic_high == expected_high, "Wrong data.");
+
+	sr_session_destroy(session);
+	g_free(in);
+}
+
+/* Check that the session cuts a device's data off right at its limits. */
+START_TEST(test_limits)
+{
+	fail_unless(g_file_set_contents(FILENAME, vcd_file, -1, NULL));
+
+	limit_check(500000, 0, 500000, 10);
+	limit_check(1000002, 0, 1000002, 12);
+	limit_check(0, 0, 1000005, 15);
+	/* At 1 MHz, from the file's timescale. */
+	limit_check(0, 100, 100000, 10);
+	limit_check(200000, 100, 100000, 10);
+}
+END_TEST
+
+/* Check that the packets can be pulled from a packet queue, in order. */
+START_TEST(test_packet_queue)
+{
+	struct sr_session *session;
+	struct sr_input *in;
+	const struct sr_dev_inst *sdi;
+	struct sr_datafeed_packet *packet;
+	const struct sr_datafeed_logic *logic;
+	uint64_t samples;
+	int ret, num_packets, last_type;
+
+	fail_unless(g_file_set_contents(FILENAME, vcd_file, -1, NULL));
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+	in->format = srtest_input_get("vcd");
+	ret = in->format->init(in, FILENAME);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	logic_samples = logic_high = 0;
+	session = sr_session_new();
+	ret = sr_session_packet_next(session, 0, &sdi, &packet);
+	fail_unless(ret == SR_ERR_NA, "Pulled without a queue: %d.", ret);
+	ret = sr_session_packet_queue_set(session, 1024);
+	fail_unless(ret == SR_OK, "Setting up the queue failed: %d.", ret);
+	sr_session_datafeed_callback_add(session, datafeed_logic, NULL);
+	sr_session_dev_add(session, in->sdi);
+	in->format->loadfile(in, FILENAME);
+
+	samples = 0;
+	num_packets = 0;
+	last_type = -1;
+	while (sr_session_packet_next(session, 0, &sdi, &packet) == SR_OK) {
+		fail_unless(sdi == in->sdi, "Packet from the wrong device.");
+		if (!num_packets++)
+			fail_unless(packet->type == SR_DF_HEADER,
+					"The header didn't come first.");
+		if (packet->type == SR_DF_LOGIC) {
+			logic = packet->payload;
+			samples += logic->length / logic->unitsize;
+		}
+		last_type = packet->type;
+		sr_session_packet_free(packet);
+	}
+	fail_unless(last_type == SR_DF_END, "The end didn't come last.");
+	fail_unless(samples == logic_samples, "Got %" PRIu64 " samples, "
+			"the callback %" PRIu64 ".", samples, logic_samples);
+	ret = sr_session_packet_next(session, 10, &sdi, &packet);
+	fail_unless(ret == SR_ERR_TIMEOUT, "Empty queue didn't time out.");
+
+	sr_session_destroy(session);
+	g_free(in);
+}
+END_TEST
+
+Suite *suite_datafeed(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("datafeed");
+
+	tc = tcase_create("ref");
+	tcase_add_test(tc, test_logic_ref_copy);
+	tcase_add_test(tc, test_analog_ref_copy);
+	tcase_add_test(tc, test_stream_params);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("formats");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_logic_formats);
+	tcase_add_test(tc, test_logic_decimate);
+	tcase_add_test(tc, test_logic_packet_size);
+	tcase_add_test(tc, test_session_profile);
+	tcase_add_test(tc, test_logic_compressed);
+	tcase_add_test(tc, test_logic_vcd_threads);
+	tcase_add_test(tc, test_transform_probes);
+	tcase_add_test(tc, test_transform_measure);
+	tcase_add_test(tc, test_analog_planar);
+	tcase_add_test(tc, test_transform_logic_stats);
+	tcase_add_test(tc, test_transform_deglitch);
+	tcase_add_test(tc, test_transform_decimate);
+	tcase_add_test(tc, test_session_stats);
+	tcase_add_test(tc, test_packet_queue);
+	tcase_add_test(tc, test_limits);
+	tcase_add_test(tc, test_analog_raw_file);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -19,6 +19,8 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 #include <check.h>
 #include "../libsigrok.h"
 #include "lib.h"
@@ -77,6 +79,550 @@ START_TEST(test_config_get_set_samplerate)
 END_TEST
 #endif
 
+/*
+ * Check whether batched config gets and sets work, and whether cached
+ * values are dropped when a key is set.
+ */
+START_TEST(test_config_multi_cache)
+{
+	struct sr_dev_driver *driver;
+	struct sr_dev_inst *sdi;
+	GSList *devices;
+	GVariant *data[3];
+	int keys[3], ret;
+
+	driver = srtest_driver_get("demo");
+	srtest_driver_init(sr_ctx, driver);
+	devices = sr_driver_scan(driver, NULL);
+	fail_unless(devices != NULL, "No demo device found.");
+	sdi = devices->data;
+	g_slist_free(devices);
+	ret = sr_dev_open(sdi);
+	fail_unless(ret == SR_OK, "sr_dev_open() failed: %d.", ret);
+	ret = sr_config_cache_set(sdi, TRUE);
+	fail_unless(ret == SR_OK, "sr_config_cache_set() failed: %d.", ret);
+
+	keys[0] = SR_CONF_SAMPLERATE;
+	keys[1] = SR_CONF_LIMIT_SAMPLES;
+	data[0] = g_variant_new_uint64(SR_KHZ(19));
+	data[1] = g_variant_new_uint64(1000);
+	ret = sr_config_set_multi(sdi, NULL, keys, data, 2);
+	fail_unless(ret == SR_OK, "sr_config_set_multi() failed: %d.", ret);
+
+	/* The demo driver doesn't know the last key. */
+	keys[2] = -1;
+	ret = sr_config_get_multi(driver, sdi, NULL, keys, data, 3);
+	fail_unless(ret == 2, "Expected two values, got %d.", ret);
+	fail_unless(g_variant_get_uint64(data[0]) == SR_KHZ(19));
+	fail_unless(g_variant_get_uint64(data[1]) == 1000);
+	fail_unless(data[2] == NULL, "Unknown key was read.");
+	g_variant_unref(data[0]);
+	g_variant_unref(data[1]);
+
+	ret = sr_config_set(sdi, NULL, SR_CONF_SAMPLERATE,
+			g_variant_new_uint64(SR_KHZ(20)));
+	fail_unless(ret == SR_OK, "sr_config_set() failed: %d.", ret);
+	ret = sr_config_get(driver, sdi, NULL, SR_CONF_SAMPLERATE, &data[0]);
+	fail_unless(ret == SR_OK, "sr_config_get() failed: %d.", ret);
+	fail_unless(g_variant_get_uint64(data[0]) == SR_KHZ(20),
+			"Got a stale cached samplerate.");
+	g_variant_unref(data[0]);
+
+	sr_dev_close(sdi);
+}
+END_TEST
+
+/* Check that a device kept open stays open over sr_dev_close(). */
+START_TEST(test_dev_keep_open)
+{
+	struct sr_dev_driver *driver;
+	struct sr_dev_inst *sdi;
+	GSList *devices;
+	int ret;
+
+	driver = srtest_driver_get("demo");
+	srtest_driver_init(sr_ctx, driver);
+	devices = sr_driver_scan(driver, NULL);
+	fail_unless(devices != NULL, "No demo device found.");
+	sdi = devices->data;
+	g_slist_free(devices);
+
+	ret = sr_dev_keep_open(sdi, TRUE);
+	fail_unless(ret == SR_OK, "sr_dev_keep_open() failed: %d.", ret);
+	ret = sr_dev_open(sdi);
+	fail_unless(ret == SR_OK, "sr_dev_open() failed: %d.", ret);
+	ret = sr_dev_close(sdi);
+	fail_unless(ret == SR_OK, "sr_dev_close() failed: %d.", ret);
+	fail_unless(sdi->status == SR_ST_ACTIVE, "Device was closed.");
+
+	/* Reopening reuses the device as it is. */
+	ret = sr_dev_open(sdi);
+	fail_unless(ret == SR_OK, "Reopening failed: %d.", ret);
+	ret = sr_dev_close(sdi);
+	fail_unless(ret == SR_OK, "sr_dev_close() failed: %d.", ret);
+
+	ret = sr_dev_keep_open(sdi, FALSE);
+	fail_unless(ret == SR_OK, "sr_dev_keep_open() failed: %d.", ret);
+	fail_unless(sdi->status == SR_ST_INACTIVE, "Device was left open.");
+	fail_unless(sr_dev_keep_open(NULL, TRUE) == SR_ERR_ARG,
+			"NULL device accepted.");
+}
+END_TEST
+
+static void dev_opened(struct sr_dev_inst *sdi, int ret, void *cb_data)
+{
+	fail_unless(ret == SR_OK, "Opening failed: %d.", ret);
+	fail_unless(sdi->status == SR_ST_ACTIVE, "Device wasn't opened.");
+	(*(int *)cb_data)++;
+}
+
+/* Check that opening devices all at once reports each of them. */
+START_TEST(test_dev_open_all)
+{
+	struct sr_dev_driver *driver;
+	GSList *devices, *l;
+	int opened, ret;
+
+	driver = srtest_driver_get("demo");
+	srtest_driver_init(sr_ctx, driver);
+	devices = sr_driver_scan(driver, NULL);
+	fail_unless(devices != NULL, "No demo device found.");
+
+	opened = 0;
+	ret = sr_dev_open_all(devices, dev_opened, &opened);
+	fail_unless(ret == SR_OK, "sr_dev_open_all() failed: %d.", ret);
+	fail_unless(opened == (int)g_slist_length(devices),
+			"Callback called %d times.", opened);
+	fail_unless(sr_dev_open_all(NULL, dev_opened, &opened) == SR_OK);
+
+	for (l = devices; l; l = l->next)
+		sr_dev_close(l->data);
+	g_slist_free(devices);
+}
+END_TEST
+
+/* The devices of test_dev_threads, and the samples each one sent. */
+static const struct sr_dev_inst *thread_devs[2];
+static uint64_t thread_samples[2];
+static int thread_ends;
+
+static void dev_threads_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	int i;
+
+	(void)cb_data;
+
+	for (i = 0; i < 2 && thread_devs[i] != sdi; i++);
+	fail_unless(i < 2, "Packet from an unknown device.");
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		thread_samples[i] += logic->length / logic->unitsize;
+	} else if (packet->type == SR_DF_END) {
+		thread_ends++;
+	}
+}
+
+/* Check that the devices of a session each run on their own thread. */
+START_TEST(test_dev_threads)
+{
+	struct sr_dev_driver *driver;
+	struct sr_session *session;
+	struct sr_dev_inst *sdi;
+	GSList *devices;
+	gboolean enable;
+	int ret, i;
+
+	driver = srtest_driver_get("demo");
+	srtest_driver_init(sr_ctx, driver);
+	session = sr_session_new();
+	for (i = 0; i < 2; i++) {
+		devices = sr_driver_scan(driver, NULL);
+		fail_unless(devices != NULL, "No demo device found.");
+		thread_devs[i] = sdi = devices->data;
+		g_slist_free(devices);
+		sr_dev_open(sdi);
+		ret = sr_config_set(sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+				g_variant_new_uint64(1000));
+		fail_unless(ret == SR_OK, "Setting the limit failed: %d.", ret);
+		sr_session_dev_add(session, sdi);
+	}
+	sr_session_datafeed_callback_add(session, dev_threads_datafeed_in,
+			NULL);
+	ret = sr_session_dev_threads_set(session, TRUE);
+	fail_unless(ret == SR_OK, "Enabling device threads failed: %d.", ret);
+	sr_session_dev_threads_get(session, &enable);
+	fail_unless(enable, "Device threads not enabled.");
+
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	for (i = 0; i < 2; i++)
+		fail_unless(thread_samples[i] == 1000,
+				"Device %d sent %" PRIu64 " samples.", i,
+				thread_samples[i]);
+	fail_unless(thread_ends == 2, "%d ends seen.", thread_ends);
+
+	sr_session_destroy(session);
+}
+END_TEST
+
+/* The samples and ends test_session_attach saw. */
+static uint64_t attach_samples;
+static int attach_ends;
+
+static void attach_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+
+	(void)sdi;
+	(void)cb_data;
+
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		attach_samples += logic->length / logic->unitsize;
+	} else if (packet->type == SR_DF_END) {
+		attach_ends++;
+	}
+}
+
+/* Check that a session runs from the application's GLib main context. */
+START_TEST(test_session_attach)
+{
+	struct sr_dev_driver *driver;
+	struct sr_session *session;
+	struct sr_dev_inst *sdi;
+	GMainContext *context;
+	GSList *devices;
+	int ret;
+
+	driver = srtest_driver_get("demo");
+	srtest_driver_init(sr_ctx, driver);
+	session = sr_session_new();
+	devices = sr_driver_scan(driver, NULL);
+	fail_unless(devices != NULL, "No demo device found.");
+	sdi = devices->data;
+	g_slist_free(devices);
+	sr_dev_open(sdi);
+	ret = sr_config_set(sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+			g_variant_new_uint64(1000));
+	fail_unless(ret == SR_OK, "Setting the limit failed: %d.", ret);
+	sr_session_dev_add(session, sdi);
+	sr_session_datafeed_callback_add(session, attach_datafeed_in, NULL);
+
+	context = g_main_context_new();
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_attach(session, context);
+	fail_unless(ret == SR_OK, "sr_session_attach() failed: %d.", ret);
+	ret = sr_session_attach(session, context);
+	fail_unless(ret != SR_OK, "Attaching twice succeeded.");
+	while (!attach_ends)
+		g_main_context_iteration(context, TRUE);
+	fail_unless(attach_samples == 1000, "%" PRIu64 " samples seen.",
+			attach_samples);
+
+	sr_session_destroy(session);
+	g_main_context_unref(context);
+}
+END_TEST
+
+/* Check that a device's memory limit keeps its acquisition from starting. */
+START_TEST(test_mem_limit)
+{
+	struct sr_dev_driver *driver;
+	struct sr_session *session;
+	struct sr_session_stats *stats;
+	struct sr_dev_inst *sdi;
+	GSList *devices;
+	uint64_t used, peak;
+	int ret;
+
+	driver = srtest_driver_get("demo");
+	srtest_driver_init(sr_ctx, driver);
+	session = sr_session_new();
+	devices = sr_driver_scan(driver, NULL);
+	fail_unless(devices != NULL, "No demo device found.");
+	sdi = devices->data;
+	g_slist_free(devices);
+	sr_dev_open(sdi);
+	ret = sr_config_set(sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+			g_variant_new_uint64(1000));
+	fail_unless(ret == SR_OK, "Setting the limit failed: %d.", ret);
+	sr_session_dev_add(session, sdi);
+
+	ret = sr_dev_mem_limit_set(sdi, 1);
+	fail_unless(ret == SR_OK, "sr_dev_mem_limit_set() failed: %d.", ret);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_ERR_MALLOC, "Started beyond the limit: %d.", ret);
+	sr_dev_mem_get(sdi, &used, &peak);
+	fail_unless(used == 0, "%" PRIu64 " bytes left in use.", used);
+
+	/* Without the limit, the memory is accounted while running. */
+	sr_dev_mem_limit_set(sdi, 0);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	ret = sr_session_stats_get(session, &stats);
+	fail_unless(ret == SR_OK, "sr_session_stats_get() failed: %d.", ret);
+	fail_unless(stats->mem_used == 0, "%" PRIu64 " bytes left in use.",
+			stats->mem_used);
+	fail_unless(stats->mem_peak > 0, "No memory use seen.");
+	fail_unless(stats->num_devs == 1 && stats->devs[0].mem_peak
+			== stats->mem_peak, "Device peak doesn't match.");
+	g_free(stats);
+
+	/* The session's own limit applies to all its devices together. */
+	ret = sr_session_mem_limit_set(session, 1);
+	fail_unless(ret == SR_OK, "sr_session_mem_limit_set() failed: %d.",
+			ret);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_ERR_MALLOC, "Started beyond the limit: %d.", ret);
+	fail_unless(sr_session_mem_limit_set(NULL, 0) == SR_ERR_BUG);
+	fail_unless(sr_dev_mem_limit_set(NULL, 0) == SR_ERR_ARG);
+
+	sr_session_destroy(session);
+}
+END_TEST
+
+/* The samples and ends each callback of test_dispatch_fanout saw. */
+static uint64_t fanout_samples[3];
+static int fanout_ends[3];
+
+static void fanout_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	int i;
+
+	(void)sdi;
+
+	i = GPOINTER_TO_INT(cb_data);
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		fanout_samples[i] += logic->length / logic->unitsize;
+		/* The last one is slow, the others must not be held up. */
+		if (i == 2)
+			g_usleep(100);
+	} else if (packet->type == SR_DF_END) {
+		fanout_ends[i]++;
+	}
+}
+
+/*
+ * Check that threaded dispatch delivers everything to every callback,
+ * through a queue much shorter than the acquisition, when it blocks.
+ */
+START_TEST(test_dispatch_fanout)
+{
+	struct sr_dev_driver *driver;
+	struct sr_session *session;
+	struct sr_dev_inst *sdi;
+	GSList *devices;
+	uint64_t overruns;
+	gboolean block;
+	int ret, i;
+
+	driver = srtest_driver_get("demo");
+	srtest_driver_init(sr_ctx, driver);
+	session = sr_session_new();
+	devices = sr_driver_scan(driver, NULL);
+	fail_unless(devices != NULL, "No demo device found.");
+	sdi = devices->data;
+	g_slist_free(devices);
+	sr_dev_open(sdi);
+	/* Many small packets, as fast as they can be made. */
+	sr_config_set(sdi, NULL, SR_CONF_FREERUN, g_variant_new_boolean(TRUE));
+	sr_config_set(sdi, NULL, SR_CONF_BUFFERSIZE, g_variant_new_uint64(64));
+	ret = sr_config_set(sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+			g_variant_new_uint64(100000));
+	fail_unless(ret == SR_OK, "Setting the limit failed: %d.", ret);
+	sr_session_dev_add(session, sdi);
+	for (i = 0; i < 3; i++)
+		sr_session_datafeed_callback_add(session, fanout_datafeed_in,
+				GINT_TO_POINTER(i));
+
+	sr_session_threaded_dispatch_set(session, TRUE);
+	ret = sr_session_dispatch_blocking_set(session, TRUE);
+	fail_unless(ret == SR_OK, "Enabling blocking failed: %d.", ret);
+	sr_session_dispatch_blocking_get(session, &block);
+	fail_unless(block, "Blocking not enabled.");
+	fail_unless(sr_session_dispatch_blocking_get(session, NULL)
+			== SR_ERR_ARG);
+
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	for (i = 0; i < 3; i++) {
+		fail_unless(fanout_samples[i] == 100000,
+				"Callback %d got %" PRIu64 " samples.", i,
+				fanout_samples[i]);
+		fail_unless(fanout_ends[i] == 1, "Callback %d saw %d ends.",
+				i, fanout_ends[i]);
+	}
+	sr_session_queue_stats_get(session, &overruns, NULL);
+	fail_unless(overruns == 0, "%" PRIu64 " overruns.", overruns);
+
+	sr_session_destroy(session);
+}
+END_TEST
+
+static void timing_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	(void)sdi;
+	(void)cb_data;
+
+	if (packet->type == SR_DF_LOGIC)
+		g_usleep(10);
+}
+
+/*
+ * Check that stage timing charges the datafeed callbacks for the samples
+ * they see and the time they take, and reports on them.
+ */
+START_TEST(test_stage_timing)
+{
+	struct sr_dev_driver *driver;
+	struct sr_session *session;
+	struct sr_session_stats *stats;
+	struct sr_dev_inst *sdi;
+	GSList *devices;
+	gboolean enable;
+	char *report;
+	int ret;
+
+	driver = srtest_driver_get("demo");
+	srtest_driver_init(sr_ctx, driver);
+	session = sr_session_new();
+	devices = sr_driver_scan(driver, NULL);
+	fail_unless(devices != NULL, "No demo device found.");
+	sdi = devices->data;
+	g_slist_free(devices);
+	sr_dev_open(sdi);
+	ret = sr_config_set(sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+			g_variant_new_uint64(1000));
+	fail_unless(ret == SR_OK, "Setting the limit failed: %d.", ret);
+	sr_session_dev_add(session, sdi);
+	sr_session_datafeed_callback_add(session, timing_datafeed_in, NULL);
+
+	fail_unless(sr_session_stage_report(session) == NULL,
+			"Report without stage timing.");
+	ret = sr_session_stage_timing_set(session, TRUE);
+	fail_unless(ret == SR_OK, "Enabling stage timing failed: %d.", ret);
+	sr_session_stage_timing_get(session, &enable);
+	fail_unless(enable, "Stage timing not enabled.");
+	fail_unless(sr_session_stage_timing_get(session, NULL) == SR_ERR_ARG);
+	fail_unless(sr_session_stage_timing_set(NULL, TRUE) == SR_ERR_BUG);
+
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	ret = sr_session_stats_get(session, &stats);
+	fail_unless(ret == SR_OK, "sr_session_stats_get() failed: %d.", ret);
+	fail_unless(stats->run_us > 0, "No run time.");
+	fail_unless(stats->num_callbacks == 1, "%u callbacks.",
+			stats->num_callbacks);
+	fail_unless(stats->callbacks[0].samples == 1000,
+			"Callback charged for %" PRIu64 " samples.",
+			stats->callbacks[0].samples);
+	fail_unless(stats->callbacks[0].self_us > 0, "No callback time.");
+	fail_unless(stats->callbacks[0].self_us
+			<= stats->callbacks[0].total_us,
+			"More time in the callback than spent on it.");
+	g_free(stats);
+
+	report = sr_session_stage_report(session);
+	fail_unless(report != NULL, "No report.");
+	fail_unless(strstr(report, "callback:1") != NULL,
+			"Callback missing from the report.");
+	g_free(report);
+
+	sr_session_destroy(session);
+}
+END_TEST
+
+/* The devices test_scan_async was told about. */
+static GSList *scan_devs;
+
+static void scan_found(struct sr_dev_inst *sdi, void *cb_data)
+{
+	struct sr_scan **scan;
+
+	scan_devs = g_slist_append(scan_devs, sdi);
+	/* Cancel from the callback, if asked to. */
+	if ((scan = cb_data))
+		sr_scan_cancel(*scan);
+}
+
+/*
+ * Check that a scan of several ports reports the devices found on each,
+ * passes the options on, and stops reporting once cancelled.
+ */
+START_TEST(test_scan_async)
+{
+	struct sr_dev_driver *driver;
+	struct sr_scan *scan;
+	struct sr_config src;
+	GSList *options, *l;
+	const char *ports[] = {"port-a", "port-b", "port-c", NULL};
+	const char *no_ports[] = {NULL};
+	int ret;
+
+	driver = srtest_driver_get("demo");
+	srtest_driver_init(sr_ctx, driver);
+	src.key = SR_CONF_NUM_LOGIC_PROBES;
+	src.data = g_variant_ref_sink(g_variant_new_uint64(3));
+	options = g_slist_append(NULL, &src);
+
+	ret = sr_driver_scan_async(driver, ports, options, scan_found, NULL,
+			&scan);
+	fail_unless(ret == SR_OK, "sr_driver_scan_async() failed: %d.", ret);
+	ret = sr_scan_wait(scan, 0);
+	fail_unless(ret == SR_OK, "sr_scan_wait() failed: %d.", ret);
+	sr_scan_free(scan);
+	fail_unless(g_slist_length(scan_devs) == 3, "%d devices reported.",
+			g_slist_length(scan_devs));
+	for (l = scan_devs; l; l = l->next) {
+		fail_unless(g_slist_length(((struct sr_dev_inst *)
+				l->data)->probes) == 3, "Options not used.");
+		fail_unless(g_slist_find(sr_dev_list(driver), l->data) != NULL,
+				"Device not in the driver's list.");
+	}
+	g_slist_free(scan_devs);
+	scan_devs = NULL;
+
+	/* The demo driver is run one port at a time, so one gets through. */
+	ret = sr_driver_scan_async(driver, ports, options, scan_found, &scan,
+			&scan);
+	fail_unless(ret == SR_OK, "sr_driver_scan_async() failed: %d.", ret);
+	sr_scan_wait(scan, 0);
+	sr_scan_free(scan);
+	fail_unless(g_slist_length(scan_devs) == 1, "%d devices reported.",
+			g_slist_length(scan_devs));
+	g_slist_free(scan_devs);
+	scan_devs = NULL;
+
+	fail_unless(sr_driver_scan_async(driver, no_ports, NULL, scan_found,
+			NULL, &scan) == SR_ERR_ARG);
+	fail_unless(sr_driver_scan_async(driver, ports, NULL, NULL, NULL,
+			&scan) == SR_ERR_ARG);
+	fail_unless(sr_driver_scan_async(NULL, ports, NULL, scan_found,
+			NULL, &scan) == SR_ERR_ARG);
+	fail_unless(sr_scan_wait(NULL, 0) == SR_ERR_ARG);
+	fail_unless(sr_scan_free(NULL) == SR_ERR_ARG);
+
+	g_slist_free(options);
+	g_variant_unref(src.data);
+}
+END_TEST
+
 Suite *suite_driver_all(void)
 {
 	Suite *s;
@@ -88,6 +634,15 @@ Suite *suite_driver_all(void)
 	tcase_add_checked_fixture(tc, setup, teardown);
 	tcase_add_test(tc, test_driver_available);
 	tcase_add_test(tc, test_driver_init_all);
+	tcase_add_test(tc, test_config_multi_cache);
+	tcase_add_test(tc, test_dev_keep_open);
+	tcase_add_test(tc, test_dev_open_all);
+	tcase_add_test(tc, test_dev_threads);
+	tcase_add_test(tc, test_session_attach);
+	tcase_add_test(tc, test_mem_limit);
+	tcase_add_test(tc, test_dispatch_fanout);
+	tcase_add_test(tc, test_stage_timing);
+	tcase_add_test(tc, test_scan_async);
 	// TODO: Currently broken.
 	// tcase_add_test(tc, test_config_get_set_samplerate);
 	suite_add_tcase(s, tc);
@@ -0,0 +1,296 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "../libsigrok.h"
+
+#define BUFSIZE 512
+
+/* Straightforward bit-by-bit version of what sr_filter_probes() does. */
+static void filter_ref(unsigned int in_unitsize, unsigned int out_unitsize,
+		const int *probes, int num_probes, const uint8_t *in,
+		uint64_t length, uint8_t *out)
+{
+	uint64_t offset;
+	int i;
+
+	for (offset = 0; offset + in_unitsize <= length; offset += in_unitsize) {
+		memset(out, 0, out_unitsize);
+		for (i = 0; i < num_probes; i++)
+			if (in[offset + probes[i] / 8] & (1 << (probes[i] % 8)))
+				out[i / 8] |= 1 << (i % 8);
+		out += out_unitsize;
+	}
+}
+
+static GArray *probe_array_new(const int *probes, int num_probes)
+{
+	GArray *probe_array;
+
+	probe_array = g_array_new(FALSE, FALSE, sizeof(int));
+	g_array_append_vals(probe_array, probes, num_probes);
+
+	return probe_array;
+}
+
+/*
+ * Check the example given in the sr_filter_probes() documentation, with
+ * the plain C kernels first, then with those for the CPU.
+ */
+START_TEST(test_filter_example)
+{
+	const int probes[] = { 5, 16, 30 };
+	GArray *probe_array;
+	uint8_t in[8], *out;
+	uint64_t length_out;
+	int ret;
+
+	sr_cpu_features_limit(_i ? ~0u : 0);
+	fail_unless(_i || sr_cpu_features_get() == 0, "Features not limited.");
+	/* Probes 5 and 30 high in the first sample, 16 in the second. */
+	memset(in, 0, sizeof(in));
+	in[0] = 1 << 5;
+	in[3] = 1 << 6;
+	in[6] = 1 << 0;
+
+	probe_array = probe_array_new(probes, 3);
+	ret = sr_filter_probes(4, 1, probe_array, in, sizeof(in), &out,
+			&length_out);
+	fail_unless(ret == SR_OK, "sr_filter_probes() failed: %d.", ret);
+	fail_unless(length_out == 2, "Wrong output length.");
+	fail_unless(out[0] == 0x05 && out[1] == 0x02, "Wrong output.");
+	g_free(out);
+	g_array_free(probe_array, TRUE);
+	sr_cpu_features_limit(~0u);
+}
+END_TEST
+
+/*
+ * Check random probe selections (including high probes and arbitrary
+ * order) against the reference, both with a separate output buffer and
+ * in place, with the plain C kernels first, then with those for the CPU.
+ */
+START_TEST(test_filter_random)
+{
+	GArray *probe_array;
+	uint8_t in[BUFSIZE], out[BUFSIZE * 8], expected[BUFSIZE * 8];
+	unsigned int in_unitsize, out_unitsize;
+	uint64_t length_out;
+	int probes[64], num_probes, ret, i, j;
+
+	sr_cpu_features_limit(_i ? ~0u : 0);
+	fail_unless(_i || sr_cpu_features_get() == 0, "Features not limited.");
+	srand(1);
+	for (i = 0; i < 1000; i++) {
+		in_unitsize = 1 + rand() % 8;
+		out_unitsize = 1 + rand() % 8;
+		num_probes = 1 + rand() % (MIN(in_unitsize, out_unitsize) * 8);
+		if (num_probes == (int)in_unitsize * 8)
+			num_probes--;
+		for (j = 0; j < num_probes; j++)
+			probes[j] = i % 2 ? rand() % (in_unitsize * 8)
+					: j * in_unitsize * 8 / num_probes;
+		for (j = 0; j < BUFSIZE; j++)
+			in[j] = rand();
+
+		probe_array = probe_array_new(probes, num_probes);
+		filter_ref(in_unitsize, out_unitsize, probes, num_probes,
+				in, BUFSIZE, expected);
+
+		ret = sr_filter_probes_buf(in_unitsize, out_unitsize,
+				probe_array, in, BUFSIZE, out, &length_out);
+		fail_unless(ret == SR_OK, "sr_filter_probes_buf() failed: %d.", ret);
+		fail_unless(length_out == BUFSIZE / in_unitsize * out_unitsize,
+				"Wrong output length.");
+		fail_unless(!memcmp(out, expected, length_out), "Wrong output.");
+
+		if (out_unitsize <= in_unitsize) {
+			memcpy(out, in, BUFSIZE);
+			ret = sr_filter_probes_buf(in_unitsize, out_unitsize,
+					probe_array, out, BUFSIZE, out, &length_out);
+			fail_unless(ret == SR_OK);
+			fail_unless(!memcmp(out, expected, length_out),
+					"Wrong in-place output.");
+		}
+
+		g_array_free(probe_array, TRUE);
+	}
+	sr_cpu_features_limit(~0u);
+}
+END_TEST
+
+/* Same as above, for samples wider than 64 bits. */
+START_TEST(test_filter_wide)
+{
+	GArray *probe_array;
+	uint8_t in[BUFSIZE], out[BUFSIZE], expected[BUFSIZE];
+	unsigned int in_unitsize, out_unitsize;
+	uint64_t length_out;
+	int probes[256], num_probes, ret, i, j;
+
+	srand(2);
+	for (i = 0; i < 200; i++) {
+		in_unitsize = 9 + rand() % 24;
+		out_unitsize = 1 + rand() % in_unitsize;
+		num_probes = 1 + rand() % (out_unitsize * 8);
+		if (num_probes == (int)in_unitsize * 8)
+			num_probes--;
+		for (j = 0; j < num_probes; j++)
+			probes[j] = i % 2 ? rand() % (in_unitsize * 8)
+					: j * in_unitsize * 8 / num_probes;
+		for (j = 0; j < BUFSIZE; j++)
+			in[j] = rand();
+
+		probe_array = probe_array_new(probes, num_probes);
+		filter_ref(in_unitsize, out_unitsize, probes, num_probes,
+				in, BUFSIZE, expected);
+
+		ret = sr_filter_probes_buf(in_unitsize, out_unitsize,
+				probe_array, in, BUFSIZE, out, &length_out);
+		fail_unless(ret == SR_OK, "sr_filter_probes_buf() failed: %d.", ret);
+		fail_unless(length_out == BUFSIZE / in_unitsize * out_unitsize,
+				"Wrong output length.");
+		fail_unless(!memcmp(out, expected, length_out), "Wrong output.");
+
+		memcpy(out, in, BUFSIZE);
+		ret = sr_filter_probes_buf(in_unitsize, out_unitsize,
+				probe_array, out, BUFSIZE, out, &length_out);
+		fail_unless(ret == SR_OK);
+		fail_unless(!memcmp(out, expected, length_out),
+				"Wrong in-place output.");
+
+		g_array_free(probe_array, TRUE);
+	}
+}
+END_TEST
+
+/*
+ * Check that sr_filter_probes() makes room for output samples wider than
+ * the input ones, and rejects input which isn't whole samples.
+ */
+START_TEST(test_filter_widen)
+{
+	const int probes[] = { 7, 0, 3 };
+	GArray *probe_array;
+	uint8_t in[BUFSIZE], expected[BUFSIZE * 4], *out;
+	uint64_t length_out;
+	int ret, i;
+
+	for (i = 0; i < BUFSIZE; i++)
+		in[i] = i * 7;
+	probe_array = probe_array_new(probes, 3);
+	filter_ref(1, 4, probes, 3, in, BUFSIZE, expected);
+
+	ret = sr_filter_probes(1, 4, probe_array, in, BUFSIZE, &out,
+			&length_out);
+	fail_unless(ret == SR_OK, "sr_filter_probes() failed: %d.", ret);
+	fail_unless(length_out == BUFSIZE * 4, "Wrong output length.");
+	fail_unless(!memcmp(out, expected, length_out), "Wrong output.");
+	g_free(out);
+
+	ret = sr_filter_probes(2, 4, probe_array, in, BUFSIZE - 1, &out,
+			&length_out);
+	fail_unless(ret == SR_ERR_ARG, "Partial sample was accepted.");
+	g_array_free(probe_array, TRUE);
+}
+END_TEST
+
+/* Check whether invalid probe selections are rejected. */
+START_TEST(test_filter_invalid)
+{
+	const int probes[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+	GArray *probe_array;
+	uint8_t in[4], out[4];
+	uint64_t length_out;
+	int ret;
+
+	memset(in, 0, sizeof(in));
+
+	/* More probes than fit into the output. */
+	probe_array = probe_array_new(probes, 9);
+	ret = sr_filter_probes_buf(2, 1, probe_array, in, 4, out, &length_out);
+	fail_unless(ret == SR_ERR_ARG, "Too many probes were accepted.");
+	g_array_free(probe_array, TRUE);
+
+	/* A probe the input doesn't have. */
+	probe_array = probe_array_new(probes + 8, 1);
+	ret = sr_filter_probes_buf(1, 1, probe_array, in, 4, out, &length_out);
+	fail_unless(ret == SR_ERR_ARG, "Invalid probe was accepted.");
+	g_array_free(probe_array, TRUE);
+}
+END_TEST
+
+/*
+ * Check that probes are found where packed data has them, and that data
+ * packed like that is what filtering to the same probes gives, with the
+ * plain C kernels first, then with those for the CPU.
+ */
+START_TEST(test_filter_pack_mask)
+{
+	const int probes[] = { 2, 9 };
+	GArray *probe_array;
+	uint8_t in[4], out[2];
+	uint64_t length_out;
+	int ret;
+
+	sr_cpu_features_limit(_i ? ~0u : 0);
+	fail_unless(_i || sr_cpu_features_get() == 0, "Features not limited.");
+	fail_unless(sr_filter_probes_pack_mask(0x0204, 0x0206) == 0x6,
+			"Wrong packed mask.");
+	fail_unless(sr_filter_probes_pack_mask(0x0001, 0x0206) == 0,
+			"Probe which isn't packed got a bit.");
+	fail_unless(sr_filter_probes_pack_mask(~(uint64_t)0, 0x8000000000000001)
+			== 0x3, "Wrong mask of all probes.");
+
+	/* Probes 2 and 9 high, then only probe 9 high. */
+	in[0] = 0x04;
+	in[1] = 0x02;
+	in[2] = 0x01;
+	in[3] = 0x02;
+	probe_array = probe_array_new(probes, 2);
+	ret = sr_filter_probes_buf(2, 1, probe_array, in, 4, out, &length_out);
+	fail_unless(ret == SR_OK, "Filtering failed: %d.", ret);
+	fail_unless(length_out == 2, "Wrong output length.");
+	fail_unless(out[0] == sr_filter_probes_pack_mask(0x0204, 0x0204)
+			&& out[1] == sr_filter_probes_pack_mask(0x0200, 0x0204),
+			"Packed probes don't match the filter's output.");
+	g_array_free(probe_array, TRUE);
+	sr_cpu_features_limit(~0u);
+}
+END_TEST
+
+Suite *suite_filter(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("filter");
+
+	tc = tcase_create("probes");
+	tcase_add_loop_test(tc, test_filter_example, 0, 2);
+	tcase_add_loop_test(tc, test_filter_random, 0, 2);
+	tcase_add_test(tc, test_filter_wide);
+	tcase_add_test(tc, test_filter_widen);
+	tcase_add_test(tc, test_filter_invalid);
+	tcase_add_loop_test(tc, test_filter_pack_mask, 0, 2);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
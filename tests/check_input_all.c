@@ -18,7 +18,10 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <check.h>
 #include "../libsigrok.h"
 #include "lib.h"
@@ -33,6 +36,46 @@ START_TEST(test_input_available)
 }
 END_TEST
 
+static void write_file(const char *filename, const void *buf, size_t len)
+{
+	FILE *f;
+
+	f = fopen(filename, "wb");
+	fail_unless(f != NULL, "Failed to create '%s'.", filename);
+	fail_unless(fwrite(buf, 1, len, f) == len, "Failed to write.");
+	fclose(f);
+}
+
+/* Check that files are matched to the right module from their header. */
+START_TEST(test_input_detect)
+{
+	/* 16-bit mono PCM, with an empty data chunk. */
+	static const uint8_t wav[] = {
+		'R', 'I', 'F', 'F', 36, 0, 0, 0, 'W', 'A', 'V', 'E',
+		'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0,
+		0x40, 0x1f, 0, 0, 0x80, 0x3e, 0, 0, 2, 0, 16, 0,
+		'd', 'a', 't', 'a', 0, 0, 0, 0,
+	};
+	static const char vcd[] = "$date today $end\n$timescale 1 us $end\n";
+	struct sr_input_format *format;
+
+	write_file("check-input-detect.wav", wav, sizeof(wav));
+	format = sr_input_format_detect("check-input-detect.wav");
+	unlink("check-input-detect.wav");
+	fail_unless(format && !strcmp(format->id, "wav"),
+			"WAV file not detected.");
+
+	write_file("check-input-detect.vcd", vcd, strlen(vcd));
+	format = sr_input_format_detect("check-input-detect.vcd");
+	unlink("check-input-detect.vcd");
+	fail_unless(format && !strcmp(format->id, "vcd"),
+			"VCD file not detected.");
+
+	format = sr_input_format_detect("check-input-detect.none");
+	fail_unless(format == NULL, "Missing file was detected.");
+}
+END_TEST
+
 Suite *suite_input_all(void)
 {
 	Suite *s;
@@ -42,6 +85,7 @@ Suite *suite_input_all(void)
 
 	tc = tcase_create("basic");
 	tcase_add_test(tc, test_input_available);
+	tcase_add_test(tc, test_input_detect);
 	suite_add_tcase(s, tc);
 
 	return s;
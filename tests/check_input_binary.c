@@ -29,6 +29,7 @@
 #define CHECK_ALL_LOW		0
 #define CHECK_ALL_HIGH		1
 #define CHECK_HELLO_WORLD	2
+#define CHECK_RANGE		3
 
 static struct sr_context *sr_ctx;
 
@@ -38,6 +39,8 @@ static GArray *logic_probelist = NULL;
 static int check_to_perform;
 static uint64_t expected_samples;
 static uint64_t *expected_samplerate;
+static uint64_t range_start;
+static uint64_t range_step;
 
 static void setup(void)
 {
@@ -45,6 +48,7 @@ static void setup(void)
 
 	ret = sr_init(&sr_ctx);
 	fail_unless(ret == SR_OK, "sr_init() failed: %d.", ret);
+	range_step = 1;
 }
 
 static void teardown(void)
@@ -93,6 +97,24 @@ static void check_hello_world(const struct sr_datafeed_logic *logic)
 	}
 }
 
+/*
+ * The data is a byte counter, starting at range_start, of which every
+ * range_step-th sample is kept.
+ */
+static void check_range(const struct sr_datafeed_logic *logic)
+{
+	uint64_t i, sample;
+	uint8_t *data;
+
+	data = logic->data;
+	for (i = 0; i < logic->length; i++) {
+		sample = sample_counter + i / logic->unitsize;
+		if (data[i] != (uint8_t)(range_start + sample * range_step
+				* logic->unitsize + i % logic->unitsize))
+			fail("Logic data was not the requested range.");
+	}
+}
+
 static void datafeed_in(const struct sr_dev_inst *sdi,
 	const struct sr_datafeed_packet *packet, void *cb_data)
 {
@@ -175,6 +197,8 @@ static void datafeed_in(const struct sr_dev_inst *sdi,
 			check_all_high(logic);
 		else if (check_to_perform == CHECK_HELLO_WORLD)
 			check_hello_world(logic);
+		else if (check_to_perform == CHECK_RANGE)
+			check_range(logic);
 
 		sample_counter += logic->length / logic->unitsize;
 
@@ -197,13 +221,14 @@ static void datafeed_in(const struct sr_dev_inst *sdi,
 	}
 }
 
-static void check_buf(const char *filename, GHashTable *param,
-		const uint8_t *buf, int check, uint64_t samples,
+static void check_file(const char *filename, GHashTable *param,
+		const uint8_t *buf, uint64_t size, int check, uint64_t samples,
 		uint64_t *samplerate)
 {
 	int ret;
 	struct sr_input *in;
 	struct sr_input_format *in_format;
+	struct sr_session *session;
 
 	/* Initialize global variables for this run. */
 	df_packet_counter = sample_counter = 0;
@@ -221,20 +246,27 @@ static void check_buf(const char *filename, GHashTable *param,
 	in->format = in_format;
 	in->param = param;
 
-	srtest_buf_to_file(filename, buf, samples); /* Create a file. */
+	srtest_buf_to_file(filename, buf, size); /* Create a file. */
 
 	ret = in->format->init(in, filename);
 	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
 	
-	sr_session_new();
-	sr_session_datafeed_callback_add(datafeed_in, NULL);
-	sr_session_dev_add(in->sdi);
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_in, NULL);
+	sr_session_dev_add(session, in->sdi);
 	in_format->loadfile(in, filename);
-	sr_session_destroy();
+	sr_session_destroy(session);
 
 	g_unlink(filename); /* Delete file again. */
 }
 
+static void check_buf(const char *filename, GHashTable *param,
+		const uint8_t *buf, int check, uint64_t samples,
+		uint64_t *samplerate)
+{
+	check_file(filename, param, buf, samples, check, samples, samplerate);
+}
+
 START_TEST(test_input_binary_all_low)
 {
 	uint64_t i, samplerate;
@@ -316,6 +348,179 @@ START_TEST(test_input_binary_hello_world)
 }
 END_TEST
 
+/* Check the sample range, block size and mmap options. */
+START_TEST(test_input_binary_range)
+{
+	uint64_t i;
+	uint8_t buf[1001];
+	GHashTable *param;
+	int m;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i;
+
+	for (m = 0; m < 2; m++) {
+		param = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, g_free);
+		g_hash_table_insert(param, g_strdup("mmap"),
+				g_strdup(m ? "yes" : "no"));
+		g_hash_table_insert(param, g_strdup("numprobes"),
+				g_strdup("16"));
+		g_hash_table_insert(param, g_strdup("blocksize"),
+				g_strdup("63"));
+
+		/* Whole file: the trailing partial sample is dropped. */
+		range_start = 0;
+		check_file(FILENAME, param, buf, sizeof(buf), CHECK_RANGE,
+				500, NULL);
+
+		/* A range within the file. */
+		g_hash_table_insert(param, g_strdup("offset"), g_strdup("10"));
+		g_hash_table_insert(param, g_strdup("samples"),
+				g_strdup("100"));
+		range_start = 20;
+		check_file(FILENAME, param, buf, sizeof(buf), CHECK_RANGE,
+				100, NULL);
+
+		/* A range reaching past the end of the file. */
+		g_hash_table_insert(param, g_strdup("offset"),
+				g_strdup("450"));
+		range_start = 900;
+		check_file(FILENAME, param, buf, sizeof(buf), CHECK_RANGE,
+				50, NULL);
+
+		/* An offset past the end of the file. */
+		g_hash_table_insert(param, g_strdup("offset"),
+				g_strdup("600"));
+		check_file(FILENAME, param, buf, sizeof(buf), CHECK_RANGE,
+				0, NULL);
+
+		g_hash_table_destroy(param);
+	}
+}
+END_TEST
+
+/* Feed buf to the streaming API in pieces of the given size. */
+static void check_stream(GHashTable *param, const uint8_t *buf,
+		uint64_t size, uint64_t piece, uint64_t samples)
+{
+	int ret;
+	uint64_t i;
+	struct sr_input *in;
+	struct sr_session *session;
+
+	df_packet_counter = sample_counter = 0;
+	have_seen_df_end = FALSE;
+	logic_probelist = NULL;
+	check_to_perform = CHECK_RANGE;
+	expected_samples = samples;
+	expected_samplerate = NULL;
+
+	in = g_try_malloc0(sizeof(struct sr_input));
+	fail_unless(in != NULL);
+
+	in->format = srtest_input_get("binary");
+	in->param = param;
+
+	ret = in->format->init(in, NULL);
+	fail_unless(ret == SR_OK, "Input format init error: %d", ret);
+
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_in, NULL);
+	sr_session_dev_add(session, in->sdi);
+	for (i = 0; i < size; i += piece) {
+		ret = sr_input_send(in, buf + i, MIN(piece, size - i));
+		fail_unless(ret == SR_OK, "sr_input_send() failed: %d", ret);
+	}
+	ret = sr_input_end(in);
+	fail_unless(ret == SR_OK, "sr_input_end() failed: %d", ret);
+	fail_unless(have_seen_df_end, "No SR_DF_END was sent.");
+	sr_session_destroy(session);
+}
+
+/* Check that streamed input splits up into the same samples as a file. */
+START_TEST(test_input_binary_stream)
+{
+	uint64_t i;
+	uint8_t buf[1001];
+	GHashTable *param;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i;
+
+	param = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+	g_hash_table_insert(param, g_strdup("numprobes"), g_strdup("16"));
+	g_hash_table_insert(param, g_strdup("blocksize"), g_strdup("63"));
+
+	/* Pieces which split samples, and the whole buffer at once. */
+	range_start = 0;
+	check_stream(param, buf, sizeof(buf), 7, 500);
+	check_stream(param, buf, sizeof(buf), sizeof(buf), 500);
+
+	g_hash_table_insert(param, g_strdup("offset"), g_strdup("10"));
+	g_hash_table_insert(param, g_strdup("samples"), g_strdup("100"));
+	range_start = 20;
+	check_stream(param, buf, sizeof(buf), 7, 100);
+	check_stream(param, buf, sizeof(buf), 1, 100);
+
+	g_hash_table_destroy(param);
+}
+END_TEST
+
+/* Check the window options all input modules take. */
+START_TEST(test_input_binary_window)
+{
+	uint64_t i, samplerate;
+	uint8_t buf[1001];
+	GHashTable *param;
+	int m;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i;
+
+	for (m = 0; m < 2; m++) {
+		param = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, g_free);
+		g_hash_table_insert(param, g_strdup("mmap"),
+				g_strdup(m ? "yes" : "no"));
+		g_hash_table_insert(param, g_strdup("numprobes"),
+				g_strdup("16"));
+		g_hash_table_insert(param, g_strdup("blocksize"),
+				g_strdup("63"));
+		g_hash_table_insert(param, g_strdup("samplerate"),
+				g_strdup("1000"));
+
+		/* Times, from sample 20 up to 30. */
+		g_hash_table_insert(param, g_strdup("start"),
+				g_strdup("20ms"));
+		g_hash_table_insert(param, g_strdup("end"),
+				g_strdup("30ms"));
+		samplerate = 1000;
+		range_start = 40;
+		range_step = 1;
+		check_file(FILENAME, param, buf, sizeof(buf), CHECK_RANGE,
+				10, &samplerate);
+
+		/* Samples 5 to 44 after the offset, every 4th of them. */
+		g_hash_table_insert(param, g_strdup("offset"), g_strdup("10"));
+		g_hash_table_insert(param, g_strdup("start"), g_strdup("5"));
+		g_hash_table_insert(param, g_strdup("end"), g_strdup("45"));
+		g_hash_table_insert(param, g_strdup("downsample"),
+				g_strdup("4"));
+		samplerate = 250;
+		range_start = 30;
+		range_step = 4;
+		check_file(FILENAME, param, buf, sizeof(buf), CHECK_RANGE,
+				10, &samplerate);
+		if (m)
+			check_stream(param, buf, sizeof(buf), 7, 10);
+
+		g_hash_table_destroy(param);
+	}
+}
+END_TEST
+
 Suite *suite_input_binary(void)
 {
 	Suite *s;
@@ -329,6 +534,9 @@ Suite *suite_input_binary(void)
 	tcase_add_test(tc, test_input_binary_all_high);
 	tcase_add_loop_test(tc, test_input_binary_all_high_loop, 0, 10);
 	tcase_add_test(tc, test_input_binary_hello_world);
+	tcase_add_test(tc, test_input_binary_range);
+	tcase_add_test(tc, test_input_binary_stream);
+	tcase_add_test(tc, test_input_binary_window);
 	suite_add_tcase(s, tc);
 
 	return s;
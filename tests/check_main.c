@@ -23,11 +23,15 @@
 #include "../libsigrok.h"
 
 Suite *suite_core(void);
+Suite *suite_datafeed(void);
 Suite *suite_driver_all(void);
+Suite *suite_filter(void);
 Suite *suite_input_all(void);
 Suite *suite_input_binary(void);
 Suite *suite_output_all(void);
+Suite *suite_session_file(void);
 Suite *suite_strutil(void);
+Suite *suite_trigger(void);
 Suite *suite_version(void);
 
 int main(void)
@@ -41,11 +45,15 @@ int main(void)
 
 	/* Add all testsuites to the master suite. */
 	srunner_add_suite(srunner, suite_core());
+	srunner_add_suite(srunner, suite_datafeed());
 	srunner_add_suite(srunner, suite_driver_all());
+	srunner_add_suite(srunner, suite_filter());
 	srunner_add_suite(srunner, suite_input_all());
 	srunner_add_suite(srunner, suite_input_binary());
 	srunner_add_suite(srunner, suite_output_all());
+	srunner_add_suite(srunner, suite_session_file());
 	srunner_add_suite(srunner, suite_strutil());
+	srunner_add_suite(srunner, suite_trigger());
 	srunner_add_suite(srunner, suite_version());
 
 	srunner_run_all(srunner, CK_VERBOSE);
@@ -19,7 +19,10 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
+#include <glib/gstdio.h>
+#include <zlib.h>
 #include "../libsigrok.h"
 #include "lib.h"
 
@@ -33,6 +36,557 @@ START_TEST(test_output_available)
 }
 END_TEST
 
+struct sink_data {
+	const void *buf;
+	uint64_t len;
+	int calls;
+};
+
+static int sink(const void *buf, uint64_t len, void *cb_data)
+{
+	struct sink_data *d;
+
+	d = cb_data;
+	d->buf = buf;
+	d->len = len;
+	d->calls++;
+
+	return SR_OK;
+}
+
+/* Check that the binary output writes logic data out without a copy. */
+START_TEST(test_output_binary_send)
+{
+	struct sr_output *o;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sink_data d;
+	uint8_t data[] = { 0x01, 0x02, 0x03, 0x04 };
+	int ret;
+
+	o = sr_output_new(srtest_output_get("binary"), NULL, NULL);
+	fail_unless(o != NULL, "sr_output_new() failed.");
+
+	memset(&logic, 0, sizeof(logic));
+	logic.length = sizeof(data);
+	logic.unitsize = 1;
+	logic.data = data;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+
+	memset(&d, 0, sizeof(d));
+	ret = sr_output_send(o, NULL, &packet, sink, &d);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	fail_unless(d.calls == 1, "Sink called %d times.", d.calls);
+	fail_unless(d.buf == data, "Output was copied.");
+	fail_unless(d.len == sizeof(data), "Wrong length %" PRIu64 ".", d.len);
+
+	/* Packets without samples produce no output. */
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	ret = sr_output_send(o, NULL, &packet, sink, &d);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	fail_unless(d.calls == 1, "Sink called for SR_DF_END.");
+
+	sr_output_free(o);
+}
+END_TEST
+
+static int sink_append(const void *buf, uint64_t len, void *cb_data)
+{
+	g_string_append_len(cb_data, buf, len);
+
+	return SR_OK;
+}
+
+/* Check that the OLS output only writes changes when asked to. */
+START_TEST(test_output_ols_rle)
+{
+	struct sr_output *o;
+	struct sr_dev_inst sdi;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	GString *out;
+	uint8_t data[] = { 0x01, 0x01, 0x01, 0x02, 0x02 };
+	const char *body;
+	int ret;
+
+	memset(&sdi, 0, sizeof(sdi));
+	o = sr_output_new(srtest_output_get("ols"), "rle", &sdi);
+	fail_unless(o != NULL, "sr_output_new() failed.");
+
+	memset(&logic, 0, sizeof(logic));
+	logic.length = sizeof(data);
+	logic.unitsize = 1;
+	logic.data = data;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+
+	out = g_string_new(NULL);
+	ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+
+	/* The last sample is repeated, and only written at the end. */
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+
+	body = strstr(out->str, "01@");
+	fail_unless(body && !strcmp(body, "01@0\n02@3\n02@4\n"),
+			"Wrong output '%s'.", out->str);
+
+	g_string_free(out, TRUE);
+	sr_output_free(o);
+}
+END_TEST
+
+/* Check the analog output's formatting of interleaved probes. */
+START_TEST(test_output_analog)
+{
+	struct sr_output *o;
+	struct sr_dev_inst sdi;
+	struct sr_probe probes[2];
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+	GString *out;
+	float data[] = { 1.5, 0.0005, -2500, 0.25 };
+	int ret;
+
+	memset(&sdi, 0, sizeof(sdi));
+	memset(probes, 0, sizeof(probes));
+	probes[0].name = "A";
+	probes[1].name = "B";
+	probes[0].enabled = probes[1].enabled = TRUE;
+	sdi.probes = g_slist_append(NULL, &probes[0]);
+	sdi.probes = g_slist_append(sdi.probes, &probes[1]);
+	o = sr_output_new(srtest_output_get("analog"), NULL, &sdi);
+	fail_unless(o != NULL, "sr_output_new() failed.");
+
+	memset(&analog, 0, sizeof(analog));
+	analog.probes = sdi.probes;
+	analog.num_samples = 2;
+	analog.mq = SR_MQ_VOLTAGE;
+	analog.unit = SR_UNIT_VOLT;
+	analog.mqflags = SR_MQFLAG_DC;
+	analog.data = data;
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+
+	out = g_string_new(NULL);
+	ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	ret = sr_output_flush(o, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_flush() failed: %d.", ret);
+	fail_unless(!strcmp(out->str, "A: 1.500000 V DC\n"
+			"B: 0.500000 mV DC\nA: -2.500000 kV DC\n"
+			"B: 0.250000 V DC\n"), "Wrong output '%s'.", out->str);
+
+	g_string_free(out, TRUE);
+	sr_output_free(o);
+	g_slist_free(sdi.probes);
+}
+END_TEST
+
+/* Check the columnar output's layout of a batch of logic samples. */
+START_TEST(test_output_columnar)
+{
+	struct sr_output *o;
+	struct sr_dev_inst sdi;
+	struct sr_probe probes[2];
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_header header;
+	struct sr_datafeed_logic logic;
+	GString *out;
+	uint8_t data[] = { 0x01, 0x02, 0x03 };
+	uint64_t bits[2];
+	int ret, i;
+
+	memset(&sdi, 0, sizeof(sdi));
+	memset(probes, 0, sizeof(probes));
+	for (i = 0; i < 2; i++) {
+		probes[i].index = i;
+		probes[i].type = SR_PROBE_LOGIC;
+		probes[i].enabled = TRUE;
+		probes[i].name = i ? "D1" : "D0";
+		sdi.probes = g_slist_append(sdi.probes, &probes[i]);
+	}
+	o = sr_output_new(srtest_output_get("columnar"), NULL, &sdi);
+	fail_unless(o != NULL, "sr_output_new() failed.");
+
+	out = g_string_new(NULL);
+	memset(&header, 0, sizeof(header));
+	packet.type = SR_DF_HEADER;
+	packet.payload = &header;
+	ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	memset(&logic, 0, sizeof(logic));
+	logic.length = sizeof(data);
+	logic.unitsize = 1;
+	logic.data = data;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	ret = sr_output_flush(o, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_flush() failed: %d.", ret);
+
+	/*
+	 * Magic, a 40 byte schema block, the batch block (header, column
+	 * numbers, sample numbers, then a word for each probe) and the
+	 * end block.
+	 */
+	fail_unless(out->len == 144, "Wrong output length %d.", (int)out->len);
+	fail_unless(!memcmp(out->str, "SRCOLS01", 8), "Wrong magic.");
+	memcpy(bits, out->str + 120, sizeof(bits));
+	fail_unless(GUINT64_FROM_LE(bits[0]) == 0x5
+			&& GUINT64_FROM_LE(bits[1]) == 0x6,
+			"Wrong logic columns.");
+
+	g_string_free(out, TRUE);
+	sr_output_free(o);
+	g_slist_free(sdi.probes);
+}
+END_TEST
+
+/*
+ * Encode one large packet with the given number of threads. A first,
+ * small packet takes the header, which has the time in it, and is not
+ * returned.
+ */
+static GString *encode_threaded(const char *id, struct sr_dev_inst *sdi,
+		const uint8_t *data, uint64_t len, int num_threads)
+{
+	struct sr_output *o;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	GString *out;
+	int ret;
+
+	o = sr_output_new(srtest_output_get(id), NULL, sdi);
+	fail_unless(o != NULL, "sr_output_new() failed for %s.", id);
+	ret = sr_output_threads_set(o, num_threads);
+	fail_unless(ret == SR_OK, "sr_output_threads_set() failed: %d.", ret);
+
+	memset(&logic, 0, sizeof(logic));
+	logic.length = 1;
+	logic.unitsize = 1;
+	logic.data = (void *)data;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+
+	out = g_string_new(NULL);
+	ret = sr_output_send(o, sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	ret = sr_output_flush(o, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_flush() failed: %d.", ret);
+	g_string_truncate(out, 0);
+
+	logic.length = len - 1;
+	logic.data = (void *)(data + 1);
+	ret = sr_output_send(o, sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	ret = sr_output_send(o, sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	sr_output_free(o);
+
+	return out;
+}
+
+/* Check that encoding in several threads doesn't change the output. */
+START_TEST(test_output_threads)
+{
+	const char *ids[] = { "csv", "ols", "gnuplot", "vcd", NULL };
+	struct sr_dev_inst sdi;
+	struct sr_probe probes[8];
+	char names[8][2];
+	GString *single, *threaded;
+	uint8_t *data;
+	uint64_t len, i;
+	int p;
+
+	memset(&sdi, 0, sizeof(sdi));
+	for (p = 0; p < 8; p++) {
+		names[p][0] = '0' + p;
+		names[p][1] = '\0';
+		memset(&probes[p], 0, sizeof(probes[p]));
+		probes[p].index = p;
+		probes[p].type = SR_PROBE_LOGIC;
+		probes[p].enabled = TRUE;
+		probes[p].name = names[p];
+		sdi.probes = g_slist_append(sdi.probes, &probes[p]);
+	}
+
+	/* Mostly steady signals, so the edges between ranges matter. */
+	len = 1024 * 1024;
+	data = g_malloc(len);
+	for (i = 0; i < len; i++)
+		data[i] = (i / 1000) * 37;
+
+	for (p = 0; ids[p]; p++) {
+		single = encode_threaded(ids[p], &sdi, data, len, 1);
+		threaded = encode_threaded(ids[p], &sdi, data, len, 4);
+		fail_unless(single->len == threaded->len
+				&& !memcmp(single->str, threaded->str,
+				single->len),
+				"Threaded %s output differs.", ids[p]);
+		g_string_free(single, TRUE);
+		g_string_free(threaded, TRUE);
+	}
+
+	g_free(data);
+	g_slist_free(sdi.probes);
+}
+END_TEST
+
+/*
+ * Check that the VCD output gives over 94 probes identifiers of more
+ * than one character, and writes a bus as one vector.
+ */
+START_TEST(test_output_vcd_bus)
+{
+	struct sr_output *o;
+	struct sr_dev_inst sdi;
+	struct sr_probe probes[104];
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_header header;
+	struct sr_datafeed_logic logic;
+	char names[104][4];
+	uint8_t data[2 * 13];
+	GString *out;
+	int ret, p;
+
+	memset(&sdi, 0, sizeof(sdi));
+	for (p = 0; p < 104; p++) {
+		g_snprintf(names[p], sizeof(names[p]), "D%d", p);
+		memset(&probes[p], 0, sizeof(probes[p]));
+		probes[p].index = p;
+		probes[p].type = SR_PROBE_LOGIC;
+		probes[p].enabled = TRUE;
+		probes[p].name = names[p];
+		sdi.probes = g_slist_append(sdi.probes, &probes[p]);
+	}
+	o = sr_output_new(srtest_output_get("vcd"), "bus=B:0-7", &sdi);
+	fail_unless(o != NULL, "sr_output_new() failed.");
+
+	out = g_string_new(NULL);
+	memset(&header, 0, sizeof(header));
+	packet.type = SR_DF_HEADER;
+	packet.payload = &header;
+	ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+
+	/* Then the bus goes to 5 and the last probe high. */
+	memset(data, 0, sizeof(data));
+	data[13] = 0x05;
+	data[25] = 0x80;
+	memset(&logic, 0, sizeof(logic));
+	logic.length = sizeof(data);
+	logic.unitsize = 13;
+	logic.data = data;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	ret = sr_output_flush(o, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_flush() failed: %d.", ret);
+
+	/* The 96 probes outside the bus come first, then the bus. */
+	fail_unless(strstr(out->str, "$var wire 1 ~ D101 $end\n")
+			&& strstr(out->str, "$var wire 1 \"! D103 $end\n")
+			&& strstr(out->str, "$var wire 8 #! B [7:0] $end\n"),
+			"Wrong variables.");
+	fail_unless(!strstr(out->str, " D0 "), "Bus probe written alone.");
+	fail_unless(strstr(out->str, "#0\n0!\n")
+			&& strstr(out->str, "b0 #!\n#1\n1\"!\nb101 #!\n"),
+			"Wrong changes.");
+
+	g_string_free(out, TRUE);
+	sr_output_free(o);
+	g_slist_free(sdi.probes);
+}
+END_TEST
+
+/* Send a datafeed of two logic packets to the srnet output. */
+static GString *srnet_encode(const char *param, const uint8_t *data,
+		uint64_t len)
+{
+	struct sr_output *o;
+	struct sr_dev_inst sdi;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_header header;
+	struct sr_datafeed_logic logic;
+	GString *out;
+	int ret, i;
+
+	memset(&sdi, 0, sizeof(sdi));
+	o = sr_output_new(srtest_output_get("srnet"), param, &sdi);
+	fail_unless(o != NULL, "sr_output_new() failed.");
+	out = g_string_new(NULL);
+
+	memset(&header, 0, sizeof(header));
+	packet.type = SR_DF_HEADER;
+	packet.payload = &header;
+	ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+
+	memset(&logic, 0, sizeof(logic));
+	logic.length = len;
+	logic.unitsize = 1;
+	logic.data = (void *)data;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	for (i = 0; i < 2; i++) {
+		ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+		fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	}
+
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	ret = sr_output_send(o, &sdi, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	sr_output_free(o);
+
+	return out;
+}
+
+/* Get the type, flags and length of the frame at offset in out. */
+static void srnet_frame(const GString *out, size_t offset, int *type,
+		int *flags, uint32_t *len)
+{
+	const uint8_t *p;
+
+	fail_unless(offset + 8 <= out->len, "Frame header missing.");
+	p = (const uint8_t *)out->str + offset;
+	*type = p[0] | (p[1] << 8);
+	*flags = p[2] | (p[3] << 8);
+	*len = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+	fail_unless(offset + 8 + *len <= out->len, "Frame truncated.");
+}
+
+/*
+ * Check the framing of the srnet output: the samples of consecutive logic
+ * packets end up in one frame, which is deflated if asked to.
+ */
+START_TEST(test_output_srnet)
+{
+	const int types[] = { 1, 2, 6, 3 };
+	uint8_t data[1000];
+	GString *out;
+	uint32_t len;
+	size_t offset;
+	int type, flags, i;
+
+	memset(data, 0x55, sizeof(data));
+	out = srnet_encode(NULL, data, sizeof(data));
+	fail_unless(out->len > 8 && !memcmp(out->str, "SRNET01\n", 8),
+			"Stream magic missing.");
+	offset = 8;
+	for (i = 0; i < 4; i++) {
+		srnet_frame(out, offset, &type, &flags, &len);
+		fail_unless(type == types[i], "Frame %d has type %d.", i, type);
+		fail_unless(!flags, "Frame %d has flags %d.", i, flags);
+		if (type == 6)
+			fail_unless(len == 2 + 2 * sizeof(data),
+					"Logic frame of %u bytes.", len);
+		offset += 8 + len;
+	}
+	fail_unless(offset == out->len, "Trailing output.");
+	g_string_free(out, TRUE);
+
+	/* No batching: one frame per packet, deflated. */
+	out = srnet_encode("compress=9,batch=0", data, sizeof(data));
+	offset = 8;
+	for (i = 0; i < 5; i++) {
+		srnet_frame(out, offset, &type, &flags, &len);
+		if (i == 2 || i == 3) {
+			fail_unless(type == 6, "Frame %d has type %d.", i,
+					type);
+			fail_unless(flags == 1 && len < sizeof(data),
+					"Logic frame wasn't deflated.");
+		}
+		offset += 8 + len;
+	}
+	fail_unless(offset == out->len, "Trailing output.");
+	g_string_free(out, TRUE);
+}
+END_TEST
+
+#define COMPRESS_FILENAME "check-compress.gz"
+#define COMPRESS_LEN (3 * 1024 * 1024 + 100)
+
+/*
+ * Check that compressed output, in more blocks than threads, reads back
+ * as the plain output with zlib.
+ */
+START_TEST(test_output_compress)
+{
+	struct sr_output *o;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	GString *out;
+	gzFile file;
+	uint8_t *data, *back;
+	int ret, len, i;
+
+	data = g_malloc(COMPRESS_LEN);
+	back = g_malloc(COMPRESS_LEN + 1);
+	for (i = 0; i < COMPRESS_LEN; i++)
+		data[i] = (i / 16) % 251;
+
+	o = sr_output_new(srtest_output_get("binary"), NULL, NULL);
+	fail_unless(o != NULL, "sr_output_new() failed.");
+	fail_unless(sr_output_compress_set(o, 10, 1) == SR_ERR_ARG,
+			"Invalid level accepted.");
+	ret = sr_output_compress_set(o, 6, 2);
+	fail_unless(ret == SR_OK, "sr_output_compress_set() failed: %d.", ret);
+
+	memset(&logic, 0, sizeof(logic));
+	logic.length = COMPRESS_LEN;
+	logic.unitsize = 1;
+	logic.data = data;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	out = g_string_new(NULL);
+	ret = sr_output_send(o, NULL, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	ret = sr_output_send(o, NULL, &packet, sink_append, out);
+	fail_unless(ret == SR_OK, "sr_output_send() failed: %d.", ret);
+	sr_output_free(o);
+
+	fail_unless(out->len > 2 && out->len < COMPRESS_LEN / 4,
+			"Output wasn't compressed.");
+	fail_unless((uint8_t)out->str[0] == 0x1f
+			&& (uint8_t)out->str[1] == 0x8b, "No gzip magic.");
+
+	fail_unless(g_file_set_contents(COMPRESS_FILENAME, out->str, out->len,
+			NULL));
+	file = gzopen(COMPRESS_FILENAME, "rb");
+	fail_unless(file != NULL, "Failed to open '%s'.", COMPRESS_FILENAME);
+	len = gzread(file, back, COMPRESS_LEN + 1);
+	gzclose(file);
+	g_unlink(COMPRESS_FILENAME);
+	fail_unless(len == COMPRESS_LEN, "Decompressed to %d bytes.", len);
+	fail_unless(!memcmp(back, data, COMPRESS_LEN), "Wrong output.");
+
+	g_string_free(out, TRUE);
+	g_free(back);
+	g_free(data);
+}
+END_TEST
+
 Suite *suite_output_all(void)
 {
 	Suite *s;
@@ -42,6 +596,14 @@ Suite *suite_output_all(void)
 
 	tc = tcase_create("basic");
 	tcase_add_test(tc, test_output_available);
+	tcase_add_test(tc, test_output_binary_send);
+	tcase_add_test(tc, test_output_ols_rle);
+	tcase_add_test(tc, test_output_analog);
+	tcase_add_test(tc, test_output_columnar);
+	tcase_add_test(tc, test_output_threads);
+	tcase_add_test(tc, test_output_vcd_bus);
+	tcase_add_test(tc, test_output_srnet);
+	tcase_add_test(tc, test_output_compress);
 	suite_add_tcase(s, tc);
 
 	return s;
@@ -0,0 +1,1462 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <check.h>
+#include "../libsigrok.h"
+#include "lib.h"
+
+#define FILENAME "check-session-file.sr"
+#define RECORD_FILENAME "check-session-record.sr"
+#define RECORD_INDEX "check-session-record.index"
+
+/* Large enough to need more than one chunk. */
+#define NUM_SAMPLES (3 * 1024 * 1024)
+
+static struct sr_context *sr_ctx;
+
+static void setup(void)
+{
+	int ret;
+
+	ret = sr_init(&sr_ctx);
+	fail_unless(ret == SR_OK, "sr_init() failed: %d.", ret);
+}
+
+static void teardown(void)
+{
+	sr_exit(sr_ctx);
+	unlink(FILENAME);
+}
+
+/*
+ * Check whether a file written by the streaming session writer can be
+ * loaded again, with the probe setup intact.
+ */
+START_TEST(test_writer_roundtrip)
+{
+	struct sr_session_writer *writer;
+	struct sr_dev_inst sdi, *loaded;
+	struct sr_probe probes[2], *probe;
+	struct sr_session *session;
+	GSList *devlist;
+	uint16_t *buf;
+	int ret, i;
+
+	memset(&sdi, 0, sizeof(sdi));
+	memset(probes, 0, sizeof(probes));
+	for (i = 0; i < 2; i++) {
+		probes[i].index = i;
+		probes[i].type = SR_PROBE_LOGIC;
+		probes[i].enabled = TRUE;
+		sdi.probes = g_slist_append(sdi.probes, &probes[i]);
+	}
+	probes[0].name = "CLK";
+	probes[1].name = "DATA";
+
+	buf = g_try_malloc(NUM_SAMPLES * sizeof(uint16_t));
+	fail_unless(buf != NULL);
+	for (i = 0; i < NUM_SAMPLES; i++)
+		buf[i] = i;
+
+	ret = sr_session_writer_open(&writer, FILENAME, &sdi, 2);
+	fail_unless(ret == SR_OK, "sr_session_writer_open() failed: %d.", ret);
+	/* Odd sizes, so the chunk boundaries fall in between. */
+	for (i = 0; i < NUM_SAMPLES; i += 100000) {
+		ret = sr_session_writer_write(writer, buf + i,
+				MIN(100000, NUM_SAMPLES - i));
+		fail_unless(ret == SR_OK, "Write failed: %d.", ret);
+	}
+	ret = sr_session_writer_close(writer);
+	fail_unless(ret == SR_OK, "sr_session_writer_close() failed: %d.", ret);
+	g_free(buf);
+	g_slist_free(sdi.probes);
+
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+
+	ret = sr_session_dev_list(session, &devlist);
+	fail_unless(ret == SR_OK);
+	fail_unless(g_slist_length(devlist) == 1, "Expected one device.");
+	loaded = devlist->data;
+	fail_unless(g_slist_length(loaded->probes) == 2,
+			"Expected two probes.");
+	probe = loaded->probes->data;
+	fail_unless(!strcmp(probe->name, "CLK"), "Wrong probe name.");
+	probe = loaded->probes->next->data;
+	fail_unless(!strcmp(probe->name, "DATA"), "Wrong probe name.");
+	g_slist_free(devlist);
+
+	sr_session_destroy(session);
+}
+END_TEST
+
+static void write_file(int level, gboolean summary, gboolean planar,
+		gboolean rle)
+{
+	struct sr_session_writer *writer;
+	struct sr_dev_inst sdi;
+	uint16_t *buf;
+	int ret, i;
+
+	memset(&sdi, 0, sizeof(sdi));
+	buf = g_try_malloc(NUM_SAMPLES * sizeof(uint16_t));
+	fail_unless(buf != NULL);
+	for (i = 0; i < NUM_SAMPLES; i++)
+		buf[i] = i;
+
+	ret = sr_session_writer_open(&writer, FILENAME, &sdi, 2);
+	fail_unless(ret == SR_OK, "sr_session_writer_open() failed: %d.", ret);
+	ret = sr_session_writer_compression_set(writer, level);
+	fail_unless(ret == SR_OK);
+	ret = sr_session_writer_summary_set(writer, summary);
+	fail_unless(ret == SR_OK);
+	ret = sr_session_writer_planar_set(writer, planar);
+	fail_unless(ret == SR_OK);
+	ret = sr_session_writer_rle_set(writer, rle);
+	fail_unless(ret == SR_OK);
+	ret = sr_session_writer_write(writer, buf, NUM_SAMPLES);
+	fail_unless(ret == SR_OK, "Write failed: %d.", ret);
+	ret = sr_session_writer_close(writer);
+	fail_unless(ret == SR_OK, "sr_session_writer_close() failed: %d.", ret);
+	g_free(buf);
+}
+
+static void check_reader(void)
+{
+	struct sr_session_reader *reader;
+	const uint16_t *data;
+	const void *p;
+	uint64_t num_samples, count, start;
+	int ret, unitsize;
+
+	ret = sr_session_reader_open(&reader, FILENAME);
+	fail_unless(ret == SR_OK, "sr_session_reader_open() failed: %d.", ret);
+	sr_session_reader_info(reader, &num_samples, &unitsize);
+	fail_unless(num_samples == NUM_SAMPLES, "Wrong number of samples.");
+	fail_unless(unitsize == 2, "Wrong unitsize.");
+
+	/* Jump around, including across chunk boundaries. */
+	for (start = NUM_SAMPLES - 1; start > 0; start /= 3) {
+		count = 10;
+		ret = sr_session_reader_get(reader, start, &count, &p);
+		fail_unless(ret == SR_OK, "sr_session_reader_get() failed: %d.", ret);
+		fail_unless(count > 0 && count <= 10, "Wrong count.");
+		data = p;
+		fail_unless(data[0] == (uint16_t)start, "Wrong sample data.");
+		fail_unless(data[count - 1] == (uint16_t)(start + count - 1));
+	}
+
+	count = 1;
+	ret = sr_session_reader_get(reader, NUM_SAMPLES, &count, &p);
+	fail_unless(ret == SR_ERR_ARG, "Read past the end succeeded.");
+
+	sr_session_reader_close(reader);
+}
+
+/* Check random access to uncompressed capture data. */
+START_TEST(test_reader_stored)
+{
+	write_file(0, FALSE, FALSE, FALSE);
+	check_reader();
+}
+END_TEST
+
+/* Check random access to deflated capture data. */
+START_TEST(test_reader_deflated)
+{
+	write_file(1, FALSE, FALSE, FALSE);
+	check_reader();
+}
+END_TEST
+
+/*
+ * Check that data appended to a file written by the session writer
+ * follows the samples already in it.
+ */
+START_TEST(test_append)
+{
+	struct sr_session_reader *reader;
+	const uint16_t *data;
+	const void *p;
+	uint16_t buf[1000];
+	uint64_t num_samples, count;
+	int ret, unitsize, i, k;
+
+	write_file(0, FALSE, FALSE, FALSE);
+	for (k = 0; k < 2; k++) {
+		for (i = 0; i < 1000; i++)
+			buf[i] = NUM_SAMPLES + k * 1000 + i;
+		ret = sr_session_append(FILENAME, (unsigned char *)buf,
+				2, 1000);
+		fail_unless(ret == SR_OK, "sr_session_append() failed: %d.",
+				ret);
+	}
+
+	ret = sr_session_reader_open(&reader, FILENAME);
+	fail_unless(ret == SR_OK, "sr_session_reader_open() failed: %d.", ret);
+	sr_session_reader_info(reader, &num_samples, &unitsize);
+	fail_unless(num_samples == NUM_SAMPLES + 2000,
+			"Wrong number of samples.");
+	for (k = 0; k < 3; k++) {
+		count = 1;
+		ret = sr_session_reader_get(reader, NUM_SAMPLES - 1 + k * 1000,
+				&count, &p);
+		fail_unless(ret == SR_OK, "sr_session_reader_get() failed: %d.",
+				ret);
+		data = p;
+		fail_unless(data[0] == (uint16_t)(NUM_SAMPLES - 1 + k * 1000),
+				"Wrong sample data.");
+	}
+	sr_session_reader_close(reader);
+}
+END_TEST
+
+/*
+ * Check whether the summary of a range matches the data: with each sample
+ * being its own index, probe 0 toggles at every sample, probe 1 at every
+ * second one, and so on.
+ */
+START_TEST(test_reader_summary)
+{
+	struct sr_session_reader *reader;
+	uint64_t or_mask, and_mask, transitions[16];
+	int ret;
+
+	write_file(0, TRUE, FALSE, FALSE);
+	ret = sr_session_reader_open(&reader, FILENAME);
+	fail_unless(ret == SR_OK, "sr_session_reader_open() failed: %d.", ret);
+
+	ret = sr_session_reader_summary_get(reader, 0, NUM_SAMPLES,
+			&or_mask, &and_mask, transitions);
+	fail_unless(ret == SR_OK, "Summary failed: %d.", ret);
+	fail_unless(or_mask == 0xffff && and_mask == 0, "Wrong masks.");
+	fail_unless(transitions[0] == NUM_SAMPLES - 1, "Wrong transitions.");
+	fail_unless(transitions[15] == NUM_SAMPLES / 0x8000 - 1);
+
+	/* Unaligned, spanning multiple summary blocks. */
+	ret = sr_session_reader_summary_get(reader, 1001, 1000000,
+			&or_mask, &and_mask, transitions);
+	fail_unless(ret == SR_OK, "Summary failed: %d.", ret);
+	fail_unless(transitions[0] == 1000000, "Wrong transitions.");
+	fail_unless(transitions[1] == 500000, "Wrong transitions.");
+
+	/* A range within a single sample. */
+	ret = sr_session_reader_summary_get(reader, 0x1234, 1,
+			&or_mask, &and_mask, NULL);
+	fail_unless(ret == SR_OK, "Summary failed: %d.", ret);
+	fail_unless(or_mask == 0x1234 && and_mask == 0x1234, "Wrong masks.");
+
+	sr_session_reader_close(reader);
+}
+END_TEST
+
+/* Check pattern and edge search against samples being their own index. */
+static void check_find(void)
+{
+	struct sr_session_reader *reader;
+	uint64_t index;
+	int ret;
+
+	ret = sr_session_reader_open(&reader, FILENAME);
+	fail_unless(ret == SR_OK, "sr_session_reader_open() failed: %d.", ret);
+
+	ret = sr_session_reader_find_pattern(reader, 0, 0xffff, 0x1234, &index);
+	fail_unless(ret == SR_OK, "Pattern search failed: %d.", ret);
+	fail_unless(index == 0x1234, "Wrong pattern match.");
+	ret = sr_session_reader_find_pattern(reader, 0x1235, 0xffff, 0x1234,
+			&index);
+	fail_unless(ret == SR_OK && index == 0x11234, "Wrong pattern match.");
+	ret = sr_session_reader_find_pattern(reader, 0, 0xff00, 0xff00, &index);
+	fail_unless(ret == SR_OK && index == 0xff00, "Wrong pattern match.");
+	ret = sr_session_reader_find_pattern(reader, NUM_SAMPLES - 10, 0xffff,
+			0x1234, &index);
+	fail_unless(ret == SR_ERR_NA, "Found a pattern past the end.");
+
+	/* Probe 3 falls at every multiple of 16, probe 15 at 0x10000. */
+	ret = sr_session_reader_find_edge(reader, 3, FALSE, 1000, &index);
+	fail_unless(ret == SR_OK, "Edge search failed: %d.", ret);
+	fail_unless(index == 1008, "Wrong falling edge.");
+	ret = sr_session_reader_find_edge(reader, 3, FALSE, 1008, &index);
+	fail_unless(ret == SR_OK && index == 1008, "Missed edge at start.");
+	ret = sr_session_reader_find_edge(reader, 15, TRUE, 0, &index);
+	fail_unless(ret == SR_OK && index == 0x8000, "Wrong rising edge.");
+	ret = sr_session_reader_find_edge(reader, 15, FALSE, 0x8001, &index);
+	fail_unless(ret == SR_OK && index == 0x10000, "Wrong falling edge.");
+	ret = sr_session_reader_find_edge(reader, 15, TRUE, NUM_SAMPLES - 10,
+			&index);
+	fail_unless(ret == SR_ERR_NA, "Found an edge past the end.");
+
+	sr_session_reader_close(reader);
+}
+
+/* Check searching with and without a summary, and in the planar layout. */
+START_TEST(test_reader_find)
+{
+	write_file(1, FALSE, FALSE, FALSE);
+	check_find();
+	write_file(1, TRUE, FALSE, FALSE);
+	check_find();
+	write_file(1, TRUE, TRUE, FALSE);
+	check_find();
+}
+END_TEST
+
+/* Replayed mixed-signal data, per device. */
+static uint64_t mixed_logic[2], mixed_analog[2];
+static float mixed_last[2];
+
+static void mixed_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_analog *analog;
+	GSList *devlist;
+	int dev;
+
+	sr_session_dev_list(cb_data, &devlist);
+	dev = sdi == devlist->data ? 0 : 1;
+	g_slist_free(devlist);
+
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		mixed_logic[dev] += logic->length;
+		break;
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		fail_unless(analog->mq == SR_MQ_VOLTAGE, "Wrong mq.");
+		mixed_analog[dev] += analog->num_samples;
+		mixed_last[dev] = analog->data[analog->num_samples - 1];
+		break;
+	}
+}
+
+/*
+ * Check that float and raw analog data of two devices written to the same
+ * file is loaded and replayed with the right devices and probes, stored
+ * as it is and delta coded.
+ */
+START_TEST(test_writer_mixed)
+{
+	struct sr_session_writer *writer;
+	struct sr_dev_inst sdi[2], *loaded;
+	struct sr_probe probes[3], *probe;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+	struct sr_datafeed_analog_raw raw;
+	struct sr_session *session;
+	GSList *devlist;
+	uint8_t logic[1000];
+	float fbuf[1000], scale, offset;
+	int16_t rbuf[500];
+	int ret, i;
+
+	memset(sdi, 0, sizeof(sdi));
+	memset(probes, 0, sizeof(probes));
+	for (i = 0; i < 3; i++)
+		probes[i].enabled = TRUE;
+	probes[0].type = SR_PROBE_LOGIC;
+	probes[0].name = "D0";
+	probes[1].index = 1;
+	probes[1].type = SR_PROBE_ANALOG;
+	probes[1].name = "CH1";
+	sdi[0].probes = g_slist_append(NULL, &probes[0]);
+	sdi[0].probes = g_slist_append(sdi[0].probes, &probes[1]);
+	probes[2].type = SR_PROBE_ANALOG;
+	probes[2].name = "TEMP";
+	sdi[1].probes = g_slist_append(NULL, &probes[2]);
+
+	for (i = 0; i < 1000; i++) {
+		logic[i] = i & 1;
+		fbuf[i] = i / 10.0;
+	}
+	for (i = 0; i < 500; i++)
+		rbuf[i] = i - 250;
+
+	ret = sr_session_writer_open(&writer, FILENAME, &sdi[0], 1);
+	fail_unless(ret == SR_OK, "sr_session_writer_open() failed: %d.", ret);
+	ret = sr_session_writer_dev_add(writer, &sdi[1], 1);
+	fail_unless(ret == SR_OK, "sr_session_writer_dev_add() failed: %d.",
+			ret);
+	/* Note: _i is the loop variable from tcase_add_loop_test(). */
+	ret = sr_session_writer_compression_set(writer, _i ? 9 : 0);
+	fail_unless(ret == SR_OK);
+	ret = sr_session_writer_delta_set(writer, _i);
+	fail_unless(ret == SR_OK, "sr_session_writer_delta_set() failed: %d.",
+			ret);
+	ret = sr_session_writer_write(writer, logic, 1000);
+	fail_unless(ret == SR_OK, "Write failed: %d.", ret);
+
+	memset(&analog, 0, sizeof(analog));
+	analog.probes = g_slist_append(NULL, &probes[1]);
+	analog.num_samples = 1000;
+	analog.mq = SR_MQ_VOLTAGE;
+	analog.unit = SR_UNIT_VOLT;
+	analog.data = fbuf;
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	ret = sr_session_writer_packet(writer, &packet);
+	fail_unless(ret == SR_OK, "Analog write failed: %d.", ret);
+	g_slist_free(analog.probes);
+	ret = sr_session_writer_delta_set(writer, !_i);
+	fail_unless(ret == SR_ERR, "Coding changed after writing samples.");
+
+	scale = 0.5;
+	offset = 1;
+	memset(&raw, 0, sizeof(raw));
+	raw.probes = g_slist_append(NULL, &probes[2]);
+	raw.num_samples = 500;
+	raw.mq = SR_MQ_VOLTAGE;
+	raw.unit = SR_UNIT_VOLT;
+	raw.encoding = SR_ANALOG_S16;
+	raw.scale = &scale;
+	raw.offset = &offset;
+	raw.data = rbuf;
+	packet.type = SR_DF_ANALOG_RAW;
+	packet.payload = &raw;
+	ret = sr_session_writer_dev_packet(writer, &sdi[1], &packet);
+	fail_unless(ret == SR_OK, "Raw analog write failed: %d.", ret);
+	/* The format of a probe can't change halfway. */
+	scale = 0.25;
+	ret = sr_session_writer_dev_packet(writer, &sdi[1], &packet);
+	fail_unless(ret == SR_ERR_ARG, "Format change was accepted.");
+	g_slist_free(raw.probes);
+
+	ret = sr_session_writer_close(writer);
+	fail_unless(ret == SR_OK, "sr_session_writer_close() failed: %d.", ret);
+	g_slist_free(sdi[0].probes);
+	g_slist_free(sdi[1].probes);
+
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	sr_session_dev_list(session, &devlist);
+	fail_unless(g_slist_length(devlist) == 2, "Expected two devices.");
+	loaded = devlist->data;
+	fail_unless(g_slist_length(loaded->probes) == 2,
+			"Expected two probes.");
+	probe = loaded->probes->next->data;
+	fail_unless(probe->type == SR_PROBE_ANALOG, "Expected analog probe.");
+	fail_unless(!strcmp(probe->name, "CH1"), "Wrong probe name.");
+	loaded = devlist->next->data;
+	fail_unless(g_slist_length(loaded->probes) == 1, "Expected one probe.");
+	probe = loaded->probes->data;
+	fail_unless(!strcmp(probe->name, "TEMP"), "Wrong probe name.");
+	g_slist_free(devlist);
+
+	memset(mixed_logic, 0, sizeof(mixed_logic));
+	memset(mixed_analog, 0, sizeof(mixed_analog));
+	sr_session_datafeed_callback_add(session, mixed_datafeed_in, session);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	fail_unless(mixed_logic[0] == 1000 && mixed_analog[0] == 1000,
+			"Wrong number of samples of the first device.");
+	fail_unless(mixed_last[0] == fbuf[999], "Wrong float sample.");
+	fail_unless(mixed_logic[1] == 0 && mixed_analog[1] == 500,
+			"Wrong number of samples of the second device.");
+	fail_unless(mixed_last[1] == 249 * 0.5 + 1, "Wrong raw sample.");
+
+	sr_session_destroy(session);
+}
+END_TEST
+
+/*
+ * Check that the same file can be loaded into two sessions at once, with
+ * each holding a device of its own.
+ */
+START_TEST(test_load_twice)
+{
+	struct sr_session *session1, *session2;
+	GSList *devlist1, *devlist2;
+	int ret;
+
+	write_file(0, FALSE, FALSE, FALSE);
+
+	ret = sr_session_load(FILENAME, &session1);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	ret = sr_session_load(FILENAME, &session2);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	fail_unless(session1 != session2, "Got the same session twice.");
+
+	sr_session_dev_list(session1, &devlist1);
+	sr_session_dev_list(session2, &devlist2);
+	fail_unless(g_slist_length(devlist1) == 1, "Expected one device.");
+	fail_unless(g_slist_length(devlist2) == 1, "Expected one device.");
+	fail_unless(devlist1->data != devlist2->data, "Device was shared.");
+	fail_unless(sr_session_dev_add(session2, devlist1->data) != SR_OK,
+			"Device added to a second session.");
+	g_slist_free(devlist1);
+	g_slist_free(devlist2);
+
+	sr_session_destroy(session1);
+	ret = sr_session_dev_list(session2, &devlist2);
+	fail_unless(ret == SR_OK && g_slist_length(devlist2) == 1,
+			"Destroying a session affected the other one.");
+	g_slist_free(devlist2);
+	sr_session_destroy(session2);
+}
+END_TEST
+
+/* The logic data test_demo_roundtrip saw, and all of it if kept. */
+struct capture {
+	GChecksum *checksum;
+	GByteArray *data;
+	uint64_t samples;
+	int unitsize;
+};
+
+static void capture_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	struct capture *cap;
+
+	(void)sdi;
+
+	if (packet->type != SR_DF_LOGIC)
+		return;
+
+	cap = cb_data;
+	logic = packet->payload;
+	g_checksum_update(cap->checksum, logic->data, logic->length);
+	if (cap->data)
+		g_byte_array_append(cap->data, logic->data, logic->length);
+	cap->samples += logic->length / logic->unitsize;
+	cap->unitsize = logic->unitsize;
+}
+
+/* The ways test_demo_roundtrip saves a capture. */
+static const char *roundtrip_options[] = {
+	/* NULL: sr_session_save() of the whole capture in memory. */
+	NULL,
+	"",
+	"compression=1,rle",
+	"planar",
+};
+
+/*
+ * Check that a capture of the demo driver, large enough to take many
+ * chunks, is replayed exactly as it was captured once saved and loaded
+ * again, whether it was saved at once or streamed to the file.
+ */
+START_TEST(test_demo_roundtrip)
+{
+	struct sr_dev_driver *driver;
+	struct sr_session *session;
+	struct sr_dev_inst *sdi;
+	struct sr_config src;
+	struct capture captured, replayed;
+	const char *options;
+	GSList *devices, l;
+	char *sum;
+	int ret;
+
+	/* Note: _i is the loop variable from tcase_add_loop_test(). */
+	options = roundtrip_options[_i];
+
+	driver = srtest_driver_get("demo");
+	srtest_driver_init(sr_ctx, driver);
+	/* Two bytes per sample, so samples straddle the chunks. */
+	src.key = SR_CONF_NUM_LOGIC_PROBES;
+	src.data = g_variant_new_uint64(16);
+	l.data = &src;
+	l.next = NULL;
+	devices = sr_driver_scan(driver, &l);
+	g_variant_unref(src.data);
+	fail_unless(devices != NULL, "No demo device found.");
+	sdi = devices->data;
+	g_slist_free(devices);
+	sr_dev_open(sdi);
+	sr_config_set(sdi, NULL, SR_CONF_FREERUN, g_variant_new_boolean(TRUE));
+	sr_config_set(sdi, NULL, SR_CONF_PATTERN_MODE,
+			g_variant_new_string("random"));
+	ret = sr_config_set(sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+			g_variant_new_uint64(NUM_SAMPLES));
+	fail_unless(ret == SR_OK, "Setting the limit failed: %d.", ret);
+
+	memset(&captured, 0, sizeof(captured));
+	captured.checksum = g_checksum_new(G_CHECKSUM_SHA1);
+	if (!options)
+		captured.data = g_byte_array_new();
+	session = sr_session_new();
+	sr_session_dev_add(session, sdi);
+	sr_session_datafeed_callback_add(session, capture_datafeed_in,
+			&captured);
+	if (options) {
+		ret = sr_session_record_to(session, FILENAME, options);
+		fail_unless(ret == SR_OK, "sr_session_record_to() failed: %d.",
+				ret);
+	}
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	fail_unless(captured.samples == NUM_SAMPLES,
+			"Captured %" PRIu64 " samples.", captured.samples);
+	fail_unless(captured.unitsize == 2, "Wrong unitsize.");
+	if (!options) {
+		ret = sr_session_save(FILENAME, sdi, captured.data->data,
+				captured.unitsize, captured.samples);
+		fail_unless(ret == SR_OK, "sr_session_save() failed: %d.",
+				ret);
+		g_byte_array_free(captured.data, TRUE);
+	}
+	sr_session_destroy(session);
+
+	memset(&replayed, 0, sizeof(replayed));
+	replayed.checksum = g_checksum_new(G_CHECKSUM_SHA1);
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	sr_session_datafeed_callback_add(session, capture_datafeed_in,
+			&replayed);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	sr_session_destroy(session);
+
+	fail_unless(replayed.samples == NUM_SAMPLES,
+			"Replayed %" PRIu64 " samples.", replayed.samples);
+	fail_unless(replayed.unitsize == 2, "Wrong unitsize.");
+	sum = g_strdup(g_checksum_get_string(captured.checksum));
+	fail_unless(!strcmp(sum, g_checksum_get_string(replayed.checksum)),
+			"Replayed data differs from the capture.");
+	g_free(sum);
+	g_checksum_free(captured.checksum);
+	g_checksum_free(replayed.checksum);
+}
+END_TEST
+
+/* Logic samples replayed so far, and whether they all were in order. */
+static uint64_t replay_samples;
+static gboolean replay_ok;
+
+static void replay_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	const uint16_t *data;
+	uint64_t i;
+
+	(void)sdi;
+	(void)cb_data;
+
+	if (packet->type != SR_DF_LOGIC)
+		return;
+
+	logic = packet->payload;
+	data = logic->data;
+	for (i = 0; i < logic->length / 2; i++)
+		if (data[i] != (uint16_t)(replay_samples + i))
+			replay_ok = FALSE;
+	replay_samples += logic->length / 2;
+}
+
+/* Check that replay with several threads sends the data in order. */
+START_TEST(test_replay_threads)
+{
+	struct sr_session *session;
+	int ret, i;
+
+	write_file(1, FALSE, FALSE, FALSE);
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	sr_session_datafeed_callback_add(session, replay_datafeed_in, NULL);
+	ret = sr_session_replay_threads_set(session, 4);
+	fail_unless(ret == SR_OK, "Setting the threads failed: %d.", ret);
+
+	/* Twice, to see the threads are ready for another run. */
+	for (i = 0; i < 2; i++) {
+		replay_samples = 0;
+		replay_ok = TRUE;
+		ret = sr_session_start(session);
+		fail_unless(ret == SR_OK, "sr_session_start() failed: %d.",
+				ret);
+		ret = sr_session_run(session);
+		fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+		fail_unless(replay_samples == NUM_SAMPLES,
+				"Wrong number of samples.");
+		fail_unless(replay_ok, "Samples out of order.");
+	}
+
+	sr_session_destroy(session);
+}
+END_TEST
+
+/*
+ * Check that recording a replay gives the same samples, and that options
+ * are checked.
+ */
+START_TEST(test_record_to)
+{
+	struct sr_session *session;
+	struct sr_session_reader *reader;
+	const uint16_t *data;
+	const void *p;
+	uint64_t num_samples, count, start;
+	int ret, unitsize;
+
+	write_file(0, FALSE, FALSE, FALSE);
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	ret = sr_session_record_to(session, RECORD_FILENAME, "bogus");
+	fail_unless(ret == SR_ERR_ARG, "Unknown option accepted.");
+	ret = sr_session_record_to(session, RECORD_FILENAME, "compression=1");
+	fail_unless(ret == SR_OK, "sr_session_record_to() failed: %d.", ret);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	sr_session_destroy(session);
+
+	ret = sr_session_reader_open(&reader, RECORD_FILENAME);
+	fail_unless(ret == SR_OK, "sr_session_reader_open() failed: %d.", ret);
+	sr_session_reader_info(reader, &num_samples, &unitsize);
+	fail_unless(num_samples == NUM_SAMPLES, "Wrong number of samples.");
+	fail_unless(unitsize == 2, "Wrong unitsize.");
+	for (start = NUM_SAMPLES - 1; start > 0; start /= 3) {
+		count = 1;
+		ret = sr_session_reader_get(reader, start, &count, &p);
+		fail_unless(ret == SR_OK, "sr_session_reader_get() failed: %d.",
+				ret);
+		data = p;
+		fail_unless(data[0] == (uint16_t)start, "Wrong sample data.");
+	}
+	sr_session_reader_close(reader);
+	unlink(RECORD_FILENAME);
+}
+END_TEST
+
+/*
+ * Check that a recording ring keeps only its last files, each with the
+ * samples the index says.
+ */
+START_TEST(test_record_rotate)
+{
+	struct sr_session *session;
+	struct sr_session_reader *reader;
+	const uint16_t *data;
+	const void *p;
+	char *index, **lines, name[64];
+	uint64_t num_samples, first, count;
+	int ret, unitsize, i, n;
+
+	write_file(0, FALSE, FALSE, FALSE);
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	ret = sr_session_record_to(session, RECORD_FILENAME, "rotate=0");
+	fail_unless(ret == SR_ERR_ARG, "Empty files accepted.");
+	ret = sr_session_record_to(session, RECORD_FILENAME,
+			"rotate=1000000,files=2");
+	fail_unless(ret == SR_OK, "sr_session_record_to() failed: %d.", ret);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	sr_session_destroy(session);
+
+	fail_unless(g_file_get_contents(RECORD_INDEX, &index, NULL, NULL),
+			"No index written.");
+	lines = g_strsplit(index, "\n", 0);
+	for (i = n = 0; lines[i]; i++) {
+		if (!lines[i][0] || lines[i][0] == '#')
+			continue;
+		fail_unless(sscanf(lines[i], "%63s %" SCNu64 " %" SCNu64,
+				name, &first, &num_samples) == 3,
+				"Bad index line '%s'.", lines[i]);
+		fail_unless(first == (uint64_t)(n + 2) * 1000000,
+				"Wrong first sample.");
+		ret = sr_session_reader_open(&reader, name);
+		fail_unless(ret == SR_OK, "Opening '%s' failed: %d.", name,
+				ret);
+		sr_session_reader_info(reader, &count, &unitsize);
+		fail_unless(count == num_samples, "Wrong number of samples.");
+		fail_unless(count == MIN(NUM_SAMPLES - first, 1000000),
+				"Wrong file size.");
+		count = 1;
+		ret = sr_session_reader_get(reader, 0, &count, &p);
+		fail_unless(ret == SR_OK, "sr_session_reader_get() failed: %d.",
+				ret);
+		data = p;
+		fail_unless(data[0] == (uint16_t)first, "Wrong sample data.");
+		sr_session_reader_close(reader);
+		unlink(name);
+		n++;
+	}
+	fail_unless(n == 2, "%d files kept.", n);
+	g_strfreev(lines);
+	g_free(index);
+	unlink(RECORD_INDEX);
+	for (i = 1; i <= 2; i++) {
+		snprintf(name, sizeof(name), "check-session-record-%d.sr", i);
+		fail_unless(access(name, F_OK) != 0, "Old file kept.");
+	}
+}
+END_TEST
+
+/* What a flight recorder replayed: its first sample, and the packets. */
+static uint64_t flight_first, flight_samples;
+static int flight_headers, flight_ends;
+
+static void flight_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	const uint16_t *data;
+	uint64_t i;
+
+	(void)sdi;
+	(void)cb_data;
+
+	if (packet->type == SR_DF_HEADER)
+		flight_headers++;
+	else if (packet->type == SR_DF_END)
+		flight_ends++;
+	if (packet->type != SR_DF_LOGIC)
+		return;
+
+	logic = packet->payload;
+	data = logic->data;
+	if (!flight_samples)
+		flight_first = data[0];
+	for (i = 0; i < logic->length / 2; i++)
+		if (data[i] != (uint16_t)(flight_first + flight_samples + i))
+			replay_ok = FALSE;
+	flight_samples += logic->length / 2;
+}
+
+/*
+ * Check that a flight recorder keeps the latest samples, up to its size,
+ * and saves the same to a file.
+ */
+START_TEST(test_flight_recorder)
+{
+	struct sr_session *session;
+	struct sr_session_reader *reader;
+	const uint16_t *data;
+	const void *p;
+	uint64_t num_samples, count;
+	int ret, unitsize;
+
+	write_file(0, FALSE, FALSE, FALSE);
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	ret = sr_session_flight_replay(session, flight_datafeed_in, NULL);
+	fail_unless(ret == SR_ERR_NA, "Replayed without a flight recorder.");
+	ret = sr_session_flight_recorder_set(session, 1024 * 1024);
+	fail_unless(ret == SR_OK, "Setting the flight recorder failed: %d.",
+			ret);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+
+	replay_ok = TRUE;
+	flight_samples = 0;
+	flight_headers = flight_ends = 0;
+	ret = sr_session_flight_replay(session, flight_datafeed_in, NULL);
+	fail_unless(ret == SR_OK, "sr_session_flight_replay() failed: %d.",
+			ret);
+	fail_unless(flight_headers == 1 && flight_ends == 1,
+			"No complete acquisition replayed.");
+	fail_unless(replay_ok, "Samples out of order.");
+	fail_unless(flight_samples > 0 && flight_samples <= 512 * 1024,
+			"Wrong number of samples kept.");
+	fail_unless((uint16_t)(flight_first + flight_samples)
+			== (uint16_t)NUM_SAMPLES, "Not the last samples kept.");
+
+	ret = sr_session_flight_save(session, RECORD_FILENAME, NULL);
+	fail_unless(ret == SR_OK, "sr_session_flight_save() failed: %d.", ret);
+	ret = sr_session_flight_recorder_set(session, 0);
+	fail_unless(ret == SR_OK, "Removing the flight recorder failed: %d.",
+			ret);
+	ret = sr_session_flight_replay(session, flight_datafeed_in, NULL);
+	fail_unless(ret == SR_ERR_NA, "Replayed an empty flight recorder.");
+	sr_session_destroy(session);
+
+	ret = sr_session_reader_open(&reader, RECORD_FILENAME);
+	fail_unless(ret == SR_OK, "sr_session_reader_open() failed: %d.", ret);
+	sr_session_reader_info(reader, &num_samples, &unitsize);
+	fail_unless(num_samples == flight_samples, "Wrong number of samples.");
+	count = 1;
+	ret = sr_session_reader_get(reader, 0, &count, &p);
+	fail_unless(ret == SR_OK, "sr_session_reader_get() failed: %d.", ret);
+	data = p;
+	fail_unless(data[0] == (uint16_t)flight_first, "Wrong sample data.");
+	sr_session_reader_close(reader);
+	unlink(RECORD_FILENAME);
+}
+END_TEST
+
+/* Largest logic packet seen in a replay. */
+static uint64_t replay_max_length;
+
+static void paced_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+
+	replay_datafeed_in(sdi, packet, cb_data);
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		replay_max_length = MAX(replay_max_length, logic->length);
+	}
+}
+
+/*
+ * Check that a paced replay takes as long as the samplerate and speed
+ * say, in packets no larger than the buffer size.
+ */
+START_TEST(test_replay_paced)
+{
+	struct sr_session *session;
+	struct sr_dev_inst *sdi;
+	GSList *devlist;
+	int64_t start, elapsed;
+	int ret;
+
+	write_file(1, FALSE, FALSE, FALSE);
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	sr_session_datafeed_callback_add(session, paced_datafeed_in, NULL);
+	ret = sr_session_dev_list(session, &devlist);
+	fail_unless(ret == SR_OK && devlist);
+	sdi = devlist->data;
+	g_slist_free(devlist);
+
+	/* 200 ms of data at real time, replayed at twice the speed. */
+	ret = sr_config_set(sdi, NULL, SR_CONF_SAMPLERATE,
+			g_variant_new_uint64(NUM_SAMPLES * 5));
+	fail_unless(ret == SR_OK, "Setting the samplerate failed: %d.", ret);
+	ret = sr_config_set(sdi, NULL, SR_CONF_REPLAY_SPEED,
+			g_variant_new_double(2.0));
+	fail_unless(ret == SR_OK, "Setting the speed failed: %d.", ret);
+	ret = sr_config_set(sdi, NULL, SR_CONF_BUFFERSIZE,
+			g_variant_new_uint64(4096));
+	fail_unless(ret == SR_OK, "Setting the buffer size failed: %d.", ret);
+	ret = sr_config_set(sdi, NULL, SR_CONF_REPLAY_SPEED,
+			g_variant_new_double(-1));
+	fail_unless(ret == SR_ERR_ARG, "A negative speed was accepted.");
+
+	replay_samples = replay_max_length = 0;
+	replay_ok = TRUE;
+	start = g_get_monotonic_time();
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	elapsed = g_get_monotonic_time() - start;
+	fail_unless(replay_samples == NUM_SAMPLES, "Wrong number of samples.");
+	fail_unless(replay_ok, "Samples out of order.");
+	fail_unless(replay_max_length <= 4096, "Packets are too large.");
+	fail_unless(elapsed >= 90 * 1000, "Replay wasn't paced: %" PRIi64
+			" us.", elapsed);
+
+	sr_session_destroy(session);
+}
+END_TEST
+
+static gpointer stop_thread(gpointer data)
+{
+	g_usleep(20 * 1000);
+	sr_session_stop(data);
+
+	return NULL;
+}
+
+/* A stop from another thread ends a long replay right away. */
+START_TEST(test_replay_stop)
+{
+	struct sr_session *session;
+	struct sr_dev_inst *sdi;
+	GSList *devlist;
+	GThread *thread;
+	int64_t start, elapsed;
+	int ret;
+
+	write_file(1, FALSE, FALSE, FALSE);
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	sr_session_datafeed_callback_add(session, paced_datafeed_in, NULL);
+	ret = sr_session_dev_list(session, &devlist);
+	fail_unless(ret == SR_OK && devlist);
+	sdi = devlist->data;
+	g_slist_free(devlist);
+
+	/* 10 s of data at real time. */
+	sr_config_set(sdi, NULL, SR_CONF_SAMPLERATE,
+			g_variant_new_uint64(NUM_SAMPLES / 10));
+	sr_config_set(sdi, NULL, SR_CONF_REPLAY_SPEED,
+			g_variant_new_double(1.0));
+
+	replay_samples = replay_max_length = 0;
+	replay_ok = TRUE;
+	start = g_get_monotonic_time();
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	thread = g_thread_new("stop", stop_thread, session);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	elapsed = g_get_monotonic_time() - start;
+	g_thread_join(thread);
+	fail_unless(replay_samples < NUM_SAMPLES, "The replay wasn't stopped.");
+	fail_unless(elapsed < 1000 * 1000, "Stopping took %" PRIi64 " us.",
+			elapsed);
+
+	sr_session_destroy(session);
+}
+END_TEST
+
+/* Samplerates of the two devices of the merge test, and where each is. */
+static uint64_t merge_rates[2];
+static GSList *merge_devs;
+static uint64_t merge_samples[2];
+static double merge_last;
+
+static void merge_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	double time;
+	int i;
+
+	(void)cb_data;
+
+	if (packet->type != SR_DF_LOGIC)
+		return;
+
+	i = g_slist_index(merge_devs, sdi);
+	fail_unless(i >= 0, "Unknown device.");
+	logic = packet->payload;
+	time = (double)logic->start_sample / merge_rates[i];
+	if (time < merge_last)
+		replay_ok = FALSE;
+	merge_last = time;
+	merge_samples[i] += logic->length;
+}
+
+/* Check that the merge transform orders two devices' packets by time. */
+START_TEST(test_replay_merge)
+{
+	struct sr_session_writer *writer;
+	struct sr_transform_format **formats, *format;
+	struct sr_session *session;
+	struct sr_dev_inst sdi[2];
+	struct sr_probe probes[2];
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	uint8_t *buf;
+	GSList *l;
+	int ret, i;
+
+	format = NULL;
+	formats = sr_transform_list();
+	for (i = 0; formats[i]; i++) {
+		if (!strcmp(formats[i]->id, "merge"))
+			format = formats[i];
+	}
+	fail_unless(format != NULL, "No merge transform.");
+
+	memset(sdi, 0, sizeof(sdi));
+	memset(probes, 0, sizeof(probes));
+	for (i = 0; i < 2; i++) {
+		probes[i].type = SR_PROBE_LOGIC;
+		probes[i].enabled = TRUE;
+		probes[i].name = i ? "B0" : "A0";
+		sdi[i].probes = g_slist_append(NULL, &probes[i]);
+	}
+	buf = g_try_malloc0(NUM_SAMPLES);
+	fail_unless(buf != NULL);
+	ret = sr_session_writer_open(&writer, FILENAME, &sdi[0], 1);
+	fail_unless(ret == SR_OK, "sr_session_writer_open() failed: %d.", ret);
+	ret = sr_session_writer_dev_add(writer, &sdi[1], 1);
+	fail_unless(ret == SR_OK, "sr_session_writer_dev_add() failed: %d.",
+			ret);
+	memset(&logic, 0, sizeof(logic));
+	logic.length = NUM_SAMPLES;
+	logic.unitsize = 1;
+	logic.data = buf;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	for (i = 0; i < 2; i++) {
+		ret = sr_session_writer_dev_packet(writer, &sdi[i], &packet);
+		fail_unless(ret == SR_OK, "Write failed: %d.", ret);
+	}
+	ret = sr_session_writer_close(writer);
+	fail_unless(ret == SR_OK, "sr_session_writer_close() failed: %d.", ret);
+	g_free(buf);
+	g_slist_free(sdi[0].probes);
+	g_slist_free(sdi[1].probes);
+
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	ret = sr_session_dev_list(session, &merge_devs);
+	fail_unless(ret == SR_OK && g_slist_length(merge_devs) == 2,
+			"Expected two devices.");
+	/* The second device's data takes a quarter of the time. */
+	merge_rates[0] = SR_MHZ(1);
+	merge_rates[1] = SR_MHZ(4);
+	for (i = 0, l = merge_devs; l; i++, l = l->next)
+		sr_config_set(l->data, NULL, SR_CONF_SAMPLERATE,
+				g_variant_new_uint64(merge_rates[i]));
+	ret = sr_session_transform_add(session, format, NULL);
+	fail_unless(ret == SR_OK, "Adding the transform failed: %d.", ret);
+	sr_session_datafeed_callback_add(session, merge_datafeed_in, NULL);
+
+	merge_samples[0] = merge_samples[1] = 0;
+	merge_last = 0;
+	replay_ok = TRUE;
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	fail_unless(merge_samples[0] == NUM_SAMPLES
+			&& merge_samples[1] == NUM_SAMPLES,
+			"Wrong number of samples.");
+	fail_unless(replay_ok, "Packets out of time order.");
+
+	g_slist_free(merge_devs);
+	sr_session_destroy(session);
+}
+END_TEST
+
+/*
+ * Check single probe access: with each sample being its own index, probe 0
+ * toggles at every sample and probe 1 at every second one.
+ */
+static void check_probes(void)
+{
+	struct sr_session_reader *reader;
+	const uint8_t *data;
+	const void *p;
+	uint64_t count;
+	int ret;
+
+	ret = sr_session_reader_open(&reader, FILENAME);
+	fail_unless(ret == SR_OK, "sr_session_reader_open() failed: %d.", ret);
+
+	count = 64;
+	ret = sr_session_reader_probe_get(reader, 0, 1024, &count, &p);
+	fail_unless(ret == SR_OK, "Getting probe 0 failed: %d.", ret);
+	fail_unless(count == 64, "Wrong count.");
+	data = p;
+	fail_unless(data[0] == 0xaa && data[7] == 0xaa, "Wrong probe 0 data.");
+	count = 8;
+	ret = sr_session_reader_probe_get(reader, 1, NUM_SAMPLES - 8, &count,
+			&p);
+	fail_unless(ret == SR_OK, "Getting probe 1 failed: %d.", ret);
+	fail_unless(count == 8, "Wrong count.");
+	data = p;
+	fail_unless(data[0] == 0xcc, "Wrong probe 1 data.");
+
+	count = 8;
+	ret = sr_session_reader_probe_get(reader, 0, 3, &count, &p);
+	fail_unless(ret == SR_ERR_ARG, "Unaligned start was accepted.");
+	ret = sr_session_reader_probe_get(reader, 16, 0, &count, &p);
+	fail_unless(ret == SR_ERR_ARG, "Unknown probe was accepted.");
+
+	sr_session_reader_close(reader);
+}
+
+/* Check random and single probe access to interleaved samples. */
+START_TEST(test_reader_probes)
+{
+	write_file(1, FALSE, FALSE, FALSE);
+	check_probes();
+}
+END_TEST
+
+/*
+ * Check that the planar layout reads back the same, both randomly and
+ * when replayed.
+ */
+START_TEST(test_reader_planar)
+{
+	struct sr_session *session;
+	int ret;
+
+	write_file(1, TRUE, TRUE, FALSE);
+	check_reader();
+	check_probes();
+
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	sr_session_datafeed_callback_add(session, replay_datafeed_in, NULL);
+	replay_samples = 0;
+	replay_ok = TRUE;
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start() failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+	fail_unless(replay_samples == NUM_SAMPLES, "Wrong number of samples.");
+	fail_unless(replay_ok, "Samples out of order.");
+	sr_session_destroy(session);
+}
+END_TEST
+
+/*
+ * Check that run-length coded chunks read back the same, randomly, when
+ * appended to, and when replayed with and without threads.
+ */
+START_TEST(test_reader_rle)
+{
+	struct sr_session *session;
+	struct sr_session_reader *reader;
+	struct stat st;
+	const uint16_t *data;
+	const void *p;
+	uint16_t buf[1000];
+	uint64_t num_samples, count;
+	int ret, unitsize, i;
+
+	write_file(1, FALSE, FALSE, TRUE);
+	/* Only the lowest probes change often enough not to shrink. */
+	fail_unless(stat(FILENAME, &st) == 0 && st.st_size < NUM_SAMPLES,
+			"Coded file too large.");
+	check_reader();
+
+	for (i = 0; i < 1000; i++)
+		buf[i] = NUM_SAMPLES + i;
+	ret = sr_session_append(FILENAME, (unsigned char *)buf, 2, 1000);
+	fail_unless(ret == SR_OK, "sr_session_append() failed: %d.", ret);
+	ret = sr_session_reader_open(&reader, FILENAME);
+	fail_unless(ret == SR_OK, "sr_session_reader_open() failed: %d.", ret);
+	sr_session_reader_info(reader, &num_samples, &unitsize);
+	fail_unless(num_samples == NUM_SAMPLES + 1000,
+			"Wrong number of samples.");
+	count = 1;
+	ret = sr_session_reader_get(reader, NUM_SAMPLES + 999, &count, &p);
+	fail_unless(ret == SR_OK, "sr_session_reader_get() failed: %d.", ret);
+	data = p;
+	fail_unless(data[0] == (uint16_t)(NUM_SAMPLES + 999),
+			"Wrong sample data.");
+	sr_session_reader_close(reader);
+
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	sr_session_datafeed_callback_add(session, replay_datafeed_in, NULL);
+	for (i = 1; i <= 4; i += 3) {
+		ret = sr_session_replay_threads_set(session, i);
+		fail_unless(ret == SR_OK, "Setting the threads failed: %d.",
+				ret);
+		replay_samples = 0;
+		replay_ok = TRUE;
+		ret = sr_session_start(session);
+		fail_unless(ret == SR_OK, "sr_session_start() failed: %d.",
+				ret);
+		ret = sr_session_run(session);
+		fail_unless(ret == SR_OK, "sr_session_run() failed: %d.", ret);
+		fail_unless(replay_samples == NUM_SAMPLES + 1000,
+				"Wrong number of samples.");
+		fail_unless(replay_ok, "Samples out of order.");
+	}
+	sr_session_destroy(session);
+}
+END_TEST
+
+/*
+ * Check that a file being written can be followed, chunk by chunk, until
+ * the writer closes it.
+ */
+START_TEST(test_reader_tail)
+{
+	struct sr_session_writer *writer;
+	struct sr_session_reader *reader;
+	struct sr_dev_inst sdi;
+	const uint16_t *data;
+	const void *p;
+	uint64_t num_samples, count;
+	uint16_t *buf;
+	gboolean done;
+	char c;
+	int fds[2], ret, i;
+
+	memset(&sdi, 0, sizeof(sdi));
+	buf = g_try_malloc(NUM_SAMPLES * sizeof(uint16_t));
+	fail_unless(buf != NULL);
+	for (i = 0; i < NUM_SAMPLES; i++)
+		buf[i] = i;
+	fail_unless(pipe(fds) == 0, "pipe() failed.");
+
+	ret = sr_session_writer_open(&writer, FILENAME, &sdi, 2);
+	fail_unless(ret == SR_OK, "sr_session_writer_open() failed: %d.", ret);
+	ret = sr_session_writer_notify_set(writer, fds[1]);
+	fail_unless(ret == SR_OK);
+	ret = sr_session_reader_tail_open(&reader, FILENAME, 2);
+	fail_unless(ret == SR_OK, "sr_session_reader_tail_open() failed: %d.",
+			ret);
+	sr_session_reader_info(reader, &num_samples, NULL);
+	fail_unless(num_samples == 0, "Samples before any were written.");
+
+	/* More than a chunk, the rest stays in the writer for now. */
+	ret = sr_session_writer_write(writer, buf, NUM_SAMPLES);
+	fail_unless(ret == SR_OK, "Write failed: %d.", ret);
+	fail_unless(read(fds[0], &c, 1) == 1, "No notification.");
+	ret = sr_session_reader_tail_update(reader, &done);
+	fail_unless(ret == SR_OK, "Update failed: %d.", ret);
+	fail_unless(!done, "Done before the writer closed the file.");
+	sr_session_reader_info(reader, &num_samples, NULL);
+	fail_unless(num_samples > 0 && num_samples < NUM_SAMPLES,
+			"Wrong number of samples written so far.");
+	count = 1;
+	ret = sr_session_reader_get(reader, num_samples - 1, &count, &p);
+	fail_unless(ret == SR_OK, "sr_session_reader_get() failed: %d.", ret);
+	data = p;
+	fail_unless(data[0] == (uint16_t)(num_samples - 1),
+			"Wrong sample data.");
+
+	ret = sr_session_writer_close(writer);
+	fail_unless(ret == SR_OK, "sr_session_writer_close() failed: %d.", ret);
+	ret = sr_session_reader_tail_update(reader, &done);
+	fail_unless(ret == SR_OK, "Update failed: %d.", ret);
+	fail_unless(done, "Not done after the writer closed the file.");
+	sr_session_reader_info(reader, &num_samples, NULL);
+	fail_unless(num_samples == NUM_SAMPLES, "Wrong number of samples.");
+	count = 1;
+	ret = sr_session_reader_get(reader, NUM_SAMPLES - 1, &count, &p);
+	fail_unless(ret == SR_OK, "sr_session_reader_get() failed: %d.", ret);
+	data = p;
+	fail_unless(data[0] == (uint16_t)(NUM_SAMPLES - 1),
+			"Wrong sample data.");
+	sr_session_reader_close(reader);
+
+	close(fds[0]);
+	close(fds[1]);
+	g_free(buf);
+}
+END_TEST
+
+/*
+ * Check that a spill buffer keeps only its window in RAM while capturing,
+ * and leaves a complete session file behind.
+ */
+START_TEST(test_spill)
+{
+	struct sr_session_spill *spill;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_dev_inst sdi;
+	const uint16_t *data;
+	const void *p;
+	uint64_t num_samples, first, count;
+	uint16_t *buf;
+	int ret, i;
+
+	memset(&sdi, 0, sizeof(sdi));
+	buf = g_try_malloc(NUM_SAMPLES * sizeof(uint16_t));
+	fail_unless(buf != NULL);
+	for (i = 0; i < NUM_SAMPLES; i++)
+		buf[i] = i;
+
+	ret = sr_session_spill_open(&spill, FILENAME, &sdi, 2, 250000);
+	fail_unless(ret == SR_OK, "sr_session_spill_open() failed: %d.", ret);
+
+	/* Packets both smaller and larger than the window. */
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	logic.unitsize = 2;
+	for (i = 0; i < NUM_SAMPLES; i += count) {
+		count = MIN(i % 3 ? 100000 : 300000, NUM_SAMPLES - i);
+		logic.length = count * 2;
+		logic.data = buf + i;
+		ret = sr_session_spill_packet(spill, &packet);
+		fail_unless(ret == SR_OK, "Spill failed: %d.", ret);
+	}
+
+	sr_session_spill_info(spill, &num_samples, &first);
+	fail_unless(num_samples == NUM_SAMPLES, "Wrong number of samples.");
+	fail_unless(first == NUM_SAMPLES - 250000, "Wrong window.");
+	count = 1;
+	ret = sr_session_spill_get(spill, first - 1, &count, &p);
+	fail_unless(ret == SR_ERR_NA, "Got a spilled sample from RAM.");
+	for (i = first; i < NUM_SAMPLES; i += count) {
+		count = NUM_SAMPLES;
+		ret = sr_session_spill_get(spill, i, &count, &p);
+		fail_unless(ret == SR_OK, "sr_session_spill_get() failed: %d.",
+				ret);
+		data = p;
+		fail_unless(data[0] == (uint16_t)i, "Wrong sample data.");
+		fail_unless(data[count - 1] == (uint16_t)(i + count - 1));
+	}
+
+	/* Once ended, everything is read back from the file. */
+	packet.type = SR_DF_END;
+	ret = sr_session_spill_packet(spill, &packet);
+	fail_unless(ret == SR_OK, "Ending the capture failed: %d.", ret);
+	count = 10;
+	ret = sr_session_spill_get(spill, 1, &count, &p);
+	fail_unless(ret == SR_OK, "sr_session_spill_get() failed: %d.", ret);
+	data = p;
+	fail_unless(data[0] == 1, "Wrong sample data.");
+	ret = sr_session_spill_close(spill);
+	fail_unless(ret == SR_OK, "sr_session_spill_close() failed: %d.", ret);
+	g_free(buf);
+
+	check_reader();
+}
+END_TEST
+
+Suite *suite_session_file(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("session_file");
+
+	tc = tcase_create("writer");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_writer_roundtrip);
+	tcase_add_loop_test(tc, test_writer_mixed, 0, 2);
+	tcase_add_test(tc, test_spill);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("reader");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_reader_stored);
+	tcase_add_test(tc, test_reader_deflated);
+	tcase_add_test(tc, test_append);
+	tcase_add_test(tc, test_reader_summary);
+	tcase_add_test(tc, test_reader_find);
+	tcase_add_test(tc, test_load_twice);
+	tcase_add_test(tc, test_replay_threads);
+	tcase_add_test(tc, test_record_to);
+	tcase_add_test(tc, test_record_rotate);
+	tcase_add_test(tc, test_flight_recorder);
+	tcase_add_test(tc, test_replay_paced);
+	tcase_add_test(tc, test_replay_stop);
+	tcase_add_test(tc, test_replay_merge);
+	tcase_add_test(tc, test_reader_probes);
+	tcase_add_test(tc, test_reader_planar);
+	tcase_add_test(tc, test_reader_rle);
+	tcase_add_test(tc, test_reader_tail);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("roundtrip");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_loop_test(tc, test_demo_roundtrip, 0,
+			G_N_ELEMENTS(roundtrip_options));
+	suite_add_tcase(s, tc);
+
+	return s;
+}
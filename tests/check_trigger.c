@@ -0,0 +1,756 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+#include "../libsigrok.h"
+
+#define FILENAME "check-trigger.sr"
+
+/* Large enough for the session file to be sent in several packets. */
+#define NUM_SAMPLES (3 * 1024 * 1024)
+
+/* CLK goes high here, DATA stays high from here on. */
+#define EDGE (2 * 1024 * 1024 + 12345)
+
+#define CLK  (1 << 0)
+#define DATA (1 << 1)
+
+static struct sr_context *sr_ctx;
+static struct sr_session *session;
+
+/* What the datafeed callback saw. */
+static gboolean seen_trigger, seen_end;
+static uint64_t samples_before, samples_after, first_start;
+static uint8_t first_sample;
+
+static void setup(void)
+{
+	int ret;
+
+	ret = sr_init(&sr_ctx);
+	fail_unless(ret == SR_OK, "sr_init() failed: %d.", ret);
+}
+
+static void teardown(void)
+{
+	sr_exit(sr_ctx);
+	unlink(FILENAME);
+}
+
+static void write_file(void)
+{
+	struct sr_session_writer *writer;
+	struct sr_dev_inst sdi;
+	struct sr_probe probes[2];
+	uint8_t *buf;
+	int ret, i;
+
+	memset(&sdi, 0, sizeof(sdi));
+	memset(probes, 0, sizeof(probes));
+	for (i = 0; i < 2; i++) {
+		probes[i].index = i;
+		probes[i].type = SR_PROBE_LOGIC;
+		probes[i].enabled = TRUE;
+		sdi.probes = g_slist_append(sdi.probes, &probes[i]);
+	}
+	probes[0].name = "CLK";
+	probes[1].name = "DATA";
+
+	buf = g_try_malloc0(NUM_SAMPLES);
+	fail_unless(buf != NULL);
+	buf[EDGE] = CLK | DATA;
+	for (i = EDGE + 1; i < NUM_SAMPLES; i++)
+		buf[i] = DATA;
+
+	ret = sr_session_writer_open(&writer, FILENAME, &sdi, 1);
+	fail_unless(ret == SR_OK, "sr_session_writer_open() failed: %d.", ret);
+	ret = sr_session_writer_write(writer, buf, NUM_SAMPLES);
+	fail_unless(ret == SR_OK, "Write failed: %d.", ret);
+	ret = sr_session_writer_close(writer);
+	fail_unless(ret == SR_OK, "sr_session_writer_close() failed: %d.", ret);
+	g_free(buf);
+	g_slist_free(sdi.probes);
+}
+
+static void datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+
+	(void)sdi;
+	(void)cb_data;
+
+	switch (packet->type) {
+	case SR_DF_TRIGGER:
+		fail_unless(!seen_trigger, "More than one trigger.");
+		seen_trigger = TRUE;
+		break;
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		fail_unless(logic->unitsize == 1, "Wrong unitsize.");
+		if (!seen_trigger) {
+			samples_before += logic->length;
+		} else {
+			if (!samples_after && logic->length) {
+				first_sample = *(const uint8_t *)logic->data;
+				first_start = logic->start_sample;
+			}
+			samples_after += logic->length;
+		}
+		break;
+	case SR_DF_END:
+		seen_end = TRUE;
+		break;
+	}
+}
+
+/* Run the session file with the given trigger. */
+static void run_trigger(const char *trigger)
+{
+	GSList *devlist;
+	int ret;
+
+	seen_trigger = seen_end = FALSE;
+	samples_before = samples_after = first_start = 0;
+	first_sample = 0;
+
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	ret = sr_session_dev_list(session, &devlist);
+	fail_unless(ret == SR_OK);
+	fail_unless(devlist != NULL, "No device.");
+	ret = sr_session_trigger_set(session, devlist->data, trigger);
+	fail_unless(ret == SR_OK, "sr_session_trigger_set(session, ) failed: %d.", ret);
+	g_slist_free(devlist);
+
+	sr_session_datafeed_callback_add(session, datafeed_in, NULL);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start(session) failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run(session) failed: %d.", ret);
+	fail_unless(seen_end, "No SR_DF_END packet.");
+	sr_session_destroy(session);
+}
+
+/*
+ * Check that a level trigger fires on the first matching sample, with
+ * the plain C kernels first, then with those for the CPU.
+ */
+START_TEST(test_trigger_level)
+{
+	sr_cpu_features_limit(_i ? ~0u : 0);
+	fail_unless(_i || sr_cpu_features_get() == 0, "Features not limited.");
+	write_file();
+	run_trigger("DATA=1");
+	fail_unless(seen_trigger, "Trigger didn't fire.");
+	fail_unless(samples_before == 0, "Data sent before the trigger.");
+	fail_unless(samples_after == NUM_SAMPLES - EDGE,
+			"Wrong number of samples after the trigger.");
+	fail_unless(first_sample == (CLK | DATA), "Wrong first sample.");
+	fail_unless(first_start == EDGE, "Wrong first sample number.");
+	sr_cpu_features_limit(~0u);
+}
+END_TEST
+
+/*
+ * Check edge triggers, and that a missing edge doesn't fire, with the
+ * plain C kernels first, then with those for the CPU.
+ */
+START_TEST(test_trigger_edge)
+{
+	sr_cpu_features_limit(_i ? ~0u : 0);
+	fail_unless(_i || sr_cpu_features_get() == 0, "Features not limited.");
+	write_file();
+	run_trigger("CLK=r");
+	fail_unless(seen_trigger, "Rising edge trigger didn't fire.");
+	fail_unless(samples_after == NUM_SAMPLES - EDGE,
+			"Wrong number of samples after the trigger.");
+
+	run_trigger("DATA=f");
+	fail_unless(!seen_trigger, "Falling edge trigger fired.");
+	fail_unless(samples_before == 0 && samples_after == 0,
+			"Data sent without a trigger.");
+	sr_cpu_features_limit(~0u);
+}
+END_TEST
+
+/*
+ * Check that stages match on consecutive samples, with the plain C
+ * kernels first, then with those for the CPU.
+ */
+START_TEST(test_trigger_sequence)
+{
+	sr_cpu_features_limit(_i ? ~0u : 0);
+	fail_unless(_i || sr_cpu_features_get() == 0, "Features not limited.");
+	write_file();
+	run_trigger("CLK=01,DATA=01");
+	fail_unless(seen_trigger, "Sequence trigger didn't fire.");
+	fail_unless(samples_after == NUM_SAMPLES - EDGE + 1,
+			"Wrong number of samples after the trigger.");
+	fail_unless(first_sample == 0, "Wrong first sample.");
+	fail_unless(first_start == EDGE - 1, "Wrong first sample number.");
+
+	run_trigger("CLK=rf,DATA=11");
+	fail_unless(seen_trigger, "Sequence trigger didn't fire.");
+	fail_unless(samples_after == NUM_SAMPLES - EDGE,
+			"Wrong number of samples after the trigger.");
+
+	run_trigger("CLK=rr");
+	fail_unless(!seen_trigger, "Impossible sequence fired.");
+	sr_cpu_features_limit(~0u);
+}
+END_TEST
+
+START_TEST(test_trigger_invalid)
+{
+	GSList *devlist;
+	int ret;
+
+	write_file();
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	ret = sr_session_dev_list(session, &devlist);
+	fail_unless(ret == SR_OK);
+	fail_unless(sr_session_trigger_set(session, devlist->data, "CLK=x") != SR_OK,
+			"Invalid trigger type accepted.");
+	fail_unless(sr_session_trigger_set(session, devlist->data, "FOO=1") != SR_OK,
+			"Invalid probe accepted.");
+	fail_unless(sr_session_trigger_set(session, NULL, "CLK=1") != SR_OK,
+			"NULL device accepted.");
+	fail_unless(sr_session_trigger_set(session, NULL, NULL) == SR_OK,
+			"Disabling the trigger failed.");
+	g_slist_free(devlist);
+	sr_session_destroy(session);
+}
+END_TEST
+
+/*
+ * The protocol test's buses, at 1 MHz: UART at 100 kbaud, and SPI and
+ * I2C with a 10 sample clock period, each with two transactions.
+ */
+#define BUS_SAMPLES 60000
+#define BUS_SAMPLERATE 1000000
+
+#define RX   (1 << 0)
+#define CS   (1 << 1)
+#define SCK  (1 << 2)
+#define MOSI (1 << 3)
+#define SCL  (1 << 4)
+#define SDA  (1 << 5)
+
+static const char *bus_probes[] = { "RX", "CS", "SCK", "MOSI", "SCL", "SDA" };
+
+static void bus_set(uint8_t *buf, int from, int to, uint8_t bit, int level)
+{
+	int i;
+
+	for (i = from; i < to; i++) {
+		if (level)
+			buf[i] |= bit;
+		else
+			buf[i] &= ~bit;
+	}
+}
+
+/* Start bit, 8 data bits LSB first, stop bit. */
+static void bus_uart(uint8_t *buf, int start, uint8_t byte)
+{
+	int i;
+
+	bus_set(buf, start, start + 10, RX, 0);
+	for (i = 0; i < 8; i++)
+		bus_set(buf, start + 10 * (i + 1), start + 10 * (i + 2), RX,
+				(byte >> i) & 1);
+}
+
+/* Mode 0: MOSI changes while SCK is low, MSB first. */
+static void bus_spi(uint8_t *buf, int start, uint8_t byte)
+{
+	int i;
+
+	bus_set(buf, start, start + 100, CS, 0);
+	for (i = 0; i < 8; i++) {
+		bus_set(buf, start + 10 * i, start + 10 * i + 10, MOSI,
+				(byte >> (7 - i)) & 1);
+		bus_set(buf, start + 10 * i + 5, start + 10 * i + 10, SCK, 1);
+	}
+}
+
+/* START, the address byte, an ACK, STOP. */
+static void bus_i2c(uint8_t *buf, int start, uint8_t byte)
+{
+	int i, j;
+
+	bus_set(buf, start, start + 5, SDA, 0);
+	for (i = 0; i < 9; i++) {
+		j = start + 5 + 10 * i;
+		bus_set(buf, j, j + 10, SDA, i < 8 ? (byte >> (7 - i)) & 1 : 0);
+		bus_set(buf, j, j + 5, SCL, 0);
+	}
+	bus_set(buf, start + 95, start + 100, SDA, 0);
+}
+
+static void write_bus_file(void)
+{
+	struct sr_session_writer *writer;
+	struct sr_dev_inst sdi;
+	struct sr_probe probes[G_N_ELEMENTS(bus_probes)];
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_meta meta;
+	struct sr_config src;
+	uint8_t *buf;
+	unsigned int i;
+	int ret;
+
+	memset(&sdi, 0, sizeof(sdi));
+	memset(probes, 0, sizeof(probes));
+	for (i = 0; i < G_N_ELEMENTS(bus_probes); i++) {
+		probes[i].index = i;
+		probes[i].type = SR_PROBE_LOGIC;
+		probes[i].enabled = TRUE;
+		probes[i].name = (char *)bus_probes[i];
+		sdi.probes = g_slist_append(sdi.probes, &probes[i]);
+	}
+
+	buf = g_try_malloc(BUS_SAMPLES);
+	fail_unless(buf != NULL);
+	memset(buf, RX | CS | SCL | SDA, BUS_SAMPLES);
+	bus_uart(buf, 1000, 0x41);
+	bus_uart(buf, 5000, 0x55);
+	bus_uart(buf, 9000, 0x55);
+	bus_spi(buf, 20000, 0xa5);
+	bus_spi(buf, 30000, 0x3c);
+	bus_i2c(buf, 40000, 0x50 << 1);
+	bus_i2c(buf, 50000, 0x68 << 1 | 1);
+
+	ret = sr_session_writer_open(&writer, FILENAME, &sdi, 1);
+	fail_unless(ret == SR_OK, "sr_session_writer_open() failed: %d.", ret);
+	src.key = SR_CONF_SAMPLERATE;
+	src.data = g_variant_ref_sink(g_variant_new_uint64(BUS_SAMPLERATE));
+	meta.config = g_slist_append(NULL, &src);
+	packet.type = SR_DF_META;
+	packet.payload = &meta;
+	ret = sr_session_writer_packet(writer, &packet);
+	fail_unless(ret == SR_OK, "Meta write failed: %d.", ret);
+	ret = sr_session_writer_write(writer, buf, BUS_SAMPLES);
+	fail_unless(ret == SR_OK, "Write failed: %d.", ret);
+	ret = sr_session_writer_close(writer);
+	fail_unless(ret == SR_OK, "sr_session_writer_close() failed: %d.", ret);
+	g_variant_unref(src.data);
+	g_slist_free(meta.config);
+	g_slist_free(sdi.probes);
+	g_free(buf);
+}
+
+/* Run the bus file with a protocol trigger on the named probes. */
+static void run_protocol_trigger(struct sr_protocol_trigger *trigger,
+		const char *data, const char *clock, const char *select)
+{
+	const struct sr_probe *probe;
+	struct sr_dev_inst *sdi;
+	GSList *devlist, *l;
+	int ret;
+
+	seen_trigger = seen_end = FALSE;
+	samples_before = samples_after = first_start = 0;
+
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	ret = sr_session_dev_list(session, &devlist);
+	fail_unless(ret == SR_OK);
+	fail_unless(devlist != NULL, "No device.");
+	sdi = devlist->data;
+	g_slist_free(devlist);
+	for (l = sdi->probes; l; l = l->next) {
+		probe = l->data;
+		if (data && !strcmp(probe->name, data))
+			trigger->data = probe;
+		if (clock && !strcmp(probe->name, clock))
+			trigger->clock = probe;
+		if (select && !strcmp(probe->name, select))
+			trigger->select = probe;
+	}
+	ret = sr_session_protocol_trigger_set(session, sdi, trigger);
+	fail_unless(ret == SR_OK, "sr_session_protocol_trigger_set() "
+			"failed: %d.", ret);
+
+	sr_session_datafeed_callback_add(session, datafeed_in, NULL);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start(session) failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run(session) failed: %d.", ret);
+	fail_unless(seen_end, "No SR_DF_END packet.");
+	sr_session_destroy(session);
+}
+
+/* Check that the data is passed on from the matching transaction. */
+static void check_protocol_fired(uint64_t start)
+{
+	fail_unless(seen_trigger, "Protocol trigger didn't fire.");
+	fail_unless(samples_before == 0, "Data sent before the trigger.");
+	fail_unless(first_start == start, "Data sent from sample %" PRIu64
+			", not %" PRIu64 ".", first_start, start);
+	fail_unless(samples_after == BUS_SAMPLES - start,
+			"Wrong number of samples after the trigger.");
+}
+
+/* Check UART, SPI and I2C triggers on the second of two transactions. */
+START_TEST(test_trigger_protocol)
+{
+	struct sr_protocol_trigger trigger;
+
+	write_bus_file();
+
+	memset(&trigger, 0, sizeof(trigger));
+	trigger.type = SR_PROTOCOL_TRIGGER_UART;
+	trigger.baudrate = 100000;
+	trigger.value = 0x55;
+	trigger.mask = 0xff;
+	run_protocol_trigger(&trigger, "RX", NULL, NULL);
+	check_protocol_fired(5000);
+	trigger.value = 0x99;
+	run_protocol_trigger(&trigger, "RX", NULL, NULL);
+	fail_unless(!seen_trigger, "UART trigger fired on a missing byte.");
+
+	memset(&trigger, 0, sizeof(trigger));
+	trigger.type = SR_PROTOCOL_TRIGGER_SPI;
+	trigger.value = 0x3c;
+	trigger.mask = 0xff;
+	run_protocol_trigger(&trigger, "MOSI", "SCK", "CS");
+	check_protocol_fired(30000);
+
+	memset(&trigger, 0, sizeof(trigger));
+	trigger.type = SR_PROTOCOL_TRIGGER_I2C;
+	trigger.value = 0x68 << 1;
+	trigger.mask = 0xfe;
+	run_protocol_trigger(&trigger, "SDA", "SCL", NULL);
+	check_protocol_fired(50000);
+}
+END_TEST
+
+START_TEST(test_trigger_protocol_invalid)
+{
+	struct sr_protocol_trigger trigger;
+	struct sr_dev_inst *sdi;
+	GSList *devlist;
+	int ret;
+
+	write_bus_file();
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	ret = sr_session_dev_list(session, &devlist);
+	fail_unless(ret == SR_OK);
+	fail_unless(devlist != NULL, "No device.");
+	sdi = devlist->data;
+	g_slist_free(devlist);
+
+	memset(&trigger, 0, sizeof(trigger));
+	trigger.type = SR_PROTOCOL_TRIGGER_UART;
+	trigger.data = g_slist_nth_data(sdi->probes, 0);
+	fail_unless(sr_session_protocol_trigger_set(session, sdi,
+			&trigger) != SR_OK, "UART without baud rate accepted.");
+	trigger.type = SR_PROTOCOL_TRIGGER_I2C;
+	fail_unless(sr_session_protocol_trigger_set(session, sdi,
+			&trigger) != SR_OK, "I2C without clock accepted.");
+	trigger.type = SR_PROTOCOL_TRIGGER_SPI;
+	trigger.clock = g_slist_nth_data(sdi->probes, 2);
+	trigger.select = g_slist_nth_data(sdi->probes, 1);
+	trigger.spi_mode = 4;
+	fail_unless(sr_session_protocol_trigger_set(session, sdi,
+			&trigger) != SR_OK, "Invalid SPI mode accepted.");
+	trigger.spi_mode = 0;
+	fail_unless(sr_session_protocol_trigger_set(session, NULL,
+			&trigger) != SR_OK, "NULL device accepted.");
+	trigger.type = 0;
+	fail_unless(sr_session_protocol_trigger_set(session, sdi,
+			&trigger) != SR_OK, "Invalid protocol accepted.");
+	fail_unless(sr_session_protocol_trigger_set(session, NULL,
+			NULL) == SR_OK, "Disabling the trigger failed.");
+	sr_session_destroy(session);
+}
+END_TEST
+
+/* The analog test's sawtooth: 0 to 0.999, 1000 samples per period. */
+#define ANALOG_PERIOD 1000
+#define ANALOG_SAMPLES (20 * ANALOG_PERIOD)
+
+static int frames, bad_frames;
+static uint64_t frame_samples, frame_pre;
+static gboolean in_frame, frame_triggered;
+static float first_value;
+
+static void write_analog_file(void)
+{
+	struct sr_session_writer *writer;
+	struct sr_dev_inst sdi;
+	struct sr_probe probes[2];
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+	uint8_t *logic;
+	float *buf;
+	int ret, i;
+
+	memset(&sdi, 0, sizeof(sdi));
+	memset(probes, 0, sizeof(probes));
+	probes[0].type = SR_PROBE_LOGIC;
+	probes[0].enabled = TRUE;
+	probes[0].name = "D0";
+	probes[1].index = 1;
+	probes[1].type = SR_PROBE_ANALOG;
+	probes[1].enabled = TRUE;
+	probes[1].name = "CH1";
+	sdi.probes = g_slist_append(NULL, &probes[0]);
+	sdi.probes = g_slist_append(sdi.probes, &probes[1]);
+
+	logic = g_try_malloc0(ANALOG_SAMPLES);
+	buf = g_try_malloc(ANALOG_SAMPLES * sizeof(float));
+	fail_unless(logic != NULL && buf != NULL);
+	for (i = 0; i < ANALOG_SAMPLES; i++)
+		buf[i] = (i % ANALOG_PERIOD) / 1000.0;
+
+	ret = sr_session_writer_open(&writer, FILENAME, &sdi, 1);
+	fail_unless(ret == SR_OK, "sr_session_writer_open() failed: %d.", ret);
+	ret = sr_session_writer_write(writer, logic, ANALOG_SAMPLES);
+	fail_unless(ret == SR_OK, "Write failed: %d.", ret);
+	memset(&analog, 0, sizeof(analog));
+	analog.probes = g_slist_append(NULL, &probes[1]);
+	analog.num_samples = ANALOG_SAMPLES;
+	analog.mq = SR_MQ_VOLTAGE;
+	analog.unit = SR_UNIT_VOLT;
+	analog.data = buf;
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	ret = sr_session_writer_packet(writer, &packet);
+	fail_unless(ret == SR_OK, "Analog write failed: %d.", ret);
+	ret = sr_session_writer_close(writer);
+	fail_unless(ret == SR_OK, "sr_session_writer_close() failed: %d.", ret);
+	g_slist_free(analog.probes);
+	g_slist_free(sdi.probes);
+	g_free(logic);
+	g_free(buf);
+}
+
+static void datafeed_analog_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_analog *analog;
+
+	(void)sdi;
+	(void)cb_data;
+
+	switch (packet->type) {
+	case SR_DF_FRAME_BEGIN:
+		fail_unless(!in_frame, "Nested frames.");
+		in_frame = TRUE;
+		frame_triggered = FALSE;
+		frame_samples = frame_pre = 0;
+		break;
+	case SR_DF_TRIGGER:
+		fail_unless(in_frame, "Trigger outside a frame.");
+		fail_unless(!frame_triggered, "Two triggers in a frame.");
+		frame_triggered = TRUE;
+		frame_pre = frame_samples;
+		break;
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		fail_unless(in_frame, "Analog data outside a frame.");
+		if (frame_triggered && frame_samples == frame_pre)
+			first_value = analog->data[0];
+		frame_samples += analog->num_samples;
+		break;
+	case SR_DF_FRAME_END:
+		fail_unless(in_frame, "Frame end outside a frame.");
+		in_frame = FALSE;
+		frames++;
+		if (!frame_triggered || frame_pre != 100
+				|| frame_samples != 300 || first_value != 0.5)
+			bad_frames++;
+		break;
+	case SR_DF_END:
+		fail_unless(!in_frame, "Unfinished frame.");
+		seen_end = TRUE;
+		break;
+	}
+}
+
+/*
+ * Check that an analog trigger sends a frame around each rising edge,
+ * with the plain C kernels first, then with those for the CPU.
+ */
+START_TEST(test_trigger_analog)
+{
+	struct sr_analog_trigger trigger;
+	struct sr_dev_inst *sdi;
+	struct sr_probe *probe;
+	GSList *devlist;
+	int ret;
+
+	sr_cpu_features_limit(_i ? ~0u : 0);
+	fail_unless(_i || sr_cpu_features_get() == 0, "Features not limited.");
+	write_analog_file();
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	ret = sr_session_dev_list(session, &devlist);
+	fail_unless(ret == SR_OK);
+	fail_unless(devlist != NULL, "No device.");
+	sdi = devlist->data;
+	g_slist_free(devlist);
+	fail_unless(g_slist_length(sdi->probes) == 2, "Expected two probes.");
+	probe = g_slist_nth_data(sdi->probes, 1);
+
+	memset(&trigger, 0, sizeof(trigger));
+	trigger.type = SR_ANALOG_TRIGGER_RISING;
+	trigger.level = 0.5;
+	trigger.hysteresis = 0.1;
+	trigger.pre_samples = 100;
+	trigger.post_samples = 200;
+	fail_unless(sr_session_analog_trigger_set(session, sdi,
+			g_slist_nth_data(sdi->probes, 0), &trigger) != SR_OK,
+			"Logic probe accepted.");
+	trigger.hysteresis = -1;
+	fail_unless(sr_session_analog_trigger_set(session, sdi, probe,
+			&trigger) != SR_OK, "Negative hysteresis accepted.");
+	trigger.hysteresis = 0.1;
+	ret = sr_session_analog_trigger_set(session, sdi, probe, &trigger);
+	fail_unless(ret == SR_OK, "sr_session_analog_trigger_set() failed: "
+			"%d.", ret);
+
+	frames = bad_frames = 0;
+	in_frame = seen_end = FALSE;
+	sr_session_datafeed_callback_add(session, datafeed_analog_in, NULL);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start(session) failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run(session) failed: %d.", ret);
+	fail_unless(seen_end, "No SR_DF_END packet.");
+	fail_unless(frames == ANALOG_SAMPLES / ANALOG_PERIOD,
+			"Expected %d frames, got %d.",
+			ANALOG_SAMPLES / ANALOG_PERIOD, frames);
+	fail_unless(bad_frames == 0, "%d wrong frames.", bad_frames);
+	sr_session_destroy(session);
+	sr_cpu_features_limit(~0u);
+}
+END_TEST
+
+static void datafeed_frame_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_frame *frame;
+
+	(void)cb_data;
+
+	if (packet->type == SR_DF_END)
+		seen_end = TRUE;
+	if (packet->type != SR_DF_FRAME_END)
+		return;
+
+	/* The frame just ended is the latest one already. */
+	if (sr_session_frame_get(session, sdi, 0, &frame) != SR_OK
+			|| frame->frame_num != (uint64_t)frames
+			|| frame->num_probes != 1
+			|| frame->probes[0].num_samples != 300
+			|| frame->probes[0].data[100] != 0.5)
+		bad_frames++;
+	frames++;
+}
+
+/* Check that the last frames of an analog trigger are kept, in order. */
+START_TEST(test_frame_history)
+{
+	struct sr_analog_trigger trigger;
+	const struct sr_frame *frame;
+	struct sr_dev_inst *sdi;
+	GSList *devlist;
+	unsigned int i;
+	int ret;
+
+	write_analog_file();
+	ret = sr_session_load(FILENAME, &session);
+	fail_unless(ret == SR_OK, "sr_session_load() failed: %d.", ret);
+	ret = sr_session_dev_list(session, &devlist);
+	fail_unless(ret == SR_OK);
+	fail_unless(devlist != NULL, "No device.");
+	sdi = devlist->data;
+	g_slist_free(devlist);
+
+	memset(&trigger, 0, sizeof(trigger));
+	trigger.type = SR_ANALOG_TRIGGER_RISING;
+	trigger.level = 0.5;
+	trigger.hysteresis = 0.1;
+	trigger.pre_samples = 100;
+	trigger.post_samples = 200;
+	ret = sr_session_analog_trigger_set(session, sdi,
+			g_slist_nth_data(sdi->probes, 1), &trigger);
+	fail_unless(ret == SR_OK, "sr_session_analog_trigger_set() failed: "
+			"%d.", ret);
+	ret = sr_session_frame_history_set(session, 4);
+	fail_unless(ret == SR_OK, "sr_session_frame_history_set() failed: "
+			"%d.", ret);
+	ret = sr_session_frame_get(session, sdi, 0, &frame);
+	fail_unless(ret == SR_ERR_NA, "Got a frame before any: %d.", ret);
+
+	frames = bad_frames = 0;
+	seen_end = FALSE;
+	sr_session_datafeed_callback_add(session, datafeed_frame_in, NULL);
+	ret = sr_session_start(session);
+	fail_unless(ret == SR_OK, "sr_session_start(session) failed: %d.", ret);
+	ret = sr_session_run(session);
+	fail_unless(ret == SR_OK, "sr_session_run(session) failed: %d.", ret);
+	fail_unless(seen_end, "No SR_DF_END packet.");
+	fail_unless(frames == ANALOG_SAMPLES / ANALOG_PERIOD,
+			"Expected %d frames, got %d.",
+			ANALOG_SAMPLES / ANALOG_PERIOD, frames);
+	fail_unless(bad_frames == 0, "%d wrong frames.", bad_frames);
+
+	for (i = 0; i < 4; i++) {
+		ret = sr_session_frame_get(session, sdi, i, &frame);
+		fail_unless(ret == SR_OK, "Frame %u missing: %d.", i, ret);
+		fail_unless(frame->frame_num == (uint64_t)frames - 1 - i,
+				"Frame %u is number %" PRIu64 ".", i,
+				frame->frame_num);
+	}
+	ret = sr_session_frame_get(session, sdi, 4, &frame);
+	fail_unless(ret == SR_ERR_NA, "Got more frames than kept: %d.", ret);
+	sr_session_destroy(session);
+}
+END_TEST
+
+Suite *suite_trigger(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("trigger");
+
+	tc = tcase_create("soft");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_loop_test(tc, test_trigger_level, 0, 2);
+	tcase_add_loop_test(tc, test_trigger_edge, 0, 2);
+	tcase_add_loop_test(tc, test_trigger_sequence, 0, 2);
+	tcase_add_test(tc, test_trigger_invalid);
+	tcase_add_test(tc, test_trigger_protocol);
+	tcase_add_test(tc, test_trigger_protocol_invalid);
+	tcase_add_loop_test(tc, test_trigger_analog, 0, 2);
+	tcase_add_test(tc, test_frame_history);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
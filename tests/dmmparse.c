@@ -0,0 +1,216 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * DMM packet parser tests. Runs the packet check and parser of each chip
+ * in hardware/common/dmm, and of the drivers with parsers of their own,
+ * on a corpus of packets: ones as the meters send them, and broken ones.
+ * A packet the check should have rejected or accepted, a parser result
+ * other than the expected one, or a wrong value, quantity, unit or flag
+ * fails the test. The parsers are private to libsigrok, which is why
+ * this links it statically.
+ *
+ * With --bench, each chip's corpus is then run through its check and
+ * parser over and over, and the rate of the best of a few runs printed
+ * in packets per second, "name value unit" per line like the perf suite
+ * does. "make -C tests dmm-check" runs the tests.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "config.h"
+#include "../libsigrok.h"
+#include "dmmparse.h"
+
+static gboolean opt_bench = FALSE;
+static gint opt_packets = 1000000;
+static gint opt_runs = 3;
+static gint opt_loglevel = SR_LOG_NONE;
+static gchar *opt_only = NULL;
+
+static GOptionEntry optargs[] = {
+	{"bench", 'b', 0, G_OPTION_ARG_NONE, &opt_bench,
+		"Measure the parse rate after the tests", NULL},
+	{"packets", 'n', 0, G_OPTION_ARG_INT, &opt_packets,
+		"Packets per benchmark run", NULL},
+	{"runs", 'r', 0, G_OPTION_ARG_INT, &opt_runs,
+		"Runs per benchmark, the best counts", NULL},
+	{"loglevel", 'l', 0, G_OPTION_ARG_INT, &opt_loglevel,
+		"Log level of the parsers", NULL},
+	{"only", 'o', 0, G_OPTION_ARG_STRING, &opt_only,
+		"Only run chips whose name contains this", NULL},
+	{NULL, 0, 0, 0, NULL, NULL, NULL}
+};
+
+static const struct dmmparse_chip *chips[] = {
+	&dmmparse_fs9721,
+	&dmmparse_fs9922,
+	&dmmparse_es519xx_2400_11b,
+	&dmmparse_es519xx_19200_14b,
+	&dmmparse_metex14,
+#ifdef HAVE_HW_BRYMEN_DMM
+	&dmmparse_brymen,
+#endif
+#ifdef HAVE_HW_VICTOR_DMM
+	&dmmparse_victor,
+#endif
+	NULL,
+};
+
+static gboolean value_matches(float value, float expected)
+{
+	if (isnan(expected))
+		return isnan(value);
+	if (isinf(expected))
+		return value == expected;
+
+	return fabs(value - expected) <= fabs(expected) * 1e-6;
+}
+
+/* Returns the number of the chip's packets which failed. */
+static int chip_check(const struct dmmparse_chip *chip, void *info)
+{
+	const struct dmmparse_packet *p;
+	struct sr_datafeed_analog analog;
+	float value;
+	gboolean valid;
+	int failed, ret, i;
+
+	failed = 0;
+	for (i = 0; i < chip->num_packets; i++) {
+		p = &chip->packets[i];
+		valid = !chip->packet_valid || chip->packet_valid(p->buf);
+		if (valid != p->valid) {
+			printf("%s/%s: the check should %s the packet.\n",
+			       chip->name, p->name,
+			       p->valid ? "accept" : "reject");
+			failed++;
+			continue;
+		}
+		if (!valid)
+			continue;
+
+		memset(&analog, 0, sizeof(analog));
+		memset(info, 0, chip->info_size);
+		value = 0;
+		if ((ret = chip->packet_parse(p->buf, &value, &analog,
+				info)) != p->ret) {
+			printf("%s/%s: parsing returned %d, not %d.\n",
+			       chip->name, p->name, ret, p->ret);
+			failed++;
+			continue;
+		}
+		if (ret != SR_OK)
+			continue;
+
+		if (!value_matches(value, p->value) || analog.mq != p->mq
+		    || analog.unit != p->unit
+		    || analog.mqflags != p->mqflags) {
+			printf("%s/%s: got %g mq %d unit %d flags 0x%"
+			       PRIx64 ", not %g mq %d unit %d flags 0x%"
+			       PRIx64 ".\n",
+			       chip->name, p->name, value, analog.mq,
+			       analog.unit, analog.mqflags, p->value, p->mq,
+			       p->unit, p->mqflags);
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+/* Check and parse opt_packets packets of the corpus, in turns. */
+static void chip_bench_run(const struct dmmparse_chip *chip, void *info)
+{
+	const struct dmmparse_packet *p;
+	struct sr_datafeed_analog analog;
+	float value;
+	int i;
+
+	for (i = 0; i < opt_packets; i++) {
+		p = &chip->packets[i % chip->num_packets];
+		if (chip->packet_valid && !chip->packet_valid(p->buf))
+			continue;
+		memset(&analog, 0, sizeof(analog));
+		chip->packet_parse(p->buf, &value, &analog, info);
+	}
+}
+
+static void chip_bench(const struct dmmparse_chip *chip, void *info)
+{
+	gint64 start, elapsed, best;
+	int i;
+
+	best = G_MAXINT64;
+	for (i = 0; i < opt_runs; i++) {
+		start = g_get_monotonic_time();
+		chip_bench_run(chip, info);
+		elapsed = MAX(g_get_monotonic_time() - start, 1);
+		best = MIN(best, elapsed);
+	}
+
+	printf("dmm.%s %.1f kpackets/s\n", chip->name,
+	       opt_packets * 1000.0 / best);
+}
+
+int main(int argc, char **argv)
+{
+	GOptionContext *context;
+	GError *error;
+	const struct dmmparse_chip *chip;
+	void *info;
+	int failed, i;
+
+	error = NULL;
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, optargs, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+	if (opt_packets < 1 || opt_runs < 1) {
+		fprintf(stderr, "Packets and runs must be positive.\n");
+		return 1;
+	}
+
+	/* Broken packets make the parsers complain. */
+	sr_log_loglevel_set(opt_loglevel);
+
+	failed = 0;
+	for (i = 0; (chip = chips[i]); i++) {
+		if (opt_only && !strstr(chip->name, opt_only))
+			continue;
+		info = g_malloc0(MAX(chip->info_size, 1));
+		failed += chip_check(chip, info);
+		if (opt_bench)
+			chip_bench(chip, info);
+		g_free(info);
+	}
+
+	if (failed)
+		printf("%d packet(s) failed.\n", failed);
+
+	return failed ? 1 : 0;
+}
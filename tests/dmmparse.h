@@ -0,0 +1,73 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef LIBSIGROK_TESTS_DMMPARSE_H
+#define LIBSIGROK_TESTS_DMMPARSE_H
+
+#include <stdint.h>
+#include <glib.h>
+#include "../libsigrok.h"
+
+/* A recorded packet, and what the chip's parser must make of it. */
+struct dmmparse_packet {
+	const char *name;
+	const uint8_t *buf;
+	/* Whether the chip's packet check accepts it. */
+	gboolean valid;
+	/* For packets which pass the check: what parsing them returns. */
+	int ret;
+	/* For packets which parse: the results. */
+	float value;
+	int mq;
+	int unit;
+	uint64_t mqflags;
+};
+
+#define PACKET(name, buf, value, mq, unit, mqflags) \
+	{ name, buf, TRUE, SR_OK, value, mq, unit, mqflags }
+#define PACKET_UNPARSED(name, buf, ret) \
+	{ name, buf, TRUE, ret, 0, 0, 0, 0 }
+#define PACKET_INVALID(name, buf) \
+	{ name, buf, FALSE, SR_OK, 0, 0, 0, 0 }
+
+/*
+ * A DMM chip or protocol as seen by the parser tests. They are kept in
+ * files by the headers they need, since drivers' headers can't be
+ * included together.
+ */
+struct dmmparse_chip {
+	const char *name;
+	/* NULL if the parser checks packets itself. */
+	gboolean (*packet_valid)(const uint8_t *buf);
+	int (*packet_parse)(const uint8_t *buf, float *floatval,
+			struct sr_datafeed_analog *analog, void *info);
+	/* The size of the parser's info struct. */
+	size_t info_size;
+	const struct dmmparse_packet *packets;
+	int num_packets;
+};
+
+extern const struct dmmparse_chip dmmparse_fs9721;
+extern const struct dmmparse_chip dmmparse_fs9922;
+extern const struct dmmparse_chip dmmparse_es519xx_2400_11b;
+extern const struct dmmparse_chip dmmparse_es519xx_19200_14b;
+extern const struct dmmparse_chip dmmparse_metex14;
+extern const struct dmmparse_chip dmmparse_brymen;
+extern const struct dmmparse_chip dmmparse_victor;
+
+#endif
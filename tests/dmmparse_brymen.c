@@ -0,0 +1,69 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Packets of the Brymen BM850 series: DLE STX, a command and length byte,
+ * four flag bytes and the value as text, the XOR of those, DLE ETX. The
+ * parser looks for "OL" in the text with strstr(), so each packet here
+ * ends in a NUL, as the driver's receive buffer does.
+ */
+
+#include <math.h>
+#include "config.h"
+#include "../hardware/brymen-dmm/protocol.h"
+#include "dmmparse.h"
+
+#ifdef HAVE_HW_BRYMEN_DMM
+
+#define BUF(...) ((const uint8_t []){ __VA_ARGS__, 0x00 })
+
+static const struct dmmparse_packet brymen_packets[] = {
+	PACKET("dc-volt", BUF(0x10, 0x02, 0x00, 0x0e, 0x06, 0x00, 0x00,
+			0x00, ' ', '1', '.', '2', '3', '4', '5', 'E', '+', '0',
+			0x67, 0x10, 0x03),
+		1.2345, SR_MQ_VOLTAGE, SR_UNIT_VOLT, SR_MQFLAG_DC),
+	PACKET("ac-milliamp", BUF(0x10, 0x02, 0x00, 0x0d, 0x01, 0x02, 0x00,
+			0x00, ' ', '1', '2', '.', '3', '4', 'E', '-', '3',
+			0x52, 0x10, 0x03),
+		0.01234, SR_MQ_CURRENT, SR_UNIT_AMPERE, SR_MQFLAG_AC),
+	PACKET("megaohm-ol", BUF(0x10, 0x02, 0x00, 0x0e, 0x80, 0x00, 0x00,
+			0x00, ' ', '.', 'O', 'L', ' ', ' ', ' ', 'E', '+', '6',
+			0xf5, 0x10, 0x03),
+		INFINITY, SR_MQ_RESISTANCE, SR_UNIT_OHM, 0),
+	PACKET("dbm", BUF(0x10, 0x02, 0x00, 0x0e, 0x00, 0x20, 0x00, 0x00,
+			'-', '0', '.', '0', '1', '2', '3', 'E', '+', '0',
+			0x4d, 0x10, 0x03),
+		-12.3, SR_MQ_POWER, SR_UNIT_DECIBEL_MW, 0),
+	PACKET("low-battery", BUF(0x10, 0x02, 0x00, 0x0e, 0x06, 0x00, 0x00,
+			0x80, '-', '1', '.', '2', '3', '4', '5', 'E', '+', '0',
+			0xea, 0x10, 0x03),
+		-1.2345, SR_MQ_VOLTAGE, SR_UNIT_VOLT, SR_MQFLAG_DC),
+	PACKET_INVALID("checksum", BUF(0x10, 0x02, 0x00, 0x0e, 0x06, 0x00,
+			0x00, 0x00, ' ', '1', '.', '2', '3', '4', '5', 'E', '+',
+			'0', 0x66, 0x10, 0x03)),
+};
+
+const struct dmmparse_chip dmmparse_brymen = {
+	"brymen",
+	brymen_packet_is_valid,
+	sr_brymen_parse,
+	0,
+	ARRAY_AND_SIZE(brymen_packets),
+};
+
+#endif
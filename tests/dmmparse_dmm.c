@@ -0,0 +1,189 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Packets of the chips in hardware/common/dmm, as the meters send them,
+ * and ones a noisy line or a misaligned read makes of them.
+ */
+
+#include <math.h>
+#include "../libsigrok.h"
+#include "../libsigrok-internal.h"
+#include "dmmparse.h"
+
+#define BUF(...) ((const uint8_t []){ __VA_ARGS__ })
+#define STR(s) ((const uint8_t *)(s))
+
+/*
+ * Byte n has n + 1 in its high nibble; the low nibbles are LCD segments
+ * and symbols.
+ */
+static const struct dmmparse_packet fs9721_packets[] = {
+	PACKET("dc-volt", BUF(0x17, 0x20, 0x35, 0x4d, 0x5b, 0x61, 0x7f,
+			0x82, 0x97, 0xa0, 0xb0, 0xc0, 0xd4, 0xe0),
+		1.234, SR_MQ_VOLTAGE, SR_UNIT_VOLT,
+		SR_MQFLAG_DC | SR_MQFLAG_AUTORANGE),
+	PACKET("ac-millivolt", BUF(0x19, 0x28, 0x35, 0x45, 0x5b, 0x69, 0x7f,
+			0x82, 0x97, 0xa0, 0xb8, 0xc0, 0xd4, 0xe0),
+		-0.01234, SR_MQ_VOLTAGE, SR_UNIT_VOLT, SR_MQFLAG_AC),
+	PACKET("kiloohm-ol", BUF(0x13, 0x20, 0x30, 0x47, 0x5d, 0x66, 0x78,
+			0x80, 0x90, 0xa2, 0xb0, 0xc4, 0xd0, 0xe0),
+		INFINITY, SR_MQ_RESISTANCE, SR_UNIT_OHM, SR_MQFLAG_AUTORANGE),
+	PACKET("continuity", BUF(0x11, 0x27, 0x3d, 0x4f, 0x5d, 0x60, 0x75,
+			0x85, 0x9b, 0xa0, 0xb1, 0xc4, 0xd0, 0xe0),
+		1.0, SR_MQ_CONTINUITY, SR_UNIT_BOOLEAN, 0),
+	PACKET_INVALID("sync-nibble", BUF(0x17, 0x20, 0x35, 0x4d, 0x5b,
+			0xe1, 0x7f, 0x82, 0x97, 0xa0, 0xb0, 0xc0, 0xd4, 0xe0)),
+	PACKET_INVALID("no-rs232", BUF(0x16, 0x20, 0x35, 0x4d, 0x5b, 0x61,
+			0x7f, 0x82, 0x97, 0xa0, 0xb0, 0xc0, 0xd4, 0xe0)),
+	PACKET_INVALID("two-multipliers", BUF(0x17, 0x20, 0x35, 0x4d, 0x5b,
+			0x61, 0x7f, 0x82, 0x97, 0xa8, 0xb8, 0xc0, 0xd4, 0xe0)),
+};
+
+/* Sign, four digits, space, decimal point, four flag bytes, bargraph. */
+static const struct dmmparse_packet fs9922_packets[] = {
+	PACKET("dc-volt", BUF('+', '1', '2', '3', '4', ' ', '1',
+			0x30, 0x00, 0x00, 0x80, 0x00, '\r', '\n'),
+		1.234, SR_MQ_VOLTAGE, SR_UNIT_VOLT,
+		SR_MQFLAG_DC | SR_MQFLAG_AUTORANGE),
+	PACKET("ac-milliamp", BUF('-', '0', '5', '2', '3', ' ', '2',
+			0x28, 0x00, 0x40, 0x40, 0x00, '\r', '\n'),
+		-0.00523, SR_MQ_CURRENT, SR_UNIT_AMPERE,
+		SR_MQFLAG_AC | SR_MQFLAG_AUTORANGE),
+	PACKET("megaohm-ol", BUF('+', '?', '0', ':', '?', ' ', '0',
+			0x20, 0x00, 0x10, 0x20, 0x00, '\r', '\n'),
+		INFINITY, SR_MQ_RESISTANCE, SR_UNIT_OHM, SR_MQFLAG_AUTORANGE),
+	PACKET("kilohertz", BUF('+', '1', '0', '0', '0', ' ', '4',
+			0x20, 0x00, 0x20, 0x08, 0x00, '\r', '\n'),
+		100000, SR_MQ_FREQUENCY, SR_UNIT_HERTZ, SR_MQFLAG_AUTORANGE),
+	PACKET("continuity", BUF('+', '0', '0', '1', '2', ' ', '1',
+			0x00, 0x00, 0x08, 0x20, 0x00, '\r', '\n'),
+		1.0, SR_MQ_CONTINUITY, SR_UNIT_BOOLEAN, 0),
+	PACKET("min-hold", BUF('+', '0', '3', '3', '0', ' ', '1',
+			0x12, 0x10, 0x00, 0x80, 0x00, '\r', '\n'),
+		0.33, SR_MQ_VOLTAGE, SR_UNIT_VOLT,
+		SR_MQFLAG_DC | SR_MQFLAG_HOLD | SR_MQFLAG_MIN),
+	PACKET_UNPARSED("bad-digit", BUF('+', '1', '2', 'x', '4', ' ', '1',
+			0x30, 0x00, 0x00, 0x80, 0x00, '\r', '\n'), SR_ERR),
+	PACKET_INVALID("bad-sign", BUF('x', '1', '2', '3', '4', ' ', '1',
+			0x30, 0x00, 0x00, 0x80, 0x00, '\r', '\n')),
+	PACKET_INVALID("no-newline", BUF('+', '1', '2', '3', '4', ' ', '1',
+			0x30, 0x00, 0x00, 0x80, 0x00, '\r', '\r')),
+	PACKET_INVALID("volt-and-amp", BUF('+', '1', '2', '3', '4', ' ', '1',
+			0x30, 0x00, 0x00, 0xc0, 0x00, '\r', '\n')),
+};
+
+/*
+ * Range, four digits, function, status and two option bytes, CR, LF,
+ * sent twice in a row.
+ */
+static const struct dmmparse_packet es519xx_2400_11b_packets[] = {
+	PACKET("dc-volt", STR("21234;00:\r\n" "21234;00:\r\n"),
+		12.34, SR_MQ_VOLTAGE, SR_UNIT_VOLT,
+		SR_MQFLAG_DC | SR_MQFLAG_AUTORANGE),
+	PACKET("ac-amp", STR("00523?004\r\n" "00523?004\r\n"),
+		5.23, SR_MQ_CURRENT, SR_UNIT_AMPERE,
+		SR_MQFLAG_AC | SR_MQFLAG_AUTORANGE),
+	PACKET("ohm-ol", STR("100003102\r\n" "100003102\r\n"),
+		INFINITY, SR_MQ_RESISTANCE, SR_UNIT_OHM, SR_MQFLAG_AUTORANGE),
+	PACKET_UNPARSED("bad-range", STR("91234;00:\r\n" "91234;00:\r\n"),
+		SR_ERR),
+	PACKET_INVALID("halves-differ", STR("21234;00:\r\n" "21235;00:\r\n")),
+	PACKET_INVALID("no-newline", STR("21234;00:\r\r" "21234;00:\r\r")),
+};
+
+/*
+ * Range, five digits, function, status and four option bytes, CR, LF.
+ */
+static const struct dmmparse_packet es519xx_19200_14b_packets[] = {
+	PACKET("dc-volt", STR("112345;000:0\r\n"),
+		12.345, SR_MQ_VOLTAGE, SR_UNIT_VOLT,
+		SR_MQFLAG_DC | SR_MQFLAG_AUTORANGE),
+	PACKET("negative", STR("112345;400:0\r\n"),
+		-12.345, SR_MQ_VOLTAGE, SR_UNIT_VOLT,
+		SR_MQFLAG_DC | SR_MQFLAG_AUTORANGE),
+	PACKET("kiloohm", STR("304700300020\r\n"),
+		47000, SR_MQ_RESISTANCE, SR_UNIT_OHM, SR_MQFLAG_AUTORANGE),
+	PACKET("ohm-ol", STR("300000310020\r\n"),
+		INFINITY, SR_MQ_RESISTANCE, SR_UNIT_OHM, SR_MQFLAG_AUTORANGE),
+	PACKET("hertz", STR("3500002800:0\r\n"),
+		50000, SR_MQ_FREQUENCY, SR_UNIT_HERTZ,
+		SR_MQFLAG_DC | SR_MQFLAG_AUTORANGE),
+	PACKET("max-rel", STR("112345;0:0:0\r\n"),
+		12.345, SR_MQ_VOLTAGE, SR_UNIT_VOLT, SR_MQFLAG_DC |
+		SR_MQFLAG_AUTORANGE | SR_MQFLAG_MAX | SR_MQFLAG_RELATIVE),
+	PACKET_INVALID("ac-and-dc", STR("112345;000>0\r\n")),
+	PACKET_INVALID("no-cr", STR("112345;000:0\n\n")),
+};
+
+/* Mode, value and unit as text, CR. */
+static const struct dmmparse_packet metex14_packets[] = {
+	PACKET("dc-volt", STR("DC -1.234   V\r"),
+		-1.234, SR_MQ_VOLTAGE, SR_UNIT_VOLT, SR_MQFLAG_DC),
+	PACKET("ac-millivolt", STR("AC  123.4  mV\r"),
+		0.1234, SR_MQ_VOLTAGE, SR_UNIT_VOLT, SR_MQFLAG_AC),
+	PACKET("megaohm-ol", STR("OH  .OL  MOhm\r"),
+		INFINITY, SR_MQ_RESISTANCE, SR_UNIT_OHM, 0),
+	PACKET("nanofarad", STR("CA  12.34  nF\r"),
+		12.34e-9, SR_MQ_CAPACITANCE, SR_UNIT_FARAD, 0),
+	PACKET("kilohertz", STR("FR  1.000 KHz\r"),
+		1000, SR_MQ_FREQUENCY, SR_UNIT_HERTZ, 0),
+	PACKET("diode", STR("DI  0.512   V\r"),
+		0.512, SR_MQ_VOLTAGE, SR_UNIT_VOLT, SR_MQFLAG_DIODE),
+	PACKET_INVALID("no-cr", STR("DC -1.234   V\n")),
+};
+
+const struct dmmparse_chip dmmparse_fs9721 = {
+	"fs9721",
+	sr_fs9721_packet_valid,
+	sr_fs9721_parse,
+	sizeof(struct fs9721_info),
+	ARRAY_AND_SIZE(fs9721_packets),
+};
+
+const struct dmmparse_chip dmmparse_fs9922 = {
+	"fs9922",
+	sr_fs9922_packet_valid,
+	sr_fs9922_parse,
+	sizeof(struct fs9922_info),
+	ARRAY_AND_SIZE(fs9922_packets),
+};
+
+const struct dmmparse_chip dmmparse_es519xx_2400_11b = {
+	"es519xx-2400-11b",
+	sr_es519xx_2400_11b_packet_valid,
+	sr_es519xx_2400_11b_parse,
+	sizeof(struct es519xx_info),
+	ARRAY_AND_SIZE(es519xx_2400_11b_packets),
+};
+
+const struct dmmparse_chip dmmparse_es519xx_19200_14b = {
+	"es519xx-19200-14b",
+	sr_es519xx_19200_14b_packet_valid,
+	sr_es519xx_19200_14b_parse,
+	sizeof(struct es519xx_info),
+	ARRAY_AND_SIZE(es519xx_19200_14b_packets),
+};
+
+const struct dmmparse_chip dmmparse_metex14 = {
+	"metex14",
+	sr_metex14_packet_valid,
+	sr_metex14_parse,
+	sizeof(struct metex14_info),
+	ARRAY_AND_SIZE(metex14_packets),
+};
@@ -0,0 +1,80 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Packets of the Victor 70C/86C, obfuscated and shuffled as they come
+ * over USB. The parser has no separate check, packets it can't make a
+ * value of fail to parse.
+ */
+
+#include <math.h>
+#include "config.h"
+#include "../hardware/victor-dmm/protocol.h"
+#include "dmmparse.h"
+
+#ifdef HAVE_HW_VICTOR_DMM
+
+#define BUF(...) ((const uint8_t []){ __VA_ARGS__ })
+
+/* The parser sets both for every packet. */
+#define MAX_MIN (SR_MQFLAG_MAX | SR_MQFLAG_MIN)
+
+static const struct dmmparse_packet victor_packets[] = {
+	PACKET("dc-volt", BUF(0x76, 0x6f, 0x64, 0xa5, 0x6e, 0xf8, 0x95,
+			0x6e, 0x6a, 0x23, 0xeb, 0x78, 0x69, 0x61),
+		1.234, SR_MQ_VOLTAGE, SR_UNIT_VOLT,
+		SR_MQFLAG_DC | SR_MQFLAG_AUTORANGE | MAX_MIN),
+	PACKET("ac-milliamp", BUF(0x7a, 0x6f, 0x64, 0x05, 0x6f, 0xb8, 0x35,
+			0x6e, 0x6b, 0xa3, 0x6b, 0x78, 0x6b, 0x61),
+		-0.00523, SR_MQ_CURRENT, SR_UNIT_AMPERE,
+		SR_MQFLAG_AC | MAX_MIN),
+	PACKET("kiloohm-ol", BUF(0x6e, 0x6f, 0x64, 0x65, 0x6e, 0x78, 0x65,
+			0x6e, 0x6d, 0xb3, 0x5b, 0x78, 0x6d, 0x61),
+		INFINITY, SR_MQ_RESISTANCE, SR_UNIT_OHM,
+		SR_MQFLAG_AUTORANGE | MAX_MIN),
+	PACKET("continuity", BUF(0x6a, 0x6f, 0x64, 0x65, 0x6e, 0x78, 0x15,
+			0x6e, 0x6d, 0x63, 0x6b, 0x78, 0x79, 0x61),
+		1.0, SR_MQ_CONTINUITY, SR_UNIT_BOOLEAN, MAX_MIN),
+	PACKET("diode-ol", BUF(0x6a, 0x6f, 0x64, 0x65, 0x6e, 0x78, 0x65,
+			0x6e, 0x6a, 0xb3, 0x5b, 0x78, 0x89, 0x61),
+		NAN, SR_MQ_VOLTAGE, SR_UNIT_VOLT, SR_MQFLAG_DIODE | MAX_MIN),
+	PACKET_UNPARSED("all-zeroes", BUF(0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00),
+		SR_ERR),
+	PACKET_UNPARSED("unknown-mode", BUF(0x6a, 0x6f, 0x64, 0x65, 0x6e,
+			0x78, 0xf5, 0x6e, 0x71, 0x63, 0x6b, 0x78, 0x69, 0x61),
+		SR_ERR),
+};
+
+static int victor_parse(const uint8_t *buf, float *floatval,
+		struct sr_datafeed_analog *analog, void *info)
+{
+	(void)info;
+
+	return victor_dmm_parse(buf, floatval, analog);
+}
+
+const struct dmmparse_chip dmmparse_victor = {
+	"victor",
+	NULL,
+	victor_parse,
+	0,
+	ARRAY_AND_SIZE(victor_packets),
+};
+
+#endif
@@ -0,0 +1,838 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Performance regression suite. Measures the probe filter, the encode
+ * rate of every output module, the parse rate of the csv, vcd, wav and
+ * binary input modules, saving and loading session files, and the cost
+ * of sending packets over the session bus, all on generated data. The
+ * session file round trip captures from the demo driver, records the
+ * capture to a file, replays it and compares the checksums of the data
+ * both times; it also reports the peak memory use (where the system
+ * tells, i.e. on Linux).
+ *
+ * Each benchmark runs a few times and the best run counts. The results
+ * are written with -w, one "name value unit" line each, and compared
+ * with a baseline written that way before with -c: a result more than
+ * the tolerance below its baseline is a regression (above it, for
+ * memory use), and makes the exit status nonzero. Baselines depend on
+ * the machine, so they are kept in the build directory. "make -C tests
+ * perf-check" compares with perf.baseline there; copy perf.results over
+ * it to record a new one.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "../libsigrok.h"
+
+static gint opt_size = 16;
+static gint opt_runs = 3;
+static gdouble opt_tolerance = 20;
+static gchar *opt_baseline = NULL;
+static gchar *opt_results = NULL;
+static gchar *opt_only = NULL;
+
+static GOptionEntry optargs[] = {
+	{"size", 's', 0, G_OPTION_ARG_INT, &opt_size,
+		"MiB of data per benchmark", NULL},
+	{"runs", 'r', 0, G_OPTION_ARG_INT, &opt_runs,
+		"Runs per benchmark, the best counts", NULL},
+	{"compare", 'c', 0, G_OPTION_ARG_FILENAME, &opt_baseline,
+		"Compare with the baseline in this file", NULL},
+	{"tolerance", 'T', 0, G_OPTION_ARG_DOUBLE, &opt_tolerance,
+		"Percent below the baseline which is a regression", NULL},
+	{"write", 'w', 0, G_OPTION_ARG_FILENAME, &opt_results,
+		"Write the results to this file", NULL},
+	{"only", 'o', 0, G_OPTION_ARG_STRING, &opt_only,
+		"Only run benchmarks whose name contains this", NULL},
+	{NULL, 0, 0, 0, NULL, NULL, NULL}
+};
+
+struct result {
+	char *name;
+	double value;
+	const char *unit;
+};
+
+/* What a benchmark run got through, and where to put its files. */
+struct bench {
+	const char *dir;
+	struct sr_dev_inst *sdi;
+	const uint8_t *logic;
+	uint64_t logic_len;
+	uint64_t bytes;
+	uint64_t packets;
+	/* Peak memory use of the run in KiB, for benchmarks measuring it. */
+	uint64_t peak_kib;
+	int ret;
+};
+
+typedef int (*bench_fn)(struct bench *b, void *data);
+
+static GSList *results = NULL;
+
+/*
+ * Logic data with probes toggling at different rates: probe n changes
+ * every 4^n samples.
+ */
+static uint8_t *logic_new(uint64_t len)
+{
+	uint8_t *buf;
+	uint64_t i;
+	int n;
+
+	buf = g_malloc(len);
+	for (i = 0; i < len; i++) {
+		buf[i] = 0;
+		for (n = 0; n < 8; n++)
+			buf[i] |= ((i >> (2 * n)) & 1) << n;
+	}
+
+	return buf;
+}
+
+static gboolean wanted(const char *name)
+{
+	return !opt_only || strstr(name, opt_only);
+}
+
+static void result_add(const char *name, double value, const char *unit)
+{
+	struct result *r;
+
+	r = g_malloc(sizeof(struct result));
+	r->name = g_strdup(name);
+	r->value = value;
+	r->unit = unit;
+	results = g_slist_append(results, r);
+}
+
+/* Results in these units are better the lower they are. */
+static gboolean lower_is_better(const char *unit)
+{
+	return !strcmp(unit, "MiB");
+}
+
+/*
+ * Start measuring the peak memory use of the process over again. Only
+ * Linux allows that, by resetting the peak resident set size.
+ */
+static void peak_reset(void)
+{
+	FILE *f;
+
+	if ((f = fopen("/proc/self/clear_refs", "w"))) {
+		fputs("5", f);
+		fclose(f);
+	}
+}
+
+/* The peak resident set size since peak_reset() in KiB, or 0. */
+static uint64_t peak_get(void)
+{
+	FILE *f;
+	char line[256];
+	uint64_t kib;
+
+	kib = 0;
+	if (!(f = fopen("/proc/self/status", "r")))
+		return 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "VmHWM: %" SCNu64, &kib) == 1)
+			break;
+	}
+	fclose(f);
+
+	return kib;
+}
+
+/*
+ * Run a benchmark opt_runs times, and record the rate of its best run:
+ * MB/s of b->bytes, or for a unit of "kpackets/s", of b->packets. For
+ * benchmarks setting b->peak_kib, the lowest peak memory use of the runs
+ * is recorded as well, as "<name>.peak". Returns 1 if the benchmark
+ * failed.
+ */
+static int run(const char *name, const char *unit, bench_fn fn,
+		struct bench *b, void *data)
+{
+	gint64 start, elapsed, best;
+	uint64_t peak;
+	double rate;
+	char *peak_name;
+	int i, ret;
+
+	if (!wanted(name))
+		return 0;
+
+	best = G_MAXINT64;
+	rate = 0;
+	peak = 0;
+	for (i = 0; i < opt_runs; i++) {
+		b->bytes = b->packets = b->peak_kib = 0;
+		b->ret = SR_OK;
+		start = g_get_monotonic_time();
+		if ((ret = fn(b, data)) == SR_OK)
+			ret = b->ret;
+		elapsed = MAX(g_get_monotonic_time() - start, 1);
+		if (ret != SR_OK) {
+			printf("%-24s failed: %d\n", name, ret);
+			return 1;
+		}
+		if (b->peak_kib && (!peak || b->peak_kib < peak))
+			peak = b->peak_kib;
+		if (elapsed >= best)
+			continue;
+		best = elapsed;
+		/* Bytes per microsecond are MB/s. */
+		if (!strcmp(unit, "MB/s"))
+			rate = (double)b->bytes / elapsed;
+		else
+			rate = (double)b->packets * 1000 / elapsed;
+	}
+
+	result_add(name, rate, unit);
+	if (peak) {
+		peak_name = g_strdup_printf("%s.peak", name);
+		result_add(peak_name, peak / 1024.0, "MiB");
+		g_free(peak_name);
+	}
+
+	return 0;
+}
+
+/* Counts what arrives on the session bus. */
+static void datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	struct bench *b;
+
+	(void)sdi;
+
+	b = cb_data;
+	b->packets++;
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		b->bytes += logic->length;
+	}
+}
+
+/*--- Probe filter ----------------------------------------------------------*/
+
+static int bench_filter(struct bench *b, void *data)
+{
+	GArray *probes;
+	uint8_t *out;
+	uint64_t out_len;
+	int unitsize, i, ret;
+
+	unitsize = GPOINTER_TO_INT(data);
+
+	/* Every other probe of the first byte, and all of the last one. */
+	probes = g_array_new(FALSE, FALSE, sizeof(int));
+	for (i = 0; i < 8; i += 2)
+		g_array_append_val(probes, i);
+	for (i = (unitsize - 1) * 8; unitsize > 1 && i < unitsize * 8; i++)
+		g_array_append_val(probes, i);
+
+	ret = sr_filter_probes(unitsize, (probes->len + 7) / 8, probes,
+			b->logic, b->logic_len - b->logic_len % unitsize,
+			&out, &out_len);
+	if (ret == SR_OK)
+		g_free(out);
+	b->bytes = b->logic_len - b->logic_len % unitsize;
+	g_array_free(probes, TRUE);
+
+	return ret;
+}
+
+/*--- Output modules --------------------------------------------------------*/
+
+/* Output sink which discards what it's given. */
+static int output_count(const void *buf, uint64_t len, void *cb_data)
+{
+	(void)buf;
+	(void)cb_data;
+
+	return SR_OK;
+}
+
+static int bench_output(struct bench *b, void *data)
+{
+	struct sr_output *o;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_header header;
+	struct sr_datafeed_meta meta;
+	struct sr_datafeed_logic logic;
+	struct sr_config src;
+	GSList l;
+	uint64_t offset;
+	int ret;
+
+	if (!(o = sr_output_new(data, NULL, b->sdi)))
+		return SR_ERR;
+
+	header.feed_version = 1;
+	gettimeofday(&header.starttime, NULL);
+	packet.type = SR_DF_HEADER;
+	packet.payload = &header;
+	ret = sr_output_send(o, b->sdi, &packet, output_count, b);
+
+	src.key = SR_CONF_SAMPLERATE;
+	src.data = g_variant_ref_sink(g_variant_new_uint64(SR_MHZ(1)));
+	l.data = &src;
+	l.next = NULL;
+	meta.config = &l;
+	packet.type = SR_DF_META;
+	packet.payload = &meta;
+	if (ret == SR_OK)
+		ret = sr_output_send(o, b->sdi, &packet, output_count, b);
+	g_variant_unref(src.data);
+
+	/* Packets of the size drivers typically send. */
+	memset(&logic, 0, sizeof(logic));
+	logic.unitsize = 1;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	for (offset = 0; ret == SR_OK && offset < b->logic_len;
+			offset += logic.length) {
+		logic.length = MIN(64 * 1024, b->logic_len - offset);
+		logic.data = (void *)(b->logic + offset);
+		ret = sr_output_send(o, b->sdi, &packet, output_count, b);
+	}
+	b->bytes = offset;
+
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	if (ret == SR_OK)
+		ret = sr_output_send(o, b->sdi, &packet, output_count, b);
+	if (ret == SR_OK)
+		ret = sr_output_flush(o, output_count, b);
+	sr_output_free(o);
+
+	return ret;
+}
+
+/*--- Input modules ---------------------------------------------------------*/
+
+struct input_file {
+	const char *id;
+	char *filename;
+};
+
+static struct sr_input_format *input_get(const char *id)
+{
+	struct sr_input_format **inputs;
+	int i;
+
+	inputs = sr_input_list();
+	for (i = 0; inputs[i]; i++) {
+		if (!strcmp(inputs[i]->id, id))
+			return inputs[i];
+	}
+
+	return NULL;
+}
+
+static void csv_write(FILE *f, const uint8_t *logic, uint64_t len)
+{
+	uint64_t i;
+	int n;
+
+	for (i = 0; i < len; i++) {
+		for (n = 0; n < 8; n++)
+			fprintf(f, n ? ",%d" : "%d", (logic[i] >> n) & 1);
+		fputc('\n', f);
+	}
+}
+
+static void vcd_write(FILE *f, const uint8_t *logic, uint64_t len)
+{
+	uint64_t i;
+	uint8_t changed;
+	int n;
+
+	fprintf(f, "$timescale 1 us $end\n$scope module perf $end\n");
+	for (n = 0; n < 8; n++)
+		fprintf(f, "$var wire 1 %c p%d $end\n", '!' + n, n);
+	fprintf(f, "$upscope $end\n$enddefinitions $end\n");
+	for (i = 0; i < len; i++) {
+		changed = i ? logic[i] ^ logic[i - 1] : 0xff;
+		if (!changed)
+			continue;
+		fprintf(f, "#%" PRIu64 "\n", i);
+		for (n = 0; n < 8; n++) {
+			if (changed & (1 << n))
+				fprintf(f, "%d%c\n", (logic[i] >> n) & 1,
+					'!' + n);
+		}
+	}
+}
+
+static void le_write(FILE *f, uint32_t v, int len)
+{
+	while (len--) {
+		fputc(v & 0xff, f);
+		v >>= 8;
+	}
+}
+
+/* Mono 16 bit PCM at 1 MHz, a sample for each byte of logic data. */
+static void wav_write(FILE *f, const uint8_t *logic, uint64_t len)
+{
+	uint64_t i;
+
+	fputs("RIFF", f);
+	le_write(f, 36 + len * 2, 4);
+	fputs("WAVEfmt ", f);
+	le_write(f, 16, 4);
+	le_write(f, 1, 2);
+	le_write(f, 1, 2);
+	le_write(f, SR_MHZ(1), 4);
+	le_write(f, SR_MHZ(1) * 2, 4);
+	le_write(f, 2, 2);
+	le_write(f, 16, 2);
+	fputs("data", f);
+	le_write(f, len * 2, 4);
+	for (i = 0; i < len; i++)
+		le_write(f, (logic[i] << 8) - 0x8000, 2);
+}
+
+/* The text formats take several bytes per sample, so use fewer. */
+static int input_file_write(struct bench *b, struct input_file *file)
+{
+	FILE *f;
+
+	file->filename = g_strdup_printf("%s/perf.%s", b->dir, file->id);
+	if (!(f = fopen(file->filename, "wb")))
+		return SR_ERR;
+	if (!strcmp(file->id, "csv"))
+		csv_write(f, b->logic, b->logic_len / 16);
+	else if (!strcmp(file->id, "vcd"))
+		vcd_write(f, b->logic, b->logic_len / 4);
+	else if (!strcmp(file->id, "wav"))
+		wav_write(f, b->logic, b->logic_len / 2);
+	else
+		fwrite(b->logic, 1, b->logic_len, f);
+	fclose(f);
+
+	return SR_OK;
+}
+
+static int bench_input(struct bench *b, void *data)
+{
+	struct input_file *file;
+	struct sr_input *in;
+	struct sr_session *session;
+	GStatBuf st;
+	int ret;
+
+	file = data;
+	if (g_stat(file->filename, &st) < 0)
+		return SR_ERR;
+
+	in = g_malloc0(sizeof(struct sr_input));
+	if (!(in->format = input_get(file->id))) {
+		g_free(in);
+		return SR_ERR_NA;
+	}
+	if ((ret = in->format->init(in, file->filename)) != SR_OK) {
+		g_free(in);
+		return ret;
+	}
+
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_in, b);
+	sr_session_dev_add(session, in->sdi);
+	ret = in->format->loadfile(in, file->filename);
+	sr_session_destroy(session);
+	g_free(in);
+
+	/* The parse rate is of the file, not of the samples in it. */
+	b->bytes = st.st_size;
+
+	return ret;
+}
+
+/*--- Session files ---------------------------------------------------------*/
+
+static int bench_session_save(struct bench *b, void *data)
+{
+	struct sr_session_writer *writer;
+	int ret;
+
+	if ((ret = sr_session_writer_open(&writer, data, b->sdi,
+			1)) != SR_OK)
+		return ret;
+	ret = sr_session_writer_write(writer, b->logic, b->logic_len);
+	if (sr_session_writer_close(writer) != SR_OK && ret == SR_OK)
+		ret = SR_ERR;
+	b->bytes = b->logic_len;
+
+	return ret;
+}
+
+static int bench_session_load(struct bench *b, void *data)
+{
+	struct sr_session *session;
+	int ret;
+
+	if ((ret = sr_session_load(data, &session)) != SR_OK)
+		return ret;
+	sr_session_datafeed_callback_add(session, datafeed_in, b);
+	if ((ret = sr_session_start(session)) == SR_OK)
+		ret = sr_session_run(session);
+	sr_session_destroy(session);
+
+	return ret;
+}
+
+/* What bench_session_roundtrip saw of the logic data. */
+struct roundtrip {
+	GChecksum *checksum;
+	uint64_t bytes;
+};
+
+static void roundtrip_datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	struct roundtrip *rt;
+
+	(void)sdi;
+
+	if (packet->type != SR_DF_LOGIC)
+		return;
+
+	rt = cb_data;
+	logic = packet->payload;
+	g_checksum_update(rt->checksum, logic->data, logic->length);
+	rt->bytes += logic->length;
+}
+
+/* Run a session with the roundtrip callback, and return the checksum. */
+static int roundtrip_run(struct sr_session *session, struct roundtrip *rt,
+		char **sum)
+{
+	int ret;
+
+	rt->checksum = g_checksum_new(G_CHECKSUM_SHA1);
+	rt->bytes = 0;
+	sr_session_datafeed_callback_add(session, roundtrip_datafeed_in, rt);
+	if ((ret = sr_session_start(session)) == SR_OK)
+		ret = sr_session_run(session);
+	*sum = g_strdup(g_checksum_get_string(rt->checksum));
+	g_checksum_free(rt->checksum);
+
+	return ret;
+}
+
+/*
+ * Capture b->logic_len samples from the demo device while recording them
+ * to a session file, then load and replay that. The rate is of the whole
+ * round trip; data replayed differently from how it was captured fails.
+ */
+static int bench_session_roundtrip(struct bench *b, void *data)
+{
+	struct sr_session *session;
+	struct roundtrip captured, replayed;
+	char *captured_sum, *replayed_sum;
+	int ret;
+
+	peak_reset();
+	session = sr_session_new();
+	if ((ret = sr_session_dev_add(session, b->sdi)) == SR_OK)
+		ret = sr_session_record_to(session, data, NULL);
+	captured_sum = NULL;
+	if (ret == SR_OK)
+		ret = roundtrip_run(session, &captured, &captured_sum);
+	sr_session_destroy(session);
+	if (ret != SR_OK) {
+		g_free(captured_sum);
+		return ret;
+	}
+
+	if ((ret = sr_session_load(data, &session)) != SR_OK) {
+		g_free(captured_sum);
+		return ret;
+	}
+	ret = roundtrip_run(session, &replayed, &replayed_sum);
+	sr_session_destroy(session);
+	g_unlink(data);
+	if (ret == SR_OK && (captured.bytes != b->logic_len
+	    || replayed.bytes != captured.bytes
+	    || strcmp(captured_sum, replayed_sum))) {
+		printf("Session file round trip changed the data.\n");
+		ret = SR_ERR;
+	}
+	g_free(captured_sum);
+	g_free(replayed_sum);
+	b->bytes = captured.bytes;
+	b->peak_kib = peak_get();
+
+	return ret;
+}
+
+/*--- Session bus -----------------------------------------------------------*/
+
+/* Small packets through the binary input, so the dispatch cost shows. */
+static int bench_dispatch(struct bench *b, void *data)
+{
+	struct sr_input *in;
+	struct sr_session *session;
+	uint64_t offset;
+	int ret;
+
+	(void)data;
+
+	in = g_malloc0(sizeof(struct sr_input));
+	if (!(in->format = input_get("binary"))) {
+		g_free(in);
+		return SR_ERR_NA;
+	}
+	if ((ret = in->format->init(in, NULL)) != SR_OK) {
+		g_free(in);
+		return ret;
+	}
+
+	session = sr_session_new();
+	sr_session_datafeed_callback_add(session, datafeed_in, b);
+	sr_session_dev_add(session, in->sdi);
+	for (offset = 0; ret == SR_OK && offset + 64 <= b->logic_len;
+			offset += 64)
+		ret = sr_input_send(in, b->logic + offset, 64);
+	if (ret == SR_OK)
+		ret = sr_input_end(in);
+	sr_session_destroy(session);
+	g_free(in);
+
+	return ret;
+}
+
+/*--- Results ---------------------------------------------------------------*/
+
+static int results_write(const char *filename)
+{
+	struct result *r;
+	GSList *l;
+	FILE *f;
+
+	if (!(f = fopen(filename, "w"))) {
+		fprintf(stderr, "Failed to write '%s'.\n", filename);
+		return SR_ERR;
+	}
+	fprintf(f, "# libsigrok perf, %d MiB, best of %d\n", opt_size,
+		opt_runs);
+	for (l = results; l; l = l->next) {
+		r = l->data;
+		fprintf(f, "%s %.3f %s\n", r->name, r->value, r->unit);
+	}
+	fclose(f);
+
+	return SR_OK;
+}
+
+/* Returns a table of the baseline values by name, or NULL. */
+static GHashTable *baseline_read(const char *filename)
+{
+	GHashTable *baseline;
+	FILE *f;
+	char line[256], name[128];
+	double value, *v;
+
+	if (!(f = fopen(filename, "r")))
+		return NULL;
+
+	baseline = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			g_free);
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || sscanf(line, "%127s %lf", name,
+				&value) != 2)
+			continue;
+		v = g_malloc(sizeof(double));
+		*v = value;
+		g_hash_table_insert(baseline, g_strdup(name), v);
+	}
+	fclose(f);
+
+	return baseline;
+}
+
+/* Print the results, and return the number of regressions. */
+static int results_print(GHashTable *baseline)
+{
+	struct result *r;
+	GSList *l;
+	double *base;
+	int regressions;
+
+	regressions = 0;
+	for (l = results; l; l = l->next) {
+		r = l->data;
+		printf("%-24s %12.1f %-10s", r->name, r->value, r->unit);
+		base = baseline ? g_hash_table_lookup(baseline, r->name) : NULL;
+		if (base && *base > 0) {
+			printf(" %+7.1f%%", (r->value / *base - 1) * 100);
+			if (lower_is_better(r->unit)
+			    ? r->value > *base * (1 + opt_tolerance / 100)
+			    : r->value < *base * (1 - opt_tolerance / 100)) {
+				printf("  REGRESSION");
+				regressions++;
+			}
+		}
+		printf("\n");
+	}
+
+	return regressions;
+}
+
+int main(int argc, char **argv)
+{
+	GOptionContext *context;
+	GError *error;
+	GHashTable *baseline;
+	struct sr_context *sr_ctx;
+	struct sr_dev_driver **drivers, *driver;
+	struct sr_output_format **outputs;
+	struct input_file files[] = {
+		{"csv", NULL}, {"vcd", NULL}, {"wav", NULL}, {"binary", NULL},
+	};
+	struct bench b;
+	GSList *devices;
+	uint8_t *logic;
+	char *dir, *name, *session_file;
+	int failed, regressions, i;
+
+	error = NULL;
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, optargs, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+	if (opt_size < 1 || opt_runs < 1) {
+		fprintf(stderr, "Size and runs must be positive.\n");
+		return 1;
+	}
+
+	if (sr_init(&sr_ctx) != SR_OK)
+		return 1;
+
+	/* The demo device stands in for a device where modules need one. */
+	driver = NULL;
+	drivers = sr_driver_list();
+	for (i = 0; drivers[i]; i++) {
+		if (!strcmp(drivers[i]->name, "demo"))
+			driver = drivers[i];
+	}
+	if (!driver || sr_driver_init(sr_ctx, driver) != SR_OK
+	    || !(devices = sr_driver_scan(driver, NULL))) {
+		fprintf(stderr, "The demo driver is not available.\n");
+		sr_exit(sr_ctx);
+		return 1;
+	}
+	if (!(dir = g_dir_make_tmp("sigrok-perf-XXXXXX", &error))) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		sr_exit(sr_ctx);
+		return 1;
+	}
+
+	memset(&b, 0, sizeof(b));
+	b.dir = dir;
+	b.sdi = devices->data;
+	g_slist_free(devices);
+	b.logic_len = (uint64_t)opt_size * 1024 * 1024;
+	b.logic = logic = logic_new(b.logic_len);
+
+	failed = 0;
+	failed |= run("filter.unitsize1", "MB/s", bench_filter, &b,
+			GINT_TO_POINTER(1));
+	failed |= run("filter.unitsize4", "MB/s", bench_filter, &b,
+			GINT_TO_POINTER(4));
+
+	outputs = sr_output_list();
+	for (i = 0; outputs[i]; i++) {
+		name = g_strdup_printf("output.%s", outputs[i]->id);
+		failed |= run(name, "MB/s", bench_output, &b, outputs[i]);
+		g_free(name);
+	}
+
+	for (i = 0; i < (int)G_N_ELEMENTS(files); i++) {
+		name = g_strdup_printf("input.%s", files[i].id);
+		if (wanted(name) && input_file_write(&b, &files[i]) == SR_OK)
+			failed |= run(name, "MB/s", bench_input, &b,
+					&files[i]);
+		if (files[i].filename)
+			g_unlink(files[i].filename);
+		g_free(files[i].filename);
+		g_free(name);
+	}
+
+	session_file = g_strdup_printf("%s/perf.sr", dir);
+	failed |= run("session.save", "MB/s", bench_session_save, &b,
+			session_file);
+	if (!wanted("session.save") && wanted("session.load"))
+		bench_session_save(&b, session_file);
+	failed |= run("session.load", "MB/s", bench_session_load, &b,
+			session_file);
+	g_unlink(session_file);
+
+	/* Random data, as fast as the demo device makes it. */
+	sr_dev_open(b.sdi);
+	sr_config_set(b.sdi, NULL, SR_CONF_FREERUN,
+			g_variant_new_boolean(TRUE));
+	sr_config_set(b.sdi, NULL, SR_CONF_PATTERN_MODE,
+			g_variant_new_string("random"));
+	sr_config_set(b.sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+			g_variant_new_uint64(b.logic_len));
+	failed |= run("session.roundtrip", "MB/s", bench_session_roundtrip,
+			&b, session_file);
+	g_free(session_file);
+
+	failed |= run("session.dispatch", "kpackets/s", bench_dispatch, &b,
+			NULL);
+
+	g_rmdir(dir);
+	g_free(dir);
+	g_free(logic);
+	sr_exit(sr_ctx);
+
+	baseline = NULL;
+	if (opt_baseline && !(baseline = baseline_read(opt_baseline)))
+		printf("No baseline in '%s' yet.\n", opt_baseline);
+	regressions = results_print(baseline);
+	if (baseline)
+		g_hash_table_destroy(baseline);
+	if (opt_results && results_write(opt_results) != SR_OK)
+		failed = 1;
+	if (regressions)
+		printf("%d regression(s) of more than %.0f%%.\n", regressions,
+		       opt_tolerance);
+
+	return failed || regressions ? 1 : 0;
+}
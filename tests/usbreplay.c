@@ -0,0 +1,680 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * USB replay harness. Runs the acquisition of the fx2lafw, saleae-logic16
+ * and hantek-dso drivers without the hardware, to measure and check their
+ * transfer callbacks and what comes after them: trigger matching, sample
+ * conversion and the session bus.
+ *
+ * The functions of libusb which the drivers use for transfers are
+ * replaced by the ones below, which is why this links libsigrok
+ * statically. Transfers complete when the session polls for USB events,
+ * with data from a recording (-f) or made up by the driver's file here,
+ * at most at the given rate. The data is cut off after --size, after
+ * which the drivers finish on their own, or are stopped.
+ *
+ * A recording is a series of records of a type byte (0 for the data of
+ * an asynchronous IN transfer, 1 for the reply to a synchronous one), the
+ * endpoint, two reserved bytes, the length as 32-bit little endian and
+ * the data. Asynchronous records are used over and over in order,
+ * synchronous ones once each.
+ *
+ * The results are the time spent in the callbacks, per transfer and over
+ * all, and a SHA-1 digest of the datafeed. With --expect, a digest which
+ * doesn't match is an error, so the same data replayed makes a
+ * regression test of the driver's conversion and trigger code.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <libusb.h>
+#include "config.h"
+#include "../libsigrok.h"
+#include "usbreplay.h"
+
+/* Transfers without data until the session is stopped from here. */
+#define QUIET_TRANSFERS		1000
+
+enum {
+	RECORD_ASYNC,
+	RECORD_SYNC,
+};
+
+struct record {
+	int type;
+	unsigned char endpoint;
+	uint32_t length;
+	unsigned char *data;
+};
+
+static gchar *opt_driver = NULL;
+static gchar *opt_file = NULL;
+static gdouble opt_rate = 0;
+static gint opt_size = 16;
+static gchar *opt_samplerate = NULL;
+static gchar *opt_trigger = NULL;
+static gchar *opt_expect = NULL;
+
+static GOptionEntry optargs[] = {
+	{"driver", 'd', 0, G_OPTION_ARG_STRING, &opt_driver,
+		"Driver to run: fx2lafw, saleae-logic16 or hantek-dso", NULL},
+	{"file", 'f', 0, G_OPTION_ARG_FILENAME, &opt_file,
+		"Replay the transfers recorded in this file", NULL},
+	{"rate", 'r', 0, G_OPTION_ARG_DOUBLE, &opt_rate,
+		"MB/s the device delivers, unlimited by default", NULL},
+	{"size", 's', 0, G_OPTION_ARG_INT, &opt_size,
+		"MiB of data the device delivers", NULL},
+	{"samplerate", 0, 0, G_OPTION_ARG_STRING, &opt_samplerate,
+		"Samplerate to set", NULL},
+	{"trigger", 't', 0, G_OPTION_ARG_STRING, &opt_trigger,
+		"Triggers to set, as probe=type,...", NULL},
+	{"expect", 'e', 0, G_OPTION_ARG_STRING, &opt_expect,
+		"SHA-1 digest the datafeed must have", NULL},
+	{NULL, 0, 0, 0, NULL, NULL, NULL}
+};
+
+static const struct usbreplay_driver *drivers[] = {
+#ifdef HAVE_HW_FX2LAFW
+	&usbreplay_fx2lafw,
+#endif
+#ifdef HAVE_HW_SALEAE_LOGIC16
+	&usbreplay_logic16,
+#endif
+#ifdef HAVE_HW_HANTEK_DSO
+	&usbreplay_hantek_dso,
+#endif
+	NULL,
+};
+
+/* The state of the fake device, shared with the libusb functions. */
+static struct {
+	const struct usbreplay_driver *drv;
+	struct sr_session *session;
+	GArray *records;
+	unsigned int async_pos, sync_pos;
+	gboolean have_async;
+	GQueue *pending;
+	GHashTable *cancelled;
+	int pipe_fds[2];
+	struct libusb_pollfd pollfd;
+	uint64_t limit;
+	uint64_t bytes;
+	int quiet;
+	gboolean stopped;
+	int64_t start, end;
+	uint64_t transfers;
+	int64_t busy, busy_min, busy_max;
+	GChecksum *digest;
+	uint64_t packets, samples;
+} replay;
+
+static char fake_handle;
+
+static guint32 random_state = 0x12345678;
+
+void usbreplay_random(unsigned char *buf, int len)
+{
+	int i;
+
+	/* xorshift32 */
+	for (i = 0; i < len; i++) {
+		random_state ^= random_state << 13;
+		random_state ^= random_state >> 17;
+		random_state ^= random_state << 5;
+		buf[i] = random_state;
+	}
+}
+
+/*--- Recordings ------------------------------------------------------------*/
+
+static int records_load(const char *filename)
+{
+	struct record rec;
+	gchar *buf;
+	gsize len, pos;
+	GError *error;
+
+	error = NULL;
+	if (!g_file_get_contents(filename, &buf, &len, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return SR_ERR;
+	}
+
+	for (pos = 0; pos + 8 <= len; pos += 8 + rec.length) {
+		rec.type = (unsigned char)buf[pos];
+		rec.endpoint = buf[pos + 1];
+		rec.length = (unsigned char)buf[pos + 4]
+			| (unsigned char)buf[pos + 5] << 8
+			| (unsigned char)buf[pos + 6] << 16
+			| (uint32_t)(unsigned char)buf[pos + 7] << 24;
+		if (rec.length > len - pos - 8)
+			break;
+		rec.data = g_memdup(buf + pos + 8, rec.length);
+		g_array_append_val(replay.records, rec);
+		if (rec.type == RECORD_ASYNC && rec.length)
+			replay.have_async = TRUE;
+	}
+	g_free(buf);
+
+	if (pos != len) {
+		fprintf(stderr, "%s: truncated record at offset %"
+			G_GSIZE_FORMAT ".\n", filename, pos);
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}
+
+static struct record *record_next(int type, unsigned int *pos, gboolean wrap)
+{
+	struct record *rec;
+	unsigned int i, n;
+
+	n = replay.records->len;
+	for (i = 0; i < n; i++) {
+		if (*pos >= n) {
+			if (!wrap)
+				return NULL;
+			*pos = 0;
+		}
+		rec = &g_array_index(replay.records, struct record, (*pos)++);
+		if (rec->type == type)
+			return rec;
+	}
+
+	return NULL;
+}
+
+/*--- The fake libusb -------------------------------------------------------*/
+
+static int sync_transfer(unsigned char endpoint, unsigned char *buf, int len)
+{
+	struct record *rec;
+
+	if (!(endpoint & LIBUSB_ENDPOINT_IN)) {
+		if (replay.drv->sync_out)
+			replay.drv->sync_out(endpoint, buf, len);
+		return len;
+	}
+
+	if ((rec = record_next(RECORD_SYNC, &replay.sync_pos, FALSE))) {
+		len = MIN(len, (int)rec->length);
+		memcpy(buf, rec->data, len);
+		return len;
+	}
+	if (replay.drv->sync_in)
+		return replay.drv->sync_in(endpoint, buf, len);
+	memset(buf, 0, len);
+
+	return len;
+}
+
+/* The data of a bulk transfer coming back, as its length. */
+static int transfer_fill(struct libusb_transfer *transfer)
+{
+	struct record *rec;
+	int len;
+
+	len = transfer->length;
+	if (!(transfer->endpoint & LIBUSB_ENDPOINT_IN))
+		return sync_transfer(transfer->endpoint, transfer->buffer, len);
+
+	if (replay.bytes >= replay.limit) {
+		/* The device went quiet. */
+		replay.quiet++;
+		return 0;
+	}
+	len = MIN((uint64_t)len, replay.limit - replay.bytes);
+
+	if (replay.have_async) {
+		rec = record_next(RECORD_ASYNC, &replay.async_pos, TRUE);
+		len = MIN(len, (int)rec->length);
+		memcpy(transfer->buffer, rec->data, len);
+	} else if (replay.drv->generate) {
+		len = replay.drv->generate(transfer->endpoint,
+				transfer->buffer, len);
+	} else {
+		memset(transfer->buffer, 0, len);
+	}
+	replay.bytes += len;
+
+	return len;
+}
+
+static void transfer_complete(struct libusb_transfer *transfer)
+{
+	int64_t start, busy;
+	gboolean free_transfer;
+
+	if (g_hash_table_remove(replay.cancelled, transfer)) {
+		transfer->status = LIBUSB_TRANSFER_CANCELLED;
+		transfer->actual_length = 0;
+	} else {
+		transfer->status = LIBUSB_TRANSFER_COMPLETED;
+		transfer->actual_length = transfer_fill(transfer);
+	}
+
+	/* The callback may free the transfer. */
+	free_transfer = transfer->flags & LIBUSB_TRANSFER_FREE_TRANSFER;
+	start = g_get_monotonic_time();
+	transfer->callback(transfer);
+	busy = g_get_monotonic_time() - start;
+	if (free_transfer)
+		libusb_free_transfer(transfer);
+
+	if (!replay.transfers++ || busy < replay.busy_min)
+		replay.busy_min = busy;
+	replay.busy_max = MAX(replay.busy_max, busy);
+	replay.busy += busy;
+	replay.end = g_get_monotonic_time();
+}
+
+/* Microseconds until the device has the next transfer's data. */
+static int64_t transfer_due(void)
+{
+	int64_t due;
+
+	if (opt_rate <= 0 || replay.bytes >= replay.limit)
+		return 0;
+	due = replay.start + replay.bytes / opt_rate;
+
+	return MAX(due - g_get_monotonic_time(), 0);
+}
+
+static void events_handle(struct timeval *tv)
+{
+	struct libusb_transfer *transfer;
+	int64_t wait, timeout;
+	unsigned int n;
+
+	if (!replay.start)
+		replay.start = g_get_monotonic_time();
+
+	/* Transfers submitted again from their callback wait a round. */
+	for (n = g_queue_get_length(replay.pending); n; n--) {
+		transfer = g_queue_peek_head(replay.pending);
+		if (!g_hash_table_contains(replay.cancelled, transfer)
+		    && (wait = transfer_due())) {
+			timeout = tv ? tv->tv_sec * 1000000 + tv->tv_usec : 0;
+			g_usleep(MIN(wait, MAX(timeout, 1000)));
+			if (transfer_due())
+				break;
+		}
+		g_queue_pop_head(replay.pending);
+		transfer_complete(transfer);
+	}
+
+	if (replay.quiet > QUIET_TRANSFERS && !replay.stopped) {
+		replay.stopped = TRUE;
+		sr_session_stop(replay.session);
+	}
+}
+
+/* None of the drivers here use isochronous transfers. */
+struct libusb_transfer * LIBUSB_CALL libusb_alloc_transfer(int iso_packets)
+{
+	if (iso_packets)
+		return NULL;
+
+	return g_malloc0(sizeof(struct libusb_transfer));
+}
+
+void LIBUSB_CALL libusb_free_transfer(struct libusb_transfer *transfer)
+{
+	if (!transfer)
+		return;
+
+	if (transfer->flags & LIBUSB_TRANSFER_FREE_BUFFER)
+		free(transfer->buffer);
+	g_queue_remove(replay.pending, transfer);
+	g_hash_table_remove(replay.cancelled, transfer);
+	g_free(transfer);
+}
+
+int LIBUSB_CALL libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+	if (g_queue_find(replay.pending, transfer))
+		return LIBUSB_ERROR_BUSY;
+
+	g_queue_push_tail(replay.pending, transfer);
+
+	return 0;
+}
+
+int LIBUSB_CALL libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+	if (!g_queue_find(replay.pending, transfer))
+		return LIBUSB_ERROR_NOT_FOUND;
+
+	g_hash_table_add(replay.cancelled, transfer);
+
+	return 0;
+}
+
+int LIBUSB_CALL libusb_control_transfer(libusb_device_handle *dev_handle,
+		uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+		uint16_t wIndex, unsigned char *data, uint16_t wLength,
+		unsigned int timeout)
+{
+	(void)dev_handle;
+	(void)bRequest;
+	(void)wValue;
+	(void)wIndex;
+	(void)timeout;
+
+	return sync_transfer(request_type & LIBUSB_ENDPOINT_IN, data, wLength);
+}
+
+int LIBUSB_CALL libusb_bulk_transfer(libusb_device_handle *dev_handle,
+		unsigned char endpoint, unsigned char *data, int length,
+		int *actual_length, unsigned int timeout)
+{
+	int len;
+
+	(void)dev_handle;
+	(void)timeout;
+
+	len = sync_transfer(endpoint, data, length);
+	if (actual_length)
+		*actual_length = len;
+
+	return 0;
+}
+
+/* The pipe is always readable, so the session keeps polling. */
+const struct libusb_pollfd ** LIBUSB_CALL libusb_get_pollfds(
+		libusb_context *ctx)
+{
+	const struct libusb_pollfd **lupfd;
+
+	(void)ctx;
+
+	lupfd = malloc(2 * sizeof(*lupfd));
+	lupfd[0] = &replay.pollfd;
+	lupfd[1] = NULL;
+
+	return lupfd;
+}
+
+int LIBUSB_CALL libusb_handle_events_timeout(libusb_context *ctx,
+		struct timeval *tv)
+{
+	(void)ctx;
+
+	events_handle(tv);
+
+	return 0;
+}
+
+int LIBUSB_CALL libusb_handle_events_timeout_completed(libusb_context *ctx,
+		struct timeval *tv, int *completed)
+{
+	(void)ctx;
+	(void)completed;
+
+	events_handle(tv);
+
+	return 0;
+}
+
+void LIBUSB_CALL libusb_lock_events(libusb_context *ctx)
+{
+	(void)ctx;
+}
+
+void LIBUSB_CALL libusb_unlock_events(libusb_context *ctx)
+{
+	(void)ctx;
+}
+
+int LIBUSB_CALL libusb_release_interface(libusb_device_handle *dev_handle,
+		int interface_number)
+{
+	(void)dev_handle;
+	(void)interface_number;
+
+	return 0;
+}
+
+void LIBUSB_CALL libusb_close(libusb_device_handle *dev_handle)
+{
+	(void)dev_handle;
+}
+
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+/* The drivers fall back to memory of their own. */
+unsigned char * LIBUSB_CALL libusb_dev_mem_alloc(
+		libusb_device_handle *dev_handle, size_t length)
+{
+	(void)dev_handle;
+	(void)length;
+
+	return NULL;
+}
+
+int LIBUSB_CALL libusb_dev_mem_free(libusb_device_handle *dev_handle,
+		unsigned char *buffer, size_t length)
+{
+	(void)dev_handle;
+	(void)buffer;
+	(void)length;
+
+	return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+#endif
+
+/*--- Running a driver ------------------------------------------------------*/
+
+static void datafeed_in(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *cb_data)
+{
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_analog *analog;
+	guchar type;
+
+	(void)sdi;
+	(void)cb_data;
+
+	replay.packets++;
+	type = packet->type;
+	g_checksum_update(replay.digest, &type, 1);
+
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		g_checksum_update(replay.digest, logic->data, logic->length);
+		replay.samples += logic->length / logic->unitsize;
+		break;
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		g_checksum_update(replay.digest, (const guchar *)analog->data,
+				analog->num_samples * sizeof(float)
+				* g_slist_length(analog->probes));
+		replay.samples += analog->num_samples;
+		break;
+	}
+}
+
+static int triggers_set(const struct sr_dev_inst *sdi, const char *triggers)
+{
+	char **tokens, **pair;
+	int ret, i;
+
+	ret = SR_OK;
+	tokens = g_strsplit(triggers, ",", 0);
+	for (i = 0; tokens[i] && ret == SR_OK; i++) {
+		pair = g_strsplit(tokens[i], "=", 2);
+		if (!pair[0] || !pair[1])
+			ret = SR_ERR_ARG;
+		else
+			ret = sr_dev_trigger_set(sdi, strtol(pair[0], NULL, 10),
+					pair[1]);
+		if (ret != SR_OK)
+			fprintf(stderr, "Invalid trigger '%s'.\n", tokens[i]);
+		g_strfreev(pair);
+	}
+	g_strfreev(tokens);
+
+	return ret;
+}
+
+static int acquire(struct sr_context *sr_ctx)
+{
+	struct sr_dev_inst *sdi;
+	const struct usbreplay_driver *drv;
+	uint64_t samplerate;
+	int ret;
+
+	drv = replay.drv;
+	if (sr_driver_init(sr_ctx, drv->driver) != SR_OK)
+		return SR_ERR;
+	if (!(sdi = drv->dev_new(sr_ctx, (libusb_device_handle *)&fake_handle,
+			replay.limit)))
+		return SR_ERR;
+
+	if (opt_samplerate) {
+		if (sr_parse_sizestring(opt_samplerate, &samplerate) != SR_OK
+		    || sr_config_set(sdi, NULL, SR_CONF_SAMPLERATE,
+				g_variant_new_uint64(samplerate)) != SR_OK) {
+			fprintf(stderr, "Can't set the samplerate to %s.\n",
+				opt_samplerate);
+			return SR_ERR;
+		}
+	}
+	if (opt_trigger && (ret = triggers_set(sdi, opt_trigger)) != SR_OK)
+		return ret;
+
+	replay.session = sr_session_new();
+	sr_session_datafeed_callback_add(replay.session, datafeed_in, NULL);
+	if ((ret = sr_session_dev_add(replay.session, sdi)) == SR_OK
+	    && (ret = sr_session_start(replay.session)) == SR_OK)
+		ret = sr_session_run(replay.session);
+	sr_session_destroy(replay.session);
+
+	return ret;
+}
+
+static void results_print(void)
+{
+	double wall, busy;
+
+	wall = MAX(replay.end - replay.start, 1) / 1000000.0;
+	busy = MAX(replay.busy, 1) / 1000000.0;
+
+	printf("%s: %" PRIu64 " bytes in %" PRIu64 " transfers, %.3f s\n",
+	       replay.drv->name, replay.bytes, replay.transfers, wall);
+	printf("  %" PRIu64 " packets, %" PRIu64 " samples\n",
+	       replay.packets, replay.samples);
+	printf("  throughput %.1f MB/s, %.1f MB/s in callbacks\n",
+	       replay.bytes / wall / 1000000, replay.bytes / busy / 1000000);
+	if (replay.transfers)
+		printf("  callback time min %" PRIi64 " avg %.1f max %" PRIi64
+		       " us\n", replay.busy_min,
+		       (double)replay.busy / replay.transfers, replay.busy_max);
+	printf("  digest %s\n", g_checksum_get_string(replay.digest));
+}
+
+int main(int argc, char **argv)
+{
+	struct sr_context *sr_ctx;
+	GOptionContext *context;
+	GError *error;
+	struct record *rec;
+	unsigned int i;
+	int ret;
+
+	error = NULL;
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, optargs, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	for (i = 0; drivers[i]; i++) {
+		if (opt_driver && !strcmp(drivers[i]->name, opt_driver))
+			replay.drv = drivers[i];
+	}
+	if (!replay.drv) {
+		fprintf(stderr, "Drivers:");
+		for (i = 0; drivers[i]; i++)
+			fprintf(stderr, " %s", drivers[i]->name);
+		fprintf(stderr, "\n");
+		return 1;
+	}
+	if (opt_size < 1) {
+		fprintf(stderr, "The size must be positive.\n");
+		return 1;
+	}
+
+	replay.limit = (uint64_t)opt_size * 1024 * 1024;
+	replay.records = g_array_new(FALSE, FALSE, sizeof(struct record));
+	replay.pending = g_queue_new();
+	replay.cancelled = g_hash_table_new(NULL, NULL);
+	replay.digest = g_checksum_new(G_CHECKSUM_SHA1);
+	if (pipe(replay.pipe_fds) < 0
+	    || write(replay.pipe_fds[1], "", 1) != 1) {
+		perror("pipe");
+		return 1;
+	}
+	replay.pollfd.fd = replay.pipe_fds[0];
+	replay.pollfd.events = G_IO_IN;
+
+	ret = SR_OK;
+	if (opt_file)
+		ret = records_load(opt_file);
+	if (ret == SR_OK && (ret = sr_init(&sr_ctx)) == SR_OK) {
+		ret = acquire(sr_ctx);
+		sr_exit(sr_ctx);
+	}
+
+	if (ret == SR_OK) {
+		results_print();
+		if (opt_expect && g_ascii_strcasecmp(opt_expect,
+				g_checksum_get_string(replay.digest))) {
+			fprintf(stderr, "The digest should be %s.\n",
+				opt_expect);
+			ret = SR_ERR;
+		}
+	} else {
+		fprintf(stderr, "Running the %s driver failed.\n",
+			replay.drv->name);
+	}
+
+	for (i = 0; i < replay.records->len; i++) {
+		rec = &g_array_index(replay.records, struct record, i);
+		g_free(rec->data);
+	}
+	g_array_free(replay.records, TRUE);
+	g_queue_free(replay.pending);
+	g_hash_table_destroy(replay.cancelled);
+	g_checksum_free(replay.digest);
+	close(replay.pipe_fds[0]);
+	close(replay.pipe_fds[1]);
+
+	return ret == SR_OK ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef LIBSIGROK_TESTS_USBREPLAY_H
+#define LIBSIGROK_TESTS_USBREPLAY_H
+
+#include <stdint.h>
+#include <libusb.h>
+#include "../libsigrok.h"
+
+/*
+ * A driver as seen by the replay harness. Each one lives in a file of
+ * its own, since the drivers' headers can't be included together.
+ */
+struct usbreplay_driver {
+	const char *name;
+	struct sr_dev_driver *driver;
+	/*
+	 * Set up an opened device on the fake handle, stopping on its own
+	 * after about this many bytes of the driver's data.
+	 */
+	struct sr_dev_inst *(*dev_new)(struct sr_context *ctx,
+			libusb_device_handle *hdl, uint64_t bytes);
+	/*
+	 * The device's side of synchronous transfers: fill in the reply to
+	 * an IN request, or take an OUT request. Returns the length done.
+	 * Either may be NULL, IN requests then get zeroes.
+	 */
+	int (*sync_in)(unsigned char endpoint, unsigned char *buf, int len);
+	void (*sync_out)(unsigned char endpoint, const unsigned char *buf,
+			int len);
+	/* Fill in the data of a completed bulk IN transfer. */
+	int (*generate)(unsigned char endpoint, unsigned char *buf, int len);
+};
+
+extern const struct usbreplay_driver usbreplay_fx2lafw;
+extern const struct usbreplay_driver usbreplay_logic16;
+extern const struct usbreplay_driver usbreplay_hantek_dso;
+
+/* Random but reproducible data, the same for every run. */
+void usbreplay_random(unsigned char *buf, int len);
+
+#endif
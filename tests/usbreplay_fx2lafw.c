@@ -0,0 +1,98 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * The fx2lafw driver in the replay harness, as an 8-bit Saleae Logic
+ * clone. The firmware only takes the start command, so the data just
+ * streams into the bulk transfers.
+ */
+
+#include "config.h"
+#include "../hardware/fx2lafw/protocol.h"
+#include "usbreplay.h"
+
+#ifdef HAVE_HW_FX2LAFW
+
+static const struct fx2lafw_profile profile = {
+	0x0925, 0x3881, "Saleae", "Logic", NULL,
+	"fx2lafw-saleae-logic.fw", 0,
+};
+
+extern SR_PRIV struct sr_dev_driver fx2lafw_driver_info;
+
+static struct sr_dev_inst *dev_new(struct sr_context *ctx,
+		libusb_device_handle *hdl, uint64_t bytes)
+{
+	struct sr_dev_driver *di;
+	struct drv_context *drvc;
+	struct dev_context *devc;
+	struct sr_dev_inst *sdi;
+	struct sr_probe *probe;
+	char name[8];
+	int i;
+
+	(void)ctx;
+
+	di = &fx2lafw_driver_info;
+	drvc = di->priv;
+
+	if (!(sdi = sr_dev_inst_new(0, SR_ST_ACTIVE, profile.vendor,
+			profile.model, profile.model_version)))
+		return NULL;
+	sdi->driver = di;
+	for (i = 0; i < 8; i++) {
+		snprintf(name, sizeof(name), "%d", i);
+		if (!(probe = sr_probe_new(i, SR_PROBE_LOGIC, TRUE, name)))
+			return NULL;
+		sdi->probes = g_slist_append(sdi->probes, probe);
+	}
+	if (!(devc = fx2lafw_dev_new()))
+		return NULL;
+	devc->profile = &profile;
+	sdi->priv = devc;
+	sdi->inst_type = SR_INST_USB;
+	sdi->conn = sr_usb_dev_inst_new(1, 1, hdl);
+	drvc->instances = g_slist_append(drvc->instances, sdi);
+
+	/* One byte per sample with up to 8 probes. */
+	if (sr_config_set(sdi, NULL, SR_CONF_SAMPLERATE,
+			g_variant_new_uint64(SR_MHZ(24))) != SR_OK
+	    || sr_config_set(sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+			g_variant_new_uint64(bytes)) != SR_OK)
+		return NULL;
+
+	return sdi;
+}
+
+static int generate(unsigned char endpoint, unsigned char *buf, int len)
+{
+	(void)endpoint;
+
+	usbreplay_random(buf, len);
+
+	return len;
+}
+
+const struct usbreplay_driver usbreplay_fx2lafw = {
+	.name = "fx2lafw",
+	.driver = &fx2lafw_driver_info,
+	.dev_new = dev_new,
+	.generate = generate,
+};
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * The hantek-dso driver in the replay harness, as a DSO-2090 with the
+ * driver's defaults. The device always reports a captured frame, with
+ * the trigger at its start, so the driver goes through its whole state
+ * machine for every frame.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <libusb.h>
+#include "config.h"
+#include "../libsigrok.h"
+#include "../libsigrok-internal.h"
+#include "../hardware/hantek-dso/dso.h"
+#include "usbreplay.h"
+
+#ifdef HAVE_HW_HANTEK_DSO
+
+extern SR_PRIV struct sr_dev_driver hantek_dso_driver_info;
+
+static const uint64_t buffersizes[] = {
+	10240, 32768,
+};
+
+static const struct dso_profile profile = {
+	0x04b4, 0x2090, 0x04b5, 0x2090,
+	"Hantek", "DSO-2090", buffersizes, "hantek-dso-2090.fw",
+};
+
+static struct sr_dev_inst *dev_new(struct sr_context *ctx,
+		libusb_device_handle *hdl, uint64_t bytes)
+{
+	static const char *probe_names[] = { "CH1", "CH2", NULL };
+	struct sr_dev_driver *di;
+	struct drv_context *drvc;
+	struct dev_context *devc;
+	struct sr_dev_inst *sdi;
+	struct sr_probe *probe;
+	uint64_t frames;
+	int i;
+
+	(void)ctx;
+
+	di = &hantek_dso_driver_info;
+	drvc = di->priv;
+
+	if (!(sdi = sr_dev_inst_new(0, SR_ST_ACTIVE, profile.vendor,
+			profile.model, NULL)))
+		return NULL;
+	sdi->driver = di;
+	for (i = 0; probe_names[i]; i++) {
+		if (!(probe = sr_probe_new(i, SR_PROBE_ANALOG, TRUE,
+				probe_names[i])))
+			return NULL;
+		sdi->probes = g_slist_append(sdi->probes, probe);
+	}
+	if (!(devc = g_try_malloc0(sizeof(struct dev_context))))
+		return NULL;
+
+	/* As the driver sets up a new device, then opens it. */
+	devc->profile = &profile;
+	devc->dev_state = IDLE;
+	devc->timebase = DEFAULT_TIMEBASE;
+	devc->ch1_enabled = TRUE;
+	devc->ch2_enabled = TRUE;
+	devc->voltage_ch1 = DEFAULT_VOLTAGE;
+	devc->voltage_ch2 = DEFAULT_VOLTAGE;
+	devc->coupling_ch1 = DEFAULT_COUPLING;
+	devc->coupling_ch2 = DEFAULT_COUPLING;
+	devc->voffset_ch1 = DEFAULT_VERT_OFFSET;
+	devc->voffset_ch2 = DEFAULT_VERT_OFFSET;
+	devc->voffset_trigger = DEFAULT_VERT_TRIGGERPOS;
+	devc->framesize = DEFAULT_FRAMESIZE;
+	devc->triggerslope = SLOPE_POSITIVE;
+	devc->triggersource = g_strdup(DEFAULT_TRIGGER_SOURCE);
+	devc->triggerposition = DEFAULT_HORIZ_TRIGGERPOS;
+	devc->epin_maxpacketsize = 512;
+	sdi->priv = devc;
+	sdi->inst_type = SR_INST_USB;
+	sdi->conn = sr_usb_dev_inst_new(1, 1, hdl);
+	drvc->instances = g_slist_append(drvc->instances, sdi);
+
+	/* Two bytes per sample, one for each channel. */
+	frames = MAX(bytes / (devc->framesize * 2), 1);
+	if (sr_config_set(sdi, NULL, SR_CONF_LIMIT_FRAMES,
+			g_variant_new_uint64(frames)) != SR_OK)
+		return NULL;
+
+	return sdi;
+}
+
+static int sync_in(unsigned char endpoint, unsigned char *buf, int len)
+{
+	memset(buf, 0, len);
+
+	/* The capture state, with the trigger offset at 0. */
+	if (endpoint == DSO_EP_IN && len > 0)
+		buf[0] = CAPTURE_READY_8BIT;
+
+	return len;
+}
+
+static int generate(unsigned char endpoint, unsigned char *buf, int len)
+{
+	(void)endpoint;
+
+	usbreplay_random(buf, len);
+
+	return len;
+}
+
+const struct usbreplay_driver usbreplay_hantek_dso = {
+	.name = "hantek-dso",
+	.driver = &hantek_dso_driver_info,
+	.dev_new = dev_new,
+	.sync_in = sync_in,
+	.generate = generate,
+};
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * The saleae-logic16 driver in the replay harness. The device is set up
+ * as if its FPGA had been configured already, and the EP1 commands which
+ * setting up and stopping an acquisition take are answered like the
+ * device does, through the same cipher.
+ */
+
+#include <string.h>
+#include "config.h"
+#include "../hardware/saleae-logic16/protocol.h"
+#include "usbreplay.h"
+
+#ifdef HAVE_HW_SALEAE_LOGIC16
+
+#define COMMAND_ABORT_ACQUISITION_SYNC	0x7d
+#define COMMAND_FPGA_WRITE_REGISTER	0x80
+#define COMMAND_FPGA_READ_REGISTER	0x81
+
+extern SR_PRIV struct sr_dev_driver saleae_logic16_driver_info;
+
+static uint8_t fpga_regs[256];
+static uint8_t reply[64];
+static int reply_len;
+
+/* The same as in the driver, the device uses it both ways. */
+static void encrypt(uint8_t *dest, const uint8_t *src, uint8_t cnt)
+{
+	uint8_t state1 = 0x9b, state2 = 0x54;
+	uint8_t t, v;
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		v = src[i];
+		t = (((v ^ state2 ^ 0x2b) - 0x05) ^ 0x35) - 0x39;
+		t = (((t ^ state1 ^ 0x5a) - 0xb0) ^ 0x38) - 0x45;
+		dest[i] = state2 = t;
+		state1 = v;
+	}
+}
+
+static void decrypt(uint8_t *dest, const uint8_t *src, uint8_t cnt)
+{
+	uint8_t state1 = 0x9b, state2 = 0x54;
+	uint8_t t, v;
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		v = src[i];
+		t = (((v + 0x45) ^ 0x38) + 0xb0) ^ 0x5a ^ state1;
+		t = (((t + 0x39) ^ 0x35) + 0x05) ^ 0x2b ^ state2;
+		dest[i] = state1 = t;
+		state2 = v;
+	}
+}
+
+static struct sr_dev_inst *dev_new(struct sr_context *ctx,
+		libusb_device_handle *hdl, uint64_t bytes)
+{
+	struct sr_dev_driver *di;
+	struct drv_context *drvc;
+	struct dev_context *devc;
+	struct sr_dev_inst *sdi;
+	struct sr_probe *probe;
+	char name[8];
+	int i;
+
+	(void)ctx;
+
+	di = &saleae_logic16_driver_info;
+	drvc = di->priv;
+
+	if (!(sdi = sr_dev_inst_new(0, SR_ST_ACTIVE, "Saleae", "Logic16",
+			NULL)))
+		return NULL;
+	sdi->driver = di;
+	for (i = 0; i < 16; i++) {
+		snprintf(name, sizeof(name), "%d", i);
+		if (!(probe = sr_probe_new(i, SR_PROBE_LOGIC, TRUE, name)))
+			return NULL;
+		sdi->probes = g_slist_append(sdi->probes, probe);
+	}
+	if (!(devc = g_try_malloc0(sizeof(struct dev_context))))
+		return NULL;
+	/* Skips the bitstream upload. */
+	devc->selected_voltage_range = VOLTAGE_RANGE_18_33_V;
+	devc->cur_voltage_range = VOLTAGE_RANGE_18_33_V;
+	sdi->priv = devc;
+	sdi->inst_type = SR_INST_USB;
+	sdi->conn = sr_usb_dev_inst_new(1, 1, hdl);
+	drvc->instances = g_slist_append(drvc->instances, sdi);
+
+	/* The fastest with all 16 channels, two bytes per sample. */
+	if (sr_config_set(sdi, NULL, SR_CONF_SAMPLERATE,
+			g_variant_new_uint64(SR_MHZ(16))) != SR_OK
+	    || sr_config_set(sdi, NULL, SR_CONF_LIMIT_SAMPLES,
+			g_variant_new_uint64(bytes / 2)) != SR_OK)
+		return NULL;
+
+	return sdi;
+}
+
+static uint8_t fpga_register_read(uint8_t address)
+{
+	/* Bit 3 of register 1 reads back set while the device is idle. */
+	if (address == 1)
+		return fpga_regs[1] | 0x08;
+
+	return fpga_regs[address];
+}
+
+static void sync_out(unsigned char endpoint, const unsigned char *buf,
+		int len)
+{
+	uint8_t command[64];
+	int i;
+
+	if (endpoint != 1 || len < 1 || len > 64)
+		return;
+
+	decrypt(command, buf, len);
+	reply_len = 0;
+	switch (command[0]) {
+	case COMMAND_FPGA_WRITE_REGISTER:
+		for (i = 0; i < command[1] && 3 + 2 * i < len; i++)
+			fpga_regs[command[2 + 2 * i]] = command[3 + 2 * i];
+		break;
+	case COMMAND_FPGA_READ_REGISTER:
+		if (len < 3)
+			break;
+		for (i = 0; i < command[1] && i < 64; i++)
+			reply[i] = fpga_register_read(command[2] + i);
+		reply_len = i;
+		break;
+	case COMMAND_ABORT_ACQUISITION_SYNC:
+		if (len < 2)
+			break;
+		reply[0] = ~command[1];
+		reply_len = 1;
+		break;
+	}
+}
+
+static int sync_in(unsigned char endpoint, unsigned char *buf, int len)
+{
+	if (endpoint != (0x80 | 1))
+		return 0;
+
+	len = MIN(len, reply_len);
+	encrypt(buf, reply, len);
+	reply_len = 0;
+
+	return len;
+}
+
+static int generate(unsigned char endpoint, unsigned char *buf, int len)
+{
+	(void)endpoint;
+
+	usbreplay_random(buf, len);
+
+	return len;
+}
+
+const struct usbreplay_driver usbreplay_logic16 = {
+	.name = "saleae-logic16",
+	.driver = &saleae_logic16_driver_info,
+	.dev_new = dev_new,
+	.sync_in = sync_in,
+	.sync_out = sync_out,
+	.generate = generate,
+};
+
+#endif
@@ -0,0 +1,730 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reduces the samplerate of logic and analog data by a whole factor, and
+ * sends an SR_DF_META packet with the new samplerate after the header and
+ * in place of every samplerate change. Every window of factor samples
+ * becomes one sample: for logic data the window's first sample, or with
+ * "logic" set to "or" the OR of its samples, so a pulse shorter than the
+ * window still shows. For analog data each probe's average, or with
+ * "analog" set to "minmax" the minimum and the maximum of a window twice
+ * as long, as two samples. A partial window left at the end of the
+ * acquisition is sent before SR_DF_END. RLE data stays RLE, and raw
+ * analog data is sent as floats.
+ *
+ * Options: "samplerate", the samplerate to decimate to (e.g. "1M"), from
+ * which the factor follows, rounding down the result, or "factor" to give
+ * it directly. One of them is needed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "transform/decimate: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+struct device {
+	const struct sr_dev_inst *sdi;
+	uint64_t samplerate;
+	uint64_t factor;
+	/* The logic window so far, and the number of samples sent. */
+	uint16_t unitsize;
+	uint8_t *logic_acc;
+	uint64_t logic_count;
+	uint64_t logic_out;
+	int64_t logic_timestamp;
+	/* The same for analog data, and what it was sent with. */
+	GSList *probes;
+	unsigned int num_probes;
+	int mq;
+	int unit;
+	uint64_t mqflags;
+	float *analog_min;
+	float *analog_max;
+	double *analog_sum;
+	uint64_t analog_count;
+	uint64_t analog_out;
+	int64_t analog_timestamp;
+};
+
+struct context {
+	uint64_t samplerate;
+	uint64_t factor;
+	gboolean logic_or;
+	gboolean minmax;
+	GSList *devices;
+	uint8_t *buf;
+	size_t buf_size;
+	uint64_t *run_counts;
+	size_t run_counts_size;
+};
+
+static int init(struct sr_transform *t)
+{
+	struct context *ctx;
+	const char *param;
+	char *end;
+	uint64_t samplerate, factor;
+	gboolean logic_or, minmax;
+
+	samplerate = factor = 0;
+	param = t->param ? g_hash_table_lookup(t->param, "samplerate") : NULL;
+	if (param && (sr_parse_sizestring(param, &samplerate) != SR_OK
+	    || !samplerate)) {
+		sr_err("Invalid samplerate '%s'.", param);
+		return SR_ERR_ARG;
+	}
+	param = t->param ? g_hash_table_lookup(t->param, "factor") : NULL;
+	if (param) {
+		factor = strtoull(param, &end, 10);
+		if (!*param || *end || !factor) {
+			sr_err("Invalid factor '%s'.", param);
+			return SR_ERR_ARG;
+		}
+	}
+	if (!samplerate == !factor) {
+		sr_err("Either a samplerate or a factor is needed.");
+		return SR_ERR_ARG;
+	}
+
+	logic_or = FALSE;
+	param = t->param ? g_hash_table_lookup(t->param, "logic") : NULL;
+	if (param) {
+		if (!strcmp(param, "or")) {
+			logic_or = TRUE;
+		} else if (strcmp(param, "sample")) {
+			sr_err("Invalid logic option '%s'.", param);
+			return SR_ERR_ARG;
+		}
+	}
+
+	minmax = FALSE;
+	param = t->param ? g_hash_table_lookup(t->param, "analog") : NULL;
+	if (param) {
+		if (!strcmp(param, "minmax")) {
+			minmax = TRUE;
+		} else if (strcmp(param, "average")) {
+			sr_err("Invalid analog option '%s'.", param);
+			return SR_ERR_ARG;
+		}
+	}
+
+	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
+		sr_err("%s: ctx malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	ctx->samplerate = samplerate;
+	ctx->factor = factor;
+	ctx->logic_or = logic_or;
+	ctx->minmax = minmax;
+	t->internal = ctx;
+
+	return SR_OK;
+}
+
+static void device_free(gpointer data)
+{
+	struct device *dev;
+
+	dev = data;
+	g_free(dev->logic_acc);
+	g_slist_free(dev->probes);
+	g_free(dev->analog_min);
+	g_free(dev);
+}
+
+static struct device *device_get(struct context *ctx,
+		const struct sr_dev_inst *sdi)
+{
+	struct device *dev;
+	GSList *l;
+
+	for (l = ctx->devices; l; l = l->next) {
+		dev = l->data;
+		if (dev->sdi == sdi)
+			return dev;
+	}
+
+	if (!(dev = g_try_malloc0(sizeof(struct device)))) {
+		sr_err("%s: dev malloc failed", __func__);
+		return NULL;
+	}
+	dev->sdi = sdi;
+	dev->factor = 1;
+	ctx->devices = g_slist_prepend(ctx->devices, dev);
+
+	return dev;
+}
+
+static void *buf_get(void **buf, size_t *buf_size, size_t size)
+{
+	void *p;
+
+	if (size <= *buf_size)
+		return *buf;
+	if (!(p = g_try_realloc(*buf, size))) {
+		sr_err("%s: buf malloc failed", __func__);
+		return NULL;
+	}
+	*buf = p;
+	*buf_size = size;
+
+	return p;
+}
+
+/*
+ * Send the samplerate decimated to, with the rest of the device's META
+ * packet if it came from one.
+ */
+static int meta_send(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		struct device *dev, const struct sr_datafeed_meta *orig)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_meta meta;
+	struct sr_config *cfg, *src;
+	GSList *l;
+	int ret;
+
+	if (!(cfg = sr_config_new(SR_CONF_SAMPLERATE,
+			g_variant_new_uint64(dev->samplerate / dev->factor)))) {
+		sr_err("%s: cfg malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	meta.config = NULL;
+	for (l = orig ? orig->config : NULL; l; l = l->next) {
+		src = l->data;
+		meta.config = g_slist_append(meta.config,
+				src->key == SR_CONF_SAMPLERATE ? cfg : src);
+	}
+	if (!orig)
+		meta.config = g_slist_append(NULL, cfg);
+	packet.type = SR_DF_META;
+	packet.payload = &meta;
+	ret = sr_transform_send(t, sdi, &packet);
+	g_slist_free(meta.config);
+	sr_config_free(cfg);
+
+	return ret;
+}
+
+static void factor_update(struct context *ctx, struct device *dev)
+{
+	if (ctx->factor)
+		dev->factor = ctx->factor;
+	else if (dev->samplerate)
+		dev->factor = MAX(dev->samplerate / ctx->samplerate, 1);
+	else
+		dev->factor = 1;
+	sr_dbg("Decimating by %" PRIu64 ".", dev->factor);
+}
+
+static int logic_send(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		struct device *dev, uint64_t num_samples)
+{
+	struct context *ctx;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+
+	if (!num_samples)
+		return SR_OK;
+
+	ctx = t->internal;
+	logic.length = num_samples * dev->unitsize;
+	logic.unitsize = dev->unitsize;
+	logic.data = ctx->buf;
+	logic.start_sample = dev->logic_out;
+	logic.timestamp = dev->logic_timestamp;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+	dev->logic_out += num_samples;
+
+	return sr_transform_send(t, sdi, &packet);
+}
+
+/*
+ * Add n samples equal to the given one to the logic window, returning the
+ * number of windows completed. n must not go past the end of the window,
+ * unless the window is empty and n is a multiple of the factor.
+ */
+static uint64_t logic_add(struct context *ctx, struct device *dev,
+		const uint8_t *sample, uint64_t n)
+{
+	unsigned int j;
+
+	if (!dev->logic_count) {
+		memcpy(dev->logic_acc, sample, dev->unitsize);
+		if (n >= dev->factor) {
+			dev->logic_count = 0;
+			return n / dev->factor;
+		}
+	} else if (ctx->logic_or) {
+		for (j = 0; j < dev->unitsize; j++)
+			dev->logic_acc[j] |= sample[j];
+	}
+	dev->logic_count += MIN(n, dev->factor - dev->logic_count);
+	if (dev->logic_count < dev->factor)
+		return 0;
+	dev->logic_count = 0;
+
+	return 1;
+}
+
+static int decimate_logic(struct sr_transform *t,
+		const struct sr_dev_inst *sdi, struct device *dev,
+		const struct sr_datafeed_logic *logic)
+{
+	struct context *ctx;
+	const uint8_t *data;
+	uint8_t *out;
+	uint64_t num_samples, num_out, i, n;
+
+	ctx = t->internal;
+	data = logic->data;
+	num_samples = logic->length / dev->unitsize;
+	if (!(out = buf_get((void **)&ctx->buf, &ctx->buf_size,
+			(num_samples / dev->factor + 1) * dev->unitsize)))
+		return SR_ERR_MALLOC;
+
+	dev->logic_timestamp = logic->timestamp;
+	num_out = 0;
+	for (i = 0; i < num_samples; i += n) {
+		/* Without OR, only the first sample of a window matters. */
+		n = ctx->logic_or ? 1 : MIN(num_samples - i,
+				dev->factor - dev->logic_count);
+		if (logic_add(ctx, dev, data + i * dev->unitsize, n))
+			memcpy(out + num_out++ * dev->unitsize,
+					dev->logic_acc, dev->unitsize);
+	}
+
+	return logic_send(t, sdi, dev, num_out);
+}
+
+static int decimate_rle(struct sr_transform *t,
+		const struct sr_dev_inst *sdi, struct device *dev,
+		const struct sr_datafeed_logic_rle *rle)
+{
+	struct context *ctx;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic_rle rle_out;
+	const uint8_t *values;
+	uint8_t *out;
+	uint64_t run, left, n, windows, num_runs, num_samples, *counts;
+
+	ctx = t->internal;
+	/* Every run ends at most two windows: a partial and whole ones. */
+	if (!(out = buf_get((void **)&ctx->buf, &ctx->buf_size,
+			2 * rle->num_runs * dev->unitsize)))
+		return SR_ERR_MALLOC;
+	if (!(counts = buf_get((void **)&ctx->run_counts,
+			&ctx->run_counts_size,
+			2 * rle->num_runs * sizeof(uint64_t))))
+		return SR_ERR_MALLOC;
+
+	values = rle->values;
+	num_runs = num_samples = 0;
+	for (run = 0; run < rle->num_runs; run++) {
+		for (left = rle->counts[run]; left; left -= n) {
+			n = dev->logic_count ? MIN(left,
+					dev->factor - dev->logic_count) : left;
+			if (!dev->logic_count && n >= dev->factor)
+				n -= n % dev->factor;
+			windows = logic_add(ctx, dev,
+					values + run * dev->unitsize, n);
+			if (!windows)
+				continue;
+			num_samples += windows;
+			if (num_runs && !memcmp(out + (num_runs - 1)
+					* dev->unitsize, dev->logic_acc,
+					dev->unitsize)) {
+				counts[num_runs - 1] += windows;
+				continue;
+			}
+			memcpy(out + num_runs * dev->unitsize, dev->logic_acc,
+					dev->unitsize);
+			counts[num_runs++] = windows;
+		}
+	}
+	if (!num_runs)
+		return SR_OK;
+
+	rle_out.num_samples = num_samples;
+	rle_out.num_runs = num_runs;
+	rle_out.unitsize = dev->unitsize;
+	rle_out.values = out;
+	rle_out.counts = counts;
+	rle_out.start_sample = dev->logic_out;
+	rle_out.timestamp = rle->timestamp;
+	packet.type = SR_DF_LOGIC_RLE;
+	packet.payload = &rle_out;
+	dev->logic_out += num_samples;
+
+	return sr_transform_send(t, sdi, &packet);
+}
+
+/* Start logic windows over, for data of this unitsize. */
+static int logic_reset(struct device *dev, uint16_t unitsize)
+{
+	dev->logic_count = 0;
+	if (unitsize == dev->unitsize)
+		return SR_OK;
+
+	g_free(dev->logic_acc);
+	if (!(dev->logic_acc = g_try_malloc(unitsize))) {
+		sr_err("%s: logic_acc malloc failed", __func__);
+		dev->unitsize = 0;
+		return SR_ERR_MALLOC;
+	}
+	dev->unitsize = unitsize;
+
+	return SR_OK;
+}
+
+static int analog_send(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		struct device *dev, const float *data, uint64_t num_samples)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog analog;
+
+	if (!num_samples)
+		return SR_OK;
+
+	analog.probes = dev->probes;
+	analog.num_samples = num_samples;
+	analog.mq = dev->mq;
+	analog.unit = dev->unit;
+	analog.mqflags = dev->mqflags;
+	analog.data = (float *)data;
+	analog.start_sample = dev->analog_out;
+	analog.timestamp = dev->analog_timestamp;
+	analog.timestamps = NULL;
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	dev->analog_out += num_samples;
+
+	return sr_transform_send(t, sdi, &packet);
+}
+
+/* Write the window's sample, or its two, and start the next window. */
+static unsigned int analog_window_end(struct context *ctx,
+		struct device *dev, float *out)
+{
+	unsigned int j;
+
+	if (ctx->minmax) {
+		memcpy(out, dev->analog_min, dev->num_probes * sizeof(float));
+		memcpy(out + dev->num_probes, dev->analog_max,
+				dev->num_probes * sizeof(float));
+	} else {
+		for (j = 0; j < dev->num_probes; j++)
+			out[j] = dev->analog_sum[j] / dev->analog_count;
+	}
+	dev->analog_count = 0;
+
+	return ctx->minmax ? 2 : 1;
+}
+
+/* Start analog windows over, for data of these probes. */
+static int analog_reset(struct device *dev,
+		const struct sr_datafeed_analog *analog)
+{
+	unsigned int num_probes;
+
+	dev->analog_count = 0;
+	g_slist_free(dev->probes);
+	dev->probes = g_slist_copy(analog->probes);
+	dev->mq = analog->mq;
+	dev->unit = analog->unit;
+	dev->mqflags = analog->mqflags;
+	num_probes = g_slist_length(analog->probes);
+	if (num_probes == dev->num_probes)
+		return SR_OK;
+
+	g_free(dev->analog_min);
+	dev->analog_min = g_try_malloc(num_probes
+			* (2 * sizeof(float) + sizeof(double)));
+	if (!dev->analog_min) {
+		sr_err("%s: window malloc failed", __func__);
+		dev->num_probes = 0;
+		return SR_ERR_MALLOC;
+	}
+	dev->analog_max = dev->analog_min + num_probes;
+	dev->analog_sum = (double *)(dev->analog_max + num_probes);
+	dev->num_probes = num_probes;
+
+	return SR_OK;
+}
+
+static gboolean probes_equal(GSList *a, GSList *b)
+{
+	for (; a && b; a = a->next, b = b->next) {
+		if (a->data != b->data)
+			return FALSE;
+	}
+
+	return !a && !b;
+}
+
+static int decimate_analog(struct sr_transform *t,
+		const struct sr_dev_inst *sdi, struct device *dev,
+		const struct sr_datafeed_analog *analog)
+{
+	struct context *ctx;
+	const float *sample;
+	float *out;
+	uint64_t window, num_out;
+	unsigned int num_probes, j;
+	int i, ret;
+
+	ctx = t->internal;
+	if (!probes_equal(analog->probes, dev->probes) || analog->mq != dev->mq
+	    || analog->unit != dev->unit || analog->mqflags != dev->mqflags) {
+		/* The last window of other data stays as it is. */
+		if (dev->analog_count) {
+			if (!(out = buf_get((void **)&ctx->buf, &ctx->buf_size,
+					2 * dev->num_probes * sizeof(float))))
+				return SR_ERR_MALLOC;
+			num_out = analog_window_end(ctx, dev, out);
+			if ((ret = analog_send(t, sdi, dev, out,
+					num_out)) != SR_OK)
+				return ret;
+		}
+		if ((ret = analog_reset(dev, analog)) != SR_OK)
+			return ret;
+	}
+
+	num_probes = dev->num_probes;
+	window = ctx->minmax ? 2 * dev->factor : dev->factor;
+	if (!(out = buf_get((void **)&ctx->buf, &ctx->buf_size,
+			(analog->num_samples / window + 1) * 2 * num_probes
+			* sizeof(float))))
+		return SR_ERR_MALLOC;
+
+	dev->analog_timestamp = analog->timestamp;
+	num_out = 0;
+	sample = analog->data;
+	for (i = 0; i < analog->num_samples; i++, sample += num_probes) {
+		if (!dev->analog_count) {
+			memcpy(dev->analog_min, sample,
+					num_probes * sizeof(float));
+			memcpy(dev->analog_max, sample,
+					num_probes * sizeof(float));
+			for (j = 0; j < num_probes; j++)
+				dev->analog_sum[j] = sample[j];
+		} else {
+			for (j = 0; j < num_probes; j++) {
+				dev->analog_min[j] = MIN(dev->analog_min[j],
+						sample[j]);
+				dev->analog_max[j] = MAX(dev->analog_max[j],
+						sample[j]);
+				dev->analog_sum[j] += sample[j];
+			}
+		}
+		if (++dev->analog_count == window)
+			num_out += analog_window_end(ctx, dev,
+					out + num_out * num_probes);
+	}
+
+	return analog_send(t, sdi, dev, out, num_out);
+}
+
+static int decimate_raw(struct sr_transform *t,
+		const struct sr_dev_inst *sdi, struct device *dev,
+		const struct sr_datafeed_analog_raw *raw)
+{
+	struct sr_datafeed_analog analog;
+	float *data;
+	int ret;
+
+	if (!(data = g_try_malloc((size_t)raw->num_samples
+			* g_slist_length(raw->probes) * sizeof(float)))) {
+		sr_err("%s: data malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if ((ret = sr_analog_raw_to_float(raw, data)) != SR_OK) {
+		g_free(data);
+		return ret;
+	}
+
+	analog.probes = raw->probes;
+	analog.num_samples = raw->num_samples;
+	analog.mq = raw->mq;
+	analog.unit = raw->unit;
+	analog.mqflags = raw->mqflags;
+	analog.data = data;
+	analog.start_sample = raw->start_sample;
+	analog.timestamp = raw->timestamp;
+	analog.timestamps = NULL;
+	ret = decimate_analog(t, sdi, dev, &analog);
+	g_free(data);
+
+	return ret;
+}
+
+/* Send what there is of the last windows. */
+static int windows_flush(struct sr_transform *t,
+		const struct sr_dev_inst *sdi, struct device *dev)
+{
+	struct context *ctx;
+	float *out;
+	unsigned int num_out;
+	int ret;
+
+	ctx = t->internal;
+	if (dev->logic_count) {
+		if (!buf_get((void **)&ctx->buf, &ctx->buf_size,
+				dev->unitsize))
+			return SR_ERR_MALLOC;
+		memcpy(ctx->buf, dev->logic_acc, dev->unitsize);
+		dev->logic_count = 0;
+		if ((ret = logic_send(t, sdi, dev, 1)) != SR_OK)
+			return ret;
+	}
+	if (dev->analog_count) {
+		if (!(out = buf_get((void **)&ctx->buf, &ctx->buf_size,
+				2 * dev->num_probes * sizeof(float))))
+			return SR_ERR_MALLOC;
+		num_out = analog_window_end(ctx, dev, out);
+		if ((ret = analog_send(t, sdi, dev, out, num_out)) != SR_OK)
+			return ret;
+	}
+
+	return SR_OK;
+}
+
+static int receive(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct context *ctx;
+	struct device *dev;
+	const struct sr_datafeed_meta *meta;
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+	struct sr_config *src;
+	GVariant *gvar;
+	GSList *l;
+	uint16_t unitsize;
+	int ret;
+
+	ctx = t->internal;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		dev->logic_count = dev->logic_out = 0;
+		dev->analog_count = dev->analog_out = 0;
+		g_slist_free(dev->probes);
+		dev->probes = NULL;
+		dev->samplerate = 0;
+		if (sdi && sdi->driver && sr_config_get(sdi->driver, sdi, NULL,
+				SR_CONF_SAMPLERATE, &gvar) == SR_OK) {
+			dev->samplerate = g_variant_get_uint64(gvar);
+			g_variant_unref(gvar);
+		}
+		factor_update(ctx, dev);
+		if ((ret = sr_transform_send(t, sdi, packet)) != SR_OK)
+			return ret;
+		return dev->factor > 1 ? meta_send(t, sdi, dev, NULL) : SR_OK;
+	case SR_DF_META:
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		meta = packet->payload;
+		for (l = meta->config; l; l = l->next) {
+			src = l->data;
+			if (src->key == SR_CONF_SAMPLERATE)
+				break;
+		}
+		if (!l)
+			break;
+		/* Windows of the old samplerate end with it. */
+		if ((ret = windows_flush(t, sdi, dev)) != SR_OK)
+			return ret;
+		dev->samplerate = g_variant_get_uint64(src->data);
+		factor_update(ctx, dev);
+		if (dev->factor == 1)
+			break;
+		return meta_send(t, sdi, dev, meta);
+	case SR_DF_LOGIC:
+	case SR_DF_LOGIC_RLE:
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		logic = packet->payload;
+		rle = packet->payload;
+		unitsize = packet->type == SR_DF_LOGIC ? logic->unitsize
+				: rle->unitsize;
+		if (!unitsize)
+			return SR_OK;
+		if (unitsize != dev->unitsize) {
+			if ((ret = windows_flush(t, sdi, dev)) != SR_OK)
+				return ret;
+			if ((ret = logic_reset(dev, unitsize)) != SR_OK)
+				return ret;
+		}
+		if (packet->type == SR_DF_LOGIC)
+			return decimate_logic(t, sdi, dev, logic);
+		else
+			return decimate_rle(t, sdi, dev, rle);
+	case SR_DF_ANALOG:
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		return decimate_analog(t, sdi, dev, packet->payload);
+	case SR_DF_ANALOG_RAW:
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		return decimate_raw(t, sdi, dev, packet->payload);
+	case SR_DF_END:
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		if ((ret = windows_flush(t, sdi, dev)) != SR_OK)
+			return ret;
+		break;
+	}
+
+	return sr_transform_send(t, sdi, packet);
+}
+
+static int cleanup(struct sr_transform *t)
+{
+	struct context *ctx;
+
+	ctx = t->internal;
+	g_slist_free_full(ctx->devices, device_free);
+	g_free(ctx->buf);
+	g_free(ctx->run_counts);
+	g_free(ctx);
+	t->internal = NULL;
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_transform_format transform_decimate = {
+	.id = "decimate",
+	.description = "Reduce the samplerate of logic and analog data",
+	.init = init,
+	.receive = receive,
+	.cleanup = cleanup,
+};
@@ -0,0 +1,386 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Suppresses pulses shorter than a number of samples on every logic probe:
+ * a probe's output only follows its input once the input has had the new
+ * value for that many samples in a row. All edges thus come out width - 1
+ * samples late, the same on every probe, so their relative timing is kept.
+ *
+ * The probes are debounced all at once, with a bit-sliced counter per
+ * probe: bit k of counts[k] is bit k of every probe's count of samples
+ * differing from the output. Samples equal to the output with no count
+ * pending cost a single compare, eight bytes of samples at a time.
+ *
+ * Options: "width", the shortest pulse kept in samples (default 2).
+ * Samples larger than 64 bits are passed on unfiltered.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "transform/deglitch: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+#define DEFAULT_WIDTH 2
+#define MAX_WIDTH 0xffff
+#define COUNT_BITS 16
+
+struct device {
+	const struct sr_dev_inst *sdi;
+	uint16_t unitsize;
+	/* The output so far, if any sample was seen. */
+	gboolean have_out;
+	uint64_t out;
+	/* The bit-sliced counts, and the OR of them. */
+	uint64_t counts[COUNT_BITS];
+	uint64_t pending;
+};
+
+struct context {
+	unsigned int width;
+	unsigned int count_bits;
+	GSList *devices;
+	uint8_t *buf;
+	uint64_t buf_size;
+	uint64_t *run_counts;
+	uint64_t run_counts_size;
+};
+
+static int init(struct sr_transform *t)
+{
+	struct context *ctx;
+	const char *param;
+	char *end;
+	unsigned long width;
+
+	width = DEFAULT_WIDTH;
+	param = t->param ? g_hash_table_lookup(t->param, "width") : NULL;
+	if (param) {
+		width = strtoul(param, &end, 10);
+		if (!*param || *end || !width || width > MAX_WIDTH) {
+			sr_err("Invalid width '%s'.", param);
+			return SR_ERR_ARG;
+		}
+	}
+
+	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
+		sr_err("%s: ctx malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	ctx->width = width;
+	while (width >> ctx->count_bits)
+		ctx->count_bits++;
+	t->internal = ctx;
+
+	return SR_OK;
+}
+
+static struct device *device_get(struct context *ctx,
+		const struct sr_dev_inst *sdi)
+{
+	struct device *dev;
+	GSList *l;
+
+	for (l = ctx->devices; l; l = l->next) {
+		dev = l->data;
+		if (dev->sdi == sdi)
+			return dev;
+	}
+
+	if (!(dev = g_try_malloc0(sizeof(struct device)))) {
+		sr_err("%s: dev malloc failed", __func__);
+		return NULL;
+	}
+	dev->sdi = sdi;
+	ctx->devices = g_slist_prepend(ctx->devices, dev);
+
+	return dev;
+}
+
+/* Start over, with the next sample as the output. */
+static void device_reset(struct device *dev, uint16_t unitsize)
+{
+	dev->unitsize = unitsize;
+	dev->have_out = FALSE;
+	dev->out = 0;
+	memset(dev->counts, 0, sizeof(dev->counts));
+	dev->pending = 0;
+}
+
+static uint64_t sample_read(const uint8_t *p, uint16_t unitsize)
+{
+	uint64_t v;
+
+	v = 0;
+	memcpy(&v, p, unitsize);
+
+	return GUINT64_FROM_LE(v);
+}
+
+static void sample_write(uint8_t *p, uint64_t v, uint16_t unitsize)
+{
+	v = GUINT64_TO_LE(v);
+	memcpy(p, &v, unitsize);
+}
+
+/* Run one sample through the filter, returning the output for it. */
+static uint64_t debounce(const struct context *ctx, struct device *dev,
+		uint64_t v)
+{
+	uint64_t d, carry, t, eq;
+	unsigned int k;
+
+	if (!dev->have_out) {
+		dev->out = v;
+		dev->have_out = TRUE;
+		return v;
+	}
+
+	d = v ^ dev->out;
+	if (!d && !dev->pending)
+		return dev->out;
+
+	/* Probes back at their output count from 0, others count up. */
+	carry = d;
+	eq = d;
+	dev->pending = 0;
+	for (k = 0; k < ctx->count_bits; k++) {
+		dev->counts[k] &= d;
+		t = dev->counts[k] & carry;
+		dev->counts[k] ^= carry;
+		carry = t;
+		eq &= (ctx->width >> k) & 1 ? dev->counts[k] : ~dev->counts[k];
+	}
+	/* Probes stable for width samples switch over. */
+	if (eq) {
+		dev->out ^= eq;
+		for (k = 0; k < ctx->count_bits; k++)
+			dev->counts[k] &= ~eq;
+	}
+	for (k = 0; k < ctx->count_bits; k++)
+		dev->pending |= dev->counts[k];
+
+	return dev->out;
+}
+
+static int buf_get(struct context *ctx, uint64_t size)
+{
+	uint8_t *buf;
+
+	if (size <= ctx->buf_size)
+		return SR_OK;
+	if (!(buf = g_try_realloc(ctx->buf, size))) {
+		sr_err("%s: buf malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	ctx->buf = buf;
+	ctx->buf_size = size;
+
+	return SR_OK;
+}
+
+static void filter_samples(const struct context *ctx, struct device *dev,
+		const uint8_t *data, uint64_t num_samples, uint8_t *buf)
+{
+	uint64_t rep, w, i, per_word;
+	unsigned int k;
+
+	/* The output repeated in every sample of a 64-bit word. */
+	per_word = 8 % dev->unitsize ? 1 : 8 / dev->unitsize;
+	rep = 0;
+	for (k = 0; k < per_word; k++)
+		rep |= dev->out << (k * dev->unitsize * 8);
+
+	i = 0;
+	while (i < num_samples) {
+		if (per_word > 1 && dev->have_out && !dev->pending
+		    && i + per_word <= num_samples) {
+			memcpy(&w, data + i * dev->unitsize, 8);
+			if (GUINT64_FROM_LE(w) == rep) {
+				memcpy(buf + i * dev->unitsize, &w, 8);
+				i += per_word;
+				continue;
+			}
+		}
+		sample_write(buf + i * dev->unitsize, debounce(ctx, dev,
+				sample_read(data + i * dev->unitsize,
+				dev->unitsize)), dev->unitsize);
+		i++;
+		if (per_word > 1 && !dev->pending) {
+			rep = 0;
+			for (k = 0; k < per_word; k++)
+				rep |= dev->out << (k * dev->unitsize * 8);
+		}
+	}
+}
+
+static int filter_logic(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		struct device *dev, const struct sr_datafeed_logic *logic)
+{
+	struct context *ctx;
+	struct sr_datafeed_logic logic_out;
+	struct sr_datafeed_packet out;
+	uint64_t num_samples;
+	int ret;
+
+	ctx = t->internal;
+	num_samples = logic->length / logic->unitsize;
+	if ((ret = buf_get(ctx, num_samples * logic->unitsize)) != SR_OK)
+		return ret;
+	filter_samples(ctx, dev, logic->data, num_samples, ctx->buf);
+
+	logic_out = *logic;
+	logic_out.length = num_samples * logic->unitsize;
+	logic_out.data = ctx->buf;
+	out.type = SR_DF_LOGIC;
+	out.payload = &logic_out;
+
+	return sr_transform_send(t, sdi, &out);
+}
+
+/*
+ * Runs are filtered a sample at a time only until they have lasted width
+ * samples, after which the output equals the input. Runs of the same
+ * output are merged, so glitches leave fewer runs behind.
+ */
+static int filter_rle(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		struct device *dev, const struct sr_datafeed_logic_rle *rle)
+{
+	struct context *ctx;
+	struct sr_datafeed_logic_rle rle_out;
+	struct sr_datafeed_packet out;
+	const uint8_t *values;
+	uint64_t max_runs, num_runs, run, n, i, v, o, prev, *run_counts;
+	int ret;
+
+	ctx = t->internal;
+	/* Within a run, every probe's output changes at most once. */
+	max_runs = rle->num_runs * (1 + MIN(ctx->width, rle->unitsize * 8));
+	if ((ret = buf_get(ctx, max_runs * rle->unitsize)) != SR_OK)
+		return ret;
+	if (max_runs > ctx->run_counts_size) {
+		if (!(run_counts = g_try_realloc(ctx->run_counts,
+				max_runs * sizeof(uint64_t)))) {
+			sr_err("%s: run_counts malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		ctx->run_counts = run_counts;
+		ctx->run_counts_size = max_runs;
+	}
+
+	values = rle->values;
+	num_runs = 0;
+	prev = 0;
+	for (run = 0; run < rle->num_runs; run++) {
+		v = sample_read(values + run * rle->unitsize, rle->unitsize);
+		for (i = 0; i < rle->counts[run]; i += n) {
+			n = 1;
+			o = debounce(ctx, dev, v);
+			/* Settled for the rest of the run. */
+			if (o == v)
+				n = rle->counts[run] - i;
+			if (num_runs && o == prev) {
+				ctx->run_counts[num_runs - 1] += n;
+				continue;
+			}
+			sample_write(ctx->buf + num_runs * rle->unitsize, o,
+					rle->unitsize);
+			ctx->run_counts[num_runs++] = n;
+			prev = o;
+		}
+	}
+
+	rle_out = *rle;
+	rle_out.num_runs = num_runs;
+	rle_out.values = ctx->buf;
+	rle_out.counts = ctx->run_counts;
+	out.type = SR_DF_LOGIC_RLE;
+	out.payload = &rle_out;
+
+	return sr_transform_send(t, sdi, &out);
+}
+
+static int receive(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct context *ctx;
+	struct device *dev;
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+	uint16_t unitsize;
+
+	ctx = t->internal;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		device_reset(dev, 0);
+		break;
+	case SR_DF_LOGIC:
+	case SR_DF_LOGIC_RLE:
+		logic = packet->payload;
+		rle = packet->payload;
+		unitsize = packet->type == SR_DF_LOGIC ? logic->unitsize
+				: rle->unitsize;
+		if (!unitsize || unitsize > 8)
+			break;
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		/* Other probes than before, so the counts are moot. */
+		if (unitsize != dev->unitsize)
+			device_reset(dev, unitsize);
+		if (packet->type == SR_DF_LOGIC)
+			return filter_logic(t, sdi, dev, logic);
+		else
+			return filter_rle(t, sdi, dev, rle);
+	}
+
+	return sr_transform_send(t, sdi, packet);
+}
+
+static int cleanup(struct sr_transform *t)
+{
+	struct context *ctx;
+
+	ctx = t->internal;
+	g_slist_free_full(ctx->devices, g_free);
+	g_free(ctx->buf);
+	g_free(ctx->run_counts);
+	g_free(ctx);
+	t->internal = NULL;
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_transform_format transform_deglitch = {
+	.id = "deglitch",
+	.description = "Suppress pulses shorter than a number of samples",
+	.init = init,
+	.receive = receive,
+	.cleanup = cleanup,
+};
@@ -0,0 +1,476 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Counts the high samples, edges and rising edges of each bit of the
+ * logic data, and sends them with the duty cycle and frequency in an
+ * SR_DF_LOGIC_STATS packet after every window of samples, and at the end
+ * of the acquisition for the last part of a window. The frequency is the
+ * number of rising edges per second, as a frequency counter with the
+ * window as gate time would show it.
+ *
+ * Options: "window", the number of samples per window (default 1000000),
+ * and "data", "keep" (the default) to pass the logic data on as well, or
+ * "drop" to send only the statistics.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "transform/logic-stats: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+#define DEFAULT_WINDOW 1000000
+
+/* The counts of one bit, over a window or the acquisition. */
+struct counts {
+	uint64_t high;
+	uint64_t edges;
+	uint64_t rising;
+};
+
+struct device {
+	const struct sr_dev_inst *sdi;
+	struct sr_stream_params params;
+	uint16_t unitsize;
+	/* The last sample seen, if any, to find edges at packet starts. */
+	gboolean have_prev;
+	uint8_t *prev;
+	/* Samples in the current window and so far, and the window's first. */
+	uint64_t count;
+	uint64_t total_count;
+	uint64_t start_sample;
+	int64_t timestamp;
+	/* The window's, then the total counts of each bit. */
+	struct counts *counts;
+	struct sr_logic_stats *stats;
+};
+
+struct context {
+	uint64_t window;
+	gboolean drop;
+	GSList *devices;
+};
+
+static int init(struct sr_transform *t)
+{
+	struct context *ctx;
+	const char *param;
+	char *end;
+	uint64_t window;
+	gboolean drop;
+
+	window = DEFAULT_WINDOW;
+	param = t->param ? g_hash_table_lookup(t->param, "window") : NULL;
+	if (param) {
+		window = strtoull(param, &end, 10);
+		if (!*param || *end || !window) {
+			sr_err("Invalid window '%s'.", param);
+			return SR_ERR_ARG;
+		}
+	}
+
+	drop = FALSE;
+	param = t->param ? g_hash_table_lookup(t->param, "data") : NULL;
+	if (param) {
+		if (!strcmp(param, "drop")) {
+			drop = TRUE;
+		} else if (strcmp(param, "keep")) {
+			sr_err("Invalid data option '%s'.", param);
+			return SR_ERR_ARG;
+		}
+	}
+
+	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
+		sr_err("%s: ctx malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	ctx->window = window;
+	ctx->drop = drop;
+	t->internal = ctx;
+
+	return SR_OK;
+}
+
+static void device_free(gpointer data)
+{
+	struct device *dev;
+
+	dev = data;
+	g_free(dev->prev);
+	g_free(dev->counts);
+	g_free(dev->stats);
+	g_free(dev);
+}
+
+static struct device *device_get(struct context *ctx,
+		const struct sr_dev_inst *sdi)
+{
+	struct device *dev;
+	GSList *l;
+
+	for (l = ctx->devices; l; l = l->next) {
+		dev = l->data;
+		if (dev->sdi == sdi)
+			return dev;
+	}
+
+	if (!(dev = g_try_malloc0(sizeof(struct device)))) {
+		sr_err("%s: dev malloc failed", __func__);
+		return NULL;
+	}
+	dev->sdi = sdi;
+	ctx->devices = g_slist_prepend(ctx->devices, dev);
+
+	return dev;
+}
+
+/* Start counting over, for data of this unitsize. */
+static int device_reset(struct device *dev, uint16_t unitsize)
+{
+	unsigned int num_bits;
+
+	dev->have_prev = FALSE;
+	dev->count = dev->total_count = 0;
+	if (dev->unitsize == unitsize) {
+		memset(dev->counts, 0, 2 * unitsize * 8
+				* sizeof(struct counts));
+		return SR_OK;
+	}
+
+	g_free(dev->prev);
+	g_free(dev->counts);
+	g_free(dev->stats);
+	num_bits = unitsize * 8;
+	dev->prev = g_try_malloc0(unitsize);
+	dev->counts = g_try_malloc0(2 * num_bits * sizeof(struct counts));
+	dev->stats = g_try_malloc0(2 * num_bits
+			* sizeof(struct sr_logic_stats));
+	if (!dev->prev || !dev->counts || !dev->stats) {
+		sr_err("%s: counts malloc failed", __func__);
+		g_free(dev->prev);
+		g_free(dev->counts);
+		g_free(dev->stats);
+		dev->prev = NULL;
+		dev->counts = NULL;
+		dev->stats = NULL;
+		dev->unitsize = 0;
+		return SR_ERR_MALLOC;
+	}
+	dev->unitsize = unitsize;
+
+	return SR_OK;
+}
+
+/*
+ * Count num_samples samples of up to 64 bits, several to a 64-bit word,
+ * with a popcount per bit of the XOR with the previous samples.
+ */
+static void count_words(struct device *dev, const uint8_t *data,
+		uint64_t num_samples)
+{
+	struct counts *c;
+	uint64_t rep, w, t, r, p, m, words, i;
+	unsigned int lane, per_word, b, k;
+
+	lane = dev->unitsize * 8;
+	per_word = 64 / lane;
+	rep = 0;
+	for (k = 0; k < per_word; k++)
+		rep |= (uint64_t)1 << (k * lane);
+
+	p = 0;
+	memcpy(&p, dev->prev, dev->unitsize);
+	p = GUINT64_FROM_LE(p);
+	if (!dev->have_prev) {
+		/* No edge at the first sample. */
+		memcpy(&p, data, dev->unitsize);
+		p = GUINT64_FROM_LE(p);
+	}
+
+	c = dev->counts;
+	words = num_samples / per_word;
+	for (i = 0; i < words; i++) {
+		memcpy(&w, data + i * 8, 8);
+		w = GUINT64_FROM_LE(w);
+		if (lane == 64)
+			t = w ^ p;
+		else
+			t = w ^ ((w << lane) | p);
+		r = t & w;
+		p = lane == 64 ? w : w >> (64 - lane);
+		if (w == ~(uint64_t)0) {
+			for (b = 0; b < lane; b++)
+				c[b].high += per_word;
+		} else if (w) {
+			for (b = 0; b < lane; b++)
+				c[b].high += __builtin_popcountll(w
+						& (rep << b));
+		}
+		if (!t)
+			continue;
+		for (b = 0; b < lane; b++) {
+			m = rep << b;
+			c[b].edges += __builtin_popcountll(t & m);
+			c[b].rising += __builtin_popcountll(r & m);
+		}
+	}
+
+	p = GUINT64_TO_LE(p);
+	memcpy(dev->prev, &p, dev->unitsize);
+	dev->have_prev = TRUE;
+}
+
+/* Count num_samples samples which are all the same. */
+static void count_run(struct device *dev, const uint8_t *sample,
+		uint64_t num_samples)
+{
+	struct counts *c;
+	unsigned int i, b;
+	uint8_t x;
+
+	c = dev->counts;
+	for (i = 0; i < dev->unitsize; i++) {
+		x = dev->have_prev ? sample[i] ^ dev->prev[i] : 0;
+		for (b = 0; b < 8; b++) {
+			if (sample[i] & (1 << b))
+				c[i * 8 + b].high += num_samples;
+			if (x & (1 << b)) {
+				c[i * 8 + b].edges++;
+				if (sample[i] & (1 << b))
+					c[i * 8 + b].rising++;
+			}
+		}
+	}
+	memcpy(dev->prev, sample, dev->unitsize);
+	dev->have_prev = TRUE;
+}
+
+static void count_samples(struct device *dev, const uint8_t *data,
+		uint64_t num_samples)
+{
+	uint64_t words, i;
+
+	i = 0;
+	if (dev->unitsize <= 8 && 8 % dev->unitsize == 0) {
+		words = num_samples / (8 / dev->unitsize);
+		count_words(dev, data, num_samples);
+		i = words * (8 / dev->unitsize);
+	}
+	for (; i < num_samples; i++)
+		count_run(dev, data + i * dev->unitsize, 1);
+}
+
+static void stats_fill(struct sr_logic_stats *stats, const struct counts *c,
+		uint64_t count, uint64_t samplerate)
+{
+	stats->count = count;
+	stats->high = c->high;
+	stats->edges = c->edges;
+	stats->rising = c->rising;
+	stats->duty_cycle = count ? (double)c->high / count : 0;
+	stats->frequency = count && samplerate
+			? (double)c->rising * samplerate / count : 0;
+}
+
+/* Send the counts of the current window, and start the next one. */
+static int window_end(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		struct device *dev)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic_stats out;
+	struct counts *window, *total;
+	unsigned int num_bits, b;
+
+	num_bits = dev->unitsize * 8;
+	window = dev->counts;
+	total = dev->counts + num_bits;
+	dev->total_count += dev->count;
+	for (b = 0; b < num_bits; b++) {
+		total[b].high += window[b].high;
+		total[b].edges += window[b].edges;
+		total[b].rising += window[b].rising;
+		stats_fill(&dev->stats[b], &window[b], dev->count,
+				dev->params.samplerate);
+		stats_fill(&dev->stats[num_bits + b], &total[b],
+				dev->total_count, dev->params.samplerate);
+	}
+	memset(window, 0, num_bits * sizeof(struct counts));
+
+	out.unitsize = dev->unitsize;
+	out.start_sample = dev->start_sample;
+	out.timestamp = dev->timestamp;
+	out.window = dev->stats;
+	out.total = dev->stats + num_bits;
+	packet.type = SR_DF_LOGIC_STATS;
+	packet.payload = &out;
+	dev->count = 0;
+
+	return sr_transform_send(t, sdi, &packet);
+}
+
+static int count_logic(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		struct device *dev, const struct sr_datafeed_logic *logic)
+{
+	struct context *ctx;
+	const uint8_t *data;
+	uint64_t num_samples, pos, n;
+	int ret;
+
+	ctx = t->internal;
+	data = logic->data;
+	num_samples = logic->length / logic->unitsize;
+	pos = 0;
+	while (pos < num_samples) {
+		if (!dev->count)
+			dev->start_sample = logic->start_sample + pos;
+		n = MIN(num_samples - pos, ctx->window - dev->count);
+		count_samples(dev, data + pos * dev->unitsize, n);
+		dev->count += n;
+		dev->timestamp = logic->timestamp;
+		pos += n;
+		if (dev->count == ctx->window
+				&& (ret = window_end(t, sdi, dev)) != SR_OK)
+			return ret;
+	}
+
+	return SR_OK;
+}
+
+/* Runs are counted in one go, however long they are. */
+static int count_rle(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		struct device *dev, const struct sr_datafeed_logic_rle *rle)
+{
+	struct context *ctx;
+	const uint8_t *values;
+	uint64_t run, left, pos, n;
+	int ret;
+
+	ctx = t->internal;
+	values = rle->values;
+	pos = 0;
+	for (run = 0; run < rle->num_runs; run++) {
+		for (left = rle->counts[run]; left; left -= n) {
+			if (!dev->count)
+				dev->start_sample = rle->start_sample + pos;
+			n = MIN(left, ctx->window - dev->count);
+			count_run(dev, values + run * dev->unitsize, n);
+			dev->count += n;
+			dev->timestamp = rle->timestamp;
+			pos += n;
+			if (dev->count == ctx->window
+					&& (ret = window_end(t, sdi,
+					dev)) != SR_OK)
+				return ret;
+		}
+	}
+
+	return SR_OK;
+}
+
+static int receive(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct context *ctx;
+	struct device *dev;
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+	uint16_t unitsize;
+	int ret;
+
+	ctx = t->internal;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		/* Counting starts with the first data. */
+		if (dev->unitsize)
+			device_reset(dev, dev->unitsize);
+		sr_stream_params_update(&dev->params, sdi, packet);
+		break;
+	case SR_DF_META:
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		sr_stream_params_update(&dev->params, sdi, packet);
+		break;
+	case SR_DF_LOGIC:
+	case SR_DF_LOGIC_RLE:
+		if (!ctx->drop && (ret = sr_transform_send(t, sdi,
+				packet)) != SR_OK)
+			return ret;
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		logic = packet->payload;
+		rle = packet->payload;
+		unitsize = packet->type == SR_DF_LOGIC ? logic->unitsize
+				: rle->unitsize;
+		if (!unitsize)
+			return SR_OK;
+		if (unitsize != dev->unitsize) {
+			/* Other probes than before, so the counts are moot. */
+			if (dev->count && (ret = window_end(t, sdi,
+					dev)) != SR_OK)
+				return ret;
+			if ((ret = device_reset(dev, unitsize)) != SR_OK)
+				return ret;
+		}
+		if (packet->type == SR_DF_LOGIC)
+			return count_logic(t, sdi, dev, logic);
+		else
+			return count_rle(t, sdi, dev, rle);
+	case SR_DF_END:
+		/* The last part of a window. */
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		if (dev->count && (ret = window_end(t, sdi, dev)) != SR_OK)
+			return ret;
+		break;
+	}
+
+	return sr_transform_send(t, sdi, packet);
+}
+
+static int cleanup(struct sr_transform *t)
+{
+	struct context *ctx;
+
+	ctx = t->internal;
+	g_slist_free_full(ctx->devices, device_free);
+	g_free(ctx);
+	t->internal = NULL;
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_transform_format transform_logic_stats = {
+	.id = "logic-stats",
+	.description = "Edge counts, duty cycle and frequency of each "
+			"logic probe",
+	.init = init,
+	.receive = receive,
+	.cleanup = cleanup,
+};
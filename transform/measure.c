@@ -0,0 +1,535 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Keeps the minimum, maximum, mean, RMS value and frequency of each
+ * analog probe, and sends them in an SR_DF_ANALOG_STATS packet after
+ * every window of samples, and at the end of the acquisition for the
+ * last part of a window. Each packet has the statistics of the window
+ * and those since the start of the acquisition.
+ *
+ * Options: "window", the number of samples per window (default 1000),
+ * and "data", "keep" (the default) to pass the analog data on as well,
+ * or "drop" to send only the statistics.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "transform/measure: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+#define DEFAULT_WINDOW 1000
+
+/* Independent accumulators, so the compiler can keep them in SIMD lanes. */
+#define LANES 4
+
+/* The sums of one probe's values, over a window or the acquisition. */
+struct accum {
+	uint64_t count;
+	float min;
+	float max;
+	double sum;
+	double sumsq;
+	/* Rising crossings: how many, and the first and last one's sample. */
+	uint64_t crossings;
+	uint64_t first_crossing;
+	uint64_t last_crossing;
+};
+
+struct probe_state {
+	struct accum window;
+	struct accum total;
+	/* The previous window's range, whose middle crossings count at. */
+	gboolean have_range;
+	float range_min;
+	float range_max;
+	/* Below the middle less the hysteresis, since the last crossing. */
+	gboolean armed;
+};
+
+/* The data of one list of probes, as sent together by a device. */
+struct group {
+	GSList *probes;
+	unsigned int num_probes;
+	int mq;
+	int unit;
+	uint64_t mqflags;
+	/* Samples in the current window, and the number of its first. */
+	uint64_t count;
+	uint64_t start_sample;
+	int64_t timestamp;
+	struct probe_state *state;
+	/* The window's, then the total statistics of each probe. */
+	struct sr_analog_stats *stats;
+};
+
+struct device {
+	const struct sr_dev_inst *sdi;
+	struct sr_stream_params params;
+	GSList *groups;
+};
+
+struct context {
+	uint64_t window;
+	gboolean drop;
+	GSList *devices;
+	/* Where raw data gets converted. */
+	float *buf;
+	size_t buf_size;
+};
+
+static int init(struct sr_transform *t)
+{
+	struct context *ctx;
+	const char *param;
+	char *end;
+	uint64_t window;
+	gboolean drop;
+
+	window = DEFAULT_WINDOW;
+	param = t->param ? g_hash_table_lookup(t->param, "window") : NULL;
+	if (param) {
+		window = strtoull(param, &end, 10);
+		if (!*param || *end || !window) {
+			sr_err("Invalid window '%s'.", param);
+			return SR_ERR_ARG;
+		}
+	}
+
+	drop = FALSE;
+	param = t->param ? g_hash_table_lookup(t->param, "data") : NULL;
+	if (param) {
+		if (!strcmp(param, "drop")) {
+			drop = TRUE;
+		} else if (strcmp(param, "keep")) {
+			sr_err("Invalid data option '%s'.", param);
+			return SR_ERR_ARG;
+		}
+	}
+
+	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
+		sr_err("%s: ctx malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	ctx->window = window;
+	ctx->drop = drop;
+	t->internal = ctx;
+
+	return SR_OK;
+}
+
+static void group_free(gpointer data)
+{
+	struct group *g;
+
+	g = data;
+	g_slist_free(g->probes);
+	g_free(g->state);
+	g_free(g->stats);
+	g_free(g);
+}
+
+static void device_free(gpointer data)
+{
+	struct device *dev;
+
+	dev = data;
+	g_slist_free_full(dev->groups, group_free);
+	g_free(dev);
+}
+
+static struct device *device_get(struct context *ctx,
+		const struct sr_dev_inst *sdi)
+{
+	struct device *dev;
+	GSList *l;
+
+	for (l = ctx->devices; l; l = l->next) {
+		dev = l->data;
+		if (dev->sdi == sdi)
+			return dev;
+	}
+
+	if (!(dev = g_try_malloc0(sizeof(struct device)))) {
+		sr_err("%s: dev malloc failed", __func__);
+		return NULL;
+	}
+	dev->sdi = sdi;
+	ctx->devices = g_slist_prepend(ctx->devices, dev);
+
+	return dev;
+}
+
+static gboolean probes_equal(GSList *a, GSList *b)
+{
+	for (; a && b; a = a->next, b = b->next) {
+		if (a->data != b->data)
+			return FALSE;
+	}
+
+	return !a && !b;
+}
+
+static struct group *group_get(struct device *dev, GSList *probes,
+		int mq, int unit, uint64_t mqflags)
+{
+	struct group *g;
+	GSList *l;
+
+	for (l = dev->groups; l; l = l->next) {
+		g = l->data;
+		if (probes_equal(g->probes, probes))
+			return g;
+	}
+
+	if (!(g = g_try_malloc0(sizeof(struct group)))) {
+		sr_err("%s: group malloc failed", __func__);
+		return NULL;
+	}
+	g->num_probes = g_slist_length(probes);
+	g->state = g_try_malloc0(g->num_probes * sizeof(struct probe_state));
+	g->stats = g_try_malloc0(2 * g->num_probes
+			* sizeof(struct sr_analog_stats));
+	if (!g->state || !g->stats) {
+		sr_err("%s: state malloc failed", __func__);
+		g_free(g->state);
+		g_free(g->stats);
+		g_free(g);
+		return NULL;
+	}
+	g->probes = g_slist_copy(probes);
+	g->mq = mq;
+	g->unit = unit;
+	g->mqflags = mqflags;
+	dev->groups = g_slist_prepend(dev->groups, g);
+
+	return g;
+}
+
+/* Add num_samples values, stride floats apart, to the sums. */
+static void accum_add(struct accum *a, const float *data,
+		uint64_t num_samples, unsigned int stride)
+{
+	float min[LANES], max[LANES], v;
+	double sum[LANES], sumsq[LANES];
+	uint64_t i;
+	int j;
+
+	if (!num_samples)
+		return;
+
+	if (!a->count)
+		a->min = a->max = data[0];
+	for (j = 0; j < LANES; j++) {
+		min[j] = a->min;
+		max[j] = a->max;
+		sum[j] = sumsq[j] = 0;
+	}
+
+	for (i = 0; i + LANES <= num_samples; i += LANES) {
+		for (j = 0; j < LANES; j++) {
+			v = data[(i + j) * stride];
+			min[j] = v < min[j] ? v : min[j];
+			max[j] = v > max[j] ? v : max[j];
+			sum[j] += v;
+			sumsq[j] += (double)v * v;
+		}
+	}
+	for (; i < num_samples; i++) {
+		v = data[i * stride];
+		min[0] = MIN(min[0], v);
+		max[0] = MAX(max[0], v);
+		sum[0] += v;
+		sumsq[0] += (double)v * v;
+	}
+
+	for (j = 0; j < LANES; j++) {
+		a->min = MIN(a->min, min[j]);
+		a->max = MAX(a->max, max[j]);
+		a->sum += sum[j];
+		a->sumsq += sumsq[j];
+	}
+	a->count += num_samples;
+}
+
+/*
+ * Count the values' rising crossings of the middle of the previous
+ * window's range, or else of the current window's so far. Rising again
+ * only counts after falling below it by a tenth of the range.
+ */
+static void crossings_add(struct probe_state *ps, const float *data,
+		uint64_t num_samples, unsigned int stride,
+		uint64_t start_sample)
+{
+	struct accum *a;
+	float min, max, mid, low;
+	uint64_t i;
+
+	min = ps->have_range ? ps->range_min : ps->window.min;
+	max = ps->have_range ? ps->range_max : ps->window.max;
+	if (!(max > min))
+		return;
+	mid = min + (max - min) / 2;
+	low = mid - (max - min) / 10;
+
+	a = &ps->window;
+	for (i = 0; i < num_samples; i++) {
+		if (!ps->armed) {
+			ps->armed = data[i * stride] < low;
+		} else if (data[i * stride] >= mid) {
+			ps->armed = FALSE;
+			if (!a->crossings++)
+				a->first_crossing = start_sample + i;
+			a->last_crossing = start_sample + i;
+		}
+	}
+}
+
+static void accum_merge(struct accum *to, const struct accum *from)
+{
+	if (!from->count)
+		return;
+
+	if (!to->count) {
+		to->min = from->min;
+		to->max = from->max;
+	}
+	to->count += from->count;
+	to->min = MIN(to->min, from->min);
+	to->max = MAX(to->max, from->max);
+	to->sum += from->sum;
+	to->sumsq += from->sumsq;
+	if (from->crossings) {
+		if (!to->crossings)
+			to->first_crossing = from->first_crossing;
+		to->last_crossing = from->last_crossing;
+		to->crossings += from->crossings;
+	}
+}
+
+static void stats_fill(struct sr_analog_stats *stats, const struct accum *a,
+		uint64_t samplerate)
+{
+	stats->count = a->count;
+	stats->min = a->min;
+	stats->max = a->max;
+	stats->mean = a->count ? a->sum / a->count : 0;
+	stats->rms = a->count ? sqrt(a->sumsq / a->count) : 0;
+	stats->frequency = 0;
+	if (samplerate && a->crossings > 1)
+		stats->frequency = (double)(a->crossings - 1) * samplerate
+				/ (a->last_crossing - a->first_crossing);
+}
+
+/* Send the statistics of the current window, and start the next one. */
+static int window_end(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		struct device *dev, struct group *g)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_analog_stats out;
+	struct probe_state *ps;
+	unsigned int i;
+
+	for (i = 0; i < g->num_probes; i++) {
+		ps = &g->state[i];
+		accum_merge(&ps->total, &ps->window);
+		stats_fill(&g->stats[i], &ps->window, dev->params.samplerate);
+		stats_fill(&g->stats[g->num_probes + i], &ps->total,
+				dev->params.samplerate);
+		ps->have_range = TRUE;
+		ps->range_min = ps->window.min;
+		ps->range_max = ps->window.max;
+		memset(&ps->window, 0, sizeof(struct accum));
+	}
+
+	out.probes = g->probes;
+	out.mq = g->mq;
+	out.unit = g->unit;
+	out.mqflags = g->mqflags;
+	out.start_sample = g->start_sample;
+	out.timestamp = g->timestamp;
+	out.window = g->stats;
+	out.total = g->stats + g->num_probes;
+	packet.type = SR_DF_ANALOG_STATS;
+	packet.payload = &out;
+	g->count = 0;
+
+	return sr_transform_send(t, sdi, &packet);
+}
+
+static int measure(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_analog *analog)
+{
+	struct context *ctx;
+	struct device *dev;
+	struct group *g;
+	const float *data;
+	uint64_t num_samples, pos, n;
+	unsigned int i;
+	int ret;
+
+	ctx = t->internal;
+	if (!(dev = device_get(ctx, sdi)))
+		return SR_ERR_MALLOC;
+	if (!(g = group_get(dev, analog->probes, analog->mq, analog->unit,
+			analog->mqflags)))
+		return SR_ERR_MALLOC;
+
+	num_samples = analog->num_samples;
+	pos = 0;
+	while (pos < num_samples) {
+		if (!g->count)
+			g->start_sample = analog->start_sample + pos;
+		n = MIN(num_samples - pos, ctx->window - g->count);
+		data = analog->data + pos * g->num_probes;
+		for (i = 0; i < g->num_probes; i++) {
+			accum_add(&g->state[i].window, data + i, n,
+					g->num_probes);
+			crossings_add(&g->state[i], data + i, n,
+					g->num_probes,
+					analog->start_sample + pos);
+		}
+		g->count += n;
+		g->timestamp = analog->timestamp;
+		pos += n;
+		if (g->count == ctx->window) {
+			if ((ret = window_end(t, sdi, dev, g)) != SR_OK)
+				return ret;
+		}
+	}
+
+	return SR_OK;
+}
+
+static int measure_raw(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_analog_raw *raw)
+{
+	struct context *ctx;
+	struct sr_datafeed_analog analog;
+	size_t size;
+	float *buf;
+	int ret;
+
+	ctx = t->internal;
+	size = (size_t)raw->num_samples * g_slist_length(raw->probes)
+			* sizeof(float);
+	if (size > ctx->buf_size) {
+		if (!(buf = g_try_realloc(ctx->buf, size))) {
+			sr_err("%s: buf malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		ctx->buf = buf;
+		ctx->buf_size = size;
+	}
+	if ((ret = sr_analog_raw_to_float(raw, ctx->buf)) != SR_OK)
+		return ret;
+
+	analog.probes = raw->probes;
+	analog.num_samples = raw->num_samples;
+	analog.mq = raw->mq;
+	analog.unit = raw->unit;
+	analog.mqflags = raw->mqflags;
+	analog.data = ctx->buf;
+	analog.start_sample = raw->start_sample;
+	analog.timestamp = raw->timestamp;
+	analog.timestamps = NULL;
+
+	return measure(t, sdi, &analog);
+}
+
+static int receive(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct context *ctx;
+	struct device *dev;
+	struct group *g;
+	GSList *l;
+	int ret;
+
+	ctx = t->internal;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		/* Start over, with the device's probes as they are now. */
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		g_slist_free_full(dev->groups, group_free);
+		dev->groups = NULL;
+		sr_stream_params_update(&dev->params, sdi, packet);
+		break;
+	case SR_DF_META:
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		sr_stream_params_update(&dev->params, sdi, packet);
+		break;
+	case SR_DF_ANALOG:
+	case SR_DF_ANALOG_RAW:
+		if (!ctx->drop && (ret = sr_transform_send(t, sdi,
+				packet)) != SR_OK)
+			return ret;
+		if (packet->type == SR_DF_ANALOG)
+			return measure(t, sdi, packet->payload);
+		else
+			return measure_raw(t, sdi, packet->payload);
+	case SR_DF_END:
+		/* The last part of a window. */
+		if (!(dev = device_get(ctx, sdi)))
+			return SR_ERR_MALLOC;
+		for (l = dev->groups; l; l = l->next) {
+			g = l->data;
+			if (g->count && (ret = window_end(t, sdi, dev,
+					g)) != SR_OK)
+				return ret;
+		}
+		break;
+	}
+
+	return sr_transform_send(t, sdi, packet);
+}
+
+static int cleanup(struct sr_transform *t)
+{
+	struct context *ctx;
+
+	ctx = t->internal;
+	g_slist_free_full(ctx->devices, device_free);
+	g_free(ctx->buf);
+	g_free(ctx);
+	t->internal = NULL;
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_transform_format transform_measure = {
+	.id = "measure",
+	.description = "Minimum, maximum, mean, RMS and frequency of "
+			"analog data",
+	.init = init,
+	.receive = receive,
+	.cleanup = cleanup,
+};
@@ -0,0 +1,357 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Passes on the packets of all the devices in the session in the order
+ * of the time their data starts at, instead of the order they arrive in.
+ * A packet's time is its start sample divided by the device's samplerate,
+ * or, without a samplerate, the time it was sent since the device's
+ * header. Other packets keep their place after the device's data sent
+ * before them.
+ *
+ * A packet is held back until each of the other devices has sent data up
+ * to its time, or has ended. Option "depth" (default 256) is the most
+ * packets held back in all; beyond that, the earliest one goes on anyway,
+ * so a device which sends rarely doesn't stall the others for long.
+ */
+
+#include <stdlib.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "transform/merge: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+#define DEFAULT_DEPTH 256
+
+struct entry {
+	struct sr_datafeed_packet *packet;
+	/* In seconds since the start of the acquisition. */
+	double time;
+};
+
+struct device {
+	const struct sr_dev_inst *sdi;
+	struct sr_stream_params params;
+	/* When the header came, for devices without a samplerate. */
+	int64_t start_time;
+	gboolean started;
+	gboolean ended;
+	/* Where the data received so far ends, in seconds. */
+	double end;
+	/* The packets held back, struct entry each. */
+	GQueue queue;
+};
+
+struct context {
+	unsigned int depth;
+	unsigned int num_queued;
+	GSList *devices;
+};
+
+static int init(struct sr_transform *t)
+{
+	struct context *ctx;
+	const char *param;
+	char *end;
+	unsigned long depth;
+
+	depth = DEFAULT_DEPTH;
+	param = t->param ? g_hash_table_lookup(t->param, "depth") : NULL;
+	if (param) {
+		depth = strtoul(param, &end, 10);
+		if (!*param || *end || !depth || depth > G_MAXUINT) {
+			sr_err("Invalid depth '%s'.", param);
+			return SR_ERR_ARG;
+		}
+	}
+
+	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
+		sr_err("%s: ctx malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	ctx->depth = depth;
+	t->internal = ctx;
+
+	return SR_OK;
+}
+
+static void entry_free(gpointer data)
+{
+	struct entry *e;
+
+	e = data;
+	sr_packet_free(e->packet);
+	g_free(e);
+}
+
+static void device_free(gpointer data)
+{
+	struct device *dev;
+	struct entry *e;
+
+	dev = data;
+	while ((e = g_queue_pop_head(&dev->queue)))
+		entry_free(e);
+	g_free(dev);
+}
+
+static struct device *device_add(struct context *ctx,
+		const struct sr_dev_inst *sdi)
+{
+	struct device *dev;
+
+	if (!(dev = g_try_malloc0(sizeof(struct device)))) {
+		sr_err("%s: dev malloc failed", __func__);
+		return NULL;
+	}
+	dev->sdi = sdi;
+	g_queue_init(&dev->queue);
+	ctx->devices = g_slist_append(ctx->devices, dev);
+
+	return dev;
+}
+
+/*
+ * At the start of an acquisition, wait for all the devices in the
+ * session, not just the ones which sent something yet.
+ */
+static int devices_add(struct sr_transform *t)
+{
+	struct context *ctx;
+	GSList *l;
+
+	ctx = t->internal;
+	for (l = t->session->devs; l; l = l->next) {
+		if (!device_add(ctx, l->data))
+			return SR_ERR_MALLOC;
+	}
+
+	return SR_OK;
+}
+
+static struct device *device_get(struct context *ctx,
+		const struct sr_dev_inst *sdi)
+{
+	struct device *dev;
+	GSList *l;
+
+	for (l = ctx->devices; l; l = l->next) {
+		dev = l->data;
+		if (dev->sdi == sdi)
+			return dev;
+	}
+
+	return device_add(ctx, sdi);
+}
+
+static double sample_time(struct device *dev, uint64_t sample,
+		int64_t timestamp)
+{
+	if (dev->params.samplerate)
+		return (double)sample / dev->params.samplerate;
+	else
+		return (timestamp - dev->start_time) / 1000000.0;
+}
+
+/* The time of a packet, which also moves on where the device's data ends. */
+static double packet_time(struct device *dev,
+		const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+	const struct sr_datafeed_analog *analog;
+	const struct sr_datafeed_analog_raw *raw;
+	double start, end;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		dev->started = TRUE;
+		dev->start_time = g_get_monotonic_time();
+		dev->end = 0;
+		sr_stream_params_update(&dev->params, dev->sdi, packet);
+		return 0;
+	case SR_DF_META:
+		sr_stream_params_update(&dev->params, dev->sdi, packet);
+		return dev->end;
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		start = sample_time(dev, logic->start_sample,
+				logic->timestamp);
+		end = sample_time(dev, logic->start_sample
+				+ (logic->unitsize ? logic->length
+				/ logic->unitsize : 0), logic->timestamp);
+		break;
+	case SR_DF_LOGIC_RLE:
+		rle = packet->payload;
+		start = sample_time(dev, rle->start_sample, rle->timestamp);
+		end = sample_time(dev, rle->start_sample + rle->num_samples,
+				rle->timestamp);
+		break;
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		start = sample_time(dev, analog->start_sample,
+				analog->timestamp);
+		end = sample_time(dev, analog->start_sample
+				+ analog->num_samples, analog->timestamp);
+		break;
+	case SR_DF_ANALOG_RAW:
+		raw = packet->payload;
+		start = sample_time(dev, raw->start_sample, raw->timestamp);
+		end = sample_time(dev, raw->start_sample + raw->num_samples,
+				raw->timestamp);
+		break;
+	default:
+		return dev->end;
+	}
+
+	/* Not before anything the device sent earlier. */
+	start = MAX(start, dev->end);
+	dev->end = MAX(end, start);
+
+	return start;
+}
+
+/* Whether the device might still send something from before this time. */
+static gboolean device_behind(struct device *dev, double time)
+{
+	if (dev->ended || !g_queue_is_empty(&dev->queue))
+		return FALSE;
+
+	return !dev->started || dev->end < time;
+}
+
+/* Pass on the held back packets which are due. */
+static int release(struct sr_transform *t)
+{
+	struct context *ctx;
+	struct device *dev, *next;
+	struct entry *e, *head;
+	GSList *l;
+	gboolean wait, done;
+	int ret;
+
+	ctx = t->internal;
+	for (;;) {
+		next = NULL;
+		head = NULL;
+		for (l = ctx->devices; l; l = l->next) {
+			dev = l->data;
+			e = g_queue_peek_head(&dev->queue);
+			if (e && (!head || e->time < head->time)) {
+				next = dev;
+				head = e;
+			}
+		}
+		if (!next)
+			break;
+
+		wait = FALSE;
+		if (ctx->num_queued <= ctx->depth) {
+			for (l = ctx->devices; l && !wait; l = l->next)
+				wait = l->data != next
+					&& device_behind(l->data, head->time);
+		}
+		if (wait)
+			break;
+
+		g_queue_pop_head(&next->queue);
+		ctx->num_queued--;
+		if (head->packet->type == SR_DF_HEADER)
+			next->ended = FALSE;
+		else if (head->packet->type == SR_DF_END)
+			next->ended = TRUE;
+		ret = sr_transform_send(t, next->sdi, head->packet);
+		entry_free(head);
+		if (ret != SR_OK)
+			return ret;
+	}
+
+	/* Once every device which started has ended, the run is over. */
+	done = TRUE;
+	for (l = ctx->devices; l && done; l = l->next) {
+		dev = l->data;
+		done = !dev->started || dev->ended;
+	}
+	if (done && !ctx->num_queued) {
+		g_slist_free_full(ctx->devices, device_free);
+		ctx->devices = NULL;
+	}
+
+	return SR_OK;
+}
+
+static int receive(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct context *ctx;
+	struct device *dev;
+	struct entry *e;
+	int ret;
+
+	ctx = t->internal;
+
+	/* There is nothing to merge. */
+	if (!ctx->devices && g_slist_length(t->session->devs) < 2)
+		return sr_transform_send(t, sdi, packet);
+
+	if (!ctx->devices && (ret = devices_add(t)) != SR_OK)
+		return ret;
+	if (!(dev = device_get(ctx, sdi)))
+		return SR_ERR_MALLOC;
+
+	if (!(e = g_try_malloc(sizeof(struct entry)))) {
+		sr_err("%s: entry malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if (!(e->packet = sr_packet_copy(packet))) {
+		g_free(e);
+		return SR_ERR_MALLOC;
+	}
+	e->time = packet_time(dev, packet);
+	g_queue_push_tail(&dev->queue, e);
+	ctx->num_queued++;
+
+	return release(t);
+}
+
+static int cleanup(struct sr_transform *t)
+{
+	struct context *ctx;
+
+	ctx = t->internal;
+	g_slist_free_full(ctx->devices, device_free);
+	g_free(ctx);
+	t->internal = NULL;
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_transform_format transform_merge = {
+	.id = "merge",
+	.description = "Pass on the data of all devices in time order",
+	.init = init,
+	.receive = receive,
+	.cleanup = cleanup,
+};
@@ -0,0 +1,237 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Keeps only the given logic probes in the datafeed, packed into the
+ * lowest bits of each sample in the order they are listed. Takes one
+ * option, "probes", a comma-separated list of probe names.
+ *
+ * Data a driver already packed (see SR_CONF_PROBE_PACKING) is filtered
+ * by where the probes are in it, and passed on as it is if it holds
+ * just the probes asked for, in that order.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "transform/probes: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_log_lazy(SPEW, sr_spew, LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_log_lazy(DBG, sr_dbg, LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_log_lazy(INFO, sr_info, LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_log_lazy(WARN, sr_warn, LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_log_lazy(ERR, sr_err, LOG_PREFIX s, ## args)
+
+struct context {
+	char **names;
+	/* The device the probe indices below were looked up for. */
+	const struct sr_dev_inst *sdi;
+	gboolean valid;
+	/* Has the SR_CONF_PACKED_PROBES of the device's data, or 0. */
+	struct sr_stream_params params;
+	/* Whether the packed data is already what's asked for. */
+	gboolean as_is;
+	GArray *probe_array;
+	uint16_t unitsize;
+	uint8_t *buf;
+	uint64_t buf_size;
+};
+
+static int init(struct sr_transform *t)
+{
+	struct context *ctx;
+	const char *param;
+
+	param = t->param ? g_hash_table_lookup(t->param, "probes") : NULL;
+	if (!param || !*param) {
+		sr_err("No probes given.");
+		return SR_ERR_ARG;
+	}
+
+	if (!(ctx = g_try_malloc0(sizeof(struct context)))) {
+		sr_err("%s: ctx malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	ctx->names = g_strsplit(param, ",", 0);
+	ctx->probe_array = g_array_new(FALSE, FALSE, sizeof(int));
+	ctx->unitsize = (g_strv_length(ctx->names) + 7) / 8;
+	t->internal = ctx;
+
+	return SR_OK;
+}
+
+/* Look up the probe indices, once for every device sending data. */
+static void probes_resolve(struct context *ctx, const struct sr_dev_inst *sdi)
+{
+	struct sr_probe *probe;
+	GSList *l;
+	uint64_t packed, bit;
+	int i, index;
+
+	if (ctx->sdi == sdi)
+		return;
+
+	packed = ctx->params.packed_probes;
+	ctx->sdi = sdi;
+	ctx->valid = TRUE;
+	ctx->as_is = packed != 0;
+	g_array_set_size(ctx->probe_array, 0);
+	for (i = 0; ctx->names[i]; i++) {
+		for (l = sdi ? sdi->probes : NULL; l; l = l->next) {
+			probe = l->data;
+			if (probe->type == SR_PROBE_LOGIC
+			    && !strcmp(probe->name, ctx->names[i]))
+				break;
+		}
+		if (!l) {
+			sr_warn("No logic probe '%s', passing the device's "
+				"data on unfiltered.", ctx->names[i]);
+			ctx->valid = FALSE;
+			return;
+		}
+		index = probe->index;
+		if (packed) {
+			bit = index < 64 ? (uint64_t)1 << index : 0;
+			if (!(packed & bit)) {
+				sr_warn("Probe '%s' isn't in the packed data, "
+					"passing it on unfiltered.",
+					ctx->names[i]);
+				ctx->valid = FALSE;
+				return;
+			}
+			index = __builtin_popcountll(packed & (bit - 1));
+			if (index != i)
+				ctx->as_is = FALSE;
+		}
+		g_array_append_val(ctx->probe_array, index);
+	}
+	if (i != __builtin_popcountll(packed))
+		ctx->as_is = FALSE;
+}
+
+static int filter(struct context *ctx, unsigned int in_unitsize,
+		const void *data_in, uint64_t length_in, uint64_t *length_out)
+{
+	uint8_t *buf;
+	uint64_t size;
+
+	*length_out = 0;
+	if (!length_in)
+		return SR_OK;
+
+	size = (length_in / in_unitsize) * ctx->unitsize;
+	if (size > ctx->buf_size) {
+		if (!(buf = g_try_realloc(ctx->buf, size))) {
+			sr_err("%s: buf malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		ctx->buf = buf;
+		ctx->buf_size = size;
+	}
+
+	return sr_filter_probes_buf(in_unitsize, ctx->unitsize,
+			ctx->probe_array, data_in, length_in, ctx->buf,
+			length_out);
+}
+
+static int receive(struct sr_transform *t, const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet)
+{
+	struct context *ctx;
+	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_logic_rle *rle;
+	struct sr_datafeed_logic logic_out;
+	struct sr_datafeed_logic_rle rle_out;
+	struct sr_datafeed_packet out;
+	uint64_t length;
+	int ret;
+
+	ctx = t->internal;
+
+	/*
+	 * The device's probes may have changed since the last run, and
+	 * a META packet may say the data is packed from now on.
+	 */
+	if (packet->type == SR_DF_HEADER || packet->type == SR_DF_META) {
+		sr_stream_params_update(&ctx->params, sdi, packet);
+		ctx->sdi = NULL;
+	}
+
+	if (packet->type != SR_DF_LOGIC && packet->type != SR_DF_LOGIC_RLE)
+		return sr_transform_send(t, sdi, packet);
+
+	probes_resolve(ctx, sdi);
+	if (!ctx->valid)
+		return sr_transform_send(t, sdi, packet);
+
+	/* The driver did the filtering already. */
+	logic = packet->payload;
+	rle = packet->payload;
+	if (ctx->as_is && ctx->unitsize == (packet->type == SR_DF_LOGIC
+			? logic->unitsize : rle->unitsize))
+		return sr_transform_send(t, sdi, packet);
+
+	out.type = packet->type;
+	if (packet->type == SR_DF_LOGIC) {
+		if ((ret = filter(ctx, logic->unitsize, logic->data,
+				logic->length, &length)) != SR_OK)
+			return ret;
+		logic_out.length = length;
+		logic_out.unitsize = ctx->unitsize;
+		logic_out.data = ctx->buf;
+		logic_out.start_sample = logic->start_sample;
+		logic_out.timestamp = logic->timestamp;
+		out.payload = &logic_out;
+	} else {
+		if ((ret = filter(ctx, rle->unitsize, rle->values,
+				rle->num_runs * rle->unitsize,
+				&length)) != SR_OK)
+			return ret;
+		rle_out = *rle;
+		rle_out.unitsize = ctx->unitsize;
+		rle_out.values = ctx->buf;
+		out.payload = &rle_out;
+	}
+
+	return sr_transform_send(t, sdi, &out);
+}
+
+static int cleanup(struct sr_transform *t)
+{
+	struct context *ctx;
+
+	ctx = t->internal;
+	g_strfreev(ctx->names);
+	g_array_free(ctx->probe_array, TRUE);
+	g_free(ctx->buf);
+	g_free(ctx);
+	t->internal = NULL;
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_transform_format transform_probes = {
+	.id = "probes",
+	.description = "Keep only the given logic probes",
+	.init = init,
+	.receive = receive,
+	.cleanup = cleanup,
+};
@@ -0,0 +1,72 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+
+/**
+ * @file
+ *
+ * Datafeed transform handling.
+ */
+
+/**
+ * @defgroup grp_transform Transforms
+ *
+ * Datafeed transform handling.
+ *
+ * Transforms sit on the datafeed between the drivers and the datafeed
+ * callbacks, and may change, drop or add packets on the way. They are
+ * chained in the order they were added with sr_session_transform_add(),
+ * and run once per packet on the session thread, no matter how many
+ * callbacks there are.
+ *
+ * @{
+ */
+
+/** @cond PRIVATE */
+extern SR_PRIV struct sr_transform_format transform_probes;
+extern SR_PRIV struct sr_transform_format transform_measure;
+extern SR_PRIV struct sr_transform_format transform_logic_stats;
+extern SR_PRIV struct sr_transform_format transform_merge;
+extern SR_PRIV struct sr_transform_format transform_deglitch;
+extern SR_PRIV struct sr_transform_format transform_decimate;
+/* @endcond */
+
+static struct sr_transform_format *transform_module_list[] = {
+	&transform_probes,
+	&transform_measure,
+	&transform_logic_stats,
+	&transform_merge,
+	&transform_deglitch,
+	&transform_decimate,
+	NULL,
+};
+
+/**
+ * Get the list of available transform modules.
+ *
+ * @return A NULL-terminated array of transform modules.
+ *
+ * @since 0.3.0
+ */
+SR_API struct sr_transform_format **sr_transform_list(void)
+{
+	return transform_module_list;
+}
+
+/** @} */